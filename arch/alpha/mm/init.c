@@ -255,7 +255,7 @@ callback_init(void * kernel_end)
 		console_remap_vm.flags = VM_ALLOC;
 		console_remap_vm.addr = (void *) VMALLOC_START;
 		console_remap_vm.size = vaddr - VMALLOC_START;
-		vmlist = &console_remap_vm;
+		vm_area_add_early(&console_remap_vm);
 	}
 
 	callback_init_done = 1;
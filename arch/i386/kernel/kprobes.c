@@ -30,6 +30,15 @@
 #include <linux/ptrace.h>
 #include <linux/spinlock.h>
 #include <linux/preempt.h>
+#ifdef CONFIG_OPTPROBES
+#include <linux/kallsyms.h>
+#include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/stop_machine.h>
+#include <linux/vmalloc.h>
+#include <asm/cacheflush.h>
+#endif
 #include <asm/kdebug.h>
 #include <asm/desc.h>
 
@@ -62,6 +71,9 @@ static inline int is_IF_modifier(kprobe_opcode_t opcode)
 
 int arch_prepare_kprobe(struct kprobe *p)
 {
+#ifdef CONFIG_OPTPROBES
+	p->ainsn.detour = NULL;
+#endif
 	return 0;
 }
 
@@ -374,3 +386,505 @@ int longjmp_break_handler(struct kprobe *p, struct pt_regs *regs)
 	}
 	return 0;
 }
+
+#ifdef CONFIG_OPTPROBES
+/*
+ * Optimized probes.  The breakpoint at the probe address and the
+ * instructions after it, RELATIVEJUMP_SIZE bytes at least, are replaced
+ * by a jump to a detour: it saves the registers as a struct pt_regs,
+ * calls the pre_handler, restores them, runs copies of the replaced
+ * instructions and jumps back behind them.  One trap and no single-step
+ * are left of the two traps a probe hit costs otherwise.
+ *
+ * It is only safe when nothing can jump or return into the middle of
+ * the jump: the replaced instructions must not branch, call or fault
+ * to a fixup, and no branch of the function may target them, which is
+ * checked by decoding the whole function.  Anything the decoder doesn't
+ * know keeps the probe on its breakpoint.  The jump is written and
+ * removed under stop_machine_run(), and the detour is only freed after
+ * synchronize_kernel(), which is enough without kernel preemption.
+ */
+
+/* What decode_insn() found */
+#define INSN_COPY	0	/* can run anywhere */
+#define INSN_REL	1	/* relative jump or call, see target */
+#define INSN_NOCOPY	2	/* ret, indirect call, ...: not in the jump */
+#define INSN_INDIRECT	3	/* indirect jump: might land anywhere */
+
+/* ModRM, SIB and displacement bytes, 32-bit addressing */
+static int modrm_len(const kprobe_opcode_t *p)
+{
+	int mod = p[0] >> 6, rm = p[0] & 7, len = 1;
+
+	if (mod == 3)
+		return 1;
+	if (rm == 4) {
+		len++;
+		if (mod == 0 && (p[1] & 7) == 5)
+			len += 4;
+	} else if (mod == 0 && rm == 5)
+		len += 4;
+	if (mod == 1)
+		len += 1;
+	else if (mod == 2)
+		len += 4;
+	return len;
+}
+
+/*
+ * Length of the instruction at insn, a copy of the code at addr, or 0 if
+ * it isn't one the kernel is compiled to.  This is deliberately not a
+ * full decoder: whatever is missing just isn't optimized.
+ */
+static int decode_insn(const kprobe_opcode_t *insn, unsigned long addr,
+		       int *kind, unsigned long *target)
+{
+	const kprobe_opcode_t *p = insn;
+	int opsize = 4, rel = 0, len;
+	kprobe_opcode_t op;
+
+	*kind = INSN_COPY;
+	for (;; p++) {
+		switch (*p) {
+		case 0x26: case 0x2e: case 0x36: case 0x3e:
+		case 0x64: case 0x65: case 0xf0: case 0xf2: case 0xf3:
+			continue;
+		case 0x66:
+			opsize = 2;
+			continue;
+		}
+		break;
+	}
+	if (p - insn > 4)
+		return 0;
+
+	op = *p++;
+	if (op < 0x40 && (op & 7) < 6) {
+		/* add, or, adc, sbb, and, sub, xor, cmp */
+		if ((op & 7) < 4)
+			p += modrm_len(p);
+		else
+			p += (op & 7) == 4 ? 1 : opsize;
+		goto out;
+	}
+
+	switch (op) {
+	case 0x06: case 0x07: case 0x0e: case 0x16: case 0x17:
+	case 0x1e: case 0x1f: case 0x27: case 0x2f: case 0x37: case 0x3f:
+	case 0x40 ... 0x61: case 0x6c ... 0x6f:
+	case 0x90 ... 0x99: case 0x9b ... 0x9f:
+	case 0xa4 ... 0xa7: case 0xaa ... 0xaf:
+	case 0xc9: case 0xd7: case 0xec ... 0xef:
+	case 0xf5: case 0xf8 ... 0xfd:
+		break;
+	case 0x6a: case 0xa8: case 0xb0 ... 0xb7:
+	case 0xd4: case 0xd5: case 0xe4 ... 0xe7:
+		p += 1;
+		break;
+	case 0x68: case 0xa9: case 0xb8 ... 0xbf:
+		p += opsize;
+		break;
+	case 0xa0 ... 0xa3:
+		p += 4;
+		break;
+	case 0xc8:
+		p += 3;
+		break;
+	case 0x84 ... 0x8f: case 0xc4: case 0xc5:
+	case 0xd0 ... 0xd3: case 0xd8 ... 0xdf:
+		p += modrm_len(p);
+		break;
+	case 0x6b: case 0x80: case 0x83: case 0xc0: case 0xc1: case 0xc6:
+		p += modrm_len(p) + 1;
+		break;
+	case 0x69: case 0x81: case 0xc7:
+		p += modrm_len(p) + opsize;
+		break;
+	case 0xf6: case 0xf7:
+		/* only test has an immediate */
+		len = ((*p >> 3) & 7) < 2 ? (op == 0xf6 ? 1 : opsize) : 0;
+		p += modrm_len(p) + len;
+		break;
+	case 0xfe:
+		if (((*p >> 3) & 7) > 1)
+			return 0;
+		p += modrm_len(p);
+		break;
+	case 0xff:
+		switch ((*p >> 3) & 7) {
+		case 0: case 1: case 6:		/* inc, dec, push */
+			break;
+		case 2:				/* call */
+			*kind = INSN_NOCOPY;
+			break;
+		case 4:				/* jmp */
+			*kind = INSN_INDIRECT;
+			break;
+		default:
+			return 0;
+		}
+		p += modrm_len(p);
+		break;
+	case 0x70 ... 0x7f: case 0xe0 ... 0xe3: case 0xeb:
+		rel = 1;
+		break;
+	case 0xe8: case 0xe9:
+		if (opsize != 4)
+			return 0;
+		rel = 4;
+		break;
+	case 0xc2:
+		p += 2;
+		/* fall through */
+	case 0xc3: case 0xf4:
+		*kind = INSN_NOCOPY;
+		break;
+	case 0x0f:
+		op = *p++;
+		switch (op) {
+		case 0x06: case 0x08: case 0x09: case 0x30 ... 0x33:
+		case 0x77: case 0xa0 ... 0xa2: case 0xa8: case 0xa9:
+		case 0xc8 ... 0xcf:
+			break;
+		case 0x00: case 0x01: case 0x10 ... 0x23: case 0x28 ... 0x2f:
+		case 0x40 ... 0x4f: case 0x51 ... 0x6f: case 0x74 ... 0x76:
+		case 0x7e: case 0x7f: case 0x90 ... 0x9f: case 0xa3:
+		case 0xa5: case 0xab: case 0xad ... 0xaf: case 0xb0: case 0xb1:
+		case 0xb3: case 0xb6: case 0xb7: case 0xbb ... 0xbf:
+		case 0xc0: case 0xc1: case 0xc3: case 0xc7: case 0xd1 ... 0xfe:
+			p += modrm_len(p);
+			break;
+		case 0x70 ... 0x73: case 0xa4: case 0xac: case 0xba:
+		case 0xc2: case 0xc4 ... 0xc6:
+			p += modrm_len(p) + 1;
+			break;
+		case 0x80 ... 0x8f:
+			if (opsize != 4)
+				return 0;
+			rel = 4;
+			break;
+		case 0x0b:
+			/* ud2, BUG() puts its line and file behind it */
+			*kind = INSN_NOCOPY;
+#ifdef CONFIG_DEBUG_BUGVERBOSE
+			p += 6;
+#endif
+			break;
+		default:
+			return 0;
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	if (rel) {
+		long disp = rel == 1 ? *(s8 *)p : *(s32 *)p;
+
+		p += rel;
+		*kind = INSN_REL;
+		*target = addr + (p - insn) + disp;
+	}
+out:
+	len = p - insn;
+	return len <= MAX_INSN_SIZE ? len : 0;
+}
+
+/*
+ * Copy the instruction at addr as it was before any probes, without
+ * reading past end.
+ */
+static void recover_insn(kprobe_opcode_t *buf, unsigned long addr,
+			 unsigned long end)
+{
+	struct kprobe *q;
+	int i, j, n = min_t(unsigned long, MAX_INSN_SIZE, end - addr);
+
+	memset(buf, 0, MAX_INSN_SIZE);
+	memcpy(buf, (void *)addr, n);
+	for (i = 1 - RELATIVEJUMP_SIZE; i < n; i++) {
+		q = get_kprobe((void *)(addr + i));
+		if (!q)
+			continue;
+		if (i >= 0)
+			buf[i] = q->opcode;
+		if (!kprobe_optimized(q))
+			continue;
+		for (j = 1; j < RELATIVEJUMP_SIZE; j++)
+			if (i + j >= 0 && i + j < n)
+				buf[i + j] = q->ainsn.insn[j];
+	}
+}
+
+/*
+ * How many bytes of whole instructions at p->addr the jump would replace,
+ * or 0 if it can't be done safely.  Called with kprobe_mutex held.
+ */
+static int can_optimize_kprobe(struct kprobe *p)
+{
+	unsigned long addr = (unsigned long)p->addr;
+	unsigned long size, offset, start, end, a, target;
+	kprobe_opcode_t buf[MAX_INSN_SIZE];
+	char namebuf[KSYM_NAME_LEN + 1];
+	char *modname;
+	int len, n, kind;
+
+	if (!kallsyms_lookup(addr, &size, &offset, &modname, namebuf))
+		return 0;
+	start = addr - offset;
+	end = start + size;
+
+	for (len = 0; len < RELATIVEJUMP_SIZE; len += n) {
+		a = addr + len;
+		if (a >= end || search_exception_tables(a))
+			return 0;
+		recover_insn(buf, a, end);
+		n = decode_insn(buf, a, &kind, &target);
+		if (!n || kind != INSN_COPY || a + n > end)
+			return 0;
+	}
+	/* Probes at the other bytes */
+	for (a = addr + 1; a < addr + len; a++)
+		if (get_kprobe((void *)a))
+			return 0;
+
+	for (a = start; a < addr; a += n) {
+		recover_insn(buf, a, end);
+		n = decode_insn(buf, a, &kind, &target);
+		if (!n || a + n > addr)
+			return 0;
+	}
+	for (a = start; a < end; a += n) {
+		recover_insn(buf, a, end);
+		n = decode_insn(buf, a, &kind, &target);
+		if (!n || kind == INSN_INDIRECT)
+			return 0;
+		if (kind == INSN_REL && target > addr && target < addr + len)
+			return 0;
+	}
+	return len;
+}
+
+/*
+ * The detours, in slots of executable pages
+ */
+#define DETOUR_SIZE		128
+#define DETOURS_PER_PAGE	(PAGE_SIZE / DETOUR_SIZE)
+
+struct detour_page {
+	struct hlist_node hlist;
+	kprobe_opcode_t *detours;
+	char slot_used[DETOURS_PER_PAGE];
+	int nused;
+};
+
+static struct hlist_head detour_pages;
+
+static kprobe_opcode_t *get_detour_slot(void)
+{
+	struct detour_page *dp;
+	struct hlist_node *pos;
+	int i;
+
+	hlist_for_each(pos, &detour_pages) {
+		dp = hlist_entry(pos, struct detour_page, hlist);
+		if (dp->nused == DETOURS_PER_PAGE)
+			continue;
+		for (i = 0; i < DETOURS_PER_PAGE; i++) {
+			if (!dp->slot_used[i]) {
+				dp->slot_used[i] = 1;
+				dp->nused++;
+				return dp->detours + i * DETOUR_SIZE;
+			}
+		}
+	}
+
+	dp = kmalloc(sizeof(struct detour_page), GFP_KERNEL);
+	if (!dp)
+		return NULL;
+	dp->detours = __vmalloc(PAGE_SIZE, GFP_KERNEL | __GFP_HIGHMEM,
+				PAGE_KERNEL_EXEC);
+	if (!dp->detours) {
+		kfree(dp);
+		return NULL;
+	}
+	hlist_add_head(&dp->hlist, &detour_pages);
+	memset(dp->slot_used, 0, DETOURS_PER_PAGE);
+	dp->slot_used[0] = 1;
+	dp->nused = 1;
+	return dp->detours;
+}
+
+static void free_detour_slot(kprobe_opcode_t *slot)
+{
+	struct detour_page *dp;
+	struct hlist_node *pos;
+
+	hlist_for_each(pos, &detour_pages) {
+		dp = hlist_entry(pos, struct detour_page, hlist);
+		if (slot < dp->detours || slot >= dp->detours + PAGE_SIZE)
+			continue;
+		dp->slot_used[(slot - dp->detours) / DETOUR_SIZE] = 0;
+		if (--dp->nused == 0) {
+			hlist_del(&dp->hlist);
+			vfree(dp->detours);
+			kfree(dp);
+		}
+		return;
+	}
+}
+
+/*
+ * The detour starts with a copy of this.  It builds a struct pt_regs
+ * below the stack pointer of the probe point, the way a trap from kernel
+ * mode does, and calls optimized_callback(kprobe, regs).  The immediates
+ * are filled in by arch_optimize_kprobe().
+ */
+void optprobe_template_entry(void);
+void optprobe_template_eip(void);
+void optprobe_template_op(void);
+void optprobe_template_call(void);
+void optprobe_template_end(void);
+
+asm(".text\n"
+    ".globl optprobe_template_entry\n"
+    "optprobe_template_entry:\n"
+    "	pushfl\n"
+    "	pushl %cs\n"
+    ".globl optprobe_template_eip\n"
+    "optprobe_template_eip:\n"
+    "	.byte 0x68\n"		/* pushl $eip */
+    "	.long 0\n"
+    "	pushl $-1\n"
+    "	pushl %es\n"
+    "	pushl %ds\n"
+    "	pushl %eax\n"
+    "	pushl %ebp\n"
+    "	pushl %edi\n"
+    "	pushl %esi\n"
+    "	pushl %edx\n"
+    "	pushl %ecx\n"
+    "	pushl %ebx\n"
+    "	pushl %esp\n"
+    ".globl optprobe_template_op\n"
+    "optprobe_template_op:\n"
+    "	.byte 0x68\n"		/* pushl $kprobe */
+    "	.long 0\n"
+    ".globl optprobe_template_call\n"
+    "optprobe_template_call:\n"
+    "	.byte 0xe8\n"		/* call optimized_callback */
+    "	.long 0\n"
+    "	addl $8, %esp\n"
+    "	popl %ebx\n"
+    "	popl %ecx\n"
+    "	popl %edx\n"
+    "	popl %esi\n"
+    "	popl %edi\n"
+    "	popl %ebp\n"
+    "	popl %eax\n"
+    "	addl $20, %esp\n"	/* ds, es, orig_eax, eip, cs */
+    "	popfl\n"
+    ".globl optprobe_template_end\n"
+    "optprobe_template_end:\n");
+
+#define TMPL_OFFSET(sym) \
+	((unsigned long)(sym) - (unsigned long)optprobe_template_entry)
+
+/* The detour of p was entered, like the breakpoint would have been */
+asmlinkage void optimized_callback(struct kprobe *p, struct pt_regs *regs)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	/* A probe handler ran into us: don't recurse */
+	if (kprobe_running()) {
+		local_irq_restore(flags);
+		return;
+	}
+	lock_kprobes();
+	kprobe_status = KPROBE_HIT_ACTIVE;
+	current_kprobe = p;
+	p->pre_handler(p, regs);
+	unlock_kprobes();
+	local_irq_restore(flags);
+}
+
+static void set_jmp(kprobe_opcode_t *from, void *to, kprobe_opcode_t op)
+{
+	from[0] = op;
+	*(s32 *)(from + 1) = (long)to - ((long)from + RELATIVEJUMP_SIZE);
+}
+
+static int arm_optprobe(void *data)
+{
+	struct kprobe *p = data;
+
+	set_jmp(p->addr, p->ainsn.detour, 0xe9);
+	flush_icache_range((unsigned long)p->addr,
+			   (unsigned long)p->addr + RELATIVEJUMP_SIZE);
+	return 0;
+}
+
+/* Back to the breakpoint */
+static int disarm_optprobe(void *data)
+{
+	struct kprobe *p = data;
+
+	p->addr[0] = BREAKPOINT_INSTRUCTION;
+	memcpy(p->addr + 1, p->ainsn.insn + 1, RELATIVEJUMP_SIZE - 1);
+	flush_icache_range((unsigned long)p->addr,
+			   (unsigned long)p->addr + RELATIVEJUMP_SIZE);
+	return 0;
+}
+
+/*
+ * Replace the breakpoint of p by a jump to a detour, if it is safe.
+ * Called with kprobe_mutex held, may sleep.
+ */
+int arch_optimize_kprobe(struct kprobe *p)
+{
+	unsigned long tmpl_len = TMPL_OFFSET(optprobe_template_end);
+	kprobe_opcode_t *detour, *insn;
+	int len;
+
+	len = can_optimize_kprobe(p);
+	if (!len)
+		return -EINVAL;
+	BUG_ON(tmpl_len + len + RELATIVEJUMP_SIZE > DETOUR_SIZE);
+
+	detour = get_detour_slot();
+	if (!detour)
+		return -ENOMEM;
+
+	memcpy(detour, optprobe_template_entry, tmpl_len);
+	/* The handler sees eip behind the breakpoint, as it would have */
+	*(u32 *)(detour + TMPL_OFFSET(optprobe_template_eip) + 1) =
+		(unsigned long)p->addr + 1;
+	*(u32 *)(detour + TMPL_OFFSET(optprobe_template_op) + 1) =
+		(unsigned long)p;
+	set_jmp(detour + TMPL_OFFSET(optprobe_template_call),
+		optimized_callback, 0xe8);
+
+	insn = detour + tmpl_len;
+	insn[0] = p->opcode;
+	memcpy(insn + 1, p->addr + 1, len - 1);
+	set_jmp(insn + len, p->addr + len, 0xe9);
+
+	p->ainsn.detour = detour;
+	p->ainsn.opt_len = len;
+	stop_machine_run(arm_optprobe, p, NR_CPUS);
+	return 0;
+}
+
+/*
+ * Put the breakpoint of p back, and free the detour once no cpu can be
+ * running it.  Called with kprobe_mutex held, may sleep.
+ */
+void arch_unoptimize_kprobe(struct kprobe *p)
+{
+	stop_machine_run(disarm_optprobe, p, NR_CPUS);
+	synchronize_kernel();
+	free_detour_slot(p->ainsn.detour);
+	p->ainsn.detour = NULL;
+}
+#endif /* CONFIG_OPTPROBES */
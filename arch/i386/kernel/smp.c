@@ -582,6 +582,7 @@ void smp_send_stop(void)
 fastcall void smp_reschedule_interrupt(struct pt_regs *regs)
 {
 	ack_APIC_irq();
+	scheduler_ipi();
 }
 
 fastcall void smp_call_function_interrupt(struct pt_regs *regs)
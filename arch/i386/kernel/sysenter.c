@@ -18,6 +18,7 @@
 #include <asm/msr.h>
 #include <asm/pgtable.h>
 #include <asm/unistd.h>
+#include <asm/vsyscall.h>
 
 extern asmlinkage void sysenter_entry(void);
 
@@ -44,9 +45,14 @@ extern const char vsyscall_sysenter_start, vsyscall_sysenter_end;
 static int __init sysenter_setup(void)
 {
 	void *page = (void *)get_zeroed_page(GFP_ATOMIC);
+	void *gtod = (void *)get_zeroed_page(GFP_ATOMIC);
 
 	__set_fixmap(FIX_VSYSCALL, __pa(page), PAGE_READONLY_EXEC);
 
+	/* Zeroed, it sends the vsyscall gettimeofday() to the kernel */
+	__set_fixmap(FIX_VSYSCALL_GTOD, __pa(gtod), PAGE_READONLY);
+	vsyscall_gtod = gtod;
+
 	if (!boot_cpu_has(X86_FEATURE_SEP)) {
 		memcpy(page,
 		       &vsyscall_int80_start,
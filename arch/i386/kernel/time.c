@@ -56,6 +56,7 @@
 #include <asm/uaccess.h>
 #include <asm/processor.h>
 #include <asm/timer.h>
+#include <asm/vsyscall.h>
 
 #include "mach_time.h"
 
@@ -165,6 +166,46 @@ void do_gettimeofday(struct timeval *tv)
 
 EXPORT_SYMBOL(do_gettimeofday);
 
+extern struct timezone sys_tz;
+
+/* Set up by sysenter_setup() */
+struct vsyscall_gtod_data *vsyscall_gtod;
+
+/*
+ * Leave what do_gettimeofday() would use for the vsyscall DSO.  Called
+ * with xtime_lock held for writing.
+ */
+void update_vsyscall_gtod(void)
+{
+	struct vsyscall_gtod_data *vg = vsyscall_gtod;
+
+	if (!vg)
+		return;
+
+	vg->seq++;
+	smp_wmb();
+
+	/* With ticks not yet added to xtime, leave it to the kernel */
+	if (jiffies == wall_jiffies && vsyscall_gtod_tsc(vg))
+		vg->mode = VGTOD_MODE_TSC;
+	else
+		vg->mode = VGTOD_MODE_SYSCALL;
+	if (unlikely(time_adjust < 0))
+		vg->max_usec = (USEC_PER_SEC / HZ) - tickadj;
+	else
+		vg->max_usec = ~0U;
+
+	vg->wall_sec = xtime.tv_sec;
+	vg->wall_usec = xtime.tv_nsec / 1000;
+	vg->wtm_sec = wall_to_monotonic.tv_sec;
+	vg->wtm_nsec = wall_to_monotonic.tv_nsec;
+	vg->tz_minuteswest = sys_tz.tz_minuteswest;
+	vg->tz_dsttime = sys_tz.tz_dsttime;
+
+	smp_wmb();
+	vg->seq++;
+}
+
 int do_settimeofday(struct timespec *tv)
 {
 	time_t wtm_sec, sec = tv->tv_sec;
@@ -193,6 +234,7 @@ int do_settimeofday(struct timespec *tv)
 	time_status |= STA_UNSYNC;
 	time_maxerror = NTP_PHASE_LIMIT;
 	time_esterror = NTP_PHASE_LIMIT;
+	update_vsyscall_gtod();
 	write_sequnlock_irq(&xtime_lock);
 	clock_was_set();
 	return 0;
@@ -322,6 +364,8 @@ irqreturn_t timer_interrupt(int irq, void *dev_id, struct pt_regs *regs)
  
 	do_timer_interrupt(irq, NULL, regs);
 
+	update_vsyscall_gtod();
+
 	write_sequnlock(&xtime_lock);
 	return IRQ_HANDLED;
 }
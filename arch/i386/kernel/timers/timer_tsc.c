@@ -24,12 +24,13 @@
 #include "mach_timer.h"
 
 #include <asm/hpet.h>
+#include <asm/vsyscall.h>
 
 #ifdef CONFIG_HPET_TIMER
 static unsigned long hpet_usec_quotient;
 static unsigned long hpet_last;
-static struct timer_opts timer_tsc;
 #endif
+static struct timer_opts timer_tsc;
 
 static inline void cpufreq_delayed_get(void);
 
@@ -38,6 +39,8 @@ int tsc_disable __initdata = 0;
 extern spinlock_t i8253_lock;
 
 static int use_tsc;
+/* The TSCs of the cpus may no longer run at one rate, see cpufreq below */
+static int tsc_unstable;
 /* Number of usecs that the last interrupt was delayed */
 static int delay_at_last_interrupt;
 
@@ -112,6 +115,22 @@ static unsigned long get_offset_tsc(void)
 	return delay_at_last_interrupt + edx;
 }
 
+/*
+ * What the vsyscall gettimeofday() needs to do get_offset_tsc() in user
+ * space.  Returns 0 if it can't, when the TSC is not the time source or
+ * is not to be trusted.  Called with xtime_lock held.
+ */
+int vsyscall_gtod_tsc(struct vsyscall_gtod_data *vg)
+{
+	if (cur_timer != &timer_tsc || tsc_unstable)
+		return 0;
+
+	vg->last_tsc_low = last_tsc_low;
+	vg->quot = fast_gettimeoffset_quotient;
+	vg->delay = delay_at_last_interrupt;
+	return 1;
+}
+
 static unsigned long long monotonic_clock_tsc(void)
 {
 	unsigned long long last_offset, this_offset, base;
@@ -281,6 +300,11 @@ time_cpufreq_notifier(struct notifier_block *nb, unsigned long val,
 	    (val == CPUFREQ_RESUMECHANGE)) {
 		if (!(freq->flags & CPUFREQ_CONST_LOOPS))
 			cpu_data[freq->cpu].loops_per_jiffy = cpufreq_scale(loops_per_jiffy_ref, ref_freq, freq->new);
+#ifdef CONFIG_SMP
+		/* fast_gettimeoffset_quotient is not for every cpu now */
+		if (!(freq->flags & CPUFREQ_CONST_LOOPS))
+			tsc_unstable = 1;
+#endif
 #ifndef CONFIG_SMP
 		if (cpu_khz)
 			cpu_khz = cpufreq_scale(cpu_khz_ref, ref_freq, freq->new);
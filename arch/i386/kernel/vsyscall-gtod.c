@@ -0,0 +1,109 @@
+/*
+ * linux/arch/i386/kernel/vsyscall-gtod.c
+ *
+ * gettimeofday() and clock_gettime() in the vsyscall DSO.  They read
+ * the TSC and the time of day the kernel leaves in the page described
+ * in asm/vsyscall.h, the way do_gettimeofday() does with the TSC timer,
+ * and make the system call when the kernel uses another time source.
+ *
+ * This runs in user mode: no kernel data but that page, and nothing
+ * that needs relocating.
+ */
+
+#include <linux/linkage.h>
+#include <linux/time.h>
+#include <asm/unistd.h>
+#include <asm/msr.h>
+#include <asm/vsyscall.h>
+
+#define vgtod	((const volatile struct vsyscall_gtod_data *)VSYSCALL_GTOD_BASE)
+
+/* PIC code can't touch %ebx in an asm constraint */
+static inline long vsyscall_fallback(long nr, long arg1, long arg2)
+{
+	long ret;
+
+	asm volatile("xchgl %%ebx, %1\n\t"
+		     "int $0x80\n\t"
+		     "xchgl %%ebx, %1"
+		     : "=a" (ret), "+r" (arg1)
+		     : "0" (nr), "c" (arg2)
+		     : "memory");
+	return ret;
+}
+
+/* The time of day in sec and usec, or 0 if the kernel has to be asked */
+static inline int do_vgettimeofday(long *sec, long *usec,
+				   long *wtm_sec, long *wtm_nsec)
+{
+	unsigned int seq, eax, edx;
+
+	do {
+		seq = vgtod->seq;
+		barrier();
+		if (vgtod->mode != VGTOD_MODE_TSC)
+			return 0;
+
+		rdtsc(eax, edx);
+		eax -= vgtod->last_tsc_low;
+		__asm__("mull %2"
+			: "=a" (eax), "=d" (edx)
+			: "rm" (vgtod->quot), "0" (eax));
+		edx += vgtod->delay;
+		if (edx > vgtod->max_usec)
+			edx = vgtod->max_usec;
+
+		*sec = vgtod->wall_sec;
+		*usec = vgtod->wall_usec + edx;
+		if (wtm_sec) {
+			*wtm_sec = vgtod->wtm_sec;
+			*wtm_nsec = vgtod->wtm_nsec;
+		}
+		barrier();
+	} while ((seq & 1) || seq != vgtod->seq);
+
+	while (*usec >= USEC_PER_SEC) {
+		*usec -= USEC_PER_SEC;
+		(*sec)++;
+	}
+	return 1;
+}
+
+asmlinkage int __kernel_gettimeofday(struct timeval *tv, struct timezone *tz)
+{
+	long sec, usec;
+
+	if (!do_vgettimeofday(&sec, &usec, NULL, NULL))
+		return vsyscall_fallback(__NR_gettimeofday, (long)tv, (long)tz);
+
+	if (tv) {
+		tv->tv_sec = sec;
+		tv->tv_usec = usec;
+	}
+	if (tz) {
+		tz->tz_minuteswest = vgtod->tz_minuteswest;
+		tz->tz_dsttime = vgtod->tz_dsttime;
+	}
+	return 0;
+}
+
+asmlinkage int __kernel_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	long sec, usec, wtm_sec, wtm_nsec;
+
+	if ((clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) ||
+	    !do_vgettimeofday(&sec, &usec, &wtm_sec, &wtm_nsec))
+		return vsyscall_fallback(__NR_clock_gettime, clock, (long)ts);
+
+	ts->tv_sec = sec;
+	ts->tv_nsec = usec * NSEC_PER_USEC;
+	if (clock == CLOCK_MONOTONIC) {
+		ts->tv_sec += wtm_sec;
+		ts->tv_nsec += wtm_nsec;
+		if (ts->tv_nsec >= NSEC_PER_SEC) {
+			ts->tv_nsec -= NSEC_PER_SEC;
+			ts->tv_sec++;
+		}
+	}
+	return 0;
+}
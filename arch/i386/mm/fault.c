@@ -218,7 +218,8 @@ fastcall void do_page_fault(struct pt_regs *regs, unsigned long error_code)
 	struct vm_area_struct * vma;
 	unsigned long address;
 	unsigned long page;
-	int write;
+	int write, fault;
+	unsigned int flags;
 	siginfo_t info;
 
 	/* get the address */
@@ -227,6 +228,7 @@ fastcall void do_page_fault(struct pt_regs *regs, unsigned long error_code)
 	if (notify_die(DIE_PAGE_FAULT, "page fault", regs, error_code, 14,
 					SIGSEGV) == NOTIFY_STOP)
 		return;
+	perf_swcounter_event(PERF_COUNT_PAGE_FAULTS, 1, regs);
 	/* It's safe to allow irq's after cr2 has been saved */
 	if (regs->eflags & (X86_EFLAGS_IF|VM_MASK))
 		local_irq_enable();
@@ -289,6 +291,9 @@ fastcall void do_page_fault(struct pt_regs *regs, unsigned long error_code)
 		down_read(&mm->mmap_sem);
 	}
 
+	/* Only user mode faults: in the kernel, mmap_sem may be held above */
+	flags = (error_code & 4) ? FAULT_FLAG_ALLOW_RETRY : 0;
+retry:
 	vma = find_vma(mm, address);
 	if (!vma)
 		goto bad_area;
@@ -339,14 +344,27 @@ good_area:
 	 * If for any reason at all we couldn't handle the fault,
 	 * make sure we exit gracefully rather than endlessly redo
 	 * the fault.
+	 *
+	 * A fault which had to wait for I/O may have dropped mmap_sem for
+	 * that, and must then be tried again: once, waiting under mmap_sem
+	 * if need be, to be sure of progress.  It is accounted on the
+	 * first try only, as the major fault it was.
 	 */
-	switch (handle_mm_fault(mm, vma, address, write)) {
+	fault = __handle_mm_fault(mm, vma, address, write, flags);
+	switch (fault) {
 		case VM_FAULT_MINOR:
-			tsk->min_flt++;
+			if (!(flags & FAULT_FLAG_TRIED))
+				tsk->min_flt++;
 			break;
 		case VM_FAULT_MAJOR:
-			tsk->maj_flt++;
+			if (!(flags & FAULT_FLAG_TRIED))
+				tsk->maj_flt++;
 			break;
+		case VM_FAULT_RETRY:
+			tsk->maj_flt++;
+			flags = FAULT_FLAG_TRIED;
+			down_read(&mm->mmap_sem);
+			goto retry;
 		case VM_FAULT_SIGBUS:
 			goto do_sigbus;
 		case VM_FAULT_OOM:
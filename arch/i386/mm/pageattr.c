@@ -9,6 +9,7 @@
 #include <linux/highmem.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <asm/uaccess.h>
 #include <asm/processor.h>
 #include <asm/tlbflush.h>
@@ -193,6 +194,9 @@ void global_flush_tlb(void)
 
 	BUG_ON(irqs_disabled());
 
+	/* No stale vmalloc translations to the pages just changed */
+	vm_unmap_aliases();
+
 	spin_lock_irq(&cpa_lock);
 	list_splice_init(&df_list, &l);
 	spin_unlock_irq(&cpa_lock);
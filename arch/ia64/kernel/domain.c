@@ -358,6 +358,11 @@ next_sg:
 #endif
 		cpu_attach_domain(sd, i);
 	}
+
+	/*
+	 * Tune cache-hot values:
+	 */
+	calibrate_migration_costs(&cpu_default_map);
 }
 
 void __devinit arch_destroy_sched_domains(void)
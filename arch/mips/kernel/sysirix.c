@@ -17,6 +17,7 @@
 #include <linux/errno.h>
 #include <linux/time.h>
 #include <linux/timex.h>
+#include <linux/hrtimer.h>
 #include <linux/times.h>
 #include <linux/elf.h>
 #include <linux/msg.h>
@@ -641,29 +642,19 @@ asmlinkage int irix_stime(int value)
 	return 0;
 }
 
-static inline void jiffiestotv(unsigned long jiffies, struct timeval *value)
-{
-	value->tv_usec = (jiffies % HZ) * (1000000 / HZ);
-	value->tv_sec = jiffies / HZ;
-}
-
 static inline void getitimer_real(struct itimerval *value)
 {
-	register unsigned long val, interval;
-
-	interval = current->it_real_incr;
-	val = 0;
-	if (del_timer(&current->real_timer)) {
-		unsigned long now = jiffies;
-		val = current->real_timer.expires;
-		add_timer(&current->real_timer);
-		/* look out for negative/zero itimer.. */
-		if (val <= now)
-			val = now+1;
-		val -= now;
-	}
-	jiffiestotv(val, &value->it_value);
-	jiffiestotv(interval, &value->it_interval);
+	struct hrtimer *timer = &current->signal->real_timer;
+	ktime_t rem = hrtimer_get_remaining(timer);
+
+	/* look out for negative/zero itimer.. */
+	if (hrtimer_active(timer)) {
+		if (rem.tv64 <= 0)
+			rem.tv64 = NSEC_PER_USEC;
+	} else
+		rem.tv64 = 0;
+	value->it_value = ktime_to_timeval(rem);
+	value->it_interval = ktime_to_timeval(current->signal->it_real_incr);
 }
 
 asmlinkage unsigned int irix_alarm(unsigned int seconds)
@@ -672,8 +663,10 @@ asmlinkage unsigned int irix_alarm(unsigned int seconds)
 	unsigned int oldalarm;
 
 	if (!seconds) {
+		spin_lock_irq(&current->sighand->siglock);
 		getitimer_real(&it_old);
-		del_timer(&current->real_timer);
+		spin_unlock_irq(&current->sighand->siglock);
+		hrtimer_cancel(&current->signal->real_timer);
 	} else {
 		it_new.it_interval.tv_sec = it_new.it_interval.tv_usec = 0;
 		it_new.it_value.tv_sec = seconds;
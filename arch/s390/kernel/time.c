@@ -241,12 +241,15 @@ static inline void stop_hz_timer(void)
 		return;
 
 	cpu_set(smp_processor_id(), nohz_cpu_mask);
+	smp_mb();
+	rcu_enter_nohz(smp_processor_id());
 
 	/*
 	 * Leave the clock comparator set up for the next timer
-	 * tick if either rcu or a softirq is pending.
+	 * tick if either rcu, a softirq or a kprintd wakeup is pending.
 	 */
-	if (rcu_pending(smp_processor_id()) || local_softirq_pending()) {
+	if (rcu_pending(smp_processor_id()) || local_softirq_pending() ||
+	    printk_needs_cpu(smp_processor_id())) {
 		cpu_clear(smp_processor_id(), nohz_cpu_mask);
 		return;
 	}
@@ -0,0 +1,142 @@
+/*
+ * Cryptographic API.
+ *
+ * CRC32C chksum, with the crc32 instruction of SSE4.2.
+ *
+ * The instruction gives the same reflected crc, not inverted, as
+ * crc32c_le() of lib/libcrc32c, so seeds and results are those of
+ * crypto/crc32c.c.  It folds in eight bytes at a time, and is written
+ * as .byte so that assemblers that do not know it yet can build it.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <asm/cpufeature.h>
+
+#define CHKSUM_BLOCK_SIZE	32
+#define CHKSUM_DIGEST_SIZE	4
+
+struct chksum_ctx {
+	u32 crc;
+};
+
+static u32 crc32c_intel_le_hw_byte(u32 crc, unsigned char const *data,
+				   size_t length)
+{
+	while (length--) {
+		/* crc32b %cl, %esi */
+		__asm__ __volatile__(
+			".byte 0xf2, 0x0f, 0x38, 0xf0, 0xf1"
+			: "=S" (crc)
+			: "0" (crc), "c" (*data));
+		data++;
+	}
+	return crc;
+}
+
+static u32 crc32c_intel_le_hw(u32 crc, unsigned char const *p, size_t len)
+{
+	unsigned long iquotient = len / sizeof(unsigned long);
+	unsigned long iremainder = len % sizeof(unsigned long);
+	const unsigned long *ptmp = (const unsigned long *)p;
+
+	while (iquotient--) {
+		/* crc32q %rcx, %rsi */
+		__asm__ __volatile__(
+			".byte 0xf2, 0x48, 0x0f, 0x38, 0xf1, 0xf1"
+			: "=S" (crc)
+			: "0" (crc), "c" (*ptmp));
+		ptmp++;
+	}
+	if (iremainder)
+		crc = crc32c_intel_le_hw_byte(crc, (unsigned char const *)ptmp,
+					      iremainder);
+	return crc;
+}
+
+static void chksum_init(void *ctx)
+{
+	struct chksum_ctx *mctx = ctx;
+
+	mctx->crc = ~(u32)0;			/* common usage */
+}
+
+/*
+ * Setting the seed allows arbitrary accumulators and flexible XOR policy
+ * If your algorithm starts with ~0, then XOR with ~0 before you set
+ * the seed.
+ */
+static int chksum_setkey(void *ctx, const u8 *key, unsigned int keylen,
+			 u32 *flags)
+{
+	struct chksum_ctx *mctx = ctx;
+
+	if (keylen != sizeof(mctx->crc)) {
+		if (flags)
+			*flags = CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	mctx->crc = *(u32 *)key;
+	return 0;
+}
+
+static void chksum_update(void *ctx, const u8 *data, unsigned int length)
+{
+	struct chksum_ctx *mctx = ctx;
+
+	mctx->crc = crc32c_intel_le_hw(mctx->crc, data, length);
+}
+
+static void chksum_final(void *ctx, u8 *out)
+{
+	struct chksum_ctx *mctx = ctx;
+
+	*(u32 *)out = mctx->crc ^ ~(u32)0;
+}
+
+static struct crypto_alg alg = {
+	.cra_name	=	"crc32c",
+	.cra_driver_name =	"crc32c-intel",
+	.cra_priority	=	100,
+	.cra_flags	=	CRYPTO_ALG_TYPE_DIGEST,
+	.cra_blocksize	=	CHKSUM_BLOCK_SIZE,
+	.cra_ctxsize	=	sizeof(struct chksum_ctx),
+	.cra_module	=	THIS_MODULE,
+	.cra_list	=	LIST_HEAD_INIT(alg.cra_list),
+	.cra_u		=	{
+		.digest = {
+			 .dia_digestsize=	CHKSUM_DIGEST_SIZE,
+			 .dia_setkey	=	chksum_setkey,
+			 .dia_init   	= 	chksum_init,
+			 .dia_update 	=	chksum_update,
+			 .dia_final  	=	chksum_final
+		 }
+	}
+};
+
+static int __init init(void)
+{
+	if (!cpu_has_xmm4_2)
+		return -ENODEV;
+	return crypto_register_alg(&alg);
+}
+
+static void __exit fini(void)
+{
+	crypto_unregister_alg(&alg);
+}
+
+module_init(init);
+module_exit(fini);
+
+MODULE_DESCRIPTION("CRC32c (Castagnoli) calculations with SSE4.2");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("crc32c");
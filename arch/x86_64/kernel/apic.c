@@ -26,6 +26,8 @@
 #include <linux/mc146818rtc.h>
 #include <linux/kernel_stat.h>
 #include <linux/sysdev.h>
+#include <linux/rcupdate.h>
+#include <linux/hrtimer.h>
 
 #include <asm/atomic.h>
 #include <asm/smp.h>
@@ -45,6 +47,14 @@ static DEFINE_PER_CPU(int, prof_multiplier) = 1;
 static DEFINE_PER_CPU(int, prof_old_multiplier) = 1;
 static DEFINE_PER_CPU(int, prof_counter) = 1;
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+/* this cpu's APIC timer is in one-shot mode, driving the hrtimers */
+static DEFINE_PER_CPU(int, apic_oneshot);
+#define apic_timer_oneshot(cpu)	per_cpu(apic_oneshot, cpu)
+#else
+#define apic_timer_oneshot(cpu)	0
+#endif
+
 static void apic_pm_activate(void);
 
 void enable_NMI_through_LVT0 (void * dummy)
@@ -671,12 +681,42 @@ static void __setup_APIC_LVTT(unsigned int clocks)
 	apic_write_around(APIC_TMICT, clocks/APIC_DIVISOR);
 }
 
+#if defined(CONFIG_NO_IDLE_HZ) || defined(CONFIG_HIGH_RES_TIMERS)
+/*
+ * Program the local APIC timer to fire once, after 'clocks' bus clocks
+ * (before the divisor, like __setup_APIC_LVTT()).
+ */
+static void __setup_APIC_LVTT_oneshot(unsigned long clocks)
+{
+	unsigned int lvtt_value, ver;
+	unsigned long count = clocks / APIC_DIVISOR;
+
+	ver = GET_APIC_VERSION(apic_read(APIC_LVR));
+	lvtt_value = LOCAL_TIMER_VECTOR;
+	if (!APIC_INTEGRATED(ver))
+		lvtt_value |= SET_APIC_TIMER_BASE(APIC_TIMER_BASE_DIV);
+	apic_write_around(APIC_LVTT, lvtt_value);
+
+	if (count > 0xffffffffUL)
+		count = 0xffffffffUL;
+	/* a zero count would stop the timer */
+	if (!count)
+		count = 1;
+	apic_write_around(APIC_TMICT, count);
+}
+#endif
+
 static void setup_APIC_timer(unsigned int clocks)
 {
 	unsigned long flags;
 
 	local_irq_save(flags);
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+	/* back to periodic mode until the hrtimer code switches us over */
+	per_cpu(apic_oneshot, smp_processor_id()) = 0;
+#endif
+
 	/* For some reasons this doesn't work on Simics, so fake it for now */ 
 	if (!strstr(boot_cpu_data.x86_model_id, "Screwdriver")) { 
 	__setup_APIC_LVTT(clocks);
@@ -752,6 +792,163 @@ static int __init calibrate_APIC_clock(void)
 
 static unsigned int calibration_result;
 
+#ifdef CONFIG_NO_IDLE_HZ
+int sysctl_hz_timer = 0;
+
+/* jiffies value at which this cpu stopped its tick */
+static DEFINE_PER_CPU(unsigned long, nohz_stamp);
+
+/*
+ * Stop the HZ tick on the current CPU, and program the local APIC
+ * timer to fire once when the next timer on this CPU's wheel is due.
+ * Only the idle loop may call this function, with interrupts disabled.
+ */
+void stop_hz_timer(void)
+{
+	int cpu = smp_processor_id();
+	unsigned long delta;
+
+	if (sysctl_hz_timer != 0 || !using_apic_timer ||
+	    apic_timer_oneshot(cpu))
+		return;
+
+	cpu_set(cpu, nohz_cpu_mask);
+	smp_mb();
+	rcu_enter_nohz(cpu);
+
+	/*
+	 * Keep ticking if either rcu, a softirq or a kprintd wakeup is
+	 * pending, or if the next timer is due on the next tick anyway.
+	 */
+	if (rcu_pending(cpu) || local_softirq_pending() ||
+	    printk_needs_cpu(cpu))
+		goto out_tick;
+
+	delta = next_timer_interrupt() - jiffies;
+	if ((long)delta <= 1)
+		goto out_tick;
+
+	per_cpu(nohz_stamp, cpu) = jiffies;
+	__setup_APIC_LVTT_oneshot((unsigned long)calibration_result * delta);
+	return;
+
+out_tick:
+	cpu_clear(cpu, nohz_cpu_mask);
+}
+
+/*
+ * Restart the HZ tick on the current CPU after it was stopped by
+ * stop_hz_timer(), and account the ticks it slept through as idle
+ * time. Only the idle loop may call this function, with interrupts
+ * disabled.
+ */
+void start_hz_timer(void)
+{
+	int cpu = smp_processor_id();
+	unsigned long ticks;
+
+	if (!cpu_isset(cpu, nohz_cpu_mask))
+		return;
+
+	__setup_APIC_LVTT(calibration_result /
+				per_cpu(prof_old_multiplier, cpu));
+	cpu_clear(cpu, nohz_cpu_mask);
+
+	/*
+	 * The tick that woke us (if it was ours) has accounted
+	 * itself already:
+	 */
+	ticks = jiffies - per_cpu(nohz_stamp, cpu);
+	if (ticks > 1)
+		account_system_time(current, 0,
+				jiffies_to_cputime(ticks - 1));
+}
+#endif
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+/*
+ * In high resolution mode the local APIC timer is always programmed
+ * one-shot, for whichever comes first: the next (emulated) local
+ * tick, or the next hrtimer on this cpu.
+ */
+
+/* don't program events closer than this, in nanoseconds */
+#define APIC_MIN_DELTA_NS	1000
+
+static DEFINE_PER_CPU(ktime_t, apic_next_tick);
+static DEFINE_PER_CPU(ktime_t, apic_next_event);
+
+/* The local tick period; the profiling multiplier speeds it up */
+static inline s64 apic_tick_period(int cpu)
+{
+	return TICK_NSEC / per_cpu(prof_old_multiplier, cpu);
+}
+
+static void apic_program_next_event(int cpu)
+{
+	ktime_t next = per_cpu(apic_next_tick, cpu);
+	s64 delta;
+
+	if (per_cpu(apic_next_event, cpu).tv64 < next.tv64)
+		next = per_cpu(apic_next_event, cpu);
+
+	delta = ktime_to_ns(ktime_sub(next, ktime_get()));
+	if (delta < APIC_MIN_DELTA_NS)
+		delta = APIC_MIN_DELTA_NS;
+
+	/* calibration_result is in bus clocks per tick */
+	__setup_APIC_LVTT_oneshot((unsigned long)
+			((u64)delta * calibration_result / TICK_NSEC));
+}
+
+int hrtimer_arch_switch_to_oneshot(void)
+{
+	int cpu = smp_processor_id();
+
+	if (!using_apic_timer || !calibration_result)
+		return -ENODEV;
+
+	per_cpu(apic_next_tick, cpu) = ktime_add_ns(ktime_get(),
+						    apic_tick_period(cpu));
+	per_cpu(apic_next_event, cpu).tv64 = KTIME_MAX;
+	per_cpu(apic_oneshot, cpu) = 1;
+	apic_program_next_event(cpu);
+	return 0;
+}
+
+void hrtimer_arch_program_event(ktime_t expires)
+{
+	int cpu = smp_processor_id();
+
+	per_cpu(apic_next_event, cpu) = expires;
+	apic_program_next_event(cpu);
+}
+
+/*
+ * One-shot APIC timer interrupt: run the local tick if it is due,
+ * then the hrtimers. hrtimer_interrupt() programs the next event.
+ */
+static void apic_oneshot_interrupt(struct pt_regs *regs)
+{
+	int cpu = smp_processor_id();
+	ktime_t now = ktime_get();
+
+	if (now.tv64 >= per_cpu(apic_next_tick, cpu).tv64) {
+		s64 period = apic_tick_period(cpu);
+
+		smp_local_timer_interrupt(regs);
+		/* skip the ticks we were late for, rather than replay them */
+		do
+			per_cpu(apic_next_tick, cpu) =
+				ktime_add_ns(per_cpu(apic_next_tick, cpu),
+					     period);
+		while (per_cpu(apic_next_tick, cpu).tv64 <= now.tv64);
+	}
+
+	hrtimer_interrupt();
+}
+#endif
+
 void __init setup_boot_APIC_clock (void)
 {
 	if (disable_apic_timer) { 
@@ -857,8 +1054,10 @@ void smp_local_timer_interrupt(struct pt_regs *regs)
 		per_cpu(prof_counter, cpu) = per_cpu(prof_multiplier, cpu);
 		if (per_cpu(prof_counter, cpu) != 
 		    per_cpu(prof_old_multiplier, cpu)) {
-			__setup_APIC_LVTT(calibration_result/
-					per_cpu(prof_counter, cpu));
+			/* the one-shot timer picks up the new period itself */
+			if (!apic_timer_oneshot(cpu))
+				__setup_APIC_LVTT(calibration_result/
+						per_cpu(prof_counter, cpu));
 			per_cpu(prof_old_multiplier, cpu) =
 				per_cpu(prof_counter, cpu);
 		}
@@ -906,7 +1105,12 @@ void smp_apic_timer_interrupt(struct pt_regs *regs)
 	 * interrupt lock, which is the WrongThing (tm) to do.
 	 */
 	irq_enter();
-	smp_local_timer_interrupt(regs);
+#ifdef CONFIG_HIGH_RES_TIMERS
+	if (apic_timer_oneshot(smp_processor_id()))
+		apic_oneshot_interrupt(regs);
+	else
+#endif
+		smp_local_timer_interrupt(regs);
 	irq_exit();
 }
 
@@ -0,0 +1,283 @@
+/*
+ * Hardware performance counters for kernel/perf_counter.c: Intel
+ * architectural perfmon, and AMD K8 and later.
+ *
+ * Every counter is started at minus its period, or at half its range
+ * when only counting, with the overflow NMI on, so that it cannot wrap
+ * unseen.  The NMI adds up what was counted, writes a sample for a
+ * sampling counter, and starts it over.  The count is brought up to
+ * date with a cmpxchg of prev_count, since the NMI can hit a read of the
+ * same counter.
+ *
+ * The NMI watchdog in local APIC mode (nmi_watchdog=2) and oprofile use
+ * the same counters, and exclude these ones.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/notifier.h>
+#include <linux/percpu.h>
+#include <linux/perf_counter.h>
+#include <asm/msr.h>
+#include <asm/apic.h>
+#include <asm/kdebug.h>
+#include <asm/processor.h>
+
+#define X86_PMC_MAX		8
+
+#define EVNTSEL_USR		(1 << 16)
+#define EVNTSEL_OS		(1 << 17)
+#define EVNTSEL_INT		(1 << 20)
+#define EVNTSEL_EN		(1 << 22)
+
+struct x86_pmu {
+	const char	*name;
+	unsigned int	eventsel;
+	unsigned int	perfctr;
+	int		num_counters;
+	int		width;
+	u64		max_period;
+	u64		event_map[PERF_HW_EVENTS_MAX];	/* 0 if not available */
+};
+
+static struct x86_pmu x86_pmu;
+
+struct cpu_hw_counters {
+	struct perf_counter	*counters[X86_PMC_MAX];
+	unsigned long		used;
+};
+
+static DEFINE_PER_CPU(struct cpu_hw_counters, cpu_hw_counters);
+
+static inline u64 x86_counter_mask(void)
+{
+	return (1ULL << x86_pmu.width) - 1;
+}
+
+/* Add what the hardware counted since last time to counter->count. */
+static void x86_perf_counter_update(struct perf_counter *counter)
+{
+	struct hw_perf_counter *hwc = &counter->hw;
+	u64 prev, new, delta, old;
+
+	do {
+		prev = hwc->prev_count;
+		rdmsrl(x86_pmu.perfctr + hwc->idx, new);
+	} while (cmpxchg(&hwc->prev_count, prev, new) != prev);
+
+	delta = (new - prev) & x86_counter_mask();
+	do {
+		old = counter->count;
+	} while (cmpxchg(&counter->count, old, old + delta) != old);
+}
+
+/* Start the hardware counter at minus the events to the next overflow. */
+static void x86_perf_counter_set_period(struct perf_counter *counter)
+{
+	struct hw_perf_counter *hwc = &counter->hw;
+	s64 left = counter->hw_event.irq_period;
+
+	if (!left || left > x86_pmu.max_period)
+		left = x86_pmu.max_period;
+	hwc->prev_count = (u64)-left & x86_counter_mask();
+	wrmsrl(x86_pmu.perfctr + hwc->idx, hwc->prev_count);
+}
+
+static int x86_perf_counter_enable(struct perf_counter *counter)
+{
+	struct cpu_hw_counters *cpuc = &__get_cpu_var(cpu_hw_counters);
+	struct hw_perf_counter *hwc = &counter->hw;
+	u64 config = hwc->config | EVNTSEL_INT | EVNTSEL_EN;
+	int idx;
+
+	idx = find_first_zero_bit(&cpuc->used, x86_pmu.num_counters);
+	if (idx >= x86_pmu.num_counters)
+		return -ENOSPC;
+	__set_bit(idx, &cpuc->used);
+	hwc->idx = idx;
+
+	if (!(counter->hw_event.flags & PERF_FLAG_EXCLUDE_USER))
+		config |= EVNTSEL_USR;
+	if (!(counter->hw_event.flags & PERF_FLAG_EXCLUDE_KERNEL))
+		config |= EVNTSEL_OS;
+
+	x86_perf_counter_set_period(counter);
+	cpuc->counters[idx] = counter;
+	apic_write(APIC_LVTPC, APIC_DM_NMI);
+	wrmsrl(x86_pmu.eventsel + idx, config);
+	return 0;
+}
+
+static void x86_perf_counter_disable(struct perf_counter *counter)
+{
+	struct cpu_hw_counters *cpuc = &__get_cpu_var(cpu_hw_counters);
+	int idx = counter->hw.idx;
+
+	wrmsrl(x86_pmu.eventsel + idx, 0);
+	cpuc->counters[idx] = NULL;
+	x86_perf_counter_update(counter);
+	__clear_bit(idx, &cpuc->used);
+}
+
+static const struct hw_perf_counter_ops x86_perf_counter_ops = {
+	.enable		= x86_perf_counter_enable,
+	.disable	= x86_perf_counter_disable,
+	.read		= x86_perf_counter_update,
+};
+
+const struct hw_perf_counter_ops *
+hw_perf_counter_init(struct perf_counter *counter)
+{
+	u64 config;
+
+	if (!x86_pmu.num_counters)
+		return NULL;
+	config = x86_pmu.event_map[counter->hw_event.config];
+	if (!config)
+		return NULL;
+	counter->hw.config = config;
+	return &x86_perf_counter_ops;
+}
+
+static int x86_perf_counter_nmi(struct notifier_block *self,
+				unsigned long val, void *data)
+{
+	struct die_args *args = data;
+	struct cpu_hw_counters *cpuc;
+	struct perf_counter *counter;
+	int idx, handled = 0;
+	u64 count;
+
+	if (val != DIE_NMI_IPI)
+		return NOTIFY_DONE;
+
+	cpuc = &__get_cpu_var(cpu_hw_counters);
+	for (idx = 0; idx < x86_pmu.num_counters; idx++) {
+		counter = cpuc->counters[idx];
+		if (!counter)
+			continue;
+		/* Still negative: not this one */
+		rdmsrl(x86_pmu.perfctr + idx, count);
+		if (count & (1ULL << (x86_pmu.width - 1)))
+			continue;
+
+		x86_perf_counter_update(counter);
+		if (counter->hw_event.irq_period)
+			perf_counter_output(counter, args->regs->rip);
+		x86_perf_counter_set_period(counter);
+		handled = 1;
+	}
+	if (!handled)
+		return NOTIFY_DONE;
+
+	/* The PMI masked the vector */
+	apic_write(APIC_LVTPC, APIC_DM_NMI);
+	return NOTIFY_STOP;
+}
+
+static struct notifier_block x86_perf_counter_nmi_notifier = {
+	.notifier_call	= x86_perf_counter_nmi,
+};
+
+/* The event masks of the architectural events, in cpuid 0xa ebx order */
+static const u64 intel_arch_events[] = {
+	[PERF_COUNT_CPU_CYCLES]			= 0x003c,
+	[PERF_COUNT_INSTRUCTIONS]		= 0x00c0,
+	[PERF_COUNT_CACHE_REFERENCES]		= 0x4f2e,
+	[PERF_COUNT_CACHE_MISSES]		= 0x412e,
+	[PERF_COUNT_BRANCH_INSTRUCTIONS]	= 0x00c4,
+	[PERF_COUNT_BRANCH_MISSES]		= 0x00c5,
+};
+static const int intel_arch_event_bit[] = {
+	[PERF_COUNT_CPU_CYCLES]			= 0,
+	[PERF_COUNT_INSTRUCTIONS]		= 1,
+	[PERF_COUNT_CACHE_REFERENCES]		= 3,
+	[PERF_COUNT_CACHE_MISSES]		= 4,
+	[PERF_COUNT_BRANCH_INSTRUCTIONS]	= 5,
+	[PERF_COUNT_BRANCH_MISSES]		= 6,
+};
+
+static int __init intel_pmu_init(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	int i;
+
+	if (cpuid_eax(0) < 0xa)
+		return 0;
+	cpuid(0xa, &eax, &ebx, &ecx, &edx);
+	if (!(eax & 0xff))
+		return 0;
+
+	x86_pmu.name = "Intel architectural";
+	x86_pmu.eventsel = MSR_P6_EVNTSEL0;
+	x86_pmu.perfctr = MSR_P6_PERFCTR0;
+	x86_pmu.num_counters = min_t(int, (eax >> 8) & 0xff, X86_PMC_MAX);
+	x86_pmu.width = (eax >> 16) & 0xff;
+	/* Only the low 32 bits can be written, sign extended */
+	x86_pmu.max_period = (1ULL << 31) - 1;
+	for (i = 0; i < PERF_HW_EVENTS_MAX; i++)
+		if (!(ebx & (1 << intel_arch_event_bit[i])))
+			x86_pmu.event_map[i] = intel_arch_events[i];
+	return 1;
+}
+
+static const u64 amd_events[] = {
+	[PERF_COUNT_CPU_CYCLES]			= 0x0076,
+	[PERF_COUNT_INSTRUCTIONS]		= 0x00c0,
+	[PERF_COUNT_CACHE_REFERENCES]		= 0x0040,
+	[PERF_COUNT_CACHE_MISSES]		= 0x0041,
+	[PERF_COUNT_BRANCH_INSTRUCTIONS]	= 0x00c2,
+	[PERF_COUNT_BRANCH_MISSES]		= 0x00c3,
+};
+
+static int __init amd_pmu_init(void)
+{
+	if (boot_cpu_data.x86 < 0xf)
+		return 0;
+
+	x86_pmu.name = "AMD K8";
+	x86_pmu.eventsel = MSR_K7_EVNTSEL0;
+	x86_pmu.perfctr = MSR_K7_PERFCTR0;
+	x86_pmu.num_counters = 4;
+	x86_pmu.width = 48;
+	x86_pmu.max_period = (1ULL << 47) - 1;
+	memcpy(x86_pmu.event_map, amd_events, sizeof(amd_events));
+	return 1;
+}
+
+static int __init init_hw_perf_counters(void)
+{
+	int ok = 0;
+
+	if (nmi_watchdog == NMI_LOCAL_APIC) {
+		printk(KERN_INFO "Performance counters: in use by the NMI "
+		       "watchdog\n");
+		return 0;
+	}
+
+	switch (boot_cpu_data.x86_vendor) {
+	case X86_VENDOR_INTEL:
+		ok = intel_pmu_init();
+		break;
+	case X86_VENDOR_AMD:
+		ok = amd_pmu_init();
+		break;
+	}
+	if (!ok)
+		return 0;
+
+	/* A sampling period has to fit in the positive half */
+	if (x86_pmu.max_period > (x86_counter_mask() >> 1))
+		x86_pmu.max_period = x86_counter_mask() >> 1;
+
+	register_die_notifier(&x86_perf_counter_nmi_notifier);
+	printk(KERN_INFO "Performance counters: %s, %d counters of %d bits\n",
+	       x86_pmu.name, x86_pmu.num_counters, x86_pmu.width);
+	return 0;
+}
+__initcall(init_hw_perf_counters);
@@ -86,9 +86,13 @@ void default_idle(void)
 {
 	if (!atomic_read(&hlt_counter)) {
 		local_irq_disable();
-		if (!need_resched())
+		if (!need_resched()) {
+			stop_hz_timer();
 			safe_halt();
-		else
+			local_irq_disable();
+			start_hz_timer();
+			local_irq_enable();
+		} else
 			local_irq_enable();
 	}
 }
@@ -383,6 +383,7 @@ void smp_send_stop(void)
 asmlinkage void smp_reschedule_interrupt(void)
 {
 	ack_APIC_irq();
+	scheduler_ipi();
 }
 
 asmlinkage void smp_call_function_interrupt(void)
@@ -71,6 +71,7 @@ static cpumask_t smp_commenced_mask;
 struct cpuinfo_x86 cpu_data[NR_CPUS] __cacheline_aligned;
 
 cpumask_t cpu_sibling_map[NR_CPUS] __cacheline_aligned;
+cpumask_t cpu_core_map[NR_CPUS] __cacheline_aligned;
 
 /*
  * Trampoline 80x86 program as an array.
@@ -681,6 +682,7 @@ static void smp_tune_scheduling (void)
 			cachesize = 16; /* Pentiums, 2x8kB cache */
 			bandwidth = 100;
 		}
+		max_cache_size = cachesize * 1024;
 	}
 }
 
@@ -867,6 +869,30 @@ static void __init smp_boot_cpus(unsigned int max_cpus)
 		}       
 	}
 
+	/*
+	 * Construct cpu_core_map[]: all cores of the physical package,
+	 * including HT siblings. AMD dual core parts hide their second
+	 * core from cpu_sibling_map[] (see sched_cmp_hack()) but still
+	 * report the package in phys_proc_id[].
+	 */
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		int i;
+
+		cpus_clear(cpu_core_map[cpu]);
+		if (!cpu_isset(cpu, cpu_callout_map))
+			continue;
+
+		cpu_set(cpu, cpu_core_map[cpu]);
+		if (phys_proc_id[cpu] == BAD_APICID)
+			continue;
+		for (i = 0; i < NR_CPUS; i++) {
+			if (!cpu_isset(i, cpu_callout_map))
+				continue;
+			if (phys_proc_id[cpu] == phys_proc_id[i])
+				cpu_set(i, cpu_core_map[cpu]);
+		}
+	}
+
 	Dprintk("Boot done.\n");
 
 	/*
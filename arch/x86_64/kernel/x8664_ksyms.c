@@ -200,6 +200,7 @@ EXPORT_SYMBOL(register_die_notifier);
 
 #ifdef CONFIG_SMP
 EXPORT_SYMBOL(cpu_sibling_map);
+EXPORT_SYMBOL(cpu_core_map);
 EXPORT_SYMBOL(smp_num_siblings);
 #endif
 
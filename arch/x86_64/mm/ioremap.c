@@ -248,30 +248,25 @@ void __iomem *ioremap_nocache (unsigned long phys_addr, unsigned long size)
 
 void iounmap(volatile void __iomem *addr)
 {
-	struct vm_struct *p, **pprev;
+	struct vm_struct *p;
 
 	if (addr <= high_memory) 
 		return; 
 
 	write_lock(&vmlist_lock);
-	for (p = vmlist, pprev = &vmlist; p != NULL; pprev = &p->next, p = *pprev)
-		if (p->addr == (void *)(PAGE_MASK & (unsigned long)addr))
-			break;
+	p = __remove_vm_area((void *)(PAGE_MASK & (unsigned long)addr));
+	write_unlock(&vmlist_lock);
 	if (!p) { 
 		printk("__iounmap: bad address %p\n", addr);
-		goto out_unlock;
+		return;
 	}
-	*pprev = p->next;
-	unmap_vm_area(p);
+	/* global_flush_tlb() takes vmlist_lock itself, so not under it */
 	if ((p->flags >> 20) &&
 		p->phys_addr + p->size - 1 < virt_to_phys(high_memory)) {
-		/* p->size includes the guard page, but cpa doesn't like that */
 		change_page_attr(virt_to_page(__va(p->phys_addr)),
 				 p->size >> PAGE_SHIFT,
 				 PAGE_KERNEL);
 		global_flush_tlb();
 	} 
-out_unlock:
-	write_unlock(&vmlist_lock);
 	kfree(p); 
 }
@@ -9,6 +9,7 @@
 #include <linux/highmem.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <asm/uaccess.h>
 #include <asm/processor.h>
 #include <asm/tlbflush.h>
@@ -217,6 +218,9 @@ void global_flush_tlb(void)
 { 
 	struct deferred_page *df, *next_df;
 
+	/* No stale vmalloc translations to the pages just changed */
+	vm_unmap_aliases();
+
 	down_read(&init_mm.mmap_sem);
 	df = xchg(&df_list, NULL);
 	up_read(&init_mm.mmap_sem);
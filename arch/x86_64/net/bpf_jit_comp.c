@@ -0,0 +1,557 @@
+/*
+ * linux/arch/x86_64/net/bpf_jit_comp.c
+ *
+ * Just-in-time compiler for socket filters.  A filter that has passed
+ * sk_chk_filter() is translated to x86_64 code when it is attached, and
+ * sk_filter_run() calls that code instead of interpreting the filter
+ * for every packet.  Filters using an instruction that isn't handled
+ * here are left to sk_run_filter().
+ *
+ * This file is released under the GPL.
+ */
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <asm/system.h>
+
+/* net.core.bpf_jit_enable: compile filters attached from now on */
+int bpf_jit_enable = 0;
+
+/*
+ * Register use of the generated code:
+ *
+ *	eax	A
+ *	ebx	X
+ *	r12	skb->data
+ *	r13d	bytes in the linear part, skb->len - skb->data_len
+ *	r14	the skb
+ *	ecx, edx, esi, edi	scratch
+ *
+ * rbx and r12-r14 are callee saved, so they survive the calls to
+ * bpf_load_slow().  The frame holds the BPF_MEMWORDS scratch words
+ * below rbp, followed by the four saved registers.
+ */
+#define MEM_DISP(k)	((u8) (-4 * (BPF_MEMWORDS - (int) (k))))
+#define JIT_FRAME_SIZE	(4 * BPF_MEMWORDS + 4 * 8)
+
+/*
+ * The image is vmalloc()ed, which can't be undone from interrupt
+ * context, where the last reference to a filter may be dropped.  The
+ * work_struct to defer that with lives in front of the code.
+ */
+struct bpf_jit_image {
+	struct work_struct	work;
+	u8			code[0];
+};
+
+struct jit_ctx {
+	u8		*image;		/* NULL while sizing the code */
+	unsigned int	pos;
+	unsigned int	*addrs;		/* offset of the code of each insn */
+	unsigned int	ret0;		/* offset of the "return 0" stub */
+	unsigned int	epilogue;
+};
+
+static void emit_bytes(struct jit_ctx *ctx, const u8 *bytes, unsigned int len)
+{
+	if (ctx->image)
+		memcpy(ctx->image + ctx->pos, bytes, len);
+	ctx->pos += len;
+}
+
+#define EMIT(ctx, ...)							\
+	do {								\
+		u8 __b[] = { __VA_ARGS__ };				\
+		emit_bytes(ctx, __b, sizeof(__b));			\
+	} while (0)
+
+static void emit_u32(struct jit_ctx *ctx, u32 val)
+{
+	emit_bytes(ctx, (u8 *) &val, sizeof(val));
+}
+
+static void emit_u64(struct jit_ctx *ctx, u64 val)
+{
+	emit_bytes(ctx, (u8 *) &val, sizeof(val));
+}
+
+/* rel32 of a jump or call to @target, the field ending the insn */
+static void emit_rel32(struct jit_ctx *ctx, unsigned int target)
+{
+	emit_u32(ctx, target - (ctx->pos + 4));
+}
+
+static void emit_jmp(struct jit_ctx *ctx, unsigned int target)
+{
+	EMIT(ctx, 0xe9);			/* jmp rel32 */
+	emit_rel32(ctx, target);
+}
+
+static void emit_jcc(struct jit_ctx *ctx, u8 cc, unsigned int target)
+{
+	EMIT(ctx, 0x0f, cc);			/* jcc rel32 */
+	emit_rel32(ctx, target);
+}
+
+#define JCC_JB	0x82
+#define JCC_JAE	0x83
+#define JCC_JE	0x84
+#define JCC_JNE	0x85
+#define JCC_JBE	0x86
+#define JCC_JA	0x87
+#define JCC_JS	0x88
+
+/* Same as load_pointer() in net/core/filter.c */
+static u8 *bpf_load_pointer(const struct sk_buff *skb, int k)
+{
+	u8 *ptr = NULL;
+
+	if (k >= SKF_NET_OFF)
+		ptr = skb->nh.raw + k - SKF_NET_OFF;
+	else if (k >= SKF_LL_OFF)
+		ptr = skb->mac.raw + k - SKF_LL_OFF;
+
+	if (ptr >= skb->head && ptr < skb->tail)
+		return ptr;
+	return NULL;
+}
+
+/*
+ * Called by the generated code for the loads it can't do from the
+ * linear part of the skb: data in the fragments, the negative offsets
+ * relative to the network or link layer header and the ancillary data.
+ * Returns the value loaded, or -1 if the filter has to return 0, like
+ * sk_run_filter() does.
+ */
+static long bpf_load_slow(const struct sk_buff *skb, int k, unsigned int size)
+{
+	u8 *ptr;
+	u32 tmp;
+
+	if (k >= 0) {
+		ptr = skb_header_pointer(skb, k, size, &tmp);
+	} else if (k >= SKF_AD_OFF) {
+		switch (k - SKF_AD_OFF) {
+		case SKF_AD_PROTOCOL:
+			return htons(skb->protocol);
+		case SKF_AD_PKTTYPE:
+			return skb->pkt_type;
+		case SKF_AD_IFINDEX:
+			return skb->dev->ifindex;
+		}
+		return -1;
+	} else {
+		ptr = bpf_load_pointer(skb, k);
+	}
+
+	if (!ptr)
+		return -1;
+
+	switch (size) {
+	case 4:
+		return ntohl(*(u32 *) ptr);
+	case 2:
+		return ntohs(*(u16 *) ptr);
+	}
+	return *ptr;
+}
+
+/* call bpf_load_slow(skb, esi, size), A = the result or return 0 */
+#define SLOW_LOAD_LEN	29
+
+static void emit_slow_load(struct jit_ctx *ctx, unsigned int size)
+{
+	EMIT(ctx, 0x4c, 0x89, 0xf7);		/* mov %r14,%rdi */
+	EMIT(ctx, 0xba);			/* mov $size,%edx */
+	emit_u32(ctx, size);
+	EMIT(ctx, 0x48, 0xb8);			/* mov $bpf_load_slow,%rax */
+	emit_u64(ctx, (unsigned long) bpf_load_slow);
+	EMIT(ctx, 0xff, 0xd0);			/* call *%rax */
+	EMIT(ctx, 0x48, 0x85, 0xc0);		/* test %rax,%rax */
+	emit_jcc(ctx, JCC_JS, ctx->ret0);
+}
+
+/*
+ * A = the @size bytes at offset k, or X + k for BPF_IND.  Offsets
+ * within the linear part are loaded inline, everything else goes
+ * through bpf_load_slow().
+ */
+static void emit_load(struct jit_ctx *ctx, unsigned int size, int ind, u32 k)
+{
+	unsigned int len;
+
+	if (ind) {
+		EMIT(ctx, 0x8d, 0xb3);		/* lea k(%rbx),%esi */
+		emit_u32(ctx, k);
+	} else {
+		EMIT(ctx, 0xbe);		/* mov $k,%esi */
+		emit_u32(ctx, k);
+		if ((int) k < 0) {
+			emit_slow_load(ctx, size);
+			return;
+		}
+	}
+
+	switch (size) {
+	case 4:
+		len = 6;
+		break;
+	case 2:
+		len = 9;
+		break;
+	default:
+		len = 5;
+		break;
+	}
+
+	/* negative offsets are huge unsigned and take the slow path */
+	EMIT(ctx, 0x44, 0x89, 0xe9);		/* mov %r13d,%ecx */
+	EMIT(ctx, 0x83, 0xe9, size);		/* sub $size,%ecx */
+	EMIT(ctx, 0x72, len + 6);		/* jb slow */
+	EMIT(ctx, 0x39, 0xce);			/* cmp %ecx,%esi */
+	EMIT(ctx, 0x77, len + 2);		/* ja slow */
+
+	switch (size) {
+	case 4:
+		EMIT(ctx, 0x41, 0x8b, 0x04, 0x34);	/* mov (%r12,%rsi),%eax */
+		EMIT(ctx, 0x0f, 0xc8);			/* bswap %eax */
+		break;
+	case 2:
+		EMIT(ctx, 0x41, 0x0f, 0xb7, 0x04, 0x34); /* movzwl (%r12,%rsi),%eax */
+		EMIT(ctx, 0x66, 0xc1, 0xc0, 0x08);	/* rol $8,%ax */
+		break;
+	default:
+		EMIT(ctx, 0x41, 0x0f, 0xb6, 0x04, 0x34); /* movzbl (%r12,%rsi),%eax */
+		break;
+	}
+
+	EMIT(ctx, 0xeb, SLOW_LOAD_LEN);		/* jmp done */
+	emit_slow_load(ctx, size);
+}
+
+/* jump to the insns @jt or @jf after @pc on the flags set by the caller */
+static void emit_cond_jmp(struct jit_ctx *ctx, int pc, struct sock_filter *f,
+			  u8 cc_true, u8 cc_false)
+{
+	if (f->jt)
+		emit_jcc(ctx, cc_true, ctx->addrs[pc + 1 + f->jt]);
+	if (f->jf) {
+		if (f->jt)
+			emit_jmp(ctx, ctx->addrs[pc + 1 + f->jf]);
+		else
+			emit_jcc(ctx, cc_false, ctx->addrs[pc + 1 + f->jf]);
+	}
+}
+
+/*
+ * Generate the code for @fp.  Every insn has the same size on every
+ * pass and all jumps are forward, so the first pass, with a NULL image,
+ * gives the offsets the second one needs.  Returns -EINVAL if the
+ * filter uses an insn this compiler doesn't know.
+ */
+static int bpf_jit_pass(struct jit_ctx *ctx, struct sk_filter *fp)
+{
+	struct sock_filter *f;
+	int pc;
+
+	ctx->pos = 0;
+
+	EMIT(ctx, 0x55);			/* push %rbp */
+	EMIT(ctx, 0x48, 0x89, 0xe5);		/* mov %rsp,%rbp */
+	EMIT(ctx, 0x48, 0x83, 0xec, JIT_FRAME_SIZE); /* sub $JIT_FRAME_SIZE,%rsp */
+	EMIT(ctx, 0x48, 0x89, 0x5d, 0xb8);	/* mov %rbx,-72(%rbp) */
+	EMIT(ctx, 0x4c, 0x89, 0x65, 0xb0);	/* mov %r12,-80(%rbp) */
+	EMIT(ctx, 0x4c, 0x89, 0x6d, 0xa8);	/* mov %r13,-88(%rbp) */
+	EMIT(ctx, 0x4c, 0x89, 0x75, 0xa0);	/* mov %r14,-96(%rbp) */
+	EMIT(ctx, 0x49, 0x89, 0xfe);		/* mov %rdi,%r14 */
+	EMIT(ctx, 0x44, 0x8b, 0xaf);		/* mov len(%rdi),%r13d */
+	emit_u32(ctx, offsetof(struct sk_buff, len));
+	EMIT(ctx, 0x44, 0x2b, 0xaf);		/* sub data_len(%rdi),%r13d */
+	emit_u32(ctx, offsetof(struct sk_buff, data_len));
+	EMIT(ctx, 0x4c, 0x8b, 0xa7);		/* mov data(%rdi),%r12 */
+	emit_u32(ctx, offsetof(struct sk_buff, data));
+	EMIT(ctx, 0x31, 0xc0);			/* xor %eax,%eax */
+	EMIT(ctx, 0x31, 0xdb);			/* xor %ebx,%ebx */
+
+	for (pc = 0; pc < fp->len; pc++) {
+		f = &fp->insns[pc];
+		ctx->addrs[pc] = ctx->pos;
+
+		switch (f->code) {
+		case BPF_ALU|BPF_ADD|BPF_X:
+			EMIT(ctx, 0x01, 0xd8);		/* add %ebx,%eax */
+			break;
+		case BPF_ALU|BPF_ADD|BPF_K:
+			EMIT(ctx, 0x05);		/* add $k,%eax */
+			emit_u32(ctx, f->k);
+			break;
+		case BPF_ALU|BPF_SUB|BPF_X:
+			EMIT(ctx, 0x29, 0xd8);		/* sub %ebx,%eax */
+			break;
+		case BPF_ALU|BPF_SUB|BPF_K:
+			EMIT(ctx, 0x2d);		/* sub $k,%eax */
+			emit_u32(ctx, f->k);
+			break;
+		case BPF_ALU|BPF_MUL|BPF_X:
+			EMIT(ctx, 0x0f, 0xaf, 0xc3);	/* imul %ebx,%eax */
+			break;
+		case BPF_ALU|BPF_MUL|BPF_K:
+			EMIT(ctx, 0x69, 0xc0);		/* imul $k,%eax,%eax */
+			emit_u32(ctx, f->k);
+			break;
+		case BPF_ALU|BPF_DIV|BPF_X:
+			EMIT(ctx, 0x85, 0xdb);		/* test %ebx,%ebx */
+			emit_jcc(ctx, JCC_JE, ctx->ret0);
+			EMIT(ctx, 0x31, 0xd2);		/* xor %edx,%edx */
+			EMIT(ctx, 0xf7, 0xf3);		/* div %ebx */
+			break;
+		case BPF_ALU|BPF_DIV|BPF_K:
+			if (!f->k) {
+				emit_jmp(ctx, ctx->ret0);
+				break;
+			}
+			EMIT(ctx, 0xb9);		/* mov $k,%ecx */
+			emit_u32(ctx, f->k);
+			EMIT(ctx, 0x31, 0xd2);		/* xor %edx,%edx */
+			EMIT(ctx, 0xf7, 0xf1);		/* div %ecx */
+			break;
+		case BPF_ALU|BPF_AND|BPF_X:
+			EMIT(ctx, 0x21, 0xd8);		/* and %ebx,%eax */
+			break;
+		case BPF_ALU|BPF_AND|BPF_K:
+			EMIT(ctx, 0x25);		/* and $k,%eax */
+			emit_u32(ctx, f->k);
+			break;
+		case BPF_ALU|BPF_OR|BPF_X:
+			EMIT(ctx, 0x09, 0xd8);		/* or %ebx,%eax */
+			break;
+		case BPF_ALU|BPF_OR|BPF_K:
+			EMIT(ctx, 0x0d);		/* or $k,%eax */
+			emit_u32(ctx, f->k);
+			break;
+		case BPF_ALU|BPF_LSH|BPF_X:
+			EMIT(ctx, 0x89, 0xd9);		/* mov %ebx,%ecx */
+			EMIT(ctx, 0xd3, 0xe0);		/* shl %cl,%eax */
+			break;
+		case BPF_ALU|BPF_LSH|BPF_K:
+			EMIT(ctx, 0xc1, 0xe0, f->k);	/* shl $k,%eax */
+			break;
+		case BPF_ALU|BPF_RSH|BPF_X:
+			EMIT(ctx, 0x89, 0xd9);		/* mov %ebx,%ecx */
+			EMIT(ctx, 0xd3, 0xe8);		/* shr %cl,%eax */
+			break;
+		case BPF_ALU|BPF_RSH|BPF_K:
+			EMIT(ctx, 0xc1, 0xe8, f->k);	/* shr $k,%eax */
+			break;
+		case BPF_ALU|BPF_NEG:
+			EMIT(ctx, 0xf7, 0xd8);		/* neg %eax */
+			break;
+		case BPF_JMP|BPF_JA:
+			if (f->k)
+				emit_jmp(ctx, ctx->addrs[pc + 1 + f->k]);
+			break;
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_K:
+		case BPF_JMP|BPF_JSET|BPF_K:
+		case BPF_JMP|BPF_JGT|BPF_X:
+		case BPF_JMP|BPF_JGE|BPF_X:
+		case BPF_JMP|BPF_JEQ|BPF_X:
+		case BPF_JMP|BPF_JSET|BPF_X:
+			if (f->jt == f->jf) {
+				if (f->jt)
+					emit_jmp(ctx, ctx->addrs[pc + 1 + f->jt]);
+				break;
+			}
+			if (BPF_OP(f->code) == BPF_JSET) {
+				if (BPF_SRC(f->code) == BPF_X)
+					EMIT(ctx, 0x85, 0xd8);	/* test %ebx,%eax */
+				else {
+					EMIT(ctx, 0xa9);	/* test $k,%eax */
+					emit_u32(ctx, f->k);
+				}
+			} else {
+				if (BPF_SRC(f->code) == BPF_X)
+					EMIT(ctx, 0x39, 0xd8);	/* cmp %ebx,%eax */
+				else {
+					EMIT(ctx, 0x3d);	/* cmp $k,%eax */
+					emit_u32(ctx, f->k);
+				}
+			}
+			switch (BPF_OP(f->code)) {
+			case BPF_JGT:
+				emit_cond_jmp(ctx, pc, f, JCC_JA, JCC_JBE);
+				break;
+			case BPF_JGE:
+				emit_cond_jmp(ctx, pc, f, JCC_JAE, JCC_JB);
+				break;
+			case BPF_JEQ:
+				emit_cond_jmp(ctx, pc, f, JCC_JE, JCC_JNE);
+				break;
+			default:
+				emit_cond_jmp(ctx, pc, f, JCC_JNE, JCC_JE);
+				break;
+			}
+			break;
+		case BPF_LD|BPF_W|BPF_ABS:
+			emit_load(ctx, 4, 0, f->k);
+			break;
+		case BPF_LD|BPF_H|BPF_ABS:
+			emit_load(ctx, 2, 0, f->k);
+			break;
+		case BPF_LD|BPF_B|BPF_ABS:
+			emit_load(ctx, 1, 0, f->k);
+			break;
+		case BPF_LD|BPF_W|BPF_IND:
+			emit_load(ctx, 4, 1, f->k);
+			break;
+		case BPF_LD|BPF_H|BPF_IND:
+			emit_load(ctx, 2, 1, f->k);
+			break;
+		case BPF_LD|BPF_B|BPF_IND:
+			emit_load(ctx, 1, 1, f->k);
+			break;
+		case BPF_LD|BPF_W|BPF_LEN:
+			EMIT(ctx, 0x44, 0x89, 0xe8);	/* mov %r13d,%eax */
+			break;
+		case BPF_LDX|BPF_W|BPF_LEN:
+			EMIT(ctx, 0x44, 0x89, 0xeb);	/* mov %r13d,%ebx */
+			break;
+		case BPF_LDX|BPF_B|BPF_MSH:
+			EMIT(ctx, 0x41, 0x81, 0xfd);	/* cmp $k,%r13d */
+			emit_u32(ctx, f->k);
+			emit_jcc(ctx, JCC_JBE, ctx->ret0);
+			/* movzbl k(%r12),%ebx */
+			EMIT(ctx, 0x41, 0x0f, 0xb6, 0x9c, 0x24);
+			emit_u32(ctx, f->k);
+			EMIT(ctx, 0x83, 0xe3, 0x0f);	/* and $0xf,%ebx */
+			EMIT(ctx, 0xc1, 0xe3, 0x02);	/* shl $2,%ebx */
+			break;
+		case BPF_LD|BPF_IMM:
+			EMIT(ctx, 0xb8);		/* mov $k,%eax */
+			emit_u32(ctx, f->k);
+			break;
+		case BPF_LDX|BPF_IMM:
+			EMIT(ctx, 0xbb);		/* mov $k,%ebx */
+			emit_u32(ctx, f->k);
+			break;
+		case BPF_LD|BPF_MEM:
+			EMIT(ctx, 0x8b, 0x45, MEM_DISP(f->k));	/* mov mem,%eax */
+			break;
+		case BPF_LDX|BPF_MEM:
+			EMIT(ctx, 0x8b, 0x5d, MEM_DISP(f->k));	/* mov mem,%ebx */
+			break;
+		case BPF_ST:
+			EMIT(ctx, 0x89, 0x45, MEM_DISP(f->k));	/* mov %eax,mem */
+			break;
+		case BPF_STX:
+			EMIT(ctx, 0x89, 0x5d, MEM_DISP(f->k));	/* mov %ebx,mem */
+			break;
+		case BPF_MISC|BPF_TAX:
+			EMIT(ctx, 0x89, 0xc3);		/* mov %eax,%ebx */
+			break;
+		case BPF_MISC|BPF_TXA:
+			EMIT(ctx, 0x89, 0xd8);		/* mov %ebx,%eax */
+			break;
+		case BPF_RET|BPF_K:
+			EMIT(ctx, 0xb8);		/* mov $k,%eax */
+			emit_u32(ctx, f->k);
+			emit_jmp(ctx, ctx->epilogue);
+			break;
+		case BPF_RET|BPF_A:
+			emit_jmp(ctx, ctx->epilogue);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	/* sk_chk_filter() made sure we never get past the last RET */
+	ctx->ret0 = ctx->pos;
+	EMIT(ctx, 0x31, 0xc0);			/* xor %eax,%eax */
+
+	ctx->epilogue = ctx->pos;
+	EMIT(ctx, 0x48, 0x8b, 0x5d, 0xb8);	/* mov -72(%rbp),%rbx */
+	EMIT(ctx, 0x4c, 0x8b, 0x65, 0xb0);	/* mov -80(%rbp),%r12 */
+	EMIT(ctx, 0x4c, 0x8b, 0x6d, 0xa8);	/* mov -88(%rbp),%r13 */
+	EMIT(ctx, 0x4c, 0x8b, 0x75, 0xa0);	/* mov -96(%rbp),%r14 */
+	EMIT(ctx, 0xc9);			/* leave */
+	EMIT(ctx, 0xc3);			/* ret */
+
+	return 0;
+}
+
+/**
+ *	bpf_jit_compile - translate a socket filter to native code
+ *	@fp: a filter that passed sk_chk_filter()
+ *
+ * Sets fp->bpf_func on success.  Any failure just leaves the filter
+ * to the interpreter.
+ */
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	struct bpf_jit_image *img;
+	struct jit_ctx ctx;
+	unsigned int proglen;
+
+	if (!bpf_jit_enable)
+		return;
+
+	ctx.addrs = kmalloc(fp->len * sizeof(*ctx.addrs), GFP_KERNEL);
+	if (!ctx.addrs)
+		return;
+
+	ctx.image = NULL;
+	ctx.ret0 = 0;
+	ctx.epilogue = 0;
+	if (bpf_jit_pass(&ctx, fp))
+		goto out;
+	proglen = ctx.pos;
+
+	img = vmalloc_exec(sizeof(*img) + proglen);
+	if (!img)
+		goto out;
+
+	ctx.image = img->code;
+	bpf_jit_pass(&ctx, fp);
+	BUG_ON(ctx.pos != proglen);
+
+	fp->bpf_func = (void *) img->code;
+out:
+	kfree(ctx.addrs);
+}
+
+static void bpf_jit_free_work(void *data)
+{
+	vfree(data);
+}
+
+/**
+ *	bpf_jit_free - release the native code of a socket filter
+ *	@fp: filter whose last reference is gone
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	struct bpf_jit_image *img;
+
+	if (!fp->bpf_func)
+		return;
+
+	img = (struct bpf_jit_image *)
+		((u8 *) fp->bpf_func - offsetof(struct bpf_jit_image, code));
+	fp->bpf_func = NULL;
+
+	if (in_interrupt() || irqs_disabled()) {
+		INIT_WORK(&img->work, bpf_jit_free_work, img);
+		schedule_work(&img->work);
+	} else
+		vfree(img);
+}
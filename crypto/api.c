@@ -33,7 +33,12 @@ static inline void crypto_alg_put(struct crypto_alg *alg)
 	module_put(alg->cra_module);
 }
 
-struct crypto_alg *crypto_alg_lookup(const char *name)
+/*
+ * An exact match on the driver name wins; otherwise the implementation
+ * of that name with the highest priority.  Asynchronous-only algorithms
+ * are left out unless the transform can take them.
+ */
+struct crypto_alg *crypto_alg_lookup(const char *name, u32 flags)
 {
 	struct crypto_alg *q, *alg = NULL;
 
@@ -43,11 +48,25 @@ struct crypto_alg *crypto_alg_lookup(const char *name)
 	down_read(&crypto_alg_sem);
 	
 	list_for_each_entry(q, &crypto_alg_list, cra_list) {
-		if (!(strcmp(q->cra_name, name))) {
-			if (crypto_alg_get(q))
-				alg = q;
+		int exact;
+
+		if ((q->cra_flags & CRYPTO_ALG_ASYNC) &&
+		    !(flags & CRYPTO_TFM_REQ_MAY_ASYNC))
+			continue;
+
+		exact = !strcmp(q->cra_driver_name, name);
+		if (!exact && strcmp(q->cra_name, name))
+			continue;
+		if (!exact && alg && q->cra_priority <= alg->cra_priority)
+			continue;
+		if (!crypto_alg_get(q))
+			continue;
+
+		if (alg)
+			crypto_alg_put(alg);
+		alg = q;
+		if (exact)
 			break;
-		}
 	}
 	
 	up_read(&crypto_alg_sem);
@@ -122,7 +141,7 @@ struct crypto_tfm *crypto_alloc_tfm(const char *name, u32 flags)
 	struct crypto_tfm *tfm = NULL;
 	struct crypto_alg *alg;
 
-	alg = crypto_alg_mod_lookup(name);
+	alg = crypto_alg_mod_lookup(name, flags);
 	if (alg == NULL)
 		goto out;
 	
@@ -169,10 +188,14 @@ int crypto_register_alg(struct crypto_alg *alg)
 	int ret = 0;
 	struct crypto_alg *q;
 	
+	if (!alg->cra_driver_name[0])
+		strlcpy(alg->cra_driver_name, alg->cra_name,
+			sizeof(alg->cra_driver_name));
+
 	down_write(&crypto_alg_sem);
 	
 	list_for_each_entry(q, &crypto_alg_list, cra_list) {
-		if (!(strcmp(q->cra_name, alg->cra_name))) {
+		if (!(strcmp(q->cra_driver_name, alg->cra_driver_name))) {
 			ret = -EEXIST;
 			goto out;
 		}
@@ -207,7 +230,7 @@ out:
 int crypto_alg_available(const char *name, u32 flags)
 {
 	int ret = 0;
-	struct crypto_alg *alg = crypto_alg_mod_lookup(name);
+	struct crypto_alg *alg = crypto_alg_mod_lookup(name, flags);
 	
 	if (alg) {
 		crypto_alg_put(alg);
@@ -16,6 +16,7 @@
 #include <linux/errno.h>
 #include <linux/mm.h>
 #include <linux/slab.h>
+#include <linux/completion.h>
 #include <asm/scatterlist.h>
 #include "internal.h"
 #include "scatterwalk.h"
@@ -213,13 +214,108 @@ static int nocrypt_iv(struct crypto_tfm *tfm,
 	return -ENOSYS;
 }
 
+/*
+ * Requests on software algorithms are done there and then.
+ */
+static int sync_submit(struct cipher_request *req)
+{
+	struct crypto_tfm *tfm = req->tfm;
+	struct cipher_tfm *ops = &tfm->crt_cipher;
+	int iv = req->iv && ops->cit_mode != CRYPTO_TFM_MODE_ECB;
+
+	if (req->dir == CRYPTO_DIR_ENCRYPT)
+		return iv ? ops->cit_encrypt_iv(tfm, req->dst, req->src,
+		                                req->nbytes, req->iv)
+		          : ops->cit_encrypt(tfm, req->dst, req->src,
+		                             req->nbytes);
+	return iv ? ops->cit_decrypt_iv(tfm, req->dst, req->src,
+	                                req->nbytes, req->iv)
+	          : ops->cit_decrypt(tfm, req->dst, req->src, req->nbytes);
+}
+
+static int async_submit(struct cipher_request *req)
+{
+	struct crypto_tfm *tfm = req->tfm;
+
+	return tfm->__crt_alg->cra_cipher.cia_submit(crypto_tfm_ctx(tfm), req);
+}
+
+/*
+ * Synchronous calls on algorithms with CRYPTO_ALG_ASYNC submit the
+ * request and sleep until it is done.
+ */
+struct async_wait {
+	struct completion done;
+	int err;
+};
+
+static void async_wait_done(struct cipher_request *req, int err)
+{
+	struct async_wait *wait = req->data;
+
+	wait->err = err;
+	complete(&wait->done);
+}
+
+static int async_crypt(struct crypto_tfm *tfm, struct scatterlist *dst,
+                       struct scatterlist *src, unsigned int nbytes,
+                       u8 *iv, int dir)
+{
+	struct cipher_request req;
+	struct async_wait wait;
+	int err;
+
+	might_sleep();
+
+	init_completion(&wait.done);
+	cipher_request_init(&req, tfm, CRYPTO_REQ_MAY_BACKLOG,
+	                    async_wait_done, &wait);
+	cipher_request_set_crypt(&req, dst, src, nbytes, iv);
+	req.dir = dir;
+
+	err = async_submit(&req);
+	if (err == -EINPROGRESS || err == -EBUSY) {
+		wait_for_completion(&wait.done);
+		err = wait.err;
+	}
+	return err;
+}
+
+static int async_encrypt(struct crypto_tfm *tfm, struct scatterlist *dst,
+                         struct scatterlist *src, unsigned int nbytes)
+{
+	return async_crypt(tfm, dst, src, nbytes, tfm->crt_cipher.cit_iv,
+	                   CRYPTO_DIR_ENCRYPT);
+}
+
+static int async_encrypt_iv(struct crypto_tfm *tfm, struct scatterlist *dst,
+                            struct scatterlist *src, unsigned int nbytes,
+                            u8 *iv)
+{
+	return async_crypt(tfm, dst, src, nbytes, iv, CRYPTO_DIR_ENCRYPT);
+}
+
+static int async_decrypt(struct crypto_tfm *tfm, struct scatterlist *dst,
+                         struct scatterlist *src, unsigned int nbytes)
+{
+	return async_crypt(tfm, dst, src, nbytes, tfm->crt_cipher.cit_iv,
+	                   CRYPTO_DIR_DECRYPT);
+}
+
+static int async_decrypt_iv(struct crypto_tfm *tfm, struct scatterlist *dst,
+                            struct scatterlist *src, unsigned int nbytes,
+                            u8 *iv)
+{
+	return async_crypt(tfm, dst, src, nbytes, iv, CRYPTO_DIR_DECRYPT);
+}
+
 int crypto_init_cipher_flags(struct crypto_tfm *tfm, u32 flags)
 {
 	u32 mode = flags & CRYPTO_TFM_MODE_MASK;
 	
 	tfm->crt_cipher.cit_mode = mode ? mode : CRYPTO_TFM_MODE_ECB;
-	if (flags & CRYPTO_TFM_REQ_WEAK_KEY)
-		tfm->crt_flags = CRYPTO_TFM_REQ_WEAK_KEY;
+	tfm->crt_flags = flags & (CRYPTO_TFM_REQ_WEAK_KEY |
+	                          CRYPTO_TFM_REQ_MAY_ASYNC);
 	
 	return 0;
 }
@@ -231,6 +327,12 @@ int crypto_init_cipher_ops(struct crypto_tfm *tfm)
 
 	ops->cit_setkey = setkey;
 
+	if (tfm->__crt_alg->cra_cipher.cia_submit &&
+	    (tfm->crt_flags & CRYPTO_TFM_REQ_MAY_ASYNC))
+		ops->cit_submit = async_submit;
+	else
+		ops->cit_submit = sync_submit;
+
 	switch (tfm->crt_cipher.cit_mode) {
 	case CRYPTO_TFM_MODE_ECB:
 		ops->cit_encrypt = ecb_encrypt;
@@ -261,6 +363,18 @@ int crypto_init_cipher_ops(struct crypto_tfm *tfm)
 	default:
 		BUG();
 	}
+
+	if (tfm->__crt_alg->cra_flags & CRYPTO_ALG_ASYNC) {
+		if (ops->cit_mode == CRYPTO_TFM_MODE_ECB) {
+			ops->cit_encrypt = async_encrypt;
+			ops->cit_decrypt = async_decrypt;
+		} else if (ops->cit_mode == CRYPTO_TFM_MODE_CBC) {
+			ops->cit_encrypt = async_encrypt;
+			ops->cit_decrypt = async_decrypt;
+			ops->cit_encrypt_iv = async_encrypt_iv;
+			ops->cit_decrypt_iv = async_decrypt_iv;
+		}
+	}
 	
 	if (ops->cit_mode == CRYPTO_TFM_MODE_CBC) {
 	    	
@@ -76,6 +76,7 @@ static void chksum_final(void *ctx, u8 *out)
 
 static struct crypto_alg alg = {
 	.cra_name	=	"crc32c",
+	.cra_driver_name =	"crc32c-generic",
 	.cra_flags	=	CRYPTO_ALG_TYPE_DIGEST,
 	.cra_blocksize	=	CHKSUM_BLOCK_SIZE,
 	.cra_ctxsize	=	sizeof(struct chksum_ctx),
@@ -108,3 +109,4 @@ module_exit(fini);
 MODULE_AUTHOR("Clay Haapala <chaapala@cisco.com>");
 MODULE_DESCRIPTION("CRC32c (Castagnoli) calculations wrapper for lib/crc32c");
 MODULE_LICENSE("GPL");
+MODULE_ALIAS("crc32c-generic");
@@ -47,13 +47,14 @@ static inline void *crypto_tfm_ctx(struct crypto_tfm *tfm)
 	return (void *)&tfm[1];
 }
 
-struct crypto_alg *crypto_alg_lookup(const char *name);
+struct crypto_alg *crypto_alg_lookup(const char *name, u32 flags);
 
-/* A far more intelligent version of this is planned.  For now, just
- * try an exact match on the name of the algorithm. */
-static inline struct crypto_alg *crypto_alg_mod_lookup(const char *name)
+/* Look for the algorithm by name or driver name, loading the module of
+ * that name if there is no such algorithm yet. */
+static inline struct crypto_alg *crypto_alg_mod_lookup(const char *name,
+						       u32 flags)
 {
-	return try_then_request_module(crypto_alg_lookup(name), name);
+	return try_then_request_module(crypto_alg_lookup(name, flags), name);
 }
 
 #ifdef CONFIG_CRYPTO_HMAC
@@ -0,0 +1,99 @@
+/*
+ * Cryptographic API.
+ *
+ * LZO1X compression, as lib/lzo, for users that want speed more than
+ * ratio.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/crypto.h>
+#include <linux/vmalloc.h>
+#include <linux/lzo.h>
+
+struct lzo_ctx {
+	void *lzo_comp_mem;
+};
+
+static int lzo_init(void *ctx)
+{
+	struct lzo_ctx *lctx = ctx;
+
+	lctx->lzo_comp_mem = vmalloc(LZO1X_MEM_COMPRESS);
+	if (!lctx->lzo_comp_mem)
+		return -ENOMEM;
+	return 0;
+}
+
+static void lzo_exit(void *ctx)
+{
+	struct lzo_ctx *lctx = ctx;
+
+	vfree(lctx->lzo_comp_mem);
+}
+
+static int lzo_compress(void *ctx, const u8 *src, unsigned int slen,
+			u8 *dst, unsigned int *dlen)
+{
+	struct lzo_ctx *lctx = ctx;
+	size_t tmp_len = *dlen;
+	int err;
+
+	/* lzo1x_1_compress() does not check the room it is given */
+	if (*dlen < lzo1x_worst_compress(slen))
+		return -EINVAL;
+
+	err = lzo1x_1_compress(src, slen, dst, &tmp_len, lctx->lzo_comp_mem);
+	if (err != LZO_E_OK)
+		return -EINVAL;
+
+	*dlen = tmp_len;
+	return 0;
+}
+
+static int lzo_decompress(void *ctx, const u8 *src, unsigned int slen,
+			  u8 *dst, unsigned int *dlen)
+{
+	size_t tmp_len = *dlen;
+	int err;
+
+	err = lzo1x_decompress_safe(src, slen, dst, &tmp_len);
+	if (err != LZO_E_OK)
+		return -EINVAL;
+
+	*dlen = tmp_len;
+	return 0;
+}
+
+static struct crypto_alg alg = {
+	.cra_name		= "lzo",
+	.cra_flags		= CRYPTO_ALG_TYPE_COMPRESS,
+	.cra_ctxsize		= sizeof(struct lzo_ctx),
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(alg.cra_list),
+	.cra_u			= { .compress = {
+	.coa_init		= lzo_init,
+	.coa_exit		= lzo_exit,
+	.coa_compress		= lzo_compress,
+	.coa_decompress		= lzo_decompress } }
+};
+
+static int __init init(void)
+{
+	return crypto_register_alg(&alg);
+}
+
+static void __exit fini(void)
+{
+	crypto_unregister_alg(&alg);
+}
+
+module_init(init);
+module_exit(fini);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZO Compression Algorithm");
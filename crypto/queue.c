@@ -0,0 +1,55 @@
+/*
+ * Cryptographic API.
+ *
+ * Request queues for the drivers of asynchronous algorithms.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option) 
+ * any later version.
+ *
+ */
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <linux/errno.h>
+#include <linux/list.h>
+
+void crypto_init_queue(struct crypto_queue *queue, unsigned int max_qlen)
+{
+	INIT_LIST_HEAD(&queue->list);
+	queue->qlen = 0;
+	queue->max_qlen = max_qlen;
+}
+
+int crypto_enqueue_request(struct crypto_queue *queue,
+			   struct cipher_request *req)
+{
+	int err = -EINPROGRESS;
+
+	if (unlikely(queue->qlen >= queue->max_qlen)) {
+		err = -EBUSY;
+		if (!(req->flags & CRYPTO_REQ_MAY_BACKLOG))
+			return err;
+	}
+
+	queue->qlen++;
+	list_add_tail(&req->list, &queue->list);
+	return err;
+}
+
+struct cipher_request *crypto_dequeue_request(struct crypto_queue *queue)
+{
+	struct cipher_request *req;
+
+	if (list_empty(&queue->list))
+		return NULL;
+
+	req = list_entry(queue->list.next, struct cipher_request, list);
+	list_del(&req->list);
+	queue->qlen--;
+	return req;
+}
+
+EXPORT_SYMBOL_GPL(crypto_init_queue);
+EXPORT_SYMBOL_GPL(crypto_enqueue_request);
+EXPORT_SYMBOL_GPL(crypto_dequeue_request);
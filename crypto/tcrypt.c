@@ -25,6 +25,8 @@
 #include <linux/crypto.h>
 #include <linux/highmem.h>
 #include <linux/moduleparam.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
 #include "tcrypt.h"
 
 /*
@@ -56,13 +58,14 @@
 static unsigned int IDX[8] = { IDX1, IDX2, IDX3, IDX4, IDX5, IDX6, IDX7, IDX8 };
 
 static int mode;
+static unsigned int sec = 1;
 static char *xbuf;
 static char *tvmem;
 
 static char *check[] = {
 	"des", "md5", "des3_ede", "rot13", "sha1", "sha256", "blowfish",
 	"twofish", "serpent", "sha384", "sha512", "md4", "aes", "cast6", 
-	"arc4", "michael_mic", "deflate", "crc32c", "tea", "xtea", 
+	"arc4", "michael_mic", "deflate", "lzo", "crc32c", "tea", "xtea", 
 	"khazad", "wp512", "wp384", "wp256", "tnepres", NULL
 };
 
@@ -418,7 +421,8 @@ out:
 }
 
 static void
-test_deflate(void)
+test_comp(char *algo, struct comp_testvec *ctemplate,
+	  struct comp_testvec *dtemplate, int ctcount, int dtcount)
 {
 	unsigned int i;
 	char result[COMP_BUF_SIZE];
@@ -426,25 +430,25 @@ test_deflate(void)
 	struct comp_testvec *tv;
 	unsigned int tsize;
 
-	printk("\ntesting deflate compression\n");
+	printk("\ntesting %s compression\n", algo);
 
-	tsize = sizeof (deflate_comp_tv_template);
+	tsize = sizeof (struct comp_testvec) * ctcount;
 	if (tsize > TVMEMSIZE) {
 		printk("template (%u) too big for tvmem (%u)\n", tsize,
 		       TVMEMSIZE);
 		return;
 	}
 
-	memcpy(tvmem, deflate_comp_tv_template, tsize);
+	memcpy(tvmem, ctemplate, tsize);
 	tv = (void *) tvmem;
 
-	tfm = crypto_alloc_tfm("deflate", 0);
+	tfm = crypto_alloc_tfm(algo, 0);
 	if (tfm == NULL) {
-		printk("failed to load transform for deflate\n");
+		printk("failed to load transform for %s\n", algo);
 		return;
 	}
 
-	for (i = 0; i < DEFLATE_COMP_TEST_VECTORS; i++) {
+	for (i = 0; i < ctcount; i++) {
 		int ilen, ret, dlen = COMP_BUF_SIZE;
 		
 		printk("test %u:\n", i + 1);
@@ -463,19 +467,19 @@ test_deflate(void)
 		       ilen, dlen);
 	}
 
-	printk("\ntesting deflate decompression\n");
+	printk("\ntesting %s decompression\n", algo);
 
-	tsize = sizeof (deflate_decomp_tv_template);
+	tsize = sizeof (struct comp_testvec) * dtcount;
 	if (tsize > TVMEMSIZE) {
 		printk("template (%u) too big for tvmem (%u)\n", tsize,
 		       TVMEMSIZE);
 		goto out;
 	}
 
-	memcpy(tvmem, deflate_decomp_tv_template, tsize);
+	memcpy(tvmem, dtemplate, tsize);
 	tv = (void *) tvmem;
 
-	for (i = 0; i < DEFLATE_DECOMP_TEST_VECTORS; i++) {
+	for (i = 0; i < dtcount; i++) {
 		int ilen, ret, dlen = COMP_BUF_SIZE;
 		
 		printk("test %u:\n", i + 1);
@@ -598,6 +602,103 @@ test_crc32c(void)
 	printk("crc32c test complete\n");
 }
 
+/*
+ * Speed tests: as many operations on buffers of each size as fit in
+ * sec seconds.  algo may be a driver name, to compare implementations.
+ */
+static unsigned int speed_sizes[] = { 16, 64, 256, 1024, 8192, 0 };
+
+static void
+test_cipher_speed(char *algo, int mode, int enc, unsigned int klen)
+{
+	struct crypto_tfm *tfm;
+	struct scatterlist sg[1];
+	unsigned long start, end;
+	unsigned int i, ops;
+	char key[32];
+
+	if (mode)
+		tfm = crypto_alloc_tfm(algo, 0);
+	else
+		tfm = crypto_alloc_tfm(algo, CRYPTO_TFM_MODE_CBC);
+	if (tfm == NULL) {
+		printk("failed to load transform for %s\n", algo);
+		return;
+	}
+
+	printk("\ntesting speed of %s (%s) %s %s, %u bit key\n", algo,
+	       crypto_tfm_alg_driver_name(tfm), mode == MODE_ECB ? "ECB" : "CBC",
+	       enc == ENCRYPT ? "encryption" : "decryption", klen * 8);
+
+	memset(key, 0xff, sizeof(key));
+	if (crypto_cipher_setkey(tfm, key, klen)) {
+		printk("setkey() failed flags=%x\n", tfm->crt_flags);
+		goto out;
+	}
+	if (!mode)
+		crypto_cipher_set_iv(tfm, key, crypto_tfm_alg_ivsize(tfm));
+
+	memset(xbuf, 0xff, XBUFSIZE);
+	for (i = 0; speed_sizes[i]; i++) {
+		sg[0].page = virt_to_page(xbuf);
+		sg[0].offset = offset_in_page(xbuf);
+		sg[0].length = speed_sizes[i];
+
+		start = jiffies;
+		end = start + sec * HZ;
+		for (ops = 0; time_before(jiffies, end); ops++) {
+			if (enc == ENCRYPT)
+				crypto_cipher_encrypt(tfm, sg, sg, sg[0].length);
+			else
+				crypto_cipher_decrypt(tfm, sg, sg, sg[0].length);
+			cond_resched();
+		}
+		printk("%5u byte blocks: %u operations in %u seconds "
+		       "(%lu bytes)\n", speed_sizes[i], ops, sec,
+		       (unsigned long)ops * speed_sizes[i]);
+	}
+out:
+	crypto_free_tfm(tfm);
+}
+
+static void
+test_hash_speed(char *algo)
+{
+	struct crypto_tfm *tfm;
+	struct scatterlist sg[1];
+	unsigned long start, end;
+	unsigned int i, ops;
+	char result[64];
+
+	tfm = crypto_alloc_tfm(algo, 0);
+	if (tfm == NULL) {
+		printk("failed to load transform for %s\n", algo);
+		return;
+	}
+
+	printk("\ntesting speed of %s (%s)\n", algo,
+	       crypto_tfm_alg_driver_name(tfm));
+
+	memset(xbuf, 0xff, XBUFSIZE);
+	for (i = 0; speed_sizes[i]; i++) {
+		sg[0].page = virt_to_page(xbuf);
+		sg[0].offset = offset_in_page(xbuf);
+		sg[0].length = speed_sizes[i];
+
+		start = jiffies;
+		end = start + sec * HZ;
+		for (ops = 0; time_before(jiffies, end); ops++) {
+			crypto_digest_digest(tfm, sg, 1, result);
+			cond_resched();
+		}
+		printk("%5u byte blocks: %u operations in %u seconds "
+		       "(%lu bytes)\n", speed_sizes[i], ops, sec,
+		       (unsigned long)ops * speed_sizes[i]);
+	}
+
+	crypto_free_tfm(tfm);
+}
+
 static void
 test_available(void)
 {
@@ -698,7 +799,11 @@ do_test(void)
 		test_hash("tgr192", tgr192_tv_template, TGR192_TEST_VECTORS);
 		test_hash("tgr160", tgr160_tv_template, TGR160_TEST_VECTORS);
 		test_hash("tgr128", tgr128_tv_template, TGR128_TEST_VECTORS);
-		test_deflate();
+		test_comp("deflate", deflate_comp_tv_template,
+			  deflate_decomp_tv_template, DEFLATE_COMP_TEST_VECTORS,
+			  DEFLATE_DECOMP_TEST_VECTORS);
+		test_comp("lzo", lzo_comp_tv_template, lzo_decomp_tv_template,
+			  LZO_COMP_TEST_VECTORS, LZO_DECOMP_TEST_VECTORS);
 		test_crc32c();
 #ifdef CONFIG_CRYPTO_HMAC
 		test_hmac("md5", hmac_md5_tv_template, HMAC_MD5_TEST_VECTORS);
@@ -770,7 +875,9 @@ do_test(void)
 		break;
 
 	case 13:
-		test_deflate();
+		test_comp("deflate", deflate_comp_tv_template,
+			  deflate_decomp_tv_template, DEFLATE_COMP_TEST_VECTORS,
+			  DEFLATE_DECOMP_TEST_VECTORS);
 		break;
 
 	case 14:
@@ -848,6 +955,11 @@ do_test(void)
 		test_hash("tgr128", tgr128_tv_template, TGR128_TEST_VECTORS);
 		break;
 
+	case 30:
+		test_comp("lzo", lzo_comp_tv_template, lzo_decomp_tv_template,
+			  LZO_COMP_TEST_VECTORS, LZO_DECOMP_TEST_VECTORS);
+		break;
+
 #ifdef CONFIG_CRYPTO_HMAC
 	case 100:
 		test_hmac("md5", hmac_md5_tv_template, HMAC_MD5_TEST_VECTORS);
@@ -863,6 +975,32 @@ do_test(void)
 
 #endif
 
+	/* The generic implementation against the preferred one */
+	case 200:
+		test_cipher_speed("aes-generic", MODE_ECB, ENCRYPT, 16);
+		test_cipher_speed("aes", MODE_ECB, ENCRYPT, 16);
+		test_cipher_speed("aes-generic", MODE_ECB, DECRYPT, 16);
+		test_cipher_speed("aes", MODE_ECB, DECRYPT, 16);
+		test_cipher_speed("aes-generic", MODE_CBC, ENCRYPT, 16);
+		test_cipher_speed("aes", MODE_CBC, ENCRYPT, 16);
+		test_cipher_speed("aes-generic", MODE_CBC, ENCRYPT, 32);
+		test_cipher_speed("aes", MODE_CBC, ENCRYPT, 32);
+		test_cipher_speed("aes-generic", MODE_CBC, DECRYPT, 32);
+		test_cipher_speed("aes", MODE_CBC, DECRYPT, 32);
+		break;
+
+	case 201:
+		test_hash_speed("sha1-generic");
+		test_hash_speed("sha1");
+		test_hash_speed("sha256-generic");
+		test_hash_speed("sha256");
+		break;
+
+	case 202:
+		test_hash_speed("crc32c-generic");
+		test_hash_speed("crc32c");
+		break;
+
 	case 1000:
 		test_available();
 		break;
@@ -904,6 +1042,8 @@ module_init(init);
 module_exit(fini);
 
 module_param(mode, int, 0);
+module_param(sec, uint, 0);
+MODULE_PARM_DESC(sec, "Length in seconds of each speed test (modes 200-202)");
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Quick & dirty crypto testing module");
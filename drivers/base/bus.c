@@ -14,6 +14,8 @@
 #include <linux/errno.h>
 #include <linux/init.h>
 #include <linux/string.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
 #include "base.h"
 #include "power/power.h"
 
@@ -300,6 +302,118 @@ int driver_probe_device(struct device_driver * drv, struct device * dev)
 }
 
 
+/*
+ * Probes of drivers with multithread_probe set, made while booting, run
+ * each in a thread of its own, so that slow buses probe concurrently.
+ * The device is claimed by setting dev->driver before the thread starts,
+ * and bound, or given up, after the probe under the bus's rwsem, which
+ * the probe itself runs without.
+ */
+struct async_probe {
+	struct list_head	list;
+	struct device		* dev;
+	struct device_driver	* drv;
+};
+
+static LIST_HEAD(async_probes);
+static DEFINE_SPINLOCK(async_probe_lock);
+static DECLARE_WAIT_QUEUE_HEAD(async_probe_wait);
+
+static int async_probe_thread(void * data)
+{
+	struct async_probe * ap = data;
+	struct device * dev = ap->dev;
+	struct device_driver * drv = ap->drv;
+	int error;
+
+	error = drv->probe(dev);
+
+	down_write(&drv->bus->subsys.rwsem);
+	if (error) {
+		dev->driver = NULL;
+		if (error != -ENODEV && error != -ENXIO)
+			printk(KERN_WARNING
+			    "%s: probe of %s failed with error %d\n",
+			    drv->name, dev->bus_id, error);
+	} else
+		device_bind_driver(dev);
+	up_write(&drv->bus->subsys.rwsem);
+
+	spin_lock(&async_probe_lock);
+	list_del(&ap->list);
+	spin_unlock(&async_probe_lock);
+	wake_up_all(&async_probe_wait);
+
+	put_driver(drv);
+	put_device(dev);
+	kfree(ap);
+	return 0;
+}
+
+/* Is a probe of dev, or by drv, or any at all if both are NULL, running? */
+static int async_probe_pending(struct device * dev, struct device_driver * drv)
+{
+	struct async_probe * ap;
+	int ret = 0;
+
+	spin_lock(&async_probe_lock);
+	list_for_each_entry(ap, &async_probes, list) {
+		if ((!dev || ap->dev == dev) && (!drv || ap->drv == drv)) {
+			ret = 1;
+			break;
+		}
+	}
+	spin_unlock(&async_probe_lock);
+	return ret;
+}
+
+/**
+ *	wait_for_device_probe - wait for the probes started at boot to finish.
+ *
+ *	Called before the root filesystem is mounted.
+ */
+void wait_for_device_probe(void)
+{
+	wait_event(async_probe_wait, !async_probe_pending(NULL, NULL));
+}
+
+/*
+ * Start @drv's probe of @dev in a thread.  Returns the error of the bus
+ * match, or of a probe that was done synchronously after all.
+ */
+static int driver_probe_device_async(struct device_driver * drv,
+				     struct device * dev)
+{
+	struct async_probe * ap;
+	struct task_struct * p;
+
+	if (drv->bus->match && !drv->bus->match(dev, drv))
+		return -ENODEV;
+	if (!drv->probe || !(ap = kmalloc(sizeof(*ap), GFP_KERNEL)))
+		return driver_probe_device(drv, dev);
+
+	ap->dev = get_device(dev);
+	ap->drv = get_driver(drv);
+	dev->driver = drv;
+	spin_lock(&async_probe_lock);
+	list_add_tail(&ap->list, &async_probes);
+	spin_unlock(&async_probe_lock);
+
+	p = kthread_run(async_probe_thread, ap, "probe-%s", dev->bus_id);
+	if (!IS_ERR(p))
+		return 0;
+
+	spin_lock(&async_probe_lock);
+	list_del(&ap->list);
+	spin_unlock(&async_probe_lock);
+	dev->driver = NULL;
+	put_driver(drv);
+	put_device(dev);
+	kfree(ap);
+	return driver_probe_device(drv, dev);
+}
+
+
 /**
  *	device_attach - try to attach device to a driver.
  *	@dev:	device.
@@ -362,7 +476,11 @@ void driver_attach(struct device_driver * drv)
 	list_for_each(entry, &bus->devices.list) {
 		struct device * dev = container_of(entry, struct device, bus_list);
 		if (!dev->driver) {
-			error = driver_probe_device(drv, dev);
+			if (drv->multithread_probe &&
+			    system_state == SYSTEM_BOOTING)
+				error = driver_probe_device_async(drv, dev);
+			else
+				error = driver_probe_device(drv, dev);
 			if (error && (error != -ENODEV))
 				/* driver matched but the probe failed */
 				printk(KERN_WARNING
@@ -485,6 +603,7 @@ void bus_remove_device(struct device * dev)
 		sysfs_remove_link(&dev->kobj, "bus");
 		sysfs_remove_link(&dev->bus->devices.kobj, dev->bus_id);
 		device_remove_attrs(dev->bus, dev);
+		wait_event(async_probe_wait, !async_probe_pending(dev, NULL));
 		down_write(&dev->bus->subsys.rwsem);
 		pr_debug("bus %s: remove device %s\n", dev->bus->name, dev->bus_id);
 		device_release_driver(dev);
@@ -573,6 +692,7 @@ void bus_remove_driver(struct device_driver * drv)
 {
 	if (drv->bus) {
 		driver_remove_attrs(drv->bus, drv);
+		wait_event(async_probe_wait, !async_probe_pending(NULL, drv));
 		down_write(&drv->bus->subsys.rwsem);
 		pr_debug("bus %s: remove driver %s\n", drv->bus->name, drv->name);
 		driver_detach(drv);
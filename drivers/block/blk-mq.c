@@ -0,0 +1,526 @@
+/*
+ *  linux/drivers/block/blk-mq.c
+ *
+ *  Multi-queue request path.
+ *
+ *  The normal request path funnels every request of a device through
+ *  q->queue_lock, one request list and one elevator.  For devices that do
+ *  not care about request order and can take requests from several cpus
+ *  at once (flash, mostly) that lock is the limit, long before the device
+ *  is.  Here bios are turned into requests taken from a preallocated,
+ *  tagged set per hardware queue and put on a per-cpu submission queue;
+ *  each hardware queue is fed by a fixed set of cpus' submission queues
+ *  and passes the requests straight to the driver, without merging or
+ *  sorting them.  No lock is shared by all cpus.
+ *
+ *  Disk statistics are kept, except for in_flight and io_ticks, which
+ *  need the queue lock there is no longer.
+ */
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/smp.h>
+#include <linux/writeback.h>
+
+/*
+ * hctx->state bits
+ */
+enum {
+	BLK_MQ_S_STOPPED,	/* driver asked us not to dispatch */
+	BLK_MQ_S_RUNNING,	/* someone is dispatching */
+	BLK_MQ_S_AGAIN,		/* new work since dispatch started */
+};
+
+/*
+ * a per-cpu submission queue
+ */
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;
+	unsigned int		index_hw;	/* bit in hctx->ctx_map */
+	struct blk_mq_hw_queue	*hctx;
+};
+
+static int blk_mq_get_tag(struct blk_mq_hw_queue *hctx)
+{
+	unsigned int tag;
+
+	do {
+		tag = find_first_zero_bit(hctx->tag_map, hctx->queue_depth);
+		if (tag >= hctx->queue_depth)
+			return -1;
+	} while (test_and_set_bit(tag, hctx->tag_map));
+
+	return tag;
+}
+
+static void blk_mq_put_tag(struct blk_mq_hw_queue *hctx, unsigned int tag)
+{
+	clear_bit(tag, hctx->tag_map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&hctx->wait))
+		wake_up(&hctx->wait);
+}
+
+static struct request *blk_mq_get_request(struct blk_mq_hw_queue *hctx,
+					  int can_wait)
+{
+	int tag;
+
+	if (can_wait)
+		wait_event(hctx->wait, (tag = blk_mq_get_tag(hctx)) >= 0);
+	else if ((tag = blk_mq_get_tag(hctx)) < 0)
+		return NULL;
+
+	return &hctx->rqs[tag];
+}
+
+/*
+ * q, tag, special and mq_hctx are set once, when the requests are
+ * allocated; everything else rq_init() would do is done here.
+ */
+static void blk_mq_rq_init(struct blk_mq_hw_queue *hctx, struct request *rq,
+			   struct bio *bio)
+{
+	INIT_LIST_HEAD(&rq->queuelist);
+
+	rq->flags = REQ_CMD;
+	/*
+	 * inherit FAILFAST from bio (for read-ahead, and explicit FAILFAST)
+	 */
+	if (bio_rw_ahead(bio) || bio_failfast(bio))
+		rq->flags |= REQ_FAILFAST;
+
+	rq->errors = 0;
+	rq->rq_status = RQ_ACTIVE;
+	rq->ref_count = 1;
+	rq->waiting = NULL;
+	rq->data_len = 0;
+	rq->data = NULL;
+	rq->sense = NULL;
+	rq->end_io = NULL;
+	rq->end_io_data = NULL;
+
+	rq->hard_sector = rq->sector = bio->bi_sector;
+	blk_rq_bio_prep(hctx->queue, rq, bio);
+	rq->rq_disk = bio->bi_bdev->bd_disk;
+	rq->start_time = jiffies;
+}
+
+static void blk_mq_account(struct request *rq, unsigned long nr_sectors)
+{
+	struct gendisk *disk = rq->rq_disk;
+	unsigned long duration = jiffies - rq->start_time;
+	unsigned long flags;
+
+	if (!disk || !blk_fs_request(rq))
+		return;
+
+	/* the per-cpu counters are also updated from interrupts */
+	local_irq_save(flags);
+	switch (rq_data_dir(rq)) {
+	    case WRITE:
+		__disk_stat_inc(disk, writes);
+		__disk_stat_add(disk, write_sectors, nr_sectors);
+		__disk_stat_add(disk, write_ticks, duration);
+		break;
+	    case READ:
+		__disk_stat_inc(disk, reads);
+		__disk_stat_add(disk, read_sectors, nr_sectors);
+		__disk_stat_add(disk, read_ticks, duration);
+		break;
+	}
+	local_irq_restore(flags);
+}
+
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_queue *hctx)
+{
+	request_queue_t *q = hctx->queue;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	unsigned long flags;
+	unsigned int i;
+	int ret;
+
+	/*
+	 * requests the driver bounced last time go first, then the
+	 * submission queues in cpu order
+	 */
+	spin_lock_irqsave(&hctx->lock, flags);
+	list_splice_init(&hctx->dispatch, &rq_list);
+	spin_unlock_irqrestore(&hctx->lock, flags);
+
+	for (i = find_first_bit(hctx->ctx_map, hctx->nr_ctx); i < hctx->nr_ctx;
+	     i = find_next_bit(hctx->ctx_map, hctx->nr_ctx, i + 1)) {
+		struct blk_mq_ctx *ctx = hctx->ctxs[i];
+
+		if (!test_and_clear_bit(i, hctx->ctx_map))
+			continue;
+
+		spin_lock_irqsave(&ctx->lock, flags);
+		list_splice_init(&ctx->rq_list, rq_list.prev);
+		spin_unlock_irqrestore(&ctx->lock, flags);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_entry(rq_list.next, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+		if (ret == BLK_MQ_RQ_QUEUE_ERROR) {
+			blk_mq_end_io(rq, 0);
+			continue;
+		}
+
+		/*
+		 * the driver is full: keep the rest, in order, for when it
+		 * completes something
+		 */
+		list_add(&rq->queuelist, &rq_list);
+		spin_lock_irqsave(&hctx->lock, flags);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock_irqrestore(&hctx->lock, flags);
+		break;
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - pass pending requests of a hardware queue on
+ * @hctx:	the hardware queue
+ *
+ * Description:
+ *    Only one cpu dispatches from a hardware queue at a time.  If another
+ *    one is already at it, it is told to go round again and we return
+ *    at once, so submitters never wait behind each other here.
+ **/
+void blk_mq_run_hw_queue(struct blk_mq_hw_queue *hctx)
+{
+	set_bit(BLK_MQ_S_AGAIN, &hctx->state);
+
+	while (!test_bit(BLK_MQ_S_STOPPED, &hctx->state) &&
+	       !test_and_set_bit(BLK_MQ_S_RUNNING, &hctx->state)) {
+		clear_bit(BLK_MQ_S_AGAIN, &hctx->state);
+		smp_mb__after_clear_bit();
+
+		__blk_mq_run_hw_queue(hctx);
+
+		smp_mb__before_clear_bit();
+		clear_bit(BLK_MQ_S_RUNNING, &hctx->state);
+		smp_mb__after_clear_bit();
+		if (!test_bit(BLK_MQ_S_AGAIN, &hctx->state))
+			break;
+	}
+}
+
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+/**
+ * blk_mq_end_io - complete a multi-queue request
+ * @rq:		the request
+ * @uptodate:	1 for success, 0 for I/O error, < 0 for specific error
+ *
+ * Description:
+ *    Ends all the I/O left on @rq, frees its tag and gives the hardware
+ *    queue another go if the driver had bounced requests.  May be called
+ *    from interrupt context.
+ **/
+void blk_mq_end_io(struct request *rq, int uptodate)
+{
+	struct blk_mq_hw_queue *hctx = rq->mq_hctx;
+
+	blk_mq_account(rq, rq->hard_nr_sectors);
+	if (end_that_request_first(rq, uptodate, rq->hard_nr_sectors))
+		BUG();
+
+	if (unlikely(laptop_mode) && blk_fs_request(rq))
+		laptop_io_completion();
+
+	rq->rq_status = RQ_INACTIVE;
+	rq->bio = rq->biotail = NULL;
+	blk_mq_put_tag(hctx, rq->tag);
+
+	if (!list_empty(&hctx->dispatch) ||
+	    test_bit(BLK_MQ_S_RUNNING, &hctx->state))
+		blk_mq_run_hw_queue(hctx);
+}
+
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static int blk_mq_make_request(request_queue_t *q, struct bio *bio)
+{
+	struct blk_mq_ctx *ctx;
+	struct blk_mq_hw_queue *hctx;
+	struct request *rq;
+	unsigned long flags;
+
+	/*
+	 * low level driver can indicate that it wants pages above a
+	 * certain limit bounced to low memory (ie for highmem, or even
+	 * ISA dma in theory)
+	 */
+	blk_queue_bounce(q, &bio);
+
+	if (bio_barrier(bio)) {
+		bio_endio(bio, bio->bi_size, -EOPNOTSUPP);
+		return 0;
+	}
+
+	/*
+	 * any cpu's submission queue will do, it is only a matter of
+	 * which is cheapest, so it does not matter if we move after this
+	 */
+	ctx = per_cpu_ptr(q->queue_ctx, _smp_processor_id());
+	hctx = ctx->hctx;
+
+	rq = blk_mq_get_request(hctx, !bio_rw_ahead(bio));
+	if (!rq) {
+		bio_endio(bio, bio->bi_size, -EWOULDBLOCK);
+		return 0;
+	}
+	blk_mq_rq_init(hctx, rq, bio);
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+	set_bit(ctx->index_hw, hctx->ctx_map);
+
+	blk_mq_run_hw_queue(hctx);
+	return 0;
+}
+
+static void blk_mq_free_hw_queue(struct blk_mq_hw_queue *hctx)
+{
+	if (hctx->rqs && hctx->rqs[0].special)
+		kfree(hctx->rqs[0].special);
+	kfree(hctx->rqs);
+	kfree(hctx->tag_map);
+	kfree(hctx->ctx_map);
+	kfree(hctx->ctxs);
+	kfree(hctx);
+}
+
+static struct blk_mq_hw_queue *
+blk_mq_alloc_hw_queue(request_queue_t *q, struct blk_mq_reg *reg,
+		      unsigned int queue_num, unsigned int nr_ctx, int node)
+{
+	struct blk_mq_hw_queue *hctx;
+	unsigned int depth = reg->queue_depth;
+	unsigned int cmd_size = ALIGN(reg->cmd_size, sizeof(long));
+	char *pdus = NULL;
+	unsigned int i;
+
+	hctx = kmalloc_node(sizeof(*hctx), GFP_KERNEL, node);
+	if (!hctx)
+		return NULL;
+	memset(hctx, 0, sizeof(*hctx));
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	init_waitqueue_head(&hctx->wait);
+	hctx->queue = q;
+	hctx->queue_num = queue_num;
+	hctx->queue_depth = depth;
+
+	hctx->tag_map = kmalloc_node(BITS_TO_LONGS(depth) * sizeof(long),
+				     GFP_KERNEL, node);
+	hctx->ctx_map = kmalloc_node(BITS_TO_LONGS(nr_ctx) * sizeof(long),
+				     GFP_KERNEL, node);
+	hctx->ctxs = kmalloc_node(nr_ctx * sizeof(struct blk_mq_ctx *),
+				  GFP_KERNEL, node);
+	hctx->rqs = kmalloc_node(depth * sizeof(struct request), GFP_KERNEL,
+				 node);
+	if (cmd_size)
+		pdus = kmalloc_node(depth * cmd_size, GFP_KERNEL, node);
+	if (!hctx->tag_map || !hctx->ctx_map || !hctx->ctxs || !hctx->rqs ||
+	    (cmd_size && !pdus)) {
+		if (pdus)
+			kfree(pdus);
+		if (hctx->rqs) {
+			kfree(hctx->rqs);
+			hctx->rqs = NULL;
+		}
+		blk_mq_free_hw_queue(hctx);
+		return NULL;
+	}
+
+	memset(hctx->tag_map, 0, BITS_TO_LONGS(depth) * sizeof(long));
+	memset(hctx->ctx_map, 0, BITS_TO_LONGS(nr_ctx) * sizeof(long));
+	memset(hctx->rqs, 0, depth * sizeof(struct request));
+	if (pdus)
+		memset(pdus, 0, depth * cmd_size);
+
+	for (i = 0; i < depth; i++) {
+		struct request *rq = &hctx->rqs[i];
+
+		rq->q = q;
+		rq->tag = i;
+		rq->rq_status = RQ_INACTIVE;
+		rq->mq_hctx = hctx;
+		rq->special = pdus ? pdus + i * cmd_size : NULL;
+	}
+
+	return hctx;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:	the driver's operations and queue sizes
+ * @driver_data: stored in q->queuedata
+ *
+ * Description:
+ *    Sets up @reg->nr_hw_queues hardware queues of @reg->queue_depth
+ *    requests, with the possible cpus spread over them in turn.  Each
+ *    request comes with @reg->cmd_size bytes for the driver, found with
+ *    blk_mq_rq_to_pdu().
+ *
+ *    The driver gets requests through @reg->ops->queue_rq, in whatever
+ *    order the cpus submitted them, and completes each with
+ *    blk_mq_end_io(); there is no elevator.  Queue limits are set with
+ *    the usual blk_queue_* calls, and the queue is freed with
+ *    blk_cleanup_queue().
+ *
+ *    A driver that returns BLK_MQ_RQ_QUEUE_BUSY while it has none of its
+ *    requests outstanding has to restart the queue itself, with
+ *    blk_mq_run_hw_queue() or blk_mq_start_hw_queues(); otherwise the
+ *    next completion does it.
+ **/
+request_queue_t *blk_mq_init_queue(struct blk_mq_reg *reg, void *driver_data)
+{
+	request_queue_t *q;
+	unsigned int nr_hw_queues, i, cpu;
+	unsigned int *nr_ctx;
+
+	if (!reg->ops || !reg->ops->queue_rq || !reg->queue_depth ||
+	    !reg->nr_hw_queues)
+		return NULL;
+
+	nr_hw_queues = min_t(unsigned int, reg->nr_hw_queues,
+			     num_possible_cpus());
+
+	q = blk_alloc_queue(GFP_KERNEL);
+	if (!q)
+		return NULL;
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->queuedata = driver_data;
+	q->mq_ops = reg->ops;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->mq_map = kmalloc(NR_CPUS * sizeof(unsigned int), GFP_KERNEL);
+	q->queue_hw_ctx = kmalloc(nr_hw_queues *
+				  sizeof(struct blk_mq_hw_queue *), GFP_KERNEL);
+	nr_ctx = kmalloc(nr_hw_queues * sizeof(unsigned int), GFP_KERNEL);
+	if (!q->queue_ctx || !q->mq_map || !q->queue_hw_ctx || !nr_ctx)
+		goto fail;
+	memset(q->queue_hw_ctx, 0,
+	       nr_hw_queues * sizeof(struct blk_mq_hw_queue *));
+	memset(nr_ctx, 0, nr_hw_queues * sizeof(unsigned int));
+
+	/*
+	 * hand out the possible cpus in turn, so each hardware queue gets
+	 * a run of neighbouring cpus once there are fewer queues than cpus
+	 */
+	i = 0;
+	for_each_cpu(cpu) {
+		q->mq_map[cpu] = i++ * nr_hw_queues / num_possible_cpus();
+		nr_ctx[q->mq_map[cpu]]++;
+	}
+
+	for (i = 0; i < nr_hw_queues; i++) {
+		int node = -1;
+
+		for_each_cpu(cpu) {
+			if (q->mq_map[cpu] == i) {
+				node = cpu_to_node(cpu);
+				break;
+			}
+		}
+		q->queue_hw_ctx[i] = blk_mq_alloc_hw_queue(q, reg, i,
+							   nr_ctx[i], node);
+		if (!q->queue_hw_ctx[i])
+			goto fail;
+		q->nr_hw_queues++;
+	}
+
+	for_each_cpu(cpu) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, cpu);
+		struct blk_mq_hw_queue *hctx = q->queue_hw_ctx[q->mq_map[cpu]];
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->hctx = hctx;
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	kfree(nr_ctx);
+	return q;
+
+fail:
+	if (nr_ctx)
+		kfree(nr_ctx);
+	blk_cleanup_queue(q);
+	return NULL;
+}
+
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * called by blk_cleanup_queue when the last reference goes
+ */
+void blk_mq_free_queue(request_queue_t *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		blk_mq_free_hw_queue(q->queue_hw_ctx[i]);
+
+	if (q->queue_hw_ctx)
+		kfree(q->queue_hw_ctx);
+	if (q->mq_map)
+		kfree(q->mq_map);
+	if (q->queue_ctx)
+		free_percpu(q->queue_ctx);
+}
+
+/**
+ * blk_mq_stop_hw_queues - stop dispatching requests to the driver
+ * @q:		the queue
+ *
+ * Description:
+ *    The multi-queue equivalent of blk_stop_queue().  Requests keep
+ *    being accepted and are held until blk_mq_start_hw_queues().
+ **/
+void blk_mq_stop_hw_queues(request_queue_t *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		set_bit(BLK_MQ_S_STOPPED, &q->queue_hw_ctx[i]->state);
+}
+
+EXPORT_SYMBOL(blk_mq_stop_hw_queues);
+
+void blk_mq_start_hw_queues(request_queue_t *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		struct blk_mq_hw_queue *hctx = q->queue_hw_ctx[i];
+
+		clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+		smp_mb__after_clear_bit();
+		blk_mq_run_hw_queue(hctx);
+	}
+}
+
+EXPORT_SYMBOL(blk_mq_start_hw_queues);
@@ -6,6 +6,9 @@
  *  Based on ideas from a previously unfinished io
  *  scheduler (round robin per-process disk scheduling) and Andrea Arcangeli.
  *
+ *  Queues are served in time slices, in order of io priority, see
+ *  Documentation/block/ioprio.txt.
+ *
  *  Copyright (C) 2003 Jens Axboe <axboe@suse.de>
  */
 #include <linux/kernel.h>
@@ -21,6 +24,7 @@
 #include <linux/hash.h>
 #include <linux/rbtree.h>
 #include <linux/mempool.h>
+#include <linux/ioprio.h>
 
 static unsigned long max_elapsed_crq;
 static unsigned long max_elapsed_dispatch;
@@ -30,12 +34,26 @@ static unsigned long max_elapsed_dispatch;
  */
 static int cfq_quantum = 4;		/* max queue in one round of service */
 static int cfq_queued = 8;		/* minimum rq allocate limit per-queue*/
-static int cfq_service = HZ;		/* period over which service is avg */
 static int cfq_fifo_expire_r = HZ / 2;	/* fifo timeout for sync requests */
 static int cfq_fifo_expire_w = 5 * HZ;	/* fifo timeout for async requests */
 static int cfq_fifo_rate = HZ / 8;	/* fifo expiry rate */
 static int cfq_back_max = 16 * 1024;	/* maximum backwards seek, in KiB */
 static int cfq_back_penalty = 2;	/* penalty of a backwards seek */
+static int cfq_slice_sync = HZ / 10;	/* time slice of a sync queue */
+static int cfq_slice_async = HZ / 25;	/* time slice of an async queue */
+static int cfq_slice_idle = HZ / 100;	/* wait this long for the next sync rq */
+
+/*
+ * the base slice is what a queue at the normal priority level gets, every
+ * level above or below it adds or takes away a CFQ_SLICE_SCALE'th of it
+ */
+#define CFQ_SLICE_SCALE		(5)
+
+/*
+ * one round robin list per level of the real-time and best-effort classes,
+ * real-time ones first. the idle class has a list of its own
+ */
+#define CFQ_PRIO_LISTS		(2 * IOPRIO_BE_NR)
 
 /*
  * for the hash of cfqq inside the cfqd
@@ -75,11 +93,6 @@ static int cfq_back_penalty = 2;	/* penalty of a backwards seek */
 #define rb_entry_crq(node)	rb_entry((node), struct cfq_rq, rb_node)
 #define rq_rb_key(rq)		(rq)->sector
 
-/*
- * threshold for switching off non-tag accounting
- */
-#define CFQ_MAX_TAG		(4)
-
 /*
  * sort key types and names
  */
@@ -98,15 +111,24 @@ static kmem_cache_t *cfq_pool;
 static kmem_cache_t *cfq_ioc_pool;
 
 struct cfq_data {
-	struct list_head rr_list;
+	struct list_head rr_list[CFQ_PRIO_LISTS];
+	struct list_head idle_rr_list;
 	struct list_head empty_list;
 
 	struct hlist_head *cfq_hash;
 	struct hlist_head *crq_hash;
 
-	/* queues on rr_list (ie they have pending requests */
+	/* queues on an rr list (ie they have pending requests */
 	unsigned int busy_queues;
 
+	/*
+	 * the queue whose time slice is running, and the timer that waits
+	 * on its behalf for the next request of a sync reader
+	 */
+	struct cfq_queue *active_queue;
+	struct timer_list idle_slice_timer;
+	struct work_struct unplug_work;
+
 	unsigned int max_queued;
 
 	atomic_t ref;
@@ -132,8 +154,8 @@ struct cfq_data {
 	unsigned int cfq_back_penalty;
 	unsigned int cfq_back_max;
 	unsigned int find_best_crq;
-
-	unsigned int cfq_tagged;
+	unsigned int cfq_slice[2];
+	unsigned int cfq_slice_idle;
 };
 
 struct cfq_queue {
@@ -164,15 +186,21 @@ struct cfq_queue {
 
 	int key_type;
 
-	unsigned long service_start;
-	unsigned long service_used;
-
-	unsigned int max_rate;
+	/* io priority class and level, see linux/ioprio.h */
+	unsigned short ioprio;
+	unsigned short ioprio_class;
+	/* when the time slice of the active queue runs out */
+	unsigned long slice_end;
 
 	/* number of requests that have been handed to the driver */
 	int in_flight;
 	/* number of currently allocated requests */
 	int alloc_limit[2];
+
+	/* idle timer is running, waiting for a request from this queue */
+	unsigned int wait_request : 1;
+	/* the last request dispatched was sync */
+	unsigned int dispatched_sync : 1;
 };
 
 struct cfq_rq {
@@ -197,6 +225,7 @@ static struct cfq_queue *cfq_find_cfq_hash(struct cfq_data *, unsigned long);
 static void cfq_dispatch_sort(request_queue_t *, struct cfq_rq *);
 static void cfq_update_next_crq(struct cfq_rq *);
 static void cfq_put_cfqd(struct cfq_data *cfqd);
+static void cfq_slice_expired(struct cfq_data *cfqd);
 
 /*
  * what the fairness is based on (ie how processes are grouped and
@@ -401,75 +430,25 @@ static void cfq_update_next_crq(struct cfq_rq *crq)
 		cfqq->next_crq = cfq_find_next_crq(cfqq->cfqd, cfqq, crq);
 }
 
-static int cfq_check_sort_rr_list(struct cfq_queue *cfqq)
-{
-	struct list_head *head = &cfqq->cfqd->rr_list;
-	struct list_head *next, *prev;
-
-	/*
-	 * list might still be ordered
-	 */
-	next = cfqq->cfq_list.next;
-	if (next != head) {
-		struct cfq_queue *cnext = list_entry_cfqq(next);
-
-		if (cfqq->service_used > cnext->service_used)
-			return 1;
-	}
-
-	prev = cfqq->cfq_list.prev;
-	if (prev != head) {
-		struct cfq_queue *cprev = list_entry_cfqq(prev);
-
-		if (cfqq->service_used < cprev->service_used)
-			return 1;
-	}
-
-	return 0;
-}
-
-static void cfq_sort_rr_list(struct cfq_queue *cfqq, int new_queue)
+/*
+ * the round robin list a queue waits on for its next time slice
+ */
+static inline struct list_head *
+cfq_rr_list(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 {
-	struct list_head *entry = &cfqq->cfqd->rr_list;
-
-	if (!cfqq->on_rr)
-		return;
-	if (!new_queue && !cfq_check_sort_rr_list(cfqq))
-		return;
-
-	list_del(&cfqq->cfq_list);
-
-	/*
-	 * sort by our mean service_used, sub-sort by in-flight requests
-	 */
-	while ((entry = entry->prev) != &cfqq->cfqd->rr_list) {
-		struct cfq_queue *__cfqq = list_entry_cfqq(entry);
-
-		if (cfqq->service_used > __cfqq->service_used)
-			break;
-		else if (cfqq->service_used == __cfqq->service_used) {
-			struct list_head *prv;
-
-			while ((prv = entry->prev) != &cfqq->cfqd->rr_list) {
-				__cfqq = list_entry_cfqq(prv);
-
-				WARN_ON(__cfqq->service_used > cfqq->service_used);
-				if (cfqq->service_used != __cfqq->service_used)
-					break;
-				if (cfqq->in_flight > __cfqq->in_flight)
-					break;
-
-				entry = prv;
-			}
-		}
+	switch (cfqq->ioprio_class) {
+		case IOPRIO_CLASS_RT:
+			return &cfqd->rr_list[cfqq->ioprio];
+		case IOPRIO_CLASS_IDLE:
+			return &cfqd->idle_rr_list;
+		default:
+			return &cfqd->rr_list[IOPRIO_BE_NR + cfqq->ioprio];
 	}
-
-	list_add(&cfqq->cfq_list, entry);
 }
 
 /*
- * add to busy list of queues for service, trying to be fair in ordering
- * the pending list according to requests serviced
+ * add to busy list of queues for service, at the back of the queues of the
+ * same priority
  */
 static inline void
 cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
@@ -480,10 +459,7 @@ cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	cfqq->on_rr = 1;
 	cfqd->busy_queues++;
 
-	if (time_after(jiffies, cfqq->service_start + cfq_service))
-		cfqq->service_used >>= 3;
-
-	cfq_sort_rr_list(cfqq, 1);
+	list_move_tail(&cfqq->cfq_list, cfq_rr_list(cfqd, cfqq));
 }
 
 static inline void
@@ -614,11 +590,6 @@ static void cfq_deactivate_request(request_queue_t *q, struct request *rq)
 	if (crq) {
 		struct cfq_queue *cfqq = crq->cfq_queue;
 
-		if (cfqq->cfqd->cfq_tagged) {
-			cfqq->service_used--;
-			cfq_sort_rr_list(cfqq, 0);
-		}
-
 		if (crq->accounted) {
 			crq->accounted = 0;
 			cfqq->cfqd->rq_in_driver--;
@@ -726,7 +697,7 @@ cfq_merged_requests(request_queue_t *q, struct request *rq,
 }
 
 /*
- * we dispatch cfqd->cfq_quantum requests in total from the rr_list queues,
+ * we dispatch up to cfqd->cfq_quantum requests at a time from the active queue,
  * this function sector sorts the selected request to minimize seeks. we start
  * at cfqd->last_sector, not 0.
  */
@@ -814,6 +785,7 @@ cfq_dispatch_request(request_queue_t *q, struct cfq_data *cfqd,
 	}
 
 	cfqd->last_sector = crq->request->sector + crq->request->nr_sectors;
+	cfqq->dispatched_sync = crq->is_sync;
 
 	/*
 	 * finally, insert request into driver list
@@ -821,46 +793,247 @@ cfq_dispatch_request(request_queue_t *q, struct cfq_data *cfqd,
 	cfq_dispatch_sort(q, crq);
 }
 
-static int cfq_dispatch_requests(request_queue_t *q, int max_dispatch)
+/*
+ * a sync queue that runs out of requests keeps the disk for a little while,
+ * its process is most likely about to issue the next one close to the last.
+ * there's no point in waiting for async or idle class queues
+ */
+static inline int cfq_may_idle(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 {
-	struct cfq_data *cfqd = q->elevator->elevator_data;
-	struct cfq_queue *cfqq;
-	struct list_head *entry, *tmp;
-	int queued, busy_queues, first_round;
+	return cfqd->cfq_slice_idle && cfqq->dispatched_sync &&
+		cfqq->ioprio_class != IOPRIO_CLASS_IDLE;
+}
+
+/*
+ * start waiting for the next request of the active queue, if it may be
+ * idled for and has some of its slice left. returns 1 if the timer is set
+ */
+static int cfq_arm_slice_timer(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	unsigned long expires;
 
-	if (list_empty(&cfqd->rr_list))
+	if (!cfq_may_idle(cfqd, cfqq))
+		return 0;
+	if (!time_before(jiffies, cfqq->slice_end))
 		return 0;
 
-	queued = 0;
-	first_round = 1;
-restart:
-	busy_queues = 0;
-	list_for_each_safe(entry, tmp, &cfqd->rr_list) {
-		cfqq = list_entry_cfqq(entry);
+	expires = jiffies + cfqd->cfq_slice_idle;
+	if (time_after(expires, cfqq->slice_end))
+		expires = cfqq->slice_end;
 
-		BUG_ON(RB_EMPTY(&cfqq->sort_list));
+	cfqq->wait_request = 1;
+	mod_timer(&cfqd->idle_slice_timer, expires);
+	return 1;
+}
+
+/*
+ * a new slice has to be started when the queue blocking the disk changes
+ * priority or gives up. defer restarting the queue to kblockd, we may be
+ * called with the queue in any kind of state
+ */
+static inline void cfq_schedule_dispatch(struct cfq_data *cfqd)
+{
+	if (cfqd->busy_queues)
+		kblockd_schedule_work(&cfqd->unplug_work);
+}
+
+static void cfq_kick_queue(void *data)
+{
+	request_queue_t *q = data;
+	unsigned long flags;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	if (!elv_queue_empty(q))
+		q->request_fn(q);
+	spin_unlock_irqrestore(q->queue_lock, flags);
+}
+
+static void cfq_idle_slice_timer(unsigned long data)
+{
+	struct cfq_data *cfqd = (struct cfq_data *) data;
+	struct cfq_queue *cfqq;
+	unsigned long flags;
+
+	spin_lock_irqsave(cfqd->queue->queue_lock, flags);
+
+	cfqq = cfqd->active_queue;
+	if (cfqq && cfqq->wait_request) {
+		cfqq->wait_request = 0;
 
 		/*
-		 * first round of queueing, only select from queues that
-		 * don't already have io in-flight
+		 * nothing came in time, give the disk to somebody else
 		 */
-		if (first_round && cfqq->in_flight)
-			continue;
+		if (RB_EMPTY(&cfqq->sort_list))
+			cfq_slice_expired(cfqd);
+	}
 
-		cfq_dispatch_request(q, cfqd, cfqq);
+	cfq_schedule_dispatch(cfqd);
+	spin_unlock_irqrestore(cfqd->queue->queue_lock, flags);
+}
+
+/*
+ * the length of the time slice of a queue, scaled by its priority level
+ */
+static inline unsigned long
+cfq_prio_to_slice(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	const int base_slice = cfqd->cfq_slice[!!cfqq->queued[1]];
+
+	return base_slice + (base_slice / CFQ_SLICE_SCALE * (4 - cfqq->ioprio));
+}
+
+/*
+ * current slice is done, put the queue at the back of its list for the
+ * next round
+ */
+static void cfq_slice_expired(struct cfq_data *cfqd)
+{
+	struct cfq_queue *cfqq = cfqd->active_queue;
+
+	if (!cfqq)
+		return;
+
+	if (cfqq->wait_request) {
+		del_timer(&cfqd->idle_slice_timer);
+		cfqq->wait_request = 0;
+	}
+
+	if (cfqq->on_rr)
+		list_move_tail(&cfqq->cfq_list, cfq_rr_list(cfqd, cfqq));
+
+	cfqd->active_queue = NULL;
+}
+
+/*
+ * hand the next time slice to the first queue of the highest priority that
+ * has requests pending. the idle class only gets served when nobody else
+ * wants the disk
+ */
+static struct cfq_queue *cfq_set_active_queue(struct cfq_data *cfqd)
+{
+	struct cfq_queue *cfqq = NULL;
+	int i;
+
+	for (i = 0; i < CFQ_PRIO_LISTS; i++) {
+		if (!list_empty(&cfqd->rr_list[i])) {
+			cfqq = list_entry_cfqq(cfqd->rr_list[i].next);
+			break;
+		}
+	}
+
+	if (!cfqq && !list_empty(&cfqd->idle_rr_list))
+		cfqq = list_entry_cfqq(cfqd->idle_rr_list.next);
+
+	if (cfqq) {
+		cfqq->slice_end = jiffies + cfq_prio_to_slice(cfqd, cfqq);
+		cfqq->wait_request = 0;
+	}
+
+	cfqd->active_queue = cfqq;
+	return cfqq;
+}
+
+/*
+ * get the queue to dispatch from. the active queue keeps the disk until its
+ * slice runs out or it has nothing more to do; if it was issuing sync
+ * requests, that means until the requests it has in flight completed and
+ * no new one showed up within slice_idle. returns NULL while waiting
+ */
+static struct cfq_queue *cfq_select_queue(struct cfq_data *cfqd)
+{
+	struct cfq_queue *cfqq = cfqd->active_queue;
+
+	if (!cfqq)
+		goto new_queue;
+
+	if (time_after(jiffies, cfqq->slice_end))
+		goto expire;
+
+	if (!RB_EMPTY(&cfqq->sort_list))
+		goto keep_queue;
+
+	/*
+	 * the idle timer gets armed once the last request completes, see
+	 * cfq_completed_request()
+	 */
+	if (cfqq->wait_request || (cfqq->in_flight && cfq_may_idle(cfqd, cfqq)))
+		return NULL;
+
+expire:
+	cfq_slice_expired(cfqd);
+new_queue:
+	cfqq = cfq_set_active_queue(cfqd);
+keep_queue:
+	return cfqq;
+}
+
+static int
+__cfq_forced_dispatch(request_queue_t *q, struct cfq_data *cfqd,
+		      struct list_head *list)
+{
+	struct list_head *entry, *tmp;
+	int dispatched = 0;
 
-		if (!RB_EMPTY(&cfqq->sort_list))
-			busy_queues++;
+	list_for_each_safe(entry, tmp, list) {
+		struct cfq_queue *cfqq = list_entry_cfqq(entry);
 
-		queued++;
+		while (!RB_EMPTY(&cfqq->sort_list)) {
+			cfq_dispatch_request(q, cfqd, cfqq);
+			dispatched++;
+		}
 	}
 
-	if ((queued < max_dispatch) && (busy_queues || first_round)) {
-		first_round = 0;
-		goto restart;
+	return dispatched;
+}
+
+/*
+ * move everything to the dispatch list, regardless of slices
+ */
+static int cfq_forced_dispatch(request_queue_t *q, struct cfq_data *cfqd)
+{
+	int i, dispatched = 0;
+
+	cfq_slice_expired(cfqd);
+
+	for (i = 0; i < CFQ_PRIO_LISTS; i++)
+		dispatched += __cfq_forced_dispatch(q, cfqd, &cfqd->rr_list[i]);
+
+	dispatched += __cfq_forced_dispatch(q, cfqd, &cfqd->idle_rr_list);
+
+	return dispatched;
+}
+
+static int
+cfq_dispatch_requests(request_queue_t *q, int max_dispatch, int force)
+{
+	struct cfq_data *cfqd = q->elevator->elevator_data;
+	struct cfq_queue *cfqq;
+	int dispatched;
+
+	if (!cfqd->busy_queues)
+		return 0;
+
+	if (unlikely(force))
+		return cfq_forced_dispatch(q, cfqd);
+
+	cfqq = cfq_select_queue(cfqd);
+	if (!cfqq)
+		return 0;
+
+	dispatched = 0;
+	while (!RB_EMPTY(&cfqq->sort_list) && dispatched < max_dispatch) {
+		cfq_dispatch_request(q, cfqd, cfqq);
+		dispatched++;
 	}
 
-	return queued;
+	/*
+	 * queues we don't idle for give up the rest of their slice as soon
+	 * as they run dry
+	 */
+	if (RB_EMPTY(&cfqq->sort_list) && !cfq_may_idle(cfqd, cfqq))
+		cfq_slice_expired(cfqd);
+
+	return dispatched;
 }
 
 static inline void cfq_account_dispatch(struct cfq_rq *crq)
@@ -880,42 +1053,20 @@ static inline void cfq_account_dispatch(struct cfq_rq *crq)
 		return;
 
 	now = jiffies;
-	if (cfqq->service_start == ~0UL)
-		cfqq->service_start = now;
-
-	/*
-	 * on drives with tagged command queueing, command turn-around time
-	 * doesn't necessarily reflect the time spent processing this very
-	 * command inside the drive. so do the accounting differently there,
-	 * by just sorting on the number of requests
-	 */
-	if (cfqd->cfq_tagged) {
-		if (time_after(now, cfqq->service_start + cfq_service)) {
-			cfqq->service_start = now;
-			cfqq->service_used /= 10;
-		}
-
-		cfqq->service_used++;
-		cfq_sort_rr_list(cfqq, 0);
-	}
-
 	elapsed = now - crq->queue_start;
 	if (elapsed > max_elapsed_dispatch)
 		max_elapsed_dispatch = elapsed;
 
 	crq->accounted = 1;
 	crq->service_start = now;
-
-	if (++cfqd->rq_in_driver >= CFQ_MAX_TAG && !cfqd->cfq_tagged) {
-		cfqq->cfqd->cfq_tagged = 1;
-		printk("cfq: depth %d reached, tagging now on\n", CFQ_MAX_TAG);
-	}
+	cfqd->rq_in_driver++;
 }
 
 static inline void
 cfq_account_completion(struct cfq_queue *cfqq, struct cfq_rq *crq)
 {
 	struct cfq_data *cfqd = cfqq->cfqd;
+	unsigned long duration;
 
 	if (!crq->accounted)
 		return;
@@ -923,21 +1074,9 @@ cfq_account_completion(struct cfq_queue *cfqq, struct cfq_rq *crq)
 	WARN_ON(!cfqd->rq_in_driver);
 	cfqd->rq_in_driver--;
 
-	if (!cfqd->cfq_tagged) {
-		unsigned long now = jiffies;
-		unsigned long duration = now - crq->service_start;
-
-		if (time_after(now, cfqq->service_start + cfq_service)) {
-			cfqq->service_start = now;
-			cfqq->service_used >>= 3;
-		}
-
-		cfqq->service_used += duration;
-		cfq_sort_rr_list(cfqq, 0);
-
-		if (duration > max_elapsed_crq)
-			max_elapsed_crq = duration;
-	}
+	duration = jiffies - crq->service_start;
+	if (duration > max_elapsed_crq)
+		max_elapsed_crq = duration;
 }
 
 static struct request *cfq_next_request(request_queue_t *q)
@@ -958,7 +1097,7 @@ dispatch:
 		return rq;
 	}
 
-	if (cfq_dispatch_requests(q, cfqd->cfq_quantum))
+	if (cfq_dispatch_requests(q, cfqd->cfq_quantum, 0))
 		goto dispatch;
 
 	return NULL;
@@ -980,6 +1119,9 @@ static void cfq_put_queue(struct cfq_queue *cfqq)
 	BUG_ON(rb_first(&cfqq->sort_list));
 	BUG_ON(cfqq->on_rr);
 
+	if (unlikely(cfqq->cfqd->active_queue == cfqq))
+		cfq_slice_expired(cfqq->cfqd);
+
 	cfq_put_cfqd(cfqq->cfqd);
 
 	/*
@@ -1224,7 +1366,8 @@ retry:
 		cfqq->cfqd = cfqd;
 		atomic_inc(&cfqd->ref);
 		cfqq->key_type = cfqd->key_type;
-		cfqq->service_start = ~0UL;
+		cfqq->ioprio_class = IOPRIO_CLASS_BE;
+		cfqq->ioprio = IOPRIO_NORM;
 	}
 
 	if (new_cfqq)
@@ -1236,6 +1379,69 @@ out:
 	return cfqq;
 }
 
+/*
+ * pick up the io priority of the task that is allocating a request for the
+ * queue. a waiting queue moves to its new list at once, the active one
+ * finishes its slice first
+ */
+static void cfq_init_prio_data(struct cfq_queue *cfqq)
+{
+	struct task_struct *tsk = current;
+	unsigned short ioprio_class = task_ioprio_class(tsk);
+	unsigned short ioprio = task_ioprio(tsk);
+
+	/*
+	 * the idle class has no levels
+	 */
+	if (ioprio_class == IOPRIO_CLASS_IDLE)
+		ioprio = IOPRIO_BE_NR - 1;
+
+	if (cfqq->ioprio_class == ioprio_class && cfqq->ioprio == ioprio)
+		return;
+
+	cfqq->ioprio_class = ioprio_class;
+	cfqq->ioprio = ioprio;
+
+	if (cfqq->on_rr && cfqq != cfqq->cfqd->active_queue)
+		list_move_tail(&cfqq->cfq_list, cfq_rr_list(cfqq->cfqd, cfqq));
+}
+
+/*
+ * should a new request for cfqq take the disk away from the active queue
+ */
+static inline int
+cfq_should_preempt(struct cfq_queue *active, struct cfq_queue *cfqq)
+{
+	if (cfqq->ioprio_class == IOPRIO_CLASS_RT &&
+	    active->ioprio_class != IOPRIO_CLASS_RT)
+		return 1;
+	if (active->ioprio_class == IOPRIO_CLASS_IDLE &&
+	    cfqq->ioprio_class != IOPRIO_CLASS_IDLE)
+		return 1;
+
+	return 0;
+}
+
+static void
+cfq_crq_enqueued(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	struct cfq_queue *active = cfqd->active_queue;
+
+	if (cfqq == active) {
+		/*
+		 * this is the request we were idling for, get it going
+		 */
+		if (cfqq->wait_request) {
+			del_timer(&cfqd->idle_slice_timer);
+			cfqq->wait_request = 0;
+			cfq_schedule_dispatch(cfqd);
+		}
+	} else if (active && cfq_should_preempt(active, cfqq)) {
+		cfq_slice_expired(cfqd);
+		cfq_schedule_dispatch(cfqd);
+	}
+}
+
 static void cfq_enqueue(struct cfq_data *cfqd, struct cfq_rq *crq)
 {
 	crq->is_sync = 0;
@@ -1246,6 +1452,8 @@ static void cfq_enqueue(struct cfq_data *cfqd, struct cfq_rq *crq)
 	crq->queue_start = jiffies;
 
 	list_add_tail(&crq->request->queuelist, &crq->cfq_queue->fifo[crq->is_sync]);
+
+	cfq_crq_enqueued(cfqd, crq->cfq_queue);
 }
 
 static void
@@ -1256,8 +1464,7 @@ cfq_insert_request(request_queue_t *q, struct request *rq, int where)
 
 	switch (where) {
 		case ELEVATOR_INSERT_BACK:
-			while (cfq_dispatch_requests(q, cfqd->cfq_quantum))
-				;
+			cfq_dispatch_requests(q, cfqd->cfq_quantum, 1);
 			list_add_tail(&rq->queuelist, &q->queue_head);
 			break;
 		case ELEVATOR_INSERT_FRONT:
@@ -1284,11 +1491,12 @@ static int cfq_queue_empty(request_queue_t *q)
 {
 	struct cfq_data *cfqd = q->elevator->elevator_data;
 
-	return list_empty(&q->queue_head) && list_empty(&cfqd->rr_list);
+	return list_empty(&q->queue_head) && !cfqd->busy_queues;
 }
 
 static void cfq_completed_request(request_queue_t *q, struct request *rq)
 {
+	struct cfq_data *cfqd = q->elevator->elevator_data;
 	struct cfq_rq *crq = RQ_DATA(rq);
 	struct cfq_queue *cfqq;
 
@@ -1303,6 +1511,18 @@ static void cfq_completed_request(request_queue_t *q, struct request *rq)
 	}
 
 	cfq_account_completion(cfqq, crq);
+
+	/*
+	 * the active queue is done with everything it had, wait for its
+	 * next request or let the next queue have a go
+	 */
+	if (cfqq == cfqd->active_queue && !cfqq->in_flight &&
+	    !cfqq->wait_request && RB_EMPTY(&cfqq->sort_list)) {
+		if (!cfq_arm_slice_timer(cfqd, cfqq)) {
+			cfq_slice_expired(cfqd);
+			cfq_schedule_dispatch(cfqd);
+		}
+	}
 }
 
 static struct request *
@@ -1425,6 +1645,8 @@ static int cfq_set_request(request_queue_t *q, struct request *rq, int gfp_mask)
 	if (!cfqq)
 		goto out_lock;
 
+	cfq_init_prio_data(cfqq);
+
 repeat:
 	if (cfqq->allocated[rw] >= cfqd->max_queued)
 		goto out_lock;
@@ -1492,7 +1714,17 @@ static void cfq_put_cfqd(struct cfq_data *cfqd)
 
 static void cfq_exit_queue(elevator_t *e)
 {
-	cfq_put_cfqd(e->elevator_data);
+	struct cfq_data *cfqd = e->elevator_data;
+	request_queue_t *q = cfqd->queue;
+
+	spin_lock_irq(q->queue_lock);
+	cfq_slice_expired(cfqd);
+	spin_unlock_irq(q->queue_lock);
+
+	del_timer_sync(&cfqd->idle_slice_timer);
+	kblockd_flush();
+
+	cfq_put_cfqd(cfqd);
 }
 
 static int cfq_init_queue(request_queue_t *q, elevator_t *e)
@@ -1505,7 +1737,9 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 		return -ENOMEM;
 
 	memset(cfqd, 0, sizeof(*cfqd));
-	INIT_LIST_HEAD(&cfqd->rr_list);
+	for (i = 0; i < CFQ_PRIO_LISTS; i++)
+		INIT_LIST_HEAD(&cfqd->rr_list[i]);
+	INIT_LIST_HEAD(&cfqd->idle_rr_list);
 	INIT_LIST_HEAD(&cfqd->empty_list);
 
 	cfqd->crq_hash = kmalloc(sizeof(struct hlist_head) * CFQ_MHASH_ENTRIES, GFP_KERNEL);
@@ -1530,6 +1764,11 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 	cfqd->queue = q;
 	atomic_inc(&q->refcnt);
 
+	init_timer(&cfqd->idle_slice_timer);
+	cfqd->idle_slice_timer.function = cfq_idle_slice_timer;
+	cfqd->idle_slice_timer.data = (unsigned long) cfqd;
+	INIT_WORK(&cfqd->unplug_work, cfq_kick_queue, q);
+
 	/*
 	 * just set it to some high value, we want anyone to be able to queue
 	 * some requests. fairness is handled differently
@@ -1548,6 +1787,9 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 	cfqd->cfq_fifo_batch_expire = cfq_fifo_rate;
 	cfqd->cfq_back_max = cfq_back_max;
 	cfqd->cfq_back_penalty = cfq_back_penalty;
+	cfqd->cfq_slice[0] = cfq_slice_async;
+	cfqd->cfq_slice[1] = cfq_slice_sync;
+	cfqd->cfq_slice_idle = cfq_slice_idle;
 
 	return 0;
 out_crqpool:
@@ -1672,6 +1914,9 @@ SHOW_FUNCTION(cfq_fifo_batch_expire_show, cfqd->cfq_fifo_batch_expire, 1);
 SHOW_FUNCTION(cfq_find_best_show, cfqd->find_best_crq, 0);
 SHOW_FUNCTION(cfq_back_max_show, cfqd->cfq_back_max, 0);
 SHOW_FUNCTION(cfq_back_penalty_show, cfqd->cfq_back_penalty, 0);
+SHOW_FUNCTION(cfq_slice_idle_show, cfqd->cfq_slice_idle, 1);
+SHOW_FUNCTION(cfq_slice_sync_show, cfqd->cfq_slice[1], 1);
+SHOW_FUNCTION(cfq_slice_async_show, cfqd->cfq_slice[0], 1);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -1697,6 +1942,9 @@ STORE_FUNCTION(cfq_fifo_batch_expire_store, &cfqd->cfq_fifo_batch_expire, 0, UIN
 STORE_FUNCTION(cfq_find_best_store, &cfqd->find_best_crq, 0, 1, 0);
 STORE_FUNCTION(cfq_back_max_store, &cfqd->cfq_back_max, 0, UINT_MAX, 0);
 STORE_FUNCTION(cfq_back_penalty_store, &cfqd->cfq_back_penalty, 1, UINT_MAX, 0);
+STORE_FUNCTION(cfq_slice_idle_store, &cfqd->cfq_slice_idle, 0, UINT_MAX, 1);
+STORE_FUNCTION(cfq_slice_sync_store, &cfqd->cfq_slice[1], 1, UINT_MAX, 1);
+STORE_FUNCTION(cfq_slice_async_store, &cfqd->cfq_slice[0], 1, UINT_MAX, 1);
 #undef STORE_FUNCTION
 
 static struct cfq_fs_entry cfq_quantum_entry = {
@@ -1739,6 +1987,21 @@ static struct cfq_fs_entry cfq_back_penalty_entry = {
 	.show = cfq_back_penalty_show,
 	.store = cfq_back_penalty_store,
 };
+static struct cfq_fs_entry cfq_slice_idle_entry = {
+	.attr = {.name = "slice_idle", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_idle_show,
+	.store = cfq_slice_idle_store,
+};
+static struct cfq_fs_entry cfq_slice_sync_entry = {
+	.attr = {.name = "slice_sync", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_sync_show,
+	.store = cfq_slice_sync_store,
+};
+static struct cfq_fs_entry cfq_slice_async_entry = {
+	.attr = {.name = "slice_async", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_async_show,
+	.store = cfq_slice_async_store,
+};
 static struct cfq_fs_entry cfq_clear_elapsed_entry = {
 	.attr = {.name = "clear_elapsed", .mode = S_IWUSR },
 	.store = cfq_clear_elapsed,
@@ -1759,6 +2022,9 @@ static struct attribute *default_attrs[] = {
 	&cfq_find_best_entry.attr,
 	&cfq_back_max_entry.attr,
 	&cfq_back_penalty_entry.attr,
+	&cfq_slice_sync_entry.attr,
+	&cfq_slice_async_entry.attr,
+	&cfq_slice_idle_entry.attr,
 	&cfq_clear_elapsed_entry.attr,
 	NULL,
 };
@@ -34,6 +34,7 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/compiler.h>
+#include <linux/blktrace_api.h>
 
 #include <asm/uaccess.h>
 
@@ -282,6 +283,8 @@ void elv_requeue_request(request_queue_t *q, struct request *rq)
 {
 	elv_deactivate_request(q, rq);
 
+	blk_add_trace_rq(q, rq, BLK_TA_REQUEUE);
+
 	/*
 	 * if this is the flush, requeue the original instead and drop the flush
 	 */
@@ -315,6 +318,8 @@ void __elv_add_request(request_queue_t *q, struct request *rq, int where,
 
 	rq->q = q;
 
+	blk_add_trace_rq(q, rq, BLK_TA_INSERT);
+
 	if (!test_bit(QUEUE_FLAG_DRAIN, &q->queue_flags)) {
 		q->elevator->ops->elevator_add_req_fn(q, rq, where);
 
@@ -374,7 +379,10 @@ struct request *elv_next_request(request_queue_t *q)
 		 * that has been delayed should not be passed by new incoming
 		 * requests
 		 */
-		rq->flags |= REQ_STARTED;
+		if (!(rq->flags & REQ_STARTED)) {
+			blk_add_trace_rq(q, rq, BLK_TA_ISSUE);
+			rq->flags |= REQ_STARTED;
+		}
 
 		if (rq == q->last_merge)
 			q->last_merge = NULL;
@@ -28,6 +28,9 @@
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/writeback.h>
+#include <linux/blk-mq.h>
+#include <linux/blktrace_api.h>
+#include <linux/interrupt.h>
 
 /*
  * for max sense size
@@ -1422,8 +1425,10 @@ void blk_plug_device(request_queue_t *q)
 	if (test_bit(QUEUE_FLAG_STOPPED, &q->queue_flags))
 		return;
 
-	if (!test_and_set_bit(QUEUE_FLAG_PLUGGED, &q->queue_flags))
+	if (!test_and_set_bit(QUEUE_FLAG_PLUGGED, &q->queue_flags)) {
 		mod_timer(&q->unplug_timer, jiffies + q->unplug_delay);
+		blk_add_trace_generic(q, NULL, 0, BLK_TA_PLUG);
+	}
 }
 
 EXPORT_SYMBOL(blk_plug_device);
@@ -1456,6 +1461,9 @@ void __generic_unplug_device(request_queue_t *q)
 	if (!blk_remove_plug(q))
 		return;
 
+	blk_add_trace_pdu_int(q, BLK_TA_UNPLUG_IO, NULL,
+				q->rq.count[READ] + q->rq.count[WRITE]);
+
 	/*
 	 * was plugged, fire request_fn if queue has stuff to do
 	 */
@@ -1506,6 +1514,9 @@ static void blk_unplug_timeout(unsigned long data)
 {
 	request_queue_t *q = (request_queue_t *)data;
 
+	blk_add_trace_pdu_int(q, BLK_TA_UNPLUG_TIMER, NULL,
+				q->rq.count[READ] + q->rq.count[WRITE]);
+
 	kblockd_schedule_work(&q->unplug_work);
 }
 
@@ -1621,6 +1632,13 @@ void blk_cleanup_queue(request_queue_t * q)
 
 	blk_sync_queue(q);
 
+	blk_trace_shutdown(q);
+
+#ifdef CONFIG_BLK_MQ
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+#endif
+
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
 
@@ -1956,6 +1974,10 @@ static struct request *get_request_wait(request_queue_t *q, int rw)
 	DEFINE_WAIT(wait);
 	struct request *rq;
 
+	/*
+	 * the requests we are waiting for may be sitting on our own plug
+	 */
+	blk_flush_plug(current);
 	generic_unplug_device(q);
 	do {
 		struct request_list *rl = &q->rq;
@@ -2556,10 +2578,186 @@ void __blk_attempt_remerge(request_queue_t *q, struct request *rq)
 
 EXPORT_SYMBOL(__blk_attempt_remerge);
 
+/**
+ * blk_start_plug - hold back the requests the current task queues
+ * @plug:	the &struct blk_plug, usually on the caller's stack
+ *
+ * Description:
+ *   Until blk_finish_plug(), the requests this task builds for a queue
+ *   with the default make_request_fn are collected on @plug instead of
+ *   going to the queue, so that a batch of io is handed over sorted and
+ *   with a single acquisition of each queue lock, and that the queue
+ *   doesn't have to be plugged (and its unplug timer waited for) to build
+ *   up merges.  If the task is already plugging, the outer plug is kept.
+ **/
+void blk_start_plug(struct blk_plug *plug)
+{
+	struct task_struct *tsk = current;
+
+	INIT_LIST_HEAD(&plug->list);
+
+	if (!tsk->plug)
+		tsk->plug = plug;
+}
+
+EXPORT_SYMBOL(blk_start_plug);
+
+/*
+ * keep the plug sorted by queue, then by sector.  io is usually built in
+ * ascending order, so look from the tail
+ */
+static void blk_plug_add_request(struct blk_plug *plug, struct request *rq)
+{
+	struct list_head *entry;
+
+	list_for_each_prev(entry, &plug->list) {
+		struct request *pos = list_entry_rq(entry);
+
+		if (pos->q < rq->q ||
+		    (pos->q == rq->q && pos->sector <= rq->sector))
+			break;
+	}
+
+	list_add(&rq->queuelist, entry);
+}
+
+/*
+ * try to merge the bio into a request on the plug.  The requests on it
+ * belong to this task alone, so this needs no locking.  The disk stats
+ * pick up the merged sectors when the request is flushed to the queue.
+ */
+static int blk_attempt_plug_merge(struct blk_plug *plug, request_queue_t *q,
+				  struct bio *bio)
+{
+	struct request *rq;
+	int nr_sectors = bio_sectors(bio);
+
+	list_for_each_entry_reverse(rq, &plug->list, queuelist) {
+		if (rq->q != q || !elv_rq_merge_ok(rq, bio))
+			continue;
+
+		if (rq->sector + rq->nr_sectors == bio->bi_sector) {
+			if (!q->back_merge_fn(q, rq, bio))
+				return 0;
+
+			blk_add_trace_bio(q, bio, BLK_TA_BACKMERGE);
+
+			rq->biotail->bi_next = bio;
+			rq->biotail = bio;
+			rq->nr_sectors = rq->hard_nr_sectors += nr_sectors;
+			return 1;
+		}
+
+		if (rq->sector - nr_sectors == bio->bi_sector) {
+			if (!q->front_merge_fn(q, rq, bio))
+				return 0;
+
+			blk_add_trace_bio(q, bio, BLK_TA_FRONTMERGE);
+
+			bio->bi_next = rq->bio;
+			rq->bio = bio;
+			rq->buffer = bio_data(bio);
+			rq->current_nr_sectors = bio_cur_sectors(bio);
+			rq->hard_cur_sectors = rq->current_nr_sectors;
+			rq->sector = rq->hard_sector = bio->bi_sector;
+			rq->nr_sectors = rq->hard_nr_sectors += nr_sectors;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * the plugging task is done, so there is no point in waiting for more io:
+ * let the queue rip right away.  Called with the queue lock held.
+ */
+static void blk_run_plugged_queue(request_queue_t *q)
+{
+	if (test_bit(QUEUE_FLAG_STOPPED, &q->queue_flags))
+		return;
+
+	blk_remove_plug(q);
+
+	if (elv_next_request(q))
+		q->request_fn(q);
+}
+
+/**
+ * blk_flush_plug - hand the requests held on a task's plug to their queues
+ * @tsk:	the task, must be current
+ *
+ * Description:
+ *   Inserts the requests in sector order, taking each queue lock once,
+ *   and starts the queues.  Called by blk_finish_plug(), when the task
+ *   sleeps or when it has to wait for a free request.  Doesn't sleep.
+ **/
+void blk_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+	request_queue_t *q = NULL;
+	struct request *rq;
+	unsigned long flags;
+
+	if (!plug || list_empty(&plug->list))
+		return;
+
+	local_irq_save(flags);
+	while (!list_empty(&plug->list)) {
+		rq = list_entry_rq(plug->list.next);
+		list_del_init(&rq->queuelist);
+
+		if (rq->q != q) {
+			if (q) {
+				blk_run_plugged_queue(q);
+				spin_unlock(q->queue_lock);
+			}
+			q = rq->q;
+			spin_lock(q->queue_lock);
+		}
+
+		add_request(q, rq);
+	}
+
+	blk_run_plugged_queue(q);
+	spin_unlock(q->queue_lock);
+	local_irq_restore(flags);
+}
+
+/**
+ * blk_finish_plug - submit the requests held back since blk_start_plug()
+ * @plug:	the &struct blk_plug passed to blk_start_plug()
+ **/
+void blk_finish_plug(struct blk_plug *plug)
+{
+	struct task_struct *tsk = current;
+
+	if (tsk->plug != plug)
+		return;
+
+	blk_flush_plug(tsk);
+	tsk->plug = NULL;
+}
+
+EXPORT_SYMBOL(blk_finish_plug);
+
+/*
+ * io submitted from interrupt context must not end up on the plug of
+ * whatever task happened to be interrupted
+ */
+static inline struct blk_plug *blk_current_plug(void)
+{
+	if (in_interrupt())
+		return NULL;
+
+	return current->plug;
+}
+
 static int __make_request(request_queue_t *q, struct bio *bio)
 {
 	struct request *req, *freereq = NULL;
 	int el_ret, rw, nr_sectors, cur_nr_sectors, barrier, err;
+	struct blk_plug *plug;
 	sector_t sector;
 
 	sector = bio->bi_sector;
@@ -2575,6 +2773,8 @@ static int __make_request(request_queue_t *q, struct bio *bio)
 	 */
 	blk_queue_bounce(q, &bio);
 
+	blk_add_trace_bio(q, bio, BLK_TA_QUEUE);
+
 	spin_lock_prefetch(q->queue_lock);
 
 	barrier = bio_barrier(bio);
@@ -2583,11 +2783,24 @@ static int __make_request(request_queue_t *q, struct bio *bio)
 		goto end_io;
 	}
 
+	plug = blk_current_plug();
+	if (plug) {
+		/*
+		 * a barrier must not pass what was plugged before it
+		 */
+		if (barrier) {
+			blk_flush_plug(current);
+			plug = NULL;
+		} else if (blk_attempt_plug_merge(plug, q, bio))
+			return 0;
+	}
+
 again:
 	spin_lock_irq(q->queue_lock);
 
 	if (elv_queue_empty(q)) {
-		blk_plug_device(q);
+		if (!plug)
+			blk_plug_device(q);
 		goto get_rq;
 	}
 	if (barrier)
@@ -2601,6 +2814,8 @@ again:
 			if (!q->back_merge_fn(q, req, bio))
 				break;
 
+			blk_add_trace_bio(q, bio, BLK_TA_BACKMERGE);
+
 			req->biotail->bi_next = bio;
 			req->biotail = bio;
 			req->nr_sectors = req->hard_nr_sectors += nr_sectors;
@@ -2615,6 +2830,8 @@ again:
 			if (!q->front_merge_fn(q, req, bio))
 				break;
 
+			blk_add_trace_bio(q, bio, BLK_TA_FRONTMERGE);
+
 			bio->bi_next = req->bio;
 			req->bio = bio;
 
@@ -2663,11 +2880,14 @@ get_rq:
 			if (bio_rw_ahead(bio))
 				goto end_io;
 	
+			blk_add_trace_bio(q, bio, BLK_TA_SLEEPRQ);
 			freereq = get_request_wait(q, rw);
 		}
 		goto again;
 	}
 
+	blk_add_trace_bio(q, bio, BLK_TA_GETRQ);
+
 	req->flags |= REQ_CMD;
 
 	/*
@@ -2694,7 +2914,10 @@ get_rq:
 	req->rq_disk = bio->bi_bdev->bd_disk;
 	req->start_time = jiffies;
 
-	add_request(q, req);
+	if (plug)
+		blk_plug_add_request(plug, req);
+	else
+		add_request(q, req);
 out:
 	if (freereq)
 		__blk_put_request(q, freereq);
@@ -3063,6 +3286,8 @@ static int __end_that_request_first(struct request *req, int uptodate,
 				(unsigned long long)req->sector);
 	}
 
+	blk_add_trace_rq(req->q, req, BLK_TA_COMPLETE);
+
 	total_bytes = bio_nbytes = 0;
 	while ((bio = req->bio) != NULL) {
 		int nbytes;
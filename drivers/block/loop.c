@@ -74,6 +74,8 @@
 #include <linux/completion.h>
 #include <linux/highmem.h>
 #include <linux/gfp.h>
+#include <linux/mempool.h>
+#include <linux/vmalloc.h>
 
 #include <asm/uaccess.h>
 
@@ -504,10 +506,172 @@ static struct bio *loop_get_bio(struct loop_device *lo)
 	return bio;
 }
 
+/*
+ * Direct mode.  Instead of going through the page cache of the backing
+ * file one bio at a time in loop_thread, bios are remapped to where the
+ * file lives on its block device, the way swap files are handled, and
+ * submitted straight from loop_make_request.  Any number of them can be
+ * in flight and nothing gets cached twice.  The map of the file is built
+ * with bmap() when direct mode is switched on, so the file must not have
+ * holes, and it is marked as a swap file to keep it from being truncated
+ * under us.
+ */
+static kmem_cache_t *loop_dio_cache;
+static mempool_t *loop_dio_pool;
+static struct bio_set *loop_bio_set;
+
+#define LOOP_MIN_DIO	16
+
+struct loop_dio {
+	struct loop_device	*lo;
+	struct bio		*bio;
+	atomic_t		remaining;
+	int			error;
+};
+
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					    sector_t sector)
+{
+	unsigned int l = 0, h = lo->lo_nr_extents;
+
+	while (l < h) {
+		unsigned int m = (l + h) / 2;
+		struct loop_extent *ext = &lo->lo_extents[m];
+
+		if (sector < ext->start)
+			h = m;
+		else if (sector >= ext->start + ext->nr)
+			l = m + 1;
+		else
+			return ext;
+	}
+
+	return NULL;
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+	struct bio *bio = dio->bio;
+
+	if (!atomic_dec_and_test(&dio->remaining))
+		return;
+
+	bio_endio(bio, bio->bi_size, dio->error);
+	mempool_free(dio, loop_dio_pool);
+
+	if (atomic_dec_and_test(&lo->lo_direct_inflight))
+		wake_up(&lo->lo_direct_wait);
+}
+
+static int loop_direct_end_io(struct bio *bio, unsigned int bytes_done,
+			      int error)
+{
+	struct loop_dio *dio = bio->bi_private;
+
+	if (bio->bi_size)
+		return 1;
+
+	if (!error && !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		error = -EIO;
+	if (error)
+		dio->error = error;
+
+	bio_put(bio);
+	loop_dio_put(dio);
+	return 0;
+}
+
+static void loop_direct_submit(struct loop_dio *dio, struct bio *bio)
+{
+	if (!bio)
+		return;
+
+	atomic_inc(&dio->remaining);
+	generic_make_request(bio);
+}
+
+/*
+ * Remap @bio to the backing device.  A bio that crosses extents is split
+ * into one bio per extent, pointing at the pages of the original.  The
+ * caller holds a reference on lo_direct_inflight, which is dropped when
+ * the bio completes.
+ */
+static void loop_direct_bio(struct loop_device *lo, struct bio *bio)
+{
+	struct loop_extent *ext = NULL;
+	struct bio *clone = NULL;
+	sector_t sector = bio->bi_sector;
+	struct loop_dio *dio;
+	struct bio_vec *bvec;
+	int i;
+
+	dio = mempool_alloc(loop_dio_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->error = 0;
+	atomic_set(&dio->remaining, 1);
+
+	bio_for_each_segment(bvec, bio, i) {
+		unsigned int offset = 0;
+
+		while (offset < bvec->bv_len) {
+			unsigned int len = bvec->bv_len - offset;
+			struct bio_vec *cvec;
+			sector_t left;
+
+			if (!ext || sector >= ext->start + ext->nr) {
+				loop_direct_submit(dio, clone);
+				clone = NULL;
+				ext = loop_find_extent(lo, sector);
+				if (!ext)
+					goto fail;
+			}
+
+			left = ext->start + ext->nr - sector;
+			if (len > (left << 9))
+				len = left << 9;
+
+			if (!clone) {
+				clone = bio_alloc_bioset(GFP_NOIO,
+							 bio->bi_vcnt - i,
+							 loop_bio_set);
+				if (!clone)
+					goto fail;
+				clone->bi_sector = ext->disk +
+						   (sector - ext->start);
+				clone->bi_bdev = lo->lo_direct_bdev;
+				clone->bi_rw = bio->bi_rw &
+					       ~(1 << BIO_RW_BARRIER);
+				clone->bi_end_io = loop_direct_end_io;
+				clone->bi_private = dio;
+			}
+
+			cvec = &clone->bi_io_vec[clone->bi_vcnt++];
+			cvec->bv_page = bvec->bv_page;
+			cvec->bv_offset = bvec->bv_offset + offset;
+			cvec->bv_len = len;
+			clone->bi_size += len;
+
+			offset += len;
+			sector += len >> 9;
+		}
+	}
+
+	loop_direct_submit(dio, clone);
+	loop_dio_put(dio);
+	return;
+
+fail:
+	dio->error = -EIO;
+	loop_dio_put(dio);
+}
+
 static int loop_make_request(request_queue_t *q, struct bio *old_bio)
 {
 	struct loop_device *lo = q->queuedata;
 	int rw = bio_rw(old_bio);
+	int direct;
 
 	if (!lo)
 		goto out;
@@ -515,7 +679,14 @@ static int loop_make_request(request_queue_t *q, struct bio *old_bio)
 	spin_lock_irq(&lo->lo_lock);
 	if (lo->lo_state != Lo_bound)
 		goto inactive;
-	atomic_inc(&lo->lo_pending);
+	/*
+	 * switch requests (no bi_bdev) always go through the thread
+	 */
+	direct = (lo->lo_flags & LO_FLAGS_DIRECT) && old_bio->bi_bdev;
+	if (direct)
+		atomic_inc(&lo->lo_direct_inflight);
+	else
+		atomic_inc(&lo->lo_pending);
 	spin_unlock_irq(&lo->lo_lock);
 
 	if (rw == WRITE) {
@@ -527,10 +698,16 @@ static int loop_make_request(request_queue_t *q, struct bio *old_bio)
 		printk(KERN_ERR "loop: unknown command (%x)\n", rw);
 		goto err;
 	}
-	loop_add_bio(lo, old_bio);
+	if (direct)
+		loop_direct_bio(lo, old_bio);
+	else
+		loop_add_bio(lo, old_bio);
 	return 0;
 err:
-	if (atomic_dec_and_test(&lo->lo_pending))
+	if (direct) {
+		if (atomic_dec_and_test(&lo->lo_direct_inflight))
+			wake_up(&lo->lo_direct_wait);
+	} else if (atomic_dec_and_test(&lo->lo_pending))
 		up(&lo->lo_bh_mutex);
 out:
 	bio_io_error(old_bio, old_bio->bi_size);
@@ -552,19 +729,34 @@ static void loop_unplug(request_queue_t *q)
 }
 
 struct switch_request {
-	struct file *file;
+	struct file *file;		/* new backing file, or */
+	struct loop_extent *extents;	/* direct mode map, NULL for off */
+	unsigned int nr_extents;
+	struct block_device *bdev;
 	struct completion wait;
 };
 
 static void do_loop_switch(struct loop_device *, struct switch_request *);
+static void do_loop_set_direct(struct loop_device *, struct switch_request *);
 
 static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 {
+	struct switch_request *p;
 	int ret;
 
 	if (unlikely(!bio->bi_bdev)) {
-		do_loop_switch(lo, bio->bi_private);
+		p = bio->bi_private;
+		if (p->file)
+			do_loop_switch(lo, p);
+		else
+			do_loop_set_direct(lo, p);
 		bio_put(bio);
+	} else if (lo->lo_flags & LO_FLAGS_DIRECT) {
+		/*
+		 * queued before direct mode was switched on
+		 */
+		atomic_inc(&lo->lo_direct_inflight);
+		loop_direct_bio(lo, bio);
 	} else {
 		ret = do_bio_filebacked(lo, bio);
 		bio_endio(bio, bio->bi_size, ret);
@@ -634,21 +826,28 @@ static int loop_thread(void *data)
  * First it needs to flush existing IO, it does this by sending a magic
  * BIO down the pipe. The completion of this BIO does the actual switch.
  */
-static int loop_switch(struct loop_device *lo, struct file *file)
+static int loop_send_switch(struct loop_device *lo, struct switch_request *w)
 {
-	struct switch_request w;
 	struct bio *bio = bio_alloc(GFP_KERNEL, 1);
 	if (!bio)
 		return -ENOMEM;
-	init_completion(&w.wait);
-	w.file = file;
-	bio->bi_private = &w;
+	init_completion(&w->wait);
+	bio->bi_private = w;
 	bio->bi_bdev = NULL;
 	loop_make_request(lo->lo_queue, bio);
-	wait_for_completion(&w.wait);
+	wait_for_completion(&w->wait);
 	return 0;
 }
 
+static int loop_switch(struct loop_device *lo, struct file *file)
+{
+	struct switch_request w;
+
+	memset(&w, 0, sizeof(w));
+	w.file = file;
+	return loop_send_switch(lo, &w);
+}
+
 /*
  * Do the actual switch; called from the BIO completion routine
  */
@@ -666,6 +865,203 @@ static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
 	complete(&p->wait);
 }
 
+/*
+ * Build the extent map for direct mode into @p
+ */
+static int loop_build_extents(struct loop_device *lo, struct switch_request *p)
+{
+	struct file *file = lo->lo_backing_file;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	sector_t size = get_loop_size(lo, file);
+	struct loop_extent *ext, *new;
+	unsigned int nr = 0, max = 64;
+	sector_t block, nr_blocks, i;
+	unsigned int blkbits, spb;
+
+	if (!size)
+		return -EINVAL;
+
+	if (S_ISBLK(inode->i_mode)) {
+		if (lo->lo_offset & 511)
+			return -EINVAL;
+		ext = vmalloc(sizeof(*ext));
+		if (!ext)
+			return -ENOMEM;
+		ext->start = 0;
+		ext->disk = lo->lo_offset >> 9;
+		ext->nr = size;
+		p->extents = ext;
+		p->nr_extents = 1;
+		p->bdev = I_BDEV(inode);
+		return 0;
+	}
+
+	if (!mapping->a_ops->bmap || !inode->i_sb->s_bdev)
+		return -EINVAL;
+
+	blkbits = inode->i_blkbits;
+	if (lo->lo_offset & ((1 << blkbits) - 1))
+		return -EINVAL;
+	spb = 1 << (blkbits - 9);
+
+	block = lo->lo_offset >> blkbits;
+	nr_blocks = (size + spb - 1) >> (blkbits - 9);
+
+	ext = vmalloc(max * sizeof(*ext));
+	if (!ext)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_blocks; i++) {
+		sector_t phys = bmap(inode, block + i);
+
+		/*
+		 * a hole, or something bmap can't tell us about
+		 */
+		if (!phys)
+			goto fail;
+
+		phys <<= blkbits - 9;
+		if (nr && ext[nr - 1].disk + ext[nr - 1].nr == phys) {
+			ext[nr - 1].nr += spb;
+			continue;
+		}
+
+		if (nr == max) {
+			new = vmalloc(2 * max * sizeof(*ext));
+			if (!new) {
+				vfree(ext);
+				return -ENOMEM;
+			}
+			memcpy(new, ext, max * sizeof(*ext));
+			vfree(ext);
+			ext = new;
+			max *= 2;
+		}
+
+		ext[nr].start = i * spb;
+		ext[nr].disk = phys;
+		ext[nr].nr = spb;
+		nr++;
+
+		if (!(i & 1023))
+			cond_resched();
+	}
+
+	p->extents = ext;
+	p->nr_extents = nr;
+	p->bdev = inode->i_sb->s_bdev;
+	return 0;
+
+fail:
+	vfree(ext);
+	return -EINVAL;
+}
+
+/*
+ * Switch direct mode on or off; called from the BIO completion routine,
+ * so that everything queued before went through the old path
+ */
+static void do_loop_set_direct(struct loop_device *lo, struct switch_request *p)
+{
+	struct address_space *mapping = lo->lo_backing_file->f_mapping;
+	struct loop_extent *old;
+
+	if (p->extents) {
+		/*
+		 * what was written so far is in the page cache of the file,
+		 * push it out and drop it before reading behind its back
+		 */
+		filemap_fdatawrite(mapping);
+		filemap_fdatawait(mapping);
+		invalidate_inode_pages(mapping);
+
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_extents = p->extents;
+		lo->lo_nr_extents = p->nr_extents;
+		lo->lo_direct_bdev = p->bdev;
+		lo->lo_flags |= LO_FLAGS_DIRECT;
+		spin_unlock_irq(&lo->lo_lock);
+	} else {
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_flags &= ~LO_FLAGS_DIRECT;
+		spin_unlock_irq(&lo->lo_lock);
+
+		wait_event(lo->lo_direct_wait,
+			   !atomic_read(&lo->lo_direct_inflight));
+
+		old = lo->lo_extents;
+		lo->lo_extents = NULL;
+		lo->lo_nr_extents = 0;
+		lo->lo_direct_bdev = NULL;
+		p->extents = old;
+		invalidate_inode_pages(mapping);
+	}
+	complete(&p->wait);
+}
+
+static void loop_direct_release_file(struct loop_device *lo,
+				     struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+
+	if (S_ISREG(inode->i_mode)) {
+		down(&inode->i_sem);
+		inode->i_flags &= ~S_SWAPFILE;
+		up(&inode->i_sem);
+	}
+}
+
+/*
+ * Turn direct mode on or off, see loop_direct_bio()
+ */
+static int loop_set_direct(struct loop_device *lo, int on)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode = file->f_mapping->host;
+	struct switch_request w;
+	int error;
+
+	memset(&w, 0, sizeof(w));
+
+	if (on) {
+		if (lo->lo_encryption)
+			return -EINVAL;
+
+		error = loop_build_extents(lo, &w);
+		if (error)
+			return error;
+
+		if (S_ISREG(inode->i_mode)) {
+			down(&inode->i_sem);
+			if (IS_SWAPFILE(inode)) {
+				up(&inode->i_sem);
+				vfree(w.extents);
+				return -EBUSY;
+			}
+			inode->i_flags |= S_SWAPFILE;
+			up(&inode->i_sem);
+		}
+
+		blk_queue_stack_limits(lo->lo_queue, bdev_get_queue(w.bdev));
+	}
+
+	error = loop_send_switch(lo, &w);
+	if (error) {
+		if (on) {
+			loop_direct_release_file(lo, file);
+			vfree(w.extents);
+		}
+		return error;
+	}
+
+	if (!on) {
+		loop_direct_release_file(lo, file);
+		vfree(w.extents);
+	}
+	return 0;
+}
+
 
 /*
  * loop_change_fd switched the backing store of a loopback device to
@@ -686,9 +1082,10 @@ static int loop_change_fd(struct loop_device *lo, struct file *lo_file,
 	if (lo->lo_state != Lo_bound)
 		goto out;
 
-	/* the loop device has to be read-only */
+	/* the loop device has to be read-only, and not mapping the old file */
 	error = -EINVAL;
-	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
+	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY) ||
+	    (lo->lo_flags & LO_FLAGS_DIRECT))
 		goto out;
 
 	error = -EBADF;
@@ -906,6 +1303,16 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 
 	down(&lo->lo_sem);
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT) {
+		wait_event(lo->lo_direct_wait,
+			   !atomic_read(&lo->lo_direct_inflight));
+		vfree(lo->lo_extents);
+		lo->lo_extents = NULL;
+		lo->lo_nr_extents = 0;
+		lo->lo_direct_bdev = NULL;
+		loop_direct_release_file(lo, filp);
+	}
+
 	lo->lo_backing_file = NULL;
 
 	loop_release_xfer(lo);
@@ -944,6 +1351,22 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	/* direct mode bypasses the transfer functions */
+	if ((info->lo_flags & LO_FLAGS_DIRECT) && info->lo_encrypt_type)
+		return -EINVAL;
+
+	/*
+	 * the map of the file depends on the offset and size limit, so
+	 * direct mode is switched off and back on around a change of them
+	 */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT) &&
+	    (!(info->lo_flags & LO_FLAGS_DIRECT) ||
+	     lo->lo_offset != info->lo_offset ||
+	     lo->lo_sizelimit != info->lo_sizelimit)) {
+		err = loop_set_direct(lo, 0);
+		if (err)
+			return err;
+	}
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -991,6 +1414,10 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		lo->lo_key_owner = current->uid;
 	}	
 
+	if ((info->lo_flags & LO_FLAGS_DIRECT) &&
+	    !(lo->lo_flags & LO_FLAGS_DIRECT))
+		return loop_set_direct(lo, 1);
+
 	return 0;
 }
 
@@ -1242,6 +1669,13 @@ int loop_unregister_transfer(int number)
 EXPORT_SYMBOL(loop_register_transfer);
 EXPORT_SYMBOL(loop_unregister_transfer);
 
+static void loop_direct_exit(void)
+{
+	bioset_free(loop_bio_set);
+	mempool_destroy(loop_dio_pool);
+	kmem_cache_destroy(loop_dio_cache);
+}
+
 static int __init loop_init(void)
 {
 	int	i;
@@ -1252,8 +1686,22 @@ static int __init loop_init(void)
 		max_loop = 8;
 	}
 
-	if (register_blkdev(LOOP_MAJOR, "loop"))
+	loop_dio_cache = kmem_cache_create("loop_dio", sizeof(struct loop_dio),
+					   0, 0, NULL, NULL);
+	if (!loop_dio_cache)
+		return -ENOMEM;
+	loop_dio_pool = mempool_create(LOOP_MIN_DIO, mempool_alloc_slab,
+				       mempool_free_slab, loop_dio_cache);
+	if (!loop_dio_pool)
+		goto out_dio1;
+	loop_bio_set = bioset_create(LOOP_MIN_DIO, LOOP_MIN_DIO, 4);
+	if (!loop_bio_set)
+		goto out_dio2;
+
+	if (register_blkdev(LOOP_MAJOR, "loop")) {
+		loop_direct_exit();
 		return -EIO;
+	}
 
 	loop_dev = kmalloc(max_loop * sizeof(struct loop_device), GFP_KERNEL);
 	if (!loop_dev)
@@ -1283,6 +1731,7 @@ static int __init loop_init(void)
 		init_MUTEX(&lo->lo_ctl_mutex);
 		init_MUTEX_LOCKED(&lo->lo_sem);
 		init_MUTEX_LOCKED(&lo->lo_bh_mutex);
+		init_waitqueue_head(&lo->lo_direct_wait);
 		lo->lo_number = i;
 		spin_lock_init(&lo->lo_lock);
 		disk->major = LOOP_MAJOR;
@@ -1313,8 +1762,15 @@ out_mem2:
 	kfree(loop_dev);
 out_mem1:
 	unregister_blkdev(LOOP_MAJOR, "loop");
+	loop_direct_exit();
 	printk(KERN_ERR "loop: ran out of memory\n");
 	return -ENOMEM;
+
+out_dio2:
+	mempool_destroy(loop_dio_pool);
+out_dio1:
+	kmem_cache_destroy(loop_dio_cache);
+	return -ENOMEM;
 }
 
 static void loop_exit(void)
@@ -1332,6 +1788,7 @@ static void loop_exit(void)
 
 	kfree(disks);
 	kfree(loop_dev);
+	loop_direct_exit();
 }
 
 module_init(loop_init);
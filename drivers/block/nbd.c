@@ -54,6 +54,7 @@
 #include <linux/errno.h>
 #include <linux/file.h>
 #include <linux/ioctl.h>
+#include <linux/kthread.h>
 #include <net/sock.h>
 
 #include <linux/devfs_fs_kernel.h>
@@ -107,6 +108,7 @@ static const char *ioctl_cmd_to_ascii(int cmd)
 	case NBD_PRINT_DEBUG: return "print-debug";
 	case NBD_SET_SIZE_BLOCKS: return "set-size-blocks";
 	case NBD_DISCONNECT: return "disconnect";
+	case NBD_SET_DEPTH: return "set-depth";
 	case BLKROSET: return "set-read-only";
 	case BLKFLSBUF: return "flush-buffer-cache";
 	}
@@ -216,12 +218,13 @@ static inline int sock_send_bvec(struct socket *sock, struct bio_vec *bvec,
 	return result;
 }
 
-static int nbd_send_req(struct nbd_device *lo, struct request *req)
+static int nbd_send_req(struct nbd_device *lo, struct nbd_sock *ns,
+		struct request *req)
 {
 	int result, i, flags;
 	struct nbd_request request;
 	unsigned long size = req->nr_sectors << 9;
-	struct socket *sock = lo->sock;
+	struct socket *sock = ns->sock;
 
 	request.magic = htonl(NBD_REQUEST_MAGIC);
 	request.type = htonl(nbd_cmd(req));
@@ -229,9 +232,9 @@ static int nbd_send_req(struct nbd_device *lo, struct request *req)
 	request.len = htonl(size);
 	memcpy(request.handle, &req, sizeof(req));
 
-	down(&lo->tx_lock);
+	down(&ns->tx_lock);
 
-	if (!sock || !lo->sock) {
+	if (!sock || !ns->sock) {
 		printk(KERN_ERR "%s: Attempted send on closed socket\n",
 				lo->disk->disk_name);
 		goto error_out;
@@ -275,15 +278,43 @@ static int nbd_send_req(struct nbd_device *lo, struct request *req)
 			}
 		}
 	}
-	up(&lo->tx_lock);
+	up(&ns->tx_lock);
 	return 0;
 
 error_out:
-	up(&lo->tx_lock);
+	up(&ns->tx_lock);
 	return 1;
 }
 
-static struct request *nbd_find_request(struct nbd_device *lo, char *handle)
+/*
+ * Take a request off its connection, it is no longer in flight.  If that
+ * makes room below the depth limit, get do_nbd_request() going again;
+ * not from here, as the receivers must never block sending.  Called with
+ * lo->queue_lock held.
+ */
+static void nbd_unqueue_request(struct nbd_device *lo, struct request *req)
+{
+	list_del_init(&req->queuelist);
+	lo->in_flight--;
+
+	if (lo->throttled && (!lo->depth || lo->in_flight < lo->depth)) {
+		lo->throttled = 0;
+		kblockd_schedule_work(&lo->kick);
+	}
+}
+
+static void nbd_kick(void *data)
+{
+	struct nbd_device *lo = data;
+	request_queue_t *q = lo->disk->queue;
+
+	spin_lock_irq(q->queue_lock);
+	q->request_fn(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+static struct request *nbd_find_request(struct nbd_device *lo,
+		struct nbd_sock *ns, char *handle)
 {
 	struct request *req;
 	struct list_head *tmp;
@@ -292,11 +323,11 @@ static struct request *nbd_find_request(struct nbd_device *lo, char *handle)
 	memcpy(&xreq, handle, sizeof(xreq));
 
 	spin_lock(&lo->queue_lock);
-	list_for_each(tmp, &lo->queue_head) {
+	list_for_each(tmp, &ns->queue_head) {
 		req = list_entry(tmp, struct request, queuelist);
 		if (req != xreq)
 			continue;
-		list_del_init(&req->queuelist);
+		nbd_unqueue_request(lo, req);
 		spin_unlock(&lo->queue_lock);
 		return req;
 	}
@@ -315,12 +346,17 @@ static inline int sock_recv_bvec(struct socket *sock, struct bio_vec *bvec)
 }
 
 /* NULL returned = something went wrong, inform userspace */
-static struct request *nbd_read_stat(struct nbd_device *lo)
+static struct request *nbd_read_stat(struct nbd_device *lo, struct nbd_sock *ns)
 {
 	int result;
 	struct nbd_reply reply;
 	struct request *req;
-	struct socket *sock = lo->sock;
+	struct socket *sock = ns->sock;
+
+	if (!sock) {
+		result = -EPIPE;
+		goto harderror;
+	}
 
 	reply.magic = 0;
 	result = sock_xmit(sock, 0, &reply, sizeof(reply), MSG_WAITALL);
@@ -329,7 +365,7 @@ static struct request *nbd_read_stat(struct nbd_device *lo)
 				lo->disk->disk_name, result);
 		goto harderror;
 	}
-	req = nbd_find_request(lo, reply.handle);
+	req = nbd_find_request(lo, ns, reply.handle);
 	if (req == NULL) {
 		printk(KERN_ERR "%s: Unexpected reply (%p)\n",
 				lo->disk->disk_name, reply.handle);
@@ -377,36 +413,142 @@ harderror:
 	return NULL;
 }
 
-static void nbd_do_it(struct nbd_device *lo)
+/*
+ * Forcibly shutdown the sockets causing all listeners to error
+ *
+ * FIXME: This code is duplicated from sys_shutdown, but
+ * there should be a more generic interface rather than
+ * calling socket ops directly here
+ */
+static void nbd_shutdown_socks(struct nbd_device *lo)
+{
+	int i;
+
+	for (i = 0; i < lo->num_socks; i++) {
+		struct nbd_sock *ns = lo->socks[i];
+
+		down(&ns->tx_lock);
+		if (ns->sock) {
+			printk(KERN_WARNING "%s: shutting down socket %d\n",
+				lo->disk->disk_name, i);
+			ns->sock->ops->shutdown(ns->sock,
+				SEND_SHUTDOWN|RCV_SHUTDOWN);
+			ns->sock = NULL;
+		}
+		up(&ns->tx_lock);
+	}
+}
+
+/*
+ * Receive replies on one connection until it fails.  A connection going
+ * down takes the others with it, the device is then torn down as a whole.
+ */
+static void nbd_do_it(struct nbd_device *lo, struct nbd_sock *ns)
 {
 	struct request *req;
 
 	BUG_ON(lo->magic != LO_MAGIC);
 
-	while ((req = nbd_read_stat(lo)) != NULL)
+	while ((req = nbd_read_stat(lo, ns)) != NULL)
 		nbd_end_request(req);
-	return;
+
+	nbd_shutdown_socks(lo);
+}
+
+/* receivers for all but the first connection, which NBD_DO_IT serves */
+static int nbd_recv_thread(void *data)
+{
+	struct nbd_sock *ns = data;
+
+	nbd_do_it(ns->lo, ns);
+	complete(&ns->done);
+	return 0;
 }
 
 static void nbd_clear_que(struct nbd_device *lo)
 {
 	struct request *req;
+	int i;
 
 	BUG_ON(lo->magic != LO_MAGIC);
 
-	do {
-		req = NULL;
-		spin_lock(&lo->queue_lock);
-		if (!list_empty(&lo->queue_head)) {
-			req = list_entry(lo->queue_head.next, struct request, queuelist);
-			list_del_init(&req->queuelist);
-		}
-		spin_unlock(&lo->queue_lock);
-		if (req) {
-			req->errors++;
-			nbd_end_request(req);
-		}
-	} while (req);
+	for (i = 0; i < NBD_MAX_CONNECTIONS; i++) {
+		struct nbd_sock *ns = lo->socks[i];
+
+		if (!ns)
+			break;
+		do {
+			req = NULL;
+			spin_lock(&lo->queue_lock);
+			if (!list_empty(&ns->queue_head)) {
+				req = list_entry(ns->queue_head.next,
+						struct request, queuelist);
+				nbd_unqueue_request(lo, req);
+			}
+			spin_unlock(&lo->queue_lock);
+			if (req) {
+				req->errors++;
+				nbd_end_request(req);
+			}
+		} while (req);
+	}
+}
+
+/*
+ * Disconnect the device from its sockets.  The nbd_sock structures stay
+ * around for the next connection, a sender may still be looking at them.
+ */
+static void nbd_clear_socks(struct nbd_device *lo)
+{
+	struct file *files[NBD_MAX_CONNECTIONS];
+	int i, n;
+
+	spin_lock(&lo->queue_lock);
+	n = lo->num_socks;
+	lo->num_socks = 0;
+	spin_unlock(&lo->queue_lock);
+
+	for (i = 0; i < n; i++) {
+		struct nbd_sock *ns = lo->socks[i];
+
+		down(&ns->tx_lock);
+		ns->sock = NULL;
+		files[i] = ns->file;
+		ns->file = NULL;
+		up(&ns->tx_lock);
+	}
+
+	nbd_clear_que(lo);
+
+	for (i = 0; i < n; i++)
+		if (files[i])
+			fput(files[i]);
+}
+
+static int nbd_add_sock(struct nbd_device *lo, struct file *file)
+{
+	struct nbd_sock *ns = lo->socks[lo->num_socks];
+
+	if (!ns) {
+		ns = kmalloc(sizeof(*ns), GFP_KERNEL);
+		if (!ns)
+			return -ENOMEM;
+		memset(ns, 0, sizeof(*ns));
+		ns->lo = lo;
+		INIT_LIST_HEAD(&ns->queue_head);
+		init_MUTEX(&ns->tx_lock);
+		lo->socks[lo->num_socks] = ns;
+	}
+
+	down(&ns->tx_lock);
+	ns->file = file;
+	ns->sock = SOCKET_I(file->f_dentry->d_inode);
+	up(&ns->tx_lock);
+
+	spin_lock(&lo->queue_lock);
+	lo->num_socks++;
+	spin_unlock(&lo->queue_lock);
+	return 0;
 }
 
 /*
@@ -422,6 +564,20 @@ static void do_nbd_request(request_queue_t * q)
 	
 	while ((req = elv_next_request(q)) != NULL) {
 		struct nbd_device *lo;
+		struct nbd_sock *ns;
+
+		if (req->flags & REQ_CMD) {
+			lo = req->rq_disk->private_data;
+
+			/* leave it queued until a reply makes room */
+			spin_lock(&lo->queue_lock);
+			if (lo->depth && lo->in_flight >= lo->depth) {
+				lo->throttled = 1;
+				spin_unlock(&lo->queue_lock);
+				break;
+			}
+			spin_unlock(&lo->queue_lock);
+		}
 
 		blkdev_dequeue_request(req);
 		dprintk(DBG_BLKDEV, "%s: request %p: dequeued (flags=%lx)\n",
@@ -434,7 +590,7 @@ static void do_nbd_request(request_queue_t * q)
 
 		BUG_ON(lo->magic != LO_MAGIC);
 
-		if (!lo->file) {
+		if (!lo->num_socks) {
 			printk(KERN_ERR "%s: Request when not-ready\n",
 					lo->disk->disk_name);
 			goto error_out;
@@ -454,7 +610,7 @@ static void do_nbd_request(request_queue_t * q)
 
 		spin_lock(&lo->queue_lock);
 
-		if (!lo->file) {
+		if (!lo->num_socks) {
 			spin_unlock(&lo->queue_lock);
 			printk(KERN_ERR "%s: failed between accept and semaphore, file lost\n",
 					lo->disk->disk_name);
@@ -464,13 +620,16 @@ static void do_nbd_request(request_queue_t * q)
 			continue;
 		}
 
-		list_add(&req->queuelist, &lo->queue_head);
+		/* spread the requests over the connections */
+		ns = lo->socks[lo->next_sock++ % lo->num_socks];
+		list_add_tail(&req->queuelist, &ns->queue_head);
+		lo->in_flight++;
 		spin_unlock(&lo->queue_lock);
 
-		if (nbd_send_req(lo, req) != 0) {
+		if (nbd_send_req(lo, ns, req) != 0) {
 			printk(KERN_ERR "%s: Request send failed\n",
 					lo->disk->disk_name);
-			if (nbd_find_request(lo, (char *)&req) != NULL) {
+			if (nbd_find_request(lo, ns, (char *)&req) != NULL) {
 				/* we still own req */
 				req->errors++;
 				nbd_end_request(req);
@@ -494,7 +653,7 @@ static int nbd_ioctl(struct inode *inode, struct file *file,
 		     unsigned int cmd, unsigned long arg)
 {
 	struct nbd_device *lo = inode->i_bdev->bd_disk->private_data;
-	int error;
+	int error, i;
 	struct request sreq ;
 
 	if (!capable(CAP_SYS_ADMIN))
@@ -518,46 +677,46 @@ static int nbd_ioctl(struct inode *inode, struct file *file,
 		 */
 		sreq.sector = 0;
 		sreq.nr_sectors = 0;
-                if (!lo->sock)
+		if (!lo->num_socks)
 			return -EINVAL;
-                nbd_send_req(lo, &sreq);
-                return 0;
+		/* every connection is told, the server may serve each apart */
+		for (i = 0; i < lo->num_socks; i++)
+			nbd_send_req(lo, lo->socks[i], &sreq);
+		return 0;
  
 	case NBD_CLEAR_SOCK:
 		error = 0;
-		down(&lo->tx_lock);
-		lo->sock = NULL;
-		up(&lo->tx_lock);
-		spin_lock(&lo->queue_lock);
-		file = lo->file;
-		lo->file = NULL;
-		spin_unlock(&lo->queue_lock);
-		nbd_clear_que(lo);
+		nbd_clear_socks(lo);
 		spin_lock(&lo->queue_lock);
-		if (!list_empty(&lo->queue_head)) {
+		if (lo->in_flight) {
 			printk(KERN_ERR "nbd: disconnect: some requests are in progress -> please try again.\n");
 			error = -EBUSY;
 		}
 		spin_unlock(&lo->queue_lock);
-		if (file)
-			fput(file);
 		return error;
 	case NBD_SET_SOCK:
-		if (lo->file)
+		/* repeat to add more connections before NBD_DO_IT */
+		if (lo->running || lo->num_socks == NBD_MAX_CONNECTIONS)
 			return -EBUSY;
 		error = -EINVAL;
 		file = fget(arg);
 		if (file) {
 			inode = file->f_dentry->d_inode;
-			if (inode->i_sock) {
-				lo->file = file;
-				lo->sock = SOCKET_I(inode);
-				error = 0;
-			} else {
+			if (inode->i_sock)
+				error = nbd_add_sock(lo, file);
+			if (error)
 				fput(file);
-			}
 		}
 		return error;
+	case NBD_SET_DEPTH:
+		spin_lock(&lo->queue_lock);
+		lo->depth = arg;
+		if (lo->throttled) {
+			lo->throttled = 0;
+			kblockd_schedule_work(&lo->kick);
+		}
+		spin_unlock(&lo->queue_lock);
+		return 0;
 	case NBD_SET_BLKSIZE:
 		lo->blksize = arg;
 		lo->bytesize &= ~(lo->blksize-1);
@@ -578,49 +737,55 @@ static int nbd_ioctl(struct inode *inode, struct file *file,
 		set_capacity(lo->disk, lo->bytesize >> 9);
 		return 0;
 	case NBD_DO_IT:
-		if (!lo->file)
+		if (lo->running || !lo->num_socks)
 			return -EINVAL;
-		nbd_do_it(lo);
-		/* on return tidy up in case we have a signal */
-		/* Forcibly shutdown the socket causing all listeners
-		 * to error
-		 *
-		 * FIXME: This code is duplicated from sys_shutdown, but
-		 * there should be a more generic interface rather than
-		 * calling socket ops directly here */
-		down(&lo->tx_lock);
-		if (lo->sock) {
-			printk(KERN_WARNING "%s: shutting down socket\n",
-				lo->disk->disk_name);
-			lo->sock->ops->shutdown(lo->sock,
-				SEND_SHUTDOWN|RCV_SHUTDOWN);
-			lo->sock = NULL;
+		lo->running = 1;
+		lo->harderror = 0;
+		/* the extra connections get a receiver thread each */
+		for (i = 1; i < lo->num_socks; i++) {
+			struct nbd_sock *ns = lo->socks[i];
+			struct task_struct *p;
+
+			init_completion(&ns->done);
+			p = kthread_run(nbd_recv_thread, ns, "%s-recv%d",
+					lo->disk->disk_name, i);
+			if (IS_ERR(p)) {
+				nbd_shutdown_socks(lo);
+				complete(&ns->done);
+			}
 		}
-		up(&lo->tx_lock);
-		spin_lock(&lo->queue_lock);
-		file = lo->file;
-		lo->file = NULL;
-		spin_unlock(&lo->queue_lock);
-		nbd_clear_que(lo);
+		nbd_do_it(lo, lo->socks[0]);
+		for (i = 1; i < lo->num_socks; i++)
+			wait_for_completion(&lo->socks[i]->done);
+		/* on return tidy up in case we have a signal */
+		nbd_clear_socks(lo);
 		printk(KERN_WARNING "%s: queue cleared\n", lo->disk->disk_name);
-		if (file)
-			fput(file);
+		lo->running = 0;
 		return lo->harderror;
 	case NBD_CLEAR_QUE:
-		down(&lo->tx_lock);
-		if (lo->sock) {
-			up(&lo->tx_lock);
-			return 0; /* probably should be error, but that would
-				   * break "nbd-client -d", so just return 0 */
+		for (i = 0; i < lo->num_socks; i++) {
+			down(&lo->socks[i]->tx_lock);
+			if (lo->socks[i]->sock) {
+				up(&lo->socks[i]->tx_lock);
+				return 0; /* probably should be error, but that would
+					   * break "nbd-client -d", so just return 0 */
+			}
+			up(&lo->socks[i]->tx_lock);
 		}
-		up(&lo->tx_lock);
 		nbd_clear_que(lo);
 		return 0;
 	case NBD_PRINT_DEBUG:
-		printk(KERN_INFO "%s: next = %p, prev = %p, head = %p\n",
-			inode->i_bdev->bd_disk->disk_name,
-			lo->queue_head.next, lo->queue_head.prev,
-			&lo->queue_head);
+		printk(KERN_INFO "%s: %d connections, %d requests in flight "
+			"(depth %d)\n", inode->i_bdev->bd_disk->disk_name,
+			lo->num_socks, lo->in_flight, lo->depth);
+		for (i = 0; i < lo->num_socks; i++) {
+			struct nbd_sock *ns = lo->socks[i];
+
+			printk(KERN_INFO "%s: sock %d: next = %p, prev = %p, "
+				"head = %p\n", inode->i_bdev->bd_disk->disk_name,
+				i, ns->queue_head.next, ns->queue_head.prev,
+				&ns->queue_head);
+		}
 		return 0;
 	}
 	return -EINVAL;
@@ -675,12 +840,11 @@ static int __init nbd_init(void)
 	devfs_mk_dir("nbd");
 	for (i = 0; i < MAX_NBD; i++) {
 		struct gendisk *disk = nbd_dev[i].disk;
-		nbd_dev[i].file = NULL;
+		nbd_dev[i].num_socks = 0;
 		nbd_dev[i].magic = LO_MAGIC;
 		nbd_dev[i].flags = 0;
 		spin_lock_init(&nbd_dev[i].queue_lock);
-		INIT_LIST_HEAD(&nbd_dev[i].queue_head);
-		init_MUTEX(&nbd_dev[i].tx_lock);
+		INIT_WORK(&nbd_dev[i].kick, nbd_kick, &nbd_dev[i]);
 		nbd_dev[i].blksize = 1024;
 		nbd_dev[i].bytesize = 0x7ffffc00ULL << 10; /* 2TB */
 		disk->major = NBD_MAJOR;
@@ -705,7 +869,7 @@ out:
 
 static void __exit nbd_cleanup(void)
 {
-	int i;
+	int i, j;
 	for (i = 0; i < MAX_NBD; i++) {
 		struct gendisk *disk = nbd_dev[i].disk;
 		if (disk) {
@@ -713,6 +877,8 @@ static void __exit nbd_cleanup(void)
 			blk_cleanup_queue(disk->queue);
 			put_disk(disk);
 		}
+		for (j = 0; j < NBD_MAX_CONNECTIONS; j++)
+			kfree(nbd_dev[i].socks[j]);
 	}
 	devfs_remove("nbd");
 	unregister_blkdev(NBD_MAJOR, "nbd");
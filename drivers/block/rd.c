@@ -387,10 +387,41 @@ static int rd_open(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+/*
+ * For execute in place: the data of a ramdisk is its blockdev pagecache, so
+ * the kernel address of a page of it can be handed out directly.  The page
+ * is dirty, and so is not reclaimed, as long as the ramdisk exists.
+ */
+#define PAGE_SECTORS	(1 << (PAGE_CACHE_SHIFT - 9))
+
+static int rd_direct_access(struct block_device *bdev, sector_t sector,
+			    unsigned long *addr)
+{
+	struct address_space *mapping = bdev->bd_inode->i_mapping;
+	struct page *page;
+
+	if (sector & (PAGE_SECTORS - 1))
+		return -EINVAL;
+	if (sector + PAGE_SECTORS > get_capacity(bdev->bd_disk))
+		return -ERANGE;
+
+	page = grab_cache_page(mapping, sector >> (PAGE_CACHE_SHIFT - 9));
+	if (!page)
+		return -ENOMEM;
+	if (!PageUptodate(page))
+		make_page_uptodate(page);
+	SetPageDirty(page);
+	*addr = (unsigned long)page_address(page);
+	unlock_page(page);
+	page_cache_release(page);
+	return 0;
+}
+
 static struct block_device_operations rd_bd_op = {
 	.owner =	THIS_MODULE,
 	.open =		rd_open,
 	.ioctl =	rd_ioctl,
+	.direct_access = rd_direct_access,
 };
 
 /*
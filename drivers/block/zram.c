@@ -0,0 +1,474 @@
+/*
+ * zram.c - compressed RAM block devices.
+ *
+ * Every page written to a zram device is compressed with LZO1X and kept
+ * in memory from a zsmalloc pool; pages which do not compress are kept
+ * as they are, and pages of zeroes take no memory at all.  The devices
+ * are meant for swap: swapping to one costs a compression instead of
+ * a disk write, and the swap code tells the driver when a swap slot is
+ * freed, so its memory goes back at once.
+ *
+ * Only I/O of whole, page aligned pages is supported, which is all
+ * swap does.  See Documentation/block/zram.txt.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/swap.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/genhd.h>
+#include <linux/lzo.h>
+#include <linux/zsmalloc.h>
+#include <asm/semaphore.h>
+
+#define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - 9)
+#define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
+
+/* Pages which compress worse than this are kept as they are */
+#define MAX_ZPAGE_SIZE		(PAGE_SIZE / 4 * 3)
+
+/* zram_slot flags */
+#define ZRAM_ZERO		0x1	/* All zeroes, nothing stored */
+
+/* One per page of the device */
+struct zram_slot {
+	struct zspage *zspage;		/* Where the page is kept, or NULL */
+	unsigned short index;		/* Object in the zspage */
+	unsigned short flags;
+	unsigned int size;		/* Compressed, or PAGE_SIZE if not */
+};
+
+struct zram_stats {
+	unsigned long num_reads;
+	unsigned long num_writes;
+	unsigned long failed_reads;
+	unsigned long failed_writes;
+	unsigned long invalid_io;	/* Not whole aligned pages */
+	unsigned long notify_free;	/* Swap slots freed */
+	unsigned long pages_zero;	/* Pages of zeroes */
+	unsigned long pages_stored;	/* Pages kept in the pool */
+	unsigned long pages_expand;	/* ... of which uncompressed */
+	unsigned long compr_size;	/* Bytes they take in the pool */
+};
+
+struct zram {
+	struct zram_slot *table;
+	unsigned long nr_pages;
+	struct zs_pool *pool;
+	spinlock_t lock;		/* Protects table and stats */
+	struct semaphore sem;		/* Serializes I/O, for the buffers */
+	void *compress_workmem;
+	void *compress_buffer;		/* Also the buffer to decompress from */
+	struct request_queue *queue;
+	struct gendisk *disk;
+	struct zram_stats stats;
+};
+
+static int zram_major;
+static struct zram *zram_devices;
+
+static unsigned int num_devices = 1;
+static unsigned long zram_size;		/* In kB; 0 for a quarter of RAM */
+
+static int page_zero_filled(void *ptr)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++)
+		if (page[pos])
+			return 0;
+	return 1;
+}
+
+/* Called with zram->lock held */
+static void zram_free_slot(struct zram *zram, unsigned long index)
+{
+	struct zram_slot *slot = &zram->table[index];
+
+	if (slot->flags & ZRAM_ZERO) {
+		slot->flags &= ~ZRAM_ZERO;
+		zram->stats.pages_zero--;
+		return;
+	}
+	if (!slot->zspage)
+		return;
+
+	zs_free(zram->pool, slot->zspage, slot->index);
+	zram->stats.pages_stored--;
+	if (slot->size == PAGE_SIZE)
+		zram->stats.pages_expand--;
+	zram->stats.compr_size -= slot->size;
+	slot->zspage = NULL;
+	slot->size = 0;
+}
+
+static int zram_read(struct zram *zram, struct page *page, unsigned long index)
+{
+	struct zram_slot *slot = &zram->table[index];
+	size_t clen, len = PAGE_SIZE;
+	unsigned char *dst;
+	int ret;
+
+	spin_lock(&zram->lock);
+	/* Never written, or zeroes */
+	if (!slot->zspage) {
+		spin_unlock(&zram->lock);
+		dst = kmap_atomic(page, KM_USER1);
+		memset(dst, 0, PAGE_SIZE);
+		kunmap_atomic(dst, KM_USER1);
+		flush_dcache_page(page);
+		return 0;
+	}
+	clen = slot->size;
+	if (clen == PAGE_SIZE) {
+		dst = kmap_atomic(page, KM_USER1);
+		zs_read_object(zram->pool, slot->zspage, slot->index,
+			       dst, PAGE_SIZE);
+		kunmap_atomic(dst, KM_USER1);
+		spin_unlock(&zram->lock);
+		flush_dcache_page(page);
+		return 0;
+	}
+	zs_read_object(zram->pool, slot->zspage, slot->index,
+		       zram->compress_buffer, clen);
+	spin_unlock(&zram->lock);
+
+	dst = kmap_atomic(page, KM_USER1);
+	ret = lzo1x_decompress_safe(zram->compress_buffer, clen, dst, &len);
+	kunmap_atomic(dst, KM_USER1);
+	flush_dcache_page(page);
+
+	if (unlikely(ret != LZO_E_OK || len != PAGE_SIZE)) {
+		printk(KERN_ERR "zram: decompression of page %lu failed: %d\n",
+		       index, ret);
+		return -EIO;
+	}
+	return 0;
+}
+
+static int zram_write(struct zram *zram, struct page *page, unsigned long index)
+{
+	struct zram_slot *slot = &zram->table[index];
+	struct zspage *zspage;
+	unsigned int obj;
+	size_t clen;
+	unsigned char *src;
+	int ret;
+
+	src = kmap_atomic(page, KM_USER1);
+	if (page_zero_filled(src)) {
+		kunmap_atomic(src, KM_USER1);
+		spin_lock(&zram->lock);
+		zram_free_slot(zram, index);
+		slot->flags |= ZRAM_ZERO;
+		zram->stats.pages_zero++;
+		spin_unlock(&zram->lock);
+		return 0;
+	}
+	ret = lzo1x_1_compress(src, PAGE_SIZE, zram->compress_buffer, &clen,
+			       zram->compress_workmem);
+	kunmap_atomic(src, KM_USER1);
+	if (unlikely(ret != LZO_E_OK)) {
+		printk(KERN_ERR "zram: compression of page %lu failed: %d\n",
+		       index, ret);
+		return -EIO;
+	}
+	if (clen > MAX_ZPAGE_SIZE)
+		clen = PAGE_SIZE;
+
+	zspage = zs_malloc(zram->pool, clen, &obj);
+	if (!zspage)
+		return -ENOMEM;
+	if (clen == PAGE_SIZE) {
+		src = kmap_atomic(page, KM_USER1);
+		zs_write_object(zram->pool, zspage, obj, src, PAGE_SIZE);
+		kunmap_atomic(src, KM_USER1);
+	} else
+		zs_write_object(zram->pool, zspage, obj,
+				zram->compress_buffer, clen);
+
+	spin_lock(&zram->lock);
+	zram_free_slot(zram, index);
+	slot->zspage = zspage;
+	slot->index = obj;
+	slot->size = clen;
+	zram->stats.pages_stored++;
+	if (clen == PAGE_SIZE)
+		zram->stats.pages_expand++;
+	zram->stats.compr_size += clen;
+	spin_unlock(&zram->lock);
+	return 0;
+}
+
+static int valid_io_request(struct zram *zram, struct bio *bio)
+{
+	if (bio->bi_sector & (SECTORS_PER_PAGE - 1) ||
+	    bio->bi_size & (PAGE_SIZE - 1))
+		return 0;
+	if ((bio->bi_sector >> SECTORS_PER_PAGE_SHIFT) +
+	    (bio->bi_size >> PAGE_SHIFT) > zram->nr_pages)
+		return 0;
+	return 1;
+}
+
+static int zram_make_request(request_queue_t *q, struct bio *bio)
+{
+	struct zram *zram = q->queuedata;
+	int rw = bio_data_dir(bio);
+	struct bio_vec *bvec;
+	unsigned long index;
+	int ret = 0, i;
+
+	if (!valid_io_request(zram, bio)) {
+		spin_lock(&zram->lock);
+		zram->stats.invalid_io++;
+		spin_unlock(&zram->lock);
+		bio_io_error(bio, bio->bi_size);
+		return 0;
+	}
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	down(&zram->sem);
+	bio_for_each_segment(bvec, bio, i) {
+		if (bvec->bv_offset || bvec->bv_len != PAGE_SIZE) {
+			ret = -EINVAL;
+			break;
+		}
+		if (rw == WRITE)
+			ret = zram_write(zram, bvec->bv_page, index);
+		else
+			ret = zram_read(zram, bvec->bv_page, index);
+		if (ret)
+			break;
+		index++;
+	}
+	up(&zram->sem);
+
+	spin_lock(&zram->lock);
+	if (rw == WRITE) {
+		zram->stats.num_writes++;
+		if (ret)
+			zram->stats.failed_writes++;
+	} else {
+		zram->stats.num_reads++;
+		if (ret)
+			zram->stats.failed_reads++;
+	}
+	spin_unlock(&zram->lock);
+
+	if (ret)
+		bio_io_error(bio, bio->bi_size);
+	else
+		bio_endio(bio, bio->bi_size, 0);
+	return 0;
+}
+
+/* Called by the swap code, under its locks, as a swap slot is freed */
+static void zram_slot_free_notify(struct block_device *bdev,
+				  unsigned long index)
+{
+	struct zram *zram = bdev->bd_disk->private_data;
+
+	if (index >= zram->nr_pages)
+		return;
+	spin_lock(&zram->lock);
+	zram_free_slot(zram, index);
+	zram->stats.notify_free++;
+	spin_unlock(&zram->lock);
+}
+
+static struct block_device_operations zram_fops = {
+	.owner =		 THIS_MODULE,
+	.swap_slot_free_notify = zram_slot_free_notify,
+};
+
+/*
+ * Statistics, in /sys/block/zram<id>/.  orig_data_size over
+ * mem_used_total is the compression ratio, all overhead included.
+ */
+
+#define ZRAM_STAT_SHOW(_name, expr)					\
+static ssize_t zram_##_name##_show(struct gendisk *disk, char *page)	\
+{									\
+	struct zram *zram = disk->private_data;				\
+	unsigned long val;						\
+									\
+	spin_lock(&zram->lock);						\
+	val = (expr);							\
+	spin_unlock(&zram->lock);					\
+	return sprintf(page, "%lu\n", val);				\
+}									\
+static struct disk_attribute zram_attr_##_name = {			\
+	.attr = { .name = #_name, .mode = S_IRUGO, .owner = THIS_MODULE },\
+	.show = zram_##_name##_show,					\
+};
+
+ZRAM_STAT_SHOW(disksize, zram->nr_pages << PAGE_SHIFT)
+ZRAM_STAT_SHOW(num_reads, zram->stats.num_reads)
+ZRAM_STAT_SHOW(num_writes, zram->stats.num_writes)
+ZRAM_STAT_SHOW(failed_reads, zram->stats.failed_reads)
+ZRAM_STAT_SHOW(failed_writes, zram->stats.failed_writes)
+ZRAM_STAT_SHOW(invalid_io, zram->stats.invalid_io)
+ZRAM_STAT_SHOW(notify_free, zram->stats.notify_free)
+ZRAM_STAT_SHOW(zero_pages, zram->stats.pages_zero)
+ZRAM_STAT_SHOW(pages_stored, zram->stats.pages_stored)
+ZRAM_STAT_SHOW(orig_data_size, zram->stats.pages_stored << PAGE_SHIFT)
+ZRAM_STAT_SHOW(compr_data_size, zram->stats.compr_size)
+ZRAM_STAT_SHOW(mem_used_total, zs_get_total_pages(zram->pool) << PAGE_SHIFT)
+
+static struct disk_attribute *zram_attrs[] = {
+	&zram_attr_disksize,
+	&zram_attr_num_reads,
+	&zram_attr_num_writes,
+	&zram_attr_failed_reads,
+	&zram_attr_failed_writes,
+	&zram_attr_invalid_io,
+	&zram_attr_notify_free,
+	&zram_attr_zero_pages,
+	&zram_attr_pages_stored,
+	&zram_attr_orig_data_size,
+	&zram_attr_compr_data_size,
+	&zram_attr_mem_used_total,
+	NULL,
+};
+
+static void destroy_device(struct zram *zram)
+{
+	unsigned long index;
+
+	if (zram->disk) {
+		del_gendisk(zram->disk);
+		put_disk(zram->disk);
+	}
+	if (zram->queue)
+		blk_cleanup_queue(zram->queue);
+
+	if (zram->table) {
+		for (index = 0; index < zram->nr_pages; index++)
+			zram_free_slot(zram, index);
+		vfree(zram->table);
+	}
+	if (zram->pool)
+		zs_destroy_pool(zram->pool);
+	vfree(zram->compress_buffer);
+	vfree(zram->compress_workmem);
+}
+
+static int __init create_device(struct zram *zram, int id)
+{
+	struct gendisk *disk;
+	int i;
+
+	spin_lock_init(&zram->lock);
+	init_MUTEX(&zram->sem);
+	zram->nr_pages = zram_size >> (PAGE_SHIFT - 10);
+
+	zram->table = vmalloc(zram->nr_pages * sizeof(*zram->table));
+	zram->compress_workmem = vmalloc(LZO1X_MEM_COMPRESS);
+	zram->compress_buffer = vmalloc(lzo1x_worst_compress(PAGE_SIZE));
+	/* Swap writes out under memory pressure: no I/O to get memory */
+	zram->pool = zs_create_pool(GFP_NOIO | __GFP_HIGHMEM | __GFP_NOWARN);
+	if (!zram->table || !zram->compress_workmem ||
+	    !zram->compress_buffer || !zram->pool)
+		return -ENOMEM;
+	memset(zram->table, 0, zram->nr_pages * sizeof(*zram->table));
+
+	zram->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!zram->queue)
+		return -ENOMEM;
+	blk_queue_make_request(zram->queue, zram_make_request);
+	blk_queue_hardsect_size(zram->queue, PAGE_SIZE);
+	blk_queue_bounce_limit(zram->queue, BLK_BOUNCE_ANY);
+	zram->queue->queuedata = zram;
+
+	disk = alloc_disk(1);
+	if (!disk)
+		return -ENOMEM;
+	disk->major = zram_major;
+	disk->first_minor = id;
+	disk->fops = &zram_fops;
+	disk->queue = zram->queue;
+	disk->private_data = zram;
+	disk->flags |= GENHD_FL_SUPPRESS_PARTITION_INFO;
+	sprintf(disk->disk_name, "zram%d", id);
+	sprintf(disk->devfs_name, "zram/%d", id);
+	set_capacity(disk, zram->nr_pages << SECTORS_PER_PAGE_SHIFT);
+	add_disk(disk);
+	zram->disk = disk;
+
+	for (i = 0; zram_attrs[i]; i++)
+		sysfs_create_file(&disk->kobj, &zram_attrs[i]->attr);
+	return 0;
+}
+
+static void __exit zram_exit(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_devices; i++)
+		destroy_device(&zram_devices[i]);
+	kfree(zram_devices);
+	unregister_blkdev(zram_major, "zram");
+}
+
+static int __init zram_init(void)
+{
+	unsigned int i;
+	int err;
+
+	if (!num_devices || num_devices > 256) {
+		printk(KERN_WARNING "zram: invalid num_devices %u\n",
+		       num_devices);
+		return -EINVAL;
+	}
+	if (!zram_size)
+		zram_size = (totalram_pages << (PAGE_SHIFT - 10)) / 4;
+
+	zram_major = register_blkdev(0, "zram");
+	if (zram_major <= 0)
+		return -EBUSY;
+
+	zram_devices = kmalloc(num_devices * sizeof(struct zram), GFP_KERNEL);
+	if (!zram_devices) {
+		err = -ENOMEM;
+		goto out_unregister;
+	}
+	memset(zram_devices, 0, num_devices * sizeof(struct zram));
+
+	for (i = 0; i < num_devices; i++) {
+		err = create_device(&zram_devices[i], i);
+		if (err) {
+			num_devices = i + 1;
+			goto out_destroy;
+		}
+	}
+
+	printk(KERN_INFO "zram: %u devices of %luK\n", num_devices, zram_size);
+	return 0;
+
+out_destroy:
+	for (i = 0; i < num_devices; i++)
+		destroy_device(&zram_devices[i]);
+	kfree(zram_devices);
+out_unregister:
+	unregister_blkdev(zram_major, "zram");
+	return err;
+}
+
+module_init(zram_init);
+module_exit(zram_exit);
+
+module_param(num_devices, uint, 0);
+MODULE_PARM_DESC(num_devices, "Number of zram devices");
+module_param(zram_size, ulong, 0);
+MODULE_PARM_DESC(zram_size, "Size of each zram device in kbytes");
+MODULE_LICENSE("GPL");
@@ -275,6 +275,23 @@ static int trickle_thresh = INPUT_POOL_WORDS * 28;
 
 static DEFINE_PER_CPU(int, trickle_count) = 0;
 
+/*
+ * Timing samples are first mixed into a small pool of the cpu they
+ * occur on, and only every FAST_POOL_BATCH samples, or every second,
+ * into the input pool, so that interrupts do not all take its lock.
+ */
+#define FAST_POOL_WORDS 4
+#define FAST_POOL_BATCH 16
+
+/*
+ * Each cpu has its own pool for /dev/urandom and get_random_bytes(),
+ * which is reseeded from the input pool every URANDOM_RESEED_INTERVAL,
+ * or every URANDOM_RETRY_INTERVAL while the input pool is short of
+ * entropy.
+ */
+#define URANDOM_RESEED_INTERVAL (60 * HZ)
+#define URANDOM_RETRY_INTERVAL HZ
+
 /*
  * A pool of size .poolwords is stirred with a primitive polynomial
  * of degree .poolwords over GF(2).  The taps for various sizes are
@@ -401,12 +418,14 @@ struct entropy_store {
 	const char *name;
 	int limit;
 	struct entropy_store *pull;
+	unsigned long reseed_interval;	/* Pull only now and then */
 
 	/* read-write data: */
 	spinlock_t lock ____cacheline_aligned_in_smp;
 	unsigned add_ptr;
 	int entropy_count;
 	int input_rotate;
+	unsigned long next_reseed;
 };
 
 static __u32 input_pool_data[INPUT_POOL_WORDS];
@@ -430,6 +449,9 @@ static struct entropy_store blocking_pool = {
 	.pool = blocking_pool_data
 };
 
+/*
+ * Used until the per-cpu urandom pools are set up, and to seed them.
+ */
 static struct entropy_store nonblocking_pool = {
 	.poolinfo = &poolinfo_table[1],
 	.name = "nonblocking",
@@ -438,6 +460,18 @@ static struct entropy_store nonblocking_pool = {
 	.pool = nonblocking_pool_data
 };
 
+struct urandom_pool {
+	struct entropy_store store;
+	__u32 data[OUTPUT_POOL_WORDS];
+};
+
+static DEFINE_PER_CPU(struct urandom_pool, urandom_pools);
+static int urandom_pools_ready;
+
+static __u32 const twist_table[8] = {
+	0x00000000, 0x3b6e20c8, 0x76dc4190, 0x4db26158,
+	0xedb88320, 0xd6d6a3e8, 0x9b64c2b0, 0xa00ae278 };
+
 /*
  * This function adds a byte into the entropy "pool".  It does not
  * update the entropy estimate.  The caller should call
@@ -451,9 +485,6 @@ static struct entropy_store nonblocking_pool = {
 static void __add_entropy_words(struct entropy_store *r, const __u32 *in,
 				int nwords, __u32 out[16])
 {
-	static __u32 const twist_table[8] = {
-		0x00000000, 0x3b6e20c8, 0x76dc4190, 0x4db26158,
-		0xedb88320, 0xd6d6a3e8, 0x9b64c2b0, 0xa00ae278 };
 	unsigned long i, add_ptr, tap1, tap2, tap3, tap4, tap5;
 	int new_rotate, input_rotate;
 	int wordmask = r->poolinfo->poolwords - 1;
@@ -559,6 +590,50 @@ struct timer_rand_state {
 static struct timer_rand_state input_timer_state;
 static struct timer_rand_state *irq_timer_state[NR_IRQS];
 
+struct fast_pool {
+	__u32 pool[FAST_POOL_WORDS];
+	unsigned count;			/* Words mixed in */
+	unsigned rotate;
+	int samples;			/* Since the last flush */
+	int credit;			/* Bits, likewise */
+	unsigned long last;		/* jiffies of the last flush */
+};
+
+static DEFINE_PER_CPU(struct fast_pool, fast_pools);
+
+/*
+ * A cheap mix, with no lock: the pool belongs to this cpu, and the
+ * caller has interrupts off.
+ */
+static void fast_mix(struct fast_pool *f, const __u32 *in, int nwords)
+{
+	unsigned i = f->count, rotate = f->rotate;
+	__u32 w;
+
+	while (nwords--) {
+		w = rol32(*in++, rotate) ^ f->pool[i % FAST_POOL_WORDS] ^
+			f->pool[(i + 1) % FAST_POOL_WORDS];
+		f->pool[i % FAST_POOL_WORDS] = (w >> 3) ^ twist_table[w & 7];
+		rotate = (rotate + ((i++ % FAST_POOL_WORDS) ? 7 : 14)) & 31;
+	}
+	f->count = i;
+	f->rotate = rotate;
+}
+
+/*
+ * Move the fast pool of this cpu into the input pool.  It holds no
+ * more than its size in entropy, whatever its samples were credited.
+ */
+static void flush_fast_pool(struct fast_pool *f)
+{
+	add_entropy_words(&input_pool, f->pool, FAST_POOL_WORDS);
+	credit_entropy_store(&input_pool,
+			     min_t(int, f->credit, FAST_POOL_WORDS * 32));
+	f->samples = 0;
+	f->credit = 0;
+	f->last = jiffies;
+}
+
 /*
  * This function adds entropy to the entropy "pool" by using timing
  * delays.  It uses the timer_rand_state structure to make an estimate
@@ -577,8 +652,11 @@ static void add_timer_randomness(struct timer_rand_state *state, unsigned num)
 		unsigned num;
 	} sample;
 	long delta, delta2, delta3;
+	struct fast_pool *f;
+	unsigned long flags;
+	int flushed = 0;
 
-	preempt_disable();
+	local_irq_save(flags);
 	/* if over the trickle threshold, use only 1 in 4096 samples */
 	if (input_pool.entropy_count > trickle_thresh &&
 	    (__get_cpu_var(trickle_count)++ & 0xfff))
@@ -587,7 +665,9 @@ static void add_timer_randomness(struct timer_rand_state *state, unsigned num)
 	sample.jiffies = jiffies;
 	sample.cycles = get_cycles();
 	sample.num = num;
-	add_entropy_words(&input_pool, (u32 *)&sample, sizeof(sample)/4);
+	f = &__get_cpu_var(fast_pools);
+	fast_mix(f, (u32 *)&sample, sizeof(sample)/4);
+	f->samples++;
 
 	/*
 	 * Calculate number of bits of randomness we probably added.
@@ -621,15 +701,20 @@ static void add_timer_randomness(struct timer_rand_state *state, unsigned num)
 		 * Round down by 1 bit on general principles,
 		 * and limit entropy entimate to 12 bits.
 		 */
-		credit_entropy_store(&input_pool,
-				     min_t(int, fls(delta>>1), 11));
+		f->credit += min_t(int, fls(delta>>1), 11);
 	}
 
-	if(input_pool.entropy_count >= random_read_wakeup_thresh)
-		wake_up_interruptible(&random_read_wait);
+	if (f->samples >= FAST_POOL_BATCH ||
+	    time_after_eq(jiffies, f->last + HZ)) {
+		flush_fast_pool(f);
+		flushed = 1;
+	}
 
 out:
-	preempt_enable();
+	local_irq_restore(flags);
+
+	if (flushed && input_pool.entropy_count >= random_read_wakeup_thresh)
+		wake_up_interruptible(&random_read_wait);
 }
 
 extern void add_input_randomness(unsigned int type, unsigned int code,
@@ -684,26 +769,42 @@ static ssize_t extract_entropy(struct entropy_store *r, void * buf,
  * This utility inline function is responsible for transfering entropy
  * from the primary pool to the secondary extraction pool. We make
  * sure we pull enough for a 'catastrophic reseed'.
+ *
+ * A pool with a reseed_interval is reseeded in full when that is up,
+ * rather than whenever its entropy count runs low: the urandom pools
+ * would otherwise all be at the input pool's lock on every read.
  */
 static void xfer_secondary_pool(struct entropy_store *r, size_t nbytes)
 {
 	__u32 tmp[OUTPUT_POOL_WORDS];
+	int bytes, rsvd;
 
-	if (r->pull && r->entropy_count < nbytes * 8 &&
-	    r->entropy_count < r->poolinfo->POOLBITS) {
-		int bytes = max_t(int, random_read_wakeup_thresh / 8,
-				min_t(int, nbytes, sizeof(tmp)));
-		int rsvd = r->limit ? 0 : random_read_wakeup_thresh/4;
+	if (!r->pull)
+		return;
+	if (r->reseed_interval) {
+		if (time_before(jiffies, r->next_reseed))
+			return;
+		nbytes = sizeof(tmp);
+	} else if (r->entropy_count >= nbytes * 8 ||
+		   r->entropy_count >= r->poolinfo->POOLBITS)
+		return;
 
-		DEBUG_ENT("going to reseed %s with %d bits "
-			  "(%d of %d requested)\n",
-			  r->name, bytes * 8, nbytes * 8, r->entropy_count);
+	bytes = max_t(int, random_read_wakeup_thresh / 8,
+		      min_t(int, nbytes, sizeof(tmp)));
+	rsvd = r->limit ? 0 : random_read_wakeup_thresh/4;
 
-		bytes=extract_entropy(r->pull, tmp, bytes,
-				      random_read_wakeup_thresh / 8, rsvd);
-		add_entropy_words(r, tmp, (bytes + 3) / 4);
-		credit_entropy_store(r, bytes*8);
-	}
+	DEBUG_ENT("going to reseed %s with %d bits "
+		  "(%d of %d requested)\n",
+		  r->name, bytes * 8, nbytes * 8, r->entropy_count);
+
+	bytes=extract_entropy(r->pull, tmp, bytes,
+			      random_read_wakeup_thresh / 8, rsvd);
+	add_entropy_words(r, tmp, (bytes + 3) / 4);
+	credit_entropy_store(r, bytes*8);
+
+	if (r->reseed_interval)
+		r->next_reseed = jiffies + (bytes ? r->reseed_interval :
+					    URANDOM_RETRY_INTERVAL);
 }
 
 /*
@@ -856,6 +957,21 @@ static ssize_t extract_entropy_user(struct entropy_store *r, void __user *buf,
 	return ret;
 }
 
+/*
+ * The urandom pool of this cpu.  The caller may sleep, and so move to
+ * another cpu, while using it: the pool's lock still covers it.
+ */
+static struct entropy_store *urandom_pool(void)
+{
+	struct entropy_store *r = &nonblocking_pool;
+
+	if (likely(urandom_pools_ready)) {
+		r = &per_cpu(urandom_pools, get_cpu()).store;
+		put_cpu();
+	}
+	return r;
+}
+
 /*
  * This function is the exported kernel interface.  It returns some
  * number of good random numbers, suitable for seeding TCP sequence
@@ -863,7 +979,7 @@ static ssize_t extract_entropy_user(struct entropy_store *r, void __user *buf,
  */
 void get_random_bytes(void *buf, int nbytes)
 {
-	extract_entropy(&nonblocking_pool, buf, nbytes, 0, 0);
+	extract_entropy(urandom_pool(), buf, nbytes, 0, 0);
 }
 
 EXPORT_SYMBOL(get_random_bytes);
@@ -892,11 +1008,55 @@ static void init_std_data(struct entropy_store *r)
 			  sizeof(system_utsname)/4);
 }
 
+/*
+ * Each urandom pool starts off from the nonblocking pool and its cpu
+ * number, so that no two give the same output before they are
+ * first reseeded.
+ */
+static void __init init_urandom_pools(void)
+{
+	__u32 tmp[OUTPUT_POOL_WORDS];
+	struct urandom_pool *p;
+	struct entropy_store *r;
+	int cpu;
+
+	for_each_cpu(cpu) {
+		p = &per_cpu(urandom_pools, cpu);
+		r = &p->store;
+		r->poolinfo = &poolinfo_table[1];
+		r->name = "urandom";
+		r->pull = &input_pool;
+		r->reseed_interval = URANDOM_RESEED_INTERVAL;
+		spin_lock_init(&r->lock);
+		r->pool = p->data;
+		r->next_reseed = jiffies;
+
+		init_std_data(r);
+		extract_entropy(&nonblocking_pool, tmp, sizeof(tmp), 0, 0);
+		add_entropy_words(r, tmp, OUTPUT_POOL_WORDS);
+		tmp[0] = cpu;
+		add_entropy_words(r, tmp, 1);
+	}
+	memset(tmp, 0, sizeof(tmp));
+
+	smp_wmb();
+	urandom_pools_ready = 1;
+}
+
+static void clear_urandom_pools(void)
+{
+	int cpu;
+
+	for_each_cpu(cpu)
+		init_std_data(&per_cpu(urandom_pools, cpu).store);
+}
+
 static int __init rand_initialize(void)
 {
 	init_std_data(&input_pool);
 	init_std_data(&blocking_pool);
 	init_std_data(&nonblocking_pool);
+	init_urandom_pools();
 	return 0;
 }
 module_init(rand_initialize);
@@ -1000,7 +1160,7 @@ static ssize_t
 urandom_read(struct file * file, char __user * buf,
 		      size_t nbytes, loff_t *ppos)
 {
-	return extract_entropy_user(&nonblocking_pool, buf, nbytes);
+	return extract_entropy_user(urandom_pool(), buf, nbytes);
 }
 
 static unsigned int
@@ -1107,6 +1267,7 @@ random_ioctl(struct inode * inode, struct file * file,
 		init_std_data(&input_pool);
 		init_std_data(&blocking_pool);
 		init_std_data(&nonblocking_pool);
+		clear_urandom_pools();
 		return 0;
 	default:
 		return -EINVAL;
@@ -0,0 +1,818 @@
+/*
+ * bitmap.c: write-intent bitmap for md RAID1/4/5 arrays
+ *
+ * Before a write to the array is issued, the bit of every chunk it
+ * touches is set in an on-disk bitmap kept next to the md superblock
+ * of each device.  Bits are set lazily: a chunk's bit only has to be
+ * written once per burst of writes to it, and the personalities flush
+ * all newly set bits with a single bitmap_unplug() before issuing the
+ * writes that wait for them.  Once a chunk has been idle for a full
+ * daemon_sleep period its bit is cleared again, without any urgency.
+ *
+ * After an unclean shutdown only chunks with their bit set need to be
+ * resynced, and while the array is degraded no bits are cleared, so a
+ * device that was only missing briefly can be brought back by copying
+ * the chunks written in the meantime.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/module.h>
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/raid/md.h>
+#include <linux/raid/bitmap.h>
+#include <asm/bitops.h>
+
+/*
+ * Find the counter of the chunk holding 'offset' and the number of
+ * sectors from there to the end of the chunk (or of the bitmap).
+ * Must be called with bitmap->lock held.
+ */
+static bitmap_counter_t *bitmap_get_counter(struct bitmap *bitmap,
+					    sector_t offset, int *blocks)
+{
+	unsigned long chunk = offset >> bitmap->chunkshift;
+	sector_t end;
+
+	if (offset >= bitmap->sync_size) {
+		*blocks = 1024;
+		return NULL;
+	}
+	end = (sector_t)(chunk + 1) << bitmap->chunkshift;
+	if (end > bitmap->sync_size)
+		end = bitmap->sync_size;
+	*blocks = end - offset;
+	return &bitmap->counts[chunk];
+}
+
+/*
+ * The on-disk bit of 'chunk' lives in page 'idx' of the image, after
+ * the superblock.
+ */
+static void *bitmap_bit_addr(struct bitmap *bitmap, unsigned long chunk,
+			     unsigned long *bit, unsigned long *idx)
+{
+	unsigned long nr = chunk + (sizeof(bitmap_super_t) << 3);
+
+	*idx = nr >> (PAGE_SHIFT + 3);
+	*bit = nr & ((PAGE_SIZE << 3) - 1);
+	return page_address(bitmap->pages[*idx]);
+}
+
+static inline void bitmap_mark_dirty(struct bitmap *bitmap, unsigned long idx)
+{
+	if (!__test_and_set_bit(idx, bitmap->dirty_pages))
+		bitmap->dirty++;
+}
+
+static void bitmap_set_disk_bit(struct bitmap *bitmap, unsigned long chunk)
+{
+	unsigned long bit, idx;
+	void *addr = bitmap_bit_addr(bitmap, chunk, &bit, &idx);
+
+	if (!ext2_set_bit(bit, addr))
+		bitmap_mark_dirty(bitmap, idx);
+}
+
+static void bitmap_clear_disk_bit(struct bitmap *bitmap, unsigned long chunk)
+{
+	unsigned long bit, idx;
+	void *addr = bitmap_bit_addr(bitmap, chunk, &bit, &idx);
+
+	if (ext2_clear_bit(bit, addr))
+		bitmap_mark_dirty(bitmap, idx);
+}
+
+static int bitmap_test_disk_bit(struct bitmap *bitmap, unsigned long chunk)
+{
+	unsigned long bit, idx;
+	void *addr = bitmap_bit_addr(bitmap, chunk, &bit, &idx);
+
+	return ext2_test_bit(bit, addr);
+}
+
+/*
+ * copy the in-memory state into the superblock at the start of the
+ * image, with bitmap->lock held
+ */
+static void bitmap_fill_sb(struct bitmap *bitmap)
+{
+	mddev_t *mddev = bitmap->mddev;
+	bitmap_super_t *sb = page_address(bitmap->pages[0]);
+
+	memset(sb, 0, sizeof(*sb));
+	sb->magic = cpu_to_le32(BITMAP_MAGIC);
+	sb->version = cpu_to_le32(BITMAP_MAJOR);
+	memcpy(sb->uuid, mddev->uuid, 16);
+	sb->events = cpu_to_le64(mddev->events);
+	sb->events_cleared = cpu_to_le64(bitmap->events_cleared);
+	sb->sync_size = cpu_to_le64(bitmap->sync_size);
+	sb->state = cpu_to_le32(BITMAP_ACTIVE);
+	sb->chunksize = cpu_to_le32(512 << bitmap->chunkshift);
+	sb->daemon_sleep = cpu_to_le32(bitmap->daemon_sleep / HZ);
+	bitmap_mark_dirty(bitmap, 0);
+}
+
+static inline sector_t bitmap_page_sector(struct bitmap *bitmap,
+					  mdk_rdev_t *rdev, unsigned long idx)
+{
+	return (rdev->sb_offset << 1) + bitmap->offset +
+		idx * (PAGE_SIZE >> 9);
+}
+
+static inline int bitmap_page_size(struct bitmap *bitmap, unsigned long idx)
+{
+	unsigned long size = bitmap->bytes - idx * PAGE_SIZE;
+
+	return size > PAGE_SIZE ? PAGE_SIZE : size;
+}
+
+/*
+ * write one page of the image to every working device.  A device we
+ * can't write the bitmap to can't be trusted to have it, so it is failed.
+ */
+static int write_page(struct bitmap *bitmap, unsigned long idx)
+{
+	mddev_t *mddev = bitmap->mddev;
+	mdk_rdev_t *rdev;
+	struct list_head *tmp;
+	int written = 0;
+
+	ITERATE_RDEV(mddev, rdev, tmp) {
+		if (rdev->faulty)
+			continue;
+		if (sync_page_io(rdev->bdev,
+				 bitmap_page_sector(bitmap, rdev, idx),
+				 bitmap_page_size(bitmap, idx),
+				 bitmap->pages[idx], WRITE))
+			written++;
+		else {
+			char b[BDEVNAME_SIZE];
+			printk(KERN_ERR "%s: bitmap write failed on %s\n",
+			       mdname(mddev), bdevname(rdev->bdev, b));
+			md_error(mddev, rdev);
+		}
+	}
+	return written ? 0 : -EIO;
+}
+
+/**
+ * bitmap_unplug - write all changed bitmap pages to disk
+ * @bitmap: the bitmap, may be NULL
+ *
+ * Once this returns, every bit set by a bitmap_startwrite() that came
+ * before the call is on disk.  Sleeps.
+ */
+int bitmap_unplug(struct bitmap *bitmap)
+{
+	unsigned long i, flags;
+	int need, err = 0;
+
+	if (!bitmap)
+		return 0;
+
+	down(&bitmap->write_sem);
+	for (i = 0; i < bitmap->npages; i++) {
+		spin_lock_irqsave(&bitmap->lock, flags);
+		need = __test_and_clear_bit(i, bitmap->dirty_pages);
+		if (need) {
+			bitmap->dirty--;
+			bitmap->flushing++;
+		}
+		spin_unlock_irqrestore(&bitmap->lock, flags);
+		if (!need)
+			continue;
+
+		if (write_page(bitmap, i))
+			err = -EIO;
+
+		spin_lock_irqsave(&bitmap->lock, flags);
+		bitmap->flushing--;
+		spin_unlock_irqrestore(&bitmap->lock, flags);
+	}
+	up(&bitmap->write_sem);
+
+	if (err)
+		printk(KERN_ERR "%s: bitmap could not be written\n",
+		       mdname(bitmap->mddev));
+	return err;
+}
+
+/**
+ * bitmap_pending - are there bits that have not reached the disk yet?
+ * @bitmap: the bitmap, may be NULL
+ *
+ * Writes must not be issued while this returns true, bitmap_unplug()
+ * first.
+ */
+int bitmap_pending(struct bitmap *bitmap)
+{
+	unsigned long flags;
+	int ret;
+
+	if (!bitmap)
+		return 0;
+
+	spin_lock_irqsave(&bitmap->lock, flags);
+	ret = bitmap->dirty || bitmap->flushing;
+	spin_unlock_irqrestore(&bitmap->lock, flags);
+	return ret;
+}
+
+/**
+ * bitmap_update_sb - write the bitmap superblock
+ * @bitmap: the bitmap, may be NULL
+ *
+ * Called by md_update_sb() before the md superblocks are written, so the
+ * bitmap never looks older than the array.
+ */
+void bitmap_update_sb(struct bitmap *bitmap)
+{
+	unsigned long flags;
+
+	if (!bitmap)
+		return;
+
+	spin_lock_irqsave(&bitmap->lock, flags);
+	bitmap_fill_sb(bitmap);
+	spin_unlock_irqrestore(&bitmap->lock, flags);
+	bitmap_unplug(bitmap);
+}
+
+/**
+ * bitmap_write_all - write the whole bitmap again
+ * @bitmap: the bitmap, may be NULL
+ *
+ * For devices that have just joined the array.
+ */
+void bitmap_write_all(struct bitmap *bitmap)
+{
+	unsigned long i, flags;
+
+	if (!bitmap)
+		return;
+
+	spin_lock_irqsave(&bitmap->lock, flags);
+	bitmap_fill_sb(bitmap);
+	for (i = 0; i < bitmap->npages; i++)
+		bitmap_mark_dirty(bitmap, i);
+	spin_unlock_irqrestore(&bitmap->lock, flags);
+	bitmap_unplug(bitmap);
+}
+
+/**
+ * bitmap_startwrite - note that a write is about to start
+ * @bitmap: the bitmap, may be NULL
+ * @offset: first sector, in device sectors
+ * @sectors: length of the write
+ *
+ * Sets the on-disk bit of every chunk that was clean.  The caller must
+ * bitmap_unplug() (or see bitmap_pending() go false) before issuing the
+ * write.  May sleep if a chunk has too many writes in flight.
+ */
+void bitmap_startwrite(struct bitmap *bitmap, sector_t offset,
+		       unsigned long sectors)
+{
+	if (!bitmap)
+		return;
+
+	while (sectors) {
+		bitmap_counter_t *bmc;
+		int blocks;
+
+		spin_lock_irq(&bitmap->lock);
+		bmc = bitmap_get_counter(bitmap, offset, &blocks);
+		if (!bmc) {
+			spin_unlock_irq(&bitmap->lock);
+			return;
+		}
+
+		if (COUNTER(*bmc) == COUNTER_MAX) {
+			DEFINE_WAIT(wait);
+
+			prepare_to_wait(&bitmap->overflow_wait, &wait,
+					TASK_UNINTERRUPTIBLE);
+			spin_unlock_irq(&bitmap->lock);
+			schedule();
+			finish_wait(&bitmap->overflow_wait, &wait);
+			continue;
+		}
+
+		switch (COUNTER(*bmc)) {
+		case 0:
+			bitmap_set_disk_bit(bitmap, offset >> bitmap->chunkshift);
+			/* fall through */
+		case 1:
+			*bmc = (*bmc & ~COUNTER_MAX) | 2;
+		}
+		(*bmc)++;
+		bitmap->allclean = 0;
+		spin_unlock_irq(&bitmap->lock);
+
+		offset += blocks;
+		if (sectors > blocks)
+			sectors -= blocks;
+		else
+			sectors = 0;
+	}
+}
+
+/**
+ * bitmap_endwrite - note that a write has finished
+ * @bitmap: the bitmap, may be NULL
+ * @offset: first sector, as given to bitmap_startwrite()
+ * @sectors: length of the write
+ * @success: the write reached every device of the array
+ *
+ * If it didn't, the chunks are marked as needing a resync and keep
+ * their bits.  Callable from interrupt context.
+ */
+void bitmap_endwrite(struct bitmap *bitmap, sector_t offset,
+		     unsigned long sectors, int success)
+{
+	unsigned long flags;
+
+	if (!bitmap)
+		return;
+
+	while (sectors) {
+		bitmap_counter_t *bmc;
+		int blocks;
+
+		spin_lock_irqsave(&bitmap->lock, flags);
+		bmc = bitmap_get_counter(bitmap, offset, &blocks);
+		if (!bmc) {
+			spin_unlock_irqrestore(&bitmap->lock, flags);
+			return;
+		}
+
+		if (!success)
+			*bmc |= NEEDED_MASK;
+		if (COUNTER(*bmc) == COUNTER_MAX)
+			wake_up(&bitmap->overflow_wait);
+		if (COUNTER(*bmc) > 2)
+			(*bmc)--;
+		else
+			printk(KERN_ERR "%s: bitmap counter underflow at %llu\n",
+			       mdname(bitmap->mddev),
+			       (unsigned long long)offset);
+		spin_unlock_irqrestore(&bitmap->lock, flags);
+
+		offset += blocks;
+		if (sectors > blocks)
+			sectors -= blocks;
+		else
+			sectors = 0;
+	}
+}
+
+/**
+ * bitmap_start_sync - does this chunk need resyncing?
+ * @bitmap: the bitmap, may be NULL
+ * @offset: sector the resync is at
+ * @blocks: returns the number of sectors the answer is good for
+ * @degraded: the array will still be degraded afterwards, so the chunk
+ *	must stay marked as needing resync
+ *
+ * Without a bitmap everything needs resyncing.
+ */
+int bitmap_start_sync(struct bitmap *bitmap, sector_t offset, int *blocks,
+		      int degraded)
+{
+	bitmap_counter_t *bmc;
+	unsigned long flags;
+	int rv = 0;
+
+	if (!bitmap) {
+		*blocks = 1024;
+		return 1;
+	}
+
+	spin_lock_irqsave(&bitmap->lock, flags);
+	bmc = bitmap_get_counter(bitmap, offset, blocks);
+	if (bmc) {
+		if (RESYNC(*bmc))
+			rv = 1;
+		else if (NEEDED(*bmc)) {
+			rv = 1;
+			if (!degraded) {
+				*bmc |= RESYNC_MASK;
+				*bmc &= ~NEEDED_MASK;
+			}
+		}
+	}
+	spin_unlock_irqrestore(&bitmap->lock, flags);
+	return rv;
+}
+
+/**
+ * bitmap_end_sync - the resync of a chunk is over
+ * @bitmap: the bitmap, may be NULL
+ * @offset: a sector in the chunk
+ * @blocks: returns the number of sectors to the end of the chunk
+ * @aborted: the resync didn't complete, the chunk still needs it
+ */
+void bitmap_end_sync(struct bitmap *bitmap, sector_t offset, int *blocks,
+		     int aborted)
+{
+	bitmap_counter_t *bmc;
+	unsigned long flags;
+
+	if (!bitmap) {
+		*blocks = 1024;
+		return;
+	}
+
+	spin_lock_irqsave(&bitmap->lock, flags);
+	bmc = bitmap_get_counter(bitmap, offset, blocks);
+	if (bmc && RESYNC(*bmc)) {
+		*bmc &= ~RESYNC_MASK;
+		if (aborted)
+			*bmc |= NEEDED_MASK;
+		else
+			bitmap->allclean = 0;
+	}
+	spin_unlock_irqrestore(&bitmap->lock, flags);
+}
+
+/**
+ * bitmap_close_sync - a resync pass has finished
+ * @bitmap: the bitmap, may be NULL
+ *
+ * Every chunk still marked as being resynced was completed.
+ */
+void bitmap_close_sync(struct bitmap *bitmap)
+{
+	sector_t sector = 0;
+	int blocks;
+
+	if (!bitmap)
+		return;
+
+	while (sector < bitmap->sync_size) {
+		bitmap_end_sync(bitmap, sector, &blocks, 0);
+		sector += blocks;
+	}
+}
+
+/**
+ * bitmap_daemon_work - age the idle chunks and clear their bits
+ * @bitmap: the bitmap, may be NULL
+ *
+ * Called from the array's md thread, does something at most every
+ * daemon_sleep.  A chunk's bit is cleared on the second pass after
+ * its last write finished.  Nothing is cleared while the array is
+ * degraded, so that events_cleared stays older than any device that
+ * dropped out and the bits cover everything it missed.
+ */
+void bitmap_daemon_work(struct bitmap *bitmap)
+{
+	unsigned long j, flags;
+	int cleared = 0, busy = 0;
+
+	if (!bitmap)
+		return;
+	if (time_before(jiffies, bitmap->daemon_lastrun + bitmap->daemon_sleep))
+		return;
+	bitmap->daemon_lastrun = jiffies;
+	if (bitmap->allclean)
+		return;
+
+	spin_lock_irqsave(&bitmap->lock, flags);
+	for (j = 0; j < bitmap->chunks; j++) {
+		bitmap_counter_t *bmc = &bitmap->counts[j];
+
+		if (*bmc == 1 && !bitmap->mddev->degraded) {
+			*bmc = 0;
+			bitmap_clear_disk_bit(bitmap, j);
+			cleared = 1;
+		} else if (*bmc) {
+			busy = 1;
+			if (COUNTER(*bmc) == 2)
+				*bmc = (*bmc & ~COUNTER_MAX) | 1;
+		}
+
+		/* don't keep interrupts off for the whole bitmap */
+		if ((j & ((PAGE_SIZE << 3) - 1)) == (PAGE_SIZE << 3) - 1) {
+			spin_unlock_irqrestore(&bitmap->lock, flags);
+			cond_resched();
+			spin_lock_irqsave(&bitmap->lock, flags);
+		}
+	}
+	if (!busy)
+		bitmap->allclean = 1;
+	if (cleared) {
+		bitmap->events_cleared = bitmap->mddev->events;
+		bitmap_fill_sb(bitmap);
+	}
+	spin_unlock_irqrestore(&bitmap->lock, flags);
+
+	if (cleared)
+		bitmap_unplug(bitmap);
+}
+
+/**
+ * bitmap_flush - clear every bit that can be cleared
+ * @mddev: the array, which has no writes in flight
+ */
+void bitmap_flush(mddev_t *mddev)
+{
+	struct bitmap *bitmap = mddev->bitmap;
+	unsigned long sleep;
+
+	if (!bitmap)
+		return;
+
+	/* two passes to age the chunks, the third clears them */
+	sleep = bitmap->daemon_sleep;
+	bitmap->daemon_sleep = 0;
+	bitmap_daemon_work(bitmap);
+	bitmap_daemon_work(bitmap);
+	bitmap_daemon_work(bitmap);
+	bitmap->daemon_sleep = sleep;
+	bitmap_update_sb(bitmap);
+}
+
+void bitmap_status(struct seq_file *seq, struct bitmap *bitmap)
+{
+	unsigned long j, set = 0, flags;
+
+	spin_lock_irqsave(&bitmap->lock, flags);
+	for (j = 0; j < bitmap->chunks; j++)
+		if (bitmap->counts[j])
+			set++;
+	spin_unlock_irqrestore(&bitmap->lock, flags);
+
+	seq_printf(seq, "\n      bitmap: %lu/%lu chunks dirty, %dKB chunk",
+		   set, bitmap->chunks, 1 << (bitmap->chunkshift - 1));
+}
+
+static void bitmap_free(struct bitmap *bitmap)
+{
+	unsigned long i;
+
+	if (bitmap->pages) {
+		for (i = 0; i < bitmap->npages; i++)
+			if (bitmap->pages[i])
+				__free_page(bitmap->pages[i]);
+		kfree(bitmap->pages);
+	}
+	if (bitmap->counts)
+		vfree(bitmap->counts);
+	if (bitmap->dirty_pages)
+		kfree(bitmap->dirty_pages);
+	kfree(bitmap);
+}
+
+/*
+ * lay out a bitmap of 'chunksize' bytes per bit over the array
+ */
+static void bitmap_set_geometry(struct bitmap *bitmap, unsigned long chunksize)
+{
+	unsigned long chunk_sectors = chunksize >> 9;
+
+	bitmap->chunkshift = ffz(~chunk_sectors);
+	bitmap->chunks = (bitmap->sync_size + chunk_sectors - 1) >>
+		bitmap->chunkshift;
+	bitmap->bytes = sizeof(bitmap_super_t) + (bitmap->chunks + 7) / 8;
+	bitmap->bytes = (bitmap->bytes + 511) & ~511UL;
+	bitmap->npages = (bitmap->bytes + PAGE_SIZE - 1) >> PAGE_SHIFT;
+}
+
+/*
+ * read the bitmap superblock from the first good device; returns that
+ * device, NULL if none could be read
+ */
+static mdk_rdev_t *bitmap_read_sb(struct bitmap *bitmap)
+{
+	mdk_rdev_t *rdev;
+	struct list_head *tmp;
+
+	ITERATE_RDEV(bitmap->mddev, rdev, tmp) {
+		if (rdev->faulty || !rdev->in_sync)
+			continue;
+		if (sync_page_io(rdev->bdev, bitmap_page_sector(bitmap, rdev, 0),
+				 PAGE_SIZE < BITMAP_SB90_BYTES ?
+				 PAGE_SIZE : BITMAP_SB90_BYTES,
+				 bitmap->pages[0], READ))
+			return rdev;
+	}
+	return NULL;
+}
+
+/**
+ * bitmap_create - load the bitmap of an array that has just started
+ * @mddev: the array, with mddev->bitmap_offset set
+ *
+ * A bitmap that doesn't match the array, or that is older than it, is
+ * rebuilt with every bit set.  Only 0.90 arrays get a new bitmap made up
+ * from scratch, as only there do we know where there is room for one.
+ */
+int bitmap_create(mddev_t *mddev)
+{
+	struct bitmap *bitmap;
+	bitmap_super_t *sb;
+	mdk_rdev_t *rdev;
+	unsigned long chunksize = 0, npages, i;
+	sector_t start;
+	int stale = 0, err = -ENOMEM;
+
+	if (!mddev->bitmap_offset)
+		return 0;
+	BUG_ON(mddev->bitmap);
+
+	bitmap = kmalloc(sizeof(*bitmap), GFP_KERNEL);
+	if (!bitmap)
+		return -ENOMEM;
+	memset(bitmap, 0, sizeof(*bitmap));
+
+	spin_lock_init(&bitmap->lock);
+	init_MUTEX(&bitmap->write_sem);
+	init_waitqueue_head(&bitmap->overflow_wait);
+	bitmap->mddev = mddev;
+	bitmap->offset = mddev->bitmap_offset;
+	bitmap->sync_size = mddev->size << 1;
+	bitmap->daemon_sleep = BITMAP_DAEMON_SLEEP * HZ;
+	bitmap->daemon_lastrun = jiffies;
+
+	/* the first page tells us how big the rest is */
+	bitmap->pages = kmalloc(sizeof(struct page *), GFP_KERNEL);
+	if (!bitmap->pages)
+		goto out;
+	bitmap->pages[0] = alloc_page(GFP_KERNEL);
+	if (!bitmap->pages[0])
+		goto out;
+	bitmap->npages = 1;
+
+	err = -EIO;
+	rdev = bitmap_read_sb(bitmap);
+	if (!rdev)
+		goto out;
+
+	sb = page_address(bitmap->pages[0]);
+	if (le32_to_cpu(sb->magic) == BITMAP_MAGIC &&
+	    le32_to_cpu(sb->version) == BITMAP_MAJOR &&
+	    memcmp(sb->uuid, mddev->uuid, 16) == 0) {
+		chunksize = le32_to_cpu(sb->chunksize);
+		if (chunksize < PAGE_SIZE || (chunksize & (chunksize - 1)) ||
+		    le64_to_cpu(sb->sync_size) < bitmap->sync_size) {
+			printk(KERN_WARNING "%s: bitmap doesn't fit the array,"
+			       " rebuilding it\n", mdname(mddev));
+			chunksize = 0;
+		} else {
+			if (le32_to_cpu(sb->daemon_sleep))
+				bitmap->daemon_sleep =
+					le32_to_cpu(sb->daemon_sleep) * HZ;
+			bitmap->events_cleared = le64_to_cpu(sb->events_cleared);
+			if ((le32_to_cpu(sb->state) & BITMAP_STALE) ||
+			    le64_to_cpu(sb->events) < mddev->events) {
+				printk(KERN_INFO "%s: bitmap is out of date,"
+				       " resyncing everything\n",
+				       mdname(mddev));
+				stale = 1;
+			}
+		}
+	}
+
+	if (!chunksize) {
+		if (mddev->major_version != 0) {
+			printk(KERN_ERR "%s: no valid bitmap found\n",
+			       mdname(mddev));
+			err = -EINVAL;
+			goto out;
+		}
+		for (chunksize = BITMAP_MIN_CHUNK; ; chunksize <<= 1) {
+			bitmap_set_geometry(bitmap, chunksize);
+			if (bitmap->bytes <= BITMAP_SB90_BYTES)
+				break;
+		}
+		bitmap->npages = 1;
+		memset(page_address(bitmap->pages[0]), 0, PAGE_SIZE);
+		bitmap->events_cleared = mddev->events;
+		stale = 1;
+	}
+	bitmap_set_geometry(bitmap, chunksize);
+	/* only page 0 exists until the page array is reallocated */
+	npages = bitmap->npages;
+	bitmap->npages = 1;
+
+	err = -ENOSPC;
+	if (mddev->major_version == 0 && bitmap->bytes > BITMAP_SB90_BYTES) {
+		printk(KERN_ERR "%s: bitmap too big for the superblock area\n",
+		       mdname(mddev));
+		goto out;
+	}
+
+	err = -ENOMEM;
+	kfree(bitmap->pages);
+	bitmap->pages = kmalloc(npages * sizeof(struct page *), GFP_KERNEL);
+	if (!bitmap->pages)
+		goto out_page0;
+	/* keep the page we already read */
+	bitmap->pages[0] = virt_to_page(sb);
+	bitmap->npages = npages;
+	for (i = 1; i < npages; i++) {
+		bitmap->pages[i] = alloc_page(GFP_KERNEL);
+		if (!bitmap->pages[i]) {
+			bitmap->npages = i;
+			goto out;
+		}
+		if (stale)
+			memset(page_address(bitmap->pages[i]), 0, PAGE_SIZE);
+		else if (!sync_page_io(rdev->bdev,
+				       bitmap_page_sector(bitmap, rdev, i),
+				       bitmap_page_size(bitmap, i),
+				       bitmap->pages[i], READ)) {
+			bitmap->npages = i + 1;
+			err = -EIO;
+			goto out;
+		}
+	}
+
+	bitmap->dirty_pages = kmalloc(BITS_TO_LONGS(bitmap->npages) *
+				      sizeof(unsigned long), GFP_KERNEL);
+	bitmap->counts = vmalloc(bitmap->chunks * sizeof(bitmap_counter_t));
+	if (!bitmap->dirty_pages || !bitmap->counts)
+		goto out;
+	memset(bitmap->dirty_pages, 0,
+	       BITS_TO_LONGS(bitmap->npages) * sizeof(unsigned long));
+	memset(bitmap->counts, 0, bitmap->chunks * sizeof(bitmap_counter_t));
+
+	/*
+	 * Chunks with their bit set need resyncing from where the last
+	 * resync stopped.  If the array is degraded, bits may have been
+	 * left set for the missing devices since the last clean pass,
+	 * so they all count.
+	 */
+	if (mddev->degraded == 0 || bitmap->events_cleared == mddev->events)
+		start = mddev->recovery_cp;
+	else
+		start = 0;
+
+	for (i = 0; i < bitmap->chunks; i++) {
+		if (stale)
+			bitmap_set_disk_bit(bitmap, i);
+		else if (!bitmap_test_disk_bit(bitmap, i))
+			continue;
+		bitmap->counts[i] = 1;
+		if (((sector_t)(i + 1) << bitmap->chunkshift) >= start)
+			bitmap->counts[i] |= NEEDED_MASK;
+	}
+
+	spin_lock_irq(&bitmap->lock);
+	bitmap_fill_sb(bitmap);
+	if (stale)
+		for (i = 0; i < bitmap->npages; i++)
+			bitmap_mark_dirty(bitmap, i);
+	spin_unlock_irq(&bitmap->lock);
+
+	mddev->bitmap = bitmap;
+	if (bitmap_unplug(bitmap)) {
+		mddev->bitmap = NULL;
+		err = -EIO;
+		goto out;
+	}
+	if (mddev->thread)
+		mddev->thread->timeout = bitmap->daemon_sleep;
+
+	printk(KERN_INFO "%s: bitmap of %lu chunks of %luKB%s\n",
+	       mdname(mddev), bitmap->chunks, chunksize >> 10,
+	       stale ? ", all marked dirty" : "");
+	return 0;
+
+out_page0:
+	__free_page(virt_to_page(sb));
+out:
+	bitmap_free(bitmap);
+	return err;
+}
+
+/**
+ * bitmap_destroy - forget the bitmap of an array that has stopped
+ * @mddev: the array
+ */
+void bitmap_destroy(mddev_t *mddev)
+{
+	struct bitmap *bitmap = mddev->bitmap;
+
+	if (!bitmap)
+		return;
+
+	mddev->bitmap = NULL;
+	if (mddev->thread)
+		mddev->thread->timeout = MAX_SCHEDULE_TIMEOUT;
+	bitmap_free(bitmap);
+}
+
+EXPORT_SYMBOL(bitmap_unplug);
+EXPORT_SYMBOL(bitmap_pending);
+EXPORT_SYMBOL(bitmap_startwrite);
+EXPORT_SYMBOL(bitmap_endwrite);
+EXPORT_SYMBOL(bitmap_start_sync);
+EXPORT_SYMBOL(bitmap_end_sync);
+EXPORT_SYMBOL(bitmap_close_sync);
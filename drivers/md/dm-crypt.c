@@ -14,6 +14,7 @@
 #include <linux/slab.h>
 #include <linux/crypto.h>
 #include <linux/workqueue.h>
+#include <linux/completion.h>
 #include <asm/atomic.h>
 #include <asm/scatterlist.h>
 #include <asm/page.h>
@@ -46,6 +47,23 @@ struct convert_context {
 	unsigned int idx_out;
 	sector_t sector;
 	int write;
+
+	/* requests in flight, plus one while submitting */
+	atomic_t pending;
+	struct completion done;
+	int error;
+};
+
+/*
+ * A request for one sector, which the cipher may complete later.
+ */
+struct crypt_req {
+	struct cipher_request req;
+	struct convert_context *ctx;
+	struct crypt_config *cc;
+	struct scatterlist sg_in;
+	struct scatterlist sg_out;
+	u8 iv[0];
 };
 
 struct crypt_config;
@@ -72,6 +90,7 @@ struct crypt_config {
 	 */
 	mempool_t *io_pool;
 	mempool_t *page_pool;
+	mempool_t *req_pool;
 
 	/*
 	 * crypto related data
@@ -82,7 +101,16 @@ struct crypt_config {
 	sector_t iv_offset;
 	unsigned int iv_size;
 
+	/*
+	 * The tfm is shared by all cpus: dm-crypt only uses the calls
+	 * that take the IV as an argument, and the key schedule isn't
+	 * written to after setkey, so conversions can run in parallel.
+	 * It may be an asynchronous cipher, with sectors in flight.
+	 */
 	struct crypto_tfm *tfm;
+
+	int last_cpu;		/* kcryptd thread the last io went to */
+
 	unsigned int key_size;
 	u8 key[0];
 };
@@ -106,6 +134,16 @@ static void mempool_free_page(void *page, void *data)
 	__free_page(page);
 }
 
+static void *mempool_alloc_req(int gfp_mask, void *data)
+{
+	return kmalloc((unsigned long)data, gfp_mask);
+}
+
+static void mempool_free_req(void *req, void *data)
+{
+	kfree(req);
+}
+
 
 /*
  * Different IV generation algorithms:
@@ -231,30 +269,69 @@ static struct crypt_iv_operations crypt_iv_essiv_ops = {
 };
 
 
+static void crypt_convert_done(struct cipher_request *req, int error)
+{
+	struct crypt_req *creq = container_of(req, struct crypt_req, req);
+	struct convert_context *ctx = creq->ctx;
+
+	if (error < 0)
+		ctx->error = error;
+	mempool_free(creq, creq->cc->req_pool);
+
+	if (atomic_dec_and_test(&ctx->pending))
+		complete(&ctx->done);
+}
+
+/*
+ * Wait for the requests in flight, then start counting afresh.
+ */
+static void crypt_convert_wait(struct convert_context *ctx)
+{
+	if (!atomic_dec_and_test(&ctx->pending))
+		wait_for_completion(&ctx->done);
+
+	atomic_set(&ctx->pending, 1);
+	init_completion(&ctx->done);
+}
+
+/*
+ * Submit the conversion of a sector: returns 0 if it was queued, else
+ * its result.
+ */
 static inline int
-crypt_convert_scatterlist(struct crypt_config *cc, struct scatterlist *out,
-                          struct scatterlist *in, unsigned int length,
-                          int write, sector_t sector)
+crypt_convert_scatterlist(struct crypt_config *cc, struct crypt_req *creq,
+                          unsigned int length, int write, sector_t sector)
 {
-	u8 iv[cc->iv_size];
+	u8 *iv = NULL;
 	int r;
 
 	if (cc->iv_gen_ops) {
+		iv = creq->iv;
 		r = cc->iv_gen_ops->generator(cc, iv, sector);
 		if (r < 0)
 			return r;
+	}
 
-		if (write)
-			r = crypto_cipher_encrypt_iv(cc->tfm, out, in, length, iv);
-		else
-			r = crypto_cipher_decrypt_iv(cc->tfm, out, in, length, iv);
-	} else {
-		if (write)
-			r = crypto_cipher_encrypt(cc->tfm, out, in, length);
-		else
-			r = crypto_cipher_decrypt(cc->tfm, out, in, length);
+	cipher_request_init(&creq->req, cc->tfm, CRYPTO_REQ_MAY_BACKLOG,
+	                    crypt_convert_done, NULL);
+	cipher_request_set_crypt(&creq->req, &creq->sg_out, &creq->sg_in,
+	                         length, iv);
+
+	if (write)
+		r = crypto_cipher_encrypt_async(&creq->req);
+	else
+		r = crypto_cipher_decrypt_async(&creq->req);
+
+	switch (r) {
+	case -EBUSY:
+		/* queued, but the cipher is backed up */
+		crypt_convert_wait(creq->ctx);
+	case -EINPROGRESS:
+		return 0;
 	}
 
+	atomic_dec(&creq->ctx->pending);
+	mempool_free(creq, cc->req_pool);
 	return r;
 }
 
@@ -275,40 +352,53 @@ crypt_convert_init(struct crypt_config *cc, struct convert_context *ctx,
 
 /*
  * Encrypt / decrypt data from one bio to another one (can be the same one)
+ *
+ * Every sector is submitted without waiting for the one before, so an
+ * asynchronous cipher gets the whole bio to work on; the conversion
+ * waits for them all at the end.
  */
 static int crypt_convert(struct crypt_config *cc,
                          struct convert_context *ctx)
 {
 	int r = 0;
 
+	atomic_set(&ctx->pending, 1);
+	init_completion(&ctx->done);
+	ctx->error = 0;
+
 	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 		struct bio_vec *bv_in = bio_iovec_idx(ctx->bio_in, ctx->idx_in);
 		struct bio_vec *bv_out = bio_iovec_idx(ctx->bio_out, ctx->idx_out);
-		struct scatterlist sg_in = {
-			.page = bv_in->bv_page,
-			.offset = bv_in->bv_offset + ctx->offset_in,
-			.length = 1 << SECTOR_SHIFT
-		};
-		struct scatterlist sg_out = {
-			.page = bv_out->bv_page,
-			.offset = bv_out->bv_offset + ctx->offset_out,
-			.length = 1 << SECTOR_SHIFT
-		};
-
-		ctx->offset_in += sg_in.length;
+		struct crypt_req *creq = mempool_alloc(cc->req_pool, GFP_NOIO);
+		struct scatterlist *sg_in = &creq->sg_in;
+		struct scatterlist *sg_out = &creq->sg_out;
+
+		creq->ctx = ctx;
+		creq->cc = cc;
+		memset(sg_in, 0, sizeof(*sg_in));
+		memset(sg_out, 0, sizeof(*sg_out));
+		sg_in->page = bv_in->bv_page;
+		sg_in->offset = bv_in->bv_offset + ctx->offset_in;
+		sg_in->length = 1 << SECTOR_SHIFT;
+		sg_out->page = bv_out->bv_page;
+		sg_out->offset = bv_out->bv_offset + ctx->offset_out;
+		sg_out->length = 1 << SECTOR_SHIFT;
+
+		ctx->offset_in += sg_in->length;
 		if (ctx->offset_in >= bv_in->bv_len) {
 			ctx->offset_in = 0;
 			ctx->idx_in++;
 		}
 
-		ctx->offset_out += sg_out.length;
+		ctx->offset_out += sg_out->length;
 		if (ctx->offset_out >= bv_out->bv_len) {
 			ctx->offset_out = 0;
 			ctx->idx_out++;
 		}
 
-		r = crypt_convert_scatterlist(cc, &sg_out, &sg_in, sg_in.length,
+		atomic_inc(&ctx->pending);
+		r = crypt_convert_scatterlist(cc, creq, 1 << SECTOR_SHIFT,
 		                              ctx->write, ctx->sector);
 		if (r < 0)
 			break;
@@ -316,7 +406,8 @@ static int crypt_convert(struct crypt_config *cc,
 		ctx->sector++;
 	}
 
-	return r;
+	crypt_convert_wait(ctx);
+	return r < 0 ? r : ctx->error;
 }
 
 /*
@@ -459,12 +550,21 @@ static void dec_pending(struct crypt_io *io, int error)
 	mempool_free(io, cc->io_pool);
 }
 
+static int crypt_dispatch(struct crypt_io *io);
+
 /*
  * kcryptd:
  *
  * Needed because it would be very unwise to do decryption in an
  * interrupt context, so bios returning from read requests get
- * queued here.
+ * queued here.  Writes are queued here too, to be encrypted and sent
+ * on, so that a single submitter doesn't limit them to one cpu either.
+ *
+ * Every io is converted as a whole by one thread, so the clones of a
+ * write still go out in order.  Successive ios are handed to the
+ * online cpus in turn rather than to the cpu that completed or
+ * submitted them, which for reads would be whichever takes the disk
+ * interrupt.
  */
 static struct workqueue_struct *_kcryptd_workqueue;
 
@@ -475,6 +575,12 @@ static void kcryptd_do_work(void *data)
 	struct convert_context ctx;
 	int r;
 
+	if (bio_data_dir(io->bio) == WRITE) {
+		if (crypt_dispatch(io) < 0)
+			dec_pending(io, -ENOMEM);
+		return;
+	}
+
 	crypt_convert_init(cc, &ctx, io->bio, io->bio,
 	                   io->bio->bi_sector - io->target->begin, 0);
 	r = crypt_convert(cc, &ctx);
@@ -484,8 +590,17 @@ static void kcryptd_do_work(void *data)
 
 static void kcryptd_queue_io(struct crypt_io *io)
 {
+	struct crypt_config *cc = (struct crypt_config *) io->target->private;
+	int cpu;
+
+	/* racy, but a lost update only means a cpu gets two in a row */
+	cpu = next_cpu(cc->last_cpu, cpu_online_map);
+	if (cpu >= NR_CPUS)
+		cpu = first_cpu(cpu_online_map);
+	cc->last_cpu = cpu;
+
 	INIT_WORK(&io->work, kcryptd_do_work, io);
-	queue_work(_kcryptd_workqueue, &io->work);
+	queue_work_on(cpu, _kcryptd_workqueue, &io->work);
 }
 
 /*
@@ -569,6 +684,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	}
 
 	cc->key_size = key_size;
+	cc->last_cpu = 0;
 	if ((!key_size && strcmp(argv[1], "-") != 0) ||
 	    (key_size && crypt_decode_key(cc->key, argv[1], key_size) < 0)) {
 		ti->error = PFX "Error decoding key";
@@ -596,7 +712,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad1;
 	}
 
-	tfm = crypto_alloc_tfm(cipher, crypto_flags);
+	tfm = crypto_alloc_tfm(cipher, crypto_flags | CRYPTO_TFM_REQ_MAY_ASYNC);
 	if (!tfm) {
 		ti->error = PFX "Error allocating crypto tfm";
 		goto bad1;
@@ -656,25 +772,34 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad4;
 	}
 
+	cc->req_pool = mempool_create(MIN_IOS, mempool_alloc_req,
+				      mempool_free_req,
+				      (void *)(unsigned long)
+				      (sizeof(struct crypt_req) + cc->iv_size));
+	if (!cc->req_pool) {
+		ti->error = PFX "Cannot allocate crypt request mempool";
+		goto bad5;
+	}
+
 	if (tfm->crt_cipher.cit_setkey(tfm, cc->key, key_size) < 0) {
 		ti->error = PFX "Error setting key";
-		goto bad5;
+		goto bad6;
 	}
 
 	if (sscanf(argv[2], SECTOR_FORMAT, &cc->iv_offset) != 1) {
 		ti->error = PFX "Invalid iv_offset sector";
-		goto bad5;
+		goto bad6;
 	}
 
 	if (sscanf(argv[4], SECTOR_FORMAT, &cc->start) != 1) {
 		ti->error = PFX "Invalid device sector";
-		goto bad5;
+		goto bad6;
 	}
 
 	if (dm_get_device(ti, argv[3], cc->start, ti->len,
 	                  dm_table_get_mode(ti->table), &cc->dev)) {
 		ti->error = PFX "Device lookup failed";
-		goto bad5;
+		goto bad6;
 	}
 
 	if (ivmode && cc->iv_gen_ops) {
@@ -683,7 +808,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		cc->iv_mode = kmalloc(strlen(ivmode) + 1, GFP_KERNEL);
 		if (!cc->iv_mode) {
 			ti->error = PFX "Error kmallocing iv_mode string";
-			goto bad5;
+			goto bad6;
 		}
 		strcpy(cc->iv_mode, ivmode);
 	} else
@@ -692,6 +817,8 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	ti->private = cc;
 	return 0;
 
+bad6:
+	mempool_destroy(cc->req_pool);
 bad5:
 	mempool_destroy(cc->page_pool);
 bad4:
@@ -710,6 +837,7 @@ static void crypt_dtr(struct dm_target *ti)
 {
 	struct crypt_config *cc = (struct crypt_config *) ti->private;
 
+	mempool_destroy(cc->req_pool);
 	mempool_destroy(cc->page_pool);
 	mempool_destroy(cc->io_pool);
 
@@ -800,23 +928,21 @@ crypt_clone(struct crypt_config *cc, struct crypt_io *io, struct bio *bio,
 	return clone;
 }
 
-static int crypt_map(struct dm_target *ti, struct bio *bio,
-		     union map_info *map_context)
+/*
+ * Clone the bio, encrypting the data of writes, and send the clones
+ * to the underlying device.  If not even the first clone could be
+ * allocated -ENOMEM is returned and io is left to the caller.
+ */
+static int crypt_dispatch(struct crypt_io *io)
 {
-	struct crypt_config *cc = (struct crypt_config *) ti->private;
-	struct crypt_io *io = mempool_alloc(cc->io_pool, GFP_NOIO);
+	struct crypt_config *cc = (struct crypt_config *) io->target->private;
+	struct bio *bio = io->bio;
 	struct convert_context ctx;
 	struct bio *clone;
 	unsigned int remaining = bio->bi_size;
-	sector_t sector = bio->bi_sector - ti->begin;
+	sector_t sector = bio->bi_sector - io->target->begin;
 	unsigned int bvec_idx = 0;
 
-	io->target = ti;
-	io->bio = bio;
-	io->first_clone = NULL;
-	io->error = 0;
-	atomic_set(&io->pending, 1); /* hold a reference */
-
 	if (bio_data_dir(bio) == WRITE)
 		crypt_convert_init(cc, &ctx, NULL, bio, sector, 1);
 
@@ -860,11 +986,36 @@ cleanup:
 		return 0;
 	}
 
-	/* if no bio has been dispatched yet, we can directly return the error */
-	mempool_free(io, cc->io_pool);
+	/* if no bio has been dispatched yet, the caller reports the error */
 	return -ENOMEM;
 }
 
+static int crypt_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct crypt_config *cc = (struct crypt_config *) ti->private;
+	struct crypt_io *io = mempool_alloc(cc->io_pool, GFP_NOIO);
+
+	io->target = ti;
+	io->bio = bio;
+	io->first_clone = NULL;
+	io->error = 0;
+	atomic_set(&io->pending, 1); /* hold a reference */
+
+	/* writes are encrypted and sent on by kcryptd */
+	if (bio_data_dir(bio) == WRITE) {
+		kcryptd_queue_io(io);
+		return 0;
+	}
+
+	if (crypt_dispatch(io) < 0) {
+		/* nothing has been dispatched, return the error directly */
+		mempool_free(io, cc->io_pool);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
 static int crypt_status(struct dm_target *ti, status_type_t type,
 			char *result, unsigned int maxlen)
 {
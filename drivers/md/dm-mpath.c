@@ -93,6 +93,7 @@ struct multipath {
 struct mpath_io {
 	struct pgpath *pgpath;
 	struct dm_bio_details details;
+	size_t nr_bytes;		/* size given to the path selector */
 };
 
 typedef int (*action_fn) (struct pgpath *pgpath);
@@ -289,6 +290,7 @@ static int map_io(struct multipath *m, struct bio *bio, struct mpath_io *mpio,
 	int r = 1;
 	unsigned long flags;
 	struct pgpath *pgpath;
+	struct path_selector *ps;
 
 	spin_lock_irqsave(&m->lock, flags);
 
@@ -313,8 +315,13 @@ static int map_io(struct multipath *m, struct bio *bio, struct mpath_io *mpio,
 		r = 0;
 	} else if (!pgpath)
 		r = -EIO;		/* Failed */
-	else
+	else {
 		bio->bi_bdev = pgpath->path.dev->bdev;
+		mpio->nr_bytes = bio->bi_size;
+		ps = &pgpath->pg->ps;
+		if (ps->type->start_io)
+			ps->type->start_io(ps, &pgpath->path, mpio->nr_bytes);
+	}
 
 	mpio->pgpath = pgpath;
 
@@ -1037,7 +1044,7 @@ static int multipath_end_io(struct dm_target *ti, struct bio *bio,
 	if (pgpath) {
 		ps = &pgpath->pg->ps;
 		if (ps->type->end_io)
-			ps->type->end_io(ps, &pgpath->path);
+			ps->type->end_io(ps, &pgpath->path, mpio->nr_bytes);
 	}
 	if (r <= 0)
 		mempool_free(mpio, m->mpio_pool);
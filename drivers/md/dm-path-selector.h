@@ -75,7 +75,15 @@ struct path_selector_type {
 	int (*status) (struct path_selector *ps, struct path *path,
 		       status_type_t type, char *result, unsigned int maxlen);
 
-	int (*end_io) (struct path_selector *ps, struct path *path);
+	/*
+	 * Notify the selector that an io of nr_bytes has been sent
+	 * down a path, and that it has completed.  Called once each
+	 * per dispatch, start_io with the multipath lock held.
+	 */
+	int (*start_io) (struct path_selector *ps, struct path *path,
+			 size_t nr_bytes);
+	int (*end_io) (struct path_selector *ps, struct path *path,
+		       size_t nr_bytes);
 };
 
 /* Register a path selector */
@@ -133,7 +133,12 @@ static void region_free(void *element, void *pool_data)
 }
 
 #define MIN_REGIONS 64
-#define MAX_RECOVERY 1
+/*
+ * Regions recovered at once, and the pieces of their copies kcopyd
+ * keeps in flight while the mirror devices aren't congested.
+ */
+#define MAX_RECOVERY 8
+#define RECOVERY_IO 16
 static int rh_init(struct region_hash *rh, struct mirror_set *ms,
 		   struct dirty_log *log, uint32_t region_size,
 		   region_t nr_regions)
@@ -1067,6 +1072,9 @@ static int mirror_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		return r;
 	}
 
+	/* resync is background work, let it yield to the mirror's io */
+	kcopyd_client_throttle(ms->kcopyd_client, RECOVERY_IO);
+
 	add_mirror_set(ms);
 	return 0;
 }
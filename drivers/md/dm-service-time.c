@@ -0,0 +1,287 @@
+/*
+ * Service-time path selector.  Sends io down the path expected to
+ * complete it first: the one with the fewest bytes in flight relative
+ * to its throughput.  Each path may be given a relative throughput
+ * (1-100) for fabrics whose paths differ in bandwidth.
+ *
+ * This file is released under the GPL.
+ */
+
+#include "dm.h"
+#include "dm-path-selector.h"
+
+#include <linux/slab.h>
+#include <asm/atomic.h>
+
+#define ST_MIN_IO	1
+#define ST_MAX_RELATIVE_THROUGHPUT	100
+#define ST_VERSION	"0.1.0"
+
+struct path_info {
+	struct list_head list;
+	struct path *path;
+	unsigned repeat_count;
+	unsigned relative_throughput;
+	atomic_t qlen;			/* ios in flight */
+	atomic_t in_flight_size;	/* bytes in flight */
+};
+
+struct selector {
+	struct list_head valid_paths;
+	struct list_head failed_paths;
+};
+
+static void free_paths(struct list_head *paths)
+{
+	struct path_info *pi, *next;
+
+	list_for_each_entry_safe(pi, next, paths, list) {
+		list_del(&pi->list);
+		kfree(pi);
+	}
+}
+
+static int st_create(struct path_selector *ps, unsigned argc, char **argv)
+{
+	struct selector *s = kmalloc(sizeof(*s), GFP_KERNEL);
+
+	if (!s)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&s->valid_paths);
+	INIT_LIST_HEAD(&s->failed_paths);
+
+	ps->context = s;
+	return 0;
+}
+
+static void st_destroy(struct path_selector *ps)
+{
+	struct selector *s = (struct selector *) ps->context;
+
+	free_paths(&s->valid_paths);
+	free_paths(&s->failed_paths);
+	kfree(s);
+	ps->context = NULL;
+}
+
+static int st_status(struct path_selector *ps, struct path *path,
+		     status_type_t type, char *result, unsigned int maxlen)
+{
+	struct path_info *pi;
+	int sz = 0;
+
+	if (!path)
+		DMEMIT("0 ");
+	else {
+		pi = path->pscontext;
+
+		switch(type) {
+		case STATUSTYPE_INFO:
+			DMEMIT("%u %u ", atomic_read(&pi->qlen),
+			       atomic_read(&pi->in_flight_size));
+			break;
+		case STATUSTYPE_TABLE:
+			DMEMIT("%u %u ", pi->repeat_count,
+			       pi->relative_throughput);
+			break;
+		}
+	}
+
+	return sz;
+}
+
+/*
+ * Called during initialisation to register each path with an
+ * optional repeat_count and relative_throughput.
+ */
+static int st_add_path(struct path_selector *ps, struct path *path,
+		       int argc, char **argv, char **error)
+{
+	struct selector *s = (struct selector *) ps->context;
+	struct path_info *pi;
+	unsigned repeat_count = ST_MIN_IO;
+	unsigned relative_throughput = 1;
+
+	if (argc > 2) {
+		*error = "service-time ps: incorrect number of arguments";
+		return -EINVAL;
+	}
+
+	/* First path argument is number of I/Os before switching path */
+	if (argc && (sscanf(argv[0], "%u", &repeat_count) != 1)) {
+		*error = "service-time ps: invalid repeat count";
+		return -EINVAL;
+	}
+
+	/*
+	 * Second is the throughput of the path relative to the others;
+	 * a path with 0 is only used when all the others have 0 too.
+	 */
+	if ((argc == 2) &&
+	    (sscanf(argv[1], "%u", &relative_throughput) != 1 ||
+	     relative_throughput > ST_MAX_RELATIVE_THROUGHPUT)) {
+		*error = "service-time ps: invalid relative_throughput value";
+		return -EINVAL;
+	}
+
+	pi = kmalloc(sizeof(*pi), GFP_KERNEL);
+	if (!pi) {
+		*error = "service-time ps: Error allocating path context";
+		return -ENOMEM;
+	}
+
+	pi->path = path;
+	pi->repeat_count = repeat_count;
+	pi->relative_throughput = relative_throughput;
+	atomic_set(&pi->qlen, 0);
+	atomic_set(&pi->in_flight_size, 0);
+
+	path->pscontext = pi;
+
+	list_add_tail(&pi->list, &s->valid_paths);
+
+	return 0;
+}
+
+static void st_fail_path(struct path_selector *ps, struct path *path)
+{
+	struct selector *s = (struct selector *) ps->context;
+	struct path_info *pi = path->pscontext;
+
+	list_move(&pi->list, &s->failed_paths);
+}
+
+static int st_reinstate_path(struct path_selector *ps, struct path *path)
+{
+	struct selector *s = (struct selector *) ps->context;
+	struct path_info *pi = path->pscontext;
+
+	list_move_tail(&pi->list, &s->valid_paths);
+
+	return 0;
+}
+
+/*
+ * Returns < 0 if pi1 is expected to complete new io sooner than pi2,
+ * > 0 if later, 0 if there is nothing to tell them apart.
+ *
+ * The expected service time of a path is the data it has in flight
+ * (plus the new io, counted as a byte as its size isn't known here)
+ * divided by its relative throughput, so compare
+ *	(sz1 + 1) / rt1  against  (sz2 + 1) / rt2
+ * as (sz1 + 1) * rt2 against (sz2 + 1) * rt1.
+ */
+static int st_compare_load(struct path_info *pi1, struct path_info *pi2)
+{
+	u64 sz1 = atomic_read(&pi1->in_flight_size);
+	u64 sz2 = atomic_read(&pi2->in_flight_size);
+	unsigned rt1 = pi1->relative_throughput;
+	unsigned rt2 = pi2->relative_throughput;
+	u64 st1, st2;
+
+	/* a path with no throughput loses against any other */
+	if (!rt1 != !rt2)
+		return rt1 ? -1 : 1;
+
+	if (!rt1) {
+		rt1 = 1;
+		rt2 = 1;
+	}
+
+	st1 = (sz1 + 1) * rt2;
+	st2 = (sz2 + 1) * rt1;
+	if (st1 != st2)
+		return st1 < st2 ? -1 : 1;
+
+	/* same expected time: the faster path drains its queue first */
+	if (rt1 != rt2)
+		return rt1 > rt2 ? -1 : 1;
+
+	return 0;
+}
+
+static struct path *st_select_path(struct path_selector *ps,
+				   unsigned *repeat_count)
+{
+	struct selector *s = (struct selector *) ps->context;
+	struct path_info *pi, *best = NULL;
+
+	if (list_empty(&s->valid_paths))
+		return NULL;
+
+	/* Change preferred (first in list) path to evenly balance. */
+	list_move_tail(s->valid_paths.next, &s->valid_paths);
+
+	list_for_each_entry(pi, &s->valid_paths, list)
+		if (!best || (st_compare_load(pi, best) < 0))
+			best = pi;
+
+	*repeat_count = best->repeat_count;
+
+	return best->path;
+}
+
+static int st_start_io(struct path_selector *ps, struct path *path,
+		       size_t nr_bytes)
+{
+	struct path_info *pi = path->pscontext;
+
+	atomic_inc(&pi->qlen);
+	atomic_add(nr_bytes, &pi->in_flight_size);
+
+	return 0;
+}
+
+static int st_end_io(struct path_selector *ps, struct path *path,
+		     size_t nr_bytes)
+{
+	struct path_info *pi = path->pscontext;
+
+	atomic_dec(&pi->qlen);
+	atomic_sub(nr_bytes, &pi->in_flight_size);
+
+	return 0;
+}
+
+static struct path_selector_type st_ps = {
+	.name		= "service-time",
+	.module		= THIS_MODULE,
+	.table_args	= 2,
+	.info_args	= 2,
+	.create		= st_create,
+	.destroy	= st_destroy,
+	.status		= st_status,
+	.add_path	= st_add_path,
+	.fail_path	= st_fail_path,
+	.reinstate_path	= st_reinstate_path,
+	.select_path	= st_select_path,
+	.start_io	= st_start_io,
+	.end_io		= st_end_io,
+};
+
+static int __init dm_st_init(void)
+{
+	int r = dm_register_path_selector(&st_ps);
+
+	if (r < 0)
+		DMERR("service-time: register failed %d", r);
+
+	DMINFO("dm-service-time version " ST_VERSION " loaded");
+
+	return r;
+}
+
+static void __exit dm_st_exit(void)
+{
+	int r = dm_unregister_path_selector(&st_ps);
+
+	if (r < 0)
+		DMERR("service-time: unregister failed %d", r);
+}
+
+module_init(dm_st_init);
+module_exit(dm_st_exit);
+
+MODULE_DESCRIPTION(DM_NAME " throughput oriented path selector");
+MODULE_LICENSE("GPL");
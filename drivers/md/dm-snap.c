@@ -63,6 +63,14 @@ struct pending_exception {
 	 * kcopyd.
 	 */
 	int started;
+
+	/*
+	 * Exceptions of other snapshots of the same origin whose
+	 * copy is done by the same kcopyd job as this one: the
+	 * origin chunk is read once and written to every cow
+	 * device in the chain.
+	 */
+	struct pending_exception *copy_next;
 };
 
 /*
@@ -663,25 +671,37 @@ static void commit_callback(void *context, int success)
 static void copy_callback(int read_err, unsigned int write_err, void *context)
 {
 	struct pending_exception *pe = (struct pending_exception *) context;
-	struct dm_snapshot *s = pe->snap;
+	struct pending_exception *next;
+	struct dm_snapshot *s;
+	unsigned int dest = 0;
 
-	if (read_err || write_err)
-		pending_complete(pe, 0);
+	/* destination n of the copy is the n-th exception of the chain */
+	for (; pe; pe = next, dest++) {
+		/* pe may be freed by the time the calls below return */
+		next = pe->copy_next;
+		s = pe->snap;
 
-	else
-		/* Update the metadata if we are persistent */
-		s->store.commit_exception(&s->store, &pe->e, commit_callback,
-					  pe);
+		if (read_err || (write_err & (1 << dest)))
+			pending_complete(pe, 0);
+
+		else
+			/* Update the metadata if we are persistent */
+			s->store.commit_exception(&s->store, &pe->e,
+						  commit_callback, pe);
+	}
 }
 
 /*
- * Dispatches the copy operation to kcopyd.
+ * Dispatches the copy operation to kcopyd, with one destination for
+ * pe and every exception chained to it.
  */
 static inline void start_copy(struct pending_exception *pe)
 {
 	struct dm_snapshot *s = pe->snap;
-	struct io_region src, dest;
+	struct pending_exception *p;
+	struct io_region src, dest[KCOPYD_MAX_REGIONS];
 	struct block_device *bdev = s->origin->bdev;
+	unsigned int num_dests = 0;
 	sector_t dev_size;
 
 	dev_size = get_dev_size(bdev);
@@ -690,13 +710,17 @@ static inline void start_copy(struct pending_exception *pe)
 	src.sector = chunk_to_sector(s, pe->e.old_chunk);
 	src.count = min(s->chunk_size, dev_size - src.sector);
 
-	dest.bdev = s->cow->bdev;
-	dest.sector = chunk_to_sector(s, pe->e.new_chunk);
-	dest.count = src.count;
+	for (p = pe; p; p = p->copy_next) {
+		dest[num_dests].bdev = p->snap->cow->bdev;
+		dest[num_dests].sector = chunk_to_sector(p->snap,
+							 p->e.new_chunk);
+		dest[num_dests].count = src.count;
+		num_dests++;
+	}
 
 	/* Hand over to kcopyd */
 	kcopyd_copy(s->kcopyd_client,
-		    &src, 1, &dest, 0, copy_callback, pe);
+		    &src, num_dests, dest, 0, copy_callback, pe);
 }
 
 /*
@@ -742,6 +766,7 @@ __find_pending_exception(struct dm_snapshot *s, struct bio *bio)
 			INIT_LIST_HEAD(&pe->siblings);
 			pe->snap = s;
 			pe->started = 0;
+			pe->copy_next = NULL;
 
 			if (s->store.prepare_exception(&s->store, &pe->e)) {
 				free_pending_exception(pe);
@@ -922,6 +947,8 @@ static int __origin_write(struct list_head *snapshots, struct bio *bio)
 	struct dm_snapshot *snap;
 	struct exception *e;
 	struct pending_exception *pe, *last = NULL;
+	struct pending_exception *copy = NULL, *copy_tail = NULL;
+	unsigned int copy_dests = 0;
 	chunk_t chunk;
 
 	/* Do all the snapshots on this origin */
@@ -966,6 +993,9 @@ static int __origin_write(struct list_head *snapshots, struct bio *bio)
 
 	/*
 	 * Now that we have a complete pe list we can start the copying.
+	 * Snapshots with the same chunk size need the same origin chunk,
+	 * so rather than copying it once per snapshot, one kcopyd job
+	 * reads it and writes it to all their cow devices.
 	 */
 	if (last) {
 		pe = last;
@@ -976,7 +1006,19 @@ static int __origin_write(struct list_head *snapshots, struct bio *bio)
 			if (!pe->started) {
 				pe->started = 1;
 				up_write(&pe->snap->lock);
-				start_copy(pe);
+
+				if (copy &&
+				    copy->snap->chunk_size == pe->snap->chunk_size &&
+				    copy_dests < KCOPYD_MAX_REGIONS) {
+					copy_tail->copy_next = pe;
+					copy_tail = pe;
+					copy_dests++;
+				} else {
+					if (copy)
+						start_copy(copy);
+					copy = copy_tail = pe;
+					copy_dests = 1;
+				}
 			} else
 				up_write(&pe->snap->lock);
 			first = 0;
@@ -984,6 +1026,9 @@ static int __origin_write(struct list_head *snapshots, struct bio *bio)
 					struct pending_exception, siblings);
 
 		} while (pe != last);
+
+		if (copy)
+			start_copy(copy);
 	}
 
 	return r;
@@ -19,6 +19,7 @@
 #include <linux/module.h>
 #include <linux/pagemap.h>
 #include <linux/slab.h>
+#include <linux/timer.h>
 #include <linux/vmalloc.h>
 #include <linux/workqueue.h>
 
@@ -32,9 +33,24 @@ static inline void wake(void)
 	queue_work(_kcopyd_wq, &_kcopyd_work);
 }
 
+/*
+ * Throttled clients back off for this long when the devices they
+ * copy between are congested.
+ */
+#define BACKOFF_DELAY (HZ / 50)
+
+static struct timer_list _backoff_timer;
+
+static void backoff_timer_fn(unsigned long data)
+{
+	wake();
+}
+
 /*-----------------------------------------------------------------
  * Each kcopyd client has its own little pool of preallocated
- * pages for kcopyd io.
+ * pages for kcopyd io.  The pool is grown, up to max_pages, while
+ * there are copies waiting for pages and memory to spare, and
+ * shrunk back to the preallocated size once the client is idle.
  *---------------------------------------------------------------*/
 struct kcopyd_client {
 	struct list_head list;
@@ -43,17 +59,32 @@ struct kcopyd_client {
 	struct page_list *pages;
 	unsigned int nr_pages;
 	unsigned int nr_free_pages;
+	unsigned int nr_reserved_pages;	/* preallocated, never freed */
+	unsigned int max_pages;
+
+	/*
+	 * Jobs that have their pages, i.e. are doing io.  A
+	 * throttled client has at most max_io of them, and doesn't
+	 * start any while its devices are congested.
+	 */
+	atomic_t nr_io;
+	unsigned int max_io;		/* 0: not throttled */
+
+	/* do_work() pass in which this client last had to wait */
+	unsigned long blocked_pass;
 };
 
-static struct page_list *alloc_pl(void)
+#define MAX_PAGES_FACTOR 4
+
+static struct page_list *alloc_pl(int gfp_mask)
 {
 	struct page_list *pl;
 
-	pl = kmalloc(sizeof(*pl), GFP_KERNEL);
+	pl = kmalloc(sizeof(*pl), gfp_mask);
 	if (!pl)
 		return NULL;
 
-	pl->page = alloc_page(GFP_KERNEL);
+	pl->page = alloc_page(gfp_mask);
 	if (!pl->page) {
 		kfree(pl);
 		return NULL;
@@ -68,15 +99,88 @@ static void free_pl(struct page_list *pl)
 	kfree(pl);
 }
 
+/*
+ * Try to add nr pages to the pool, without waiting for memory and
+ * without going over max_pages.  Returns the number added.
+ */
+static unsigned int client_grow_pages(struct kcopyd_client *kc,
+				      unsigned int nr)
+{
+	struct page_list *pl = NULL, *next;
+	unsigned int i;
+
+	spin_lock(&kc->lock);
+	if (kc->nr_pages + nr > kc->max_pages)
+		nr = kc->max_pages - kc->nr_pages;
+	spin_unlock(&kc->lock);
+
+	for (i = 0; i < nr; i++) {
+		next = alloc_pl(GFP_NOIO | __GFP_NOWARN | __GFP_NORETRY);
+		if (!next)
+			break;
+		next->next = pl;
+		pl = next;
+	}
+
+	if (!pl)
+		return 0;
+
+	spin_lock(&kc->lock);
+	for (next = pl; next->next; next = next->next)
+		;
+	next->next = kc->pages;
+	kc->pages = pl;
+	kc->nr_pages += i;
+	kc->nr_free_pages += i;
+	spin_unlock(&kc->lock);
+
+	return i;
+}
+
+/*
+ * Give the pages grown beyond the preallocated ones back.
+ */
+static void client_shrink_pages(struct kcopyd_client *kc)
+{
+	struct page_list *pl = NULL, *next;
+
+	spin_lock(&kc->lock);
+	while (kc->nr_pages > kc->nr_reserved_pages && kc->nr_free_pages) {
+		next = kc->pages;
+		kc->pages = next->next;
+		next->next = pl;
+		pl = next;
+		kc->nr_pages--;
+		kc->nr_free_pages--;
+	}
+	spin_unlock(&kc->lock);
+
+	while (pl) {
+		next = pl->next;
+		free_pl(pl);
+		pl = next;
+	}
+}
+
 static int kcopyd_get_pages(struct kcopyd_client *kc,
 			    unsigned int nr, struct page_list **pages)
 {
 	struct page_list *pl;
+	unsigned int short_by;
 
 	spin_lock(&kc->lock);
 	if (kc->nr_free_pages < nr) {
+		short_by = nr - kc->nr_free_pages;
 		spin_unlock(&kc->lock);
-		return -ENOMEM;
+
+		if (client_grow_pages(kc, short_by) < short_by)
+			return -ENOMEM;
+
+		spin_lock(&kc->lock);
+		if (kc->nr_free_pages < nr) {
+			spin_unlock(&kc->lock);
+			return -ENOMEM;
+		}
 	}
 
 	kc->nr_free_pages -= nr;
@@ -125,7 +229,7 @@ static int client_alloc_pages(struct kcopyd_client *kc, unsigned int nr)
 	struct page_list *pl = NULL, *next;
 
 	for (i = 0; i < nr; i++) {
-		next = alloc_pl();
+		next = alloc_pl(GFP_KERNEL);
 		if (!next) {
 			if (pl)
 				drop_pages(pl);
@@ -288,12 +392,17 @@ static inline void push(struct list_head *jobs, struct kcopyd_job *job)
  */
 static int run_complete_job(struct kcopyd_job *job)
 {
+	struct kcopyd_client *kc = job->kc;
 	void *context = job->context;
 	int read_err = job->read_err;
 	unsigned int write_err = job->write_err;
 	kcopyd_notify_fn fn = job->fn;
 
-	kcopyd_put_pages(job->kc, job->pages);
+	if (job->pages) {
+		kcopyd_put_pages(kc, job->pages);
+		if (atomic_dec_and_test(&kc->nr_io))
+			client_shrink_pages(kc);
+	}
 	mempool_free(job, _job_pool);
 	fn(read_err, write_err, context);
 	return 0;
@@ -348,19 +457,53 @@ static int run_io_job(struct kcopyd_job *job)
 	return r;
 }
 
+/*
+ * Should a throttled client hold back its copy to let other io
+ * through?
+ */
+static int job_congested(struct kcopyd_job *job)
+{
+	unsigned int i;
+
+	if (bdi_read_congested(blk_get_backing_dev_info(job->source.bdev)))
+		return 1;
+
+	for (i = 0; i < job->num_dests; i++)
+		if (bdi_write_congested(
+			blk_get_backing_dev_info(job->dests[i].bdev)))
+			return 1;
+
+	return 0;
+}
+
 static int run_pages_job(struct kcopyd_job *job)
 {
+	struct kcopyd_client *kc = job->kc;
 	int r;
 
+	if (kc->max_io) {
+		if (atomic_read(&kc->nr_io) >= kc->max_io)
+			/* woken again when one of them completes */
+			return 1;
+
+		if (job_congested(job)) {
+			mod_timer(&_backoff_timer, jiffies + BACKOFF_DELAY);
+			return 1;
+		}
+	}
+
 	job->nr_pages = dm_div_up(job->dests[0].count + job->offset,
 				  PAGE_SIZE >> 9);
-	r = kcopyd_get_pages(job->kc, job->nr_pages, &job->pages);
+	r = kcopyd_get_pages(kc, job->nr_pages, &job->pages);
 	if (!r) {
 		/* this job is ready for io */
+		atomic_inc(&kc->nr_io);
 		push(&_io_jobs, job);
 		return 0;
 	}
 
+	job->pages = NULL;
+
 	if (r == -ENOMEM)
 		/* can't complete now */
 		return 1;
@@ -371,14 +514,30 @@ static int run_pages_job(struct kcopyd_job *job)
 /*
  * Run through a list for as long as possible.  Returns the count
  * of successful jobs.
+ *
+ * A job that can't be serviced yet only holds up the later jobs of
+ * its own client, so that one client running out of pages or being
+ * throttled doesn't stall the copies of all the others.
  */
 static int process_jobs(struct list_head *jobs, int (*fn) (struct kcopyd_job *))
 {
+	static unsigned long pass;
 	struct kcopyd_job *job;
+	LIST_HEAD(waiting);
+	unsigned long flags;
 	int r, count = 0;
 
+	/* kcopyd is single threaded, so pass needs no locking */
+	if (!++pass)
+		++pass;
+
 	while ((job = pop(jobs))) {
 
+		if (job->kc->blocked_pass == pass) {
+			list_add_tail(&job->list, &waiting);
+			continue;
+		}
+
 		r = fn(job);
 
 		if (r < 0) {
@@ -388,21 +547,28 @@ static int process_jobs(struct list_head *jobs, int (*fn) (struct kcopyd_job *))
 			else
 				job->read_err = 1;
 			push(&_complete_jobs, job);
-			break;
+			continue;
 		}
 
 		if (r > 0) {
 			/*
 			 * We couldn't service this job ATM, so
-			 * push this job back onto the list.
+			 * put it back on the list, in order.
 			 */
-			push(jobs, job);
-			break;
+			job->kc->blocked_pass = pass;
+			list_add_tail(&job->list, &waiting);
+			continue;
 		}
 
 		count++;
 	}
 
+	if (!list_empty(&waiting)) {
+		spin_lock_irqsave(&_job_lock, flags);
+		list_splice(&waiting, jobs);
+		spin_unlock_irqrestore(&_job_lock, flags);
+	}
+
 	return count;
 }
 
@@ -500,16 +666,21 @@ static void segment_complete(int read_err,
 }
 
 /*
- * Create some little jobs that will do the move between
- * them.
+ * Create some little jobs that will do the move between them: one
+ * per SUB_JOB_SIZE, up to MAX_SPLIT_COUNT of them in flight at a
+ * time.  As each finishes it starts the next piece.
  */
-#define SPLIT_COUNT 8
+#define MAX_SPLIT_COUNT 32
 static void split_job(struct kcopyd_job *job)
 {
-	int i;
+	int i, nr;
+
+	nr = dm_div_up(job->source.count, SUB_JOB_SIZE);
+	if (nr > MAX_SPLIT_COUNT)
+		nr = MAX_SPLIT_COUNT;
 
-	atomic_set(&job->sub_jobs, SPLIT_COUNT);
-	for (i = 0; i < SPLIT_COUNT; i++)
+	atomic_set(&job->sub_jobs, nr);
+	for (i = 0; i < nr; i++)
 		segment_complete(0, 0u, job);
 }
 
@@ -618,6 +789,8 @@ static int kcopyd_init(void)
 
 	kcopyd_clients++;
 	INIT_WORK(&_kcopyd_work, do_work, NULL);
+	init_timer(&_backoff_timer);
+	_backoff_timer.function = backoff_timer_fn;
 	up(&kcopyd_init_lock);
 	return 0;
 }
@@ -627,6 +800,7 @@ static void kcopyd_exit(void)
 	down(&kcopyd_init_lock);
 	kcopyd_clients--;
 	if (!kcopyd_clients) {
+		del_timer_sync(&_backoff_timer);
 		jobs_exit();
 		destroy_workqueue(_kcopyd_wq);
 		_kcopyd_wq = NULL;
@@ -652,6 +826,11 @@ int kcopyd_client_create(unsigned int nr_pages, struct kcopyd_client **result)
 	spin_lock_init(&kc->lock);
 	kc->pages = NULL;
 	kc->nr_pages = kc->nr_free_pages = 0;
+	kc->nr_reserved_pages = nr_pages;
+	kc->max_pages = nr_pages * MAX_PAGES_FACTOR;
+	atomic_set(&kc->nr_io, 0);
+	kc->max_io = 0;
+	kc->blocked_pass = 0;
 	r = client_alloc_pages(kc, nr_pages);
 	if (r) {
 		kfree(kc);
@@ -672,9 +851,21 @@ int kcopyd_client_create(unsigned int nr_pages, struct kcopyd_client **result)
 	return 0;
 }
 
+/*
+ * Mark the client's copies as background work: at most max_io
+ * pieces of them doing io at once, and none started while the
+ * devices involved are congested.  0 lifts the limit again.
+ */
+void kcopyd_client_throttle(struct kcopyd_client *kc, unsigned int max_io)
+{
+	kc->max_io = max_io;
+	wake();
+}
+
 void kcopyd_client_destroy(struct kcopyd_client *kc)
 {
-	dm_io_put(kc->nr_pages);
+	client_shrink_pages(kc);
+	dm_io_put(kc->nr_reserved_pages);
 	client_free_pages(kc);
 	client_del(kc);
 	kfree(kc);
@@ -683,5 +874,6 @@ void kcopyd_client_destroy(struct kcopyd_client *kc)
 
 EXPORT_SYMBOL(kcopyd_client_create);
 EXPORT_SYMBOL(kcopyd_client_destroy);
+EXPORT_SYMBOL(kcopyd_client_throttle);
 EXPORT_SYMBOL(kcopyd_copy);
 EXPORT_SYMBOL(kcopyd_cancel);
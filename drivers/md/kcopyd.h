@@ -25,6 +25,13 @@ struct kcopyd_client;
 int kcopyd_client_create(unsigned int num_pages, struct kcopyd_client **result);
 void kcopyd_client_destroy(struct kcopyd_client *kc);
 
+/*
+ * Treat the copies of a client as background work, yielding to
+ * other io on the devices.  max_io limits the pieces of them in
+ * flight at once; 0 turns throttling off again.
+ */
+void kcopyd_client_throttle(struct kcopyd_client *kc, unsigned int max_io);
+
 /*
  * Submit a copy job to kcopyd.  This is built on top of the
  * previous three fns.
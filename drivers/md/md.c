@@ -33,6 +33,7 @@
 #include <linux/config.h>
 #include <linux/linkage.h>
 #include <linux/raid/md.h>
+#include <linux/raid/bitmap.h>
 #include <linux/sysctl.h>
 #include <linux/devfs_fs_kernel.h>
 #include <linux/buffer_head.h> /* for invalidate_bdev */
@@ -329,7 +330,7 @@ static int bi_complete(struct bio *bio, unsigned int bytes_done, int error)
 	return 0;
 }
 
-static int sync_page_io(struct block_device *bdev, sector_t sector, int size,
+int sync_page_io(struct block_device *bdev, sector_t sector, int size,
 		   struct page *page, int rw)
 {
 	struct bio *bio = bio_alloc(GFP_KERNEL, 1);
@@ -599,6 +600,19 @@ static int super_90_validate(mddev_t *mddev, mdk_rdev_t *rdev)
 		memcpy(mddev->uuid+12,&sb->set_uuid3, 4);
 
 		mddev->max_disks = MD_SB_DISKS;
+
+		if (sb->state & (1<<MD_SB_BITMAP_PRESENT))
+			mddev->bitmap_offset = MD_SB_SECTORS;
+		else
+			mddev->bitmap_offset = 0;
+	} else if (mddev->bitmap) {
+		/* adding to an array with a bitmap: an older device is
+		 * fine, as long as no bit was cleared since it left.
+		 * One that is too old is just a new spare.
+		 */
+		__u64 ev1 = md_event(sb);
+		if (ev1 < mddev->bitmap->events_cleared)
+			return 0;
 	} else {
 		__u64 ev1;
 		ev1 = md_event(sb);
@@ -618,6 +632,8 @@ static int super_90_validate(mddev_t *mddev, mdk_rdev_t *rdev)
 			rdev->in_sync = 1;
 			rdev->raid_disk = desc->raid_disk;
 		}
+		if (desc->state & (1<<MD_DISK_WRITEMOSTLY))
+			rdev->write_mostly = 1;
 	}
 	return 0;
 }
@@ -680,6 +696,9 @@ static void super_90_sync(mddev_t *mddev, mdk_rdev_t *rdev)
 	} else
 		sb->recovery_cp = 0;
 
+	if (mddev->bitmap && mddev->persistent)
+		sb->state |= (1<<MD_SB_BITMAP_PRESENT);
+
 	sb->layout = mddev->layout;
 	sb->chunk_size = mddev->chunk_size;
 
@@ -712,6 +731,8 @@ static void super_90_sync(mddev_t *mddev, mdk_rdev_t *rdev)
 			spare++;
 			working++;
 		}
+		if (rdev2->write_mostly)
+			d->state |= (1<<MD_DISK_WRITEMOSTLY);
 	}
 	
 	/* now set the "removed" and "faulty" bits on any missing devices */
@@ -805,7 +826,7 @@ static int super_1_load(mdk_rdev_t *rdev, mdk_rdev_t *refdev, int minor_version)
 	    sb->major_version != cpu_to_le32(1) ||
 	    le32_to_cpu(sb->max_dev) > (4096-256)/2 ||
 	    le64_to_cpu(sb->super_offset) != (rdev->sb_offset<<1) ||
-	    sb->feature_map != 0)
+	    (le32_to_cpu(sb->feature_map) & ~MD_FEATURE_ALL))
 		return -EINVAL;
 
 	if (calc_sb_1_csum(sb) != sb->sb_csum) {
@@ -877,6 +898,16 @@ static int super_1_validate(mddev_t *mddev, mdk_rdev_t *rdev)
 		memcpy(mddev->uuid, sb->set_uuid, 16);
 
 		mddev->max_disks =  (4096-256)/2;
+
+		if (le32_to_cpu(sb->feature_map) & MD_FEATURE_BITMAP_OFFSET)
+			mddev->bitmap_offset = (__s32)le32_to_cpu(sb->bitmap_offset);
+		else
+			mddev->bitmap_offset = 0;
+	} else if (mddev->bitmap) {
+		/* an older device is fine if the bitmap covers it */
+		__u64 ev1 = le64_to_cpu(sb->events);
+		if (ev1 < mddev->bitmap->events_cleared)
+			return 0;
 	} else {
 		__u64 ev1;
 		ev1 = le64_to_cpu(sb->events);
@@ -906,6 +937,8 @@ static int super_1_validate(mddev_t *mddev, mdk_rdev_t *rdev)
 			rdev->raid_disk = role;
 			break;
 		}
+		if (sb->devflags & WriteMostly1)
+			rdev->write_mostly = 1;
 	}
 	return 0;
 }
@@ -926,6 +959,16 @@ static void super_1_sync(mddev_t *mddev, mdk_rdev_t *rdev)
 	memset(sb->pad2, 0, sizeof(sb->pad2));
 	memset(sb->pad3, 0, sizeof(sb->pad3));
 
+	sb->devflags = 0;
+	if (rdev->write_mostly)
+		sb->devflags |= WriteMostly1;
+
+	if (mddev->bitmap) {
+		sb->feature_map = cpu_to_le32(MD_FEATURE_BITMAP_OFFSET);
+		sb->bitmap_offset = cpu_to_le32((__u32)mddev->bitmap_offset);
+	} else
+		sb->bitmap_offset = 0;
+
 	sb->utime = cpu_to_le64((__u64)mddev->utime);
 	sb->events = cpu_to_le64(mddev->events);
 	if (mddev->in_sync)
@@ -1275,6 +1318,9 @@ repeat:
 	if (!mddev->persistent)
 		return;
 
+	/* the bitmap must never be older than the superblock */
+	bitmap_update_sb(mddev->bitmap);
+
 	dprintk(KERN_INFO 
 		"md: updating %s RAID superblock on device (in sync %d)\n",
 		mdname(mddev),mddev->in_sync);
@@ -1338,6 +1384,8 @@ static mdk_rdev_t *md_import_device(dev_t newdev, int super_format, int super_mi
 		goto abort_free;
 
 	rdev->desc_nr = -1;
+	rdev->raid_disk = -1;
+	rdev->saved_raid_disk = -1;
 	rdev->faulty = 0;
 	rdev->in_sync = 0;
 	rdev->data_offset = 0;
@@ -1623,6 +1671,22 @@ static int do_md_run(mddev_t * mddev)
 		mddev->pers = NULL;
 		return -EINVAL;
 	}
+	if (mddev->bitmap_offset &&
+	    (!mddev->persistent ||
+	     (mddev->level != 1 && mddev->level != 4 && mddev->level != 5))) {
+		printk(KERN_WARNING "md: %s: bitmap not supported for this"
+		       " array, ignored\n", mdname(mddev));
+		mddev->bitmap_offset = 0;
+	}
+	err = bitmap_create(mddev);
+	if (err) {
+		printk(KERN_ERR "md: %s: failed to create bitmap (%d)\n",
+		       mdname(mddev), err);
+		mddev->pers->stop(mddev);
+		module_put(mddev->pers->owner);
+		mddev->pers = NULL;
+		return err;
+	}
  	atomic_set(&mddev->writes_pending,0);
 	mddev->safemode = 0;
 	mddev->safemode_timer.function = md_safemode_timeout;
@@ -1716,6 +1780,7 @@ static int do_md_stop(mddev_t * mddev, int ro)
 			if (mddev->ro)
 				goto out;
 			mddev->ro = 1;
+			bitmap_flush(mddev);
 		} else {
 			if (mddev->ro)
 				set_disk_ro(disk, 0);
@@ -1725,12 +1790,16 @@ static int do_md_stop(mddev_t * mddev, int ro)
 			mddev->pers = NULL;
 			if (mddev->ro)
 				mddev->ro = 0;
+			/* nothing is in flight any more, clear what we can */
+			bitmap_flush(mddev);
 		}
 		if (!mddev->in_sync) {
 			/* mark array as shutdown cleanly */
 			mddev->in_sync = 1;
 			md_update_sb(mddev);
 		}
+		if (!ro)
+			bitmap_destroy(mddev);
 		if (ro)
 			set_disk_ro(disk, 1);
 	}
@@ -1744,6 +1813,7 @@ static int do_md_stop(mddev_t * mddev, int ro)
 		export_array(mddev);
 
 		mddev->array_size = 0;
+		mddev->bitmap_offset = 0;
 		disk = mddev->gendisk;
 		if (disk)
 			set_capacity(disk, 0);
@@ -1980,6 +2050,8 @@ static int get_array_info(mddev_t * mddev, void __user * arg)
 	info.state         = 0;
 	if (mddev->in_sync)
 		info.state = (1<<MD_SB_CLEAN);
+	if (mddev->bitmap && mddev->persistent)
+		info.state |= (1<<MD_SB_BITMAP_PRESENT);
 	info.active_disks  = active;
 	info.working_disks = working;
 	info.failed_disks  = failed;
@@ -2017,6 +2089,8 @@ static int get_disk_info(mddev_t * mddev, void __user * arg)
 			info.state |= (1<<MD_DISK_ACTIVE);
 			info.state |= (1<<MD_DISK_SYNC);
 		}
+		if (rdev->write_mostly)
+			info.state |= (1<<MD_DISK_WRITEMOSTLY);
 	} else {
 		info.major = info.minor = 0;
 		info.raid_disk = -1;
@@ -2089,6 +2163,21 @@ static int add_new_disk(mddev_t * mddev, mdu_disk_info_t *info)
 				PTR_ERR(rdev));
 			return PTR_ERR(rdev);
 		}
+		/* a device that was part of the array not long ago may only
+		 * need the chunks the bitmap says were written since
+		 */
+		rdev->raid_disk = -1;
+		if (mddev->bitmap && !list_empty(&mddev->disks)) {
+			mdk_rdev_t *rdev0 = list_entry(mddev->disks.next,
+						       mdk_rdev_t, same_set);
+			if (super_types[mddev->major_version]
+			    .load_super(rdev, rdev0, mddev->minor_version) >= 0 &&
+			    super_types[mddev->major_version]
+			    .validate_super(mddev, rdev) == 0)
+				rdev->saved_raid_disk = rdev->raid_disk;
+		}
+		if (info->state & (1<<MD_DISK_WRITEMOSTLY))
+			rdev->write_mostly = 1;
 		rdev->in_sync = 0; /* just to be sure */
 		rdev->raid_disk = -1;
 		err = bind_rdev_to_array(rdev, mddev);
@@ -2129,6 +2218,9 @@ static int add_new_disk(mddev_t * mddev, mdu_disk_info_t *info)
 		else
 			rdev->in_sync = 0;
 
+		if (info->state & (1<<MD_DISK_WRITEMOSTLY))
+			rdev->write_mostly = 1;
+
 		err = bind_rdev_to_array(rdev, mddev);
 		if (err) {
 			export_rdev(rdev);
@@ -2321,6 +2413,12 @@ static int set_array_info(mddev_t * mddev, mdu_array_info_t *info)
 
 	mddev->max_disks     = MD_SB_DISKS;
 
+	/* a bitmap can only be asked for when the array is created */
+	if (info->state & (1<<MD_SB_BITMAP_PRESENT))
+		mddev->bitmap_offset = MD_SB_SECTORS;
+	else
+		mddev->bitmap_offset = 0;
+
 	mddev->sb_dirty      = 1;
 
 	/*
@@ -2387,6 +2485,9 @@ static int update_array_info(mddev_t *mddev, mdu_array_info_t *info)
 		 */
 		if (mddev->sync_thread)
 			return -EBUSY;
+		/* the bitmap can't grow with the array */
+		if (mddev->bitmap)
+			return -EBUSY;
 		ITERATE_RDEV(mddev,rdev,tmp) {
 			sector_t avail;
 			int fit = (info->size == 0);
@@ -2420,7 +2521,7 @@ static int update_array_info(mddev_t *mddev, mdu_array_info_t *info)
 		if (info->raid_disks <= 0 ||
 		    info->raid_disks >= mddev->max_disks)
 			return -EINVAL;
-		if (mddev->sync_thread)
+		if (mddev->sync_thread || mddev->bitmap)
 			return -EBUSY;
 		rv = mddev->pers->reshape(mddev, info->raid_disks);
 		if (!rv) {
@@ -2784,8 +2885,10 @@ int md_thread(void * arg)
 	while (thread->run) {
 		void (*run)(mddev_t *);
 
-		wait_event_interruptible(thread->wqueue,
-					 test_bit(THREAD_WAKEUP, &thread->flags));
+		/* with a bitmap, wake up now and then to clear bits */
+		wait_event_interruptible_timeout(thread->wqueue,
+						 test_bit(THREAD_WAKEUP, &thread->flags),
+						 thread->timeout);
 		if (current->flags & PF_FREEZE)
 			refrigerator(PF_FREEZE);
 
@@ -2831,6 +2934,7 @@ mdk_thread_t *md_register_thread(void (*run) (mddev_t *), mddev_t *mddev,
 	thread->run = run;
 	thread->mddev = mddev;
 	thread->name = name;
+	thread->timeout = MAX_SCHEDULE_TIMEOUT;
 	ret = kernel_thread(md_thread, thread, 0);
 	if (ret < 0) {
 		kfree(thread);
@@ -3066,6 +3170,8 @@ static int md_seq_show(struct seq_file *seq, void *v)
 			char b[BDEVNAME_SIZE];
 			seq_printf(seq, " %s[%d]",
 				bdevname(rdev->bdev,b), rdev->desc_nr);
+			if (rdev->write_mostly)
+				seq_printf(seq, "(W)");
 			if (rdev->faulty) {
 				seq_printf(seq, "(F)");
 				continue;
@@ -3089,6 +3195,8 @@ static int md_seq_show(struct seq_file *seq, void *v)
 				status_resync (seq, mddev);
 			else if (mddev->curr_resync == 1 || mddev->curr_resync == 2)
 				seq_printf(seq, "	resync=DELAYED");
+			if (mddev->bitmap)
+				bitmap_status(seq, mddev->bitmap);
 		}
 
 		seq_printf(seq, "\n");
@@ -3265,6 +3373,8 @@ static void md_do_sync(mddev_t *mddev)
 	int last_mark,m;
 	struct list_head *tmp;
 	sector_t last_check;
+	int skipped = 0;
+	sector_t io_sectors = 0;
 
 	/* just incase thread restarts... */
 	if (test_bit(MD_RECOVERY_DONE, &mddev->recovery))
@@ -3378,19 +3488,25 @@ static void md_do_sync(mddev_t *mddev)
 	while (j < max_sectors) {
 		int sectors;
 
-		sectors = mddev->pers->sync_request(mddev, j, currspeed < sysctl_speed_limit_min);
+		skipped = 0;
+		sectors = mddev->pers->sync_request(mddev, j, &skipped,
+					    currspeed < sysctl_speed_limit_min);
 		if (sectors < 0) {
 			set_bit(MD_RECOVERY_ERR, &mddev->recovery);
 			goto out;
 		}
-		atomic_add(sectors, &mddev->recovery_active);
+		/* chunks the bitmap says are in sync are skipped, no io */
+		if (!skipped) {
+			io_sectors += sectors;
+			atomic_add(sectors, &mddev->recovery_active);
+		}
 		j += sectors;
 		if (j>1) mddev->curr_resync = j;
 
-		if (last_check + window > j || j == max_sectors)
+		if (last_check + window > io_sectors || j == max_sectors)
 			continue;
 
-		last_check = j;
+		last_check = io_sectors;
 
 		if (test_bit(MD_RECOVERY_INTR, &mddev->recovery) ||
 		    test_bit(MD_RECOVERY_ERR, &mddev->recovery))
@@ -3451,7 +3567,7 @@ static void md_do_sync(mddev_t *mddev)
 	wait_event(mddev->recovery_wait, !atomic_read(&mddev->recovery_active));
 
 	/* tell personality that we are finished */
-	mddev->pers->sync_request(mddev, max_sectors, 1);
+	mddev->pers->sync_request(mddev, max_sectors, &skipped, 1);
 
 	if (!test_bit(MD_RECOVERY_ERR, &mddev->recovery) &&
 	    mddev->curr_resync > 2 &&
@@ -3506,6 +3622,9 @@ void md_check_recovery(mddev_t *mddev)
 
 	if (mddev->ro)
 		return;
+
+	bitmap_daemon_work(mddev->bitmap);
+
 	if ( ! (
 		mddev->sb_dirty ||
 		test_bit(MD_RECOVERY_NEEDED, &mddev->recovery) ||
@@ -3571,6 +3690,9 @@ void md_check_recovery(mddev_t *mddev)
 			/* nothing we can do ... */
 			goto unlock;
 		}
+		if (spares)
+			/* the new devices need a copy of the bitmap */
+			bitmap_write_all(mddev->bitmap);
 		if (mddev->pers->sync_request) {
 			set_bit(MD_RECOVERY_RUNNING, &mddev->recovery);
 			if (!spares)
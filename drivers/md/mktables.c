@@ -77,6 +77,32 @@ int main(int argc, char *argv[])
   }
   printf("};\n");
 
+  /* Compute vector multiplication table: for each multiplier, the
+     products with the low nibbles 0x00-0x0f followed by the products
+     with the high nibbles 0x00-0xf0, in the form pshufb wants them */
+  printf("\nconst u8  __attribute__((aligned(256)))\n"
+	 "raid6_vgfmul[256][32] =\n"
+	 "{\n");
+  for ( i = 0 ; i < 256 ; i++ ) {
+    printf("\t{\n");
+    for ( j = 0 ; j < 16 ; j += 8 ) {
+      printf("\t\t");
+      for ( k = 0 ; k < 8 ; k++ ) {
+	printf("0x%02x, ", gfmul(i,j+k));
+      }
+      printf("\n");
+    }
+    for ( j = 0 ; j < 16 ; j += 8 ) {
+      printf("\t\t");
+      for ( k = 0 ; k < 8 ; k++ ) {
+	printf("0x%02x, ", gfmul(i,(j+k) << 4));
+      }
+      printf("\n");
+    }
+    printf("\t},\n");
+  }
+  printf("};\n");
+
   /* Compute power-of-2 table (exponent) */
   v = 1;
   printf("\nconst u8 __attribute__((aligned(256)))\n"
@@ -22,13 +22,28 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include "dm-bio-list.h"
 #include <linux/raid/raid1.h>
+#include <linux/raid/bitmap.h>
 
 /*
  * Number of guaranteed r1bios in case of extreme VM load:
  */
 #define	NR_RAID1_BIOS 256
 
+/*
+ * How read_balance() chooses between the in-sync mirrors that aren't
+ * write-mostly:
+ *   0 - the one whose head is closest to the request
+ *   1 - the one with the fewest requests in flight, closest head on a tie.
+ *       Suits mirrors of differing speed, where the faster one drains
+ *       its queue sooner and so gets more of the reads.
+ * Write-mostly mirrors are only read from when no other mirror can be.
+ */
+static int read_balance_mode;
+module_param(read_balance_mode, int, 0644);
+MODULE_PARM_DESC(read_balance_mode, "0: nearest head, 1: fewest pending requests");
+
 static mdk_personality_t raid1_personality;
 
 static void unplug_slaves(mddev_t *mddev);
@@ -287,9 +302,11 @@ static int raid1_end_write_request(struct bio *bio, unsigned int bytes_done, int
 	/*
 	 * this branch is our 'one mirror IO has finished' event handler:
 	 */
-	if (!uptodate)
+	if (!uptodate) {
 		md_error(r1_bio->mddev, conf->mirrors[mirror].rdev);
-	else
+		/* the chunk must stay dirty in the bitmap */
+		set_bit(R1BIO_Degraded, &r1_bio->state);
+	} else
 		/*
 		 * Set R1BIO_Uptodate in our master bio, so that
 		 * we will return a good error code for to the higher
@@ -309,6 +326,9 @@ static int raid1_end_write_request(struct bio *bio, unsigned int bytes_done, int
 	 * already.
 	 */
 	if (atomic_dec_and_test(&r1_bio->remaining)) {
+		bitmap_endwrite(r1_bio->mddev->bitmap, r1_bio->sector,
+				r1_bio->sectors,
+				!test_bit(R1BIO_Degraded, &r1_bio->state));
 		md_write_end(r1_bio->mddev);
 		raid_end_bio_io(r1_bio);
 	}
@@ -336,44 +356,52 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 {
 	const unsigned long this_sector = r1_bio->sector;
 	int new_disk = conf->last_used, disk = new_disk;
+	int wonly_disk;
 	const int sectors = r1_bio->sectors;
 	sector_t new_distance, current_distance;
-	mdk_rdev_t *new_rdev, *rdev;
+	unsigned int new_pending, current_pending;
+	mdk_rdev_t *new_rdev, *rdev, *wonly_rdev;
 
 	rcu_read_lock();
 	/*
 	 * Check if it if we can balance. We can balance on the whole
 	 * device if no resync is going on, or below the resync window.
 	 * We take the first readable disk when above the resync window.
+	 * A write-mostly disk is only used when it is the only choice.
 	 */
  retry:
+	wonly_disk = -1;
+	wonly_rdev = NULL;
 	if (conf->mddev->recovery_cp < MaxSector &&
 	    (this_sector + sectors >= conf->next_resync)) {
 		/* Choose the first operation device, for consistancy */
-		new_disk = 0;
-
-		while ((new_rdev=conf->mirrors[new_disk].rdev) == NULL ||
-		       !new_rdev->in_sync) {
-			new_disk++;
-			if (new_disk == conf->raid_disks) {
-				new_disk = -1;
-				break;
+		for (new_disk = 0; new_disk < conf->raid_disks; new_disk++) {
+			new_rdev = conf->mirrors[new_disk].rdev;
+			if (new_rdev == NULL || !new_rdev->in_sync)
+				continue;
+			if (!new_rdev->write_mostly)
+				goto rb_out;
+			if (wonly_disk < 0) {
+				wonly_disk = new_disk;
+				wonly_rdev = new_rdev;
 			}
 		}
-		goto rb_out;
+		goto rb_wonly;
 	}
 
 
 	/* make sure the disk is operational */
 	while ((new_rdev=conf->mirrors[new_disk].rdev) == NULL ||
-	       !new_rdev->in_sync) {
+	       !new_rdev->in_sync || new_rdev->write_mostly) {
+		if (new_rdev && new_rdev->in_sync && wonly_disk < 0) {
+			wonly_disk = new_disk;
+			wonly_rdev = new_rdev;
+		}
 		if (new_disk <= 0)
 			new_disk = conf->raid_disks;
 		new_disk--;
-		if (new_disk == disk) {
-			new_disk = -1;
-			goto rb_out;
-		}
+		if (new_disk == disk)
+			goto rb_wonly;
 	}
 	disk = new_disk;
 	/* now disk == new_disk == starting point for search */
@@ -387,8 +415,9 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 		goto rb_out;
 
 	current_distance = abs(this_sector - conf->mirrors[disk].head_position);
+	current_pending = atomic_read(&new_rdev->nr_pending);
 
-	/* Find the disk whose head is closest */
+	/* Find the disk whose head is closest, or that is least busy */
 
 	do {
 		if (disk <= 0)
@@ -396,22 +425,33 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 		disk--;
 
 		if ((rdev=conf->mirrors[disk].rdev) == NULL ||
-		    !rdev->in_sync)
+		    !rdev->in_sync || rdev->write_mostly)
 			continue;
 
-		if (!atomic_read(&rdev->nr_pending)) {
+		new_pending = atomic_read(&rdev->nr_pending);
+		if (!new_pending) {
 			new_disk = disk;
 			new_rdev = rdev;
 			break;
 		}
 		new_distance = abs(this_sector - conf->mirrors[disk].head_position);
-		if (new_distance < current_distance) {
-			current_distance = new_distance;
-			new_disk = disk;
-			new_rdev = rdev;
-		}
+		if (read_balance_mode == 1) {
+			if (new_pending > current_pending ||
+			    (new_pending == current_pending &&
+			     new_distance >= current_distance))
+				continue;
+		} else if (new_distance >= current_distance)
+			continue;
+		current_distance = new_distance;
+		current_pending = new_pending;
+		new_disk = disk;
+		new_rdev = rdev;
 	} while (disk != conf->last_used);
+	goto rb_out;
 
+rb_wonly:
+	new_disk = wonly_disk;
+	new_rdev = wonly_rdev;
 rb_out:
 
 
@@ -521,9 +561,11 @@ static int make_request(request_queue_t *q, struct bio * bio)
 	conf_t *conf = mddev_to_conf(mddev);
 	mirror_info_t *mirror;
 	r1bio_t *r1_bio;
-	struct bio *read_bio;
+	struct bio *read_bio, *mbio;
 	int i, disks;
 	mdk_rdev_t *rdev;
+	struct bio_list bl;
+	unsigned long flags;
 
 	/*
 	 * Register the new request and wait if the reconstruction
@@ -607,13 +649,16 @@ static int make_request(request_queue_t *q, struct bio * bio)
 				r1_bio->bios[i] = bio;
 		} else
 			r1_bio->bios[i] = NULL;
+		if (!r1_bio->bios[i])
+			set_bit(R1BIO_Degraded, &r1_bio->state);
 	}
 	rcu_read_unlock();
 
 	atomic_set(&r1_bio->remaining, 1);
 	md_write_start(mddev);
+	bitmap_startwrite(mddev->bitmap, r1_bio->sector, r1_bio->sectors);
+	bio_list_init(&bl);
 	for (i = 0; i < disks; i++) {
-		struct bio *mbio;
 		if (!r1_bio->bios[i])
 			continue;
 
@@ -627,10 +672,24 @@ static int make_request(request_queue_t *q, struct bio * bio)
 		mbio->bi_private = r1_bio;
 
 		atomic_inc(&r1_bio->remaining);
-		generic_make_request(mbio);
+		bio_list_add(&bl, mbio);
 	}
 
+	if (mddev->bitmap && bl.head) {
+		/* the bitmap has to reach the disks first, raid1d
+		 * unplugs it and submits the writes
+		 */
+		spin_lock_irqsave(&conf->device_lock, flags);
+		bio_list_merge(&conf->pending_bio_list, &bl);
+		spin_unlock_irqrestore(&conf->device_lock, flags);
+		md_wakeup_thread(mddev->thread);
+	} else
+		while ((mbio = bio_list_pop(&bl)) != NULL)
+			generic_make_request(mbio);
+
 	if (atomic_dec_and_test(&r1_bio->remaining)) {
+		bitmap_endwrite(mddev->bitmap, r1_bio->sector, r1_bio->sectors,
+				!test_bit(R1BIO_Degraded, &r1_bio->state));
 		md_write_end(mddev);
 		raid_end_bio_io(r1_bio);
 	}
@@ -757,7 +816,15 @@ static int raid1_add_disk(mddev_t *mddev, mdk_rdev_t *rdev)
 	int mirror;
 	mirror_info_t *p;
 
-	for (mirror=0; mirror < mddev->raid_disks; mirror++)
+	/* a device coming back to its old slot only needs the chunks
+	 * the bitmap has marked
+	 */
+	if (rdev->saved_raid_disk >= 0 &&
+	    conf->mirrors[rdev->saved_raid_disk].rdev == NULL)
+		mirror = rdev->saved_raid_disk;
+	else
+		mirror = 0;
+	for ( ; mirror < mddev->raid_disks; mirror++)
 		if ( !(p=conf->mirrors+mirror)->rdev) {
 
 			blk_queue_stack_limits(mddev->queue,
@@ -773,6 +840,8 @@ static int raid1_add_disk(mddev_t *mddev, mdk_rdev_t *rdev)
 			p->head_position = 0;
 			rdev->raid_disk = mirror;
 			found = 1;
+			if (rdev->saved_raid_disk != mirror)
+				conf->fullsync = 1;
 			p->rdev = rdev;
 			break;
 		}
@@ -855,8 +924,18 @@ static int end_sync_write(struct bio *bio, unsigned int bytes_done, int error)
 			mirror = i;
 			break;
 		}
-	if (!uptodate)
+	if (!uptodate) {
+		int sync_blocks = 0;
+		sector_t s = r1_bio->sector;
+		long sectors_to_go = r1_bio->sectors;
+		/* make sure these bits don't get cleared. */
+		do {
+			bitmap_end_sync(mddev->bitmap, s, &sync_blocks, 1);
+			s += sync_blocks;
+			sectors_to_go -= sync_blocks;
+		} while (sectors_to_go > 0);
 		md_error(mddev, conf->mirrors[mirror].rdev);
+	}
 	update_head_pos(mirror, r1_bio);
 
 	if (atomic_dec_and_test(&r1_bio->remaining)) {
@@ -912,12 +991,40 @@ static void sync_request_write(mddev_t *mddev, r1bio_t *r1_bio)
 	}
 }
 
+/*
+ * Submit the writes queued by make_request() once the bitmap bits
+ * they depend on are on disk.  Returns 1 if there were any.
+ */
+static int flush_pending_writes(conf_t *conf)
+{
+	struct bio *bio;
+
+	spin_lock_irq(&conf->device_lock);
+	bio = bio_list_get(&conf->pending_bio_list);
+	spin_unlock_irq(&conf->device_lock);
+	if (!bio)
+		return 0;
+
+	if (bitmap_unplug(conf->mddev->bitmap))
+		printk(KERN_ERR "raid1: %s: bitmap write failed\n",
+		       mdname(conf->mddev));
+
+	while (bio) {
+		struct bio *next = bio->bi_next;
+		bio->bi_next = NULL;
+		generic_make_request(bio);
+		bio = next;
+	}
+	return 1;
+}
+
 /*
  * This is a kernel thread which:
  *
  *	1.	Retries failed read operations on working mirrors.
  *	2.	Updates the raid superblock when problems encounter.
  *	3.	Performs writes following reads for array syncronising.
+ *	4.	Submits writes once the bitmap is on disk.
  */
 
 static void raid1d(mddev_t *mddev)
@@ -932,7 +1039,9 @@ static void raid1d(mddev_t *mddev)
 
 	md_check_recovery(mddev);
 	md_handle_safemode(mddev);
-	
+
+	unplug = flush_pending_writes(conf);
+
 	for (;;) {
 		char b[BDEVNAME_SIZE];
 		spin_lock_irqsave(&conf->device_lock, flags);
@@ -1009,7 +1118,7 @@ static int init_resync(conf_t *conf)
  * that can be installed to exclude normal IO requests.
  */
 
-static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
+static int sync_request(mddev_t *mddev, sector_t sector_nr, int *skipped, int go_faster)
 {
 	conf_t *conf = mddev_to_conf(mddev);
 	mirror_info_t *mirror;
@@ -1019,6 +1128,8 @@ static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
 	int disk;
 	int i;
 	int write_targets = 0;
+	int sync_blocks;
+	int still_degraded = 0;
 
 	if (!conf->r1buf_pool)
 		if (init_resync(conf))
@@ -1026,10 +1137,31 @@ static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
 
 	max_sector = mddev->size << 1;
 	if (sector_nr >= max_sector) {
+		/* If we aborted, we need to abort the
+		 * sync on the 'current' bitmap chunk (there will
+		 * only be one in raid1 resync.
+		 * We can find the current addess in mddev->curr_resync
+		 */
+		if (mddev->curr_resync < max_sector) /* aborted */
+			bitmap_end_sync(mddev->bitmap, mddev->curr_resync,
+					&sync_blocks, 1);
+		else /* completed sync */
+			conf->fullsync = 0;
+
+		bitmap_close_sync(mddev->bitmap);
 		close_sync(conf);
 		return 0;
 	}
 
+	/* the bitmap knows which chunks are in sync already, unless
+	 * a fresh device needs everything
+	 */
+	if (!bitmap_start_sync(mddev->bitmap, sector_nr, &sync_blocks, 1) &&
+	    !conf->fullsync) {
+		*skipped = 1;
+		return sync_blocks;
+	}
+
 	/*
 	 * If there is non-resync activity waiting for us then
 	 * put in a delay to throttle resync.
@@ -1089,10 +1221,12 @@ static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
 		if (i == disk) {
 			bio->bi_rw = READ;
 			bio->bi_end_io = end_sync_read;
-		} else if (conf->mirrors[i].rdev &&
-			   !conf->mirrors[i].rdev->faulty &&
-			   (!conf->mirrors[i].rdev->in_sync ||
-			    sector_nr + RESYNC_SECTORS > mddev->recovery_cp)) {
+		} else if (conf->mirrors[i].rdev == NULL ||
+			   conf->mirrors[i].rdev->faulty) {
+			still_degraded = 1;
+			continue;
+		} else if (!conf->mirrors[i].rdev->in_sync ||
+			   sector_nr + RESYNC_SECTORS > mddev->recovery_cp) {
 			bio->bi_rw = WRITE;
 			bio->bi_end_io = end_sync_write;
 			write_targets ++;
@@ -1114,6 +1248,7 @@ static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
 	}
 
 	nr_sectors = 0;
+	sync_blocks = 0;
 	do {
 		struct page *page;
 		int len = PAGE_SIZE;
@@ -1121,6 +1256,15 @@ static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
 			len = (max_sector - sector_nr) << 9;
 		if (len == 0)
 			break;
+		if (sync_blocks == 0) {
+			if (!bitmap_start_sync(mddev->bitmap, sector_nr,
+					       &sync_blocks, still_degraded) &&
+			    !conf->fullsync)
+				break;
+			if (len > (sync_blocks<<9))
+				len = sync_blocks<<9;
+		}
+
 		for (i=0 ; i < conf->raid_disks; i++) {
 			bio = r1_bio->bios[i];
 			if (bio->bi_end_io) {
@@ -1143,6 +1287,7 @@ static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
 		}
 		nr_sectors += len>>9;
 		sector_nr += len>>9;
+		sync_blocks -= (len>>9);
 	} while (r1_bio->bios[disk]->bi_vcnt < RESYNC_PAGES);
  bio_full:
 	bio = r1_bio->bios[disk];
@@ -1228,6 +1373,7 @@ static int run(mddev_t *mddev)
 	conf->mddev = mddev;
 	spin_lock_init(&conf->device_lock);
 	INIT_LIST_HEAD(&conf->retry_list);
+	bio_list_init(&conf->pending_bio_list);
 	if (conf->working_disks == 1)
 		mddev->recovery_cp = MaxSector;
 
@@ -1307,6 +1453,8 @@ static int stop(mddev_t *mddev)
 {
 	conf_t *conf = mddev_to_conf(mddev);
 
+	/* don't leave queued writes behind the thread */
+	flush_pending_writes(conf);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	blk_sync_queue(mddev->queue); /* the unplug fn references 'conf'*/
@@ -45,6 +45,16 @@
  */
 #define	NR_RAID10_BIOS 256
 
+/*
+ * How read_balance() chooses between the in-sync copies that aren't on
+ * write-mostly devices: 0 - closest head, 1 - fewest requests in flight
+ * with the closest head on a tie.  Write-mostly devices are only read
+ * from when no other copy can be.
+ */
+static int read_balance_mode;
+module_param(read_balance_mode, int, 0644);
+MODULE_PARM_DESC(read_balance_mode, "0: nearest head, 1: fewest pending requests");
+
 static void unplug_slaves(mddev_t *mddev);
 
 static void * r10bio_pool_alloc(int gfp_flags, void *data)
@@ -494,8 +504,11 @@ static int read_balance(conf_t *conf, r10bio_t *r10_bio)
 {
 	const unsigned long this_sector = r10_bio->sector;
 	int disk, slot, nslot;
+	int wonly_disk = -1, wonly_slot = 0;
 	const int sectors = r10_bio->sectors;
 	sector_t new_distance, current_distance;
+	unsigned int new_pending, current_pending;
+	mdk_rdev_t *rdev;
 
 	raid10_find_phys(conf, r10_bio);
 	rcu_read_lock();
@@ -503,67 +516,80 @@ static int read_balance(conf_t *conf, r10bio_t *r10_bio)
 	 * Check if we can balance. We can balance on the whole
 	 * device if no resync is going on, or below the resync window.
 	 * We take the first readable disk when above the resync window.
+	 * A copy on a write-mostly disk is only used when it is the only one.
 	 */
 	if (conf->mddev->recovery_cp < MaxSector
 	    && (this_sector + sectors >= conf->next_resync)) {
 		/* make sure that disk is operational */
-		slot = 0;
-		disk = r10_bio->devs[slot].devnum;
-
-		while (!conf->mirrors[disk].rdev ||
-		       !conf->mirrors[disk].rdev->in_sync) {
-			slot++;
-			if (slot == conf->copies) {
-				slot = 0;
-				disk = -1;
-				break;
-			}
+		for (slot = 0; slot < conf->copies; slot++) {
 			disk = r10_bio->devs[slot].devnum;
+			rdev = conf->mirrors[disk].rdev;
+			if (!rdev || !rdev->in_sync)
+				continue;
+			if (!rdev->write_mostly)
+				goto rb_out;
+			if (wonly_disk < 0) {
+				wonly_disk = disk;
+				wonly_slot = slot;
+			}
 		}
-		goto rb_out;
+		goto rb_wonly;
 	}
 
 
 	/* make sure the disk is operational */
 	slot = 0;
 	disk = r10_bio->devs[slot].devnum;
-	while (!conf->mirrors[disk].rdev ||
-	       !conf->mirrors[disk].rdev->in_sync) {
-		slot ++;
-		if (slot == conf->copies) {
-			disk = -1;
-			goto rb_out;
+	while (!(rdev = conf->mirrors[disk].rdev) ||
+	       !rdev->in_sync || rdev->write_mostly) {
+		if (rdev && rdev->in_sync && wonly_disk < 0) {
+			wonly_disk = disk;
+			wonly_slot = slot;
 		}
+		slot ++;
+		if (slot == conf->copies)
+			goto rb_wonly;
 		disk = r10_bio->devs[slot].devnum;
 	}
 
 
 	current_distance = abs(this_sector - conf->mirrors[disk].head_position);
+	current_pending = atomic_read(&rdev->nr_pending);
 
-	/* Find the disk whose head is closest */
+	/* Find the disk whose head is closest, or that is least busy */
 
 	for (nslot = slot; nslot < conf->copies; nslot++) {
 		int ndisk = r10_bio->devs[nslot].devnum;
 
-
-		if (!conf->mirrors[ndisk].rdev ||
-		    !conf->mirrors[ndisk].rdev->in_sync)
+		rdev = conf->mirrors[ndisk].rdev;
+		if (!rdev || !rdev->in_sync || rdev->write_mostly)
 			continue;
 
-		if (!atomic_read(&conf->mirrors[ndisk].rdev->nr_pending)) {
+		new_pending = atomic_read(&rdev->nr_pending);
+		if (!new_pending) {
 			disk = ndisk;
 			slot = nslot;
 			break;
 		}
 		new_distance = abs(r10_bio->devs[nslot].addr -
 				   conf->mirrors[ndisk].head_position);
-		if (new_distance < current_distance) {
-			current_distance = new_distance;
-			disk = ndisk;
-			slot = nslot;
-		}
+		if (read_balance_mode == 1) {
+			if (new_pending > current_pending ||
+			    (new_pending == current_pending &&
+			     new_distance >= current_distance))
+				continue;
+		} else if (new_distance >= current_distance)
+			continue;
+		current_distance = new_distance;
+		current_pending = new_pending;
+		disk = ndisk;
+		slot = nslot;
 	}
+	goto rb_out;
 
+rb_wonly:
+	disk = wonly_disk;
+	slot = wonly_slot;
 rb_out:
 	r10_bio->read_slot = slot;
 /*	conf->next_seq_sect = this_sector + sectors;*/
@@ -1319,7 +1345,7 @@ static int init_resync(conf_t *conf)
  *
  */
 
-static int sync_request(mddev_t *mddev, sector_t sector_nr, int go_faster)
+static int sync_request(mddev_t *mddev, sector_t sector_nr, int *skipped, int go_faster)
 {
 	conf_t *conf = mddev_to_conf(mddev);
 	r10bio_t *r10_bio;
@@ -20,8 +20,10 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/raid/raid5.h>
+#include <linux/raid/bitmap.h>
 #include <linux/highmem.h>
 #include <linux/bitops.h>
+#include <linux/kthread.h>
 #include <asm/atomic.h>
 
 /*
@@ -69,6 +71,22 @@
 
 static void print_raid5_conf (raid5_conf_t *conf);
 
+/*
+ * Stripes are handled, and their parity computed, by whichever thread
+ * takes them off handle_list.  Besides the array's md thread there can
+ * be this many extra worker threads per array; -1 means one for every
+ * online cpu beyond the first.
+ */
+static int worker_threads = -1;
+module_param(worker_threads, int, 0444);
+MODULE_PARM_DESC(worker_threads, "extra stripe handling threads per array (-1: one per additional cpu)");
+
+static inline void wake_workers(raid5_conf_t *conf)
+{
+	if (conf->nr_workers)
+		wake_up(&conf->wait_for_work);
+}
+
 static inline void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -79,8 +97,10 @@ static inline void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 		if (test_bit(STRIPE_HANDLE, &sh->state)) {
 			if (test_bit(STRIPE_DELAYED, &sh->state))
 				list_add_tail(&sh->lru, &conf->delayed_list);
-			else
+			else {
 				list_add_tail(&sh->lru, &conf->handle_list);
+				wake_workers(conf);
+			}
 			md_wakeup_thread(conf->mddev->thread);
 		} else {
 			if (test_and_clear_bit(STRIPE_PREREAD_ACTIVE, &sh->state)) {
@@ -436,8 +456,10 @@ static int raid5_end_write_request (struct bio *bi, unsigned int bytes_done,
 	}
 
 	spin_lock_irqsave(&conf->device_lock, flags);
-	if (!uptodate)
+	if (!uptodate) {
 		md_error(conf->mddev, conf->disks[i].rdev);
+		set_bit(STRIPE_DEGRADED, &sh->state);
+	}
 
 	rdev_dec_pending(conf->disks[i].rdev, conf->mddev);
 	
@@ -808,6 +830,12 @@ static int add_stripe_bio(struct stripe_head *sh, struct bio *bi, int dd_idx, in
 		(unsigned long long)bi->bi_sector,
 		(unsigned long long)sh->sector);
 
+	/* the bit must be set before the stripe can see the bio;
+	 * it is dropped again when the bio is returned
+	 */
+	if (forwrite)
+		bitmap_startwrite(conf->mddev->bitmap, sh->sector,
+				  STRIPE_SECTORS);
 
 	spin_lock(&sh->lock);
 	spin_lock_irq(&conf->device_lock);
@@ -855,6 +883,9 @@ static int add_stripe_bio(struct stripe_head *sh, struct bio *bi, int dd_idx, in
 	set_bit(R5_Overlap, &sh->dev[dd_idx].flags);
 	spin_unlock_irq(&conf->device_lock);
 	spin_unlock(&sh->lock);
+	if (forwrite)
+		bitmap_endwrite(conf->mddev->bitmap, sh->sector,
+				STRIPE_SECTORS, 1);
 	return 0;
 }
 
@@ -971,6 +1002,8 @@ static void handle_stripe(struct stripe_head *sh)
 			while (bi && bi->bi_sector < sh->dev[i].sector + STRIPE_SECTORS){
 				struct bio *nextbi = r5_next_bio(bi, sh->dev[i].sector);
 				clear_bit(BIO_UPTODATE, &bi->bi_flags);
+				bitmap_endwrite(conf->mddev->bitmap, sh->sector,
+						STRIPE_SECTORS, 0);
 				if (--bi->bi_phys_segments == 0) {
 					md_write_end(conf->mddev);
 					bi->bi_next = return_bi;
@@ -984,6 +1017,8 @@ static void handle_stripe(struct stripe_head *sh)
 			while (bi && bi->bi_sector < sh->dev[i].sector + STRIPE_SECTORS) {
 				struct bio *bi2 = r5_next_bio(bi, sh->dev[i].sector);
 				clear_bit(BIO_UPTODATE, &bi->bi_flags);
+				bitmap_endwrite(conf->mddev->bitmap, sh->sector,
+						STRIPE_SECTORS, 0);
 				if (--bi->bi_phys_segments == 0) {
 					md_write_end(conf->mddev);
 					bi->bi_next = return_bi;
@@ -1044,6 +1079,9 @@ static void handle_stripe(struct stripe_head *sh)
 			    dev->written = NULL;
 			    while (wbi && wbi->bi_sector < dev->sector + STRIPE_SECTORS) {
 				    wbi2 = r5_next_bio(wbi, dev->sector);
+				    bitmap_endwrite(conf->mddev->bitmap, sh->sector,
+						    STRIPE_SECTORS,
+						    !test_bit(STRIPE_DEGRADED, &sh->state));
 				    if (--wbi->bi_phys_segments == 0) {
 					    md_write_end(conf->mddev);
 					    wbi->bi_next = return_bi;
@@ -1174,9 +1212,16 @@ static void handle_stripe(struct stripe_head *sh)
 					}
 				}
 			}
-		/* now if nothing is locked, and if we have enough data, we can start a write request */
-		if (locked == 0 && (rcw == 0 ||rmw == 0)) {
+		/* now if nothing is locked, and if we have enough data, we can start a write request.
+		 * The bitmap has to be on disk first, raid5d writes it and
+		 * comes back to this stripe.
+		 */
+		if (locked == 0 && (rcw == 0 ||rmw == 0) &&
+		    !bitmap_pending(conf->mddev->bitmap)) {
 			PRINTK("Computing parity...\n");
+			/* a missing device won't see this write */
+			if (failed)
+				set_bit(STRIPE_DEGRADED, &sh->state);
 			compute_parity(sh, rcw==0 ? RECONSTRUCT_WRITE : READ_MODIFY_WRITE);
 			/* now every locked buffer is ready to be written */
 			for (i=disks; i--;)
@@ -1298,6 +1343,8 @@ static void handle_stripe(struct stripe_head *sh)
 			bi->bi_next = NULL;
 			generic_make_request(bi);
 		} else {
+			if (rw == 1)
+				set_bit(STRIPE_DEGRADED, &sh->state);
 			PRINTK("skip op %ld on disc %d for sector %llu\n",
 				bi->bi_rw, i, (unsigned long long)sh->sector);
 			clear_bit(R5_LOCKED, &sh->dev[i].flags);
@@ -1319,6 +1366,8 @@ static inline void raid5_activate_delayed(raid5_conf_t *conf)
 				atomic_inc(&conf->preread_active_stripes);
 			list_add_tail(&sh->lru, &conf->handle_list);
 		}
+		if (conf->nr_workers && !list_empty(&conf->handle_list))
+			wake_up_all(&conf->wait_for_work);
 	}
 }
 
@@ -1475,7 +1524,7 @@ static int make_request (request_queue_t *q, struct bio * bi)
 }
 
 /* FIXME go_faster isn't used */
-static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
+static int sync_request (mddev_t *mddev, sector_t sector_nr, int *skipped, int go_faster)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 	struct stripe_head *sh;
@@ -1487,10 +1536,22 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
 	sector_t first_sector;
 	int raid_disks = conf->raid_disks;
 	int data_disks = raid_disks-1;
+	sector_t max_sector = mddev->size << 1;
+	int sync_blocks;
+	int still_degraded = 0;
+	int i;
 
-	if (sector_nr >= mddev->size <<1) {
+	if (sector_nr >= max_sector) {
 		/* just being told to finish up .. nothing much to do */
 		unplug_slaves(mddev);
+
+		if (mddev->curr_resync < max_sector) /* aborted */
+			bitmap_end_sync(mddev->bitmap, mddev->curr_resync,
+					&sync_blocks, 1);
+		else /* completed sync */
+			conf->fullsync = 0;
+		bitmap_close_sync(mddev->bitmap);
+
 		return 0;
 	}
 	/* if there is 1 or more failed drives and we are trying
@@ -1498,10 +1559,16 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
 	 * nothing we can do.
 	 */
 	if (mddev->degraded >= 1 && test_bit(MD_RECOVERY_SYNC, &mddev->recovery)) {
-		int rv = (mddev->size << 1) - sector_nr;
-		md_done_sync(mddev, rv, 1);
+		int rv = max_sector - sector_nr;
+		*skipped = 1;
 		return rv;
 	}
+	if (!bitmap_start_sync(mddev->bitmap, sector_nr, &sync_blocks, 1) &&
+	    !conf->fullsync && sync_blocks >= STRIPE_SECTORS) {
+		/* the bitmap says this is in sync; skip whole stripes */
+		*skipped = 1;
+		return (sync_blocks / STRIPE_SECTORS) * STRIPE_SECTORS;
+	}
 
 	x = sector_nr;
 	chunk_offset = sector_div(x, sectors_per_chunk);
@@ -1519,6 +1586,13 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
 		set_current_state(TASK_UNINTERRUPTIBLE);
 		schedule_timeout(1);
 	}
+	/* with a device missing the bitmap has to keep these chunks */
+	for (i=0; i<mddev->raid_disks; i++)
+		if (conf->disks[i].rdev == NULL)
+			still_degraded = 1;
+
+	bitmap_start_sync(mddev->bitmap, sector_nr, &sync_blocks, still_degraded);
+
 	spin_lock(&sh->lock);	
 	set_bit(STRIPE_SYNCING, &sh->state);
 	clear_bit(STRIPE_INSYNC, &sh->state);
@@ -1537,25 +1611,24 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
  * During the scan, completed stripes are saved for us by the interrupt
  * handler, so that they will not have to wait for our next wakeup.
  */
-static void raid5d (mddev_t *mddev)
+/*
+ * Take stripes off handle_list until it is empty.  Called by the md
+ * thread and by the worker threads, several may be running at once:
+ * each stripe is only on the list once and handle_stripe() takes the
+ * stripe lock.  Returns the number of stripes handled.
+ */
+static int handle_active_stripes(raid5_conf_t *conf)
 {
 	struct stripe_head *sh;
-	raid5_conf_t *conf = mddev_to_conf(mddev);
-	int handled;
-
-	PRINTK("+++ raid5d active\n");
+	int handled = 0;
 
-	md_check_recovery(mddev);
-	md_handle_safemode(mddev);
-
-	handled = 0;
 	spin_lock_irq(&conf->device_lock);
 	while (1) {
 		struct list_head *first;
 
 		if (list_empty(&conf->handle_list) &&
 		    atomic_read(&conf->preread_active_stripes) < IO_THRESHOLD &&
-		    !blk_queue_plugged(mddev->queue) &&
+		    !blk_queue_plugged(conf->mddev->queue) &&
 		    !list_empty(&conf->delayed_list))
 			raid5_activate_delayed(conf);
 
@@ -1570,22 +1643,105 @@ static void raid5d (mddev_t *mddev)
 		if (atomic_read(&sh->count)!= 1)
 			BUG();
 		spin_unlock_irq(&conf->device_lock);
-		
+
+		/* writes held back by handle_stripe wait for this */
+		if (bitmap_pending(conf->mddev->bitmap))
+			bitmap_unplug(conf->mddev->bitmap);
+
 		handled++;
 		handle_stripe(sh);
 		release_stripe(sh);
 
 		spin_lock_irq(&conf->device_lock);
 	}
-	PRINTK("%d stripes handled\n", handled);
-
 	spin_unlock_irq(&conf->device_lock);
 
+	return handled;
+}
+
+static void raid5d (mddev_t *mddev)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	int handled;
+
+	PRINTK("+++ raid5d active\n");
+
+	md_check_recovery(mddev);
+	md_handle_safemode(mddev);
+
+	handled = handle_active_stripes(conf);
+	PRINTK("%d stripes handled\n", handled);
+
 	unplug_slaves(mddev);
 
 	PRINTK("--- raid5d inactive\n");
 }
 
+static int raid5_worker(void *data)
+{
+	raid5_conf_t *conf = data;
+	DEFINE_WAIT(wait);
+
+	while (!kthread_should_stop()) {
+		prepare_to_wait_exclusive(&conf->wait_for_work, &wait,
+					  TASK_INTERRUPTIBLE);
+		if (list_empty(&conf->handle_list) && !kthread_should_stop())
+			schedule();
+		finish_wait(&conf->wait_for_work, &wait);
+
+		if (current->flags & PF_FREEZE)
+			refrigerator(PF_FREEZE);
+
+		if (handle_active_stripes(conf))
+			unplug_slaves(conf->mddev);
+	}
+	return 0;
+}
+
+static void start_workers(raid5_conf_t *conf)
+{
+	mddev_t *mddev = conf->mddev;
+	int n = worker_threads;
+	int i;
+
+	if (n < 0)
+		n = num_online_cpus() - 1;
+	if (n <= 0)
+		return;
+
+	conf->workers = kmalloc(n * sizeof(struct task_struct *), GFP_KERNEL);
+	if (!conf->workers)
+		return;
+	for (i = 0; i < n; i++) {
+		struct task_struct *p;
+
+		p = kthread_run(raid5_worker, conf, "%s_raid5/%d",
+				mdname(mddev), i);
+		if (IS_ERR(p)) {
+			printk(KERN_WARNING "raid5: %s: could only start %d of"
+			       " %d worker threads\n", mdname(mddev), i, n);
+			break;
+		}
+		conf->workers[i] = p;
+	}
+	conf->nr_workers = i;
+	if (!i) {
+		kfree(conf->workers);
+		conf->workers = NULL;
+	}
+}
+
+static void stop_workers(raid5_conf_t *conf)
+{
+	int i;
+
+	for (i = 0; i < conf->nr_workers; i++)
+		kthread_stop(conf->workers[i]);
+	conf->nr_workers = 0;
+	kfree(conf->workers);
+	conf->workers = NULL;
+}
+
 static int run (mddev_t *mddev)
 {
 	raid5_conf_t *conf;
@@ -1612,6 +1768,7 @@ static int run (mddev_t *mddev)
 	memset(conf->stripe_hashtbl, 0, HASH_PAGES * PAGE_SIZE);
 
 	spin_lock_init(&conf->device_lock);
+	init_waitqueue_head(&conf->wait_for_work);
 	init_waitqueue_head(&conf->wait_for_stripe);
 	init_waitqueue_head(&conf->wait_for_overlap);
 	INIT_LIST_HEAD(&conf->handle_list);
@@ -1727,6 +1884,8 @@ memory = conf->max_nr_stripes * (sizeof(struct stripe_head) +
 			mddev->queue->backing_dev_info.ra_pages = 2 * stripe;
 	}
 
+	start_workers(conf);
+
 	/* Ok, everything is just fine now */
 	mddev->array_size =  mddev->size * (mddev->raid_disks - 1);
 	return 0;
@@ -1749,6 +1908,7 @@ static int stop (mddev_t *mddev)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 
+	stop_workers(conf);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	shrink_stripes(conf);
@@ -1898,13 +2058,21 @@ static int raid5_add_disk(mddev_t *mddev, mdk_rdev_t *rdev)
 		return 0;
 
 	/*
-	 * find the disk ...
+	 * find the disk ... but prefer rdev->saved_raid_disk
+	 * if possible.
 	 */
-	for (disk=0; disk < mddev->raid_disks; disk++)
+	if (rdev->saved_raid_disk >= 0 &&
+	    conf->disks[rdev->saved_raid_disk].rdev == NULL)
+		disk = rdev->saved_raid_disk;
+	else
+		disk = 0;
+	for ( ; disk < mddev->raid_disks; disk++)
 		if ((p=conf->disks + disk)->rdev == NULL) {
 			rdev->in_sync = 0;
 			rdev->raid_disk = disk;
 			found = 1;
+			if (rdev->saved_raid_disk != disk)
+				conf->fullsync = 1;
 			p->rdev = rdev;
 			break;
 		}
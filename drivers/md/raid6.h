@@ -101,10 +101,22 @@ extern const u8 raid6_gfmul[256][256] __attribute__((aligned(256)));
 extern const u8 raid6_gfexp[256]      __attribute__((aligned(256)));
 extern const u8 raid6_gfinv[256]      __attribute__((aligned(256)));
 extern const u8 raid6_gfexi[256]      __attribute__((aligned(256)));
+extern const u8 raid6_vgfmul[256][32] __attribute__((aligned(256)));
 
-/* Recovery routines */
-void raid6_2data_recov(int disks, size_t bytes, int faila, int failb, void **ptrs);
-void raid6_datap_recov(int disks, size_t bytes, int faila, void **ptrs);
+/* Recovery routine choices */
+struct raid6_recov_calls {
+	void (*data2)(int, size_t, int, int, void **);
+	void (*datap)(int, size_t, int, void **);
+	int  (*valid)(void);	/* Returns 1 if this routine set is usable */
+	const char *name;	/* Name of this routine set */
+};
+
+/* Recovery routine list */
+extern const struct raid6_recov_calls * const raid6_recov_algos[];
+
+/* Recovery routines, set up by raid6_select_algo() */
+extern void (*raid6_2data_recov)(int disks, size_t bytes, int faila, int failb, void **ptrs);
+extern void (*raid6_datap_recov)(int disks, size_t bytes, int faila, void **ptrs);
 void raid6_dual_recov(int disks, size_t bytes, int faila, int failb, void **ptrs);
 
 /* Some definitions to allow code to be compiled for testing in userspace */
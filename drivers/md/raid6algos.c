@@ -73,6 +73,21 @@ const struct raid6_calls * const raid6_algos[] = {
 	NULL
 };
 
+/* Recovery routine sets */
+extern const struct raid6_recov_calls raid6_recov_intx1;
+extern const struct raid6_recov_calls raid6_recov_ssse3;
+
+const struct raid6_recov_calls * const raid6_recov_algos[] = {
+	&raid6_recov_intx1,
+#if defined(__i386__) || defined(__x86_64__)
+	&raid6_recov_ssse3,
+#endif
+	NULL
+};
+
+void (*raid6_2data_recov)(int, size_t, int, int, void **);
+void (*raid6_datap_recov)(int, size_t, int, void **);
+
 #ifdef __KERNEL__
 #define RAID6_TIME_JIFFIES_LG2	4
 #else
@@ -80,6 +95,59 @@ const struct raid6_calls * const raid6_algos[] = {
 #define RAID6_TIME_JIFFIES_LG2	9
 #endif
 
+/*
+ * Pick the fastest recovery routines.  Recovery of two data blocks
+ * runs gen_syndrome as well, which is the same for every routine set
+ * so the ranking is still right.  The two blocks in scratch are
+ * treated as the failed ones and get overwritten.
+ */
+static const struct raid6_recov_calls * __init
+raid6_select_recov(int disks, void **dptrs, char *scratch)
+{
+	const struct raid6_recov_calls * const * algo;
+	const struct raid6_recov_calls * best;
+	void *d0, *d1;
+	unsigned long perf, bestperf;
+	unsigned long j0, j1;
+
+	d0 = dptrs[0];
+	d1 = dptrs[1];
+	dptrs[0] = scratch;
+	dptrs[1] = scratch + PAGE_SIZE;
+
+	bestperf = 0;  best = NULL;
+
+	for ( algo = raid6_recov_algos ; *algo ; algo++ ) {
+		if ( !(*algo)->valid || (*algo)->valid() ) {
+			perf = 0;
+
+			preempt_disable();
+			j0 = jiffies;
+			while ( (j1 = jiffies) == j0 )
+				cpu_relax();
+			while ( (jiffies-j1) < (1 << RAID6_TIME_JIFFIES_LG2) ) {
+				(*algo)->data2(disks, PAGE_SIZE, 0, 1, dptrs);
+				perf++;
+			}
+			preempt_enable();
+
+			if ( perf > bestperf ) {
+				best = *algo;
+				bestperf = perf;
+			}
+			printk("raid6: recov %-8s %5ld MB/s\n", (*algo)->name,
+			       (perf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2));
+		}
+	}
+
+	dptrs[0] = d0;
+	dptrs[1] = d1;
+
+	printk("raid6: using recovery algorithm %s\n", best->name);
+
+	return best;
+}
+
 /* Try to pick the best algorithm */
 /* This code uses the gfmul table as convenient data set to abuse */
 
@@ -87,6 +155,7 @@ int __init raid6_select_algo(void)
 {
 	const struct raid6_calls * const * algo;
 	const struct raid6_calls * best;
+	const struct raid6_recov_calls * recov;
 	char *syndromes;
 	void *dptrs[(65536/PAGE_SIZE)+2];
 	int i, disks;
@@ -99,8 +168,9 @@ int __init raid6_select_algo(void)
 		dptrs[i] = ((char *)raid6_gfmul) + PAGE_SIZE*i;
 	}
 
-	/* Normal code - use a 2-page allocation to avoid D$ conflict */
-	syndromes = (void *) __get_free_pages(GFP_KERNEL, 1);
+	/* Normal code - use a 2-page allocation to avoid D$ conflict;
+	   the other two pages are for benchmarking recovery */
+	syndromes = (void *) __get_free_pages(GFP_KERNEL, 2);
 
 	if ( !syndromes ) {
 		printk("raid6: Yikes!  No memory available.\n");
@@ -145,9 +215,16 @@ int __init raid6_select_algo(void)
 	else
 		printk("raid6: Yikes!  No algorithm found!\n");
 
-	raid6_call = *best;
+	if ( best ) {
+		raid6_call = *best;
+
+		recov = raid6_select_recov(disks, dptrs,
+					   syndromes + 2*PAGE_SIZE);
+		raid6_2data_recov = recov->data2;
+		raid6_datap_recov = recov->datap;
+	}
 
-	free_pages((unsigned long)syndromes, 1);
+	free_pages((unsigned long)syndromes, 2);
 
 	return best ? 0 : -EINVAL;
 }
@@ -26,6 +26,7 @@
 #include <linux/slab.h>
 #include <linux/highmem.h>
 #include <linux/bitops.h>
+#include <linux/kthread.h>
 #include <asm/atomic.h>
 #include "raid6.h"
 
@@ -88,6 +89,22 @@ static inline int raid6_next_disk(int disk, int raid_disks)
 
 static void print_raid6_conf (raid6_conf_t *conf);
 
+/*
+ * Stripes are handled, and their parity computed, by whichever thread
+ * takes them off handle_list.  Besides the array's md thread there can
+ * be this many extra worker threads per array; -1 means one for every
+ * online cpu beyond the first.
+ */
+static int worker_threads = -1;
+module_param(worker_threads, int, 0444);
+MODULE_PARM_DESC(worker_threads, "extra stripe handling threads per array (-1: one per additional cpu)");
+
+static inline void wake_workers(raid6_conf_t *conf)
+{
+	if (conf->nr_workers)
+		wake_up(&conf->wait_for_work);
+}
+
 static inline void __release_stripe(raid6_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -98,8 +115,10 @@ static inline void __release_stripe(raid6_conf_t *conf, struct stripe_head *sh)
 		if (test_bit(STRIPE_HANDLE, &sh->state)) {
 			if (test_bit(STRIPE_DELAYED, &sh->state))
 				list_add_tail(&sh->lru, &conf->delayed_list);
-			else
+			else {
 				list_add_tail(&sh->lru, &conf->handle_list);
+				wake_workers(conf);
+			}
 			md_wakeup_thread(conf->mddev->thread);
 		} else {
 			if (test_and_clear_bit(STRIPE_PREREAD_ACTIVE, &sh->state)) {
@@ -1478,6 +1497,8 @@ static inline void raid6_activate_delayed(raid6_conf_t *conf)
 				atomic_inc(&conf->preread_active_stripes);
 			list_add_tail(&sh->lru, &conf->handle_list);
 		}
+		if (conf->nr_workers && !list_empty(&conf->handle_list))
+			wake_up_all(&conf->wait_for_work);
 	}
 }
 
@@ -1634,7 +1655,7 @@ static int make_request (request_queue_t *q, struct bio * bi)
 }
 
 /* FIXME go_faster isn't used */
-static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
+static int sync_request (mddev_t *mddev, sector_t sector_nr, int *skipped, int go_faster)
 {
 	raid6_conf_t *conf = (raid6_conf_t *) mddev->private;
 	struct stripe_head *sh;
@@ -1696,25 +1717,24 @@ static int sync_request (mddev_t *mddev, sector_t sector_nr, int go_faster)
  * During the scan, completed stripes are saved for us by the interrupt
  * handler, so that they will not have to wait for our next wakeup.
  */
-static void raid6d (mddev_t *mddev)
+/*
+ * Take stripes off handle_list until it is empty.  Called by the md
+ * thread and by the worker threads, several may be running at once:
+ * each stripe is only on the list once and handle_stripe() takes the
+ * stripe lock.  Returns the number of stripes handled.
+ */
+static int handle_active_stripes(raid6_conf_t *conf)
 {
 	struct stripe_head *sh;
-	raid6_conf_t *conf = mddev_to_conf(mddev);
-	int handled;
-
-	PRINTK("+++ raid6d active\n");
+	int handled = 0;
 
-	md_check_recovery(mddev);
-	md_handle_safemode(mddev);
-
-	handled = 0;
 	spin_lock_irq(&conf->device_lock);
 	while (1) {
 		struct list_head *first;
 
 		if (list_empty(&conf->handle_list) &&
 		    atomic_read(&conf->preread_active_stripes) < IO_THRESHOLD &&
-		    !blk_queue_plugged(mddev->queue) &&
+		    !blk_queue_plugged(conf->mddev->queue) &&
 		    !list_empty(&conf->delayed_list))
 			raid6_activate_delayed(conf);
 
@@ -1736,15 +1756,94 @@ static void raid6d (mddev_t *mddev)
 
 		spin_lock_irq(&conf->device_lock);
 	}
-	PRINTK("%d stripes handled\n", handled);
-
 	spin_unlock_irq(&conf->device_lock);
 
+	return handled;
+}
+
+static void raid6d (mddev_t *mddev)
+{
+	raid6_conf_t *conf = mddev_to_conf(mddev);
+	int handled;
+
+	PRINTK("+++ raid6d active\n");
+
+	md_check_recovery(mddev);
+	md_handle_safemode(mddev);
+
+	handled = handle_active_stripes(conf);
+	PRINTK("%d stripes handled\n", handled);
+
 	unplug_slaves(mddev);
 
 	PRINTK("--- raid6d inactive\n");
 }
 
+static int raid6_worker(void *data)
+{
+	raid6_conf_t *conf = data;
+	DEFINE_WAIT(wait);
+
+	while (!kthread_should_stop()) {
+		prepare_to_wait_exclusive(&conf->wait_for_work, &wait,
+					  TASK_INTERRUPTIBLE);
+		if (list_empty(&conf->handle_list) && !kthread_should_stop())
+			schedule();
+		finish_wait(&conf->wait_for_work, &wait);
+
+		if (current->flags & PF_FREEZE)
+			refrigerator(PF_FREEZE);
+
+		if (handle_active_stripes(conf))
+			unplug_slaves(conf->mddev);
+	}
+	return 0;
+}
+
+static void start_workers(raid6_conf_t *conf)
+{
+	mddev_t *mddev = conf->mddev;
+	int n = worker_threads;
+	int i;
+
+	if (n < 0)
+		n = num_online_cpus() - 1;
+	if (n <= 0)
+		return;
+
+	conf->workers = kmalloc(n * sizeof(struct task_struct *), GFP_KERNEL);
+	if (!conf->workers)
+		return;
+	for (i = 0; i < n; i++) {
+		struct task_struct *p;
+
+		p = kthread_run(raid6_worker, conf, "%s_raid6/%d",
+				mdname(mddev), i);
+		if (IS_ERR(p)) {
+			printk(KERN_WARNING "raid6: %s: could only start %d of"
+			       " %d worker threads\n", mdname(mddev), i, n);
+			break;
+		}
+		conf->workers[i] = p;
+	}
+	conf->nr_workers = i;
+	if (!i) {
+		kfree(conf->workers);
+		conf->workers = NULL;
+	}
+}
+
+static void stop_workers(raid6_conf_t *conf)
+{
+	int i;
+
+	for (i = 0; i < conf->nr_workers; i++)
+		kthread_stop(conf->workers[i]);
+	conf->nr_workers = 0;
+	kfree(conf->workers);
+	conf->workers = NULL;
+}
+
 static int run (mddev_t *mddev)
 {
 	raid6_conf_t *conf;
@@ -1771,6 +1870,7 @@ static int run (mddev_t *mddev)
 	memset(conf->stripe_hashtbl, 0, HASH_PAGES * PAGE_SIZE);
 
 	spin_lock_init(&conf->device_lock);
+	init_waitqueue_head(&conf->wait_for_work);
 	init_waitqueue_head(&conf->wait_for_stripe);
 	init_waitqueue_head(&conf->wait_for_overlap);
 	INIT_LIST_HEAD(&conf->handle_list);
@@ -1893,6 +1993,8 @@ static int run (mddev_t *mddev)
 			mddev->queue->backing_dev_info.ra_pages = 2 * stripe;
 	}
 
+	start_workers(conf);
+
 	/* Ok, everything is just fine now */
 	mddev->array_size =  mddev->size * (mddev->raid_disks - 2);
 	return 0;
@@ -1915,6 +2017,7 @@ static int stop (mddev_t *mddev)
 {
 	raid6_conf_t *conf = (raid6_conf_t *) mddev->private;
 
+	stop_workers(conf);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	shrink_stripes(conf);
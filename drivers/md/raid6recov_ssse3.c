@@ -0,0 +1,205 @@
+/* -*- linux-c -*- ------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ *   Bostom MA 02111-1307, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * raid6recov_ssse3.c
+ *
+ * SSSE3 implementation of RAID-6 dual failure recovery.  A GF(2^8)
+ * multiplication by a constant is split into two 16-entry table
+ * lookups, one for each nibble of the source byte, which pshufb does
+ * for 16 bytes at a time; the tables are in raid6_vgfmul.
+ */
+
+#if defined(__i386__) || defined(__x86_64__)
+
+#include "raid6.h"
+#include "raid6x86.h"
+
+static const struct raid6_ssse3_constants {
+	u64 x0f[2];
+} raid6_ssse3_constants __attribute__((aligned(16))) = {
+	{ 0x0f0f0f0f0f0f0f0fULL, 0x0f0f0f0f0f0f0f0fULL },
+};
+
+static int raid6_have_ssse3(void)
+{
+#ifdef __KERNEL__
+	/* Not really boot_cpu but "all_cpus" */
+	return boot_cpu_has(X86_FEATURE_MMX) &&
+		boot_cpu_has(X86_FEATURE_FXSR) &&
+		boot_cpu_has(X86_FEATURE_XMM) &&
+		boot_cpu_has(X86_FEATURE_XMM2) &&
+		boot_cpu_has(X86_FEATURE_SSSE3);
+#else
+	/* User space test code */
+	u32 features = cpuid_features();
+	return ( (features & (15<<23)) == (15<<23) ) &&
+		( cpuid_features_ecx() & (1<<9) );
+#endif
+}
+
+/* Recover two failed data blocks. */
+static void raid6_2data_recov_ssse3(int disks, size_t bytes, int faila,
+				    int failb, void **ptrs)
+{
+	u8 *p, *q, *dp, *dq;
+	const u8 *pbmul;	/* P multiplier table for B data */
+	const u8 *qmul;		/* Q multiplier table (for both) */
+	raid6_sse_save_t sa;
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data pages
+	   Use the dead data pages as temporary storage for
+	   delta p and delta q */
+	dp = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-2] = dp;
+	dq = (u8 *)ptrs[failb];
+	ptrs[failb] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dp;
+	ptrs[failb]   = dq;
+	ptrs[disks-2] = p;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	pbmul = raid6_vgfmul[raid6_gfexi[failb-faila]];
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila] ^
+					 raid6_gfexp[failb]]];
+
+	raid6_before_sse2(&sa);
+
+	asm volatile("movdqa %0,%%xmm7" : : "m" (raid6_ssse3_constants.x0f[0]));
+
+	while ( bytes ) {
+		asm volatile("movdqa %0,%%xmm1" : : "m" (q[0]));
+		asm volatile("movdqa %0,%%xmm0" : : "m" (p[0]));
+		asm volatile("pxor   %0,%%xmm1" : : "m" (dq[0]));
+		asm volatile("pxor   %0,%%xmm0" : : "m" (dp[0]));
+
+		/* xmm1 = q ^ dq, xmm0 = px = p ^ dp */
+
+		/* xmm5 = qx = qmul[q ^ dq] */
+		asm volatile("movdqa %0,%%xmm4" : : "m" (qmul[0]));
+		asm volatile("movdqa %0,%%xmm5" : : "m" (qmul[16]));
+		asm volatile("movdqa %xmm1,%xmm3");
+		asm volatile("psrlw $4,%xmm1");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("pshufb %xmm3,%xmm4");
+		asm volatile("pshufb %xmm1,%xmm5");
+		asm volatile("pxor %xmm4,%xmm5");
+
+		/* xmm1 = pbmul[px] */
+		asm volatile("movdqa %0,%%xmm4" : : "m" (pbmul[0]));
+		asm volatile("movdqa %0,%%xmm1" : : "m" (pbmul[16]));
+		asm volatile("movdqa %xmm0,%xmm2");
+		asm volatile("movdqa %xmm0,%xmm3");
+		asm volatile("psrlw $4,%xmm2");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pshufb %xmm3,%xmm4");
+		asm volatile("pshufb %xmm2,%xmm1");
+		asm volatile("pxor %xmm4,%xmm1");
+
+		/* xmm1 = db = pbmul[px] ^ qx: reconstructed B */
+		asm volatile("pxor %xmm5,%xmm1");
+		asm volatile("movdqa %%xmm1,%0" : "=m" (dq[0]));
+
+		/* xmm0 = db ^ px: reconstructed A */
+		asm volatile("pxor %xmm1,%xmm0");
+		asm volatile("movdqa %%xmm0,%0" : "=m" (dp[0]));
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dp += 16;
+		dq += 16;
+	}
+
+	raid6_after_sse2(&sa);
+}
+
+/* Recover failure of one data block plus the P block */
+static void raid6_datap_recov_ssse3(int disks, size_t bytes, int faila,
+				    void **ptrs)
+{
+	u8 *p, *q, *dq;
+	const u8 *qmul;		/* Q multiplier table */
+	raid6_sse_save_t sa;
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data page
+	   Use the dead data page as temporary storage for delta q */
+	dq = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dq;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila]]];
+
+	raid6_before_sse2(&sa);
+
+	asm volatile("movdqa %0,%%xmm7" : : "m" (raid6_ssse3_constants.x0f[0]));
+
+	while ( bytes ) {
+		asm volatile("movdqa %0,%%xmm3" : : "m" (dq[0]));
+		asm volatile("movdqa %0,%%xmm2" : : "m" (p[0]));
+		asm volatile("pxor   %0,%%xmm3" : : "m" (q[0]));
+
+		/* xmm3 = q ^ dq */
+
+		/* xmm1 = qmul[q ^ dq]: reconstructed data */
+		asm volatile("movdqa %0,%%xmm4" : : "m" (qmul[0]));
+		asm volatile("movdqa %0,%%xmm1" : : "m" (qmul[16]));
+		asm volatile("movdqa %xmm3,%xmm0");
+		asm volatile("psrlw $4,%xmm0");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm0");
+		asm volatile("pshufb %xmm3,%xmm4");
+		asm volatile("pshufb %xmm0,%xmm1");
+		asm volatile("pxor %xmm4,%xmm1");
+		asm volatile("movdqa %%xmm1,%0" : "=m" (dq[0]));
+
+		/* p ^= reconstructed data */
+		asm volatile("pxor %xmm1,%xmm2");
+		asm volatile("movdqa %%xmm2,%0" : "=m" (p[0]));
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dq += 16;
+	}
+
+	raid6_after_sse2(&sa);
+}
+
+const struct raid6_recov_calls raid6_recov_ssse3 = {
+	raid6_2data_recov_ssse3,
+	raid6_datap_recov_ssse3,
+	raid6_have_ssse3,
+	"ssse3",
+};
+
+#endif
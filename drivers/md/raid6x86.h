@@ -239,6 +239,17 @@ static inline int cpuid_features(void)
 
 	return edx;
 }
+
+static inline int cpuid_features_ecx(void)
+{
+	u32 eax = 1;
+	u32 ebx, ecx, edx;
+
+	asm volatile("cpuid" :
+		     "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+
+	return ecx;
+}
 #endif /* ndef __KERNEL__ */
 
 #endif
@@ -61,6 +61,7 @@
 #include <linux/ethtool.h>
 #include <linux/if_bonding.h>
 #include <linux/pkt_sched.h>
+#include <linux/rcupdate.h>
 #include "bonding.h"
 #include "bond_3ad.h"
 
@@ -2344,32 +2345,41 @@ int bond_3ad_get_active_agg_info(struct bonding *bond, struct ad_info *ad_info)
 
 int bond_3ad_xmit_xor(struct sk_buff *skb, struct net_device *dev)
 {
-	struct slave *slave, *start_at;
+	struct slave *slave;
 	struct bonding *bond = dev->priv;
-	struct ethhdr *data = (struct ethhdr *)skb->data;
+	struct bond_xmit_slaves *slaves;
+	struct aggregator *active = NULL;
 	int slave_agg_no;
 	int slaves_in_agg;
 	int agg_id;
-	int i;
-	struct ad_info ad_info;
+	int i, start_at;
 	int res = 1;
 
-	/* make sure that the slaves list will
-	 * not change during tx
-	 */
-	read_lock(&bond->lock);
+	/* the slaves array stays until we are done, see bonding.h */
+	rcu_read_lock_bh();
 
-	if (!BOND_IS_OK(bond)) {
+	slaves = rcu_dereference(bond->xmit_slaves);
+	if (!slaves || !(dev->flags & IFF_UP) || !netif_running(dev)) {
 		goto out;
 	}
 
-	if (bond_3ad_get_active_agg_info(bond, &ad_info)) {
+	/* as bond_3ad_get_active_agg_info(), without the slave list */
+	for (i = 0; i < slaves->count; i++) {
+		struct aggregator *agg = SLAVE_AD_INFO(slaves->slave[i]).port.aggregator;
+
+		if (agg && agg->is_active) {
+			active = agg;
+			break;
+		}
+	}
+
+	if (!active) {
 		printk(KERN_DEBUG "ERROR: bond_3ad_get_active_agg_info failed\n");
 		goto out;
 	}
 
-	slaves_in_agg = ad_info.ports;
-	agg_id = ad_info.aggregator_id;
+	slaves_in_agg = active->num_of_ports;
+	agg_id = active->aggregator_identifier;
 
 	if (slaves_in_agg == 0) {
 		/*the aggregator is empty*/
@@ -2377,10 +2387,10 @@ int bond_3ad_xmit_xor(struct sk_buff *skb, struct net_device *dev)
 		goto out;
 	}
 
-	slave_agg_no = (data->h_dest[5]^bond->dev->dev_addr[5]) % slaves_in_agg;
+	slave_agg_no = bond_xmit_hash(bond, skb, slaves_in_agg);
 
-	bond_for_each_slave(bond, slave, i) {
-		struct aggregator *agg = SLAVE_AD_INFO(slave).port.aggregator;
+	for (start_at = 0; start_at < slaves->count; start_at++) {
+		struct aggregator *agg = SLAVE_AD_INFO(slaves->slave[start_at]).port.aggregator;
 
 		if (agg && (agg->aggregator_identifier == agg_id)) {
 			slave_agg_no--;
@@ -2395,11 +2405,12 @@ int bond_3ad_xmit_xor(struct sk_buff *skb, struct net_device *dev)
 		goto out;
 	}
 
-	start_at = slave;
-
-	bond_for_each_slave_from(bond, slave, i, start_at) {
+	for (i = 0; i < slaves->count; i++) {
 		int slave_agg_id = 0;
-		struct aggregator *agg = SLAVE_AD_INFO(slave).port.aggregator;
+		struct aggregator *agg;
+
+		slave = slaves->slave[(start_at + i) % slaves->count];
+		agg = SLAVE_AD_INFO(slave).port.aggregator;
 
 		if (agg) {
 			slave_agg_id = agg->aggregator_identifier;
@@ -2416,7 +2427,7 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
+	rcu_read_unlock_bh();
 	return 0;
 }
 
@@ -476,6 +476,11 @@
  *        spinlock.
  *        Set version to 2.6.1.
  *
+ * 2005/03/20 - Added the xmit_hash_policy module param: layer3+4 spreads
+ *	  flows behind a router over the slaves in XOR and 802.3ad modes.
+ *	- The XOR and 802.3ad transmit paths no longer take bond->lock, but
+ *	  look at an RCU array of the slaves.
+ *
  */
 
 //#define BONDING_DEBUG 1
@@ -499,6 +504,7 @@
 #include <linux/ctype.h>
 #include <linux/inet.h>
 #include <linux/bitops.h>
+#include <linux/rcupdate.h>
 #include <asm/system.h>
 #include <asm/io.h>
 #include <asm/dma.h>
@@ -509,6 +515,7 @@
 #include <linux/etherdevice.h>
 #include <linux/skbuff.h>
 #include <net/sock.h>
+#include <net/ip.h>
 #include <linux/rtnetlink.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
@@ -537,6 +544,7 @@ static int use_carrier	= 1;
 static char *mode	= NULL;
 static char *primary	= NULL;
 static char *lacp_rate	= NULL;
+static char *xmit_hash_policy = NULL;
 static int arp_interval = BOND_LINK_ARP_INTERV;
 static char *arp_ip_target[BOND_MAX_ARP_TARGETS] = { NULL, };
 
@@ -556,6 +564,8 @@ module_param(primary, charp, 0);
 MODULE_PARM_DESC(primary, "Primary network device to use");
 module_param(lacp_rate, charp, 0);
 MODULE_PARM_DESC(lacp_rate, "LACPDU tx rate to request from 802.3ad partner (slow/fast)");
+module_param(xmit_hash_policy, charp, 0);
+MODULE_PARM_DESC(xmit_hash_policy, "XOR and 802.3ad slave selection (layer2/layer3+4)");
 module_param(arp_interval, int, 0);
 MODULE_PARM_DESC(arp_interval, "arp interval in milliseconds");
 module_param_array(arp_ip_target, charp, NULL, 0);
@@ -577,6 +587,7 @@ static int arp_ip_count	= 0;
 static u32 my_ip	= 0;
 static int bond_mode	= BOND_MODE_ROUNDROBIN;
 static int lacp_fast	= 0;
+static int xmit_policy	= BOND_XMIT_POLICY_LAYER2;
 static int app_abi_ver	= 0;
 static int orig_app_abi_ver = -1; /* This is used to save the first ABI version
 				   * we receive from the application. Once set,
@@ -597,6 +608,12 @@ static struct bond_parm_tbl bond_lacp_tbl[] = {
 {	NULL,		-1},
 };
 
+static struct bond_parm_tbl xmit_hashtype_tbl[] = {
+{	"layer2",		BOND_XMIT_POLICY_LAYER2},
+{	"layer3+4",		BOND_XMIT_POLICY_LAYER34},
+{	NULL,			-1},
+};
+
 static struct bond_parm_tbl bond_mode_tbl[] = {
 {	"balance-rr",		BOND_MODE_ROUNDROBIN},
 {	"active-backup",	BOND_MODE_ACTIVEBACKUP},
@@ -636,6 +653,18 @@ static const char *bond_mode_name(int mode)
 	}
 }
 
+static const char *bond_xmit_policy_name(int policy)
+{
+	switch (policy) {
+	case BOND_XMIT_POLICY_LAYER2:
+		return "layer2";
+	case BOND_XMIT_POLICY_LAYER34:
+		return "layer3+4";
+	default:
+		return "unknown";
+	}
+}
+
 /*---------------------------------- VLAN -----------------------------------*/
 
 /**
@@ -1522,6 +1551,46 @@ static void bond_select_active_slave(struct bonding *bond)
 
 /*--------------------------- slave list handling ---------------------------*/
 
+static void bond_free_xmit_slaves(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct bond_xmit_slaves, rcu));
+}
+
+/*
+ * Put an array of the slave list in place for the transmit paths.  If
+ * there is no memory for it, the bond has none and drops what it sends
+ * until the next attach or detach.
+ *
+ * bond->lock held for writing by caller.
+ */
+static void bond_update_xmit_slaves(struct bonding *bond)
+{
+	struct bond_xmit_slaves *old = bond->xmit_slaves, *new = NULL;
+	struct slave *slave;
+	int i;
+
+	if (bond->slave_cnt) {
+		new = kmalloc(sizeof(*new) +
+			      bond->slave_cnt * sizeof(struct slave *),
+			      GFP_ATOMIC);
+		if (new) {
+			new->count = bond->slave_cnt;
+			bond_for_each_slave(bond, slave, i) {
+				new->slave[i] = slave;
+			}
+		} else {
+			printk(KERN_ERR DRV_NAME
+			       ": %s: Error: no memory for the transmit "
+			       "slave array\n", bond->dev->name);
+		}
+	}
+
+	rcu_assign_pointer(bond->xmit_slaves, new);
+	if (old) {
+		call_rcu_bh(&old->rcu, bond_free_xmit_slaves);
+	}
+}
+
 /*
  * This function attaches the slave to the end of list.
  *
@@ -1541,6 +1610,7 @@ static void bond_attach_slave(struct bonding *bond, struct slave *new_slave)
 	}
 
 	bond->slave_cnt++;
+	bond_update_xmit_slaves(bond);
 }
 
 /*
@@ -1574,6 +1644,7 @@ static void bond_detach_slave(struct bonding *bond, struct slave *slave)
 	slave->next = NULL;
 	slave->prev = NULL;
 	bond->slave_cnt--;
+	bond_update_xmit_slaves(bond);
 }
 
 /*---------------------------------- IOCTL ----------------------------------*/
@@ -2141,6 +2212,9 @@ static int bond_release(struct net_device *bond_dev, struct net_device *slave_de
 
 	write_unlock_bh(&bond->lock);
 
+	/* wait for the lockless transmitters still using the slave */
+	synchronize_net();
+
 	bond_del_vlans_from_slave(bond, slave_dev);
 
 	/* If the mode USES_PRIMARY, then we should only remove its
@@ -2232,6 +2306,9 @@ static int bond_release_all(struct net_device *bond_dev)
 		 */
 		write_unlock_bh(&bond->lock);
 
+		/* wait for the lockless transmitters still using the slave */
+		synchronize_net();
+
 		bond_del_vlans_from_slave(bond, slave_dev);
 
 		/* If the mode USES_PRIMARY, then we should only remove its
@@ -3154,6 +3231,12 @@ static void bond_info_show_master(struct seq_file *seq)
 	seq_printf(seq, "Bonding Mode: %s\n",
 		   bond_mode_name(bond->params.mode));
 
+	if (bond->params.mode == BOND_MODE_XOR ||
+	    bond->params.mode == BOND_MODE_8023AD) {
+		seq_printf(seq, "Transmit Hash Policy: %s\n",
+			   bond_xmit_policy_name(bond->params.xmit_policy));
+	}
+
 	if (USES_PRIMARY(bond->params.mode)) {
 		seq_printf(seq, "Primary Slave: %s\n",
 			   (bond->params.primary[0]) ?
@@ -4102,37 +4185,61 @@ out:
 }
 
 /*
- * in XOR mode, we determine the output device by performing xor on
- * the source and destination hw adresses.  If this device is not
- * enabled, find the next slave following this xor slave.
+ * Hash a frame to one of count slaves, by xmit_hash_policy: layer2 uses
+ * the destination hw address, layer3+4 the IP addresses and the TCP or
+ * UDP ports, so that flows through a router are spread.  Frames that are
+ * not IP, and IP fragments, are hashed by layer2.
+ */
+int bond_xmit_hash(struct bonding *bond, struct sk_buff *skb, int count)
+{
+	struct ethhdr *data = (struct ethhdr *)skb->data;
+	struct iphdr *iph = skb->nh.iph;
+	u32 ports = 0;
+
+	if (bond->params.xmit_policy == BOND_XMIT_POLICY_LAYER34 &&
+	    skb->protocol == htons(ETH_P_IP) &&
+	    skb->nh.raw + sizeof(struct iphdr) <= skb->tail) {
+		if (!(iph->frag_off & htons(IP_MF|IP_OFFSET)) &&
+		    (iph->protocol == IPPROTO_TCP ||
+		     iph->protocol == IPPROTO_UDP) &&
+		    skb->nh.raw + iph->ihl * 4 + 4 <= skb->tail) {
+			u16 *layer4 = (u16 *)(skb->nh.raw + iph->ihl * 4);
+
+			ports = ntohs(layer4[0]) ^ ntohs(layer4[1]);
+		}
+		return (ports ^ (ntohl(iph->saddr ^ iph->daddr) & 0xffff)) %
+			count;
+	}
+
+	return (data->h_dest[5]^bond->dev->dev_addr[5]) % count;
+}
+
+/*
+ * in XOR mode, we determine the output device by hashing the frame, see
+ * bond_xmit_hash().  If this device is not enabled, find the next slave
+ * following this xor slave.
  */
 static int bond_xmit_xor(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = bond_dev->priv;
-	struct ethhdr *data = (struct ethhdr *)skb->data;
-	struct slave *slave, *start_at;
+	struct bond_xmit_slaves *slaves;
+	struct slave *slave;
 	int slave_no;
 	int i;
 	int res = 1;
 
-	read_lock(&bond->lock);
+	rcu_read_lock_bh();
 
-	if (!BOND_IS_OK(bond)) {
+	slaves = rcu_dereference(bond->xmit_slaves);
+	if (!slaves || !(bond_dev->flags & IFF_UP) ||
+	    !netif_running(bond_dev)) {
 		goto out;
 	}
 
-	slave_no = (data->h_dest[5]^bond_dev->dev_addr[5]) % bond->slave_cnt;
-
-	bond_for_each_slave(bond, slave, i) {
-		slave_no--;
-		if (slave_no < 0) {
-			break;
-		}
-	}
-
-	start_at = slave;
+	slave_no = bond_xmit_hash(bond, skb, slaves->count);
 
-	bond_for_each_slave_from(bond, slave, i, start_at) {
+	for (i = 0; i < slaves->count; i++) {
+		slave = slaves->slave[(slave_no + i) % slaves->count];
 		if (IS_UP(slave->dev) &&
 		    (slave->link == BOND_LINK_UP) &&
 		    (slave->state == BOND_STATE_ACTIVE)) {
@@ -4146,7 +4253,7 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
+	rcu_read_unlock_bh();
 	return 0;
 }
 
@@ -4267,6 +4374,7 @@ static int __init bond_init(struct net_device *bond_dev, struct bond_params *par
 
 	/* Initialize pointers */
 	bond->first_slave = NULL;
+	bond->xmit_slaves = NULL;
 	bond->curr_active_slave = NULL;
 	bond->current_arp_slave = NULL;
 	bond->primary_slave = NULL;
@@ -4405,6 +4513,25 @@ static int bond_check_params(struct bond_params *params)
 		}
 	}
 
+	if (xmit_hash_policy) {
+		if (bond_mode != BOND_MODE_XOR &&
+		    bond_mode != BOND_MODE_8023AD) {
+			printk(KERN_INFO DRV_NAME
+			       ": xmit_hash_policy param is irrelevant in "
+			       "mode %s\n",
+			       bond_mode_name(bond_mode));
+		} else {
+			xmit_policy = bond_parse_parm(xmit_hash_policy,
+						      xmit_hashtype_tbl);
+			if (xmit_policy == -1) {
+				printk(KERN_ERR DRV_NAME
+				       ": Error: Invalid xmit_hash_policy \"%s\"\n",
+				       xmit_hash_policy);
+				return -EINVAL;
+			}
+		}
+	}
+
 	if (max_bonds < 1 || max_bonds > INT_MAX) {
 		printk(KERN_WARNING DRV_NAME
 		       ": Warning: max_bonds (%d) not in range %d-%d, so it "
@@ -4606,6 +4733,7 @@ static int bond_check_params(struct bond_params *params)
 	params->downdelay = downdelay;
 	params->use_carrier = use_carrier;
 	params->lacp_fast = lacp_fast;
+	params->xmit_policy = xmit_policy;
 	params->primary[0] = 0;
 
 	if (primary) {
@@ -143,6 +143,7 @@ struct bond_params {
 	int updelay;
 	int downdelay;
 	int lacp_fast;
+	int xmit_policy;
 	char primary[IFNAMSIZ];
 	u32 arp_targets[BOND_MAX_ARP_TARGETS];
 };
@@ -169,6 +170,18 @@ struct slave {
 	struct tlb_slave_info tlb_info;
 };
 
+/*
+ * The slaves as an array for the transmit paths, which look at it under
+ * rcu_read_lock_bh() instead of bond->lock.  A new one is put in place
+ * on every attach and detach, and a detached slave is only freed after
+ * a grace period.
+ */
+struct bond_xmit_slaves {
+	struct rcu_head rcu;
+	int    count;
+	struct slave *slave[0];
+};
+
 /*
  * Here are the locking policies for the two bonding locks:
  *
@@ -177,6 +190,8 @@ struct slave {
  *    (It is unnecessary when the write-lock is put with bond->lock.)
  * 3) When we lock with bond->curr_slave_lock, we must lock with bond->lock
  *    beforehand.
+ * 4) The XOR and 802.3ad transmit paths take neither, and use
+ *    bond->xmit_slaves under rcu_read_lock_bh().
  */
 struct bonding {
 	struct   net_device *dev; /* first - usefull for panic debug */
@@ -185,6 +200,7 @@ struct bonding {
 	struct   slave *current_arp_slave;
 	struct   slave *primary_slave;
 	s32      slave_cnt; /* never change this value outside the attach/detach wrappers */
+	struct   bond_xmit_slaves *xmit_slaves; /* RCU, NULL without slaves */
 	rwlock_t lock;
 	rwlock_t curr_slave_lock;
 	struct   timer_list mii_timer;
@@ -247,6 +263,7 @@ extern inline void bond_set_slave_active_flags(struct slave *slave)
 
 struct vlan_entry *bond_next_vlan(struct bonding *bond, struct vlan_entry *curr);
 int bond_dev_queue_xmit(struct bonding *bond, struct sk_buff *skb, struct net_device *slave_dev);
+int bond_xmit_hash(struct bonding *bond, struct sk_buff *skb, int count);
 
 #endif /* _LINUX_BONDING_H */
 
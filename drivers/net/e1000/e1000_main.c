@@ -151,6 +151,9 @@ static irqreturn_t e1000_intr(int irq, void *data, struct pt_regs *regs);
 static boolean_t e1000_clean_tx_irq(struct e1000_adapter *adapter);
 #ifdef CONFIG_E1000_NAPI
 static int e1000_clean(struct net_device *netdev, int *budget);
+#ifdef CONFIG_NET_BUSY_POLL
+static int e1000_busy_poll(struct net_device *netdev, int budget);
+#endif
 static boolean_t e1000_clean_rx_irq(struct e1000_adapter *adapter,
                                     int *work_done, int work_to_do);
 #else
@@ -498,6 +501,9 @@ e1000_probe(struct pci_dev *pdev,
 #ifdef CONFIG_E1000_NAPI
 	netdev->poll = &e1000_clean;
 	netdev->weight = 64;
+#ifdef CONFIG_NET_BUSY_POLL
+	netdev->busy_poll = &e1000_busy_poll;
+#endif
 #endif
 	netdev->vlan_rx_register = e1000_vlan_rx_register;
 	netdev->vlan_rx_add_vid = e1000_vlan_rx_add_vid;
@@ -536,6 +542,9 @@ e1000_probe(struct pci_dev *pdev,
 
  	/* hard_start_xmit is safe against parallel locking */
  	netdev->features |= NETIF_F_LLTX; 
+#ifdef CONFIG_E1000_NAPI
+	netdev->features |= NETIF_F_GRO;
+#endif
  
 	/* before reading the EEPROM, reset the controller to 
 	 * put the device in a known good starting state */
@@ -1212,7 +1221,7 @@ e1000_unmap_and_free_tx_resource(struct e1000_adapter *adapter,
 		buffer_info->dma = 0;
 	}
 	if(buffer_info->skb) {
-		dev_kfree_skb_any(buffer_info->skb);
+		dev_kfree_skb_recycle(buffer_info->skb);
 		buffer_info->skb = NULL;
 	}
 }
@@ -2331,6 +2340,55 @@ e1000_clean(struct net_device *netdev, int *budget)
 	return 1;
 }
 
+#ifdef CONFIG_NET_BUSY_POLL
+/**
+ * e1000_busy_poll - clean the rings on behalf of a busy-polling socket
+ * @netdev: network interface device structure
+ * @budget: max number of rx packets to clean
+ *
+ * Owns the rings through the NAPI scheduling bit, so that neither
+ * e1000_clean nor the interrupt handler touch them meanwhile.
+ **/
+
+static int
+e1000_busy_poll(struct net_device *netdev, int budget)
+{
+	struct e1000_adapter *adapter = netdev->priv;
+	struct e1000_desc_ring *tx_ring = &adapter->tx_ring;
+	struct e1000_desc_ring *rx_ring = &adapter->rx_ring;
+	struct e1000_rx_desc *rx_desc;
+	struct e1000_tx_desc *eop_desc;
+	uint32_t ics = 0;
+	int work_done = 0;
+
+	if(!netif_rx_schedule_prep(netdev))
+		return 0;
+
+	e1000_clean_tx_irq(adapter);
+	e1000_clean_rx_irq(adapter, &work_done, budget);
+	netif_gro_flush(netdev);
+
+	smp_mb__before_clear_bit();
+	clear_bit(__LINK_STATE_RX_SCHED, &netdev->state);
+
+	/* An interrupt that came in while we owned the rings found the
+	 * poll scheduled and did nothing, so raise it again for whatever
+	 * we left behind.
+	 */
+	rx_desc = E1000_RX_DESC(*rx_ring, rx_ring->next_to_clean);
+	if(rx_desc->status & E1000_RXD_STAT_DD)
+		ics |= E1000_ICS_RXT0;
+	eop_desc = E1000_TX_DESC(*tx_ring,
+	           tx_ring->buffer_info[tx_ring->next_to_clean].next_to_watch);
+	if(eop_desc->upper.data & cpu_to_le32(E1000_TXD_STAT_DD))
+		ics |= E1000_ICS_TXDW;
+	if(ics)
+		E1000_WRITE_REG(&adapter->hw, ICS, ics);
+
+	return work_done;
+}
+#endif
+
 #endif
 /**
  * e1000_clean_tx_irq - Reclaim resources after transmit completes
@@ -2534,7 +2592,7 @@ e1000_clean_rx_irq(struct e1000_adapter *adapter)
 					le16_to_cpu(rx_desc->special) &
 					E1000_RXD_SPC_VLAN_MASK);
 		} else {
-			netif_receive_skb(skb);
+			netif_gro_receive(netdev, skb);
 		}
 #else /* CONFIG_E1000_NAPI */
 		if(unlikely(adapter->vlgrp &&
@@ -2585,7 +2643,7 @@ e1000_alloc_rx_buffers(struct e1000_adapter *adapter)
 	while(!buffer_info->skb) {
 		bufsz = adapter->rx_buffer_len + NET_IP_ALIGN;
 
-		skb = dev_alloc_skb(bufsz);
+		skb = dev_alloc_skb_recycle(bufsz);
 		if(unlikely(!skb)) {
 			/* Better luck next round */
 			break;
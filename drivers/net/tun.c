@@ -56,6 +56,11 @@
 #include <linux/if_ether.h>
 #include <linux/if_tun.h>
 #include <linux/crc32.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <net/ip.h>
 
 #include <asm/system.h>
 #include <asm/uaccess.h>
@@ -68,6 +73,7 @@ static int debug;
 
 static LIST_HEAD(tun_dev_list);
 static struct ethtool_ops tun_ethtool_ops;
+static u32 tun_hashrnd;
 
 /* Net device open. */
 static int tun_net_open(struct net_device *dev)
@@ -83,19 +89,46 @@ static int tun_net_close(struct net_device *dev)
 	return 0;
 }
 
+/*
+ * Pick the queue for a packet by its flow, so that the packets of a
+ * flow stay in order.
+ */
+static struct tun_queue *tun_select_queue(struct tun_struct *tun,
+					  struct sk_buff *skb)
+{
+	struct iphdr *iph = skb->nh.iph;
+	u32 ports = 0, hash;
+
+	if (tun->numqueues == 1)
+		return tun->queues[0];
+
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    skb->nh.raw + sizeof(*iph) > skb->tail)
+		return tun->queues[0];
+	if (!(iph->frag_off & htons(IP_MF|IP_OFFSET)) &&
+	    (iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP) &&
+	    skb->nh.raw + iph->ihl * 4 + 4 <= skb->tail)
+		ports = *(u32 *)(skb->nh.raw + iph->ihl * 4);
+	hash = jhash_3words(iph->saddr, iph->daddr, ports, tun_hashrnd);
+
+	return tun->queues[((u64)hash * tun->numqueues) >> 32];
+}
+
 /* Net device start xmit */
 static int tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
+	struct tun_queue *q;
 
 	DBG(KERN_INFO "%s: tun_net_xmit %d\n", tun->dev->name, skb->len);
 
 	/* Drop packet if interface is not attached */
-	if (!tun->attached)
+	if (!tun->numqueues)
 		goto drop;
+	q = tun_select_queue(tun, skb);
 
 	/* Packet dropping */
-	if (skb_queue_len(&tun->readq) >= dev->tx_queue_len) {
+	if (skb_queue_len(&q->readq) >= dev->tx_queue_len) {
 		if (!(tun->flags & TUN_ONE_QUEUE)) {
 			/* Normal queueing mode. */
 			/* Packet scheduler handles dropping of further packets. */
@@ -112,13 +145,13 @@ static int tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	/* Queue packet */
-	skb_queue_tail(&tun->readq, skb);
+	skb_queue_tail(&q->readq, skb);
 	dev->trans_start = jiffies;
 
 	/* Notify and wake up reader process */
-	if (tun->flags & TUN_FASYNC)
-		kill_fasync(&tun->fasync, SIGIO, POLL_IN);
-	wake_up_interruptible(&tun->read_wait);
+	if (q->flags & TUN_FASYNC)
+		kill_fasync(&q->fasync, SIGIO, POLL_IN);
+	wake_up_interruptible(&q->read_wait);
 	return 0;
 
 drop:
@@ -205,7 +238,8 @@ static void tun_net_init(struct net_device *dev)
 /* Poll */
 static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 {  
-	struct tun_struct *tun = file->private_data;
+	struct tun_queue *q = file->private_data;
+	struct tun_struct *tun = q->tun;
 	unsigned int mask = POLLOUT | POLLWRNORM;
 
 	if (!tun)
@@ -213,16 +247,17 @@ static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 
 	DBG(KERN_INFO "%s: tun_chr_poll\n", tun->dev->name);
 
-	poll_wait(file, &tun->read_wait, wait);
+	poll_wait(file, &q->read_wait, wait);
  
-	if (skb_queue_len(&tun->readq))
+	if (skb_queue_len(&q->readq))
 		mask |= POLLIN | POLLRDNORM;
 
 	return mask;
 }
 
-/* Get packet from user space buffer */
-static __inline__ ssize_t tun_get_user(struct tun_struct *tun, struct iovec *iv, size_t count)
+/* Build a packet from a user space buffer */
+static struct sk_buff *tun_get_user_skb(struct tun_struct *tun,
+					struct iovec *iv, size_t count)
 {
 	struct tun_pi pi = { 0, __constant_htons(ETH_P_IP) };
 	struct sk_buff *skb;
@@ -230,20 +265,22 @@ static __inline__ ssize_t tun_get_user(struct tun_struct *tun, struct iovec *iv,
 
 	if (!(tun->flags & TUN_NO_PI)) {
 		if ((len -= sizeof(pi)) > count)
-			return -EINVAL;
+			return ERR_PTR(-EINVAL);
 
 		if(memcpy_fromiovec((void *)&pi, iv, sizeof(pi)))
-			return -EFAULT;
+			return ERR_PTR(-EFAULT);
 	}
  
 	if (!(skb = alloc_skb(len + 2, GFP_KERNEL))) {
 		tun->stats.rx_dropped++;
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 	}
 
 	skb_reserve(skb, 2);
-	if (memcpy_fromiovec(skb_put(skb, len), iv, len))
-		return -EFAULT;
+	if (memcpy_fromiovec(skb_put(skb, len), iv, len)) {
+		kfree_skb(skb);
+		return ERR_PTR(-EFAULT);
+	}
 
 	skb->dev = tun->dev;
 	switch (tun->flags & TUN_TYPE_MASK) {
@@ -258,15 +295,31 @@ static __inline__ ssize_t tun_get_user(struct tun_struct *tun, struct iovec *iv,
 
 	if (tun->flags & TUN_NOCHECKSUM)
 		skb->ip_summed = CHECKSUM_UNNECESSARY;
- 
-	netif_rx_ni(skb);
+
+	return skb;
+}
+
+static inline void tun_account_rx(struct tun_struct *tun, struct sk_buff *skb)
+{
 	tun->dev->last_rx = jiffies;
-   
 	tun->stats.rx_packets++;
-	tun->stats.rx_bytes += len;
+	tun->stats.rx_bytes += skb->len;
+}
+
+/* Get packet from user space buffer */
+static __inline__ ssize_t tun_get_user(struct tun_struct *tun, struct iovec *iv, size_t count)
+{
+	struct sk_buff *skb = tun_get_user_skb(tun, iv, count);
+
+	if (IS_ERR(skb))
+		return PTR_ERR(skb);
+
+	tun_account_rx(tun, skb);
+	netif_rx_ni(skb);
 
 	return count;
-} 
+}
+
 
 static inline size_t iov_total(const struct iovec *iv, unsigned long count)
 {
@@ -283,7 +336,8 @@ static inline size_t iov_total(const struct iovec *iv, unsigned long count)
 static ssize_t tun_chr_writev(struct file * file, const struct iovec *iv, 
 			      unsigned long count, loff_t *pos)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_queue *q = file->private_data;
+	struct tun_struct *tun = q->tun;
 
 	if (!tun)
 		return -EBADFD;
@@ -334,25 +388,16 @@ static __inline__ ssize_t tun_put_user(struct tun_struct *tun,
 	return total;
 }
 
-/* Readv */
-static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
-			    unsigned long count, loff_t *pos)
+/* Read one frame of the queue */
+static ssize_t tun_do_read(struct tun_queue *q, struct iovec *iv,
+			   ssize_t len, int noblock)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_struct *tun = q->tun;
 	DECLARE_WAITQUEUE(wait, current);
 	struct sk_buff *skb;
-	ssize_t len, ret = 0;
-
-	if (!tun)
-		return -EBADFD;
-
-	DBG(KERN_INFO "%s: tun_chr_read\n", tun->dev->name);
-
-	len = iov_total(iv, count);
-	if (len < 0)
-		return -EINVAL;
+	ssize_t ret = 0;
 
-	add_wait_queue(&tun->read_wait, &wait);
+	add_wait_queue(&q->read_wait, &wait);
 	while (len) {
 		const u8 ones[ ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 		u8 addr[ ETH_ALEN];
@@ -361,8 +406,8 @@ static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
 		current->state = TASK_INTERRUPTIBLE;
 
 		/* Read frames from the queue */
-		if (!(skb=skb_dequeue(&tun->readq))) {
-			if (file->f_flags & O_NONBLOCK) {
+		if (!(skb=skb_dequeue(&q->readq))) {
+			if (noblock) {
 				ret = -EAGAIN;
 				break;
 			}
@@ -399,7 +444,7 @@ static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
 			DBG(KERN_DEBUG "%s: tun_chr_readv: accepted: %x:%x:%x:%x:%x:%x\n",
 					tun->dev->name, addr[0], addr[1], addr[2],
 					addr[3], addr[4], addr[5]);
-			ret = tun_put_user(tun, skb, (struct iovec *) iv, len);
+			ret = tun_put_user(tun, skb, iv, len);
 			kfree_skb(skb);
 			break;
 		} else {
@@ -412,11 +457,32 @@ static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
 	}
 
 	current->state = TASK_RUNNING;
-	remove_wait_queue(&tun->read_wait, &wait);
+	remove_wait_queue(&q->read_wait, &wait);
 
 	return ret;
 }
 
+/* Readv */
+static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
+			    unsigned long count, loff_t *pos)
+{
+	struct tun_queue *q = file->private_data;
+	struct tun_struct *tun = q->tun;
+	ssize_t len;
+
+	if (!tun)
+		return -EBADFD;
+
+	DBG(KERN_INFO "%s: tun_chr_read\n", tun->dev->name);
+
+	len = iov_total(iv, count);
+	if (len < 0)
+		return -EINVAL;
+
+	return tun_do_read(q, (struct iovec *) iv, len,
+			   file->f_flags & O_NONBLOCK);
+}
+
 /* Read */
 static ssize_t tun_chr_read(struct file * file, char __user * buf, 
 			    size_t count, loff_t *pos)
@@ -425,13 +491,76 @@ static ssize_t tun_chr_read(struct file * file, char __user * buf,
 	return tun_chr_readv(file, &iv, 1, pos);
 }
 
+/* Read up to TUN_MAX_FRAMES frames, waiting for the first only */
+static int tun_read_frames(struct file *file, struct tun_queue *q,
+			   struct tun_frames *tf)
+{
+	struct iovec iv;
+	unsigned int i;
+	ssize_t ret = 0;
+
+	for (i = 0; i < tf->count && i < TUN_MAX_FRAMES; i++) {
+		if (copy_from_user(&iv, &tf->frames[i], sizeof(iv))) {
+			ret = -EFAULT;
+			break;
+		}
+		if ((ssize_t)iv.iov_len < 0) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = tun_do_read(q, &iv, iv.iov_len,
+				  i || (file->f_flags & O_NONBLOCK));
+		if (ret < 0)
+			break;
+		if (put_user(ret, &tf->frames[i].iov_len)) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+	return i ? i : ret;
+}
+
+/*
+ * Write up to TUN_MAX_FRAMES frames.  They are all copied in before any
+ * is passed up, with bottom halves off, so that the stack takes them in
+ * one softirq run.
+ */
+static int tun_write_frames(struct tun_struct *tun, struct tun_frames *tf)
+{
+	struct sk_buff_head frames;
+	struct sk_buff *skb;
+	struct iovec iv;
+	unsigned int i;
+	int ret = 0;
+
+	skb_queue_head_init(&frames);
+	for (i = 0; i < tf->count && i < TUN_MAX_FRAMES; i++) {
+		if (copy_from_user(&iv, &tf->frames[i], sizeof(iv))) {
+			ret = -EFAULT;
+			break;
+		}
+		skb = tun_get_user_skb(tun, &iv, iv.iov_len);
+		if (IS_ERR(skb)) {
+			ret = PTR_ERR(skb);
+			break;
+		}
+		__skb_queue_tail(&frames, skb);
+	}
+
+	local_bh_disable();
+	while ((skb = __skb_dequeue(&frames)) != NULL) {
+		tun_account_rx(tun, skb);
+		netif_rx(skb);
+	}
+	local_bh_enable();
+
+	return i ? i : ret;
+}
+
 static void tun_setup(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
 
-	skb_queue_head_init(&tun->readq);
-	init_waitqueue_head(&tun->read_wait);
-
 	tun->owner = -1;
 
 	SET_MODULE_OWNER(dev);
@@ -456,6 +585,34 @@ static struct tun_struct *tun_get_by_name(const char *name)
 	return NULL;
 }
 
+/* Attach a file's queue to the device, under rtnl */
+static void tun_attach(struct tun_struct *tun, struct tun_queue *q)
+{
+	spin_lock_bh(&tun->dev->xmit_lock);
+	q->tun = tun;
+	q->index = tun->numqueues;
+	tun->queues[tun->numqueues++] = q;
+	spin_unlock_bh(&tun->dev->xmit_lock);
+}
+
+/* And detach it, dropping what it had not read, under rtnl */
+static void tun_detach(struct tun_queue *q)
+{
+	struct tun_struct *tun = q->tun;
+
+	spin_lock_bh(&tun->dev->xmit_lock);
+	tun->queues[q->index] = tun->queues[--tun->numqueues];
+	tun->queues[q->index]->index = q->index;
+	tun->queues[tun->numqueues] = NULL;
+	q->tun = NULL;
+	spin_unlock_bh(&tun->dev->xmit_lock);
+
+	skb_queue_purge(&q->readq);
+	/* The queue that stopped the device may have been this one */
+	if (tun->numqueues)
+		netif_wake_queue(tun->dev);
+}
+
 static int tun_set_iff(struct file *file, struct ifreq *ifr)
 {
 	struct tun_struct *tun;
@@ -464,7 +621,10 @@ static int tun_set_iff(struct file *file, struct ifreq *ifr)
 
 	tun = tun_get_by_name(ifr->ifr_name);
 	if (tun) {
-		if (tun->attached)
+		if (tun->numqueues &&
+		    (!(tun->flags & TUN_MULTI_QUEUE) ||
+		     !(ifr->ifr_flags & IFF_MULTI_QUEUE) ||
+		     tun->numqueues == TUN_MAX_QUEUES))
 			return -EBUSY;
 
 		/* Check permissions */
@@ -491,6 +651,9 @@ static int tun_set_iff(struct file *file, struct ifreq *ifr)
 			name = "tap%d";
 		} else 
 			goto failed;
+
+		if (ifr->ifr_flags & IFF_MULTI_QUEUE)
+			flags |= TUN_MULTI_QUEUE;
    
 		if (*ifr->ifr_name)
 			name = ifr->ifr_name;
@@ -533,8 +696,7 @@ static int tun_set_iff(struct file *file, struct ifreq *ifr)
 	if (ifr->ifr_flags & IFF_ONE_QUEUE)
 		tun->flags |= TUN_ONE_QUEUE;
 
-	file->private_data = tun;
-	tun->attached = 1;
+	tun_attach(tun, file->private_data);
 
 	strcpy(ifr->ifr_name, tun->dev->name);
 	return 0;
@@ -548,8 +710,10 @@ static int tun_set_iff(struct file *file, struct ifreq *ifr)
 static int tun_chr_ioctl(struct inode *inode, struct file *file, 
 			 unsigned int cmd, unsigned long arg)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_queue *q = file->private_data;
+	struct tun_struct *tun = q->tun;
 	void __user* argp = (void __user*)arg;
+	struct tun_frames tf;
 	struct ifreq ifr;
 
 	if (cmd == TUNSETIFF || _IOC_TYPE(cmd) == 0x89)
@@ -579,6 +743,14 @@ static int tun_chr_ioctl(struct inode *inode, struct file *file,
 	DBG(KERN_INFO "%s: tun_chr_ioctl cmd %d\n", tun->dev->name, cmd);
 
 	switch (cmd) {
+	case TUNREADFRAMES:
+	case TUNWRITEFRAMES:
+		if (copy_from_user(&tf, argp, sizeof(tf)))
+			return -EFAULT;
+		if (cmd == TUNREADFRAMES)
+			return tun_read_frames(file, q, &tf);
+		return tun_write_frames(tun, &tf);
+
 	case TUNSETNOCSUM:
 		/* Disable/Enable checksum */
 		if (arg)
@@ -678,7 +850,8 @@ static int tun_chr_ioctl(struct inode *inode, struct file *file,
 
 static int tun_chr_fasync(int fd, struct file *file, int on)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_queue *q = file->private_data;
+	struct tun_struct *tun = q->tun;
 	int ret;
 
 	if (!tun)
@@ -686,33 +859,44 @@ static int tun_chr_fasync(int fd, struct file *file, int on)
 
 	DBG(KERN_INFO "%s: tun_chr_fasync %d\n", tun->dev->name, on);
 
-	if ((ret = fasync_helper(fd, file, on, &tun->fasync)) < 0)
+	if ((ret = fasync_helper(fd, file, on, &q->fasync)) < 0)
 		return ret; 
  
 	if (on) {
 		ret = f_setown(file, current->pid, 0);
 		if (ret)
 			return ret;
-		tun->flags |= TUN_FASYNC;
+		q->flags |= TUN_FASYNC;
 	} else 
-		tun->flags &= ~TUN_FASYNC;
+		q->flags &= ~TUN_FASYNC;
 
 	return 0;
 }
 
 static int tun_chr_open(struct inode *inode, struct file * file)
 {
+	struct tun_queue *q;
+
 	DBG1(KERN_INFO "tunX: tun_chr_open\n");
-	file->private_data = NULL;
+
+	q = kmalloc(sizeof(*q), GFP_KERNEL);
+	if (!q)
+		return -ENOMEM;
+	memset(q, 0, sizeof(*q));
+	init_waitqueue_head(&q->read_wait);
+	skb_queue_head_init(&q->readq);
+
+	file->private_data = q;
 	return 0;
 }
 
 static int tun_chr_close(struct inode *inode, struct file *file)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_queue *q = file->private_data;
+	struct tun_struct *tun = q->tun;
 
 	if (!tun)
-		return 0;
+		goto out;
 
 	DBG(KERN_INFO "%s: tun_chr_close\n", tun->dev->name);
 
@@ -720,20 +904,18 @@ static int tun_chr_close(struct inode *inode, struct file *file)
 
 	rtnl_lock();
 
-	/* Detach from net device */
-	file->private_data = NULL;
-	tun->attached = 0;
-
-	/* Drop read queue */
-	skb_queue_purge(&tun->readq);
+	/* Detach from net device, dropping the read queue */
+	tun_detach(q);
 
-	if (!(tun->flags & TUN_PERSIST)) {
+	if (!tun->numqueues && !(tun->flags & TUN_PERSIST)) {
 		list_del(&tun->list);
 		unregister_netdevice(tun->dev);
 	}
 
 	rtnl_unlock();
-
+out:
+	file->private_data = NULL;
+	kfree(q);
 	return 0;
 }
 
@@ -814,7 +996,7 @@ static void tun_set_msglevel(struct net_device *dev, u32 value)
 static u32 tun_get_link(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
-	return tun->attached;
+	return tun->numqueues != 0;
 }
 
 static u32 tun_get_rx_csum(struct net_device *dev)
@@ -850,6 +1032,8 @@ static int __init tun_init(void)
 	printk(KERN_INFO "tun: %s, %s\n", DRV_DESCRIPTION, DRV_VERSION);
 	printk(KERN_INFO "tun: %s\n", DRV_COPYRIGHT);
 
+	get_random_bytes(&tun_hashrnd, sizeof(tun_hashrnd));
+
 	ret = misc_register(&tun_miscdev);
 	if (ret)
 		printk(KERN_ERR "tun: Can't register misc device %d\n", TUN_MINOR);
@@ -46,11 +46,13 @@ enum {
 	AHCI_MAX_SG		= 168, /* hardware max is 64K */
 	AHCI_DMA_BOUNDARY	= 0xffffffff,
 	AHCI_USE_CLUSTERING	= 0,
-	AHCI_CMD_SLOT_SZ	= 32 * 32,
+	AHCI_MAX_CMDS		= 32,
+	AHCI_CMD_SLOT_SZ	= AHCI_MAX_CMDS * 32,
 	AHCI_RX_FIS_SZ		= 256,
 	AHCI_CMD_TBL_HDR	= 0x80,
 	AHCI_CMD_TBL_SZ		= AHCI_CMD_TBL_HDR + (AHCI_MAX_SG * 16),
-	AHCI_PORT_PRIV_DMA_SZ	= AHCI_CMD_SLOT_SZ + AHCI_CMD_TBL_SZ +
+	AHCI_CMD_TBL_AR_SZ	= AHCI_CMD_TBL_SZ * AHCI_MAX_CMDS,
+	AHCI_PORT_PRIV_DMA_SZ	= AHCI_CMD_SLOT_SZ + AHCI_CMD_TBL_AR_SZ +
 				  AHCI_RX_FIS_SZ,
 	AHCI_IRQ_ON_SG		= (1 << 31),
 	AHCI_CMD_ATAPI		= (1 << 5),
@@ -74,6 +76,7 @@ enum {
 
 	/* HOST_CAP bits */
 	HOST_CAP_64		= (1 << 31), /* PCI DAC (64-bit DMA) support */
+	HOST_CAP_NCQ		= (1 << 30), /* native command queuing */
 
 	/* registers for each SATA port */
 	PORT_LST_ADDR		= 0x00, /* command list DMA addr */
@@ -159,9 +162,8 @@ struct ahci_host_priv {
 struct ahci_port_priv {
 	struct ahci_cmd_hdr	*cmd_slot;
 	dma_addr_t		cmd_slot_dma;
-	void			*cmd_tbl;
+	void			*cmd_tbl;	/* one table per slot */
 	dma_addr_t		cmd_tbl_dma;
-	struct ahci_sg		*cmd_tbl_sg;
 	void			*rx_fis;
 	dma_addr_t		rx_fis_dma;
 };
@@ -189,7 +191,7 @@ static Scsi_Host_Template ahci_sht = {
 	.ioctl			= ata_scsi_ioctl,
 	.queuecommand		= ata_scsi_queuecmd,
 	.eh_strategy_handler	= ata_scsi_error,
-	.can_queue		= ATA_DEF_QUEUE,
+	.can_queue		= AHCI_MAX_CMDS - 1,
 	.this_id		= ATA_SHT_THIS_ID,
 	.sg_tablesize		= AHCI_MAX_SG,
 	.max_sectors		= ATA_MAX_SECTORS,
@@ -335,14 +337,12 @@ static int ahci_port_start(struct ata_port *ap)
 	mem_dma += AHCI_RX_FIS_SZ;
 
 	/*
-	 * Third item: data area for storing a single command
-	 * and its scatter-gather table
+	 * Third item: data area for storing a command and its
+	 * scatter-gather table, for each of the 32 command slots
 	 */
 	pp->cmd_tbl = mem;
 	pp->cmd_tbl_dma = mem_dma;
 
-	pp->cmd_tbl_sg = mem + AHCI_CMD_TBL_HDR;
-
 	ap->private_data = pp;
 
 	if (hpriv->cap & HOST_CAP_64)
@@ -474,9 +474,9 @@ static void ahci_tf_read(struct ata_port *ap, struct ata_taskfile *tf)
 	ata_tf_from_fis(d2h_fis, tf);
 }
 
-static void ahci_fill_sg(struct ata_queued_cmd *qc)
+static void ahci_fill_sg(struct ata_queued_cmd *qc, void *cmd_tbl)
 {
-	struct ahci_port_priv *pp = qc->ap->private_data;
+	struct ahci_sg *ahci_sg = cmd_tbl + AHCI_CMD_TBL_HDR;
 	unsigned int i;
 
 	VPRINTK("ENTER\n");
@@ -491,21 +491,25 @@ static void ahci_fill_sg(struct ata_queued_cmd *qc)
 		addr = sg_dma_address(&qc->sg[i]);
 		sg_len = sg_dma_len(&qc->sg[i]);
 
-		pp->cmd_tbl_sg[i].addr = cpu_to_le32(addr & 0xffffffff);
-		pp->cmd_tbl_sg[i].addr_hi = cpu_to_le32((addr >> 16) >> 16);
-		pp->cmd_tbl_sg[i].flags_size = cpu_to_le32(sg_len - 1);
+		ahci_sg[i].addr = cpu_to_le32(addr & 0xffffffff);
+		ahci_sg[i].addr_hi = cpu_to_le32((addr >> 16) >> 16);
+		ahci_sg[i].flags_size = cpu_to_le32(sg_len - 1);
 	}
 }
 
 static void ahci_qc_prep(struct ata_queued_cmd *qc)
 {
 	struct ahci_port_priv *pp = qc->ap->private_data;
+	struct ahci_cmd_hdr *cmd_slot = &pp->cmd_slot[qc->tag];
+	void *cmd_tbl = pp->cmd_tbl + qc->tag * AHCI_CMD_TBL_SZ;
+	dma_addr_t cmd_tbl_dma = pp->cmd_tbl_dma + qc->tag * AHCI_CMD_TBL_SZ;
 	u32 opts;
 	const u32 cmd_fis_len = 5; /* five dwords */
 
 	/*
-	 * Fill in command slot information (currently only one slot,
-	 * slot 0, is currently since we don't do queueing)
+	 * Fill in command slot information.  The command goes in the
+	 * slot of its tag, which for NCQ is also the tag the device
+	 * sees.
 	 */
 
 	opts = (qc->n_elem << 16) | cmd_fis_len;
@@ -524,21 +528,21 @@ static void ahci_qc_prep(struct ata_queued_cmd *qc)
 		break;
 	}
 
-	pp->cmd_slot[0].opts = cpu_to_le32(opts);
-	pp->cmd_slot[0].status = 0;
-	pp->cmd_slot[0].tbl_addr = cpu_to_le32(pp->cmd_tbl_dma & 0xffffffff);
-	pp->cmd_slot[0].tbl_addr_hi = cpu_to_le32((pp->cmd_tbl_dma >> 16) >> 16);
+	cmd_slot->opts = cpu_to_le32(opts);
+	cmd_slot->status = 0;
+	cmd_slot->tbl_addr = cpu_to_le32(cmd_tbl_dma & 0xffffffff);
+	cmd_slot->tbl_addr_hi = cpu_to_le32((cmd_tbl_dma >> 16) >> 16);
 
 	/*
 	 * Fill in command table information.  First, the header,
 	 * a SATA Register - Host to Device command FIS.
 	 */
-	ata_tf_to_fis(&qc->tf, pp->cmd_tbl, 0);
+	ata_tf_to_fis(&qc->tf, cmd_tbl, 0);
 
 	if (!(qc->flags & ATA_QCFLAG_DMAMAP))
 		return;
 
-	ahci_fill_sg(qc);
+	ahci_fill_sg(qc, cmd_tbl);
 }
 
 static void ahci_intr_error(struct ata_port *ap, u32 irq_stat)
@@ -599,6 +603,11 @@ static void ahci_eng_timeout(struct ata_port *ap)
 
 	ahci_intr_error(ap, readl(port_mmio + PORT_IRQ_STAT));
 
+	if (ap->sactive || ap->ncq_aborted) {
+		ata_ncq_timeout(ap);
+		return;
+	}
+
 	qc = ata_qc_from_tag(ap, ap->active_tag);
 	if (!qc) {
 		printk(KERN_ERR "ata%u: BUG: timeout without command\n",
@@ -628,12 +637,25 @@ static inline int ahci_host_intr(struct ata_port *ap, struct ata_queued_cmd *qc)
 	status = readl(port_mmio + PORT_IRQ_STAT);
 	writel(status, port_mmio + PORT_IRQ_STAT);
 
+	/* queued commands: the device clears the SActive bit of
+	 * each one it completes, and on error aborts them all
+	 */
+	if (ap->sactive) {
+		if (unlikely(status & PORT_IRQ_FATAL)) {
+			ahci_intr_error(ap, status);
+			ata_ncq_error(ap);
+		} else if (ata_ncq_complete(ap,
+				readl(port_mmio + PORT_SCR_ACT)) < 0)
+			printk(KERN_WARNING "ata%u: SActive 0x%x, "
+			       "tags not issued\n", ap->id,
+			       readl(port_mmio + PORT_SCR_ACT));
+		return 1;
+	}
+
 	ci = readl(port_mmio + PORT_CMD_ISSUE);
-	if (likely((ci & 0x1) == 0)) {
-		if (qc) {
-			ata_qc_complete(qc, 0);
-			qc = NULL;
-		}
+	if (qc && likely((ci & (1 << qc->tag)) == 0)) {
+		ata_qc_complete(qc, 0);
+		qc = NULL;
 	}
 
 	if (status & PORT_IRQ_FATAL) {
@@ -703,10 +725,12 @@ static int ahci_qc_issue(struct ata_queued_cmd *qc)
 	struct ata_port *ap = qc->ap;
 	void *port_mmio = (void *) ap->ioaddr.cmd_addr;
 
-	writel(1, port_mmio + PORT_SCR_ACT);
-	readl(port_mmio + PORT_SCR_ACT);	/* flush */
+	if (qc->tf.protocol == ATA_PROT_NCQ) {
+		writel(1 << qc->tag, port_mmio + PORT_SCR_ACT);
+		readl(port_mmio + PORT_SCR_ACT);	/* flush */
+	}
 
-	writel(1, port_mmio + PORT_CMD_ISSUE);
+	writel(1 << qc->tag, port_mmio + PORT_CMD_ISSUE);
 	readl(port_mmio + PORT_CMD_ISSUE);	/* flush */
 
 	return 0;
@@ -1023,6 +1047,11 @@ static int ahci_init_one (struct pci_dev *pdev, const struct pci_device_id *ent)
 	if (rc)
 		goto err_out_hpriv;
 
+	/* NCQ tags are command slots, and libata uses all 32 */
+	if ((hpriv->cap & HOST_CAP_NCQ) &&
+	    ((hpriv->cap >> 8) & 0x1f) + 1 == AHCI_MAX_CMDS)
+		probe_ent->host_flags |= ATA_FLAG_NCQ;
+
 	ahci_print_info(probe_ent);
 
 	/* FIXME: check ata_device_add return value */
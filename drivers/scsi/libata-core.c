@@ -1146,14 +1146,26 @@ retry:
 			dev->n_sectors = ata_id_u32(dev->id, 60);
 		}
 
+		/* FPDMA QUEUED commands always carry a 48-bit LBA.  One
+		 * tag is left for the commands libata issues itself.
+		 */
+		if ((ap->flags & ATA_FLAG_NCQ) && ata_id_has_ncq(dev->id) &&
+		    (dev->flags & ATA_DFLAG_LBA48)) {
+			dev->flags |= ATA_DFLAG_NCQ;
+			dev->queue_depth = min_t(unsigned int,
+						 ata_id_queue_depth(dev->id),
+						 ATA_MAX_QUEUE - 1);
+		}
+
 		ap->host->max_cmd_len = 16;
 
 		/* print device info to dmesg */
-		printk(KERN_INFO "ata%u: dev %u ATA, max %s, %Lu sectors:%s\n",
+		printk(KERN_INFO "ata%u: dev %u ATA, max %s, %Lu sectors:%s%s\n",
 		       ap->id, device,
 		       ata_mode_string(xfer_modes),
 		       (unsigned long long)dev->n_sectors,
-		       dev->flags & ATA_DFLAG_LBA48 ? " lba48" : "");
+		       dev->flags & ATA_DFLAG_LBA48 ? " lba48" : "",
+		       dev->flags & ATA_DFLAG_NCQ ? " ncq" : "");
 	}
 
 	/* ATAPI-specific feature tests */
@@ -2733,6 +2745,7 @@ struct ata_queued_cmd *ata_qc_new_init(struct ata_port *ap,
 		qc->cursect = qc->cursg = qc->cursg_ofs = 0;
 		qc->nsect = 0;
 		qc->nbytes = qc->curbytes = 0;
+		qc->ncq_err = 0;
 
 		ata_tf_init(ap, &qc->tf, dev->devno);
 
@@ -2758,6 +2771,8 @@ static void __ata_qc_complete(struct ata_queued_cmd *qc)
 	if (likely(ata_tag_valid(tag))) {
 		if (tag == ap->active_tag)
 			ap->active_tag = ATA_TAG_POISON;
+		ap->sactive &= ~(1 << tag);
+		ap->ncq_aborted &= ~(1 << tag);
 		qc->tag = ATA_TAG_POISON;
 		do_clear = 1;
 	}
@@ -2823,6 +2838,219 @@ void ata_qc_complete(struct ata_queued_cmd *qc, u8 drv_stat)
 	VPRINTK("EXIT\n");
 }
 
+/**
+ *	ata_ncq_complete - Complete the NCQ commands the device is done with
+ *	@ap: Port the commands were issued on
+ *	@sactive: Tags the host controller still shows in flight
+ *
+ *	Called by the LLD interrupt handler with the SActive value
+ *	read from the controller: every queued command whose bit the
+ *	device has cleared completed without error.
+ *
+ *	LOCKING:
+ *	spin_lock_irqsave(host_set lock)
+ *
+ *	RETURNS:
+ *	Number of commands completed, or negative if @sactive holds
+ *	tags that were never issued.
+ */
+
+int ata_ncq_complete(struct ata_port *ap, u32 sactive)
+{
+	u32 done_mask;
+	unsigned int tag;
+	int nr_done = 0;
+
+	if (unlikely(sactive & ~ap->sactive))
+		return -1;
+
+	done_mask = ap->sactive & ~sactive;
+	for (tag = 0; done_mask; tag++, done_mask >>= 1) {
+		struct ata_queued_cmd *qc;
+
+		if (!(done_mask & 1))
+			continue;
+
+		qc = ata_qc_from_tag(ap, tag);
+		if (qc) {
+			ata_qc_complete(qc, ATA_DRDY);
+			nr_done++;
+		}
+	}
+
+	return nr_done;
+}
+
+/* Hand a command the device aborted back to the SCSI layer for reissue */
+static void ata_qc_requeue(struct ata_queued_cmd *qc)
+{
+	if (likely(qc->flags & ATA_QCFLAG_DMAMAP))
+		ata_sg_clean(qc);
+
+	qc->scsicmd->result = DID_IMM_RETRY << 16;
+	qc->scsidone(qc->scsicmd);
+
+	__ata_qc_complete(qc);
+}
+
+static void ata_ncq_fail_aborted(struct ata_port *ap, u32 aborted,
+				 unsigned int bad_tag, u8 drv_stat)
+{
+	unsigned int tag;
+
+	for (tag = 0; aborted; tag++, aborted >>= 1) {
+		struct ata_queued_cmd *qc;
+
+		if (!(aborted & 1))
+			continue;
+
+		qc = ata_qc_from_tag(ap, tag);
+		if (!qc)
+			continue;
+
+		if (tag == bad_tag || !ata_tag_valid(bad_tag) || !qc->scsicmd)
+			ata_qc_complete(qc, drv_stat);
+		else
+			ata_qc_requeue(qc);
+	}
+}
+
+/*
+ * The NCQ command error log names the one command that failed, with
+ * its status and error registers; the device aborted all the others,
+ * which go back to the SCSI layer to be issued again.  If the log
+ * cannot be read, or does not name a command, they all fail.
+ */
+static int ata_ncq_log_complete(struct ata_queued_cmd *qc, u8 drv_stat)
+{
+	struct ata_port *ap = qc->ap;
+	u8 *log = ap->ncq_log;
+	u32 aborted = ap->ncq_aborted;
+	unsigned int bad_tag = ATA_TAG_POISON;
+	u8 bad_stat = ATA_ERR;
+
+	ap->ncq_aborted = 0;
+
+	if (!(drv_stat & (ATA_ERR | ATA_BUSY | ATA_DRQ)) &&
+	    !(log[0] & ATA_LOG_NCQ_NQ)) {
+		bad_tag = log[0] & ATA_LOG_NCQ_TAG;
+		bad_stat = log[2] | ATA_ERR;
+		if (aborted & (1 << bad_tag))
+			ata_qc_from_tag(ap, bad_tag)->ncq_err = log[3];
+		else
+			bad_tag = ATA_TAG_POISON;
+	}
+
+	if (!ata_tag_valid(bad_tag))
+		printk(KERN_ERR "ata%u: NCQ error, no failed command logged\n",
+		       ap->id);
+
+	ata_ncq_fail_aborted(ap, aborted, bad_tag, bad_stat);
+
+	return 0;
+}
+
+/**
+ *	ata_ncq_error - Recover from an error on queued commands
+ *	@ap: Port the NCQ error was signalled on
+ *
+ *	Called by the LLD interrupt handler when the device reports an
+ *	error with NCQ commands in flight, after the LLD has restarted
+ *	its command engine.  The device has aborted every outstanding
+ *	command; read its NCQ error log to find out which one failed.
+ *
+ *	LOCKING:
+ *	spin_lock_irqsave(host_set lock)
+ */
+
+void ata_ncq_error(struct ata_port *ap)
+{
+	struct ata_queued_cmd *qc;
+	struct ata_device *dev;
+	u32 aborted = ap->sactive;
+	unsigned int tag;
+
+	if (!aborted)
+		return;
+
+	printk(KERN_WARNING "ata%u: NCQ error, sactive 0x%x\n",
+	       ap->id, aborted);
+
+	ap->ncq_aborted = aborted;
+	ap->sactive = 0;
+
+	for (tag = 0; !(aborted & (1 << tag)); tag++)
+		;
+	dev = ata_qc_from_tag(ap, tag)->dev;
+
+	qc = ata_qc_new_init(ap, dev);
+	if (!qc)
+		goto err_out;
+
+	ata_sg_init_one(qc, ap->ncq_log, ATA_SECT_SIZE);
+	qc->dma_dir = DMA_FROM_DEVICE;
+
+	qc->tf.flags |= ATA_TFLAG_ISADDR | ATA_TFLAG_DEVICE | ATA_TFLAG_LBA48;
+	qc->tf.command = ATA_CMD_READ_LOG_EXT;
+	qc->tf.protocol = ATA_PROT_PIO;
+	qc->tf.nsect = 1;
+	qc->tf.lbal = ATA_LOG_SATA_NCQ;
+	qc->nsect = 1;
+
+	qc->complete_fn = ata_ncq_log_complete;
+
+	if (ata_qc_issue(qc) == 0)
+		return;
+
+	ata_qc_free(qc);
+err_out:
+	ap->ncq_aborted = 0;
+	ata_ncq_fail_aborted(ap, aborted, ATA_TAG_POISON, ATA_ERR);
+}
+
+/**
+ *	ata_ncq_timeout - Fail every queued command after a timeout
+ *	@ap: Port on which commands timed out
+ *
+ *	Called by the LLD ->eng_timeout() hook, after it has stopped
+ *	and restarted its command engine, when NCQ commands or an
+ *	NCQ error log read were outstanding.  With one tag timed out
+ *	nothing more can be learned from the device: everything in
+ *	flight is completed with error.
+ *
+ *	LOCKING:
+ *	Inherited from SCSI layer (none, can sleep)
+ */
+
+void ata_ncq_timeout(struct ata_port *ap)
+{
+	struct ata_queued_cmd *qc;
+	u32 pending = ap->sactive | ap->ncq_aborted;
+	unsigned int tag;
+
+	printk(KERN_ERR "ata%u: NCQ timeout, sactive 0x%x\n",
+	       ap->id, pending);
+
+	/* see ata_qc_timeout(): scsi_done() cannot be used from EH */
+	for (tag = 0; tag < ATA_MAX_QUEUE; tag++) {
+		qc = ata_qc_from_tag(ap, tag);
+		if (qc && qc->scsicmd && (pending & (1 << tag)))
+			qc->scsidone = scsi_finish_command;
+	}
+
+	ap->sactive = 0;
+	ap->ncq_aborted = 0;
+
+	/* the error log read, if it was the one to time out */
+	qc = ata_qc_from_tag(ap, ap->active_tag);
+	if (qc) {
+		qc->complete_fn = ata_qc_complete_noop;
+		ata_qc_complete(qc, ATA_ERR);
+	}
+
+	ata_ncq_fail_aborted(ap, pending, ATA_TAG_POISON, ATA_ERR);
+}
+
 static inline int ata_should_dma_map(struct ata_queued_cmd *qc)
 {
 	struct ata_port *ap = qc->ap;
@@ -2830,6 +3058,7 @@ static inline int ata_should_dma_map(struct ata_queued_cmd *qc)
 	switch (qc->tf.protocol) {
 	case ATA_PROT_DMA:
 	case ATA_PROT_ATAPI_DMA:
+	case ATA_PROT_NCQ:
 		return 1;
 
 	case ATA_PROT_ATAPI:
@@ -2856,6 +3085,10 @@ static inline int ata_should_dma_map(struct ata_queued_cmd *qc)
  *	area, filling in the S/G table, and finally
  *	writing the taskfile to hardware, starting the command.
  *
+ *	Any number of NCQ commands may be in flight together, but
+ *	a non-NCQ command only with no other command: the caller
+ *	makes sure of it.
+ *
  *	LOCKING:
  *	spin_lock_irqsave(host_set lock)
  *
@@ -2881,7 +3114,13 @@ int ata_qc_issue(struct ata_queued_cmd *qc)
 
 	ap->ops->qc_prep(qc);
 
-	qc->ap->active_tag = qc->tag;
+	if (qc->tf.protocol == ATA_PROT_NCQ) {
+		assert(!ata_tag_valid(ap->active_tag));
+		ap->sactive |= 1 << qc->tag;
+	} else {
+		assert(!ap->sactive);
+		ap->active_tag = qc->tag;
+	}
 	qc->flags |= ATA_QCFLAG_ACTIVE;
 
 	return ap->ops->qc_issue(qc);
@@ -3309,6 +3548,16 @@ int ata_port_start (struct ata_port *ap)
 
 	DPRINTK("prd alloc, virt %p, dma %llx\n", ap->prd, (unsigned long long) ap->prd_dma);
 
+	/* read from the interrupt handler when a queued command fails */
+	if (ap->flags & ATA_FLAG_NCQ) {
+		ap->ncq_log = kmalloc(ATA_SECT_SIZE, GFP_KERNEL);
+		if (!ap->ncq_log) {
+			dma_free_coherent(dev, ATA_PRD_TBL_SZ, ap->prd,
+					  ap->prd_dma);
+			return -ENOMEM;
+		}
+	}
+
 	return 0;
 }
 
@@ -3317,6 +3566,7 @@ void ata_port_stop (struct ata_port *ap)
 	struct device *dev = ap->host_set->dev;
 
 	dma_free_coherent(dev, ATA_PRD_TBL_SZ, ap->prd, ap->prd_dma);
+	kfree(ap->ncq_log);
 }
 
 /**
@@ -3980,6 +4230,9 @@ EXPORT_SYMBOL_GPL(ata_device_add);
 EXPORT_SYMBOL_GPL(ata_sg_init);
 EXPORT_SYMBOL_GPL(ata_sg_init_one);
 EXPORT_SYMBOL_GPL(ata_qc_complete);
+EXPORT_SYMBOL_GPL(ata_ncq_complete);
+EXPORT_SYMBOL_GPL(ata_ncq_error);
+EXPORT_SYMBOL_GPL(ata_ncq_timeout);
 EXPORT_SYMBOL_GPL(ata_qc_issue_prot);
 EXPORT_SYMBOL_GPL(ata_eng_timeout);
 EXPORT_SYMBOL_GPL(ata_tf_load);
@@ -28,6 +28,7 @@
 #include <scsi/scsi.h>
 #include "scsi.h"
 #include <scsi/scsi_host.h>
+#include <scsi/scsi_tcq.h>
 #include <linux/libata.h>
 #include <asm/uaccess.h>
 
@@ -220,9 +221,15 @@ void ata_to_sense_error(struct ata_queued_cmd *qc, u8 drv_stat)
 	 *	Is this an error we can process/parse
 	 */
 
-	if(drv_stat & ATA_ERR)
-		/* Read the err bits */
-		err = ata_chk_err(qc->ap);
+	if(drv_stat & ATA_ERR) {
+		/* Read the err bits; for a queued command the
+		 * register is long gone, they come from the NCQ log
+		 */
+		if (qc->tf.protocol == ATA_PROT_NCQ)
+			err = qc->ncq_err;
+		else
+			err = ata_chk_err(qc->ap);
+	}
 
 	/* Display the ATA level error info */
 
@@ -350,6 +357,11 @@ int ata_scsi_slave_config(struct scsi_device *sdev)
 			sdev->host->max_sectors = 2048;
 			blk_queue_max_sectors(sdev->request_queue, 2048);
 		}
+
+		if (ata_ncq_enabled(dev))
+			scsi_adjust_queue_depth(sdev, MSG_SIMPLE_TAG,
+				min_t(int, dev->queue_depth,
+				      sdev->host->can_queue));
 	}
 
 	return 0;	/* scsi layer doesn't check return value, sigh */
@@ -377,11 +389,11 @@ int ata_scsi_error(struct Scsi_Host *host)
 	ap = (struct ata_port *) &host->hostdata[0];
 	ap->ops->eng_timeout(ap);
 
-	/* TODO: this is per-command; when queueing is supported
-	 * this code will either change or move to a more
-	 * appropriate place
+	/* ->eng_timeout() has completed every command that failed,
+	 * which with NCQ may be more than one
 	 */
-	host->host_failed--;
+	host->host_failed = 0;
+	INIT_LIST_HEAD(&host->eh_cmd_q);
 
 	DPRINTK("EXIT\n");
 	return 0;
@@ -510,6 +522,42 @@ static unsigned int ata_scsi_verify_xlat(struct ata_queued_cmd *qc, u8 *scsicmd)
 	return 0;
 }
 
+/**
+ *	ata_scsi_rw_queued - Turn a translated READ/WRITE into FPDMA QUEUED
+ *	@qc: Command holding the translated read/write taskfile
+ *
+ *	On a device doing NCQ, the sector count moves to the feature
+ *	registers and the tag takes its place.
+ *
+ *	LOCKING:
+ *	spin_lock_irqsave(host_set lock)
+ *
+ *	RETURNS:
+ *	Zero.
+ */
+
+static unsigned int ata_scsi_rw_queued(struct ata_queued_cmd *qc)
+{
+	struct ata_taskfile *tf = &qc->tf;
+
+	if (!ata_ncq_enabled(qc->dev))
+		return 0;
+
+	tf->protocol = ATA_PROT_NCQ;
+	tf->flags |= ATA_TFLAG_LBA48;
+	if (tf->flags & ATA_TFLAG_WRITE)
+		tf->command = ATA_CMD_FPDMA_WRITE;
+	else
+		tf->command = ATA_CMD_FPDMA_READ;
+
+	tf->feature = tf->nsect;
+	tf->hob_feature = tf->hob_nsect;
+	tf->nsect = qc->tag << 3;
+	tf->hob_nsect = 0;
+
+	return 0;
+}
+
 /**
  *	ata_scsi_rw_xlat - Translate SCSI r/w command into an ATA one
  *	@qc: Storage for translated ATA taskfile
@@ -572,7 +620,7 @@ static unsigned int ata_scsi_rw_xlat(struct ata_queued_cmd *qc, u8 *scsicmd)
 		tf->lbah = scsicmd[3];
 
 		VPRINTK("ten-byte command\n");
-		return 0;
+		return ata_scsi_rw_queued(qc);
 	}
 
 	if (scsicmd[0] == READ_6 || scsicmd[0] == WRITE_6) {
@@ -582,7 +630,7 @@ static unsigned int ata_scsi_rw_xlat(struct ata_queued_cmd *qc, u8 *scsicmd)
 		tf->lbah = scsicmd[1] & 0x1f; /* mask out reserved bits */
 
 		VPRINTK("six-byte command\n");
-		return 0;
+		return ata_scsi_rw_queued(qc);
 	}
 
 	if (scsicmd[0] == READ_16 || scsicmd[0] == WRITE_16) {
@@ -616,7 +664,7 @@ static unsigned int ata_scsi_rw_xlat(struct ata_queued_cmd *qc, u8 *scsicmd)
 		tf->lbah = scsicmd[7];
 
 		VPRINTK("sixteen-byte command\n");
-		return 0;
+		return ata_scsi_rw_queued(qc);
 	}
 
 	DPRINTK("no-byte command\n");
@@ -652,11 +700,19 @@ static int ata_scsi_qc_complete(struct ata_queued_cmd *qc, u8 drv_stat)
  *	This function sets up an ata_queued_cmd structure for the
  *	SCSI command, and sends that ata_queued_cmd to the hardware.
  *
+ *	NCQ and non-NCQ commands cannot be in flight together, nor
+ *	can anything be issued while the NCQ error log is awaited:
+ *	such a command is handed back to the SCSI layer, which
+ *	tries it again when an outstanding one completes.
+ *
  *	LOCKING:
  *	spin_lock_irqsave(host_set lock)
+ *
+ *	RETURNS:
+ *	Zero, or SCSI_MLQUEUE_DEVICE_BUSY if the command must wait.
  */
 
-static void ata_scsi_translate(struct ata_port *ap, struct ata_device *dev,
+static int ata_scsi_translate(struct ata_port *ap, struct ata_device *dev,
 			      struct scsi_cmnd *cmd,
 			      void (*done)(struct scsi_cmnd *),
 			      ata_xlat_func_t xlat_func)
@@ -668,7 +724,7 @@ static void ata_scsi_translate(struct ata_port *ap, struct ata_device *dev,
 
 	qc = ata_scsi_qc_new(ap, dev, cmd, done);
 	if (!qc)
-		return;
+		return 0;
 
 	/* data is present; dma-map it */
 	if (cmd->sc_data_direction == SCSI_DATA_READ ||
@@ -693,17 +749,26 @@ static void ata_scsi_translate(struct ata_port *ap, struct ata_device *dev,
 	if (xlat_func(qc, scsicmd))
 		goto err_out;
 
+	if (unlikely(ap->ncq_aborted ||
+		     ata_tag_valid(ap->active_tag) ||
+		     (ap->sactive && qc->tf.protocol != ATA_PROT_NCQ))) {
+		ata_qc_free(qc);
+		VPRINTK("EXIT - defer\n");
+		return SCSI_MLQUEUE_DEVICE_BUSY;
+	}
+
 	/* select device, send command to hardware */
 	if (ata_qc_issue(qc))
 		goto err_out;
 
 	VPRINTK("EXIT\n");
-	return;
+	return 0;
 
 err_out:
 	ata_qc_free(qc);
 	ata_bad_cdb(cmd, done);
 	DPRINTK("EXIT - badcmd\n");
+	return 0;
 }
 
 /**
@@ -1465,7 +1530,7 @@ static inline void ata_scsi_dump_cdb(struct ata_port *ap,
  *	Releases scsi-layer-held lock, and obtains host_set lock.
  *
  *	RETURNS:
- *	Zero.
+ *	Zero, or SCSI_MLQUEUE_DEVICE_BUSY to have @cmd queued again.
  */
 
 int ata_scsi_queuecmd(struct scsi_cmnd *cmd, void (*done)(struct scsi_cmnd *))
@@ -1473,6 +1538,7 @@ int ata_scsi_queuecmd(struct scsi_cmnd *cmd, void (*done)(struct scsi_cmnd *))
 	struct ata_port *ap;
 	struct ata_device *dev;
 	struct scsi_device *scsidev = cmd->device;
+	int rc = 0;
 
 	ap = (struct ata_port *) &scsidev->host->hostdata[0];
 
@@ -1490,14 +1556,14 @@ int ata_scsi_queuecmd(struct scsi_cmnd *cmd, void (*done)(struct scsi_cmnd *))
 							      cmd->cmnd[0]);
 
 		if (xlat_func)
-			ata_scsi_translate(ap, dev, cmd, done, xlat_func);
+			rc = ata_scsi_translate(ap, dev, cmd, done, xlat_func);
 		else
 			ata_scsi_simulate(dev->id, cmd, done);
 	} else
-		ata_scsi_translate(ap, dev, cmd, done, atapi_xlat);
+		rc = ata_scsi_translate(ap, dev, cmd, done, atapi_xlat);
 
 out_unlock:
-	return 0;
+	return rc;
 }
 
 /**
@@ -29,6 +29,9 @@
 #include <linux/highmem.h>
 #include <linux/workqueue.h>
 #include <linux/security.h>
+#include <linux/net.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -62,6 +65,31 @@ LIST_HEAD(fput_head);
 
 static void aio_kick_handler(void *);
 
+/* The submission ring of a kioctx and the thread that drains it */
+struct aio_sq_info {
+	struct kioctx		*ctx;
+	struct task_struct	*thread;
+	wait_queue_head_t	wait;
+
+	struct aio_sq_ring	*ring;		/* vmap of the pages */
+	unsigned		nr, head;	/* trusted copies */
+	unsigned long		idle;		/* jiffies to poll before sleeping */
+
+	unsigned long		mmap_base;
+	unsigned long		mmap_size;
+	struct page		**pages;
+	long			nr_pages;
+
+	/* what the submitter's io_submit() would have run with */
+	struct files_struct	*files;
+	struct group_info	*group_info;
+	uid_t			uid, euid, fsuid;
+	gid_t			gid, egid, fsgid;
+	kernel_cap_t		cap_effective;
+};
+
+static void aio_sq_release(struct kioctx *ctx);
+
 /* aio_setup
  *	Creates the slab caches used by the aio routines, panic on
  *	failure as this is done early during the boot sequence.
@@ -80,6 +108,21 @@ static int __init aio_setup(void)
 	return 0;
 }
 
+/*
+ * Without cmpxchg() the kernel cannot advance the ring head safely
+ * against userspace doing the same, so reaping from userspace is only
+ * advertised where it has one.
+ */
+#ifdef __HAVE_ARCH_CMPXCHG
+#define AIO_RING_COMPAT_FEATURES	(AIO_RING_COMPAT_BASE | AIO_RING_COMPAT_USER_REAP)
+#define aio_ring_set_head(ring, old, new) \
+	(cmpxchg(&(ring)->head, (old), (new)) == (old))
+#else
+#define AIO_RING_COMPAT_FEATURES	AIO_RING_COMPAT_BASE
+#define aio_ring_set_head(ring, old, new) \
+	((ring)->head = (new), 1)
+#endif
+
 static void aio_free_ring(struct kioctx *ctx)
 {
 	struct aio_ring_info *info = &ctx->ring_info;
@@ -337,6 +380,7 @@ void fastcall exit_aio(struct mm_struct *mm)
 	while (ctx) {
 		struct kioctx *next = ctx->next;
 		ctx->next = NULL;
+		aio_sq_release(ctx);
 		aio_cancel_all(ctx);
 
 		wait_for_all_aios(ctx);
@@ -724,13 +768,14 @@ static ssize_t aio_run_iocb(struct kiocb *iocb)
 	 * the aio_wake_function callback).
 	 */
 	BUG_ON(current->io_wait != NULL);
-	current->io_wait = &iocb->ki_wait;
+	iocb->ki_wait.key.flags = NULL;
+	current->io_wait = &iocb->ki_wait.wait;
 	ret = retry(iocb);
 	current->io_wait = NULL;
 
 	if (-EIOCBRETRY != ret) {
  		if (-EIOCBQUEUED != ret) {
-			BUG_ON(!list_empty(&iocb->ki_wait.task_list));
+			BUG_ON(!list_empty(&iocb->ki_wait.wait.task_list));
 			aio_complete(iocb, ret, 0);
 			/* must not access the iocb after this */
 		}
@@ -739,7 +784,7 @@ static ssize_t aio_run_iocb(struct kiocb *iocb)
 		 * Issue an additional retry to avoid waiting forever if
 		 * no waits were queued (e.g. in case of a short read).
 		 */
-		if (list_empty(&iocb->ki_wait.task_list))
+		if (list_empty(&iocb->ki_wait.wait.task_list))
 			kiocbSetKicked(iocb);
 	}
 out:
@@ -885,7 +930,7 @@ void queue_kicked_iocb(struct kiocb *iocb)
 	unsigned long flags;
 	int run = 0;
 
-	WARN_ON((!list_empty(&iocb->ki_wait.task_list)));
+	WARN_ON((!list_empty(&iocb->ki_wait.wait.task_list)));
 
 	spin_lock_irqsave(&ctx->ctx_lock, flags);
 	run = __queue_kicked_iocb(iocb);
@@ -1030,14 +1075,15 @@ put_rq:
 /* aio_read_evt
  *	Pull an event off of the ioctx's event ring.  Returns the number of 
  *	events fetched (0 or 1 ;-)
- *	FIXME: make this use cmpxchg.
- *	TODO: make the ringbuffer user mmap()able (requires FIXME).
+ *	ring_lock only serialises the kernel's readers; userspace may be
+ *	reaping the same ring, so head is advanced with aio_ring_set_head()
+ *	and the event is read again if someone else took it first.
  */
 static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
 {
 	struct aio_ring_info *info = &ioctx->ring_info;
 	struct aio_ring *ring;
-	unsigned long head;
+	unsigned head;
 	int ret = 0;
 
 	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
@@ -1050,16 +1096,21 @@ static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
 
 	spin_lock(&info->ring_lock);
 
-	head = ring->head % info->nr;
-	if (head != ring->tail) {
-		struct io_event *evp = aio_ring_event(info, head, KM_USER1);
+	do {
+		struct io_event *evp;
+
+		head = ring->head;
+		if (head == ring->tail) {
+			ret = 0;
+			break;
+		}
+		smp_rmb(); /* read the tail before the event it covers */
+		evp = aio_ring_event(info, head % info->nr, KM_USER1);
 		*ent = *evp;
-		head = (head + 1) % info->nr;
-		smp_mb(); /* finish reading the event before updatng the head */
-		ring->head = head;
-		ret = 1;
 		put_aio_ring_event(evp, KM_USER1);
-	}
+		ret = 1;
+		smp_mb(); /* finish reading the event before updatng the head */
+	} while (!aio_ring_set_head(ring, head, (head % info->nr + 1) % info->nr));
 	spin_unlock(&info->ring_lock);
 
 out:
@@ -1244,6 +1295,7 @@ static void io_destroy(struct kioctx *ioctx)
 	if (likely(!was_dead))
 		put_ioctx(ioctx);	/* twice for the list */
 
+	aio_sq_release(ioctx);
 	aio_cancel_all(ioctx);
 	wait_for_all_aios(ioctx);
 	put_ioctx(ioctx);	/* once for the lookup */
@@ -1441,6 +1493,18 @@ ssize_t aio_setup_iocb(struct kiocb *kiocb)
 		if (file->f_op->aio_fsync)
 			kiocb->ki_retry = aio_fsync;
 		break;
+#ifdef CONFIG_NET
+	case IOCB_CMD_ACCEPT:
+		ret = -ENOTSOCK;
+		if (unlikely(!S_ISSOCK(file->f_dentry->d_inode->i_mode)))
+			break;
+		ret = -EFAULT;
+		if (unlikely(!access_ok(VERIFY_WRITE, kiocb->ki_buf,
+			kiocb->ki_left)))
+			break;
+		kiocb->ki_retry = sock_aio_accept;
+		break;
+#endif
 	default:
 		dprintk("EINVAL: io_submit: no operation provided\n");
 		ret = -EINVAL;
@@ -1463,6 +1527,11 @@ ssize_t aio_setup_iocb(struct kiocb *kiocb)
  * 	instead of a synchronous wait when an i/o blocking
  *	condition is encountered during aio).
  *
+ *	Page waits (wait_on_page_bit_async, lock_page_async) set
+ *	the key of the entry, and share hashed wait queues with
+ *	other pages: for those, only the wakeup of the bit being
+ *	waited for kicks the iocb, like wake_bit_function.
+ *
  * Note:
  * This routine is executed with the wait queue lock held.
  * Since kick_iocb acquires iocb->ctx->ctx_lock, it nests
@@ -1472,7 +1541,14 @@ ssize_t aio_setup_iocb(struct kiocb *kiocb)
  */
 int aio_wake_function(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	struct kiocb *iocb = container_of(wait, struct kiocb, ki_wait);
+	struct kiocb *iocb = io_wait_to_kiocb(wait);
+	struct wait_bit_key *bit_key = key;
+
+	if (iocb->ki_wait.key.flags && bit_key &&
+	    (iocb->ki_wait.key.flags != bit_key->flags ||
+	     iocb->ki_wait.key.bit_nr != bit_key->bit_nr ||
+	     test_bit(bit_key->bit_nr, bit_key->flags)))
+		return 0;
 
 	list_del_init(&wait->task_list);
 	kick_iocb(iocb);
@@ -1528,8 +1604,9 @@ int fastcall io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	req->ki_buf = (char __user *)(unsigned long)iocb->aio_buf;
 	req->ki_left = req->ki_nbytes = iocb->aio_nbytes;
 	req->ki_opcode = iocb->aio_lio_opcode;
-	init_waitqueue_func_entry(&req->ki_wait, aio_wake_function);
-	INIT_LIST_HEAD(&req->ki_wait.task_list);
+	init_waitqueue_func_entry(&req->ki_wait.wait, aio_wake_function);
+	INIT_LIST_HEAD(&req->ki_wait.wait.task_list);
+	req->ki_wait.key.flags = NULL;
 	req->ki_run_list.next = req->ki_run_list.prev = NULL;
 	req->ki_retry = NULL;
 	req->ki_retried = 0;
@@ -1612,10 +1689,348 @@ asmlinkage long sys_io_submit(aio_context_t ctx_id, long nr,
 			break;
 	}
 
+	/* an empty submission kicks the submission ring's thread */
+	if (!nr) {
+		spin_lock_irq(&ctx->ctx_lock);
+		if (ctx->sq)
+			wake_up(&ctx->sq->wait);
+		spin_unlock_irq(&ctx->ctx_lock);
+	}
+
 	put_ioctx(ctx);
 	return i ? i : ret;
 }
 
+/* aio_post_error
+ *	Puts an event for an iocb that never became a request on the
+ *	completion ring, provided there is room for it beyond what the
+ *	active requests have reserved.  Returns -EAGAIN if there is not.
+ */
+static int aio_post_error(struct kioctx *ctx, struct iocb __user *user_iocb,
+			  u64 data, long res)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_ring *ring;
+	struct io_event *event;
+	unsigned long tail;
+	int ret = -EAGAIN;
+
+	spin_lock_irq(&ctx->ctx_lock);
+	ring = kmap_atomic(info->ring_pages[0], KM_IRQ1);
+	if (ctx->reqs_active < aio_ring_avail(info, ring)) {
+		tail = info->tail;
+		event = aio_ring_event(info, tail, KM_IRQ0);
+		tail = (tail + 1) % info->nr;
+
+		event->obj = (u64)(unsigned long)user_iocb;
+		event->data = data;
+		event->res = res;
+		event->res2 = 0;
+
+		smp_wmb();	/* make event visible before updating tail */
+
+		info->tail = tail;
+		ring->tail = tail;
+		put_aio_ring_event(event, KM_IRQ0);
+		ret = 0;
+	}
+	kunmap_atomic(ring, KM_IRQ1);
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	if (!ret && waitqueue_active(&ctx->wait))
+		wake_up(&ctx->wait);
+	return ret;
+}
+
+/* aio_sq_drain
+ *	Submits what userspace has put on the submission ring.  Returns the
+ *	number of entries consumed, or -EAGAIN if the completion ring has
+ *	no room for the first one.
+ */
+static int aio_sq_drain(struct aio_sq_info *sq)
+{
+	struct aio_sq_ring *ring = sq->ring;
+	unsigned head = sq->head;
+	unsigned tail = ring->tail;
+	int done = 0;
+
+	if (unlikely(tail >= sq->nr))
+		return 0;
+	smp_rmb();	/* read the tail before the slots it covers */
+
+	while (head != tail) {
+		struct iocb __user *user_iocb;
+		struct iocb tmp;
+		long ret;
+
+		user_iocb = (struct iocb __user *)(unsigned long)ring->iocbs[head];
+		if (unlikely(copy_from_user(&tmp, user_iocb, sizeof(tmp)))) {
+			tmp.aio_data = 0;
+			ret = -EFAULT;
+		} else
+			ret = io_submit_one(sq->ctx, user_iocb, &tmp);
+
+		/* out of completion slots: leave it for the next pass */
+		if (ret == -EAGAIN)
+			break;
+		if (ret && aio_post_error(sq->ctx, user_iocb, tmp.aio_data, ret))
+			break;
+
+		head = (head + 1) % sq->nr;
+		done++;
+	}
+
+	if (done) {
+		smp_mb();	/* done with the slots before handing them back */
+		sq->head = head;
+		ring->head = head;
+	}
+	return (done || head == tail) ? done : -EAGAIN;
+}
+
+/* aio_sq_thread
+ *	Polls the submission ring for sq->idle jiffies after it last found
+ *	work, then asks to be woken through AIO_SQ_NEED_WAKEUP and sleeps.
+ *	It runs in the submitter's mm, with its files and credentials, so
+ *	that each iocb is submitted just as io_submit() would have done it.
+ */
+static int aio_sq_thread(void *data)
+{
+	struct aio_sq_info *sq = data;
+	struct aio_sq_ring *ring = sq->ring;
+	struct files_struct *files;
+	unsigned long timeout;
+	DEFINE_WAIT(wait);
+
+	current->uid = sq->uid;
+	current->euid = sq->euid;
+	current->fsuid = sq->fsuid;
+	current->gid = sq->gid;
+	current->egid = sq->egid;
+	current->fsgid = sq->fsgid;
+	current->cap_effective = sq->cap_effective;
+	set_current_groups(sq->group_info);
+
+	task_lock(current);
+	files = current->files;
+	current->files = sq->files;
+	task_unlock(current);
+
+	use_mm(sq->ctx->mm);
+
+	timeout = jiffies + sq->idle;
+	while (!kthread_should_stop()) {
+		int ret = aio_sq_drain(sq);
+
+		if (ret > 0) {
+			timeout = jiffies + sq->idle;
+			cond_resched();
+			continue;
+		}
+		if (ret < 0) {
+			/* wait for events to be reaped */
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (!kthread_should_stop())
+				schedule_timeout(1);
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+		if (time_before(jiffies, timeout)) {
+			cpu_relax();
+			cond_resched();
+			continue;
+		}
+
+		prepare_to_wait(&sq->wait, &wait, TASK_INTERRUPTIBLE);
+		ring->flags |= AIO_SQ_NEED_WAKEUP;
+		smp_mb();	/* set the flag before looking at the tail again */
+		if (ring->tail == sq->head && !kthread_should_stop())
+			schedule();
+		ring->flags &= ~AIO_SQ_NEED_WAKEUP;
+		finish_wait(&sq->wait, &wait);
+		timeout = jiffies + sq->idle;
+	}
+
+	unuse_mm(sq->ctx->mm);
+
+	task_lock(current);
+	current->files = files;
+	task_unlock(current);
+	return 0;
+}
+
+static void aio_sq_free(struct aio_sq_info *sq)
+{
+	struct mm_struct *mm = sq->ctx->mm;
+	long i;
+
+	if (sq->ring)
+		vunmap(sq->ring);
+	for (i = 0; i < sq->nr_pages; i++)
+		put_page(sq->pages[i]);
+	kfree(sq->pages);
+
+	if (sq->mmap_size) {
+		down_write(&mm->mmap_sem);
+		do_munmap(mm, sq->mmap_base, sq->mmap_size);
+		up_write(&mm->mmap_sem);
+	}
+
+	if (sq->files)
+		put_files_struct(sq->files);
+	if (sq->group_info)
+		put_group_info(sq->group_info);
+	kfree(sq);
+}
+
+/* aio_sq_release
+ *	Stops the submission ring's thread, if the context has one, and
+ *	frees the ring.  Called as the context is destroyed, before its
+ *	requests are cancelled so that no new ones come in behind them.
+ */
+static void aio_sq_release(struct kioctx *ctx)
+{
+	struct aio_sq_info *sq;
+
+	spin_lock_irq(&ctx->ctx_lock);
+	sq = ctx->sq;
+	ctx->sq = NULL;
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	if (sq) {
+		kthread_stop(sq->thread);
+		aio_sq_free(sq);
+	}
+}
+
+static int aio_sq_setup_ring(struct aio_sq_info *sq, unsigned nr)
+{
+	struct mm_struct *mm = current->mm;
+	unsigned long size;
+	int nr_pages;
+
+	size = sizeof(struct aio_sq_ring) + nr * sizeof(__u64);
+	nr_pages = (size + PAGE_SIZE-1) >> PAGE_SHIFT;
+
+	sq->pages = kmalloc(sizeof(struct page *) * nr_pages, GFP_KERNEL);
+	if (!sq->pages)
+		return -ENOMEM;
+
+	sq->mmap_size = nr_pages * PAGE_SIZE;
+	down_write(&mm->mmap_sem);
+	sq->mmap_base = do_mmap(NULL, 0, sq->mmap_size,
+				PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, 0);
+	if (IS_ERR((void *)sq->mmap_base)) {
+		up_write(&mm->mmap_sem);
+		sq->mmap_size = 0;
+		return -EAGAIN;
+	}
+	sq->nr_pages = get_user_pages(current, mm, sq->mmap_base, nr_pages,
+				      1, 0, sq->pages, NULL);
+	up_write(&mm->mmap_sem);
+
+	if (unlikely(sq->nr_pages != nr_pages)) {
+		if (sq->nr_pages < 0)
+			sq->nr_pages = 0;
+		return -EAGAIN;
+	}
+
+	sq->ring = vmap(sq->pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!sq->ring)
+		return -ENOMEM;
+
+	sq->nr = nr;
+	sq->head = 0;
+	sq->ring->head = sq->ring->tail = 0;
+	sq->ring->nr = nr;
+	sq->ring->flags = 0;
+	return 0;
+}
+
+/* sys_io_setup_sq:
+ *	Attach a submission ring of nr_entries slots to the aio context
+ *	ctx_id, drained by a kernel thread that polls it for idle_ms
+ *	milliseconds after finding work before going to sleep.  Returns
+ *	the address at which the struct aio_sq_ring is mapped.  A context
+ *	has at most one submission ring, which lives as long as it does.
+ */
+asmlinkage long sys_io_setup_sq(aio_context_t ctx_id, unsigned nr_entries,
+				unsigned idle_ms)
+{
+	struct kioctx *ctx;
+	struct aio_sq_info *sq;
+	struct task_struct *p;
+	long ret;
+
+	if (!nr_entries || nr_entries > 0x10000000U / sizeof(__u64))
+		return -EINVAL;
+	if (idle_ms > 1000)
+		idle_ms = 1000;
+
+	ctx = lookup_ioctx(ctx_id);
+	if (unlikely(!ctx))
+		return -EINVAL;
+
+	ret = -EBUSY;
+	if (ctx->sq)
+		goto out_put;
+
+	ret = -ENOMEM;
+	sq = kmalloc(sizeof(*sq), GFP_KERNEL);
+	if (!sq)
+		goto out_put;
+	memset(sq, 0, sizeof(*sq));
+	sq->ctx = ctx;
+	init_waitqueue_head(&sq->wait);
+	sq->idle = msecs_to_jiffies(idle_ms);
+
+	ret = aio_sq_setup_ring(sq, nr_entries);
+	if (ret)
+		goto out_free;
+
+	task_lock(current);
+	sq->files = current->files;
+	atomic_inc(&sq->files->count);
+	sq->group_info = current->group_info;
+	get_group_info(sq->group_info);
+	task_unlock(current);
+	sq->uid = current->uid;
+	sq->euid = current->euid;
+	sq->fsuid = current->fsuid;
+	sq->gid = current->gid;
+	sq->egid = current->egid;
+	sq->fsgid = current->fsgid;
+	sq->cap_effective = current->cap_effective;
+
+	p = kthread_create(aio_sq_thread, sq, "aio_sq/%d", current->pid);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+		goto out_free;
+	}
+	sq->thread = p;
+	wake_up_process(p);
+
+	spin_lock_irq(&ctx->ctx_lock);
+	if (ctx->sq || ctx->dead) {
+		spin_unlock_irq(&ctx->ctx_lock);
+		kthread_stop(p);
+		ret = ctx->dead ? -EINVAL : -EBUSY;
+		goto out_free;
+	}
+	ctx->sq = sq;
+	ret = sq->mmap_base;	/* sq is the context's from here on */
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	put_ioctx(ctx);
+	return ret;
+
+out_free:
+	aio_sq_free(sq);
+out_put:
+	put_ioctx(ctx);
+	return ret;
+}
+
 /* lookup_kiocb
  *	Finds a given iocb for cancellation.
  *	MUST be called with ctx->ctx_lock held.
@@ -47,6 +47,14 @@ extern int SendReceive(const unsigned int /* xid */ , struct cifsSesInfo *,
 			struct smb_hdr * /* input */ ,
 			struct smb_hdr * /* out */ ,
 			int * /* bytes returned */ , const int long_op);
+extern int SendNoWait(const unsigned int /* xid */ , struct cifsSesInfo *,
+			struct smb_hdr * /* input */ ,
+			struct mid_q_entry ** /* returned */ ,
+			const int long_op, const int nowait);
+extern int ReceiveForMid(const unsigned int /* xid */ , struct cifsSesInfo *,
+			struct mid_q_entry *,
+			struct smb_hdr ** /* response, returned */ ,
+			const int long_op);
 extern int checkSMBhdr(struct smb_hdr *smb, __u16 mid);
 extern int checkSMB(struct smb_hdr *smb, __u16 mid, int length);
 extern int is_valid_oplock_break(struct smb_hdr *smb);
@@ -198,6 +206,21 @@ extern int CIFSSMBClose(const int xid, struct cifsTconInfo *tcon,
 extern int CIFSSMBRead(const int xid, struct cifsTconInfo *tcon,
 			const int netfid, unsigned int count,
 			const __u64 lseek, unsigned int *nbytes, char **buf);
+extern int CIFSSMBReadSend(const int xid, struct cifsTconInfo *tcon,
+			const int netfid, const unsigned int count,
+			const __u64 lseek, struct mid_q_entry **pmid,
+			const int nowait);
+extern int CIFSSMBReadReceive(const int xid, struct cifsTconInfo *tcon,
+			struct mid_q_entry *mid, const unsigned int count,
+			unsigned int *nbytes, char **buf);
+extern int CIFSSMBWriteSend(const int xid, struct cifsTconInfo *tcon,
+			const int netfid, struct page **pages,
+			const unsigned int nr_pages, const unsigned int count,
+			const __u64 offset, struct mid_q_entry **pmid,
+			const int long_op, const int nowait);
+extern int CIFSSMBWriteReceive(const int xid, struct cifsTconInfo *tcon,
+			struct mid_q_entry *mid, unsigned int *nbytes,
+			const int long_op);
 extern int CIFSSMBWrite(const int xid, struct cifsTconInfo *tcon,
 			const int netfid, const unsigned int count,
 			const __u64 lseek, unsigned int *nbytes,
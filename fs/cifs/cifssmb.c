@@ -30,6 +30,8 @@
 #include <linux/fs.h>
 #include <linux/kernel.h>
 #include <linux/vfs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
 #include <linux/posix_acl_xattr.h>
 #include <asm/uaccess.h>
 #include "cifspdu.h"
@@ -859,6 +861,91 @@ CIFSSMBRead(const int xid, struct cifsTconInfo *tcon,
 	return rc;
 }
 
+/*
+ * The two halves of CIFSSMBRead, for callers that keep several reads on
+ * the wire at once (readpages).  CIFSSMBReadSend queues the request and
+ * returns its mid; CIFSSMBReadReceive waits for the reply and returns
+ * the receive buffer itself in *buf, with *nbytes of data starting at
+ * DataOffset, so the data is only copied once - straight into the page
+ * cache.  The caller frees *buf with cifs_buf_release.
+ */
+int
+CIFSSMBReadSend(const int xid, struct cifsTconInfo *tcon,
+		const int netfid, const unsigned int count,
+		const __u64 lseek, struct mid_q_entry **pmid, const int nowait)
+{
+	int rc;
+	READ_REQ *pSMB = NULL;
+	READ_RSP *pSMBr = NULL;
+
+	cFYI(1,("Sending read of %d bytes on fid %d",count,netfid));
+
+	rc = smb_init(SMB_COM_READ_ANDX, 12, tcon, (void **) &pSMB,
+		      (void **) &pSMBr);
+	if (rc)
+		return rc;
+
+	/* tcon and ses pointer are checked in smb_init */
+	if (tcon->ses->server == NULL) {
+		cifs_buf_release(pSMB);
+		return -ECONNABORTED;
+	}
+
+	pSMB->AndXCommand = 0xFF;	/* none */
+	pSMB->Fid = netfid;
+	pSMB->OffsetLow = cpu_to_le32(lseek & 0xFFFFFFFF);
+	pSMB->OffsetHigh = cpu_to_le32(lseek >> 32);
+	pSMB->Remaining = 0;
+	pSMB->MaxCount = cpu_to_le16(count & 0xFFFF);
+	pSMB->MaxCountHigh = cpu_to_le32(count >> 16);
+	pSMB->ByteCount = 0;  /* no need to do le conversion since it is 0 */
+
+	rc = SendNoWait(xid, tcon->ses, (struct smb_hdr *) pSMB, pmid, 0,
+			nowait);
+	if (rc && rc != -EBUSY)
+		cERROR(1, ("Send error in read = %d", rc));
+
+	/* the reply comes back in a buffer of its own */
+	cifs_buf_release(pSMB);
+	return rc;
+}
+
+int
+CIFSSMBReadReceive(const int xid, struct cifsTconInfo *tcon,
+		   struct mid_q_entry *mid, const unsigned int count,
+		   unsigned int *nbytes, char **buf)
+{
+	int rc;
+	READ_RSP *pSMBr;
+	int data_length;
+
+	*nbytes = 0;
+
+	rc = ReceiveForMid(xid, tcon->ses, mid, (struct smb_hdr **) &pSMBr, 0);
+	*buf = (char *)pSMBr;
+	if (rc) {
+		cERROR(1, ("Send error in read = %d", rc));
+		return rc;
+	}
+
+	data_length = le16_to_cpu(pSMBr->DataLengthHigh);
+	data_length = data_length << 16;
+	data_length += le16_to_cpu(pSMBr->DataLength);
+
+	/*check that DataLength would not go beyond end of SMB */
+	if ((data_length > CIFSMaxBufSize) || (data_length > count) ||
+	    (le16_to_cpu(pSMBr->DataOffset) + data_length >
+	     pSMBr->hdr.smb_buf_length)) {
+		cFYI(1,("bad length %d for count %d",data_length,count));
+		return -EIO;
+	}
+	*nbytes = data_length;
+
+	/* Note: On -EAGAIN error only caller can retry on handle based calls 
+		since file handle passed in no longer valid */
+	return 0;
+}
+
 int
 CIFSSMBWrite(const int xid, struct cifsTconInfo *tcon,
 	     const int netfid, const unsigned int count,
@@ -942,6 +1029,94 @@ CIFSSMBWrite(const int xid, struct cifsTconInfo *tcon,
 	return rc;
 }
 
+/*
+ * Write count bytes from the start of an array of page cache pages,
+ * without waiting for the reply, for writepages to keep several writes
+ * on the wire.  count must fit in one SMB buffer.  CIFSSMBWriteReceive
+ * collects the result.
+ */
+int
+CIFSSMBWriteSend(const int xid, struct cifsTconInfo *tcon,
+		 const int netfid, struct page **pages,
+		 const unsigned int nr_pages, const unsigned int count,
+		 const __u64 offset, struct mid_q_entry **pmid,
+		 const int long_op, const int nowait)
+{
+	int rc;
+	WRITE_REQ *pSMB = NULL;
+	WRITE_RSP *pSMBr = NULL;
+	unsigned int i, copied, len;
+	char *kaddr;
+
+	if ((count > CIFSMaxBufSize) ||
+	    (count > ((unsigned long)nr_pages << PAGE_CACHE_SHIFT)))
+		return -EINVAL;
+
+	rc = smb_init(SMB_COM_WRITE_ANDX, 14, tcon, (void **) &pSMB,
+		      (void **) &pSMBr);
+	if (rc)
+		return rc;
+	/* tcon and ses pointer are checked in smb_init */
+	if (tcon->ses->server == NULL) {
+		cifs_buf_release(pSMB);
+		return -ECONNABORTED;
+	}
+
+	pSMB->AndXCommand = 0xFF;	/* none */
+	pSMB->Fid = netfid;
+	pSMB->OffsetLow = cpu_to_le32(offset & 0xFFFFFFFF);
+	pSMB->OffsetHigh = cpu_to_le32(offset >> 32);
+	pSMB->Reserved = 0xFFFFFFFF;
+	pSMB->WriteMode = 0;
+	pSMB->Remaining = 0;
+	pSMB->DataOffset =
+	    cpu_to_le16(offsetof(struct smb_com_write_req,Data) - 4);
+
+	for (i = 0, copied = 0; copied < count; i++) {
+		len = min_t(unsigned int, count - copied, PAGE_CACHE_SIZE);
+		kaddr = kmap_atomic(pages[i], KM_USER0);
+		memcpy(pSMB->Data + copied, kaddr, len);
+		kunmap_atomic(kaddr, KM_USER0);
+		copied += len;
+	}
+
+	pSMB->DataLengthLow = cpu_to_le16(count & 0xFFFF);
+	pSMB->DataLengthHigh = cpu_to_le16(count >> 16);
+	pSMB->hdr.smb_buf_length += count+1;
+	pSMB->ByteCount = cpu_to_le16(count + 1 /* pad */);
+
+	rc = SendNoWait(xid, tcon->ses, (struct smb_hdr *) pSMB, pmid,
+			long_op, nowait);
+	if (rc && rc != -EBUSY)
+		cFYI(1, ("Send error in write = %d", rc));
+
+	cifs_buf_release(pSMB);
+	return rc;
+}
+
+int
+CIFSSMBWriteReceive(const int xid, struct cifsTconInfo *tcon,
+		    struct mid_q_entry *mid, unsigned int *nbytes,
+		    const int long_op)
+{
+	int rc;
+	WRITE_RSP *pSMBr;
+
+	*nbytes = 0;
+	rc = ReceiveForMid(xid, tcon->ses, mid, (struct smb_hdr **) &pSMBr,
+			   long_op);
+	if (rc == 0) {
+		*nbytes = le16_to_cpu(pSMBr->CountHigh);
+		*nbytes = (*nbytes) << 16;
+		*nbytes += le16_to_cpu(pSMBr->Count);
+	} else
+		cFYI(1, ("Send error in write = %d", rc));
+	if (pSMBr)
+		cifs_buf_release(pSMBr);
+
+	return rc;
+}
+
 #ifdef CONFIG_CIFS_EXPERIMENTAL
 int CIFSSMBWrite2(const int xid, struct cifsTconInfo *tcon,
 	     const int netfid, const unsigned int count,
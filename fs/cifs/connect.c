@@ -1379,8 +1379,13 @@ cifs_mount(struct super_block *sb, struct cifs_sb_info *cifs_sb,
     
 	/* search for existing tcon to this server share */
 	if (!rc) {
+		/* servers with large read/write support are not bound by
+		   their negotiated buffer size, only by ours (CIFSMaxBufSize
+		   module parameter, up to a bit under 128K) */
 		if((volume_info.rsize) && (volume_info.rsize <= CIFSMaxBufSize))
 			cifs_sb->rsize = volume_info.rsize;
+		else if(pSesInfo->capabilities & CAP_LARGE_READ_X)
+			cifs_sb->rsize = CIFSMaxBufSize;
 		else
 			cifs_sb->rsize = srvTcp->maxBuf - MAX_CIFS_HDR_SIZE; /* default */
 		if((volume_info.wsize) && (volume_info.wsize <= CIFSMaxBufSize))
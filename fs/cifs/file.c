@@ -25,6 +25,8 @@
 #include <linux/fcntl.h>
 #include <linux/pagemap.h>
 #include <linux/pagevec.h>
+#include <linux/mpage.h>
+#include <linux/writeback.h>
 #include <linux/smp_lock.h>
 #include <asm/div64.h>
 #include "cifsfs.h"
@@ -935,23 +937,317 @@ cifs_partialpagewrite(struct page *page,unsigned from, unsigned to)
 	return rc;
 }
 
-#if 0
+/* most writes a single writepages call keeps on the wire at once */
+#define CIFS_MAX_WRITEBACK_REQS 8
+
+struct cifs_writeback_req {
+	struct mid_q_entry *mid;
+	loff_t offset;
+	unsigned int count;
+	unsigned int nr_pages;
+	struct page **pages;
+};
+
+struct cifs_writeback {
+	int xid;
+	struct address_space *mapping;
+	struct cifsTconInfo *tcon;
+	struct cifsFileInfo *open_file;
+	unsigned int head;
+	unsigned int nr_out;
+	unsigned int written;
+	struct cifs_writeback_req reqs[CIFS_MAX_WRITEBACK_REQS];
+};
+
+static struct cifsFileInfo *
+find_writable_file(struct cifsInodeInfo *cifs_inode)
+{
+	struct cifsFileInfo *open_file;
+
+	read_lock(&GlobalSMBSeslock);
+	list_for_each_entry(open_file, &cifs_inode->openFileList, flist) {
+		if(open_file->closePend)
+			continue;
+		if((open_file->pfile) &&
+		   ((open_file->pfile->f_flags & O_RDWR) ||
+		    (open_file->pfile->f_flags & O_WRONLY))) {
+			read_unlock(&GlobalSMBSeslock);
+			return open_file;
+		}
+	}
+	read_unlock(&GlobalSMBSeslock);
+	return NULL;
+}
+
+/*
+ * Finish writeback of the pages of a write that has completed (or could
+ * not be sent).  On -EAGAIN the handle went stale under us and the pages
+ * are simply dirtied again for the caller to retry.
+ */
+static void
+cifs_writeback_end(struct cifs_writeback *wb, struct cifs_writeback_req *req,
+		   int rc)
+{
+	unsigned int i;
+	struct page *page;
+
+	for (i = 0; i < req->nr_pages; i++) {
+		page = req->pages[i];
+		if (rc == -EAGAIN)
+			__set_page_dirty_nobuffers(page);
+		else if (rc) {
+			SetPageError(page);
+			if (rc == -ENOSPC)
+				set_bit(AS_ENOSPC, &wb->mapping->flags);
+			else
+				set_bit(AS_EIO, &wb->mapping->flags);
+		}
+		end_page_writeback(page);
+		page_cache_release(page);
+	}
+	req->nr_pages = 0;
+}
+
+/* wait for the oldest outstanding write and complete it */
+static int
+cifs_writeback_wait(struct cifs_writeback *wb)
+{
+	struct cifs_writeback_req *req = &wb->reqs[wb->head];
+	unsigned int bytes_written;
+	int rc;
+
+	wb->head = (wb->head + 1) % CIFS_MAX_WRITEBACK_REQS;
+	wb->nr_out--;
+
+	rc = CIFSSMBWriteReceive(wb->xid, wb->tcon, req->mid, &bytes_written,
+				 1);
+	if (rc == 0 && bytes_written < req->count) {
+		cFYI(1,("short write of %d bytes of %d",bytes_written,
+			req->count));
+		rc = -ENOSPC;
+	}
+	if (rc == 0)
+		wb->written += bytes_written;
+	cifs_writeback_end(wb, req, rc);
+	return rc;
+}
+
+/*
+ * Put the batch of pages in the next free slot on the wire.  Only the
+ * first outstanding write may wait for a request slot, as in readpages.
+ */
+static int
+cifs_writeback_send(struct cifs_writeback *wb, struct cifs_writeback_req *req)
+{
+	int rc;
+
+	for (;;) {
+		rc = CIFSSMBWriteSend(wb->xid, wb->tcon, wb->open_file->netfid,
+				req->pages, req->nr_pages, req->count,
+				req->offset, &req->mid, 1, wb->nr_out != 0);
+		if (rc != -EBUSY)
+			break;
+		rc = cifs_writeback_wait(wb);
+		if (rc)
+			break;
+	}
+	if (rc == 0)
+		wb->nr_out++;
+	else
+		cifs_writeback_end(wb, req, rc);
+	return rc;
+}
+
+/*
+ * Gather runs of contiguous dirty pages into writes of up to wsize and
+ * keep up to CIFS_MAX_WRITEBACK_REQS of them outstanding, rather than
+ * writing a page at a time through writepage.  The walk over the dirty
+ * pages follows mpage_writepages, which is also what we fall back to -
+ * writing through cifs_writepage one page at a time - if we have no
+ * usable handle or the handle needs reopening.
+ */
 static int
 cifs_writepages(struct address_space *mapping, struct writeback_control *wbc)
 {
-	int rc = -EFAULT;
+	struct inode *inode = mapping->host;
+	struct cifs_sb_info *cifs_sb = CIFS_SB(inode->i_sb);
+	struct cifs_writeback *wb;
+	struct cifs_writeback_req *req = NULL;
+	struct cifsFileInfo *open_file;
+	struct pagevec pvec;
+	unsigned int max_pages, wsize, i;
+	pgoff_t index, next_index = 0;
+	pgoff_t end = -1;		/* Inclusive */
+	loff_t isize;
+	int scanned = 0;
+	int is_range = 0;
+	int done = 0;
+	int nr_pages;
+	int rc = 0;
 	int xid;
 
+	open_file = find_writable_file(CIFS_I(inode));
+	if((open_file == NULL) || (open_file->invalidHandle))
+		return mpage_writepages(mapping, wbc, NULL);
+
+	wsize = min_t(unsigned int, cifs_sb->wsize, CIFSMaxBufSize);
+	if(!(cifs_sb->tcon->ses->capabilities & CAP_LARGE_WRITE_X))
+		wsize = min_t(unsigned int, wsize,
+			(cifs_sb->tcon->ses->server->maxBuf - MAX_CIFS_HDR_SIZE)
+			 & ~0xFF);
+	max_pages = wsize >> PAGE_CACHE_SHIFT;
+	if(max_pages < 2)
+		return mpage_writepages(mapping, wbc, NULL);
+
+	wb = kmalloc(sizeof(struct cifs_writeback) +
+		     CIFS_MAX_WRITEBACK_REQS * max_pages *
+		     sizeof(struct page *), GFP_NOFS);
+	if(wb == NULL)
+		return mpage_writepages(mapping, wbc, NULL);
+	memset(wb, 0, sizeof(struct cifs_writeback));
+	for (i = 0; i < CIFS_MAX_WRITEBACK_REQS; i++)
+		wb->reqs[i].pages = (struct page **)(wb + 1) + i * max_pages;
 	xid = GetXid();
+	wb->xid = xid;
+	wb->mapping = mapping;
+	wb->tcon = cifs_sb->tcon;
+	wb->open_file = open_file;
+
+	pagevec_init(&pvec, 0);
+	if (wbc->sync_mode == WB_SYNC_NONE) {
+		index = mapping->writeback_index; /* Start from prev offset */
+	} else {
+		index = 0;			  /* whole-file sweep */
+		scanned = 1;
+	}
+	if (wbc->start || wbc->end) {
+		index = wbc->start >> PAGE_CACHE_SHIFT;
+		end = wbc->end >> PAGE_CACHE_SHIFT;
+		is_range = 1;
+		scanned = 1;
+	}
+retry:
+	while (!done && (index <= end) &&
+			(nr_pages = pagevec_lookup_tag(&pvec, mapping, &index,
+			PAGECACHE_TAG_DIRTY,
+			min(end - index, (pgoff_t)PAGEVEC_SIZE-1) + 1))) {
+		scanned = 1;
+		for (i = 0; i < nr_pages && !done; i++) {
+			struct page *page = pvec.pages[i];
+
+			/* a write covers one run of contiguous pages */
+			if (req && ((page->index != next_index) ||
+				    (req->nr_pages == max_pages))) {
+				rc = cifs_writeback_send(wb, req);
+				req = NULL;
+				if (rc)
+					break;
+			}
+
+			lock_page(page);
+
+			if (unlikely(page->mapping != mapping)) {
+				unlock_page(page);
+				continue;
+			}
+
+			if (unlikely(is_range) && page->index > end) {
+				done = 1;
+				unlock_page(page);
+				continue;
+			}
+
+			if (wbc->sync_mode != WB_SYNC_NONE)
+				wait_on_page_writeback(page);
+
+			if (PageWriteback(page) ||
+					!clear_page_dirty_for_io(page)) {
+				unlock_page(page);
+				continue;
+			}
+
+			/* racing with truncate? */
+			isize = i_size_read(inode);
+			if (((loff_t)page->index << PAGE_CACHE_SHIFT) >= isize) {
+				unlock_page(page);
+				continue;
+			}
 
-    /* Find contiguous pages then iterate through repeating */
-/* call 16K write then Setpageuptodate or if LARGE_WRITE_X
-support then send larger writes via kevec so as to eliminate
-a memcpy */
+			if (req == NULL) {
+				if (wb->nr_out == CIFS_MAX_WRITEBACK_REQS) {
+					rc = cifs_writeback_wait(wb);
+					if (rc) {
+						__set_page_dirty_nobuffers(page);
+						unlock_page(page);
+						break;
+					}
+				}
+				req = &wb->reqs[(wb->head + wb->nr_out) %
+						CIFS_MAX_WRITEBACK_REQS];
+				req->offset = (loff_t)page->index <<
+					PAGE_CACHE_SHIFT;
+				req->count = 0;
+				req->nr_pages = 0;
+			}
+
+			set_page_writeback(page);
+			unlock_page(page);
+			page_cache_get(page);
+			req->pages[req->nr_pages++] = page;
+			/* do not extend the file past the last page */
+			req->count = min_t(loff_t,
+				(loff_t)req->nr_pages << PAGE_CACHE_SHIFT,
+				isize - req->offset);
+			next_index = page->index + 1;
+
+			if (--(wbc->nr_to_write) <= 0)
+				done = 1;
+		}
+		pagevec_release(&pvec);
+		if (rc)
+			break;
+		cond_resched();
+	}
+	if (!rc && !scanned && !done) {
+		/*
+		 * We hit the last page and there is more work to be done: wrap
+		 * back to the start of the file
+		 */
+		scanned = 1;
+		index = 0;
+		goto retry;
+	}
+	if (req) {
+		if (rc)
+			cifs_writeback_end(wb, req, -EAGAIN);
+		else
+			rc = cifs_writeback_send(wb, req);
+	}
+	while (wb->nr_out) {
+		int wait_rc = cifs_writeback_wait(wb);
+		if (wait_rc && !rc)
+			rc = wait_rc;
+	}
+	if (!is_range)
+		mapping->writeback_index = index;
+
+	if (wb->written) {
+#ifdef CONFIG_CIFS_STATS
+		atomic_inc(&wb->tcon->num_writes);
+		spin_lock(&wb->tcon->stat_lock);
+		wb->tcon->bytes_written += wb->written;
+		spin_unlock(&wb->tcon->stat_lock);
+#endif
+		inode->i_atime = inode->i_mtime = current_fs_time(inode->i_sb);
+	}
+	kfree(wb);
 	FreeXid(xid);
+
+	/* the handle went stale: let writepage reopen it and finish up */
+	if (rc == -EAGAIN)
+		return mpage_writepages(mapping, wbc, NULL);
 	return rc;
 }
-#endif
 
 static int
 cifs_writepage(struct page* page, struct writeback_control *wbc)
@@ -1294,20 +1590,31 @@ int cifs_file_mmap(struct file * file, struct vm_area_struct * vma)
 }
 
 
+/*
+ * Move the first nr_pages pages off the tail of the readahead list into
+ * the page cache, filling them from the bytes_read bytes at data.  Pages
+ * past the end of the data (a short read, at server EOF) are dropped.
+ */
 static void cifs_copy_cache_pages(struct address_space *mapping, 
-		struct list_head *pages, int bytes_read, 
+		struct list_head *pages, unsigned int nr_pages, int bytes_read, 
 		char *data,struct pagevec * plru_pvec)
 {
 	struct page *page;
 	char * target;
 
-	while (bytes_read > 0) {
+	for (; nr_pages > 0; nr_pages--, bytes_read -= PAGE_CACHE_SIZE,
+	       data += PAGE_CACHE_SIZE) {
 		if(list_empty(pages))
 			break;
 
 		page = list_entry(pages->prev, struct page, lru);
 		list_del(&page->lru);
 
+		if (bytes_read <= 0) {
+			page_cache_release(page);
+			continue;
+		}
+
 		if (add_to_page_cache(page, mapping, page->index, GFP_KERNEL)) {
 			page_cache_release(page);
 			cFYI(1,("Add page cache failed"));
@@ -1320,10 +1627,8 @@ static void cifs_copy_cache_pages(struct address_space *mapping,
 			memcpy(target,data,bytes_read);
 			/* zero the tail end of this partial page */
 			memset(target+bytes_read,0,PAGE_CACHE_SIZE-bytes_read);
-			bytes_read = 0;
 		} else {
 			memcpy(target,data,PAGE_CACHE_SIZE);
-			bytes_read -= PAGE_CACHE_SIZE;
 		}
 		kunmap_atomic(target,KM_USER0);
 
@@ -1332,28 +1637,50 @@ static void cifs_copy_cache_pages(struct address_space *mapping,
 		unlock_page(page);
 		if (!pagevec_add(plru_pvec, page))
 			__pagevec_lru_add(plru_pvec);
-		data += PAGE_CACHE_SIZE;
 	}
 	return;
 }
 
+/* most reads a single readpages call keeps on the wire at once */
+#define CIFS_MAX_READAHEAD_REQS 8
+
+struct cifs_readahead_req {
+	struct mid_q_entry *mid;
+	unsigned int nr_pages;
+	unsigned int read_size;
+};
 
+/*
+ * Read the readahead list in chunks of up to rsize of contiguous pages,
+ * with up to CIFS_MAX_READAHEAD_REQS reads outstanding.  Replies come
+ * back in the order the requests were sent (the list is consumed from
+ * the tail, lowest index first), and each chunk is copied straight from
+ * the receive buffer into its pages.  Only the first outstanding read may
+ * wait for a request slot; the others are sent only if one is free, so we
+ * never sit on slots the server needs to answer us.  Readahead is only a
+ * hint: on error the rest of the list is dropped and readpage will fetch
+ * whatever is actually needed.
+ */
 static int
 cifs_readpages(struct file *file, struct address_space *mapping,
 		struct list_head *page_list, unsigned num_pages)
 {
-	int rc = -EACCES;
+	int rc = 0;
 	int xid;
 	loff_t offset;
 	struct page * page;
+	struct page * next_page;
 	struct cifs_sb_info *cifs_sb;
 	struct cifsTconInfo *pTcon;
-	int bytes_read = 0;
-	unsigned int read_size,i;
+	unsigned int bytes_read = 0;
+	unsigned int max_pages;
 	char * smb_read_data = NULL;
 	struct smb_com_read_rsp * pSMBr;
 	struct pagevec lru_pvec;
 	struct cifsFileInfo * open_file;
+	struct cifs_readahead_req reqs[CIFS_MAX_READAHEAD_REQS];
+	struct cifs_readahead_req *req;
+	unsigned int head = 0, nr_out = 0;
 
 	xid = GetXid();
 	if (file->private_data == NULL) {
@@ -1364,106 +1691,95 @@ cifs_readpages(struct file *file, struct address_space *mapping,
 	cifs_sb = CIFS_SB(file->f_dentry->d_sb);
 	pTcon = cifs_sb->tcon;
 
-	pagevec_init(&lru_pvec, 0);
-
-	for(i = 0;i<num_pages;) {
-		unsigned contig_pages;
-		struct page * tmp_page;
-		unsigned long expected_index;
+	/* Read size needs to be in multiples of one page */
+	max_pages = (cifs_sb->rsize & PAGE_CACHE_MASK) >> PAGE_CACHE_SHIFT;
+	if (max_pages == 0)
+		max_pages = 1;
 
-		if(list_empty(page_list)) {
-			break;
-		}
-		page = list_entry(page_list->prev, struct page, lru);
-		offset = (loff_t)page->index << PAGE_CACHE_SHIFT;
+	pagevec_init(&lru_pvec, 0);
 
-		/* count adjacent pages that we will read into */
-		contig_pages = 0;
-		expected_index = list_entry(page_list->prev,struct page,lru)->index;
-		list_for_each_entry_reverse(tmp_page,page_list,lru) {
-			if(tmp_page->index == expected_index) {
+	/* next_page is the first page for which we have not sent a read */
+	next_page = list_empty(page_list) ? NULL :
+		list_entry(page_list->prev, struct page, lru);
+
+	while (next_page || nr_out) {
+		while (next_page && (nr_out < CIFS_MAX_READAHEAD_REQS)) {
+			unsigned long expected_index;
+			unsigned int contig_pages = 0;
+			struct page * tmp_page = next_page;
+
+			/* count adjacent pages that we will read into */
+			expected_index = next_page->index;
+			while ((contig_pages < max_pages) &&
+			       (&tmp_page->lru != page_list) &&
+			       (tmp_page->index == expected_index)) {
 				contig_pages++;
 				expected_index++;
-			} else {
-				break; 
+				tmp_page = list_entry(tmp_page->lru.prev,
+						      struct page, lru);
 			}
-		}
-		if(contig_pages + i >  num_pages) {
-			contig_pages = num_pages - i;
-		}
-
-		/* for reads over a certain size could initiate async read ahead */
 
-		read_size = contig_pages * PAGE_CACHE_SIZE;
-		/* Read size needs to be in multiples of one page */
-		read_size = min_t(const unsigned int,read_size,cifs_sb->rsize & PAGE_CACHE_MASK);
+			offset = (loff_t)next_page->index << PAGE_CACHE_SHIFT;
+			req = &reqs[(head + nr_out) % CIFS_MAX_READAHEAD_REQS];
+			req->nr_pages = contig_pages;
+			req->read_size = contig_pages * PAGE_CACHE_SIZE;
 
-		rc = -EAGAIN;
-		while(rc == -EAGAIN) {
-			if ((open_file->invalidHandle) && (!open_file->closePend)) {
+			if ((open_file->invalidHandle) && (nr_out == 0) &&
+			    (!open_file->closePend)) {
 				rc = cifs_reopen_file(file->f_dentry->d_inode,
 					file, TRUE);
 				if(rc != 0)
 					break;
 			}
 
-			rc = CIFSSMBRead(xid, pTcon,
-				open_file->netfid,
-				read_size, offset,
-				&bytes_read, &smb_read_data);
-			/* BB need to check return code here */
-			if(rc== -EAGAIN) {
-				if(smb_read_data) {
-					cifs_buf_release(smb_read_data);
-					smb_read_data = NULL;
-				}
-			}
+			rc = CIFSSMBReadSend(xid, pTcon, open_file->netfid,
+				req->read_size, offset, &req->mid,
+				nr_out != 0);
+			if (rc == -EAGAIN && nr_out == 0 &&
+			    !open_file->closePend)
+				continue; /* reopen the handle and retry */
+			if (rc)
+				break;
+
+			nr_out++;
+			next_page = (&tmp_page->lru != page_list) ?
+				tmp_page : NULL;
 		}
-		if ((rc < 0) || (smb_read_data == NULL)) {
+		if (rc == -EBUSY || (rc == -EAGAIN && nr_out))
+			rc = 0; /* collect replies, then send more */
+		if (rc) {
 			cFYI(1,("Read error in readpages: %d",rc));
-			/* clean up remaing pages off list */
-			while (!list_empty(page_list) && (i < num_pages)) {
-				page = list_entry(page_list->prev, struct page, lru);
-				list_del(&page->lru);
-				page_cache_release(page);
-			}
+			next_page = NULL;
+		}
+		if (nr_out == 0)
 			break;
-		} else if (bytes_read > 0) {
+
+		req = &reqs[head];
+		head = (head + 1) % CIFS_MAX_READAHEAD_REQS;
+		nr_out--;
+
+		rc = CIFSSMBReadReceive(xid, pTcon, req->mid, req->read_size,
+					&bytes_read, &smb_read_data);
+		if (rc == 0 && bytes_read > 0) {
 			pSMBr = (struct smb_com_read_rsp *)smb_read_data;
-			cifs_copy_cache_pages(mapping, page_list, bytes_read,
+			cifs_copy_cache_pages(mapping, page_list,
+				req->nr_pages, bytes_read,
 				smb_read_data + 4 /* RFC1001 hdr */ +
 				le16_to_cpu(pSMBr->DataOffset), &lru_pvec);
-
-			i +=  bytes_read >> PAGE_CACHE_SHIFT;
 #ifdef CONFIG_CIFS_STATS
 			atomic_inc(&pTcon->num_reads);
 			spin_lock(&pTcon->stat_lock);
 			pTcon->bytes_read += bytes_read;
 			spin_unlock(&pTcon->stat_lock);
 #endif
-			if((int)(bytes_read & PAGE_CACHE_MASK) != bytes_read) {
-				i++; /* account for partial page */
-
-				/* server copy of file can have smaller size than client */
-				/* BB do we need to verify this common case ? this case is ok - 
-				if we are at server EOF we will hit it on next read */
-
-			/* while(!list_empty(page_list) && (i < num_pages)) {
-					page = list_entry(page_list->prev,struct page, list);
-					list_del(&page->list);
-					page_cache_release(page);
-				}
-				break; */
-			}
 		} else {
-			cFYI(1,("No bytes read (%d) at offset %lld . Cleaning remaining pages from readahead list",bytes_read,offset)); 
-			/* BB turn off caching and do new lookup on file size at server? */
-			while (!list_empty(page_list) && (i < num_pages)) {
-				page = list_entry(page_list->prev, struct page, lru);
-				list_del(&page->lru);
-				page_cache_release(page); /* BB removeme - replace with zero of page? */
-			}
-			break;
+			/* error, or nothing at all at this offset (server
+			   EOF) - no point in asking for anything beyond */
+			cFYI(1,("Read error (%d) or no bytes read (%d) in readpages",
+				rc, bytes_read));
+			cifs_copy_cache_pages(mapping, page_list,
+				req->nr_pages, 0, NULL, &lru_pvec);
+			next_page = NULL;
 		}
 		if(smb_read_data) {
 			cifs_buf_release(smb_read_data);
@@ -1472,13 +1788,14 @@ cifs_readpages(struct file *file, struct address_space *mapping,
 		bytes_read = 0;
 	}
 
-	pagevec_lru_add(&lru_pvec);
+	/* clean up remaining pages off list */
+	while (!list_empty(page_list)) {
+		page = list_entry(page_list->prev, struct page, lru);
+		list_del(&page->lru);
+		page_cache_release(page);
+	}
 
-/* need to free smb_read_data buf before exit */
-	if(smb_read_data) {
-		cifs_buf_release(smb_read_data);
-		smb_read_data = NULL;
-	} 
+	pagevec_lru_add(&lru_pvec);
 
 	FreeXid(xid);
 	return rc;
@@ -1623,6 +1940,7 @@ struct address_space_operations cifs_addr_ops = {
 	.readpage = cifs_readpage,
 	.readpages = cifs_readpages,
 	.writepage = cifs_writepage,
+	.writepages = cifs_writepages,
 	.prepare_write = cifs_prepare_write, 
 	.commit_write = cifs_commit_write,
 	.set_page_dirty = __set_page_dirty_nobuffers,
@@ -377,14 +377,80 @@ cifs_out_label:
 
 #endif /* CIFS_EXPERIMENTAL */
 
+/*
+ * Take a slot for a request on the wire to this server, waiting for one
+ * to free up unless nowait is set, in which case -EBUSY is returned.  We
+ * never have more than cifs_max_pending requests outstanding, nor more
+ * than the server said it would take (MaxMpxCount) in its negprot reply.
+ */
+static int
+wait_for_free_request(struct cifsSesInfo *ses, const int long_op,
+		      const int nowait)
+{
+	unsigned int max_pending = cifs_max_pending;
+
+	if((ses->server->maxReq > 1) && (ses->server->maxReq < max_pending))
+		max_pending = ses->server->maxReq;
+
+	if(long_op == -1) {
+		/* oplock breaks must not be held up */
+		atomic_inc(&ses->server->inFlight);
+		return 0;
+	}
+
+	spin_lock(&GlobalMid_Lock); 
+	while(1) {        
+		if(atomic_read(&ses->server->inFlight) >= max_pending){
+			spin_unlock(&GlobalMid_Lock);
+			if(nowait)
+				return -EBUSY;
+			wait_event(ses->server->request_q,
+				atomic_read(&ses->server->inFlight)
+				 < max_pending);
+			spin_lock(&GlobalMid_Lock);
+		} else {
+			if(ses->server->tcpStatus == CifsExiting) {
+				spin_unlock(&GlobalMid_Lock);
+				return -ENOENT;
+			}
+
+		/* can not count locking commands against total since
+		   they are allowed to block on server */
+				
+			if(long_op < 3) {
+			/* update # of requests on the wire to server */
+				atomic_inc(&ses->server->inFlight);
+			}
+			spin_unlock(&GlobalMid_Lock);
+			return 0;
+		}
+	}
+}
+
+static void
+release_request(struct cifsSesInfo *ses, const int long_op)
+{
+	/* If not lock req, update # of requests on wire to server */
+	if(long_op < 3) {
+		atomic_dec(&ses->server->inFlight); 
+		wake_up(&ses->server->request_q);
+	}
+}
+
+/*
+ * Sign and send in_buf without waiting for the response.  On success
+ * *pmid is the queued mid, which holds a request slot until it is handed
+ * to ReceiveForMid; in_buf may be freed as soon as we return.  With
+ * nowait set we give up with -EBUSY rather than wait for a free slot,
+ * so that a caller that already has requests outstanding cannot end up
+ * waiting on itself.
+ */
 int
-SendReceive(const unsigned int xid, struct cifsSesInfo *ses,
-	    struct smb_hdr *in_buf, struct smb_hdr *out_buf,
-	    int *pbytes_returned, const int long_op)
+SendNoWait(const unsigned int xid, struct cifsSesInfo *ses,
+	   struct smb_hdr *in_buf, struct mid_q_entry **pmid,
+	   const int long_op, const int nowait)
 {
 	int rc = 0;
-	unsigned int receive_len;
-	unsigned long timeout;
 	struct mid_q_entry *midQ;
 
 	if (ses == NULL) {
@@ -396,39 +462,10 @@ SendReceive(const unsigned int xid, struct cifsSesInfo *ses,
 		return -EIO;
 	}
 
-	/* Ensure that we do not send more than 50 overlapping requests 
-	   to the same server. We may make this configurable later or
-	   use ses->maxReq */
-	if(long_op == -1) {
-		/* oplock breaks must not be held up */
-		atomic_inc(&ses->server->inFlight);
-	} else {
-		spin_lock(&GlobalMid_Lock); 
-		while(1) {        
-			if(atomic_read(&ses->server->inFlight) >= cifs_max_pending){
-				spin_unlock(&GlobalMid_Lock);
-				wait_event(ses->server->request_q,
-					atomic_read(&ses->server->inFlight)
-					 < cifs_max_pending);
-				spin_lock(&GlobalMid_Lock);
-			} else {
-				if(ses->server->tcpStatus == CifsExiting) {
-					spin_unlock(&GlobalMid_Lock);
-					return -ENOENT;
-				}
+	rc = wait_for_free_request(ses, long_op, nowait);
+	if(rc)
+		return rc;
 
-			/* can not count locking commands against total since
-			   they are allowed to block on server */
-					
-				if(long_op < 3) {
-				/* update # of requests on the wire to server */
-					atomic_inc(&ses->server->inFlight);
-				}
-				spin_unlock(&GlobalMid_Lock);
-				break;
-			}
-		}
-	}
 	/* make sure that we sign in the same order that we send on this socket 
 	   and avoid races inside tcp sendmsg code that could cause corruption
 	   of smb data */
@@ -452,27 +489,17 @@ SendReceive(const unsigned int xid, struct cifsSesInfo *ses,
 	}
 	midQ = AllocMidQEntry(in_buf, ses);
 	if (midQ == NULL) {
-		up(&ses->server->tcpSem);
-		/* If not lock req, update # of requests on wire to server */
-		if(long_op < 3) {
-			atomic_dec(&ses->server->inFlight); 
-			wake_up(&ses->server->request_q);
-		}
-		return -ENOMEM;
+		rc = -ENOMEM;
+		goto out_unlock;
 	}
 
 	if (in_buf->smb_buf_length > CIFSMaxBufSize + MAX_CIFS_HDR_SIZE - 4) {
-		up(&ses->server->tcpSem);
 		cERROR(1,
 		       ("Illegal length, greater than maximum frame, %d ",
 			in_buf->smb_buf_length));
 		DeleteMidQEntry(midQ);
-		/* If not lock req, update # of requests on wire to server */
-		if(long_op < 3) {
-			atomic_dec(&ses->server->inFlight); 
-			wake_up(&ses->server->request_q);
-		}
-		return -EIO;
+		rc = -EIO;
+		goto out_unlock;
 	}
 
 	rc = cifs_sign_smb(in_buf, ses, &midQ->sequence_number);
@@ -482,15 +509,39 @@ SendReceive(const unsigned int xid, struct cifsSesInfo *ses,
 		      (struct sockaddr *) &(ses->server->addr.sockAddr));
 	if(rc < 0) {
 		DeleteMidQEntry(midQ);
-		up(&ses->server->tcpSem);
-		/* If not lock req, update # of requests on wire to server */
-		if(long_op < 3) {
-			atomic_dec(&ses->server->inFlight); 
-			wake_up(&ses->server->request_q);
-		}
-		return rc;
-	} else
-		up(&ses->server->tcpSem);
+		goto out_unlock;
+	}
+	up(&ses->server->tcpSem);
+	*pmid = midQ;
+	return 0;
+
+out_unlock:
+	up(&ses->server->tcpSem);
+	release_request(ses, long_op);
+	return rc;
+}
+
+/*
+ * Wait for the response to a request sent with SendNoWait and pass the
+ * receive buffer itself back in *presp rather than copying it: the RFC1001
+ * length is converted to host order (and excludes those four bytes, as
+ * usual), the ByteCount is converted and the signature checked.  The
+ * caller frees *presp with cifs_buf_release whenever it is set, even if
+ * an error (e.g. the SMB status mapped to an errno) is returned.  The mid
+ * and its request slot are released in all cases.
+ */
+int
+ReceiveForMid(const unsigned int xid, struct cifsSesInfo *ses,
+	      struct mid_q_entry *midQ, struct smb_hdr **presp,
+	      const int long_op)
+{
+	int rc = 0;
+	unsigned int receive_len;
+	unsigned long timeout;
+	struct smb_hdr *resp;
+
+	*presp = NULL;
+
 	if (long_op == -1)
 		goto cifs_no_response_exit;
 	else if (long_op == 2) /* writes past end of file can take looooong time */
@@ -549,13 +600,7 @@ SendReceive(const unsigned int xid, struct cifsSesInfo *ses,
 			}
 		}
 		spin_unlock(&GlobalMid_Lock);
-		DeleteMidQEntry(midQ);
-		/* If not lock req, update # of requests on wire to server */
-		if(long_op < 3) {
-			atomic_dec(&ses->server->inFlight); 
-			wake_up(&ses->server->request_q);
-		}
-		return rc;
+		goto cifs_no_response_exit;
 	}
   
 	if (receive_len > CIFSMaxBufSize + MAX_CIFS_HDR_SIZE) {
@@ -563,56 +608,65 @@ SendReceive(const unsigned int xid, struct cifsSesInfo *ses,
 		       ("Frame too large received.  Length: %d  Xid: %d",
 			receive_len, xid));
 		rc = -EIO;
-	} else {		/* rcvd frame is ok */
-
-		if (midQ->resp_buf && out_buf
-		    && (midQ->midState == MID_RESPONSE_RECEIVED)) {
-			out_buf->smb_buf_length = receive_len;
-			memcpy((char *)out_buf + 4,
-			       (char *)midQ->resp_buf + 4,
-			       receive_len);
-
-			dump_smb(out_buf, 92);
-			/* convert the length into a more usable form */
-			if((receive_len > 24) &&
-			   (ses->server->secMode & (SECMODE_SIGN_REQUIRED | SECMODE_SIGN_ENABLED))) {
-				rc = cifs_verify_signature(out_buf, ses->mac_signing_key,midQ->sequence_number); /* BB fix BB */
-				if(rc)
-					cFYI(1,("Unexpected signature received from server"));
-			}
-
-			*pbytes_returned = out_buf->smb_buf_length;
+	} else if (midQ->midState == MID_RESPONSE_RECEIVED) {
+		/* rcvd frame is ok - take it over from the mid */
+		resp = midQ->resp_buf;
+		midQ->resp_buf = NULL;
+		resp->smb_buf_length = receive_len;
+
+		dump_smb(resp, 92);
+		/* convert the length into a more usable form */
+		if((receive_len > 24) &&
+		   (ses->server->secMode & (SECMODE_SIGN_REQUIRED | SECMODE_SIGN_ENABLED))) {
+			rc = cifs_verify_signature(resp, ses->mac_signing_key,midQ->sequence_number); /* BB fix BB */
+			if(rc)
+				cFYI(1,("Unexpected signature received from server"));
+		}
 
-			/* BB special case reconnect tid and reconnect uid here? */
-			rc = map_smb_to_linux_error(out_buf);
+		/* BB special case reconnect tid and reconnect uid here? */
+		rc = map_smb_to_linux_error(resp);
 
-			/* convert ByteCount if necessary */
-			if (receive_len >=
-			    sizeof (struct smb_hdr) -
-			    4 /* do not count RFC1001 header */  +
-			    (2 * out_buf->WordCount) + 2 /* bcc */ )
-				BCC(out_buf) = le16_to_cpu(BCC(out_buf));
-		} else {
-			rc = -EIO;
-			cFYI(1,("Bad MID state? "));
-		}
+		/* convert ByteCount if necessary */
+		if (receive_len >=
+		    sizeof (struct smb_hdr) -
+		    4 /* do not count RFC1001 header */  +
+		    (2 * resp->WordCount) + 2 /* bcc */ )
+			BCC(resp) = le16_to_cpu(BCC(resp));
+		*presp = resp;
+	} else {
+		rc = -EIO;
+		cFYI(1,("Bad MID state? "));
 	}
 cifs_no_response_exit:
 	DeleteMidQEntry(midQ);
-
-	if(long_op < 3) {
-		atomic_dec(&ses->server->inFlight); 
-		wake_up(&ses->server->request_q);
-	}
+	release_request(ses, long_op);
 
 	return rc;
+}
 
-out_unlock:
-	up(&ses->server->tcpSem);
-	/* If not lock req, update # of requests on wire to server */
-	if(long_op < 3) {
-		atomic_dec(&ses->server->inFlight); 
-		wake_up(&ses->server->request_q);
+int
+SendReceive(const unsigned int xid, struct cifsSesInfo *ses,
+	    struct smb_hdr *in_buf, struct smb_hdr *out_buf,
+	    int *pbytes_returned, const int long_op)
+{
+	int rc;
+	struct mid_q_entry *midQ;
+	struct smb_hdr *resp;
+
+	rc = SendNoWait(xid, ses, in_buf, &midQ, long_op, 0);
+	if(rc)
+		return rc;
+
+	rc = ReceiveForMid(xid, ses, midQ, &resp, long_op);
+	if(resp) {
+		if(out_buf) {
+			memcpy(out_buf, resp, resp->smb_buf_length + 4);
+			*pbytes_returned = out_buf->smb_buf_length;
+		} else {
+			rc = -EIO;
+			cFYI(1,("Bad MID state? "));
+		}
+		cifs_buf_release(resp);
 	}
 
 	return rc;
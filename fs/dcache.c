@@ -27,11 +27,13 @@
 #include <linux/module.h>
 #include <linux/mount.h>
 #include <linux/file.h>
+#include <linux/fsnotify.h>
 #include <asm/uaccess.h>
 #include <linux/security.h>
 #include <linux/seqlock.h>
 #include <linux/swap.h>
 #include <linux/bootmem.h>
+#include <linux/sysctl.h>
 
 /* #define DCACHE_DEBUG 1 */
 
@@ -60,7 +62,6 @@ static kmem_cache_t *dentry_cache;
 static unsigned int d_hash_mask;
 static unsigned int d_hash_shift;
 static struct hlist_head *dentry_hashtable;
-static LIST_HEAD(dentry_unused);
 
 /* Statistics gathering. */
 struct dentry_stat_t dentry_stat = {
@@ -95,11 +96,17 @@ static void d_free(struct dentry *dentry)
 static inline void dentry_iput(struct dentry * dentry)
 {
 	struct inode *inode = dentry->d_inode;
+
+	/* Whatever happens to it next, RCU walkers must let go */
+	write_seqcount_begin(&dentry->d_seq);
+	dentry->d_inode = NULL;
+	write_seqcount_end(&dentry->d_seq);
 	if (inode) {
-		dentry->d_inode = NULL;
 		list_del_init(&dentry->d_alias);
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
+		if (!inode->i_nlink)
+			fsnotify_inoderemove(inode);
 		if (dentry->d_op && dentry->d_op->d_iput)
 			dentry->d_op->d_iput(dentry, inode);
 		else
@@ -110,6 +117,40 @@ static inline void dentry_iput(struct dentry * dentry)
 	}
 }
 
+/*
+ * Unused dentries are kept on the s_dentry_lru of their superblock, under
+ * its s_dentry_lru_lock.  That nests inside d_lock, so dput() can put a
+ * dentry on the LRU without dcache_lock; whoever walks the LRU has to
+ * trylock the dentries on it.
+ */
+static void dentry_lru_add(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	if (list_empty(&dentry->d_lru)) {
+		dentry->d_flags |= DCACHE_REFERENCED;
+		list_add(&dentry->d_lru, &sb->s_dentry_lru);
+		sb->s_nr_dentry_unused++;
+	}
+	spin_unlock(&sb->s_dentry_lru_lock);
+}
+
+static void dentry_lru_del(struct dentry *dentry)
+{
+	struct super_block *sb;
+
+	if (list_empty(&dentry->d_lru))
+		return;
+	sb = dentry->d_sb;
+	spin_lock(&sb->s_dentry_lru_lock);
+	if (!list_empty(&dentry->d_lru)) {
+		list_del_init(&dentry->d_lru);
+		sb->s_nr_dentry_unused--;
+	}
+	spin_unlock(&sb->s_dentry_lru_lock);
+}
+
 /* 
  * This is dput
  *
@@ -147,6 +188,25 @@ void dput(struct dentry *dentry)
 repeat:
 	if (atomic_read(&dentry->d_count) == 1)
 		might_sleep();
+	if (!atomic_dec_and_lock(&dentry->d_count, &dentry->d_lock))
+		return;
+
+	/*
+	 * The common case: the dentry stays cached, and d_lock is all
+	 * it takes to put it on the LRU.
+	 */
+	if (!(dentry->d_op && dentry->d_op->d_delete) && !d_unhashed(dentry)) {
+		dentry_lru_add(dentry);
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+
+	/*
+	 * Anything else needs dcache_lock, which nests outside d_lock:
+	 * take our reference back and drop it again the slow way.
+	 */
+	atomic_inc(&dentry->d_count);
+	spin_unlock(&dentry->d_lock);
 	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
 		return;
 
@@ -167,11 +227,7 @@ repeat:
 	/* Unreachable? Get rid of it */
  	if (d_unhashed(dentry))
 		goto kill_it;
-  	if (list_empty(&dentry->d_lru)) {
-  		dentry->d_flags |= DCACHE_REFERENCED;
-  		list_add(&dentry->d_lru, &dentry_unused);
-  		dentry_stat.nr_unused++;
-  	}
+	dentry_lru_add(dentry);
  	spin_unlock(&dentry->d_lock);
 	spin_unlock(&dcache_lock);
 	return;
@@ -185,10 +241,7 @@ kill_it: {
 		/* If dentry was on d_lru list
 		 * delete it from there
 		 */
-  		if (!list_empty(&dentry->d_lru)) {
-  			list_del(&dentry->d_lru);
-  			dentry_stat.nr_unused--;
-  		}
+		dentry_lru_del(dentry);
   		list_del(&dentry->d_child);
 		dentry_stat.nr_dentry--;	/* For d_free, below */
 		/*drops the locks, at that point nobody can reach this dentry */
@@ -264,10 +317,7 @@ int d_invalidate(struct dentry * dentry)
 static inline struct dentry * __dget_locked(struct dentry *dentry)
 {
 	atomic_inc(&dentry->d_count);
-	if (!list_empty(&dentry->d_lru)) {
-		dentry_stat.nr_unused--;
-		list_del_init(&dentry->d_lru);
-	}
+	dentry_lru_del(dentry);
 	return dentry;
 }
 
@@ -375,20 +425,10 @@ static inline void prune_one_dentry(struct dentry * dentry)
 	spin_lock(&dcache_lock);
 }
 
-/**
- * prune_dcache - shrink the dcache
- * @count: number of entries to try and free
- *
- * Shrink the dcache. This is done when we need
- * more memory, or simply when we need to unmount
- * something (at which point we need to unuse
- * all dentries).
- *
- * This function may fail to free any resources if
- * all the dentries are in use.
+/*
+ * Free up to @count unused dentries of @sb, from the cold end of its LRU.
  */
- 
-static void prune_dcache(int count)
+static void prune_dcache_sb(struct super_block *sb, int count)
 {
 	spin_lock(&dcache_lock);
 	for (; count ; count--) {
@@ -397,49 +437,106 @@ static void prune_dcache(int count)
 
 		cond_resched_lock(&dcache_lock);
 
-		tmp = dentry_unused.prev;
-		if (tmp == &dentry_unused)
+		spin_lock(&sb->s_dentry_lru_lock);
+		tmp = sb->s_dentry_lru.prev;
+		if (tmp == &sb->s_dentry_lru) {
+			spin_unlock(&sb->s_dentry_lru_lock);
 			break;
-		list_del_init(tmp);
-		prefetch(dentry_unused.prev);
- 		dentry_stat.nr_unused--;
+		}
 		dentry = list_entry(tmp, struct dentry, d_lru);
+		if (!spin_trylock(&dentry->d_lock)) {
+			/* Busy in dput(): look at it again later */
+			list_move(tmp, &sb->s_dentry_lru);
+			spin_unlock(&sb->s_dentry_lru_lock);
+			continue;
+		}
+		list_del_init(tmp);
+		prefetch(sb->s_dentry_lru.prev);
+		sb->s_nr_dentry_unused--;
 
- 		spin_lock(&dentry->d_lock);
 		/*
 		 * We found an inuse dentry which was not removed from
-		 * dentry_unused because of laziness during lookup.  Do not free
-		 * it - just keep it off the dentry_unused list.
+		 * the LRU because of laziness during lookup.  Do not free
+		 * it - just keep it off the LRU.
 		 */
  		if (atomic_read(&dentry->d_count)) {
+			spin_unlock(&sb->s_dentry_lru_lock);
  			spin_unlock(&dentry->d_lock);
 			continue;
 		}
 		/* If the dentry was recently referenced, don't free it. */
 		if (dentry->d_flags & DCACHE_REFERENCED) {
 			dentry->d_flags &= ~DCACHE_REFERENCED;
- 			list_add(&dentry->d_lru, &dentry_unused);
- 			dentry_stat.nr_unused++;
+ 			list_add(&dentry->d_lru, &sb->s_dentry_lru);
+ 			sb->s_nr_dentry_unused++;
+			spin_unlock(&sb->s_dentry_lru_lock);
  			spin_unlock(&dentry->d_lock);
 			continue;
 		}
+		spin_unlock(&sb->s_dentry_lru_lock);
 		prune_one_dentry(dentry);
 	}
 	spin_unlock(&dcache_lock);
 }
 
-/*
- * Shrink the dcache for the specified super block.
- * This allows us to unmount a device without disturbing
- * the dcache for the other devices.
+static int nr_dentry_unused(void)
+{
+	struct super_block *sb;
+	int unused = 0;
+
+	spin_lock(&sb_lock);
+	list_for_each_entry(sb, &super_blocks, s_list)
+		unused += sb->s_nr_dentry_unused;
+	spin_unlock(&sb_lock);
+	return unused;
+}
+
+/**
+ * prune_dcache - shrink the dcache
+ * @count: number of entries to try and free
  *
- * This implementation makes just two traversals of the
- * unused list.  On the first pass we move the selected
- * dentries to the most recent end, and on the second
- * pass we free them.  The second pass must restart after
- * each dput(), but since the target dentries are all at
- * the end, it's really just a single traversal.
+ * Shrink the dcache when we need more memory.  Each superblock gives
+ * up its share of @count, in proportion to its unused dentries.
+ * Superblocks being mounted or unmounted are left alone.
+ *
+ * This function may fail to free any resources if
+ * all the dentries are in use.
  */
+ 
+static void prune_dcache(int count)
+{
+	struct super_block *sb;
+	int unused = nr_dentry_unused();
+	int ratio;
+
+	if (!unused || !count)
+		return;
+	ratio = count >= unused ? 1 : unused / count;
+
+	spin_lock(&sb_lock);
+restart:
+	list_for_each_entry(sb, &super_blocks, s_list) {
+		int nr;
+
+		if (!sb->s_nr_dentry_unused)
+			continue;
+		nr = sb->s_nr_dentry_unused / ratio + 1;
+		sb->s_count++;
+		spin_unlock(&sb_lock);
+		if (down_read_trylock(&sb->s_umount)) {
+			if (sb->s_root)
+				prune_dcache_sb(sb, nr);
+			up_read(&sb->s_umount);
+		}
+		spin_lock(&sb_lock);
+		count -= nr;
+		if (__put_super_and_need_restart(sb) && count > 0)
+			goto restart;
+		if (count <= 0)
+			break;
+	}
+	spin_unlock(&sb_lock);
+}
 
 /**
  * shrink_dcache_sb - shrink dcache for a superblock
@@ -452,46 +549,28 @@ static void prune_dcache(int count)
 
 void shrink_dcache_sb(struct super_block * sb)
 {
-	struct list_head *tmp, *next;
 	struct dentry *dentry;
 
-	/*
-	 * Pass one ... move the dentries for the specified
-	 * superblock to the most recent end of the unused list.
-	 */
 	spin_lock(&dcache_lock);
-	next = dentry_unused.next;
-	while (next != &dentry_unused) {
-		tmp = next;
-		next = tmp->next;
-		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
-		list_del(tmp);
-		list_add(tmp, &dentry_unused);
-	}
-
-	/*
-	 * Pass two ... free the dentries for this superblock.
-	 */
-repeat:
-	next = dentry_unused.next;
-	while (next != &dentry_unused) {
-		tmp = next;
-		next = tmp->next;
-		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
-		dentry_stat.nr_unused--;
-		list_del_init(tmp);
-		spin_lock(&dentry->d_lock);
-		if (atomic_read(&dentry->d_count)) {
-			spin_unlock(&dentry->d_lock);
+	spin_lock(&sb->s_dentry_lru_lock);
+	while (!list_empty(&sb->s_dentry_lru)) {
+		dentry = list_entry(sb->s_dentry_lru.prev, struct dentry, d_lru);
+		if (!spin_trylock(&dentry->d_lock)) {
+			spin_unlock(&sb->s_dentry_lru_lock);
+			cpu_relax();
+			spin_lock(&sb->s_dentry_lru_lock);
 			continue;
 		}
-		prune_one_dentry(dentry);
-		goto repeat;
+		list_del_init(&dentry->d_lru);
+		sb->s_nr_dentry_unused--;
+		spin_unlock(&sb->s_dentry_lru_lock);
+		if (atomic_read(&dentry->d_count))
+			spin_unlock(&dentry->d_lock);
+		else
+			prune_one_dentry(dentry);
+		spin_lock(&sb->s_dentry_lru_lock);
 	}
+	spin_unlock(&sb->s_dentry_lru_lock);
 	spin_unlock(&dcache_lock);
 }
 
@@ -550,7 +629,7 @@ positive:
 /*
  * Search the dentry child list for the specified parent,
  * and move any unused dentries to the end of the unused
- * list for prune_dcache(). We descend to the next level
+ * list for prune_dcache_sb(). We descend to the next level
  * whenever the d_subdirs list is non-empty and continue
  * searching.
  *
@@ -565,9 +644,11 @@ static int select_parent(struct dentry * parent)
 {
 	struct dentry *this_parent = parent;
 	struct list_head *next;
+	struct super_block *sb = parent->d_sb;
 	int found = 0;
 
 	spin_lock(&dcache_lock);
+	spin_lock(&sb->s_dentry_lru_lock);
 repeat:
 	next = this_parent->d_subdirs.next;
 resume:
@@ -577,16 +658,16 @@ resume:
 		next = tmp->next;
 
 		if (!list_empty(&dentry->d_lru)) {
-			dentry_stat.nr_unused--;
+			sb->s_nr_dentry_unused--;
 			list_del_init(&dentry->d_lru);
 		}
 		/* 
 		 * move only zero ref count dentries to the end 
-		 * of the unused list for prune_dcache
+		 * of the unused list for prune_dcache_sb
 		 */
 		if (!atomic_read(&dentry->d_count)) {
-			list_add(&dentry->d_lru, dentry_unused.prev);
-			dentry_stat.nr_unused++;
+			list_add_tail(&dentry->d_lru, &sb->s_dentry_lru);
+			sb->s_nr_dentry_unused++;
 			found++;
 		}
 
@@ -623,6 +704,7 @@ this_parent->d_parent->d_name.name, this_parent->d_name.name, found);
 		goto resume;
 	}
 out:
+	spin_unlock(&sb->s_dentry_lru_lock);
 	spin_unlock(&dcache_lock);
 	return found;
 }
@@ -639,12 +721,12 @@ void shrink_dcache_parent(struct dentry * parent)
 	int found;
 
 	while ((found = select_parent(parent)) != 0)
-		prune_dcache(found);
+		prune_dcache_sb(parent->d_sb, found);
 }
 
 /**
  * shrink_dcache_anon - further prune the cache
- * @head: head of d_hash list of dentries to prune
+ * @sb: superblock whose anonymous dentries to prune
  *
  * Prune the dentries that are anonymous
  *
@@ -652,32 +734,34 @@ void shrink_dcache_parent(struct dentry * parent)
  * done under dcache_lock.
  *
  */
-void shrink_dcache_anon(struct hlist_head *head)
+void shrink_dcache_anon(struct super_block *sb)
 {
 	struct hlist_node *lp;
 	int found;
 	do {
 		found = 0;
 		spin_lock(&dcache_lock);
-		hlist_for_each(lp, head) {
+		spin_lock(&sb->s_dentry_lru_lock);
+		hlist_for_each(lp, &sb->s_anon) {
 			struct dentry *this = hlist_entry(lp, struct dentry, d_hash);
 			if (!list_empty(&this->d_lru)) {
-				dentry_stat.nr_unused--;
+				sb->s_nr_dentry_unused--;
 				list_del_init(&this->d_lru);
 			}
 
 			/* 
 			 * move only zero ref count dentries to the end 
-			 * of the unused list for prune_dcache
+			 * of the unused list for prune_dcache_sb
 			 */
 			if (!atomic_read(&this->d_count)) {
-				list_add_tail(&this->d_lru, &dentry_unused);
-				dentry_stat.nr_unused++;
+				list_add_tail(&this->d_lru, &sb->s_dentry_lru);
+				sb->s_nr_dentry_unused++;
 				found++;
 			}
 		}
+		spin_unlock(&sb->s_dentry_lru_lock);
 		spin_unlock(&dcache_lock);
-		prune_dcache(found);
+		prune_dcache_sb(sb, found);
 	} while(found);
 }
 
@@ -700,7 +784,17 @@ static int shrink_dcache_memory(int nr, unsigned int gfp_mask)
 			return -1;
 		prune_dcache(nr);
 	}
-	return (dentry_stat.nr_unused / 100) * sysctl_vfs_cache_pressure;
+	return (nr_dentry_unused() / 100) * sysctl_vfs_cache_pressure;
+}
+
+/*
+ * /proc/sys/fs/dentry-state: nr_unused is kept per superblock.
+ */
+int proc_nr_dentry(ctl_table *table, int write, struct file *filp,
+		   void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	dentry_stat.nr_unused = nr_dentry_unused();
+	return proc_dointvec(table, write, filp, buffer, lenp, ppos);
 }
 
 /**
@@ -741,6 +835,7 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 	atomic_set(&dentry->d_count, 1);
 	dentry->d_flags = DCACHE_UNHASHED;
 	spin_lock_init(&dentry->d_lock);
+	seqcount_init(&dentry->d_seq);
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
 	dentry->d_sb = NULL;
@@ -779,6 +874,18 @@ struct dentry *d_alloc_name(struct dentry *parent, const char *name)
 	return d_alloc(parent, &q);
 }
 
+/*
+ * Set d_inode so that RCU path walk notices.  Called with dcache_lock held.
+ */
+static inline void __d_set_inode(struct dentry *dentry, struct inode *inode)
+{
+	spin_lock(&dentry->d_lock);
+	write_seqcount_begin(&dentry->d_seq);
+	dentry->d_inode = inode;
+	write_seqcount_end(&dentry->d_seq);
+	spin_unlock(&dentry->d_lock);
+}
+
 /**
  * d_instantiate - fill in inode information for a dentry
  * @entry: dentry to complete
@@ -800,7 +907,7 @@ void d_instantiate(struct dentry *entry, struct inode * inode)
 	spin_lock(&dcache_lock);
 	if (inode)
 		list_add(&entry->d_alias, &inode->i_dentry);
-	entry->d_inode = inode;
+	__d_set_inode(entry, inode);
 	spin_unlock(&dcache_lock);
 	security_d_instantiate(entry, inode);
 }
@@ -846,7 +953,7 @@ struct dentry *d_instantiate_unique(struct dentry *entry, struct inode *inode)
 	}
 	list_add(&entry->d_alias, &inode->i_dentry);
 do_negative:
-	entry->d_inode = inode;
+	__d_set_inode(entry, inode);
 	spin_unlock(&dcache_lock);
 	security_d_instantiate(entry, inode);
 	return NULL;
@@ -985,7 +1092,7 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
 		} else {
 			/* d_instantiate takes dcache_lock, so we do it by hand */
 			list_add(&dentry->d_alias, &inode->i_dentry);
-			dentry->d_inode = inode;
+			__d_set_inode(dentry, inode);
 			spin_unlock(&dcache_lock);
 			security_d_instantiate(dentry, inode);
 			d_rehash(dentry);
@@ -1016,7 +1123,7 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
  * rcu_read_lock() and rcu_read_unlock() are used to disable preemption while
  * lookup is going on.
  *
- * dentry_unused list is not updated even if lookup finds the required dentry
+ * LRU is not updated even if lookup finds the required dentry
  * in there. It is updated in places such as prune_dcache, shrink_dcache_sb,
  * select_parent and __dget_locked. This laziness saves lookup from dcache_lock
  * acquisition.
@@ -1100,6 +1207,49 @@ next:
  	return found;
 }
 
+/**
+ * __d_lookup_rcu - search for a dentry without taking a reference
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ * @seqp: returns the d_seq of the dentry found
+ *
+ * __d_lookup() for RCU path walk, called under rcu_read_lock().  Nothing
+ * is locked, so the dentry may change under us: the caller has to check
+ * *@seqp before trusting anything it read from it.  Parents with their own
+ * ->d_compare() are left to __d_lookup().
+ */
+struct dentry * __d_lookup_rcu(struct dentry * parent, struct qstr * name,
+			       unsigned *seqp)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct hlist_head *head = d_hash(parent,hash);
+	struct hlist_node *node;
+
+	hlist_for_each_rcu(node, head) {
+		struct dentry *dentry;
+		unsigned seq;
+
+		dentry = hlist_entry(node, struct dentry, d_hash);
+
+		if (dentry->d_name.hash != hash)
+			continue;
+		seq = read_seqcount_begin(&dentry->d_seq);
+		if (dentry->d_parent != parent)
+			continue;
+		if (d_unhashed(dentry))
+			continue;
+		if (dentry->d_name.len != len)
+			continue;
+		if (memcmp(dentry->d_name.name, str, len))
+			continue;
+		*seqp = seq;
+		return dentry;
+	}
+	return NULL;
+}
+
 /**
  * d_validate - verify dentry provided from insecure source
  * @dentry: The dentry alleged to be valid child of @dparent
@@ -1164,13 +1314,16 @@ out:
  
 void d_delete(struct dentry * dentry)
 {
+	int isdir = 0;
 	/*
 	 * Are we the only user?
 	 */
 	spin_lock(&dcache_lock);
 	spin_lock(&dentry->d_lock);
+	isdir = S_ISDIR(dentry->d_inode->i_mode);
 	if (atomic_read(&dentry->d_count) == 1) {
 		dentry_iput(dentry);
+		fsnotify_nameremove(dentry, isdir);
 		return;
 	}
 
@@ -1179,6 +1332,8 @@ void d_delete(struct dentry * dentry)
 
 	spin_unlock(&dentry->d_lock);
 	spin_unlock(&dcache_lock);
+
+	fsnotify_nameremove(dentry, isdir);
 }
 
 static void __d_rehash(struct dentry * entry, struct hlist_head *list)
@@ -1311,6 +1466,9 @@ already_unhashed:
 	/* Unhash the target: dput() will then get rid of it */
 	__d_drop(target);
 
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&target->d_seq);
+
 	list_del(&dentry->d_child);
 	list_del(&target->d_child);
 
@@ -1332,6 +1490,8 @@ already_unhashed:
 	}
 
 	list_add(&dentry->d_child, &dentry->d_parent->d_subdirs);
+	write_seqcount_end(&target->d_seq);
+	write_seqcount_end(&dentry->d_seq);
 	spin_unlock(&target->d_lock);
 	spin_unlock(&dentry->d_lock);
 	write_sequnlock(&rename_lock);
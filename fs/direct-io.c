@@ -42,6 +42,12 @@
  */
 #define DIO_PAGES	64
 
+/*
+ * A block-aligned request of up to this many user pages has them all pinned
+ * up front, in one array of a page, under a single hold of mmap_sem.
+ */
+#define DIO_MAX_PINNED	(PAGE_SIZE / sizeof(struct page *))
+
 /*
  * This code generally works in units of "dio_blocks".  A dio_block is
  * somewhere between the hard sector size and the filesystem block size.  it
@@ -84,7 +90,6 @@ struct dio {
 	sector_t final_block_in_request;/* doesn't change */
 	unsigned first_block_in_page;	/* doesn't change, Used only once */
 	int boundary;			/* prev block is at a boundary */
-	int reap_counter;		/* rate limit reaping */
 	get_blocks_t *get_blocks;	/* block mapping function */
 	dio_iodone_t *end_io;		/* IO completion function */
 	sector_t final_block_in_bio;	/* current final block in bio + 1 */
@@ -111,18 +116,24 @@ struct dio {
 
 	/*
 	 * Page queue.  These variables belong to dio_refill_pages() and
-	 * dio_get_page().
+	 * dio_get_page().  pages is page_buf, refilled DIO_PAGES at a time,
+	 * or the nr_pinned pages of the whole request, see dio_pin_iovec().
 	 */
-	struct page *pages[DIO_PAGES];	/* page buffer */
+	struct page **pages;		/* page buffer */
+	struct page *page_buf[DIO_PAGES];
+	unsigned nr_pinned;		/* pages pinned by dio_pin_iovec() */
 	unsigned head;			/* next page to process */
 	unsigned tail;			/* last valid page + 1 */
 	int page_errors;		/* errno from get_user_pages() */
 
-	/* BIO completion state */
-	spinlock_t bio_lock;		/* protects BIO fields below */
-	int bio_count;			/* nr bios to be completed */
-	int bios_in_flight;		/* nr bios in flight */
-	struct bio *bio_list;		/* singly linked via bi_private */
+	/*
+	 * BIO completion state.  A completing BIO only decrements bio_count;
+	 * bio_lock is taken by the one taking it to zero, to wake the waiter.
+	 */
+	atomic_t bio_count;		/* nr bios to be completed */
+	int io_error;			/* a bio failed */
+	int wait_for_io;		/* submitter waits for the last bio */
+	spinlock_t bio_lock;		/* protects waiter */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
 
 	/* AIO related stuff */
@@ -147,6 +158,7 @@ static int dio_refill_pages(struct dio *dio)
 	int ret;
 	int nr_pages;
 
+	BUG_ON(dio->pages != dio->page_buf);
 	nr_pages = min(dio->total_pages - dio->curr_page, DIO_PAGES);
 	down_read(&current->mm->mmap_sem);
 	ret = get_user_pages(
@@ -186,6 +198,63 @@ out:
 	return ret;	
 }
 
+/*
+ * Pin the user pages of the whole request with one hold of mmap_sem, rather
+ * than DIO_PAGES at a time, when the request is aligned to the fs blocksize
+ * and small enough.  The pages of each segment follow those of the one
+ * before, and direct_io_worker() moves the head..tail window along them.
+ *
+ * Returns zero with the pages pinned in dio->pages, or non-zero with nothing
+ * pinned, in which case dio_refill_pages() does as usual.
+ */
+static int dio_pin_iovec(struct dio *dio, const struct iovec *iov,
+			 unsigned long nr_segs)
+{
+	struct page **pages;
+	unsigned long user_addr;
+	unsigned nr_pages = 0;
+	int seg, ret = 0;
+
+	if (dio->blkfactor || !dio->pages_in_io ||
+	    dio->pages_in_io > DIO_MAX_PINNED)
+		return 1;
+
+	pages = kmalloc(dio->pages_in_io * sizeof(struct page *), GFP_KERNEL);
+	if (!pages)
+		return 1;
+
+	down_read(&current->mm->mmap_sem);
+	for (seg = 0; seg < nr_segs; seg++) {
+		int seg_pages;
+
+		user_addr = (unsigned long)iov[seg].iov_base;
+		seg_pages = (user_addr + iov[seg].iov_len + PAGE_SIZE - 1) /
+				PAGE_SIZE - user_addr / PAGE_SIZE;
+		if (!seg_pages)
+			continue;
+		ret = get_user_pages(current, current->mm, user_addr,
+				seg_pages, dio->rw == READ, 0,
+				&pages[nr_pages], NULL);
+		if (ret > 0)
+			nr_pages += ret;
+		if (ret != seg_pages)
+			break;
+	}
+	up_read(&current->mm->mmap_sem);
+
+	if (seg < nr_segs) {
+		/* leave a fault to the page at a time path */
+		while (nr_pages)
+			page_cache_release(pages[--nr_pages]);
+		kfree(pages);
+		return 1;
+	}
+
+	dio->pages = pages;
+	dio->nr_pinned = nr_pages;
+	return 0;
+}
+
 /*
  * Get another userspace page.  Returns an ERR_PTR on error.  Pages are
  * buffered inside the dio so that we can call get_user_pages() against a
@@ -221,83 +290,73 @@ static void dio_complete(struct dio *dio, loff_t offset, ssize_t bytes)
 
 /*
  * Called when a BIO has been processed.  If the count goes to zero then IO is
- * complete and we can signal this to the AIO layer.
+ * complete: an async dio is completed to the AIO layer here, otherwise the
+ * submitter is waiting in dio_await_completion() and is woken.
  */
 static void finished_one_bio(struct dio *dio)
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(&dio->bio_lock, flags);
-	if (dio->bio_count == 1) {
-		if (dio->is_async) {
-			/*
-			 * Last reference to the dio is going away.
-			 * Drop spinlock and complete the DIO.
-			 */
-			spin_unlock_irqrestore(&dio->bio_lock, flags);
-			dio_complete(dio, dio->block_in_file << dio->blkbits,
-					dio->result);
-			/* Complete AIO later if falling back to buffered i/o */
-			if (dio->result == dio->size ||
-				((dio->rw == READ) && dio->result)) {
-				aio_complete(dio->iocb, dio->result, 0);
-				kfree(dio);
-				return;
-			} else {
-				/*
-				 * Falling back to buffered
-				 */
-				spin_lock_irqsave(&dio->bio_lock, flags);
-				dio->bio_count--;
-				if (dio->waiter)
-					wake_up_process(dio->waiter);
-				spin_unlock_irqrestore(&dio->bio_lock, flags);
-				return;
-			}
-		}
+	local_irq_save(flags);
+	if (!atomic_dec_and_lock(&dio->bio_count, &dio->bio_lock)) {
+		local_irq_restore(flags);
+		return;
+	}
+
+	if (dio->io_error)
+		dio->result = -EIO;
+
+	if (dio->wait_for_io) {
+		/* The waiter frees the dio once we drop the lock */
+		if (dio->waiter)
+			wake_up_process(dio->waiter);
+		spin_unlock_irqrestore(&dio->bio_lock, flags);
+		return;
 	}
-	dio->bio_count--;
 	spin_unlock_irqrestore(&dio->bio_lock, flags);
+
+	/* Last reference to an async dio is going away */
+	dio_complete(dio, dio->block_in_file << dio->blkbits, dio->result);
+	aio_complete(dio->iocb, dio->result, 0);
+	kfree(dio);
 }
 
-static int dio_bio_complete(struct dio *dio, struct bio *bio);
 /*
- * Asynchronous IO callback. 
+ * Release a completed BIO's pages, and its reference to the dio.
+ *
+ * Reads were dirtied before IO by dio_bio_submit(); bio_check_pages_dirty()
+ * redirties in process context any which were cleaned meanwhile, so this
+ * can run from the BIO completion handler.
  */
-static int dio_bio_end_aio(struct bio *bio, unsigned int bytes_done, int error)
+static void dio_bio_complete(struct dio *dio, struct bio *bio)
 {
-	struct dio *dio = bio->bi_private;
+	struct bio_vec *bvec = bio->bi_io_vec;
+	int page_no;
 
-	if (bio->bi_size)
-		return 1;
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		dio->io_error = 1;
 
-	/* cleanup the bio */
-	dio_bio_complete(dio, bio);
-	return 0;
+	if (dio->rw == READ) {
+		bio_check_pages_dirty(bio);	/* transfers ownership */
+	} else {
+		for (page_no = 0; page_no < bio->bi_vcnt; page_no++)
+			page_cache_release(bvec[page_no].bv_page);
+		bio_put(bio);
+	}
+	finished_one_bio(dio);
 }
 
 /*
- * The BIO completion handler simply queues the BIO up for the process-context
- * handler.
- *
- * During I/O bi_private points at the dio.  After I/O, bi_private is used to
- * implement a singly-linked list of completed BIOs, at dio->bio_list.
+ * The BIO completion handler, for sync and async IO alike.
  */
 static int dio_bio_end_io(struct bio *bio, unsigned int bytes_done, int error)
 {
 	struct dio *dio = bio->bi_private;
-	unsigned long flags;
 
 	if (bio->bi_size)
 		return 1;
 
-	spin_lock_irqsave(&dio->bio_lock, flags);
-	bio->bi_private = dio->bio_list;
-	dio->bio_list = bio;
-	dio->bios_in_flight--;
-	if (dio->waiter && dio->bios_in_flight == 0)
-		wake_up_process(dio->waiter);
-	spin_unlock_irqrestore(&dio->bio_lock, flags);
+	dio_bio_complete(dio, bio);
 	return 0;
 }
 
@@ -313,31 +372,24 @@ dio_bio_alloc(struct dio *dio, struct block_device *bdev,
 
 	bio->bi_bdev = bdev;
 	bio->bi_sector = first_sector;
-	if (dio->is_async)
-		bio->bi_end_io = dio_bio_end_aio;
-	else
-		bio->bi_end_io = dio_bio_end_io;
+	bio->bi_end_io = dio_bio_end_io;
 
 	dio->bio = bio;
 	return 0;
 }
 
 /*
- * In the AIO read case we speculatively dirty the pages before starting IO.
+ * In the read case we speculatively dirty the pages before starting IO.
  * During IO completion, any of these pages which happen to have been written
  * back will be redirtied by bio_check_pages_dirty().
  */
 static void dio_bio_submit(struct dio *dio)
 {
 	struct bio *bio = dio->bio;
-	unsigned long flags;
 
 	bio->bi_private = dio;
-	spin_lock_irqsave(&dio->bio_lock, flags);
-	dio->bio_count++;
-	dio->bios_in_flight++;
-	spin_unlock_irqrestore(&dio->bio_lock, flags);
-	if (dio->is_async && dio->rw == READ)
+	atomic_inc(&dio->bio_count);
+	if (dio->rw == READ)
 		bio_set_pages_dirty(bio);
 	submit_bio(dio->rw, bio);
 
@@ -355,114 +407,24 @@ static void dio_cleanup(struct dio *dio)
 }
 
 /*
- * Wait for the next BIO to complete.  Remove it and return it.
+ * Wait for all in-flight BIOs to complete.  bio_lock keeps the last
+ * completion's wakeup from running after we have freed the dio.
  */
-static struct bio *dio_await_one(struct dio *dio)
+static void dio_await_completion(struct dio *dio)
 {
 	unsigned long flags;
-	struct bio *bio;
 
 	spin_lock_irqsave(&dio->bio_lock, flags);
-	while (dio->bio_list == NULL) {
+	while (atomic_read(&dio->bio_count)) {
 		set_current_state(TASK_UNINTERRUPTIBLE);
-		if (dio->bio_list == NULL) {
-			dio->waiter = current;
-			spin_unlock_irqrestore(&dio->bio_lock, flags);
-			blk_run_address_space(dio->inode->i_mapping);
-			io_schedule();
-			spin_lock_irqsave(&dio->bio_lock, flags);
-			dio->waiter = NULL;
-		}
-		set_current_state(TASK_RUNNING);
+		dio->waiter = current;
+		spin_unlock_irqrestore(&dio->bio_lock, flags);
+		blk_run_address_space(dio->inode->i_mapping);
+		io_schedule();
+		spin_lock_irqsave(&dio->bio_lock, flags);
+		dio->waiter = NULL;
 	}
-	bio = dio->bio_list;
-	dio->bio_list = bio->bi_private;
 	spin_unlock_irqrestore(&dio->bio_lock, flags);
-	return bio;
-}
-
-/*
- * Process one completed BIO.  No locks are held.
- */
-static int dio_bio_complete(struct dio *dio, struct bio *bio)
-{
-	const int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
-	struct bio_vec *bvec = bio->bi_io_vec;
-	int page_no;
-
-	if (!uptodate)
-		dio->result = -EIO;
-
-	if (dio->is_async && dio->rw == READ) {
-		bio_check_pages_dirty(bio);	/* transfers ownership */
-	} else {
-		for (page_no = 0; page_no < bio->bi_vcnt; page_no++) {
-			struct page *page = bvec[page_no].bv_page;
-
-			if (dio->rw == READ && !PageCompound(page))
-				set_page_dirty_lock(page);
-			page_cache_release(page);
-		}
-		bio_put(bio);
-	}
-	finished_one_bio(dio);
-	return uptodate ? 0 : -EIO;
-}
-
-/*
- * Wait on and process all in-flight BIOs.
- */
-static int dio_await_completion(struct dio *dio)
-{
-	int ret = 0;
-
-	if (dio->bio)
-		dio_bio_submit(dio);
-
-	/*
-	 * The bio_lock is not held for the read of bio_count.
-	 * This is ok since it is the dio_bio_complete() that changes
-	 * bio_count.
-	 */
-	while (dio->bio_count) {
-		struct bio *bio = dio_await_one(dio);
-		int ret2;
-
-		ret2 = dio_bio_complete(dio, bio);
-		if (ret == 0)
-			ret = ret2;
-	}
-	return ret;
-}
-
-/*
- * A really large O_DIRECT read or write can generate a lot of BIOs.  So
- * to keep the memory consumption sane we periodically reap any completed BIOs
- * during the BIO generation phase.
- *
- * This also helps to limit the peak amount of pinned userspace memory.
- */
-static int dio_bio_reap(struct dio *dio)
-{
-	int ret = 0;
-
-	if (dio->reap_counter++ >= 64) {
-		while (dio->bio_list) {
-			unsigned long flags;
-			struct bio *bio;
-			int ret2;
-
-			spin_lock_irqsave(&dio->bio_lock, flags);
-			bio = dio->bio_list;
-			dio->bio_list = bio->bi_private;
-			spin_unlock_irqrestore(&dio->bio_lock, flags);
-			ret2 = dio_bio_complete(dio, bio);
-			if (ret == 0)
-				ret = ret2;
-		}
-		dio->reap_counter = 0;
-	}
-	return ret;
 }
 
 /*
@@ -542,15 +504,11 @@ static int dio_new_bio(struct dio *dio, sector_t start_sector)
 	sector_t sector;
 	int ret, nr_pages;
 
-	ret = dio_bio_reap(dio);
-	if (ret)
-		goto out;
 	sector = start_sector << (dio->blkbits - 9);
 	nr_pages = min(dio->pages_in_io, bio_get_nr_vecs(dio->map_bh.b_bdev));
 	BUG_ON(nr_pages <= 0);
 	ret = dio_bio_alloc(dio, dio->map_bh.b_bdev, sector, nr_pages);
 	dio->boundary = 0;
-out:
 	return ret;
 }
 
@@ -941,13 +899,16 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 	dio->cur_page = NULL;
 
 	dio->boundary = 0;
-	dio->reap_counter = 0;
 	dio->get_blocks = get_blocks;
 	dio->end_io = end_io;
 	dio->map_bh.b_private = NULL;
 	dio->final_block_in_bio = -1;
 	dio->next_block_for_io = -1;
 
+	dio->pages = dio->page_buf;
+	dio->nr_pinned = 0;
+	dio->head = 0;
+	dio->tail = 0;
 	dio->page_errors = 0;
 	dio->result = 0;
 	dio->iocb = iocb;
@@ -960,10 +921,10 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 	 * (or synchronous) device could take the count to zero while we're
 	 * still submitting BIOs.
 	 */
-	dio->bio_count = 1;
-	dio->bios_in_flight = 0;
+	atomic_set(&dio->bio_count, 1);
+	dio->io_error = 0;
+	dio->wait_for_io = !dio->is_async;
 	spin_lock_init(&dio->bio_lock);
-	dio->bio_list = NULL;
 	dio->waiter = NULL;
 
 	/*
@@ -982,6 +943,8 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 				- user_addr/PAGE_SIZE);
 	}
 
+	dio_pin_iovec(dio, iov, nr_segs);
+
 	for (seg = 0; seg < nr_segs; seg++) {
 		user_addr = (unsigned long)iov[seg].iov_base;
 		dio->size += bytes = iov[seg].iov_len;
@@ -990,17 +953,27 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 		dio->first_block_in_page = (user_addr & ~PAGE_MASK) >> blkbits;
 		dio->final_block_in_request = dio->block_in_file +
 						(bytes >> blkbits);
-		/* Page fetching state */
-		dio->head = 0;
-		dio->tail = 0;
-		dio->curr_page = 0;
 
-		dio->total_pages = 0;
-		if (user_addr & (PAGE_SIZE-1)) {
-			dio->total_pages++;
-			bytes -= PAGE_SIZE - (user_addr & (PAGE_SIZE - 1));
+		/* Pages of the last segment not used, if it hit EOF */
+		dio_cleanup(dio);
+
+		/* Page fetching state */
+		if (dio->pages != dio->page_buf) {
+			/* this segment's share of the pinned pages */
+			dio->tail += (user_addr + bytes + PAGE_SIZE - 1) /
+					PAGE_SIZE - user_addr / PAGE_SIZE;
+		} else {
+			dio->head = 0;
+			dio->tail = 0;
+			dio->curr_page = 0;
+
+			dio->total_pages = 0;
+			if (user_addr & (PAGE_SIZE-1)) {
+				dio->total_pages++;
+				bytes -= PAGE_SIZE - (user_addr & (PAGE_SIZE - 1));
+			}
+			dio->total_pages += (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
 		}
-		dio->total_pages += (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
 		dio->curr_user_address = user_addr;
 	
 		ret = do_direct_IO(dio);
@@ -1043,6 +1016,12 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 	 * In that case, we need to release all the pages we got hold on.
 	 */
 	dio_cleanup(dio);
+	if (dio->pages != dio->page_buf) {
+		while (dio->nr_pinned > dio->tail)
+			page_cache_release(dio->pages[--dio->nr_pinned]);
+		kfree(dio->pages);
+		dio->pages = dio->page_buf;
+	}
 
 	/*
 	 * All block lookups have been performed. For READ requests
@@ -1060,7 +1039,7 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 		int should_wait = 0;
 
 		if (dio->result < dio->size && rw == WRITE) {
-			dio->waiter = current;
+			dio->wait_for_io = 1;
 			should_wait = 1;
 		}
 		if (ret == 0)
@@ -1068,32 +1047,23 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 		finished_one_bio(dio);		/* This can free the dio */
 		blk_run_address_space(inode->i_mapping);
 		if (should_wait) {
-			unsigned long flags;
 			/*
 			 * Wait for already issued I/O to drain out and
 			 * release its references to user-space pages
 			 * before returning to fallback on buffered I/O
 			 */
-
-			spin_lock_irqsave(&dio->bio_lock, flags);
-			set_current_state(TASK_UNINTERRUPTIBLE);
-			while (dio->bio_count) {
-				spin_unlock_irqrestore(&dio->bio_lock, flags);
-				io_schedule();
-				spin_lock_irqsave(&dio->bio_lock, flags);
-				set_current_state(TASK_UNINTERRUPTIBLE);
-			}
-			spin_unlock_irqrestore(&dio->bio_lock, flags);
-			set_current_state(TASK_RUNNING);
+			dio_await_completion(dio);
+			dio_complete(dio, dio->block_in_file << dio->blkbits,
+					dio->result);
 			kfree(dio);
 		}
 	} else {
 		ssize_t transferred = 0;
 
 		finished_one_bio(dio);
-		ret2 = dio_await_completion(dio);
-		if (ret == 0)
-			ret = ret2;
+		dio_await_completion(dio);
+		if (ret == 0 && dio->io_error)
+			ret = -EIO;
 		if (ret == 0)
 			ret = dio->page_errors;
 		if (dio->result) {
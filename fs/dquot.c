@@ -83,25 +83,37 @@
 #define __DQUOT_PARANOIA
 
 /*
- * There are two quota SMP locks. dq_list_lock protects all lists with quotas
- * and quota formats and also dqstats structure containing statistics about the
- * lists. dq_data_lock protects data from dq_dqb and also mem_dqinfo structures
- * and also guards consistency of dquot->dq_dqb with inode->i_blocks, i_bytes.
- * i_blocks and i_bytes updates itself are guarded by i_lock acquired directly
- * in inode_add_bytes() and inode_sub_bytes().
+ * The quota SMP locks:
+ *  - dq_list_lock protects the inuse list, the free list and the hash of
+ *    dquots, the list of quota formats and the dqstats structure.
+ *  - sb_dqopt(sb)->dq_dirty_lock protects the dirty lists of the dquots of
+ *    the filesystem, so dirtying dquots doesn't touch a global lock.
+ *  - dquot->dq_dqb_lock protects dq_dqb of that dquot.  An operation
+ *    working on the several dquots of an inode takes their locks in the
+ *    order of quota types.
+ *  - dq_data_lock protects the mem_dqinfo structures and serializes
+ *    dquot_transfer(), which locks the dquots of two owners of each type.
+ *  - inode->i_lock guards consistency of dquot->dq_dqb with
+ *    inode->i_blocks, i_bytes, and the pointers from the inode to its
+ *    dquots together with S_NOQUOTA, so that space can be charged
+ *    without dqptr_sem (see below).
+ *  - the lock of a per-CPU space batch (see dquot_fold_space()).
  *
- * The spinlock ordering is hence: dq_data_lock > dq_list_lock > i_lock
+ * The spinlock ordering is hence: i_lock > dq_data_lock > dq_dqb_lock >
+ *   > batch lock, dq_list_lock > dq_dqb_lock, and both i_lock and
+ *   dq_list_lock > dq_dirty_lock.
  *
  * Note that some things (eg. sb pointer, type, id) doesn't change during
  * the life of the dquot structure and so needn't to be protected by a lock
  *
- * Any operation working on dquots via inode pointers must hold dqptr_sem.  If
- * operation is just reading pointers from inode (or not using them at all) the
- * read lock is enough. If pointers are altered function must hold write lock
- * (these locking rules also apply for S_NOQUOTA flag in the inode - note that
- * for altering the flag i_sem is also needed).  If operation is holding
- * reference to dquot in other way (e.g. quotactl ops) it must be guarded by
- * dqonoff_sem.
+ * Any operation working on dquots via inode pointers must hold dqptr_sem
+ * or, when it doesn't sleep, inode->i_lock.  If operation is just reading
+ * pointers from inode (or not using them at all) the read lock is enough. If
+ * pointers are altered function must hold write lock and change them under
+ * i_lock (these locking rules also apply for S_NOQUOTA flag in the inode -
+ * note that for altering the flag i_sem is also needed).  If operation is
+ * holding reference to dquot in other way (e.g. quotactl ops) it must be
+ * guarded by dqonoff_sem.
  * This locking assures that:
  *   a) update/access to dquot pointers in inode is serialized
  *   b) everyone is guarded against invalidate_dquots()
@@ -112,7 +124,7 @@
  * it is being allocated) on the first dqget() and when it is being released on
  * the last dqput(). The allocation and release oparations are serialized by
  * the dq_lock and by checking the use count in dquot_release().  Write
- * operations on dquots don't hold dq_lock as they copy data under dq_data_lock
+ * operations on dquots don't hold dq_lock as they copy data under dq_dqb_lock
  * spinlock to internal buffers before writing.
  *
  * Lock ordering (including related VFS locks) is the following:
@@ -208,6 +220,8 @@ static struct hlist_head *dquot_hash;
 struct dqstats dqstats;
 
 static void dqput(struct dquot *dquot);
+static void dquot_fold_space(struct dquot *dquot);
+static void dquot_allow_batch(struct dquot *dquot);
 
 static inline unsigned int
 hashfn(const struct super_block *sb, unsigned int id, int type)
@@ -285,17 +299,23 @@ static void wait_on_dquot(struct dquot *dquot)
 
 #define mark_dquot_dirty(dquot) ((dquot)->dq_sb->dq_op->mark_dirty(dquot))
 
+/* Doesn't sleep, dquot_alloc_space() calls it under i_lock */
 int dquot_mark_dquot_dirty(struct dquot *dquot)
 {
-	spin_lock(&dq_list_lock);
+	struct quota_info *dqopt = sb_dqopt(dquot->dq_sb);
+
+	/* The flag is cleared before a write copies the dquot */
+	if (dquot_dirty(dquot))
+		return 0;
+	spin_lock(&dqopt->dq_dirty_lock);
 	if (!test_and_set_bit(DQ_MOD_B, &dquot->dq_flags))
-		list_add(&dquot->dq_dirty, &sb_dqopt(dquot->dq_sb)->
-				info[dquot->dq_type].dqi_dirty_list);
-	spin_unlock(&dq_list_lock);
+		list_add(&dquot->dq_dirty,
+			 &dqopt->info[dquot->dq_type].dqi_dirty_list);
+	spin_unlock(&dqopt->dq_dirty_lock);
 	return 0;
 }
 
-/* This function needs dq_list_lock */
+/* This function needs dq_dirty_lock */
 static inline int clear_dquot_dirty(struct dquot *dquot)
 {
 	if (!test_and_clear_bit(DQ_MOD_B, &dquot->dq_flags))
@@ -355,15 +375,20 @@ int dquot_commit(struct dquot *dquot)
 	struct quota_info *dqopt = sb_dqopt(dquot->dq_sb);
 
 	down(&dqopt->dqio_sem);
-	spin_lock(&dq_list_lock);
+	spin_lock(&dqopt->dq_dirty_lock);
 	if (!clear_dquot_dirty(dquot)) {
-		spin_unlock(&dq_list_lock);
+		spin_unlock(&dqopt->dq_dirty_lock);
 		goto out_sem;
 	}
-	spin_unlock(&dq_list_lock);
+	spin_unlock(&dqopt->dq_dirty_lock);
 	/* Inactive dquot can be only if there was error during read/init
 	 * => we have better not writing it */
 	if (test_bit(DQ_ACTIVE_B, &dquot->dq_flags)) {
+		/* Space charged after this dirties the dquot again */
+		spin_lock(&dquot->dq_dqb_lock);
+		dquot_fold_space(dquot);
+		dquot_allow_batch(dquot);
+		spin_unlock(&dquot->dq_dqb_lock);
 		ret = dqopt->ops[dquot->dq_type]->commit_dqblk(dquot);
 		if (info_dirty(&dqopt->info[dquot->dq_type]))
 			ret2 = dqopt->ops[dquot->dq_type]->write_file_info(dquot->dq_sb, dquot->dq_type);
@@ -446,7 +471,7 @@ int vfs_quota_sync(struct super_block *sb, int type)
 			continue;
 		if (!sb_has_quota_enabled(sb, cnt))
 			continue;
-		spin_lock(&dq_list_lock);
+		spin_lock(&dqopt->dq_dirty_lock);
 		dirty = &dqopt->info[cnt].dqi_dirty_list;
 		while (!list_empty(dirty)) {
 			dquot = list_entry(dirty->next, struct dquot, dq_dirty);
@@ -457,15 +482,18 @@ int vfs_quota_sync(struct super_block *sb, int type)
 			}
 			/* Now we have active dquot from which someone is
  			 * holding reference so we can safely just increase
-			 * use count */
+			 * use count: dqput() doesn't drop the last one of a
+			 * dirty dquot */
 			atomic_inc(&dquot->dq_count);
+			spin_unlock(&dqopt->dq_dirty_lock);
+			spin_lock(&dq_list_lock);
 			dqstats.lookups++;
 			spin_unlock(&dq_list_lock);
 			sb->dq_op->write_dquot(dquot);
 			dqput(dquot);
-			spin_lock(&dq_list_lock);
+			spin_lock(&dqopt->dq_dirty_lock);
 		}
-		spin_unlock(&dq_list_lock);
+		spin_unlock(&dqopt->dq_dirty_lock);
 	}
 
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
@@ -554,12 +582,18 @@ we_slept:
 		goto we_slept;
 	}
 	/* Clear flag in case dquot was inactive (something bad happened) */
+	spin_lock(&sb_dqopt(dquot->dq_sb)->dq_dirty_lock);
 	clear_dquot_dirty(dquot);
+	spin_unlock(&sb_dqopt(dquot->dq_sb)->dq_dirty_lock);
 	if (test_bit(DQ_ACTIVE_B, &dquot->dq_flags)) {
 		spin_unlock(&dq_list_lock);
 		dquot->dq_sb->dq_op->release_dquot(dquot);
 		goto we_slept;
 	}
+	/* Nobody charges it any more, the batches must not outlive it */
+	spin_lock(&dquot->dq_dqb_lock);
+	dquot_fold_space(dquot);
+	spin_unlock(&dquot->dq_dqb_lock);
 	atomic_dec(&dquot->dq_count);
 #ifdef __DQUOT_PARANOIA
 	/* sanity check */
@@ -584,6 +618,8 @@ static struct dquot *get_empty_dquot(struct super_block *sb, int type)
 	INIT_LIST_HEAD(&dquot->dq_inuse);
 	INIT_HLIST_NODE(&dquot->dq_hash);
 	INIT_LIST_HEAD(&dquot->dq_dirty);
+	spin_lock_init(&dquot->dq_dqb_lock);
+	atomic_set(&dquot->dq_batched, 0);
 	dquot->dq_sb = sb;
 	dquot->dq_type = type;
 	atomic_set(&dquot->dq_count, 1);
@@ -663,22 +699,26 @@ static int dqinit_needed(struct inode *inode, int type)
 static void add_dquot_ref(struct super_block *sb, int type)
 {
 	struct list_head *p;
+	int cpu;
 
 restart:
-	file_list_lock();
-	list_for_each(p, &sb->s_files) {
-		struct file *filp = list_entry(p, struct file, f_list);
-		struct inode *inode = filp->f_dentry->d_inode;
-		if (filp->f_mode & FMODE_WRITE && dqinit_needed(inode, type)) {
-			struct dentry *dentry = dget(filp->f_dentry);
-			file_list_unlock();
-			sb->dq_op->initialize(inode, type);
-			dput(dentry);
-			/* As we may have blocked we had better restart... */
-			goto restart;
+	for_each_cpu(cpu) {
+		file_sb_list_lock(cpu);
+		list_for_each(p, sb_files(sb, cpu)) {
+			struct file *filp = list_entry(p, struct file, f_list);
+			struct inode *inode = filp->f_dentry->d_inode;
+			if (filp->f_mode & FMODE_WRITE &&
+			    dqinit_needed(inode, type)) {
+				struct dentry *dentry = dget(filp->f_dentry);
+				file_sb_list_unlock(cpu);
+				sb->dq_op->initialize(inode, type);
+				dput(dentry);
+				/* As we may have blocked we had better restart... */
+				goto restart;
+			}
 		}
+		file_sb_list_unlock(cpu);
 	}
-	file_list_unlock();
 }
 
 /* Return 0 if dqput() won't block (note that 1 doesn't necessarily mean blocking) */
@@ -693,9 +733,12 @@ static inline int dqput_blocks(struct dquot *dquot)
 /* We can't race with anybody because we hold dqptr_sem for writing... */
 int remove_inode_dquot_ref(struct inode *inode, int type, struct list_head *tofree_head)
 {
-	struct dquot *dquot = inode->i_dquot[type];
+	struct dquot *dquot;
 
+	spin_lock(&inode->i_lock);
+	dquot = inode->i_dquot[type];
 	inode->i_dquot[type] = NODQUOT;
+	spin_unlock(&inode->i_lock);
 	if (dquot != NODQUOT) {
 		if (dqput_blocks(dquot)) {
 #ifdef __DQUOT_PARANOIA
@@ -777,6 +820,267 @@ static inline void dquot_decr_space(struct dquot *dquot, qsize_t number)
 	clear_bit(DQ_BLKS_B, &dquot->dq_flags);
 }
 
+#ifdef CONFIG_SMP
+/*
+ * Space charged and freed on a CPU can be kept in a batch of that CPU,
+ * a few slots each holding the bytes not yet added to the dq_dqb of one
+ * dquot, so that writing a file takes no lock shared with other CPUs.
+ * A slot is folded into the dquot when it would get past
+ * DQUOT_SPACE_BATCH, when it is wanted for another dquot, and whenever
+ * the exact usage is needed: for checking limits, for writing the dquot
+ * and for quotactl.
+ *
+ * Batches are used only while the dquot has DQ_BATCH_B, which
+ * dquot_allow_batch() sets when the usage is so far below the block
+ * limits that the batches of all CPUs together cannot reach them, so no
+ * check can be skipped.  Anything that changes dq_dqb.dqb_curspace
+ * otherwise first calls dquot_fold_space(), which clears the flag, and
+ * sets it again when done.  Batching needs a dquot that is just put on
+ * the dirty list when modified: where each change is written to the
+ * journal, as ext3 and reiserfs do with journalled quota, the dquot
+ * must be exact at each change.
+ */
+#define DQUOT_BATCH_SLOTS	8
+#define DQUOT_SPACE_BATCH	(1L << 20)
+
+struct dquot_batch {
+	spinlock_t lock;
+	struct dquot *dquot[DQUOT_BATCH_SLOTS];
+	long space[DQUOT_BATCH_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct dquot_batch, dquot_batch);
+static qsize_t dquot_batch_slack;	/* DQUOT_SPACE_BATCH for each CPU */
+
+/* Needs dq_dqb_lock. Empties all the batches of the dquot into dq_dqb */
+static void dquot_fold_space(struct dquot *dquot)
+{
+	long long delta = 0;
+	int cpu, i;
+
+	clear_bit(DQ_BATCH_B, &dquot->dq_flags);
+	/* Pairs with the barrier in dquot_batch_slot() */
+	smp_mb__after_clear_bit();
+	if (!atomic_read(&dquot->dq_batched))
+		return;
+	for_each_cpu(cpu) {
+		struct dquot_batch *b = &per_cpu(dquot_batch, cpu);
+
+		spin_lock(&b->lock);
+		for (i = 0; i < DQUOT_BATCH_SLOTS; i++) {
+			if (b->dquot[i] != dquot)
+				continue;
+			delta += b->space[i];
+			b->dquot[i] = NODQUOT;
+			b->space[i] = 0;
+			atomic_dec(&dquot->dq_batched);
+		}
+		spin_unlock(&b->lock);
+	}
+	/* Just the sum is meaningful, a single batch may be negative */
+	if (delta >= 0)
+		dquot_incr_space(dquot, delta);
+	else
+		dquot_decr_space(dquot, -delta);
+}
+
+/* Needs dq_dqb_lock, and the batches of the dquot folded */
+static void dquot_allow_batch(struct dquot *dquot)
+{
+	struct mem_dqblk *dm = &dquot->dq_dqb;
+	qsize_t limit = dm->dqb_bsoftlimit;
+
+	if (dquot->dq_sb->dq_op->mark_dirty != dquot_mark_dquot_dirty)
+		return;
+	if (!limit || (dm->dqb_bhardlimit && dm->dqb_bhardlimit < limit))
+		limit = dm->dqb_bhardlimit;
+	if (limit && toqb(dm->dqb_curspace + dquot_batch_slack) > limit)
+		return;
+	set_bit(DQ_BATCH_B, &dquot->dq_flags);
+}
+
+/*
+ * Free a slot of the batch for another dquot.  The batch lock ranks
+ * below dq_dqb_lock, so only a dquot whose lock is free can be folded.
+ */
+static int dquot_batch_evict(struct dquot_batch *b, struct dquot **keep)
+{
+	struct dquot *dquot;
+	int i, cnt;
+
+	for (i = 0; i < DQUOT_BATCH_SLOTS; i++) {
+		dquot = b->dquot[i];
+		for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+			if (keep[cnt] == dquot)
+				break;
+		if (cnt < MAXQUOTAS || !spin_trylock(&dquot->dq_dqb_lock))
+			continue;
+		/* The other batches may now grow again, check them */
+		clear_bit(DQ_BATCH_B, &dquot->dq_flags);
+		if (b->space[i] >= 0)
+			dquot_incr_space(dquot, b->space[i]);
+		else
+			dquot_decr_space(dquot, -b->space[i]);
+		b->dquot[i] = NODQUOT;
+		b->space[i] = 0;
+		atomic_dec(&dquot->dq_batched);
+		spin_unlock(&dquot->dq_dqb_lock);
+		return i;
+	}
+	return -1;
+}
+
+/*
+ * Needs the batch lock.  Returns the slot of the batch where number bytes
+ * can be charged to the dquot, or -1 if the dquot has to be updated under
+ * dq_dqb_lock.  The other dquots of the inode are kept in their slots.
+ */
+static int dquot_batch_slot(struct dquot_batch *b, struct dquot *dquot,
+			    long number, struct dquot **keep)
+{
+	int i, slot = -1;
+
+	for (i = 0; i < DQUOT_BATCH_SLOTS; i++) {
+		if (b->dquot[i] == dquot)
+			break;
+		if (!b->dquot[i] && slot < 0)
+			slot = i;
+	}
+	if (i < DQUOT_BATCH_SLOTS) {
+		/* The fold clears the flag before it takes our lock */
+		if (!test_bit(DQ_BATCH_B, &dquot->dq_flags))
+			return -1;
+		slot = i;
+	} else {
+		if (slot < 0)
+			slot = dquot_batch_evict(b, keep);
+		if (slot < 0)
+			return -1;
+		/*
+		 * Count the slot before looking at the flag, so that
+		 * dquot_fold_space() either sees the count or we see the
+		 * flag cleared.
+		 */
+		atomic_inc(&dquot->dq_batched);
+		smp_mb__after_atomic_inc();
+		if (!test_bit(DQ_BATCH_B, &dquot->dq_flags)) {
+			atomic_dec(&dquot->dq_batched);
+			return -1;
+		}
+		b->dquot[slot] = dquot;
+	}
+	if (b->space[slot] + number > DQUOT_SPACE_BATCH ||
+	    b->space[slot] + number < -DQUOT_SPACE_BATCH)
+		return -1;
+	return slot;
+}
+
+/*
+ * Charge number bytes, or free them when it is negative, in the batch of
+ * this CPU.  The dquot pointers of the inode are held steady by i_lock,
+ * which everybody changing them takes, and nothing here sleeps, so
+ * dqptr_sem isn't needed.  Returns 0 when it has to be done the slow way.
+ */
+static int dquot_space_fast(struct inode *inode, long number)
+{
+	struct dquot_batch *b;
+	int slot[MAXQUOTAS];
+	int cnt, ret = 0;
+
+	if (number > DQUOT_SPACE_BATCH || number < -DQUOT_SPACE_BATCH)
+		return 0;
+	if (inode->i_sb->dq_op->mark_dirty != dquot_mark_dquot_dirty)
+		return 0;
+	spin_lock(&inode->i_lock);
+	if (IS_NOQUOTA(inode))
+		goto out_unlock;
+	b = &per_cpu(dquot_batch, get_cpu());
+	spin_lock(&b->lock);
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
+		if (inode->i_dquot[cnt] == NODQUOT)
+			continue;
+		slot[cnt] = dquot_batch_slot(b, inode->i_dquot[cnt], number,
+					     inode->i_dquot);
+		if (slot[cnt] < 0)
+			goto out_batch;
+	}
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+		if (inode->i_dquot[cnt] != NODQUOT)
+			b->space[slot[cnt]] += number;
+	ret = 1;
+out_batch:
+	spin_unlock(&b->lock);
+	put_cpu();
+	if (ret) {
+		if (number >= 0)
+			__inode_add_bytes(inode, number);
+		else
+			__inode_sub_bytes(inode, -number);
+		/* Still under i_lock, so dqput() will find them dirty */
+		for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+			if (inode->i_dquot[cnt] != NODQUOT)
+				dquot_mark_dquot_dirty(inode->i_dquot[cnt]);
+	}
+out_unlock:
+	spin_unlock(&inode->i_lock);
+	return ret;
+}
+
+static void __init dquot_batch_init(void)
+{
+	int cpu;
+
+	for_each_cpu(cpu)
+		spin_lock_init(&per_cpu(dquot_batch, cpu).lock);
+	dquot_batch_slack = (qsize_t)DQUOT_SPACE_BATCH * num_possible_cpus();
+}
+#else
+static inline void dquot_fold_space(struct dquot *dquot)
+{
+}
+
+static inline void dquot_allow_batch(struct dquot *dquot)
+{
+}
+
+static inline int dquot_space_fast(struct inode *inode, long number)
+{
+	return 0;
+}
+
+static inline void dquot_batch_init(void)
+{
+}
+#endif
+
+/*
+ * Lock the dquots of an inode for updating their dq_dqb, in the order of
+ * quota types, with their space made exact
+ */
+static void lock_dquots(struct dquot * const *dquots)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
+		if (dquots[cnt] == NODQUOT)
+			continue;
+		spin_lock(&dquots[cnt]->dq_dqb_lock);
+		dquot_fold_space(dquots[cnt]);
+	}
+}
+
+static void unlock_dquots(struct dquot * const *dquots)
+{
+	int cnt;
+
+	for (cnt = MAXQUOTAS - 1; cnt >= 0; cnt--) {
+		if (dquots[cnt] == NODQUOT)
+			continue;
+		dquot_allow_batch(dquots[cnt]);
+		spin_unlock(&dquots[cnt]->dq_dqb_lock);
+	}
+}
+
 static int flag_print_warnings = 1;
 
 static inline int need_print_warning(struct dquot *dquot)
@@ -858,7 +1162,7 @@ static inline char ignore_hardlimit(struct dquot *dquot)
 	    (info->dqi_format->qf_fmt_id != QFMT_VFS_OLD || !(info->dqi_flags & V1_DQF_RSQUASH));
 }
 
-/* needs dq_data_lock */
+/* needs dq_dqb_lock */
 static int check_idq(struct dquot *dquot, ulong inodes, char *warntype)
 {
 	*warntype = NOWARN;
@@ -890,7 +1194,7 @@ static int check_idq(struct dquot *dquot, ulong inodes, char *warntype)
 	return QUOTA_OK;
 }
 
-/* needs dq_data_lock */
+/* needs dq_dqb_lock */
 static int check_bdq(struct dquot *dquot, qsize_t space, int prealloc, char *warntype)
 {
 	*warntype = 0;
@@ -953,6 +1257,8 @@ int dquot_initialize(struct inode *inode, int type)
 		if (type != -1 && cnt != type)
 			continue;
 		if (inode->i_dquot[cnt] == NODQUOT) {
+			struct dquot *dquot;
+
 			switch (cnt) {
 				case USRQUOTA:
 					id = inode->i_uid;
@@ -961,7 +1267,10 @@ int dquot_initialize(struct inode *inode, int type)
 					id = inode->i_gid;
 					break;
 			}
-			inode->i_dquot[cnt] = dqget(inode->i_sb, id, cnt);
+			dquot = dqget(inode->i_sb, id, cnt);
+			spin_lock(&inode->i_lock);
+			inode->i_dquot[cnt] = dquot;
+			spin_unlock(&inode->i_lock);
 		}
 	}
 out_err:
@@ -975,13 +1284,17 @@ out_err:
  */
 int dquot_drop(struct inode *inode)
 {
+	struct dquot *dquot;
 	int cnt;
 
 	down_write(&sb_dqopt(inode->i_sb)->dqptr_sem);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (inode->i_dquot[cnt] != NODQUOT) {
-			dqput(inode->i_dquot[cnt]);
+			spin_lock(&inode->i_lock);
+			dquot = inode->i_dquot[cnt];
 			inode->i_dquot[cnt] = NODQUOT;
+			spin_unlock(&inode->i_lock);
+			dqput(dquot);
 		}
 	}
 	up_write(&sb_dqopt(inode->i_sb)->dqptr_sem);
@@ -1012,6 +1325,9 @@ out_add:
 		inode_add_bytes(inode, number);
 		return QUOTA_OK;
 	}
+	/* Well below the limits nothing is checked, nor slept on */
+	if (number <= DQUOT_SPACE_BATCH && dquot_space_fast(inode, number))
+		return QUOTA_OK;
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
 		warntype[cnt] = NOWARN;
 
@@ -1020,7 +1336,8 @@ out_add:
 		up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 		goto out_add;
 	}
-	spin_lock(&dq_data_lock);
+	spin_lock(&inode->i_lock);
+	lock_dquots(inode->i_dquot);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (inode->i_dquot[cnt] == NODQUOT)
 			continue;
@@ -1032,10 +1349,11 @@ out_add:
 			continue;
 		dquot_incr_space(inode->i_dquot[cnt], number);
 	}
-	inode_add_bytes(inode, number);
+	__inode_add_bytes(inode, number);
 	ret = QUOTA_OK;
 warn_put_all:
-	spin_unlock(&dq_data_lock);
+	unlock_dquots(inode->i_dquot);
+	spin_unlock(&inode->i_lock);
 	if (ret == QUOTA_OK)
 		/* Dirtify all the dquots - this can block when journalling */
 		for (cnt = 0; cnt < MAXQUOTAS; cnt++)
@@ -1065,7 +1383,7 @@ int dquot_alloc_inode(const struct inode *inode, unsigned long number)
 		up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 		return QUOTA_OK;
 	}
-	spin_lock(&dq_data_lock);
+	lock_dquots(inode->i_dquot);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (inode->i_dquot[cnt] == NODQUOT)
 			continue;
@@ -1080,7 +1398,7 @@ int dquot_alloc_inode(const struct inode *inode, unsigned long number)
 	}
 	ret = QUOTA_OK;
 warn_put_all:
-	spin_unlock(&dq_data_lock);
+	unlock_dquots(inode->i_dquot);
 	if (ret == QUOTA_OK)
 		/* Dirtify all the dquots - this can block when journalling */
 		for (cnt = 0; cnt < MAXQUOTAS; cnt++)
@@ -1105,20 +1423,24 @@ out_sub:
 		inode_sub_bytes(inode, number);
 		return QUOTA_OK;
 	}
+	if (number <= DQUOT_SPACE_BATCH && dquot_space_fast(inode, -(long)number))
+		return QUOTA_OK;
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 	/* Now recheck reliably when holding dqptr_sem */
 	if (IS_NOQUOTA(inode)) {
 		up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 		goto out_sub;
 	}
-	spin_lock(&dq_data_lock);
+	spin_lock(&inode->i_lock);
+	lock_dquots(inode->i_dquot);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (inode->i_dquot[cnt] == NODQUOT)
 			continue;
 		dquot_decr_space(inode->i_dquot[cnt], number);
 	}
-	inode_sub_bytes(inode, number);
-	spin_unlock(&dq_data_lock);
+	__inode_sub_bytes(inode, number);
+	unlock_dquots(inode->i_dquot);
+	spin_unlock(&inode->i_lock);
 	/* Dirtify all the dquots - this can block when journalling */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
 		if (inode->i_dquot[cnt])
@@ -1144,13 +1466,13 @@ int dquot_free_inode(const struct inode *inode, unsigned long number)
 		up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 		return QUOTA_OK;
 	}
-	spin_lock(&dq_data_lock);
+	lock_dquots(inode->i_dquot);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (inode->i_dquot[cnt] == NODQUOT)
 			continue;
 		dquot_decr_inodes(inode->i_dquot[cnt], number);
 	}
-	spin_unlock(&dq_data_lock);
+	unlock_dquots(inode->i_dquot);
 	/* Dirtify all the dquots - this can block when journalling */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
 		if (inode->i_dquot[cnt])
@@ -1206,13 +1528,25 @@ int dquot_transfer(struct inode *inode, struct iattr *iattr)
 				break;
 		}
 	}
+	spin_lock(&inode->i_lock);
 	spin_lock(&dq_data_lock);
-	space = inode_get_bytes(inode);
-	/* Build the transfer_from list and check the limits */
+	space = __inode_get_bytes(inode);
+	/* Build the transfer_from list and lock both lists type by type */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (transfer_to[cnt] == NODQUOT)
 			continue;
 		transfer_from[cnt] = inode->i_dquot[cnt];
+		if (transfer_from[cnt]) {
+			spin_lock(&transfer_from[cnt]->dq_dqb_lock);
+			dquot_fold_space(transfer_from[cnt]);
+		}
+		spin_lock(&transfer_to[cnt]->dq_dqb_lock);
+		dquot_fold_space(transfer_to[cnt]);
+	}
+	/* Check the limits */
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
+		if (transfer_to[cnt] == NODQUOT)
+			continue;
 		if (check_idq(transfer_to[cnt], 1, warntype+cnt) == NO_QUOTA ||
 		    check_bdq(transfer_to[cnt], space, 0, warntype+cnt) == NO_QUOTA)
 			goto warn_put_all;
@@ -1241,7 +1575,18 @@ int dquot_transfer(struct inode *inode, struct iattr *iattr)
 	}
 	ret = QUOTA_OK;
 warn_put_all:
+	for (cnt = MAXQUOTAS - 1; cnt >= 0; cnt--) {
+		if (transfer_to[cnt] == NODQUOT)
+			continue;
+		dquot_allow_batch(transfer_to[cnt]);
+		spin_unlock(&transfer_to[cnt]->dq_dqb_lock);
+		if (transfer_from[cnt]) {
+			dquot_allow_batch(transfer_from[cnt]);
+			spin_unlock(&transfer_from[cnt]->dq_dqb_lock);
+		}
+	}
 	spin_unlock(&dq_data_lock);
+	spin_unlock(&inode->i_lock);
 	/* Dirtify all the dquots - this can block when journalling */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (transfer_from[cnt])
@@ -1442,8 +1787,10 @@ static int vfs_quota_on_inode(struct inode *inode, int type, int format_id)
 	 * Also nobody should write to the file - we use special IO operations
 	 * which ignore the immutable bit. */
 	down_write(&dqopt->dqptr_sem);
+	spin_lock(&inode->i_lock);
 	oldflags = inode->i_flags & (S_NOATIME | S_IMMUTABLE | S_NOQUOTA);
 	inode->i_flags |= S_NOQUOTA | S_NOATIME | S_IMMUTABLE;
+	spin_unlock(&inode->i_lock);
 	up_write(&dqopt->dqptr_sem);
 
 	error = -EIO;
@@ -1480,8 +1827,10 @@ out_lock:
 		down_write(&dqopt->dqptr_sem);
 		/* Set the flags back (in the case of accidental quotaon()
 		 * on a wrong file we don't want to mess up the flags) */
+		spin_lock(&inode->i_lock);
 		inode->i_flags &= ~(S_NOATIME | S_NOQUOTA | S_IMMUTABLE);
 		inode->i_flags |= oldflags;
+		spin_unlock(&inode->i_lock);
 		up_write(&dqopt->dqptr_sem);
 	}
 	up(&inode->i_sem);
@@ -1535,7 +1884,8 @@ static void do_get_dqblk(struct dquot *dquot, struct if_dqblk *di)
 {
 	struct mem_dqblk *dm = &dquot->dq_dqb;
 
-	spin_lock(&dq_data_lock);
+	spin_lock(&dquot->dq_dqb_lock);
+	dquot_fold_space(dquot);
 	di->dqb_bhardlimit = dm->dqb_bhardlimit;
 	di->dqb_bsoftlimit = dm->dqb_bsoftlimit;
 	di->dqb_curspace = dm->dqb_curspace;
@@ -1545,7 +1895,8 @@ static void do_get_dqblk(struct dquot *dquot, struct if_dqblk *di)
 	di->dqb_btime = dm->dqb_btime;
 	di->dqb_itime = dm->dqb_itime;
 	di->dqb_valid = QIF_ALL;
-	spin_unlock(&dq_data_lock);
+	dquot_allow_batch(dquot);
+	spin_unlock(&dquot->dq_dqb_lock);
 }
 
 int vfs_get_dqblk(struct super_block *sb, int type, qid_t id, struct if_dqblk *di)
@@ -1569,7 +1920,8 @@ static void do_set_dqblk(struct dquot *dquot, struct if_dqblk *di)
 	struct mem_dqblk *dm = &dquot->dq_dqb;
 	int check_blim = 0, check_ilim = 0;
 
-	spin_lock(&dq_data_lock);
+	spin_lock(&dquot->dq_dqb_lock);
+	dquot_fold_space(dquot);
 	if (di->dqb_valid & QIF_SPACE) {
 		dm->dqb_curspace = di->dqb_curspace;
 		check_blim = 1;
@@ -1613,7 +1965,8 @@ static void do_set_dqblk(struct dquot *dquot, struct if_dqblk *di)
 		clear_bit(DQ_FAKE_B, &dquot->dq_flags);
 	else
 		set_bit(DQ_FAKE_B, &dquot->dq_flags);
-	spin_unlock(&dq_data_lock);
+	dquot_allow_batch(dquot);
+	spin_unlock(&dquot->dq_dqb_lock);
 	mark_dquot_dirty(dquot);
 }
 
@@ -1793,6 +2146,7 @@ static int __init dquot_init(void)
 	printk(KERN_NOTICE "VFS: Disk quotas %s\n", __DQUOT_VERSION__);
 
 	register_sysctl_table(sys_table, 0);
+	dquot_batch_init();
 
 	dquot_cachep = kmem_cache_create("dquot", 
 			sizeof(struct dquot), sizeof(unsigned long) * 4,
@@ -0,0 +1,73 @@
+/*
+ *  linux/fs/ext2/xip.c
+ *
+ * Execute in place on block devices whose memory the cpu can address,
+ * with the "xip" mount option: regular files are read, written and
+ * mapped straight from the device, see mm/filemap_xip.c.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/buffer_head.h>
+#include <linux/err.h>
+#include "ext2.h"
+#include "xip.h"
+
+static inline int
+__inode_direct_access(struct inode *inode, sector_t sector,
+		      unsigned long *data)
+{
+	struct block_device *bdev = inode->i_sb->s_bdev;
+
+	return bdev->bd_disk->fops->direct_access(bdev, sector, data);
+}
+
+/*
+ * The page of the device holding sector of the file.  A block newly
+ * allocated is cleared, so that what it held before does not show.
+ */
+struct page *
+ext2_get_xip_page(struct address_space *mapping, sector_t sector, int create)
+{
+	struct inode *inode = mapping->host;
+	struct buffer_head tmp;
+	unsigned long data;
+	int rc;
+
+	memset(&tmp, 0, sizeof(struct buffer_head));
+	rc = ext2_get_block(inode, sector >> (inode->i_blkbits - 9), &tmp,
+			    create);
+	if (rc)
+		return ERR_PTR(rc);
+	if (!buffer_mapped(&tmp))
+		return ERR_PTR(-ENODATA);
+
+	rc = __inode_direct_access(inode,
+				   tmp.b_blocknr << (inode->i_blkbits - 9),
+				   &data);
+	if (rc)
+		return ERR_PTR(rc);
+	if (buffer_new(&tmp))
+		memset((void *)data, 0, PAGE_SIZE);
+	return virt_to_page(data);
+}
+
+/* Drop the xip option where the device or the block size cannot do it. */
+void ext2_xip_verify_sb(struct super_block *sb)
+{
+	struct ext2_sb_info *sbi = EXT2_SB(sb);
+
+	if (!test_opt(sb, XIP))
+		return;
+	if (!sb->s_bdev->bd_disk->fops->direct_access) {
+		clear_opt(sbi->s_mount_opt, XIP);
+		ext2_warning(sb, __FUNCTION__,
+			     "ignoring xip option - not supported by bdev");
+	} else if (sb->s_blocksize != PAGE_SIZE) {
+		clear_opt(sbi->s_mount_opt, XIP);
+		ext2_warning(sb, __FUNCTION__,
+			     "ignoring xip option - block size is not "
+			     "the page size");
+	}
+}
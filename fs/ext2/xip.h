@@ -0,0 +1,17 @@
+/*
+ *  linux/fs/ext2/xip.h
+ *
+ * Execute in place on memory-like block devices, see xip.c.
+ */
+
+#ifdef CONFIG_EXT2_FS_XIP
+extern void ext2_xip_verify_sb (struct super_block *);
+extern struct page *ext2_get_xip_page (struct address_space *, sector_t, int);
+#define ext2_use_xip(sb)		test_opt(sb, XIP)
+#define mapping_is_xip(map)		unlikely((map)->a_ops->get_xip_page)
+#else
+#define ext2_xip_verify_sb(sb)		do { } while (0)
+#define ext2_use_xip(sb)		0
+#define mapping_is_xip(map)		0
+#define xip_truncate_page(map, from)	0
+#endif
@@ -616,11 +616,17 @@ claim_block(spinlock_t *lock, int block, struct buffer_head *bh)
  * If we failed to allocate the desired block then we may end up crossing to a
  * new bitmap.  In that case we must release write access to the old one via
  * ext3_journal_release_buffer(), else we'll run out of credits.
+ *
+ * Once a block has been claimed, up to *count - 1 of the blocks following
+ * it are claimed as well, for as long as they are free and inside the
+ * reservation window.  *count is set to the length of the run claimed.
  */
 static int
 ext3_try_to_allocate(struct super_block *sb, handle_t *handle, int group,
-	struct buffer_head *bitmap_bh, int goal, struct ext3_reserve_window *my_rsv)
+	struct buffer_head *bitmap_bh, int goal, unsigned long *count,
+	struct ext3_reserve_window *my_rsv)
 {
+	unsigned long num;
 	int group_first_block, start, end;
 
 	/* we do allocation within the reservation window if we have a window */
@@ -679,8 +685,16 @@ repeat:
 			goto fail_access;
 		goto repeat;
 	}
+	num = 1;
+	while (num < *count && goal + num < end &&
+	       ext3_test_allocatable(goal + num, bitmap_bh) &&
+	       claim_block(sb_bgl_lock(EXT3_SB(sb), group), goal + num,
+			   bitmap_bh))
+		num++;
+	*count = num;
 	return goal;
 fail_access:
+	*count = 0;
 	return -1;
 }
 
@@ -987,11 +1001,12 @@ failed:
 static int
 ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 			unsigned int group, struct buffer_head *bitmap_bh,
-			int goal, struct ext3_reserve_window_node * my_rsv,
-			int *errp)
+			int goal, unsigned long *count,
+			struct ext3_reserve_window_node * my_rsv, int *errp)
 {
 	spinlock_t *rsv_lock;
 	unsigned long group_first_block;
+	unsigned long num;
 	int ret = 0;
 	int fatal;
 
@@ -1016,7 +1031,8 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 	 * or last attempt to allocate a block with reservation turned on failed
 	 */
 	if (my_rsv == NULL ) {
-		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal, NULL);
+		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal,
+					   count, NULL);
 		goto out;
 	}
 	rsv_lock = &EXT3_SB(sb)->s_rsv_window_lock;
@@ -1073,11 +1089,13 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 		if ((rsv_copy._rsv_start >= group_first_block + EXT3_BLOCKS_PER_GROUP(sb))
 		    || (rsv_copy._rsv_end < group_first_block))
 			BUG();
+		num = *count;
 		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal,
-					   &rsv_copy);
+					   &num, &rsv_copy);
 		if (ret >= 0) {
 			if (!read_seqretry(&my_rsv->rsv_seqlock, seq))
 				atomic_inc(&my_rsv->rsv_alloc_hit);
+			*count = num;
 			break;				/* succeed */
 		}
 	}
@@ -1098,13 +1116,16 @@ out:
 	return ret;
 }
 
-static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
+static int ext3_has_free_blocks(struct ext3_sb_info *sbi, unsigned long count)
 {
-	int free_blocks, root_blocks;
+	long free_blocks, root_blocks;
 
-	free_blocks = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
+	/* blocks promised to delayed allocations are as good as gone */
+	free_blocks = percpu_counter_read_positive(&sbi->s_freeblocks_counter) -
+		percpu_counter_read_positive(&sbi->s_dirtyblocks_counter);
 	root_blocks = le32_to_cpu(sbi->s_es->s_r_blocks_count);
-	if (free_blocks < root_blocks + 1 && !capable(CAP_SYS_RESOURCE) &&
+	if (free_blocks < root_blocks + (long)count &&
+		!capable(CAP_SYS_RESOURCE) &&
 		sbi->s_resuid != current->fsuid &&
 		(sbi->s_resgid == 0 || !in_group_p (sbi->s_resgid))) {
 		return 0;
@@ -1112,6 +1133,29 @@ static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
 	return 1;
 }
 
+/*
+ * Set aside @count blocks for data that has been written to the page
+ * cache but not yet allocated on disk.  Nothing is taken from the
+ * bitmaps; the blocks are only kept from other allocations until the
+ * writer's ext3_release_blocks(), which comes just before the real
+ * ext3_new_block() at writeback time, or when the dirty data goes away.
+ */
+int ext3_reserve_blocks(struct super_block *sb, unsigned long count)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+
+	if (!ext3_has_free_blocks(sbi, count))
+		return -ENOSPC;
+	percpu_counter_mod(&sbi->s_dirtyblocks_counter, count);
+	return 0;
+}
+
+void ext3_release_blocks(struct super_block *sb, unsigned long count)
+{
+	percpu_counter_mod(&EXT3_SB(sb)->s_dirtyblocks_counter,
+			   -(long)count);
+}
+
 /*
  * ext3_should_retry_alloc() is called when ENOSPC is returned, and if
  * it is profitable to retry the operation, this function will wait
@@ -1120,7 +1164,7 @@ static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
  */
 int ext3_should_retry_alloc(struct super_block *sb, int *retries)
 {
-	if (!ext3_has_free_blocks(EXT3_SB(sb)) || (*retries)++ > 3)
+	if (!ext3_has_free_blocks(EXT3_SB(sb), 1) || (*retries)++ > 3)
 		return 0;
 
 	jbd_debug(1, "%s: retrying operation after ENOSPC\n", sb->s_id);
@@ -1129,15 +1173,21 @@ int ext3_should_retry_alloc(struct super_block *sb, int *retries)
 }
 
 /*
- * ext3_new_block uses a goal block to assist allocation.  If the goal is
+ * ext3_new_blocks uses a goal block to assist allocation.  If the goal is
  * free, or there is a free block within 32 blocks of the goal, that block
  * is allocated.  Otherwise a forward search is made for a free block; within 
  * each block group the search first looks for an entire free byte in the block
  * bitmap, and then for any free bit if that fails.
+ *
+ * Up to *count blocks are allocated as one contiguous run starting at the
+ * returned block: the run is cut short by the first block in use or the
+ * end of the inode's reservation window, and *count is updated to its
+ * length.  The bitmap and group descriptor are journalled once for the
+ * whole run.
  * This function also updates quota and i_blocks field.
  */
-int ext3_new_block(handle_t *handle, struct inode *inode,
-			unsigned long goal, int *errp)
+int ext3_new_blocks(handle_t *handle, struct inode *inode,
+			unsigned long goal, unsigned long *count, int *errp)
 {
 	struct buffer_head *bitmap_bh = NULL;
 	struct buffer_head *gdp_bh;
@@ -1149,6 +1199,7 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	int fatal = 0, err;
 	int performed_allocation = 0;
 	int free_blocks;
+	unsigned long num = *count;	/* blocks asked for */
 	struct super_block *sb;
 	struct ext3_group_desc *gdp;
 	struct ext3_super_block *es;
@@ -1167,11 +1218,13 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 		printk("ext3_new_block: nonexistent device");
 		return 0;
 	}
+	if (!num)
+		num = *count = 1;
 
 	/*
-	 * Check quota for allocation of this block.
+	 * Check quota for allocation of these blocks.
 	 */
-	if (DQUOT_ALLOC_BLOCK(inode, 1)) {
+	if (DQUOT_ALLOC_BLOCK(inode, num)) {
 		*errp = -EDQUOT;
 		return 0;
 	}
@@ -1191,7 +1244,7 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	if (test_opt(sb, RESERVATION) &&
 		S_ISREG(inode->i_mode) && (windowsz > 0))
 		my_rsv = rsv;
-	if (!ext3_has_free_blocks(sbi)) {
+	if (!ext3_has_free_blocks(sbi, 1)) {
 		*errp = -ENOSPC;
 		goto out;
 	}
@@ -1217,8 +1270,9 @@ retry:
 		bitmap_bh = read_block_bitmap(sb, group_no);
 		if (!bitmap_bh)
 			goto io_error;
+		*count = num;
 		ret_block = ext3_try_to_allocate_with_rsv(sb, handle, group_no,
-					bitmap_bh, ret_block, my_rsv, &fatal);
+				bitmap_bh, ret_block, count, my_rsv, &fatal);
 		if (fatal)
 			goto out;
 		if (ret_block >= 0)
@@ -1254,8 +1308,9 @@ retry:
 		bitmap_bh = read_block_bitmap(sb, group_no);
 		if (!bitmap_bh)
 			goto io_error;
+		*count = num;
 		ret_block = ext3_try_to_allocate_with_rsv(sb, handle, group_no,
-					bitmap_bh, -1, my_rsv, &fatal);
+					bitmap_bh, -1, count, my_rsv, &fatal);
 		if (fatal)
 			goto out;
 		if (ret_block >= 0) 
@@ -1290,13 +1345,14 @@ allocated:
 	target_block = ret_block + group_no * EXT3_BLOCKS_PER_GROUP(sb)
 				+ le32_to_cpu(es->s_first_data_block);
 
-	if (target_block == le32_to_cpu(gdp->bg_block_bitmap) ||
-	    target_block == le32_to_cpu(gdp->bg_inode_bitmap) ||
+	if (in_range(le32_to_cpu(gdp->bg_block_bitmap), target_block, *count) ||
+	    in_range(le32_to_cpu(gdp->bg_inode_bitmap), target_block, *count) ||
 	    in_range(target_block, le32_to_cpu(gdp->bg_inode_table),
-		      EXT3_SB(sb)->s_itb_per_group))
+		      EXT3_SB(sb)->s_itb_per_group) ||
+	    in_range(le32_to_cpu(gdp->bg_inode_table), target_block, *count))
 		ext3_error(sb, "ext3_new_block",
 			    "Allocating block in system zone - "
-			    "block = %u", target_block);
+			    "blocks from %u, length %lu", target_block, *count);
 
 	performed_allocation = 1;
 
@@ -1329,10 +1385,10 @@ allocated:
 	/* ret_block was blockgroup-relative.  Now it becomes fs-relative */
 	ret_block = target_block;
 
-	if (ret_block >= le32_to_cpu(es->s_blocks_count)) {
+	if (ret_block + *count - 1 >= le32_to_cpu(es->s_blocks_count)) {
 		ext3_error(sb, "ext3_new_block",
-			    "block(%d) >= blocks count(%d) - "
-			    "block_group = %d, es == %p ", ret_block,
+			    "block(%lu) >= blocks count(%d) - "
+			    "block_group = %d, es == %p ", ret_block + *count - 1,
 			le32_to_cpu(es->s_blocks_count), group_no, es);
 		goto out;
 	}
@@ -1347,9 +1403,9 @@ allocated:
 
 	spin_lock(sb_bgl_lock(sbi, group_no));
 	gdp->bg_free_blocks_count =
-			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - 1);
+		cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - *count);
 	spin_unlock(sb_bgl_lock(sbi, group_no));
-	percpu_counter_mod(&sbi->s_freeblocks_counter, -1);
+	percpu_counter_mod(&sbi->s_freeblocks_counter, -(long)*count);
 
 	BUFFER_TRACE(gdp_bh, "journal_dirty_metadata for group descriptor");
 	err = ext3_journal_dirty_metadata(handle, gdp_bh);
@@ -1362,6 +1418,8 @@ allocated:
 
 	*errp = 0;
 	brelse(bitmap_bh);
+	if (*count < num)
+		DQUOT_FREE_BLOCK(inode, num - *count);
 	return ret_block;
 
 io_error:
@@ -1375,11 +1433,20 @@ out:
 	 * Undo the block allocation
 	 */
 	if (!performed_allocation)
-		DQUOT_FREE_BLOCK(inode, 1);
+		DQUOT_FREE_BLOCK(inode, num);
 	brelse(bitmap_bh);
+	*count = 0;
 	return 0;
 }
 
+int ext3_new_block(handle_t *handle, struct inode *inode,
+			unsigned long goal, int *errp)
+{
+	unsigned long count = 1;
+
+	return ext3_new_blocks(handle, inode, goal, &count, errp);
+}
+
 unsigned long ext3_count_free_blocks(struct super_block *sb)
 {
 	unsigned long desc_count;
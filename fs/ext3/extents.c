@@ -0,0 +1,736 @@
+/*
+ *  linux/fs/ext3/extents.c
+ *
+ *  Extent mapped regular files.
+ *
+ *  A file with EXT3_EXTENTS_FL set describes its blocks as runs
+ *  (logical block, length, physical block) kept in a small B-tree rooted
+ *  in i_data, rather than as one pointer per block.  A large contiguous
+ *  file then costs a handful of tree entries instead of a megabyte of
+ *  indirect blocks, and truncating it frees runs instead of walking
+ *  every pointer.  See <linux/ext3_extents.h> for the on-disk format.
+ *
+ *  All tree changes are serialised by truncate_sem, like the indirect
+ *  block tree in inode.c.
+ */
+
+#include <linux/fs.h>
+#include <linux/time.h>
+#include <linux/ext3_jbd.h>
+#include <linux/jbd.h>
+#include <linux/string.h>
+#include <linux/buffer_head.h>
+#include <linux/ext3_extents.h>
+
+static inline struct ext3_extent_header *ext_inode_hdr(struct inode *inode)
+{
+	return (struct ext3_extent_header *) EXT3_I(inode)->i_data;
+}
+
+static inline struct ext3_extent_header *ext_block_hdr(struct buffer_head *bh)
+{
+	return (struct ext3_extent_header *) bh->b_data;
+}
+
+static inline int ext_depth(struct inode *inode)
+{
+	return le16_to_cpu(ext_inode_hdr(inode)->eh_depth);
+}
+
+/* extents and indexes are the same size, so one capacity fits both */
+static inline int ext3_ext_space_root(struct inode *inode)
+{
+	return (sizeof(EXT3_I(inode)->i_data) -
+		sizeof(struct ext3_extent_header)) / sizeof(struct ext3_extent);
+}
+
+static inline int ext3_ext_space_block(struct inode *inode)
+{
+	return (inode->i_sb->s_blocksize -
+		sizeof(struct ext3_extent_header)) / sizeof(struct ext3_extent);
+}
+
+static int ext3_ext_check(struct inode *inode, struct ext3_extent_header *eh,
+			  int depth)
+{
+	int max = depth == ext_depth(inode) ? ext3_ext_space_root(inode) :
+					      ext3_ext_space_block(inode);
+	const char *error_msg;
+
+	if (le16_to_cpu(eh->eh_magic) != EXT3_EXT_MAGIC)
+		error_msg = "invalid magic";
+	else if (le16_to_cpu(eh->eh_depth) != depth)
+		error_msg = "unexpected depth";
+	else if (le16_to_cpu(eh->eh_max) == 0 || le16_to_cpu(eh->eh_max) > max)
+		error_msg = "invalid eh_max";
+	else if (le16_to_cpu(eh->eh_entries) > le16_to_cpu(eh->eh_max))
+		error_msg = "invalid eh_entries";
+	else if (depth && eh->eh_entries == 0)
+		error_msg = "empty index node";
+	else
+		return 0;
+
+	ext3_error(inode->i_sb, "ext3_ext_check",
+		   "bad extent header in inode #%lu: %s - magic %x, "
+		   "entries %u, max %u, depth %u", inode->i_ino, error_msg,
+		   le16_to_cpu(eh->eh_magic), le16_to_cpu(eh->eh_entries),
+		   le16_to_cpu(eh->eh_max), le16_to_cpu(eh->eh_depth));
+	return -EIO;
+}
+
+/*
+ * Binary search for the last entry starting at or before @block, or the
+ * first entry if they all start after it.  The node must not be empty.
+ */
+static struct ext3_extent_idx *
+ext3_ext_binsearch_idx(struct ext3_extent_header *eh, unsigned long block)
+{
+	struct ext3_extent_idx *l = EXT_FIRST_INDEX(eh) + 1;
+	struct ext3_extent_idx *r = EXT_LAST_INDEX(eh);
+	struct ext3_extent_idx *m;
+
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ei_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	return l - 1;
+}
+
+static struct ext3_extent *
+ext3_ext_binsearch(struct ext3_extent_header *eh, unsigned long block)
+{
+	struct ext3_extent *l = EXT_FIRST_EXTENT(eh) + 1;
+	struct ext3_extent *r = EXT_LAST_EXTENT(eh);
+	struct ext3_extent *m;
+
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ee_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	return l - 1;
+}
+
+static void ext3_ext_drop_refs(struct ext3_ext_path *path)
+{
+	int i;
+
+	for (i = 0; i <= EXT3_EXT_MAX_DEPTH; i++) {
+		brelse(path[i].p_bh);
+		path[i].p_bh = NULL;
+	}
+}
+
+/*
+ * Walk from the root to the leaf that would hold @block, filling in
+ * @path.  path[depth].p_ext is the extent nearest to @block as found by
+ * ext3_ext_binsearch(), or NULL if the leaf is empty.  Returns the depth
+ * of the tree or a negative error; the caller drops the buffers with
+ * ext3_ext_drop_refs() either way.
+ */
+static int ext3_ext_find_extent(struct inode *inode, unsigned long block,
+				struct ext3_ext_path *path)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+	struct buffer_head *bh;
+	unsigned long nr;
+	int depth = ext_depth(inode);
+	int i;
+
+	if (depth > EXT3_EXT_MAX_DEPTH) {
+		ext3_error(inode->i_sb, "ext3_ext_find_extent",
+			   "inode #%lu: extent tree too deep (%d)",
+			   inode->i_ino, depth);
+		return -EIO;
+	}
+	if (ext3_ext_check(inode, eh, depth))
+		return -EIO;
+
+	for (i = 0; i < depth; i++) {
+		path[i].p_hdr = eh;
+		path[i].p_idx = ext3_ext_binsearch_idx(eh, block);
+		path[i].p_ext = NULL;
+
+		nr = le32_to_cpu(path[i].p_idx->ei_leaf);
+		bh = sb_bread(inode->i_sb, nr);
+		if (!bh) {
+			ext3_error(inode->i_sb, "ext3_ext_find_extent",
+				   "Read failure, inode=%lu, block=%lu",
+				   inode->i_ino, nr);
+			return -EIO;
+		}
+		path[i + 1].p_bh = bh;
+		eh = ext_block_hdr(bh);
+		if (ext3_ext_check(inode, eh, depth - i - 1))
+			return -EIO;
+	}
+
+	path[depth].p_hdr = eh;
+	path[depth].p_idx = NULL;
+	path[depth].p_ext = eh->eh_entries ? ext3_ext_binsearch(eh, block) :
+					     NULL;
+	return depth;
+}
+
+/*
+ * Each node lives either in a buffer or, for the root, in the inode:
+ * these get journal access to and dirty whichever one it is.
+ */
+static int ext3_ext_get_access(handle_t *handle, struct ext3_ext_path *path)
+{
+	if (path->p_bh)
+		return ext3_journal_get_write_access(handle, path->p_bh);
+	return 0;
+}
+
+static int ext3_ext_dirty(handle_t *handle, struct inode *inode,
+			  struct ext3_ext_path *path)
+{
+	if (path->p_bh)
+		return ext3_journal_dirty_metadata(handle, path->p_bh);
+	return ext3_mark_inode_dirty(handle, inode);
+}
+
+static unsigned long ext3_ext_group_goal(struct inode *inode)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long bg_start;
+	unsigned long colour;
+
+	bg_start = (ei->i_block_group * EXT3_BLOCKS_PER_GROUP(inode->i_sb)) +
+		le32_to_cpu(EXT3_SB(inode->i_sb)->s_es->s_first_data_block);
+	colour = (current->pid % 16) *
+			(EXT3_BLOCKS_PER_GROUP(inode->i_sb) / 16);
+	return bg_start + colour;
+}
+
+/*
+ * Prefer the block that would make @block contiguous with the nearest
+ * extent, then the leaf itself, then the inode's group as ext3_find_near()
+ * does for indirect mapped files.
+ */
+static unsigned long ext3_ext_find_goal(struct inode *inode,
+					struct ext3_ext_path *path,
+					int depth, unsigned long block)
+{
+	struct ext3_extent *ex = path[depth].p_ext;
+
+	if (ex) {
+		unsigned long ee_block = le32_to_cpu(ex->ee_block);
+		unsigned long ee_start = le32_to_cpu(ex->ee_start);
+
+		if (block >= ee_block)
+			return ee_start + (block - ee_block);
+		if (ee_start > ee_block - block)
+			return ee_start - (ee_block - block);
+		return ee_start;
+	}
+	if (path[depth].p_bh)
+		return path[depth].p_bh->b_blocknr;
+	return ext3_ext_group_goal(inode);
+}
+
+/*
+ * Allocate and initialise an empty tree node of the given depth.  The
+ * caller fills it in and dirties it.
+ */
+static struct buffer_head *ext3_ext_new_node(handle_t *handle,
+					     struct inode *inode,
+					     unsigned long goal, int depth,
+					     int *err)
+{
+	struct ext3_extent_header *eh;
+	struct buffer_head *bh;
+	unsigned long nr;
+
+	nr = ext3_new_block(handle, inode, goal, err);
+	if (!nr)
+		return NULL;
+
+	bh = sb_getblk(inode->i_sb, nr);
+	lock_buffer(bh);
+	BUFFER_TRACE(bh, "call get_create_access");
+	*err = ext3_journal_get_create_access(handle, bh);
+	if (*err) {
+		unlock_buffer(bh);
+		brelse(bh);
+		ext3_free_blocks(handle, inode, nr, 1);
+		return NULL;
+	}
+	memset(bh->b_data, 0, bh->b_size);
+	eh = ext_block_hdr(bh);
+	eh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	eh->eh_max = cpu_to_le16(ext3_ext_space_block(inode));
+	eh->eh_depth = cpu_to_le16(depth);
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+	return bh;
+}
+
+/*
+ * The nodes of @path below level @at are full, and @at has room for one
+ * more index.  Move everything to the right of @path below @at into a
+ * new chain of nodes, and index the chain from @at.  The new chain starts
+ * at the first moved extent, or at @block itself when @path ends at the
+ * last extent, in which case the new leaf is left empty for it.
+ */
+static int ext3_ext_split(handle_t *handle, struct inode *inode,
+			  struct ext3_ext_path *path, int at,
+			  unsigned long block, unsigned long goal)
+{
+	struct buffer_head *bhs[EXT3_EXT_MAX_DEPTH + 1];
+	struct ext3_extent_header *eh, *neh;
+	struct ext3_extent_idx *ix;
+	struct ext3_extent *ex;
+	unsigned long border;
+	int depth = ext_depth(inode);
+	int i, m, err = 0;
+
+	ex = path[depth].p_ext;
+	if (ex != EXT_LAST_EXTENT(path[depth].p_hdr))
+		border = le32_to_cpu(ex[1].ee_block);
+	else
+		border = block;
+
+	memset(bhs, 0, sizeof(bhs));
+	for (i = depth; i > at; i--) {
+		bhs[i] = ext3_ext_new_node(handle, inode, goal, depth - i, &err);
+		if (!bhs[i]) {
+			for (i++; i <= depth; i++) {
+				unsigned long nr = bhs[i]->b_blocknr;
+
+				ext3_journal_forget(handle, bhs[i]);
+				ext3_free_blocks(handle, inode, nr, 1);
+			}
+			return err;
+		}
+	}
+
+	/* the new leaf takes the extents after path[depth].p_ext */
+	eh = path[depth].p_hdr;
+	neh = ext_block_hdr(bhs[depth]);
+	m = EXT_LAST_EXTENT(eh) - ex;
+	if (m) {
+		err = ext3_ext_get_access(handle, path + depth);
+		if (err)
+			goto out;
+		memmove(EXT_FIRST_EXTENT(neh), ex + 1,
+			m * sizeof(struct ext3_extent));
+		neh->eh_entries = cpu_to_le16(m);
+		eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) - m);
+		err = ext3_ext_dirty(handle, inode, path + depth);
+		if (err)
+			goto out;
+	}
+	err = ext3_journal_dirty_metadata(handle, bhs[depth]);
+	if (err)
+		goto out;
+
+	/* each new index node points down the chain, then takes the
+	 * indexes after the path at its level */
+	for (i = depth - 1; i > at; i--) {
+		eh = path[i].p_hdr;
+		neh = ext_block_hdr(bhs[i]);
+		ix = EXT_FIRST_INDEX(neh);
+		ix->ei_block = cpu_to_le32(border);
+		ix->ei_leaf = cpu_to_le32(bhs[i + 1]->b_blocknr);
+		m = EXT_LAST_INDEX(eh) - path[i].p_idx;
+		if (m) {
+			err = ext3_ext_get_access(handle, path + i);
+			if (err)
+				goto out;
+			memmove(ix + 1, path[i].p_idx + 1,
+				m * sizeof(struct ext3_extent_idx));
+			eh->eh_entries =
+				cpu_to_le16(le16_to_cpu(eh->eh_entries) - m);
+			err = ext3_ext_dirty(handle, inode, path + i);
+			if (err)
+				goto out;
+		}
+		neh->eh_entries = cpu_to_le16(m + 1);
+		err = ext3_journal_dirty_metadata(handle, bhs[i]);
+		if (err)
+			goto out;
+	}
+
+	/* and finally hook the chain in at level @at */
+	err = ext3_ext_get_access(handle, path + at);
+	if (err)
+		goto out;
+	eh = path[at].p_hdr;
+	ix = path[at].p_idx + 1;
+	m = EXT_LAST_INDEX(eh) - path[at].p_idx;
+	if (m)
+		memmove(ix + 1, ix, m * sizeof(struct ext3_extent_idx));
+	ix->ei_block = cpu_to_le32(border);
+	ix->ei_leaf = cpu_to_le32(bhs[at + 1]->b_blocknr);
+	ix->ei_leaf_hi = 0;
+	ix->ei_unused = 0;
+	eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) + 1);
+	err = ext3_ext_dirty(handle, inode, path + at);
+out:
+	for (i = at + 1; i <= depth; i++)
+		brelse(bhs[i]);
+	return err;
+}
+
+/*
+ * Every node is full: push the contents of the root down into a new
+ * block and leave the root as a single index pointing at it.  The first
+ * index of each level always covers from block 0, so nothing to the left
+ * of the tree needs fixing up later.
+ */
+static int ext3_ext_grow_indepth(handle_t *handle, struct inode *inode,
+				 unsigned long goal)
+{
+	struct ext3_extent_header *root = ext_inode_hdr(inode);
+	struct ext3_extent_header *neh;
+	struct ext3_extent_idx *ix;
+	struct buffer_head *bh;
+	int depth = ext_depth(inode);
+	int err;
+
+	bh = ext3_ext_new_node(handle, inode, goal, depth, &err);
+	if (!bh)
+		return err;
+	neh = ext_block_hdr(bh);
+	memcpy(EXT_FIRST_EXTENT(neh), EXT_FIRST_EXTENT(root),
+	       le16_to_cpu(root->eh_entries) * sizeof(struct ext3_extent));
+	neh->eh_entries = root->eh_entries;
+	err = ext3_journal_dirty_metadata(handle, bh);
+	if (!err) {
+		ix = EXT_FIRST_INDEX(root);
+		ix->ei_block = 0;
+		ix->ei_leaf = cpu_to_le32(bh->b_blocknr);
+		ix->ei_leaf_hi = 0;
+		ix->ei_unused = 0;
+		root->eh_entries = cpu_to_le16(1);
+		root->eh_depth = cpu_to_le16(depth + 1);
+		err = ext3_mark_inode_dirty(handle, inode);
+	}
+	brelse(bh);
+	return err;
+}
+
+/*
+ * The leaf of @path is full: split the lowest level that has room, or
+ * grow the tree by a level if none does.  Either way @path is stale on
+ * return and the caller must look @block up again.
+ */
+static int ext3_ext_make_room(handle_t *handle, struct inode *inode,
+			      struct ext3_ext_path *path, unsigned long block)
+{
+	int depth = ext_depth(inode);
+	unsigned long goal;
+	int i;
+
+	if (path[depth].p_bh)
+		goal = path[depth].p_bh->b_blocknr;
+	else
+		goal = ext3_ext_group_goal(inode);
+
+	for (i = depth - 1; i >= 0; i--)
+		if (le16_to_cpu(path[i].p_hdr->eh_entries) <
+		    le16_to_cpu(path[i].p_hdr->eh_max))
+			return ext3_ext_split(handle, inode, path, i,
+					      block, goal);
+
+	if (depth >= EXT3_EXT_MAX_DEPTH) {
+		ext3_error(inode->i_sb, "ext3_ext_make_room",
+			   "inode #%lu: extent tree too deep", inode->i_ino);
+		return -EIO;
+	}
+	return ext3_ext_grow_indepth(handle, inode, goal);
+}
+
+/*
+ * Add a one block extent for @block to a leaf that has room for it.
+ */
+static int ext3_ext_insert(handle_t *handle, struct inode *inode,
+			   struct ext3_ext_path *path, unsigned long block,
+			   unsigned long newblock)
+{
+	struct ext3_extent_header *eh = path->p_hdr;
+	struct ext3_extent *ex = path->p_ext;
+	int m, err;
+
+	err = ext3_ext_get_access(handle, path);
+	if (err)
+		return err;
+
+	if (!ex)
+		ex = EXT_FIRST_EXTENT(eh);
+	else if (block > le32_to_cpu(ex->ee_block))
+		ex++;
+	m = EXT_LAST_EXTENT(eh) - ex + 1;
+	if (m > 0)
+		memmove(ex + 1, ex, m * sizeof(struct ext3_extent));
+	ex->ee_block = cpu_to_le32(block);
+	ex->ee_len = cpu_to_le16(1);
+	ex->ee_start_hi = 0;
+	ex->ee_start = cpu_to_le32(newblock);
+	eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) + 1);
+
+	return ext3_ext_dirty(handle, inode, path);
+}
+
+/*
+ * The extent mapped counterpart of ext3_get_block_handle().  Blocks are
+ * allocated one at a time, next to the extent they follow, so a file
+ * written sequentially keeps growing the same extent.
+ */
+int ext3_ext_get_block(handle_t *handle, struct inode *inode, sector_t iblock,
+		       struct buffer_head *bh_result, int create,
+		       int extend_disksize)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	struct ext3_ext_path path[EXT3_EXT_MAX_DEPTH + 1];
+	struct ext3_extent *ex;
+	unsigned long block = iblock;
+	unsigned long ee_block = 0, ee_start = 0, ee_len = 0;
+	unsigned long newblock = 0;
+	int depth, err;
+
+	J_ASSERT(handle != NULL || create == 0);
+
+	memset(path, 0, sizeof(path));
+	down(&ei->truncate_sem);
+repeat:
+	depth = ext3_ext_find_extent(inode, block, path);
+	if (depth < 0) {
+		err = depth;
+		goto out_free;
+	}
+
+	ex = path[depth].p_ext;
+	if (ex) {
+		ee_block = le32_to_cpu(ex->ee_block);
+		ee_start = le32_to_cpu(ex->ee_start);
+		ee_len = le16_to_cpu(ex->ee_len);
+		if (block >= ee_block && block < ee_block + ee_len) {
+			/* only possible on the first pass */
+			clear_buffer_new(bh_result);
+			map_bh(bh_result, inode->i_sb,
+			       ee_start + block - ee_block);
+			err = 0;
+			goto out;
+		}
+	}
+
+	/* a hole: plain lookups are done */
+	err = 0;
+	if (!create)
+		goto out;
+
+	if (!newblock) {
+		newblock = ext3_new_block(handle, inode,
+				ext3_ext_find_goal(inode, path, depth, block),
+				&err);
+		if (!newblock)
+			goto out;
+	}
+
+	if (ex && block == ee_block + ee_len &&
+	    newblock == ee_start + ee_len && ee_len < EXT3_EXT_MAX_LEN) {
+		err = ext3_ext_get_access(handle, path + depth);
+		if (!err) {
+			ex->ee_len = cpu_to_le16(ee_len + 1);
+			err = ext3_ext_dirty(handle, inode, path + depth);
+		}
+	} else if (le16_to_cpu(path[depth].p_hdr->eh_entries) <
+		   le16_to_cpu(path[depth].p_hdr->eh_max)) {
+		err = ext3_ext_insert(handle, inode, path + depth,
+				      block, newblock);
+	} else {
+		err = ext3_ext_make_room(handle, inode, path, block);
+		ext3_ext_drop_refs(path);
+		if (!err)
+			goto repeat;
+	}
+	if (err)
+		goto out_free;
+
+	/* i_disksize growing is protected by truncate_sem, as in
+	 * ext3_get_block_handle() */
+	if (extend_disksize && inode->i_size > ei->i_disksize)
+		ei->i_disksize = inode->i_size;
+	inode->i_ctime = CURRENT_TIME_SEC;
+	ext3_mark_inode_dirty(handle, inode);
+
+	set_buffer_new(bh_result);
+	map_bh(bh_result, inode->i_sb, newblock);
+	goto out;
+
+out_free:
+	if (newblock)
+		ext3_free_blocks(handle, inode, newblock, 1);
+out:
+	ext3_ext_drop_refs(path);
+	up(&ei->truncate_sem);
+	return err;
+}
+
+/*
+ * Make sure the handle has @needed credits for the next truncate step,
+ * committing what has been done so far if it cannot be extended.  The
+ * tree is consistent between steps, so that is always safe.
+ */
+static int ext3_ext_truncate_extend(handle_t *handle, struct inode *inode,
+				    int needed)
+{
+	int err;
+
+	if (handle->h_buffer_credits >= needed)
+		return 0;
+	err = ext3_journal_extend(handle, needed);
+	if (err <= 0)
+		return err;
+	err = ext3_mark_inode_dirty(handle, inode);
+	if (err)
+		return err;
+	jbd_debug(2, "restarting handle %p\n", handle);
+	return ext3_journal_restart(handle, needed);
+}
+
+/*
+ * Free the empty node at @level of the rightmost path @path and drop
+ * its index, the last one of the level above, freeing in turn any index
+ * node that leaves empty.  An empty root becomes an empty leaf again.
+ */
+static int ext3_ext_rm_node(handle_t *handle, struct inode *inode,
+			    struct ext3_ext_path *path, int level)
+{
+	struct ext3_extent_header *eh;
+	unsigned long nr;
+	int err;
+
+	for (; level > 0; level--) {
+		eh = path[level - 1].p_hdr;
+		err = ext3_ext_get_access(handle, path + level - 1);
+		if (err)
+			return err;
+		eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) - 1);
+		err = ext3_ext_dirty(handle, inode, path + level - 1);
+		if (err)
+			return err;
+
+		/* revoke before the bitmap is cleared: see
+		 * ext3_free_branches() */
+		nr = path[level].p_bh->b_blocknr;
+		ext3_forget(handle, 1, inode, path[level].p_bh, nr);
+		path[level].p_bh = NULL;
+		ext3_free_blocks(handle, inode, nr, 1);
+
+		if (eh->eh_entries)
+			return 0;
+	}
+
+	eh = ext_inode_hdr(inode);
+	eh->eh_depth = 0;
+	return ext3_mark_inode_dirty(handle, inode);
+}
+
+/*
+ * Free every block of @inode at or after logical block @start.  Called
+ * from ext3_truncate() with truncate_sem held and the inode on the
+ * orphan list.  Works from the right end of the file one extent at a
+ * time, so the tree is whole whenever the transaction has to be
+ * restarted and a crash leaves a file ext3_orphan_cleanup() can finish.
+ */
+void ext3_ext_truncate(handle_t *handle, struct inode *inode,
+		       unsigned long start)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext3_ext_path path[EXT3_EXT_MAX_DEPTH + 1];
+	struct ext3_extent_header *eh;
+	struct ext3_extent *ex;
+	unsigned long ee_block, ee_start, ee_len, num, nr;
+	int depth, err;
+
+	memset(path, 0, sizeof(path));
+	for (;;) {
+		if (is_handle_aborted(handle))
+			break;
+		depth = ext3_ext_find_extent(inode, ~0UL, path);
+		if (depth < 0)
+			break;
+
+		err = ext3_ext_truncate_extend(handle, inode,
+				EXT3_DATA_TRANS_BLOCKS + 3 * depth);
+		if (err)
+			break;
+
+		eh = path[depth].p_hdr;
+		ex = path[depth].p_ext;
+		if (!ex) {
+			/* only the root can be an empty leaf, but tidy up
+			 * after anything else that left one behind */
+			if (depth == 0 || ext3_ext_rm_node(handle, inode,
+							   path, depth))
+				break;
+			ext3_ext_drop_refs(path);
+			continue;
+		}
+
+		ee_block = le32_to_cpu(ex->ee_block);
+		ee_start = le32_to_cpu(ex->ee_start);
+		ee_len = le16_to_cpu(ex->ee_len);
+		if (ee_block + ee_len <= start)
+			break;
+
+		err = ext3_ext_get_access(handle, path + depth);
+		if (err)
+			break;
+		if (ee_block >= start) {
+			num = ee_len;
+			eh->eh_entries =
+				cpu_to_le16(le16_to_cpu(eh->eh_entries) - 1);
+		} else {
+			num = ee_block + ee_len - start;
+			ex->ee_len = cpu_to_le16(ee_len - num);
+		}
+		err = ext3_ext_dirty(handle, inode, path + depth);
+		if (err)
+			break;
+
+		for (nr = ee_start + ee_len - num; nr < ee_start + ee_len; nr++)
+			ext3_forget(handle, 0, inode,
+				    sb_find_get_block(sb, nr), nr);
+		ext3_free_blocks(handle, inode, ee_start + ee_len - num, num);
+
+		if (eh->eh_entries == 0 && depth &&
+		    ext3_ext_rm_node(handle, inode, path, depth))
+			break;
+		ext3_ext_drop_refs(path);
+	}
+	ext3_ext_drop_refs(path);
+}
+
+/*
+ * Credits for mapping @nrblocks blocks: at worst each one splits every
+ * level of the tree, or grows it by one.
+ */
+int ext3_ext_trans_blocks(struct inode *inode, int nrblocks)
+{
+	return nrblocks * (2 * (ext_depth(inode) + 1) + 1);
+}
+
+/*
+ * Start an empty extent tree in the i_data of a new inode.
+ */
+void ext3_ext_tree_init(struct inode *inode)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+
+	eh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	eh->eh_entries = 0;
+	eh->eh_max = cpu_to_le16(ext3_ext_space_root(inode));
+	eh->eh_depth = 0;
+	eh->eh_generation = 0;
+	EXT3_I(inode)->i_flags |= EXT3_EXTENTS_FL;
+}
@@ -409,6 +409,93 @@ static int find_group_other(struct super_block *sb, struct inode *parent)
 	return -1;
 }
 
+/*
+ * With flex_bg the bitmaps and inode tables of 2^s_log_groups_per_flex
+ * consecutive groups are packed together at the start of the first one,
+ * which leaves the data blocks of the whole flex group to be handed out
+ * in long runs.  Files are kept in their parent's flex group for as long
+ * as it has a fair share of the free blocks left; after that they go to
+ * the flex group with the most free blocks that still has free inodes.
+ */
+static void flex_group_counts(struct super_block *sb, int flex,
+			      unsigned long *free_inodes,
+			      unsigned long *free_blocks)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	int group = flex << sbi->s_log_groups_per_flex;
+	int end = min_t(int, group + (1 << sbi->s_log_groups_per_flex),
+			sbi->s_groups_count);
+	struct ext3_group_desc *desc;
+	struct buffer_head *bh;
+
+	*free_inodes = *free_blocks = 0;
+	for (; group < end; group++) {
+		desc = ext3_get_group_desc(sb, group, &bh);
+		if (!desc)
+			continue;
+		*free_inodes += le16_to_cpu(desc->bg_free_inodes_count);
+		*free_blocks += le16_to_cpu(desc->bg_free_blocks_count);
+	}
+}
+
+static int find_group_flex(struct super_block *sb, struct inode *parent)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	int log_flex = sbi->s_log_groups_per_flex;
+	int ngroups = sbi->s_groups_count;
+	int nflex = (ngroups + (1 << log_flex) - 1) >> log_flex;
+	int parent_group = EXT3_I(parent)->i_block_group;
+	int flex = parent_group >> log_flex;
+	int best_flex = -1;
+	unsigned long freei, freeb, best_freeb = 0, min_blocks;
+	struct ext3_group_desc *desc;
+	struct buffer_head *bh;
+	int first, end, group, i, pass;
+
+	min_blocks = (EXT3_BLOCKS_PER_GROUP(sb) << log_flex) / 8;
+	freeb = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
+	if (min_blocks > freeb / nflex)
+		min_blocks = freeb / nflex;
+
+	flex_group_counts(sb, flex, &freei, &freeb);
+	if (freei && freeb >= min_blocks) {
+		best_flex = flex;
+	} else {
+		for (i = 1; i < nflex; i++) {
+			if (++flex >= nflex)
+				flex = 0;
+			flex_group_counts(sb, flex, &freei, &freeb);
+			if (freei && freeb > best_freeb) {
+				best_flex = flex;
+				best_freeb = freeb;
+			}
+		}
+		if (best_flex < 0)
+			return -1;
+	}
+
+	/*
+	 * Now a group inside it, starting from the parent's own if that is
+	 * in there: first one with free blocks too, then any with inodes.
+	 */
+	first = best_flex << log_flex;
+	end = min(first + (1 << log_flex), ngroups);
+	for (pass = 0; pass < 2; pass++) {
+		group = parent_group;
+		if (group < first || group >= end)
+			group = first;
+		for (i = first; i < end; i++) {
+			desc = ext3_get_group_desc(sb, group, &bh);
+			if (desc && le16_to_cpu(desc->bg_free_inodes_count) &&
+			    (pass || le16_to_cpu(desc->bg_free_blocks_count)))
+				return group;
+			if (++group >= end)
+				group = first;
+		}
+	}
+	return -1;
+}
+
 /*
  * There are two policies for allocating an inode.  If the new inode is
  * a directory, then a forward search is made for a block group with both
@@ -452,6 +539,10 @@ struct inode *ext3_new_inode(handle_t *handle, struct inode * dir, int mode)
 			group = find_group_dir(sb, dir);
 		else
 			group = find_group_orlov(sb, dir);
+	} else if (sbi->s_log_groups_per_flex) {
+		group = find_group_flex(sb, dir);
+		if (group == -1)
+			group = find_group_other(sb, dir);
 	} else 
 		group = find_group_other(sb, dir);
 
@@ -567,7 +658,7 @@ got:
 	ei->i_dir_start_lookup = 0;
 	ei->i_disksize = 0;
 
-	ei->i_flags = EXT3_I(dir)->i_flags & ~EXT3_INDEX_FL;
+	ei->i_flags = EXT3_I(dir)->i_flags & ~(EXT3_INDEX_FL|EXT3_EXTENTS_FL);
 	if (S_ISLNK(mode))
 		ei->i_flags &= ~(EXT3_IMMUTABLE_FL|EXT3_APPEND_FL);
 	/* dirsync only applies to directories */
@@ -587,6 +678,8 @@ got:
 	atomic_set(&ei->i_rsv_window.rsv_alloc_hit, 0);
 	seqlock_init(&ei->i_rsv_window.rsv_seqlock);
 	ei->i_block_group = group;
+	if (S_ISREG(mode) && test_opt(sb, EXTENTS))
+		ext3_ext_tree_init(inode);
 
 	ext3_set_inode_flags(inode);
 	if (IS_DIRSYNC(inode))
@@ -35,11 +35,13 @@
 #include <linux/buffer_head.h>
 #include <linux/writeback.h>
 #include <linux/mpage.h>
+#include <linux/pagevec.h>
 #include <linux/uio.h>
 #include "xattr.h"
 #include "acl.h"
 
 static int ext3_writepage_trans_blocks(struct inode *inode);
+static struct address_space_operations ext3_da_aops;
 
 /*
  * Test whether an inode is a fast symlink.
@@ -494,6 +496,9 @@ static int ext3_find_goal(struct inode *inode, long block, Indirect chain[4],
  *
  *	This function allocates @num blocks, zeroes out all but the last one,
  *	links them into chain and (if we are synchronous) writes them to disk.
+ *	The blocks are asked for as one contiguous run, so that the indirect
+ *	blocks land right in front of the data they map; whatever the run
+ *	came up short by is allocated a block at a time.
  *	In other words, it prepares a branch that can be spliced onto the
  *	inode. It stores the information about that chain in the branch[], in
  *	the same format as ext3_get_branch() would do. We are calling it after
@@ -520,14 +525,21 @@ static int ext3_alloc_branch(handle_t *handle, struct inode *inode,
 	int n = 0, keys = 0;
 	int err = 0;
 	int i;
-	int parent = ext3_alloc_block(handle, inode, goal, &err);
+	unsigned long count = num;
+	int parent = ext3_new_blocks(handle, inode, goal, &count, &err);
 
 	branch[0].key = cpu_to_le32(parent);
 	if (parent) {
+		keys = 1;
 		for (n = 1; n < num; n++) {
 			struct buffer_head *bh;
-			/* Allocate the next block */
-			int nr = ext3_alloc_block(handle, inode, parent, &err);
+			int nr;
+
+			/* Allocate the next block, unless the run covered it */
+			if (n < count)
+				nr = parent + 1;
+			else
+				nr = ext3_alloc_block(handle, inode, parent, &err);
 			if (!nr)
 				break;
 			branch[n].key = cpu_to_le32(nr);
@@ -574,6 +586,9 @@ static int ext3_alloc_branch(handle_t *handle, struct inode *inode,
 	}
 	for (i = 0; i < keys; i++)
 		ext3_free_blocks(handle, inode, le32_to_cpu(branch[i].key), 1);
+	if (count > keys)
+		ext3_free_blocks(handle, inode,
+				 le32_to_cpu(branch[0].key) + keys, count - keys);
 	return err;
 }
 
@@ -706,9 +721,15 @@ ext3_get_block_handle(handle_t *handle, struct inode *inode, sector_t iblock,
 	unsigned long goal;
 	int left;
 	int boundary = 0;
-	int depth = ext3_block_to_path(inode, iblock, offsets, &boundary);
+	int depth;
 	struct ext3_inode_info *ei = EXT3_I(inode);
 
+	if (ei->i_flags & EXT3_EXTENTS_FL)
+		return ext3_ext_get_block(handle, inode, iblock, bh_result,
+					  create, extend_disksize);
+
+	depth = ext3_block_to_path(inode, iblock, offsets, &boundary);
+
 	J_ASSERT(handle != NULL || create == 0);
 
 	if (depth == 0)
@@ -1183,6 +1204,10 @@ static sector_t ext3_bmap(struct address_space *mapping, sector_t block)
 			return 0;
 	}
 
+	/* delayed blocks have no address yet: allocate them first */
+	if (mapping->a_ops == &ext3_da_aops)
+		filemap_write_and_wait(mapping);
+
 	return generic_block_bmap(mapping,block,ext3_get_block);
 }
 
@@ -1352,6 +1377,335 @@ out_fail:
 	return ret;
 }
 
+/*
+ * Delayed allocation, for regular files in data=writeback mode when the
+ * filesystem is mounted with "delalloc".
+ *
+ * prepare_write() only looks blocks up.  A hole is not allocated but
+ * reserved: quota is charged and ext3_reserve_blocks() sets the block
+ * aside, and the buffer is marked BH_Delay.  ext3_da_writepages() then
+ * allocates every delayed buffer in the dirty range under one handle
+ * before the pages go to disk, so a file written in small appends still
+ * gets its blocks in one contiguous run, and a file removed before
+ * writeback never touches the bitmaps at all.
+ *
+ * All changes to a buffer's delayed state happen under the page lock.
+ */
+static unsigned long ext3_da_meta_blocks(struct inode *inode,
+					 unsigned long data_blocks)
+{
+	int addr_per_block = EXT3_ADDR_PER_BLOCK(inode->i_sb);
+
+	/*
+	 * One indirect block per addr_per_block data blocks, plus the
+	 * double and triple indirect blocks above them.  That is exact for
+	 * a contiguous range, which is what delayed allocation is for;
+	 * scattered writes may need more and can still get ENOSPC at
+	 * writeback.
+	 */
+	if (!data_blocks)
+		return 0;
+	return (data_blocks + addr_per_block - 1) / addr_per_block + 2;
+}
+
+static int ext3_da_reserve_space(struct inode *inode)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long md_needed;
+	int ret;
+
+	if (DQUOT_ALLOC_BLOCK_NODIRTY(inode, 1))
+		return -EDQUOT;
+
+	spin_lock(&ei->i_block_reservation_lock);
+	md_needed = ext3_da_meta_blocks(inode, ei->i_reserved_data_blocks + 1) -
+		    ei->i_reserved_meta_blocks;
+	ret = ext3_reserve_blocks(inode->i_sb, 1 + md_needed);
+	if (!ret) {
+		ei->i_reserved_data_blocks++;
+		ei->i_reserved_meta_blocks += md_needed;
+	}
+	spin_unlock(&ei->i_block_reservation_lock);
+
+	if (ret)
+		DQUOT_FREE_BLOCK_NODIRTY(inode, 1);
+	return ret;
+}
+
+static void ext3_da_release_space(struct inode *inode, int nr)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long md_released;
+
+	spin_lock(&ei->i_block_reservation_lock);
+	ei->i_reserved_data_blocks -= nr;
+	md_released = ei->i_reserved_meta_blocks -
+		      ext3_da_meta_blocks(inode, ei->i_reserved_data_blocks);
+	ei->i_reserved_meta_blocks -= md_released;
+	spin_unlock(&ei->i_block_reservation_lock);
+
+	ext3_release_blocks(inode->i_sb, nr + md_released);
+	DQUOT_FREE_BLOCK_NODIRTY(inode, nr);
+}
+
+/*
+ * get_block for prepare_write(): map what is already allocated, reserve
+ * (once) what is not.  A hole reads as zeroes, so that is what the rest
+ * of a newly delayed block holds.
+ */
+static int ext3_da_get_block_prep(struct inode *inode, sector_t iblock,
+				  struct buffer_head *bh_result, int create)
+{
+	struct page *page = bh_result->b_page;
+	int ret;
+
+	ret = ext3_get_block_handle(NULL, inode, iblock, bh_result, 0, 0);
+	if (ret || buffer_mapped(bh_result) || buffer_delay(bh_result))
+		return ret;
+
+	ret = ext3_da_reserve_space(inode);
+	if (ret)
+		return ret;
+
+	if (!PageUptodate(page) && !buffer_uptodate(bh_result)) {
+		char *kaddr = kmap_atomic(page, KM_USER0);
+
+		memset(kaddr + bh_offset(bh_result), 0, bh_result->b_size);
+		flush_dcache_page(page);
+		kunmap_atomic(kaddr, KM_USER0);
+		set_buffer_uptodate(bh_result);
+	}
+	set_buffer_delay(bh_result);
+	return 0;
+}
+
+/*
+ * get_block for writepage(): a delayed buffer hands its reservation back
+ * just before the real allocation takes it again.
+ */
+static int ext3_da_get_block_write(struct inode *inode, sector_t iblock,
+				   struct buffer_head *bh_result, int create)
+{
+	if (buffer_delay(bh_result)) {
+		ext3_da_release_space(inode, 1);
+		clear_buffer_delay(bh_result);
+	}
+	return ext3_get_block(inode, iblock, bh_result, create);
+}
+
+/*
+ * Drop the reservations of delayed buffers from @offset to the end of
+ * the page, which is about to be invalidated; and, with @clean_only, of
+ * the delayed buffers a failed prepare_write() left clean.
+ */
+static void ext3_da_drop_delayed(struct page *page, unsigned long offset,
+				 int clean_only)
+{
+	struct inode *inode = page->mapping->host;
+	struct buffer_head *head, *bh;
+	unsigned long curr_off = 0;
+	int nr = 0;
+
+	if (!page_has_buffers(page))
+		return;
+	bh = head = page_buffers(page);
+	do {
+		if (curr_off >= offset && buffer_delay(bh) &&
+		    !(clean_only && buffer_dirty(bh))) {
+			clear_buffer_delay(bh);
+			nr++;
+		}
+		curr_off += bh->b_size;
+		bh = bh->b_this_page;
+	} while (bh != head);
+
+	if (nr)
+		ext3_da_release_space(inode, nr);
+}
+
+static int ext3_da_prepare_write(struct file *file, struct page *page,
+				 unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	int retries = 0;
+	int ret;
+
+retry:
+	ret = block_prepare_write(page, from, to, ext3_da_get_block_prep);
+	if (ret) {
+		ext3_da_drop_delayed(page, 0, 1);
+		if (ret == -ENOSPC &&
+		    ext3_should_retry_alloc(inode->i_sb, &retries))
+			goto retry;
+	}
+	return ret;
+}
+
+static int ext3_da_commit_write(struct file *file, struct page *page,
+				unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	loff_t new_i_size;
+
+	new_i_size = ((loff_t)page->index << PAGE_CACHE_SHIFT) + to;
+	if (new_i_size > EXT3_I(inode)->i_disksize)
+		EXT3_I(inode)->i_disksize = new_i_size;
+	return generic_commit_write(file, page, from, to);
+}
+
+static int ext3_da_writepage(struct page *page, struct writeback_control *wbc)
+{
+	struct inode *inode = page->mapping->host;
+	handle_t *handle = NULL;
+	int ret = 0;
+	int err;
+
+	if (ext3_journal_current_handle())
+		goto out_fail;
+
+	handle = ext3_journal_start(inode, ext3_writepage_trans_blocks(inode));
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out_fail;
+	}
+
+	ret = block_write_full_page(page, ext3_da_get_block_write, wbc);
+	err = ext3_journal_stop(handle);
+	if (!ret)
+		ret = err;
+	return ret;
+
+out_fail:
+	redirty_page_for_writepage(wbc, page);
+	unlock_page(page);
+	return ret;
+}
+
+/*
+ * Allocate the delayed buffers of a locked page inside i_size.
+ */
+static int ext3_da_map_page(handle_t *handle, struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	struct buffer_head *head, *bh;
+	sector_t block, last_block;
+	int err = 0;
+
+	block = (sector_t)page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits);
+	last_block = (i_size_read(inode) - 1) >> inode->i_blkbits;
+	bh = head = page_buffers(page);
+	do {
+		if (buffer_delay(bh) && block <= last_block) {
+			ext3_da_release_space(inode, 1);
+			clear_buffer_delay(bh);
+			err = ext3_get_block_handle(handle, inode, block, bh, 1, 0);
+			if (err)
+				break;
+			if (buffer_new(bh)) {
+				clear_buffer_new(bh);
+				unmap_underlying_metadata(bh->b_bdev,
+							  bh->b_blocknr);
+			}
+		}
+		block++;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return err;
+}
+
+static int ext3_da_page_has_delayed(struct page *page)
+{
+	struct buffer_head *head, *bh;
+
+	if (!page_has_buffers(page))
+		return 0;
+	bh = head = page_buffers(page);
+	do {
+		if (buffer_delay(bh))
+			return 1;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return 0;
+}
+
+/*
+ * First map every delayed buffer in the range being written back, in
+ * file order and under a single handle, so the allocator sees the whole
+ * dirty range at once; then write the pages out as usual.
+ *
+ * Pages may only be locked outside a handle, so while one is open they
+ * are only trylocked: a page somebody else holds keeps its delayed
+ * buffers and is allocated by ext3_da_writepage() instead.
+ */
+static int ext3_da_writepages(struct address_space *mapping,
+			      struct writeback_control *wbc)
+{
+	struct inode *inode = mapping->host;
+	int needed = ext3_writepage_trans_blocks(inode);
+	handle_t *handle = NULL;
+	struct pagevec pvec;
+	pgoff_t index = 0;
+	pgoff_t end = ~(pgoff_t)0;
+	long nr_pages = wbc->nr_to_write;
+	int i, nr, err = 0;
+
+	if (ext3_journal_current_handle())
+		goto write;
+
+	if (wbc->start || wbc->end) {
+		index = wbc->start >> PAGE_CACHE_SHIFT;
+		end = wbc->end >> PAGE_CACHE_SHIFT;
+	}
+
+	pagevec_init(&pvec, 0);
+	while (!err && nr_pages > 0 && index <= end &&
+	       (nr = pagevec_lookup_tag(&pvec, mapping, &index,
+					PAGECACHE_TAG_DIRTY, PAGEVEC_SIZE))) {
+		for (i = 0; i < nr && !err; i++) {
+			struct page *page = pvec.pages[i];
+
+			if (page->index > end)
+				break;
+			if (TestSetPageLocked(page))
+				continue;
+			if (page->mapping != mapping ||
+			    !ext3_da_page_has_delayed(page)) {
+				unlock_page(page);
+				continue;
+			}
+
+			if (!handle) {
+				handle = ext3_journal_start(inode, needed);
+				if (IS_ERR(handle)) {
+					err = PTR_ERR(handle);
+					handle = NULL;
+				}
+			} else if (handle->h_buffer_credits < needed) {
+				err = ext3_journal_extend(handle, needed);
+				if (err > 0)
+					err = ext3_journal_restart(handle,
+								   needed);
+			}
+			if (!err)
+				err = ext3_da_map_page(handle, page);
+			unlock_page(page);
+			nr_pages--;
+		}
+		pagevec_release(&pvec);
+		cond_resched();
+	}
+	if (handle) {
+		int ret = ext3_journal_stop(handle);
+
+		if (!err)
+			err = ret;
+	}
+write:
+	/* buffers left delayed by an error go through writepage() */
+	i = mpage_writepages(mapping, wbc, NULL);
+	return err ? err : i;
+}
+
 static int ext3_journalled_writepage(struct page *page,
 				struct writeback_control *wbc)
 {
@@ -1431,6 +1785,7 @@ static int ext3_invalidatepage(struct page *page, unsigned long offset)
 	if (offset == 0)
 		ClearPageChecked(page);
 
+	ext3_da_drop_delayed(page, offset, 0);
 	return journal_invalidatepage(journal, page, offset);
 }
 
@@ -1563,6 +1918,20 @@ static struct address_space_operations ext3_writeback_aops = {
 	.direct_IO	= ext3_direct_IO,
 };
 
+static struct address_space_operations ext3_da_aops = {
+	.readpage	= ext3_readpage,
+	.readpages	= ext3_readpages,
+	.writepage	= ext3_da_writepage,
+	.writepages	= ext3_da_writepages,
+	.sync_page	= block_sync_page,
+	.prepare_write	= ext3_da_prepare_write,
+	.commit_write	= ext3_da_commit_write,
+	.bmap		= ext3_bmap,
+	.invalidatepage	= ext3_invalidatepage,
+	.releasepage	= ext3_releasepage,
+	.direct_IO	= ext3_direct_IO,
+};
+
 static struct address_space_operations ext3_journalled_aops = {
 	.readpage	= ext3_readpage,
 	.readpages	= ext3_readpages,
@@ -1580,6 +1949,9 @@ void ext3_set_aops(struct inode *inode)
 {
 	if (ext3_should_order_data(inode))
 		inode->i_mapping->a_ops = &ext3_ordered_aops;
+	else if (ext3_should_writeback_data(inode) &&
+		 test_opt(inode->i_sb, DELALLOC))
+		inode->i_mapping->a_ops = &ext3_da_aops;
 	else if (ext3_should_writeback_data(inode))
 		inode->i_mapping->a_ops = &ext3_writeback_aops;
 	else
@@ -2107,9 +2479,13 @@ void ext3_truncate(struct inode * inode)
 	if (page)
 		ext3_block_truncate_page(handle, page, mapping, inode->i_size);
 
-	n = ext3_block_to_path(inode, last_block, offsets, NULL);
-	if (n == 0)
-		goto out_stop;	/* error */
+	if (ei->i_flags & EXT3_EXTENTS_FL)
+		n = 0;
+	else {
+		n = ext3_block_to_path(inode, last_block, offsets, NULL);
+		if (n == 0)
+			goto out_stop;	/* error */
+	}
 
 	/*
 	 * OK.  This truncate is going to happen.  We add the inode to the
@@ -2138,6 +2514,11 @@ void ext3_truncate(struct inode * inode)
 	 */
 	down(&ei->truncate_sem);
 
+	if (ei->i_flags & EXT3_EXTENTS_FL) {
+		ext3_ext_truncate(handle, inode, last_block);
+		goto out_unlock;
+	}
+
 	if (n == 1) {		/* direct blocks */
 		ext3_free_data(handle, inode, NULL, i_data+offsets[0],
 			       i_data + EXT3_NDIR_BLOCKS);
@@ -2200,6 +2581,7 @@ do_indirects:
 		case EXT3_TIND_BLOCK:
 			;
 	}
+out_unlock:
 	up(&ei->truncate_sem);
 	inode->i_mtime = inode->i_ctime = CURRENT_TIME_SEC;
 	ext3_mark_inode_dirty(handle, inode);
@@ -2601,7 +2983,10 @@ static int ext3_do_update_inode(handle_t *handle,
 	raw_inode->i_atime = cpu_to_le32(inode->i_atime.tv_sec);
 	raw_inode->i_ctime = cpu_to_le32(inode->i_ctime.tv_sec);
 	raw_inode->i_mtime = cpu_to_le32(inode->i_mtime.tv_sec);
-	raw_inode->i_blocks = cpu_to_le32(inode->i_blocks);
+	/* blocks reserved for delayed allocation are not on disk yet */
+	raw_inode->i_blocks = cpu_to_le32(inode->i_blocks -
+			(ei->i_reserved_data_blocks <<
+				(inode->i_sb->s_blocksize_bits - 9)));
 	raw_inode->i_dtime = cpu_to_le32(ei->i_dtime);
 	raw_inode->i_flags = cpu_to_le32(ei->i_flags);
 #ifdef EXT3_FRAGMENTS
@@ -2843,6 +3228,9 @@ static int ext3_writepage_trans_blocks(struct inode *inode)
 	int indirects = (EXT3_NDIR_BLOCKS % bpp) ? 5 : 3;
 	int ret;
 
+	if (EXT3_I(inode)->i_flags & EXT3_EXTENTS_FL)
+		indirects = ext3_ext_trans_blocks(inode, bpp);
+
 	if (ext3_should_journal_data(inode))
 		ret = 3 * (bpp + indirects) + 2;
 	else
@@ -3020,6 +3408,10 @@ int ext3_change_inode_journal_flag(struct inode *inode, int val)
 	if (is_journal_aborted(journal) || IS_RDONLY(inode))
 		return -EROFS;
 
+	/* the journalled aops know nothing of delayed buffers */
+	if (inode->i_mapping->a_ops == &ext3_da_aops)
+		filemap_write_and_wait(inode->i_mapping);
+
 	journal_lock_updates(journal);
 	journal_flush(journal);
 
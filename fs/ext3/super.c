@@ -49,6 +49,7 @@ static void ext3_mark_recovery_complete(struct super_block * sb,
 					struct ext3_super_block * es);
 static void ext3_clear_journal_err(struct super_block * sb,
 				   struct ext3_super_block * es);
+static void ext3_set_journal_csum_features(struct super_block *sb);
 static int ext3_sync_fs(struct super_block *sb, int wait);
 static const char *ext3_decode_error(struct super_block * sb, int errno,
 				     char nbuf[16]);
@@ -393,6 +394,7 @@ static void ext3_put_super (struct super_block * sb)
 	percpu_counter_destroy(&sbi->s_freeblocks_counter);
 	percpu_counter_destroy(&sbi->s_freeinodes_counter);
 	percpu_counter_destroy(&sbi->s_dirs_counter);
+	percpu_counter_destroy(&sbi->s_dirtyblocks_counter);
 	brelse(sbi->s_sbh);
 #ifdef CONFIG_QUOTA
 	for (i = 0; i < MAXQUOTAS; i++) {
@@ -442,6 +444,8 @@ static struct inode *ext3_alloc_inode(struct super_block *sb)
 	ei->i_default_acl = EXT3_ACL_NOT_CACHED;
 #endif
 	ei->i_rsv_window.rsv_end = EXT3_RESERVE_WINDOW_NOT_ALLOCATED;
+	ei->i_reserved_data_blocks = 0;
+	ei->i_reserved_meta_blocks = 0;
 	ei->vfs_inode.i_version = 1;
 	return &ei->vfs_inode;
 }
@@ -462,6 +466,7 @@ static void init_once(void * foo, kmem_cache_t * cachep, unsigned long flags)
 		init_rwsem(&ei->xattr_sem);
 #endif
 		init_MUTEX(&ei->truncate_sem);
+		spin_lock_init(&ei->i_block_reservation_lock);
 		inode_init_once(&ei->vfs_inode);
 	}
 }
@@ -582,6 +587,8 @@ enum {
 	Opt_usrjquota, Opt_grpjquota, Opt_offusrjquota, Opt_offgrpjquota,
 	Opt_jqfmt_vfsold, Opt_jqfmt_vfsv0,
 	Opt_ignore, Opt_barrier, Opt_err, Opt_resize,
+	Opt_extents, Opt_noextents, Opt_delalloc, Opt_nodelalloc,
+	Opt_journal_checksum, Opt_journal_async_commit,
 };
 
 static match_table_t tokens = {
@@ -629,6 +636,12 @@ static match_table_t tokens = {
 	{Opt_ignore, "quota"},
 	{Opt_ignore, "usrquota"},
 	{Opt_barrier, "barrier=%u"},
+	{Opt_extents, "extents"},
+	{Opt_noextents, "noextents"},
+	{Opt_delalloc, "delalloc"},
+	{Opt_nodelalloc, "nodelalloc"},
+	{Opt_journal_checksum, "journal_checksum"},
+	{Opt_journal_async_commit, "journal_async_commit"},
 	{Opt_err, NULL},
 	{Opt_resize, "resize"},
 };
@@ -772,6 +785,25 @@ static int parse_options (char * options, struct super_block *sb,
 		case Opt_noreservation:
 			clear_opt(sbi->s_mount_opt, RESERVATION);
 			break;
+		case Opt_extents:
+			set_opt(sbi->s_mount_opt, EXTENTS);
+			break;
+		case Opt_noextents:
+			clear_opt(sbi->s_mount_opt, EXTENTS);
+			break;
+		case Opt_delalloc:
+			set_opt(sbi->s_mount_opt, DELALLOC);
+			break;
+		case Opt_nodelalloc:
+			clear_opt(sbi->s_mount_opt, DELALLOC);
+			break;
+		case Opt_journal_checksum:
+			set_opt(sbi->s_mount_opt, JOURNAL_CHECKSUM);
+			break;
+		case Opt_journal_async_commit:
+			set_opt(sbi->s_mount_opt, JOURNAL_ASYNC_COMMIT);
+			set_opt(sbi->s_mount_opt, JOURNAL_CHECKSUM);
+			break;
 		case Opt_journal_update:
 			/* @@@ FIXME */
 			/* Eventually we will want to be able to create
@@ -988,6 +1020,9 @@ static int ext3_setup_super(struct super_block *sb, struct ext3_super_block *es,
 	es->s_mtime = cpu_to_le32(get_seconds());
 	ext3_update_dynamic_rev(sb);
 	EXT3_SET_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_RECOVER);
+	/* older kernels must not mount a filesystem with extent files */
+	if (test_opt(sb, EXTENTS))
+		EXT3_SET_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_EXTENTS);
 
 	ext3_commit_super(sb, es, 1);
 	if (test_opt(sb, DEBUG))
@@ -1022,6 +1057,7 @@ static int ext3_check_descriptors (struct super_block * sb)
 {
 	struct ext3_sb_info *sbi = EXT3_SB(sb);
 	unsigned long block = le32_to_cpu(sbi->s_es->s_first_data_block);
+	unsigned long first_block, last_block;
 	struct ext3_group_desc * gdp = NULL;
 	int desc_block = 0;
 	int i;
@@ -1030,12 +1066,25 @@ static int ext3_check_descriptors (struct super_block * sb)
 
 	for (i = 0; i < sbi->s_groups_count; i++)
 	{
+		/*
+		 * With flex_bg a group's bitmaps and inode table may live
+		 * in another group: all we can ask is that they are
+		 * inside the filesystem.
+		 */
+		if (EXT3_HAS_INCOMPAT_FEATURE(sb,
+					      EXT3_FEATURE_INCOMPAT_FLEX_BG)) {
+			first_block = le32_to_cpu(sbi->s_es->s_first_data_block);
+			last_block = le32_to_cpu(sbi->s_es->s_blocks_count) - 1;
+		} else {
+			first_block = block;
+			last_block = block + EXT3_BLOCKS_PER_GROUP(sb) - 1;
+		}
+
 		if ((i % EXT3_DESC_PER_BLOCK(sb)) == 0)
 			gdp = (struct ext3_group_desc *)
 					sbi->s_group_desc[desc_block++]->b_data;
-		if (le32_to_cpu(gdp->bg_block_bitmap) < block ||
-		    le32_to_cpu(gdp->bg_block_bitmap) >=
-				block + EXT3_BLOCKS_PER_GROUP(sb))
+		if (le32_to_cpu(gdp->bg_block_bitmap) < first_block ||
+		    le32_to_cpu(gdp->bg_block_bitmap) > last_block)
 		{
 			ext3_error (sb, "ext3_check_descriptors",
 				    "Block bitmap for group %d"
@@ -1044,9 +1093,8 @@ static int ext3_check_descriptors (struct super_block * sb)
 					le32_to_cpu(gdp->bg_block_bitmap));
 			return 0;
 		}
-		if (le32_to_cpu(gdp->bg_inode_bitmap) < block ||
-		    le32_to_cpu(gdp->bg_inode_bitmap) >=
-				block + EXT3_BLOCKS_PER_GROUP(sb))
+		if (le32_to_cpu(gdp->bg_inode_bitmap) < first_block ||
+		    le32_to_cpu(gdp->bg_inode_bitmap) > last_block)
 		{
 			ext3_error (sb, "ext3_check_descriptors",
 				    "Inode bitmap for group %d"
@@ -1055,9 +1103,9 @@ static int ext3_check_descriptors (struct super_block * sb)
 					le32_to_cpu(gdp->bg_inode_bitmap));
 			return 0;
 		}
-		if (le32_to_cpu(gdp->bg_inode_table) < block ||
-		    le32_to_cpu(gdp->bg_inode_table) + sbi->s_itb_per_group >=
-		    block + EXT3_BLOCKS_PER_GROUP(sb))
+		if (le32_to_cpu(gdp->bg_inode_table) < first_block ||
+		    le32_to_cpu(gdp->bg_inode_table) + sbi->s_itb_per_group - 1
+		    > last_block)
 		{
 			ext3_error (sb, "ext3_check_descriptors",
 				    "Inode table for group %d"
@@ -1430,6 +1478,9 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 	for (i=0; i < 4; i++)
 		sbi->s_hash_seed[i] = le32_to_cpu(es->s_hash_seed[i]);
 	sbi->s_def_hash_version = es->s_def_hash_version;
+	if (EXT3_HAS_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_FLEX_BG) &&
+	    es->s_log_groups_per_flex > 0 && es->s_log_groups_per_flex < 31)
+		sbi->s_log_groups_per_flex = es->s_log_groups_per_flex;
 
 	if (sbi->s_blocks_per_group > blocksize * 8) {
 		printk (KERN_ERR
@@ -1468,6 +1519,7 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 	percpu_counter_init(&sbi->s_freeblocks_counter);
 	percpu_counter_init(&sbi->s_freeinodes_counter);
 	percpu_counter_init(&sbi->s_dirs_counter);
+	percpu_counter_init(&sbi->s_dirtyblocks_counter);
 	bgl_lock_init(&sbi->s_blockgroup_lock);
 
 	for (i = 0; i < db_count; i++) {
@@ -1563,6 +1615,16 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 		break;
 	}
 
+	if (test_opt(sb, DELALLOC) &&
+	    test_opt(sb, DATA_FLAGS) != EXT3_MOUNT_WRITEBACK_DATA) {
+		printk(KERN_WARNING "EXT3-fs: delalloc needs data=writeback, "
+		       "ignoring it\n");
+		clear_opt(sbi->s_mount_opt, DELALLOC);
+	}
+
+	if (!(sb->s_flags & MS_RDONLY))
+		ext3_set_journal_csum_features(sb);
+
 	/*
 	 * The journal_load will have done any necessary log recovery,
 	 * so we can safely mount the rest of the filesystem now.
@@ -1653,12 +1715,51 @@ static void ext3_init_journal_params(struct super_block *sb, journal_t *journal)
 	 * interval here, but for now we'll just fall back to the jbd
 	 * default. */
 
-	spin_lock(&journal->j_state_lock);
+	write_lock(&journal->j_state_lock);
 	if (test_opt(sb, BARRIER))
 		journal->j_flags |= JFS_BARRIER;
 	else
 		journal->j_flags &= ~JFS_BARRIER;
-	spin_unlock(&journal->j_state_lock);
+	write_unlock(&journal->j_state_lock);
+}
+
+/*
+ * Bring the checksum and asynchronous commit features of the journal in
+ * line with the mount options.  This is only done while the log is empty,
+ * straight after it has been loaded or recovered for a read-write mount:
+ * dropping the features with transactions still in the log would have
+ * recovery trust commits it cannot check.  The journal superblock goes
+ * out before the first commit that relies on the new features.
+ */
+static void ext3_set_journal_csum_features(struct super_block *sb)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	journal_t *journal = sbi->s_journal;
+
+	if (test_opt(sb, JOURNAL_ASYNC_COMMIT)) {
+		if (!journal_set_features(journal, JFS_FEATURE_COMPAT_CHECKSUM,
+				0, JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+			printk(KERN_WARNING "EXT3-fs: journal does not support "
+			       "journal_async_commit, ignoring it\n");
+			clear_opt(sbi->s_mount_opt, JOURNAL_ASYNC_COMMIT);
+			clear_opt(sbi->s_mount_opt, JOURNAL_CHECKSUM);
+		}
+	}
+	if (!test_opt(sb, JOURNAL_ASYNC_COMMIT))
+		journal_clear_features(journal, 0, 0,
+				       JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+	if (test_opt(sb, JOURNAL_CHECKSUM)) {
+		if (!journal_set_features(journal, JFS_FEATURE_COMPAT_CHECKSUM,
+					  0, 0)) {
+			printk(KERN_WARNING "EXT3-fs: journal does not support "
+			       "journal_checksum, ignoring it\n");
+			clear_opt(sbi->s_mount_opt, JOURNAL_CHECKSUM);
+		}
+	}
+	if (!test_opt(sb, JOURNAL_CHECKSUM))
+		journal_clear_features(journal, JFS_FEATURE_COMPAT_CHECKSUM,
+				       0, 0);
+	journal_update_superblock(journal, 1);
 }
 
 static journal_t *ext3_get_journal(struct super_block *sb, int journal_inum)
@@ -2126,7 +2227,15 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 				return ret;
 			if (!ext3_setup_super (sb, es, 0))
 				sb->s_flags &= ~MS_RDONLY;
+			if (!(sb->s_flags & MS_RDONLY))
+				ext3_set_journal_csum_features(sb);
 		}
+	} else if (!(sb->s_flags & MS_RDONLY) && test_opt(sb, EXTENTS) &&
+		   !EXT3_HAS_INCOMPAT_FEATURE(sb,
+					      EXT3_FEATURE_INCOMPAT_EXTENTS)) {
+		/* extents turned on by a read-write remount */
+		EXT3_SET_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_EXTENTS);
+		ext3_commit_super(sb, es, 1);
 	}
 	return 0;
 }
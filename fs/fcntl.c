@@ -10,6 +10,7 @@
 #include <linux/fs.h>
 #include <linux/file.h>
 #include <linux/dnotify.h>
+#include <linux/pipe_fs_i.h>
 #include <linux/smp_lock.h>
 #include <linux/slab.h>
 #include <linux/module.h>
@@ -151,7 +152,7 @@ asmlinkage long sys_dup2(unsigned int oldfd, unsigned int newfd)
 	if (!tofree && FD_ISSET(newfd, files->open_fds))
 		goto out_fput;
 
-	files->fd[newfd] = file;
+	rcu_assign_pointer(files->fd[newfd], file);
 	FD_SET(newfd, files->open_fds);
 	FD_CLR(newfd, files->close_on_exec);
 	spin_unlock(&files->file_lock);
@@ -323,6 +324,10 @@ static long do_fcntl(int fd, unsigned int cmd, unsigned long arg,
 	case F_NOTIFY:
 		err = fcntl_dirnotify(fd, filp, arg);
 		break;
+	case F_SETPIPE_SZ:
+	case F_GETPIPE_SZ:
+		err = pipe_fcntl(filp, cmd, arg);
+		break;
 	default:
 		break;
 	}
@@ -14,6 +14,7 @@
 #include <linux/fs.h>
 #include <linux/security.h>
 #include <linux/eventpoll.h>
+#include <linux/fsnotify.h>
 #include <linux/mount.h>
 #include <linux/cdev.h>
 
@@ -27,6 +28,9 @@ EXPORT_SYMBOL(files_stat); /* Needed by unix.o */
 /* public. Not pretty! */
  __cacheline_aligned_in_smp DEFINE_SPINLOCK(files_lock);
 
+/* Protects the per-CPU superblock file lists of its CPU */
+static DEFINE_PER_CPU(spinlock_t, files_cpu_lock) = SPIN_LOCK_UNLOCKED;
+
 static DEFINE_SPINLOCK(filp_count_lock);
 
 /* slab constructors and destructors are called from arbitrary
@@ -52,11 +56,66 @@ void filp_dtor(void * objp, struct kmem_cache_s *cachep, unsigned long dflags)
 	spin_unlock_irqrestore(&filp_count_lock, flags);
 }
 
-static inline void file_free(struct file *f)
+static void file_free_rcu(struct rcu_head *head)
 {
+	struct file *f = container_of(head, struct file, f_rcuhead);
+
 	kmem_cache_free(filp_cachep, f);
 }
 
+/*
+ * fget() may still be looking at the file from another thread sharing
+ * the fd table, so it is only freed a grace period later.
+ */
+static inline void file_free(struct file *f)
+{
+	call_rcu(&f->f_rcuhead, file_free_rcu);
+}
+
+#ifdef __HAVE_ARCH_CMPXCHG
+/*
+ * Take a reference to a file found under rcu_read_lock(), unless its last
+ * reference is already gone.
+ */
+static inline int get_file_rcu(struct file *file)
+{
+	int c = atomic_read(&file->f_count);
+
+	while (c) {
+		int old = cmpxchg(&file->f_count.counter, c, c + 1);
+
+		if (old == c)
+			return 1;
+		c = old;
+	}
+	return 0;
+}
+
+static struct file *fget_rcu(struct files_struct *files, unsigned int fd)
+{
+	struct file *file;
+
+	rcu_read_lock();
+	file = fcheck_files(files, fd);
+	if (file && !get_file_rcu(file))
+		file = NULL;
+	rcu_read_unlock();
+	return file;
+}
+#else
+static struct file *fget_rcu(struct files_struct *files, unsigned int fd)
+{
+	struct file *file;
+
+	spin_lock(&files->file_lock);
+	file = fcheck_files(files, fd);
+	if (file)
+		get_file(file);
+	spin_unlock(&files->file_lock);
+	return file;
+}
+#endif
+
 /* Find an unused file structure and return a pointer to it.
  * Returns NULL, if there are no more free file structures or
  * we run out of memory.
@@ -85,6 +144,7 @@ static int old_max;
 			rwlock_init(&f->f_owner.lock);
 			/* f->f_version: 0 */
 			INIT_LIST_HEAD(&f->f_list);
+			f->f_sb_list_cpu = -1;
 			f->f_maxcount = INT_MAX;
 			return f;
 		}
@@ -128,6 +188,7 @@ void fastcall __fput(struct file *file)
 	 * in the file cleanup chain.
 	 */
 	eventpoll_release(file);
+	fsnotify_close(file);
 	locks_remove_flock(file);
 
 	if (file->f_op && file->f_op->release)
@@ -148,15 +209,7 @@ void fastcall __fput(struct file *file)
 
 struct file fastcall *fget(unsigned int fd)
 {
-	struct file *file;
-	struct files_struct *files = current->files;
-
-	spin_lock(&files->file_lock);
-	file = fcheck_files(files, fd);
-	if (file)
-		get_file(file);
-	spin_unlock(&files->file_lock);
-	return file;
+	return fget_rcu(current->files, fd);
 }
 
 EXPORT_SYMBOL(fget);
@@ -177,13 +230,9 @@ struct file fastcall *fget_light(unsigned int fd, int *fput_needed)
 	if (likely((atomic_read(&files->count) == 1))) {
 		file = fcheck_files(files, fd);
 	} else {
-		spin_lock(&files->file_lock);
-		file = fcheck_files(files, fd);
-		if (file) {
-			get_file(file);
+		file = fget_rcu(files, fd);
+		if (file)
 			*fput_needed = 1;
-		}
-		spin_unlock(&files->file_lock);
 	}
 	return file;
 }
@@ -198,46 +247,89 @@ void put_filp(struct file *file)
 	}
 }
 
-void file_move(struct file *file, struct list_head *list)
+void file_sb_list_lock(int cpu)
 {
-	if (!list)
-		return;
-	file_list_lock();
-	list_move(&file->f_list, list);
-	file_list_unlock();
+	spin_lock(&per_cpu(files_cpu_lock, cpu));
+}
+
+void file_sb_list_unlock(int cpu)
+{
+	spin_unlock(&per_cpu(files_cpu_lock, cpu));
+}
+
+/*
+ * Put a newly opened file on the superblock list of this CPU, so that
+ * open and close do not share a cacheline with other CPUs.
+ */
+void file_sb_list_add(struct file *file, struct super_block *sb)
+{
+	int cpu = get_cpu();
+
+	file_sb_list_lock(cpu);
+	file->f_sb_list_cpu = cpu;
+	list_add(&file->f_list, sb_files(sb, cpu));
+	file_sb_list_unlock(cpu);
+	put_cpu();
 }
 
 void file_kill(struct file *file)
 {
-	if (!list_empty(&file->f_list)) {
+	int cpu = file->f_sb_list_cpu;
+
+	if (list_empty(&file->f_list))
+		return;
+	if (cpu >= 0) {
+		file_sb_list_lock(cpu);
+		list_del_init(&file->f_list);
+		file->f_sb_list_cpu = -1;
+		file_sb_list_unlock(cpu);
+	} else {
 		file_list_lock();
 		list_del_init(&file->f_list);
 		file_list_unlock();
 	}
 }
 
-int fs_may_remount_ro(struct super_block *sb)
+/*
+ * Move @file to @list, off its superblock list if it is still on one.
+ * For the lists under files_lock, not the superblock lists.
+ */
+void file_move(struct file *file, struct list_head *list)
 {
-	struct list_head *p;
-
-	/* Check that no files are currently opened for writing. */
+	if (!list)
+		return;
+	if (file->f_sb_list_cpu >= 0)
+		file_kill(file);
 	file_list_lock();
-	list_for_each(p, &sb->s_files) {
-		struct file *file = list_entry(p, struct file, f_list);
-		struct inode *inode = file->f_dentry->d_inode;
+	list_move(&file->f_list, list);
+	file_list_unlock();
+}
 
-		/* File with pending delete? */
-		if (inode->i_nlink == 0)
-			goto too_bad;
+int fs_may_remount_ro(struct super_block *sb)
+{
+	struct file *file;
+	int cpu;
 
-		/* Writeable file? */
-		if (S_ISREG(inode->i_mode) && (file->f_mode & FMODE_WRITE))
-			goto too_bad;
+	/* Check that no files are currently opened for writing. */
+	for_each_cpu(cpu) {
+		file_sb_list_lock(cpu);
+		list_for_each_entry(file, sb_files(sb, cpu), f_list) {
+			struct inode *inode = file->f_dentry->d_inode;
+
+			/* File with pending delete? */
+			if (inode->i_nlink == 0)
+				goto too_bad;
+
+			/* Writeable file? */
+			if (S_ISREG(inode->i_mode) &&
+			    (file->f_mode & FMODE_WRITE))
+				goto too_bad;
+		}
+		file_sb_list_unlock(cpu);
 	}
-	file_list_unlock();
 	return 1; /* Tis' cool bro. */
 too_bad:
-	file_list_unlock();
+	file_sb_list_unlock(cpu);
 	return 0;
 }
 
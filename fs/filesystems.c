@@ -108,6 +108,8 @@ int unregister_filesystem(struct file_system_type * fs)
 			*tmp = fs->next;
 			fs->next = NULL;
 			write_unlock(&file_systems_lock);
+			/* its ->destroy_inode() may be about to go away */
+			flush_destroyed_inodes();
 			return 0;
 		}
 		tmp = &(*tmp)->next;
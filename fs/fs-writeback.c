@@ -45,6 +45,9 @@ extern struct super_block *blockdev_superblock;
  * This function *must* be atomic for the I_DIRTY_PAGES case -
  * set_page_dirty() is called under spinlock in several places.
  *
+ * The dirty lists are protected by sb->s_inode_wb_lock, which nests
+ * outside inode->i_lock.
+ *
  * Note that for blockdevs, inode->dirtied_when represents the dirtying time of
  * the block-special inode (/dev/hda1) itself.  And the ->dirtied_when field of
  * the kernel-internal blockdev inode represents the dirtying time of the
@@ -93,7 +96,8 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 			       name, inode->i_sb->s_id);
 	}
 
-	spin_lock(&inode_lock);
+	spin_lock(&sb->s_inode_wb_lock);
+	spin_lock(&inode->i_lock);
 	if ((inode->i_state & flags) != flags) {
 		const int was_dirty = inode->i_state & I_DIRTY;
 
@@ -128,7 +132,8 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 		}
 	}
 out:
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
+	spin_unlock(&sb->s_inode_wb_lock);
 }
 
 EXPORT_SYMBOL(__mark_inode_dirty);
@@ -148,7 +153,7 @@ static int write_inode(struct inode *inode, int sync)
  * starvation of particular inodes when others are being redirtied, prevent
  * livelocks, etc.
  *
- * Called under inode_lock.
+ * Called under sb->s_inode_wb_lock and inode->i_lock.
  */
 static int
 __sync_single_inode(struct inode *inode, struct writeback_control *wbc)
@@ -166,7 +171,8 @@ __sync_single_inode(struct inode *inode, struct writeback_control *wbc)
 	inode->i_state |= I_LOCK;
 	inode->i_state &= ~I_DIRTY;
 
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
+	spin_unlock(&sb->s_inode_wb_lock);
 
 	ret = do_writepages(mapping, wbc);
 
@@ -183,7 +189,8 @@ __sync_single_inode(struct inode *inode, struct writeback_control *wbc)
 			ret = err;
 	}
 
-	spin_lock(&inode_lock);
+	spin_lock(&sb->s_inode_wb_lock);
+	spin_lock(&inode->i_lock);
 	inode->i_state &= ~I_LOCK;
 	if (!(inode->i_state & I_FREEING)) {
 		if (!(inode->i_state & I_DIRTY) &&
@@ -220,17 +227,13 @@ __sync_single_inode(struct inode *inode, struct writeback_control *wbc)
 			 * the pages.
 			 */
 			list_move(&inode->i_list, &sb->s_dirty);
-		} else if (atomic_read(&inode->i_count)) {
-			/*
-			 * The inode is clean, inuse
-			 */
-			list_move(&inode->i_list, &inode_in_use);
 		} else {
 			/*
-			 * The inode is clean, unused
+			 * The inode is clean
 			 */
-			list_move(&inode->i_list, &inode_unused);
-			inodes_stat.nr_unused++;
+			list_del_init(&inode->i_list);
+			if (!atomic_read(&inode->i_count))
+				inode_lru_list_add(inode);
 		}
 	}
 	wake_up_inode(inode);
@@ -238,12 +241,14 @@ __sync_single_inode(struct inode *inode, struct writeback_control *wbc)
 }
 
 /*
- * Write out an inode's dirty pages.  Called under inode_lock.
+ * Write out an inode's dirty pages.  Called under sb->s_inode_wb_lock and
+ * inode->i_lock, which are held again on return.
  */
 static int
 __writeback_single_inode(struct inode *inode,
 			struct writeback_control *wbc)
 {
+	struct super_block *sb = inode->i_sb;
 	wait_queue_head_t *wqh;
 
 	if ((wbc->sync_mode != WB_SYNC_ALL) && (inode->i_state & I_LOCK)) {
@@ -260,11 +265,13 @@ __writeback_single_inode(struct inode *inode,
 		wqh = bit_waitqueue(&inode->i_state, __I_LOCK);
 		do {
 			__iget(inode);
-			spin_unlock(&inode_lock);
+			spin_unlock(&inode->i_lock);
+			spin_unlock(&sb->s_inode_wb_lock);
 			__wait_on_bit(wqh, &wq, inode_wait,
 							TASK_UNINTERRUPTIBLE);
 			iput(inode);
-			spin_lock(&inode_lock);
+			spin_lock(&sb->s_inode_wb_lock);
+			spin_lock(&inode->i_lock);
 		} while (inode->i_state & I_LOCK);
 	}
 	return __sync_single_inode(inode, wbc);
@@ -283,7 +290,7 @@ __writeback_single_inode(struct inode *inode,
  * WB_SYNC_HOLD is a hack for sys_sync(): reattach the inode to sb->s_dirty so
  * that it can be located for waiting on in __writeback_single_inode().
  *
- * Called under inode_lock.
+ * Called under sb->s_inode_wb_lock.
  *
  * If `bdi' is non-zero then we're being asked to writeback a specific queue.
  * This function assumes that the blockdev superblock's inodes are backed by
@@ -340,7 +347,8 @@ sync_sb_inodes(struct super_block *sb, struct writeback_control *wbc)
 			continue;		/* Skip a congested blockdev */
 		}
 
-		if (wbc->bdi && bdi != wbc->bdi) {
+		if ((wbc->bdi && bdi != wbc->bdi) ||
+		    (wbc->pdflush_only && bdi->flusher)) {
 			if (sb != blockdev_superblock)
 				break;		/* fs has the wrong queue */
 			list_move(&inode->i_list, &sb->s_dirty);
@@ -360,7 +368,18 @@ sync_sb_inodes(struct super_block *sb, struct writeback_control *wbc)
 		if (current_is_pdflush() && !writeback_acquire(bdi))
 			break;
 
-		BUG_ON(inode->i_state & I_FREEING);
+		spin_lock(&inode->i_lock);
+		if (inode->i_state & I_FREEING) {
+			/*
+			 * Its last iput() is freeing it, and will take it
+			 * off the list once we let go of it.
+			 */
+			spin_unlock(&inode->i_lock);
+			list_del_init(&inode->i_list);
+			if (current_is_pdflush())
+				writeback_release(bdi);
+			continue;
+		}
 		__iget(inode);
 		pages_skipped = wbc->pages_skipped;
 		__writeback_single_inode(inode, wbc);
@@ -368,6 +387,7 @@ sync_sb_inodes(struct super_block *sb, struct writeback_control *wbc)
 			inode->dirtied_when = jiffies;
 			list_move(&inode->i_list, &sb->s_dirty);
 		}
+		spin_unlock(&inode->i_lock);
 		if (current_is_pdflush())
 			writeback_release(bdi);
 		if (wbc->pages_skipped != pages_skipped) {
@@ -377,10 +397,10 @@ sync_sb_inodes(struct super_block *sb, struct writeback_control *wbc)
 			 */
 			list_move(&inode->i_list, &sb->s_dirty);
 		}
-		spin_unlock(&inode_lock);
+		spin_unlock(&sb->s_inode_wb_lock);
 		cond_resched();
 		iput(inode);
-		spin_lock(&inode_lock);
+		spin_lock(&sb->s_inode_wb_lock);
 		if (wbc->nr_to_write <= 0)
 			break;
 	}
@@ -394,7 +414,7 @@ sync_sb_inodes(struct super_block *sb, struct writeback_control *wbc)
  * We don't need to grab a reference to superblock here. If it has non-empty
  * ->s_dirty it's hadn't been killed yet and kill_super() won't proceed
  * past sync_inodes_sb() until both the ->s_dirty and ->s_io lists are
- * empty. Since __sync_single_inode() regains inode_lock before it finally moves
+ * empty. Since __sync_single_inode() regains s_inode_wb_lock before it finally moves
  * inode from superblock lists we are OK.
  *
  * If `older_than_this' is non-zero then only flush inodes which have a
@@ -427,9 +447,9 @@ restart:
 			 */
 			if (down_read_trylock(&sb->s_umount)) {
 				if (sb->s_root) {
-					spin_lock(&inode_lock);
+					spin_lock(&sb->s_inode_wb_lock);
 					sync_sb_inodes(sb, wbc);
-					spin_unlock(&inode_lock);
+					spin_unlock(&sb->s_inode_wb_lock);
 				}
 				up_read(&sb->s_umount);
 			}
@@ -463,12 +483,12 @@ void sync_inodes_sb(struct super_block *sb, int wait)
 	unsigned long nr_unstable = read_page_state(nr_unstable);
 
 	wbc.nr_to_write = nr_dirty + nr_unstable +
-			(inodes_stat.nr_inodes - inodes_stat.nr_unused) +
+			(get_nr_inodes() - get_nr_inodes_unused()) +
 			nr_dirty + nr_unstable;
 	wbc.nr_to_write += wbc.nr_to_write / 2;		/* Bit more for luck */
-	spin_lock(&inode_lock);
+	spin_lock(&sb->s_inode_wb_lock);
 	sync_sb_inodes(sb, &wbc);
-	spin_unlock(&inode_lock);
+	spin_unlock(&sb->s_inode_wb_lock);
 }
 
 /*
@@ -570,9 +590,11 @@ int write_inode_now(struct inode *inode, int sync)
 		return 0;
 
 	might_sleep();
-	spin_lock(&inode_lock);
+	spin_lock(&inode->i_sb->s_inode_wb_lock);
+	spin_lock(&inode->i_lock);
 	ret = __writeback_single_inode(inode, &wbc);
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
+	spin_unlock(&inode->i_sb->s_inode_wb_lock);
 	if (sync)
 		wait_on_inode(inode);
 	return ret;
@@ -594,9 +616,11 @@ int sync_inode(struct inode *inode, struct writeback_control *wbc)
 {
 	int ret;
 
-	spin_lock(&inode_lock);
+	spin_lock(&inode->i_sb->s_inode_wb_lock);
+	spin_lock(&inode->i_lock);
 	ret = __writeback_single_inode(inode, wbc);
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
+	spin_unlock(&inode->i_sb->s_inode_wb_lock);
 	return ret;
 }
 EXPORT_SYMBOL(sync_inode);
@@ -638,11 +662,11 @@ int generic_osync_inode(struct inode *inode, struct address_space *mapping, int
 	}
 	current->flags &= ~PF_SYNCWRITE;
 
-	spin_lock(&inode_lock);
+	spin_lock(&inode->i_lock);
 	if ((inode->i_state & I_DIRTY) &&
 	    ((what & OSYNC_INODE) || (inode->i_state & I_DIRTY_DATASYNC)))
 		need_write_inode_now = 1;
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
 
 	if (need_write_inode_now) {
 		err2 = write_inode_now(inode, 1);
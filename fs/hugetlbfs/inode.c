@@ -79,7 +79,14 @@ static int hugetlbfs_file_mmap(struct file *file, struct vm_area_struct *vma)
 	if (!(vma->vm_flags & VM_WRITE) && len > inode->i_size)
 		goto out;
 
+	/*
+	 * Allocate surplus pages now, when we may wait for them; the
+	 * prefault cannot, under the page_table_lock.  Those not needed,
+	 * for pages already in the file, are given back at once.
+	 */
+	hugetlb_grow_pool(vma_len >> HPAGE_SHIFT);
 	ret = hugetlb_prefault(mapping, vma);
+	hugetlb_trim_pool();
 	if (ret)
 		goto out;
 
@@ -223,12 +230,10 @@ static void hugetlbfs_delete_inode(struct inode *inode)
 {
 	struct hugetlbfs_sb_info *sbinfo = HUGETLBFS_SB(inode->i_sb);
 
-	hlist_del_init(&inode->i_hash);
-	list_del_init(&inode->i_list);
-	list_del_init(&inode->i_sb_list);
 	inode->i_state |= I_FREEING;
-	inodes_stat.nr_inodes--;
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
+	inode_unlist(inode);
+	remove_inode_hash(inode);
 
 	if (inode->i_data.nrpages)
 		truncate_hugepages(&inode->i_data, 0);
@@ -253,25 +258,18 @@ static void hugetlbfs_forget_inode(struct inode *inode)
 	if (hlist_unhashed(&inode->i_hash))
 		goto out_truncate;
 
-	if (!(inode->i_state & (I_DIRTY|I_LOCK))) {
-		list_del(&inode->i_list);
-		list_add(&inode->i_list, &inode_unused);
-	}
-	inodes_stat.nr_unused++;
 	if (!super_block || (super_block->s_flags & MS_ACTIVE)) {
-		spin_unlock(&inode_lock);
+		inode_lru_list_add(inode);
+		spin_unlock(&inode->i_lock);
 		return;
 	}
 
 	/* write_inode_now() ? */
-	inodes_stat.nr_unused--;
-	hlist_del_init(&inode->i_hash);
 out_truncate:
-	list_del_init(&inode->i_list);
-	list_del_init(&inode->i_sb_list);
 	inode->i_state |= I_FREEING;
-	inodes_stat.nr_inodes--;
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
+	inode_unlist(inode);
+	remove_inode_hash(inode);
 	if (inode->i_data.nrpages)
 		truncate_hugepages(&inode->i_data, 0);
 
@@ -21,6 +21,10 @@
 #include <linux/pagemap.h>
 #include <linux/cdev.h>
 #include <linux/bootmem.h>
+#include <linux/workqueue.h>
+#include <linux/inotify.h>
+#include <linux/percpu.h>
+#include <linux/sysctl.h>
 
 /*
  * This is needed for the following functions:
@@ -59,28 +63,39 @@ static unsigned int i_hash_mask;
 static unsigned int i_hash_shift;
 
 /*
- * Each inode can be on two separate lists. One is
- * the hash list of the inode, used for lookups. The
- * other linked list is the "type" list:
- *  "in_use" - valid inode, i_count > 0, i_nlink > 0
- *  "dirty"  - as "in_use" but also dirty
- *  "unused" - valid inode, i_count = 0
+ * Each inode can be on the hash list, used for lookups, and on
+ * lists of its super block:
+ *  s_inodes - every inode of the super block, through i_sb_list
+ *  s_dirty, s_io - dirty inodes, through i_list, see fs-writeback.c
+ *  s_inode_lru - unused inodes, through i_lru
  *
- * A "dirty" list is maintained for each super block,
- * allowing for low-overhead inode sync() operations.
- */
-
-LIST_HEAD(inode_in_use);
-LIST_HEAD(inode_unused);
-static struct hlist_head *inode_hashtable;
-
-/*
- * A simple spinlock to protect the list manipulations.
+ * Each hash chain, and each of those lists, has its own lock:
+ *
+ *  inode_hash_bucket->lock: the chain and i_hash of inodes on it
+ *  sb->s_inode_list_lock: s_inodes, s_nr_inodes
+ *  sb->s_inode_wb_lock: s_dirty, s_io
+ *  sb->s_inode_lru_lock: s_inode_lru, s_nr_inodes_unused
+ *  inode->i_lock: i_state
+ *
+ * Lock ordering:
+ *  inode_hash_bucket->lock
+ *    sb->s_inode_list_lock
+ *      inode->i_lock
+ *  sb->s_inode_wb_lock
+ *    inode->i_lock
+ *      sb->s_inode_lru_lock
  *
- * NOTE! You also have to own the lock if you change
- * the i_state of an inode while it is in use..
+ * The LRU is lazy: an inode taken off it by __iget() stays there until
+ * prune_icache() comes across it, which is why prune_icache() only
+ * trylocks i_lock.  An inode being freed (I_FREEING) comes off the lists
+ * after i_state has been set, in inode_unlist().
  */
-DEFINE_SPINLOCK(inode_lock);
+struct inode_hash_bucket {
+	struct hlist_head	chain;
+	spinlock_t		lock;
+};
+
+static struct inode_hash_bucket *inode_hashtable;
 
 /*
  * iprune_sem provides exclusion between the kswapd or try_to_free_pages
@@ -136,6 +151,9 @@ static struct inode *alloc_inode(struct super_block *sb)
 		inode->i_rdev = 0;
 		inode->i_security = NULL;
 		inode->dirtied_when = 0;
+		inode->i_hash_bucket = NULL;
+		INIT_LIST_HEAD(&inode->i_list);
+		INIT_LIST_HEAD(&inode->i_lru);
 		if (security_inode_alloc(inode)) {
 			if (inode->i_sb->s_op->destroy_inode)
 				inode->i_sb->s_op->destroy_inode(inode);
@@ -170,10 +188,18 @@ static struct inode *alloc_inode(struct super_block *sb)
 	return inode;
 }
 
-void destroy_inode(struct inode *inode) 
+/*
+ * RCU path walk looks at inodes it holds no reference to, so an inode is
+ * only freed a grace period after it is destroyed.  Until then it waits on
+ * inode_free_list, through i_list, and inode_free_work frees them in
+ * batches.  Before the workqueue exists nobody can be walking.
+ */
+static LIST_HEAD(inode_free_list);
+static DEFINE_SPINLOCK(inode_free_lock);
+static struct workqueue_struct *inode_free_wq;
+
+static void __destroy_inode(struct inode *inode)
 {
-	if (inode_has_buffers(inode))
-		BUG();
 	security_inode_free(inode);
 	if (inode->i_sb->s_op->destroy_inode)
 		inode->i_sb->s_op->destroy_inode(inode);
@@ -181,6 +207,59 @@ void destroy_inode(struct inode *inode)
 		kmem_cache_free(inode_cachep, (inode));
 }
 
+static void inode_free_work_fn(void *unused)
+{
+	LIST_HEAD(list);
+
+	spin_lock(&inode_free_lock);
+	list_splice_init(&inode_free_list, &list);
+	spin_unlock(&inode_free_lock);
+
+	synchronize_kernel();
+	while (!list_empty(&list)) {
+		struct inode *inode;
+
+		inode = list_entry(list.next, struct inode, i_list);
+		list_del(&inode->i_list);
+		__destroy_inode(inode);
+	}
+}
+
+static DECLARE_WORK(inode_free_work, inode_free_work_fn, NULL);
+
+void destroy_inode(struct inode *inode) 
+{
+	if (inode_has_buffers(inode))
+		BUG();
+	if (unlikely(!inode_free_wq)) {
+		__destroy_inode(inode);
+		return;
+	}
+	spin_lock(&inode_free_lock);
+	list_add_tail(&inode->i_list, &inode_free_list);
+	spin_unlock(&inode_free_lock);
+	queue_work(inode_free_wq, &inode_free_work);
+}
+
+/*
+ * Wait until the inodes destroyed so far have been freed.  Their
+ * superblock or the module providing ->destroy_inode() may go away next.
+ */
+void flush_destroyed_inodes(void)
+{
+	if (inode_free_wq)
+		flush_workqueue(inode_free_wq);
+}
+
+static int __init inode_free_init(void)
+{
+	inode_free_wq = create_singlethread_workqueue("inode_free");
+	if (!inode_free_wq)
+		panic("Failed to create inode_free workqueue\n");
+	return 0;
+}
+__initcall(inode_free_init);
+
 
 /*
  * These are initializations that only need to be done
@@ -204,6 +283,10 @@ void inode_init_once(struct inode *inode)
 	INIT_LIST_HEAD(&inode->i_data.i_mmap_nonlinear);
 	spin_lock_init(&inode->i_lock);
 	i_size_ordered_init(inode);
+#ifdef CONFIG_INOTIFY
+	INIT_LIST_HEAD(&inode->inotify_watches);
+	sema_init(&inode->inotify_sem, 1);
+#endif
 }
 
 EXPORT_SYMBOL(inode_init_once);
@@ -218,18 +301,72 @@ static void init_once(void * foo, kmem_cache_t * cachep, unsigned long flags)
 }
 
 /*
- * inode_lock must be held
+ * inode->i_lock must be held, or a reference.  An unused inode is left
+ * on the LRU for prune_icache() to take off.
  */
 void __iget(struct inode * inode)
 {
-	if (atomic_read(&inode->i_count)) {
-		atomic_inc(&inode->i_count);
-		return;
-	}
 	atomic_inc(&inode->i_count);
-	if (!(inode->i_state & (I_DIRTY|I_LOCK)))
-		list_move(&inode->i_list, &inode_in_use);
-	inodes_stat.nr_unused--;
+}
+
+/*
+ * Put an unused inode on its super block's LRU, if it is not there
+ * already.  inode->i_lock must be held.
+ */
+void inode_lru_list_add(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+
+	spin_lock(&sb->s_inode_lru_lock);
+	if (list_empty(&inode->i_lru)) {
+		list_add(&inode->i_lru, &sb->s_inode_lru);
+		sb->s_nr_inodes_unused++;
+	}
+	spin_unlock(&sb->s_inode_lru_lock);
+}
+
+static void inode_lru_list_del(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+
+	spin_lock(&sb->s_inode_lru_lock);
+	if (!list_empty(&inode->i_lru)) {
+		list_del_init(&inode->i_lru);
+		sb->s_nr_inodes_unused--;
+	}
+	spin_unlock(&sb->s_inode_lru_lock);
+}
+
+/*
+ * Take an inode with I_FREEING set off the LRU, writeback and super block
+ * lists.  Called without inode->i_lock.
+ */
+void inode_unlist(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+
+	inode_lru_list_del(inode);
+
+	spin_lock(&sb->s_inode_wb_lock);
+	list_del_init(&inode->i_list);
+	spin_unlock(&sb->s_inode_wb_lock);
+
+	spin_lock(&sb->s_inode_list_lock);
+	if (!list_empty(&inode->i_sb_list)) {
+		list_del_init(&inode->i_sb_list);
+		sb->s_nr_inodes--;
+	}
+	spin_unlock(&sb->s_inode_list_lock);
+}
+
+static void inode_sb_list_add(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+
+	spin_lock(&sb->s_inode_list_lock);
+	list_add(&inode->i_sb_list, &sb->s_inodes);
+	sb->s_nr_inodes++;
+	spin_unlock(&sb->s_inode_list_lock);
 }
 
 /**
@@ -268,37 +405,34 @@ EXPORT_SYMBOL(clear_inode);
  * dispose_list - dispose of the contents of a local list
  * @head: the head of the list to free
  *
- * Dispose-list gets a local list with local inodes in it, so it doesn't
- * need to worry about list corruption and SMP locks.
+ * Dispose-list gets a local list, through i_lru, of inodes with I_FREEING
+ * set, so it doesn't need to worry about list corruption and SMP locks.
  */
 static void dispose_list(struct list_head *head)
 {
-	int nr_disposed = 0;
-
 	while (!list_empty(head)) {
 		struct inode *inode;
 
-		inode = list_entry(head->next, struct inode, i_list);
-		list_del(&inode->i_list);
+		inode = list_entry(head->next, struct inode, i_lru);
+		list_del_init(&inode->i_lru);
+		inode_unlist(inode);
+		remove_inode_hash(inode);
 
 		if (inode->i_data.nrpages)
 			truncate_inode_pages(&inode->i_data, 0);
 		clear_inode(inode);
 		destroy_inode(inode);
-		nr_disposed++;
 	}
-	spin_lock(&inode_lock);
-	inodes_stat.nr_inodes -= nr_disposed;
-	spin_unlock(&inode_lock);
 }
 
 /*
- * Invalidate all inodes for a device.
+ * Invalidate all inodes for a device.  Called with sb->s_inode_list_lock.
  */
-static int invalidate_list(struct list_head *head, struct list_head *dispose)
+static int invalidate_list(struct super_block *sb, struct list_head *dispose)
 {
+	struct list_head *head = &sb->s_inodes;
 	struct list_head *next;
-	int busy = 0, count = 0;
+	int busy = 0;
 
 	next = head->next;
 	for (;;) {
@@ -311,25 +445,31 @@ static int invalidate_list(struct list_head *head, struct list_head *dispose)
 		 * change during umount anymore, and because iprune_sem keeps
 		 * shrink_icache_memory() away.
 		 */
-		cond_resched_lock(&inode_lock);
+		cond_resched_lock(&sb->s_inode_list_lock);
 
 		next = next->next;
 		if (tmp == head)
 			break;
 		inode = list_entry(tmp, struct inode, i_sb_list);
 		invalidate_inode_buffers(inode);
+		spin_lock(&inode->i_lock);
+		if (inode->i_state & I_FREEING) {
+			/* Its last iput() is freeing it */
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
 		if (!atomic_read(&inode->i_count)) {
-			hlist_del_init(&inode->i_hash);
-			list_del(&inode->i_sb_list);
-			list_move(&inode->i_list, dispose);
 			inode->i_state |= I_FREEING;
-			count++;
+			inode_lru_list_del(inode);
+			spin_unlock(&inode->i_lock);
+			list_del_init(&inode->i_sb_list);
+			sb->s_nr_inodes--;
+			list_add(&inode->i_lru, dispose);
 			continue;
 		}
+		spin_unlock(&inode->i_lock);
 		busy = 1;
 	}
-	/* only unused inodes may be cached with i_count zero */
-	inodes_stat.nr_unused -= count;
 	return busy;
 }
 
@@ -355,9 +495,10 @@ int invalidate_inodes(struct super_block * sb)
 	LIST_HEAD(throw_away);
 
 	down(&iprune_sem);
-	spin_lock(&inode_lock);
-	busy = invalidate_list(&sb->s_inodes, &throw_away);
-	spin_unlock(&inode_lock);
+	spin_lock(&sb->s_inode_list_lock);
+	inotify_unmount_inodes(sb);
+	busy = invalidate_list(sb, &throw_away);
+	spin_unlock(&sb->s_inode_list_lock);
 
 	dispose_list(&throw_away);
 	up(&iprune_sem);
@@ -408,64 +549,78 @@ static int can_unuse(struct inode *inode)
 }
 
 /*
- * Scan `goal' inodes on the unused list for freeable ones. They are moved to
- * a temporary list and then are freed outside inode_lock by dispose_list().
+ * Scan `goal' inodes on the super block's unused list for freeable ones.
+ * They are moved to a temporary list and then are freed outside
+ * s_inode_lru_lock by dispose_list().
  *
- * Any inodes which are pinned purely because of attached pagecache have their
- * pagecache removed.  We expect the final iput() on that inode to add it to
- * the front of the inode_unused list.  So look for it there and if the
- * inode is still freeable, proceed.  The right inode is found 99.9% of the
- * time in testing on a 4-way.
+ * Inodes which were referenced since they went on the list are taken off
+ * it here.  Any inodes which are pinned purely because of attached
+ * pagecache have their pagecache removed.  The final iput() on that inode
+ * leaves it where it was, at the tail of the list.  So look for it there
+ * and if the inode is still freeable, proceed.
  *
  * If the inode has metadata buffers attached to mapping->private_list then
  * try to remove them.
  */
-static void prune_icache(int nr_to_scan)
+static void prune_icache_sb(struct super_block *sb, int nr_to_scan)
 {
 	LIST_HEAD(freeable);
-	int nr_pruned = 0;
 	int nr_scanned;
 	unsigned long reap = 0;
 
-	down(&iprune_sem);
-	spin_lock(&inode_lock);
+	spin_lock(&sb->s_inode_lru_lock);
 	for (nr_scanned = 0; nr_scanned < nr_to_scan; nr_scanned++) {
 		struct inode *inode;
 
-		if (list_empty(&inode_unused))
+		if (list_empty(&sb->s_inode_lru))
 			break;
 
-		inode = list_entry(inode_unused.prev, struct inode, i_list);
+		inode = list_entry(sb->s_inode_lru.prev, struct inode, i_lru);
 
-		if (inode->i_state || atomic_read(&inode->i_count)) {
-			list_move(&inode->i_list, &inode_unused);
+		if (!spin_trylock(&inode->i_lock)) {
+			/* Busy in iput() or a lookup: look at it again later */
+			list_move(&inode->i_lru, &sb->s_inode_lru);
+			continue;
+		}
+		if (atomic_read(&inode->i_count) ||
+		    (inode->i_state & I_FREEING)) {
+			list_del_init(&inode->i_lru);
+			sb->s_nr_inodes_unused--;
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		if (inode->i_state) {
+			list_move(&inode->i_lru, &sb->s_inode_lru);
+			spin_unlock(&inode->i_lock);
 			continue;
 		}
 		if (inode_has_buffers(inode) || inode->i_data.nrpages) {
 			__iget(inode);
-			spin_unlock(&inode_lock);
+			spin_unlock(&inode->i_lock);
+			spin_unlock(&sb->s_inode_lru_lock);
 			if (remove_inode_buffers(inode))
 				reap += invalidate_inode_pages(&inode->i_data);
 			iput(inode);
-			spin_lock(&inode_lock);
+			spin_lock(&sb->s_inode_lru_lock);
 
-			if (inode != list_entry(inode_unused.next,
-						struct inode, i_list))
+			if (inode != list_entry(sb->s_inode_lru.prev,
+						struct inode, i_lru))
 				continue;	/* wrong inode or list_empty */
-			if (!can_unuse(inode))
+			if (!spin_trylock(&inode->i_lock))
+				continue;
+			if (!can_unuse(inode)) {
+				spin_unlock(&inode->i_lock);
 				continue;
+			}
 		}
-		hlist_del_init(&inode->i_hash);
-		list_del_init(&inode->i_sb_list);
-		list_move(&inode->i_list, &freeable);
 		inode->i_state |= I_FREEING;
-		nr_pruned++;
+		spin_unlock(&inode->i_lock);
+		list_move(&inode->i_lru, &freeable);
+		sb->s_nr_inodes_unused--;
 	}
-	inodes_stat.nr_unused -= nr_pruned;
-	spin_unlock(&inode_lock);
+	spin_unlock(&sb->s_inode_lru_lock);
 
 	dispose_list(&freeable);
-	up(&iprune_sem);
 
 	if (current_is_kswapd())
 		mod_page_state(kswapd_inodesteal, reap);
@@ -473,6 +628,82 @@ static void prune_icache(int nr_to_scan)
 		mod_page_state(pginodesteal, reap);
 }
 
+int get_nr_inodes(void)
+{
+	struct super_block *sb;
+	int nr = 0;
+
+	spin_lock(&sb_lock);
+	list_for_each_entry(sb, &super_blocks, s_list)
+		nr += sb->s_nr_inodes;
+	spin_unlock(&sb_lock);
+	return nr;
+}
+
+int get_nr_inodes_unused(void)
+{
+	struct super_block *sb;
+	int nr = 0;
+
+	spin_lock(&sb_lock);
+	list_for_each_entry(sb, &super_blocks, s_list)
+		nr += sb->s_nr_inodes_unused;
+	spin_unlock(&sb_lock);
+	return nr;
+}
+
+/*
+ * /proc/sys/fs/inode-nr and inode-state: the counts are kept per super block.
+ */
+int proc_nr_inodes(ctl_table *table, int write, struct file *filp,
+		   void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	inodes_stat.nr_inodes = get_nr_inodes();
+	inodes_stat.nr_unused = get_nr_inodes_unused();
+	return proc_dointvec(table, write, filp, buffer, lenp, ppos);
+}
+
+/*
+ * Each superblock gives up its share of @nr_to_scan, in proportion to its
+ * unused inodes, as in prune_dcache().
+ */
+static void prune_icache(int nr_to_scan)
+{
+	struct super_block *sb;
+	int unused = get_nr_inodes_unused();
+	int ratio;
+
+	if (!unused || !nr_to_scan)
+		return;
+	ratio = nr_to_scan >= unused ? 1 : unused / nr_to_scan;
+
+	down(&iprune_sem);
+	spin_lock(&sb_lock);
+restart:
+	list_for_each_entry(sb, &super_blocks, s_list) {
+		int nr;
+
+		if (!sb->s_nr_inodes_unused)
+			continue;
+		nr = sb->s_nr_inodes_unused / ratio + 1;
+		sb->s_count++;
+		spin_unlock(&sb_lock);
+		if (down_read_trylock(&sb->s_umount)) {
+			if (sb->s_root)
+				prune_icache_sb(sb, nr);
+			up_read(&sb->s_umount);
+		}
+		spin_lock(&sb_lock);
+		nr_to_scan -= nr;
+		if (__put_super_and_need_restart(sb) && nr_to_scan > 0)
+			goto restart;
+		if (nr_to_scan <= 0)
+			break;
+	}
+	spin_unlock(&sb_lock);
+	up(&iprune_sem);
+}
+
 /*
  * shrink_icache_memory() will attempt to reclaim some unused inodes.  Here,
  * "unused" means that no dentries are referring to the inodes: the files are
@@ -494,32 +725,34 @@ static int shrink_icache_memory(int nr, unsigned int gfp_mask)
 			return -1;
 		prune_icache(nr);
 	}
-	return (inodes_stat.nr_unused / 100) * sysctl_vfs_cache_pressure;
+	return (get_nr_inodes_unused() / 100) * sysctl_vfs_cache_pressure;
 }
 
-static void __wait_on_freeing_inode(struct inode *inode);
+static void __wait_on_freeing_inode(struct inode_hash_bucket *b,
+				    struct inode *inode);
 /*
- * Called with the inode lock held.
- * NOTE: we are not increasing the inode-refcount, you must call __iget()
- * by hand after calling find_inode now! This simplifies iunique and won't
- * add any additional branch in the common code.
+ * Called with the hash bucket lock held.  The inode found is returned
+ * with a reference taken with __iget().
  */
-static struct inode * find_inode(struct super_block * sb, struct hlist_head *head, int (*test)(struct inode *, void *), void *data)
+static struct inode * find_inode(struct super_block * sb, struct inode_hash_bucket *b, int (*test)(struct inode *, void *), void *data)
 {
 	struct hlist_node *node;
 	struct inode * inode = NULL;
 
 repeat:
-	hlist_for_each (node, head) { 
+	hlist_for_each (node, &b->chain) { 
 		inode = hlist_entry(node, struct inode, i_hash);
 		if (inode->i_sb != sb)
 			continue;
 		if (!test(inode, data))
 			continue;
+		spin_lock(&inode->i_lock);
 		if (inode->i_state & (I_FREEING|I_CLEAR)) {
-			__wait_on_freeing_inode(inode);
+			__wait_on_freeing_inode(b, inode);
 			goto repeat;
 		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
 		break;
 	}
 	return node ? inode : NULL;
@@ -529,27 +762,56 @@ repeat:
  * find_inode_fast is the fast path version of find_inode, see the comment at
  * iget_locked for details.
  */
-static struct inode * find_inode_fast(struct super_block * sb, struct hlist_head *head, unsigned long ino)
+static struct inode * find_inode_fast(struct super_block * sb, struct inode_hash_bucket *b, unsigned long ino)
 {
 	struct hlist_node *node;
 	struct inode * inode = NULL;
 
 repeat:
-	hlist_for_each (node, head) {
+	hlist_for_each (node, &b->chain) {
 		inode = hlist_entry(node, struct inode, i_hash);
 		if (inode->i_ino != ino)
 			continue;
 		if (inode->i_sb != sb)
 			continue;
+		spin_lock(&inode->i_lock);
 		if (inode->i_state & (I_FREEING|I_CLEAR)) {
-			__wait_on_freeing_inode(inode);
+			__wait_on_freeing_inode(b, inode);
 			goto repeat;
 		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
 		break;
 	}
 	return node ? inode : NULL;
 }
 
+/*
+ * Inode numbers for new_inode() are handed out to each CPU in batches of
+ * LAST_INO_BATCH, so that creating inodes does not bounce one counter
+ * between CPUs.  They are only unique until they wrap, as they always were.
+ */
+#define LAST_INO_BATCH 1024
+static DEFINE_PER_CPU(unsigned long, last_ino);
+
+static unsigned long get_next_ino(void)
+{
+	unsigned long *p = &get_cpu_var(last_ino);
+	unsigned long res = *p;
+
+#ifdef CONFIG_SMP
+	if (unlikely((res & (LAST_INO_BATCH - 1)) == 0)) {
+		static atomic_t shared_last_ino;
+		int next = atomic_add_return(LAST_INO_BATCH, &shared_last_ino);
+
+		res = (unsigned int)next - LAST_INO_BATCH;
+	}
+#endif
+	*p = ++res;
+	put_cpu_var(last_ino);
+	return res;
+}
+
 /**
  *	new_inode 	- obtain an inode
  *	@sb: superblock
@@ -558,20 +820,13 @@ repeat:
  */
 struct inode *new_inode(struct super_block *sb)
 {
-	static unsigned long last_ino;
 	struct inode * inode;
 
-	spin_lock_prefetch(&inode_lock);
-	
 	inode = alloc_inode(sb);
 	if (inode) {
-		spin_lock(&inode_lock);
-		inodes_stat.nr_inodes++;
-		list_add(&inode->i_list, &inode_in_use);
-		list_add(&inode->i_sb_list, &sb->s_inodes);
-		inode->i_ino = ++last_ino;
+		inode->i_ino = get_next_ino();
 		inode->i_state = 0;
-		spin_unlock(&inode_lock);
+		inode_sb_list_add(inode);
 	}
 	return inode;
 }
@@ -581,14 +836,13 @@ EXPORT_SYMBOL(new_inode);
 void unlock_new_inode(struct inode *inode)
 {
 	/*
-	 * This is special!  We do not need the spinlock
-	 * when clearing I_LOCK, because we're guaranteed
-	 * that nobody else tries to do anything about the
-	 * state of the inode when it is locked, as we
-	 * just created it (so there can be no old holders
-	 * that haven't tested I_LOCK).
+	 * Nobody else does anything about the state of the inode
+	 * while it is locked, as we just created it, but it can
+	 * be dirtied behind our back.
 	 */
+	spin_lock(&inode->i_lock);
 	inode->i_state &= ~(I_LOCK|I_NEW);
+	spin_unlock(&inode->i_lock);
 	wake_up_inode(inode);
 }
 
@@ -600,7 +854,7 @@ EXPORT_SYMBOL(unlock_new_inode);
  * We no longer cache the sb_flags in i_flags - see fs.h
  *	-- rmk@arm.uk.linux.org
  */
-static struct inode * get_new_inode(struct super_block *sb, struct hlist_head *head, int (*test)(struct inode *, void *), int (*set)(struct inode *, void *), void *data)
+static struct inode * get_new_inode(struct super_block *sb, struct inode_hash_bucket *b, int (*test)(struct inode *, void *), int (*set)(struct inode *, void *), void *data)
 {
 	struct inode * inode;
 
@@ -608,19 +862,18 @@ static struct inode * get_new_inode(struct super_block *sb, struct hlist_head *h
 	if (inode) {
 		struct inode * old;
 
-		spin_lock(&inode_lock);
+		spin_lock(&b->lock);
 		/* We released the lock, so.. */
-		old = find_inode(sb, head, test, data);
+		old = find_inode(sb, b, test, data);
 		if (!old) {
 			if (set(inode, data))
 				goto set_failed;
 
-			inodes_stat.nr_inodes++;
-			list_add(&inode->i_list, &inode_in_use);
-			list_add(&inode->i_sb_list, &sb->s_inodes);
-			hlist_add_head(&inode->i_hash, head);
 			inode->i_state = I_LOCK|I_NEW;
-			spin_unlock(&inode_lock);
+			inode_sb_list_add(inode);
+			hlist_add_head(&inode->i_hash, &b->chain);
+			inode->i_hash_bucket = b;
+			spin_unlock(&b->lock);
 
 			/* Return the locked inode with I_NEW set, the
 			 * caller is responsible for filling in the contents
@@ -633,8 +886,7 @@ static struct inode * get_new_inode(struct super_block *sb, struct hlist_head *h
 		 * us. Use the old inode instead of the one we just
 		 * allocated.
 		 */
-		__iget(old);
-		spin_unlock(&inode_lock);
+		spin_unlock(&b->lock);
 		destroy_inode(inode);
 		inode = old;
 		wait_on_inode(inode);
@@ -642,7 +894,7 @@ static struct inode * get_new_inode(struct super_block *sb, struct hlist_head *h
 	return inode;
 
 set_failed:
-	spin_unlock(&inode_lock);
+	spin_unlock(&b->lock);
 	destroy_inode(inode);
 	return NULL;
 }
@@ -651,7 +903,7 @@ set_failed:
  * get_new_inode_fast is the fast path version of get_new_inode, see the
  * comment at iget_locked for details.
  */
-static struct inode * get_new_inode_fast(struct super_block *sb, struct hlist_head *head, unsigned long ino)
+static struct inode * get_new_inode_fast(struct super_block *sb, struct inode_hash_bucket *b, unsigned long ino)
 {
 	struct inode * inode;
 
@@ -659,17 +911,16 @@ static struct inode * get_new_inode_fast(struct super_block *sb, struct hlist_he
 	if (inode) {
 		struct inode * old;
 
-		spin_lock(&inode_lock);
+		spin_lock(&b->lock);
 		/* We released the lock, so.. */
-		old = find_inode_fast(sb, head, ino);
+		old = find_inode_fast(sb, b, ino);
 		if (!old) {
 			inode->i_ino = ino;
-			inodes_stat.nr_inodes++;
-			list_add(&inode->i_list, &inode_in_use);
-			list_add(&inode->i_sb_list, &sb->s_inodes);
-			hlist_add_head(&inode->i_hash, head);
 			inode->i_state = I_LOCK|I_NEW;
-			spin_unlock(&inode_lock);
+			inode_sb_list_add(inode);
+			hlist_add_head(&inode->i_hash, &b->chain);
+			inode->i_hash_bucket = b;
+			spin_unlock(&b->lock);
 
 			/* Return the locked inode with I_NEW set, the
 			 * caller is responsible for filling in the contents
@@ -682,8 +933,7 @@ static struct inode * get_new_inode_fast(struct super_block *sb, struct hlist_he
 		 * us. Use the old inode instead of the one we just
 		 * allocated.
 		 */
-		__iget(old);
-		spin_unlock(&inode_lock);
+		spin_unlock(&b->lock);
 		destroy_inode(inode);
 		inode = old;
 		wait_on_inode(inode);
@@ -715,44 +965,56 @@ static inline unsigned long hash(struct super_block *sb, unsigned long hashval)
  *	With a large number of inodes live on the file system this function
  *	currently becomes quite slow.
  */
+static int test_inode_iunique(struct super_block *sb, unsigned long ino)
+{
+	struct inode_hash_bucket *b = inode_hashtable + hash(sb, ino);
+	struct hlist_node *node;
+	struct inode *inode;
+
+	spin_lock(&b->lock);
+	hlist_for_each_entry(inode, node, &b->chain, i_hash) {
+		if (inode->i_ino == ino && inode->i_sb == sb) {
+			spin_unlock(&b->lock);
+			return 0;
+		}
+	}
+	spin_unlock(&b->lock);
+	return 1;
+}
+
 ino_t iunique(struct super_block *sb, ino_t max_reserved)
 {
+	static DEFINE_SPINLOCK(iunique_lock);
 	static ino_t counter;
-	struct inode *inode;
-	struct hlist_head * head;
 	ino_t res;
-	spin_lock(&inode_lock);
-retry:
-	if (counter > max_reserved) {
-		head = inode_hashtable + hash(sb,counter);
+
+	spin_lock(&iunique_lock);
+	do {
+		if (counter <= max_reserved)
+			counter = max_reserved + 1;
 		res = counter++;
-		inode = find_inode_fast(sb, head, res);
-		if (!inode) {
-			spin_unlock(&inode_lock);
-			return res;
-		}
-	} else {
-		counter = max_reserved + 1;
-	}
-	goto retry;
-	
+	} while (!test_inode_iunique(sb, res));
+	spin_unlock(&iunique_lock);
+	return res;
 }
 
 EXPORT_SYMBOL(iunique);
 
 struct inode *igrab(struct inode *inode)
 {
-	spin_lock(&inode_lock);
-	if (!(inode->i_state & I_FREEING))
+	spin_lock(&inode->i_lock);
+	if (!(inode->i_state & I_FREEING)) {
 		__iget(inode);
-	else
+		spin_unlock(&inode->i_lock);
+	} else {
+		spin_unlock(&inode->i_lock);
 		/*
 		 * Handle the case where s_op->clear_inode is not been
 		 * called yet, and somebody is calling igrab
 		 * while the inode is getting freed.
 		 */
 		inode = NULL;
-	spin_unlock(&inode_lock);
+	}
 	return inode;
 }
 
@@ -761,7 +1023,7 @@ EXPORT_SYMBOL(igrab);
 /**
  * ifind - internal function, you want ilookup5() or iget5().
  * @sb:		super block of file system to search
- * @head:       the head of the list to search
+ * @b:		the hash bucket to search
  * @test:	callback used for comparisons between inodes
  * @data:	opaque data pointer to pass to @test
  *
@@ -774,30 +1036,26 @@ EXPORT_SYMBOL(igrab);
  *
  * Otherwise NULL is returned.
  *
- * Note, @test is called with the inode_lock held, so can't sleep.
+ * Note, @test is called with the hash bucket lock held, so can't sleep.
  */
 static inline struct inode *ifind(struct super_block *sb,
-		struct hlist_head *head, int (*test)(struct inode *, void *),
+		struct inode_hash_bucket *b, int (*test)(struct inode *, void *),
 		void *data)
 {
 	struct inode *inode;
 
-	spin_lock(&inode_lock);
-	inode = find_inode(sb, head, test, data);
-	if (inode) {
-		__iget(inode);
-		spin_unlock(&inode_lock);
+	spin_lock(&b->lock);
+	inode = find_inode(sb, b, test, data);
+	spin_unlock(&b->lock);
+	if (inode)
 		wait_on_inode(inode);
-		return inode;
-	}
-	spin_unlock(&inode_lock);
-	return NULL;
+	return inode;
 }
 
 /**
  * ifind_fast - internal function, you want ilookup() or iget().
  * @sb:		super block of file system to search
- * @head:       head of the list to search
+ * @b:		the hash bucket to search
  * @ino:	inode number to search for
  *
  * ifind_fast() searches for the inode @ino in the inode cache. This is for
@@ -810,20 +1068,16 @@ static inline struct inode *ifind(struct super_block *sb,
  * Otherwise NULL is returned.
  */
 static inline struct inode *ifind_fast(struct super_block *sb,
-		struct hlist_head *head, unsigned long ino)
+		struct inode_hash_bucket *b, unsigned long ino)
 {
 	struct inode *inode;
 
-	spin_lock(&inode_lock);
-	inode = find_inode_fast(sb, head, ino);
-	if (inode) {
-		__iget(inode);
-		spin_unlock(&inode_lock);
+	spin_lock(&b->lock);
+	inode = find_inode_fast(sb, b, ino);
+	spin_unlock(&b->lock);
+	if (inode)
 		wait_on_inode(inode);
-		return inode;
-	}
-	spin_unlock(&inode_lock);
-	return NULL;
+	return inode;
 }
 
 /**
@@ -843,14 +1097,14 @@ static inline struct inode *ifind_fast(struct super_block *sb,
  *
  * Otherwise NULL is returned.
  *
- * Note, @test is called with the inode_lock held, so can't sleep.
+ * Note, @test is called with the hash bucket lock held, so can't sleep.
  */
 struct inode *ilookup5(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct inode_hash_bucket *b = inode_hashtable + hash(sb, hashval);
 
-	return ifind(sb, head, test, data);
+	return ifind(sb, b, test, data);
 }
 
 EXPORT_SYMBOL(ilookup5);
@@ -871,9 +1125,9 @@ EXPORT_SYMBOL(ilookup5);
  */
 struct inode *ilookup(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct inode_hash_bucket *b = inode_hashtable + hash(sb, ino);
 
-	return ifind_fast(sb, head, ino);
+	return ifind_fast(sb, b, ino);
 }
 
 EXPORT_SYMBOL(ilookup);
@@ -898,23 +1152,24 @@ EXPORT_SYMBOL(ilookup);
  * inode and this is returned locked, hashed, and with the I_NEW flag set. The
  * file system gets to fill it in before unlocking it via unlock_new_inode().
  *
- * Note both @test and @set are called with the inode_lock held, so can't sleep.
+ * Note both @test and @set are called with the hash bucket lock held, so
+ * can't sleep.
  */
 struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *),
 		int (*set)(struct inode *, void *), void *data)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct inode_hash_bucket *b = inode_hashtable + hash(sb, hashval);
 	struct inode *inode;
 
-	inode = ifind(sb, head, test, data);
+	inode = ifind(sb, b, test, data);
 	if (inode)
 		return inode;
 	/*
 	 * get_new_inode() will do the right thing, re-trying the search
 	 * in case it had to block at any point.
 	 */
-	return get_new_inode(sb, head, test, set, data);
+	return get_new_inode(sb, b, test, set, data);
 }
 
 EXPORT_SYMBOL(iget5_locked);
@@ -938,17 +1193,17 @@ EXPORT_SYMBOL(iget5_locked);
  */
 struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct inode_hash_bucket *b = inode_hashtable + hash(sb, ino);
 	struct inode *inode;
 
-	inode = ifind_fast(sb, head, ino);
+	inode = ifind_fast(sb, b, ino);
 	if (inode)
 		return inode;
 	/*
 	 * get_new_inode_fast() will do the right thing, re-trying the search
 	 * in case it had to block at any point.
 	 */
-	return get_new_inode_fast(sb, head, ino);
+	return get_new_inode_fast(sb, b, ino);
 }
 
 EXPORT_SYMBOL(iget_locked);
@@ -963,10 +1218,13 @@ EXPORT_SYMBOL(iget_locked);
  */
 void __insert_inode_hash(struct inode *inode, unsigned long hashval)
 {
-	struct hlist_head *head = inode_hashtable + hash(inode->i_sb, hashval);
-	spin_lock(&inode_lock);
-	hlist_add_head(&inode->i_hash, head);
-	spin_unlock(&inode_lock);
+	struct inode_hash_bucket *b = inode_hashtable + hash(inode->i_sb, hashval);
+	spin_lock(&b->lock);
+	spin_lock(&inode->i_lock);
+	hlist_add_head(&inode->i_hash, &b->chain);
+	inode->i_hash_bucket = b;
+	spin_unlock(&inode->i_lock);
+	spin_unlock(&b->lock);
 }
 
 EXPORT_SYMBOL(__insert_inode_hash);
@@ -975,13 +1233,21 @@ EXPORT_SYMBOL(__insert_inode_hash);
  *	remove_inode_hash - remove an inode from the hash
  *	@inode: inode to unhash
  *
- *	Remove an inode from the superblock.
+ *	Remove an inode from the superblock.  An inode is hashed and
+ *	unhashed by its owner, so i_hash_bucket cannot change under us.
  */
 void remove_inode_hash(struct inode *inode)
 {
-	spin_lock(&inode_lock);
+	struct inode_hash_bucket *b = inode->i_hash_bucket;
+
+	if (!b)
+		return;
+	spin_lock(&b->lock);
+	spin_lock(&inode->i_lock);
 	hlist_del_init(&inode->i_hash);
-	spin_unlock(&inode_lock);
+	inode->i_hash_bucket = NULL;
+	spin_unlock(&inode->i_lock);
+	spin_unlock(&b->lock);
 }
 
 EXPORT_SYMBOL(remove_inode_hash);
@@ -997,16 +1263,17 @@ EXPORT_SYMBOL(remove_inode_hash);
  *
  * I_FREEING is set so that no-one will take a new reference to the inode while
  * it is being deleted.
+ *
+ * Called with inode->i_lock held, which it drops, like the other ->drop_inode
+ * methods.
  */
 void generic_delete_inode(struct inode *inode)
 {
 	struct super_operations *op = inode->i_sb->s_op;
 
-	list_del_init(&inode->i_list);
-	list_del_init(&inode->i_sb_list);
 	inode->i_state|=I_FREEING;
-	inodes_stat.nr_inodes--;
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
+	inode_unlist(inode);
 
 	if (inode->i_data.nrpages)
 		truncate_inode_pages(&inode->i_data, 0);
@@ -1021,9 +1288,7 @@ void generic_delete_inode(struct inode *inode)
 		delete(inode);
 	} else
 		clear_inode(inode);
-	spin_lock(&inode_lock);
-	hlist_del_init(&inode->i_hash);
-	spin_unlock(&inode_lock);
+	remove_inode_hash(inode);
 	wake_up_inode(inode);
 	if (inode->i_state != I_CLEAR)
 		BUG();
@@ -1037,22 +1302,17 @@ static void generic_forget_inode(struct inode *inode)
 	struct super_block *sb = inode->i_sb;
 
 	if (!hlist_unhashed(&inode->i_hash)) {
-		if (!(inode->i_state & (I_DIRTY|I_LOCK)))
-			list_move(&inode->i_list, &inode_unused);
-		inodes_stat.nr_unused++;
-		spin_unlock(&inode_lock);
+		inode_lru_list_add(inode);
+		spin_unlock(&inode->i_lock);
 		if (!sb || (sb->s_flags & MS_ACTIVE))
 			return;
 		write_inode_now(inode, 1);
-		spin_lock(&inode_lock);
-		inodes_stat.nr_unused--;
-		hlist_del_init(&inode->i_hash);
+		spin_lock(&inode->i_lock);
 	}
-	list_del_init(&inode->i_list);
-	list_del_init(&inode->i_sb_list);
 	inode->i_state|=I_FREEING;
-	inodes_stat.nr_inodes--;
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
+	inode_unlist(inode);
+	remove_inode_hash(inode);
 	if (inode->i_data.nrpages)
 		truncate_inode_pages(&inode->i_data, 0);
 	clear_inode(inode);
@@ -1079,7 +1339,7 @@ static void generic_drop_inode(struct inode *inode)
  * Call the FS "drop()" function, defaulting to
  * the legacy UNIX filesystem behaviour..
  *
- * NOTE! NOTE! NOTE! We're called with the inode lock
+ * NOTE! NOTE! NOTE! We're called with inode->i_lock
  * held, and the drop function is supposed to release
  * the lock!
  */
@@ -1111,7 +1371,7 @@ void iput(struct inode *inode)
 		if (op && op->put_inode)
 			op->put_inode(inode);
 
-		if (atomic_dec_and_lock(&inode->i_count, &inode_lock))
+		if (atomic_dec_and_lock(&inode->i_count, &inode->i_lock))
 			iput_final(inode);
 	}
 }
@@ -1231,7 +1491,7 @@ void remove_dquot_ref(struct super_block *sb, int type,
 
 	if (!sb->dq_op)
 		return;	/* nothing to do */
-	spin_lock(&inode_lock);	/* This lock is for inodes code */
+	spin_lock(&sb->s_inode_list_lock);	/* This lock is for inodes code */
 
 	/*
 	 * We don't have to lock against quota code - test IS_QUOTAINIT is
@@ -1241,7 +1501,7 @@ void remove_dquot_ref(struct super_block *sb, int type,
 		if (!IS_NOQUOTA(inode))
 			remove_inode_dquot_ref(inode, type, tofree_head);
 
-	spin_unlock(&inode_lock);
+	spin_unlock(&sb->s_inode_list_lock);
 }
 
 #endif
@@ -1258,36 +1518,40 @@ int inode_wait(void *word)
  * that it isn't found.  This is because iget will immediately call
  * ->read_inode, and we want to be sure that evidence of the deletion is found
  * by ->read_inode.
- * This is called with inode_lock held.
+ * This is called with the hash bucket lock and inode->i_lock held, and
+ * returns with only the hash bucket lock.
  */
-static void __wait_on_freeing_inode(struct inode *inode)
+static void __wait_on_freeing_inode(struct inode_hash_bucket *b,
+				    struct inode *inode)
 {
 	wait_queue_head_t *wq;
 	DEFINE_WAIT_BIT(wait, &inode->i_state, __I_LOCK);
 
 	/*
-	 * I_FREEING and I_CLEAR are cleared in process context under
-	 * inode_lock, so we have to give the tasks who would clear them
-	 * a chance to run and acquire inode_lock.
+	 * The inode is unhashed in process context under the hash bucket
+	 * lock, so we have to give the tasks who would unhash it a chance
+	 * to run and acquire the lock.
 	 */
 	if (!(inode->i_state & I_LOCK)) {
-		spin_unlock(&inode_lock);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&b->lock);
 		yield();
-		spin_lock(&inode_lock);
+		spin_lock(&b->lock);
 		return;
 	}
 	wq = bit_waitqueue(&inode->i_state, __I_LOCK);
 	prepare_to_wait(wq, &wait.wait, TASK_UNINTERRUPTIBLE);
-	spin_unlock(&inode_lock);
+	spin_unlock(&inode->i_lock);
+	spin_unlock(&b->lock);
 	schedule();
 	finish_wait(wq, &wait.wait);
-	spin_lock(&inode_lock);
+	spin_lock(&b->lock);
 }
 
 void wake_up_inode(struct inode *inode)
 {
 	/*
-	 * Prevent speculative execution through spin_unlock(&inode_lock);
+	 * Prevent speculative execution through the spin_unlock() before us;
 	 */
 	smp_mb();
 	wake_up_bit(&inode->i_state, __I_LOCK);
@@ -1318,7 +1582,7 @@ void __init inode_init_early(void)
 
 	inode_hashtable =
 		alloc_large_system_hash("Inode-cache",
-					sizeof(struct hlist_head),
+					sizeof(struct inode_hash_bucket),
 					ihash_entries,
 					14,
 					HASH_EARLY,
@@ -1326,8 +1590,10 @@ void __init inode_init_early(void)
 					&i_hash_mask,
 					0);
 
-	for (loop = 0; loop < (1 << i_hash_shift); loop++)
-		INIT_HLIST_HEAD(&inode_hashtable[loop]);
+	for (loop = 0; loop < (1 << i_hash_shift); loop++) {
+		INIT_HLIST_HEAD(&inode_hashtable[loop].chain);
+		spin_lock_init(&inode_hashtable[loop].lock);
+	}
 }
 
 void __init inode_init(unsigned long mempages)
@@ -1345,7 +1611,7 @@ void __init inode_init(unsigned long mempages)
 
 	inode_hashtable =
 		alloc_large_system_hash("Inode-cache",
-					sizeof(struct hlist_head),
+					sizeof(struct inode_hash_bucket),
 					ihash_entries,
 					14,
 					0,
@@ -1353,8 +1619,10 @@ void __init inode_init(unsigned long mempages)
 					&i_hash_mask,
 					0);
 
-	for (loop = 0; loop < (1 << i_hash_shift); loop++)
-		INIT_HLIST_HEAD(&inode_hashtable[loop]);
+	for (loop = 0; loop < (1 << i_hash_shift); loop++) {
+		INIT_HLIST_HEAD(&inode_hashtable[loop].chain);
+		spin_lock_init(&inode_hashtable[loop].lock);
+	}
 }
 
 void init_special_inode(struct inode *inode, umode_t mode, dev_t rdev)
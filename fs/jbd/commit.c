@@ -21,6 +21,8 @@
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/smp_lock.h>
+#include <linux/crc32.h>
+#include <linux/blkdev.h>
 
 /*
  * Default IO end handler for temporary BJ_IO buffer_heads.
@@ -93,6 +95,100 @@ static int inverted_lock(journal_t *journal, struct buffer_head *bh)
 	return 1;
 }
 
+/*
+ * Get a log block for the commit record of the transaction and fill it
+ * in, with the transaction's checksum if the journal carries them.
+ */
+static struct journal_head *
+journal_get_commit_record(journal_t *journal,
+			  transaction_t *commit_transaction, __u32 crc32_sum)
+{
+	struct journal_head *descriptor;
+	struct commit_header *tmp;
+	struct buffer_head *bh;
+
+	descriptor = journal_get_descriptor_buffer(journal);
+	if (!descriptor)
+		return NULL;
+
+	bh = jh2bh(descriptor);
+	tmp = (struct commit_header *)bh->b_data;
+	tmp->h_magic = cpu_to_be32(JFS_MAGIC_NUMBER);
+	tmp->h_blocktype = cpu_to_be32(JFS_COMMIT_BLOCK);
+	tmp->h_sequence = cpu_to_be32(commit_transaction->t_tid);
+
+	if (JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM)) {
+		tmp->h_chksum_type = JFS_CRC32_CHKSUM;
+		tmp->h_chksum_size = JFS_CRC32_CHKSUM_SIZE;
+		tmp->h_chksum[0] = cpu_to_be32(crc32_sum);
+	}
+	return descriptor;
+}
+
+/*
+ * On a journal with asynchronous commits the commit record goes out
+ * straight behind the transaction's other log blocks, without waiting
+ * for them: the checksum in it lets recovery tell a commit that made it
+ * to disk from one that was torn.  Returns NULL if the journal needs to
+ * be aborted.
+ */
+static struct journal_head *
+journal_submit_commit_record(journal_t *journal,
+			     transaction_t *commit_transaction, __u32 crc32_sum)
+{
+	struct journal_head *descriptor;
+	struct buffer_head *bh;
+
+	descriptor = journal_get_commit_record(journal, commit_transaction,
+					       crc32_sum);
+	if (!descriptor)
+		return NULL;
+
+	bh = jh2bh(descriptor);
+	JBUFFER_TRACE(descriptor, "submit commit block");
+	lock_buffer(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = journal_end_buffer_io_sync;
+	submit_bh(WRITE, bh);
+	return descriptor;
+}
+
+/*
+ * Wait for an asynchronously submitted commit record.  With barriers
+ * on, the disk cache is flushed once the whole transaction is written,
+ * so that the commit is durable before checkpointing may start.
+ *
+ * Returns 1 if the journal needs to be aborted or 0 on success
+ */
+static int journal_wait_on_commit_record(journal_t *journal,
+					 struct journal_head *descriptor)
+{
+	struct buffer_head *bh = jh2bh(descriptor);
+	int ret = 0;
+
+	wait_on_buffer(bh);
+	if (unlikely(!buffer_uptodate(bh)))
+		ret = 1;
+
+	if (!ret && (journal->j_flags & JFS_BARRIER) &&
+	    blkdev_issue_flush(journal->j_dev, NULL) == -EOPNOTSUPP) {
+		char b[BDEVNAME_SIZE];
+
+		printk(KERN_WARNING
+			"JBD: cache flush failed on %s - "
+			"disabling barriers\n",
+			bdevname(journal->j_dev, b));
+		write_lock(&journal->j_state_lock);
+		journal->j_flags &= ~JFS_BARRIER;
+		write_unlock(&journal->j_state_lock);
+	}
+	put_bh(bh);		/* One for getblk() */
+	journal_put_journal_head(descriptor);
+
+	return ret;
+}
+
 /* Done it all: now write the commit record.  We should have
  * cleaned up our previous buffers by now, so if we are in abort
  * mode we can now just skip the rest of the journal write
@@ -101,30 +197,24 @@ static int inverted_lock(journal_t *journal, struct buffer_head *bh)
  * Returns 1 if the journal needs to be aborted or 0 on success
  */
 static int journal_write_commit_record(journal_t *journal,
-					transaction_t *commit_transaction)
+				transaction_t *commit_transaction,
+				__u32 crc32_sum)
 {
 	struct journal_head *descriptor;
 	struct buffer_head *bh;
-	int i, ret;
+	int ret;
 	int barrier_done = 0;
 
 	if (is_journal_aborted(journal))
 		return 0;
 
-	descriptor = journal_get_descriptor_buffer(journal);
+	descriptor = journal_get_commit_record(journal, commit_transaction,
+					       crc32_sum);
 	if (!descriptor)
 		return 1;
 
 	bh = jh2bh(descriptor);
 
-	/* AKPM: buglet - add `i' to tmp! */
-	for (i = 0; i < bh->b_size; i += 512) {
-		journal_header_t *tmp = (journal_header_t*)bh->b_data;
-		tmp->h_magic = cpu_to_be32(JFS_MAGIC_NUMBER);
-		tmp->h_blocktype = cpu_to_be32(JFS_COMMIT_BLOCK);
-		tmp->h_sequence = cpu_to_be32(commit_transaction->t_tid);
-	}
-
 	JBUFFER_TRACE(descriptor, "write commit block");
 	set_buffer_dirty(bh);
 	if (journal->j_flags & JFS_BARRIER) {
@@ -144,9 +234,9 @@ static int journal_write_commit_record(journal_t *journal,
 			"JBD: barrier-based sync failed on %s - "
 			"disabling barriers\n",
 			bdevname(journal->j_dev, b));
-		spin_lock(&journal->j_state_lock);
+		write_lock(&journal->j_state_lock);
 		journal->j_flags &= ~JFS_BARRIER;
-		spin_unlock(&journal->j_state_lock);
+		write_unlock(&journal->j_state_lock);
 
 		/* And try again, without the barrier */
 		clear_buffer_ordered(bh);
@@ -170,6 +260,7 @@ void journal_commit_transaction(journal_t *journal)
 {
 	transaction_t *commit_transaction;
 	struct journal_head *jh, *new_jh, *descriptor;
+	struct journal_head *commit_record = NULL;
 	struct buffer_head **wbuf = journal->j_wbuf;
 	int bufs;
 	int flags;
@@ -182,6 +273,7 @@ void journal_commit_transaction(journal_t *journal)
 	int first_tag = 0;
 	int tag_flag;
 	int i;
+	__u32 crc32_sum = ~0;
 
 	/*
 	 * First job: lock down the current transaction and wait for
@@ -211,27 +303,28 @@ void journal_commit_transaction(journal_t *journal)
 	jbd_debug(1, "JBD: starting commit of transaction %d\n",
 			commit_transaction->t_tid);
 
-	spin_lock(&journal->j_state_lock);
+	write_lock(&journal->j_state_lock);
 	commit_transaction->t_state = T_LOCKED;
 
-	spin_lock(&commit_transaction->t_handle_lock);
-	while (commit_transaction->t_updates) {
+	/*
+	 * Handles join a transaction under j_state_lock held for reading,
+	 * so now that T_LOCKED is set under the write lock no new ones
+	 * can: only the ones already running are left to wait for.
+	 */
+	while (atomic_read(&commit_transaction->t_updates)) {
 		DEFINE_WAIT(wait);
 
 		prepare_to_wait(&journal->j_wait_updates, &wait,
 					TASK_UNINTERRUPTIBLE);
-		if (commit_transaction->t_updates) {
-			spin_unlock(&commit_transaction->t_handle_lock);
-			spin_unlock(&journal->j_state_lock);
+		if (atomic_read(&commit_transaction->t_updates)) {
+			write_unlock(&journal->j_state_lock);
 			schedule();
-			spin_lock(&journal->j_state_lock);
-			spin_lock(&commit_transaction->t_handle_lock);
+			write_lock(&journal->j_state_lock);
 		}
 		finish_wait(&journal->j_wait_updates, &wait);
 	}
-	spin_unlock(&commit_transaction->t_handle_lock);
 
-	J_ASSERT (commit_transaction->t_outstanding_credits <=
+	J_ASSERT (atomic_read(&commit_transaction->t_outstanding_credits) <=
 			journal->j_max_transaction_buffers);
 
 	/*
@@ -291,7 +384,7 @@ void journal_commit_transaction(journal_t *journal)
 	journal->j_running_transaction = NULL;
 	commit_transaction->t_log_start = journal->j_head;
 	wake_up(&journal->j_wait_transaction_locked);
-	spin_unlock(&journal->j_state_lock);
+	write_unlock(&journal->j_state_lock);
 
 	jbd_debug (3, "JBD: commit phase 2\n");
 
@@ -521,7 +614,7 @@ write_out_data:
 		 * the free space in the log, but this counter is changed
 		 * by journal_next_log_block() also.
 		 */
-		commit_transaction->t_outstanding_credits--;
+		atomic_dec(&commit_transaction->t_outstanding_credits);
 
 		/* Bump b_count to prevent truncate from stumbling over
                    the shadowed buffer!  @@@ This can go if we ever get
@@ -585,6 +678,11 @@ write_out_data:
 start_journal_io:
 			for (i = 0; i < bufs; i++) {
 				struct buffer_head *bh = wbuf[i];
+
+				if (JFS_HAS_COMPAT_FEATURE(journal,
+						JFS_FEATURE_COMPAT_CHECKSUM))
+					crc32_sum = crc32_be(crc32_sum,
+						(void *)bh->b_data, bh->b_size);
 				lock_buffer(bh);
 				clear_buffer_dirty(bh);
 				set_buffer_uptodate(bh);
@@ -600,6 +698,18 @@ start_journal_io:
 		}
 	}
 
+	/* With asynchronous commits the commit record follows the
+	   rest of the transaction to the log right away. */
+
+	if (JFS_HAS_INCOMPAT_FEATURE(journal,
+			JFS_FEATURE_INCOMPAT_ASYNC_COMMIT) &&
+	    !is_journal_aborted(journal)) {
+		commit_record = journal_submit_commit_record(journal,
+					commit_transaction, crc32_sum);
+		if (!commit_record)
+			__journal_abort_hard(journal);
+	}
+
 	/* Lo and behold: we have just managed to send a transaction to
            the log.  Before we can commit it, wait for the IO so far to
            complete.  Control buffers being written are on the
@@ -699,8 +809,15 @@ wait_for_iobuf:
 
 	jbd_debug(3, "JBD: commit phase 6\n");
 
-	if (journal_write_commit_record(journal, commit_transaction))
-		err = -EIO;
+	if (commit_record) {
+		if (journal_wait_on_commit_record(journal, commit_record))
+			err = -EIO;
+	} else if (!JFS_HAS_INCOMPAT_FEATURE(journal,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+		if (journal_write_commit_record(journal, commit_transaction,
+						crc32_sum))
+			err = -EIO;
+	}
 
 	if (err)
 		__journal_abort_hard(journal);
@@ -809,13 +926,13 @@ restart_loop:
 	 * Really, __jornal_remove_checkpoint should be using j_state_lock but
 	 * it's a bit hassle to hold that across __journal_remove_checkpoint
 	 */
-	spin_lock(&journal->j_state_lock);
+	write_lock(&journal->j_state_lock);
 	spin_lock(&journal->j_list_lock);
 	commit_transaction->t_state = T_FINISHED;
 	J_ASSERT(commit_transaction == journal->j_committing_transaction);
 	journal->j_commit_sequence = commit_transaction->t_tid;
 	journal->j_committing_transaction = NULL;
-	spin_unlock(&journal->j_state_lock);
+	write_unlock(&journal->j_state_lock);
 
 	if (commit_transaction->t_checkpoint_list == NULL) {
 		__journal_drop_transaction(journal, commit_transaction);
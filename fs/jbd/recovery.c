@@ -21,6 +21,7 @@
 #include <linux/jbd.h>
 #include <linux/errno.h>
 #include <linux/slab.h>
+#include <linux/crc32.h>
 #endif
 
 /*
@@ -209,6 +210,51 @@ do {									\
 		var -= ((journal)->j_last - (journal)->j_first);	\
 } while (0)
 
+/*
+ * Fold a descriptor block and the log blocks it describes into the
+ * running checksum of a transaction, and step *next_log_block past them.
+ */
+static int calc_chksums(journal_t *journal, struct buffer_head *bh,
+			unsigned long *next_log_block, __u32 *crc32_sum)
+{
+	int i, num_blks, err;
+	unsigned long io_block;
+	struct buffer_head *obh;
+
+	num_blks = count_tags(bh, journal->j_blocksize);
+	*crc32_sum = crc32_be(*crc32_sum, (void *)bh->b_data, bh->b_size);
+
+	for (i = 0; i < num_blks; i++) {
+		io_block = (*next_log_block)++;
+		wrap(journal, *next_log_block);
+		err = jread(&obh, journal, io_block);
+		if (err) {
+			printk(KERN_ERR "JBD: IO error %d recovering block "
+				"%lu in log\n", err, io_block);
+			return -EIO;
+		}
+		*crc32_sum = crc32_be(*crc32_sum, (void *)obh->b_data,
+				      obh->b_size);
+		brelse(obh);
+	}
+	return 0;
+}
+
+/*
+ * Does the checksum in a commit block match the one computed over the
+ * transaction?  Commit blocks written before the journal got checksums
+ * carry none and are taken as they are.
+ */
+static int commit_chksum_ok(struct commit_header *cbh, __u32 crc32_sum)
+{
+	if (cbh->h_chksum_type == 0 && cbh->h_chksum_size == 0 &&
+	    cbh->h_chksum[0] == 0)
+		return 1;
+	return cbh->h_chksum_type == JFS_CRC32_CHKSUM &&
+	       cbh->h_chksum_size == JFS_CRC32_CHKSUM_SIZE &&
+	       be32_to_cpu(cbh->h_chksum[0]) == crc32_sum;
+}
+
 /**
  * int journal_recover(journal_t *journal) - recovers a on-disk journal
  * @journal: the journal to recover
@@ -318,6 +364,7 @@ static int do_one_pass(journal_t *journal,
 	struct buffer_head *	bh;
 	unsigned int		sequence;
 	int			blocktype;
+	__u32			crc32_sum = ~0; /* Transactional Checksums */
 
 	/* Precompute the maximum metadata descriptors in a descriptor block */
 	int			MAX_BLOCKS_PER_DESC;
@@ -412,6 +459,17 @@ static int do_one_pass(journal_t *journal,
 			 * in pass REPLAY; otherwise, just skip over the
 			 * blocks it describes. */
 			if (pass != PASS_REPLAY) {
+				if (pass == PASS_SCAN &&
+				    JFS_HAS_COMPAT_FEATURE(journal,
+					    JFS_FEATURE_COMPAT_CHECKSUM)) {
+					err = calc_chksums(journal, bh,
+							   &next_log_block,
+							   &crc32_sum);
+					brelse(bh);
+					if (err)
+						goto failed;
+					continue;
+				}
 				next_log_block +=
 					count_tags(bh, journal->j_blocksize);
 				wrap(journal, next_log_block);
@@ -508,7 +566,30 @@ static int do_one_pass(journal_t *journal,
 		case JFS_COMMIT_BLOCK:
 			/* Found an expected commit block: not much to
 			 * do other than move on to the next sequence
-			 * number. */
+			 * number.  If the journal checksums its
+			 * transactions, a commit whose checksum does not
+			 * match was torn: the log ends in front of it.
+			 * With asynchronous commits that is what a crash
+			 * in mid-commit looks like; otherwise the log is
+			 * corrupt. */
+			if (pass == PASS_SCAN &&
+			    JFS_HAS_COMPAT_FEATURE(journal,
+				    JFS_FEATURE_COMPAT_CHECKSUM)) {
+				struct commit_header *cbh =
+					(struct commit_header *)bh->b_data;
+
+				if (!commit_chksum_ok(cbh, crc32_sum)) {
+					if (!JFS_HAS_INCOMPAT_FEATURE(journal,
+					    JFS_FEATURE_INCOMPAT_ASYNC_COMMIT))
+						printk(KERN_ERR "JBD: checksum "
+						       "error in transaction "
+						       "%u, ignoring it\n",
+						       next_commit_ID);
+					brelse(bh);
+					goto done;
+				}
+				crc32_sum = ~0;
+			}
 			brelse(bh);
 			next_commit_ID++;
 			continue;
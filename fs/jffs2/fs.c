@@ -498,10 +498,14 @@ int jffs2_do_fill_super(struct super_block *sb, void *data, int silent)
 	if (ret)
 		return ret;
 
+	ret = jffs2_sum_init(c);
+	if (ret)
+		goto out_wbuf;
+
 	c->inocache_list = kmalloc(INOCACHE_HASHSIZE * sizeof(struct jffs2_inode_cache *), GFP_KERNEL);
 	if (!c->inocache_list) {
 		ret = -ENOMEM;
-		goto out_wbuf;
+		goto out_sum;
 	}
 	memset(c->inocache_list, 0, INOCACHE_HASHSIZE * sizeof(struct jffs2_inode_cache *));
 
@@ -543,6 +547,8 @@ int jffs2_do_fill_super(struct super_block *sb, void *data, int silent)
 		kfree(c->blocks);
  out_inohash:
 	kfree(c->inocache_list);
+ out_sum:
+	jffs2_sum_exit(c);
  out_wbuf:
 	jffs2_flash_cleanup(c);
 
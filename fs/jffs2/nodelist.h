@@ -28,6 +28,8 @@
 #include "os-linux.h"
 #endif
 
+#include "summary.h"
+
 #ifndef CONFIG_JFFS2_FS_DEBUG
 #define CONFIG_JFFS2_FS_DEBUG 1
 #endif
@@ -162,8 +162,18 @@ int jffs2_reserve_space_gc(struct jffs2_sb_info *c, uint32_t minsize, uint32_t *
 static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, uint32_t *ofs, uint32_t *len)
 {
 	struct jffs2_eraseblock *jeb = c->nextblock;
+	uint32_t reserved;
 	
  restart:
+	/* Keep back the room for the summary of the block, and write
+	   it out once the block has no other use for that room */
+	reserved = jffs2_sum_reserved(c);
+	if (jeb && reserved && minsize + reserved > jeb->free_size) {
+		jffs2_sum_write_sumnode(c);
+		jeb = c->nextblock;
+		goto restart;
+	}
+
 	if (jeb && minsize > jeb->free_size) {
 		/* Skip the end of this block and file it as having some dirty space */
 		/* If there's a pending write to it, flush now */
@@ -257,6 +267,7 @@ static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, ui
 		list_del(next);
 		c->nextblock = jeb = list_entry(next, struct jffs2_eraseblock, list);
 		c->nr_free_blocks--;
+		jffs2_sum_reset_collected(c);
 
 		if (jeb->free_size != c->sector_size - c->cleanmarker_size) {
 			printk(KERN_WARNING "Eep. Block 0x%08x taken from free_list had free_size of 0x%08x!!\n", jeb->offset, jeb->free_size);
@@ -265,8 +276,14 @@ static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, ui
 	}
 	/* OK, jeb (==c->nextblock) is now pointing at a block which definitely has
 	   enough space */
+	reserved = jffs2_sum_reserved(c);
+	if (minsize + reserved > jeb->free_size) {
+		/* A fresh block, and this node leaves no room for its summary */
+		jffs2_sum_disable_collecting(c);
+		reserved = 0;
+	}
 	*ofs = jeb->offset + (c->sector_size - jeb->free_size);
-	*len = jeb->free_size;
+	*len = jeb->free_size - reserved;
 
 	if (c->cleanmarker_size && jeb->used_size == c->cleanmarker_size &&
 	    !jeb->first_node->next_in_ino) {
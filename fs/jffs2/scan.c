@@ -48,6 +48,7 @@ static uint32_t pseudo_random;
 
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
 				  unsigned char *buf, uint32_t buf_size);
+static int jffs2_scan_classify_jeb(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
 
 /* These helper functions _must_ increase ofs and also do the dirty/used space accounting. 
  * Returning an error will abort the mount - bad checksums etc. should just mark the space
@@ -57,6 +58,11 @@ static int jffs2_scan_inode_node(struct jffs2_sb_info *c, struct jffs2_erasebloc
 				 struct jffs2_raw_inode *ri, uint32_t ofs);
 static int jffs2_scan_dirent_node(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
 				 struct jffs2_raw_dirent *rd, uint32_t ofs);
+static struct jffs2_inode_cache *jffs2_scan_make_ino_cache(struct jffs2_sb_info *c, uint32_t ino);
+#ifdef CONFIG_JFFS2_SUMMARY
+static int jffs2_scan_summary(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			      unsigned char *buf, uint32_t buf_size);
+#endif
 
 #define BLK_STATE_ALLFF		0
 #define BLK_STATE_CLEAN		1
@@ -310,6 +316,14 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 		default: 	return ret;
 		}
 	}
+#endif
+#ifdef CONFIG_JFFS2_SUMMARY
+	/* A block with a summary needn't be read any further */
+	err = jffs2_scan_summary(c, jeb, buf, buf_size);
+	if (err < 0)
+		return err;
+	if (err)
+		return jffs2_scan_classify_jeb(c, jeb);
 #endif
 	buf_ofs = jeb->offset;
 
@@ -609,6 +623,11 @@ scan_more:
 	D1(printk(KERN_DEBUG "Block at 0x%08x: free 0x%08x, dirty 0x%08x, unchecked 0x%08x, used 0x%08x\n", jeb->offset, 
 		  jeb->free_size, jeb->dirty_size, jeb->unchecked_size, jeb->used_size));
 
+	return jffs2_scan_classify_jeb(c, jeb);
+}
+
+static int jffs2_scan_classify_jeb(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
 	/* mark_node_obsolete can add to wasted !! */
 	if (jeb->wasted_size) {
 		jeb->dirty_size += jeb->wasted_size;
@@ -809,6 +828,236 @@ static int jffs2_scan_dirent_node(struct jffs2_sb_info *c, struct jffs2_eraseblo
 	return 0;
 }
 
+#ifdef CONFIG_JFFS2_SUMMARY
+/* Check that the entries are sane and in order before any of them is used */
+static int jffs2_sum_entries_ok(struct jffs2_sb_info *c, struct jffs2_raw_summary *summary,
+				uint32_t sum_ofs, uint32_t sumlen)
+{
+	unsigned char *sp = summary->sum;
+	unsigned char *end = (unsigned char *)summary + sumlen - sizeof(struct jffs2_sum_marker);
+	uint32_t i, ofs, totlen, minlen, next = 0;
+
+	for (i = 0; i < je32_to_cpu(summary->sum_num); i++) {
+		struct jffs2_sum_inode_flash *spi = (void *)sp;
+		struct jffs2_sum_dirent_flash *spd = (void *)sp;
+
+		if (end - sp < sizeof(jint16_t))
+			return 0;
+
+		switch (je16_to_cpu(spi->nodetype)) {
+		case JFFS2_NODETYPE_INODE:
+			if (end - sp < JFFS2_SUMMARY_INODE_SIZE)
+				return 0;
+			ofs = je32_to_cpu(spi->offset);
+			totlen = je32_to_cpu(spi->totlen);
+			minlen = sizeof(struct jffs2_raw_inode);
+			sp += JFFS2_SUMMARY_INODE_SIZE;
+			break;
+
+		case JFFS2_NODETYPE_DIRENT:
+			if (end - sp < JFFS2_SUMMARY_DIRENT_SIZE(0) ||
+			    end - sp < JFFS2_SUMMARY_DIRENT_SIZE(spd->nsize))
+				return 0;
+			ofs = je32_to_cpu(spd->offset);
+			totlen = je32_to_cpu(spd->totlen);
+			minlen = sizeof(struct jffs2_raw_dirent) + spd->nsize;
+			sp += JFFS2_SUMMARY_DIRENT_SIZE(spd->nsize);
+			break;
+
+		default:
+			return 0;
+		}
+		if ((ofs & 3) || ofs < next || totlen < minlen ||
+		    totlen > sum_ofs || ofs > sum_ofs - PAD(totlen))
+			return 0;
+		next = ofs + PAD(totlen);
+	}
+	return 1;
+}
+
+/*
+ * Build the block from its summary, if it has a good one.  Returns 1 if
+ * it did, 0 if the block has to be scanned in full, or an error.  Inodes
+ * are left unchecked as by the full scan, and the space between the
+ * nodes the summary lists is taken for dirty.
+ */
+static int jffs2_scan_summary(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			      unsigned char *buf, uint32_t buf_size)
+{
+	struct jffs2_sum_marker *sm;
+	struct jffs2_raw_summary *summary;
+	unsigned char *sumbuf = NULL, *sp;
+	uint32_t sum_ofs, sumlen, crc, i;
+	int err, ret = 0;
+
+	if (buf_size) {
+		err = jffs2_fill_scan_buf(c, buf, jeb->offset + c->sector_size - sizeof(*sm), sizeof(*sm));
+		if (err)
+			return err;
+		sm = (void *)buf;
+	} else {
+		sm = (void *)buf + c->sector_size - sizeof(*sm);
+	}
+
+	if (je32_to_cpu(sm->magic) != JFFS2_SUM_MAGIC)
+		return 0;
+
+	sum_ofs = je32_to_cpu(sm->offset);
+	if ((sum_ofs & 3) || sum_ofs > c->sector_size - JFFS2_SUMMARY_FRAME_SIZE) {
+		printk(KERN_NOTICE "jffs2_scan_summary(): Bad summary offset 0x%08x in block at 0x%08x\n",
+		       sum_ofs, jeb->offset);
+		return 0;
+	}
+	sumlen = c->sector_size - sum_ofs;
+
+	if (!buf_size) {
+		summary = (void *)buf + sum_ofs;
+	} else {
+		if (sumlen > buf_size) {
+			sumbuf = kmalloc(sumlen, GFP_KERNEL);
+			if (!sumbuf)
+				return 0;
+		}
+		err = jffs2_fill_scan_buf(c, sumbuf ? : buf, jeb->offset + sum_ofs, sumlen);
+		if (err) {
+			kfree(sumbuf);
+			return err;
+		}
+		summary = (void *)(sumbuf ? : buf);
+	}
+
+	if (je16_to_cpu(summary->magic) != JFFS2_MAGIC_BITMASK ||
+	    je16_to_cpu(summary->nodetype) != JFFS2_NODETYPE_SUMMARY ||
+	    je32_to_cpu(summary->totlen) != sumlen) {
+		/* Most likely obsoleted since, with the block partly collected */
+		D1(printk(KERN_DEBUG "jffs2_scan_summary(): No summary node at 0x%08x\n",
+			  jeb->offset + sum_ofs));
+		goto out;
+	}
+	crc = crc32(0, summary, sizeof(struct jffs2_unknown_node)-4);
+	if (crc != je32_to_cpu(summary->hdr_crc))
+		goto badcrc;
+	crc = crc32(0, summary, sizeof(*summary)-8);
+	if (crc != je32_to_cpu(summary->node_crc))
+		goto badcrc;
+	crc = crc32(0, summary->sum, sumlen - sizeof(*summary));
+	if (crc != je32_to_cpu(summary->sum_crc))
+		goto badcrc;
+
+	if (!jffs2_sum_entries_ok(c, summary, sum_ofs, sumlen)) {
+		printk(KERN_NOTICE "jffs2_scan_summary(): Bad entry in summary at 0x%08x\n",
+		       jeb->offset + sum_ofs);
+		goto out;
+	}
+
+	D1(printk(KERN_DEBUG "jffs2_scan_summary(): %d nodes in summary at 0x%08x\n",
+		  je32_to_cpu(summary->sum_num), jeb->offset + sum_ofs));
+
+	sp = summary->sum;
+	for (i = 0; i < je32_to_cpu(summary->sum_num); i++) {
+		struct jffs2_sum_inode_flash *spi = (void *)sp;
+		struct jffs2_sum_dirent_flash *spd = (void *)sp;
+		struct jffs2_raw_node_ref *raw;
+		struct jffs2_inode_cache *ic;
+		struct jffs2_full_dirent *fd = NULL;
+		uint32_t totlen;
+
+		raw = jffs2_alloc_raw_node_ref();
+		if (!raw) {
+			printk(KERN_NOTICE "jffs2_scan_summary(): allocation of node reference failed\n");
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		if (je16_to_cpu(spi->nodetype) == JFFS2_NODETYPE_INODE) {
+			totlen = PAD(je32_to_cpu(spi->totlen));
+			ic = jffs2_scan_make_ino_cache(c, je32_to_cpu(spi->inode));
+			raw->flash_offset = (jeb->offset + je32_to_cpu(spi->offset)) | REF_UNCHECKED;
+			pseudo_random += je32_to_cpu(spi->version);
+			sp += JFFS2_SUMMARY_INODE_SIZE;
+		} else {
+			totlen = PAD(je32_to_cpu(spd->totlen));
+			fd = jffs2_alloc_full_dirent(spd->nsize+1);
+			if (!fd) {
+				jffs2_free_raw_node_ref(raw);
+				ret = -ENOMEM;
+				goto out;
+			}
+			memcpy(&fd->name, spd->name, spd->nsize);
+			fd->name[spd->nsize] = 0;
+			fd->raw = raw;
+			fd->next = NULL;
+			fd->version = je32_to_cpu(spd->version);
+			fd->ino = je32_to_cpu(spd->ino);
+			fd->nhash = full_name_hash(fd->name, spd->nsize);
+			fd->type = spd->type;
+
+			ic = jffs2_scan_make_ino_cache(c, je32_to_cpu(spd->pino));
+			raw->flash_offset = (jeb->offset + je32_to_cpu(spd->offset)) | REF_PRISTINE;
+			pseudo_random += je32_to_cpu(spd->version);
+			sp += JFFS2_SUMMARY_DIRENT_SIZE(spd->nsize);
+		}
+		if (!ic) {
+			if (fd)
+				jffs2_free_full_dirent(fd);
+			jffs2_free_raw_node_ref(raw);
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		raw->__totlen = totlen;
+		raw->next_phys = NULL;
+		raw->next_in_ino = ic->nodes;
+		ic->nodes = raw;
+		if (!jeb->first_node)
+			jeb->first_node = raw;
+		if (jeb->last_node)
+			jeb->last_node->next_phys = raw;
+		jeb->last_node = raw;
+
+		if (fd) {
+			USED_SPACE(totlen);
+			jffs2_add_fd_to_list(c, fd, &ic->scan_dents);
+		} else {
+			UNCHECKED_SPACE(totlen);
+		}
+	}
+
+	/* The summary node itself, which the garbage collector will obsolete */
+	{
+		struct jffs2_raw_node_ref *raw = jffs2_alloc_raw_node_ref();
+
+		if (!raw) {
+			printk(KERN_NOTICE "jffs2_scan_summary(): allocation of node reference failed\n");
+			ret = -ENOMEM;
+			goto out;
+		}
+		raw->flash_offset = (jeb->offset + sum_ofs) | REF_NORMAL;
+		raw->__totlen = sumlen;
+		raw->next_phys = NULL;
+		raw->next_in_ino = NULL;
+		if (!jeb->first_node)
+			jeb->first_node = raw;
+		if (jeb->last_node)
+			jeb->last_node->next_phys = raw;
+		jeb->last_node = raw;
+		USED_SPACE(sumlen);
+	}
+
+	/* Whatever is left is the gaps between nodes */
+	DIRTY_SPACE(jeb->free_size);
+	ret = 1;
+	goto out;
+
+ badcrc:
+	printk(KERN_NOTICE "jffs2_scan_summary(): CRC failed on summary at 0x%08x\n",
+	       jeb->offset + sum_ofs);
+ out:
+	kfree(sumbuf);
+	return ret;
+}
+#endif /* CONFIG_JFFS2_SUMMARY */
+
 static int count_list(struct list_head *l)
 {
 	uint32_t count = 0;
@@ -0,0 +1,233 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ * Collecting and writing erase block summaries.  The entries for the
+ * nodes written to c->nextblock are kept in their on-flash form, and
+ * jffs2_do_reserve_space() keeps back the room to write them when the
+ * block is full.  A block which had nodes put in it any other way (the
+ * one left part written at mount, or one written by wbuf recovery) gets
+ * no summary, and is scanned in full at the next mount.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mtd/mtd.h>
+#include <linux/crc32.h>
+#include "nodelist.h"
+
+int jffs2_sum_init(struct jffs2_sb_info *c)
+{
+	c->summary = kmalloc(sizeof(struct jffs2_summary), GFP_KERNEL);
+	if (!c->summary)
+		return -ENOMEM;
+
+	/* The entries can never be more than the block they describe */
+	c->summary->sum_buf = vmalloc(c->sector_size);
+	if (!c->summary->sum_buf) {
+		kfree(c->summary);
+		return -ENOMEM;
+	}
+
+	jffs2_sum_disable_collecting(c);
+	return 0;
+}
+
+void jffs2_sum_exit(struct jffs2_sb_info *c)
+{
+	vfree(c->summary->sum_buf);
+	kfree(c->summary);
+	c->summary = NULL;
+}
+
+/* c->nextblock is a freshly erased block; start its summary */
+void jffs2_sum_reset_collected(struct jffs2_sb_info *c)
+{
+	c->summary->sum_size = 0;
+	c->summary->sum_num = 0;
+}
+
+void jffs2_sum_disable_collecting(struct jffs2_sb_info *c)
+{
+	c->summary->sum_size = JFFS2_SUMMARY_NOSUM_SIZE;
+	c->summary->sum_num = 0;
+}
+
+/* Space at the end of c->nextblock which a new node must not use */
+uint32_t jffs2_sum_reserved(struct jffs2_sb_info *c)
+{
+	if (c->summary->sum_size == JFFS2_SUMMARY_NOSUM_SIZE)
+		return 0;
+
+	return PAD(c->summary->sum_size + JFFS2_SUMMARY_FRAME_SIZE +
+		   JFFS2_SUMMARY_MAX_ENTRY);
+}
+
+static void *jffs2_sum_add_entry(struct jffs2_sb_info *c, uint32_t ofs, uint32_t size)
+{
+	struct jffs2_summary *s = c->summary;
+	struct jffs2_eraseblock *jeb = c->nextblock;
+	void *entry;
+
+	if (s->sum_size == JFFS2_SUMMARY_NOSUM_SIZE)
+		return NULL;
+
+	if (!jeb || ofs < jeb->offset || ofs >= jeb->offset + c->sector_size ||
+	    s->sum_size + size + JFFS2_SUMMARY_FRAME_SIZE > c->sector_size) {
+		printk(KERN_WARNING "jffs2_sum_add_entry(): Node at 0x%08x doesn't fit the summary of the current block. Dropping it\n", ofs);
+		jffs2_sum_disable_collecting(c);
+		return NULL;
+	}
+
+	entry = s->sum_buf + s->sum_size;
+	s->sum_size += size;
+	s->sum_num++;
+	return entry;
+}
+
+void jffs2_sum_add_inode(struct jffs2_sb_info *c, struct jffs2_raw_inode *ri, uint32_t ofs)
+{
+	struct jffs2_sum_inode_flash *e;
+
+	e = jffs2_sum_add_entry(c, ofs, JFFS2_SUMMARY_INODE_SIZE);
+	if (!e)
+		return;
+
+	e->nodetype = ri->nodetype;
+	e->inode = ri->ino;
+	e->version = ri->version;
+	e->offset = cpu_to_je32(ofs - c->nextblock->offset);
+	e->totlen = ri->totlen;
+}
+
+void jffs2_sum_add_dirent(struct jffs2_sb_info *c, struct jffs2_raw_dirent *rd,
+			  const unsigned char *name, uint32_t ofs)
+{
+	struct jffs2_sum_dirent_flash *e;
+
+	e = jffs2_sum_add_entry(c, ofs, JFFS2_SUMMARY_DIRENT_SIZE(rd->nsize));
+	if (!e)
+		return;
+
+	e->nodetype = rd->nodetype;
+	e->totlen = rd->totlen;
+	e->offset = cpu_to_je32(ofs - c->nextblock->offset);
+	e->pino = rd->pino;
+	e->version = rd->version;
+	e->ino = rd->ino;
+	e->nsize = rd->nsize;
+	e->type = rd->type;
+	memcpy(e->name, name, rd->nsize);
+}
+
+/* A node copied whole by the garbage collector */
+void jffs2_sum_add_node(struct jffs2_sb_info *c, union jffs2_node_union *node, uint32_t ofs)
+{
+	switch (je16_to_cpu(node->u.nodetype)) {
+	case JFFS2_NODETYPE_INODE:
+		jffs2_sum_add_inode(c, &node->i, ofs);
+		break;
+
+	case JFFS2_NODETYPE_DIRENT:
+		jffs2_sum_add_dirent(c, &node->d, node->d.name, ofs);
+		break;
+
+	default:
+		/* Nothing else is copied, but if it were the scan
+		   would have to find it */
+		jffs2_sum_disable_collecting(c);
+		break;
+	}
+}
+
+/*
+ * Write the summary of c->nextblock in all the space left in it, with
+ * the marker in the last bytes of the block.  Called with alloc_sem and
+ * erase_completion_lock held; drops the latter while it writes.  If the
+ * summary can't be written the block is simply left without one.
+ */
+void jffs2_sum_write_sumnode(struct jffs2_sb_info *c)
+{
+	struct jffs2_summary *s = c->summary;
+	struct jffs2_eraseblock *jeb = c->nextblock;
+	struct jffs2_raw_node_ref *raw;
+	struct jffs2_raw_summary isum;
+	struct jffs2_sum_marker *sm;
+	struct kvec vecs[2];
+	uint32_t sum_ofs, totlen, datasize;
+	size_t retlen;
+	int ret;
+
+	totlen = jeb->free_size;
+	sum_ofs = c->sector_size - totlen;
+
+	/* Nothing to describe, or padding by the write buffer has eaten
+	   into the room for it */
+	if (!s->sum_num || s->sum_size + JFFS2_SUMMARY_FRAME_SIZE > totlen || (sum_ofs & 3)) {
+		D1(printk(KERN_DEBUG "jffs2_sum_write_sumnode(): No summary written at 0x%08x\n",
+			  jeb->offset + sum_ofs));
+		jffs2_sum_disable_collecting(c);
+		return;
+	}
+
+	raw = jffs2_alloc_raw_node_ref();
+	if (!raw) {
+		jffs2_sum_disable_collecting(c);
+		return;
+	}
+
+	datasize = totlen - sizeof(isum);
+	memset(s->sum_buf + s->sum_size, 0xff, datasize - s->sum_size);
+	sm = (struct jffs2_sum_marker *)(s->sum_buf + datasize - sizeof(*sm));
+	sm->offset = cpu_to_je32(sum_ofs);
+	sm->magic = cpu_to_je32(JFFS2_SUM_MAGIC);
+
+	isum.magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
+	isum.nodetype = cpu_to_je16(JFFS2_NODETYPE_SUMMARY);
+	isum.totlen = cpu_to_je32(totlen);
+	isum.hdr_crc = cpu_to_je32(crc32(0, &isum, sizeof(struct jffs2_unknown_node)-4));
+	isum.sum_num = cpu_to_je32(s->sum_num);
+	isum.sum_crc = cpu_to_je32(crc32(0, s->sum_buf, datasize));
+	isum.node_crc = cpu_to_je32(crc32(0, &isum, sizeof(isum)-8));
+
+	vecs[0].iov_base = &isum;
+	vecs[0].iov_len = sizeof(isum);
+	vecs[1].iov_base = s->sum_buf;
+	vecs[1].iov_len = datasize;
+
+	D1(printk(KERN_DEBUG "jffs2_sum_write_sumnode(): Writing %d entries at 0x%08x\n",
+		  s->sum_num, jeb->offset + sum_ofs));
+
+	/* Whatever happens, nothing more goes into this summary */
+	jffs2_sum_disable_collecting(c);
+
+	raw->flash_offset = jeb->offset + sum_ofs;
+	raw->__totlen = totlen;
+	raw->next_phys = NULL;
+	raw->next_in_ino = NULL;
+
+	spin_unlock(&c->erase_completion_lock);
+
+	ret = jffs2_flash_writev(c, vecs, 2, raw->flash_offset, &retlen, 0);
+
+	if (ret || retlen != totlen) {
+		printk(KERN_NOTICE "Write of %u bytes at 0x%08x failed. returned %d, retlen %zd\n",
+		       totlen, raw->flash_offset, ret, retlen);
+		if (retlen) {
+			raw->flash_offset |= REF_OBSOLETE;
+			jffs2_add_physical_node_ref(c, raw);
+			jffs2_mark_node_obsolete(c, raw);
+		} else {
+			jffs2_free_raw_node_ref(raw);
+		}
+	} else {
+		/* No inode; the garbage collector just obsoletes it */
+		raw->flash_offset |= REF_NORMAL;
+		jffs2_add_physical_node_ref(c, raw);
+	}
+
+	spin_lock(&c->erase_completion_lock);
+}
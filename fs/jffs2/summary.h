@@ -0,0 +1,109 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ * Erase block summaries.  When an erase block is filled, a summary node
+ * listing the inode and dirent nodes in it is written at its end, so
+ * that the mount can build the block from the summary alone and not
+ * from reading every node in it.  Blocks without a valid summary are
+ * scanned in full as before.
+ *
+ */
+
+#ifndef __JFFS2_SUMMARY_H__
+#define __JFFS2_SUMMARY_H__
+
+#include <linux/config.h>
+
+/* Last eight bytes of a block with a summary */
+#define JFFS2_SUM_MAGIC	0x02851885
+
+struct jffs2_sum_marker
+{
+	jint32_t offset;	/* Of the summary node, from the start of the block */
+	jint32_t magic;		/* JFFS2_SUM_MAGIC */
+} __attribute__((packed));
+
+struct jffs2_raw_summary
+{
+	jint16_t magic;
+	jint16_t nodetype;	/* == JFFS2_NODETYPE_SUMMARY */
+	jint32_t totlen;	/* Runs to the end of the block */
+	jint32_t hdr_crc;
+	jint32_t sum_num;	/* Number of entries */
+	jint32_t sum_crc;	/* Over everything after this header */
+	jint32_t node_crc;	/* Over the header up to sum_crc */
+	uint8_t sum[0];		/* Entries, then 0xff to the marker */
+} __attribute__((packed));
+
+/* One per inode node in the block */
+struct jffs2_sum_inode_flash
+{
+	jint16_t nodetype;	/* == JFFS2_NODETYPE_INODE */
+	jint32_t inode;
+	jint32_t version;
+	jint32_t offset;	/* From the start of the block */
+	jint32_t totlen;
+} __attribute__((packed));
+
+/* One per dirent node in the block */
+struct jffs2_sum_dirent_flash
+{
+	jint16_t nodetype;	/* == JFFS2_NODETYPE_DIRENT */
+	jint32_t totlen;
+	jint32_t offset;	/* From the start of the block */
+	jint32_t pino;
+	jint32_t version;
+	jint32_t ino;		/* == zero for unlink */
+	uint8_t nsize;
+	uint8_t type;
+	uint8_t name[0];
+} __attribute__((packed));
+
+#define JFFS2_SUMMARY_INODE_SIZE	(sizeof(struct jffs2_sum_inode_flash))
+#define JFFS2_SUMMARY_DIRENT_SIZE(x)	(sizeof(struct jffs2_sum_dirent_flash) + (x))
+#define JFFS2_SUMMARY_FRAME_SIZE	(sizeof(struct jffs2_raw_summary) + sizeof(struct jffs2_sum_marker))
+
+/* Room kept back for the entry of the node the space is reserved for */
+#define JFFS2_SUMMARY_MAX_ENTRY		JFFS2_SUMMARY_DIRENT_SIZE(JFFS2_MAX_NAME_LEN)
+
+/* sum_size while nothing is being collected for c->nextblock */
+#define JFFS2_SUMMARY_NOSUM_SIZE	0xffffffff
+
+#ifdef CONFIG_JFFS2_SUMMARY
+
+/* Protected by c->alloc_sem, like c->nextblock it describes */
+struct jffs2_summary
+{
+	uint32_t sum_size;	/* Bytes of entries in sum_buf */
+	uint32_t sum_num;
+	unsigned char *sum_buf;	/* The entries, as they go on the flash */
+};
+
+int jffs2_sum_init(struct jffs2_sb_info *c);
+void jffs2_sum_exit(struct jffs2_sb_info *c);
+void jffs2_sum_reset_collected(struct jffs2_sb_info *c);
+void jffs2_sum_disable_collecting(struct jffs2_sb_info *c);
+uint32_t jffs2_sum_reserved(struct jffs2_sb_info *c);
+void jffs2_sum_write_sumnode(struct jffs2_sb_info *c);
+void jffs2_sum_add_inode(struct jffs2_sb_info *c, struct jffs2_raw_inode *ri, uint32_t ofs);
+void jffs2_sum_add_dirent(struct jffs2_sb_info *c, struct jffs2_raw_dirent *rd,
+			  const unsigned char *name, uint32_t ofs);
+void jffs2_sum_add_node(struct jffs2_sb_info *c, union jffs2_node_union *node, uint32_t ofs);
+
+#else /* !CONFIG_JFFS2_SUMMARY */
+
+#define jffs2_sum_init(c) (0)
+#define jffs2_sum_exit(c) do { } while (0)
+#define jffs2_sum_reset_collected(c) do { } while (0)
+#define jffs2_sum_disable_collecting(c) do { } while (0)
+#define jffs2_sum_reserved(c) (0)
+#define jffs2_sum_write_sumnode(c) do { } while (0)
+#define jffs2_sum_add_inode(c, ri, ofs) do { } while (0)
+#define jffs2_sum_add_dirent(c, rd, name, ofs) do { } while (0)
+#define jffs2_sum_add_node(c, node, ofs) do { } while (0)
+
+#endif /* CONFIG_JFFS2_SUMMARY */
+
+#endif /* __JFFS2_SUMMARY_H__ */
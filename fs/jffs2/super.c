@@ -281,6 +281,7 @@ static void jffs2_put_super (struct super_block *sb)
 		vfree(c->blocks);
 	else
 		kfree(c->blocks);
+	jffs2_sum_exit(c);
 	jffs2_flash_cleanup(c);
 	kfree(c->inocache_list);
 	if (c->mtd->sync)
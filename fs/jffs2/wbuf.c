@@ -268,6 +268,9 @@ static void jffs2_wbuf_recover(struct jffs2_sb_info *c)
 			kfree(buf);
 		return;
 	}
+	/* The nodes we move there won't be in its summary */
+	jffs2_sum_disable_collecting(c);
+
 	if (end-start >= c->wbuf_pagesize) {
 		/* Need to do another write immediately. This, btw,
 		 means that we'll be writing from 'buf' and not from
@@ -210,6 +210,7 @@ struct jffs2_full_dnode *jffs2_write_dnode(struct jffs2_sb_info *c, struct jffs2
 	} else {
 		raw->flash_offset |= REF_NORMAL;
 	}
+	jffs2_sum_add_inode(c, ri, flash_ofs);
 	jffs2_add_physical_node_ref(c, raw);
 
 	/* Link into per-inode list */
@@ -333,6 +334,7 @@ struct jffs2_full_dirent *jffs2_write_dirent(struct jffs2_sb_info *c, struct jff
 	}
 	/* Mark the space used */
 	raw->flash_offset |= REF_PRISTINE;
+	jffs2_sum_add_dirent(c, rd, name, flash_ofs);
 	jffs2_add_physical_node_ref(c, raw);
 
 	spin_lock(&c->erase_completion_lock);
@@ -117,6 +117,7 @@
 #include <linux/capability.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/security.h>
@@ -142,7 +143,19 @@ LIST_HEAD(file_lock_list);
 
 EXPORT_SYMBOL(file_lock_list);
 
-static LIST_HEAD(blocked_list);
+/*
+ * Waiters on POSIX locks, hashed by owner, so that deadlock detection
+ * only looks at the waiters of the owner it is following.
+ */
+#define BLOCKED_HASH_BITS	7
+#define BLOCKED_HASH_SIZE	(1 << BLOCKED_HASH_BITS)
+
+static struct list_head blocked_hash[BLOCKED_HASH_SIZE];
+
+static inline struct list_head *blocked_chain(struct file_lock *fl)
+{
+	return &blocked_hash[hash_ptr(fl->fl_owner, BLOCKED_HASH_BITS)];
+}
 
 static kmem_cache_t *filelock_cache;
 
@@ -475,6 +488,178 @@ posix_same_owner(struct file_lock *fl1, struct file_lock *fl2)
 	return fl1->fl_owner == fl2->fl_owner;
 }
 
+/*
+ * The POSIX locks on i_flock are also kept in an interval tree, ordered by
+ * fl_start, in which every node caches the largest fl_end in its subtree.
+ * This lets conflict checks and __posix_lock_file() visit just the locks
+ * overlapping a range instead of every lock on the inode.  The cached ends
+ * are brought up to date after a rebalance by walking from the deepest
+ * node it can have moved up to the root, fixing the siblings on the way.
+ */
+#define posix_tree_entry(node)	rb_entry((node), struct file_lock, fl_rb)
+
+static inline struct inode *posix_lock_inode(struct file_lock *fl)
+{
+	return fl->fl_file->f_dentry->d_inode;
+}
+
+static inline loff_t posix_subtree_end(struct rb_node *node)
+{
+	return node ? posix_tree_entry(node)->fl_subtree_end : -1;
+}
+
+static void posix_tree_fixup(struct rb_node *node)
+{
+	struct file_lock *fl = posix_tree_entry(node);
+	loff_t end = fl->fl_end;
+
+	if (posix_subtree_end(node->rb_left) > end)
+		end = posix_subtree_end(node->rb_left);
+	if (posix_subtree_end(node->rb_right) > end)
+		end = posix_subtree_end(node->rb_right);
+	fl->fl_subtree_end = end;
+}
+
+static void posix_tree_fixup_path(struct rb_node *node)
+{
+	struct rb_node *parent;
+
+	for (; node; node = parent) {
+		posix_tree_fixup(node);
+		parent = node->rb_parent;
+		if (!parent)
+			break;
+		if (node == parent->rb_left && parent->rb_right)
+			posix_tree_fixup(parent->rb_right);
+		else if (parent->rb_left)
+			posix_tree_fixup(parent->rb_left);
+	}
+}
+
+static void posix_tree_insert(struct inode *inode, struct file_lock *fl)
+{
+	struct rb_node **p = &inode->i_posix_locks.rb_node;
+	struct rb_node *node, *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		if (fl->fl_start < posix_tree_entry(parent)->fl_start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	node = &fl->fl_rb;
+	fl->fl_subtree_end = fl->fl_end;
+	rb_link_node(node, parent, p);
+	rb_insert_color(node, &inode->i_posix_locks);
+
+	if (node->rb_left)
+		node = node->rb_left;
+	else if (node->rb_right)
+		node = node->rb_right;
+	posix_tree_fixup_path(node);
+}
+
+static void posix_tree_erase(struct inode *inode, struct file_lock *fl)
+{
+	struct rb_node *node = &fl->fl_rb;
+	struct rb_node *deepest;
+
+	if (!node->rb_left && !node->rb_right)
+		deepest = node->rb_parent;
+	else if (!node->rb_right)
+		deepest = node->rb_left;
+	else if (!node->rb_left)
+		deepest = node->rb_right;
+	else {
+		deepest = rb_next(node);
+		if (deepest->rb_right)
+			deepest = deepest->rb_right;
+		else if (deepest->rb_parent != node)
+			deepest = deepest->rb_parent;
+	}
+	rb_erase(node, &inode->i_posix_locks);
+	posix_tree_fixup_path(deepest);
+}
+
+/* Call after changing the range of a POSIX lock on i_flock. */
+static inline void posix_tree_update(struct inode *inode, struct file_lock *fl)
+{
+	posix_tree_erase(inode, fl);
+	posix_tree_insert(inode, fl);
+}
+
+/* The lowest starting lock under node that overlaps start..end. */
+static struct file_lock *posix_tree_search(struct rb_node *node,
+					   loff_t start, loff_t end)
+{
+	while (node) {
+		struct file_lock *fl = posix_tree_entry(node);
+
+		if (posix_subtree_end(node->rb_left) >= start) {
+			node = node->rb_left;
+			continue;
+		}
+		if (fl->fl_start > end)
+			break;
+		if (fl->fl_end >= start)
+			return fl;
+		node = node->rb_right;
+		if (posix_subtree_end(node) < start)
+			break;
+	}
+	return NULL;
+}
+
+static inline struct file_lock *
+posix_tree_first(struct inode *inode, loff_t start, loff_t end)
+{
+	return posix_tree_search(inode->i_posix_locks.rb_node, start, end);
+}
+
+/* The next lock after fl, in fl_start order, that overlaps start..end. */
+static struct file_lock *posix_tree_next(struct file_lock *fl,
+					 loff_t start, loff_t end)
+{
+	struct rb_node *node = &fl->fl_rb;
+	struct rb_node *rb = node->rb_right;
+	struct rb_node *prev;
+
+	for (;;) {
+		if (posix_subtree_end(rb) >= start)
+			return posix_tree_search(rb, start, end);
+
+		/* Go up until we come from a left child */
+		do {
+			rb = node->rb_parent;
+			if (!rb)
+				return NULL;
+			prev = node;
+			node = rb;
+			rb = node->rb_right;
+		} while (prev == rb);
+
+		fl = posix_tree_entry(node);
+		if (fl->fl_start > end)
+			return NULL;
+		if (fl->fl_end >= start)
+			return fl;
+	}
+}
+
+/* New POSIX locks go after the leases and flock locks of the inode. */
+static struct file_lock **posix_insert_pos(struct inode *inode)
+{
+	struct file_lock **before;
+
+	for_each_lock(inode, before) {
+		struct file_lock *fl = *before;
+		if (IS_POSIX(fl))
+			break;
+	}
+	return before;
+}
+
 /* Remove waiter from blocker's block list.
  * When blocker ends up pointing to itself then the list is empty.
  */
@@ -511,7 +696,7 @@ static void locks_insert_block(struct file_lock *blocker,
 	list_add_tail(&waiter->fl_block, &blocker->fl_block);
 	waiter->fl_next = blocker;
 	if (IS_POSIX(blocker))
-		list_add(&waiter->fl_link, &blocked_list);
+		list_add(&waiter->fl_link, blocked_chain(waiter));
 }
 
 /* Wake up processes blocked waiting for blocker.
@@ -540,8 +725,14 @@ static void locks_insert_lock(struct file_lock **pos, struct file_lock *fl)
 
 	/* insert into file's list */
 	fl->fl_next = *pos;
+	if (fl->fl_next)
+		fl->fl_next->fl_pprev = &fl->fl_next;
+	fl->fl_pprev = pos;
 	*pos = fl;
 
+	if (IS_POSIX(fl))
+		posix_tree_insert(posix_lock_inode(fl), fl);
+
 	if (fl->fl_ops && fl->fl_ops->fl_insert)
 		fl->fl_ops->fl_insert(fl);
 }
@@ -557,9 +748,14 @@ static void locks_delete_lock(struct file_lock **thisfl_p)
 	struct file_lock *fl = *thisfl_p;
 
 	*thisfl_p = fl->fl_next;
+	if (fl->fl_next)
+		fl->fl_next->fl_pprev = thisfl_p;
 	fl->fl_next = NULL;
 	list_del_init(&fl->fl_link);
 
+	if (IS_POSIX(fl))
+		posix_tree_erase(posix_lock_inode(fl), fl);
+
 	fasync_helper(0, fl->fl_file, 0, &fl->fl_fasync);
 	if (fl->fl_fasync != NULL) {
 		printk(KERN_ERR "locks_delete_lock: fasync == %p\n", fl->fl_fasync);
@@ -649,12 +845,12 @@ static int locks_block_on_timeout(struct file_lock *blocker, struct file_lock *w
 struct file_lock *
 posix_test_lock(struct file *filp, struct file_lock *fl)
 {
+	struct inode *inode = filp->f_dentry->d_inode;
 	struct file_lock *cfl;
 
 	lock_kernel();
-	for (cfl = filp->f_dentry->d_inode->i_flock; cfl; cfl = cfl->fl_next) {
-		if (!IS_POSIX(cfl))
-			continue;
+	for (cfl = posix_tree_first(inode, fl->fl_start, fl->fl_end); cfl;
+	     cfl = posix_tree_next(cfl, fl->fl_start, fl->fl_end)) {
 		if (posix_locks_conflict(cfl, fl))
 			break;
 	}
@@ -678,6 +874,9 @@ EXPORT_SYMBOL(posix_test_lock);
  * Note: the above assumption may not be true when handling lock requests
  * from a broken NFS client. But broken NFS clients have a lot more to
  * worry about than proper deadlock detection anyway... --okir
+ *
+ * Waiters are hashed by owner, so each step only searches the chain
+ * that blocked_task's waiter, if it has one, is on.
  */
 int posix_locks_deadlock(struct file_lock *caller_fl,
 				struct file_lock *block_fl)
@@ -687,7 +886,7 @@ int posix_locks_deadlock(struct file_lock *caller_fl,
 next_task:
 	if (posix_same_owner(caller_fl, block_fl))
 		return 1;
-	list_for_each(tmp, &blocked_list) {
+	list_for_each(tmp, blocked_chain(block_fl)) {
 		struct file_lock *fl = list_entry(tmp, struct file_lock, fl_link);
 		if (posix_same_owner(fl, block_fl)) {
 			fl = fl->fl_next;
@@ -765,11 +964,11 @@ EXPORT_SYMBOL(posix_lock_file);
 
 static int __posix_lock_file(struct inode *inode, struct file_lock *request)
 {
-	struct file_lock *fl;
+	struct file_lock *fl, *next;
 	struct file_lock *new_fl, *new_fl2;
 	struct file_lock *left = NULL;
 	struct file_lock *right = NULL;
-	struct file_lock **before;
+	loff_t start, end;
 	int error, added = 0;
 
 	/*
@@ -781,10 +980,10 @@ static int __posix_lock_file(struct inode *inode, struct file_lock *request)
 
 	lock_kernel();
 	if (request->fl_type != F_UNLCK) {
-		for_each_lock(inode, before) {
-			struct file_lock *fl = *before;
-			if (!IS_POSIX(fl))
-				continue;
+		for (fl = posix_tree_first(inode, request->fl_start,
+					   request->fl_end); fl;
+		     fl = posix_tree_next(fl, request->fl_start,
+					  request->fl_end)) {
 			if (!posix_locks_conflict(request, fl))
 				continue;
 			error = -EAGAIN;
@@ -811,27 +1010,27 @@ static int __posix_lock_file(struct inode *inode, struct file_lock *request)
 	/*
 	 * We've allocated the new locks in advance, so there are no
 	 * errors possible (and no blocking operations) from here on.
-	 * 
-	 * Find the first old lock with the same owner as the new lock.
+	 *
+	 * Visit the locks of this owner that overlap or adjoin the new
+	 * lock, in order of their start.  The next one is looked up before
+	 * the current one is changed; a lock changed here only ever moves
+	 * down the range, so it is not visited twice.
 	 */
-	
-	before = &inode->i_flock;
+	start = request->fl_start ? request->fl_start - 1 : 0;
+	end = request->fl_end < OFFSET_MAX ? request->fl_end + 1 : OFFSET_MAX;
 
-	/* First skip locks owned by other processes.  */
-	while ((fl = *before) && (!IS_POSIX(fl) ||
-				  !posix_same_owner(request, fl))) {
-		before = &fl->fl_next;
-	}
+	for (fl = posix_tree_first(inode, start, end); fl; fl = next) {
+		next = posix_tree_next(fl, start, end);
+		if (!posix_same_owner(request, fl))
+			continue;
 
-	/* Process locks with this owner.  */
-	while ((fl = *before) && posix_same_owner(request, fl)) {
 		/* Detect adjacent or overlapping regions (if same lock type)
 		 */
 		if (request->fl_type == fl->fl_type) {
 			if (fl->fl_end < request->fl_start - 1)
-				goto next_lock;
-			/* If the next lock in the list has entirely bigger
-			 * addresses than the new one, insert the lock here.
+				continue;
+			/* If the next lock of this owner has entirely bigger
+			 * addresses than the new one, we're done.
 			 */
 			if (fl->fl_start > request->fl_end + 1)
 				break;
@@ -850,9 +1049,11 @@ static int __posix_lock_file(struct inode *inode, struct file_lock *request)
 			else
 				request->fl_end = fl->fl_end;
 			if (added) {
-				locks_delete_lock(before);
+				locks_delete_lock(fl->fl_pprev);
+				posix_tree_update(inode, request);
 				continue;
 			}
+			posix_tree_update(inode, fl);
 			request = fl;
 			added = 1;
 		}
@@ -861,15 +1062,15 @@ static int __posix_lock_file(struct inode *inode, struct file_lock *request)
 			 * more complex.
 			 */
 			if (fl->fl_end < request->fl_start)
-				goto next_lock;
+				continue;
 			if (fl->fl_start > request->fl_end)
 				break;
 			if (request->fl_type == F_UNLCK)
 				added = 1;
 			if (fl->fl_start < request->fl_start)
 				left = fl;
-			/* If the next lock in the list has a higher end
-			 * address than the new one, insert the new one here.
+			/* If the next lock of this owner has a higher end
+			 * address than the new one, we're done.
 			 */
 			if (fl->fl_end > request->fl_end) {
 				right = fl;
@@ -880,7 +1081,7 @@ static int __posix_lock_file(struct inode *inode, struct file_lock *request)
 				 * one (This may happen several times).
 				 */
 				if (added) {
-					locks_delete_lock(before);
+					locks_delete_lock(fl->fl_pprev);
 					continue;
 				}
 				/* Replace the old lock with the new one.
@@ -893,14 +1094,11 @@ static int __posix_lock_file(struct inode *inode, struct file_lock *request)
 				fl->fl_end = request->fl_end;
 				fl->fl_type = request->fl_type;
 				fl->fl_u = request->fl_u;
+				posix_tree_update(inode, fl);
 				request = fl;
 				added = 1;
 			}
 		}
-		/* Go on to next lock.
-		 */
-	next_lock:
-		before = &fl->fl_next;
 	}
 
 	error = 0;
@@ -908,7 +1106,7 @@ static int __posix_lock_file(struct inode *inode, struct file_lock *request)
 		if (request->fl_type == F_UNLCK)
 			goto out;
 		locks_copy_lock(new_fl, request);
-		locks_insert_lock(before, new_fl);
+		locks_insert_lock(posix_insert_pos(inode), new_fl);
 		new_fl = NULL;
 	}
 	if (right) {
@@ -919,13 +1117,15 @@ static int __posix_lock_file(struct inode *inode, struct file_lock *request)
 			left = new_fl2;
 			new_fl2 = NULL;
 			locks_copy_lock(left, right);
-			locks_insert_lock(before, left);
+			locks_insert_lock(posix_insert_pos(inode), left);
 		}
 		right->fl_start = request->fl_end + 1;
+		posix_tree_update(inode, right);
 		locks_wake_up_blocks(right);
 	}
 	if (left) {
 		left->fl_end = request->fl_start - 1;
+		posix_tree_update(inode, left);
 		locks_wake_up_blocks(left);
 	}
  out:
@@ -947,7 +1147,8 @@ static int __posix_lock_file(struct inode *inode, struct file_lock *request)
  *
  * Add a POSIX style lock to a file.
  * We merge adjacent & overlapping locks whenever possible.
- * POSIX locks are sorted by owner task, then by starting address
+ * POSIX locks follow the inode's leases and flock locks on i_flock, and
+ * are indexed by range in i_posix_locks.
  */
 int posix_lock_file(struct file *filp, struct file_lock *fl)
 {
@@ -961,7 +1162,8 @@ int posix_lock_file(struct file *filp, struct file_lock *fl)
  *
  * Add a POSIX style lock to a file.
  * We merge adjacent & overlapping locks whenever possible.
- * POSIX locks are sorted by owner task, then by starting address
+ * POSIX locks follow the inode's leases and flock locks on i_flock, and
+ * are indexed by range in i_posix_locks.
  */
 int posix_lock_file_wait(struct file *filp, struct file_lock *fl)
 {
@@ -2203,6 +2405,11 @@ EXPORT_SYMBOL(steal_locks);
 
 static int __init filelock_init(void)
 {
+	int i;
+
+	for (i = 0; i < BLOCKED_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&blocked_hash[i]);
+
 	filelock_cache = kmem_cache_create("file_lock_cache",
 			sizeof(struct file_lock), 0, SLAB_PANIC,
 			init_once, NULL);
@@ -24,6 +24,14 @@
  * Invalid cache entries will be freed when the last handle to the cache
  * entry is released. Entries that cannot be freed immediately are put
  * back on the lru list.
+ *
+ * Each hash bucket has its own lock, and each cache its own lru list and
+ * lock.  The handles of an entry (e_used, e_queued) and whether it is
+ * valid are protected by the lock of the bucket of its device and block
+ * in c_block_hash, taken inside the lock of an index bucket when the entry
+ * is found through an index.  The lru lock ranks below the bucket locks;
+ * to free entries from the lru list, the entries are taken out with a
+ * trylock on their buckets.
  */
 
 #include <linux/kernel.h>
@@ -76,6 +84,11 @@ EXPORT_SYMBOL(mb_cache_entry_find_first);
 EXPORT_SYMBOL(mb_cache_entry_find_next);
 #endif
 
+struct mb_cache_bucket {
+	spinlock_t			b_lock;
+	struct list_head		b_list;
+};
+
 struct mb_cache {
 	struct list_head		c_cache_list;
 	const char			*c_name;
@@ -86,19 +99,18 @@ struct mb_cache {
 	int				c_indexes_count;
 #endif
 	kmem_cache_t			*c_entry_cache;
-	struct list_head		*c_block_hash;
-	struct list_head		*c_indexes_hash[0];
+	spinlock_t			c_lru_lock;
+	struct list_head		c_lru_list;
+	struct mb_cache_bucket		*c_block_hash;
+	struct mb_cache_bucket		*c_indexes_hash[0];
 };
 
 
 /*
- * Global data: list of all mbcache's, lru list, and a spinlock for
- * accessing cache data structures on SMP machines. The lru list is
- * global across all mbcaches.
+ * Global data: list of all mbcache's, and a spinlock for the list.
  */
 
 static LIST_HEAD(mb_cache_list);
-static LIST_HEAD(mb_cache_lru_list);
 static DEFINE_SPINLOCK(mb_cache_spinlock);
 static struct shrinker *mb_shrinker;
 
@@ -119,6 +131,31 @@ mb_cache_indexes(struct mb_cache *cache)
 static int mb_cache_shrink_fn(int nr_to_scan, unsigned int gfp_mask);
 
 
+static inline struct mb_cache_bucket *
+mb_cache_block_bucket(struct mb_cache *cache, struct block_device *bdev,
+		      sector_t block)
+{
+	return &cache->c_block_hash[hash_long((unsigned long)bdev +
+		(block & 0xffffffff), cache->c_bucket_bits)];
+}
+
+
+static inline struct mb_cache_bucket *
+mb_cache_index_bucket(struct mb_cache *cache, int index, unsigned int key)
+{
+	return &cache->c_indexes_hash[index][hash_long(key,
+						      cache->c_bucket_bits)];
+}
+
+
+/* The bucket whose lock protects the handles of the entry */
+static inline struct mb_cache_bucket *
+mb_cache_entry_bucket(struct mb_cache_entry *ce)
+{
+	return mb_cache_block_bucket(ce->e_cache, ce->e_bdev, ce->e_block);
+}
+
+
 static inline int
 __mb_cache_entry_is_hashed(struct mb_cache_entry *ce)
 {
@@ -126,16 +163,28 @@ __mb_cache_entry_is_hashed(struct mb_cache_entry *ce)
 }
 
 
-static inline void
+/*
+ * Only the holder of an entry unhashes it, exclusively: either a writer
+ * or whoever has taken it off the lru list.
+ */
+static void
 __mb_cache_entry_unhash(struct mb_cache_entry *ce)
 {
+	struct mb_cache *cache = ce->e_cache;
+	struct mb_cache_bucket *bucket;
 	int n;
 
-	if (__mb_cache_entry_is_hashed(ce)) {
-		list_del_init(&ce->e_block_list);
-		for (n=0; n<mb_cache_indexes(ce->e_cache); n++)
-			list_del(&ce->e_indexes[n].o_list);
+	for (n=0; n<mb_cache_indexes(cache); n++) {
+		bucket = mb_cache_index_bucket(cache, n,
+					       ce->e_indexes[n].o_key);
+		spin_lock(&bucket->b_lock);
+		list_del_init(&ce->e_indexes[n].o_list);
+		spin_unlock(&bucket->b_lock);
 	}
+	bucket = mb_cache_entry_bucket(ce);
+	spin_lock(&bucket->b_lock);
+	list_del_init(&ce->e_block_list);
+	spin_unlock(&bucket->b_lock);
 }
 
 
@@ -148,9 +197,9 @@ __mb_cache_entry_forget(struct mb_cache_entry *ce, int gfp_mask)
 	if (cache->c_op.free && cache->c_op.free(ce, gfp_mask)) {
 		/* free failed -- put back on the lru list
 		   for freeing later. */
-		spin_lock(&mb_cache_spinlock);
-		list_add(&ce->e_lru_list, &mb_cache_lru_list);
-		spin_unlock(&mb_cache_spinlock);
+		spin_lock(&cache->c_lru_lock);
+		list_add(&ce->e_lru_list, &cache->c_lru_list);
+		spin_unlock(&cache->c_lru_lock);
 	} else {
 		kmem_cache_free(cache->c_entry_cache, ce);
 		atomic_dec(&cache->c_entry_count);
@@ -158,9 +207,13 @@ __mb_cache_entry_forget(struct mb_cache_entry *ce, int gfp_mask)
 }
 
 
-static inline void
+/* Called with the lock of the entry's bucket held, which it drops */
+static void
 __mb_cache_entry_release_unlock(struct mb_cache_entry *ce)
 {
+	struct mb_cache *cache = ce->e_cache;
+	struct mb_cache_bucket *bucket = mb_cache_entry_bucket(ce);
+
 	/* Wake up all processes queuing for this cache entry. */
 	if (ce->e_queued)
 		wake_up_all(&mb_cache_queue);
@@ -171,21 +224,85 @@ __mb_cache_entry_release_unlock(struct mb_cache_entry *ce)
 		if (!__mb_cache_entry_is_hashed(ce))
 			goto forget;
 		mb_assert(list_empty(&ce->e_lru_list));
-		list_add_tail(&ce->e_lru_list, &mb_cache_lru_list);
+		spin_lock(&cache->c_lru_lock);
+		list_add_tail(&ce->e_lru_list, &cache->c_lru_list);
+		spin_unlock(&cache->c_lru_lock);
 	}
-	spin_unlock(&mb_cache_spinlock);
+	spin_unlock(&bucket->b_lock);
 	return;
 forget:
-	spin_unlock(&mb_cache_spinlock);
+	spin_unlock(&bucket->b_lock);
 	__mb_cache_entry_forget(ce, GFP_KERNEL);
 }
 
 
+/* Called with the lock of the entry's bucket held: a handle is taken */
+static inline void
+__mb_cache_entry_unlru(struct mb_cache_entry *ce)
+{
+	struct mb_cache *cache = ce->e_cache;
+
+	if (!list_empty(&ce->e_lru_list)) {
+		spin_lock(&cache->c_lru_lock);
+		list_del_init(&ce->e_lru_list);
+		spin_unlock(&cache->c_lru_lock);
+	}
+}
+
+
+/*
+ * Takes an entry off the lru list onto free_list, as its writer, so that
+ * it can be unhashed and freed by __mb_cache_free_list().  Called with
+ * the lru lock held; fails if the lock of the entry's bucket is busy.
+ */
+static int
+__mb_cache_entry_takeout(struct mb_cache_entry *ce,
+			 struct list_head *free_list)
+{
+	struct mb_cache_bucket *bucket = mb_cache_entry_bucket(ce);
+
+	if (!spin_trylock(&bucket->b_lock))
+		return 0;
+	/* Entries on the lru list have no handles */
+	mb_assert(!(ce->e_used || ce->e_queued));
+	ce->e_used = 1 + MB_CACHE_WRITER;
+	list_move_tail(&ce->e_lru_list, free_list);
+	spin_unlock(&bucket->b_lock);
+	return 1;
+}
+
+
+static void
+__mb_cache_free_list(struct list_head *free_list, int gfp_mask)
+{
+	struct list_head *l, *ltmp;
+
+	list_for_each_safe(l, ltmp, free_list) {
+		struct mb_cache_entry *ce =
+			list_entry(l, struct mb_cache_entry, e_lru_list);
+		struct mb_cache_bucket *bucket = mb_cache_entry_bucket(ce);
+
+		list_del_init(&ce->e_lru_list);
+		__mb_cache_entry_unhash(ce);
+		spin_lock(&bucket->b_lock);
+		if (ce->e_used != 1 + MB_CACHE_WRITER || ce->e_queued) {
+			/* Somebody found it meanwhile, the last one frees it */
+			__mb_cache_entry_release_unlock(ce);
+			continue;
+		}
+		ce->e_used = 0;
+		spin_unlock(&bucket->b_lock);
+		__mb_cache_entry_forget(ce, gfp_mask);
+	}
+}
+
+
 /*
  * mb_cache_shrink_fn()  memory pressure callback
  *
  * This function is called by the kernel memory management when memory
- * gets low.
+ * gets low.  Each cache's lru list is scanned for about its share of
+ * nr_to_scan, by the number of entries in it.
  *
  * @nr_to_scan: Number of objects to scan
  * @gfp_mask: (ignored)
@@ -196,7 +313,7 @@ static int
 mb_cache_shrink_fn(int nr_to_scan, unsigned int gfp_mask)
 {
 	LIST_HEAD(free_list);
-	struct list_head *l, *ltmp;
+	struct list_head *l;
 	int count = 0;
 
 	spin_lock(&mb_cache_spinlock);
@@ -208,22 +325,29 @@ mb_cache_shrink_fn(int nr_to_scan, unsigned int gfp_mask)
 		count += atomic_read(&cache->c_entry_count);
 	}
 	mb_debug("trying to free %d entries", nr_to_scan);
-	if (nr_to_scan == 0) {
+	if (nr_to_scan == 0 || count == 0) {
 		spin_unlock(&mb_cache_spinlock);
 		goto out;
 	}
-	while (nr_to_scan-- && !list_empty(&mb_cache_lru_list)) {
-		struct mb_cache_entry *ce =
-			list_entry(mb_cache_lru_list.next,
-				   struct mb_cache_entry, e_lru_list);
-		list_move_tail(&ce->e_lru_list, &free_list);
-		__mb_cache_entry_unhash(ce);
+	list_for_each(l, &mb_cache_list) {
+		struct mb_cache *cache =
+			list_entry(l, struct mb_cache, c_cache_list);
+		int nr = atomic_read(&cache->c_entry_count) /
+			 (count / nr_to_scan + 1) + 1;
+
+		spin_lock(&cache->c_lru_lock);
+		while (nr-- && !list_empty(&cache->c_lru_list)) {
+			struct mb_cache_entry *ce =
+				list_entry(cache->c_lru_list.next,
+					   struct mb_cache_entry, e_lru_list);
+			if (!__mb_cache_entry_takeout(ce, &free_list))
+				list_move_tail(&ce->e_lru_list,
+					       &cache->c_lru_list);
+		}
+		spin_unlock(&cache->c_lru_lock);
 	}
 	spin_unlock(&mb_cache_spinlock);
-	list_for_each_safe(l, ltmp, &free_list) {
-		__mb_cache_entry_forget(list_entry(l, struct mb_cache_entry,
-						   e_lru_list), gfp_mask);
-	}
+	__mb_cache_free_list(&free_list, gfp_mask);
 out:
 	return count;
 }
@@ -258,7 +382,8 @@ mb_cache_create(const char *name, struct mb_cache_op *cache_op,
 		return NULL;
 
 	cache = kmalloc(sizeof(struct mb_cache) +
-	                indexes_count * sizeof(struct list_head), GFP_KERNEL);
+	                indexes_count * sizeof(struct mb_cache_bucket *),
+			GFP_KERNEL);
 	if (!cache)
 		goto fail;
 	cache->c_name = name;
@@ -272,20 +397,27 @@ mb_cache_create(const char *name, struct mb_cache_op *cache_op,
 #else
 	cache->c_indexes_count = indexes_count;
 #endif
-	cache->c_block_hash = kmalloc(bucket_count * sizeof(struct list_head),
+	spin_lock_init(&cache->c_lru_lock);
+	INIT_LIST_HEAD(&cache->c_lru_list);
+	cache->c_block_hash = kmalloc(bucket_count *
+				      sizeof(struct mb_cache_bucket),
 	                              GFP_KERNEL);
 	if (!cache->c_block_hash)
 		goto fail;
-	for (n=0; n<bucket_count; n++)
-		INIT_LIST_HEAD(&cache->c_block_hash[n]);
+	for (n=0; n<bucket_count; n++) {
+		spin_lock_init(&cache->c_block_hash[n].b_lock);
+		INIT_LIST_HEAD(&cache->c_block_hash[n].b_list);
+	}
 	for (m=0; m<indexes_count; m++) {
 		cache->c_indexes_hash[m] = kmalloc(bucket_count *
-		                                 sizeof(struct list_head),
+		                                 sizeof(struct mb_cache_bucket),
 		                                 GFP_KERNEL);
 		if (!cache->c_indexes_hash[m])
 			goto fail;
-		for (n=0; n<bucket_count; n++)
-			INIT_LIST_HEAD(&cache->c_indexes_hash[m][n]);
+		for (n=0; n<bucket_count; n++) {
+			spin_lock_init(&cache->c_indexes_hash[m][n].b_lock);
+			INIT_LIST_HEAD(&cache->c_indexes_hash[m][n].b_list);
+		}
 	}
 	cache->c_entry_cache = kmem_cache_create(name, entry_size, 0,
 		SLAB_RECLAIM_ACCOUNT, NULL, NULL);
@@ -309,6 +441,34 @@ fail:
 }
 
 
+/*
+ * Takes all the entries of a device, or all entries if bdev is NULL, off
+ * the lru list of a cache.
+ */
+static void
+__mb_cache_takeout_all(struct mb_cache *cache, struct block_device *bdev,
+		       struct list_head *free_list)
+{
+	struct list_head *l, *ltmp;
+
+restart:
+	spin_lock(&cache->c_lru_lock);
+	list_for_each_safe(l, ltmp, &cache->c_lru_list) {
+		struct mb_cache_entry *ce =
+			list_entry(l, struct mb_cache_entry, e_lru_list);
+		if (bdev && ce->e_bdev != bdev)
+			continue;
+		if (!__mb_cache_entry_takeout(ce, free_list)) {
+			/* Its bucket is busy, let it go and come back */
+			spin_unlock(&cache->c_lru_lock);
+			cpu_relax();
+			goto restart;
+		}
+	}
+	spin_unlock(&cache->c_lru_lock);
+}
+
+
 /*
  * mb_cache_shrink()
  *
@@ -323,22 +483,9 @@ void
 mb_cache_shrink(struct mb_cache *cache, struct block_device *bdev)
 {
 	LIST_HEAD(free_list);
-	struct list_head *l, *ltmp;
 
-	spin_lock(&mb_cache_spinlock);
-	list_for_each_safe(l, ltmp, &mb_cache_lru_list) {
-		struct mb_cache_entry *ce =
-			list_entry(l, struct mb_cache_entry, e_lru_list);
-		if (ce->e_bdev == bdev) {
-			list_move_tail(&ce->e_lru_list, &free_list);
-			__mb_cache_entry_unhash(ce);
-		}
-	}
-	spin_unlock(&mb_cache_spinlock);
-	list_for_each_safe(l, ltmp, &free_list) {
-		__mb_cache_entry_forget(list_entry(l, struct mb_cache_entry,
-						   e_lru_list), GFP_KERNEL);
-	}
+	__mb_cache_takeout_all(cache, bdev, &free_list);
+	__mb_cache_free_list(&free_list, GFP_KERNEL);
 }
 
 
@@ -353,25 +500,14 @@ void
 mb_cache_destroy(struct mb_cache *cache)
 {
 	LIST_HEAD(free_list);
-	struct list_head *l, *ltmp;
 	int n;
 
 	spin_lock(&mb_cache_spinlock);
-	list_for_each_safe(l, ltmp, &mb_cache_lru_list) {
-		struct mb_cache_entry *ce =
-			list_entry(l, struct mb_cache_entry, e_lru_list);
-		if (ce->e_cache == cache) {
-			list_move_tail(&ce->e_lru_list, &free_list);
-			__mb_cache_entry_unhash(ce);
-		}
-	}
 	list_del(&cache->c_cache_list);
 	spin_unlock(&mb_cache_spinlock);
 
-	list_for_each_safe(l, ltmp, &free_list) {
-		__mb_cache_entry_forget(list_entry(l, struct mb_cache_entry,
-						   e_lru_list), GFP_KERNEL);
-	}
+	__mb_cache_takeout_all(cache, NULL, &free_list);
+	__mb_cache_free_list(&free_list, GFP_KERNEL);
 
 	if (atomic_read(&cache->c_entry_count) > 0) {
 		mb_error("cache %s: %d orphaned entries",
@@ -400,13 +536,18 @@ struct mb_cache_entry *
 mb_cache_entry_alloc(struct mb_cache *cache)
 {
 	struct mb_cache_entry *ce;
+	int n;
 
 	atomic_inc(&cache->c_entry_count);
 	ce = kmem_cache_alloc(cache->c_entry_cache, GFP_KERNEL);
 	if (ce) {
 		INIT_LIST_HEAD(&ce->e_lru_list);
 		INIT_LIST_HEAD(&ce->e_block_list);
+		for (n=0; n<mb_cache_indexes(cache); n++)
+			INIT_LIST_HEAD(&ce->e_indexes[n].o_list);
 		ce->e_cache = cache;
+		ce->e_bdev = NULL;
+		ce->e_block = 0;
 		ce->e_used = 1 + MB_CACHE_WRITER;
 		ce->e_queued = 0;
 	}
@@ -434,33 +575,35 @@ mb_cache_entry_insert(struct mb_cache_entry *ce, struct block_device *bdev,
 		      sector_t block, unsigned int keys[])
 {
 	struct mb_cache *cache = ce->e_cache;
-	unsigned int bucket;
+	struct mb_cache_bucket *bucket;
 	struct list_head *l;
-	int error = -EBUSY, n;
+	int n;
 
-	bucket = hash_long((unsigned long)bdev + (block & 0xffffffff), 
-			   cache->c_bucket_bits);
-	spin_lock(&mb_cache_spinlock);
-	list_for_each_prev(l, &cache->c_block_hash[bucket]) {
+	/* Nobody else can know the entry, it moves to its bucket here */
+	mb_assert(!__mb_cache_entry_is_hashed(ce));
+	bucket = mb_cache_block_bucket(cache, bdev, block);
+	spin_lock(&bucket->b_lock);
+	list_for_each_prev(l, &bucket->b_list) {
 		struct mb_cache_entry *ce =
 			list_entry(l, struct mb_cache_entry, e_block_list);
-		if (ce->e_bdev == bdev && ce->e_block == block)
-			goto out;
+		if (ce->e_bdev == bdev && ce->e_block == block) {
+			spin_unlock(&bucket->b_lock);
+			return -EBUSY;
+		}
 	}
-	__mb_cache_entry_unhash(ce);
 	ce->e_bdev = bdev;
 	ce->e_block = block;
-	list_add(&ce->e_block_list, &cache->c_block_hash[bucket]);
-	for (n=0; n<mb_cache_indexes(cache); n++) {
+	list_add(&ce->e_block_list, &bucket->b_list);
+	for (n=0; n<mb_cache_indexes(cache); n++)
 		ce->e_indexes[n].o_key = keys[n];
-		bucket = hash_long(keys[n], cache->c_bucket_bits);
-		list_add(&ce->e_indexes[n].o_list,
-			 &cache->c_indexes_hash[n][bucket]);
+	spin_unlock(&bucket->b_lock);
+	for (n=0; n<mb_cache_indexes(cache); n++) {
+		bucket = mb_cache_index_bucket(cache, n, keys[n]);
+		spin_lock(&bucket->b_lock);
+		list_add(&ce->e_indexes[n].o_list, &bucket->b_list);
+		spin_unlock(&bucket->b_lock);
 	}
-	error = 0;
-out:
-	spin_unlock(&mb_cache_spinlock);
-	return error;
+	return 0;
 }
 
 
@@ -474,7 +617,7 @@ out:
 void
 mb_cache_entry_release(struct mb_cache_entry *ce)
 {
-	spin_lock(&mb_cache_spinlock);
+	spin_lock(&mb_cache_entry_bucket(ce)->b_lock);
 	__mb_cache_entry_release_unlock(ce);
 }
 
@@ -488,10 +631,9 @@ mb_cache_entry_release(struct mb_cache_entry *ce)
 void
 mb_cache_entry_free(struct mb_cache_entry *ce)
 {
-	spin_lock(&mb_cache_spinlock);
 	mb_assert(list_empty(&ce->e_lru_list));
 	__mb_cache_entry_unhash(ce);
-	__mb_cache_entry_release_unlock(ce);
+	mb_cache_entry_release(ce);
 }
 
 
@@ -507,28 +649,26 @@ struct mb_cache_entry *
 mb_cache_entry_get(struct mb_cache *cache, struct block_device *bdev,
 		   sector_t block)
 {
-	unsigned int bucket;
+	struct mb_cache_bucket *bucket;
 	struct list_head *l;
 	struct mb_cache_entry *ce;
 
-	bucket = hash_long((unsigned long)bdev + (block & 0xffffffff),
-			   cache->c_bucket_bits);
-	spin_lock(&mb_cache_spinlock);
-	list_for_each(l, &cache->c_block_hash[bucket]) {
+	bucket = mb_cache_block_bucket(cache, bdev, block);
+	spin_lock(&bucket->b_lock);
+	list_for_each(l, &bucket->b_list) {
 		ce = list_entry(l, struct mb_cache_entry, e_block_list);
 		if (ce->e_bdev == bdev && ce->e_block == block) {
 			DEFINE_WAIT(wait);
 
-			if (!list_empty(&ce->e_lru_list))
-				list_del_init(&ce->e_lru_list);
+			__mb_cache_entry_unlru(ce);
 
 			while (ce->e_used > 0) {
 				ce->e_queued++;
 				prepare_to_wait(&mb_cache_queue, &wait,
 						TASK_UNINTERRUPTIBLE);
-				spin_unlock(&mb_cache_spinlock);
+				spin_unlock(&bucket->b_lock);
 				schedule();
-				spin_lock(&mb_cache_spinlock);
+				spin_lock(&bucket->b_lock);
 				ce->e_queued--;
 			}
 			finish_wait(&mb_cache_queue, &wait);
@@ -544,25 +684,31 @@ mb_cache_entry_get(struct mb_cache *cache, struct block_device *bdev,
 	ce = NULL;
 
 cleanup:
-	spin_unlock(&mb_cache_spinlock);
+	spin_unlock(&bucket->b_lock);
 	return ce;
 }
 
 #if !defined(MB_CACHE_INDEXES_COUNT) || (MB_CACHE_INDEXES_COUNT > 0)
 
+/* Called with the index bucket locked, returns with no lock held */
 static struct mb_cache_entry *
-__mb_cache_entry_find(struct list_head *l, struct list_head *head,
+__mb_cache_entry_find(struct list_head *l, struct mb_cache_bucket *index_bucket,
 		      int index, struct block_device *bdev, unsigned int key)
 {
+	struct list_head *head = &index_bucket->b_list;
+
 	while (l != head) {
 		struct mb_cache_entry *ce =
 			list_entry(l, struct mb_cache_entry,
 			           e_indexes[index].o_list);
 		if (ce->e_bdev == bdev && ce->e_indexes[index].o_key == key) {
+			struct mb_cache_bucket *bucket =
+				mb_cache_entry_bucket(ce);
 			DEFINE_WAIT(wait);
 
-			if (!list_empty(&ce->e_lru_list))
-				list_del_init(&ce->e_lru_list);
+			spin_lock(&bucket->b_lock);
+			spin_unlock(&index_bucket->b_lock);
+			__mb_cache_entry_unlru(ce);
 
 			/* Incrementing before holding the lock gives readers
 			   priority over writers. */
@@ -571,22 +717,23 @@ __mb_cache_entry_find(struct list_head *l, struct list_head *head,
 				ce->e_queued++;
 				prepare_to_wait(&mb_cache_queue, &wait,
 						TASK_UNINTERRUPTIBLE);
-				spin_unlock(&mb_cache_spinlock);
+				spin_unlock(&bucket->b_lock);
 				schedule();
-				spin_lock(&mb_cache_spinlock);
+				spin_lock(&bucket->b_lock);
 				ce->e_queued--;
 			}
 			finish_wait(&mb_cache_queue, &wait);
 
 			if (!__mb_cache_entry_is_hashed(ce)) {
 				__mb_cache_entry_release_unlock(ce);
-				spin_lock(&mb_cache_spinlock);
 				return ERR_PTR(-EAGAIN);
 			}
+			spin_unlock(&bucket->b_lock);
 			return ce;
 		}
 		l = l->next;
 	}
+	spin_unlock(&index_bucket->b_lock);
 	return NULL;
 }
 
@@ -608,17 +755,13 @@ struct mb_cache_entry *
 mb_cache_entry_find_first(struct mb_cache *cache, int index,
 			  struct block_device *bdev, unsigned int key)
 {
-	unsigned int bucket = hash_long(key, cache->c_bucket_bits);
-	struct list_head *l;
-	struct mb_cache_entry *ce;
+	struct mb_cache_bucket *bucket;
 
 	mb_assert(index < mb_cache_indexes(cache));
-	spin_lock(&mb_cache_spinlock);
-	l = cache->c_indexes_hash[index][bucket].next;
-	ce = __mb_cache_entry_find(l, &cache->c_indexes_hash[index][bucket],
-	                           index, bdev, key);
-	spin_unlock(&mb_cache_spinlock);
-	return ce;
+	bucket = mb_cache_index_bucket(cache, index, key);
+	spin_lock(&bucket->b_lock);
+	return __mb_cache_entry_find(bucket->b_list.next, bucket, index,
+				     bdev, key);
 }
 
 
@@ -646,16 +789,16 @@ mb_cache_entry_find_next(struct mb_cache_entry *prev, int index,
 			 struct block_device *bdev, unsigned int key)
 {
 	struct mb_cache *cache = prev->e_cache;
-	unsigned int bucket = hash_long(key, cache->c_bucket_bits);
-	struct list_head *l;
+	struct mb_cache_bucket *bucket;
 	struct mb_cache_entry *ce;
 
 	mb_assert(index < mb_cache_indexes(cache));
-	spin_lock(&mb_cache_spinlock);
-	l = prev->e_indexes[index].o_list.next;
-	ce = __mb_cache_entry_find(l, &cache->c_indexes_hash[index][bucket],
-	                           index, bdev, key);
-	__mb_cache_entry_release_unlock(prev);
+	bucket = mb_cache_index_bucket(cache, index, key);
+	/* Our handle keeps prev in the index */
+	spin_lock(&bucket->b_lock);
+	ce = __mb_cache_entry_find(prev->e_indexes[index].o_list.next,
+				   bucket, index, bdev, key);
+	mb_cache_entry_release(prev);
 	return ce;
 }
 
@@ -674,4 +817,3 @@ static void __exit exit_mbcache(void)
 
 module_init(init_mbcache)
 module_exit(exit_mbcache)
-
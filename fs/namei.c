@@ -21,7 +21,7 @@
 #include <linux/namei.h>
 #include <linux/quotaops.h>
 #include <linux/pagemap.h>
-#include <linux/dnotify.h>
+#include <linux/fsnotify.h>
 #include <linux/smp_lock.h>
 #include <linux/personality.h>
 #include <linux/security.h>
@@ -994,6 +994,248 @@ set_it:
 	}
 }
 
+/*
+ * RCU path walk.
+ *
+ * Most lookups find every component in the dcache, and for those taking
+ * d_lock and a reference on each dentry on the way, then dropping it
+ * again under dcache_lock, is what costs: the dentries near the root are
+ * shared by everybody.  So path_lookup() first walks under rcu_read_lock(),
+ * without touching the dentries at all.  Dentries are freed by RCU and
+ * inodes a grace period after destroy_inode(), so whatever we look at stays
+ * readable; d_seq tells us whether it stayed what we looked at.  A dentry's
+ * d_seq is sampled before anything is read from it and checked before
+ * anything found through it is trusted, nd->seq being that of nd->dentry.
+ *
+ * Only the final dentry is pinned, by nameidata_drop_rcu().  Whatever the
+ * lockless walk cannot do itself - mount points, ".." out of a mount,
+ * ->d_hash(), ->d_compare(), ->d_revalidate(), ->permission(), symlinks and
+ * dcache misses - makes it pin the current dentry and carry on with
+ * link_path_walk() from that component.  If a dentry changed under us we
+ * have no valid place to carry on from, and start again with the ordinary
+ * walk.
+ *
+ * current->fs->lock is held for reading throughout, which pins the starting
+ * vfsmount and the root we compare against for "..".  The walk never leaves
+ * the starting vfsmount.
+ */
+
+/*
+ * Take references to nd->dentry and nd->mnt, if nd->dentry has not changed
+ * since nd->seq, and leave RCU walk.  Returns -ECHILD if it had changed.
+ */
+static int nameidata_drop_rcu(struct nameidata *nd)
+{
+	struct dentry *dentry = nd->dentry;
+	int err = 0;
+
+	spin_lock(&dentry->d_lock);
+	if (read_seqcount_retry(&dentry->d_seq, nd->seq))
+		err = -ECHILD;
+	else
+		atomic_inc(&dentry->d_count);
+	spin_unlock(&dentry->d_lock);
+	if (!err)
+		mntget(nd->mnt);
+	rcu_read_unlock();
+	read_unlock(&current->fs->lock);
+	return err;
+}
+
+/*
+ * ".." in RCU walk.  Returns -EAGAIN if the ordinary walk has to do it,
+ * -ECHILD if nd->dentry has changed.
+ */
+static int follow_dotdot_rcu(struct nameidata *nd)
+{
+	struct dentry *dentry = nd->dentry;
+	struct dentry *parent;
+	unsigned seq;
+
+	if (dentry == current->fs->root && nd->mnt == current->fs->rootmnt)
+		return 0;
+	if (dentry == nd->mnt->mnt_root)
+		return -EAGAIN;
+	parent = dentry->d_parent;
+	seq = read_seqcount_begin(&parent->d_seq);
+	if (read_seqcount_retry(&dentry->d_seq, nd->seq))
+		return -ECHILD;
+	if (d_mountpoint(parent))
+		return -EAGAIN;
+	nd->dentry = parent;
+	nd->seq = seq;
+	return 0;
+}
+
+/*
+ * __link_path_walk() under rcu_read_lock(), starting at nd->dentry, nd->seq.
+ * Leaves RCU walk in all cases.  On success nd holds references, as after
+ * link_path_walk(); on failure it holds nothing, and -ECHILD means the
+ * whole lookup has to be done again the ordinary way.
+ */
+static int rcu_path_walk(const char *name, struct nameidata *nd)
+{
+	unsigned int lookup_flags = nd->flags;
+	const char *start;
+	struct qstr this;
+	struct inode *inode;
+	int err;
+
+	while (*name == '/')
+		name++;
+	if (!*name)
+		goto done;
+
+	inode = nd->dentry->d_inode;
+	for (;;) {
+		struct dentry *parent = nd->dentry;
+		struct dentry *dentry;
+		unsigned long hash;
+		unsigned int c;
+		unsigned seq;
+		int last = 0;
+
+		start = name;
+		err = exec_permission_lite(inode, nd);
+		if (err == -EAGAIN)
+			goto hand_over;
+		if (err)
+			goto fail;
+
+		this.name = name;
+		c = *(const unsigned char *)name;
+
+		hash = init_name_hash();
+		do {
+			name++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)name;
+		} while (c && (c != '/'));
+		this.len = name - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		if (!c)
+			last = 1;
+		else {
+			while (*++name == '/');
+			if (!*name) {
+				lookup_flags |= LOOKUP_FOLLOW | LOOKUP_DIRECTORY;
+				last = 1;
+			}
+		}
+		if (last && (lookup_flags & LOOKUP_PARENT))
+			goto lookup_parent;
+
+		if (this.name[0] == '.' && (this.len == 1 ||
+		    (this.len == 2 && this.name[1] == '.'))) {
+			if (this.len == 2) {
+				err = follow_dotdot_rcu(nd);
+				if (err == -EAGAIN)
+					goto hand_over;
+				if (err)
+					goto out;
+				inode = nd->dentry->d_inode;
+			}
+			if (last)
+				goto done;
+			continue;
+		}
+
+		if (parent->d_op &&
+		    (parent->d_op->d_hash || parent->d_op->d_compare))
+			goto hand_over;
+		dentry = __d_lookup_rcu(parent, &this, &seq);
+		if (!dentry)
+			goto hand_over;
+		/* Was it still a child of parent, when we found it? */
+		if (read_seqcount_retry(&parent->d_seq, nd->seq)) {
+			err = -ECHILD;
+			goto out;
+		}
+		if (dentry->d_op && dentry->d_op->d_revalidate)
+			goto hand_over;
+		if (d_mountpoint(dentry))
+			goto hand_over;
+
+		inode = dentry->d_inode;
+		if (inode && inode->i_op && inode->i_op->follow_link &&
+		    (!last || (lookup_flags & LOOKUP_FOLLOW)))
+			goto hand_over;
+		nd->dentry = dentry;
+		nd->seq = seq;
+
+		err = -ENOENT;
+		if (!inode)
+			goto fail;
+		if (last) {
+			if ((lookup_flags & LOOKUP_DIRECTORY) &&
+			    (!inode->i_op || !inode->i_op->lookup)) {
+				err = -ENOTDIR;
+				goto fail;
+			}
+			goto done;
+		}
+		err = -ENOTDIR;
+		if (!inode->i_op || !inode->i_op->lookup)
+			goto fail;
+	}
+
+lookup_parent:
+	nd->last = this;
+	nd->last_type = LAST_NORM;
+	if (this.name[0] == '.') {
+		if (this.len == 1)
+			nd->last_type = LAST_DOT;
+		else if (this.len == 2 && this.name[1] == '.')
+			nd->last_type = LAST_DOTDOT;
+	}
+done:
+	return nameidata_drop_rcu(nd);
+
+hand_over:
+	err = nameidata_drop_rcu(nd);
+	if (err)
+		return err;
+	return link_path_walk(start, nd);
+
+fail:
+	/* The error only stands if what it was based on is still there */
+	if (read_seqcount_retry(&nd->dentry->d_seq, nd->seq))
+		err = -ECHILD;
+out:
+	rcu_read_unlock();
+	read_unlock(&current->fs->lock);
+	nd->mnt = NULL;
+	nd->dentry = NULL;
+	return err;
+}
+
+static int path_lookup_rcu(const char *name, struct nameidata *nd)
+{
+	struct fs_struct *fs = current->fs;
+
+	read_lock(&fs->lock);
+	if (*name=='/') {
+		if (fs->altroot && !(nd->flags & LOOKUP_NOALT)) {
+			read_unlock(&fs->lock);
+			return -ECHILD;
+		}
+		nd->mnt = fs->rootmnt;
+		nd->dentry = fs->root;
+	} else {
+		nd->mnt = fs->pwdmnt;
+		nd->dentry = fs->pwd;
+	}
+	/* The walk stays on this superblock, so this is checked only once */
+	if (nd->dentry->d_sb->s_type->fs_flags & FS_REVAL_DOT) {
+		read_unlock(&fs->lock);
+		return -ECHILD;
+	}
+	rcu_read_lock();
+	nd->seq = read_seqcount_begin(&nd->dentry->d_seq);
+	return rcu_path_walk(name, nd);
+}
+
 int fastcall path_lookup(const char *name, unsigned int flags, struct nameidata *nd)
 {
 	int retval;
@@ -1001,7 +1243,15 @@ int fastcall path_lookup(const char *name, unsigned int flags, struct nameidata
 	nd->last_type = LAST_ROOT; /* if there are only slashes... */
 	nd->flags = flags;
 	nd->depth = 0;
+	current->total_link_count = 0;
+
+	retval = path_lookup_rcu(name, nd);
+	if (retval != -ECHILD)
+		goto out;
 
+	nd->last_type = LAST_ROOT;
+	nd->flags = flags;
+	nd->depth = 0;
 	read_lock(&current->fs->lock);
 	if (*name=='/') {
 		if (current->fs->altroot && !(nd->flags & LOOKUP_NOALT)) {
@@ -1021,6 +1271,7 @@ int fastcall path_lookup(const char *name, unsigned int flags, struct nameidata
 	read_unlock(&current->fs->lock);
 	current->total_link_count = 0;
 	retval = link_path_walk(name, nd);
+out:
 	if (unlikely(current->audit_context
 		     && nd && nd->dentry && nd->dentry->d_inode))
 		audit_inode(name, nd->dentry->d_inode);
@@ -1292,7 +1543,7 @@ int vfs_create(struct inode *dir, struct dentry *dentry, int mode,
 	DQUOT_INIT(dir);
 	error = dir->i_op->create(dir, dentry, mode, nd);
 	if (!error) {
-		inode_dir_notify(dir, DN_CREATE);
+		fsnotify_create(dir, dentry->d_name.name);
 		security_inode_post_create(dir, dentry, mode);
 	}
 	return error;
@@ -1597,7 +1848,7 @@ int vfs_mknod(struct inode *dir, struct dentry *dentry, int mode, dev_t dev)
 	DQUOT_INIT(dir);
 	error = dir->i_op->mknod(dir, dentry, mode, dev);
 	if (!error) {
-		inode_dir_notify(dir, DN_CREATE);
+		fsnotify_create(dir, dentry->d_name.name);
 		security_inode_post_mknod(dir, dentry, mode, dev);
 	}
 	return error;
@@ -1670,7 +1921,7 @@ int vfs_mkdir(struct inode *dir, struct dentry *dentry, int mode)
 	DQUOT_INIT(dir);
 	error = dir->i_op->mkdir(dir, dentry, mode);
 	if (!error) {
-		inode_dir_notify(dir, DN_CREATE);
+		fsnotify_mkdir(dir, dentry->d_name.name);
 		security_inode_post_mkdir(dir,dentry, mode);
 	}
 	return error;
@@ -1760,10 +2011,8 @@ int vfs_rmdir(struct inode *dir, struct dentry *dentry)
 		}
 	}
 	up(&dentry->d_inode->i_sem);
-	if (!error) {
-		inode_dir_notify(dir, DN_DELETE);
+	if (!error)
 		d_delete(dentry);
-	}
 	dput(dentry);
 
 	return error;
@@ -1833,10 +2082,8 @@ int vfs_unlink(struct inode *dir, struct dentry *dentry)
 	up(&dentry->d_inode->i_sem);
 
 	/* We don't d_delete() NFS sillyrenamed files--they still exist. */
-	if (!error && !(dentry->d_flags & DCACHE_NFSFS_RENAMED)) {
+	if (!error && !(dentry->d_flags & DCACHE_NFSFS_RENAMED))
 		d_delete(dentry);
-		inode_dir_notify(dir, DN_DELETE);
-	}
 	return error;
 }
 
@@ -1910,7 +2157,7 @@ int vfs_symlink(struct inode *dir, struct dentry *dentry, const char *oldname, i
 	DQUOT_INIT(dir);
 	error = dir->i_op->symlink(dir, dentry, oldname);
 	if (!error) {
-		inode_dir_notify(dir, DN_CREATE);
+		fsnotify_create(dir, dentry->d_name.name);
 		security_inode_post_symlink(dir, dentry, oldname);
 	}
 	return error;
@@ -1983,7 +2230,7 @@ int vfs_link(struct dentry *old_dentry, struct inode *dir, struct dentry *new_de
 	error = dir->i_op->link(old_dentry, dir, new_dentry);
 	up(&old_dentry->d_inode->i_sem);
 	if (!error) {
-		inode_dir_notify(dir, DN_CREATE);
+		fsnotify_create(dir, new_dentry->d_name.name);
 		security_inode_post_link(old_dentry, dir, new_dentry);
 	}
 	return error;
@@ -2147,6 +2394,7 @@ int vfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 {
 	int error;
 	int is_dir = S_ISDIR(old_dentry->d_inode->i_mode);
+	const char *old_name;
 
 	if (old_dentry->d_inode == new_dentry->d_inode)
  		return 0;
@@ -2168,18 +2416,19 @@ int vfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 	DQUOT_INIT(old_dir);
 	DQUOT_INIT(new_dir);
 
+	old_name = fsnotify_oldname_init(old_dentry);
+
 	if (is_dir)
 		error = vfs_rename_dir(old_dir,old_dentry,new_dir,new_dentry);
 	else
 		error = vfs_rename_other(old_dir,old_dentry,new_dir,new_dentry);
 	if (!error) {
-		if (old_dir == new_dir)
-			inode_dir_notify(old_dir, DN_RENAME);
-		else {
-			inode_dir_notify(old_dir, DN_DELETE);
-			inode_dir_notify(new_dir, DN_CREATE);
-		}
+		const char *new_name = old_dentry->d_name.name;
+		fsnotify_move(old_dir, new_dir, old_name, new_name, is_dir,
+			      old_dentry->d_inode);
 	}
+	fsnotify_oldname_free(old_name);
+
 	return error;
 }
 
@@ -24,6 +24,7 @@
 #include <linux/string.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/file.h>
 #include <linux/mm.h>
 #include <linux/sunrpc/clnt.h>
 #include <linux/nfs_fs.h>
@@ -31,6 +32,7 @@
 #include <linux/pagemap.h>
 #include <linux/smp_lock.h>
 #include <linux/namei.h>
+#include <linux/workqueue.h>
 
 #include "delegation.h"
 
@@ -121,6 +123,7 @@ typedef struct {
 	decode_dirent_t	decode;
 	int		plus;
 	int		error;
+	unsigned long	timestamp;	/* when the current page was read */
 } nfs_readdir_descriptor_t;
 
 /* Now we cache directories properly, by stuffing the dirent
@@ -160,6 +163,7 @@ int nfs_readdir_filler(nfs_readdir_descriptor_t *desc, struct page *page)
 		}
 		goto error;
 	}
+	page->private = timestamp;
 	SetPageUptodate(page);
 	NFS_FLAGS(inode) |= NFS_INO_INVALID_ATIME;
 	/* Ensure consistent page alignment of the data.
@@ -200,6 +204,208 @@ void dir_page_release(nfs_readdir_descriptor_t *desc)
 	desc->ptr = NULL;
 }
 
+/*
+ * Directory readahead.
+ *
+ * Each READDIR needs the last cookie of the reply before it, so the
+ * calls for one directory cannot be issued in parallel.  What we can do
+ * is keep them going while the caller is busy with what it already has:
+ * when a reader starts on a page whose successor is not cached, we send
+ * the READDIR for the successor asynchronously and, as each reply comes
+ * in, the one after it, up to NFS_READDIR_RA_PAGES pages ahead.  The
+ * pages are added to the page cache locked, so a reader that catches up
+ * simply waits for the reply in read_cache_page().
+ *
+ * A chain stops when it reaches the end of the directory, a page that is
+ * already cached, or when the directory cache has been invalidated since
+ * it started.  Replies that arrive after an invalidation are left
+ * !PageUptodate, and the reader fills the page itself.
+ */
+#define NFS_READDIR_RA_PAGES	8
+
+struct nfs_readdir_ra {
+	struct nfs_readdir_data	data;
+	struct file		*file;
+	struct work_struct	work;
+	unsigned int		remaining;
+	unsigned long		verifier;
+	unsigned long		readdir_timestamp;
+	decode_dirent_t		decode;
+	struct nfs_entry	entry;
+	struct nfs_fh		fh;
+	struct nfs_fattr	fattr;
+};
+
+static void nfs_readdir_ra_start(struct nfs_readdir_ra *ra);
+
+static int nfs_readdir_ra_valid(struct nfs_readdir_ra *ra)
+{
+	struct inode *dir = ra->data.inode;
+
+	return NFS_I(dir)->cache_change_attribute == ra->verifier
+		&& NFS_I(dir)->readdir_timestamp == ra->readdir_timestamp
+		&& !(NFS_FLAGS(dir) & NFS_INO_INVALID_DATA)
+		&& ra->data.page->mapping == dir->i_mapping;
+}
+
+static void nfs_readdir_ra_free(struct nfs_readdir_ra *ra)
+{
+	if (ra->data.page)
+		page_cache_release(ra->data.page);
+	put_rpccred(ra->data.cred);
+	fput(ra->file);
+	kfree(ra);
+}
+
+static void nfs_readdir_ra_complete(struct nfs_readdir_data *data, int status)
+{
+	struct nfs_readdir_ra *ra = container_of(data, struct nfs_readdir_ra, data);
+	struct page *page = data->page;
+
+	if (status >= 0 && nfs_readdir_ra_valid(ra)) {
+		page->private = data->timestamp;
+		SetPageUptodate(page);
+	} else
+		ra->remaining = 0;
+	unlock_page(page);
+}
+
+static void nfs_readdir_ra_work(void *arg)
+{
+	struct nfs_readdir_ra *ra = arg;
+
+	lock_kernel();
+	if (ra->remaining != 0)
+		nfs_readdir_ra_start(ra);
+	else
+		nfs_readdir_ra_free(ra);
+	unlock_kernel();
+}
+
+/*
+ * Called from rpciod: sending the next call, or dropping the file,
+ * may sleep, so both are left to keventd.
+ */
+static void nfs_readdir_ra_release(struct rpc_task *task)
+{
+	struct nfs_readdir_ra *ra = container_of(task, struct nfs_readdir_ra, data.task);
+
+	schedule_work(&ra->work);
+}
+
+/*
+ * Find the cookie of the last entry in an uptodate page.  Returns 0 if
+ * there is a next page to read.
+ */
+static int nfs_readdir_last_cookie(struct nfs_readdir_ra *ra, struct page *page)
+{
+	struct nfs_entry *entry = &ra->entry;
+	u32 *p;
+	int n = 0;
+
+	if (!PageUptodate(page))
+		return -EIO;
+	entry->cookie = entry->prev_cookie = 0;
+	entry->eof = 0;
+	p = kmap(page);
+	for (;;) {
+		p = ra->decode(p, entry, ra->data.plus);
+		if (IS_ERR(p))
+			break;
+		n++;
+	}
+	kunmap(page);
+	if (PTR_ERR(p) != -EAGAIN || n == 0 || entry->eof)
+		return -EBADCOOKIE;
+	return 0;
+}
+
+/*
+ * Send the READDIR for the page after ra->data.page.  Consumes ra on
+ * failure.  Called with the BKL held.
+ */
+static void nfs_readdir_ra_start(struct nfs_readdir_ra *ra)
+{
+	struct inode *dir = ra->data.inode;
+	struct page *prev = ra->data.page;
+	struct page *page;
+	struct rpc_clnt *clnt = NFS_CLIENT(dir);
+	sigset_t oldset;
+
+	ra->remaining--;
+	if (!nfs_readdir_ra_valid(ra) || nfs_readdir_last_cookie(ra, prev) != 0)
+		goto out_free;
+	page = grab_cache_page_nowait(dir->i_mapping, prev->index + 1);
+	if (page == NULL)
+		goto out_free;
+	if (PageUptodate(page)) {
+		unlock_page(page);
+		page_cache_release(page);
+		goto out_free;
+	}
+	page_cache_release(prev);
+	ra->data.page = page;
+	ra->data.cookie = ra->entry.cookie;
+	ra->data.timestamp = jiffies;
+
+	dfprintk(VFS, "NFS: readdir readahead of cookie %Lu into page %lu\n",
+			(long long)ra->data.cookie, page->index);
+
+	NFS_PROTO(dir)->readdir_setup(&ra->data);
+	ra->data.task.tk_cookie = (unsigned long)dir;
+	ra->data.task.tk_calldata = &ra->data;
+	ra->data.task.tk_release = nfs_readdir_ra_release;
+
+	rpc_clnt_sigmask(clnt, &oldset);
+	rpc_execute(&ra->data.task);
+	rpc_clnt_sigunmask(clnt, &oldset);
+	return;
+ out_free:
+	nfs_readdir_ra_free(ra);
+}
+
+/*
+ * The reader has just got hold of 'page': start reading ahead of it
+ * unless the next page is already cached or on its way.
+ */
+static void nfs_readdir_readahead(nfs_readdir_descriptor_t *desc, struct page *page)
+{
+	struct file *file = desc->file;
+	struct inode *dir = file->f_dentry->d_inode;
+	struct nfs_readdir_ra *ra;
+	struct page *next;
+
+	if (NFS_PROTO(dir)->readdir_setup == NULL)
+		return;
+	next = find_get_page(dir->i_mapping, page->index + 1);
+	if (next != NULL) {
+		page_cache_release(next);
+		return;
+	}
+	ra = kmalloc(sizeof(*ra), GFP_KERNEL);
+	if (ra == NULL)
+		return;
+	memset(ra, 0, sizeof(*ra));
+	ra->file = file;
+	get_file(file);
+	ra->data.inode = dir;
+	ra->data.cred = get_rpccred(nfs_file_cred(file));
+	ra->data.count = NFS_SERVER(dir)->dtsize;
+	ra->data.plus = desc->plus;
+	ra->data.complete = nfs_readdir_ra_complete;
+	ra->data.page = page;
+	page_cache_get(page);
+	ra->decode = desc->decode;
+	ra->entry.fh = &ra->fh;
+	ra->entry.fattr = &ra->fattr;
+	ra->remaining = NFS_READDIR_RA_PAGES;
+	ra->verifier = nfs_save_change_attribute(dir);
+	ra->readdir_timestamp = NFS_I(dir)->readdir_timestamp;
+	INIT_WORK(&ra->work, nfs_readdir_ra_work, ra);
+
+	nfs_readdir_ra_start(ra);
+}
+
 /*
  * Given a pointer to a buffer that has already been filled by a call
  * to readdir, find the next entry.
@@ -250,8 +456,11 @@ int find_dirent_page(nfs_readdir_descriptor_t *desc)
 	if (!PageUptodate(page))
 		goto read_error;
 
+	nfs_readdir_readahead(desc, page);
+
 	/* NOTE: Someone else may have changed the READDIRPLUS flag */
 	desc->page = page;
+	desc->timestamp = page->private;
 	desc->ptr = kmap(page);		/* matching kunmap in nfs_do_filldir */
 	status = find_dirent(desc, page);
 	if (status < 0)
@@ -382,6 +591,7 @@ int uncached_readdir(nfs_readdir_descriptor_t *desc, void *dirent,
 		status = -ENOMEM;
 		goto out;
 	}
+	desc->timestamp = jiffies;
 	desc->error = NFS_PROTO(inode)->readdir(file->f_dentry, cred, desc->target,
 						page,
 						NFS_SERVER(inode)->dtsize,
@@ -928,10 +1138,28 @@ static struct dentry *nfs_readdir_lookup(nfs_readdir_descriptor_t *desc)
 	}
 	name.hash = full_name_hash(name.name, name.len);
 	dentry = d_lookup(parent, &name);
-	if (dentry != NULL)
+	if (!desc->plus || !(entry->fattr->valid & NFS_ATTR_FATTR)
+			|| entry->fh->size == 0)
 		return dentry;
-	if (!desc->plus || !(entry->fattr->valid & NFS_ATTR_FATTR))
-		return NULL;
+	/* The attributes are as old as the reply, not as the decode */
+	entry->fattr->timestamp = desc->timestamp;
+	if (dentry != NULL) {
+		inode = dentry->d_inode;
+		if (inode != NULL) {
+			/* Keep the cached attributes current, so that
+			 * stat() after readdir() needs no GETATTR */
+			if (nfs_compare_fh(entry->fh, NFS_FH(inode)) == 0
+					&& nfs_readdirplus_update_inode(inode,
+							entry->fattr) == 0) {
+				nfs_renew_times(dentry);
+				nfs_set_verifier(dentry, nfs_save_change_attribute(dir));
+			}
+			return dentry;
+		}
+		/* The name exists now: replace the negative dentry */
+		d_drop(dentry);
+		dput(dentry);
+	}
 	/* Note: caller is already holding the dir->i_sem! */
 	dentry = d_alloc(parent, &name);
 	if (dentry == NULL)
@@ -45,6 +45,8 @@
 #include <linux/file.h>
 #include <linux/pagemap.h>
 #include <linux/kref.h>
+#include <linux/aio.h>
+#include <linux/workqueue.h>
 
 #include <linux/nfs_fs.h>
 #include <linux/nfs_page.h>
@@ -57,6 +59,10 @@
 #define NFSDBG_FACILITY		NFSDBG_VFS
 #define MAX_DIRECTIO_SIZE	(4096UL << PAGE_SHIFT)
 
+/* states of unstable direct writes, in nfs_direct_req.flags */
+#define NFS_ODIRECT_DO_COMMIT		(1)	/* an unstable reply was received */
+#define NFS_ODIRECT_RESCHED_WRITES	(2)	/* write verification failed */
+
 static kmem_cache_t *nfs_direct_cachep;
 
 /*
@@ -64,13 +70,27 @@ static kmem_cache_t *nfs_direct_cachep;
  */
 struct nfs_direct_req {
 	struct kref		kref;		/* release manager */
-	struct list_head	list;		/* nfs_read_data structs */
+	struct list_head	list;		/* nfs_read_data/nfs_write_data structs */
 	wait_queue_head_t	wait;		/* wait for i/o completion */
+	struct kiocb *		iocb;		/* aio request, NULL if synchronous */
+	struct inode *		inode;		/* target file of i/o */
+	struct nfs_open_context	*ctx;		/* file open context info */
 	struct page **		pages;		/* pages in our buffer */
 	unsigned int		npages;		/* count of pages */
+	unsigned long		user_addr;	/* start of the user's buffer */
+	size_t			size;		/* bytes requested */
+	loff_t			pos;		/* file offset of the i/o */
 	atomic_t		complete,	/* i/os we're waiting for */
 				count,		/* bytes actually processed */
 				error;		/* any reported error */
+	int			done;		/* all i/o, and COMMIT, finished */
+
+	/* unstable writes */
+	spinlock_t		lock;		/* protects flags and verf */
+	int			flags;
+	struct nfs_writeverf	verf;		/* verifier of the first reply */
+	struct nfs_write_data *	commit_data;	/* COMMIT, allocated up front */
+	struct work_struct	work;		/* resends the writes stably */
 };
 
 
@@ -141,31 +161,118 @@ static void nfs_direct_req_release(struct kref *kref)
 }
 
 /**
- * nfs_direct_read_alloc - allocate nfs_read_data structures for direct read
- * @count: count of bytes for the read request
- * @rsize: local rsize setting
+ * nfs_direct_req_alloc - allocate and initialize an nfs_direct_req
+ * @iocb: aio request to complete when the i/o is done, or NULL
+ * @inode: target inode
+ * @ctx: target file open context
+ * @user_addr: starting address of this segment of user's buffer
+ * @count: size of this segment
+ * @file_offset: offset in file to begin the operation
+ * @pages: array of addresses of page structs defining user's buffer
+ * @nr_pages: number of pages in the array
  *
- * Note we also set the number of requests we have in the dreq when we are
- * done.  This prevents races with I/O completion so we will always wait
- * until all requests have been dispatched and completed.
+ * The request takes over the pages; they are released when the i/o has
+ * completed.  The caller holds one reference, which it gives up in
+ * nfs_direct_wait().
  */
-static struct nfs_direct_req *nfs_direct_read_alloc(size_t nbytes, unsigned int rsize)
+static struct nfs_direct_req *nfs_direct_req_alloc(struct kiocb *iocb,
+		struct inode *inode, struct nfs_open_context *ctx,
+		unsigned long user_addr, size_t count, loff_t file_offset,
+		struct page **pages, unsigned int nr_pages)
 {
-	struct list_head *list;
 	struct nfs_direct_req *dreq;
-	unsigned int reads = 0;
 
 	dreq = kmem_cache_alloc(nfs_direct_cachep, SLAB_KERNEL);
 	if (!dreq)
 		return NULL;
 
+	memset(dreq, 0, sizeof(*dreq));
 	kref_init(&dreq->kref);
 	init_waitqueue_head(&dreq->wait);
 	INIT_LIST_HEAD(&dreq->list);
+	spin_lock_init(&dreq->lock);
+	dreq->iocb = iocb;
+	dreq->inode = inode;
+	dreq->ctx = ctx;
+	dreq->user_addr = user_addr;
+	dreq->size = count;
+	dreq->pos = file_offset;
+	dreq->pages = pages;
+	dreq->npages = nr_pages;
 	atomic_set(&dreq->count, 0);
 	atomic_set(&dreq->error, 0);
+	return dreq;
+}
+
+/**
+ * nfs_direct_complete - finish off a direct i/o request
+ * @dreq: the request
+ *
+ * Called once all of its RPCs have completed, in rpciod or keventd, and
+ * after the caller has given back the user's pages.  Completes the aio
+ * request or wakes a synchronous waiter, then drops the i/o reference.
+ */
+static void nfs_direct_complete(struct nfs_direct_req *dreq)
+{
+	if (dreq->iocb) {
+		long res = atomic_read(&dreq->error);
+
+		if (!res)
+			res = atomic_read(&dreq->count);
+		aio_complete(dreq->iocb, res, 0);
+	}
+	dreq->done = 1;
+	wake_up(&dreq->wait);
+	kref_put(&dreq->kref, nfs_direct_req_release);
+}
+
+/**
+ * nfs_direct_wait - wait for I/O completion for direct reads and writes
+ * @dreq: request on which we are to wait
+ * @intr: whether or not this wait can be interrupted
+ *
+ * Collects and returns the final error value/byte-count.  Requests that
+ * carry an aio kiocb are completed through aio_complete() instead, and
+ * we return -EIOCBQUEUED at once.
+ */
+static ssize_t nfs_direct_wait(struct nfs_direct_req *dreq, int intr)
+{
+	int result = -EIOCBQUEUED;
+
+	if (dreq->iocb)
+		goto out;
+
+	result = 0;
+	if (intr) {
+		result = wait_event_interruptible(dreq->wait, dreq->done);
+	} else {
+		wait_event(dreq->wait, dreq->done);
+	}
+
+	if (!result)
+		result = atomic_read(&dreq->error);
+	if (!result)
+		result = atomic_read(&dreq->count);
+out:
+	kref_put(&dreq->kref, nfs_direct_req_release);
+	return (ssize_t) result;
+}
+
+/**
+ * nfs_direct_read_alloc - allocate nfs_read_data structures for direct read
+ * @dreq: the request
+ * @rsize: local rsize setting
+ *
+ * Note we also set the number of requests we have in the dreq when we are
+ * done.  This prevents races with I/O completion so we will always wait
+ * until all requests have been dispatched and completed.
+ */
+static int nfs_direct_read_alloc(struct nfs_direct_req *dreq, unsigned int rsize)
+{
+	struct list_head *list = &dreq->list;
+	size_t nbytes = dreq->size;
+	unsigned int reads = 0;
 
-	list = &dreq->list;
 	for(;;) {
 		struct nfs_read_data *data = nfs_readdata_alloc();
 
@@ -176,8 +283,7 @@ static struct nfs_direct_req *nfs_direct_read_alloc(size_t nbytes, unsigned int
 				list_del(&data->pages);
 				nfs_readdata_free(data);
 			}
-			kref_put(&dreq->kref, nfs_direct_req_release);
-			return NULL;
+			return -ENOMEM;
 		}
 
 		INIT_LIST_HEAD(&data->pages);
@@ -189,9 +295,8 @@ static struct nfs_direct_req *nfs_direct_read_alloc(size_t nbytes, unsigned int
 			break;
 		nbytes -= rsize;
 	}
-	kref_get(&dreq->kref);
 	atomic_set(&dreq->complete, reads);
-	return dreq;
+	return 0;
 }
 
 /**
@@ -201,7 +306,7 @@ static struct nfs_direct_req *nfs_direct_read_alloc(size_t nbytes, unsigned int
  *
  * We must hold a reference to all the pages in this direct read request
  * until the RPCs complete.  This could be long *after* we are woken up in
- * nfs_direct_read_wait (for instance, if someone hits ^C on a slow server).
+ * nfs_direct_wait (for instance, if someone hits ^C on a slow server).
  */
 static void nfs_direct_read_result(struct nfs_read_data *data, int status)
 {
@@ -214,34 +319,30 @@ static void nfs_direct_read_result(struct nfs_read_data *data, int status)
 
 	if (unlikely(atomic_dec_and_test(&dreq->complete))) {
 		nfs_free_user_pages(dreq->pages, dreq->npages, 1);
-		wake_up(&dreq->wait);
-		kref_put(&dreq->kref, nfs_direct_req_release);
+		nfs_direct_complete(dreq);
 	}
 }
 
 /**
  * nfs_direct_read_schedule - dispatch NFS READ operations for a direct read
  * @dreq: address of nfs_direct_req struct for this request
- * @inode: target inode
- * @ctx: target file open context
- * @user_addr: starting address of this segment of user's buffer
- * @count: size of this segment
- * @file_offset: offset in file to begin the operation
  *
  * For each nfs_read_data struct that was allocated on the list, dispatch
  * an NFS READ operation
  */
-static void nfs_direct_read_schedule(struct nfs_direct_req *dreq,
-		struct inode *inode, struct nfs_open_context *ctx,
-		unsigned long user_addr, size_t count, loff_t file_offset)
+static void nfs_direct_read_schedule(struct nfs_direct_req *dreq)
 {
+	struct inode *inode = dreq->inode;
+	struct nfs_open_context *ctx = dreq->ctx;
 	struct list_head *list = &dreq->list;
 	struct page **pages = dreq->pages;
+	size_t count = dreq->size;
+	loff_t file_offset = dreq->pos;
 	unsigned int curpage, pgbase;
 	unsigned int rsize = NFS_SERVER(inode)->rsize;
 
 	curpage = 0;
-	pgbase = user_addr & ~PAGE_MASK;
+	pgbase = dreq->user_addr & ~PAGE_MASK;
 	do {
 		struct nfs_read_data *data;
 		unsigned int bytes;
@@ -272,16 +373,17 @@ static void nfs_direct_read_schedule(struct nfs_direct_req *dreq,
 		data->task.tk_release = nfs_readdata_release;
 		data->complete = nfs_direct_read_result;
 
-		lock_kernel();
-		rpc_execute(&data->task);
-		unlock_kernel();
-
+		/* data may be gone as soon as it has been started */
 		dfprintk(VFS, "NFS: %4d initiated direct read call (req %s/%Ld, %u bytes @ offset %Lu)\n",
 				data->task.tk_pid,
 				inode->i_sb->s_id,
 				(long long)NFS_FILEID(inode),
 				bytes,
-				(unsigned long long)data->args.offset);
+				(unsigned long long)file_offset);
+
+		lock_kernel();
+		rpc_execute(&data->task);
+		unlock_kernel();
 
 		file_offset += bytes;
 		pgbase += bytes;
@@ -292,69 +394,50 @@ static void nfs_direct_read_schedule(struct nfs_direct_req *dreq,
 	} while (count != 0);
 }
 
-/**
- * nfs_direct_read_wait - wait for I/O completion for direct reads
- * @dreq: request on which we are to wait
- * @intr: whether or not this wait can be interrupted
- *
- * Collects and returns the final error value/byte-count.
- */
-static ssize_t nfs_direct_read_wait(struct nfs_direct_req *dreq, int intr)
-{
-	int result = 0;
-
-	if (intr) {
-		result = wait_event_interruptible(dreq->wait,
-					(atomic_read(&dreq->complete) == 0));
-	} else {
-		wait_event(dreq->wait, (atomic_read(&dreq->complete) == 0));
-	}
-
-	if (!result)
-		result = atomic_read(&dreq->error);
-	if (!result)
-		result = atomic_read(&dreq->count);
-
-	kref_put(&dreq->kref, nfs_direct_req_release);
-	return (ssize_t) result;
-}
-
 /**
  * nfs_direct_read_seg - Read in one iov segment.  Generate separate
  *                        read RPCs for each "rsize" bytes.
  * @inode: target inode
  * @ctx: target file open context
+ * @iocb: aio request to complete, or NULL to wait for the reads here
  * @user_addr: starting address of this segment of user's buffer
  * @count: size of this segment
  * @file_offset: offset in file to begin the operation
  * @pages: array of addresses of page structs defining user's buffer
  * @nr_pages: number of pages in the array
  *
+ * All the READs of the segment are in flight at once.
  */
 static ssize_t nfs_direct_read_seg(struct inode *inode,
-		struct nfs_open_context *ctx, unsigned long user_addr,
-		size_t count, loff_t file_offset, struct page **pages,
-		unsigned int nr_pages)
+		struct nfs_open_context *ctx, struct kiocb *iocb,
+		unsigned long user_addr, size_t count, loff_t file_offset,
+		struct page **pages, unsigned int nr_pages)
 {
 	ssize_t result;
 	sigset_t oldset;
 	struct rpc_clnt *clnt = NFS_CLIENT(inode);
 	struct nfs_direct_req *dreq;
 
-	dreq = nfs_direct_read_alloc(count, NFS_SERVER(inode)->rsize);
+	dreq = nfs_direct_req_alloc(iocb, inode, ctx, user_addr, count,
+				    file_offset, pages, nr_pages);
 	if (!dreq)
-		return -ENOMEM;
-
-	dreq->pages = pages;
-	dreq->npages = nr_pages;
+		goto out_nomem;
+	if (nfs_direct_read_alloc(dreq, NFS_SERVER(inode)->rsize) != 0) {
+		kref_put(&dreq->kref, nfs_direct_req_release);
+		goto out_nomem;
+	}
+	kref_get(&dreq->kref);
 
 	rpc_clnt_sigmask(clnt, &oldset);
-	nfs_direct_read_schedule(dreq, inode, ctx, user_addr, count,
-				 file_offset);
-	result = nfs_direct_read_wait(dreq, clnt->cl_intr);
+	nfs_direct_read_schedule(dreq);
+	result = nfs_direct_wait(dreq, clnt->cl_intr);
 	rpc_clnt_sigunmask(clnt, &oldset);
 
 	return result;
+
+out_nomem:
+	nfs_free_user_pages(pages, nr_pages, 0);
+	return -ENOMEM;
 }
 
 /**
@@ -362,6 +445,7 @@ static ssize_t nfs_direct_read_seg(struct inode *inode,
  *                   then generate read RPCs.
  * @inode: target inode
  * @ctx: target file open context
+ * @iocb: aio request to complete, or NULL; only with a single segment
  * @iov: array of vectors that define I/O buffer
  * file_offset: offset in file to begin the operation
  * nr_segs: size of iovec array
@@ -371,8 +455,8 @@ static ssize_t nfs_direct_read_seg(struct inode *inode,
  */
 static ssize_t
 nfs_direct_read(struct inode *inode, struct nfs_open_context *ctx,
-		const struct iovec *iov, loff_t file_offset,
-		unsigned long nr_segs)
+		struct kiocb *iocb, const struct iovec *iov,
+		loff_t file_offset, unsigned long nr_segs)
 {
 	ssize_t tot_bytes = 0;
 	unsigned long seg = 0;
@@ -393,7 +477,7 @@ nfs_direct_read(struct inode *inode, struct nfs_open_context *ctx,
                         return page_count;
                 }
 
-		result = nfs_direct_read_seg(inode, ctx, user_addr, size,
+		result = nfs_direct_read_seg(inode, ctx, iocb, user_addr, size,
 				file_offset, pages, page_count);
 
 		if (result <= 0) {
@@ -411,119 +495,323 @@ nfs_direct_read(struct inode *inode, struct nfs_open_context *ctx,
 }
 
 /**
- * nfs_direct_write_seg - Write out one iov segment.  Generate separate
- *                        write RPCs for each "wsize" bytes, then commit.
- * @inode: target inode
- * @ctx: target file open context
- * user_addr: starting address of this segment of user's buffer
- * count: size of this segment
- * file_offset: offset in file to begin the operation
- * @pages: array of addresses of page structs defining user's buffer
- * nr_pages: size of pages array
+ * nfs_direct_write_alloc - allocate nfs_write_data structures for direct write
+ * @dreq: the request
+ * @wsize: local wsize setting
+ *
+ * Like nfs_direct_read_alloc().  Also used to resend the writes stably.
  */
-static ssize_t nfs_direct_write_seg(struct inode *inode,
-		struct nfs_open_context *ctx, unsigned long user_addr,
-		size_t count, loff_t file_offset, struct page **pages,
-		int nr_pages)
+static int nfs_direct_write_alloc(struct nfs_direct_req *dreq, unsigned int wsize)
 {
-	const unsigned int wsize = NFS_SERVER(inode)->wsize;
-	size_t request;
-	int curpage, need_commit;
-	ssize_t result, tot_bytes;
-	struct nfs_writeverf first_verf;
-	struct nfs_write_data *wdata;
-
-	wdata = nfs_writedata_alloc();
-	if (!wdata)
-		return -ENOMEM;
+	struct list_head *list = &dreq->list;
+	size_t nbytes = dreq->size;
+	unsigned int writes = 0;
 
-	wdata->inode = inode;
-	wdata->cred = ctx->cred;
-	wdata->args.fh = NFS_FH(inode);
-	wdata->args.context = ctx;
-	wdata->args.stable = NFS_UNSTABLE;
-	if (IS_SYNC(inode) || NFS_PROTO(inode)->version == 2 || count <= wsize)
-		wdata->args.stable = NFS_FILE_SYNC;
-	wdata->res.fattr = &wdata->fattr;
-	wdata->res.verf = &wdata->verf;
+	for(;;) {
+		struct nfs_write_data *data = nfs_writedata_alloc();
 
-	nfs_begin_data_update(inode);
-retry:
-	need_commit = 0;
-	tot_bytes = 0;
-	curpage = 0;
-	request = count;
-	wdata->args.pgbase = user_addr & ~PAGE_MASK;
-	wdata->args.offset = file_offset;
-	do {
-		wdata->args.count = request;
-		if (wdata->args.count > wsize)
-			wdata->args.count = wsize;
-		wdata->args.pages = &pages[curpage];
+		if (unlikely(!data)) {
+			while (!list_empty(list)) {
+				data = list_entry(list->next,
+						  struct nfs_write_data, pages);
+				list_del(&data->pages);
+				nfs_writedata_free(data);
+			}
+			return -ENOMEM;
+		}
 
-		dprintk("NFS: direct write: c=%u o=%Ld ua=%lu, pb=%u, cp=%u\n",
-			wdata->args.count, (long long) wdata->args.offset,
-			user_addr + tot_bytes, wdata->args.pgbase, curpage);
+		INIT_LIST_HEAD(&data->pages);
+		list_add(&data->pages, list);
 
-		lock_kernel();
-		result = NFS_PROTO(inode)->write(wdata);
-		unlock_kernel();
+		data->req = (struct nfs_page *) dreq;
+		writes++;
+		if (nbytes <= wsize)
+			break;
+		nbytes -= wsize;
+	}
+	atomic_set(&dreq->complete, writes);
+	return 0;
+}
 
-		if (result <= 0) {
-			if (tot_bytes > 0)
+/**
+ * nfs_direct_write_done - finish off a direct write request
+ * @dreq: the request
+ */
+static void nfs_direct_write_done(struct nfs_direct_req *dreq)
+{
+	if (dreq->commit_data != NULL)
+		nfs_writedata_free(dreq->commit_data);
+	dreq->commit_data = NULL;
+	nfs_end_data_update_defer(dreq->inode);
+	nfs_free_user_pages(dreq->pages, dreq->npages, 0);
+	nfs_direct_complete(dreq);
+}
+
+static void nfs_direct_write_schedule(struct nfs_direct_req *dreq, int how);
+
+/**
+ * nfs_direct_write_reschedule - resend a direct write as stable writes
+ * @arg: the nfs_direct_req
+ *
+ * The server lost unstable data we sent it (the write verifier changed),
+ * so write all of it again.  Runs from keventd, as it needs to allocate.
+ */
+static void nfs_direct_write_reschedule(void *arg)
+{
+	struct nfs_direct_req *dreq = arg;
+
+	dprintk("NFS: direct write to %s/%Ld: verifier changed, resending\n",
+			dreq->inode->i_sb->s_id,
+			(long long)NFS_FILEID(dreq->inode));
+
+	dreq->flags = 0;
+	if (nfs_direct_write_alloc(dreq, NFS_SERVER(dreq->inode)->wsize) != 0) {
+		atomic_set(&dreq->error, -ENOMEM);
+		nfs_direct_write_done(dreq);
+		return;
+	}
+	nfs_direct_write_schedule(dreq, FLUSH_STABLE);
+}
+
+/**
+ * nfs_direct_commit_result - handle the COMMIT that ends a direct write
+ * @data: address of NFS COMMIT operation control block
+ * @status: status of the NFS COMMIT operation
+ */
+static void nfs_direct_commit_result(struct nfs_write_data *data, int status)
+{
+	struct nfs_direct_req *dreq = (struct nfs_direct_req *) data->req;
+
+	if (status < 0 || memcmp(&dreq->verf.verifier, &data->verf.verifier,
+				 sizeof(dreq->verf.verifier)) != 0) {
+		dreq->flags = NFS_ODIRECT_RESCHED_WRITES;
+		schedule_work(&dreq->work);
+		return;
+	}
+	atomic_set(&dreq->count, dreq->size);
+	nfs_direct_write_done(dreq);
+}
+
+/**
+ * nfs_direct_commit_schedule - COMMIT all the unstable writes of a request
+ * @dreq: the request
+ *
+ * One COMMIT covers the whole segment, however many WRITEs it took.
+ */
+static void nfs_direct_commit_schedule(struct nfs_direct_req *dreq)
+{
+	struct inode *inode = dreq->inode;
+	struct nfs_write_data *data = dreq->commit_data;
+
+	dreq->commit_data = NULL;
+
+	data->inode = inode;
+	data->cred = dreq->ctx->cred;
+	data->args.fh = NFS_FH(inode);
+	data->args.offset = dreq->pos;
+	data->args.count = dreq->size;
+	data->res.count = dreq->size;
+	data->res.fattr = &data->fattr;
+	data->res.verf = &data->verf;
+
+	NFS_PROTO(inode)->commit_setup(data, 0);
+
+	data->task.tk_cookie = (unsigned long) inode;
+	data->task.tk_calldata = data;
+	data->task.tk_release = nfs_writedata_release;
+	data->req = (struct nfs_page *) dreq;
+	data->complete = nfs_direct_commit_result;
+
+	dprintk("NFS: %4d initiated direct commit call\n", data->task.tk_pid);
+
+	lock_kernel();
+	rpc_execute(&data->task);
+	unlock_kernel();
+}
+
+/**
+ * nfs_direct_write_result - handle a write reply for a direct write request
+ * @data: address of NFS WRITE operation control block
+ * @status: status of this NFS WRITE operation
+ *
+ * Short writes have already been resent by nfs_writeback_done(), so a
+ * successful reply means the whole chunk was written.  When the last
+ * reply is in, unstable data is committed with a single COMMIT.
+ */
+static void nfs_direct_write_result(struct nfs_write_data *data, int status)
+{
+	struct nfs_direct_req *dreq = (struct nfs_direct_req *) data->req;
+
+	if (likely(status >= 0)) {
+		spin_lock(&dreq->lock);
+		if (data->verf.committed == NFS_UNSTABLE) {
+			switch (dreq->flags) {
+			case 0:
+				memcpy(&dreq->verf, &data->verf,
+						sizeof(dreq->verf));
+				dreq->flags = NFS_ODIRECT_DO_COMMIT;
 				break;
-			goto out;
+			case NFS_ODIRECT_DO_COMMIT:
+				if (memcmp(&dreq->verf.verifier,
+						&data->verf.verifier,
+						sizeof(dreq->verf.verifier)))
+					dreq->flags = NFS_ODIRECT_RESCHED_WRITES;
+			}
 		}
+		spin_unlock(&dreq->lock);
+	} else
+		atomic_set(&dreq->error, status);
+
+	if (likely(!atomic_dec_and_test(&dreq->complete)))
+		return;
 
-		if (tot_bytes == 0)
-			memcpy(&first_verf.verifier, &wdata->verf.verifier,
-						sizeof(first_verf.verifier));
-		if (wdata->verf.committed != NFS_FILE_SYNC) {
-			need_commit = 1;
-			if (memcmp(&first_verf.verifier, &wdata->verf.verifier,
-					sizeof(first_verf.verifier)));
-				goto sync_retry;
+	if (atomic_read(&dreq->error) == 0) {
+		switch (dreq->flags) {
+		case NFS_ODIRECT_DO_COMMIT:
+			/* a faulty server may reply unstable to stable writes */
+			if (dreq->commit_data == NULL)
+				break;
+			nfs_direct_commit_schedule(dreq);
+			return;
+		case NFS_ODIRECT_RESCHED_WRITES:
+			schedule_work(&dreq->work);
+			return;
 		}
+		atomic_set(&dreq->count, dreq->size);
+	}
+	nfs_direct_write_done(dreq);
+}
 
-		tot_bytes += result;
+/**
+ * nfs_direct_write_schedule - dispatch NFS WRITE operations for a direct write
+ * @dreq: address of nfs_direct_req struct for this request
+ * @how: FLUSH_STABLE for stable writes, 0 for unstable ones
+ *
+ * For each nfs_write_data struct that was allocated on the list, dispatch
+ * an NFS WRITE operation
+ */
+static void nfs_direct_write_schedule(struct nfs_direct_req *dreq, int how)
+{
+	struct inode *inode = dreq->inode;
+	struct nfs_open_context *ctx = dreq->ctx;
+	struct list_head *list = &dreq->list;
+	struct page **pages = dreq->pages;
+	size_t count = dreq->size;
+	loff_t file_offset = dreq->pos;
+	unsigned int curpage, pgbase;
+	unsigned int wsize = NFS_SERVER(inode)->wsize;
 
-		/* in case of a short write: stop now, let the app recover */
-		if (result < wdata->args.count)
-			break;
+	curpage = 0;
+	pgbase = dreq->user_addr & ~PAGE_MASK;
+	do {
+		struct nfs_write_data *data;
+		unsigned int bytes;
 
-		wdata->args.offset += result;
-		wdata->args.pgbase += result;
-		curpage += wdata->args.pgbase >> PAGE_SHIFT;
-		wdata->args.pgbase &= ~PAGE_MASK;
-		request -= result;
-	} while (request != 0);
+		bytes = wsize;
+		if (count < wsize)
+			bytes = count;
 
-	/*
-	 * Commit data written so far, even in the event of an error
-	 */
-	if (need_commit) {
-		wdata->args.count = tot_bytes;
-		wdata->args.offset = file_offset;
+		data = list_entry(list->next, struct nfs_write_data, pages);
+		list_del_init(&data->pages);
+
+		data->inode = inode;
+		data->cred = ctx->cred;
+		data->args.fh = NFS_FH(inode);
+		data->args.context = ctx;
+		data->args.offset = file_offset;
+		data->args.pgbase = pgbase;
+		data->args.pages = &pages[curpage];
+		data->args.count = bytes;
+		data->res.fattr = &data->fattr;
+		data->res.count = bytes;
+		data->res.verf = &data->verf;
+
+		NFS_PROTO(inode)->write_setup(data, how);
+
+		data->task.tk_cookie = (unsigned long) inode;
+		data->task.tk_calldata = data;
+		data->task.tk_release = nfs_writedata_release;
+		data->complete = nfs_direct_write_result;
+
+		/* data may be gone as soon as it has been started */
+		dfprintk(VFS, "NFS: %4d initiated direct write call (req %s/%Ld, %u bytes @ offset %Lu)\n",
+				data->task.tk_pid,
+				inode->i_sb->s_id,
+				(long long)NFS_FILEID(inode),
+				bytes,
+				(unsigned long long)file_offset);
 
 		lock_kernel();
-		result = NFS_PROTO(inode)->commit(wdata);
+		rpc_execute(&data->task);
 		unlock_kernel();
 
-		if (result < 0 || memcmp(&first_verf.verifier,
-					 &wdata->verf.verifier,
-					 sizeof(first_verf.verifier)) != 0)
-			goto sync_retry;
+		file_offset += bytes;
+		pgbase += bytes;
+		curpage += pgbase >> PAGE_SHIFT;
+		pgbase &= ~PAGE_MASK;
+
+		count -= bytes;
+	} while (count != 0);
+}
+
+/**
+ * nfs_direct_write_seg - Write out one iov segment.  Generate separate
+ *                        write RPCs for each "wsize" bytes, then commit.
+ * @inode: target inode
+ * @ctx: target file open context
+ * @iocb: aio request to complete, or NULL to wait for the writes here
+ * user_addr: starting address of this segment of user's buffer
+ * count: size of this segment
+ * file_offset: offset in file to begin the operation
+ * @pages: array of addresses of page structs defining user's buffer
+ * nr_pages: size of pages array
+ *
+ * All the WRITEs of the segment are in flight at once.  If they are
+ * unstable, one COMMIT follows the last reply; if the server's write
+ * verifier changes on the way, everything is written again stably.
+ */
+static ssize_t nfs_direct_write_seg(struct inode *inode,
+		struct nfs_open_context *ctx, struct kiocb *iocb,
+		unsigned long user_addr, size_t count, loff_t file_offset,
+		struct page **pages, int nr_pages)
+{
+	const unsigned int wsize = NFS_SERVER(inode)->wsize;
+	ssize_t result;
+	sigset_t oldset;
+	struct rpc_clnt *clnt = NFS_CLIENT(inode);
+	struct nfs_direct_req *dreq;
+	int how = 0;
+
+	dreq = nfs_direct_req_alloc(iocb, inode, ctx, user_addr, count,
+				    file_offset, pages, nr_pages);
+	if (!dreq)
+		goto out_nomem;
+	if (nfs_direct_write_alloc(dreq, wsize) != 0) {
+		kref_put(&dreq->kref, nfs_direct_req_release);
+		goto out_nomem;
 	}
-	result = tot_bytes;
+	INIT_WORK(&dreq->work, nfs_direct_write_reschedule, dreq);
+
+	if (IS_SYNC(inode) || NFS_PROTO(inode)->version == 2 || count <= wsize)
+		how = FLUSH_STABLE;
+	else {
+		dreq->commit_data = nfs_writedata_alloc();
+		if (dreq->commit_data == NULL)
+			how = FLUSH_STABLE;
+	}
+	kref_get(&dreq->kref);
+
+	nfs_begin_data_update(inode);
+	rpc_clnt_sigmask(clnt, &oldset);
+	nfs_direct_write_schedule(dreq, how);
+	result = nfs_direct_wait(dreq, clnt->cl_intr);
+	rpc_clnt_sigunmask(clnt, &oldset);
 
-out:
-	nfs_end_data_update_defer(inode);
-	nfs_writedata_free(wdata);
 	return result;
 
-sync_retry:
-	wdata->args.stable = NFS_FILE_SYNC;
-	goto retry;
+out_nomem:
+	nfs_free_user_pages(pages, nr_pages, 0);
+	return -ENOMEM;
 }
 
 /**
@@ -531,6 +819,7 @@ sync_retry:
  *                    then generate write and commit RPCs.
  * @inode: target inode
  * @ctx: target file open context
+ * @iocb: aio request to complete, or NULL; only with a single segment
  * @iov: array of vectors that define I/O buffer
  * file_offset: offset in file to begin the operation
  * nr_segs: size of iovec array
@@ -540,8 +829,9 @@ sync_retry:
  * writes immediately.
  */
 static ssize_t nfs_direct_write(struct inode *inode,
-		struct nfs_open_context *ctx, const struct iovec *iov,
-		loff_t file_offset, unsigned long nr_segs)
+		struct nfs_open_context *ctx, struct kiocb *iocb,
+		const struct iovec *iov, loff_t file_offset,
+		unsigned long nr_segs)
 {
 	ssize_t tot_bytes = 0;
 	unsigned long seg = 0;
@@ -562,9 +852,8 @@ static ssize_t nfs_direct_write(struct inode *inode,
                         return page_count;
                 }
 
-		result = nfs_direct_write_seg(inode, ctx, user_addr, size,
-				file_offset, pages, page_count);
-		nfs_free_user_pages(pages, page_count, 0);
+		result = nfs_direct_write_seg(inode, ctx, iocb, user_addr,
+				size, file_offset, pages, page_count);
 
 		if (result <= 0) {
 			if (tot_bytes > 0)
@@ -599,7 +888,8 @@ nfs_direct_IO(int rw, struct kiocb *iocb, const struct iovec *iov,
 	struct inode *inode = dentry->d_inode;
 
 	/*
-	 * No support for async yet
+	 * aio requests come in through nfs_file_direct_read() and
+	 * nfs_file_direct_write(); the vectored path is synchronous
 	 */
 	if (!is_sync_kiocb(iocb))
 		return result;
@@ -610,14 +900,14 @@ nfs_direct_IO(int rw, struct kiocb *iocb, const struct iovec *iov,
 		dprintk("NFS: direct_IO(read) (%s) off/no(%Lu/%lu)\n",
 				dentry->d_name.name, file_offset, nr_segs);
 
-		result = nfs_direct_read(inode, ctx, iov,
+		result = nfs_direct_read(inode, ctx, NULL, iov,
 						file_offset, nr_segs);
 		break;
 	case WRITE:
 		dprintk("NFS: direct_IO(write) (%s) off/no(%Lu/%lu)\n",
 				dentry->d_name.name, file_offset, nr_segs);
 
-		result = nfs_direct_write(inode, ctx, iov,
+		result = nfs_direct_write(inode, ctx, NULL, iov,
 						file_offset, nr_segs);
 		break;
 	default:
@@ -667,8 +957,6 @@ nfs_file_direct_read(struct kiocb *iocb, char __user *buf, size_t count, loff_t
 		dentry->d_parent->d_name.name, dentry->d_name.name,
 		(unsigned long) count, (unsigned long) pos);
 
-	if (!is_sync_kiocb(iocb))
-		goto out;
 	if (count < 0)
 		goto out;
 	retval = -EFAULT;
@@ -688,7 +976,8 @@ nfs_file_direct_read(struct kiocb *iocb, char __user *buf, size_t count, loff_t
 			goto out;
 	}
 
-	retval = nfs_direct_read(inode, ctx, &iov, pos, 1);
+	retval = nfs_direct_read(inode, ctx,
+			is_sync_kiocb(iocb) ? NULL : iocb, &iov, pos, 1);
 	if (retval > 0)
 		*ppos = pos + retval;
 
@@ -742,8 +1031,6 @@ nfs_file_direct_write(struct kiocb *iocb, const char __user *buf, size_t count,
 		dentry->d_parent->d_name.name, dentry->d_name.name,
 		inode->i_ino, (unsigned long) count, (unsigned long) pos);
 
-	if (!is_sync_kiocb(iocb))
-		goto out;
 	if (count < 0)
 		goto out;
         if (pos < 0)
@@ -779,7 +1066,8 @@ nfs_file_direct_write(struct kiocb *iocb, const char __user *buf, size_t count,
 			goto out;
 	}
 
-	retval = nfs_direct_write(inode, ctx, &iov, pos, 1);
+	retval = nfs_direct_write(inode, ctx,
+			is_sync_kiocb(iocb) ? NULL : iocb, &iov, pos, 1);
 	if (mapping->nrpages)
 		invalidate_inode_pages2(mapping);
 	if (retval > 0)
@@ -350,6 +350,7 @@ nfs_create_client(struct nfs_server *server, const struct nfs_mount_data *data)
 	struct rpc_xprt		*xprt = NULL;
 	struct rpc_clnt		*clnt = NULL;
 	int			tcp   = (data->flags & NFS_MOUNT_TCP);
+	unsigned int		i;
 
 	/* Initialize timeout values */
 	timeparms.to_initval = data->timeo * HZ / 10;
@@ -376,6 +377,26 @@ nfs_create_client(struct nfs_server *server, const struct nfs_mount_data *data)
 		goto out_fail;
 	}
 
+	/*
+	 * Extra TCP connections let the calls of one mount use more
+	 * than one link of a bonded interface, and keep a stalled
+	 * connection from holding up every call.  Failing to make one
+	 * only leaves the mount with fewer.
+	 */
+	for (i = 1; tcp && i < data->nconnect && i < RPC_MAX_XPRTS; i++) {
+		xprt = xprt_create_proto(IPPROTO_TCP, &server->addr,
+					 &timeparms);
+		if (IS_ERR(xprt)) {
+			printk(KERN_WARNING "NFS: made only %u of %u "
+			       "connections.\n", i, data->nconnect);
+			break;
+		}
+		if (rpc_clnt_add_xprt(clnt, xprt) < 0) {
+			xprt_destroy(xprt);
+			break;
+		}
+	}
+
 	clnt->cl_intr     = 1;
 	clnt->cl_softrtry = 1;
 	clnt->cl_chatty   = 1;
@@ -571,6 +592,8 @@ static int nfs_show_options(struct seq_file *m, struct vfsmount *mnt)
 		else
 			seq_puts(m, nfs_infop->nostr);
 	}
+	if (nfss->client->cl_nxprts > 1)
+		seq_printf(m, ",nconnect=%u", nfss->client->cl_nxprts);
 	seq_puts(m, ",addr=");
 	seq_escape(m, nfss->hostname, " \t\n\\");
 	return 0;
@@ -1200,6 +1223,41 @@ int nfs_refresh_inode(struct inode *inode, struct nfs_fattr *fattr)
 	return 0;
 }
 
+/**
+ * nfs_readdirplus_update_inode - take on the attributes from READDIRPLUS
+ * @inode - pointer to inode
+ * @fattr - attributes returned for it in a READDIRPLUS entry
+ *
+ * A READDIRPLUS entry carries a full set of attributes, as good as a
+ * GETATTR reply, so unlike nfs_refresh_inode() this updates the cached
+ * attributes and marks them valid.  Attributes older than the ones we
+ * already have are ignored, and while we are changing the inode
+ * ourselves or someone else is revalidating it we only check them.
+ */
+int nfs_readdirplus_update_inode(struct inode *inode, struct nfs_fattr *fattr)
+{
+	struct nfs_inode *nfsi = NFS_I(inode);
+	unsigned long verifier;
+	int status;
+
+	if (nfs_have_delegation(inode, FMODE_READ))
+		return 0;
+	if ((fattr->valid & NFS_ATTR_FATTR) == 0
+			|| !time_after(fattr->timestamp, nfsi->read_cache_jiffies))
+		return 0;
+	if (nfsi->fileid != fattr->fileid
+			|| (inode->i_mode & S_IFMT) != (fattr->mode & S_IFMT))
+		return -EIO;
+	if (nfs_caches_unstable(inode) || NFS_REVALIDATING(inode))
+		return nfs_refresh_inode(inode, fattr);
+
+	verifier = nfs_save_change_attribute(inode);
+	status = nfs_update_inode(inode, fattr, verifier);
+	if (status == 0)
+		nfsi->flags &= ~(NFS_INO_INVALID_ATTR|NFS_INO_INVALID_ATIME);
+	return status;
+}
+
 /*
  * Many nfs protocol calls return the new file attributes after
  * an operation.  Here we update the inode to reflect the state
@@ -1416,6 +1474,8 @@ static struct super_block *nfs_get_sb(struct file_system_type *fs_type,
 		}
 		if (data->version < 5)
 			data->flags &= ~NFS_MOUNT_SECFLAVOUR;
+		if (data->version < 7)
+			data->nconnect = 0;
 	}
 
 	root = &server->fh;
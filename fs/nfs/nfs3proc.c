@@ -623,6 +623,56 @@ nfs3_proc_readdir(struct dentry *dentry, struct rpc_cred *cred,
 	return status;
 }
 
+static void
+nfs3_readdir_done(struct rpc_task *task)
+{
+	struct nfs_readdir_data *data = (struct nfs_readdir_data *) task->tk_calldata;
+
+	if (nfs3_async_handle_jukebox(task))
+		return;
+	if (task->tk_status >= 0)
+		nfs_refresh_inode(data->inode, &data->dir_attr);
+	data->complete(data, task->tk_status);
+}
+
+/*
+ * Asynchronous version of nfs3_proc_readdir, for directory readahead.
+ */
+static void
+nfs3_proc_readdir_setup(struct nfs_readdir_data *data)
+{
+	struct rpc_task		*task = &data->task;
+	struct inode		*dir = data->inode;
+	u32			*verf = NFS_COOKIEVERF(dir);
+	struct rpc_message	msg = {
+		.rpc_proc	= &nfs3_procedures[NFS3PROC_READDIR],
+		.rpc_argp	= &data->args,
+		.rpc_resp	= &data->res,
+		.rpc_cred	= data->cred,
+	};
+
+	data->args.fh = NFS_FH(dir);
+	data->args.cookie = data->cookie;
+	data->args.verf[0] = verf[0];
+	data->args.verf[1] = verf[1];
+	data->args.plus = data->plus;
+	data->args.count = data->count;
+	data->args.pages = &data->page;
+	data->res.dir_attr = &data->dir_attr;
+	data->res.verf = verf;
+	data->res.plus = data->plus;
+	data->dir_attr.valid = 0;
+
+	if (data->plus)
+		msg.rpc_proc = &nfs3_procedures[NFS3PROC_READDIRPLUS];
+
+	dprintk("NFS call  readdir%s %d (async)\n",
+			data->plus? "plus" : "", (unsigned int) data->cookie);
+
+	rpc_init_task(task, NFS_CLIENT(dir), nfs3_readdir_done, RPC_TASK_ASYNC);
+	rpc_call_setup(task, &msg, 0);
+}
+
 static int
 nfs3_proc_mknod(struct inode *dir, struct dentry *dentry, struct iattr *sattr,
 		dev_t rdev)
@@ -853,6 +903,7 @@ struct nfs_rpc_ops	nfs_v3_clientops = {
 	.read_setup	= nfs3_proc_read_setup,
 	.write_setup	= nfs3_proc_write_setup,
 	.commit_setup	= nfs3_proc_commit_setup,
+	.readdir_setup	= nfs3_proc_readdir_setup,
 	.file_open	= nfs_open,
 	.file_release	= nfs_release,
 	.lock		= nfs3_proc_lock,
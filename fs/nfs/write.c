@@ -104,7 +104,7 @@ static inline void nfs_commit_free(struct nfs_write_data *p)
 	mempool_free(p, nfs_commit_mempool);
 }
 
-static void nfs_writedata_release(struct rpc_task *task)
+void nfs_writedata_release(struct rpc_task *task)
 {
 	struct nfs_write_data	*wdata = (struct nfs_write_data *)task->tk_calldata;
 	nfs_writedata_free(wdata);
@@ -450,6 +450,7 @@ nfs_mark_request_dirty(struct nfs_page *req)
 	nfsi->ndirty++;
 	spin_unlock(&nfsi->req_lock);
 	inc_page_state(nr_dirty);
+	bdi_mod_reclaimable(inode->i_mapping->backing_dev_info, 1);
 	mark_inode_dirty(inode);
 }
 
@@ -478,6 +479,7 @@ nfs_mark_request_commit(struct nfs_page *req)
 	nfsi->ncommit++;
 	spin_unlock(&nfsi->req_lock);
 	inc_page_state(nr_unstable);
+	bdi_mod_reclaimable(inode->i_mapping->backing_dev_info, 1);
 	mark_inode_dirty(inode);
 }
 #endif
@@ -542,6 +544,7 @@ nfs_scan_dirty(struct inode *inode, struct list_head *dst, unsigned long idx_sta
 	res = nfs_scan_list(&nfsi->dirty, dst, idx_start, npages);
 	nfsi->ndirty -= res;
 	sub_page_state(nr_dirty,res);
+	bdi_mod_reclaimable(inode->i_mapping->backing_dev_info, -res);
 	if ((nfsi->ndirty == 0) != list_empty(&nfsi->dirty))
 		printk(KERN_ERR "NFS: desynchronized value of nfs_i.ndirty.\n");
 	return res;
@@ -922,7 +925,8 @@ static int nfs_flush_multi(struct list_head *head, struct inode *inode, int how)
 	atomic_set(&req->wb_complete, requests);
 
 	ClearPageError(page);
-	SetPageWriteback(page);
+	if (!TestSetPageWriteback(page))
+		bdi_mod_writeback(page->mapping->backing_dev_info, 1);
 	offset = 0;
 	nbytes = req->wb_bytes;
 	do {
@@ -985,7 +989,9 @@ static int nfs_flush_one(struct list_head *head, struct inode *inode, int how)
 		nfs_list_remove_request(req);
 		nfs_list_add_request(req, &data->pages);
 		ClearPageError(req->wb_page);
-		SetPageWriteback(req->wb_page);
+		if (!TestSetPageWriteback(req->wb_page))
+			bdi_mod_writeback(req->wb_page->mapping->
+						backing_dev_info, 1);
 		*pages++ = req->wb_page;
 		count += req->wb_bytes;
 	}
@@ -1324,10 +1330,15 @@ nfs_commit_done(struct rpc_task *task)
 		dprintk(" mismatch\n");
 		nfs_mark_request_dirty(req);
 	next:
+		bdi_mod_reclaimable(req->wb_context->dentry->d_inode->
+					i_mapping->backing_dev_info, -1);
 		nfs_unlock_request(req);
 		res++;
 	}
 	sub_page_state(nr_unstable,res);
+	/* A direct write's COMMIT has no requests, it wants the result */
+	if (data->complete)
+		data->complete(data, task->tk_status);
 }
 #endif
 
@@ -16,123 +16,274 @@
 #include <linux/string.h>
 #include <linux/spinlock.h>
 #include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/highmem.h>
+#include <linux/seq_file.h>
+#include <net/checksum.h>
 
 #include <linux/sunrpc/svc.h>
 #include <linux/nfsd/nfsd.h>
 #include <linux/nfsd/cache.h>
 
-/* Size of reply cache. Common values are:
- * 4.3BSD:	128
- * 4.4BSD:	256
- * Solaris2:	1024
- * DEC Unix:	512-4096
+/*
+ * The cache is a hash of buckets, each with its own lock and its own
+ * LRU list of entries, oldest first.  Entries are allocated as calls
+ * come in and freed once they are older than RC_EXPIRE, or when the
+ * whole cache grows past max_drc_entries.  The limit is sized from the
+ * amount of low memory, and the hash so that buckets stay around
+ * TARGET_BUCKET_SIZE entries long.
  */
-#define CACHESIZE		1024
-#define HASHSIZE		64
-#define REQHASH(xid)		((((xid) >> 24) ^ (xid)) & (HASHSIZE-1))
-
-static struct hlist_head *	hash_list;
-static struct list_head 	lru_head;
+#define TARGET_BUCKET_SIZE	64
+#define RC_EXPIRE		(120 * HZ)
+
+/* how much of the call to checksum, to tell apart calls with one xid */
+#define RC_CSUMLEN		256U
+
+struct nfsd_drc_bucket {
+	struct list_head	lru_head;
+	spinlock_t		cache_lock;
+};
+
+static struct nfsd_drc_bucket *	drc_hashtbl;
+static unsigned int		drc_hashbits;
+static unsigned int		max_drc_entries;
+static atomic_t			num_drc_entries;
+static kmem_cache_t *		drc_slab;
+static struct shrinker *	drc_shrinker;
 static int			cache_disabled = 1;
 
+/* statistics, for /proc/net/rpc/nfsd; not kept under any lock */
+static unsigned int		payload_misses;	/* xid matched, body did not */
+static unsigned int		lock_contended;	/* had to spin for a bucket */
+static unsigned int		longest_chain;	/* longest bucket walked */
+
 static int	nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *vec);
 
 /* 
  * locking for the reply cache:
  * A cache entry is "single use" if c_state == RC_INPROG
- * Otherwise, it when accessing _prev or _next, the lock must be held.
+ * Otherwise, it when accessing _prev or _next, the lock of its bucket
+ * must be held.  An entry in RC_INPROG is never freed.
+ */
+
+/*
+ * Allow 16 entries per square root of the low memory pages, scaled to
+ * kilobytes, but no more than 256k entries.  That is a few thousand
+ * entries on a small server and the full 256k from 64GB up.
  */
-static DEFINE_SPINLOCK(cache_lock);
+static unsigned int
+nfsd_cache_size_limit(void)
+{
+	unsigned long limit;
+	unsigned long low_pages = totalram_pages - totalhigh_pages;
+
+	limit = (16 * int_sqrt(low_pages)) << (PAGE_SHIFT - 10);
+	return min_t(unsigned long, limit, 256 * 1024);
+}
+
+static inline struct nfsd_drc_bucket *
+nfsd_cache_bucket(u32 xid)
+{
+	return &drc_hashtbl[hash_long((unsigned long)xid, drc_hashbits)];
+}
+
+static inline void
+nfsd_cache_lock(struct nfsd_drc_bucket *b)
+{
+	if (!spin_trylock(&b->cache_lock)) {
+		lock_contended++;
+		spin_lock(&b->cache_lock);
+	}
+}
+
+static void
+nfsd_reply_cache_free_locked(struct svc_cacherep *rp)
+{
+	if (rp->c_type == RC_REPLBUFF)
+		kfree(rp->c_replvec.iov_base);
+	list_del(&rp->c_lru);
+	atomic_dec(&num_drc_entries);
+	kmem_cache_free(drc_slab, rp);
+}
+
+/*
+ * Free the entries of a bucket that have expired, and while the cache
+ * is over its limit, the oldest ones as well.  Returns how many went.
+ */
+static int
+prune_bucket(struct nfsd_drc_bucket *b)
+{
+	struct svc_cacherep *rp, *tmp;
+	int freed = 0;
+
+	list_for_each_entry_safe(rp, tmp, &b->lru_head, c_lru) {
+		if (rp->c_state == RC_INPROG)
+			continue;
+		if (atomic_read(&num_drc_entries) <= max_drc_entries &&
+		    time_before(jiffies, rp->c_timestamp + RC_EXPIRE))
+			break;
+		nfsd_reply_cache_free_locked(rp);
+		freed++;
+	}
+	return freed;
+}
+
+/*
+ * Memory is short: drop whatever has expired.
+ */
+static int
+nfsd_cache_shrink(int nr_to_scan, unsigned int gfp_mask)
+{
+	unsigned int i;
+
+	if (nr_to_scan) {
+		for (i = 0; i < (1U << drc_hashbits); i++) {
+			struct nfsd_drc_bucket *b = &drc_hashtbl[i];
+
+			if (list_empty(&b->lru_head))
+				continue;
+			spin_lock(&b->cache_lock);
+			prune_bucket(b);
+			spin_unlock(&b->cache_lock);
+		}
+	}
+	return atomic_read(&num_drc_entries);
+}
 
 void
 nfsd_cache_init(void)
 {
-	struct svc_cacherep	*rp;
-	int			i;
-
-	INIT_LIST_HEAD(&lru_head);
-	i = CACHESIZE;
-	while(i) {
-		rp = kmalloc(sizeof(*rp), GFP_KERNEL);
-		if (!rp) break;
-		list_add(&rp->c_lru, &lru_head);
-		rp->c_state = RC_UNUSED;
-		rp->c_type = RC_NOCACHE;
-		INIT_HLIST_NODE(&rp->c_hash);
-		i--;
+	unsigned int hashsize, i;
+
+	max_drc_entries = nfsd_cache_size_limit();
+	atomic_set(&num_drc_entries, 0);
+
+	drc_slab = kmem_cache_create("nfsd_drc", sizeof(struct svc_cacherep),
+				     0, 0, NULL, NULL);
+	if (!drc_slab)
+		goto out_nomem;
+
+	drc_hashbits = 0;
+	while ((2U << drc_hashbits) <= max_drc_entries / TARGET_BUCKET_SIZE)
+		drc_hashbits++;
+
+	/* a smaller table only makes the buckets longer */
+	for (;;) {
+		hashsize = 1U << drc_hashbits;
+		drc_hashtbl = kmalloc(hashsize * sizeof(*drc_hashtbl),
+				      GFP_KERNEL);
+		if (drc_hashtbl || !drc_hashbits)
+			break;
+		drc_hashbits--;
 	}
+	if (!drc_hashtbl)
+		goto out_nomem;
 
-	if (i)
-		printk (KERN_ERR "nfsd: cannot allocate all %d cache entries, only got %d\n",
-			CACHESIZE, CACHESIZE-i);
-
-	hash_list = kmalloc (HASHSIZE * sizeof(struct hlist_head), GFP_KERNEL);
-	if (!hash_list) {
-		nfsd_cache_shutdown();
-		printk (KERN_ERR "nfsd: cannot allocate %Zd bytes for hash list\n",
-			HASHSIZE * sizeof(struct hlist_head));
-		return;
+	for (i = 0; i < hashsize; i++) {
+		INIT_LIST_HEAD(&drc_hashtbl[i].lru_head);
+		spin_lock_init(&drc_hashtbl[i].cache_lock);
 	}
-	memset(hash_list, 0, HASHSIZE * sizeof(struct hlist_head));
 
+	drc_shrinker = set_shrinker(DEFAULT_SEEKS, nfsd_cache_shrink);
 	cache_disabled = 0;
+	return;
+
+out_nomem:
+	printk(KERN_ERR "nfsd: failed to allocate reply cache\n");
+	nfsd_cache_shutdown();
 }
 
 void
 nfsd_cache_shutdown(void)
 {
 	struct svc_cacherep	*rp;
-
-	while (!list_empty(&lru_head)) {
-		rp = list_entry(lru_head.next, struct svc_cacherep, c_lru);
-		if (rp->c_state == RC_DONE && rp->c_type == RC_REPLBUFF)
-			kfree(rp->c_replvec.iov_base);
-		list_del(&rp->c_lru);
-		kfree(rp);
-	}
+	unsigned int		i;
 
 	cache_disabled = 1;
 
-	if (hash_list)
-		kfree (hash_list);
-	hash_list = NULL;
+	if (drc_shrinker)
+		remove_shrinker(drc_shrinker);
+	drc_shrinker = NULL;
+
+	if (drc_hashtbl) {
+		for (i = 0; i < (1U << drc_hashbits); i++) {
+			struct list_head *head = &drc_hashtbl[i].lru_head;
+
+			while (!list_empty(head)) {
+				rp = list_entry(head->next,
+						struct svc_cacherep, c_lru);
+				nfsd_reply_cache_free_locked(rp);
+			}
+		}
+		kfree(drc_hashtbl);
+	}
+	drc_hashtbl = NULL;
+
+	if (drc_slab && kmem_cache_destroy(drc_slab))
+		printk(KERN_WARNING "nfsd: reply cache slab not empty\n");
+	drc_slab = NULL;
 }
 
 /*
  * Move cache entry to end of LRU list
  */
 static void
-lru_put_end(struct svc_cacherep *rp)
+lru_put_end(struct nfsd_drc_bucket *b, struct svc_cacherep *rp)
 {
-	list_del(&rp->c_lru);
-	list_add_tail(&rp->c_lru, &lru_head);
+	list_move_tail(&rp->c_lru, &b->lru_head);
 }
 
 /*
- * Move a cache entry from one hash list to another
+ * Checksum the start of the call arguments, the part after the RPC
+ * header, so that a new call reusing an old xid is not mistaken for a
+ * retransmission of the old one.
  */
-static void
-hash_refile(struct svc_cacherep *rp)
+static unsigned int
+nfsd_cache_csum(struct svc_rqst *rqstp)
 {
-	hlist_del_init(&rp->c_hash);
-	hlist_add_head(&rp->c_hash, hash_list + REQHASH(rp->c_xid));
+	struct xdr_buf *buf = &rqstp->rq_arg;
+	unsigned int csum_len, len, base, idx;
+	unsigned int csum;
+
+	csum_len = min_t(unsigned int, buf->head[0].iov_len + buf->page_len,
+			 RC_CSUMLEN);
+	len = min_t(unsigned int, buf->head[0].iov_len, csum_len);
+	csum = csum_partial(buf->head[0].iov_base, len, 0);
+	csum_len -= len;
+
+	/* and on into the pages, for large calls */
+	idx = buf->page_base / PAGE_SIZE;
+	base = buf->page_base & ~PAGE_MASK;
+	while (csum_len) {
+		len = min_t(unsigned int, PAGE_SIZE - base, csum_len);
+		csum = csum_partial(page_address(buf->pages[idx]) + base,
+				    len, csum);
+		csum_len -= len;
+		base = 0;
+		idx++;
+	}
+	return csum;
 }
 
 /*
  * Try to find an entry matching the current call in the cache. When none
- * is found, we grab the oldest unlocked entry off the LRU list.
+ * is found, a new one is set up for the call, and old ones in the same
+ * bucket are pruned.
  * Note that no operation within the loop may sleep.
  */
 int
 nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 {
-	struct hlist_node	*hn;
-	struct hlist_head 	*rh;
-	struct svc_cacherep	*rp;
+	struct nfsd_drc_bucket	*b;
+	struct svc_cacherep	*rp, *new;
 	u32			xid = rqstp->rq_xid,
 				proto =  rqstp->rq_prot,
 				vers = rqstp->rq_vers,
 				proc = rqstp->rq_proc;
+	unsigned int		csum, len = rqstp->rq_arg.len;
+	unsigned int		entries = 0;
 	unsigned long		age;
 	int rtn;
 
@@ -142,46 +293,57 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 		return RC_DOIT;
 	}
 
-	spin_lock(&cache_lock);
+	csum = nfsd_cache_csum(rqstp);
+
+	/* allocate before taking the lock; a hit gives it back */
+	new = kmem_cache_alloc(drc_slab, GFP_KERNEL);
+
+	b = nfsd_cache_bucket(xid);
+	nfsd_cache_lock(b);
 	rtn = RC_DOIT;
 
-	rh = &hash_list[REQHASH(xid)];
-	hlist_for_each_entry(rp, hn, rh, c_hash) {
+	/* newest first: a retransmission is usually recent */
+	list_for_each_entry_reverse(rp, &b->lru_head, c_lru) {
+		entries++;
 		if (rp->c_state != RC_UNUSED &&
 		    xid == rp->c_xid && proc == rp->c_proc &&
 		    proto == rp->c_prot && vers == rp->c_vers &&
-		    time_before(jiffies, rp->c_timestamp + 120*HZ) &&
+		    time_before(jiffies, rp->c_timestamp + RC_EXPIRE) &&
 		    memcmp((char*)&rqstp->rq_addr, (char*)&rp->c_addr, sizeof(rp->c_addr))==0) {
+			if (csum != rp->c_csum || len != rp->c_len) {
+				payload_misses++;
+				continue;
+			}
 			nfsdstats.rchits++;
+			if (entries > longest_chain)
+				longest_chain = entries;
+			if (new)
+				kmem_cache_free(drc_slab, new);
 			goto found_entry;
 		}
 	}
 	nfsdstats.rcmisses++;
+	if (entries > longest_chain)
+		longest_chain = entries;
 
-	/* This loop shouldn't take more than a few iterations normally */
-	{
-	int	safe = 0;
-	list_for_each_entry(rp, &lru_head, c_lru) {
-		if (rp->c_state != RC_INPROG)
-			break;
-		if (safe++ > CACHESIZE) {
-			printk("nfsd: loop in repcache LRU list\n");
-			cache_disabled = 1;
+	if (new) {
+		rp = new;
+		rp->c_type = RC_NOCACHE;
+		list_add_tail(&rp->c_lru, &b->lru_head);
+		atomic_inc(&num_drc_entries);
+	} else {
+		/* no memory: recycle the oldest idle entry of the bucket */
+		struct svc_cacherep *old;
+
+		rp = NULL;
+		list_for_each_entry(old, &b->lru_head, c_lru)
+			if (old->c_state != RC_INPROG) {
+				rp = old;
+				break;
+			}
+		if (!rp)
 			goto out;
-		}
-	}
-	}
-
-	/* This should not happen */
-	if (rp == NULL) {
-		static int	complaints;
-
-		printk(KERN_WARNING "nfsd: all repcache entries locked!\n");
-		if (++complaints > 5) {
-			printk(KERN_WARNING "nfsd: disabling repcache.\n");
-			cache_disabled = 1;
-		}
-		goto out;
+		lru_put_end(b, rp);
 	}
 
 	rqstp->rq_cacherep = rp;
@@ -191,25 +353,27 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 	rp->c_addr = rqstp->rq_addr;
 	rp->c_prot = proto;
 	rp->c_vers = vers;
+	rp->c_csum = csum;
+	rp->c_len = len;
 	rp->c_timestamp = jiffies;
 
-	hash_refile(rp);
-
 	/* release any buffer */
 	if (rp->c_type == RC_REPLBUFF) {
 		kfree(rp->c_replvec.iov_base);
 		rp->c_replvec.iov_base = NULL;
 	}
 	rp->c_type = RC_NOCACHE;
+
+	prune_bucket(b);
  out:
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return rtn;
 
 found_entry:
 	/* We found a matching entry which is either in progress or done. */
 	age = jiffies - rp->c_timestamp;
 	rp->c_timestamp = jiffies;
-	lru_put_end(rp);
+	lru_put_end(b, rp);
 
 	rtn = RC_DROPIT;
 	/* Request being processed or excessive rexmits */
@@ -262,6 +426,7 @@ found_entry:
 void
 nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, u32 *statp)
 {
+	struct nfsd_drc_bucket *b;
 	struct svc_cacherep *rp;
 	struct kvec	*resv = &rqstp->rq_res.head[0], *cachv;
 	int		len;
@@ -288,22 +453,24 @@ nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, u32 *statp)
 		cachv = &rp->c_replvec;
 		cachv->iov_base = kmalloc(len << 2, GFP_KERNEL);
 		if (!cachv->iov_base) {
-			spin_lock(&cache_lock);
+			b = nfsd_cache_bucket(rp->c_xid);
+			spin_lock(&b->cache_lock);
 			rp->c_state = RC_UNUSED;
-			spin_unlock(&cache_lock);
+			spin_unlock(&b->cache_lock);
 			return;
 		}
 		cachv->iov_len = len << 2;
 		memcpy(cachv->iov_base, statp, len << 2);
 		break;
 	}
-	spin_lock(&cache_lock);
-	lru_put_end(rp);
+	b = nfsd_cache_bucket(rp->c_xid);
+	nfsd_cache_lock(b);
+	lru_put_end(b, rp);
 	rp->c_secure = rqstp->rq_secure;
 	rp->c_type = cachetype;
 	rp->c_state = RC_DONE;
 	rp->c_timestamp = jiffies;
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return;
 }
 
@@ -326,3 +493,20 @@ nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *data)
 	vec->iov_len += data->iov_len;
 	return 1;
 }
+
+/*
+ * The "drc" line of /proc/net/rpc/nfsd: entries, limit, buckets, calls
+ * whose body did not match an entry with their xid, contended bucket
+ * locks and the longest bucket walked.
+ */
+void
+nfsd_cache_stats_show(struct seq_file *seq)
+{
+	seq_printf(seq, "drc %u %u %u %u %u %u\n",
+		   atomic_read(&num_drc_entries),
+		   max_drc_entries,
+		   cache_disabled ? 0 : 1U << drc_hashbits,
+		   payload_misses,
+		   lock_contended,
+		   longest_chain);
+}
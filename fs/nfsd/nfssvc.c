@@ -21,6 +21,7 @@
 #include <linux/smp.h>
 #include <linux/smp_lock.h>
 #include <linux/fs_struct.h>
+#include <linux/seq_file.h>
 
 #include <linux/sunrpc/types.h>
 #include <linux/sunrpc/stats.h>
@@ -75,6 +76,18 @@ int nfsd_nrthreads(void)
 		return nfsd_serv->sv_nrthreads;
 }
 
+/*
+ * Per-pool statistics for /proc/net/rpc/nfsd.  nfsd_serv is protected
+ * by the BKL, like everywhere else.
+ */
+void nfsd_pool_stats_show(struct seq_file *seq)
+{
+	lock_kernel();
+	if (nfsd_serv)
+		svc_seq_show_pools(seq, nfsd_serv);
+	unlock_kernel();
+}
+
 int
 nfsd_svc(unsigned short port, int nrservs)
 {
@@ -100,7 +113,7 @@ nfsd_svc(unsigned short port, int nrservs)
 	if (!nfsd_serv) {
 		atomic_set(&nfsd_busy, 0);
 		error = -ENOMEM;
-		nfsd_serv = svc_create(&nfsd_program, NFSD_BUFSIZE);
+		nfsd_serv = svc_create_pooled(&nfsd_program, NFSD_BUFSIZE);
 		if (nfsd_serv == NULL)
 			goto out;
 		error = svc_makesock(nfsd_serv, IPPROTO_UDP, port);
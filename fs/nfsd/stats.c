@@ -34,6 +34,7 @@
 #include <linux/sunrpc/stats.h>
 #include <linux/nfsd/nfsd.h>
 #include <linux/nfsd/stats.h>
+#include <linux/nfsd/cache.h>
 
 struct nfsd_stats	nfsdstats;
 struct svc_stat		nfsd_svcstats = {
@@ -55,6 +56,8 @@ static int nfsd_proc_show(struct seq_file *seq, void *v)
 		      nfsdstats.fh_nocache_nondir,
 		      nfsdstats.io_read,
 		      nfsdstats.io_write);
+	/* reply cache details: */
+	nfsd_cache_stats_show(seq);
 	/* thread usage: */
 	seq_printf(seq, "th %u %u", nfsdstats.th_cnt, nfsdstats.th_fullcnt);
 	for (i=0; i<10; i++) {
@@ -72,6 +75,9 @@ static int nfsd_proc_show(struct seq_file *seq, void *v)
 	/* show my rpc info */
 	svc_seq_show(seq, &nfsd_svcstats);
 
+	/* and how the thread pools are doing */
+	nfsd_pool_stats_show(seq);
+
 	return 0;
 }
 
@@ -15,6 +15,8 @@
 #include <linux/pipe_fs_i.h>
 #include <linux/uio.h>
 #include <linux/highmem.h>
+#include <linux/fcntl.h>
+#include <linux/capability.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -34,6 +36,13 @@
  * -- Manfred Spraul <manfred@colorfullife.com> 2002-05-09
  */
 
+/*
+ * The largest pipe a user can ask for with F_SETPIPE_SZ, and how many
+ * pipe buffers all its pipes may have, unless it has CAP_SYS_RESOURCE.
+ */
+int pipe_max_size = 1048576;
+int pipe_user_pages_max = 16384;
+
 /* Drop the inode semaphore and wait for a pipe event, atomically */
 void pipe_wait(struct inode * inode)
 {
@@ -90,8 +99,12 @@ static void anon_pipe_buf_release(struct pipe_inode_info *info, struct pipe_buff
 {
 	struct page *page = buf->page;
 
-	if (info->tmp_page) {
-		__free_page(page);
+	/*
+	 * Only recycle the page if nobody else has it: tee() and sendpage
+	 * may still be looking at its contents.
+	 */
+	if (info->tmp_page || page_count(page) != 1) {
+		put_page(page);
 		return;
 	}
 	info->tmp_page = page;
@@ -107,11 +120,17 @@ static void anon_pipe_buf_unmap(struct pipe_inode_info *info, struct pipe_buffer
 	kunmap(buf->page);
 }
 
+static void anon_pipe_buf_get(struct pipe_inode_info *info, struct pipe_buffer *buf)
+{
+	get_page(buf->page);
+}
+
 static struct pipe_buf_operations anon_pipe_buf_ops = {
 	.can_merge = 1,
 	.map = anon_pipe_buf_map,
 	.unmap = anon_pipe_buf_unmap,
 	.release = anon_pipe_buf_release,
+	.get = anon_pipe_buf_get,
 };
 
 static ssize_t
@@ -148,6 +167,10 @@ pipe_readv(struct file *filp, const struct iovec *_iov,
 				chars = total_len;
 
 			addr = ops->map(filp, info, buf);
+			if (IS_ERR(addr)) {
+				if (!ret) ret = PTR_ERR(addr);
+				break;
+			}
 			error = pipe_iov_copy_to_user(iov, addr + buf->offset, chars);
 			ops->unmap(info, buf);
 			if (unlikely(error)) {
@@ -160,7 +183,7 @@ pipe_readv(struct file *filp, const struct iovec *_iov,
 			if (!buf->len) {
 				buf->ops = NULL;
 				ops->release(info, buf);
-				curbuf = (curbuf + 1) & (PIPE_BUFFERS-1);
+				curbuf = (curbuf + 1) & (info->buffers-1);
 				info->curbuf = curbuf;
 				info->nrbufs = --bufs;
 				do_wakeup = 1;
@@ -241,13 +264,17 @@ pipe_writev(struct file *filp, const struct iovec *_iov,
 		goto out;
 	}
 
-	/* We try to merge small writes */
+	/*
+	 * We try to merge small writes, unless the page is shared with
+	 * another pipe by tee(), which would see the new data too.
+	 */
 	if (info->nrbufs && total_len < PAGE_SIZE) {
-		int lastbuf = (info->curbuf + info->nrbufs - 1) & (PIPE_BUFFERS-1);
+		int lastbuf = (info->curbuf + info->nrbufs - 1) & (info->buffers-1);
 		struct pipe_buffer *buf = info->bufs + lastbuf;
 		struct pipe_buf_operations *ops = buf->ops;
 		int offset = buf->offset + buf->len;
-		if (ops->can_merge && offset + total_len <= PAGE_SIZE) {
+		if (ops->can_merge && page_count(buf->page) == 1 &&
+		    offset + total_len <= PAGE_SIZE) {
 			void *addr = ops->map(filp, info, buf);
 			int error = pipe_iov_copy_from_user(offset + addr, iov, total_len);
 			ops->unmap(info, buf);
@@ -270,9 +297,9 @@ pipe_writev(struct file *filp, const struct iovec *_iov,
 			break;
 		}
 		bufs = info->nrbufs;
-		if (bufs < PIPE_BUFFERS) {
+		if (bufs < info->buffers) {
 			ssize_t chars;
-			int newbuf = (info->curbuf + bufs) & (PIPE_BUFFERS-1);
+			int newbuf = (info->curbuf + bufs) & (info->buffers-1);
 			struct pipe_buffer *buf = info->bufs + newbuf;
 			struct page *page = info->tmp_page;
 			int error;
@@ -308,6 +335,7 @@ pipe_writev(struct file *filp, const struct iovec *_iov,
 			buf->ops = &anon_pipe_buf_ops;
 			buf->offset = 0;
 			buf->len = chars;
+			buf->flags = 0;
 			info->nrbufs = ++bufs;
 			info->tmp_page = NULL;
 
@@ -315,7 +343,7 @@ pipe_writev(struct file *filp, const struct iovec *_iov,
 			if (!total_len)
 				break;
 		}
-		if (bufs < PIPE_BUFFERS)
+		if (bufs < info->buffers)
 			continue;
 		if (filp->f_flags & O_NONBLOCK) {
 			if (!ret) ret = -EAGAIN;
@@ -382,7 +410,7 @@ pipe_ioctl(struct inode *pino, struct file *filp,
 			nrbufs = info->nrbufs;
 			while (--nrbufs >= 0) {
 				count += info->bufs[buf].len;
-				buf = (buf+1) & (PIPE_BUFFERS-1);
+				buf = (buf+1) & (info->buffers-1);
 			}
 			up(PIPE_SEM(*inode));
 			return put_user(count, (int __user *)arg);
@@ -391,6 +419,91 @@ pipe_ioctl(struct inode *pino, struct file *filp,
 	}
 }
 
+/*
+ * Resize the ring of a pipe to nr buffers, moving the buffers in use to
+ * the start of the new ring.  Called with the pipe semaphore held.
+ */
+static long pipe_set_size(struct pipe_inode_info *info, unsigned int nr)
+{
+	struct pipe_buffer *bufs;
+	int delta = nr - info->buffers;
+	unsigned int head;
+
+	if (nr < info->nrbufs)
+		return -EBUSY;
+
+	if (atomic_add_return(delta, &info->user->pipe_bufs) >
+	    pipe_user_pages_max && delta > 0 && !capable(CAP_SYS_RESOURCE)) {
+		atomic_sub(delta, &info->user->pipe_bufs);
+		return -EPERM;
+	}
+
+	bufs = kcalloc(nr, sizeof(struct pipe_buffer), GFP_KERNEL);
+	if (!bufs) {
+		atomic_sub(delta, &info->user->pipe_bufs);
+		return -ENOMEM;
+	}
+
+	head = info->buffers - info->curbuf;
+	if (head > info->nrbufs)
+		head = info->nrbufs;
+	memcpy(bufs, info->bufs + info->curbuf,
+	       head * sizeof(struct pipe_buffer));
+	memcpy(bufs + head, info->bufs,
+	       (info->nrbufs - head) * sizeof(struct pipe_buffer));
+
+	kfree(info->bufs);
+	info->bufs = bufs;
+	info->buffers = nr;
+	info->curbuf = 0;
+	return 0;
+}
+
+/*
+ * F_SETPIPE_SZ rounds the size up to a power of two number of pages.
+ * It fails with EBUSY if the data in the pipe does not fit in the new
+ * size.  Both return the size of the pipe in bytes.
+ */
+long pipe_fcntl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct inode *inode = filp->f_dentry->d_inode;
+	struct pipe_inode_info *info;
+	unsigned int nr;
+	long ret;
+
+	if (!S_ISFIFO(inode->i_mode) || !inode->i_pipe)
+		return -EBADF;
+
+	down(PIPE_SEM(*inode));
+	info = inode->i_pipe;
+	switch (cmd) {
+	case F_SETPIPE_SZ:
+		ret = -EINVAL;
+		if (arg > INT_MAX)
+			break;
+		ret = -EPERM;
+		if (arg > pipe_max_size && !capable(CAP_SYS_RESOURCE))
+			break;
+		nr = (arg + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		nr = nr ? roundup_pow_of_two(nr) : 1;
+		ret = pipe_set_size(info, nr);
+		if (ret)
+			break;
+		/* There may be room for writers now */
+		wake_up_interruptible(PIPE_WAIT(*inode));
+		ret = info->buffers * PAGE_SIZE;
+		break;
+	case F_GETPIPE_SZ:
+		ret = info->buffers * PAGE_SIZE;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	up(PIPE_SEM(*inode));
+	return ret;
+}
+
 /* No kernel lock held - fine */
 static unsigned int
 pipe_poll(struct file *filp, poll_table *wait)
@@ -412,7 +525,7 @@ pipe_poll(struct file *filp, poll_table *wait)
 	}
 
 	if (filp->f_mode & FMODE_WRITE) {
-		mask |= (nrbufs < PIPE_BUFFERS) ? POLLOUT | POLLWRNORM : 0;
+		mask |= (nrbufs < info->buffers) ? POLLOUT | POLLWRNORM : 0;
 		if (!PIPE_READERS(*inode))
 			mask |= POLLERR;
 	}
@@ -641,13 +754,16 @@ void free_pipe_info(struct inode *inode)
 	struct pipe_inode_info *info = inode->i_pipe;
 
 	inode->i_pipe = NULL;
-	for (i = 0; i < PIPE_BUFFERS; i++) {
+	for (i = 0; i < info->buffers; i++) {
 		struct pipe_buffer *buf = info->bufs + i;
 		if (buf->ops)
 			buf->ops->release(info, buf);
 	}
 	if (info->tmp_page)
 		__free_page(info->tmp_page);
+	atomic_sub(info->buffers, &info->user->pipe_bufs);
+	free_uid(info->user);
+	kfree(info->bufs);
 	kfree(info);
 }
 
@@ -659,12 +775,21 @@ struct inode* pipe_new(struct inode* inode)
 	if (!info)
 		goto fail_page;
 	memset(info, 0, sizeof(*info));
+	info->bufs = kcalloc(PIPE_BUFFERS, sizeof(struct pipe_buffer),
+			     GFP_KERNEL);
+	if (!info->bufs)
+		goto fail_info;
+	info->buffers = PIPE_BUFFERS;
+	info->user = get_uid(current->user);
+	atomic_add(PIPE_BUFFERS, &info->user->pipe_bufs);
 	inode->i_pipe = info;
 
 	init_waitqueue_head(PIPE_WAIT(*inode));
 	PIPE_RCOUNTER(*inode) = PIPE_WCOUNTER(*inode) = 1;
 
 	return inode;
+fail_info:
+	kfree(info);
 fail_page:
 	return NULL;
 }
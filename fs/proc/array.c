@@ -380,7 +380,15 @@ static int do_task_stat(struct task_struct *task, char * buffer, int whole)
 			utime = cputime_add(utime, task->signal->utime);
 			stime = cputime_add(stime, task->signal->stime);
 		}
-		it_real_value = task->signal->it_real_value;
+		if (hrtimer_active(&task->signal->real_timer)) {
+			ktime_t rem;
+
+			rem = hrtimer_get_remaining(&task->signal->real_timer);
+			if (rem.tv64 > 0) {
+				struct timespec ts = ktime_to_timespec(rem);
+				it_real_value = timespec_to_jiffies(&ts);
+			}
+		}
 	}
 	ppid = pid_alive(task) ? task->group_leader->real_parent->tgid : 0;
 	read_unlock(&tasklist_lock);
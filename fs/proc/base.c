@@ -424,10 +424,20 @@ static int proc_pid_wchan(struct task_struct *task, char *buffer)
  */
 static int proc_pid_schedstat(struct task_struct *task, char *buffer)
 {
-	return sprintf(buffer, "%lu %lu %lu\n",
+	int i, len;
+
+	len = sprintf(buffer, "%lu %lu %lu",
 			task->sched_info.cpu_time,
 			task->sched_info.run_delay,
 			task->sched_info.pcnt);
+	for (i = 0; i < SCHED_INFO_HIST_BUCKETS; i++)
+		len += sprintf(buffer + len, " %lu",
+				task->sched_info.run_delay_hist[i]);
+	for (i = 0; i < SCHED_INFO_HIST_BUCKETS; i++)
+		len += sprintf(buffer + len, " %lu",
+				task->sched_info.cpu_time_hist[i]);
+	len += sprintf(buffer + len, "\n");
+	return len;
 }
 #endif
 
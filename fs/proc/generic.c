@@ -514,27 +514,30 @@ static void proc_kill_inodes(struct proc_dir_entry *de)
 {
 	struct list_head *p;
 	struct super_block *sb = proc_mnt->mnt_sb;
+	int cpu;
 
 	/*
 	 * Actually it's a partial revoke().
 	 */
-	file_list_lock();
-	list_for_each(p, &sb->s_files) {
-		struct file * filp = list_entry(p, struct file, f_list);
-		struct dentry * dentry = filp->f_dentry;
-		struct inode * inode;
-		struct file_operations *fops;
-
-		if (dentry->d_op != &proc_dentry_operations)
-			continue;
-		inode = dentry->d_inode;
-		if (PDE(inode) != de)
-			continue;
-		fops = filp->f_op;
-		filp->f_op = NULL;
-		fops_put(fops);
+	for_each_cpu(cpu) {
+		file_sb_list_lock(cpu);
+		list_for_each(p, sb_files(sb, cpu)) {
+			struct file * filp = list_entry(p, struct file, f_list);
+			struct dentry * dentry = filp->f_dentry;
+			struct inode * inode;
+			struct file_operations *fops;
+
+			if (dentry->d_op != &proc_dentry_operations)
+				continue;
+			inode = dentry->d_inode;
+			if (PDE(inode) != de)
+				continue;
+			fops = filp->f_op;
+			filp->f_op = NULL;
+			fops_put(fops);
+		}
+		file_sb_list_unlock(cpu);
 	}
-	file_list_unlock();
 }
 
 static struct proc_dir_entry *proc_create(struct proc_dir_entry **parent,
@@ -362,6 +362,9 @@ read_kcore(struct file *file, char __user *buffer, size_t buflen, loff_t *fpos)
 				/* don't dump ioremap'd stuff! (TA) */
 				if (m->flags & VM_IOREMAP)
 					continue;
+				/* nor what is not all mapped */
+				if (m->flags & (VM_LAZY_FREE | VM_RAM))
+					continue;
 				memcpy(elf_buf + (vmstart - start),
 					(char *)vmstart, vmsize);
 			}
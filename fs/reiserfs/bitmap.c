@@ -152,7 +152,7 @@ static int scan_bitmap_block (struct reiserfs_transaction_handle *th,
     }
     if (buffer_locked (bi->bh)) {
        PROC_INFO_INC( s, scan_bitmap.wait );
-       __wait_on_buffer (bi->bh);
+       reiserfs_wait_on_buffer (s, bi->bh);
     }
 
     while (1) {
@@ -54,6 +54,7 @@ static int reiserfs_readdir (struct file * filp, void * dirent, filldir_t filldi
     char small_buf[32] ; /* avoid kmalloc if we can */
     struct reiserfs_dir_entry de;
     int ret = 0;
+    int depth, filldir_ret;
 
     reiserfs_write_lock(inode->i_sb);
 
@@ -152,8 +153,15 @@ static int reiserfs_readdir (struct file * filp, void * dirent, filldir_t filldi
 		// user space buffer is swapped out. At that time
 		// entry can move to somewhere else
 		memcpy (local_buf, d_name, d_reclen);
-		if (filldir (dirent, local_buf, d_reclen, d_off, d_ino, 
-		             DT_UNKNOWN) < 0) {
+
+		/* filldir may fault on the user buffer, and the fault may
+		   need the write lock.  The item_moved check below catches
+		   whatever changed meanwhile; deh is not looked at again */
+		depth = reiserfs_write_unlock_nested(inode->i_sb);
+		filldir_ret = filldir (dirent, local_buf, d_reclen, d_off,
+				       d_ino, DT_UNKNOWN);
+		reiserfs_write_lock_nested(inode->i_sb, depth);
+		if (filldir_ret < 0) {
 		    if (local_buf != small_buf) {
 			reiserfs_kfree(local_buf, d_reclen, inode->i_sb) ;
 		    }
@@ -164,7 +172,7 @@ static int reiserfs_readdir (struct file * filp, void * dirent, filldir_t filldi
 		}
 
 		// next entry should be looked for with such offset
-		next_pos = deh_offset (deh) + 1;
+		next_pos = d_off + 1;
 
 		if (item_moved (&tmp_ih, &path_to_entry)) {
 		    goto research;
@@ -22,14 +22,6 @@
 #include <linux/reiserfs_fs.h>
 #include <linux/buffer_head.h>
 
-#ifdef CONFIG_REISERFS_CHECK
-
-struct tree_balance * cur_tb = NULL; /* detects whether more than one
-                                        copy of tb exists as a means
-                                        of checking whether schedule
-                                        is interrupting do_balance */
-#endif
-
 inline void do_balance_mark_leaf_dirty (struct tree_balance * tb, 
 					struct buffer_head * bh, int flag)
 {
@@ -1355,7 +1347,9 @@ static int check_before_balancing (struct tree_balance * tb)
 {
   int retval = 0;	
 
-  if ( cur_tb ) {
+  /* a balance already in progress means the write lock was dropped
+     while do_balance ran */
+  if ( REISERFS_SB(tb->tb_sb)->cur_tb ) {
     reiserfs_panic (tb->tb_sb, "vs-12335: check_before_balancing: "
 		    "suspect that schedule occurred based on cur_tb not being null at this point in code. "
 		    "do_balance cannot properly handle schedule occurring while it runs.");
@@ -1496,7 +1490,7 @@ static inline void do_balance_starts (struct tree_balance *tb)
 	     "check");*/
     RFALSE( check_before_balancing (tb), "PAP-12340: locked buffers in TB");
 #ifdef CONFIG_REISERFS_CHECK
-    cur_tb = tb;
+    REISERFS_SB(tb->tb_sb)->cur_tb = tb;
 #endif
 }
 
@@ -1507,7 +1501,7 @@ static inline void do_balance_completed (struct tree_balance * tb)
 #ifdef CONFIG_REISERFS_CHECK
     check_leaf_level (tb);
     check_internal_levels (tb);
-    cur_tb = NULL;
+    REISERFS_SB(tb->tb_sb)->cur_tb = NULL;
 #endif
 
     /* reiserfs_free_block is no longer schedule safe.  So, we need to
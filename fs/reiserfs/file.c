@@ -49,8 +49,8 @@ static int reiserfs_file_release (struct inode * inode, struct file * filp)
 	return 0;
     }    
     
-    reiserfs_write_lock(inode->i_sb);
     down (&inode->i_sem); 
+    reiserfs_write_lock(inode->i_sb);
     /* freeing preallocation only involves relogging blocks that
      * are already in the current transaction.  preallocation gets
      * freed at the end of each transaction, so it is impossible for
@@ -100,8 +100,8 @@ static int reiserfs_file_release (struct inode * inode, struct file * filp)
 	err = reiserfs_truncate_file(inode, 0) ;
     }
 out:
-    up (&inode->i_sem); 
     reiserfs_write_unlock(inode->i_sb);
+    up (&inode->i_sem); 
     return err;
 }
 
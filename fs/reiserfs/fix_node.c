@@ -535,11 +535,6 @@ static int get_num_ver (int mode, struct tree_balance * tb, int h,
 }
 
 
-#ifdef CONFIG_REISERFS_CHECK
-extern struct tree_balance * cur_tb;
-#endif
-
-
 /* Set parameters for balancing.
  * Performs write of results of analysis of balancing into structure tb,
  * where it will later be used by the functions that actually do the balancing. 
@@ -1004,7 +999,7 @@ static int  get_far_parent (struct tree_balance *   p_s_tb,
     /* Check whether the common parent is locked. */
 
     if ( buffer_locked (*pp_s_com_father) ) {
-	__wait_on_buffer(*pp_s_com_father);
+	reiserfs_wait_on_buffer(p_s_tb->tb_sb, *pp_s_com_father);
 	if ( FILESYSTEM_CHANGED_TB (p_s_tb) ) {
 	    decrement_bcount(*pp_s_com_father);
 	    return REPEAT_SEARCH;
@@ -1874,7 +1869,7 @@ static int  get_direct_parent(
 	return REPEAT_SEARCH;
 
     if ( buffer_locked(p_s_bh) ) {
-	__wait_on_buffer(p_s_bh);
+	reiserfs_wait_on_buffer(p_s_tb->tb_sb, p_s_bh);
 	if ( FILESYSTEM_CHANGED_TB (p_s_tb) )
 	    return REPEAT_SEARCH;
     }
@@ -1883,6 +1878,28 @@ static int  get_direct_parent(
 }
 
 
+/* sb_bread() that gives up the write lock while it waits for the read.
+ * The caller must check FILESYSTEM_CHANGED_TB afterwards, as it does
+ * after any other sleep.
+ */
+static struct buffer_head *get_neighbor_bh(struct super_block *p_s_sb,
+					   unsigned long n_block)
+{
+    struct buffer_head *p_s_bh = sb_getblk(p_s_sb, n_block);
+
+    if (p_s_bh && !buffer_uptodate(p_s_bh)) {
+	int depth = reiserfs_write_unlock_nested(p_s_sb);
+	ll_rw_block(READ, 1, &p_s_bh);
+	wait_on_buffer(p_s_bh);
+	reiserfs_write_lock_nested(p_s_sb, depth);
+	if (!buffer_uptodate(p_s_bh)) {
+	    brelse(p_s_bh);
+	    return NULL;
+	}
+    }
+    return p_s_bh;
+}
+
 /* Using lnum[n_h] and rnum[n_h] we should determine what neighbors
  * of S[n_h] we
  * need in order to balance S[n_h], and get them if necessary.
@@ -1913,7 +1930,7 @@ static int  get_neighbors(
 
 	n_child_position = ( p_s_bh == p_s_tb->FL[n_h] ) ? p_s_tb->lkey[n_h] : B_NR_ITEMS (p_s_tb->FL[n_h]);
 	n_son_number = B_N_CHILD_NUM(p_s_tb->FL[n_h], n_child_position);
-	p_s_bh = sb_bread(p_s_sb, n_son_number);
+	p_s_bh = get_neighbor_bh(p_s_sb, n_son_number);
 	if (!p_s_bh)
 	    return IO_ERROR;
 	if ( FILESYSTEM_CHANGED_TB (p_s_tb) ) {
@@ -1946,7 +1963,7 @@ static int  get_neighbors(
 
 	n_child_position = ( p_s_bh == p_s_tb->FR[n_h] ) ? p_s_tb->rkey[n_h] + 1 : 0;
 	n_son_number = B_N_CHILD_NUM(p_s_tb->FR[n_h], n_child_position);
-	p_s_bh = sb_bread(p_s_sb, n_son_number);
+	p_s_bh = get_neighbor_bh(p_s_sb, n_son_number);
 	if (!p_s_bh)
 	    return IO_ERROR;
 	if ( FILESYSTEM_CHANGED_TB (p_s_tb) ) {
@@ -2061,7 +2078,11 @@ static int get_mem_for_virtual_node (struct tree_balance * tb)
 		tb->vn_buf_size = 0;
 	    }
 	    tb->vn_buf = buf;
-	    schedule() ;
+	    {
+		int depth = reiserfs_write_unlock_nested(tb->tb_sb);
+		schedule() ;
+		reiserfs_write_lock_nested(tb->tb_sb, depth);
+	    }
 	    return REPEAT_SEARCH;
 	}
 
@@ -2227,7 +2248,7 @@ static int wait_tb_buffers_until_unlocked (struct tree_balance * p_s_tb)
 		return ( FILESYSTEM_CHANGED_TB (p_s_tb) ) ? REPEAT_SEARCH : CARRY_ON;
 	    }
 #endif
-	    __wait_on_buffer (locked);
+	    reiserfs_wait_on_buffer (p_s_tb->tb_sb, locked);
 	    if ( FILESYSTEM_CHANGED_TB (p_s_tb) ) {
 		return REPEAT_SEARCH;
 	    }
@@ -2305,13 +2326,13 @@ int fix_nodes (int n_op_mode,
 
     /* if it possible in indirect_to_direct conversion */
     if (buffer_locked (p_s_tbS0)) {
-        __wait_on_buffer (p_s_tbS0);
+        reiserfs_wait_on_buffer (p_s_tb->tb_sb, p_s_tbS0);
         if ( FILESYSTEM_CHANGED_TB (p_s_tb) )
             return REPEAT_SEARCH;
     }
 
 #ifdef CONFIG_REISERFS_CHECK
-    if ( cur_tb ) {
+    if ( REISERFS_SB(p_s_tb->tb_sb)->cur_tb ) {
 	print_cur_tb ("fix_nodes");
 	reiserfs_panic(p_s_tb->tb_sb,"PAP-8305: fix_nodes:  there is pending do_balance");
     }
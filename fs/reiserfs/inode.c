@@ -35,9 +35,14 @@ void reiserfs_delete_inode (struct inode * inode)
 
     /* The = 0 happens when we abort creating a new inode for some reason like lack of space.. */
     if (!(inode->i_state & I_NEW) && INODE_PKEY(inode)->k_objectid != 0) { /* also handles bad_inode case */
+	int depth;
+
+	/* i_sem and the xattr code rank above the write lock */
+	depth = reiserfs_write_unlock_nested(inode->i_sb);
 	down (&inode->i_sem); 
 
 	reiserfs_delete_xattrs (inode);
+	reiserfs_write_lock_nested(inode->i_sb, depth);
 
 	if (journal_begin(&th, inode->i_sb, jbegin_count)) {
 	    up (&inode->i_sem);
@@ -474,10 +479,10 @@ static int reiserfs_get_blocks_direct_io(struct inode *inode,
        disappeared */
     if (REISERFS_I(inode)->i_flags & i_pack_on_close_mask) {
         int err;
-        lock_kernel();
+        reiserfs_write_lock(inode->i_sb);
         err = reiserfs_commit_for_inode(inode);
         REISERFS_I(inode)->i_flags &= ~i_pack_on_close_mask;
-        unlock_kernel();
+        reiserfs_write_unlock(inode->i_sb);
         if (err < 0)
             ret = err;
     }
@@ -518,7 +523,9 @@ static int convert_tail_for_hole(struct inode *inode,
        that we cannot get here if we write with O_DIRECT into
        tail page */
     if (!hole_page || index != hole_page->index) {
+	int depth = reiserfs_write_unlock_nested(inode->i_sb);
 	tail_page = grab_cache_page(inode->i_mapping, index) ;
+	reiserfs_write_lock_nested(inode->i_sb, depth);
 	retval = -ENOMEM;
 	if (!tail_page) {
 	    goto out ;
@@ -1907,6 +1914,7 @@ static int grab_tail_page(struct inode *p_s_inode,
     struct buffer_head *head ;
     struct page * page ;
     int error ;
+    int depth;
     
     /* we know that we are only called with inode->i_size > 0.
     ** we also know that a file tail can never be as big as a block
@@ -1916,7 +1924,10 @@ static int grab_tail_page(struct inode *p_s_inode,
     if ((offset & (blocksize - 1)) == 0) {
         return -ENOENT ;
     }
+    /* the page lock ranks above the write lock */
+    depth = reiserfs_write_unlock_nested(p_s_inode->i_sb);
     page = grab_cache_page(p_s_inode->i_mapping, index) ;
+    reiserfs_write_lock_nested(p_s_inode->i_sb, depth);
     error = -ENOMEM ;
     if (!page) {
         goto out ;
@@ -2750,7 +2761,10 @@ int reiserfs_setattr(struct dentry *dentry, struct iattr *attr) {
     struct inode *inode = dentry->d_inode ;
     int error ;
     unsigned int ia_valid = attr->ia_valid;
-    reiserfs_write_lock(inode->i_sb);
+
+    /* the write lock ranks below the page locks generic_cont_expand and
+    ** inode_setattr take, so it is only held around the transactions here
+    */
     if (attr->ia_valid & ATTR_SIZE) {
 	/* version 2 items will be caught by the s_maxbytes check
 	** done for us in vmtruncate
@@ -2767,11 +2781,13 @@ int reiserfs_setattr(struct dentry *dentry, struct iattr *attr) {
 		int err;
 		struct reiserfs_transaction_handle th ;
 		/* we're changing at most 2 bitmaps, inode + super */
+		reiserfs_write_lock(inode->i_sb);
 		err = journal_begin(&th, inode->i_sb, 4) ;
 		if (!err) {
 		    reiserfs_discard_prealloc (&th, inode);
 		    err = journal_end(&th, inode->i_sb, 4) ;
 		}
+		reiserfs_write_unlock(inode->i_sb);
 		if (err)
 		    error = err;
 	    }
@@ -2798,10 +2814,12 @@ int reiserfs_setattr(struct dentry *dentry, struct iattr *attr) {
 		    struct reiserfs_transaction_handle th;
 
 		    /* (user+group)*(old+new) structure - we count quota info and , inode write (sb, inode) */
+		    reiserfs_write_lock(inode->i_sb);
 		    journal_begin(&th, inode->i_sb, 4*REISERFS_QUOTA_INIT_BLOCKS+2);
                     error = DQUOT_TRANSFER(inode, attr) ? -EDQUOT : 0;
 		    if (error) {
 			journal_end(&th, inode->i_sb, 4*REISERFS_QUOTA_INIT_BLOCKS+2);
+			reiserfs_write_unlock(inode->i_sb);
 			goto out;
 		    }
 		    /* Update corresponding info in inode so that everything is in
@@ -2812,6 +2830,7 @@ int reiserfs_setattr(struct dentry *dentry, struct iattr *attr) {
 			inode->i_gid = attr->ia_gid;
 		    mark_inode_dirty(inode);
 		    journal_end(&th, inode->i_sb, 4*REISERFS_QUOTA_INIT_BLOCKS+2);
+		    reiserfs_write_unlock(inode->i_sb);
 		}
         }
         if (!error)
@@ -2825,7 +2844,6 @@ int reiserfs_setattr(struct dentry *dentry, struct iattr *attr) {
     }
 
 out:
-    reiserfs_write_unlock(inode->i_sb);
     return error ;
 }
 
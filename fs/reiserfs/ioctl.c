@@ -97,6 +97,7 @@ static int reiserfs_unpack (struct inode * inode, struct file * filp)
     struct address_space *mapping ;
     unsigned long write_from ;
     unsigned long blocksize = inode->i_sb->s_blocksize ;
+    int depth;
     	
     if (inode->i_size == 0) {
         REISERFS_I(inode)->i_flags |= i_nopack_mask;
@@ -106,12 +107,11 @@ static int reiserfs_unpack (struct inode * inode, struct file * filp)
     if (REISERFS_I(inode)->i_flags & i_nopack_mask) {
         return 0 ;
     }
-    reiserfs_write_lock(inode->i_sb);
-
     /* we need to make sure nobody is changing the file size beneath
     ** us
     */
     down(&inode->i_sem) ;
+    reiserfs_write_lock(inode->i_sb);
 
     write_from = inode->i_size & (blocksize - 1) ;
     /* if we are on a block boundary, we are already unpacked.  */
@@ -126,7 +126,10 @@ static int reiserfs_unpack (struct inode * inode, struct file * filp)
     */
     index = inode->i_size >> PAGE_CACHE_SHIFT ;
     mapping = inode->i_mapping ;
+    /* the page lock ranks above the write lock */
+    depth = reiserfs_write_unlock_nested(inode->i_sb);
     page = grab_cache_page(mapping, index) ;
+    reiserfs_write_lock_nested(inode->i_sb, depth);
     retval = -ENOMEM;
     if (!page) {
         goto out ;
@@ -145,7 +148,7 @@ out_unlock:
     page_cache_release(page) ;
 
 out:
-    up(&inode->i_sem) ;
     reiserfs_write_unlock(inode->i_sb);
+    up(&inode->i_sem) ;
     return retval;
 }
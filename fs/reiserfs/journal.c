@@ -177,7 +177,9 @@ repeat:
   }
   bn = allocate_bitmap_node(p_s_sb) ;
   if (!bn) {
+    int depth = reiserfs_write_unlock_nested(p_s_sb);
     yield();
+    reiserfs_write_lock_nested(p_s_sb, depth);
     goto repeat ;
   }
   return bn ;
@@ -406,19 +408,6 @@ static void clear_prepared_bits(struct buffer_head *bh) {
   clear_buffer_journal_restore_dirty (bh);
 }
 
-/* utility function to force a BUG if it is called without the big
-** kernel lock held.  caller is the string printed just before calling BUG()
-*/
-void reiserfs_check_lock_depth(struct super_block *sb, char *caller) {
-#ifdef CONFIG_SMP
-  if (current->lock_depth < 0) {
-    reiserfs_panic (sb, "%s called without kernel lock held", caller) ;
-  }
-#else
-  ;
-#endif
-}
-
 /* return a cnode with same dev, block number and size in table, or null if not found */
 static inline struct reiserfs_journal_cnode *
 get_journal_hash_dev(struct super_block *sb,
@@ -517,7 +506,7 @@ static inline void insert_journal_hash(struct reiserfs_journal_cnode **table, st
 /* lock the current transaction */
 inline static void lock_journal(struct super_block *p_s_sb) {
     PROC_INFO_INC( p_s_sb, journal.lock_journal );
-    down(&SB_JOURNAL(p_s_sb)->j_lock);
+    reiserfs_down_safe(p_s_sb, &SB_JOURNAL(p_s_sb)->j_lock);
 }
 
 /* unlock the current transaction */
@@ -911,6 +900,7 @@ static int flush_commit_list(struct super_block *s, struct reiserfs_journal_list
   struct reiserfs_journal *journal = SB_JOURNAL (s);
   int barrier = 0;
   int retval = 0;
+  int depth;
 
   reiserfs_check_lock_depth(s, "flush_commit_list") ;
 
@@ -933,7 +923,7 @@ static int flush_commit_list(struct super_block *s, struct reiserfs_journal_list
   }
 
   /* make sure nobody is trying to flush this one at the same time */
-  down(&jl->j_commit_lock);
+  reiserfs_down_safe(s, &jl->j_commit_lock);
   if (!journal_list_still_alive(s, trans_id)) {
     up(&jl->j_commit_lock);
     goto put_jl;
@@ -949,11 +939,15 @@ static int flush_commit_list(struct super_block *s, struct reiserfs_journal_list
     goto put_jl;
   }
 
+  /*
+   * from here until the commit block is on disk, everything we do is
+   * covered by j_commit_lock, so the write lock can go while we wait for
+   * the log blocks
+   */
+  depth = reiserfs_write_unlock_nested(s);
   if (!list_empty(&jl->j_bh_list)) {
-      unlock_kernel();
       write_ordered_buffers(&journal->j_dirty_buffers_lock,
                             journal, jl, &jl->j_bh_list);
-      lock_kernel();
   }
   BUG_ON (!list_empty(&jl->j_bh_list));
   /*
@@ -1015,6 +1009,7 @@ static int flush_commit_list(struct super_block *s, struct reiserfs_journal_list
       sync_dirty_buffer(jl->j_commit_bh) ;
   } else
       wait_on_buffer(jl->j_commit_bh);
+  reiserfs_write_lock_nested(s, depth);
 
   check_barrier_completion(s, jl->j_commit_bh);
 
@@ -1118,13 +1113,14 @@ static void remove_all_from_journal_list(struct super_block *p_s_sb, struct reis
 static int _update_journal_header_block(struct super_block *p_s_sb, unsigned long offset, unsigned long trans_id) {
   struct reiserfs_journal_header *jh ;
   struct reiserfs_journal *journal = SB_JOURNAL (p_s_sb);
+  int depth;
 
   if (reiserfs_is_journal_aborted (journal))
     return -EIO;
 
   if (trans_id >= journal->j_last_flush_trans_id) {
     if (buffer_locked((journal->j_header_bh)))  {
-      wait_on_buffer((journal->j_header_bh)) ;
+      reiserfs_wait_on_buffer(p_s_sb, journal->j_header_bh) ;
       if (unlikely (!buffer_uptodate(journal->j_header_bh))) {
 #ifdef CONFIG_REISERFS_CHECK
         reiserfs_warning (p_s_sb, "journal-699: buffer write failed") ;
@@ -1139,6 +1135,8 @@ static int _update_journal_header_block(struct super_block *p_s_sb, unsigned lon
     jh->j_first_unflushed_offset = cpu_to_le32(offset) ;
     jh->j_mount_id = cpu_to_le32(journal->j_mount_id) ;
 
+    /* our caller holds j_flush_sem, nobody else writes the header */
+    depth = reiserfs_write_unlock_nested(p_s_sb);
     if (reiserfs_barrier_flush(p_s_sb)) {
 	int ret;
 	lock_buffer(journal->j_header_bh);
@@ -1155,6 +1153,7 @@ sync:
 	set_buffer_dirty(journal->j_header_bh) ;
 	sync_dirty_buffer(journal->j_header_bh) ;
     }
+    reiserfs_write_lock_nested(p_s_sb, depth);
     if (!buffer_uptodate(journal->j_header_bh)) {
       reiserfs_warning (p_s_sb, "journal-837: IO error during journal replay");
       return -EIO ;
@@ -1240,7 +1239,7 @@ static int flush_journal_list(struct super_block *s,
 
   /* if flushall == 0, the lock is already held */
   if (flushall) {
-      down(&journal->j_flush_sem);
+      reiserfs_down_safe(s, &journal->j_flush_sem);
   } else if (!down_trylock(&journal->j_flush_sem)) {
       BUG();
   }
@@ -1373,7 +1372,7 @@ free_cnode:
 	if (!cn->bh) {
 	  reiserfs_panic(s, "journal-1011: cn->bh is NULL\n") ;
 	}
-	wait_on_buffer(cn->bh) ;
+	reiserfs_wait_on_buffer(s, cn->bh) ;
 	if (!cn->bh) {
 	  reiserfs_panic(s, "journal-1012: cn->bh is NULL\n") ;
 	}
@@ -1553,7 +1552,7 @@ static int kupdate_transactions(struct super_block *s,
     struct reiserfs_journal *journal = SB_JOURNAL (s);
     chunk.nr = 0;
 
-    down(&journal->j_flush_sem);
+    reiserfs_down_safe(s, &journal->j_flush_sem);
     if (!journal_list_still_alive(s, orig_trans_id)) {
 	goto done;
     }
@@ -1717,6 +1716,7 @@ static int do_journal_release(struct reiserfs_transaction_handle *th, struct sup
   struct reiserfs_transaction_handle myth ;
   int flushed = 0;
   struct reiserfs_journal *journal = SB_JOURNAL(p_s_sb);
+  int depth;
 
   /* we only want to flush out transactions if we were called with error == 0
   */
@@ -1744,14 +1744,21 @@ static int do_journal_release(struct reiserfs_transaction_handle *th, struct sup
       }
   }
 
+  /* wait for all commits to finish.  The commit work takes the write
+  ** lock, so we can't hold it here.  The write lock is per filesystem,
+  ** the kernel lock still guards the shared workqueue
+  */
+  depth = reiserfs_write_unlock_nested(p_s_sb);
+  lock_kernel();
   reiserfs_mounted_fs_count-- ;
-  /* wait for all commits to finish */
   cancel_delayed_work(&SB_JOURNAL(p_s_sb)->j_work);
   flush_workqueue(commit_wq);
   if (!reiserfs_mounted_fs_count) {
     destroy_workqueue(commit_wq);
     commit_wq = NULL;
   }
+  unlock_kernel();
+  reiserfs_write_lock_nested(p_s_sb, depth);
 
   free_journal_ram(p_s_sb) ;
 
@@ -2228,7 +2235,9 @@ static struct reiserfs_journal_list *alloc_journal_list(struct super_block *s)
 retry:
     jl = reiserfs_kmalloc(sizeof(struct reiserfs_journal_list), GFP_NOFS, s);
     if (!jl) {
+	int depth = reiserfs_write_unlock_nested(s);
 	yield();
+	reiserfs_write_lock_nested(s, depth);
 	goto retry;
     }
     memset(jl, 0, sizeof(*jl));
@@ -2510,9 +2519,11 @@ int journal_init(struct super_block *p_s_sb, const char * j_dev_name, int old_fo
     goto free_and_return;
   }
 
+  lock_kernel();
   reiserfs_mounted_fs_count++ ;
   if (reiserfs_mounted_fs_count <= 1)
     commit_wq = create_workqueue("reiserfs");
+  unlock_kernel();
 
   INIT_WORK(&journal->j_work, flush_async_commits, p_s_sb);
   return 0 ;
@@ -2564,12 +2575,14 @@ void reiserfs_allow_writes(struct super_block *s) {
 }
 
 /* this must be called without a transaction started, and does not
-** require BKL
+** require the write lock.  If it is held, it is dropped while we wait.
 */
 void reiserfs_wait_on_write_block(struct super_block *s) {
     struct reiserfs_journal *journal = SB_JOURNAL (s);
+    int depth = reiserfs_write_unlock_nested(s);
     wait_event(journal->j_join_wait,
                !test_bit(J_WRITERS_BLOCKED, &journal->j_state)) ;
+    reiserfs_write_lock_nested(s, depth);
 }
 
 static void queue_log_writer(struct super_block *s) {
@@ -2584,8 +2597,11 @@ static void queue_log_writer(struct super_block *s) {
     init_waitqueue_entry(&wait, current);
     add_wait_queue(&journal->j_join_wait, &wait);
     set_current_state(TASK_UNINTERRUPTIBLE);
-    if (test_bit(J_WRITERS_QUEUED, &journal->j_state))
+    if (test_bit(J_WRITERS_QUEUED, &journal->j_state)) {
+        int depth = reiserfs_write_unlock_nested(s);
         schedule();
+        reiserfs_write_lock_nested(s, depth);
+    }
     current->state = TASK_RUNNING;
     remove_wait_queue(&journal->j_join_wait, &wait);
 }
@@ -2602,8 +2618,12 @@ static void let_transaction_grow(struct super_block *sb,
     struct reiserfs_journal *journal = SB_JOURNAL (sb);
     unsigned long bcount = journal->j_bcount;
     while(1) {
+	int depth;
+
+	depth = reiserfs_write_unlock_nested(sb);
 	set_current_state(TASK_UNINTERRUPTIBLE);
 	schedule_timeout(1);
+	reiserfs_write_lock_nested(sb, depth);
 	journal->j_current_jl->j_state |= LIST_COMMIT_PENDING;
         while ((atomic_read(&journal->j_wcount) > 0 ||
 	        atomic_read(&journal->j_jlock)) &&
@@ -3094,14 +3114,14 @@ static void flush_async_commits(void *p) {
   struct reiserfs_journal_list *jl;
   struct list_head *entry;
 
-  lock_kernel();
+  reiserfs_write_lock(p_s_sb);
   if (!list_empty(&journal->j_journal_list)) {
       /* last entry is the youngest, commit it and you get everything */
       entry = journal->j_journal_list.prev;
       jl = JOURNAL_LIST_ENTRY(entry);
       flush_commit_list(p_s_sb, jl, 1);
   }
-  unlock_kernel();
+  reiserfs_write_unlock(p_s_sb);
   /*
    * this is a little racey, but there's no harm in missing
    * the filemap_fdata_write
@@ -3449,7 +3469,6 @@ void reiserfs_restore_prepared_buffer(struct super_block *p_s_sb,
     clear_buffer_journal_prepared (bh);
 }
 
-extern struct tree_balance *cur_tb ;
 /*
 ** before we can change a metadata block, we have to make sure it won't
 ** be written to disk while we are altering it.  So, we must:
@@ -3598,7 +3617,7 @@ static int do_journal_end(struct reiserfs_transaction_handle *th, struct super_b
    * the new transaction is fully setup, and we've already flushed the
    * ordered bh list
    */
-  down(&jl->j_commit_lock);
+  reiserfs_down_safe(p_s_sb, &jl->j_commit_lock);
 
   /* save the transaction id in case we need to commit it later */
   commit_trans_id = jl->j_trans_id;
@@ -3744,10 +3763,10 @@ static int do_journal_end(struct reiserfs_transaction_handle *th, struct super_b
    * is lost.
    */
   if (!list_empty(&jl->j_tail_bh_list)) {
-      unlock_kernel();
+      int depth = reiserfs_write_unlock_nested(p_s_sb);
       write_ordered_buffers(&journal->j_dirty_buffers_lock,
 			    journal, jl, &jl->j_tail_bh_list);
-      lock_kernel();
+      reiserfs_write_lock_nested(p_s_sb, depth);
   }
   if (!list_empty(&jl->j_tail_bh_list))
       BUG();
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2000 by Hans Reiser, licensing governed by reiserfs/README
+ */
+
+/*
+ * The per-superblock write lock.
+ *
+ * This used to be the big kernel lock, and the code still relies on the
+ * properties the BKL gave it: the lock may be taken recursively by its
+ * owner, and it goes away while the owner sleeps.  The first property is
+ * kept here by recording the owner and a depth.  The second is not
+ * automatic any more: everything that can sleep for I/O, for another
+ * transaction or for a page lock while holding the write lock must give
+ * it up around the sleep with reiserfs_write_unlock_nested() and take it
+ * back with reiserfs_write_lock_nested().  The tree may have changed by
+ * then, which is what fs_changed() and the generation counter are for.
+ *
+ * There is no mutex type in this kernel, so the lock is a semaphore.
+ */
+
+#include <linux/reiserfs_fs.h>
+#include <linux/sched.h>
+#include <asm/semaphore.h>
+
+void reiserfs_write_lock(struct super_block *s)
+{
+	struct reiserfs_sb_info *sb_i = REISERFS_SB(s);
+
+	if (sb_i->lock_owner != current) {
+		down(&sb_i->lock);
+		sb_i->lock_owner = current;
+	}
+
+	/* No need to protect it, only the owner can change it */
+	sb_i->lock_depth++;
+}
+
+void reiserfs_write_unlock(struct super_block *s)
+{
+	struct reiserfs_sb_info *sb_i = REISERFS_SB(s);
+
+	/*
+	 * Are we unlocking without even holding the lock?  Such a situation
+	 * must raise a BUG() if we don't want to corrupt the data.
+	 */
+	BUG_ON(sb_i->lock_owner != current);
+
+	if (--sb_i->lock_depth == -1) {
+		sb_i->lock_owner = NULL;
+		up(&sb_i->lock);
+	}
+}
+
+/*
+ * Drop the write lock completely, however deeply it is held, and return
+ * the depth to give back to reiserfs_write_lock_nested().  Returns -1,
+ * and does nothing, if the caller does not hold the lock.
+ */
+int reiserfs_write_unlock_nested(struct super_block *s)
+{
+	struct reiserfs_sb_info *sb_i = REISERFS_SB(s);
+	int depth;
+
+	/* this can happen when the lock isn't always held */
+	if (sb_i->lock_owner != current)
+		return -1;
+
+	depth = sb_i->lock_depth;
+
+	sb_i->lock_depth = -1;
+	sb_i->lock_owner = NULL;
+	up(&sb_i->lock);
+
+	return depth;
+}
+
+void reiserfs_write_lock_nested(struct super_block *s, int depth)
+{
+	struct reiserfs_sb_info *sb_i = REISERFS_SB(s);
+
+	/* this can happen when the lock isn't always held */
+	if (depth == -1)
+		return;
+
+	down(&sb_i->lock);
+	sb_i->lock_owner = current;
+	sb_i->lock_depth = depth;
+}
+
+/*
+ * Utility function to force a BUG if it is called without the superblock
+ * write lock held.  caller is the string printed just before calling BUG()
+ */
+void reiserfs_check_lock_depth(struct super_block *sb, char *caller)
+{
+	struct reiserfs_sb_info *sb_i = REISERFS_SB(sb);
+
+	if (sb_i->lock_depth < 0 || sb_i->lock_owner != current)
+		reiserfs_panic(sb, "%s called without the write lock held",
+			       caller);
+}
@@ -597,11 +597,12 @@ static int reiserfs_create (struct inode * dir, struct dentry *dentry, int mode,
 
     locked = reiserfs_cache_default_acl (dir);
 
-    reiserfs_write_lock(dir->i_sb);
-
+    /* the xattr semaphore ranks above the write lock */
     if (locked)
         reiserfs_write_lock_xattrs (dir->i_sb);
 
+    reiserfs_write_lock(dir->i_sb);
+
     retval = journal_begin(&th, dir->i_sb, jbegin_count);
     if (retval) {
         drop_new_inode (inode);
@@ -666,11 +667,12 @@ static int reiserfs_mknod (struct inode * dir, struct dentry *dentry, int mode,
 
     locked = reiserfs_cache_default_acl (dir);
 
-    reiserfs_write_lock(dir->i_sb);
-
+    /* the xattr semaphore ranks above the write lock */
     if (locked)
         reiserfs_write_lock_xattrs (dir->i_sb);
 
+    reiserfs_write_lock(dir->i_sb);
+
     retval = journal_begin(&th, dir->i_sb, jbegin_count) ;
     if (retval) {
         drop_new_inode (inode);
@@ -742,9 +744,10 @@ static int reiserfs_mkdir (struct inode * dir, struct dentry *dentry, int mode)
 
     locked = reiserfs_cache_default_acl (dir);
 
-    reiserfs_write_lock(dir->i_sb);
+    /* the xattr semaphore ranks above the write lock */
     if (locked)
         reiserfs_write_lock_xattrs (dir->i_sb);
+    reiserfs_write_lock(dir->i_sb);
 
     retval = journal_begin(&th, dir->i_sb, jbegin_count) ;
     if (retval) {
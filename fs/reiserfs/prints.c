@@ -11,6 +11,9 @@
 
 #include <stdarg.h>
 
+/* error_buf and fmt_buf are shared by every mount, and warnings come from
+   interrupt context too */
+static DEFINE_SPINLOCK(error_lock);
 static char error_buf[1024];
 static char fmt_buf[1024];
 static char off_buf[80];
@@ -266,41 +269,57 @@ prepare_error_buf( const char *fmt, va_list args )
 
 void reiserfs_warning (struct super_block *sb, const char * fmt, ...)
 {
+  unsigned long flags;
+
+  spin_lock_irqsave(&error_lock, flags);
   do_reiserfs_warning(fmt);
   if (sb)
       printk (KERN_WARNING "ReiserFS: %s: warning: %s\n",
              reiserfs_bdevname (sb), error_buf);
   else
       printk (KERN_WARNING "ReiserFS: warning: %s\n", error_buf);
+  spin_unlock_irqrestore(&error_lock, flags);
 }
 
 /* No newline.. reiserfs_info calls can be followed by printk's */
 void reiserfs_info (struct super_block *sb, const char * fmt, ...)
 {
+  unsigned long flags;
+
+  spin_lock_irqsave(&error_lock, flags);
   do_reiserfs_warning(fmt);
   if (sb)
       printk (KERN_NOTICE "ReiserFS: %s: %s",
              reiserfs_bdevname (sb), error_buf);
   else
       printk (KERN_NOTICE "ReiserFS: %s", error_buf);
+  spin_unlock_irqrestore(&error_lock, flags);
 }
 
 /* No newline.. reiserfs_printk calls can be followed by printk's */
 static void reiserfs_printk (const char * fmt, ...)
 {
+  unsigned long flags;
+
+  spin_lock_irqsave(&error_lock, flags);
   do_reiserfs_warning(fmt);
   printk (error_buf);
+  spin_unlock_irqrestore(&error_lock, flags);
 }
 
 void reiserfs_debug (struct super_block *s, int level, const char * fmt, ...)
 {
 #ifdef CONFIG_REISERFS_CHECK
+  unsigned long flags;
+
+  spin_lock_irqsave(&error_lock, flags);
   do_reiserfs_warning(fmt);
   if (s)
       printk (KERN_DEBUG "ReiserFS: %s: %s\n",
              reiserfs_bdevname (s), error_buf);
   else
       printk (KERN_DEBUG "ReiserFS: %s\n", error_buf);
+  spin_unlock_irqrestore(&error_lock, flags);
 #endif
 }
 
@@ -349,16 +368,16 @@ void reiserfs_debug (struct super_block *s, int level, const char * fmt, ...)
 
    .  */
 
-
-#ifdef CONFIG_REISERFS_CHECK
-extern struct tree_balance * cur_tb;
-#endif
-
 void reiserfs_panic (struct super_block * sb, const char * fmt, ...)
 {
+  unsigned long flags;
+
+  spin_lock_irqsave(&error_lock, flags);
   do_reiserfs_warning(fmt);
   printk (KERN_EMERG "REISERFS: panic (device %s): %s\n",
           reiserfs_bdevname (sb), error_buf);
+  /* BUG() only kills this task, don't leave the buffers locked */
+  spin_unlock_irqrestore(&error_lock, flags);
   BUG ();
 
   /* this is not actually called, but makes reiserfs_panic() "noreturn" */
@@ -369,6 +388,9 @@ void reiserfs_panic (struct super_block * sb, const char * fmt, ...)
 void
 reiserfs_abort (struct super_block *sb, int errno, const char *fmt, ...)
 {
+    unsigned long flags;
+
+    spin_lock_irqsave(&error_lock, flags);
     do_reiserfs_warning (fmt);
 
     if (reiserfs_error_panic (sb)) {
@@ -376,11 +398,14 @@ reiserfs_abort (struct super_block *sb, int errno, const char *fmt, ...)
                reiserfs_bdevname (sb), error_buf);
     }
 
-    if (sb->s_flags & MS_RDONLY)
+    if (sb->s_flags & MS_RDONLY) {
+        spin_unlock_irqrestore(&error_lock, flags);
         return;
+    }
 
     printk (KERN_CRIT "REISERFS: abort (device %s): %s\n",
             reiserfs_bdevname (sb), error_buf);
+    spin_unlock_irqrestore(&error_lock, flags);
 
     sb->s_flags |= MS_RDONLY;
     reiserfs_journal_abort (sb, errno);
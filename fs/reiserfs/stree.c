@@ -218,10 +218,6 @@ static inline	int bin_search (
     return ITEM_NOT_FOUND;
 }
 
-#ifdef CONFIG_REISERFS_CHECK
-extern struct tree_balance * cur_tb;
-#endif
-
 
 
 /* Minimal possible key. It is never in the tree. */
@@ -640,7 +636,7 @@ int search_by_key (struct super_block * p_s_sb,
 		                     reada_blocks, reada_count);
 	    }
 	    ll_rw_block(READ, 1, &p_s_bh);
-	    wait_on_buffer(p_s_bh);
+	    reiserfs_wait_on_buffer(p_s_sb, p_s_bh);
 	    if (!buffer_uptodate(p_s_bh))
 	        goto io_error;
 	} else {
@@ -683,7 +679,7 @@ io_error:
                 ! key_in_buffer(p_s_search_path, p_s_key, p_s_sb),
 		"PAP-5130: key is not in the buffer");
 #ifdef CONFIG_REISERFS_CHECK
-	if ( cur_tb ) {
+	if ( REISERFS_SB(p_s_sb)->cur_tb ) {
 	    print_cur_tb ("5140");
 	    reiserfs_panic(p_s_sb, "PAP-5140: search_by_key: schedule occurred in do_balance!");
 	}
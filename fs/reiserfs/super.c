@@ -429,6 +429,8 @@ static void reiserfs_put_super (struct super_block * s)
     dput (REISERFS_SB(s)->priv_root);
   }
 
+  reiserfs_write_lock(s);
+
   /* change file system state to current state if it was mounted with read-write permissions */
   if (!(s->s_flags & MS_RDONLY)) {
     if (!journal_begin(&th, s, 10)) {
@@ -442,6 +444,7 @@ static void reiserfs_put_super (struct super_block * s)
   ** to do a journal_end
   */
   journal_release(&th, s) ;
+  reiserfs_write_unlock(s);
 
   for (i = 0; i < SB_BMAP_NR (s); i ++)
     brelse (SB_AP_BITMAP (s)[i].bh);
@@ -587,6 +590,11 @@ static struct super_operations reiserfs_sops =
 
 static int reiserfs_dquot_initialize(struct inode *, int);
 static int reiserfs_dquot_drop(struct inode *);
+static int reiserfs_dquot_alloc_space(struct inode *, qsize_t, int);
+static int reiserfs_dquot_alloc_inode(const struct inode *, unsigned long);
+static int reiserfs_dquot_free_space(struct inode *, qsize_t);
+static int reiserfs_dquot_free_inode(const struct inode *, unsigned long);
+static int reiserfs_dquot_transfer(struct inode *, struct iattr *);
 static int reiserfs_write_dquot(struct dquot *);
 static int reiserfs_acquire_dquot(struct dquot *);
 static int reiserfs_release_dquot(struct dquot *);
@@ -598,11 +606,11 @@ static struct dquot_operations reiserfs_quota_operations =
 {
   .initialize = reiserfs_dquot_initialize,
   .drop = reiserfs_dquot_drop,
-  .alloc_space = dquot_alloc_space,
-  .alloc_inode = dquot_alloc_inode,
-  .free_space = dquot_free_space,
-  .free_inode = dquot_free_inode,
-  .transfer = dquot_transfer,
+  .alloc_space = reiserfs_dquot_alloc_space,
+  .alloc_inode = reiserfs_dquot_alloc_inode,
+  .free_space = reiserfs_dquot_free_space,
+  .free_inode = reiserfs_dquot_free_inode,
+  .transfer = reiserfs_dquot_transfer,
   .write_dquot = reiserfs_write_dquot,
   .acquire_dquot = reiserfs_acquire_dquot,
   .release_dquot = reiserfs_release_dquot,
@@ -1061,13 +1069,16 @@ static int reiserfs_remount (struct super_block * s, int * mount_flags, char * a
   unsigned long safe_mask = 0;
   unsigned int commit_max_age = (unsigned int)-1;
   struct reiserfs_journal *journal = SB_JOURNAL(s);
-  int err;
+  int err = 0;
+  int depth;
 #ifdef CONFIG_QUOTA
   int i;
 #endif
 
   rs = SB_DISK_SUPER_BLOCK (s);
 
+  reiserfs_write_lock(s);
+
   if (!reiserfs_parse_options(s, arg, &mount_options, &blocks, NULL, &commit_max_age)) {
 #ifdef CONFIG_QUOTA
     for (i = 0; i < MAXQUOTAS; i++)
@@ -1076,7 +1087,8 @@ static int reiserfs_remount (struct super_block * s, int * mount_flags, char * a
 	    REISERFS_SB(s)->s_qf_names[i] = NULL;
 	}
 #endif
-    return -EINVAL;
+    err = -EINVAL;
+    goto out;
   }
   
   handle_attrs(s);
@@ -1113,25 +1125,29 @@ static int reiserfs_remount (struct super_block * s, int * mount_flags, char * a
   }
 
   if(blocks) {
-    int rc = reiserfs_resize(s, blocks);
-    if (rc != 0)
-      return rc;
+    err = reiserfs_resize(s, blocks);
+    if (err != 0)
+      goto out;
   }
 
   if (*mount_flags & MS_RDONLY) {
+    /* the xattr setup takes i_sem on the root, which ranks above the
+    ** write lock */
+    depth = reiserfs_write_unlock_nested(s);
     reiserfs_xattr_init (s, *mount_flags);
+    reiserfs_write_lock_nested(s, depth);
     /* remount read-only */
     if (s->s_flags & MS_RDONLY)
       /* it is read-only already */
-      return 0;
+      goto out;
     /* try to remount file system with read-only permissions */
     if (sb_umount_state(rs) == REISERFS_VALID_FS || REISERFS_SB(s)->s_mount_state != REISERFS_VALID_FS) {
-      return 0;
+      goto out;
     }
 
     err = journal_begin(&th, s, 10) ;
     if (err)
-        return err;
+        goto out;
 
     /* Mounting a rw partition read-only. */
     reiserfs_prepare_for_journal(s, SB_BUFFER_WITH_SB(s), 1) ;
@@ -1140,12 +1156,16 @@ static int reiserfs_remount (struct super_block * s, int * mount_flags, char * a
   } else {
     /* remount read-write */
     if (!(s->s_flags & MS_RDONLY)) {
+	depth = reiserfs_write_unlock_nested(s);
 	reiserfs_xattr_init (s, *mount_flags);
-	return 0; /* We are read-write already */
+	reiserfs_write_lock_nested(s, depth);
+	goto out; /* We are read-write already */
     }
 
-    if (reiserfs_is_journal_aborted (journal))
-	return journal->j_errno;
+    if (reiserfs_is_journal_aborted (journal)) {
+	err = journal->j_errno;
+	goto out;
+    }
 
     handle_data_mode(s, mount_options);
     handle_barrier_mode(s, mount_options);
@@ -1153,7 +1173,7 @@ static int reiserfs_remount (struct super_block * s, int * mount_flags, char * a
     s->s_flags &= ~MS_RDONLY ; /* now it is safe to call journal_begin */
     err = journal_begin(&th, s, 10) ;
     if (err)
-	return err;
+	goto out;
     
     /* Mount a partition which is read-only, read-write */
     reiserfs_prepare_for_journal(s, SB_BUFFER_WITH_SB(s), 1) ;
@@ -1168,15 +1188,19 @@ static int reiserfs_remount (struct super_block * s, int * mount_flags, char * a
   SB_JOURNAL(s)->j_must_wait = 1 ;
   err = journal_end(&th, s, 10) ;
   if (err)
-    return err;
+    goto out;
   s->s_dirt = 0;
 
   if (!( *mount_flags & MS_RDONLY ) ) {
     finish_unfinished( s );
+    depth = reiserfs_write_unlock_nested(s);
     reiserfs_xattr_init (s, *mount_flags);
+    reiserfs_write_lock_nested(s, depth);
   }
 
-  return 0;
+out:
+  reiserfs_write_unlock(s);
+  return err;
 }
 
 /* load_bitmap_info_data - Sets up the reiserfs_bitmap_info structure from disk.
@@ -1582,6 +1606,11 @@ static int reiserfs_fill_super (struct super_block * s, void * data, int silent)
     }
     s->s_fs_info = sbi;
     memset (sbi, 0, sizeof (struct reiserfs_sb_info));
+    init_MUTEX(&sbi->lock);
+    sbi->lock_depth = -1;
+    /* nobody else can see this super block yet, but the journal code
+       insists on the write lock being held */
+    reiserfs_write_lock(s);
     /* Set default values for options: non-aggressive tails, RO on errors */
     REISERFS_SB(s)->s_mount_opt |= (1 << REISERFS_SMALLTAIL);
     REISERFS_SB(s)->s_mount_opt |= (1 << REISERFS_ERROR_RO);
@@ -1783,12 +1812,15 @@ static int reiserfs_fill_super (struct super_block * s, void * data, int silent)
     init_waitqueue_head (&(sbi->s_wait));
     spin_lock_init(&sbi->bitmap_lock);
 
+    reiserfs_write_unlock(s);
     return (0);
 
  error:
     if (jinit_done) { /* kill the commit thread, free journal ram */
 	journal_release_error(NULL, s) ;
     }
+    if (sbi)
+	reiserfs_write_unlock(s);
     if (SB_DISK_SUPER_BLOCK (s)) {
 	for (j = 0; j < SB_BMAP_NR (s); j ++) {
 	    if (SB_AP_BITMAP (s))
@@ -1832,12 +1864,14 @@ static int reiserfs_statfs (struct super_block * s, struct kstatfs * buf)
 static int reiserfs_dquot_initialize(struct inode *inode, int type)
 {
     struct reiserfs_transaction_handle th;
-    int ret;
+    int ret, depth;
 
     /* We may create quota structure so we need to reserve enough blocks */
     reiserfs_write_lock(inode->i_sb);
     journal_begin(&th, inode->i_sb, 2*REISERFS_QUOTA_INIT_BLOCKS);
+    depth = reiserfs_write_unlock_nested(inode->i_sb);
     ret = dquot_initialize(inode, type);
+    reiserfs_write_lock_nested(inode->i_sb, depth);
     journal_end(&th, inode->i_sb, 2*REISERFS_QUOTA_INIT_BLOCKS);
     reiserfs_write_unlock(inode->i_sb);
     return ret;
@@ -1846,25 +1880,87 @@ static int reiserfs_dquot_initialize(struct inode *inode, int type)
 static int reiserfs_dquot_drop(struct inode *inode)
 {
     struct reiserfs_transaction_handle th;
-    int ret;
+    int ret, depth;
 
     /* We may delete quota structure so we need to reserve enough blocks */
     reiserfs_write_lock(inode->i_sb);
     journal_begin(&th, inode->i_sb, 2*REISERFS_QUOTA_INIT_BLOCKS);
+    depth = reiserfs_write_unlock_nested(inode->i_sb);
     ret = dquot_drop(inode);
+    reiserfs_write_lock_nested(inode->i_sb, depth);
     journal_end(&th, inode->i_sb, 2*REISERFS_QUOTA_INIT_BLOCKS);
     reiserfs_write_unlock(inode->i_sb);
     return ret;
 }
 
+/*
+ * The generic quota code sleeps on its own locks and calls back into
+ * reiserfs_write_dquot() and friends, which take the write lock, so it must
+ * never be entered with the write lock held.
+ */
+static int reiserfs_dquot_alloc_space(struct inode *inode, qsize_t number,
+				      int warn)
+{
+    int depth, ret;
+
+    depth = reiserfs_write_unlock_nested(inode->i_sb);
+    ret = dquot_alloc_space(inode, number, warn);
+    reiserfs_write_lock_nested(inode->i_sb, depth);
+    return ret;
+}
+
+static int reiserfs_dquot_alloc_inode(const struct inode *inode,
+				      unsigned long number)
+{
+    int depth, ret;
+
+    depth = reiserfs_write_unlock_nested(inode->i_sb);
+    ret = dquot_alloc_inode(inode, number);
+    reiserfs_write_lock_nested(inode->i_sb, depth);
+    return ret;
+}
+
+static int reiserfs_dquot_free_space(struct inode *inode, qsize_t number)
+{
+    int depth, ret;
+
+    depth = reiserfs_write_unlock_nested(inode->i_sb);
+    ret = dquot_free_space(inode, number);
+    reiserfs_write_lock_nested(inode->i_sb, depth);
+    return ret;
+}
+
+static int reiserfs_dquot_free_inode(const struct inode *inode,
+				     unsigned long number)
+{
+    int depth, ret;
+
+    depth = reiserfs_write_unlock_nested(inode->i_sb);
+    ret = dquot_free_inode(inode, number);
+    reiserfs_write_lock_nested(inode->i_sb, depth);
+    return ret;
+}
+
+static int reiserfs_dquot_transfer(struct inode *inode, struct iattr *iattr)
+{
+    int depth, ret;
+
+    depth = reiserfs_write_unlock_nested(inode->i_sb);
+    ret = dquot_transfer(inode, iattr);
+    reiserfs_write_lock_nested(inode->i_sb, depth);
+    return ret;
+}
+
 static int reiserfs_write_dquot(struct dquot *dquot)
 {
     struct reiserfs_transaction_handle th;
-    int ret;
+    int ret, depth;
 
     reiserfs_write_lock(dquot->dq_sb);
     journal_begin(&th, dquot->dq_sb, REISERFS_QUOTA_TRANS_BLOCKS);
+    depth = reiserfs_write_unlock_nested(dquot->dq_sb);
     ret = dquot_commit(dquot);
+    reiserfs_write_lock_nested(dquot->dq_sb, depth);
     journal_end(&th, dquot->dq_sb, REISERFS_QUOTA_TRANS_BLOCKS);
     reiserfs_write_unlock(dquot->dq_sb);
     return ret;
@@ -1873,11 +1969,13 @@ static int reiserfs_write_dquot(struct dquot *dquot)
 static int reiserfs_acquire_dquot(struct dquot *dquot)
 {
     struct reiserfs_transaction_handle th;
-    int ret;
+    int ret, depth;
 
     reiserfs_write_lock(dquot->dq_sb);
     journal_begin(&th, dquot->dq_sb, REISERFS_QUOTA_INIT_BLOCKS);
+    depth = reiserfs_write_unlock_nested(dquot->dq_sb);
     ret = dquot_acquire(dquot);
+    reiserfs_write_lock_nested(dquot->dq_sb, depth);
     journal_end(&th, dquot->dq_sb, REISERFS_QUOTA_INIT_BLOCKS);
     reiserfs_write_unlock(dquot->dq_sb);
     return ret;
@@ -1886,11 +1984,13 @@ static int reiserfs_acquire_dquot(struct dquot *dquot)
 static int reiserfs_release_dquot(struct dquot *dquot)
 {
     struct reiserfs_transaction_handle th;
-    int ret;
+    int ret, depth;
 
     reiserfs_write_lock(dquot->dq_sb);
     journal_begin(&th, dquot->dq_sb, REISERFS_QUOTA_INIT_BLOCKS);
+    depth = reiserfs_write_unlock_nested(dquot->dq_sb);
     ret = dquot_release(dquot);
+    reiserfs_write_lock_nested(dquot->dq_sb, depth);
     journal_end(&th, dquot->dq_sb, REISERFS_QUOTA_INIT_BLOCKS);
     reiserfs_write_unlock(dquot->dq_sb);
     return ret;
@@ -1911,12 +2011,14 @@ static int reiserfs_mark_dquot_dirty(struct dquot *dquot)
 static int reiserfs_write_info(struct super_block *sb, int type)
 {
     struct reiserfs_transaction_handle th;
-    int ret;
+    int ret, depth;
 
     /* Data block + inode block */
     reiserfs_write_lock(sb);
     journal_begin(&th, sb, 2);
+    depth = reiserfs_write_unlock_nested(sb);
     ret = dquot_commit_info(sb, type);
+    reiserfs_write_lock_nested(sb, depth);
     journal_end(&th, sb, 2);
     reiserfs_write_unlock(sb);
     return ret;
@@ -2040,6 +2142,7 @@ static ssize_t reiserfs_quota_write(struct super_block *sb, int type,
     struct buffer_head tmp_bh, *bh;
 
     down(&inode->i_sem);
+    reiserfs_write_lock(sb);
     while (towrite > 0) {
 	tocopy = sb->s_blocksize - offset < towrite ?
 	         sb->s_blocksize - offset : towrite;
@@ -2071,13 +2174,17 @@ static ssize_t reiserfs_quota_write(struct super_block *sb, int type,
 	blk++;
     }
 out:
-    if (len == towrite)
+    if (len == towrite) {
+	reiserfs_write_unlock(sb);
+	up(&inode->i_sem);
 	return err;
+    }
     if (inode->i_size < off+len-towrite)
 	i_size_write(inode, off+len-towrite);
     inode->i_version++;
     inode->i_mtime = inode->i_ctime = CURRENT_TIME;
     mark_inode_dirty(inode);
+    reiserfs_write_unlock(sb);
     up(&inode->i_sem);
     return len - towrite;
 }
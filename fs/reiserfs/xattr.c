@@ -291,6 +291,7 @@ static int __xattr_readdir(struct file * filp, void * dirent, filldir_t filldir)
     off_t d_off;
     ino_t d_ino;
     struct reiserfs_dir_entry de;
+    int depth, res;
 
 
     /* form key for search the next directory entry using f_pos field of
@@ -391,8 +392,13 @@ research:
 	 */
 	pathrelse (&path_to_entry);
 
-	if (filldir (dirent, local_buf, d_reclen, d_off, d_ino,
-		     DT_UNKNOWN) < 0) {
+	/* nor can it run under the write lock, it takes i_sem on the
+	 * xattr files */
+	depth = reiserfs_write_unlock_nested(inode->i_sb);
+	res = filldir (dirent, local_buf, d_reclen, d_off, d_ino,
+		       DT_UNKNOWN);
+	reiserfs_write_lock_nested(inode->i_sb, depth);
+	if (res < 0) {
 	    if (local_buf != small_buf) {
 		reiserfs_kfree(local_buf, d_reclen, inode->i_sb) ;
 	    }
@@ -425,9 +431,9 @@ int xattr_readdir(struct file *file, filldir_t filler, void *buf)
 //        down(&inode->i_zombie);
         res = -ENOENT;
         if (!IS_DEADDIR(inode)) {
-                lock_kernel();
+                reiserfs_write_lock(inode->i_sb);
                 res = __xattr_readdir(file, buf, filler);
-                unlock_kernel();
+                reiserfs_write_unlock(inode->i_sb);
         }
 //        up(&inode->i_zombie);
         up(&inode->i_sem);
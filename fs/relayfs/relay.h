@@ -0,0 +1,22 @@
+#ifndef _RELAY_H
+#define _RELAY_H
+
+/*
+ * shared between relay.c and inode.c
+ */
+extern int relay_mmap_buf(struct rchan_buf *buf, struct vm_area_struct *vma);
+extern void relay_remove_buf(struct kref *kref);
+
+/**
+ *	relay_buf_empty - boolean, is the channel buffer empty?
+ *	@buf: channel buffer
+ *
+ *	Returns 1 if the buffer holds no completed sub-buffers that haven't
+ *	been consumed yet, 0 otherwise.
+ */
+static inline int relay_buf_empty(struct rchan_buf *buf)
+{
+	return (buf->subbufs_produced - buf->subbufs_consumed) ? 0 : 1;
+}
+
+#endif /* _RELAY_H */
@@ -0,0 +1,1147 @@
+/*
+ * "splice": joining two ropes together by interweaving their strands.
+ *
+ * This is the "extended pipe" functionality, where a pipe is used as
+ * an arbitrary in-memory buffer.  Think of a pipe as a small kernel
+ * buffer that you can use to transfer data from one end to the other.
+ *
+ * The traditional unix read/write is extended with a "splice()" operation
+ * that transfers data buffers to or from a pipe buffer, and "tee()", which
+ * duplicates the buffers of one pipe into another.
+ *
+ * Reading from a file puts references to its page cache pages into the
+ * pipe, so nothing is copied.  Writing to a socket hands the pipe's pages
+ * to ->sendpage(), which does not copy either.  Writing to a file copies
+ * each buffer into the page cache with ->prepare_write()/->commit_write().
+ */
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/pagemap.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/mm_inline.h>
+#include <linux/swap.h>
+#include <linux/writeback.h>
+#include <linux/buffer_head.h>
+#include <linux/highmem.h>
+#include <linux/module.h>
+#include <linux/security.h>
+#include <linux/syscalls.h>
+#include <linux/uio.h>
+
+#include <asm/uaccess.h>
+
+/*
+ * Passed to the actors
+ */
+struct splice_desc {
+	unsigned int len;		/* current length */
+	size_t total_len;		/* remaining length */
+	unsigned int flags;		/* splice flags */
+	union {
+		struct file *file;	/* file to read/write */
+		void __user *userptr;	/* memory to write to */
+	} u;
+	loff_t pos;			/* file position */
+};
+
+/*
+ * The pages to add to a pipe, each with the part of it that holds data
+ */
+struct partial_page {
+	unsigned int offset;
+	unsigned int len;
+};
+
+struct splice_pipe_desc {
+	struct page **pages;		/* page map */
+	struct partial_page *partial;	/* pages[] may not be contig */
+	int nr_pages;			/* number of pages in map */
+	unsigned int flags;		/* splice flags */
+	struct pipe_buf_operations *ops;/* ops associated with output pipe */
+};
+
+typedef int (splice_actor)(struct pipe_inode_info *, struct pipe_buffer *,
+			   struct splice_desc *);
+
+/*
+ * Page cache pages in a pipe may still be under read when they are
+ * added, so ->map() waits for them.
+ */
+static void *page_cache_pipe_buf_map(struct file *file,
+				     struct pipe_inode_info *info,
+				     struct pipe_buffer *buf)
+{
+	struct page *page = buf->page;
+
+	if (!PageUptodate(page)) {
+		wait_on_page_locked(page);
+		if (!PageUptodate(page))
+			return ERR_PTR(-EIO);
+	}
+
+	return kmap(page);
+}
+
+static void page_cache_pipe_buf_unmap(struct pipe_inode_info *info,
+				      struct pipe_buffer *buf)
+{
+	kunmap(buf->page);
+}
+
+static void page_cache_pipe_buf_release(struct pipe_inode_info *info,
+					struct pipe_buffer *buf)
+{
+	page_cache_release(buf->page);
+}
+
+static void page_cache_pipe_buf_get(struct pipe_inode_info *info,
+				    struct pipe_buffer *buf)
+{
+	page_cache_get(buf->page);
+}
+
+static struct pipe_buf_operations page_cache_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = page_cache_pipe_buf_map,
+	.unmap = page_cache_pipe_buf_unmap,
+	.release = page_cache_pipe_buf_release,
+	.get = page_cache_pipe_buf_get,
+};
+
+/*
+ * Pipe output worker.  This fills the pipe with the pages of @spd, with
+ * its pipe buffer operations.  Otherwise very similar to the regular
+ * pipe_writev().  The references to the pages not added to the pipe are
+ * dropped.
+ */
+static ssize_t move_to_pipe(struct inode *inode, struct splice_pipe_desc *spd)
+{
+	struct pipe_inode_info *info;
+	int do_wakeup, i;
+	ssize_t ret;
+
+	ret = 0;
+	do_wakeup = 0;
+	i = 0;
+
+	down(PIPE_SEM(*inode));
+
+	info = inode->i_pipe;
+	for (;;) {
+		int bufs;
+
+		if (!PIPE_READERS(*inode)) {
+			send_sig(SIGPIPE, current, 0);
+			if (!ret)
+				ret = -EPIPE;
+			break;
+		}
+
+		bufs = info->nrbufs;
+		if (bufs < info->buffers) {
+			int newbuf = (info->curbuf + bufs) & (info->buffers - 1);
+			struct pipe_buffer *buf = info->bufs + newbuf;
+
+			buf->page = spd->pages[i];
+			buf->offset = spd->partial[i].offset;
+			buf->len = spd->partial[i].len;
+			buf->ops = spd->ops;
+			buf->flags = 0;
+			if (spd->flags & SPLICE_F_GIFT)
+				buf->flags |= PIPE_BUF_FLAG_GIFT;
+			info->nrbufs = ++bufs;
+			do_wakeup = 1;
+
+			ret += buf->len;
+			if (++i == spd->nr_pages)
+				break;
+			if (bufs < info->buffers)
+				continue;
+		}
+
+		if (spd->flags & SPLICE_F_NONBLOCK) {
+			if (!ret)
+				ret = -EAGAIN;
+			break;
+		}
+
+		if (signal_pending(current)) {
+			if (!ret)
+				ret = -ERESTARTSYS;
+			break;
+		}
+
+		if (do_wakeup) {
+			wake_up_interruptible_sync(PIPE_WAIT(*inode));
+			kill_fasync(PIPE_FASYNC_READERS(*inode), SIGIO,
+				    POLL_IN);
+			do_wakeup = 0;
+		}
+
+		PIPE_WAITING_WRITERS(*inode)++;
+		pipe_wait(inode);
+		PIPE_WAITING_WRITERS(*inode)--;
+	}
+
+	up(PIPE_SEM(*inode));
+
+	if (do_wakeup) {
+		wake_up_interruptible(PIPE_WAIT(*inode));
+		kill_fasync(PIPE_FASYNC_READERS(*inode), SIGIO, POLL_IN);
+	}
+
+	while (i < spd->nr_pages)
+		page_cache_release(spd->pages[i++]);
+
+	return ret;
+}
+
+/**
+ * generic_file_splice_read - splice data from file to a pipe
+ * @in:		file to splice from
+ * @ppos:	position in @in
+ * @pipe:	pipe to splice to
+ * @len:	number of bytes to splice
+ * @flags:	splice modifier flags
+ *
+ * Will read pages from given file and fill them into a pipe, up to one
+ * pipe's worth at a time.  Reads are only started here: the pipe buffer
+ * waits for each page when it is first looked at.
+ */
+ssize_t generic_file_splice_read(struct file *in, loff_t *ppos,
+				 struct inode *pipe, size_t len,
+				 unsigned int flags)
+{
+	struct address_space *mapping = in->f_mapping;
+	struct page *pages[PIPE_BUFFERS];
+	struct partial_page partial[PIPE_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.flags = flags,
+		.ops = &page_cache_pipe_buf_ops,
+	};
+	unsigned long index, offset, nr_pages, i;
+	loff_t isize;
+	ssize_t ret;
+	int error = 0;
+
+	isize = i_size_read(mapping->host);
+	if (*ppos >= isize)
+		return 0;
+	if (len > isize - *ppos)
+		len = isize - *ppos;
+
+	index = *ppos >> PAGE_CACHE_SHIFT;
+	offset = *ppos & ~PAGE_CACHE_MASK;
+	nr_pages = (len + offset + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	if (nr_pages > PIPE_BUFFERS)
+		nr_pages = PIPE_BUFFERS;
+
+	for (i = 0; i < nr_pages; i++, index++) {
+		struct page *page;
+find_page:
+		page = find_get_page(mapping, index);
+		if (!page) {
+			page_cache_sync_readahead(mapping, &in->f_ra, in,
+						  index, nr_pages - i);
+			page = find_get_page(mapping, index);
+		}
+		if (!page) {
+			page = page_cache_alloc_cold(mapping);
+			if (!page) {
+				error = -ENOMEM;
+				break;
+			}
+			error = add_to_page_cache_lru(page, mapping, index,
+						      GFP_KERNEL);
+			if (unlikely(error)) {
+				page_cache_release(page);
+				if (error == -EEXIST) {
+					error = 0;
+					goto find_page;
+				}
+				break;
+			}
+			/* the page is locked: start the read */
+			goto readpage;
+		}
+
+		if (PageReadahead(page))
+			page_cache_async_readahead(mapping, &in->f_ra, in, page,
+						   index, nr_pages - i);
+
+		if (!PageUptodate(page)) {
+			lock_page(page);
+			/* truncated under us */
+			if (!page->mapping) {
+				unlock_page(page);
+				page_cache_release(page);
+				goto find_page;
+			}
+			if (PageUptodate(page)) {
+				unlock_page(page);
+				goto page_ok;
+			}
+readpage:
+			error = mapping->a_ops->readpage(in, page);
+			if (unlikely(error)) {
+				page_cache_release(page);
+				break;
+			}
+		}
+page_ok:
+		mark_page_accessed(page);
+		pages[i] = page;
+		partial[i].offset = offset;
+		partial[i].len = min_t(unsigned long, len,
+				       PAGE_CACHE_SIZE - offset);
+		len -= partial[i].len;
+		offset = 0;
+	}
+
+	if (!i)
+		return error;
+
+	spd.nr_pages = i;
+	ret = move_to_pipe(pipe, &spd);
+	if (ret > 0)
+		*ppos += ret;
+
+	return ret;
+}
+
+EXPORT_SYMBOL(generic_file_splice_read);
+
+/*
+ * Send 'sd->len' bytes to socket from 'sd->u.file' at position 'sd->pos'
+ * using sendpage().
+ */
+static int pipe_to_sendpage(struct pipe_inode_info *info,
+			    struct pipe_buffer *buf, struct splice_desc *sd)
+{
+	struct file *file = sd->u.file;
+	loff_t pos = sd->pos;
+	void *ptr;
+	int ret, more;
+
+	/* only to wait for the page cache pages to be read */
+	ptr = buf->ops->map(file, info, buf);
+	if (IS_ERR(ptr))
+		return PTR_ERR(ptr);
+
+	more = (sd->flags & SPLICE_F_MORE) || sd->len < sd->total_len;
+
+	ret = file->f_op->sendpage(file, buf->page, buf->offset, sd->len,
+				   &pos, more);
+
+	buf->ops->unmap(info, buf);
+	return ret;
+}
+
+/*
+ * Copy at most 'sd->len' bytes of the buffer into the page cache of
+ * 'sd->u.file' at 'sd->pos', without crossing a page boundary.  Returns
+ * the number of bytes copied, or an error.
+ *
+ * The caller holds the i_sem of the file's inode.
+ */
+static int pipe_to_file(struct pipe_inode_info *info, struct pipe_buffer *buf,
+			struct splice_desc *sd)
+{
+	struct file *file = sd->u.file;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	unsigned int offset, this_len;
+	struct page *page;
+	pgoff_t index;
+	char *src, *dst;
+	int ret;
+
+	index = sd->pos >> PAGE_CACHE_SHIFT;
+	offset = sd->pos & ~PAGE_CACHE_MASK;
+	this_len = sd->len;
+	if (this_len + offset > PAGE_CACHE_SIZE)
+		this_len = PAGE_CACHE_SIZE - offset;
+
+	/*
+	 * Map the source first: it may be a page cache page still being
+	 * read, possibly of this very file.
+	 */
+	src = buf->ops->map(file, info, buf);
+	if (IS_ERR(src))
+		return PTR_ERR(src);
+
+	page = grab_cache_page(mapping, index);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_unmap;
+	}
+
+	ret = mapping->a_ops->prepare_write(file, page, offset,
+					    offset + this_len);
+	if (unlikely(ret)) {
+		loff_t isize = i_size_read(inode);
+
+		/*
+		 * prepare_write() may have instantiated a few blocks
+		 * outside i_size.  Trim these off again.
+		 */
+		unlock_page(page);
+		page_cache_release(page);
+		if (sd->pos + this_len > isize)
+			vmtruncate(inode, isize);
+		goto out_unmap;
+	}
+
+	dst = kmap_atomic(page, KM_USER0);
+	memcpy(dst + offset, src + buf->offset, this_len);
+	flush_dcache_page(page);
+	kunmap_atomic(dst, KM_USER0);
+
+	ret = mapping->a_ops->commit_write(file, page, offset,
+					   offset + this_len);
+	if (!ret)
+		ret = this_len;
+
+	unlock_page(page);
+	mark_page_accessed(page);
+	page_cache_release(page);
+	if (ret > 0)
+		balance_dirty_pages_ratelimited(mapping);
+out_unmap:
+	buf->ops->unmap(info, buf);
+	return ret;
+}
+
+/*
+ * Pipe input worker.  Most of this logic works like a regular pipe, the
+ * key here is the 'actor' worker passed in that actually moves the data
+ * to the wanted destination.  See pipe_to_file/pipe_to_sendpage above.
+ */
+static ssize_t __move_from_pipe(struct inode *inode, struct splice_desc *sd,
+				splice_actor *actor)
+{
+	struct pipe_inode_info *info;
+	int do_wakeup, err;
+	ssize_t ret;
+
+	ret = 0;
+	do_wakeup = 0;
+
+	down(PIPE_SEM(*inode));
+
+	info = inode->i_pipe;
+	for (;;) {
+		int bufs = info->nrbufs;
+
+		if (bufs) {
+			int curbuf = info->curbuf;
+			struct pipe_buffer *buf = info->bufs + curbuf;
+			struct pipe_buf_operations *ops = buf->ops;
+
+			sd->len = buf->len;
+			if (sd->len > sd->total_len)
+				sd->len = sd->total_len;
+
+			err = actor(info, buf, sd);
+			if (err <= 0) {
+				if (!ret && err)
+					ret = err;
+				break;
+			}
+
+			ret += err;
+			buf->offset += err;
+			buf->len -= err;
+
+			sd->pos += err;
+			sd->total_len -= err;
+
+			if (!buf->len) {
+				buf->ops = NULL;
+				ops->release(info, buf);
+				curbuf = (curbuf + 1) & (info->buffers - 1);
+				info->curbuf = curbuf;
+				info->nrbufs = --bufs;
+				do_wakeup = 1;
+			}
+
+			if (!sd->total_len)
+				break;
+		}
+
+		if (bufs)
+			continue;
+		if (!PIPE_WRITERS(*inode))
+			break;
+		if (!PIPE_WAITING_WRITERS(*inode)) {
+			if (ret)
+				break;
+			if (sd->flags & SPLICE_F_NONBLOCK) {
+				ret = -EAGAIN;
+				break;
+			}
+		}
+
+		if (signal_pending(current)) {
+			if (!ret)
+				ret = -ERESTARTSYS;
+			break;
+		}
+
+		if (do_wakeup) {
+			wake_up_interruptible_sync(PIPE_WAIT(*inode));
+			kill_fasync(PIPE_FASYNC_WRITERS(*inode),SIGIO,POLL_OUT);
+			do_wakeup = 0;
+		}
+
+		pipe_wait(inode);
+	}
+
+	up(PIPE_SEM(*inode));
+
+	if (do_wakeup) {
+		wake_up_interruptible(PIPE_WAIT(*inode));
+		kill_fasync(PIPE_FASYNC_WRITERS(*inode), SIGIO, POLL_OUT);
+	}
+
+	return ret;
+}
+
+static ssize_t move_from_pipe(struct inode *inode, struct file *out,
+			      loff_t *ppos, size_t len, unsigned int flags,
+			      splice_actor *actor)
+{
+	struct splice_desc sd;
+	ssize_t ret;
+
+	sd.total_len = len;
+	sd.flags = flags;
+	sd.u.file = out;
+	sd.pos = *ppos;
+
+	ret = __move_from_pipe(inode, &sd, actor);
+
+	*ppos = sd.pos;
+	return ret;
+}
+
+/**
+ * generic_file_splice_write - splice data from a pipe to a file
+ * @pipe:	pipe to splice from
+ * @out:	file to splice to
+ * @ppos:	position in @out
+ * @len:	number of bytes to splice
+ * @flags:	splice modifier flags
+ *
+ * Will either move or copy pages (determined by @flags options) from
+ * the given pipe inode to the given file.  For now they are always
+ * copied.
+ */
+ssize_t generic_file_splice_write(struct inode *pipe, struct file *out,
+				  loff_t *ppos, size_t len, unsigned int flags)
+{
+	struct address_space *mapping = out->f_mapping;
+	struct inode *inode = mapping->host;
+	ssize_t ret;
+	int err;
+
+	down(&inode->i_sem);
+
+	err = generic_write_checks(out, ppos, &len, S_ISBLK(inode->i_mode));
+	if (!err && len)
+		err = remove_suid(out->f_dentry);
+	if (err || !len) {
+		ret = err;
+		goto out;
+	}
+
+	inode_update_time(inode, 1);
+
+	ret = move_from_pipe(pipe, out, ppos, len, flags, pipe_to_file);
+
+	/*
+	 * For now, when the user asks for O_SYNC, we'll actually give O_DSYNC
+	 */
+	if (ret > 0 && unlikely((out->f_flags & O_SYNC) || IS_SYNC(inode))) {
+		err = generic_osync_inode(inode, mapping,
+					  OSYNC_METADATA|OSYNC_DATA);
+		if (err)
+			ret = err;
+	}
+out:
+	up(&inode->i_sem);
+	return ret;
+}
+
+EXPORT_SYMBOL(generic_file_splice_write);
+
+/**
+ * generic_splice_sendpage - splice data from a pipe to a socket
+ * @pipe:	pipe to splice from
+ * @out:	socket to write to
+ * @ppos:	position in @out
+ * @len:	number of bytes to splice
+ * @flags:	splice modifier flags
+ *
+ * Will send @len bytes from the pipe to a network socket.  No data copying
+ * is involved.
+ */
+ssize_t generic_splice_sendpage(struct inode *pipe, struct file *out,
+				loff_t *ppos, size_t len, unsigned int flags)
+{
+	return move_from_pipe(pipe, out, ppos, len, flags, pipe_to_sendpage);
+}
+
+EXPORT_SYMBOL(generic_splice_sendpage);
+
+/*
+ * Attempt to initiate a splice from pipe to file.
+ */
+static long do_splice_from(struct inode *pipe, struct file *out,
+			   loff_t *ppos, size_t len, unsigned int flags)
+{
+	int ret;
+
+	if (unlikely(!out->f_op || !out->f_op->splice_write))
+		return -EINVAL;
+
+	if (unlikely(!(out->f_mode & FMODE_WRITE)))
+		return -EBADF;
+
+	ret = rw_verify_area(WRITE, out, ppos, len);
+	if (unlikely(ret < 0))
+		return ret;
+
+	ret = security_file_permission(out, MAY_WRITE);
+	if (unlikely(ret < 0))
+		return ret;
+
+	return out->f_op->splice_write(pipe, out, ppos, len, flags);
+}
+
+/*
+ * Attempt to initiate a splice from a file to a pipe.
+ */
+static long do_splice_to(struct file *in, loff_t *ppos, struct inode *pipe,
+			 size_t len, unsigned int flags)
+{
+	int ret;
+
+	if (unlikely(!in->f_op || !in->f_op->splice_read))
+		return -EINVAL;
+
+	if (unlikely(!(in->f_mode & FMODE_READ)))
+		return -EBADF;
+
+	ret = rw_verify_area(READ, in, ppos, len);
+	if (unlikely(ret < 0))
+		return ret;
+
+	ret = security_file_permission(in, MAY_READ);
+	if (unlikely(ret < 0))
+		return ret;
+
+	return in->f_op->splice_read(in, ppos, pipe, len, flags);
+}
+
+/*
+ * Determine where to splice to/from.  One side has to be a pipe; the
+ * offset of the other one is either given by the user, pread/pwrite
+ * style, or is the file position.
+ */
+static long do_splice(struct file *in, loff_t __user *off_in,
+		      struct file *out, loff_t __user *off_out,
+		      size_t len, unsigned int flags)
+{
+	struct inode *pipe;
+	loff_t offset, *off;
+	long ret;
+
+	pipe = in->f_dentry->d_inode;
+	if (pipe->i_pipe) {
+		if (off_in)
+			return -ESPIPE;
+		if (unlikely(!(in->f_mode & FMODE_READ)))
+			return -EBADF;
+
+		off = &out->f_pos;
+		if (off_out) {
+			if (out->f_op->llseek == no_llseek)
+				return -EINVAL;
+			if (copy_from_user(&offset, off_out, sizeof(loff_t)))
+				return -EFAULT;
+			off = &offset;
+		}
+
+		ret = do_splice_from(pipe, out, off, len, flags);
+
+		if (off_out && copy_to_user(off_out, off, sizeof(loff_t)))
+			ret = -EFAULT;
+
+		return ret;
+	}
+
+	pipe = out->f_dentry->d_inode;
+	if (pipe->i_pipe) {
+		if (off_out)
+			return -ESPIPE;
+		if (unlikely(!(out->f_mode & FMODE_WRITE)))
+			return -EBADF;
+
+		off = &in->f_pos;
+		if (off_in) {
+			if (in->f_op->llseek == no_llseek)
+				return -EINVAL;
+			if (copy_from_user(&offset, off_in, sizeof(loff_t)))
+				return -EFAULT;
+			off = &offset;
+		}
+
+		ret = do_splice_to(in, off, pipe, len, flags);
+
+		if (off_in && copy_to_user(off_in, off, sizeof(loff_t)))
+			ret = -EFAULT;
+
+		return ret;
+	}
+
+	return -EINVAL;
+}
+
+asmlinkage long sys_splice(int fd_in, loff_t __user *off_in,
+			   int fd_out, loff_t __user *off_out,
+			   size_t len, unsigned int flags)
+{
+	long error;
+	struct file *in, *out;
+	int fput_in, fput_out;
+
+	if (unlikely(!len))
+		return 0;
+
+	error = -EBADF;
+	in = fget_light(fd_in, &fput_in);
+	if (in) {
+		out = fget_light(fd_out, &fput_out);
+		if (out) {
+			error = do_splice(in, off_in, out, off_out, len, flags);
+			fput_light(out, fput_out);
+		}
+		fput_light(in, fput_in);
+	}
+
+	return error;
+}
+
+/*
+ * User pages spliced into a pipe.  They are never merged into: the
+ * application could still be writing to them.
+ */
+static void *user_page_pipe_buf_map(struct file *file,
+				    struct pipe_inode_info *info,
+				    struct pipe_buffer *buf)
+{
+	return kmap(buf->page);
+}
+
+static struct pipe_buf_operations user_page_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = user_page_pipe_buf_map,
+	.unmap = page_cache_pipe_buf_unmap,
+	.release = page_cache_pipe_buf_release,
+	.get = page_cache_pipe_buf_get,
+};
+
+/*
+ * Pin the user pages described by @iov, up to a pipe's worth of them.
+ * Returns the number of pages, or an error if none could be had.
+ */
+static int get_iovec_page_array(const struct iovec __user *iov,
+				unsigned int nr_vecs, struct page **pages,
+				struct partial_page *partial, int aligned)
+{
+	int buffers = 0, error = 0;
+
+	while (nr_vecs) {
+		unsigned long off, npages;
+		void __user *base;
+		size_t len;
+		int i;
+
+		error = -EFAULT;
+		if (copy_from_user(&base, &iov->iov_base, sizeof(base)))
+			break;
+		if (copy_from_user(&len, &iov->iov_len, sizeof(len)))
+			break;
+
+		/*
+		 * Sanity check this iovec.  0 read succeeds.
+		 */
+		error = 0;
+		if (unlikely(!len))
+			goto next;
+		error = -EFAULT;
+		if (unlikely(!base))
+			break;
+		if (unlikely(!access_ok(VERIFY_READ, base, len)))
+			break;
+
+		/*
+		 * Get this base offset and number of pages, then map
+		 * in the user pages.
+		 */
+		off = (unsigned long) base & ~PAGE_MASK;
+
+		/*
+		 * If asked for alignment, the offset must be zero and the
+		 * length a multiple of the PAGE_SIZE.
+		 */
+		error = -EINVAL;
+		if (aligned && (off || len & ~PAGE_MASK))
+			break;
+
+		npages = (off + len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		if (npages > PIPE_BUFFERS - buffers)
+			npages = PIPE_BUFFERS - buffers;
+
+		down_read(&current->mm->mmap_sem);
+		error = get_user_pages(current, current->mm,
+				       (unsigned long) base, npages, 0, 0,
+				       &pages[buffers], NULL);
+		up_read(&current->mm->mmap_sem);
+
+		if (unlikely(error <= 0))
+			break;
+
+		/*
+		 * Fill this contiguous range into the partial page map.
+		 */
+		for (i = 0; i < error; i++) {
+			const int plen = min_t(size_t, len, PAGE_SIZE - off);
+
+			partial[buffers].offset = off;
+			partial[buffers].len = plen;
+
+			off = 0;
+			len -= plen;
+			buffers++;
+		}
+
+		/*
+		 * We didn't complete this iov, stop here since it probably
+		 * means we have to move some of this into a pipe to
+		 * be able to continue.
+		 */
+		if (len)
+			break;
+
+		/*
+		 * Don't continue if we mapped fewer pages than we asked for,
+		 * or if we mapped the max number of pages that we have
+		 * room for.
+		 */
+		if (error < npages || buffers == PIPE_BUFFERS)
+			break;
+next:
+		nr_vecs--;
+		iov++;
+	}
+
+	if (buffers)
+		return buffers;
+
+	return error;
+}
+
+/*
+ * vmsplice splices a user address range into a pipe.  It can be thought of
+ * as splice-from-memory, where the regular splice is splice-from-file (or
+ * to file).  In both cases the output is a pipe, naturally.
+ *
+ * Splicing from user memory is a simple operation that can be supported
+ * without any funky alignment restrictions or nasty vm tricks.  We simply
+ * map in the user memory and fill it into a pipe.  The reverse isn't quite
+ * as easy, so vmsplice() on the read side of a pipe copies the data out
+ * instead, with no restrictions on the user memory.
+ */
+static long do_vmsplice_to_pipe(struct file *file,
+				const struct iovec __user *iov,
+				unsigned long nr_segs, unsigned int flags)
+{
+	struct inode *pipe = file->f_dentry->d_inode;
+	struct page *pages[PIPE_BUFFERS];
+	struct partial_page partial[PIPE_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.flags = flags,
+		.ops = &user_page_pipe_buf_ops,
+	};
+
+	spd.nr_pages = get_iovec_page_array(iov, nr_segs, pages, partial,
+					    flags & SPLICE_F_GIFT);
+	if (spd.nr_pages <= 0)
+		return spd.nr_pages;
+
+	return move_to_pipe(pipe, &spd);
+}
+
+static int pipe_to_user(struct pipe_inode_info *info, struct pipe_buffer *buf,
+			struct splice_desc *sd)
+{
+	char *src;
+	int ret;
+
+	src = buf->ops->map(NULL, info, buf);
+	if (IS_ERR(src))
+		return PTR_ERR(src);
+
+	ret = sd->len;
+	if (copy_to_user(sd->u.userptr, src + buf->offset, sd->len))
+		ret = -EFAULT;
+	else
+		sd->u.userptr += ret;
+
+	buf->ops->unmap(info, buf);
+	return ret;
+}
+
+/*
+ * Copy the pipe contents into the user's memory, one iovec at a time.
+ * Only the first iovec waits for data.
+ */
+static long do_vmsplice_from_pipe(struct file *file,
+				  const struct iovec __user *iov,
+				  unsigned long nr_segs, unsigned int flags)
+{
+	struct inode *pipe = file->f_dentry->d_inode;
+	struct splice_desc sd;
+	long ret = 0;
+
+	while (nr_segs) {
+		void __user *base;
+		size_t len;
+		ssize_t err;
+
+		if (copy_from_user(&base, &iov->iov_base, sizeof(base)) ||
+		    copy_from_user(&len, &iov->iov_len, sizeof(len))) {
+			if (!ret)
+				ret = -EFAULT;
+			break;
+		}
+		if (unlikely(!len))
+			goto next;
+		if (unlikely(!access_ok(VERIFY_WRITE, base, len))) {
+			if (!ret)
+				ret = -EFAULT;
+			break;
+		}
+
+		sd.total_len = len;
+		sd.flags = flags;
+		if (ret)
+			sd.flags |= SPLICE_F_NONBLOCK;
+		sd.u.userptr = base;
+		sd.pos = 0;
+
+		err = __move_from_pipe(pipe, &sd, pipe_to_user);
+		if (err < 0) {
+			if (!ret)
+				ret = err;
+			break;
+		}
+		ret += err;
+		if (err < len)
+			break;
+next:
+		nr_segs--;
+		iov++;
+	}
+
+	return ret;
+}
+
+asmlinkage long sys_vmsplice(int fd, const struct iovec __user *iov,
+			     unsigned long nr_segs, unsigned int flags)
+{
+	struct file *file;
+	long error;
+	int fput;
+
+	if (unlikely(nr_segs > UIO_MAXIOV))
+		return -EINVAL;
+	if (unlikely(!nr_segs))
+		return 0;
+
+	error = -EBADF;
+	file = fget_light(fd, &fput);
+	if (file) {
+		if (!file->f_dentry->d_inode->i_pipe)
+			error = -EINVAL;
+		else if (file->f_mode & FMODE_WRITE)
+			error = do_vmsplice_to_pipe(file, iov, nr_segs, flags);
+		else if (file->f_mode & FMODE_READ)
+			error = do_vmsplice_from_pipe(file, iov, nr_segs,
+						      flags);
+
+		fput_light(file, fput);
+	}
+
+	return error;
+}
+
+/*
+ * Duplicate up to @len bytes of the buffers of @ipipe into @opipe, taking
+ * a reference to each page.  Both pipe semaphores are taken, in address
+ * order.  Returns -EAGAIN if @ipipe is empty or @opipe is full, and 0 if
+ * @ipipe is empty and has no writers left.
+ */
+static long link_pipe(struct inode *ipipe, struct inode *opipe, size_t len)
+{
+	struct pipe_inode_info *ipi, *opi;
+	long ret = 0;
+	int i = 0;
+
+	if (ipipe < opipe) {
+		down(PIPE_SEM(*ipipe));
+		down(PIPE_SEM(*opipe));
+	} else {
+		down(PIPE_SEM(*opipe));
+		down(PIPE_SEM(*ipipe));
+	}
+
+	ipi = ipipe->i_pipe;
+	opi = opipe->i_pipe;
+
+	if (!PIPE_READERS(*opipe)) {
+		send_sig(SIGPIPE, current, 0);
+		ret = -EPIPE;
+		goto out;
+	}
+
+	while (len && i < ipi->nrbufs && opi->nrbufs < opi->buffers) {
+		struct pipe_buffer *ibuf, *obuf;
+		int nbuf;
+
+		ibuf = ipi->bufs + ((ipi->curbuf + i) & (ipi->buffers - 1));
+		nbuf = (opi->curbuf + opi->nrbufs) & (opi->buffers - 1);
+		obuf = opi->bufs + nbuf;
+
+		ibuf->ops->get(ipi, ibuf);
+		/* the page is shared now, it is nobody's to give away */
+		ibuf->flags &= ~PIPE_BUF_FLAG_GIFT;
+		*obuf = *ibuf;
+		if (obuf->len > len)
+			obuf->len = len;
+
+		opi->nrbufs++;
+		ret += obuf->len;
+		len -= obuf->len;
+		i++;
+	}
+
+	if (!ret) {
+		if (ipi->nrbufs || PIPE_WRITERS(*ipipe))
+			ret = -EAGAIN;
+	}
+out:
+	up(PIPE_SEM(*ipipe));
+	up(PIPE_SEM(*opipe));
+
+	if (ret > 0) {
+		wake_up_interruptible(PIPE_WAIT(*opipe));
+		kill_fasync(PIPE_FASYNC_READERS(*opipe), SIGIO, POLL_IN);
+	}
+
+	return ret;
+}
+
+/*
+ * Wait for @ipipe to have data or @opipe to have room, whichever stopped
+ * link_pipe().
+ */
+static int link_pipe_wait(struct inode *ipipe, struct inode *opipe)
+{
+	int ret = 0;
+
+	down(PIPE_SEM(*ipipe));
+	while (!ipipe->i_pipe->nrbufs && PIPE_WRITERS(*ipipe)) {
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+		pipe_wait(ipipe);
+	}
+	up(PIPE_SEM(*ipipe));
+	if (ret)
+		return ret;
+
+	down(PIPE_SEM(*opipe));
+	while (opipe->i_pipe->nrbufs == opipe->i_pipe->buffers &&
+	       PIPE_READERS(*opipe)) {
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+		PIPE_WAITING_WRITERS(*opipe)++;
+		pipe_wait(opipe);
+		PIPE_WAITING_WRITERS(*opipe)--;
+	}
+	up(PIPE_SEM(*opipe));
+
+	return ret;
+}
+
+/*
+ * This is a tee(1) implementation that works on pipes.  It doesn't copy
+ * any data, it simply references the 'in' pages on the 'out' pipe.
+ * The 'flags' used are the SPLICE_F_* variants, currently the only
+ * applicable one is SPLICE_F_NONBLOCK.
+ */
+static long do_tee(struct file *in, struct file *out, size_t len,
+		   unsigned int flags)
+{
+	struct inode *ipipe = in->f_dentry->d_inode;
+	struct inode *opipe = out->f_dentry->d_inode;
+	long ret;
+
+	if (!ipipe->i_pipe || !opipe->i_pipe || ipipe == opipe)
+		return -EINVAL;
+	if (!(in->f_mode & FMODE_READ) || !(out->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	for (;;) {
+		ret = link_pipe(ipipe, opipe, len);
+		if (ret != -EAGAIN || (flags & SPLICE_F_NONBLOCK))
+			break;
+		ret = link_pipe_wait(ipipe, opipe);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+asmlinkage long sys_tee(int fdin, int fdout, size_t len, unsigned int flags)
+{
+	struct file *in, *out;
+	int error, fput_in, fput_out;
+
+	if (unlikely(!len))
+		return 0;
+
+	error = -EBADF;
+	in = fget_light(fdin, &fput_in);
+	if (in) {
+		out = fget_light(fdout, &fput_out);
+		if (out) {
+			error = do_tee(in, out, len, flags);
+			fput_light(out, fput_out);
+		}
+		fput_light(in, fput_in);
+	}
+
+	return error;
+}
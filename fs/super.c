@@ -57,6 +57,7 @@ static struct super_block *alloc_super(void)
 {
 	struct super_block *s = kmalloc(sizeof(struct super_block),  GFP_USER);
 	static struct super_operations default_op;
+	int cpu;
 
 	if (s) {
 		memset(s, 0, sizeof(struct super_block));
@@ -65,12 +66,26 @@ static struct super_block *alloc_super(void)
 			s = NULL;
 			goto out;
 		}
+		spin_lock_init(&s->s_inode_wb_lock);
 		INIT_LIST_HEAD(&s->s_dirty);
 		INIT_LIST_HEAD(&s->s_io);
-		INIT_LIST_HEAD(&s->s_files);
+		s->s_files = alloc_percpu(struct list_head);
+		if (!s->s_files) {
+			security_sb_free(s);
+			kfree(s);
+			s = NULL;
+			goto out;
+		}
+		for_each_cpu(cpu)
+			INIT_LIST_HEAD(sb_files(s, cpu));
 		INIT_LIST_HEAD(&s->s_instances);
 		INIT_HLIST_HEAD(&s->s_anon);
+		spin_lock_init(&s->s_inode_list_lock);
 		INIT_LIST_HEAD(&s->s_inodes);
+		spin_lock_init(&s->s_inode_lru_lock);
+		INIT_LIST_HEAD(&s->s_inode_lru);
+		INIT_LIST_HEAD(&s->s_dentry_lru);
+		spin_lock_init(&s->s_dentry_lru_lock);
 		init_rwsem(&s->s_umount);
 		sema_init(&s->s_lock, 1);
 		down_write(&s->s_umount);
@@ -80,6 +95,7 @@ static struct super_block *alloc_super(void)
 		sema_init(&s->s_dquot.dqio_sem, 1);
 		sema_init(&s->s_dquot.dqonoff_sem, 1);
 		init_rwsem(&s->s_dquot.dqptr_sem);
+		spin_lock_init(&s->s_dquot.dq_dirty_lock);
 		init_waitqueue_head(&s->s_wait_unfrozen);
 		s->s_maxbytes = MAX_NON_LFS;
 		s->dq_op = sb_dquot_ops;
@@ -99,6 +115,7 @@ out:
  */
 static inline void destroy_super(struct super_block *s)
 {
+	free_percpu(s->s_files);
 	security_sb_free(s);
 	kfree(s);
 }
@@ -230,13 +247,14 @@ void generic_shutdown_super(struct super_block *sb)
 	if (root) {
 		sb->s_root = NULL;
 		shrink_dcache_parent(root);
-		shrink_dcache_anon(&sb->s_anon);
+		shrink_dcache_anon(sb);
 		dput(root);
 		fsync_super(sb);
 		lock_super(sb);
 		sb->s_flags &= ~MS_ACTIVE;
 		/* bad name - it should be evict_inodes() */
 		invalidate_inodes(sb);
+		flush_destroyed_inodes();
 		lock_kernel();
 
 		if (sop->write_super && sb->s_dirt)
@@ -249,6 +267,7 @@ void generic_shutdown_super(struct super_block *sb)
 			printk("VFS: Busy inodes after unmount. "
 			   "Self-destruct in 5 seconds.  Have a nice day...\n");
 		}
+		flush_destroyed_inodes();
 
 		unlock_kernel();
 		unlock_super(sb);
@@ -504,13 +523,17 @@ out:
 static void mark_files_ro(struct super_block *sb)
 {
 	struct file *f;
-
-	file_list_lock();
-	list_for_each_entry(f, &sb->s_files, f_list) {
-		if (S_ISREG(f->f_dentry->d_inode->i_mode) && file_count(f))
-			f->f_mode &= ~FMODE_WRITE;
+	int cpu;
+
+	for_each_cpu(cpu) {
+		file_sb_list_lock(cpu);
+		list_for_each_entry(f, sb_files(sb, cpu), f_list) {
+			if (S_ISREG(f->f_dentry->d_inode->i_mode) &&
+			    file_count(f))
+				f->f_mode &= ~FMODE_WRITE;
+		}
+		file_sb_list_unlock(cpu);
 	}
-	file_list_unlock();
 }
 
 /**
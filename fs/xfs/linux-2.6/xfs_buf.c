@@ -201,6 +201,7 @@ test_page_region(
 
 typedef struct a_list {
 	void		*vm_addr;
+	unsigned int	count;
 	struct a_list	*next;
 } a_list_t;
 
@@ -209,11 +210,12 @@ STATIC int		as_list_len;
 STATIC DEFINE_SPINLOCK(as_lock);
 
 /*
- * Try to batch vunmaps because they are costly.
+ * Unmapping may not be done from interrupt context, so defer it.
  */
 STATIC void
 free_address(
-	void		*addr)
+	void		*addr,
+	unsigned int	count)
 {
 	a_list_t	*aentry;
 
@@ -222,11 +224,12 @@ free_address(
 		spin_lock(&as_lock);
 		aentry->next = as_free_head;
 		aentry->vm_addr = addr;
+		aentry->count = count;
 		as_free_head = aentry;
 		as_list_len++;
 		spin_unlock(&as_lock);
 	} else {
-		vunmap(addr);
+		vm_unmap_ram(addr, count);
 	}
 }
 
@@ -245,7 +248,7 @@ purge_addresses(void)
 	spin_unlock(&as_lock);
 
 	while ((old = aentry) != NULL) {
-		vunmap(aentry->vm_addr);
+		vm_unmap_ram(aentry->vm_addr, aentry->count);
 		aentry = aentry->next;
 		kfree(old);
 	}
@@ -351,7 +354,8 @@ pagebuf_free(
 		uint		i;
 
 		if ((bp->pb_flags & PBF_MAPPED) && (bp->pb_page_count > 1))
-			free_address(bp->pb_addr - bp->pb_offset);
+			free_address(bp->pb_addr - bp->pb_offset,
+					bp->pb_page_count);
 
 		for (i = 0; i < bp->pb_page_count; i++)
 			page_cache_release(bp->pb_pages[i]);
@@ -483,8 +487,8 @@ _pagebuf_map_pages(
 	} else if (flags & PBF_MAPPED) {
 		if (as_list_len > 64)
 			purge_addresses();
-		bp->pb_addr = vmap(bp->pb_pages, bp->pb_page_count,
-				VM_MAP, PAGE_KERNEL);
+		bp->pb_addr = vm_map_ram(bp->pb_pages, bp->pb_page_count,
+				PAGE_KERNEL);
 		if (unlikely(bp->pb_addr == NULL))
 			return -ENOMEM;
 		bp->pb_addr += bp->pb_offset;
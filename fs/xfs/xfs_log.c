@@ -86,8 +86,6 @@ STATIC int  xlog_state_get_iclog_space(xlog_t		*log,
 				       xlog_ticket_t	*ticket,
 				       int		*continued_write,
 				       int		*logoffsetp);
-STATIC void xlog_state_put_ticket(xlog_t	*log,
-				  xlog_ticket_t *tic);
 STATIC int  xlog_state_release_iclog(xlog_t		*log,
 				     xlog_in_core_t	*iclog);
 STATIC void xlog_state_switch_iclogs(xlog_t		*log,
@@ -112,11 +110,6 @@ STATIC void xlog_ungrant_log_space(xlog_t	 *log,
 
 /* local ticket functions */
 STATIC void		xlog_state_ticket_alloc(xlog_t *log);
-STATIC xlog_ticket_t	*xlog_ticket_get(xlog_t *log,
-					 int	unit_bytes,
-					 int	count,
-					 char	clientid,
-					 uint	flags);
 STATIC void		xlog_ticket_put(xlog_t *log, xlog_ticket_t *ticket);
 
 /* local debug functions */
@@ -322,6 +315,25 @@ xfs_log_force(xfs_mount_t *mp,
 
 	XFS_STATS_INC(xs_log_force);
 
+	/*
+	 * With delayed logging an lsn not yet on disk can belong to an item
+	 * still in the CIL, which is not in any iclog: checkpoint it, and
+	 * force out everything.
+	 */
+	if (log->l_cil && (log->l_flags & XLOG_IO_ERROR) == 0) {
+		xfs_lsn_t	sync_lsn;
+		SPLDECL(s);
+
+		s = GRANT_LOCK(log);
+		sync_lsn = log->l_last_sync_lsn;
+		GRANT_UNLOCK(log, s);
+		if (lsn == 0 ||
+		    XFS_LSN_CMP_ARCH(lsn, sync_lsn, ARCH_NOCONVERT) >= 0) {
+			xlog_cil_push(log);
+			lsn = 0;
+		}
+	}
+
 	if ((log->l_flags & XLOG_IO_ERROR) == 0) {
 		if (lsn == 0)
 			rval = xlog_state_sync_all(log, flags);
@@ -464,6 +476,8 @@ xfs_log_mount(xfs_mount_t	*mp,
 	}
 
 	mp->m_log = xlog_alloc_log(mp, log_target, blk_offset, num_bblks);
+	if (mp->m_flags & XFS_MOUNT_DELAYLOG)
+		xlog_cil_init(mp->m_log);
 
 #if defined(DEBUG) || defined(XLOG_NOLOG)
 	if (!xlog_debug) {
@@ -579,6 +593,9 @@ xfs_log_unmount_write(xfs_mount_t *mp)
 		return 0;
 #endif
 
+	/* Checkpoint what is left in the CIL ahead of the unmount record */
+	xlog_cil_push(log);
+
 	/*
 	 * Don't write out unmount record on read-only mounts.
 	 * Or, if we are doing a forced umount (typically because of IO errors).
@@ -1532,6 +1549,8 @@ xlog_unalloc_log(xlog_t *log)
 	xlog_ticket_t	*tic, *next_tic;
 	int		i;
 
+	if (log->l_cil)
+		xlog_cil_destroy(log);
 
 	iclog = log->l_iclog;
 	for (i=0; i<log->l_iclog_bufs; i++) {
@@ -0,0 +1,403 @@
+/*
+ * Delayed logging.
+ *
+ * With the "delaylog" mount option a transaction commit does not copy
+ * its items into the in-core log.  Each item is formatted into a private
+ * buffer on the committed item list (CIL) instead, replacing what an
+ * earlier transaction left there for the same item.  The log formats of
+ * inodes, buffers and dquots describe all of their changes since they
+ * were last written back, so the last copy stands for all the commits
+ * before it, and an inode or directory buffer that is modified by
+ * thousands of transactions is written to the log once.
+ *
+ * The CIL is written to the log as a single checkpoint transaction when
+ * it holds more than XLOG_CIL_SPACE_LIMIT, or when the log is forced.
+ * The transactions committed to it are completed, their items moved in
+ * the AIL and unpinned, when the commit record of the checkpoint is on
+ * disk, just as if each had been written to the log on its own.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ */
+
+#include "xfs.h"
+#include "xfs_macros.h"
+#include "xfs_types.h"
+#include "xfs_inum.h"
+#include "xfs_ag.h"
+#include "xfs_sb.h"
+#include "xfs_log.h"
+#include "xfs_trans.h"
+#include "xfs_dir.h"
+#include "xfs_dmapi.h"
+#include "xfs_mount.h"
+#include "xfs_error.h"
+#include "xfs_log_priv.h"
+#include "xfs_trans_priv.h"
+
+/*
+ * What a checkpoint takes besides its items, as xlog_ticket_get() counts
+ * it for a transaction: the trans header region, the start and commit
+ * records, the roundoff and the first log record header.  Each further
+ * l_iclog_size of items costs another record header.
+ */
+STATIC int
+xlog_cil_hdr_res(
+	xlog_t		*log)
+{
+	int		res;
+
+	res = sizeof(xfs_trans_header_t) + 3 * sizeof(xlog_op_header_t);
+	if (XFS_SB_VERSION_HASLOGV2(&log->l_mp->m_sb) &&
+	    log->l_mp->m_sb.sb_logsunit > 1)
+		res += log->l_mp->m_sb.sb_logsunit;
+	else
+		res += BBSIZE;
+	return res + log->l_iclog_hsize;
+}
+
+/*
+ * The log space an item takes in a checkpoint: its data, an op header
+ * per region, and one more each time xlog_write() has to split a region
+ * across iclogs.
+ */
+STATIC int
+xlog_cil_item_res(
+	xlog_t		*log,
+	xfs_log_vec_t	*lv)
+{
+	int		nheaders;
+
+	nheaders = lv->lv_niovecs + 1 + lv->lv_buf_len /
+					(log->l_iclog_size >> 1);
+	return lv->lv_buf_len + nheaders * sizeof(xlog_op_header_t);
+}
+
+/* A ticket without a reservation of its own, for the CIL to steal into */
+STATIC xlog_ticket_t *
+xlog_cil_ticket_alloc(
+	xlog_t		*log)
+{
+	xlog_ticket_t	*tic;
+
+	tic = xlog_ticket_get(log, 0, 1, XFS_TRANSACTION, 0);
+	tic->t_unit_res = 0;
+	tic->t_curr_res = 0;
+	return tic;
+}
+
+void
+xlog_cil_init(
+	xlog_t		*log)
+{
+	xfs_cil_t	*cil;
+
+	cil = (xfs_cil_t *)kmem_zalloc(sizeof(xfs_cil_t), KM_SLEEP);
+	mrinit(&cil->xc_ctx_lock, "xc_ctx_lock");
+	spinlock_init(&cil->xc_lock, "xc_lock");
+	INIT_LIST_HEAD(&cil->xc_items);
+	cil->xc_trans_tail = &cil->xc_trans;
+	cil->xc_ticket = xlog_cil_ticket_alloc(log);
+	log->l_cil = cil;
+}
+
+void
+xlog_cil_destroy(
+	xlog_t		*log)
+{
+	xfs_cil_t	*cil = log->l_cil;
+
+	ASSERT(cil->xc_trans == NULL);
+	ASSERT(list_empty(&cil->xc_items));
+	xlog_state_put_ticket(log, cil->xc_ticket);
+	spinlock_destroy(&cil->xc_lock);
+	mrfree(&cil->xc_ctx_lock);
+	kmem_free(cil, sizeof(xfs_cil_t));
+	log->l_cil = NULL;
+}
+
+/*
+ * Copy the regions an item formatted into a log vector of its own: they
+ * point into the item's in-core state, which changes again as soon as
+ * the item is unlocked.
+ */
+STATIC xfs_log_vec_t *
+xlog_cil_format_item(
+	xfs_log_item_t	*lip,
+	xfs_log_iovec_t	*vecp,
+	int		niovecs)
+{
+	xfs_log_vec_t	*lv;
+	char		*ptr;
+	int		len, size, i;
+
+	len = 0;
+	for (i = 0; i < niovecs; i++)
+		len += vecp[i].i_len;
+	size = sizeof(xfs_log_vec_t) + niovecs * sizeof(xfs_log_iovec_t) + len;
+
+	lv = (xfs_log_vec_t *)kmem_alloc(size, KM_SLEEP);
+	lv->lv_next = NULL;
+	lv->lv_item = lip;
+	lv->lv_niovecs = niovecs;
+	lv->lv_buf_len = len;
+	lv->lv_size = size;
+	lv->lv_iovecp = (xfs_log_iovec_t *)(lv + 1);
+
+	ptr = (char *)(lv->lv_iovecp + niovecs);
+	for (i = 0; i < niovecs; i++) {
+		memcpy(ptr, vecp[i].i_addr, vecp[i].i_len);
+		lv->lv_iovecp[i].i_addr = ptr;
+		lv->lv_iovecp[i].i_len = vecp[i].i_len;
+		ptr += vecp[i].i_len;
+	}
+	return lv;
+}
+
+/*
+ * Insert the dirty items of tp, which xfs_trans_fill_vecs() formatted
+ * into log_vector and pinned, into the CIL, and queue tp to be completed
+ * with the next checkpoint.  The log space the items take is stolen
+ * from the transaction's ticket before it is given back.
+ *
+ * Returns with xc_ctx_lock held shared, so that no checkpoint can
+ * complete tp before the caller has unlocked its items: the caller
+ * drops it with xfs_log_commit_cil_done().
+ */
+void
+xfs_log_commit_cil(
+	xfs_mount_t		*mp,
+	xfs_trans_t		*tp,
+	xfs_log_iovec_t		*log_vector,
+	xfs_lsn_t		*commit_lsn)
+{
+	xlog_t			*log = mp->m_log;
+	xfs_cil_t		*cil = log->l_cil;
+	xlog_ticket_t		*tic = (xlog_ticket_t *)tp->t_ticket;
+	xfs_log_item_desc_t	*lidp;
+	xfs_log_iovec_t		*vecp;
+	xfs_log_vec_t		*lv, *next, *old;
+	xfs_log_vec_t		*new_lvs = NULL, **new_tail = &new_lvs;
+	xfs_log_vec_t		*free_list = NULL;
+	xfs_log_item_t		*lip;
+	int			res = 0, len;
+	SPLDECL(s);
+	SPLDECL(s2);
+
+	/* Copy the items out before taking the lock, walking as fill_vecs */
+	vecp = log_vector + 1;
+	for (lidp = xfs_trans_first_item(tp);
+	     lidp != NULL;
+	     lidp = xfs_trans_next_item(tp, lidp)) {
+		if (!(lidp->lid_flags & XFS_LID_DIRTY))
+			continue;
+		if (lidp->lid_size) {
+			lv = xlog_cil_format_item(lidp->lid_item, vecp,
+						  lidp->lid_size);
+			lv->lv_res = xlog_cil_item_res(log, lv);
+			*new_tail = lv;
+			new_tail = &lv->lv_next;
+		}
+		vecp += lidp->lid_size;
+	}
+
+	mraccess(&cil->xc_ctx_lock);
+	s = mutex_spinlock(&cil->xc_lock);
+
+	if (cil->xc_trans == NULL)
+		res += xlog_cil_hdr_res(log);
+	for (lv = new_lvs; lv != NULL; lv = next) {
+		next = lv->lv_next;
+		lv->lv_next = NULL;
+		lip = lv->lv_item;
+		old = lip->li_lv;
+		if (old) {
+			/* Relogged: the new copy replaces the old one */
+			list_del(&lip->li_cil);
+			cil->xc_niovecs -= old->lv_niovecs;
+			if (lv->lv_res > old->lv_res)
+				res += lv->lv_res - old->lv_res;
+			else
+				lv->lv_res = old->lv_res;
+			old->lv_next = free_list;
+			free_list = old;
+		} else
+			res += lv->lv_res;
+		lip->li_lv = lv;
+		list_add_tail(&lip->li_cil, &cil->xc_items);
+		cil->xc_niovecs += lv->lv_niovecs;
+	}
+
+	len = cil->xc_ticket->t_unit_res;
+	res += log->l_iclog_hsize * (((len + res) >> log->l_iclog_size_log) -
+				     (len >> log->l_iclog_size_log));
+	if (tic->t_curr_res < res) {
+		xfs_cmn_err(XFS_PTAG_LOGRES, CE_ALERT, mp,
+		"xfs_log_commit_cil: reservation ran out. Need to up reservation");
+		xfs_force_shutdown(mp, XFS_CORRUPT_INCORE);
+	} else {
+		tic->t_curr_res -= res;
+		cil->xc_ticket->t_curr_res += res;
+		cil->xc_ticket->t_unit_res += res;
+	}
+
+	tp->t_cil_next = NULL;
+	*cil->xc_trans_tail = tp;
+	cil->xc_trans_tail = &tp->t_cil_next;
+
+	/*
+	 * Not in the log yet: stamp the items with the head of the log, so
+	 * that it is no earlier than anything on disk to whoever compares it
+	 * with l_last_sync_lsn, and xfs_log_force() pushes the CIL for it.
+	 */
+	s2 = LOG_LOCK(log);
+	ASSIGN_LSN(*commit_lsn, log, ARCH_NOCONVERT);
+	LOG_UNLOCK(log, s2);
+	tp->t_commit_lsn = *commit_lsn;
+	mutex_spinunlock(&cil->xc_lock, s);
+
+	while (free_list) {
+		old = free_list;
+		free_list = old->lv_next;
+		kmem_free(old, old->lv_size);
+	}
+}
+
+/*
+ * Drop the lock taken by xfs_log_commit_cil(), and checkpoint if the CIL
+ * has grown too big or the transaction was synchronous.
+ */
+void
+xfs_log_commit_cil_done(
+	xfs_mount_t	*mp,
+	int		sync)
+{
+	xlog_t		*log = mp->m_log;
+	xfs_cil_t	*cil = log->l_cil;
+	int		push;
+
+	push = sync || cil->xc_ticket->t_curr_res > XLOG_CIL_SPACE_LIMIT(log);
+	mrunlock(&cil->xc_ctx_lock);
+	if (push)
+		xlog_cil_push(log);
+}
+
+typedef struct xlog_cil_ctx {
+	xfs_log_callback_t	cb;
+	xfs_trans_t		*trans;
+} xlog_cil_ctx_t;
+
+/*
+ * The iclog holding the commit record of a checkpoint is on disk, or the
+ * log is shut down: complete its transactions, in the order they were
+ * committed.
+ */
+STATIC void
+xlog_cil_committed(
+	void		*arg,
+	int		abort)
+{
+	xlog_cil_ctx_t	*ctx = (xlog_cil_ctx_t *)arg;
+	xfs_trans_t	*tp, *next;
+
+	for (tp = ctx->trans; tp != NULL; tp = next) {
+		next = tp->t_cil_next;
+		xfs_trans_committed(tp, abort);
+	}
+	kmem_free(ctx, sizeof(xlog_cil_ctx_t));
+}
+
+/*
+ * Write the CIL to the log as one checkpoint transaction, with the last
+ * copy of each item in it, in the order the items were last committed.
+ * The commits wait for this, and start a new CIL once it is written to
+ * the in-core log.
+ */
+void
+xlog_cil_push(
+	xlog_t			*log)
+{
+	xfs_mount_t		*mp = log->l_mp;
+	xfs_cil_t		*cil = log->l_cil;
+	xlog_cil_ctx_t		*ctx;
+	xlog_ticket_t		*tic;
+	xfs_trans_header_t	header;
+	xfs_log_iovec_t		*vec, *vecp;
+	xfs_log_vec_t		*lv;
+	xfs_log_item_t		*lip;
+	xfs_trans_t		*tp;
+	xfs_lsn_t		start_lsn, commit_lsn;
+	void			*commit_iclog = NULL;
+	int			nvec, nitems, error;
+
+	if (!cil)
+		return;
+
+	mrupdate(&cil->xc_ctx_lock);
+	if (cil->xc_trans == NULL) {
+		mrunlock(&cil->xc_ctx_lock);
+		return;
+	}
+
+	ctx = (xlog_cil_ctx_t *)kmem_zalloc(sizeof(xlog_cil_ctx_t), KM_SLEEP);
+	nvec = cil->xc_niovecs + 1;
+	vec = (xfs_log_iovec_t *)kmem_alloc(nvec * sizeof(xfs_log_iovec_t),
+					    KM_SLEEP);
+
+	nitems = 0;
+	vecp = vec + 1;
+	list_for_each_entry(lip, &cil->xc_items, li_cil) {
+		lv = lip->li_lv;
+		memcpy(vecp, lv->lv_iovecp,
+		       lv->lv_niovecs * sizeof(xfs_log_iovec_t));
+		vecp += lv->lv_niovecs;
+		nitems++;
+	}
+	header.th_magic = XFS_TRANS_HEADER_MAGIC;
+	header.th_type = XFS_TRANS_CHECKPOINT;
+	header.th_tid = 0;
+	header.th_num_items = nitems;
+	vec->i_addr = (xfs_caddr_t)&header;
+	vec->i_len = sizeof(xfs_trans_header_t);
+
+	/* Take the CIL over, and start a new one */
+	tic = cil->xc_ticket;
+	ctx->trans = cil->xc_trans;
+	cil->xc_trans = NULL;
+	cil->xc_trans_tail = &cil->xc_trans;
+	cil->xc_niovecs = 0;
+	cil->xc_ticket = xlog_cil_ticket_alloc(log);
+
+	error = xfs_log_write(mp, vec, nvec, tic, &start_lsn);
+	commit_lsn = xfs_log_done(mp, tic, &commit_iclog, 0);
+
+	while (!list_empty(&cil->xc_items)) {
+		lip = list_entry(cil->xc_items.next, xfs_log_item_t, li_cil);
+		list_del(&lip->li_cil);
+		lv = lip->li_lv;
+		lip->li_lv = NULL;
+		kmem_free(lv, lv->lv_size);
+	}
+	kmem_free(vec, nvec * sizeof(xfs_log_iovec_t));
+
+	for (tp = ctx->trans; tp != NULL; tp = tp->t_cil_next) {
+		tp->t_lsn = start_lsn;
+		tp->t_commit_lsn = commit_lsn;
+	}
+
+	if (error || commit_lsn == -1) {
+		mrunlock(&cil->xc_ctx_lock);
+		xlog_cil_committed(ctx, XFS_LI_ABORTED);
+		return;
+	}
+
+	/* Attach the completion before letting the iclog go, as trans commit */
+	ctx->cb.cb_func = xlog_cil_committed;
+	ctx->cb.cb_arg = ctx;
+	error = xfs_log_notify(mp, commit_iclog, &ctx->cb);
+	mrunlock(&cil->xc_ctx_lock);
+	if (error)
+		xlog_cil_committed(ctx, XFS_LI_ABORTED);
+	xfs_log_release_iclog(mp, commit_iclog);
+}
@@ -472,6 +472,39 @@ typedef struct xlog_in_core {
  * overflow 31 bits worth of byte offset, so using a byte number will mean
  * that round off problems won't occur when releasing partial reservations.
  */
+/*
+ * Delayed logging: the committed item list, or CIL, see xfs_log_cil.c.
+ *
+ * Each log item on it has a private copy of what it last formatted, in
+ * an xfs_log_vec hung off li_lv.  The transactions are kept as well,
+ * to be completed when the checkpoint that writes the CIL is on disk,
+ * and the log space they would have used for their items moves to the
+ * CIL ticket.  Commits take xc_ctx_lock shared, a push takes it
+ * exclusive; xc_lock serialises the commits with each other.
+ */
+typedef struct xfs_log_vec {
+	struct xfs_log_vec	*lv_next;
+	struct xfs_log_item	*lv_item;
+	int			lv_niovecs;
+	int			lv_buf_len;	/* bytes of data copied */
+	int			lv_res;		/* log space it is charged */
+	int			lv_size;	/* of this allocation */
+	xfs_log_iovec_t		*lv_iovecp;	/* iovecs, then the data */
+} xfs_log_vec_t;
+
+typedef struct xfs_cil {
+	mrlock_t		xc_ctx_lock;
+	lock_t			xc_lock;
+	struct list_head	xc_items;	/* items, by last commit */
+	int			xc_niovecs;
+	struct xfs_trans	*xc_trans;	/* transactions, oldest first */
+	struct xfs_trans	**xc_trans_tail;
+	xlog_ticket_t		*xc_ticket;	/* log space for a checkpoint */
+} xfs_cil_t;
+
+/* Checkpoint once the CIL holds this much */
+#define XLOG_CIL_SPACE_LIMIT(log)	((log)->l_logsize >> 3)
+
 typedef struct log {
 	/* The following block of fields are changed while holding icloglock */
 	sema_t			l_flushsema;    /* iclog flushing semaphore */
@@ -530,6 +563,7 @@ typedef struct log {
 	uint			l_sectbb_log;   /* log2 of sector size in BBs */
 	uint			l_sectbb_mask;  /* sector size (in BBs)
 						 * alignment mask */
+	xfs_cil_t		*l_cil;		/* delayed logging, or NULL */
 } xlog_t;
 
 
@@ -545,6 +579,15 @@ extern int	 xlog_recover_finish(xlog_t *log, int mfsi_flags);
 extern void	 xlog_pack_data(xlog_t *log, xlog_in_core_t *iclog, int);
 extern void	 xlog_recover_process_iunlinks(xlog_t *log);
 
+extern xlog_ticket_t *xlog_ticket_get(xlog_t *log, int unit_bytes, int count,
+				      char clientid, uint flags);
+extern void	 xlog_state_put_ticket(xlog_t *log, xlog_ticket_t *tic);
+
+/* delayed logging */
+extern void	 xlog_cil_init(xlog_t *log);
+extern void	 xlog_cil_destroy(xlog_t *log);
+extern void	 xlog_cil_push(xlog_t *log);
+
 extern struct xfs_buf *xlog_get_bp(xlog_t *, int);
 extern void	 xlog_put_bp(struct xfs_buf *);
 extern int	 xlog_bread(xlog_t *, xfs_daddr_t, int, struct xfs_buf *);
@@ -112,6 +112,7 @@ typedef struct xfs_trans_header {
 #define	XFS_TRANS_GROWFSRT_ZERO		38
 #define	XFS_TRANS_GROWFSRT_FREE		39
 #define	XFS_TRANS_SWAPEXT		40
+#define	XFS_TRANS_CHECKPOINT		41
 /* new transaction types need to be reflected in xfs_logprint(8) */
 
 
@@ -160,6 +161,8 @@ typedef struct xfs_log_item {
 							/* buffer item iodone */
 							/* callback func */
 	struct xfs_item_ops		*li_ops;	/* function list */
+	struct xfs_log_vec		*li_lv;		/* copy in the CIL */
+	struct list_head		li_cil;		/* CIL pointers */
 } xfs_log_item_t;
 
 #define	XFS_LI_IN_AIL	0x1
@@ -409,6 +412,7 @@ typedef struct xfs_trans {
 	unsigned int		t_busy_free;	/* busy descs free */
 	xfs_log_busy_chunk_t	t_busy;		/* busy/async free blocks */
         xfs_pflags_t            t_pflags;       /* saved pflags state */
+	struct xfs_trans	*t_cil_next;	/* next in the CIL */
 } xfs_trans_t;
 
 #endif	/* __KERNEL__ */
@@ -53,6 +53,7 @@ void				xfs_trans_free_items(struct xfs_trans *, int);
 void				xfs_trans_unlock_items(struct xfs_trans *,
 							xfs_lsn_t);
 void				xfs_trans_free_busy(xfs_trans_t *tp);
+void				xfs_trans_committed(struct xfs_trans *, int);
 xfs_log_busy_slot_t		*xfs_trans_add_busy(xfs_trans_t *tp,
 						    xfs_agnumber_t ag,
 						    xfs_extlen_t idx);
@@ -0,0 +1,22 @@
+#ifndef _ASM_GENERIC_FUTEX_H
+#define _ASM_GENERIC_FUTEX_H
+
+#ifdef __KERNEL__
+
+#include <linux/futex.h>
+#include <asm/errno.h>
+#include <asm/uaccess.h>
+
+/*
+ * Atomically replace *uaddr with newval if it holds oldval, with page
+ * faults disabled.  Returns the value found, or -EFAULT.  Architectures
+ * without an implementation cannot do PI futexes.
+ */
+static inline int
+futex_atomic_cmpxchg_inatomic(int __user *uaddr, int oldval, int newval)
+{
+	return -ENOSYS;
+}
+
+#endif
+#endif
@@ -53,6 +53,7 @@
 enum fixed_addresses {
 	FIX_HOLE,
 	FIX_VSYSCALL,
+	FIX_VSYSCALL_GTOD,	/* read-only time of day, see asm/vsyscall.h */
 #ifdef CONFIG_X86_LOCAL_APIC
 	FIX_APIC_BASE,	/* local (CPU) APIC) -- required for SMP or not */
 #endif
@@ -0,0 +1,46 @@
+#ifndef _ASM_FUTEX_H
+#define _ASM_FUTEX_H
+
+#ifdef __KERNEL__
+
+#include <linux/config.h>
+#include <linux/futex.h>
+#include <asm/errno.h>
+#include <asm/system.h>
+#include <asm/uaccess.h>
+
+/*
+ * Atomically replace *uaddr with newval if it holds oldval.  Called
+ * with page faults disabled: returns the value found, or -EFAULT.
+ * The 386 has no cmpxchg, and so no PI futexes.
+ */
+static inline int
+futex_atomic_cmpxchg_inatomic(int __user *uaddr, int oldval, int newval)
+{
+#ifdef CONFIG_X86_CMPXCHG
+	if (!access_ok(VERIFY_WRITE, uaddr, sizeof(int)))
+		return -EFAULT;
+
+	__asm__ __volatile__(
+		"1:	" LOCK_PREFIX "cmpxchgl %3, %1\n"
+		"2:\n"
+		".section .fixup,\"ax\"\n"
+		"3:	mov %2, %0\n"
+		"	jmp 2b\n"
+		".previous\n"
+		".section __ex_table,\"a\"\n"
+		"	.align 4\n"
+		"	.long 1b,3b\n"
+		".previous"
+		: "=a" (oldval), "+m" (*uaddr)
+		: "i" (-EFAULT), "r" (newval), "0" (oldval)
+		: "memory");
+
+	return oldval;
+#else
+	return -ENOSYS;
+#endif
+}
+
+#endif
+#endif
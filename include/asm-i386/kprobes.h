@@ -40,10 +40,20 @@ typedef u8 kprobe_opcode_t;
 
 #define JPROBE_ENTRY(pentry)	(kprobe_opcode_t *)pentry
 
+#define RELATIVEJUMP_SIZE	5
+/* Most bytes a jump can cover: the last instruction starts in its rel32 */
+#define MAX_OPTIMIZED_LENGTH	(RELATIVEJUMP_SIZE - 1 + MAX_INSN_SIZE)
+
 /* Architecture specific copy of original instruction*/
 struct arch_specific_insn {
 	/* copy of the original instruction */
 	kprobe_opcode_t insn[MAX_INSN_SIZE];
+#ifdef CONFIG_OPTPROBES
+	/* the code the jump goes to, if the probe is optimized */
+	kprobe_opcode_t *detour;
+	/* bytes of whole instructions the jump replaces */
+	int opt_len;
+#endif
 };
 
 
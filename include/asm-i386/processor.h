@@ -667,4 +667,9 @@ extern void select_idle_routine(const struct cpuinfo_x86 *c);
 
 extern unsigned long boot_option_idle_override;
 
+#if defined(CONFIG_SMP) && defined(CONFIG_X86_CMPXCHG)
+/* smp_reschedule_interrupt() calls scheduler_ipi() */
+#define ARCH_HAS_SCHED_WAKE_QUEUE
+#endif
+
 #endif /* __ASM_I386_PROCESSOR_H */
@@ -131,6 +131,12 @@ static inline unsigned long _get_base(char * addr)
 #define wbinvd() \
 	__asm__ __volatile__ ("wbinvd": : :"memory");
 
+/*
+ * Used by the scheduler's migration cost calibration to start each
+ * measurement with cold caches:
+ */
+#define sched_cacheflush() wbinvd()
+
 static inline unsigned long get_limit(unsigned long segment)
 {
 	unsigned long __limit;
@@ -294,8 +294,24 @@
 #define __NR_add_key		286
 #define __NR_request_key	287
 #define __NR_keyctl		288
+#define __NR_migrate_pages	289
+#define __NR_inotify_init	290
+#define __NR_inotify_add_watch	291
+#define __NR_inotify_rm_watch	292
+#define __NR_splice		293
+#define __NR_tee		294
+#define __NR_vmsplice		295
+#define __NR_epoll_ctl_batch	296
+#define __NR_io_setup_sq	297
+#define __NR_ioprio_set		298
+#define __NR_ioprio_get		299
+#define __NR_recvmmsg		300
+#define __NR_sendmmsg		301
+#define __NR_set_robust_list	302
+#define __NR_get_robust_list	303
+#define __NR_perf_counter_open	304
 
-#define NR_syscalls 289
+#define NR_syscalls 305
 
 /*
  * user-visible error numbers are in the range -1 - -128: see
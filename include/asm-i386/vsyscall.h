@@ -0,0 +1,41 @@
+#ifndef _ASM_I386_VSYSCALL_H
+#define _ASM_I386_VSYSCALL_H
+
+/*
+ * The time of day as the vsyscall DSO reads it, from a page of its own
+ * mapped read-only to user space next to the vsyscall page.  It is
+ * written under xtime_lock on every tick and by settimeofday(); seq is
+ * odd while it is being written.
+ */
+
+#include <asm/fixmap.h>
+
+#define VGTOD_MODE_SYSCALL	0	/* Make the system call */
+#define VGTOD_MODE_TSC		1	/* Read the TSC, as get_offset_tsc() */
+
+struct vsyscall_gtod_data {
+	unsigned int	seq;
+	int		mode;
+
+	/* offset in usecs = delay + ((tsc_low - last_tsc_low) * quot) >> 32 */
+	unsigned int	last_tsc_low;
+	unsigned int	quot;
+	unsigned int	delay;
+	unsigned int	max_usec;	/* Clamp when NTP slews backwards */
+
+	long		wall_sec;	/* xtime */
+	long		wall_usec;
+	long		wtm_sec;	/* wall_to_monotonic */
+	long		wtm_nsec;
+	int		tz_minuteswest;	/* sys_tz */
+	int		tz_dsttime;
+};
+
+#define VSYSCALL_GTOD_BASE	(__fix_to_virt(FIX_VSYSCALL_GTOD))
+
+/* The kernel's view of the page */
+extern struct vsyscall_gtod_data *vsyscall_gtod;
+extern void update_vsyscall_gtod(void);
+extern int vsyscall_gtod_tsc(struct vsyscall_gtod_data *vg);
+
+#endif
@@ -13,7 +13,7 @@
 #define SO_BROADCAST	0x0020
 #define SO_LINGER	0x0080
 #define SO_OOBINLINE	0x0100
-/* To add :#define SO_REUSEPORT 0x0200 */
+#define SO_REUSEPORT	0x0200
 #define SO_SNDBUF	0x1001
 #define SO_RCVBUF	0x1002
 #define SO_SNDLOWAT	0x1003
@@ -47,4 +47,6 @@
 
 #define SO_PEERSEC		0x401d
 
+#define SO_BUSY_POLL		0x401e
+
 #endif /* _ASM_SOCKET_H */
@@ -71,6 +71,21 @@ extern void __rw_yield(rwlock_t *lock);
 #define __rw_yield(x)	barrier()
 #define SHARED_PROCESSOR	0
 #endif
+
+/* Hooks for the CONFIG_PREEMPT lock slow paths in kernel/spinlock.c */
+#define _raw_spin_relax(lock)	do {		\
+	HMT_low();				\
+	if (SHARED_PROCESSOR)			\
+		__spin_yield(lock);		\
+	HMT_medium();				\
+} while (0)
+#define _raw_read_relax(lock)	do {		\
+	HMT_low();				\
+	if (SHARED_PROCESSOR)			\
+		__rw_yield(lock);		\
+	HMT_medium();				\
+} while (0)
+#define _raw_write_relax(lock)	_raw_read_relax(lock)
 extern void spin_unlock_wait(spinlock_t *lock);
 
 /*
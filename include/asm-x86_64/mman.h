@@ -36,6 +36,10 @@
 #define MADV_SEQUENTIAL	0x2		/* read-ahead aggressively */
 #define MADV_WILLNEED	0x3		/* pre-fault pages */
 #define MADV_DONTNEED	0x4		/* discard these pages */
+#define MADV_MERGEABLE	12		/* KSM may merge identical pages */
+#define MADV_UNMERGEABLE	13	/* undo MADV_MERGEABLE */
+#define MADV_HUGEPAGE	14		/* back with huge pages where possible */
+#define MADV_NOHUGEPAGE	15		/* undo MADV_HUGEPAGE */
 
 /* compatibility flags */
 #define MAP_ANON	MAP_ANONYMOUS
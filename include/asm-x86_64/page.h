@@ -35,6 +35,10 @@
 void clear_page(void *);
 void copy_page(void *, void *);
 
+/* With non-temporal stores, see arch/x86_64/lib/clear_page.S */
+void clear_page_nocache(void *);
+#define __HAVE_ARCH_CLEAR_PAGE_NOCACHE
+
 #define clear_user_page(page, vaddr, pg)	clear_page(page)
 #define copy_user_page(to, from, vaddr, pg)	copy_page(to, from)
 
@@ -295,6 +295,33 @@ static inline int pmd_large(pmd_t pte) {
 	return (pmd_val(pte) & __LARGE_PTE) == __LARGE_PTE; 
 } 	
 
+/*
+ * Large pmds mapping anonymous user memory (CONFIG_TRANSPARENT_HUGEPAGE).
+ * The following only work if pmd_trans_huge() is true.
+ */
+#define pmd_trans_huge(x)	pmd_large(x)
+static inline int pmd_write(pmd_t pmd)		{ return pmd_val(pmd) & _PAGE_RW; }
+static inline int pmd_dirty(pmd_t pmd)		{ return pmd_val(pmd) & _PAGE_DIRTY; }
+static inline int pmd_young(pmd_t pmd)		{ return pmd_val(pmd) & _PAGE_ACCESSED; }
+static inline pmd_t pmd_mkhuge(pmd_t pmd)	{ return __pmd(pmd_val(pmd) | _PAGE_PSE); }
+static inline pmd_t pmd_mkwrite(pmd_t pmd)	{ return __pmd(pmd_val(pmd) | _PAGE_RW); }
+static inline pmd_t pmd_wrprotect(pmd_t pmd)	{ return __pmd(pmd_val(pmd) & ~_PAGE_RW); }
+static inline pmd_t pmd_mkdirty(pmd_t pmd)	{ return __pmd(pmd_val(pmd) | _PAGE_DIRTY); }
+static inline pmd_t pmd_mkyoung(pmd_t pmd)	{ return __pmd(pmd_val(pmd) | _PAGE_ACCESSED); }
+static inline pmd_t pmd_mkold(pmd_t pmd)	{ return __pmd(pmd_val(pmd) & ~_PAGE_ACCESSED); }
+
+static inline int pmdp_test_and_clear_young(pmd_t *pmdp)
+{
+	if (!pmd_young(*pmdp))
+		return 0;
+	return test_and_clear_bit(_PAGE_BIT_ACCESSED, pmdp);
+}
+
+static inline void pmdp_set_wrprotect(pmd_t *pmdp)
+{
+	clear_bit(_PAGE_BIT_RW, pmdp);
+}
+
 
 /*
  * Conversion functions: convert a page and protection to a page entry,
@@ -398,6 +398,11 @@ static inline void prefetchw(void *x)
 
 #define ARCH_HAS_SPINLOCK_PREFETCH 1
 
+#ifdef CONFIG_SMP
+/* smp_reschedule_interrupt() calls scheduler_ipi() */
+#define ARCH_HAS_SCHED_WAKE_QUEUE
+#endif
+
 #define spin_lock_prefetch(x)  prefetchw(x)
 
 #define cpu_relax()   rep_nop()
@@ -48,8 +48,12 @@ extern void (*mtrr_hook) (void);
 extern void zap_low_mappings(void);
 void smp_stop_cpu(void);
 extern cpumask_t cpu_sibling_map[NR_CPUS];
+extern cpumask_t cpu_core_map[NR_CPUS];
 extern u8 phys_proc_id[NR_CPUS];
 
+/* Cores sharing a package (and its last level cache), for SCHED_MC */
+#define cpu_coregroup_map(cpu)	(cpu_core_map[cpu])
+
 #define SMP_TRAMPOLINE_BASE 0x6000
 
 /*
@@ -178,6 +178,12 @@ static inline void write_cr4(unsigned long val)
 #define wbinvd() \
 	__asm__ __volatile__ ("wbinvd": : :"memory");
 
+/*
+ * Used by the scheduler's migration cost calibration to start each
+ * measurement with cold caches:
+ */
+#define sched_cacheflush() wbinvd()
+
 #endif	/* __KERNEL__ */
 
 #define nop() __asm__ __volatile__ ("nop")
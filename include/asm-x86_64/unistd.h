@@ -563,8 +563,40 @@ __SYSCALL(__NR_add_key, sys_add_key)
 __SYSCALL(__NR_request_key, sys_request_key)
 #define __NR_keyctl		250
 __SYSCALL(__NR_keyctl, sys_keyctl)
-
-#define __NR_syscall_max __NR_keyctl
+#define __NR_migrate_pages	251
+__SYSCALL(__NR_migrate_pages, sys_migrate_pages)
+#define __NR_inotify_init	252
+__SYSCALL(__NR_inotify_init, sys_inotify_init)
+#define __NR_inotify_add_watch	253
+__SYSCALL(__NR_inotify_add_watch, sys_inotify_add_watch)
+#define __NR_inotify_rm_watch	254
+__SYSCALL(__NR_inotify_rm_watch, sys_inotify_rm_watch)
+#define __NR_splice		255
+__SYSCALL(__NR_splice, sys_splice)
+#define __NR_tee		256
+__SYSCALL(__NR_tee, sys_tee)
+#define __NR_vmsplice		257
+__SYSCALL(__NR_vmsplice, sys_vmsplice)
+#define __NR_epoll_ctl_batch	258
+__SYSCALL(__NR_epoll_ctl_batch, sys_epoll_ctl_batch)
+#define __NR_io_setup_sq	259
+__SYSCALL(__NR_io_setup_sq, sys_io_setup_sq)
+#define __NR_ioprio_set		260
+__SYSCALL(__NR_ioprio_set, sys_ioprio_set)
+#define __NR_ioprio_get		261
+__SYSCALL(__NR_ioprio_get, sys_ioprio_get)
+#define __NR_recvmmsg		262
+__SYSCALL(__NR_recvmmsg, sys_recvmmsg)
+#define __NR_sendmmsg		263
+__SYSCALL(__NR_sendmmsg, sys_sendmmsg)
+#define __NR_set_robust_list	264
+__SYSCALL(__NR_set_robust_list, sys_set_robust_list)
+#define __NR_get_robust_list	265
+__SYSCALL(__NR_get_robust_list, sys_get_robust_list)
+#define __NR_perf_counter_open	266
+__SYSCALL(__NR_perf_counter_open, sys_perf_counter_open)
+
+#define __NR_syscall_max __NR_perf_counter_open
 #ifndef __NO_STUBS
 
 /* user-visible error numbers are in the range -1 - -4095 */
@@ -41,6 +41,7 @@ enum {
 	 * IOCB_CMD_POLL = 5,
 	 */
 	IOCB_CMD_NOOP = 6,
+	IOCB_CMD_ACCEPT = 7,
 };
 
 /* read() from /dev/aio returns these structures. */
@@ -85,6 +86,66 @@ struct iocb {
 	__u64	aio_reserved3;
 }; /* 64 bytes */
 
+/*
+ * The completion ring.  io_setup() maps it into the caller's address
+ * space and returns its address as the aio_context_t; the header is
+ * followed by nr io_events.
+ *
+ * The kernel is the only writer of tail: it fills in the event at tail,
+ * issues a write barrier and only then advances tail.  head belongs to
+ * whoever consumes events.  A consumer reads tail, issues a read barrier,
+ * copies out the event at head and then advances head; io_getevents()
+ * does exactly this.  Both indices stay in [0, nr) and the ring is empty
+ * when they are equal.
+ *
+ * When compat_features has AIO_RING_COMPAT_USER_REAP set, the kernel
+ * advances head with a compare-and-exchange, so userspace may reap
+ * events straight from the ring concurrently with io_getevents() as
+ * long as it advances head the same way.  It then only has to enter the
+ * kernel to sleep, with io_getevents(ctx, 1, ...) on an empty ring.
+ */
+#define AIO_RING_MAGIC			0xa10a10a1
+#define AIO_RING_COMPAT_BASE		0x00000001
+#define AIO_RING_COMPAT_USER_REAP	0x00000002
+#define AIO_RING_INCOMPAT_FEATURES	0
+
+struct aio_ring {
+	unsigned	id;	/* kernel internal index number */
+	unsigned	nr;	/* number of io_events */
+	unsigned	head;	/* next event to reap, consumer owned */
+	unsigned	tail;	/* next event to fill, kernel owned */
+
+	unsigned	magic;
+	unsigned	compat_features;
+	unsigned	incompat_features;
+	unsigned	header_length;	/* size of aio_ring */
+
+
+	struct io_event		io_events[0];
+}; /* 128 bytes + ring size */
+
+/*
+ * The submission ring, set up with io_setup_sq().  Userspace stores the
+ * address of an iocb at iocbs[tail], issues a write barrier and advances
+ * tail; a kernel thread submits the iocbs and advances head, which
+ * userspace must not write.  Both indices stay in [0, nr).
+ *
+ * An iocb that cannot be submitted completes with the error in res.
+ * After idling for the time given to io_setup_sq() the thread sets
+ * AIO_SQ_NEED_WAKEUP in flags and sleeps; userspace that finds the flag
+ * set after advancing tail must wake it with io_submit(ctx, 0, NULL).
+ */
+#define AIO_SQ_NEED_WAKEUP	0x00000001
+
+struct aio_sq_ring {
+	unsigned	head;	/* next iocb to submit, kernel owned */
+	unsigned	tail;	/* next free slot, userspace owned */
+	unsigned	nr;	/* number of slots */
+	unsigned	flags;	/* AIO_SQ_* */
+
+	__u64		iocbs[0];	/* struct iocb __user * */
+};
+
 #undef IFBIG
 #undef IFLITTLE
 
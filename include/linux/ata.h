@@ -125,6 +125,14 @@ enum {
 	ATA_CMD_PACKET		= 0xA0,
 	ATA_CMD_VERIFY		= 0x40,
 	ATA_CMD_VERIFY_EXT	= 0x42,
+	ATA_CMD_FPDMA_READ	= 0x60,	/* READ FPDMA QUEUED */
+	ATA_CMD_FPDMA_WRITE	= 0x61,	/* WRITE FPDMA QUEUED */
+	ATA_CMD_READ_LOG_EXT	= 0x2F,
+
+	/* READ LOG EXT pages */
+	ATA_LOG_SATA_NCQ	= 0x10,	/* NCQ command error log */
+	ATA_LOG_NCQ_NQ		= (1 << 7), /* error not from a queued cmd */
+	ATA_LOG_NCQ_TAG		= 0x1f,
 
 	/* SETFEATURES stuff */
 	SETFEATURES_XFER	= 0x03,
@@ -186,6 +194,7 @@ enum ata_tf_protocols {
 	ATA_PROT_ATAPI,		/* packet command, PIO data xfer*/
 	ATA_PROT_ATAPI_NODATA,	/* packet command, no data */
 	ATA_PROT_ATAPI_DMA,	/* packet command with special DMA sauce */
+	ATA_PROT_NCQ,		/* first-party DMA, queued (SATA NCQ) */
 };
 
 enum ata_ioctls {
@@ -233,6 +242,8 @@ struct ata_taskfile {
 #define ata_id_has_pm(id)	((id)[82] & (1 << 3))
 #define ata_id_has_lba(id)	((id)[49] & (1 << 9))
 #define ata_id_has_dma(id)	((id)[49] & (1 << 8))
+#define ata_id_has_ncq(id)	((id)[76] & (1 << 8))
+#define ata_id_queue_depth(id)	(((id)[75] & 0x1f) + 1)
 #define ata_id_removeable(id)	((id)[0] & (1 << 7))
 #define ata_id_u32(id,n)	\
 	(((u32) (id)[(n) + 1] << 16) | ((u32) (id)[(n)]))
@@ -8,8 +8,11 @@
 #ifndef _LINUX_BACKING_DEV_H
 #define _LINUX_BACKING_DEV_H
 
+#include <linux/list.h>
 #include <asm/atomic.h>
 
+struct task_struct;
+
 /*
  * Bits in backing_dev_info.state
  */
@@ -17,6 +20,8 @@ enum bdi_state {
 	BDI_pdflush,		/* A pdflush thread is working this device */
 	BDI_write_congested,	/* The write queue is getting full */
 	BDI_read_congested,	/* The read queue is getting full */
+	BDI_flush_background,	/* Background writeout for the flusher */
+	BDI_flush_kupdate,	/* Old data writeout for the flusher */
 	BDI_unused,		/* Available bits start here */
 };
 
@@ -30,11 +35,62 @@ struct backing_dev_info {
 	void *congested_data;	/* Pointer to aux data for congested func */
 	void (*unplug_io_fn)(struct backing_dev_info *, struct page *);
 	void *unplug_io_data;
+
+	/*
+	 * Dirty memory accounting, see mm/page-writeback.c.  All zero in
+	 * a new backing_dev_info.
+	 */
+	atomic_t nr_reclaimable;	/* Dirty and unstable pages */
+	atomic_t nr_writeback;		/* Pages under writeback */
+	atomic_t writeout_events;	/* Decayed writeout completions */
+	unsigned long writeout_period;	/* Last period they were decayed in */
+	int dirty_exceeded;		/* Over our share of the dirty limit */
+
+	/* The flusher thread, see mm/backing-dev.c */
+	struct task_struct *flusher;
+	int flusher_users;		/* Nested bdi_register()s */
+	unsigned long flush_pages;	/* Background writeout wanted */
+	struct list_head bdi_list;	/* On bdi_list while registered */
 };
 
 extern struct backing_dev_info default_backing_dev_info;
 void default_unplug_io_fn(struct backing_dev_info *bdi, struct page *page);
 
+void bdi_writeout_inc(struct backing_dev_info *bdi);
+
+void bdi_register(struct backing_dev_info *bdi, const char *name);
+void bdi_unregister(struct backing_dev_info *bdi);
+int bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages);
+void bdi_kick_flushers(int work, long nr_pages);
+
+static inline void bdi_mod_reclaimable(struct backing_dev_info *bdi, int nr)
+{
+	atomic_add(nr, &bdi->nr_reclaimable);
+}
+
+static inline void bdi_mod_writeback(struct backing_dev_info *bdi, int nr)
+{
+	atomic_add(nr, &bdi->nr_writeback);
+}
+
+/*
+ * The counters are not updated in lockstep with the page flags, so they
+ * can dip transiently below zero.
+ */
+static inline unsigned long bdi_nr_reclaimable(struct backing_dev_info *bdi)
+{
+	int nr = atomic_read(&bdi->nr_reclaimable);
+
+	return nr > 0 ? nr : 0;
+}
+
+static inline unsigned long bdi_nr_writeback(struct backing_dev_info *bdi)
+{
+	int nr = atomic_read(&bdi->nr_writeback);
+
+	return nr > 0 ? nr : 0;
+}
+
 int writeback_acquire(struct backing_dev_info *bdi);
 int writeback_in_progress(struct backing_dev_info *bdi);
 void writeback_release(struct backing_dev_info *bdi);
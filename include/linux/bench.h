@@ -0,0 +1,45 @@
+#ifndef _LINUX_BENCH_H
+#define _LINUX_BENCH_H
+/*
+ * Microbenchmarks of kernel primitives, see lib/bench.c.
+ *
+ * A benchmark does ops operations in each of 1, 2, 4 ... threads, one
+ * per online cpu, all started together.  Writing a number of
+ * operations to /debug/bench/<name> runs it, and reading the file
+ * gives the cycles per operation of each run.
+ */
+#include <linux/list.h>
+#include <linux/sched.h>
+
+struct dentry;
+
+struct bench {
+	const char	*name;
+
+	/* Before and after the run of each number of threads, or NULL */
+	int		(*setup)(struct bench *b, int nr_threads);
+	void		(*teardown)(struct bench *b, int nr_threads);
+
+	/* Do ops operations, as thread nr of nr_threads */
+	void		(*run)(struct bench *b, int nr, int nr_threads,
+			       unsigned long ops);
+	void		*private;
+
+	/* Private to lib/bench.c */
+	struct list_head list;
+	struct dentry	*dentry;
+	char		*result;
+	size_t		result_len;
+};
+
+extern int bench_register(struct bench *b);
+extern void bench_unregister(struct bench *b);
+
+/* For the loop of a run: give other tasks the cpu now and then */
+static inline void bench_cond_resched(unsigned long i)
+{
+	if (!(i & 1023))
+		cond_resched();
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef _LINUX_BLK_MQ_H
+#define _LINUX_BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+/*
+ * Multi-queue request path, see drivers/block/blk-mq.c and
+ * Documentation/block/mq.txt
+ */
+
+struct blk_mq_ctx;
+
+struct blk_mq_hw_queue {
+	spinlock_t		lock;		/* protects dispatch */
+	struct list_head	dispatch;	/* requests the driver bounced */
+	unsigned long		state;		/* BLK_MQ_S_* bits */
+
+	request_queue_t		*queue;
+	unsigned int		queue_num;
+	void			*driver_data;	/* the driver's, not touched */
+
+	/*
+	 * preallocated requests; a request's tag is its index in rqs
+	 */
+	unsigned int		queue_depth;
+	unsigned long		*tag_map;
+	struct request		*rqs;
+	wait_queue_head_t	wait;		/* for a free tag */
+
+	/*
+	 * the per-cpu submission queues feeding this one, and which of
+	 * them have requests on them
+	 */
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;
+} ____cacheline_aligned_in_smp;
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK,		/* request taken */
+	BLK_MQ_RQ_QUEUE_BUSY,		/* no room, retry it later */
+	BLK_MQ_RQ_QUEUE_ERROR,		/* fail the request */
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_queue *, struct request *);
+
+struct blk_mq_ops {
+	/*
+	 * Start a request on the hardware.  Called without any block layer
+	 * lock held, from process or interrupt context, but never twice at
+	 * once for the same hardware queue.
+	 */
+	queue_rq_fn		*queue_rq;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* tags per hardware queue */
+	unsigned int		cmd_size;	/* driver bytes per request */
+};
+
+#ifdef CONFIG_BLK_MQ
+
+extern request_queue_t *blk_mq_init_queue(struct blk_mq_reg *, void *);
+extern void blk_mq_free_queue(request_queue_t *);
+extern void blk_mq_end_io(struct request *, int);
+extern void blk_mq_run_hw_queue(struct blk_mq_hw_queue *);
+extern void blk_mq_stop_hw_queues(request_queue_t *);
+extern void blk_mq_start_hw_queues(request_queue_t *);
+
+static inline struct blk_mq_hw_queue *blk_mq_rq_hw_queue(struct request *rq)
+{
+	return rq->mq_hctx;
+}
+
+/*
+ * the reg->cmd_size bytes set aside for the driver with each request
+ */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return rq->special;
+}
+
+#endif /* CONFIG_BLK_MQ */
+
+#endif
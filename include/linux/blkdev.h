@@ -22,6 +22,10 @@ typedef struct request_queue request_queue_t;
 struct elevator_queue;
 typedef struct elevator_queue elevator_t;
 struct request_pm_state;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_queue;
+struct blk_trace;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -93,6 +97,21 @@ struct io_context *get_io_context(int gfp_flags);
 void copy_io_context(struct io_context **pdst, struct io_context **psrc);
 void swap_io_context(struct io_context **ioc1, struct io_context **ioc2);
 
+/*
+ * Per-task plugging.  Between blk_start_plug() and blk_finish_plug() the
+ * requests a task builds in __make_request() are kept on the plug, which
+ * lives on its stack, sorted by queue and sector.  They are handed to the
+ * io schedulers in one go, one queue lock round trip per queue, when the
+ * plug is finished or the task goes to sleep.
+ */
+struct blk_plug {
+	struct list_head list;
+};
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug(struct task_struct *);
+
 struct request;
 typedef void (rq_end_io_fn)(struct request *);
 
@@ -185,6 +204,13 @@ struct request {
 	 */
 	rq_end_io_fn *end_io;
 	void *end_io_data;
+
+#ifdef CONFIG_BLK_MQ
+	/*
+	 * hardware queue of a multi-queue request
+	 */
+	struct blk_mq_hw_queue *mq_hctx;
+#endif
 };
 
 /*
@@ -401,6 +427,21 @@ struct request_queue
 	 */
 	struct request		*flush_rq;
 	unsigned char		ordered;
+
+#ifdef CONFIG_BLK_MQ
+	/*
+	 * multi-queue request path, set up by blk_mq_init_queue
+	 */
+	struct blk_mq_ops	*mq_ops;
+	struct blk_mq_ctx	*queue_ctx;	/* per-cpu */
+	unsigned int		*mq_map;	/* cpu -> hardware queue */
+	struct blk_mq_hw_queue	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+#endif
+
+#ifdef CONFIG_BLK_DEV_IO_TRACE
+	struct blk_trace	*blk_trace;
+#endif
 };
 
 enum {
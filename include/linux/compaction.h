@@ -0,0 +1,42 @@
+#ifndef _LINUX_COMPACTION_H
+#define _LINUX_COMPACTION_H
+
+/*
+ * Memory compaction: migrating movable pages from the low end of a
+ * zone into free pages at its high end, so that the free memory at
+ * the low end merges into high-order blocks.
+ */
+
+#include <linux/config.h>
+
+/* Results of compacting, best last */
+#define COMPACT_SKIPPED		0	/* too few free pages to try */
+#define COMPACT_CONTINUE	1	/* not done yet */
+#define COMPACT_COMPLETE	2	/* the whole zone has been compacted */
+#define COMPACT_PARTIAL		3	/* a page of the order wanted is free */
+
+struct zone;
+struct ctl_table;
+struct file;
+
+#ifdef CONFIG_COMPACTION
+
+extern int sysctl_compact_memory;
+extern int sysctl_compaction_handler(struct ctl_table *table, int write,
+			struct file *file, void __user *buffer,
+			size_t *length, loff_t *ppos);
+
+extern int try_to_compact_pages(struct zone **zones, int order,
+			unsigned int gfp_mask);
+
+#else
+
+static inline int try_to_compact_pages(struct zone **zones, int order,
+			unsigned int gfp_mask)
+{
+	return COMPACT_SKIPPED;
+}
+
+#endif /* CONFIG_COMPACTION */
+
+#endif /* _LINUX_COMPACTION_H */
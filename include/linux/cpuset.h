@@ -26,6 +26,13 @@ int cpuset_zonelist_valid_mems_allowed(struct zonelist *zl);
 int cpuset_zone_allowed(struct zone *z);
 extern struct file_operations proc_cpuset_operations;
 extern char *cpuset_task_status_allowed(struct task_struct *task, char *buffer);
+#ifdef CONFIG_FAIR_GROUP_SCHED
+extern struct sched_share *cpuset_sched_share(struct task_struct *p);
+#endif
+#ifdef CONFIG_MEM_CONTROLLER
+struct mem_container;
+extern struct mem_container *cpuset_mem_container(struct task_struct *p);
+#endif
 
 #else /* !CONFIG_CPUSETS */
 
@@ -59,6 +66,13 @@ static inline char *cpuset_task_status_allowed(struct task_struct *task,
 	return buffer;
 }
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+static inline struct sched_share *cpuset_sched_share(struct task_struct *p)
+{
+	return NULL;
+}
+#endif
+
 #endif /* !CONFIG_CPUSETS */
 
 #endif /* _LINUX_CPUSET_H */
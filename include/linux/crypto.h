@@ -32,6 +32,8 @@
 #define CRYPTO_ALG_TYPE_DIGEST		0x00000002
 #define CRYPTO_ALG_TYPE_COMPRESS	0x00000004
 
+#define CRYPTO_ALG_ASYNC		0x00000100	/* cia_submit only */
+
 /*
  * Transform masks and values (for crt_flags).
  */
@@ -45,6 +47,7 @@
 #define CRYPTO_TFM_MODE_CTR		0x00000008
 
 #define CRYPTO_TFM_REQ_WEAK_KEY		0x00000100
+#define CRYPTO_TFM_REQ_MAY_ASYNC	0x00000200
 #define CRYPTO_TFM_RES_WEAK_KEY		0x00100000
 #define CRYPTO_TFM_RES_BAD_KEY_LEN   	0x00200000
 #define CRYPTO_TFM_RES_BAD_KEY_SCHED 	0x00400000
@@ -61,10 +64,51 @@
 #define CRYPTO_DIR_DECRYPT		0
 
 struct scatterlist;
+struct crypto_tfm;
+
+/*
+ * Asynchronous cipher requests, submitted with crypto_cipher_encrypt_async()
+ * or crypto_cipher_decrypt_async().  These return
+ *
+ *   0 or an error	 the request is done, complete is not called;
+ *   -EINPROGRESS	 complete is called when it is done, maybe from
+ *			 interrupt context;
+ *   -EBUSY		 the queue of the algorithm is full.  With
+ *			 CRYPTO_REQ_MAY_BACKLOG the request is queued all
+ *			 the same, but the caller should wait for some to
+ *			 complete before submitting more; without it the
+ *			 request was not queued.
+ *
+ * The request, its scatterlists and IV must stay put until it is done.
+ */
+struct cipher_request;
+
+typedef void (*crypto_completion_t)(struct cipher_request *req, int err);
+
+struct cipher_request {
+	struct list_head list;
+	struct crypto_tfm *tfm;
+	u32 flags;
+	int dir;			/* CRYPTO_DIR_* */
+
+	struct scatterlist *dst;
+	struct scatterlist *src;
+	unsigned int nbytes;
+	u8 *iv;				/* NULL: none, for ECB */
+
+	crypto_completion_t complete;
+	void *data;
+};
+
+#define CRYPTO_REQ_MAY_BACKLOG		0x00000001
 
 /*
  * Algorithms: modular crypto algorithm implementations, managed
  * via crypto_register_alg() and crypto_unregister_alg().
+ *
+ * A cipher driving hardware sets cia_submit, which queues the request
+ * and returns as crypto_cipher_encrypt_async() does, and CRYPTO_ALG_ASYNC
+ * in cra_flags if it has no cia_encrypt and cia_decrypt to fall back on.
  */
 struct cipher_alg {
 	unsigned int cia_min_keysize;
@@ -73,6 +117,7 @@ struct cipher_alg {
 	                  unsigned int keylen, u32 *flags);
 	void (*cia_encrypt)(void *ctx, u8 *dst, const u8 *src);
 	void (*cia_decrypt)(void *ctx, u8 *dst, const u8 *src);
+	int (*cia_submit)(void *ctx, struct cipher_request *req);
 };
 
 struct digest_alg {
@@ -97,12 +142,21 @@ struct compress_alg {
 #define cra_digest	cra_u.digest
 #define cra_compress	cra_u.compress
 
+/*
+ * Several implementations of an algorithm may be registered under its
+ * cra_name, told apart by cra_driver_name (cra_name if left empty).  A
+ * transform asked for by cra_name gets the one with the highest
+ * cra_priority, so hardware drivers should register above the 0 of
+ * the software implementations.
+ */
 struct crypto_alg {
 	struct list_head cra_list;
 	u32 cra_flags;
 	unsigned int cra_blocksize;
 	unsigned int cra_ctxsize;
+	int cra_priority;
 	const char cra_name[CRYPTO_MAX_ALG_NAME];
+	char cra_driver_name[CRYPTO_MAX_ALG_NAME];
 
 	union {
 		struct cipher_alg cipher;
@@ -131,12 +185,36 @@ static inline int crypto_alg_available(const char *name, u32 flags)
 }
 #endif
 
+/*
+ * Queue of requests for the drivers of asynchronous algorithms to keep
+ * under their own lock.  crypto_enqueue_request() returns as
+ * crypto_cipher_encrypt_async() does.
+ */
+struct crypto_queue {
+	struct list_head list;
+	unsigned int qlen;
+	unsigned int max_qlen;
+};
+
+void crypto_init_queue(struct crypto_queue *queue, unsigned int max_qlen);
+int crypto_enqueue_request(struct crypto_queue *queue,
+			   struct cipher_request *req);
+struct cipher_request *crypto_dequeue_request(struct crypto_queue *queue);
+
+static inline void cipher_request_complete(struct cipher_request *req, int err)
+{
+	req->complete(req, err);
+}
+
 /*
  * Transforms: user-instantiated objects which encapsulate algorithms
  * and core processing logic.  Managed via crypto_alloc_tfm() and
  * crypto_free_tfm(), as well as the various helpers below.
+ *
+ * Only transforms allocated with CRYPTO_TFM_REQ_MAY_ASYNC get algorithms
+ * with CRYPTO_ALG_ASYNC; their synchronous calls sleep until the
+ * request is done.
  */
-struct crypto_tfm;
 
 struct cipher_tfm {
 	void *cit_iv;
@@ -161,6 +239,7 @@ struct cipher_tfm {
 			   struct scatterlist *src,
 			   unsigned int nbytes, u8 *iv);
 	void (*cit_xor_block)(u8 *dst, const u8 *src);
+	int (*cit_submit)(struct cipher_request *req);
 };
 
 struct digest_tfm {
@@ -227,6 +306,11 @@ static inline const char *crypto_tfm_alg_name(struct crypto_tfm *tfm)
 	return tfm->__crt_alg->cra_name;
 }
 
+static inline const char *crypto_tfm_alg_driver_name(struct crypto_tfm *tfm)
+{
+	return tfm->__crt_alg->cra_driver_name;
+}
+
 static inline const char *crypto_tfm_alg_modname(struct crypto_tfm *tfm)
 {
 	return module_name(tfm->__crt_alg->cra_module);
@@ -351,6 +435,42 @@ static inline int crypto_cipher_decrypt_iv(struct crypto_tfm *tfm,
 	return tfm->crt_cipher.cit_decrypt_iv(tfm, dst, src, nbytes, iv);
 }
 
+static inline void cipher_request_init(struct cipher_request *req,
+                                       struct crypto_tfm *tfm, u32 flags,
+                                       crypto_completion_t complete,
+                                       void *data)
+{
+	req->tfm = tfm;
+	req->flags = flags;
+	req->complete = complete;
+	req->data = data;
+}
+
+static inline void cipher_request_set_crypt(struct cipher_request *req,
+                                            struct scatterlist *dst,
+                                            struct scatterlist *src,
+                                            unsigned int nbytes, u8 *iv)
+{
+	req->dst = dst;
+	req->src = src;
+	req->nbytes = nbytes;
+	req->iv = iv;
+}
+
+static inline int crypto_cipher_encrypt_async(struct cipher_request *req)
+{
+	BUG_ON(crypto_tfm_alg_type(req->tfm) != CRYPTO_ALG_TYPE_CIPHER);
+	req->dir = CRYPTO_DIR_ENCRYPT;
+	return req->tfm->crt_cipher.cit_submit(req);
+}
+
+static inline int crypto_cipher_decrypt_async(struct cipher_request *req)
+{
+	BUG_ON(crypto_tfm_alg_type(req->tfm) != CRYPTO_ALG_TYPE_CIPHER);
+	req->dir = CRYPTO_DIR_DECRYPT;
+	return req->tfm->crt_cipher.cit_submit(req);
+}
+
 static inline void crypto_cipher_set_iv(struct crypto_tfm *tfm,
                                         const u8 *src, unsigned int len)
 {
@@ -0,0 +1,75 @@
+#ifndef _LINUX_DELAYACCT_H
+#define _LINUX_DELAYACCT_H
+/*
+ * Per-task delay accounting, see kernel/delayacct.c.
+ *
+ * The time a task waits for synchronous block I/O in io_schedule(),
+ * for swapin, and in direct reclaim is added up in current->delays.
+ * Its wait for a cpu is the sched_info run_delay.  Booting with
+ * nodelayacct leaves the totals at zero.
+ */
+#include <linux/config.h>
+#include <linux/sched.h>
+
+/* current->delays.flags */
+#define DELAYACCT_PF_SWAPIN	0x1	/* Block I/O is for a swapin */
+
+#ifdef CONFIG_TASK_DELAY_ACCT
+
+extern int delayacct_on;
+
+extern void delayacct_init_task(struct task_struct *tsk);
+extern void __delayacct_blkio_end(void);
+extern void __delayacct_freepages_end(void);
+extern void delayacct_add_tsk(struct taskstats *stats,
+			      struct task_struct *tsk);
+
+static inline void delayacct_set_flag(int flag)
+{
+	current->delays.flags |= flag;
+}
+
+static inline void delayacct_clear_flag(int flag)
+{
+	current->delays.flags &= ~flag;
+}
+
+static inline void delayacct_blkio_start(void)
+{
+	if (delayacct_on)
+		current->delays.blkio_start = sched_clock();
+}
+
+static inline void delayacct_blkio_end(void)
+{
+	if (delayacct_on)
+		__delayacct_blkio_end();
+}
+
+static inline void delayacct_freepages_start(void)
+{
+	if (delayacct_on)
+		current->delays.freepages_start = sched_clock();
+}
+
+static inline void delayacct_freepages_end(void)
+{
+	if (delayacct_on)
+		__delayacct_freepages_end();
+}
+
+#else
+
+static inline void delayacct_init_task(struct task_struct *tsk) { }
+static inline void
+delayacct_add_tsk(struct taskstats *stats, struct task_struct *tsk) { }
+static inline void delayacct_set_flag(int flag) { }
+static inline void delayacct_clear_flag(int flag) { }
+static inline void delayacct_blkio_start(void) { }
+static inline void delayacct_blkio_end(void) { }
+static inline void delayacct_freepages_start(void) { }
+static inline void delayacct_freepages_end(void) { }
+
+#endif
+
+#endif
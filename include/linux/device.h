@@ -107,6 +107,8 @@ struct device_driver {
 
 	struct module 		* owner;
 
+	int	multithread_probe;	/* probe in a thread of its own at boot */
+
 	int	(*probe)	(struct device * dev);
 	int 	(*remove)	(struct device * dev);
 	void	(*shutdown)	(struct device * dev);
@@ -329,6 +331,7 @@ extern void device_bind_driver(struct device * dev);
 extern void device_release_driver(struct device * dev);
 extern int  device_attach(struct device * dev);
 extern void driver_attach(struct device_driver * drv);
+extern void wait_for_device_probe(void);
 
 
 /* driverfs interface for exporting device attributes */
@@ -388,6 +388,10 @@ struct ethtool_ops {
 #define ETHTOOL_GSTATS		0x0000001d /* get NIC-specific statistics */
 #define ETHTOOL_GTSO		0x0000001e /* Get TSO enable (ethtool_value) */
 #define ETHTOOL_STSO		0x0000001f /* Set TSO enable (ethtool_value) */
+#define ETHTOOL_GGSO		0x00000020 /* Get GSO enable (ethtool_value) */
+#define ETHTOOL_SGSO		0x00000021 /* Set GSO enable (ethtool_value) */
+#define ETHTOOL_GGRO		0x00000022 /* Get GRO enable (ethtool_value) */
+#define ETHTOOL_SGRO		0x00000023 /* Set GRO enable (ethtool_value) */
 
 /* compatibility with older code */
 #define SPARC_ETH_GSET		ETHTOOL_GSET
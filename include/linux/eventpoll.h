@@ -22,6 +22,13 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Add the target's wait queue entry as exclusive, so that a wakeup of a
+ * target watched by several epoll instances only wakes one of them.
+ * Only valid with EPOLL_CTL_ADD.
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /* Set the One Shot behaviour for the target file descriptor */
 #define EPOLLONESHOT (1 << 30)
 
@@ -43,6 +50,18 @@ struct epoll_event {
 	__u64 data;
 } EPOLL_PACKED;
 
+/*
+ * One operation of epoll_ctl_batch(2): "op", "fd", "events" and "data" are
+ * the epoll_ctl(2) arguments, and "result" gets its return value.
+ */
+struct epoll_ctl_cmd {
+	__s32 op;
+	__s32 fd;
+	__u32 events;
+	__s32 result;
+	__u64 data;
+};
+
 #ifdef __KERNEL__
 
 /* Forward declarations to avoid compiler errors */
@@ -0,0 +1,79 @@
+/*
+ *  linux/include/linux/ext3_extents.h
+ *
+ *  On-disk format of extent mapped ext3 files.
+ */
+
+#ifndef _LINUX_EXT3_EXTENTS_H
+#define _LINUX_EXT3_EXTENTS_H
+
+#include <linux/types.h>
+
+/*
+ * A file with EXT3_EXTENTS_FL set maps its blocks through a tree rooted
+ * in i_data instead of through direct and indirect blocks.  Every node,
+ * the root included, starts with an ext3_extent_header.  Leaves (depth
+ * 0) hold ext3_extents, sorted by ee_block; index nodes hold
+ * ext3_extent_idxs, sorted by ei_block, each pointing to a node one
+ * level down whose entries all start at or after ei_block.
+ *
+ * Only the low 32 bits of block numbers are used; ee_start_hi and
+ * ei_leaf_hi must be zero.
+ */
+struct ext3_extent {
+	__le32	ee_block;	/* first logical block extent covers */
+	__le16	ee_len;		/* number of blocks covered by extent */
+	__le16	ee_start_hi;	/* high 16 bits of physical block */
+	__le32	ee_start;	/* low 32 bits of physical block */
+};
+
+struct ext3_extent_idx {
+	__le32	ei_block;	/* index covers logical blocks from 'block' */
+	__le32	ei_leaf;	/* pointer to the physical block of the next
+				 * level: leaf or next index could be there */
+	__le16	ei_leaf_hi;	/* high 16 bits of physical block */
+	__u16	ei_unused;
+};
+
+struct ext3_extent_header {
+	__le16	eh_magic;	/* probably will support different formats */
+	__le16	eh_entries;	/* number of valid entries */
+	__le16	eh_max;		/* capacity of store in entries */
+	__le16	eh_depth;	/* has tree real underlying blocks? */
+	__le32	eh_generation;	/* generation of the tree */
+};
+
+#define EXT3_EXT_MAGIC		0xf30a
+
+/* longest run of blocks a single extent may map */
+#define EXT3_EXT_MAX_LEN	32768
+
+/* deepest tree we will build or follow */
+#define EXT3_EXT_MAX_DEPTH	5
+
+#define EXT_FIRST_EXTENT(__hdr__) \
+	((struct ext3_extent *) (((char *) (__hdr__)) +		\
+				 sizeof(struct ext3_extent_header)))
+#define EXT_FIRST_INDEX(__hdr__) \
+	((struct ext3_extent_idx *) (((char *) (__hdr__)) +	\
+				     sizeof(struct ext3_extent_header)))
+#define EXT_LAST_EXTENT(__hdr__) \
+	(EXT_FIRST_EXTENT((__hdr__)) + le16_to_cpu((__hdr__)->eh_entries) - 1)
+#define EXT_LAST_INDEX(__hdr__) \
+	(EXT_FIRST_INDEX((__hdr__)) + le16_to_cpu((__hdr__)->eh_entries) - 1)
+
+#ifdef __KERNEL__
+
+/*
+ * One level of a lookup, from the root (path[0]) down to the leaf.
+ */
+struct ext3_ext_path {
+	struct ext3_extent_header	*p_hdr;
+	struct ext3_extent_idx		*p_idx;	/* index levels */
+	struct ext3_extent		*p_ext;	/* leaf level */
+	struct buffer_head		*p_bh;	/* NULL for the root */
+};
+
+#endif	/* __KERNEL__ */
+
+#endif	/* _LINUX_EXT3_EXTENTS_H */
@@ -185,6 +185,7 @@ struct ext3_group_desc
 #define EXT3_NOTAIL_FL			0x00008000 /* file tail should not be merged */
 #define EXT3_DIRSYNC_FL			0x00010000 /* dirsync behaviour (directories only) */
 #define EXT3_TOPDIR_FL			0x00020000 /* Top of directory hierarchies*/
+#define EXT3_EXTENTS_FL			0x00080000 /* Inode uses extents */
 #define EXT3_RESERVED_FL		0x80000000 /* reserved for ext3 lib */
 
 #define EXT3_FL_USER_VISIBLE		0x0003DFFF /* User visible flags */
@@ -357,6 +358,10 @@ struct ext3_inode {
 #define EXT3_MOUNT_POSIX_ACL		0x08000	/* POSIX Access Control Lists */
 #define EXT3_MOUNT_RESERVATION		0x10000	/* Preallocation */
 #define EXT3_MOUNT_BARRIER		0x20000 /* Use block barriers */
+#define EXT3_MOUNT_EXTENTS		0x40000 /* Extent map new files */
+#define EXT3_MOUNT_DELALLOC		0x80000 /* Delay block allocation */
+#define EXT3_MOUNT_JOURNAL_CHECKSUM	0x100000 /* Checksum transactions */
+#define EXT3_MOUNT_JOURNAL_ASYNC_COMMIT	0x200000 /* Don't wait for commit */
 
 /* Compatibility, for having both ext2_fs.h and ext3_fs.h included at once */
 #ifndef _LINUX_EXT2_FS_H
@@ -464,7 +469,11 @@ struct ext3_super_block {
 	__u16	s_reserved_word_pad;
 	__le32	s_default_mount_opts;
 	__le32	s_first_meta_bg; 	/* First metablock block group */
-	__u32	s_reserved[190];	/* Padding to the end of the block */
+	__u32	s_reserved1[27];	/* Fields not used by ext3 */
+/*174*/	__u8	s_log_groups_per_flex;	/* FLEX_BG group size */
+	__u8	s_reserved_char_pad2;
+	__le16	s_reserved_pad;
+	__u32	s_reserved[162];	/* Padding to the end of the block */
 };
 
 #ifdef __KERNEL__
@@ -544,11 +553,15 @@ static inline struct ext3_inode_info *EXT3_I(struct inode *inode)
 #define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004 /* Needs recovery */
 #define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008 /* Journal device */
 #define EXT3_FEATURE_INCOMPAT_META_BG		0x0010
+#define EXT3_FEATURE_INCOMPAT_EXTENTS		0x0040 /* extents support */
+#define EXT3_FEATURE_INCOMPAT_FLEX_BG		0x0200
 
 #define EXT3_FEATURE_COMPAT_SUPP	EXT2_FEATURE_COMPAT_EXT_ATTR
 #define EXT3_FEATURE_INCOMPAT_SUPP	(EXT3_FEATURE_INCOMPAT_FILETYPE| \
 					 EXT3_FEATURE_INCOMPAT_RECOVER| \
-					 EXT3_FEATURE_INCOMPAT_META_BG)
+					 EXT3_FEATURE_INCOMPAT_META_BG| \
+					 EXT3_FEATURE_INCOMPAT_EXTENTS| \
+					 EXT3_FEATURE_INCOMPAT_FLEX_BG)
 #define EXT3_FEATURE_RO_COMPAT_SUPP	(EXT3_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT3_FEATURE_RO_COMPAT_LARGE_FILE| \
 					 EXT3_FEATURE_RO_COMPAT_BTREE_DIR)
@@ -714,6 +727,8 @@ struct dir_private_info {
 extern int ext3_bg_has_super(struct super_block *sb, int group);
 extern unsigned long ext3_bg_num_gdb(struct super_block *sb, int group);
 extern int ext3_new_block (handle_t *, struct inode *, unsigned long, int *);
+extern int ext3_new_blocks (handle_t *, struct inode *, unsigned long,
+			    unsigned long *, int *);
 extern void ext3_free_blocks (handle_t *, struct inode *, unsigned long,
 			      unsigned long);
 extern void ext3_free_blocks_sb (handle_t *, struct super_block *,
@@ -724,6 +739,8 @@ extern struct ext3_group_desc * ext3_get_group_desc(struct super_block * sb,
 						    unsigned int block_group,
 						    struct buffer_head ** bh);
 extern int ext3_should_retry_alloc(struct super_block *sb, int *retries);
+extern int ext3_reserve_blocks(struct super_block *sb, unsigned long count);
+extern void ext3_release_blocks(struct super_block *sb, unsigned long count);
 extern void ext3_rsv_window_add(struct super_block *sb, struct ext3_reserve_window_node *rsv);
 
 /* dir.c */
@@ -738,6 +755,13 @@ extern void ext3_htree_free_dir_info(struct dir_private_info *p);
 /* fsync.c */
 extern int ext3_sync_file (struct file *, struct dentry *, int);
 
+/* extents.c */
+extern int ext3_ext_get_block(handle_t *, struct inode *, sector_t,
+			      struct buffer_head *, int, int);
+extern void ext3_ext_truncate(handle_t *, struct inode *, unsigned long);
+extern int ext3_ext_trans_blocks(struct inode *, int);
+extern void ext3_ext_tree_init(struct inode *);
+
 /* hash.c */
 extern int ext3fs_dirhash(const char *name, int len, struct
 			  dx_hash_info *hinfo);
@@ -127,6 +127,16 @@ struct ext3_inode_info {
 	 * by other means, so we have truncate_sem.
 	 */
 	struct semaphore truncate_sem;
+
+	/*
+	 * Blocks set aside for delayed allocation: one for each dirty
+	 * buffer not yet mapped to disk, and an estimate of the indirect
+	 * blocks mapping them will need.
+	 */
+	spinlock_t i_block_reservation_lock;
+	unsigned long i_reserved_data_blocks;
+	unsigned long i_reserved_meta_blocks;
+
 	struct inode vfs_inode;
 };
 
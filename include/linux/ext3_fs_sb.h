@@ -48,6 +48,7 @@ struct ext3_sb_info {
 	unsigned short s_pad;
 	int s_addr_per_block_bits;
 	int s_desc_per_block_bits;
+	int s_log_groups_per_flex;	/* 0 unless groups are packed (flex_bg) */
 	int s_inode_size;
 	int s_first_ino;
 	spinlock_t s_next_gen_lock;
@@ -57,6 +58,7 @@ struct ext3_sb_info {
 	struct percpu_counter s_freeblocks_counter;
 	struct percpu_counter s_freeinodes_counter;
 	struct percpu_counter s_dirs_counter;
+	struct percpu_counter s_dirtyblocks_counter; /* delalloc reservations */
 	struct blockgroup_lock s_blockgroup_lock;
 
 	/* root of the per fs reservation window tree */
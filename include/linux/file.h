@@ -9,6 +9,7 @@
 #include <linux/posix_types.h>
 #include <linux/compiler.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 
 /*
  * The default fd array needs to be at least BITS_PER_LONG,
@@ -18,6 +19,10 @@
 
 /*
  * Open file table structure
+ *
+ * fd and max_fds may also be read under rcu_read_lock(), with
+ * fcheck_files(): a larger fd array is published before max_fds, and the
+ * old one is only freed a grace period later.
  */
 struct files_struct {
         atomic_t count;
@@ -60,12 +65,22 @@ extern void free_fdset(fd_set *, int);
 
 extern int expand_files(struct files_struct *, int nr);
 
+/*
+ * Called with files->file_lock held, or under rcu_read_lock().  In the
+ * latter case the file may be on its way to __fput(), and needs
+ * get_file_rcu() before it can be used.
+ */
 static inline struct file * fcheck_files(struct files_struct *files, unsigned int fd)
 {
 	struct file * file = NULL;
 
-	if (fd < files->max_fds)
-		file = files->fd[fd];
+	if (fd < files->max_fds) {
+		struct file **fdt;
+
+		smp_rmb();		/* max_fds before fd, see expand_fd_array() */
+		fdt = rcu_dereference(files->fd);
+		file = rcu_dereference(fdt[fd]);
+	}
 	return file;
 }
 
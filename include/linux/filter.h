@@ -9,6 +9,7 @@
 #include <linux/types.h>
 
 #ifdef __KERNEL__
+#include <linux/config.h>
 #include <asm/atomic.h>
 #endif
 
@@ -38,10 +39,17 @@ struct sock_fprog	/* Required for SO_ATTACH_FILTER. */
 };
 
 #ifdef __KERNEL__
+struct sk_buff;
+
 struct sk_filter
 {
 	atomic_t		refcnt;
         unsigned int         	len;	/* Number of filter blocks */
+#ifdef CONFIG_BPF_JIT
+	/* native code for insns, NULL if it could not be compiled */
+	unsigned int		(*bpf_func)(const struct sk_buff *skb,
+					    const struct sock_filter *filter);
+#endif
         struct sock_filter     	insns[0];
 };
 
@@ -146,6 +154,32 @@ struct sock;
 extern int sk_run_filter(struct sk_buff *skb, struct sock_filter *filter, int flen);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
 extern int sk_chk_filter(struct sock_filter *filter, int flen);
+
+#ifdef CONFIG_BPF_JIT
+extern void bpf_jit_compile(struct sk_filter *fp);
+extern void bpf_jit_free(struct sk_filter *fp);
+#else
+static inline void bpf_jit_compile(struct sk_filter *fp)
+{
+}
+
+static inline void bpf_jit_free(struct sk_filter *fp)
+{
+}
+#endif
+
+/*
+ * Run an attached filter: through its compiled image when the JIT
+ * managed to translate it, through the interpreter otherwise.
+ */
+static inline int sk_filter_run(struct sk_buff *skb, struct sk_filter *fp)
+{
+#ifdef CONFIG_BPF_JIT
+	if (fp->bpf_func)
+		return fp->bpf_func(skb, fp->insns);
+#endif
+	return sk_run_filter(skb, fp->insns, fp->len);
+}
 #endif /* __KERNEL__ */
 
 #endif /* __LINUX_FILTER_H__ */
@@ -1,6 +1,9 @@
 #ifndef _LINUX_FUTEX_H
 #define _LINUX_FUTEX_H
 
+#include <linux/config.h>
+#include <linux/compiler.h>
+
 /* Second argument to futex syscall */
 
 
@@ -9,9 +12,83 @@
 #define FUTEX_FD (2)
 #define FUTEX_REQUEUE (3)
 #define FUTEX_CMP_REQUEUE (4)
+#define FUTEX_LOCK_PI (5)
+#define FUTEX_UNLOCK_PI (6)
+#define FUTEX_TRYLOCK_PI (7)
+
+/*
+ * The word of a priority inheritance futex holds the TID of its owner,
+ * or 0 when it is free, so that userspace can take and release it with
+ * a compare-and-exchange alone.  The kernel sets FUTEX_WAITERS as soon
+ * as anybody blocks in FUTEX_LOCK_PI, which sends the unlock to
+ * FUTEX_UNLOCK_PI; it hands the lock straight to the waiter of highest
+ * priority, lowering the owner back to its own priority.
+ *
+ * FUTEX_OWNER_DIED is set when the lock is taken over from an owner
+ * that exited while holding it.
+ */
+#define FUTEX_WAITERS		0x80000000
+#define FUTEX_OWNER_DIED	0x40000000
+#define FUTEX_TID_MASK		0x3fffffff
+
+/*
+ * Or'ed into the operation when the futex is only ever used by the
+ * threads of one process: it is then keyed on the address alone,
+ * without looking at the mapping.  Waiters and wakers must agree on
+ * the flag.  Not for FUTEX_FD.
+ */
+#define FUTEX_PRIVATE_FLAG	128
+#define FUTEX_CMD_MASK		~FUTEX_PRIVATE_FLAG
+
+#define FUTEX_WAIT_PRIVATE	(FUTEX_WAIT | FUTEX_PRIVATE_FLAG)
+#define FUTEX_WAKE_PRIVATE	(FUTEX_WAKE | FUTEX_PRIVATE_FLAG)
+#define FUTEX_REQUEUE_PRIVATE	(FUTEX_REQUEUE | FUTEX_PRIVATE_FLAG)
+#define FUTEX_CMP_REQUEUE_PRIVATE (FUTEX_CMP_REQUEUE | FUTEX_PRIVATE_FLAG)
+#define FUTEX_LOCK_PI_PRIVATE	(FUTEX_LOCK_PI | FUTEX_PRIVATE_FLAG)
+#define FUTEX_UNLOCK_PI_PRIVATE	(FUTEX_UNLOCK_PI | FUTEX_PRIVATE_FLAG)
+#define FUTEX_TRYLOCK_PI_PRIVATE (FUTEX_TRYLOCK_PI | FUTEX_PRIVATE_FLAG)
 
 long do_futex(unsigned long uaddr, int op, int val,
 		unsigned long timeout, unsigned long uaddr2, int val2,
 		int val3);
 
+/*
+ * Robust futexes: a thread keeps the futexes it holds on a list in its
+ * own memory, registered with set_robust_list(), and the kernel walks
+ * it when the thread exits.  Every futex on it still holding the TID
+ * of the thread gets FUTEX_OWNER_DIED, and one waiter is woken.
+ * Nothing is asked of the kernel while the thread locks and unlocks.
+ *
+ * The list is circular through the head, and futex_offset leads from
+ * a list entry to its futex word.  list_op_pending points at the
+ * entry of a lock that is being taken or released, which may or may
+ * not be on the list yet.  Waiters must use the shared futex
+ * operations, as that is how the kernel wakes them.
+ */
+struct robust_list {
+	struct robust_list __user *next;
+};
+
+struct robust_list_head {
+	struct robust_list list;
+	long futex_offset;
+	struct robust_list __user *list_op_pending;
+};
+
+/* Entries walked at most, so a list that loops cannot hang the exit */
+#define ROBUST_LIST_LIMIT	2048
+
+struct task_struct;
+#ifdef CONFIG_FUTEX
+extern void exit_pi_state_list(struct task_struct *curr);
+extern void exit_robust_list(struct task_struct *curr);
+#else
+static inline void exit_pi_state_list(struct task_struct *curr)
+{
+}
+static inline void exit_robust_list(struct task_struct *curr)
+{
+}
+#endif
+
 #endif
@@ -62,6 +62,21 @@ static inline void clear_highpage(struct page *page)
 	kunmap_atomic(kaddr, KM_USER0);
 }
 
+#ifndef __HAVE_ARCH_CLEAR_PAGE_NOCACHE
+#define clear_page_nocache(page)	clear_page(page)
+#endif
+
+/*
+ * Clear a page which will not be used soon, without pulling it into
+ * the caches where the architecture can.
+ */
+static inline void clear_highpage_nocache(struct page *page)
+{
+	void *kaddr = kmap_atomic(page, KM_USER0);
+	clear_page_nocache(kaddr);
+	kunmap_atomic(kaddr, KM_USER0);
+}
+
 /*
  * Same but also flushes aliased cache contents to RAM.
  */
@@ -0,0 +1,177 @@
+/*
+ *  include/linux/hrtimer.h
+ *
+ *  hrtimers - High-resolution kernel timers
+ *
+ *  The timer wheel in kernel/timer.c is optimized for timeouts which
+ *  almost never expire (networking, I/O), so it trades precision for
+ *  cheap insertion and removal. hrtimers are for the opposite case:
+ *  timers which are expected to expire (nanosleep, itimers, POSIX
+ *  timers), kept sorted in a per-CPU rbtree with nanosecond expiry.
+ *
+ *  Without an architecture event device they are run from the timer
+ *  softirq, i.e. with tick resolution. With CONFIG_HIGH_RES_TIMERS the
+ *  architecture programs a one-shot interrupt for the first pending
+ *  expiry and calls hrtimer_interrupt() from it.
+ */
+#ifndef _LINUX_HRTIMER_H
+#define _LINUX_HRTIMER_H
+
+#include <linux/config.h>
+#include <linux/rbtree.h>
+#include <linux/ktime.h>
+#include <linux/init.h>
+#include <linux/spinlock.h>
+
+struct task_struct;
+
+/*
+ * Mode arguments of xxx_hrtimer functions:
+ */
+enum hrtimer_mode {
+	HRTIMER_ABS,	/* Time value is absolute */
+	HRTIMER_REL,	/* Time value is relative to now */
+};
+
+/*
+ * Return values of the timer callback function:
+ */
+enum hrtimer_restart {
+	HRTIMER_NORESTART,	/* Timer is not restarted */
+	HRTIMER_RESTART,	/* Timer must be restarted */
+};
+
+#define HRTIMER_INACTIVE	((void *)1UL)
+
+struct hrtimer_base;
+
+/**
+ * struct hrtimer - the basic hrtimer structure
+ *
+ * @node:	red black tree node for time ordered insertion
+ * @expires:	the absolute expiry time in the hrtimers internal
+ *		representation. The time is related to the clock on
+ *		which the timer is based.
+ * @function:	timer expiry callback function
+ * @base:	pointer to the timer base (per cpu and per clock)
+ *
+ * The hrtimer structure must be initialized by hrtimer_init()
+ */
+struct hrtimer {
+	struct rb_node		node;
+	ktime_t			expires;
+	int			(*function)(struct hrtimer *);
+	struct hrtimer_base	*base;
+};
+
+/**
+ * struct hrtimer_sleeper - simple sleeper structure
+ *
+ * @timer:	embedded timer structure
+ * @task:	task to wake up
+ *
+ * task is set to NULL, when the timer expires.
+ */
+struct hrtimer_sleeper {
+	struct hrtimer		timer;
+	struct task_struct	*task;
+};
+
+/**
+ * struct hrtimer_base - the timer base for a specific clock
+ *
+ * @index:	clock type index for per_cpu support when moving a timer
+ *		to a base on another cpu.
+ * @lock:	lock protecting the base and associated timers
+ * @active:	red black tree root node for the active timers
+ * @first:	pointer to the timer node which expires first
+ * @resolution:	the resolution of the clock, in nanoseconds
+ * @get_time:	function to retrieve the current time of the clock
+ * @curr_timer:	the timer whose callback is currently running
+ */
+struct hrtimer_base {
+	clockid_t		index;
+	spinlock_t		lock;
+	struct rb_root		active;
+	struct rb_node		*first;
+	ktime_t			resolution;
+	ktime_t			(*get_time)(void);
+	struct hrtimer		*curr_timer;
+};
+
+#define MAX_HRTIMER_BASES	2
+
+/* Exported timer functions: */
+
+/* Initialize timers: */
+extern void hrtimer_init(struct hrtimer *timer, clockid_t which_clock,
+			 enum hrtimer_mode mode);
+
+/* Basic timer operations: */
+extern int hrtimer_start(struct hrtimer *timer, ktime_t tim,
+			 const enum hrtimer_mode mode);
+extern int hrtimer_cancel(struct hrtimer *timer);
+extern int hrtimer_try_to_cancel(struct hrtimer *timer);
+
+#define hrtimer_restart(timer) hrtimer_start((timer), (timer)->expires, HRTIMER_ABS)
+
+/* Query timers: */
+extern ktime_t hrtimer_get_remaining(const struct hrtimer *timer);
+extern int hrtimer_get_res(const clockid_t which_clock, struct timespec *tp);
+
+static inline int hrtimer_active(const struct hrtimer *timer)
+{
+	return timer->node.rb_parent != HRTIMER_INACTIVE;
+}
+
+/* The current time of the clock a timer is based on: */
+static inline ktime_t hrtimer_cb_get_time(struct hrtimer *timer)
+{
+	return timer->base->get_time();
+}
+
+/* Forward a hrtimer so it expires after now: */
+extern unsigned long hrtimer_forward(struct hrtimer *timer, ktime_t now,
+				     ktime_t interval);
+
+/* Precise sleep: */
+extern long hrtimer_nanosleep(struct timespec *rqtp,
+			      struct timespec *rmtp,
+			      const enum hrtimer_mode mode,
+			      const clockid_t clockid);
+
+extern void hrtimer_init_sleeper(struct hrtimer_sleeper *sl,
+				 struct task_struct *tsk);
+
+#ifdef CONFIG_NO_IDLE_HZ
+/* Delta to the next expiry, for stopping the tick while idle: */
+extern ktime_t hrtimer_get_next_event(void);
+#endif
+
+/* Soft interrupt function to run the hrtimer queues: */
+extern void hrtimer_run_queues(void);
+
+/* Bootup initialization: */
+extern void __init hrtimers_init(void);
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+/*
+ * Called by the architecture from its one-shot event interrupt, with
+ * interrupts disabled:
+ */
+extern void hrtimer_interrupt(void);
+
+/*
+ * Provided by the architecture. hrtimer_arch_switch_to_oneshot() puts
+ * the local CPU's event device into one-shot mode and returns 0, or an
+ * error if there is no usable device. hrtimer_arch_program_event()
+ * arranges for hrtimer_interrupt() to be called at the given absolute
+ * CLOCK_MONOTONIC time (KTIME_MAX: no hrtimer pending), in addition to
+ * whatever the architecture needs the device for itself. Both are
+ * called with interrupts disabled.
+ */
+extern int hrtimer_arch_switch_to_oneshot(void);
+extern void hrtimer_arch_program_event(ktime_t expires);
+#endif
+
+#endif
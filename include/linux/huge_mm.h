@@ -0,0 +1,144 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent huge pages: anonymous memory in VM_HUGEPAGE vmas is
+ * mapped with one pmd per aligned PMD_SIZE extent where possible.
+ *
+ * The huge page is an ordinary high-order allocation whose subpages
+ * keep their own reference counts, mapcounts and LRU state, so rmap
+ * and reclaim keep working on PAGE_SIZE units.  Anything that wants
+ * to look at individual ptes splits the pmd first; the pte page for
+ * that is set aside when the huge pmd is created, so splitting never
+ * allocates and can be done under page_table_lock.
+ *
+ * Shared file mappings can have huge pmds too, where the file system put
+ * the subpages of one huge page into the page cache for the extent.
+ */
+
+#include <linux/config.h>
+
+struct mmu_gather;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+#define HPAGE_PMD_SHIFT		PMD_SHIFT
+#define HPAGE_PMD_SIZE		(1UL << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK		(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER		(HPAGE_PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR		(1 << HPAGE_PMD_ORDER)
+
+extern int khugepaged_pages_to_scan;
+extern int khugepaged_scan_sleep_millisecs;
+extern int khugepaged_max_ptes_none;
+extern int shmem_huge;
+
+/*
+ * May the extent around @address be mapped by a huge pmd?
+ */
+static inline int transparent_hugepage_vma(struct vm_area_struct *vma,
+					   unsigned long address)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+
+	if (!(vma->vm_flags & VM_HUGEPAGE) || vma->vm_ops)
+		return 0;
+	return haddr >= vma->vm_start && haddr + HPAGE_PMD_SIZE <= vma->vm_end;
+}
+
+/*
+ * May the extent around @address of a shared file mapping be mapped by
+ * a huge pmd?  It has to be aligned in the file as well.
+ */
+static inline int transparent_hugepage_file_vma(struct vm_area_struct *vma,
+						unsigned long address)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	unsigned long pgoff;
+
+	if ((vma->vm_flags & (VM_HUGEPAGE | VM_SHARED | VM_NONLINEAR)) !=
+					(VM_HUGEPAGE | VM_SHARED) ||
+	    !vma->vm_ops || !vma->vm_ops->nopage)
+		return 0;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return 0;
+	pgoff = vma->vm_pgoff + ((haddr - vma->vm_start) >> PAGE_SHIFT);
+	return !(pgoff & (HPAGE_PMD_NR - 1));
+}
+
+/* The subpage of a huge pmd which maps @address */
+static inline struct page *huge_pmd_page(pmd_t pmd, unsigned long address)
+{
+	return pmd_page(pmd) + ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+}
+
+extern int do_huge_anonymous_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, int write_access);
+extern int do_huge_file_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, int write_access);
+extern int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
+		unsigned long addr, unsigned long end);
+extern void zap_huge_pmd(struct mmu_gather *tlb, pmd_t *pmd);
+extern struct page *follow_trans_huge_pmd(pmd_t *pmd, unsigned long address,
+		int write);
+extern int page_referenced_huge_pmd(struct vm_area_struct *vma,
+		pmd_t *pmd, unsigned long address);
+extern void __split_huge_pmd(struct mm_struct *mm, pmd_t *pmd,
+		unsigned long address);
+
+/*
+ * Replace a huge pmd by a page table mapping the same pages.
+ * Called with page_table_lock held.
+ */
+static inline void split_huge_pmd(struct mm_struct *mm, pmd_t *pmd,
+				  unsigned long address)
+{
+	if (unlikely(pmd_trans_huge(*pmd)))
+		__split_huge_pmd(mm, pmd, address);
+}
+
+extern void __khugepaged_enter(struct mm_struct *mm);
+
+static inline void khugepaged_enter(struct mm_struct *mm)
+{
+	if (list_empty(&mm->khugepaged_list))
+		__khugepaged_enter(mm);
+}
+
+static inline void khugepaged_fork(struct mm_struct *mm,
+				   struct mm_struct *oldmm)
+{
+	if (!list_empty(&oldmm->khugepaged_list))
+		__khugepaged_enter(mm);
+}
+
+/* Called by mmput() under mmlist_lock, as mm_users drops to zero */
+static inline void khugepaged_exit(struct mm_struct *mm)
+{
+	if (!list_empty(&mm->khugepaged_list))
+		list_del_init(&mm->khugepaged_list);
+}
+
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+
+#define pmd_trans_huge(pmd)			0
+#define transparent_hugepage_vma(vma, address)	0
+#define do_huge_anonymous_page(mm, vma, address, pmd, write)	0
+#define transparent_hugepage_file_vma(vma, address)	0
+#define do_huge_file_page(mm, vma, address, pmd, write)	0
+#define copy_huge_pmd(dst_mm, src_mm, dst_pmd, src_pmd, vma, addr, end) 1
+#define zap_huge_pmd(tlb, pmd)			do { } while (0)
+#define huge_pmd_page(pmd, address)		NULL
+#define follow_trans_huge_pmd(pmd, address, write)	NULL
+#define page_referenced_huge_pmd(vma, pmd, address)	0
+#define split_huge_pmd(mm, pmd, address)	do { } while (0)
+#define khugepaged_enter(mm)			do { } while (0)
+#define khugepaged_fork(mm, oldmm)		do { } while (0)
+#define khugepaged_exit(mm)			do { } while (0)
+
+#endif /* !CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
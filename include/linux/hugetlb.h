@@ -30,8 +30,11 @@ int is_aligned_hugepage_range(unsigned long addr, unsigned long len);
 int pmd_huge(pmd_t pmd);
 struct page *alloc_huge_page(void);
 void free_huge_page(struct page *);
+int hugetlb_grow_pool(unsigned long count);
+void hugetlb_trim_pool(void);
 
 extern unsigned long max_huge_pages;
+extern unsigned long nr_overcommit_huge_pages;
 extern const unsigned long hugetlb_zero, hugetlb_infinity;
 extern int sysctl_hugetlb_shm_group;
 
@@ -68,6 +68,10 @@
 #define BOND_MODE_TLB           5
 #define BOND_MODE_ALB		6 /* TLB + RLB (receive load balancing) */
 
+/* xmit_hash_policy, for BOND_MODE_XOR and BOND_MODE_8023AD */
+#define BOND_XMIT_POLICY_LAYER2		0 /* hardware addresses */
+#define BOND_XMIT_POLICY_LAYER34	1 /* IP addresses and ports */
+
 /* each slave's link has 4 states */
 #define BOND_LINK_UP    0           /* link is up and running */
 #define BOND_LINK_FAIL  1           /* link has just gone down */
@@ -18,6 +18,8 @@
 #ifndef __IF_TUN_H
 #define __IF_TUN_H
 
+#include <linux/uio.h>
+
 /* Uncomment to enable debugging */
 /* #define TUN_DEBUG 1 */
 
@@ -31,20 +33,35 @@
 #define DBG1( a... )
 #endif
 
+/* Most queues, i.e. file descriptors, one device can have */
+#define TUN_MAX_QUEUES	8
+
+struct tun_struct;
+
+/* The queue of one file descriptor attached to the device */
+struct tun_queue {
+	struct tun_struct	*tun;		/* Or NULL, not attached */
+	int			index;		/* In tun->queues */
+	unsigned long		flags;		/* TUN_FASYNC */
+
+	wait_queue_head_t	read_wait;
+	struct sk_buff_head	readq;
+
+	struct fasync_struct    *fasync;
+};
+
 struct tun_struct {
 	struct list_head        list;
 	unsigned long 		flags;
-	int			attached;
 	uid_t			owner;
 
-	wait_queue_head_t	read_wait;
-	struct sk_buff_head	readq;
+	/* Changed under rtnl and dev->xmit_lock */
+	struct tun_queue	*queues[TUN_MAX_QUEUES];
+	int			numqueues;
 
 	struct net_device	*dev;
 	struct net_device_stats	stats;
 
-	struct fasync_struct    *fasync;
-
 	unsigned long if_flags;
 	u8 dev_addr[ETH_ALEN];
 	u32 chr_filter[2];
@@ -60,6 +77,9 @@ struct tun_struct {
 /* Read queue size */
 #define TUN_READQ_SIZE	500
 
+/* Most frames a TUNREADFRAMES or TUNWRITEFRAMES moves in one call */
+#define TUN_MAX_FRAMES	64
+
 /* TUN device flags */
 #define TUN_TUN_DEV 	0x0001	
 #define TUN_TAP_DEV	0x0002
@@ -70,6 +90,7 @@ struct tun_struct {
 #define TUN_NO_PI	0x0040
 #define TUN_ONE_QUEUE	0x0080
 #define TUN_PERSIST 	0x0100	
+#define TUN_MULTI_QUEUE	0x0200
 
 /* Ioctl defines */
 #define TUNSETNOCSUM  _IOW('T', 200, int) 
@@ -77,10 +98,13 @@ struct tun_struct {
 #define TUNSETIFF     _IOW('T', 202, int) 
 #define TUNSETPERSIST _IOW('T', 203, int) 
 #define TUNSETOWNER   _IOW('T', 204, int)
+#define TUNREADFRAMES _IOWR('T', 205, struct tun_frames)
+#define TUNWRITEFRAMES _IOW('T', 206, struct tun_frames)
 
 /* TUNSETIFF ifr flags */
 #define IFF_TUN		0x0001
 #define IFF_TAP		0x0002
+#define IFF_MULTI_QUEUE	0x0100
 #define IFF_NO_PI	0x1000
 #define IFF_ONE_QUEUE	0x2000
 
@@ -90,4 +114,16 @@ struct tun_pi {
 };
 #define TUN_PKT_STRIP	0x0001
 
+/*
+ * TUNREADFRAMES reads up to count frames, one into each buffer of
+ * frames, and sets its iov_len to the length read; it waits for the
+ * first frame only, unless the file is O_NONBLOCK.  TUNWRITEFRAMES
+ * writes one frame from each buffer.  Both return the number of frames
+ * moved, or the error of the first one.
+ */
+struct tun_frames {
+	unsigned int	count;
+	struct iovec	__user *frames;
+};
+
 #endif /* __IF_TUN_H */
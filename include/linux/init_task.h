@@ -111,6 +111,8 @@ extern struct group_info init_groups;
 	.switch_lock	= SPIN_LOCK_UNLOCKED,				\
 	.journal_info	= NULL,						\
 	.cpu_timers	= INIT_CPU_TIMERS(tsk.cpu_timers),		\
+	.pi_waiters	= LIST_HEAD_INIT(tsk.pi_waiters),		\
+	.pi_state_list	= LIST_HEAD_INIT(tsk.pi_state_list),		\
 }
 
 
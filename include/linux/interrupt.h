@@ -126,6 +126,7 @@ extern void softirq_init(void);
 #define __raise_softirq_irqoff(nr) do { local_softirq_pending() |= 1UL << (nr); } while (0)
 extern void FASTCALL(raise_softirq_irqoff(unsigned int nr));
 extern void FASTCALL(raise_softirq(unsigned int nr));
+extern void raise_softirq_on_cpu(int cpu, unsigned int nr);
 
 
 /* Tasklets --- multithreaded analogue of BHs.
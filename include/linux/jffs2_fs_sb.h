@@ -17,6 +17,7 @@
 #define JFFS2_SB_FLAG_MOUNTING 2
 
 struct jffs2_inodirty;
+struct jffs2_summary;
 
 /* A struct for the overall file system control.  Pointers to
    jffs2_sb_info structs are named `c' in the source code.  
@@ -111,6 +112,10 @@ struct jffs2_sb_info {
 	uint32_t fsdata_len;
 #endif
 
+#ifdef CONFIG_JFFS2_SUMMARY
+	struct jffs2_summary *summary;	/* Summary of c->nextblock, as it is written */
+#endif
+
 	/* OS-private pointer for getting back to master superblock info */
 	void *os_priv;
 };
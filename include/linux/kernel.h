@@ -132,6 +132,8 @@ static inline unsigned long __attribute_const__ roundup_pow_of_two(unsigned long
 
 extern int printk_ratelimit(void);
 extern int __printk_ratelimit(int ratelimit_jiffies, int ratelimit_burst);
+extern void printk_tick(void);
+extern int printk_needs_cpu(int cpu);
 
 static inline void console_silent(void)
 {
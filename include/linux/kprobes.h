@@ -97,6 +97,22 @@ static inline int kprobe_running(void)
 extern int arch_prepare_kprobe(struct kprobe *p);
 extern void arch_copy_kprobe(struct kprobe *p);
 extern void arch_remove_kprobe(struct kprobe *p);
+
+#ifdef CONFIG_OPTPROBES
+/*
+ * Optimized probes: a probe that only has a pre_handler can be reached
+ * by a jump to a detour instead of the breakpoint, which calls the
+ * handler and runs the instructions the jump replaced.  Its pre_handler
+ * must not change the instruction pointer; the return value is ignored.
+ */
+static inline int kprobe_optimized(struct kprobe *p)
+{
+	return p->ainsn.detour != NULL;
+}
+
+extern int arch_optimize_kprobe(struct kprobe *p);
+extern void arch_unoptimize_kprobe(struct kprobe *p);
+#endif
 extern void show_registers(struct pt_regs *regs);
 
 /* Get the kprobe at this addr (if any).  Must have called lock_kprobes */
@@ -0,0 +1,57 @@
+#ifndef _LINUX_KSM_H
+#define _LINUX_KSM_H
+
+/*
+ * Kernel samepage merging: ksmd scans the anonymous pages of VM_MERGEABLE
+ * vmas and replaces the ptes of pages with identical contents by
+ * write-protected ptes of one shared page.  A write fault on one of those
+ * copies it as on any COW page.
+ *
+ * The shared pages are anonymous without an anon_vma (see PageKsm) and
+ * are kept off the LRU, so reclaim and migration never see them.
+ */
+
+#include <linux/config.h>
+
+struct mm_struct;
+struct vm_area_struct;
+
+#ifdef CONFIG_KSM
+
+extern int ksm_pages_to_scan;
+extern int ksm_sleep_millisecs;
+
+extern void __ksm_enter(struct mm_struct *mm);
+extern void __ksm_exit(struct mm_struct *mm);
+extern int ksm_unmerge_range(struct vm_area_struct *vma,
+		unsigned long start, unsigned long end);
+
+static inline void ksm_enter(struct mm_struct *mm)
+{
+	if (list_empty(&mm->ksm_list))
+		__ksm_enter(mm);
+}
+
+static inline void ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	if (!list_empty(&oldmm->ksm_list))
+		__ksm_enter(mm);
+}
+
+/* Called by mmput() under mmlist_lock, as mm_users drops to zero */
+static inline void ksm_exit(struct mm_struct *mm)
+{
+	if (!list_empty(&mm->ksm_list))
+		__ksm_exit(mm);
+}
+
+#else /* !CONFIG_KSM */
+
+#define ksm_enter(mm)				do { } while (0)
+#define ksm_fork(mm, oldmm)			do { } while (0)
+#define ksm_exit(mm)				do { } while (0)
+#define ksm_unmerge_range(vma, start, end)	0
+
+#endif /* !CONFIG_KSM */
+
+#endif /* _LINUX_KSM_H */
@@ -80,7 +80,7 @@ enum {
 	LIBATA_MAX_PRD		= ATA_MAX_PRD / 2,
 	ATA_MAX_PORTS		= 8,
 	ATA_DEF_QUEUE		= 1,
-	ATA_MAX_QUEUE		= 1,
+	ATA_MAX_QUEUE		= 32,	/* tags; NCQ has 32 */
 	ATA_MAX_SECTORS		= 200,	/* FIXME */
 	ATA_MAX_BUS		= 2,
 	ATA_DEF_BUSY_WAIT	= 10000,
@@ -95,6 +95,7 @@ enum {
 	ATA_DFLAG_LBA48		= (1 << 0), /* device supports LBA48 */
 	ATA_DFLAG_PIO		= (1 << 1), /* device currently in PIO mode */
 	ATA_DFLAG_LOCK_SECTORS	= (1 << 2), /* don't adjust max_sectors */
+	ATA_DFLAG_NCQ		= (1 << 3), /* device and host do NCQ */
 
 	ATA_DEV_UNKNOWN		= 0,	/* unknown device */
 	ATA_DEV_ATA		= 1,	/* ATA device */
@@ -113,6 +114,7 @@ enum {
 	ATA_FLAG_MMIO		= (1 << 6), /* use MMIO, not PIO */
 	ATA_FLAG_SATA_RESET	= (1 << 7), /* use COMRESET */
 	ATA_FLAG_PIO_DMA	= (1 << 8), /* PIO cmds via DMA */
+	ATA_FLAG_NCQ		= (1 << 9), /* host can queue NCQ cmds */
 
 	ATA_QCFLAG_ACTIVE	= (1 << 1), /* cmd not yet ack'd to scsi lyer */
 	ATA_QCFLAG_SG		= (1 << 3), /* have s/g table? */
@@ -254,6 +256,8 @@ struct ata_queued_cmd {
 
 	struct completion	*waiting;
 
+	u8			ncq_err;	/* error reg, from NCQ log */
+
 	void			*private_data;
 };
 
@@ -278,6 +282,8 @@ struct ata_device {
 	u8			xfer_protocol;	/* taskfile xfer protocol */
 	u8			read_cmd;	/* opcode to use on read */
 	u8			write_cmd;	/* opcode to use on write */
+
+	unsigned int		queue_depth;	/* NCQ depth, if DFLAG_NCQ */
 };
 
 struct ata_port {
@@ -307,7 +313,10 @@ struct ata_port {
 
 	struct ata_queued_cmd	qcmd[ATA_MAX_QUEUE];
 	unsigned long		qactive;
-	unsigned int		active_tag;
+	unsigned int		active_tag;	/* non-NCQ cmd being run */
+	u32			sactive;	/* tags of NCQ cmds in flight */
+	u32			ncq_aborted;	/* NCQ cmds awaiting error log */
+	u8			*ncq_log;	/* NCQ error log page */
 
 	struct ata_host_stats	stats;
 	struct ata_host_set	*host_set;
@@ -426,6 +435,9 @@ extern void ata_bmdma_stop(struct ata_port *ap);
 extern u8   ata_bmdma_status(struct ata_port *ap);
 extern void ata_bmdma_irq_clear(struct ata_port *ap);
 extern void ata_qc_complete(struct ata_queued_cmd *qc, u8 drv_stat);
+extern int ata_ncq_complete(struct ata_port *ap, u32 sactive);
+extern void ata_ncq_error(struct ata_port *ap);
+extern void ata_ncq_timeout(struct ata_port *ap);
 extern void ata_eng_timeout(struct ata_port *ap);
 extern void ata_scsi_simulate(u16 *id, struct scsi_cmnd *cmd,
 			      void (*done)(struct scsi_cmnd *));
@@ -455,6 +467,11 @@ static inline unsigned int ata_tag_valid(unsigned int tag)
 	return (tag < ATA_MAX_QUEUE) ? 1 : 0;
 }
 
+static inline int ata_ncq_enabled(struct ata_device *dev)
+{
+	return (dev->flags & (ATA_DFLAG_NCQ | ATA_DFLAG_PIO)) == ATA_DFLAG_NCQ;
+}
+
 static inline unsigned int ata_dev_present(struct ata_device *dev)
 {
 	return ((dev->class == ATA_DEV_ATA) ||
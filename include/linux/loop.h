@@ -27,6 +27,16 @@ enum {
 
 struct loop_func_table;
 
+/*
+ * In direct mode, a run of sectors of the loop device that is contiguous
+ * on the device backing the file
+ */
+struct loop_extent {
+	sector_t	start;		/* first sector on the loop device */
+	sector_t	disk;		/* first sector on the backing device */
+	sector_t	nr;		/* length in sectors */
+};
+
 struct loop_device {
 	int		lo_number;
 	int		lo_refcnt;
@@ -63,6 +73,13 @@ struct loop_device {
 	struct semaphore	lo_bh_mutex;
 	atomic_t		lo_pending;
 
+	/* direct mode: bios are remapped to the blocks of the file */
+	struct loop_extent	*lo_extents;
+	unsigned int		lo_nr_extents;
+	struct block_device	*lo_direct_bdev;
+	atomic_t		lo_direct_inflight;
+	wait_queue_head_t	lo_direct_wait;
+
 	request_queue_t		*lo_queue;
 };
 
@@ -74,6 +91,7 @@ struct loop_device {
 enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_USE_AOPS	= 2,
+	LO_FLAGS_DIRECT		= 4,	/* settable with LOOP_SET_STATUS */
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
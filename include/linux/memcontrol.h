@@ -0,0 +1,60 @@
+#ifndef _LINUX_MEMCONTROL_H
+#define _LINUX_MEMCONTROL_H
+
+/*
+ * Memory controller: accounting and limiting the user memory of the
+ * tasks in a cpuset.
+ *
+ * Anonymous and page cache pages are charged to the cpuset of the task
+ * which faulted them in or added them to the page cache, and stay charged
+ * to it until they are freed.  A charge which would take a cpuset over its
+ * memory_limit first reclaims from the pages charged to that cpuset, and
+ * fails with -ENOMEM when that does not make room.  Tasks in the top
+ * cpuset are not accounted.
+ */
+
+#include <linux/config.h>
+#include <linux/mm.h>
+
+struct mem_container;
+
+#ifdef CONFIG_MEM_CONTROLLER
+
+extern struct mem_container *mem_container_alloc(void);
+extern void mem_container_get(struct mem_container *mem);
+extern void mem_container_put(struct mem_container *mem);
+
+extern int mem_container_charge(struct page *page, unsigned int gfp_mask);
+extern void __mem_container_uncharge_page(struct page *page);
+extern void mem_container_migrate(struct page *page, struct page *new);
+
+extern unsigned long mem_container_usage(struct mem_container *mem);
+extern unsigned long mem_container_limit(struct mem_container *mem);
+extern unsigned long mem_container_failcnt(struct mem_container *mem);
+extern int mem_container_set_limit(struct mem_container *mem,
+				   unsigned long limit);
+
+extern int mem_container_isolate_pages(struct mem_container *mem,
+		int nr_to_scan, struct list_head *page_list, int *nr_scanned);
+extern int try_to_free_mem_container_pages(struct mem_container *mem,
+					   unsigned int gfp_mask);
+
+/* Called as @page is freed */
+static inline void mem_container_uncharge_page(struct page *page)
+{
+	if (unlikely(page->page_container))
+		__mem_container_uncharge_page(page);
+}
+
+#define page_container_reset(page)	((page)->page_container = NULL)
+
+#else /* !CONFIG_MEM_CONTROLLER */
+
+#define mem_container_charge(page, gfp_mask)	0
+#define mem_container_uncharge_page(page)	do { } while (0)
+#define mem_container_migrate(page, new)	do { } while (0)
+#define page_container_reset(page)		do { } while (0)
+
+#endif /* !CONFIG_MEM_CONTROLLER */
+
+#endif /* _LINUX_MEMCONTROL_H */
@@ -0,0 +1,30 @@
+#ifndef _LINUX_MIGRATE_H
+#define _LINUX_MIGRATE_H
+
+/*
+ * Page migration: moving pages that are in use to other pages, for NUMA
+ * placement or for compaction.
+ */
+
+#include <linux/config.h>
+#include <linux/mm.h>
+
+/* Allocate the page that @page is to be migrated to */
+typedef struct page *new_page_t(struct page *page, unsigned long private);
+
+#ifdef CONFIG_MIGRATION
+
+extern int isolate_lru_page(struct page *page, struct list_head *pagelist);
+extern void putback_lru_pages(struct list_head *pagelist);
+extern int migrate_pages(struct list_head *from, new_page_t get_new_page,
+			unsigned long private);
+
+#else
+
+#define isolate_lru_page(page, pagelist)	(-ENOSYS)
+#define putback_lru_pages(pagelist)		do { } while (0)
+#define migrate_pages(from, get_new_page, private)	(-ENOSYS)
+
+#endif /* CONFIG_MIGRATION */
+
+#endif /* _LINUX_MIGRATE_H */
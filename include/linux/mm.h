@@ -25,6 +25,7 @@ extern unsigned long num_physpages;
 extern void * high_memory;
 extern unsigned long vmalloc_earlyreserve;
 extern int page_cluster;
+extern int swap_vma_readahead;
 
 #ifdef CONFIG_SYSCTL
 extern int sysctl_legacy_va_layout;
@@ -93,8 +94,10 @@ struct vm_area_struct {
 	 * list, after a COW of one of the file pages.  A MAP_SHARED vma
 	 * can only be in the i_mmap tree.  An anonymous MAP_PRIVATE, stack
 	 * or brk vma (with NULL file) can only be in an anon_vma list.
+	 * The chain is only valid while anon_vma is set.
 	 */
-	struct list_head anon_vma_node;	/* Serialized by anon_vma->lock */
+	struct list_head anon_vma_chain; /* Serialized by mmap_sem &
+					  * page_table_lock */
 	struct anon_vma *anon_vma;	/* Serialized by page_table_lock */
 
 	/* Function pointers to deal with this struct. */
@@ -107,6 +110,11 @@ struct vm_area_struct {
 	void * vm_private_data;		/* was vm_pte (shared mem) */
 	unsigned long vm_truncate_count;/* truncate_count or restart_addr */
 
+	/* Swap readahead state, see swapin_vma_readahead() */
+	unsigned long vm_swap_ra_prev;	/* Page number of the last swapin */
+	unsigned int vm_swap_ra_win;	/* Pages that swapin read */
+	unsigned int vm_swap_ra_hits;	/* Readahead pages used since */
+
 #ifndef CONFIG_MMU
 	atomic_t vm_usage;		/* refcount (VMAs shared if !MMU) */
 #endif
@@ -162,8 +170,10 @@ extern unsigned int kobjsize(const void *objp);
 #define VM_DONTEXPAND	0x00040000	/* Cannot expand with mremap() */
 #define VM_RESERVED	0x00080000	/* Don't unmap it from swap_out */
 #define VM_ACCOUNT	0x00100000	/* Is a VM accounted object */
+#define VM_HUGEPAGE	0x00200000	/* MADV_HUGEPAGE: back with huge pmds */
 #define VM_HUGETLB	0x00400000	/* Huge TLB Page VM */
 #define VM_NONLINEAR	0x00800000	/* Is non-linear (remap_file_pages) */
+#define VM_MERGEABLE	0x01000000	/* MADV_MERGEABLE: ksmd may merge its pages */
 
 #ifndef VM_STACK_DEFAULT_FLAGS		/* arch can override this */
 #define VM_STACK_DEFAULT_FLAGS VM_DATA_DEFAULT_FLAGS
@@ -198,6 +208,8 @@ struct vm_operations_struct {
 	void (*close)(struct vm_area_struct * area);
 	struct page * (*nopage)(struct vm_area_struct * area, unsigned long address, int *type);
 	int (*populate)(struct vm_area_struct * area, unsigned long address, unsigned long len, pgprot_t prot, unsigned long pgoff, int nonblock);
+	/* map what is cheaply available around a read fault at address */
+	void (*map_pages)(struct vm_area_struct *area, unsigned long address, pmd_t *pmd);
 #ifdef CONFIG_NUMA
 	int (*set_policy)(struct vm_area_struct *vma, struct mempolicy *new);
 	struct mempolicy *(*get_policy)(struct vm_area_struct *vma,
@@ -224,28 +236,45 @@ struct page {
 	page_flags_t flags;		/* Atomic flags, some possibly
 					 * updated asynchronously */
 	atomic_t _count;		/* Usage count, see below. */
-	atomic_t _mapcount;		/* Count of ptes mapped in mms,
+	union {
+		atomic_t _mapcount;	/* Count of ptes mapped in mms,
 					 * to show when page is mapped
 					 * & limit reverse map searches.
 					 */
-	unsigned long private;		/* Mapping-private opaque data:
+		unsigned int inuse;	/* SLUB: Nr of objects */
+	};
+	union {
+		unsigned long private;	/* Mapping-private opaque data:
 					 * usually used for buffer_heads
 					 * if PagePrivate set; used for
 					 * swp_entry_t if PageSwapCache
 					 * When page is free, this indicates
 					 * order in the buddy system.
 					 */
-	struct address_space *mapping;	/* If low bit clear, points to
+		struct page *first_page;	/* SLUB: first page of slab */
+	};
+	union {
+		struct address_space *mapping;	/* If low bit clear, points to
 					 * inode address_space, or NULL.
 					 * If page mapped as anonymous
 					 * memory, low bit is set, and
 					 * it points to anon_vma object:
 					 * see PAGE_MAPPING_ANON below.
 					 */
-	pgoff_t index;			/* Our offset within mapping. */
+		struct kmem_cache_s *slab;	/* SLUB: Pointer to slab */
+	};
+	union {
+		pgoff_t index;		/* Our offset within mapping. */
+		void *freelist;		/* SLUB: first free object */
+	};
 	struct list_head lru;		/* Pageout list, eg. active_list
 					 * protected by zone->lru_lock !
 					 */
+#ifdef CONFIG_MEM_CONTROLLER
+	struct page_container *page_container;	/* What the page is charged
+						 * to, see mm/memcontrol.c
+						 */
+#endif
 	/*
 	 * On machines where all RAM is mapped into kernel address space,
 	 * we can simply calculate the virtual address. On machines with
@@ -490,6 +519,19 @@ static inline int PageAnon(struct page *page)
 	return ((unsigned long)page->mapping & PAGE_MAPPING_ANON) != 0;
 }
 
+/*
+ * A page merged by ksmd is anonymous but has no anon_vma: it may be
+ * mapped by any number of unrelated vmas, and is never reclaimed.
+ */
+#ifdef CONFIG_KSM
+static inline int PageKsm(struct page *page)
+{
+	return (unsigned long)page->mapping == PAGE_MAPPING_ANON;
+}
+#else
+#define PageKsm(page)	0
+#endif
+
 /*
  * Return the pagecache index of the passed page.  Regular pagecache pages
  * use ->index whereas swapcache pages use ->private
@@ -529,6 +571,7 @@ static inline int page_mapped(struct page *page)
  */
 #define NOPAGE_SIGBUS	(NULL)
 #define NOPAGE_OOM	((struct page *) (-1))
+#define NOPAGE_RETRY	((struct page *) (-2))	/* mmap_sem was dropped */
 
 /*
  * Different kinds of faults, as returned by handle_mm_fault().
@@ -539,6 +582,17 @@ static inline int page_mapped(struct page *page)
 #define VM_FAULT_SIGBUS	0
 #define VM_FAULT_MINOR	1
 #define VM_FAULT_MAJOR	2
+#define VM_FAULT_RETRY	3	/* mmap_sem was dropped: fault again */
+
+/*
+ * Flags for __handle_mm_fault().  With FAULT_FLAG_ALLOW_RETRY, a fault
+ * which has to wait for I/O may drop mmap_sem for the wait and return
+ * VM_FAULT_RETRY.  A ->nopage method is told it may, by *type being
+ * VM_FAULT_RETRY on entry, and then returns NOPAGE_RETRY if it did:
+ * see lock_page_or_retry().
+ */
+#define FAULT_FLAG_ALLOW_RETRY	0x01
+#define FAULT_FLAG_TRIED	0x02	/* second try, after VM_FAULT_RETRY */
 
 #define offset_in_page(p)	((unsigned long)(p) & ~PAGE_MASK)
 
@@ -551,11 +605,21 @@ int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *new);
 struct mempolicy *shmem_get_policy(struct vm_area_struct *vma,
 					unsigned long addr);
 int shmem_lock(struct file *file, int lock, struct user_struct *user);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+unsigned long shmem_get_unmapped_area(struct file *file, unsigned long addr,
+		unsigned long len, unsigned long pgoff, unsigned long flags);
+void shmem_huge_vma(struct vm_area_struct *vma);
+#else
+#define shmem_get_unmapped_area	NULL
+#define shmem_huge_vma(vma)	do { } while (0)
+#endif
 #else
 #define shmem_nopage filemap_nopage
 #define shmem_lock(a, b, c) 	({0;})	/* always in memory, no need to lock */
 #define shmem_set_policy(a, b)	(0)
 #define shmem_get_policy(a, b)	(NULL)
+#define shmem_get_unmapped_area	NULL
+#define shmem_huge_vma(vma)	do { } while (0)
 #endif
 struct file *shmem_file_setup(char *name, loff_t size, unsigned long flags);
 
@@ -612,7 +676,15 @@ extern pte_t *FASTCALL(pte_alloc_kernel(struct mm_struct *mm, pmd_t *pmd, unsign
 extern pte_t *FASTCALL(pte_alloc_map(struct mm_struct *mm, pmd_t *pmd, unsigned long address));
 extern int install_page(struct mm_struct *mm, struct vm_area_struct *vma, unsigned long addr, struct page *page, pgprot_t prot);
 extern int install_file_pte(struct mm_struct *mm, struct vm_area_struct *vma, unsigned long addr, unsigned long pgoff, pgprot_t prot);
-extern int handle_mm_fault(struct mm_struct *mm,struct vm_area_struct *vma, unsigned long address, int write_access);
+extern int __handle_mm_fault(struct mm_struct *mm,struct vm_area_struct *vma, unsigned long address, int write_access, unsigned int flags);
+
+static inline int handle_mm_fault(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		int write_access)
+{
+	return __handle_mm_fault(mm, vma, address, write_access, 0);
+}
+
 extern int make_pages_present(unsigned long addr, unsigned long end);
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len, int write);
 void install_arg_page(struct vm_area_struct *, struct page *, unsigned long);
@@ -712,7 +784,7 @@ static inline void vma_nonlinear_insert(struct vm_area_struct *vma,
 
 /* mmap.c */
 extern int __vm_enough_memory(long pages, int cap_sys_admin);
-extern void vma_adjust(struct vm_area_struct *vma, unsigned long start,
+extern int vma_adjust(struct vm_area_struct *vma, unsigned long start,
 	unsigned long end, pgoff_t pgoff, struct vm_area_struct *insert);
 extern struct vm_area_struct *vma_merge(struct mm_struct *,
 	struct vm_area_struct *prev, unsigned long addr, unsigned long end,
@@ -759,6 +831,10 @@ extern void truncate_inode_pages(struct address_space *, loff_t);
 extern struct page *filemap_nopage(struct vm_area_struct *, unsigned long, int *);
 extern int filemap_populate(struct vm_area_struct *, unsigned long,
 		unsigned long, pgprot_t, unsigned long, int);
+extern void filemap_map_pages(struct vm_area_struct *, unsigned long, pmd_t *);
+
+#define FAULT_AROUND_MAX	64	/* pages */
+extern int fault_around_pages;
 
 /* mm/page-writeback.c */
 int write_one_page(struct page *page, int wait);
@@ -766,20 +842,18 @@ int write_one_page(struct page *page, int wait);
 /* readahead.c */
 #define VM_MAX_READAHEAD	128	/* kbytes */
 #define VM_MIN_READAHEAD	16	/* kbytes (includes current page) */
-#define VM_MAX_CACHE_HIT    	256	/* max pages in a row in cache before
-					 * turning readahead off */
 
 int do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			unsigned long offset, unsigned long nr_to_read);
 int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			unsigned long offset, unsigned long nr_to_read);
-unsigned long  page_cache_readahead(struct address_space *mapping,
-			  struct file_ra_state *ra,
-			  struct file *filp,
-			  unsigned long offset,
-			  unsigned long size);
-void handle_ra_miss(struct address_space *mapping, 
-		    struct file_ra_state *ra, pgoff_t offset);
+void page_cache_sync_readahead(struct address_space *mapping,
+			       struct file_ra_state *ra, struct file *filp,
+			       unsigned long offset, unsigned long req_size);
+void page_cache_async_readahead(struct address_space *mapping,
+				struct file_ra_state *ra, struct file *filp,
+				struct page *page, unsigned long offset,
+				unsigned long req_size);
 unsigned long max_sane_readahead(unsigned long nr);
 
 /* Do stack extension */
@@ -815,6 +889,7 @@ extern struct page * follow_page(struct mm_struct *mm, unsigned long address,
 extern int check_user_page_readable(struct mm_struct *mm, unsigned long address);
 int remap_pfn_range(struct vm_area_struct *, unsigned long,
 		unsigned long, unsigned long, pgprot_t);
+int vm_insert_page(struct vm_area_struct *, unsigned long, struct page *);
 
 #ifdef CONFIG_PROC_FS
 void __vm_stat_account(struct mm_struct *, unsigned long, struct file *, long);
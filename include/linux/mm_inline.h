@@ -1,40 +1,66 @@
+/*
+ * Which LRU type a page goes on is decided when it is added to the
+ * lists; PG_anon_lru remembers the choice so that the page is taken
+ * off the same lists even if it has changed in the meantime.
+ */
+static inline int page_lru_type(struct page *page)
+{
+	return PageAnonLRU(page) ? LRU_ANON : LRU_FILE;
+}
+
+static inline int set_page_lru_type(struct page *page)
+{
+	if (PageAnon(page) || PageSwapCache(page)) {
+		SetPageAnonLRU(page);
+		return LRU_ANON;
+	}
+	ClearPageAnonLRU(page);
+	return LRU_FILE;
+}
 
 static inline void
 add_page_to_active_list(struct zone *zone, struct page *page)
 {
-	list_add(&page->lru, &zone->active_list);
-	zone->nr_active++;
+	int type = set_page_lru_type(page);
+
+	list_add(&page->lru, &zone->active_list[type]);
+	zone->nr_active[type]++;
 }
 
 static inline void
 add_page_to_inactive_list(struct zone *zone, struct page *page)
 {
-	list_add(&page->lru, &zone->inactive_list);
-	zone->nr_inactive++;
+	int type = set_page_lru_type(page);
+
+	list_add(&page->lru, &zone->inactive_list[type]);
+	zone->nr_inactive[type]++;
 }
 
 static inline void
 del_page_from_active_list(struct zone *zone, struct page *page)
 {
 	list_del(&page->lru);
-	zone->nr_active--;
+	zone->nr_active[page_lru_type(page)]--;
 }
 
 static inline void
 del_page_from_inactive_list(struct zone *zone, struct page *page)
 {
 	list_del(&page->lru);
-	zone->nr_inactive--;
+	zone->nr_inactive[page_lru_type(page)]--;
 }
 
 static inline void
 del_page_from_lru(struct zone *zone, struct page *page)
 {
+	int type = page_lru_type(page);
+
 	list_del(&page->lru);
 	if (PageActive(page)) {
 		ClearPageActive(page);
-		zone->nr_active--;
+		zone->nr_active[type]--;
 	} else {
-		zone->nr_inactive--;
+		zone->nr_inactive[type]--;
 	}
+	ClearPageAnonLRU(page);
 }
@@ -21,11 +21,38 @@
 #define MAX_ORDER CONFIG_FORCE_MAX_ZONEORDER
 #endif
 
+/*
+ * Free pages are kept on separate lists by how easily the pages
+ * allocated from them can be given back, so that unmovable kernel
+ * allocations do not end up scattered over every MAX_ORDER block.
+ * Each MAX_ORDER block of a zone has a type; freed pages go to the
+ * list of their block's type. An allocation only falls back to, and
+ * possibly takes over, a block of another type when its own lists are
+ * empty.
+ */
+#define MIGRATE_UNMOVABLE	0	/* ordinary kernel allocations */
+#define MIGRATE_RECLAIMABLE	1	/* __GFP_RECLAIMABLE: e.g. dcache slabs */
+#define MIGRATE_MOVABLE		2	/* __GFP_MOVABLE: user and page cache */
+#define MIGRATE_TYPES		3
+
+/* The blocks that have a type */
+#define PAGEBLOCK_ORDER		(MAX_ORDER - 1)
+#define PAGEBLOCK_NR_PAGES	(1UL << PAGEBLOCK_ORDER)
+
 struct free_area {
-	struct list_head	free_list;
+	struct list_head	free_list[MIGRATE_TYPES];
 	unsigned long		nr_free;
 };
 
+/*
+ * Anonymous (and swap cache) pages and file backed pages are kept on
+ * separate LRU lists, so that reclaim looking for clean page cache
+ * does not have to wade through anon pages and vice versa.
+ */
+#define LRU_ANON		0
+#define LRU_FILE		1
+#define NR_LRU_TYPES		2
+
 struct pglist_data;
 
 /*
@@ -48,6 +75,9 @@ struct per_cpu_pages {
 	int low;		/* low watermark, refill needed */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
+	int base_batch;		/* boot time batch, floor for auto-scaling */
+	int events;		/* refills + drains in this interval */
+	unsigned long stamp;	/* start of the interval, in jiffies */
 	struct list_head list;	/* the list of pages */
 };
 
@@ -128,19 +158,32 @@ struct zone {
 	 * free areas of different sizes
 	 */
 	spinlock_t		lock;
+	unsigned long		lock_acquired;	/* under lock, for zoneinfo */
+	unsigned long		lock_contended;	/* ... of which had to spin */
 	struct free_area	free_area[MAX_ORDER];
 
+	/* Free pages cleared in advance by kzerod, counted in free_pages */
+	struct list_head	zero_list;
+	unsigned long		nr_zero;
+
 
 	ZONE_PADDING(_pad1_)
 
 	/* Fields commonly accessed by the page reclaim scanner */
 	spinlock_t		lru_lock;	
-	struct list_head	active_list;
-	struct list_head	inactive_list;
-	unsigned long		nr_scan_active;
-	unsigned long		nr_scan_inactive;
-	unsigned long		nr_active;
-	unsigned long		nr_inactive;
+	struct list_head	active_list[NR_LRU_TYPES];
+	struct list_head	inactive_list[NR_LRU_TYPES];
+	unsigned long		nr_scan_active[NR_LRU_TYPES];
+	unsigned long		nr_scan_inactive[NR_LRU_TYPES];
+	unsigned long		nr_active[NR_LRU_TYPES];
+	unsigned long		nr_inactive[NR_LRU_TYPES];
+	/*
+	 * Pages scanned on, and moved back to the active list of, each
+	 * LRU type lately: the cost of reclaiming from that type. Both
+	 * are halved once scanned exceeds a quarter of the lists.
+	 */
+	unsigned long		recent_scanned[NR_LRU_TYPES];
+	unsigned long		recent_rotated[NR_LRU_TYPES];
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	int			all_unreclaimable; /* All pages pinned */
 
@@ -206,6 +249,9 @@ struct zone {
 	unsigned long		spanned_pages;	/* total size, including holes */
 	unsigned long		present_pages;	/* amount of memory (excluding holes) */
 
+	/* MIGRATE_* type of each MAX_ORDER block, under zone->lock */
+	unsigned char		*pageblock_type;
+
 	/*
 	 * rarely used fields:
 	 */
@@ -370,6 +416,17 @@ static inline int is_normal(struct zone *zone)
 	return zone == zone->zone_pgdat->node_zones + ZONE_NORMAL;
 }
 
+/* Pages on the active and inactive lists of all LRU types */
+static inline unsigned long zone_nr_active(struct zone *zone)
+{
+	return zone->nr_active[LRU_ANON] + zone->nr_active[LRU_FILE];
+}
+
+static inline unsigned long zone_nr_inactive(struct zone *zone)
+{
+	return zone->nr_inactive[LRU_ANON] + zone->nr_inactive[LRU_FILE];
+}
+
 /* These two functions are used to setup the per zone pages min values */
 struct ctl_table;
 struct file;
@@ -378,6 +435,9 @@ int min_free_kbytes_sysctl_handler(struct ctl_table *, int, struct file *,
 extern int sysctl_lowmem_reserve_ratio[MAX_NR_ZONES-1];
 int lowmem_reserve_ratio_sysctl_handler(struct ctl_table *, int, struct file *,
 					void __user *, size_t *, loff_t *);
+extern int sysctl_prezero_ratio;
+int prezero_ratio_sysctl_handler(struct ctl_table *, int, struct file *,
+					void __user *, size_t *, loff_t *);
 
 #include <linux/topology.h>
 /* Returns the number of the current Node. */
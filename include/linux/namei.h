@@ -19,6 +19,7 @@ struct nameidata {
 	unsigned int	flags;
 	int		last_type;
 	unsigned	depth;
+	unsigned	seq;		/* d_seq of dentry, in RCU walk */
 	char *saved_names[MAX_NESTED_LINKS + 1];
 
 	/* Intent data */
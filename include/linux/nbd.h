@@ -24,6 +24,7 @@
 #define NBD_PRINT_DEBUG	_IO( 0xab, 6 )
 #define NBD_SET_SIZE_BLOCKS	_IO( 0xab, 7 )
 #define NBD_DISCONNECT  _IO( 0xab, 8 )
+#define NBD_SET_DEPTH	_IO( 0xab, 9 )
 
 enum {
 	NBD_CMD_READ = 0,
@@ -34,22 +35,47 @@ enum {
 #define nbd_cmd(req) ((req)->cmd[0])
 #define MAX_NBD 128
 
+/*
+ * NBD_SET_SOCK can be repeated to give a device up to this many
+ * connections to the server; requests are spread over them.
+ */
+#define NBD_MAX_CONNECTIONS 8
+
 /* userspace doesn't need the nbd_device structure */
 #ifdef __KERNEL__
 
+#include <linux/completion.h>
+#include <linux/workqueue.h>
+
 /* values for flags field */
 #define NBD_READ_ONLY 0x0001
 #define NBD_WRITE_NOCHK 0x0002
 
+struct nbd_device;
+
+/* one connection to the server */
+struct nbd_sock {
+	struct nbd_device *lo;
+	struct socket * sock;
+	struct file * file;
+	struct list_head queue_head;/* Requests sent here wait here...	*/
+	struct semaphore tx_lock;
+	struct completion done;	/* Receiver has finished		*/
+};
+
 struct nbd_device {
 	int flags;
 	int harderror;		/* Code of hard error			*/
-	struct socket * sock;
-	struct file * file; 	/* If == NULL, device is not ready, yet	*/
+	struct nbd_sock *socks[NBD_MAX_CONNECTIONS];
+	int num_socks;		/* If == 0, device is not ready, yet	*/
+	unsigned int next_sock;	/* Where to try sending next		*/
+	int running;		/* NBD_DO_IT in progress		*/
+	int depth;		/* Max requests in flight, 0 = no limit	*/
+	int in_flight;
+	int throttled;		/* do_nbd_request() held back by depth	*/
+	struct work_struct kick;
 	int magic;
-	spinlock_t queue_lock;
-	struct list_head queue_head;/* Requests are added here...	*/
-	struct semaphore tx_lock;
+	spinlock_t queue_lock;	/* Protects the above and socket lists	*/
 	struct gendisk *disk;
 	int blksize;
 	u64 bytesize;
@@ -171,6 +171,10 @@ struct netif_rx_stats
 	unsigned fastroute_deferred_out;
 	unsigned fastroute_latency_reduction;
 	unsigned cpu_collision;
+	unsigned recycle_hit;
+	unsigned recycle_miss;
+	unsigned busy_poll_loops;
+	unsigned busy_poll_packets;
 };
 
 DECLARE_PER_CPU(struct netif_rx_stats, netdev_rx_stat);
@@ -239,6 +243,33 @@ enum netdev_state_t
 	__LINK_STATE_LINKWATCH_PENDING
 };
 
+/*
+ * The extra transmit queues of a multiqueue device.  Queue 0 is the
+ * device itself: dev->qdisc, dev->queue_lock, dev->xmit_lock and the
+ * __LINK_STATE_XOFF bit.  Queues 1 .. num_tx_queues-1 each have their
+ * own copy of those, so cpus sending on different queues don't
+ * contend on any of them.
+ */
+enum netdev_queue_state_t
+{
+	__QUEUE_STATE_XOFF=0,
+	__QUEUE_STATE_SCHED,
+};
+
+struct netdev_queue
+{
+	spinlock_t		lock;		/* like dev->queue_lock */
+	struct Qdisc		*qdisc;
+	struct Qdisc		*qdisc_sleeping;
+	unsigned long		state;
+	struct netdev_queue	*next_sched;
+	struct net_device	*dev;
+	u16			index;
+
+	spinlock_t		xmit_lock;	/* like dev->xmit_lock */
+	int			xmit_lock_owner;
+} ____cacheline_aligned_in_smp;
+
 
 /*
  * This structure holds at boot time configured netdevice settings. They
@@ -365,6 +396,11 @@ struct net_device
 	struct list_head	poll_list;	/* Link to poll list	*/
 	int			quota;
 	int			weight;
+	struct sk_buff		*gro_list;	/* rx held for merging	*/
+	int			gro_count;
+#ifdef CONFIG_RPS
+	struct rps_map		*rps_map;	/* cpus to steer rx to	*/
+#endif
 
 	struct Qdisc		*qdisc;
 	struct Qdisc		*qdisc_sleeping;
@@ -372,6 +408,13 @@ struct net_device
 	struct list_head	qdisc_list;
 	unsigned long		tx_queue_len;	/* Max frames per queue allowed */
 
+	/* transmit queues 1 .. num_tx_queues-1, see netdev_get_tx_queue() */
+	struct netdev_queue	*tx_subqueues;
+	unsigned int		num_tx_queues;
+	/* pick the transmit queue of a packet, default dev_pick_tx() */
+	u16			(*select_queue)(struct net_device *dev,
+						struct sk_buff *skb);
+
 	/* ingress path synchronizer */
 	spinlock_t		ingress_lock;
 	/* hard_start_xmit synchronizer */
@@ -414,6 +457,8 @@ struct net_device
 #define NETIF_F_VLAN_CHALLENGED	1024	/* Device cannot handle VLAN packets */
 #define NETIF_F_TSO		2048	/* Can offload TCP/IP segmentation */
 #define NETIF_F_LLTX		4096	/* LockLess TX */
+#define NETIF_F_GSO		8192	/* Segment large sends in software */
+#define NETIF_F_GRO		16384	/* Merge received segments */
 
 	/* Called after device is detached from network. */
 	void			(*uninit)(struct net_device *dev);
@@ -427,6 +472,10 @@ struct net_device
 						    struct net_device *dev);
 #define HAVE_NETDEV_POLL
 	int			(*poll) (struct net_device *dev, int *quota);
+#ifdef CONFIG_NET_BUSY_POLL
+	/* cleans up to budget rx packets from process context, for sk_busy_loop() */
+	int			(*busy_poll) (struct net_device *dev, int budget);
+#endif
 	int			(*hard_header) (struct sk_buff *skb,
 						struct net_device *dev,
 						unsigned short type,
@@ -507,12 +556,18 @@ struct packet_type {
 	struct net_device		*dev;	/* NULL is wildcarded here		*/
 	int			(*func) (struct sk_buff *, struct net_device *,
 					 struct packet_type *);
+	struct sk_buff		*(*gso_segment)(struct sk_buff *skb,
+						int sg);
+	struct sk_buff		**(*gro_receive)(struct sk_buff **head,
+						 struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb);
 	void			*af_packet_priv;
 	struct list_head	list;
 };
 
 #include <linux/interrupt.h>
 #include <linux/notifier.h>
+#include <linux/rcupdate.h>
 
 extern struct net_device		loopback_dev;		/* The loopback */
 extern struct net_device		*dev_base;		/* All devices */
@@ -557,7 +612,8 @@ static inline int unregister_gifconf(unsigned int family)
 
 /*
  * Incoming packets are placed on per-cpu queues so that
- * no locking is needed.
+ * no locking is needed.  With receive packet steering other cpus
+ * queue packets here too, under input_pkt_queue.lock.
  */
 
 struct softnet_data
@@ -568,11 +624,29 @@ struct softnet_data
 	struct sk_buff_head	input_pkt_queue;
 	struct list_head	poll_list;
 	struct net_device	*output_queue;
+	struct netdev_queue	*output_subqueue;
 	struct sk_buff		*completion_queue;
+	struct sk_buff_head	recycle_pool;	/* tx skbs kept for rx refill */
+#ifdef CONFIG_RPS
+	int			rps_sched;	/* others queued to our idle backlog */
+	cpumask_t		rps_kick;	/* cpus we queued to and must kick */
+#endif
 
 	struct net_device	backlog_dev;	/* Sorry. 8) */
 };
 
+#ifdef CONFIG_RPS
+/*
+ * Receive packet steering: the cpus a device's received packets are
+ * spread over, by a hash of their flow.
+ */
+struct rps_map {
+	unsigned int		len;
+	struct rcu_head		rcu;
+	u16			cpus[0];
+};
+#endif
+
 DECLARE_PER_CPU(struct softnet_data,softnet_data);
 
 #define HAVE_NETIF_QUEUE
@@ -598,6 +672,27 @@ static inline void netif_schedule(struct net_device *dev)
 		__netif_schedule(dev);
 }
 
+static inline void __netif_schedule_subqueue(struct netdev_queue *txq)
+{
+	if (!test_and_set_bit(__QUEUE_STATE_SCHED, &txq->state)) {
+		unsigned long flags;
+		struct softnet_data *sd;
+
+		local_irq_save(flags);
+		sd = &__get_cpu_var(softnet_data);
+		txq->next_sched = sd->output_subqueue;
+		sd->output_subqueue = txq;
+		raise_softirq_irqoff(NET_TX_SOFTIRQ);
+		local_irq_restore(flags);
+	}
+}
+
+static inline void netif_schedule_subqueue(struct netdev_queue *txq)
+{
+	if (!test_bit(__QUEUE_STATE_XOFF, &txq->state))
+		__netif_schedule_subqueue(txq);
+}
+
 static inline void netif_start_queue(struct net_device *dev)
 {
 	clear_bit(__LINK_STATE_XOFF, &dev->state);
@@ -632,6 +727,65 @@ static inline int netif_running(const struct net_device *dev)
 	return test_bit(__LINK_STATE_START, &dev->state);
 }
 
+/* transmit queue @index of a multiqueue device, 1 <= @index < num_tx_queues */
+static inline struct netdev_queue *netdev_get_tx_queue(struct net_device *dev,
+						       u16 index)
+{
+	return &dev->tx_subqueues[index - 1];
+}
+
+/*
+ * Flow control of the transmit queues of a multiqueue device.  The
+ * driver finds the queue of a packet in skb->queue_mapping; queue 0
+ * is controlled by netif_start_queue() and friends as usual.
+ */
+static inline void netif_start_subqueue(struct net_device *dev, u16 index)
+{
+	if (!index)
+		netif_start_queue(dev);
+	else
+		clear_bit(__QUEUE_STATE_XOFF,
+			  &netdev_get_tx_queue(dev, index)->state);
+}
+
+static inline void netif_wake_subqueue(struct net_device *dev, u16 index)
+{
+	struct netdev_queue *txq;
+
+	if (!index) {
+		netif_wake_queue(dev);
+		return;
+	}
+#ifdef CONFIG_NETPOLL_TRAP
+	if (netpoll_trap())
+		return;
+#endif
+	txq = netdev_get_tx_queue(dev, index);
+	if (test_and_clear_bit(__QUEUE_STATE_XOFF, &txq->state))
+		__netif_schedule_subqueue(txq);
+}
+
+static inline void netif_stop_subqueue(struct net_device *dev, u16 index)
+{
+	if (!index) {
+		netif_stop_queue(dev);
+		return;
+	}
+#ifdef CONFIG_NETPOLL_TRAP
+	if (netpoll_trap())
+		return;
+#endif
+	set_bit(__QUEUE_STATE_XOFF, &netdev_get_tx_queue(dev, index)->state);
+}
+
+static inline int netif_subqueue_stopped(struct net_device *dev, u16 index)
+{
+	if (!index)
+		return netif_queue_stopped(dev);
+	return test_bit(__QUEUE_STATE_XOFF,
+			&netdev_get_tx_queue(dev, index)->state);
+}
+
 
 /* Use this variant when it is known for sure that it
  * is executing from interrupt context.
@@ -662,11 +816,39 @@ static inline void dev_kfree_skb_any(struct sk_buff *skb)
 		dev_kfree_skb(skb);
 }
 
+extern void		dev_kfree_skb_recycle(struct sk_buff *skb);
+extern struct sk_buff	*dev_alloc_skb_recycle(unsigned int length);
+
 #define HAVE_NETIF_RX 1
 extern int		netif_rx(struct sk_buff *skb);
 extern int		netif_rx_ni(struct sk_buff *skb);
 #define HAVE_NETIF_RECEIVE_SKB 1
 extern int		netif_receive_skb(struct sk_buff *skb);
+extern struct sk_buff	*skb_gso_segment(struct sk_buff *skb, int sg);
+extern int		netif_gro_receive(struct net_device *dev,
+					  struct sk_buff *skb);
+extern void		__netif_gro_flush(struct net_device *dev);
+extern void		skb_gro_receive(struct sk_buff *p, struct sk_buff *skb);
+
+/*
+ * Receive aggregation state of an skb, in skb->cb while the skb sits
+ * on dev->gro_list or is being matched against it.
+ */
+struct napi_gro_cb {
+	int			same_flow;	/* matches the skb being received */
+	int			flush;		/* must go up the stack now */
+	int			count;		/* segments merged into it */
+	struct sk_buff		*last;		/* tail of its frag_list */
+};
+
+#define NAPI_GRO_CB(skb)	((struct napi_gro_cb *)(skb)->cb)
+
+/* Pass the segments held for merging up the stack. */
+static inline void netif_gro_flush(struct net_device *dev)
+{
+	if (dev->gro_list)
+		__netif_gro_flush(dev);
+}
 extern int		dev_ioctl(unsigned int cmd, void __user *);
 extern int		dev_ethtool(struct ifreq *);
 extern unsigned		dev_get_flags(const struct net_device *);
@@ -720,6 +902,17 @@ static inline void netif_carrier_off(struct net_device *dev)
 		linkwatch_fire_event(dev);
 }
 
+/*
+ * A large send @dev can't segment itself; merged received segments
+ * being forwarded are always split in software.
+ */
+static inline int netif_needs_gso(struct net_device *dev, struct sk_buff *skb)
+{
+	return skb_shinfo(skb)->tso_size &&
+	       (!(dev->features & NETIF_F_TSO) ||
+		skb->ip_summed != CHECKSUM_HW);
+}
+
 /* Hot-plugging. */
 static inline int netif_device_present(struct net_device *dev)
 {
@@ -856,6 +1049,7 @@ static inline void netif_rx_complete(struct net_device *dev)
 {
 	unsigned long flags;
 
+	netif_gro_flush(dev);
 	local_irq_save(flags);
 	BUG_ON(!test_bit(__LINK_STATE_RX_SCHED, &dev->state));
 	list_del(&dev->poll_list);
@@ -879,7 +1073,8 @@ static inline void netif_poll_enable(struct net_device *dev)
 }
 
 /* same as netif_rx_complete, except that local_irq_save(flags)
- * has already been issued
+ * has already been issued, so it can't flush dev->gro_list: drivers
+ * using netif_gro_receive() call netif_gro_flush() before it.
  */
 static inline void __netif_rx_complete(struct net_device *dev)
 {
@@ -901,6 +1096,9 @@ static inline void netif_tx_disable(struct net_device *dev)
 extern void		ether_setup(struct net_device *dev);
 
 /* Support for loadable net-drivers */
+extern struct net_device *alloc_netdev_mq(int sizeof_priv, const char *name,
+				    void (*setup)(struct net_device *),
+				    unsigned int queue_count);
 extern struct net_device *alloc_netdev(int sizeof_priv, const char *name,
 				       void (*setup)(struct net_device *));
 extern int		register_netdev(struct net_device *dev);
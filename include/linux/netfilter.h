@@ -21,6 +21,13 @@
 #define NF_STOP 5
 #define NF_MAX_VERDICT NF_STOP
 
+/* An NF_QUEUE verdict may carry the number of the queue in its upper
+   bits; plain NF_QUEUE means queue 0. */
+#define NF_VERDICT_MASK 0x0000ffff
+#define NF_VERDICT_BITS 16
+
+#define NF_QUEUE_NR(x) (((x) << NF_VERDICT_BITS) | NF_QUEUE)
+
 /* Generic cache responses from hook functions.
    <= 0x2000 is used for protocol-flags. */
 #define NFC_UNKNOWN 0x4000
@@ -88,6 +95,9 @@ struct nf_info
 	unsigned int hook;
 	struct net_device *indev, *outdev;
 	int (*okfn)(struct sk_buff *);
+
+	/* Queue the verdict asked for, for handlers which have several. */
+	unsigned int queuenum;
 };
                                                                                 
 /* Function to register/unregister hook points. */
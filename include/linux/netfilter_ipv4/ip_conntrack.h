@@ -155,6 +155,13 @@ struct ip_conntrack
 	/* Helper, if any. */
 	struct ip_conntrack_helper *helper;
 
+	/* CPU whose unconfirmed list we are on until confirmed */
+	unsigned int cpu;
+
+	/* Defers dropping the hash table's reference past lockless
+	   lookups */
+	struct rcu_head rcu;
+
 	/* Storage reserved for other modules: */
 	union ip_conntrack_proto proto;
 
@@ -259,6 +266,43 @@ extern void ip_conntrack_tcp_update(struct sk_buff *skb,
 /* Call me when a conntrack is destroyed. */
 extern void (*ip_conntrack_destroyed)(struct ip_conntrack *conntrack);
 
+/* Call me when the conntrack hash table has been resized. */
+extern void (*ip_conntrack_resized)(unsigned int hashsize);
+
+/* Events passed to the notifiers on ip_conntrack_chain, with the
+   conntrack as data.  They are called without locks, from softirq or
+   process context, and must not sleep. */
+enum ip_conntrack_events {
+	IPCT_NEW,		/* confirmed: now in the hash table */
+	IPCT_DESTROY,		/* a confirmed one about to be freed */
+};
+
+#ifdef CONFIG_IP_NF_CONNTRACK_EVENTS
+#include <linux/notifier.h>
+#include <linux/rcupdate.h>
+
+extern struct notifier_block *ip_conntrack_chain;
+
+extern int ip_conntrack_register_notifier(struct notifier_block *nb);
+extern int ip_conntrack_unregister_notifier(struct notifier_block *nb);
+
+static inline void
+ip_conntrack_event(enum ip_conntrack_events event, struct ip_conntrack *ct)
+{
+	if (ip_conntrack_chain) {
+		/* Unregistering waits for us */
+		rcu_read_lock();
+		notifier_call_chain(&ip_conntrack_chain, event, ct);
+		rcu_read_unlock();
+	}
+}
+#else
+static inline void
+ip_conntrack_event(enum ip_conntrack_events event, struct ip_conntrack *ct)
+{
+}
+#endif /* CONFIG_IP_NF_CONNTRACK_EVENTS */
+
 /* Fake conntrack entry for untracked connections */
 extern struct ip_conntrack ip_conntrack_untracked;
 
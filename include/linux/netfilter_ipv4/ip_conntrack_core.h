@@ -1,6 +1,7 @@
 #ifndef _IP_CONNTRACK_CORE_H
 #define _IP_CONNTRACK_CORE_H
 #include <linux/netfilter.h>
+#include <linux/seqlock.h>
 #include <linux/netfilter_ipv4/lockhelp.h>
 
 /* This header is used to share core functionality between the
@@ -45,7 +46,12 @@ static inline int ip_conntrack_confirm(struct sk_buff **pskb)
 	return NF_ACCEPT;
 }
 
+/* Rehash the table into hashsize buckets, keeping all connections. */
+extern int ip_conntrack_set_hashsize(unsigned int hashsize);
+
 extern struct list_head *ip_conntrack_hash;
+/* Bumped around each resize of ip_conntrack_hash. */
+extern seqcount_t ip_conntrack_generation;
 extern struct list_head ip_conntrack_expect_list;
 DECLARE_RWLOCK_EXTERN(ip_conntrack_lock);
 #endif /* _IP_CONNTRACK_CORE_H */
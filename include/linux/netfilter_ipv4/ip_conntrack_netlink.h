@@ -0,0 +1,50 @@
+#ifndef _IP_CONNTRACK_NETLINK_H
+#define _IP_CONNTRACK_NETLINK_H
+
+/* Connection tracking over a NETLINK_CONNTRACK socket.
+ *
+ * Members of the IPCTNL_GRP_NEW and IPCTNL_GRP_DESTROY groups get a
+ * message for every conntrack confirmed and destroyed.  Messages are
+ * batched per CPU and sent when a batch fills up, or flush_interval
+ * milliseconds (a module parameter) after its first one; a member too
+ * slow to keep up loses them and sees ENOBUFS.
+ *
+ * IPCTNL_MSG_GET with NLM_F_DUMP asks for every conntrack in the table,
+ * as IPCTNL_MSG_NEW messages.  The table is walked a bucket at a time
+ * without taking its locks: conntracks which come or go meanwhile may
+ * or may not be listed, and may be listed twice.  If the table is
+ * resized during the dump, it ends early with EAGAIN in NLMSG_DONE.
+ */
+
+#define IPCTNL_GRP_NEW		0x00000001
+#define IPCTNL_GRP_DESTROY	0x00000002
+
+#define IPCTNL_MSG_BASE		0x10
+enum {
+	IPCTNL_MSG_NEW = IPCTNL_MSG_BASE,	/* Event, or dump entry */
+	IPCTNL_MSG_DESTROY,			/* Event */
+	IPCTNL_MSG_GET,				/* Dump request */
+	IPCTNL_MSG_MAX
+};
+
+/* In network byte order */
+struct ip_ctnl_tuple {
+	u_int32_t src;
+	u_int32_t dst;
+	u_int16_t src_u;		/* Port, or ICMP id */
+	u_int16_t dst_u;		/* Port, or ICMP type and code */
+};
+
+struct ip_ctnl_msg {
+	struct ip_ctnl_tuple tuple[2];	/* Original and reply */
+	u_int64_t packets[2];		/* By direction, with accounting */
+	u_int64_t bytes[2];
+	u_int32_t status;		/* IPS_* bits */
+	u_int32_t timeout;		/* Seconds left, for IPCTNL_MSG_NEW */
+	u_int32_t mark;
+	u_int8_t protonum;
+	u_int8_t tcp_state;		/* For TCP, enum tcp_conntrack */
+	u_int16_t pad;
+};
+
+#endif /*_IP_CONNTRACK_NETLINK_H*/
@@ -0,0 +1,89 @@
+/*
+ * Numbered queues of IPv4 packets for userspace, with the packets
+ * handed over in a memory mapped ring instead of netlink messages.
+ *
+ * Open /dev/ip_nfqueue, bind the file to a queue number with
+ * IP_NFQ_BIND, set up a ring of frames with IP_NFQ_SET_RING and mmap
+ * it.  Every packet the QUEUE or NFQUEUE targets send to that number
+ * fills in the next frame of the ring: a struct ip_nfq_frame, followed
+ * by up to copy_range bytes of the packet at IP_NFQ_FRAME_HDRLEN, and
+ * then has its status set to IP_NFQ_STATUS_USER.  Userspace gives the
+ * frame back by setting IP_NFQ_STATUS_KERNEL; if the kernel comes
+ * round to a frame userspace still owns, the packet is dropped.
+ *
+ * A frame may go back before its packet has a verdict.  Verdicts are
+ * written to the file, as many struct ip_nfq_verdict as fit in one
+ * write(); IP_NFQ_VERDICT_BATCH applies one to every packet queued up
+ * to and including id.
+ */
+#ifndef _IP_NFQUEUE_H
+#define _IP_NFQUEUE_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define IP_NFQ_DEVICE_NAME	"ip_nfqueue"
+
+struct ip_nfq_config {
+	u_int16_t queue;		/* Queue number */
+	u_int16_t pad;
+	u_int32_t copy_range;		/* Bytes of packet to copy, at most */
+	u_int32_t maxlen;		/* Packets awaiting verdict, 0: default */
+};
+
+/* The ring is block_nr blocks of block_size bytes, a multiple of the
+   page size, each holding block_size / frame_size frames. */
+struct ip_nfq_ring_req {
+	unsigned int block_size;
+	unsigned int block_nr;
+	unsigned int frame_size;
+	unsigned int frame_nr;
+};
+
+struct ip_nfq_stats {
+	u_int32_t queued;		/* Packets awaiting verdict */
+	u_int32_t maxlen;
+	u_int32_t queue_dropped;	/* Dropped as maxlen were queued */
+	u_int32_t ring_dropped;		/* Dropped for want of a frame */
+};
+
+#define IP_NFQ_BIND		_IOW(0xAD, 0x10, struct ip_nfq_config)
+#define IP_NFQ_SET_RING		_IOW(0xAD, 0x11, struct ip_nfq_ring_req)
+#define IP_NFQ_GET_STATS	_IOR(0xAD, 0x12, struct ip_nfq_stats)
+
+struct ip_nfq_frame {
+	unsigned long status;
+#define IP_NFQ_STATUS_KERNEL	0
+#define IP_NFQ_STATUS_USER	1
+	u_int32_t packet_id;		/* For the verdict */
+	u_int32_t len;			/* Length of the packet */
+	u_int32_t caplen;		/* Bytes of it in the frame */
+	u_int32_t mark;			/* Netfilter mark value */
+	u_int32_t tstamp_sec;		/* Arrival time */
+	u_int32_t tstamp_usec;
+	u_int32_t hook;			/* Netfilter hook it was queued from */
+	int32_t indev;			/* Interface indices, 0 for none */
+	int32_t outdev;
+	u_int16_t hw_protocol;		/* Hardware protocol (network order) */
+	u_int16_t hw_type;		/* Hardware type */
+	u_int8_t hw_addrlen;		/* Hardware address length */
+	u_int8_t hw_addr[8];		/* Hardware address */
+};
+
+#define IP_NFQ_ALIGNMENT	16
+#define IP_NFQ_ALIGN(x)		(((x)+IP_NFQ_ALIGNMENT-1)&~(IP_NFQ_ALIGNMENT-1))
+#define IP_NFQ_FRAME_HDRLEN	IP_NFQ_ALIGN(sizeof(struct ip_nfq_frame))
+
+/* Followed by data_len bytes of replacement packet, if any; the next
+   verdict starts at IP_NFQ_ALIGN(sizeof(struct ip_nfq_verdict) +
+   data_len). */
+struct ip_nfq_verdict {
+	u_int32_t verdict;		/* NF_ACCEPT, NF_DROP, NF_REPEAT or
+					   NF_QUEUE_NR(queue) */
+	u_int32_t id;			/* Packet ID */
+	u_int32_t flags;
+#define IP_NFQ_VERDICT_BATCH	0x01	/* All packets up to id */
+	u_int32_t data_len;
+};
+
+#endif /*_IP_NFQUEUE_H*/
@@ -0,0 +1,182 @@
+#ifndef _IP_SET_H
+#define _IP_SET_H
+
+/* IP sets: named, typed collections of addresses which iptables rules
+ * can test or modify in constant time, instead of one rule per entry.
+ *
+ * Sets are managed with get/setsockopt(SO_IP_SET) on a raw PF_INET
+ * socket.  Every request starts with struct ip_set_req_header; the
+ * kernel rejects requests whose version does not match its own.
+ */
+
+#define IP_SET_PROTOCOL_VERSION	1
+
+#define IP_SET_MAXNAMELEN	32	/* set and type names, with NUL */
+
+/* Sets are referred to by index from the kernel side. */
+typedef u_int16_t ip_set_id_t;
+
+#define IP_SET_INVALID_ID	65535
+
+/* Socket option, clear of the ip_tables and arp_tables ranges */
+#define SO_IP_SET		83
+
+/* Requests through setsockopt() */
+#define IP_SET_OP_CREATE	0x00000001	/* struct ip_set_req_create */
+#define IP_SET_OP_DESTROY	0x00000002	/* struct ip_set_req_header */
+#define IP_SET_OP_FLUSH		0x00000003	/* struct ip_set_req_header */
+#define IP_SET_OP_SWAP		0x00000004	/* struct ip_set_req_swap */
+#define IP_SET_OP_ADD		0x00000005	/* struct ip_set_req_elem */
+#define IP_SET_OP_DEL		0x00000006	/* struct ip_set_req_elem */
+
+/* Requests through getsockopt() */
+#define IP_SET_OP_VERSION	0x00000100	/* struct ip_set_req_header */
+#define IP_SET_OP_TEST		0x00000101	/* struct ip_set_req_elem */
+#define IP_SET_OP_LIST_SIZE	0x00000102	/* struct ip_set_req_list */
+#define IP_SET_OP_LIST		0x00000103	/* struct ip_set_req_list */
+
+/* Set type features: the dimensions an element is made of */
+#define IPSET_TYPE_IP		0x01
+#define IPSET_TYPE_PORT		0x02
+
+/* An element, in host byte order.  cidr is only used by sets of
+ * networks; port only by sets with IPSET_TYPE_PORT. */
+struct ip_set_elem {
+	u_int32_t ip;
+	u_int16_t port;
+	u_int8_t cidr;
+	u_int8_t pad;
+};
+
+struct ip_set_req_header {
+	u_int32_t op;
+	u_int32_t version;
+	char name[IP_SET_MAXNAMELEN];
+};
+
+/* Followed by the type specific creation data. */
+struct ip_set_req_create {
+	struct ip_set_req_header header;
+	char typename[IP_SET_MAXNAMELEN];
+};
+
+struct ip_set_req_swap {
+	struct ip_set_req_header header;
+	char name2[IP_SET_MAXNAMELEN];
+};
+
+/* For IP_SET_OP_TEST, result is set to 1 if the element is in the set. */
+struct ip_set_req_elem {
+	struct ip_set_req_header header;
+	struct ip_set_elem elem;
+	u_int32_t result;
+};
+
+/* IP_SET_OP_LIST_SIZE fills in everything but the elements.
+ * IP_SET_OP_LIST then needs room for members elements, and fails with
+ * EAGAIN if the set has changed size meanwhile. */
+struct ip_set_req_list {
+	struct ip_set_req_header header;
+	char typename[IP_SET_MAXNAMELEN];
+	u_int32_t features;
+	u_int32_t members;
+	struct ip_set_elem elems[0];
+};
+
+/* Creation data of the types shipped with the kernel */
+
+/* "ipmap": a bitmap of the addresses from first_ip to last_ip, at most
+ * IP_SET_IPMAP_MAX of them. */
+#define IP_SET_IPMAP_MAX	65536
+
+struct ip_set_req_ipmap_create {
+	u_int32_t first_ip;
+	u_int32_t last_ip;
+};
+
+/* "iphash" and "ipporthash": hashes of addresses, or address and port
+ * pairs.  hashsize is the number of buckets, 0 for a default. */
+struct ip_set_req_iphash_create {
+	u_int32_t hashsize;
+};
+
+/* "nettree" takes no creation data: a tree of CIDR networks, which an
+ * address matches if any of them contains it. */
+
+#ifdef __KERNEL__
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+struct sk_buff;
+struct ip_set;
+
+struct ip_set_type {
+	struct list_head list;
+
+	char typename[IP_SET_MAXNAMELEN];
+
+	/* IPSET_TYPE_* dimensions of an element */
+	unsigned int features;
+
+	/* Size of the creation data expected from userspace */
+	size_t create_size;
+
+	/* Set up set->data.  Process context. */
+	int (*create)(struct ip_set *set, const void *data, size_t size);
+
+	/* Free set->data.  The set is unreferenced. */
+	void (*destroy)(struct ip_set *set);
+
+	/* Remove all elements: called with set->lock write held. */
+	void (*flush)(struct ip_set *set);
+
+	/* Called with set->lock read held, possibly from softirq. */
+	int (*test)(struct ip_set *set, const struct ip_set_elem *elem);
+
+	/* Called with set->lock write held, possibly from softirq.
+	   Return 0, -EEXIST/-ENOENT, or another error. */
+	int (*add)(struct ip_set *set, const struct ip_set_elem *elem);
+	int (*del)(struct ip_set *set, const struct ip_set_elem *elem);
+
+	/* Listing, with set->lock read held: count the elements, then
+	   copy up to max of them out.  Return the number copied. */
+	unsigned int (*members)(const struct ip_set *set);
+	unsigned int (*list_members)(const struct ip_set *set,
+				     struct ip_set_elem *elems,
+				     unsigned int max);
+
+	/* Set this to THIS_MODULE. */
+	struct module *me;
+};
+
+struct ip_set {
+	char name[IP_SET_MAXNAMELEN];
+	ip_set_id_t id;			/* index in the set array */
+	rwlock_t lock;			/* protects data */
+	unsigned int ref;		/* rules using the index */
+	struct ip_set_type *type;
+	void *data;			/* the type's private data */
+};
+
+extern int ip_set_register_type(struct ip_set_type *type);
+extern void ip_set_unregister_type(struct ip_set_type *type);
+
+/* Look up a set by name and take a reference on it, for a rule.
+   Returns IP_SET_INVALID_ID if there's no such set. */
+extern ip_set_id_t ip_set_get_byname(const char *name);
+extern void ip_set_put(ip_set_id_t id);
+
+/* Packet path: build an element from the packet, taking the address
+   from the source if src_ip is set, else the destination, and the same
+   for the port.  Unfragmented TCP and UDP only for port sets. */
+extern int ip_set_testip_kernel(ip_set_id_t id, const struct sk_buff *skb,
+				int src_ip, int src_port);
+extern void ip_set_addip_kernel(ip_set_id_t id, const struct sk_buff *skb,
+				int src_ip, int src_port);
+extern void ip_set_delip_kernel(ip_set_id_t id, const struct sk_buff *skb,
+				int src_ip, int src_port);
+
+#endif /* __KERNEL__ */
+
+#endif /* _IP_SET_H */
@@ -154,7 +154,8 @@ struct ipt_entry
 
 #define IPT_SO_SET_REPLACE	(IPT_BASE_CTL)
 #define IPT_SO_SET_ADD_COUNTERS	(IPT_BASE_CTL + 1)
-#define IPT_SO_SET_MAX		IPT_SO_SET_ADD_COUNTERS
+#define IPT_SO_SET_SPLICE	(IPT_BASE_CTL + 2)
+#define IPT_SO_SET_MAX		IPT_SO_SET_SPLICE
 
 #define IPT_SO_GET_INFO			(IPT_BASE_CTL)
 #define IPT_SO_GET_ENTRIES		(IPT_BASE_CTL + 1)
@@ -265,6 +266,43 @@ struct ipt_replace
 	struct ipt_entry entries[0];
 };
 
+/* The argument to IPT_SO_SET_SPLICE: replace the delete_size bytes of
+ * entries at offset with insert_size bytes of new ones, which may be
+ * none, leaving the rest of the table and its counters alone.
+ *
+ * Jumps in the new entries are offsets into the table as it will be
+ * once spliced.  The kernel moves jumps in the other entries along;
+ * a jump to offset itself stays there, i.e. goes to the first new
+ * entry.  Hook entry points work the same way, so new entries at the
+ * start of a built-in chain become its first rules.  Neither a jump
+ * nor a policy may be deleted from under the table. */
+struct ipt_splice
+{
+	/* Which table. */
+	char name[IPT_TABLE_MAXNAMELEN];
+
+	/* Size and number of entries of the table being changed, which
+	   must still be current (or EAGAIN). */
+	unsigned int size;
+	unsigned int num_entries;
+
+	/* Where, in the current table. */
+	unsigned int offset;
+
+	/* Entries to delete, and where to put their counters (may be
+	   NULL). */
+	unsigned int delete_size;
+	unsigned int num_deleted;
+	struct ipt_counters __user *counters;
+
+	/* Entries to insert. */
+	unsigned int insert_size;
+	unsigned int num_inserted;
+
+	/* The new entries (hang off end: not really an array). */
+	struct ipt_entry entries[0];
+};
+
 /* The argument to IPT_SO_ADD_COUNTERS. */
 struct ipt_counters_info
 {
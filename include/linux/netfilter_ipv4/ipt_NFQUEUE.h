@@ -0,0 +1,11 @@
+#ifndef _IPT_NFQUEUE_H_target
+#define _IPT_NFQUEUE_H_target
+
+/* Queue to queuenum, or spread packets over queues_total queues from
+   queuenum on by the CPU they are handled on. */
+struct ipt_NFQ_info {
+	u_int16_t queuenum;
+	u_int16_t queues_total;
+};
+
+#endif /*_IPT_NFQUEUE_H_target*/
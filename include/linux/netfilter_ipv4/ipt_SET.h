@@ -0,0 +1,12 @@
+#ifndef _IPT_SET_H_target
+#define _IPT_SET_H_target
+
+#include <linux/netfilter_ipv4/ipt_set.h>
+
+/* Add the packet to add_set and/or remove it from del_set. */
+struct ipt_set_info_target {
+	struct ipt_set_info add_set;
+	struct ipt_set_info del_set;
+};
+
+#endif /*_IPT_SET_H_target*/
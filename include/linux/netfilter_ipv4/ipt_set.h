@@ -0,0 +1,25 @@
+#ifndef _IPT_SET_H
+#define _IPT_SET_H
+
+#include <linux/netfilter_ipv4/ip_set.h>
+
+/* Take the address, or the port, from the source of the packet
+   instead of its destination. */
+#define IPT_SET_SRC_IP		0x01
+#define IPT_SET_SRC_PORT	0x02
+/* Match packets not in the set. */
+#define IPT_SET_INV		0x04
+
+struct ipt_set_info {
+	char name[IP_SET_MAXNAMELEN];	/* empty for none */
+	u_int32_t flags;
+
+	/* Used internally by the kernel */
+	ip_set_id_t index;
+};
+
+struct ipt_set_info_match {
+	struct ipt_set_info match_set;
+};
+
+#endif /*_IPT_SET_H*/
@@ -658,6 +658,25 @@ struct nfs_write_data {
 	void (*complete) (struct nfs_write_data *, int);
 };
 
+/*
+ * An asynchronous READDIR(PLUS) of one directory page, used for
+ * directory readahead.  Only NFSv3 implements readdir_setup.
+ */
+struct nfs_readdir_data {
+	struct rpc_task		task;
+	struct inode		*inode;
+	struct rpc_cred		*cred;
+	struct page		*page;
+	__u64			cookie;
+	unsigned int		count;
+	int			plus;
+	unsigned long		timestamp;	/* jiffies when sent */
+	struct nfs_fattr	dir_attr;
+	struct nfs3_readdirargs	args;
+	struct nfs3_readdirres	res;
+	void (*complete) (struct nfs_readdir_data *, int);
+};
+
 struct nfs_access_entry;
 
 /*
@@ -710,6 +729,7 @@ struct nfs_rpc_ops {
 	void	(*read_setup)   (struct nfs_read_data *);
 	void	(*write_setup)  (struct nfs_write_data *, int how);
 	void	(*commit_setup) (struct nfs_write_data *, int how);
+	void	(*readdir_setup) (struct nfs_readdir_data *);
 	int	(*file_open)   (struct inode *, struct file *);
 	int	(*file_release) (struct inode *, struct file *);
 	int	(*lock)(struct file *, int, struct file_lock *);
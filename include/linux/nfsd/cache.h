@@ -15,11 +15,10 @@
 #include <linux/uio.h>
 
 /*
- * Representation of a reply cache entry. The first two members *must*
- * be hash_next and hash_prev.
+ * Representation of a reply cache entry.  c_lru links it into the LRU
+ * list of its hash bucket.
  */
 struct svc_cacherep {
-	struct hlist_node	c_hash;
 	struct list_head	c_lru;
 
 	unsigned char		c_state,	/* unused, inprog, done */
@@ -30,6 +29,8 @@ struct svc_cacherep {
 	u32			c_prot;
 	u32			c_proc;
 	u32			c_vers;
+	unsigned int		c_len;		/* length of the call */
+	unsigned int		c_csum;		/* checksum of its start */
 	unsigned long		c_timestamp;
 	union {
 		struct kvec	u_vec;
@@ -76,6 +77,8 @@ void	nfsd_cache_init(void);
 void	nfsd_cache_shutdown(void);
 int	nfsd_cache_lookup(struct svc_rqst *, int);
 void	nfsd_cache_update(struct svc_rqst *, int, u32 *);
+struct seq_file;
+void	nfsd_cache_stats_show(struct seq_file *);
 
 #endif /* __KERNEL__ */
 #endif /* NFSCACHE_H */
@@ -64,6 +64,8 @@ extern struct svc_version	nfsd_version2, nfsd_version3,
  * Function prototypes.
  */
 int		nfsd_svc(unsigned short port, int nrservs);
+struct seq_file;
+void		nfsd_pool_stats_show(struct seq_file *);
 int		nfsd_dispatch(struct svc_rqst *rqstp, u32 *statp);
 
 /* nfsd/vfs.c */
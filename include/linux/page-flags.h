@@ -76,6 +76,9 @@
 #define PG_reclaim		18	/* To be reclaimed asap */
 #define PG_nosave_free		19	/* Free, should not be written */
 #define PG_uncached		20	/* Page has been mapped as uncached */
+#define PG_anon_lru		21	/* On the anon LRU lists, see mm_inline.h */
+#define PG_readahead		22	/* Readahead page not yet used */
+#define PG_zeroed		23	/* Free and cleared, on zone->zero_list */
 
 /*
  * Global page accounting.  One instance per CPU.  Only unsigned longs are
@@ -108,6 +111,8 @@ struct page_state {
 
 	unsigned long pgfault;		/* faults (major+minor) */
 	unsigned long pgmajfault;	/* faults (major only) */
+	unsigned long pgfaultaround;	/* pages mapped around file faults */
+	unsigned long pgfaultaround_unused;/* file ptes unmapped while old */
 	unsigned long pgrefill_high;	/* inspected in refill_inactive_zone */
 	unsigned long pgrefill_normal;
 	unsigned long pgrefill_dma;
@@ -129,8 +134,27 @@ struct page_state {
 	unsigned long kswapd_inodesteal;/* reclaimed via kswapd inode freeing */
 	unsigned long pageoutrun;	/* kswapd's calls to page reclaim */
 	unsigned long allocstall;	/* direct reclaim calls */
+	unsigned long pgscan_container;	/* scanned for memory controller */
+	unsigned long pgsteal_container;/* reclaimed for memory controller */
 
 	unsigned long pgrotated;	/* pages rotated to tail of the LRU */
+
+	unsigned long thp_fault_alloc;	/* huge pages mapped at fault time */
+	unsigned long thp_fault_fallback;/* faults which got small pages */
+	unsigned long thp_collapse_alloc;/* huge pages mapped by khugepaged */
+	unsigned long thp_split;	/* huge pmds split into ptes */
+	unsigned long thp_file_mapped;	/* huge pmds mapping file pages */
+
+	unsigned long compact_blocks_moved;/* blocks the migrate scanner passed */
+	unsigned long compact_pages_moved;/* pages compaction migrated */
+	unsigned long compact_pagemigrate_failed;/* pages it couldn't migrate */
+	unsigned long compact_stall;	/* allocations which compacted */
+	unsigned long compact_fail;	/* ... and still failed */
+	unsigned long compact_success;	/* ... and then succeeded */
+
+	unsigned long ksm_pages_scanned;/* ptes ksmd looked at */
+	unsigned long ksm_pages_merged;	/* ptes it pointed at a shared page */
+	unsigned long ksm_cow_break;	/* writes which unshared one again */
 };
 
 extern void get_page_state(struct page_state *ret);
@@ -305,6 +329,19 @@ extern void __mod_page_state(unsigned offset, unsigned long delta);
 #define SetPageUncached(page)	set_bit(PG_uncached, &(page)->flags)
 #define ClearPageUncached(page)	clear_bit(PG_uncached, &(page)->flags)
 
+#define PageAnonLRU(page)	test_bit(PG_anon_lru, &(page)->flags)
+#define SetPageAnonLRU(page)	set_bit(PG_anon_lru, &(page)->flags)
+#define ClearPageAnonLRU(page)	clear_bit(PG_anon_lru, &(page)->flags)
+
+#define PageReadahead(page)	test_bit(PG_readahead, &(page)->flags)
+#define SetPageReadahead(page)	set_bit(PG_readahead, &(page)->flags)
+#define TestClearPageReadahead(page) \
+		test_and_clear_bit(PG_readahead, &(page)->flags)
+
+#define PageZeroed(page)	test_bit(PG_zeroed, &(page)->flags)
+#define __SetPageZeroed(page)	__set_bit(PG_zeroed, &(page)->flags)
+#define __ClearPageZeroed(page)	__clear_bit(PG_zeroed, &(page)->flags)
+
 struct page;	/* forward declaration */
 
 int test_clear_page_dirty(struct page *page);
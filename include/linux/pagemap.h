@@ -9,7 +9,9 @@
 #include <linux/list.h>
 #include <linux/highmem.h>
 #include <linux/compiler.h>
+#include <linux/rcupdate.h>
 #include <asm/uaccess.h>
+#include <asm/system.h>
 #include <linux/gfp.h>
 
 /*
@@ -50,6 +52,107 @@ static inline void mapping_set_gfp_mask(struct address_space *m, int mask)
 #define page_cache_release(page)	put_page(page)
 void release_pages(struct page **pages, int nr, int cold);
 
+/*
+ * Page cache lookups take no lock: find_get_page() and friends walk
+ * mapping->page_tree under rcu_read_lock() only, so the page they find
+ * can be removed from the cache and freed before they get a reference.
+ * page_cache_get_speculative() gets one only if the page is not free,
+ * then checks that the slot it came from still holds it.
+ *
+ * Who removes a page from the cache on the grounds that nobody else
+ * holds it (page_count 2: us and the cache) freezes its count to zero
+ * with page_freeze_refs() under tree_lock first, so that no speculative
+ * reference can come in after the check: meanwhile the lookups spin.
+ *
+ * This needs an atomic "increment unless zero", so an SMP arch without
+ * cmpxchg still takes tree_lock for read around its lookups.
+ */
+#if defined(CONFIG_SMP) && !defined(__HAVE_ARCH_CMPXCHG)
+#define page_cache_read_lock(mapping)	read_lock_irq(&(mapping)->tree_lock)
+#define page_cache_read_unlock(mapping)	read_unlock_irq(&(mapping)->tree_lock)
+#else
+#define page_cache_read_lock(mapping)	rcu_read_lock()
+#define page_cache_read_unlock(mapping)	rcu_read_unlock()
+#endif
+
+#if defined(CONFIG_SMP) && defined(__HAVE_ARCH_CMPXCHG)
+
+/* Take a reference unless the page is free, or frozen */
+static inline int get_page_unless_zero(struct page *page)
+{
+	int c = atomic_read(&page->_count), old;
+
+	for ( ; ; ) {
+		if (unlikely(c == -1))
+			return 0;
+		old = cmpxchg(&page->_count.counter, c, c + 1);
+		if (likely(old == c))
+			return 1;
+		c = old;
+	}
+}
+
+static inline struct page *page_cache_get_speculative(struct page **pagep)
+{
+	struct page *page;
+
+repeat:
+	page = rcu_dereference(*pagep);
+	if (!page)
+		return NULL;
+	if (unlikely(!get_page_unless_zero(page))) {
+		/* Freed, or frozen: the slot is about to change */
+		cpu_relax();
+		goto repeat;
+	}
+	/* The cmpxchg was a full barrier */
+	if (unlikely(page != *pagep)) {
+		page_cache_release(page);
+		goto repeat;
+	}
+	return page;
+}
+
+static inline int page_freeze_refs(struct page *page, int count)
+{
+	return cmpxchg(&page->_count.counter, count - 1, -1) == count - 1;
+}
+
+#else
+
+/*
+ * Nobody can remove the page between our load of the slot and the get:
+ * on SMP we hold tree_lock, and on UP removal is not done from interrupts
+ * while rcu_read_lock() keeps us from being preempted.
+ */
+static inline struct page *page_cache_get_speculative(struct page **pagep)
+{
+	struct page *page = *pagep;
+
+	if (page)
+		page_cache_get(page);
+	return page;
+}
+
+/* Likewise the lookups cannot run while we hold tree_lock for write */
+static inline int page_freeze_refs(struct page *page, int count)
+{
+	if (page_count(page) != count)
+		return 0;
+	set_page_count(page, 0);
+	return 1;
+}
+
+#endif
+
+/* Undo page_freeze_refs(), leaving the page with count references */
+static inline void page_unfreeze_refs(struct page *page, int count)
+{
+	BUG_ON(page_count(page) != 0);
+	smp_wmb();
+	set_page_count(page, count);
+}
+
 static inline struct page *page_cache_alloc(struct address_space *x)
 {
 	return alloc_pages(mapping_gfp_mask(x), 0);
@@ -64,6 +167,8 @@ typedef int filler_t(void *, struct page *);
 
 extern struct page * find_get_page(struct address_space *mapping,
 				unsigned long index);
+extern struct page * find_lock_page_async(struct address_space *mapping,
+				unsigned long index, wait_queue_t *wait);
 extern struct page * find_lock_page(struct address_space *mapping,
 				unsigned long index);
 extern struct page * find_trylock_page(struct address_space *mapping,
@@ -168,12 +273,43 @@ static inline void lock_page(struct page *page)
 	if (TestSetPageLocked(page))
 		__lock_page(page);
 }
+
+extern int FASTCALL(__lock_page_async(struct page *page, wait_queue_t *wait));
+
+/*
+ * Lock the page, or for a retried kiocb (@wait being its current->io_wait)
+ * queue the kiocb for when the page is unlocked and return -EIOCBRETRY.
+ */
+static inline int lock_page_async(struct page *page, wait_queue_t *wait)
+{
+	might_sleep();
+	if (TestSetPageLocked(page))
+		return __lock_page_async(page, wait);
+	return 0;
+}
+
+extern int FASTCALL(__lock_page_or_retry(struct page *page,
+				struct mm_struct *mm, int may_retry));
+
+/*
+ * Lock the page for a fault: returns 1 with it locked, or 0 with mm's
+ * mmap_sem released if it had to wait and the fault may be retried.
+ */
+static inline int lock_page_or_retry(struct page *page,
+				struct mm_struct *mm, int may_retry)
+{
+	might_sleep();
+	return !TestSetPageLocked(page) ||
+		__lock_page_or_retry(page, mm, may_retry);
+}
 	
 /*
  * This is exported only for wait_on_page_locked/wait_on_page_writeback.
  * Never use this directly!
  */
 extern void FASTCALL(wait_on_page_bit(struct page *page, int bit_nr));
+extern int FASTCALL(wait_on_page_bit_async(struct page *page, int bit_nr,
+					   wait_queue_t *wait));
 
 /* 
  * Wait for a page to be unlocked.
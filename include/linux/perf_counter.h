@@ -0,0 +1,184 @@
+#ifndef _LINUX_PERF_COUNTER_H
+#define _LINUX_PERF_COUNTER_H
+/*
+ * Performance counters, per task or per cpu, see kernel/perf_counter.c.
+ *
+ * A counter is opened with sys_perf_counter_open(), which returns a file
+ * descriptor: read() gives its 64-bit count, and with a non-zero
+ * irq_period a sample is written every irq_period events to a ring
+ * mmap()ed from it.
+ */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+enum perf_event_types {
+	PERF_TYPE_HARDWARE		= 0,
+	PERF_TYPE_SOFTWARE		= 1,
+};
+
+/* hw_event.config for PERF_TYPE_HARDWARE */
+enum hw_event_ids {
+	PERF_COUNT_CPU_CYCLES		= 0,
+	PERF_COUNT_INSTRUCTIONS		= 1,
+	PERF_COUNT_CACHE_REFERENCES	= 2,
+	PERF_COUNT_CACHE_MISSES		= 3,
+	PERF_COUNT_BRANCH_INSTRUCTIONS	= 4,
+	PERF_COUNT_BRANCH_MISSES	= 5,
+
+	PERF_HW_EVENTS_MAX		= 6,
+};
+
+/* hw_event.config for PERF_TYPE_SOFTWARE */
+enum sw_event_ids {
+	PERF_COUNT_PAGE_FAULTS		= 0,
+	PERF_COUNT_CONTEXT_SWITCHES	= 1,
+	PERF_COUNT_CPU_MIGRATIONS	= 2,
+
+	PERF_SW_EVENTS_MAX		= 3,
+};
+
+/* hw_event.flags */
+#define PERF_FLAG_DISABLED	0x1	/* Start off, see PERF_COUNTER_IOC_ENABLE */
+#define PERF_FLAG_EXCLUDE_USER	0x2	/* Hardware: don't count user mode */
+#define PERF_FLAG_EXCLUDE_KERNEL 0x4	/* Hardware: don't count the kernel */
+
+struct perf_counter_hw_event {
+	__u32	type;
+	__u32	config;
+	__u64	irq_period;		/* Sample every so many events, or 0 */
+	__u32	flags;
+	__u32	__reserved;
+};
+
+#define PERF_COUNTER_IOC_ENABLE		_IO('$', 0)
+#define PERF_COUNTER_IOC_DISABLE	_IO('$', 1)
+
+/*
+ * The first page of the mmap()ed area; 2^n pages of samples follow.
+ * data_head is the number of bytes written so far, so a sample lives at
+ * data_head modulo the size of the data pages.  The kernel does not wait
+ * for the reader, who is behind by more than the data pages holds when
+ * data_head moves on by more than that.  poll() reports POLLIN while
+ * data_tail, written by the reader, differs from data_head.
+ */
+struct perf_counter_mmap_page {
+	__u32	version;
+	__u32	__reserved;
+	__u64	data_head;
+	__u64	data_tail;
+};
+
+struct perf_counter_sample {
+	__u64	ip;
+	__u32	pid, tid;
+};
+
+#ifdef __KERNEL__
+
+#include <linux/config.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/rcupdate.h>
+#include <asm/semaphore.h>
+
+struct task_struct;
+struct pt_regs;
+struct perf_counter;
+
+/* How a counter is driven: the methods are called with interrupts off */
+struct hw_perf_counter_ops {
+	int	(*enable)(struct perf_counter *counter);
+	void	(*disable)(struct perf_counter *counter);
+	void	(*read)(struct perf_counter *counter);
+};
+
+struct hw_perf_counter {
+	int		idx;		/* Hardware counter used */
+	u64		config;		/* Event select */
+	u64		prev_count;
+	s64		period_left;
+};
+
+enum perf_counter_state {
+	PERF_COUNTER_STATE_OFF		= -1,
+	PERF_COUNTER_STATE_INACTIVE	= 0,
+	PERF_COUNTER_STATE_ACTIVE	= 1,
+};
+
+struct perf_mmap_data {
+	struct rcu_head			rcu_head;
+	int				nr_pages;	/* Data pages */
+	u64				head;
+	struct perf_counter_mmap_page	*user_page;
+	void				*data_pages[0];
+};
+
+struct perf_counter {
+	struct list_head		list_entry;	/* ctx->counter_list */
+	struct perf_counter_hw_event	hw_event;
+	struct hw_perf_counter		hw;
+	const struct hw_perf_counter_ops *ops;
+
+	struct perf_counter_context	*ctx;
+	struct task_struct		*task;		/* Or NULL, per cpu */
+	enum perf_counter_state		state;
+	int				cpu;		/* Only count on, or -1 */
+	int				oncpu;		/* Running on, or -1 */
+	u64				count;
+
+	struct perf_mmap_data		*data;
+	struct semaphore		mmap_sem;
+	int				mmap_count;
+
+	int				wakeup_pending;
+	wait_queue_head_t		waitq;
+	struct rcu_head			rcu_head;
+};
+
+/*
+ * The counters of a task or a cpu.  lock nests inside the runqueue
+ * locks; the list is RCU, for the wakeups done without the lock.
+ */
+struct perf_counter_context {
+	spinlock_t		lock;
+	struct list_head	counter_list;
+	int			nr_counters;
+	int			nr_active;
+	int			last_cpu;	/* For PERF_COUNT_CPU_MIGRATIONS */
+	int			exited;
+	struct task_struct	*task;
+};
+
+#ifdef CONFIG_PERF_COUNTERS
+
+extern const struct hw_perf_counter_ops *
+hw_perf_counter_init(struct perf_counter *counter);
+
+extern void perf_counter_init_task(struct task_struct *task);
+extern void perf_counter_exit_task(struct task_struct *task);
+extern void perf_counter_task_sched_out(struct task_struct *task, int cpu);
+extern void perf_counter_task_sched_in(struct task_struct *task, int cpu);
+extern void perf_counter_task_wakeup(struct task_struct *task);
+extern void perf_counter_do_pending(void);
+extern void perf_counter_output(struct perf_counter *counter, u64 ip);
+extern void perf_swcounter_event(u32 event, u64 nr, struct pt_regs *regs);
+
+#else
+
+static inline void perf_counter_init_task(struct task_struct *task) { }
+static inline void perf_counter_exit_task(struct task_struct *task) { }
+static inline void
+perf_counter_task_sched_out(struct task_struct *task, int cpu) { }
+static inline void
+perf_counter_task_sched_in(struct task_struct *task, int cpu) { }
+static inline void perf_counter_task_wakeup(struct task_struct *task) { }
+static inline void perf_counter_do_pending(void) { }
+static inline void
+perf_swcounter_event(u32 event, u64 nr, struct pt_regs *regs) { }
+
+#endif
+
+#endif /* __KERNEL__ */
+
+#endif
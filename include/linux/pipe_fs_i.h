@@ -3,12 +3,16 @@
 
 #define PIPEFS_MAGIC 0x50495045
 
+/* The default size of a pipe's ring, and what splice moves per call */
 #define PIPE_BUFFERS (16)
 
+#define PIPE_BUF_FLAG_GIFT	0x01	/* page is a gift from vmsplice() */
+
 struct pipe_buffer {
 	struct page *page;
 	unsigned int offset, len;
 	struct pipe_buf_operations *ops;
+	unsigned int flags;
 };
 
 struct pipe_buf_operations {
@@ -16,12 +20,19 @@ struct pipe_buf_operations {
 	void * (*map)(struct file *, struct pipe_inode_info *, struct pipe_buffer *);
 	void (*unmap)(struct pipe_inode_info *, struct pipe_buffer *);
 	void (*release)(struct pipe_inode_info *, struct pipe_buffer *);
+	void (*get)(struct pipe_inode_info *, struct pipe_buffer *);
 };
 
+/*
+ * The ring of bufs has a power of two number of buffers, PIPE_BUFFERS
+ * unless F_SETPIPE_SZ changed it.  They are accounted to the user who
+ * created the pipe.
+ */
 struct pipe_inode_info {
 	wait_queue_head_t wait;
-	unsigned int nrbufs, curbuf;
-	struct pipe_buffer bufs[PIPE_BUFFERS];
+	unsigned int nrbufs, curbuf, buffers;
+	struct pipe_buffer *bufs;
+	struct user_struct *user;
 	struct page *tmp_page;
 	unsigned int start;
 	unsigned int readers;
@@ -56,4 +67,20 @@ void pipe_wait(struct inode * inode);
 struct inode* pipe_new(struct inode* inode);
 void free_pipe_info(struct inode* inode);
 
+/* F_SETPIPE_SZ and F_GETPIPE_SZ */
+long pipe_fcntl(struct file *filp, unsigned int cmd, unsigned long arg);
+
+extern int pipe_max_size, pipe_user_pages_max;
+
+/*
+ * splice is tied to pipes as a transport (at least for now), so we'll just
+ * add the splice flags here.
+ */
+#define SPLICE_F_MOVE		(0x01)	/* move pages instead of copying */
+#define SPLICE_F_NONBLOCK	(0x02)	/* don't block on the pipe splicing (but */
+					/* we may still block on the fd we splice */
+					/* from/to, of course */
+#define SPLICE_F_MORE		(0x04)	/* expect more data */
+#define SPLICE_F_GIFT		(0x08)	/* pages passed in are a gift */
+
 #endif
@@ -193,6 +193,8 @@ enum
 	TCA_U32_INDEV,
 	TCA_U32_PCNT,
 	TCA_U32_MARK,
+	TCA_U32_AUTO,
+	TCA_U32_HCNT,
 	__TCA_U32_MAX
 };
 
@@ -235,6 +237,17 @@ struct tc_u32_pcnt
 	__u64 kcnts[0];
 };
 
+/* Statistics of a table: lookups in it and the nodes they tried
+   (counted with CONFIG_CLS_U32_PERF), and for a table with TCA_U32_AUTO
+   set, the buckets of its index and the nodes filed in them. */
+struct tc_u32_hcnt
+{
+	__u64 lookups;
+	__u64 visits;
+	__u32 buckets;
+	__u32 indexed;
+};
+
 /* Flags */
 
 #define TC_U32_TERMINAL		1
@@ -258,6 +258,7 @@ enum
 	TCA_HTB_INIT,
 	TCA_HTB_CTAB,
 	TCA_HTB_RTAB,
+	TCA_HTB_BATCH,		/* u32: bytes leaves send before charging up */
 	__TCA_HTB_MAX,
 };
 
@@ -427,6 +428,7 @@ enum
 	TCA_NETEM_UNSPEC,
 	TCA_NETEM_CORR,
 	TCA_NETEM_DELAY_DIST,
+	TCA_NETEM_RATE,
 	__TCA_NETEM_MAX,
 };
 
@@ -449,6 +451,12 @@ struct tc_netem_corr
 	__u32	dup_corr;	/* duplicate correlation  */
 };
 
+struct tc_netem_rate
+{
+	__u32	rate;		/* link rate (bytes/s), 0 for none */
+	__s32	packet_overhead; /* added to the length of every packet */
+};
+
 #define NETEM_DIST_SCALE	8192
 
 #endif
@@ -52,4 +52,9 @@
 #define PR_SET_NAME    15		/* Set process name */
 #define PR_GET_NAME    16		/* Get process name */
 
+/* Get/set how late (in nanoseconds) the process' timeouts may expire,
+ * so that they can be batched with other timers. 0 means on time. */
+#define PR_GET_TIMERSLACK 17
+#define PR_SET_TIMERSLACK 18
+
 #endif /* _LINUX_PRCTL_H */
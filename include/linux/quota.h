@@ -206,6 +206,7 @@ extern struct dqstats dqstats;
 #define DQ_READ_B	4	/* dquot was read into memory */
 #define DQ_ACTIVE_B	5	/* dquot is active (dquot_release not called) */
 #define DQ_WAITFREE_B	6	/* dquot being waited (by invalidate_dquots) */
+#define DQ_BATCH_B	7	/* space may be charged in per-CPU batches */
 
 struct dquot {
 	struct hlist_node dq_hash;	/* Hash list in memory */
@@ -220,6 +221,8 @@ struct dquot {
 	loff_t dq_off;			/* Offset of dquot on disk */
 	unsigned long dq_flags;		/* See DQ_* */
 	short dq_type;			/* Type of quota */
+	spinlock_t dq_dqb_lock;		/* Protects dq_dqb */
+	atomic_t dq_batched;		/* Per-CPU batches of space for this dquot */
 	struct mem_dqblk dq_dqb;	/* Diskquota usage */
 };
 
@@ -285,6 +288,7 @@ struct quota_info {
 	struct semaphore dqio_sem;		/* lock device while I/O in progress */
 	struct semaphore dqonoff_sem;		/* Serialize quotaon & quotaoff */
 	struct rw_semaphore dqptr_sem;		/* serialize ops using quota_info struct, pointers from inode to dquots */
+	spinlock_t dq_dirty_lock;		/* Protects dirty lists of dquots */
 	struct inode *files[MAXQUOTAS];		/* inodes of quotafiles */
 	struct vfsmount *mnt[MAXQUOTAS];	/* mountpoint entries of filesystems with quota files */
 	struct mem_dqinfo info[MAXQUOTAS];	/* Information for each quota type */
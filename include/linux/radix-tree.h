@@ -21,6 +21,7 @@
 
 #include <linux/preempt.h>
 #include <linux/types.h>
+#include <linux/rcupdate.h>
 
 struct radix_tree_root {
 	unsigned int		height;
@@ -44,12 +45,26 @@ do {									\
 	(root)->rnode = NULL;						\
 } while (0)
 
+/*
+ * Changes to a tree, and the tag lookups, are serialised by the user's
+ * lock.  radix_tree_lookup*() and radix_tree_gang_lookup*() may instead
+ * be called under rcu_read_lock(): the nodes are freed by RCU, but an
+ * item found that way may be on its way out of the tree.
+ */
 int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
 void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
+void **radix_tree_lookup_slot(struct radix_tree_root *, unsigned long);
 void *radix_tree_delete(struct radix_tree_root *, unsigned long);
 unsigned int
 radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 			unsigned long first_index, unsigned int max_items);
+unsigned int
+radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
+			unsigned long first_index, unsigned int max_items);
+unsigned long radix_tree_next_hole(struct radix_tree_root *root,
+				unsigned long index, unsigned long max_scan);
+unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
+				unsigned long index, unsigned long max_scan);
 int radix_tree_preload(int gfp_mask);
 void radix_tree_init(void);
 void *radix_tree_tag_set(struct radix_tree_root *root,
@@ -61,8 +76,20 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 unsigned int
 radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
 		unsigned long first_index, unsigned int max_items, int tag);
+unsigned long radix_tree_range_tag_clear(struct radix_tree_root *root,
+		unsigned long first, unsigned long last, int tag);
 int radix_tree_tagged(struct radix_tree_root *root, int tag);
 
+/*
+ * Replace the item in a slot got from radix_tree_lookup_slot() or
+ * radix_tree_gang_lookup_slot() under the lock, a batch of slots at a
+ * time if need be: the tags stay, and a lockless lookup sees either item.
+ */
+static inline void radix_tree_replace_slot(void **pslot, void *item)
+{
+	rcu_assign_pointer(*pslot, item);
+}
+
 static inline void radix_tree_preload_end(void)
 {
 	preempt_enable();
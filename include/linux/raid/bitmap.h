@@ -0,0 +1,131 @@
+/*
+ * bitmap.h: write-intent bitmap for md RAID1/4/5 arrays
+ *
+ * The bitmap records which chunks of the array may be out of sync, so
+ * that after an unclean shutdown, or when a device that was only briefly
+ * missing is added back, md only has to resync those chunks instead of
+ * the whole array.  See drivers/md/bitmap.c
+ *
+ * This file is released under the GPL.
+ */
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#define BITMAP_MAJOR 3
+
+#define BITMAP_MAGIC 0x6d746962	/* "bitm" */
+
+/*
+ * The on-disk bitmap: a 256 byte superblock followed by one bit per
+ * chunk, set while the chunk may have writes in flight or may differ
+ * between the devices.  A copy lives on every device of the array:
+ * for 0.90 superblocks in the reserved area right after the md
+ * superblock, for version-1 superblocks at bitmap_offset sectors
+ * (signed) from it.  All fields are little-endian.
+ */
+typedef struct bitmap_super_s {
+	__u32 magic;		/*  0 BITMAP_MAGIC */
+	__u32 version;		/*  4 BITMAP_MAJOR */
+	__u8  uuid[16];		/*  8 must match the md device's uuid */
+	__u64 events;		/* 24 md events when the bitmap was last written */
+	__u64 events_cleared;	/* 32 md events when a bit was last cleared */
+	__u64 sync_size;	/* 40 sectors per device covered by the bitmap */
+	__u32 state;		/* 48 BITMAP_* state bits */
+	__u32 chunksize;	/* 52 bytes of each device per bit */
+	__u32 daemon_sleep;	/* 56 seconds between clearing passes */
+	__u8  pad[256 - 60];	/* set to zero */
+} bitmap_super_t;
+
+/* bitmap_super_t state bits */
+#define BITMAP_ACTIVE	1	/* the bitmap is in use */
+#define BITMAP_STALE	2	/* the bits can't be trusted, resync everything */
+
+#ifdef __KERNEL__
+
+#include <linux/config.h>
+#include <linux/raid/md.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <asm/semaphore.h>
+
+struct seq_file;
+
+/*
+ * In memory every chunk has a 16-bit counter:
+ *
+ *	NEEDED	- the chunk must be resynced (loaded from disk, a write
+ *		  failed or the array was degraded when it was written)
+ *	RESYNC	- the chunk is being resynced right now
+ *	COUNTER	- 0: clean, the on-disk bit is clear
+ *		  1: idle, the on-disk bit will be cleared on the next pass
+ *		  2: idle but written since the last pass
+ *		  2 + n: n writes in flight
+ */
+typedef __u16 bitmap_counter_t;
+
+#define NEEDED_MASK	((bitmap_counter_t) 0x8000)
+#define RESYNC_MASK	((bitmap_counter_t) 0x4000)
+#define COUNTER_MAX	((bitmap_counter_t) 0x3fff)
+
+#define NEEDED(x)	(((bitmap_counter_t) x) & NEEDED_MASK)
+#define RESYNC(x)	(((bitmap_counter_t) x) & RESYNC_MASK)
+#define COUNTER(x)	(((bitmap_counter_t) x) & COUNTER_MAX)
+
+/* bytes of bitmap area in the reserved space of a 0.90 superblock */
+#define BITMAP_SB90_BYTES	(MD_RESERVED_BYTES - MD_SB_BYTES)
+
+/* smallest chunk size picked for a new bitmap */
+#define BITMAP_MIN_CHUNK	(64 * 1024)
+
+#define BITMAP_DAEMON_SLEEP	5	/* seconds */
+
+struct bitmap {
+	mddev_t *mddev;
+
+	spinlock_t lock;		/* protects counts, the pages and flags */
+	bitmap_counter_t *counts;	/* one counter per chunk */
+	unsigned long chunks;
+	int chunkshift;			/* log2 of the chunk size in sectors */
+	sector_t sync_size;		/* sectors per device covered */
+
+	long offset;			/* of the bitmap from the md superblock */
+	struct page **pages;		/* image of the on-disk bitmap */
+	unsigned long npages;
+	unsigned long bytes;		/* superblock + bits, rounded to 512 */
+	unsigned long *dirty_pages;	/* pages waiting to go to disk */
+	int dirty;			/* number of bits set in dirty_pages */
+	int flushing;			/* pages being written right now */
+	struct semaphore write_sem;	/* serialises the bitmap writers */
+
+	__u64 events_cleared;
+	unsigned long daemon_sleep;	/* jiffies */
+	unsigned long daemon_lastrun;
+	int allclean;			/* nothing for the daemon to clear */
+
+	wait_queue_head_t overflow_wait;
+};
+
+/* drivers/md/bitmap.c */
+extern int bitmap_create(mddev_t *mddev);
+extern void bitmap_destroy(mddev_t *mddev);
+extern void bitmap_flush(mddev_t *mddev);
+extern void bitmap_update_sb(struct bitmap *bitmap);
+extern void bitmap_write_all(struct bitmap *bitmap);
+extern int bitmap_unplug(struct bitmap *bitmap);
+extern int bitmap_pending(struct bitmap *bitmap);
+extern void bitmap_daemon_work(struct bitmap *bitmap);
+extern void bitmap_status(struct seq_file *seq, struct bitmap *bitmap);
+
+extern void bitmap_startwrite(struct bitmap *bitmap, sector_t offset,
+			      unsigned long sectors);
+extern void bitmap_endwrite(struct bitmap *bitmap, sector_t offset,
+			    unsigned long sectors, int success);
+extern int bitmap_start_sync(struct bitmap *bitmap, sector_t offset,
+			     int *blocks, int degraded);
+extern void bitmap_end_sync(struct bitmap *bitmap, sector_t offset,
+			    int *blocks, int aborted);
+extern void bitmap_close_sync(struct bitmap *bitmap);
+
+#endif /* __KERNEL__ */
+
+#endif
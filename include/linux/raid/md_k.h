@@ -177,9 +177,17 @@ struct mdk_rdev_s
 	 */
 	int faulty;			/* if faulty do not issue IO requests */
 	int in_sync;			/* device is a full member of the array */
+	int write_mostly;		/* only read from this device if
+					 * no other in-sync mirror can serve
+					 * the request
+					 */
 
 	int desc_nr;			/* descriptor index in the superblock */
 	int raid_disk;			/* role of device in array */
+	int saved_raid_disk;		/* role that device used to have in the
+					 * array and could again if we did a partial
+					 * resync from the bitmap
+					 */
 
 	atomic_t	nr_pending;	/* number of pending requests.
 					 * only maintained for arrays that
@@ -260,6 +268,12 @@ struct mddev_s
 	atomic_t			writes_pending; 
 	request_queue_t			*queue;	/* for plugging ... */
 
+	struct bitmap			*bitmap; /* the bitmap for the device */
+	long				bitmap_offset; /* offset from the superblock
+							* of the bitmap, in sectors,
+							* 0 for none
+							*/
+
 	struct list_head		all_mddevs;
 };
 
@@ -291,7 +305,7 @@ struct mdk_personality_s
 	int (*hot_add_disk) (mddev_t *mddev, mdk_rdev_t *rdev);
 	int (*hot_remove_disk) (mddev_t *mddev, int number);
 	int (*spare_active) (mddev_t *mddev);
-	int (*sync_request)(mddev_t *mddev, sector_t sector_nr, int go_faster);
+	int (*sync_request)(mddev_t *mddev, sector_t sector_nr, int *skipped, int go_faster);
 	int (*resize) (mddev_t *mddev, sector_t sectors);
 	int (*reshape) (mddev_t *mddev, int raid_disks);
 	int (*reconfig) (mddev_t *mddev, int layout, int chunk_size);
@@ -335,6 +349,7 @@ typedef struct mdk_thread_s {
 	struct completion	*event;
 	struct task_struct	*tsk;
 	const char		*name;
+	unsigned long		timeout;
 } mdk_thread_t;
 
 #define THREAD_WAKEUP  0
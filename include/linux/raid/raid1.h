@@ -36,6 +36,9 @@ struct r1_private_data_s {
 	spinlock_t		device_lock;
 
 	struct list_head	retry_list;
+	/* queue pending writes and submit them on unplug */
+	struct bio_list		pending_bio_list;
+
 	/* for use when syncing mirrors: */
 
 	spinlock_t		resync_lock;
@@ -46,6 +49,11 @@ struct r1_private_data_s {
 	wait_queue_head_t	wait_idle;
 	wait_queue_head_t	wait_resume;
 
+	int			fullsync;  /* set to 1 if a full sync is needed,
+					    * (fresh device added).
+					    * Cleared when a sync completes.
+					    */
+
 	struct pool_info	*poolinfo;
 
 	mempool_t *r1bio_pool;
@@ -95,4 +103,5 @@ struct r1bio_s {
 /* bits for r1bio.state */
 #define	R1BIO_Uptodate	0
 #define	R1BIO_IsSync	1
+#define	R1BIO_Degraded	2	/* a mirror missed the write */
 #endif
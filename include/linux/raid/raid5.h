@@ -171,6 +171,7 @@ struct stripe_head {
 #define	STRIPE_INSYNC		4
 #define	STRIPE_PREREAD_ACTIVE	5
 #define	STRIPE_DELAYED		6
+#define	STRIPE_DEGRADED		7	/* a write missed a device, keep the bitmap bit */
 
 /*
  * Plugging:
@@ -207,6 +208,10 @@ struct raid5_private_data {
 	int			chunk_size, level, algorithm;
 	int			raid_disks, working_disks, failed_disks;
 	int			max_nr_stripes;
+	int			fullsync;  /* set to 1 if a full sync is needed,
+					    * (fresh device added).
+					    * Cleared when a sync completes.
+					    */
 
 	struct list_head	handle_list; /* stripes needing handling */
 	struct list_head	delayed_list; /* stripes that have plugged requests */
@@ -225,6 +230,14 @@ struct raid5_private_data {
 							 * waiting for 25% to be free
 							 */        
 	spinlock_t		device_lock;
+
+	/* extra threads that take stripes off handle_list alongside
+	 * the array's md thread
+	 */
+	struct task_struct	**workers;
+	int			nr_workers;
+	wait_queue_head_t	wait_for_work;
+
 	struct disk_info	disks[0];
 };
 
@@ -2241,11 +2241,37 @@ int reiserfs_ioctl (struct inode * inode, struct file * filp,
 #define REISERFS_IOC_GETVERSION		EXT2_IOC_GETVERSION
 #define REISERFS_IOC_SETVERSION		EXT2_IOC_SETVERSION
 
-/* Locking primitives */
-/* Right now we are still falling back to (un)lock_kernel, but eventually that
-   would evolve into real per-fs locks */
-#define reiserfs_write_lock( sb ) lock_kernel()
-#define reiserfs_write_unlock( sb ) unlock_kernel()
+/* Locking primitives, see fs/reiserfs/lock.c */
+void reiserfs_write_lock(struct super_block *s);
+void reiserfs_write_unlock(struct super_block *s);
+int reiserfs_write_unlock_nested(struct super_block *s);
+void reiserfs_write_lock_nested(struct super_block *s, int depth);
+
+/*
+ * Sleeping with the write lock held stalls every other user of the
+ * filesystem, so these give it up for the duration of the wait.  Never
+ * call them, or otherwise retake the write lock, with a buffer locked:
+ * the lock order is write lock first, buffer lock second.
+ */
+static inline void reiserfs_wait_on_buffer(struct super_block *s,
+					   struct buffer_head *bh)
+{
+	if (buffer_locked(bh)) {
+		int depth = reiserfs_write_unlock_nested(s);
+		__wait_on_buffer(bh);
+		reiserfs_write_lock_nested(s, depth);
+	}
+}
+
+static inline void reiserfs_down_safe(struct super_block *s,
+				      struct semaphore *sem)
+{
+	if (down_trylock(sem)) {
+		int depth = reiserfs_write_unlock_nested(s);
+		down(sem);
+		reiserfs_write_lock_nested(s, depth);
+	}
+}
  			         
 /* xattr stuff */
 #define REISERFS_XATTR_DIR_SEM(s) (REISERFS_SB(s)->xattr_dir_sem)
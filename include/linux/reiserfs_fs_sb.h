@@ -7,6 +7,7 @@
 #ifdef __KERNEL__
 #include <linux/workqueue.h>
 #include <linux/rwsem.h>
+#include <asm/semaphore.h>
 #endif
 
 typedef enum {
@@ -410,6 +411,13 @@ struct reiserfs_sb_info
     struct rw_semaphore xattr_dir_sem;
 
     int j_errno;
+
+    struct semaphore lock;		/* the write lock, see lock.c */
+    struct task_struct *lock_owner;
+    int lock_depth;			/* -1 when not held */
+#ifdef CONFIG_REISERFS_CHECK
+    struct tree_balance *cur_tb;	/* balance in progress, for debugging */
+#endif
 #ifdef CONFIG_QUOTA
     char *s_qf_names[MAXQUOTAS];
     int s_jquota_fmt;
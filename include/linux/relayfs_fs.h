@@ -0,0 +1,248 @@
+/*
+ * linux/include/linux/relayfs_fs.h
+ *
+ * relayfs: per-cpu buffers for moving large amounts of data from the
+ * kernel to user space, see Documentation/filesystems/relayfs.txt
+ */
+
+#ifndef _LINUX_RELAYFS_FS_H
+#define _LINUX_RELAYFS_FS_H
+
+#include <linux/config.h>
+#include <linux/types.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/list.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/kref.h>
+#include <linux/workqueue.h>
+
+/*
+ * Per-cpu relay channel buffer.  It is split into n_subbufs sub-buffers
+ * that are filled one after the other; what is left over at the end of a
+ * sub-buffer when the next write doesn't fit is recorded in padding[].
+ */
+struct rchan_buf {
+	void *start;			/* start of channel buffer */
+	void *data;			/* start of current sub-buffer */
+	size_t offset;			/* current offset into sub-buffer */
+	size_t subbufs_produced;	/* count of sub-buffers produced */
+	size_t subbufs_consumed;	/* count of sub-buffers consumed */
+	size_t bytes_consumed;		/* bytes read() of current sub-buffer */
+	struct rchan *chan;		/* associated channel */
+	wait_queue_head_t read_wait;	/* reader wait queue */
+	struct work_struct wake_readers; /* reader wake-up work struct */
+	struct dentry *dentry;		/* channel file dentry */
+	struct kref kref;		/* channel buffer refcount */
+	struct page **page_array;	/* array of current buffer pages */
+	unsigned int page_count;	/* number of current buffer pages */
+	unsigned int finalized;		/* buffer has been finalized */
+	size_t *padding;		/* padding counts per sub-buffer */
+	size_t prev_padding;		/* temporary variable */
+	unsigned int cpu;		/* this buf's cpu */
+} ____cacheline_aligned;
+
+/*
+ * Relay channel data structure
+ */
+struct rchan {
+	size_t subbuf_size;		/* sub-buffer size */
+	size_t n_subbufs;		/* number of sub-buffers per buffer */
+	size_t alloc_size;		/* total buffer size allocated */
+	struct rchan_callbacks *cb;	/* client callbacks */
+	struct kref kref;		/* channel refcount */
+	void *private_data;		/* for user-defined data */
+	struct rchan_buf *buf[NR_CPUS];	/* per-cpu channel buffers */
+};
+
+/*
+ * Relay channel client callbacks
+ */
+struct rchan_callbacks {
+	/*
+	 * subbuf_start - called on buffer-switch to a new sub-buffer
+	 * @buf: the channel buffer containing the new sub-buffer
+	 * @subbuf: the start of the new sub-buffer
+	 * @prev_subbuf: the start of the previous sub-buffer
+	 * @prev_padding: unused space at the end of previous sub-buffer
+	 *
+	 * The client should return 1 to continue logging, 0 to stop
+	 * logging, usually because the buffer is full and the client
+	 * doesn't want to overwrite what the reader hasn't seen yet.
+	 * It may start the new sub-buffer with a header of its own, see
+	 * subbuf_start_reserve(), for instance to tell mmap() readers
+	 * the padding of the previous one.  If NULL, the channel stops
+	 * logging when it is full.
+	 */
+	int (*subbuf_start) (struct rchan_buf *buf,
+			     void *subbuf,
+			     void *prev_subbuf,
+			     size_t prev_padding);
+
+	/*
+	 * buf_mapped - called when a channel buffer is mmap()ed
+	 * @buf: the channel buffer
+	 * @filp: the file it is mapped through
+	 *
+	 * May be NULL.
+	 */
+	void (*buf_mapped) (struct rchan_buf *buf, struct file *filp);
+
+	/*
+	 * buf_unmapped - called when that mapping goes away
+	 * @buf: the channel buffer
+	 * @filp: the file it was mapped through
+	 *
+	 * May be NULL.
+	 */
+	void (*buf_unmapped) (struct rchan_buf *buf, struct file *filp);
+
+	/*
+	 * create_buf_file - create the file of a channel buffer
+	 * @filename: the name of the file
+	 * @parent: the directory to create it in, as given to relay_open()
+	 * @mode: the mode of the file
+	 * @buf: the channel buffer
+	 *
+	 * Returns the dentry of the file, or NULL.  The file must use
+	 * relay_file_operations and have buf as its inode's generic_ip,
+	 * which lets clients put channels in another filesystem, such as
+	 * debugfs.  If NULL, the file is created in relayfs.
+	 */
+	struct dentry *(*create_buf_file) (const char *filename,
+					   struct dentry *parent,
+					   int mode,
+					   struct rchan_buf *buf);
+
+	/*
+	 * remove_buf_file - remove a file made by create_buf_file()
+	 * @dentry: the file
+	 *
+	 * Returns 0 or a negative error.  Must be given along with
+	 * create_buf_file().
+	 */
+	int (*remove_buf_file) (struct dentry *dentry);
+};
+
+/*
+ * relayfs kernel API, fs/relayfs/relay.c
+ */
+
+struct rchan *relay_open(const char *base_filename,
+			 struct dentry *parent,
+			 size_t subbuf_size,
+			 size_t n_subbufs,
+			 struct rchan_callbacks *cb);
+extern void relay_close(struct rchan *chan);
+extern void relay_flush(struct rchan *chan);
+extern void relay_reset(struct rchan *chan);
+extern void relay_subbufs_consumed(struct rchan *chan,
+				   unsigned int cpu,
+				   size_t consumed);
+extern int relay_buf_full(struct rchan_buf *buf);
+
+extern size_t relay_switch_subbuf(struct rchan_buf *buf,
+				  size_t length);
+
+extern struct dentry *relayfs_create_dir(const char *name,
+					 struct dentry *parent);
+extern struct dentry *relayfs_create_file(const char *name,
+					  struct dentry *parent,
+					  int mode,
+					  struct file_operations *fops,
+					  void *data);
+extern int relayfs_remove(struct dentry *dentry);
+
+extern struct file_operations relay_file_operations;
+
+/**
+ *	relay_write - write data into the channel
+ *	@chan: relay channel
+ *	@data: data to be written
+ *	@length: number of bytes to write
+ *
+ *	Writes data into the current cpu's channel buffer.  Protects the
+ *	buffer by disabling interrupts, use __relay_write() if that is
+ *	already taken care of.
+ */
+static inline void relay_write(struct rchan *chan,
+			       const void *data,
+			       size_t length)
+{
+	unsigned long flags;
+	struct rchan_buf *buf;
+
+	local_irq_save(flags);
+	buf = chan->buf[smp_processor_id()];
+	if (unlikely(buf->offset + length > chan->subbuf_size))
+		length = relay_switch_subbuf(buf, length);
+	memcpy(buf->data + buf->offset, data, length);
+	buf->offset += length;
+	local_irq_restore(flags);
+}
+
+/**
+ *	__relay_write - write data into the channel
+ *	@chan: relay channel
+ *	@data: data to be written
+ *	@length: number of bytes to write
+ *
+ *	Like relay_write(), but the caller must keep interrupts and other
+ *	writers on this cpu away from the buffer.
+ */
+static inline void __relay_write(struct rchan *chan,
+				 const void *data,
+				 size_t length)
+{
+	struct rchan_buf *buf;
+
+	buf = chan->buf[get_cpu()];
+	if (unlikely(buf->offset + length > buf->chan->subbuf_size))
+		length = relay_switch_subbuf(buf, length);
+	memcpy(buf->data + buf->offset, data, length);
+	buf->offset += length;
+	put_cpu();
+}
+
+/**
+ *	relay_reserve - reserve slot in channel buffer
+ *	@chan: relay channel
+ *	@length: number of bytes to reserve
+ *
+ *	Returns pointer to reserved slot, NULL if full.  The caller must
+ *	keep interrupts and other writers on this cpu away from the buffer
+ *	until it has filled in the slot.
+ */
+static inline void *relay_reserve(struct rchan *chan, size_t length)
+{
+	void *reserved;
+	struct rchan_buf *buf = chan->buf[smp_processor_id()];
+
+	if (unlikely(buf->offset + length > buf->chan->subbuf_size)) {
+		length = relay_switch_subbuf(buf, length);
+		if (!length)
+			return NULL;
+	}
+	reserved = buf->data + buf->offset;
+	buf->offset += length;
+
+	return reserved;
+}
+
+/**
+ *	subbuf_start_reserve - reserve bytes at the start of a sub-buffer
+ *	@buf: relay channel buffer
+ *	@length: number of bytes to reserve
+ *
+ *	Only to be called from the subbuf_start() callback, which fills in
+ *	the header it reserves at the start of the new sub-buffer.
+ */
+static inline void subbuf_start_reserve(struct rchan_buf *buf,
+					size_t length)
+{
+	BUG_ON(length >= buf->chan->subbuf_size - 1);
+	buf->offset = length;
+}
+
+#endif /* _LINUX_RELAYFS_FS_H */
@@ -20,22 +20,54 @@
  * directly to a vma: instead it points to an anon_vma, on whose list
  * the related vmas can be easily linked or unlinked.
  *
+ * Each vma is linked, by an anon_vma_chain apiece, to the anon_vma of
+ * every generation it descends from, and to its own, vma->anon_vma,
+ * which new anonymous pages are given.  A page COWed in a child thus
+ * points to the child's anon_vma, whose list holds the child's vmas
+ * alone: only pages from before the fork still have to be looked for
+ * in every process sharing them.
+ *
+ * All the anon_vmas of a fork tree are serialized by the lock of its
+ * root.  rmap walks only take that for reading, so reclaim does not
+ * serialize on the lock, only against fork, exit and vma changes.
+ *
  * After unlinking the last vma on the list, we must garbage collect
  * the anon_vma object itself: we're guaranteed no page can be
- * pointing to this anon_vma once its vma list is empty.
+ * pointing to this anon_vma once its vma list is empty.  A root is
+ * kept for as long as other anon_vmas rely on its lock.
  */
 struct anon_vma {
-	spinlock_t lock;	/* Serialize access to vma list */
-	struct list_head head;	/* List of private "related" vmas */
+	struct anon_vma *root;	/* Root of this fork tree */
+	rwlock_t lock;		/* Serialize access to vma list: root's only */
+	atomic_t refcount;	/* Other anon_vmas of the tree, root's only */
+	struct list_head head;	/* Chain of private "related" vmas */
+};
+
+/*
+ * The anon_vma_chain links a vma to one of its anon_vmas.  same_vma
+ * is serialized by mmap_sem and page_table_lock, same_anon_vma by the
+ * root anon_vma's lock.
+ */
+struct anon_vma_chain {
+	struct vm_area_struct *vma;
+	struct anon_vma *anon_vma;
+	struct list_head same_vma;	/* vma->anon_vma_chain */
+	struct list_head same_anon_vma;	/* anon_vma->head */
 };
 
 #ifdef CONFIG_MMU
 
 extern kmem_cache_t *anon_vma_cachep;
+extern kmem_cache_t *anon_vma_chain_cachep;
 
 static inline struct anon_vma *anon_vma_alloc(void)
 {
-	return kmem_cache_alloc(anon_vma_cachep, SLAB_KERNEL);
+	struct anon_vma *anon_vma;
+
+	anon_vma = kmem_cache_alloc(anon_vma_cachep, SLAB_KERNEL);
+	if (anon_vma)
+		anon_vma->root = anon_vma;
+	return anon_vma;
 }
 
 static inline void anon_vma_free(struct anon_vma *anon_vma)
@@ -43,35 +75,47 @@ static inline void anon_vma_free(struct anon_vma *anon_vma)
 	kmem_cache_free(anon_vma_cachep, anon_vma);
 }
 
+static inline struct anon_vma_chain *anon_vma_chain_alloc(void)
+{
+	return kmem_cache_alloc(anon_vma_chain_cachep, SLAB_KERNEL);
+}
+
+static inline void anon_vma_chain_free(struct anon_vma_chain *avc)
+{
+	kmem_cache_free(anon_vma_chain_cachep, avc);
+}
+
+/* Exclude rmap walks of the vma's anon_vmas, while changing the vma */
 static inline void anon_vma_lock(struct vm_area_struct *vma)
 {
 	struct anon_vma *anon_vma = vma->anon_vma;
 	if (anon_vma)
-		spin_lock(&anon_vma->lock);
+		write_lock(&anon_vma->root->lock);
 }
 
 static inline void anon_vma_unlock(struct vm_area_struct *vma)
 {
 	struct anon_vma *anon_vma = vma->anon_vma;
 	if (anon_vma)
-		spin_unlock(&anon_vma->lock);
+		write_unlock(&anon_vma->root->lock);
 }
 
 /*
- * anon_vma helper functions.
+ * anon_vma helper functions.  A vma's anon_vma_chain is only valid
+ * while its anon_vma is set: these initialize it as they set that.
  */
 void anon_vma_init(void);	/* create anon_vma_cachep */
 int  anon_vma_prepare(struct vm_area_struct *);
-void __anon_vma_merge(struct vm_area_struct *, struct vm_area_struct *);
-void anon_vma_unlink(struct vm_area_struct *);
-void anon_vma_link(struct vm_area_struct *);
-void __anon_vma_link(struct vm_area_struct *);
+int  anon_vma_clone(struct vm_area_struct *, struct vm_area_struct *);
+int  anon_vma_fork(struct vm_area_struct *, struct vm_area_struct *);
+void unlink_anon_vmas(struct vm_area_struct *);
 
 /*
  * rmap interfaces called when adding or removing pte of page
  */
 void page_add_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
 void page_add_file_rmap(struct page *);
+void page_add_ksm_rmap(struct page *);
 void page_remove_rmap(struct page *);
 
 /**
@@ -90,7 +134,12 @@ static inline void page_dup_rmap(struct page *page)
  * Called from mm/vmscan.c to handle paging out
  */
 int page_referenced(struct page *, int is_locked, int ignore_token);
-int try_to_unmap(struct page *);
+int try_to_unmap(struct page *, int migration);
+
+/*
+ * Called from mm/migrate.c to map a page again after migration
+ */
+void remove_migration_ptes(struct page *old, struct page *new);
 
 /*
  * Used by swapoff to help locate where page is expected in vma.
@@ -101,10 +150,10 @@ unsigned long page_address_in_vma(struct page *, struct vm_area_struct *);
 
 #define anon_vma_init()		do {} while (0)
 #define anon_vma_prepare(vma)	(0)
-#define anon_vma_link(vma)	do {} while (0)
+#define anon_vma_fork(vma, pvma)	(0)
 
 #define page_referenced(page,l,i) TestClearPageReferenced(page)
-#define try_to_unmap(page)	SWAP_FAIL
+#define try_to_unmap(page, migration)	SWAP_FAIL
 
 #endif	/* CONFIG_MMU */
 
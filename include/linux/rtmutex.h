@@ -0,0 +1,65 @@
+#ifndef _LINUX_RTMUTEX_H
+#define _LINUX_RTMUTEX_H
+/*
+ * Sleeping locks with priority inheritance: while a task waits for an
+ * rt_mutex, the owner runs at the priority of its highest priority
+ * waiter, and so on down the chain of owners that are themselves
+ * waiting.  Unlocking hands the lock to the top waiter directly, so a
+ * lower priority task cannot take it in the meantime.
+ *
+ * All rt_mutexes, and the PI fields of the tasks, are serialised by
+ * rt_mutex_chain_lock, which is taken with interrupts disabled and
+ * nests outside the runqueue locks.
+ */
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+struct task_struct;
+
+struct rt_mutex {
+	struct list_head	wait_list;	/* highest priority first */
+	struct task_struct	*owner;
+};
+
+struct rt_mutex_waiter {
+	struct list_head	list;		/* on lock->wait_list */
+	struct list_head	pi_list;	/* on owner->pi_waiters */
+	struct task_struct	*task;
+	struct rt_mutex		*lock;
+	int			prio;
+};
+
+extern spinlock_t rt_mutex_chain_lock;
+
+static inline void rt_mutex_init(struct rt_mutex *lock)
+{
+	INIT_LIST_HEAD(&lock->wait_list);
+	lock->owner = NULL;
+}
+
+static inline int rt_mutex_has_waiters(struct rt_mutex *lock)
+{
+	return !list_empty(&lock->wait_list);
+}
+
+extern int rt_mutex_timed_lock(struct rt_mutex *lock, unsigned long timeout);
+extern int rt_mutex_start_wait(struct rt_mutex *lock,
+			       struct rt_mutex_waiter *waiter);
+extern int rt_mutex_finish_wait(struct rt_mutex *lock,
+				struct rt_mutex_waiter *waiter,
+				unsigned long timeout);
+extern void rt_mutex_unlock(struct rt_mutex *lock);
+
+/* With rt_mutex_chain_lock held */
+extern void rt_mutex_init_proxy_locked(struct rt_mutex *lock,
+				       struct task_struct *owner);
+extern struct task_struct *rt_mutex_next_owner(struct rt_mutex *lock);
+extern void __rt_mutex_unlock(struct rt_mutex *lock);
+
+extern void rt_mutex_adjust_pi(struct task_struct *task);
+
+/* In kernel/sched.c */
+extern int rt_mutex_getprio(struct task_struct *p);
+extern void rt_mutex_setprio(struct task_struct *p, int prio);
+
+#endif
@@ -102,6 +102,7 @@ extern unsigned long nr_iowait(void);
 #include <linux/param.h>
 #include <linux/resource.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
 
 #include <asm/processor.h>
 
@@ -132,6 +133,7 @@ extern unsigned long nr_iowait(void);
 #define SCHED_NORMAL		0
 #define SCHED_FIFO		1
 #define SCHED_RR		2
+#define SCHED_BATCH		3
 
 struct sched_param {
 	int sched_priority;
@@ -175,6 +177,11 @@ extern void cpu_init (void);
 extern void trap_init(void);
 extern void update_process_times(int user);
 extern void scheduler_tick(void);
+#ifdef ARCH_HAS_SCHED_WAKE_QUEUE
+extern void scheduler_ipi(void);
+#else
+static inline void scheduler_ipi(void) { }
+#endif
 
 /* Attach to any functions which should be ignored in wchan output. */
 #define __sched		__attribute__((__section__(".sched.text")))
@@ -193,6 +200,8 @@ struct namespace;
 extern int sysctl_max_map_count;
 
 #include <linux/aio.h>
+#include <linux/perf_counter.h>
+#include <linux/taskstats.h>
 
 extern unsigned long
 arch_get_unmapped_area(struct file *, unsigned long, unsigned long,
@@ -226,6 +235,15 @@ struct mm_struct {
 						 * together off init_mm.mmlist, and are protected
 						 * by mmlist_lock
 						 */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	struct list_head khugepaged_list;	/* On khugepaged's list, under mmlist_lock */
+	unsigned long khugepaged_scan;		/* Where khugepaged resumes scanning */
+	struct list_head huge_pgtables;		/* Page tables set aside for splitting */
+#endif
+#ifdef CONFIG_KSM
+	struct list_head ksm_list;		/* On ksmd's list, under mmlist_lock */
+	struct list_head ksm_rmap_list;		/* ksmd's rmap_items, by address */
+#endif
 
 	unsigned long start_code, end_code, start_data, end_data;
 	unsigned long start_brk, brk, start_stack;
@@ -265,6 +283,13 @@ struct sighand_struct {
 	spinlock_t		siglock;
 };
 
+/* CPU time used, as in task_struct's utime, stime and sched_time */
+struct task_cputime {
+	cputime_t utime;
+	cputime_t stime;
+	unsigned long long sched_time;
+};
+
 /*
  * NOTE! "signal_struct" does not have it's own
  * locking, because a shared signal_struct always
@@ -302,8 +327,9 @@ struct signal_struct {
 	struct list_head posix_timers;
 
 	/* ITIMER_REAL timer for the process */
-	struct timer_list real_timer;
-	unsigned long it_real_value, it_real_incr;
+	struct hrtimer real_timer;
+	struct task_struct *tsk;
+	ktime_t it_real_incr;
 
 	/* ITIMER_PROF and ITIMER_VIRTUAL timers for the process */
 	cputime_t it_prof_expires, it_virt_expires;
@@ -336,6 +362,11 @@ struct signal_struct {
 	 */
 	unsigned long long sched_time;
 
+#ifdef CONFIG_TASKSTATS
+	/* Statistics of dead threads, for the thread group's taskstats */
+	struct taskstats stats;
+#endif
+
 	/*
 	 * We don't bother to synchronize most readers of this at all,
 	 * because there is no reader checking a limit that actually needs
@@ -349,6 +380,22 @@ struct signal_struct {
 
 	struct list_head cpu_timers[3];
 
+	/*
+	 * CPU time of all the threads in the group, live and dead, kept
+	 * per CPU so the tick only touches its own CPU's copy.  NULL until
+	 * the group gets a second thread: the only thread's own counters
+	 * are the totals until then.
+	 */
+	struct task_cputime *cputime_totals;
+
+	/*
+	 * Earliest expiry of any process CPU timer, ITIMER_PROF/VIRTUAL
+	 * and RLIMIT_CPU included, checked on each tick against the
+	 * totals; zero for none.
+	 */
+	cputime_t cputime_prof_expires, cputime_virt_expires;
+	unsigned long long cputime_sched_expires;
+
 	/* keep the process-shared keyrings here so that they do the right
 	 * thing in threads created with CLONE_THREAD */
 #ifdef CONFIG_KEYS
@@ -385,6 +432,36 @@ struct signal_struct {
 #define MAX_PRIO		(MAX_RT_PRIO + 40)
 
 #define rt_task(p)		(unlikely((p)->prio < MAX_RT_PRIO))
+#define batch_task(p)		(unlikely((p)->policy == SCHED_BATCH))
+
+#ifdef CONFIG_FAIR_GROUP_SCHED
+/*
+ * A group of tasks that shares CPU time fairly with other groups,
+ * see task_timeslice(). Embedded in user_struct and struct cpuset.
+ */
+struct sched_share {
+	atomic_t nr_running;	/* runnable tasks of the group, all cpus */
+	unsigned int weight;	/* relative CPU share of the group */
+};
+
+#define SCHED_SHARE_DEFAULT	100
+#define SCHED_SHARE_MAX		10000
+
+#define INIT_SCHED_SHARE {			\
+	.nr_running	= ATOMIC_INIT(0),	\
+	.weight		= SCHED_SHARE_DEFAULT,	\
+}
+
+static inline void sched_share_init(struct sched_share *share)
+{
+	atomic_set(&share->nr_running, 0);
+	share->weight = SCHED_SHARE_DEFAULT;
+}
+
+extern void sched_move_share(struct task_struct *p);
+#else
+static inline void sched_move_share(struct task_struct *p) { }
+#endif
 
 /*
  * Some day this will be a full-fledged user tracking system..
@@ -394,6 +471,11 @@ struct user_struct {
 	atomic_t processes;	/* How many processes does this user have? */
 	atomic_t files;		/* How many open files does this user have? */
 	atomic_t sigpending;	/* How many pending signals does this user have? */
+	atomic_t pipe_bufs;	/* How many pipe buffers does this user have? */
+#ifdef CONFIG_INOTIFY
+	atomic_t inotify_watches; /* How many inotify watches does this user have? */
+	atomic_t inotify_devs;	/* How many inotify devs does this user have opened? */
+#endif
 	/* protected by mq_lock	*/
 	unsigned long mq_bytes;	/* How many bytes can be allocated to mqueue? */
 	unsigned long locked_shm; /* How many pages of mlocked shm ? */
@@ -403,6 +485,10 @@ struct user_struct {
 	struct key *session_keyring;	/* UID's default session keyring */
 #endif
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	struct sched_share share;	/* for sched_share=uid */
+#endif
+
 	/* Hash table maintenance information */
 	struct list_head uidhash_list;
 	uid_t uid;
@@ -417,7 +503,14 @@ typedef struct prio_array prio_array_t;
 struct backing_dev_info;
 struct reclaim_state;
 
-#ifdef CONFIG_SCHEDSTATS
+#if defined(CONFIG_SCHEDSTATS) || defined(CONFIG_TASK_DELAY_ACCT)
+/*
+ * log2 histograms, in jiffies: bucket 0 counts zero-length intervals,
+ * bucket n counts intervals of [2^(n-1), 2^n) jiffies and the last
+ * bucket collects everything longer.
+ */
+#define SCHED_INFO_HIST_BUCKETS	12
+
 struct sched_info {
 	/* cumulative counters */
 	unsigned long	cpu_time,	/* time spent on the cpu */
@@ -427,11 +520,38 @@ struct sched_info {
 	/* timestamps */
 	unsigned long	last_arrival,	/* when we last ran on a cpu */
 			last_queued;	/* when we were last queued to run */
+
+	/* histograms */
+	unsigned long	run_delay_hist[SCHED_INFO_HIST_BUCKETS],
+			cpu_time_hist[SCHED_INFO_HIST_BUCKETS];
 };
+#endif
 
+#ifdef CONFIG_SCHEDSTATS
 extern struct file_operations proc_schedstat_operations;
 #endif
 
+#ifdef CONFIG_TASK_DELAY_ACCT
+/*
+ * Time spent waiting, in sched_clock() nanoseconds, see
+ * include/linux/delayacct.h.  Only the task itself updates these, the
+ * lock keeps taskstats from reading a 64-bit total half written.
+ */
+struct task_delay_info {
+	spinlock_t	lock;
+	unsigned int	flags;		/* DELAYACCT_PF_* */
+
+	u64		blkio_start;
+	u64		blkio_delay;	/* sync block I/O, but swapin */
+	u64		swapin_delay;	/* block I/O waiting for swapin */
+	u32		blkio_count, swapin_count;
+
+	u64		freepages_start;
+	u64		freepages_delay; /* direct reclaim */
+	u32		freepages_count;
+};
+#endif
+
 enum idle_type
 {
 	SCHED_IDLE,
@@ -453,6 +573,9 @@ enum idle_type
 #define SD_WAKE_AFFINE		16	/* Wake task to waking CPU */
 #define SD_WAKE_BALANCE		32	/* Perform balancing at task wakeup */
 #define SD_SHARE_CPUPOWER	64	/* Domain members share cpu power */
+#define SD_WAKE_QUEUE		128	/* Queue remote wakeups to the target */
+#define SD_SHARE_PKG_RESOURCES	256	/* Domain members share cpu pkg resources */
+#define SD_POWERSAVINGS_BALANCE	512	/* Balance for power savings */
 
 struct sched_group {
 	struct sched_group *next;	/* Must be a circular list */
@@ -508,6 +631,10 @@ struct sched_domain {
 	unsigned long ttwu_wake_remote;
 	unsigned long ttwu_move_affine;
 	unsigned long ttwu_move_balance;
+
+	/* NUMA locality in load_balance(), see can_migrate_task() */
+	unsigned long lb_numa_toward;
+	unsigned long lb_numa_kept;
 #endif
 };
 
@@ -517,11 +644,20 @@ extern cpumask_t cpu_isolated_map;
 extern void init_sched_build_groups(struct sched_group groups[],
 	                        cpumask_t span, int (*group_fn)(int cpu));
 extern void cpu_attach_domain(struct sched_domain *sd, int cpu);
+extern void calibrate_migration_costs(const cpumask_t *cpu_map);
 #endif /* ARCH_HAS_SCHED_DOMAIN */
+
+/*
+ * Upper bound (in bytes) of the cache size seen by the migration
+ * cost calibration; architectures fill it in during SMP bootup.
+ */
+extern unsigned int max_cache_size;
 #endif /* CONFIG_SMP */
 
 
 struct io_context;			/* See blkdev.h */
+struct blk_plug;			/* See blkdev.h */
+struct worker;				/* See kernel/workqueue.c */
 void exit_io_context(void);
 struct cpuset;
 
@@ -560,6 +696,8 @@ int set_current_groups(struct group_info *group_info);
 
 struct audit_context;		/* See audit.c */
 struct mempolicy;
+struct rt_mutex_waiter;		/* See rtmutex.h */
+struct robust_list_head;	/* See futex.h */
 
 struct task_struct {
 	volatile long state;	/* -1 unrunnable, 0 runnable, >0 stopped */
@@ -573,6 +711,13 @@ struct task_struct {
 	int prio, static_prio;
 	struct list_head run_list;
 	prio_array_t *array;
+#ifdef ARCH_HAS_SCHED_WAKE_QUEUE
+	struct task_struct *wake_entry;	/* next on the target's wake_list */
+	unsigned long wake_queued;	/* bit 0: on a wake_list */
+#endif
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	struct sched_share *share;	/* group accounted to while queued */
+#endif
 
 	unsigned long sleep_avg;
 	unsigned long long timestamp, last_ran;
@@ -583,9 +728,12 @@ struct task_struct {
 	cpumask_t cpus_allowed;
 	unsigned int time_slice, first_time_slice;
 
-#ifdef CONFIG_SCHEDSTATS
+#if defined(CONFIG_SCHEDSTATS) || defined(CONFIG_TASK_DELAY_ACCT)
 	struct sched_info sched_info;
 #endif
+#ifdef CONFIG_TASK_DELAY_ACCT
+	struct task_delay_info delays;
+#endif
 
 	struct list_head tasks;
 	/*
@@ -639,6 +787,8 @@ struct task_struct {
   	cputime_t it_prof_expires, it_virt_expires;
 	unsigned long long it_sched_expires;
 	struct list_head cpu_timers[3];
+	/* how late (ns) this task's timeouts may fire, see PR_SET_TIMERSLACK */
+	unsigned long timer_slack_ns;
 
 /* process credentials */
 	uid_t uid,euid,suid,fsuid;
@@ -656,6 +806,11 @@ struct task_struct {
 	int link_count, total_link_count;
 /* ipc stuff */
 	struct sysv_sem sysvsem;
+/* priority inheritance, under rt_mutex_chain_lock */
+	struct list_head pi_waiters;	/* top waiters of the locks we own */
+	struct rt_mutex_waiter *pi_blocked_on;
+	struct list_head pi_state_list;	/* PI futexes we own */
+	struct robust_list_head __user *robust_list;
 /* CPU-specific state of this task */
 	struct thread_struct thread;
 /* filesystem information */
@@ -701,6 +856,12 @@ struct task_struct {
 	struct backing_dev_info *backing_dev_info;
 
 	struct io_context *io_context;
+	unsigned short ioprio;		/* see linux/ioprio.h */
+	struct blk_plug *plug;		/* on-stack block plug */
+	struct worker *wq_worker;	/* if a workqueue worker */
+#ifdef CONFIG_PERF_COUNTERS
+	struct perf_counter_context perf_counter_ctx;
+#endif
 
 	unsigned long ptrace_message;
 	siginfo_t *last_siginfo; /* For ptrace use.  */
@@ -721,6 +882,9 @@ struct task_struct {
 #ifdef CONFIG_NUMA
   	struct mempolicy *mempolicy;
 	short il_next;
+	/* node most recently faulted pages came from, see task_numa_fault() */
+	int numa_node;
+	int numa_faults;
 #endif
 #ifdef CONFIG_CPUSETS
 	struct cpuset *cpuset;
@@ -778,6 +942,7 @@ do { if (atomic_dec_and_test(&(tsk)->usage)) __put_task_struct(tsk); } while(0)
 #define PF_SYNCWRITE	0x00200000	/* I am doing a sync write */
 #define PF_BORROWED_MM	0x00400000	/* I am a kthread doing use_mm */
 #define PF_RANDOMIZE	0x00800000	/* randomize virtual address space */
+#define PF_WQ_WORKER	0x01000000	/* I am a workqueue pool worker */
 
 /*
  * Only the _current_ task can read/write to tsk->flags, but other
@@ -841,6 +1006,7 @@ extern int sched_setscheduler(struct task_struct *, int, struct sched_param *);
 extern task_t *idle_task(int cpu);
 
 void yield(void);
+extern int yield_to(struct task_struct *p);
 
 /*
  * The default (Linux) execution domain.
@@ -1210,6 +1376,33 @@ static inline void set_task_cpu(struct task_struct *p, unsigned int cpu)
 
 #endif /* CONFIG_SMP */
 
+#ifdef CONFIG_NUMA
+#define NUMA_FAULTS_MAX		64
+
+/*
+ * Keep a running majority vote of the nodes a task's pages are faulted
+ * in from. numa_faults saturates at NUMA_FAULTS_MAX so that a task
+ * whose memory moves changes its vote within a few dozen faults.
+ * Called from the page fault paths in mm/memory.c.
+ */
+static inline void task_numa_fault(struct task_struct *p, int nid)
+{
+	if (nid == p->numa_node) {
+		if (p->numa_faults < NUMA_FAULTS_MAX)
+			p->numa_faults++;
+	} else if (p->numa_faults)
+		p->numa_faults--;
+	else {
+		p->numa_node = nid;
+		p->numa_faults = 1;
+	}
+}
+#else
+static inline void task_numa_fault(struct task_struct *p, int nid)
+{
+}
+#endif
+
 #ifdef HAVE_ARCH_PICK_MMAP_LAYOUT
 extern void arch_pick_mmap_layout(struct mm_struct *mm);
 #else
@@ -27,6 +27,7 @@
 #include <linux/highmem.h>
 #include <linux/poll.h>
 #include <linux/net.h>
+#include <linux/rbtree.h>
 #include <net/checksum.h>
 
 #define HAVE_ALLOC_SKB		/* For the drivers to know */
@@ -165,6 +166,7 @@ struct skb_shared_info {
  *	@next: Next buffer in list
  *	@prev: Previous buffer in list
  *	@list: List we are on
+ *	@rbnode: Sequence index node, used by TCP for the write queue
  *	@sk: Socket we are owned by
  *	@stamp: Time we arrived
  *	@dev: Device we arrived on/are leaving by
@@ -188,6 +190,7 @@ struct skb_shared_info {
  *	@users: User count - see {datagram,tcp}.c
  *	@protocol: Packet protocol from driver
  *	@security: Security level of packet
+ *	@queue_mapping: Transmit queue of a multiqueue device
  *	@truesize: Buffer size 
  *	@head: Head of buffer
  *	@data: Data head pointer
@@ -212,6 +215,7 @@ struct sk_buff {
 	struct sk_buff		*prev;
 
 	struct sk_buff_head	*list;
+	struct rb_node		rbnode;
 	struct sock		*sk;
 	struct timeval		stamp;
 	struct net_device	*dev;
@@ -262,6 +266,7 @@ struct sk_buff {
 	__u32			priority;
 	unsigned short		protocol,
 				security;
+	__u16			queue_mapping;
 
 	void			(*destructor)(struct sk_buff *skb);
 #ifdef CONFIG_NETFILTER
@@ -1189,6 +1194,8 @@ extern unsigned int    skb_copy_and_csum_bits(const struct sk_buff *skb,
 extern void	       skb_copy_and_csum_dev(const struct sk_buff *skb, u8 *to);
 extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
+extern struct sk_buff *skb_segment(struct sk_buff *skb, int sg);
+extern int	       skb_recycle_check(struct sk_buff *skb);
 
 static inline void *skb_header_pointer(const struct sk_buff *skb, int offset,
 				       int len, void *buffer)
@@ -63,11 +63,11 @@ extern int kmem_cache_destroy(kmem_cache_t *);
 extern int kmem_cache_shrink(kmem_cache_t *);
 extern void *kmem_cache_alloc(kmem_cache_t *, int);
 #ifdef CONFIG_NUMA
-extern void *kmem_cache_alloc_node(kmem_cache_t *, int);
+extern void *kmem_cache_alloc_node(kmem_cache_t *, int flags, int node);
 #else
-static inline void *kmem_cache_alloc_node(kmem_cache_t *cachep, int node)
+static inline void *kmem_cache_alloc_node(kmem_cache_t *cachep, int flags, int node)
 {
-	return kmem_cache_alloc(cachep, GFP_KERNEL);
+	return kmem_cache_alloc(cachep, flags);
 }
 #endif
 extern void kmem_cache_free(kmem_cache_t *, void *);
@@ -105,6 +105,15 @@ found:
 	return __kmalloc(size, flags);
 }
 
+#ifdef CONFIG_NUMA
+extern void *kmalloc_node(size_t size, int flags, int node);
+#else
+static inline void *kmalloc_node(size_t size, int flags, int node)
+{
+	return kmalloc(size, flags);
+}
+#endif
+
 extern void *kcalloc(size_t, size_t, int);
 extern void kfree(const void *);
 extern unsigned int ksize(const void *);
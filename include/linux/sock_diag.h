@@ -0,0 +1,46 @@
+#ifndef _LINUX_SOCK_DIAG_H
+#define _LINUX_SOCK_DIAG_H
+/*
+ * Socket monitoring over NETLINK_TCPDIAG, see net/core/sock_diag.c.
+ * The nlmsg_type of a request picks the protocol handler answering it:
+ * TCPDIAG_GETSOCK, UDPDIAG_GETSOCK and RAWDIAG_GETSOCK (tcp_diag.h),
+ * and UNIXDIAG_GETSOCK (unix_diag.h).
+ */
+#define SOCK_DIAG_FIRST		18
+#define SOCK_DIAG_LAST		21
+
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+#include <linux/socket.h>
+#include <linux/netlink.h>
+#include <linux/stringify.h>
+
+struct sock;
+struct sk_buff;
+struct netlink_callback;
+
+struct sock_diag_handler {
+	__u16	type;			/* nlmsg_type answered */
+	int	req_size;		/* Size of its request */
+	/* Check a dump request before the dump starts, or NULL */
+	int	(*audit)(const struct nlmsghdr *nlh);
+	int	(*dump)(struct sk_buff *skb, struct netlink_callback *cb);
+	/* A request without NLM_F_DUMP, or NULL if dumps only */
+	int	(*get_exact)(struct sk_buff *in_skb,
+			     const struct nlmsghdr *nlh);
+};
+
+extern struct sock *sock_diag_nl;
+
+extern int sock_diag_register(struct sock_diag_handler *h);
+extern void sock_diag_unregister(struct sock_diag_handler *h);
+
+/* Loaded on demand by the first request of its type */
+#define MODULE_ALIAS_SOCK_DIAG(type) \
+	MODULE_ALIAS("net-pf-" __stringify(PF_NETLINK) "-proto-" \
+		     __stringify(NETLINK_TCPDIAG) "-type-" __stringify(type))
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_SOCK_DIAG_H */
@@ -32,6 +32,9 @@ struct rpc_portmap {
 
 struct rpc_inode;
 
+/* most transports a client can spread its calls over */
+#define RPC_MAX_XPRTS		16
+
 /*
  * The high-level client handle
  */
@@ -65,6 +68,15 @@ struct rpc_clnt {
 	struct rpc_rtt		cl_rtt_default;
 	struct rpc_portmap	cl_pmap_default;
 	char			cl_inline_name[32];
+
+	/*
+	 * Further connections to the same server.  cl_xprts[0] is
+	 * cl_xprt; each call is bound to one of them when it reserves
+	 * a slot.
+	 */
+	unsigned int		cl_nxprts;	/* used entries of cl_xprts */
+	unsigned int		cl_xprt_next;	/* where the next pick starts */
+	struct rpc_xprt *	cl_xprts[RPC_MAX_XPRTS];
 };
 #define cl_timeout		cl_xprt->timeout
 #define cl_prog			cl_pmap->pm_prog
@@ -112,6 +124,7 @@ struct rpc_clnt *rpc_create_client(struct rpc_xprt *xprt, char *servname,
 				struct rpc_program *info,
 				u32 version, rpc_authflavor_t authflavor);
 struct rpc_clnt *rpc_clone_client(struct rpc_clnt *);
+int		rpc_clnt_add_xprt(struct rpc_clnt *, struct rpc_xprt *);
 int		rpc_shutdown_client(struct rpc_clnt *);
 int		rpc_destroy_client(struct rpc_clnt *);
 void		rpc_release_client(struct rpc_clnt *);
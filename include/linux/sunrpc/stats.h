@@ -12,6 +12,8 @@
 #include <linux/config.h>
 #include <linux/proc_fs.h>
 
+struct svc_serv;
+
 struct rpc_stat {
 	struct rpc_program *	program;
 
@@ -55,6 +57,8 @@ void			svc_proc_unregister(const char *);
 
 void			svc_seq_show(struct seq_file *,
 				     const struct svc_stat *);
+void			svc_seq_show_pools(struct seq_file *,
+					   struct svc_serv *);
 
 extern struct proc_dir_entry	*proc_net_rpc;
 
@@ -70,6 +74,8 @@ static inline void svc_proc_unregister(const char *p) {}
 
 static inline void svc_seq_show(struct seq_file *seq,
 				const struct svc_stat *st) {}
+static inline void svc_seq_show_pools(struct seq_file *seq,
+				      struct svc_serv *serv) {}
 
 #define proc_net_rpc NULL
 
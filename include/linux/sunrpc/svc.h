@@ -16,20 +16,47 @@
 #include <linux/sunrpc/svcauth.h>
 #include <linux/wait.h>
 #include <linux/mm.h>
+#include <linux/cache.h>
+
+/*
+ * Statistics for one thread pool, shown in /proc/net/rpc/nfsd.
+ */
+struct svc_pool_stats {
+	unsigned long		packets;	/* sockets found ready */
+	unsigned long		sockets_queued;	/* ... with no idle thread */
+	unsigned long		threads_woken;	/* ... and handed to a thread */
+	unsigned long		threads_timedout; /* idle waits that timed out */
+};
+
+/*
+ * RPC service thread pool.
+ *
+ * A pool is a set of threads and the queue of sockets waiting for one
+ * of them.  Most services have a single pool.  nfsd on a NUMA machine
+ * gets one pool per node (or per cpu), so that a socket made ready on
+ * some cpu is served by a thread that runs near it, and the threads
+ * of different nodes do not all fight over the same lock.
+ */
+struct svc_pool {
+	unsigned int		sp_id;		/* index in sv_pools */
+	spinlock_t		sp_lock;	/* protects the fields below */
+	struct list_head	sp_threads;	/* idle server threads */
+	struct list_head	sp_sockets;	/* pending sockets */
+	unsigned int		sp_nrthreads;	/* # of threads in pool */
+	struct svc_pool_stats	sp_stats;
+} ____cacheline_aligned_in_smp;
 
 /*
  * RPC service.
  *
  * An RPC service is a ``daemon,'' possibly multithreaded, which
  * receives and processes incoming RPC messages.
- * It has one or more transport sockets associated with it, and maintains
- * a list of idle threads waiting for input.
+ * It has one or more transport sockets associated with it, and one or
+ * more pools of threads waiting for input.
  *
  * We currently do not support more than one RPC program per daemon.
  */
 struct svc_serv {
-	struct list_head	sv_threads;	/* idle server threads */
-	struct list_head	sv_sockets;	/* pending sockets */
 	struct svc_program *	sv_program;	/* RPC program */
 	struct svc_stat *	sv_stats;	/* RPC statistics */
 	spinlock_t		sv_lock;
@@ -42,6 +69,9 @@ struct svc_serv {
 	int			sv_tmpcnt;	/* count of temporary sockets */
 
 	char *			sv_name;	/* service name */
+
+	unsigned int		sv_nrpools;	/* number of thread pools */
+	struct svc_pool *	sv_pools;	/* array of thread pools */
 };
 
 /*
@@ -115,6 +145,7 @@ struct svc_rqst {
 	int			rq_addrlen;
 
 	struct svc_serv *	rq_server;	/* RPC service definition */
+	struct svc_pool *	rq_pool;	/* thread pool */
 	struct svc_procedure *	rq_procinfo;	/* procedure info */
 	struct auth_ops *	rq_authop;	/* authentication flavour */
 	struct svc_cred		rq_cred;	/* auth info */
@@ -295,6 +326,7 @@ typedef void		(*svc_thread_fn)(struct svc_rqst *);
  * Function prototypes.
  */
 struct svc_serv *  svc_create(struct svc_program *, unsigned int);
+struct svc_serv *  svc_create_pooled(struct svc_program *, unsigned int);
 int		   svc_create_thread(svc_thread_fn, struct svc_serv *);
 void		   svc_exit_thread(struct svc_rqst *);
 void		   svc_destroy(struct svc_serv *);
@@ -302,5 +334,6 @@ int		   svc_process(struct svc_serv *, struct svc_rqst *);
 int		   svc_register(struct svc_serv *, int, unsigned short);
 void		   svc_wake_up(struct svc_serv *);
 void		   svc_reserve(struct svc_rqst *rqstp, int space);
+struct svc_pool *  svc_pool_for_cpu(struct svc_serv *serv, int cpu);
 
 #endif /* SUNRPC_SVC_H */
@@ -28,7 +28,12 @@ static inline int current_is_kswapd(void)
  * the type/offset into the pte as 5/27 as well.
  */
 #define MAX_SWAPFILES_SHIFT	5
+#ifndef CONFIG_MIGRATION
 #define MAX_SWAPFILES		(1 << MAX_SWAPFILES_SHIFT)
+#else
+/* The last swap type is used for page migration entries, see swapops.h */
+#define MAX_SWAPFILES		((1 << MAX_SWAPFILES_SHIFT) - 1)
+#endif
 
 /*
  * Magic header for a swap area. The first part of the union is
@@ -106,6 +111,7 @@ enum {
 	SWP_USED	= (1 << 0),	/* is slot in swap_info[] used? */
 	SWP_WRITEOK	= (1 << 1),	/* ok to write to this swap?	*/
 	SWP_ACTIVE	= (SWP_USED | SWP_WRITEOK),
+	SWP_BLKDEV	= (1 << 2),	/* is it a block device, not a file? */
 };
 
 #define SWAP_CLUSTER_MAX 32
@@ -113,6 +119,21 @@ enum {
 #define SWAP_MAP_MAX	0x7fff
 #define SWAP_MAP_BAD	0x8000
 
+/*
+ * Swap slots are allocated in aligned clusters of SWAPFILE_CLUSTER
+ * slots.  A cluster with no slots in use sits on the swap area's
+ * free_clusters list, and each CPU takes a whole free cluster to fill
+ * sequentially before it moves on to the next.
+ */
+struct swap_cluster_info {
+	struct list_head list;		/* on free_clusters iff count is 0 */
+	unsigned int count;		/* slots in use, or not usable */
+};
+
+struct percpu_cluster {
+	unsigned int next;		/* next slot to try, 0 if none */
+};
+
 /*
  * The in-memory structure used to track swap areas.
  * extent_list.prev points at the lowest-index extent.  That list is
@@ -132,6 +153,9 @@ struct swap_info_struct {
 	unsigned int highest_bit;
 	unsigned int cluster_next;
 	unsigned int cluster_nr;
+	struct swap_cluster_info *cluster_info;
+	struct list_head free_clusters;
+	struct percpu_cluster *percpu_cluster;
 	int prio;			/* swap priority */
 	int pages;
 	unsigned long max;
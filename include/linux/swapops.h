@@ -67,3 +67,32 @@ static inline pte_t swp_entry_to_pte(swp_entry_t entry)
 	BUG_ON(pte_file(__swp_entry_to_pte(arch_entry)));
 	return __swp_entry_to_pte(arch_entry);
 }
+
+#ifdef CONFIG_MIGRATION
+/*
+ * While a page is being migrated its ptes are replaced by migration
+ * entries: swap entries of type SWP_MIGRATION whose offset is the pfn
+ * of the old page.  The page stays locked for the duration,
+ * so a fault on such an entry just waits for the page lock and retries.
+ */
+#define SWP_MIGRATION	MAX_SWAPFILES
+
+static inline swp_entry_t make_migration_entry(struct page *page)
+{
+	return swp_entry(SWP_MIGRATION, page_to_pfn(page));
+}
+
+static inline int is_migration_entry(swp_entry_t entry)
+{
+	return unlikely(swp_type(entry) == SWP_MIGRATION);
+}
+
+static inline struct page *migration_entry_to_page(swp_entry_t entry)
+{
+	return pfn_to_page(swp_offset(entry));
+}
+#else
+#define make_migration_entry(page)	({ BUG(); swp_entry(0, 0); })
+#define is_migration_entry(entry)	0
+#define migration_entry_to_page(entry)	((struct page *)NULL)
+#endif
@@ -170,6 +170,18 @@ enum
 	VM_VFS_CACHE_PRESSURE=26, /* dcache/icache reclaim pressure */
 	VM_LEGACY_VA_LAYOUT=27, /* legacy/compatibility virtual address space layout */
 	VM_SWAP_TOKEN_TIMEOUT=28, /* default time for token time out */
+	VM_PERCPU_PAGELIST_FRACTION=29,/* cap on the per-cpu page lists */
+	VM_KHUGEPAGED_PAGES_TO_SCAN=30,	/* ptes khugepaged scans per pass */
+	VM_KHUGEPAGED_SCAN_SLEEP=31,	/* msecs khugepaged sleeps between passes */
+	VM_KHUGEPAGED_MAX_PTES_NONE=32,	/* empty ptes a collapse may fill in */
+	VM_SWAP_VMA_READAHEAD=33,	/* swap readahead by virtual address */
+	VM_PREZERO_RATIO=34,		/* % of each zone kzerod keeps zeroed */
+	VM_SHMEM_HUGE=35,	/* huge pages for SysV shm and shared anon */
+	VM_FAULT_AROUND_PAGES=36,	/* cached pages mapped per file fault */
+	VM_NR_OVERCOMMIT_HUGEPAGES=37,	/* huge pages allocated on demand */
+	VM_COMPACT_MEMORY=38,	/* compact all zones when written */
+	VM_KSM_PAGES_TO_SCAN=39,	/* ptes ksmd scans per batch */
+	VM_KSM_SLEEP_MILLISECS=40,	/* msecs ksmd sleeps between batches */
 };
 
 
@@ -242,6 +254,9 @@ enum
 	NET_CORE_MOD_CONG=16,
 	NET_CORE_DEV_WEIGHT=17,
 	NET_CORE_SOMAXCONN=18,
+	NET_CORE_BPF_JIT_ENABLE=19,
+	NET_CORE_BUSY_READ=20,
+	NET_CORE_BUSY_POLL_BUDGET=21,
 };
 
 /* /proc/sys/net/ethernet */
@@ -346,6 +361,9 @@ enum
 	NET_TCP_MODERATE_RCVBUF=106,
 	NET_TCP_TSO_WIN_DIVISOR=107,
 	NET_TCP_BIC_BETA=108,
+	NET_TCP_CONG_CONTROL=109,
+	NET_TCP_LIMIT_OUTPUT_BYTES=110,
+	NET_TCP_PACING=111,
 };
 
 enum {
@@ -677,6 +695,9 @@ enum
 	FS_XFS=17,	/* struct: control xfs parameters */
 	FS_AIO_NR=18,	/* current system-wide number of aio requests */
 	FS_AIO_MAX_NR=19,	/* system-wide maximum number of aio requests */
+	FS_INOTIFY=20,	/* inotify submenu */
+	FS_PIPE_MAX_SIZE=21,	/* int: maximum size of a pipe for users */
+	FS_PIPE_USER_PAGES=22,	/* int: maximum pipe buffers of a user */
 };
 
 /* /proc/sys/fs/quota/ */
@@ -692,6 +713,13 @@ enum {
 	FS_DQ_WARNINGS = 9,
 };
 
+/* /proc/sys/fs/inotify/ */
+enum {
+	INOTIFY_MAX_USER_INSTANCES=1,	/* max instances per user */
+	INOTIFY_MAX_USER_WATCHES=2,	/* max watches per user */
+	INOTIFY_MAX_QUEUED_EVENTS=3	/* max queued events per instance */
+};
+
 /* CTL_DEBUG names: */
 
 /* CTL_DEV names: */
@@ -0,0 +1,83 @@
+#ifndef _LINUX_TASKSTATS_H
+#define _LINUX_TASKSTATS_H
+/*
+ * Task and thread group statistics over a NETLINK_TASKSTATS socket,
+ * see kernel/taskstats.c and Documentation/taskstats.txt.
+ *
+ * A TASKSTATS_MSG_GET carrying a struct taskstats_req is answered with
+ * a TASKSTATS_MSG_NEW carrying a struct taskstats.  When a task exits,
+ * its record is sent to the TASKSTATS_GRP_EXIT group, followed by the
+ * record of its thread group if it was the last of several threads.
+ * Times are in nanoseconds.
+ */
+#include <linux/types.h>
+
+#define TASKSTATS_VERSION	1
+
+/* nlmsg_type */
+#define TASKSTATS_MSG_GET	0x10	/* NLMSG_MIN_TYPE */
+#define TASKSTATS_MSG_NEW	0x11
+
+/* nl_groups */
+#define TASKSTATS_GRP_EXIT	1
+
+/* taskstats_req.type */
+#define TASKSTATS_TYPE_PID	1
+#define TASKSTATS_TYPE_TGID	2
+
+struct taskstats_req {
+	__u32	type;
+	__u32	id;		/* pid or tgid */
+};
+
+struct taskstats {
+	__u16	version;
+	__u16	__pad;
+	__u32	pid;		/* 0 for a thread group */
+	__u32	tgid;
+	__u32	__pad2;
+
+	/* Timeslices run, the time waiting for a cpu, and on it */
+	__u64	cpu_count;
+	__u64	cpu_delay_total;
+	__u64	cpu_run_real_total;
+
+	/* Waits for synchronous block I/O, other than for swapin */
+	__u64	blkio_count;
+	__u64	blkio_delay_total;
+
+	/* Waits for block I/O to swap pages in */
+	__u64	swapin_count;
+	__u64	swapin_delay_total;
+
+	/* Direct reclaim when allocating memory */
+	__u64	freepages_count;
+	__u64	freepages_delay_total;
+};
+
+#ifdef __KERNEL__
+
+#include <linux/config.h>
+
+struct task_struct;
+struct signal_struct;
+
+#ifdef CONFIG_TASKSTATS
+
+extern void taskstats_tgid_init(struct signal_struct *sig);
+extern void taskstats_tgid_add(struct signal_struct *sig,
+			       struct task_struct *tsk);
+extern void taskstats_exit(struct task_struct *tsk, int group_dead);
+
+#else
+
+static inline void taskstats_tgid_init(struct signal_struct *sig) { }
+static inline void
+taskstats_tgid_add(struct signal_struct *sig, struct task_struct *tsk) { }
+static inline void taskstats_exit(struct task_struct *tsk, int group_dead) { }
+
+#endif
+
+#endif /* __KERNEL__ */
+
+#endif
@@ -127,6 +127,16 @@ enum {
 #define TCP_WINDOW_CLAMP	10	/* Bound advertised window */
 #define TCP_INFO		11	/* Information about this connection. */
 #define TCP_QUICKACK		12	/* Block/reenable quick acks */
+#define TCP_CONGESTION		13	/* Congestion control algorithm */
+#define TCP_ZEROCOPY_RECEIVE	14	/* Map received pages (getsockopt) */
+#define TCP_ZEROCOPY_RELEASE	15	/* Unmap consumed pages (setsockopt) */
+
+/* for TCP_ZEROCOPY_RECEIVE and TCP_ZEROCOPY_RELEASE */
+struct tcp_zerocopy_receive {
+	__u64	address;	/* page aligned, in an mmap() of the socket */
+	__u32	length;		/* in: bytes of mapping; out: bytes mapped */
+	__u32	recv_skip_hint;	/* out: bytes to read with recvmsg() */
+};
 
 #define TCPI_OPT_TIMESTAMPS	1
 #define TCPI_OPT_SACK		2
@@ -194,6 +204,8 @@ struct tcp_info
 
 #include <linux/config.h>
 #include <linux/skbuff.h>
+#include <linux/rbtree.h>
+#include <linux/hrtimer.h>
 #include <linux/ip.h>
 #include <net/sock.h>
 
@@ -203,13 +215,6 @@ struct tcp_sack_block {
 	__u32	end_seq;
 };
 
-enum tcp_congestion_algo {
-	TCP_RENO=0,
-	TCP_VEGAS,
-	TCP_WESTWOOD,
-	TCP_BIC,
-};
-
 struct tcp_options_received {
 /*	PAWS/RTTM data	*/
 	long	ts_recent_stamp;/* Time we stored ts_recent (for aging) */
@@ -294,7 +299,6 @@ struct tcp_sock {
 	__u8	reordering;	/* Packet reordering metric.		*/
 	__u8	frto_counter;	/* Number of new acks after RTO */
 
-	__u8	adv_cong;	/* Using Vegas, Westwood, or BIC */
 	__u8	defer_accept;	/* User waits for some data after accept() */
 
 /* RTT measurement */
@@ -346,6 +350,9 @@ struct tcp_sock {
 /*	SACKs data	*/
 	struct tcp_sack_block duplicate_sack[1]; /* D-SACK block */
 	struct tcp_sack_block selective_acks[4]; /* The SACKS themselves*/
+	struct tcp_sack_block recv_sack_cache[4]; /* SACKs of the last ACK, already tagged */
+
+	struct rb_root	write_queue_rb;	/* Write queue indexed by sequence */
 
 	__u8	syn_retries;	/* num of allowed syn retries */
 	__u8	ecn_flags;	/* ECN status bits.			*/
@@ -405,37 +412,17 @@ struct tcp_sock {
 		__u32	time;
 	} rcvq_space;
 
-/* TCP Westwood structure */
-        struct {
-                __u32    bw_ns_est;        /* first bandwidth estimation..not too smoothed 8) */
-                __u32    bw_est;           /* bandwidth estimate */
-                __u32    rtt_win_sx;       /* here starts a new evaluation... */
-                __u32    bk;
-                __u32    snd_una;          /* used for evaluating the number of acked bytes */
-                __u32    cumul_ack;
-                __u32    accounted;
-                __u32    rtt;
-                __u32    rtt_min;          /* minimum observed RTT */
-        } westwood;
-
-/* Vegas variables */
-	struct {
-		__u32	beg_snd_nxt;	/* right edge during last RTT */
-		__u32	beg_snd_una;	/* left edge  during last RTT */
-		__u32	beg_snd_cwnd;	/* saves the size of the cwnd */
-		__u8	doing_vegas_now;/* if true, do vegas for this RTT */
-		__u16	cntRTT;		/* # of RTTs measured within last RTT */
-		__u32	minRTT;		/* min of RTTs measured within last RTT (in usec) */
-		__u32	baseRTT;	/* the min of all Vegas RTT measurements seen (in usec) */
-	} vegas;
-
-	/* BI TCP Parameters */
-	struct {
-		__u32	cnt;		/* increase cwnd by 1 after this number of ACKs */
-		__u32 	last_max_cwnd;	/* last maximium snd_cwnd */
-		__u32	last_cwnd;	/* the last snd_cwnd */
-		__u32   last_stamp;     /* time when updated last_cwnd */
-	} bictcp;
+/* Transmit queue limits (TCP Small Queues) and pacing */
+	unsigned long	tsq_flags;
+	struct list_head tsq_node;	/* On a per-cpu tsq_tasklet list */
+	__u32	pacing_rate;		/* Bytes per second, ~0U: unlimited */
+	ktime_t	pacing_next;		/* Earliest time of the next segment */
+	struct hrtimer pacing_timer;
+
+/* Congestion control algorithm and its private state */
+	struct tcp_congestion_ops *ca_ops;
+	__u32	ca_priv[16];
+#define TCP_CA_PRIV_SIZE	(16*sizeof(__u32))
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
@@ -4,6 +4,15 @@
 /* Just some random number */
 #define TCPDIAG_GETSOCK 18
 
+/*
+ * UDP and raw sockets are dumped with the same request and reply as TCP,
+ * see net/ipv4/udp_diag.c.  The states are TCP_ESTABLISHED for a
+ * connected socket and TCP_CLOSE for any other; the source port of a raw
+ * socket is its protocol, as in /proc/net/raw.  Only dumps are supported.
+ */
+#define UDPDIAG_GETSOCK 19
+#define RAWDIAG_GETSOCK 20
+
 /* Socket identity */
 struct tcpdiag_sockid
 {
@@ -99,9 +108,10 @@ enum
 	TCPDIAG_MEMINFO,
 	TCPDIAG_INFO,
 	TCPDIAG_VEGASINFO,
+	TCPDIAG_CONG,
 };
 
-#define TCPDIAG_MAX TCPDIAG_VEGASINFO
+#define TCPDIAG_MAX TCPDIAG_CONG
 
 
 /* TCPDIAG_MEM */
@@ -123,5 +133,42 @@ struct tcpvegas_info {
 	__u32	tcpv_minrtt;
 };
 
+#ifdef __KERNEL__
+
+struct sock;
+struct nlmsghdr;
+struct rtattr;
+
+/* What the bytecode of a dump request is run against */
+struct inet_diag_entry
+{
+	u32 *saddr;
+	u32 *daddr;
+	u16 sport;
+	u16 dport;
+	u16 family;
+	u16 userlocks;
+};
+
+/* Add an extension to the reply, or goto nlmsg_failure */
+#define TCPDIAG_PUT(skb, attrtype, attrlen) \
+({ int rtalen = RTA_LENGTH(attrlen);        \
+   struct rtattr *rta;                      \
+   if (skb_tailroom(skb) < RTA_ALIGN(rtalen)) goto nlmsg_failure; \
+   rta = (void*)__skb_put(skb, RTA_ALIGN(rtalen)); \
+   rta->rta_type = attrtype;                \
+   rta->rta_len = rtalen;                   \
+   RTA_DATA(rta); })
+
+/* net/ipv4/inet_diag.c, shared by the inet protocol handlers */
+extern int inet_diag_audit_req(const struct nlmsghdr *nlh);
+extern struct rtattr *inet_diag_req_bc(const struct nlmsghdr *nlh);
+extern int inet_diag_bc_run(const void *bc, int len,
+			    const struct inet_diag_entry *entry);
+extern int inet_diag_bc_sk(const struct nlmsghdr *nlh, struct sock *sk);
+extern void inet_diag_fill_id(struct tcpdiagmsg *r, struct sock *sk);
+
+#endif /* __KERNEL__ */
+
 
 #endif /* _TCP_DIAG_H_ */
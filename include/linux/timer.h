@@ -19,10 +19,15 @@ struct timer_list {
 	unsigned long data;
 
 	struct tvec_t_base_s *base;
+	unsigned long slack;
+	unsigned int flags;
 };
 
 #define TIMER_MAGIC	0x4b87ad6e
 
+/* timer_list flags: */
+#define TIMER_DEFERRABLE	0x1	/* don't wake an idle CPU for it */
+
 #define TIMER_INITIALIZER(_function, _expires, _data) {		\
 		.function = (_function),			\
 		.expires = (_expires),				\
@@ -43,9 +48,42 @@ static inline void init_timer(struct timer_list * timer)
 {
 	timer->base = NULL;
 	timer->magic = TIMER_MAGIC;
+	timer->slack = 0;
+	timer->flags = 0;
 	spin_lock_init(&timer->lock);
 }
 
+/***
+ * init_timer_deferrable - initialize a deferrable timer.
+ * @timer: the timer to be initialized
+ *
+ * A deferrable timer works as usual while the CPU is busy, but it is
+ * not taken into account when an idle CPU stops its tick: it runs
+ * the next time the CPU wakes up for something else.  Use it for
+ * housekeeping that may as well be done late.
+ */
+static inline void init_timer_deferrable(struct timer_list *timer)
+{
+	init_timer(timer);
+	timer->flags |= TIMER_DEFERRABLE;
+}
+
+/***
+ * set_timer_slack - allow a timer to expire late
+ * @timer: the timer to be modified
+ * @slack: how many jiffies after ->expires the timer may run
+ *
+ * A timer with slack is queued anywhere between its expiry time and
+ * the expiry time plus slack, preferably in a slot that has other
+ * timers queued already, so that the CPU wakes up once for all of
+ * them.  Use it for timeouts that do not need to be exact.
+ */
+static inline void set_timer_slack(struct timer_list *timer,
+				   unsigned long slack)
+{
+	timer->slack = slack;
+}
+
 /***
  * timer_pending - is a timer pending?
  * @timer: the timer in question
@@ -97,6 +135,8 @@ static inline void add_timer(struct timer_list * timer)
 
 extern void init_timers(void);
 extern void run_local_timers(void);
-extern void it_real_fn(unsigned long);
+
+struct hrtimer;
+extern int it_real_fn(struct hrtimer *);
 
 #endif
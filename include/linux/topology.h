@@ -61,8 +61,9 @@
 #endif
 
 /*
- * Below are the 3 major initializers used in building sched_domains:
+ * Below are the 4 major initializers used in building sched_domains:
  * SD_SIBLING_INIT, for SMT domains
+ * SD_MC_INIT, for multi-core domains
  * SD_CPU_INIT, for SMP domains
  * SD_NODE_INIT, for NUMA domains
  *
@@ -102,6 +103,36 @@
 #endif
 #endif /* CONFIG_SCHED_SMT */
 
+#ifdef CONFIG_SCHED_MC
+#ifndef ARCH_HAS_SCHED_WAKE_IDLE
+#define ARCH_HAS_SCHED_WAKE_IDLE
+#endif
+/* Common values for cores sharing a package */
+#ifndef SD_MC_INIT
+#define SD_MC_INIT (struct sched_domain) {		\
+	.span			= CPU_MASK_NONE,	\
+	.parent			= NULL,			\
+	.groups			= NULL,			\
+	.min_interval		= 1,			\
+	.max_interval		= 4,			\
+	.busy_factor		= 64,			\
+	.imbalance_pct		= 125,			\
+	.cache_hot_time		= (5*1000000/2),	\
+	.cache_nice_tries	= 1,			\
+	.per_cpu_gain		= 100,			\
+	.flags			= SD_LOAD_BALANCE	\
+				| SD_BALANCE_NEWIDLE	\
+				| SD_BALANCE_EXEC	\
+				| SD_WAKE_AFFINE	\
+				| SD_WAKE_IDLE		\
+				| SD_SHARE_PKG_RESOURCES,\
+	.last_balance		= jiffies,		\
+	.balance_interval	= 1,			\
+	.nr_balance_failed	= 0,			\
+}
+#endif
+#endif /* CONFIG_SCHED_MC */
+
 /* Common values for CPUs */
 #ifndef SD_CPU_INIT
 #define SD_CPU_INIT (struct sched_domain) {		\
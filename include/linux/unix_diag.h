@@ -0,0 +1,42 @@
+#ifndef _UNIX_DIAG_H_
+#define _UNIX_DIAG_H_ 1
+
+/*
+ * Unix domain socket monitoring over NETLINK_TCPDIAG, see
+ * net/unix/diag.c.  Only dumps are supported.
+ */
+#define UNIXDIAG_GETSOCK 21
+
+struct unixdiagreq
+{
+	__u8	udiag_family;		/* AF_UNIX */
+	__u8	udiag_pad[3];
+	__u32	udiag_states;		/* 1 << TCP_LISTEN, etc. */
+};
+
+struct unixdiagmsg
+{
+	__u8	udiag_family;
+	__u8	udiag_type;		/* SOCK_STREAM, SOCK_DGRAM, ... */
+	__u8	udiag_state;		/* TCP_LISTEN, TCP_ESTABLISHED, ... */
+	__u8	udiag_pad;
+
+	__u32	udiag_ino;
+	__u32	udiag_peer;		/* Inode of the peer, or 0 */
+	__u32	udiag_rqueue;		/* Queued messages, or connections */
+	__u32	udiag_wqueue;		/* Bytes sent and not yet read */
+	__u32	udiag_uid;
+	__u32	udiag_cookie[2];
+};
+
+/* Attributes */
+
+enum
+{
+	UNIXDIAG_NONE,
+	UNIXDIAG_NAME,			/* sun_path of a bound socket */
+};
+
+#define UNIXDIAG_MAX UNIXDIAG_NAME
+
+#endif /* _UNIX_DIAG_H_ */
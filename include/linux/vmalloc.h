@@ -2,12 +2,16 @@
 #define _LINUX_VMALLOC_H
 
 #include <linux/spinlock.h>
+#include <linux/rbtree.h>
 #include <asm/page.h>		/* pgprot_t */
 
 /* bits in vm_struct->flags */
 #define VM_IOREMAP	0x00000001	/* ioremap() and friends */
 #define VM_ALLOC	0x00000002	/* vmalloc() */
 #define VM_MAP		0x00000004	/* vmap()ed pages */
+#define VM_RAM		0x00000008	/* vm_map_ram() block, partly mapped */
+#define VM_LAZY_FREE	0x00000010	/* unmapped, TLB flush pending */
+#define VM_LAZY_PURGE	0x00000020	/* TLB flush in progress */
 /* bits [20..32] reserved for arch specific ioremap internals */
 
 struct vm_struct {
@@ -18,6 +22,7 @@ struct vm_struct {
 	unsigned int		nr_pages;
 	unsigned long		phys_addr;
 	struct vm_struct	*next;
+	struct rb_node		rb_node;	/* By addr, see mm/vmalloc.c */
 };
 
 /*
@@ -33,6 +38,11 @@ extern void vfree(void *addr);
 extern void *vmap(struct page **pages, unsigned int count,
 			unsigned long flags, pgprot_t prot);
 extern void vunmap(void *addr);
+
+extern void *vm_map_ram(struct page **pages, unsigned int count,
+			pgprot_t prot);
+extern void vm_unmap_ram(void *mem, unsigned int count);
+extern void vm_unmap_aliases(void);
  
 /*
  *	Lowlevel-APIs (not for driver use!)
@@ -41,6 +51,8 @@ extern struct vm_struct *get_vm_area(unsigned long size, unsigned long flags);
 extern struct vm_struct *__get_vm_area(unsigned long size, unsigned long flags,
 					unsigned long start, unsigned long end);
 extern struct vm_struct *remove_vm_area(void *addr);
+extern struct vm_struct *__remove_vm_area(void *addr);
+extern void vm_area_add_early(struct vm_struct *vm);
 extern int map_vm_area(struct vm_struct *area, pgprot_t prot,
 			struct page ***pages);
 extern void unmap_vm_area(struct vm_struct *area);
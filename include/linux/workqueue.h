@@ -10,6 +10,7 @@
 #include <linux/bitops.h>
 
 struct workqueue_struct;
+struct task_struct;
 
 struct work_struct {
 	unsigned long pending;
@@ -50,6 +51,16 @@ struct work_struct {
 		init_timer(&(_work)->timer);			\
 	} while (0)
 
+/*
+ * initialize a work-struct whose delayed timer does not wake idle
+ * CPUs (see init_timer_deferrable()):
+ */
+#define INIT_WORK_DEFERRABLE(_work, _func, _data)		\
+	do {							\
+		INIT_WORK((_work), (_func), (_data));		\
+		init_timer_deferrable(&(_work)->timer);		\
+	} while (0)
+
 extern struct workqueue_struct *__create_workqueue(const char *name,
 						    int singlethread);
 #define create_workqueue(name) __create_workqueue((name), 0)
@@ -58,6 +69,7 @@ extern struct workqueue_struct *__create_workqueue(const char *name,
 extern void destroy_workqueue(struct workqueue_struct *wq);
 
 extern int FASTCALL(queue_work(struct workqueue_struct *wq, struct work_struct *work));
+extern int FASTCALL(queue_work_on(int cpu, struct workqueue_struct *wq, struct work_struct *work));
 extern int FASTCALL(queue_delayed_work(struct workqueue_struct *wq, struct work_struct *work, unsigned long delay));
 extern void FASTCALL(flush_workqueue(struct workqueue_struct *wq));
 
@@ -70,6 +82,10 @@ extern int current_is_keventd(void);
 extern int keventd_up(void);
 
 extern void init_workqueues(void);
+
+/* Called from schedule() for PF_WQ_WORKER tasks */
+extern void wq_worker_sleeping(struct task_struct *task);
+extern void wq_worker_running(struct task_struct *task);
 void cancel_rearming_delayed_work(struct work_struct *work);
 
 /*
@@ -6,10 +6,6 @@
 
 struct backing_dev_info;
 
-extern spinlock_t inode_lock;
-extern struct list_head inode_in_use;
-extern struct list_head inode_unused;
-
 /*
  * Yes, writeback.h requires sched.h
  * No, sched.h is not included from here.
@@ -55,6 +51,7 @@ struct writeback_control {
 	unsigned encountered_congestion:1;	/* An output: a queue is full */
 	unsigned for_kupdate:1;			/* A kupdate writeback */
 	unsigned for_reclaim:1;			/* Invoked from the page allocator */
+	unsigned pdflush_only:1;		/* Skip queues with a flusher thread */
 };
 
 /*
@@ -84,6 +81,8 @@ static inline void wait_on_inode(struct inode *inode)
  * mm/page-writeback.c
  */
 int wakeup_bdflush(long nr_pages);
+void bdi_background_writeout(struct backing_dev_info *bdi, long min_pages);
+void bdi_kupdate_writeout(struct backing_dev_info *bdi);
 void laptop_io_completion(void);
 void laptop_sync_completion(void);
 void throttle_vm_writeout(void);
@@ -0,0 +1,38 @@
+#ifndef _LINUX_ZSMALLOC_H
+#define _LINUX_ZSMALLOC_H
+
+/*
+ * zsmalloc: an allocator for many small objects of odd sizes, such as
+ * compressed pages.  Objects of one size class are packed back to back
+ * in a "zspage" of up to ZS_MAX_PAGES_PER_ZSPAGE order-0 pages, which
+ * need not be contiguous and may be highmem, so an object can straddle
+ * two pages.  It is therefore not addressable, and is copied in and
+ * out with zs_write_object() and zs_read_object(), which map the pages
+ * with KM_USER0.
+ */
+
+#include <linux/config.h>
+
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+struct zs_pool;
+struct zspage;
+
+extern struct zs_pool *zs_create_pool(unsigned int gfp_mask);
+extern void zs_destroy_pool(struct zs_pool *pool);
+
+extern struct zspage *zs_malloc(struct zs_pool *pool, size_t size,
+				unsigned int *index);
+extern void zs_free(struct zs_pool *pool, struct zspage *zspage,
+		    unsigned int index);
+
+extern void zs_read_object(struct zs_pool *pool, struct zspage *zspage,
+			   unsigned int index, void *dst, size_t len);
+extern void zs_write_object(struct zs_pool *pool, struct zspage *zspage,
+			    unsigned int index, const void *src, size_t len);
+
+extern unsigned long zs_get_total_pages(struct zs_pool *pool);
+
+#endif /* _LINUX_ZSMALLOC_H */
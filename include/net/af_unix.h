@@ -9,7 +9,7 @@ extern void unix_gc(void);
 extern struct hlist_head unix_socket_table[UNIX_HASH_SIZE + 1];
 extern rwlock_t unix_table_lock;
 
-extern atomic_t unix_tot_inflight;
+extern unsigned int unix_tot_inflight;
 
 static inline struct sock *first_unix_socket(int *i)
 {
@@ -47,11 +47,15 @@ struct unix_address {
 struct unix_skb_parms {
 	struct ucred		creds;		/* Skb credentials	*/
 	struct scm_fp_list	*fp;		/* Passed files		*/
+	unsigned int		consumed;	/* Stream: bytes read	*/
 };
 
 #define UNIXCB(skb) 	(*(struct unix_skb_parms*)&((skb)->cb))
 #define UNIXCREDS(skb)	(&UNIXCB((skb)).creds)
 
+/* What is left to read of a stream skb, whose data may be in pages */
+#define unix_skb_len(skb)	((skb)->len - UNIXCB((skb)).consumed)
+
 #define unix_state_rlock(s)	read_lock(&unix_sk(s)->lock)
 #define unix_state_runlock(s)	read_unlock(&unix_sk(s)->lock)
 #define unix_state_wlock(s)	write_lock(&unix_sk(s)->lock)
@@ -68,8 +72,9 @@ struct unix_sock {
         struct semaphore        readsem;
         struct sock		*peer;
         struct sock		*other;
-        struct sock		*gc_tree;
+        struct list_head	link;		/* on the GC lists, see garbage.c */
         atomic_t                inflight;
+        unsigned int		gc_candidate : 1;
         rwlock_t                lock;
         wait_queue_head_t       peer_wait;
 };
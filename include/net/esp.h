@@ -6,6 +6,8 @@
 
 #define ESP_NUM_FAST_SG		4
 
+struct esp_parallel;
+
 struct esp_data
 {
 	struct scatterlist		sgbuf[ESP_NUM_FAST_SG];
@@ -36,6 +38,11 @@ struct esp_data
 		                               int offset, int len, u8 *icv);
 		struct crypto_tfm	*tfm;
 	} auth;
+
+#ifdef CONFIG_XFRM_PARALLEL
+	/* XFRM_STATE_PARALLEL: copies of this for each CPU's use */
+	struct esp_parallel		*par;
+#endif
 };
 
 extern int skb_to_sgvec(struct sk_buff *skb, struct scatterlist *sg, int offset, int len);
@@ -13,6 +13,7 @@
 #include <linux/init.h>
 #include <linux/jiffies.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 #include <asm/atomic.h>
 
 struct inet_peer
@@ -27,6 +28,8 @@ struct inet_peer
 	__u16			ip_id_count;	/* IP ID for the next packet */
 	__u32			tcp_ts;
 	unsigned long		tcp_ts_stamp;
+	int			dead;		/* being unlinked */
+	struct rcu_head		rcu;
 };
 
 void			inet_initpeers(void) __init;
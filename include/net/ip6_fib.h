@@ -21,6 +21,7 @@
 #include <net/flow.h>
 #include <linux/rtnetlink.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 
 struct rt6_info;
 
@@ -37,6 +38,8 @@ struct fib6_node
 	__u16			fn_bit;		/* bit key */
 	__u16			fn_flags;
 	__u32			fn_sernum;
+
+	struct rcu_head		rcu;
 };
 
 
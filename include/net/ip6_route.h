@@ -112,6 +112,14 @@ extern int inet6_rtm_getroute(struct sk_buff *skb, struct nlmsghdr* nlh, void *a
 extern void rt6_ifdown(struct net_device *dev);
 extern void rt6_mtu_change(struct net_device *dev, unsigned mtu);
 
+extern void rt6_cache_flush(void);
+extern int rt6_cache_gc(int timeout);
+
+/*
+ * Writers of the fib6 tree take rt6_lock for writing.  Packet lookups
+ * walk it under rcu_read_lock_bh() only: nodes and routes are freed a
+ * grace period after they are unlinked.
+ */
 extern rwlock_t rt6_lock;
 
 /*
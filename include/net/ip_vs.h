@@ -250,6 +250,7 @@ struct ip_vs_daemon_user {
 #include <linux/config.h>
 #include <linux/list.h>                 /* for struct list_head */
 #include <linux/spinlock.h>             /* for struct rwlock_t */
+#include <linux/rcupdate.h>		/* for struct rcu_head */
 #include <linux/skbuff.h>               /* for struct sk_buff */
 #include <linux/ip.h>                   /* for struct iphdr */
 #include <asm/atomic.h>                 /* for struct atomic_t */
@@ -359,6 +360,8 @@ enum {
 	NET_IPV4_VS_SYNC_THRESHOLD=24,
 	NET_IPV4_VS_NAT_ICMP_SEND=25,
 	NET_IPV4_VS_EXPIRE_QUIESCENT_TEMPLATE=26,
+	NET_IPV4_VS_CONN_TAB_BITS=27,
+	NET_IPV4_VS_SYNC_THREADS=28,
 	NET_IPV4_VS_LAST
 };
 
@@ -499,6 +502,7 @@ extern struct ip_vs_protocol * ip_vs_proto_get(unsigned short proto);
  */
 struct ip_vs_conn {
 	struct list_head        c_list;         /* hashed list heads */
+	struct rcu_head		rcu_head;	/* for freeing after lookups */
 
 	/* Protocol, addresses and port numbers */
 	__u32                   caddr;          /* client address */
@@ -713,8 +717,11 @@ extern void ip_vs_init_hash_table(struct list_head *table, int rows);
  */
 
 /*
- *     IPVS connection entry hash table
+ *     IPVS connection entry hash table.  CONFIG_IP_VS_TAB_BITS gives
+ *     its initial size; net.ipv4.vs.conn_tab_bits resizes it later.
  */
+#define IP_VS_CONN_TAB_BITS_MIN	8
+#define IP_VS_CONN_TAB_BITS_MAX	20
 #ifndef CONFIG_IP_VS_TAB_BITS
 #define CONFIG_IP_VS_TAB_BITS   12
 #endif
@@ -728,8 +735,8 @@ extern void ip_vs_init_hash_table(struct list_head *table, int rows);
 #if 8 <= CONFIG_IP_VS_TAB_BITS && CONFIG_IP_VS_TAB_BITS <= 20
 #define IP_VS_CONN_TAB_BITS	CONFIG_IP_VS_TAB_BITS
 #endif
-#define IP_VS_CONN_TAB_SIZE     (1 << IP_VS_CONN_TAB_BITS)
-#define IP_VS_CONN_TAB_MASK     (IP_VS_CONN_TAB_SIZE - 1)
+extern int ip_vs_conn_tab_bits;
+#define IP_VS_CONN_TAB_SIZE     (1 << ip_vs_conn_tab_bits)
 
 enum {
 	IP_VS_DIR_INPUT = 0,
@@ -763,6 +770,7 @@ extern void ip_vs_tcp_conn_listen(struct ip_vs_conn *cp);
 extern int ip_vs_check_template(struct ip_vs_conn *ct);
 extern void ip_vs_secure_tcp_set(int on);
 extern void ip_vs_random_dropentry(void);
+extern int ip_vs_conn_resize(int bits);
 extern int ip_vs_conn_init(void);
 extern void ip_vs_conn_cleanup(void);
 
@@ -908,6 +916,8 @@ extern volatile int ip_vs_master_syncid;
 extern volatile int ip_vs_backup_syncid;
 extern char ip_vs_master_mcast_ifn[IP_VS_IFNAME_MAXLEN];
 extern char ip_vs_backup_mcast_ifn[IP_VS_IFNAME_MAXLEN];
+#define IP_VS_SYNC_THREADS_MAX	8
+extern int sysctl_ip_vs_sync_threads;
 extern int start_sync_thread(int state, char *mcast_ifn, __u8 syncid);
 extern int stop_sync_thread(int state);
 extern void ip_vs_sync_conn(struct ip_vs_conn *cp);
@@ -140,6 +140,7 @@ struct neighbour
 	struct sk_buff_head	arp_queue;
 	struct timer_list	timer;
 	struct neigh_ops	*ops;
+	struct rcu_head		rcu;
 	u8			primary_key[0];
 };
 
@@ -166,6 +167,15 @@ struct pneigh_entry
  *	neighbour table manipulation
  */
 
+/* Hash buckets are published as a unit so that lockless readers
+ * always see a mask matching the array they index.
+ */
+struct neigh_hash_table
+{
+	struct neighbour	**hash_buckets;
+	unsigned int		hash_mask;
+	struct rcu_head		rcu;
+};
 
 struct neigh_table
 {
@@ -195,8 +205,7 @@ struct neigh_table
 	struct neigh_parms	*parms_list;
 	kmem_cache_t		*kmem_cachep;
 	struct neigh_statistics	*stats;
-	struct neighbour	**hash_buckets;
-	unsigned int		hash_mask;
+	struct neigh_hash_table	*nht;
 	__u32			hash_rnd;
 	unsigned int		hash_chain_gc;
 	struct pneigh_entry	**phash_buckets;
@@ -1,6 +1,7 @@
 #ifndef __NET_PKT_SCHED_H
 #define __NET_PKT_SCHED_H
 
+#include <linux/hrtimer.h>
 #include <net/sch_generic.h>
 
 struct qdisc_walker
@@ -228,12 +229,34 @@ extern void qdisc_put_rtab(struct qdisc_rate_table *tab);
 
 extern int qdisc_restart(struct net_device *dev);
 
+/* Dequeues a throttled qdisc again once delay psched units have
+   passed, clearing TCQ_F_THROTTLED. */
+struct qdisc_watchdog
+{
+	struct hrtimer		timer;
+	struct Qdisc		*qdisc;
+};
+
+extern void qdisc_watchdog_init(struct qdisc_watchdog *wd, struct Qdisc *qdisc);
+extern void qdisc_watchdog_schedule(struct qdisc_watchdog *wd,
+				    psched_tdiff_t delay);
+extern void qdisc_watchdog_cancel(struct qdisc_watchdog *wd);
+
 static inline void qdisc_run(struct net_device *dev)
 {
 	while (!netif_queue_stopped(dev) && qdisc_restart(dev) < 0)
 		/* NOTHING */;
 }
 
+extern int subqueue_restart(struct netdev_queue *txq);
+
+static inline void subqueue_run(struct netdev_queue *txq)
+{
+	while (!test_bit(__QUEUE_STATE_XOFF, &txq->state) &&
+	       subqueue_restart(txq) < 0)
+		/* NOTHING */;
+}
+
 extern int tc_classify(struct sk_buff *skb, struct tcf_proto *tp,
 	struct tcf_result *res);
 
@@ -101,11 +101,18 @@ struct rt_cache_stat
         unsigned int gc_dst_overflow;
         unsigned int in_hlist_search;
         unsigned int out_hlist_search;
+        unsigned int gc_buckets;
+        unsigned int gc_freed;
+        unsigned int gc_expired;
+        unsigned int gc_evicted;
+        unsigned int hash_resize;
 };
 
 extern struct rt_cache_stat *rt_cache_stat;
 #define RT_CACHE_STAT_INC(field)					  \
 		(per_cpu_ptr(rt_cache_stat, _smp_processor_id())->field++)
+#define RT_CACHE_STAT_ADD(field, n)					  \
+		(per_cpu_ptr(rt_cache_stat, _smp_processor_id())->field += (n))
 
 extern struct ip_rt_acct *ip_rt_acct;
 
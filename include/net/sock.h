@@ -48,6 +48,8 @@
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>	/* struct sk_buff */
 #include <linux/security.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu_counter.h>
 
 #include <linux/filter.h>
 
@@ -94,6 +96,7 @@ struct sock;
   *	@skc_family - network address family
   *	@skc_state - Connection state
   *	@skc_reuse - %SO_REUSEADDR setting
+  *	@skc_reuseport - %SO_REUSEPORT setting
   *	@skc_bound_dev_if - bound device index if != 0
   *	@skc_node - main hash linkage for various protocol lookup tables
   *	@skc_bind_node - bind hash linkage for various protocol lookup tables
@@ -105,7 +108,8 @@ struct sock;
 struct sock_common {
 	unsigned short		skc_family;
 	volatile unsigned char	skc_state;
-	unsigned char		skc_reuse;
+	unsigned char		skc_reuse:4;
+	unsigned char		skc_reuseport:4;
 	int			skc_bound_dev_if;
 	struct hlist_node	skc_node;
 	struct hlist_node	skc_bind_node;
@@ -157,6 +161,8 @@ struct sock_common {
   *	@sk_slab - the slabcache this instance was allocated from
   *	@sk_timer - sock cleanup timer
   *	@sk_stamp - time stamp of last packet received
+  *	@sk_busy_poll - %SO_BUSY_POLL setting, usecs to poll the device before sleeping
+  *	@sk_busy_ifindex - device the last packet came in on
   *	@sk_socket - Identd and reporting IO signals
   *	@sk_user_data - RPC layer private data
   *	@sk_owner - module that owns this socket
@@ -170,6 +176,7 @@ struct sock_common {
   *	@sk_error_report - callback to indicate errors (e.g. %MSG_ERRQUEUE)
   *	@sk_backlog_rcv - callback to process the backlog
   *	@sk_destruct - called at sock freeing time, i.e. when all refcnt == 0
+  *	@sk_rcu - used by protocols with RCU lookups to release a hash reference
  */
 struct sock {
 	/*
@@ -180,6 +187,7 @@ struct sock {
 #define sk_family		__sk_common.skc_family
 #define sk_state		__sk_common.skc_state
 #define sk_reuse		__sk_common.skc_reuse
+#define sk_reuseport		__sk_common.skc_reuseport
 #define sk_bound_dev_if		__sk_common.skc_bound_dev_if
 #define sk_node			__sk_common.skc_node
 #define sk_bind_node		__sk_common.skc_bind_node
@@ -234,6 +242,10 @@ struct sock {
 	kmem_cache_t		*sk_slab;
 	struct timer_list	sk_timer;
 	struct timeval		sk_stamp;
+#ifdef CONFIG_NET_BUSY_POLL
+	unsigned int		sk_busy_poll;
+	int			sk_busy_ifindex;
+#endif
 	struct socket		*sk_socket;
 	void			*sk_user_data;
 	struct module		*sk_owner;
@@ -249,6 +261,7 @@ struct sock {
   	int			(*sk_backlog_rcv)(struct sock *sk,
 						  struct sk_buff *skb);  
 	void                    (*sk_destruct)(struct sock *sk);
+	struct rcu_head		sk_rcu;
 };
 
 /*
@@ -336,6 +349,12 @@ static __inline__ void __sk_add_node(struct sock *sk, struct hlist_head *list)
 	hlist_add_head(&sk->sk_node, list);
 }
 
+static __inline__ void __sk_add_node_rcu(struct sock *sk,
+					 struct hlist_head *list)
+{
+	hlist_add_head_rcu(&sk->sk_node, list);
+}
+
 static __inline__ void sk_add_node(struct sock *sk, struct hlist_head *list)
 {
 	sock_hold(sk);
@@ -353,8 +372,16 @@ static __inline__ void sk_add_bind_node(struct sock *sk,
 	hlist_add_head(&sk->sk_bind_node, list);
 }
 
+static __inline__ void __sk_add_bind_node_rcu(struct sock *sk,
+					      struct hlist_head *list)
+{
+	hlist_add_head_rcu(&sk->sk_bind_node, list);
+}
+
 #define sk_for_each(__sk, node, list) \
 	hlist_for_each_entry(__sk, node, list, sk_node)
+#define sk_for_each_rcu(__sk, node, list) \
+	hlist_for_each_entry_rcu(__sk, node, list, sk_node)
 #define sk_for_each_from(__sk, node) \
 	if (__sk && ({ node = &(__sk)->sk_node; 1; })) \
 		hlist_for_each_entry_from(__sk, node, sk_node)
@@ -365,6 +392,8 @@ static __inline__ void sk_add_bind_node(struct sock *sk,
 	hlist_for_each_entry_safe(__sk, node, tmp, list, sk_node)
 #define sk_for_each_bound(__sk, node, list) \
 	hlist_for_each_entry(__sk, node, list, sk_bind_node)
+#define sk_for_each_bound_rcu(__sk, node, list) \
+	hlist_for_each_entry_rcu(__sk, node, list, sk_bind_node)
 
 /* Sock flags */
 enum sock_flags {
@@ -524,14 +553,24 @@ struct proto {
 	int			(*backlog_rcv) (struct sock *sk, 
 						struct sk_buff *skb);
 
+	/* Work deferred while the user owned the socket. */
+	void			(*release_cb)(struct sock *sk);
+
 	/* Keeping track of sk's, looking them up, and port selection methods. */
 	void			(*hash)(struct sock *sk);
 	void			(*unhash)(struct sock *sk);
 	int			(*get_port)(struct sock *sk, unsigned short snum);
+	/* The bound address of a hashed sk changed (connect, disconnect). */
+	void			(*rehash)(struct sock *sk);
 
 	/* Memory pressure */
 	void			(*enter_memory_pressure)(void);
-	atomic_t		*memory_allocated;	/* Current allocated memory. */
+	/*
+	 * Current allocated memory, in SK_STREAM_MEM_QUANTUM pages.  Per
+	 * CPU deltas are folded in FBC_BATCH at a time, so a read may be
+	 * off by up to FBC_BATCH * NR_CPUS.
+	 */
+	struct percpu_counter	*memory_allocated;
 	atomic_t		*sockets_allocated;	/* Current number of sockets. */
 	/*
 	 * Pressure flag: try to collapse.
@@ -815,8 +854,7 @@ static inline int sk_filter(struct sock *sk, struct sk_buff *skb, int needlock)
 		
 		filter = sk->sk_filter;
 		if (filter) {
-			int pkt_len = sk_run_filter(skb, filter->insns,
-						    filter->len);
+			int pkt_len = sk_filter_run(skb, filter);
 			if (!pkt_len)
 				err = -EPERM;
 			else
@@ -843,8 +881,10 @@ static inline void sk_filter_release(struct sock *sk, struct sk_filter *fp)
 
 	atomic_sub(size, &sk->sk_omem_alloc);
 
-	if (atomic_dec_and_test(&fp->refcnt))
+	if (atomic_dec_and_test(&fp->refcnt)) {
+		bpf_jit_free(fp);
 		kfree(fp);
+	}
 }
 
 static inline void sk_filter_charge(struct sock *sk, struct sk_filter *fp)
@@ -1054,6 +1094,38 @@ extern void sk_reset_timer(struct sock *sk, struct timer_list* timer,
 
 extern void sk_stop_timer(struct sock *sk, struct timer_list* timer);
 
+#ifdef CONFIG_NET_BUSY_POLL
+extern int sysctl_net_busy_read;
+extern int sysctl_net_busy_poll_budget;
+
+extern int sk_busy_loop(struct sock *sk, int nonblock);
+
+static inline int sk_can_busy_loop(struct sock *sk)
+{
+	return sk->sk_busy_poll && sk->sk_busy_ifindex;
+}
+
+/* Remember where the traffic of @sk comes in, for sk_busy_loop() */
+static inline void sk_mark_busy_poll(struct sock *sk, struct sk_buff *skb)
+{
+	sk->sk_busy_ifindex = skb->dev->ifindex;
+}
+#else
+static inline int sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return 0;
+}
+
+static inline int sk_can_busy_loop(struct sock *sk)
+{
+	return 0;
+}
+
+static inline void sk_mark_busy_poll(struct sock *sk, struct sk_buff *skb)
+{
+}
+#endif
+
 static inline int sock_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
 	int err = 0;
@@ -1076,6 +1148,7 @@ static inline int sock_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 	if (err)
 		goto out;
 
+	sk_mark_busy_poll(sk, skb);
 	skb->dev = NULL;
 	skb_set_owner_r(skb, sk);
 
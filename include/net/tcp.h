@@ -42,9 +42,12 @@
 /* This is for all connections with a full identity, no wildcards.
  * New scheme, half the table is for TIME_WAIT, the other half is
  * for the rest.  I'll experiment with dynamic table growth later.
+ *
+ * Lookups walk both halves under RCU; the lock of the first half's
+ * bucket serializes insertion and removal in both.
  */
 struct tcp_ehash_bucket {
-	rwlock_t	  lock;
+	spinlock_t	  lock;
 	struct hlist_head chain;
 } __attribute__((__aligned__(8)));
 
@@ -62,6 +65,10 @@ struct tcp_ehash_bucket {
  *	3) If all sockets are bound to a specific inet_sk(sk)->rcv_saddr local
  *	   address, and none of them are the same, the port may be
  *	   shared.
+ *	   Failing this, goto test 4.
+ *	4) If all sockets have sk->sk_reuseport set and belong to the same
+ *	   user, the port may be shared, listening or not.  Incoming
+ *	   connections are then spread over the listeners by flow hash.
  *	   Failing this, the port cannot be shared.
  *
  * The interesting point, is test #2.  This is what an FTP server does
@@ -106,6 +113,30 @@ static inline struct tcp_bind_bucket *tb_head(struct tcp_bind_hashbucket *head)
 	return hlist_empty(&head->chain) ? NULL : __tb_head(head);
 }
 
+/* Test #4 above, for one owner SK2 of the port.  TIME_WAIT buckets no
+ * longer have an owner to check, they only need to have had the option.
+ */
+static inline int tcp_reuseport_ok(struct sock *sk2, int reuseport, int uid)
+{
+	return reuseport && sk2->sk_reuseport &&
+	       (sk2->sk_state == TCP_TIME_WAIT || sock_i_uid(sk2) == uid);
+}
+
+extern u32 tcp_reuseport_secret;
+
+/* Listener selection walks the candidates once, replacing the pick
+ * with the N'th one with probability 1/N, driven by the flow hash.
+ */
+static inline u32 tcp_reuseport_scale(u32 phash, u32 n)
+{
+	return (u32)(((u64)phash * n) >> 32);
+}
+
+static inline u32 tcp_reuseport_next(u32 phash)
+{
+	return phash * 1664525 + 1013904223;
+}
+
 extern struct tcp_hashinfo {
 	/* This is for sockets with full identity only.  Sockets here will
 	 * always be without wildcards and will have the following invariant:
@@ -188,6 +219,7 @@ struct tcp_tw_bucket {
 #define tw_family		__tw_common.skc_family
 #define tw_state		__tw_common.skc_state
 #define tw_reuse		__tw_common.skc_reuse
+#define tw_reuseport		__tw_common.skc_reuseport
 #define tw_bound_dev_if		__tw_common.skc_bound_dev_if
 #define tw_node			__tw_common.skc_node
 #define tw_bind_node		__tw_common.skc_bind_node
@@ -218,12 +250,13 @@ struct tcp_tw_bucket {
 	struct in6_addr		tw_v6_rcv_saddr;
 	int			tw_v6_ipv6only;
 #endif
+	struct rcu_head		tw_rcu;
 };
 
 static __inline__ void tw_add_node(struct tcp_tw_bucket *tw,
 				   struct hlist_head *list)
 {
-	hlist_add_head(&tw->tw_node, list);
+	hlist_add_head_rcu(&tw->tw_node, list);
 }
 
 static __inline__ void tw_add_bind_node(struct tcp_tw_bucket *tw,
@@ -312,6 +345,23 @@ static inline void tcp_tw_put(struct tcp_tw_bucket *tw)
 	}
 }
 
+/* Members of the established hash are found without the bucket lock,
+ * so the hash holds a reference on each and drops it only a grace
+ * period after unlinking (see tcp_ipv4.c).
+ */
+extern void __tcp_ehash_add(struct sock *sk, struct hlist_head *list);
+extern int __tcp_ehash_del(struct sock *sk);
+extern void tcp_tw_put_rcu(struct tcp_tw_bucket *tw);
+
+/* Before a socket goes back into the established hash (a second
+ * connect), the reference held for its previous stay must be gone.
+ */
+static inline void tcp_ehash_sync(struct sock *sk)
+{
+	while (sk->sk_rcu.func)
+		synchronize_kernel();
+}
+
 extern atomic_t tcp_orphan_count;
 extern int tcp_tw_count;
 extern void tcp_time_wait(struct sock *sk, int state, int timeo);
@@ -505,24 +555,6 @@ static __inline__ int tcp_sk_listen_hashfn(struct sock *sk)
 # define TCP_TW_RECYCLE_TICK (12+2-TCP_TW_RECYCLE_SLOTS_LOG)
 #endif
 
-#define BICTCP_BETA_SCALE    1024	/* Scale factor beta calculation
-					 * max_cwnd = snd_cwnd * beta
-					 */
-#define BICTCP_MAX_INCREMENT 32		/*
-					 * Limit on the amount of
-					 * increment allowed during
-					 * binary search.
-					 */
-#define BICTCP_FUNC_OF_MIN_INCR 11	/*
-					 * log(B/Smin)/log(B/(B-1))+1,
-					 * Smin:min increment
-					 * B:log factor
-					 */
-#define BICTCP_B		4	 /*
-					  * In binary search,
-					  * go to point (max+min)/N
-					  */
-
 /*
  *	TCP option
  */
@@ -596,20 +628,11 @@ extern int sysctl_tcp_adv_win_scale;
 extern int sysctl_tcp_tw_reuse;
 extern int sysctl_tcp_frto;
 extern int sysctl_tcp_low_latency;
-extern int sysctl_tcp_westwood;
-extern int sysctl_tcp_vegas_cong_avoid;
-extern int sysctl_tcp_vegas_alpha;
-extern int sysctl_tcp_vegas_beta;
-extern int sysctl_tcp_vegas_gamma;
 extern int sysctl_tcp_nometrics_save;
-extern int sysctl_tcp_bic;
-extern int sysctl_tcp_bic_fast_convergence;
-extern int sysctl_tcp_bic_low_window;
-extern int sysctl_tcp_bic_beta;
 extern int sysctl_tcp_moderate_rcvbuf;
 extern int sysctl_tcp_tso_win_divisor;
 
-extern atomic_t tcp_memory_allocated;
+extern struct percpu_counter tcp_memory_allocated;
 extern atomic_t tcp_sockets_allocated;
 extern int tcp_memory_pressure;
 
@@ -776,6 +799,10 @@ extern void			tcp_shutdown (struct sock *sk, int how);
 
 extern int			tcp_v4_rcv(struct sk_buff *skb);
 
+extern struct sk_buff		*tcp_tso_segment(struct sk_buff *skb, int sg);
+extern struct sk_buff		**tcp_gro_receive(struct sk_buff **head,
+						  struct sk_buff *skb);
+
 extern int			tcp_v4_remember_stamp(struct sock *sk);
 
 extern int		    	tcp_v4_tw_remember_stamp(struct tcp_tw_bucket *tw);
@@ -784,6 +811,9 @@ extern int			tcp_sendmsg(struct kiocb *iocb, struct sock *sk,
 					    struct msghdr *msg, size_t size);
 extern ssize_t			tcp_sendpage(struct socket *sock, struct page *page, int offset, size_t size, int flags);
 
+extern int			tcp_mmap(struct file *file, struct socket *sock,
+					 struct vm_area_struct *vma);
+
 extern int			tcp_ioctl(struct sock *sk, 
 					  int cmd, 
 					  unsigned long arg);
@@ -940,6 +970,21 @@ extern __u32 cookie_v4_init_sequence(struct sock *sk, struct sk_buff *skb,
 /* tcp_output.c */
 
 extern int tcp_write_xmit(struct sock *, int nonagle);
+
+/* tcp_sock.tsq_flags bits */
+enum tsq_flags {
+	TSQ_THROTTLED,		/* Transmit stopped on the queue limit */
+	TSQ_QUEUED,		/* On a tsq_tasklet list */
+	TSQ_OWNED,		/* Tasklet found the socket owned by user */
+};
+
+extern int sysctl_tcp_limit_output_bytes;
+extern int sysctl_tcp_pacing;
+
+extern void tcp_wfree(struct sk_buff *skb);
+extern void tcp_release_cb(struct sock *sk);
+extern int tcp_pace_kick(struct hrtimer *timer);
+extern void tcp_tasklet_init(void);
 extern int tcp_retransmit_skb(struct sock *, struct sk_buff *);
 extern void tcp_xmit_retransmit_queue(struct sock *);
 extern void tcp_simple_retransmit(struct sock *);
@@ -1157,6 +1202,7 @@ struct tcp_skb_cb {
 
 	__u16		urg_ptr;	/* Valid w/URG flags is set.	*/
 	__u32		ack_seq;	/* Sequence number ACK'd	*/
+	__u32		pkt_idx;	/* Packet index in rtx queue	*/
 };
 
 #define TCP_SKB_CB(__skb)	((struct tcp_skb_cb *)&((__skb)->cb[0]))
@@ -1204,6 +1250,68 @@ static inline void tcp_packets_out_dec(struct tcp_sock *tp,
 	tp->packets_out -= tcp_skb_pcount(skb);
 }
 
+/* Besides the list, the write queue is indexed by starting sequence
+ * number in tp->write_queue_rb, so that SACK processing can locate the
+ * skb covering a sequence number without walking from the head.
+ */
+extern void tcp_write_queue_rb_insert(struct sock *sk, struct sk_buff *skb);
+
+static inline void tcp_add_write_queue_tail(struct sock *sk,
+					    struct sk_buff *skb)
+{
+	__skb_queue_tail(&sk->sk_write_queue, skb);
+	tcp_write_queue_rb_insert(sk, skb);
+}
+
+static inline void tcp_unlink_write_queue(struct sock *sk,
+					  struct sk_buff *skb)
+{
+	__skb_unlink(skb, &sk->sk_write_queue);
+	rb_erase(&skb->rbnode, &tcp_sk(sk)->write_queue_rb);
+}
+
+static inline void tcp_write_queue_purge(struct sock *sk)
+{
+	sk_stream_writequeue_purge(sk);
+	tcp_sk(sk)->write_queue_rb = RB_ROOT;
+}
+
+/* Sent skbs carry a running packet index, so the number of packets
+ * between the head of the retransmit queue and any skb (its "fack
+ * count") is known without counting.  The index of an skb is that of its
+ * predecessor plus the predecessor's packet count; it is assigned when
+ * the skb is first transmitted.
+ */
+static inline void tcp_skb_set_pkt_idx(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *prev = skb->prev;
+
+	if (prev == (struct sk_buff *)&sk->sk_write_queue)
+		TCP_SKB_CB(skb)->pkt_idx = 0;
+	else
+		TCP_SKB_CB(skb)->pkt_idx = TCP_SKB_CB(prev)->pkt_idx +
+					   tcp_skb_pcount(prev);
+}
+
+/* Packets from the head of the retransmit queue up to and including skb. */
+static inline u32 tcp_skb_fack_count(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *head = skb_peek(&sk->sk_write_queue);
+
+	return TCP_SKB_CB(skb)->pkt_idx + tcp_skb_pcount(skb) -
+	       TCP_SKB_CB(head)->pkt_idx;
+}
+
+/* Forget the SACK blocks remembered from the previous ACK.  Needed
+ * whenever SACK tags are cleared or the retransmit queue is resegmented,
+ * as tcp_sacktag_write_queue() trusts that everything wholly inside
+ * those blocks is already tagged.
+ */
+static inline void tcp_clear_sack_cache(struct tcp_sock *tp)
+{
+	memset(tp->recv_sack_cache, 0, sizeof(tp->recv_sack_cache));
+}
+
 /* This determines how many packets are "in the network" to the best
  * of our knowledge.  In many cases it is conservative, but where
  * detailed information is available from the receiver (via SACK
@@ -1224,90 +1332,85 @@ static __inline__ unsigned int tcp_packets_in_flight(const struct tcp_sock *tp)
 }
 
 /*
- * Which congestion algorithim is in use on the connection.
+ * Interface for adding new TCP congestion control handlers
  */
-#define tcp_is_vegas(__tp)	((__tp)->adv_cong == TCP_VEGAS)
-#define tcp_is_westwood(__tp)	((__tp)->adv_cong == TCP_WESTWOOD)
-#define tcp_is_bic(__tp)	((__tp)->adv_cong == TCP_BIC)
+#define TCP_CA_NAME_MAX	16
+
+/* Events passed to the congestion control handler via cwnd_event(). */
+enum tcp_ca_event {
+	CA_EVENT_TX_START,	/* first transmit when no packets in flight */
+	CA_EVENT_CWND_RESTART,	/* congestion window restart after idle */
+	CA_EVENT_COMPLETE_CWR,	/* end of congestion recovery */
+	CA_EVENT_FRTO,		/* fast recovery timeout */
+	CA_EVENT_FAST_ACK,	/* in sequence ack, header prediction hit */
+	CA_EVENT_SLOW_ACK,	/* ack processed on the slow path */
+};
 
-/* Recalculate snd_ssthresh, we want to set it to:
- *
- * Reno:
- * 	one half the current congestion window, but no
- *	less than two segments
- *
- * BIC:
- *	behave like Reno until low_window is reached,
- *	then increase congestion window slowly
- */
-static inline __u32 tcp_recalc_ssthresh(struct tcp_sock *tp)
-{
-	if (tcp_is_bic(tp)) {
-		if (sysctl_tcp_bic_fast_convergence &&
-		    tp->snd_cwnd < tp->bictcp.last_max_cwnd)
-			tp->bictcp.last_max_cwnd = (tp->snd_cwnd * 
-						    (BICTCP_BETA_SCALE
-						     + sysctl_tcp_bic_beta))
-				/ (2 * BICTCP_BETA_SCALE);
-		else
-			tp->bictcp.last_max_cwnd = tp->snd_cwnd;
+struct tcp_congestion_ops {
+	struct list_head	list;
+
+	/* initialize private data (optional) */
+	void (*init)(struct tcp_sock *tp);
+	/* cleanup private data  (optional) */
+	void (*release)(struct tcp_sock *tp);
+
+	/* return slow start threshold (required) */
+	u32 (*ssthresh)(struct tcp_sock *tp);
+	/* lower bound for congestion window (optional) */
+	u32 (*min_cwnd)(struct tcp_sock *tp);
+	/* do new cwnd calculation (required) */
+	void (*cong_avoid)(struct tcp_sock *tp, u32 ack,
+			   u32 rtt, u32 in_flight, int good_ack);
+	/* round trip time sample in jiffies (optional) */
+	void (*rtt_sample)(struct tcp_sock *tp, u32 rtt);
+	/* call before changing ca_state (optional) */
+	void (*set_state)(struct tcp_sock *tp, u8 new_state);
+	/* call when cwnd event occurs (optional) */
+	void (*cwnd_event)(struct tcp_sock *tp, enum tcp_ca_event ev);
+	/* new value of cwnd after loss (optional) */
+	u32  (*undo_cwnd)(struct tcp_sock *tp);
+	/* get info for tcp_diag (optional) */
+	void (*get_info)(struct tcp_sock *tp, u32 ext, struct sk_buff *skb);
+
+	char 		name[TCP_CA_NAME_MAX];
+	struct module 	*owner;
+};
 
-		if (tp->snd_cwnd > sysctl_tcp_bic_low_window)
-			return max((tp->snd_cwnd * sysctl_tcp_bic_beta)
-				   / BICTCP_BETA_SCALE, 2U);
-	}
+extern int tcp_register_congestion_control(struct tcp_congestion_ops *type);
+extern void tcp_unregister_congestion_control(struct tcp_congestion_ops *type);
 
-	return max(tp->snd_cwnd >> 1U, 2U);
-}
+extern void tcp_init_congestion_control(struct tcp_sock *tp);
+extern void tcp_cleanup_congestion_control(struct tcp_sock *tp);
+extern int tcp_set_default_congestion_control(const char *name);
+extern void tcp_get_default_congestion_control(char *name);
+extern int tcp_set_congestion_control(struct tcp_sock *tp, const char *name);
 
-/* Stop taking Vegas samples for now. */
-#define tcp_vegas_disable(__tp)	((__tp)->vegas.doing_vegas_now = 0)
-    
-static inline void tcp_vegas_enable(struct tcp_sock *tp)
-{
-	/* There are several situations when we must "re-start" Vegas:
-	 *
-	 *  o when a connection is established
-	 *  o after an RTO
-	 *  o after fast recovery
-	 *  o when we send a packet and there is no outstanding
-	 *    unacknowledged data (restarting an idle connection)
-	 *
-	 * In these circumstances we cannot do a Vegas calculation at the
-	 * end of the first RTT, because any calculation we do is using
-	 * stale info -- both the saved cwnd and congestion feedback are
-	 * stale.
-	 *
-	 * Instead we must wait until the completion of an RTT during
-	 * which we actually receive ACKs.
-	 */
-    
-	/* Begin taking Vegas samples next time we send something. */
-	tp->vegas.doing_vegas_now = 1;
-     
-	/* Set the beginning of the next send window. */
-	tp->vegas.beg_snd_nxt = tp->snd_nxt;
+extern struct tcp_congestion_ops tcp_init_congestion_ops;
+extern u32 tcp_reno_ssthresh(struct tcp_sock *tp);
+extern void tcp_reno_cong_avoid(struct tcp_sock *tp, u32 ack,
+				u32 rtt, u32 in_flight, int good_ack);
+extern u32 tcp_reno_min_cwnd(struct tcp_sock *tp);
+extern struct tcp_congestion_ops tcp_reno;
 
-	tp->vegas.cntRTT = 0;
-	tp->vegas.minRTT = 0x7fffffff;
+/* Private state of the congestion control handler, up to TCP_CA_PRIV_SIZE */
+static inline void *tcp_ca(const struct tcp_sock *tp)
+{
+	return (void *) tp->ca_priv;
 }
 
-/* Should we be taking Vegas samples right now? */
-#define tcp_vegas_enabled(__tp)	((__tp)->vegas.doing_vegas_now)
-
-extern void tcp_ca_init(struct tcp_sock *tp);
-
 static inline void tcp_set_ca_state(struct tcp_sock *tp, u8 ca_state)
 {
-	if (tcp_is_vegas(tp)) {
-		if (ca_state == TCP_CA_Open) 
-			tcp_vegas_enable(tp);
-		else
-			tcp_vegas_disable(tp);
-	}
+	if (tp->ca_ops->set_state)
+		tp->ca_ops->set_state(tp, ca_state);
 	tp->ca_state = ca_state;
 }
 
+static inline void tcp_ca_event(struct tcp_sock *tp, enum tcp_ca_event event)
+{
+	if (tp->ca_ops->cwnd_event)
+		tp->ca_ops->cwnd_event(tp, event);
+}
+
 /* If cwnd > ssthresh, we may raise ssthresh to be half-way to cwnd.
  * The exception is rate halving phase, when cwnd is decreasing towards
  * ssthresh.
@@ -1356,7 +1459,7 @@ static inline void tcp_cwnd_validate(struct sock *sk, struct tcp_sock *tp)
 static inline void __tcp_enter_cwr(struct tcp_sock *tp)
 {
 	tp->undo_marker = 0;
-	tp->snd_ssthresh = tcp_recalc_ssthresh(tp);
+	tp->snd_ssthresh = tp->ca_ops->ssthresh(tp);
 	tp->snd_cwnd = min(tp->snd_cwnd,
 			   tcp_packets_in_flight(tp) + 1U);
 	tp->snd_cwnd_cnt = 0;
@@ -1914,6 +2017,8 @@ static inline int tcp_paws_check(const struct tcp_options_received *rx_opt, int
 static inline void tcp_v4_setup_caps(struct sock *sk, struct dst_entry *dst)
 {
 	sk->sk_route_caps = dst->dev->features;
+	if (sk->sk_route_caps & NETIF_F_GSO)
+		sk->sk_route_caps |= NETIF_F_TSO;
 	if (sk->sk_route_caps & NETIF_F_TSO) {
 		if (sock_flag(sk, SOCK_NO_LARGESEND) || dst->header_len)
 			sk->sk_route_caps &= ~NETIF_F_TSO;
@@ -1970,53 +2075,4 @@ struct tcp_iter_state {
 
 extern int tcp_proc_register(struct tcp_seq_afinfo *afinfo);
 extern void tcp_proc_unregister(struct tcp_seq_afinfo *afinfo);
-
-/* TCP Westwood functions and constants */
-
-#define TCP_WESTWOOD_INIT_RTT  (20*HZ)           /* maybe too conservative?! */
-#define TCP_WESTWOOD_RTT_MIN   (HZ/20)           /* 50ms */
-
-static inline void tcp_westwood_update_rtt(struct tcp_sock *tp, __u32 rtt_seq)
-{
-        if (tcp_is_westwood(tp))
-                tp->westwood.rtt = rtt_seq;
-}
-
-static inline __u32 __tcp_westwood_bw_rttmin(const struct tcp_sock *tp)
-{
-        return max((tp->westwood.bw_est) * (tp->westwood.rtt_min) /
-		   (__u32) (tp->mss_cache_std),
-		   2U);
-}
-
-static inline __u32 tcp_westwood_bw_rttmin(const struct tcp_sock *tp)
-{
-	return tcp_is_westwood(tp) ? __tcp_westwood_bw_rttmin(tp) : 0;
-}
-
-static inline int tcp_westwood_ssthresh(struct tcp_sock *tp)
-{
-	__u32 ssthresh = 0;
-
-	if (tcp_is_westwood(tp)) {
-		ssthresh = __tcp_westwood_bw_rttmin(tp);
-		if (ssthresh)
-			tp->snd_ssthresh = ssthresh;  
-	}
-
-	return (ssthresh != 0);
-}
-
-static inline int tcp_westwood_cwnd(struct tcp_sock *tp)
-{
-	__u32 cwnd = 0;
-
-	if (tcp_is_westwood(tp)) {
-		cwnd = __tcp_westwood_bw_rttmin(tp);
-		if (cwnd)
-			tp->snd_cwnd = cwnd;
-	}
-
-	return (cwnd != 0);
-}
 #endif	/* _TCP_H */
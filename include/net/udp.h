@@ -25,32 +25,67 @@
 #include <linux/udp.h>
 #include <linux/ip.h>
 #include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/jhash.h>
 #include <net/sock.h>
 #include <net/snmp.h>
 #include <linux/seq_file.h>
 
-#define UDP_HTABLE_SIZE		128
+/* Smallest table, whatever the size of memory or uhash_entries= */
+#define UDP_HTABLE_SIZE_MIN	256
 
-/* udp.c: This needs to be shared by v4 and v6 because the lookup
- *        and hashing code needs to work with different AF's yet
- *        the port space is shared.
+/*
+ * A slot of the UDP hash tables.  Sockets are added and removed under
+ * the lock, and found under RCU only.  Removing one bumps the sequence
+ * count, so that a lookup which was walking past it and may have been
+ * cut short knows to walk the chain again.
  */
-extern struct hlist_head udp_hash[UDP_HTABLE_SIZE];
-extern rwlock_t udp_hash_lock;
+struct udp_hslot {
+	struct hlist_head	head;
+	int			count;
+	seqcount_t		seq;
+	spinlock_t		lock;
+};
 
-extern int udp_port_rover;
+/*
+ * udp.c: This needs to be shared by v4 and v6 because the lookup
+ * and hashing code needs to work with different AF's yet the port
+ * space is shared.
+ *
+ * Each bound socket is in two tables of mask + 1 slots, sized at boot:
+ * hash by local port through sk_node, and hash2 by local port and bound
+ * address through sk_bind_node.  The slot of a socket in hash2 is kept
+ * in sk_hashent.  Writers take the hash slot's lock, then the hash2
+ * slot's.
+ */
+struct udp_table {
+	struct udp_hslot	*hash;
+	struct udp_hslot	*hash2;
+	unsigned int		mask;
+	unsigned int		log;
+};
+extern struct udp_table udp_table;
 
-static inline int udp_lport_inuse(u16 num)
+static inline struct udp_hslot *udp_hashslot(unsigned int num)
 {
-	struct sock *sk;
-	struct hlist_node *node;
+	return &udp_table.hash[num & udp_table.mask];
+}
 
-	sk_for_each(sk, node, &udp_hash[num & (UDP_HTABLE_SIZE - 1)])
-		if (inet_sk(sk)->num == num)
-			return 1;
-	return 0;
+static inline unsigned int udp_hash2fn(u32 addr, unsigned int num)
+{
+	return (jhash_1word(addr, 0) ^ num) & udp_table.mask;
 }
 
+extern int udp_port_rover;
+
+extern int udp_lib_get_port(struct sock *sk, unsigned short snum,
+			    int (*saddr_cmp)(const struct sock *sk1,
+					     const struct sock *sk2));
+extern void udp_lib_unhash(struct sock *sk);
+extern void udp_lib_rehash(struct sock *sk);
+extern void udp_table_init(void);
+
 /* Note: this must match 'valbool' in sock_setsockopt */
 #define UDP_CSUM_NOXMIT		1
 
@@ -185,8 +185,6 @@ struct xfrm_tmpl;
 struct xfrm_state_afinfo {
 	unsigned short		family;
 	rwlock_t		lock;
-	struct list_head	*state_bydst;
-	struct list_head	*state_byspi;
 	void			(*init_tempsel)(struct xfrm_state *x, struct flowi *fl,
 						struct xfrm_tmpl *tmpl,
 						xfrm_address_t *daddr, xfrm_address_t *saddr);
@@ -211,6 +209,11 @@ struct xfrm_type
 	int			(*init_state)(struct xfrm_state *x, void *args);
 	void			(*destructor)(struct xfrm_state *);
 	int			(*input)(struct xfrm_state *, struct xfrm_decap_state *, struct sk_buff *skb);
+	/* Optional, for the first state of a tunnel mode packet with
+	 * XFRM_STATE_PARALLEL: like input, but may return -EINPROGRESS
+	 * and finish the packet later with xfrm4_rcv_resume(). output
+	 * may likewise finish with xfrm4_output_resume(). */
+	int			(*input_parallel)(struct xfrm_state *, struct xfrm_decap_state *, struct sk_buff *skb);
 	int			(*post_input)(struct xfrm_state *, struct xfrm_decap_state *, struct sk_buff *skb);
 	int			(*output)(struct xfrm_state *, struct sk_buff *pskb);
 	/* Estimate maximal size of result of transformation of a dgram */
@@ -263,6 +266,7 @@ struct xfrm_policy
 {
 	struct xfrm_policy	*next;
 	struct list_head	list;
+	struct list_head	bydst;		/* In its selector's zone */
 
 	/* This lock only affects elements except for entry. */
 	rwlock_t		lock;
@@ -271,6 +275,7 @@ struct xfrm_policy
 
 	u32			priority;
 	u32			index;
+	u32			pos;		/* Order among equal priorities */
 	struct xfrm_selector	selector;
 	struct xfrm_lifetime_cfg lft;
 	struct xfrm_lifetime_cur curlft;
@@ -316,14 +321,18 @@ static inline void xfrm_pol_put(struct xfrm_policy *policy)
 		__xfrm_policy_destroy(policy);
 }
 
-#define XFRM_DST_HSIZE		1024
+/* The state hashes, sized to the number of states; only to be looked
+   at under xfrm_state_lock. */
+extern struct list_head *xfrm_state_bydst;
+extern struct list_head *xfrm_state_byspi;
+extern unsigned int xfrm_state_hmask;
 
 static __inline__
 unsigned __xfrm4_dst_hash(xfrm_address_t *addr)
 {
 	unsigned h;
 	h = ntohl(addr->a4);
-	h = (h ^ (h>>16)) % XFRM_DST_HSIZE;
+	h = (h ^ (h>>16)) & xfrm_state_hmask;
 	return h;
 }
 
@@ -332,7 +341,7 @@ unsigned __xfrm6_dst_hash(xfrm_address_t *addr)
 {
 	unsigned h;
 	h = ntohl(addr->a6[2]^addr->a6[3]);
-	h = (h ^ (h>>16)) % XFRM_DST_HSIZE;
+	h = (h ^ (h>>16)) & xfrm_state_hmask;
 	return h;
 }
 
@@ -353,7 +362,7 @@ unsigned __xfrm4_spi_hash(xfrm_address_t *addr, u32 spi, u8 proto)
 {
 	unsigned h;
 	h = ntohl(addr->a4^spi^proto);
-	h = (h ^ (h>>10) ^ (h>>20)) % XFRM_DST_HSIZE;
+	h = (h ^ (h>>10) ^ (h>>20)) & xfrm_state_hmask;
 	return h;
 }
 
@@ -362,7 +371,7 @@ unsigned __xfrm6_spi_hash(xfrm_address_t *addr, u32 spi, u8 proto)
 {
 	unsigned h;
 	h = ntohl(addr->a6[2]^addr->a6[3]^spi^proto);
-	h = (h ^ (h>>10) ^ (h>>20)) % XFRM_DST_HSIZE;
+	h = (h ^ (h>>10) ^ (h>>20)) & xfrm_state_hmask;
 	return h;
 }
 
@@ -812,7 +821,10 @@ extern void xfrm_replay_advance(struct xfrm_state *x, u32 seq);
 extern int xfrm_state_check(struct xfrm_state *x, struct sk_buff *skb);
 extern int xfrm_state_mtu(struct xfrm_state *x, int mtu);
 extern int xfrm4_rcv(struct sk_buff *skb);
+extern void xfrm4_rcv_resume(struct xfrm_state *x, struct xfrm_decap_state *decap,
+			     struct sk_buff *skb, u32 seq, int err);
 extern int xfrm4_output(struct sk_buff *skb);
+extern int xfrm4_output_resume(struct sk_buff *skb, int err);
 extern int xfrm4_tunnel_register(struct xfrm_tunnel *handler);
 extern int xfrm4_tunnel_deregister(struct xfrm_tunnel *handler);
 extern int xfrm6_rcv_spi(struct sk_buff **pskb, unsigned int *nhoffp, u32 spi);
@@ -868,6 +880,35 @@ extern wait_queue_head_t km_waitq;
 extern int km_new_mapping(struct xfrm_state *x, xfrm_address_t *ipaddr, u16 sport);
 extern void km_policy_expired(struct xfrm_policy *pol, int dir, int hard);
 
+#ifdef CONFIG_XFRM_PARALLEL
+/* One packet's worth of work for xfrm_parallel_submit(): work is run
+ * in process context on job->cpu, done in submission order with BHs
+ * disabled. */
+struct xfrm_pjob
+{
+	struct list_head	list;
+	struct xfrm_parallel	*par;
+	u32			seq;
+	int			cpu;
+	int			err;
+	void			(*work)(struct xfrm_pjob *job);
+	void			(*done)(struct xfrm_pjob *job);
+};
+
+struct xfrm_parallel
+{
+	spinlock_t		lock;
+	u32			next_seq;	/* of the next job submitted */
+	u32			done_seq;	/* of the next job to be done */
+	int			cpu;		/* the last job went to */
+	int			draining;
+	struct list_head	reorder;	/* worked, waiting their turn */
+};
+
+extern int xfrm_parallel_init(struct xfrm_parallel *par);
+extern int xfrm_parallel_submit(struct xfrm_parallel *par, struct xfrm_pjob *job);
+#endif
+
 extern void xfrm_input_init(void);
 extern int xfrm_parse_spi(struct sk_buff *skb, u8 nexthdr, u32 *spi, u32 *seq);
 
@@ -47,6 +47,7 @@
 #include <linux/rmap.h>
 #include <linux/mempolicy.h>
 #include <linux/key.h>
+#include <linux/device.h>
 
 #include <asm/io.h>
 #include <asm/bugs.h>
@@ -466,6 +467,7 @@ asmlinkage void __init start_kernel(void)
 	init_IRQ();
 	pidhash_init();
 	init_timers();
+	hrtimers_init();
 	softirq_init();
 	time_init();
 
@@ -669,6 +671,9 @@ static int init(void * unused)
 
 	do_basic_setup();
 
+	/* The root device may still be being probed */
+	wait_for_device_probe();
+
 	/*
 	 * check if there is an early userspace init.  If yes, let it do all
 	 * the work
@@ -23,6 +23,7 @@
 #include <linux/skbuff.h>
 #include <linux/netlink.h>
 #include <linux/syscalls.h>
+#include <linux/rbtree.h>
 #include <net/sock.h>
 #include "util.h"
 
@@ -46,7 +47,7 @@
 /* default values */
 #define DFLT_QUEUESMAX	256	/* max number of message queues */
 #define DFLT_MSGMAX 	10	/* max number of messages in each queue */
-#define HARD_MSGMAX 	(131072/sizeof(void*))
+#define HARD_MSGMAX 	65536
 #define DFLT_MSGSIZEMAX 8192	/* max message size */
 
 #define NOTIFY_COOKIE_LEN	32
@@ -58,12 +59,25 @@ struct ext_wait_queue {		/* queue of sleeping tasks */
 	int state;		/* one of STATE_* values */
 };
 
+/*
+ * The messages of one priority, oldest first.  A queue keeps one of
+ * these per priority it holds messages of, in an rbtree by priority, so
+ * that send and receive are O(log P) in the number of priorities in use
+ * rather than O(n) in the number of messages.
+ */
+struct posix_msg_tree_node {
+	struct rb_node rb_node;
+	struct list_head msg_list;
+	int priority;
+};
+
 struct mqueue_inode_info {
 	spinlock_t lock;
 	struct inode vfs_inode;
 	wait_queue_head_t wait_q;
 
-	struct msg_msg **messages;
+	struct rb_root msg_tree;
+	struct posix_msg_tree_node *node_cache;	/* spare node, or NULL */
 	struct mq_attr attr;
 
 	struct sigevent notify;
@@ -99,6 +113,19 @@ static inline struct mqueue_inode_info *MQUEUE_I(struct inode *inode)
 	return container_of(inode, struct mqueue_inode_info, vfs_inode);
 }
 
+/*
+ * What a queue is charged against RLIMIT_MSGQUEUE: its messages when
+ * full, and a tree node for each priority they can be spread over.
+ */
+static unsigned long mq_queue_bytes(struct mq_attr *attr)
+{
+	unsigned long nodes = min_t(unsigned long, attr->mq_maxmsg,
+				    MQ_PRIO_MAX);
+
+	return attr->mq_maxmsg * (sizeof(struct msg_msg) + attr->mq_msgsize) +
+	       nodes * sizeof(struct posix_msg_tree_node);
+}
+
 static struct inode *mqueue_get_inode(struct super_block *sb, int mode,
 							struct mq_attr *attr)
 {
@@ -118,7 +145,7 @@ static struct inode *mqueue_get_inode(struct super_block *sb, int mode,
 			struct mqueue_inode_info *info;
 			struct task_struct *p = current;
 			struct user_struct *u = p->user;
-			unsigned long mq_bytes, mq_msg_tblsz;
+			unsigned long mq_bytes;
 
 			inode->i_fop = &mqueue_file_operations;
 			inode->i_size = FILENT_SIZE;
@@ -128,7 +155,8 @@ static struct inode *mqueue_get_inode(struct super_block *sb, int mode,
 			init_waitqueue_head(&info->wait_q);
 			INIT_LIST_HEAD(&info->e_wait_q[0].list);
 			INIT_LIST_HEAD(&info->e_wait_q[1].list);
-			info->messages = NULL;
+			info->msg_tree = RB_ROOT;
+			info->node_cache = NULL;
 			info->notify_owner = 0;
 			info->qsize = 0;
 			info->user = NULL;	/* set when all is ok */
@@ -139,9 +167,7 @@ static struct inode *mqueue_get_inode(struct super_block *sb, int mode,
 				info->attr.mq_maxmsg = attr->mq_maxmsg;
 				info->attr.mq_msgsize = attr->mq_msgsize;
 			}
-			mq_msg_tblsz = info->attr.mq_maxmsg * sizeof(struct msg_msg *);
-			mq_bytes = (mq_msg_tblsz +
-				(info->attr.mq_maxmsg * info->attr.mq_msgsize));
+			mq_bytes = mq_queue_bytes(&info->attr);
 
 			spin_lock(&mq_lock);
 			if (u->mq_bytes + mq_bytes < u->mq_bytes ||
@@ -153,13 +179,6 @@ static struct inode *mqueue_get_inode(struct super_block *sb, int mode,
 			u->mq_bytes += mq_bytes;
 			spin_unlock(&mq_lock);
 
-			info->messages = kmalloc(mq_msg_tblsz, GFP_KERNEL);
-			if (!info->messages) {
-				spin_lock(&mq_lock);
-				u->mq_bytes -= mq_bytes;
-				spin_unlock(&mq_lock);
-				goto out_inode;
-			}
 			/* all is ok */
 			info->user = get_uid(u);
 		} else if (S_ISDIR(mode)) {
@@ -235,7 +254,7 @@ static void mqueue_delete_inode(struct inode *inode)
 	struct mqueue_inode_info *info;
 	struct user_struct *user;
 	unsigned long mq_bytes;
-	int i;
+	struct rb_node *p;
 
 	if (S_ISDIR(inode->i_mode)) {
 		clear_inode(inode);
@@ -243,15 +262,23 @@ static void mqueue_delete_inode(struct inode *inode)
 	}
 	info = MQUEUE_I(inode);
 	spin_lock(&info->lock);
-	for (i = 0; i < info->attr.mq_curmsgs; i++)
-		free_msg(info->messages[i]);
-	kfree(info->messages);
+	while ((p = rb_first(&info->msg_tree)) != NULL) {
+		struct posix_msg_tree_node *leaf;
+		struct msg_msg *msg, *n;
+
+		leaf = rb_entry(p, struct posix_msg_tree_node, rb_node);
+		list_for_each_entry_safe(msg, n, &leaf->msg_list, m_list)
+			free_msg(msg);
+		rb_erase(p, &info->msg_tree);
+		kfree(leaf);
+	}
+	kfree(info->node_cache);
+	info->node_cache = NULL;
 	spin_unlock(&info->lock);
 
 	clear_inode(inode);
 
-	mq_bytes = (info->attr.mq_maxmsg * sizeof(struct msg_msg *) +
-		   (info->attr.mq_maxmsg * info->attr.mq_msgsize));
+	mq_bytes = mq_queue_bytes(&info->attr);
 	user = info->user;
 	if (user) {
 		spin_lock(&mq_lock);
@@ -461,25 +488,94 @@ static struct ext_wait_queue *wq_get_first_waiter(
 	return list_entry(ptr, struct ext_wait_queue, list);
 }
 
-/* Auxiliary functions to manipulate messages' list */
-static void msg_insert(struct msg_msg *ptr, struct mqueue_inode_info *info)
+/*
+ * Auxiliary functions to manipulate messages' tree.  A message goes at
+ * the tail of the list of its priority, and is received from the head
+ * of the highest one.  The node for a new priority is the spare one
+ * the caller put in node_cache before taking info->lock, if it is
+ * there; an emptied node is kept as the spare.
+ */
+static int msg_insert(struct msg_msg *ptr, struct mqueue_inode_info *info)
 {
-	int k;
-
-	k = info->attr.mq_curmsgs - 1;
-	while (k >= 0 && info->messages[k]->m_type >= ptr->m_type) {
-		info->messages[k + 1] = info->messages[k];
-		k--;
+	struct rb_node **p = &info->msg_tree.rb_node;
+	struct rb_node *parent = NULL;
+	struct posix_msg_tree_node *leaf;
+
+	while (*p) {
+		parent = *p;
+		leaf = rb_entry(parent, struct posix_msg_tree_node, rb_node);
+
+		if (likely(leaf->priority == ptr->m_type))
+			goto insert_msg;
+		else if (ptr->m_type < leaf->priority)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
 	}
+	if (info->node_cache) {
+		leaf = info->node_cache;
+		info->node_cache = NULL;
+	} else {
+		leaf = kmalloc(sizeof(*leaf), GFP_ATOMIC);
+		if (!leaf)
+			return -ENOMEM;
+	}
+	leaf->priority = ptr->m_type;
+	INIT_LIST_HEAD(&leaf->msg_list);
+	rb_link_node(&leaf->rb_node, parent, p);
+	rb_insert_color(&leaf->rb_node, &info->msg_tree);
+insert_msg:
 	info->attr.mq_curmsgs++;
 	info->qsize += ptr->m_ts;
-	info->messages[k + 1] = ptr;
+	list_add_tail(&ptr->m_list, &leaf->msg_list);
+	return 0;
 }
 
-static inline struct msg_msg *msg_get(struct mqueue_inode_info *info)
+static struct msg_msg *msg_get(struct mqueue_inode_info *info)
 {
-	info->qsize -= info->messages[--info->attr.mq_curmsgs]->m_ts;
-	return info->messages[info->attr.mq_curmsgs];
+	struct rb_node *parent;
+	struct posix_msg_tree_node *leaf;
+	struct msg_msg *msg;
+
+	parent = rb_last(&info->msg_tree);
+	BUG_ON(!parent);
+	leaf = rb_entry(parent, struct posix_msg_tree_node, rb_node);
+	msg = list_entry(leaf->msg_list.next, struct msg_msg, m_list);
+	list_del(&msg->m_list);
+	if (list_empty(&leaf->msg_list)) {
+		rb_erase(&leaf->rb_node, &info->msg_tree);
+		if (info->node_cache)
+			kfree(leaf);
+		else
+			info->node_cache = leaf;
+	}
+	info->attr.mq_curmsgs--;
+	info->qsize -= msg->m_ts;
+	return msg;
+}
+
+/*
+ * Get a spare tree node for msg_insert() while we may still sleep.
+ * Called without info->lock; mq_put_node_cache() under it installs the
+ * node, or hands it back to be freed if another task got there first.
+ */
+static inline struct posix_msg_tree_node *
+mq_alloc_node(struct mqueue_inode_info *info)
+{
+	if (info->node_cache)
+		return NULL;
+	return kmalloc(sizeof(struct posix_msg_tree_node), GFP_KERNEL);
+}
+
+static inline struct posix_msg_tree_node *
+mq_put_node_cache(struct mqueue_inode_info *info,
+		  struct posix_msg_tree_node *node)
+{
+	if (node && !info->node_cache) {
+		info->node_cache = node;
+		return NULL;
+	}
+	return node;
 }
 
 static inline void set_cookie(struct sk_buff *skb, char code)
@@ -582,11 +678,9 @@ static int mq_attr_ok(struct mq_attr *attr)
 			return 0;
 	}
 	/* check for overflow */
-	if (attr->mq_msgsize > ULONG_MAX/attr->mq_maxmsg)
-		return 0;
-	if ((unsigned long)(attr->mq_maxmsg * attr->mq_msgsize) +
-	    (attr->mq_maxmsg * sizeof (struct msg_msg *)) <
-	    (unsigned long)(attr->mq_maxmsg * attr->mq_msgsize))
+	if (attr->mq_msgsize > (ULONG_MAX - MQ_PRIO_MAX *
+				sizeof(struct posix_msg_tree_node)) /
+			       attr->mq_maxmsg - sizeof(struct msg_msg))
 		return 0;
 	return 1;
 }
@@ -772,7 +866,9 @@ static inline void pipelined_send(struct mqueue_inode_info *info,
 }
 
 /* pipelined_receive() - if there is task waiting in sys_mq_timedsend()
- * gets its message and put to the queue (we have one free place for sure). */
+ * gets its message and put to the queue (we have one free place for sure).
+ * Should there be no tree node for it, the sender sleeps on until the
+ * next receive tries again. */
 static inline void pipelined_receive(struct mqueue_inode_info *info)
 {
 	struct ext_wait_queue *sender = wq_get_first_waiter(info, SEND);
@@ -782,7 +878,8 @@ static inline void pipelined_receive(struct mqueue_inode_info *info)
 		wake_up_interruptible(&info->wait_q);
 		return;
 	}
-	msg_insert(sender->msg, info);
+	if (msg_insert(sender->msg, info))
+		return;
 	list_del(&sender->list);
 	sender->state = STATE_PENDING;
 	wake_up_process(sender->task);
@@ -800,6 +897,7 @@ asmlinkage long sys_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 	struct ext_wait_queue *receiver;
 	struct msg_msg *msg_ptr;
 	struct mqueue_inode_info *info;
+	struct posix_msg_tree_node *new_leaf;
 	long timeout;
 	int ret;
 
@@ -835,8 +933,10 @@ asmlinkage long sys_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 	}
 	msg_ptr->m_ts = msg_len;
 	msg_ptr->m_type = msg_prio;
+	new_leaf = mq_alloc_node(info);
 
 	spin_lock(&info->lock);
+	new_leaf = mq_put_node_cache(info, new_leaf);
 
 	if (info->attr.mq_curmsgs == info->attr.mq_maxmsg) {
 		if (filp->f_flags & O_NONBLOCK) {
@@ -855,18 +955,23 @@ asmlinkage long sys_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 			free_msg(msg_ptr);
 	} else {
 		receiver = wq_get_first_waiter(info, RECV);
+		ret = 0;
 		if (receiver) {
 			pipelined_send(info, msg_ptr, receiver);
 		} else {
 			/* adds message to the queue */
-			msg_insert(msg_ptr, info);
-			__do_notify(info);
+			ret = msg_insert(msg_ptr, info);
+			if (!ret)
+				__do_notify(info);
 		}
-		inode->i_atime = inode->i_mtime = inode->i_ctime =
-				CURRENT_TIME;
+		if (!ret)
+			inode->i_atime = inode->i_mtime = inode->i_ctime =
+					CURRENT_TIME;
 		spin_unlock(&info->lock);
-		ret = 0;
+		if (ret)
+			free_msg(msg_ptr);
 	}
+	kfree(new_leaf);
 out_fput:
 	fput(filp);
 out:
@@ -884,6 +989,7 @@ asmlinkage ssize_t sys_mq_timedreceive(mqd_t mqdes, char __user *u_msg_ptr,
 	struct inode *inode;
 	struct mqueue_inode_info *info;
 	struct ext_wait_queue wait;
+	struct posix_msg_tree_node *new_leaf;
 
 	timeout = prepare_timeout(u_abs_timeout);
 
@@ -906,7 +1012,11 @@ asmlinkage ssize_t sys_mq_timedreceive(mqd_t mqdes, char __user *u_msg_ptr,
 		goto out_fput;
 	}
 
+	/* for the message of a sender pipelined_receive() wakes */
+	new_leaf = mq_alloc_node(info);
+
 	spin_lock(&info->lock);
+	new_leaf = mq_put_node_cache(info, new_leaf);
 	if (info->attr.mq_curmsgs == 0) {
 		if (filp->f_flags & O_NONBLOCK) {
 			spin_unlock(&info->lock);
@@ -933,6 +1043,7 @@ asmlinkage ssize_t sys_mq_timedreceive(mqd_t mqdes, char __user *u_msg_ptr,
 		spin_unlock(&info->lock);
 		ret = 0;
 	}
+	kfree(new_leaf);
 	if (ret == 0) {
 		ret = msg_ptr->m_ts;
 
@@ -61,6 +61,7 @@
  * (c) 2001 Red Hat Inc <alan@redhat.com>
  * Lockless wakeup
  * (c) 2003 Manfred Spraul <manfred@colorfullife.com>
+ * Per-semaphore locks and queues for single operations, deferred wakeup
  */
 
 #include <linux/config.h>
@@ -77,7 +78,6 @@
 #include "util.h"
 
 
-#define sem_lock(id)	((struct sem_array*)ipc_lock(&sem_ids,id))
 #define sem_unlock(sma)	ipc_unlock(&(sma)->sem_perm)
 #define sem_rmid(id)	((struct sem_array*)ipc_rmid(&sem_ids,id))
 #define sem_checkid(sma, semid)	\
@@ -98,10 +98,20 @@ static int sysvipc_sem_read_proc(char *buffer, char **start, off_t offset, int l
 /*
  * linked list protection:
  *	sem_undo.id_next,
- *	sem_array.sem_pending{,last},
+ *	sem_array.sem_pending,
  *	sem_array.sem_undo: sem_lock() for read/write
+ *	sem.sem_pending: sem.lock, or sem_lock()
  *	sem_undo.proc_next: only "current" is allowed to read/write that field.
- *	
+ *
+ * Locking:
+ * sem_lock() takes the array lock and then waits until no semaphore
+ * lock is held, which gives it the whole array.  A semop() of a single
+ * operation that finds no multi-sop operation pending only takes the
+ * lock of its semaphore, as long as nobody holds the array lock: its
+ * pending operations all sit on that semaphore's sem_pending, so
+ * nothing else needs to be looked at.  Multi-sop operations wait on
+ * sem_array.sem_pending, counted in complex_count, and while there
+ * are any every semop() takes the array lock.
  */
 
 int sem_ctls[4] = {SEMMSL, SEMMNS, SEMOPM, SEMMNI};
@@ -112,6 +122,77 @@ int sem_ctls[4] = {SEMMSL, SEMMNS, SEMOPM, SEMMNI};
 
 static int used_sems;
 
+/* Wait for the holders of semaphore locks to go, with the array lock held */
+static void sem_wait_array(struct sem_array *sma)
+{
+	int i;
+
+	/* Pairs with the barrier in sem_lock_sops() */
+	smp_mb();
+	for (i = 0; i < sma->sem_nsems; i++)
+		spin_unlock_wait(&sma->sem_base[i].lock);
+}
+
+static inline struct sem_array *sem_lock(int id)
+{
+	struct sem_array *sma = (struct sem_array *)ipc_lock(&sem_ids, id);
+
+	if (sma)
+		sem_wait_array(sma);
+	return sma;
+}
+
+static inline void sem_lock_by_ptr(struct sem_array *sma)
+{
+	ipc_lock_by_ptr(&sma->sem_perm);
+	sem_wait_array(sma);
+}
+
+/*
+ * Lock sma for semop(): only the semaphore when there is a single
+ * operation and no multi-sop one is pending, the whole array otherwise.
+ * Returns the number of the semaphore locked, or -1 for the array.
+ * Called under rcu_read_lock().
+ */
+static int sem_lock_sops(struct sem_array *sma, struct sembuf *sops,
+			 int nsops)
+{
+	if (nsops == 1 && sops->sem_num < sma->sem_nsems) {
+		struct sem *sem = sma->sem_base + sops->sem_num;
+
+		if (!sma->complex_count) {
+			spin_lock(&sem->lock);
+			/* Pairs with the barrier in sem_wait_array() */
+			smp_mb();
+			if (!spin_is_locked(&sma->sem_perm.lock) &&
+			    !sma->complex_count)
+				return sops->sem_num;
+			spin_unlock(&sem->lock);
+		}
+
+		spin_lock(&sma->sem_perm.lock);
+		if (!sma->complex_count) {
+			/* Only single operations after all */
+			spin_lock(&sem->lock);
+			spin_unlock(&sma->sem_perm.lock);
+			return sops->sem_num;
+		}
+	} else
+		spin_lock(&sma->sem_perm.lock);
+
+	sem_wait_array(sma);
+	return -1;
+}
+
+static inline void sem_unlock_sops(struct sem_array *sma, int locknum)
+{
+	if (locknum == -1)
+		spin_unlock(&sma->sem_perm.lock);
+	else
+		spin_unlock(&sma->sem_base[locknum].lock);
+	rcu_read_unlock();
+}
+
 void __init sem_init (void)
 {
 	used_sems = 0;
@@ -156,9 +237,55 @@ void __init sem_init (void)
  */
 #define IN_WAKEUP	1
 
+/*
+ * Wakeups are not done under the lock, where the woken task would only
+ * spin on it.  They are collected on a list instead, q->pid holding
+ * the result, and the tasks are woken once the lock is dropped.
+ * Preemption stays disabled in between, as the woken tasks may be
+ * spinning on IN_WAKEUP.
+ */
+static void wake_up_sem_queue_prepare(struct list_head *pt,
+				      struct sem_queue *q, int error)
+{
+	if (list_empty(pt))
+		preempt_disable();
+	q->status = IN_WAKEUP;
+	q->pid = error;
+	list_add_tail(&q->list, pt);
+}
+
+static void wake_up_sem_queue_do(struct list_head *pt)
+{
+	struct sem_queue *q, *t;
+
+	if (list_empty(pt))
+		return;
+	list_for_each_entry_safe(q, t, pt, list) {
+		wake_up_process(q->sleeper);
+		/* hands-off: q will disappear immediately after
+		 * writing q->status.
+		 */
+		smp_wmb();
+		q->status = q->pid;
+	}
+	preempt_enable();
+}
+
+/* The result of a semop() we were woken for */
+static inline int get_queue_result(struct sem_queue *q)
+{
+	int error = q->status;
+
+	while (unlikely(error == IN_WAKEUP)) {
+		cpu_relax();
+		error = q->status;
+	}
+	return error;
+}
+
 static int newary (key_t key, int nsems, int semflg)
 {
-	int id;
+	int id, i;
 	int retval;
 	struct sem_array *sma;
 	int size;
@@ -185,6 +312,15 @@ static int newary (key_t key, int nsems, int semflg)
 		return retval;
 	}
 
+	sma->sem_base = (struct sem *) &sma[1];
+	for (i = 0; i < nsems; i++) {
+		spin_lock_init(&sma->sem_base[i].lock);
+		INIT_LIST_HEAD(&sma->sem_base[i].sem_pending);
+	}
+	INIT_LIST_HEAD(&sma->sem_pending);
+	/* sma->undo = NULL; */
+	sma->sem_nsems = nsems;
+
 	id = ipc_addid(&sem_ids, &sma->sem_perm, sc_semmni);
 	if(id == -1) {
 		security_sem_free(sma);
@@ -193,11 +329,6 @@ static int newary (key_t key, int nsems, int semflg)
 	}
 	used_sems += nsems;
 
-	sma->sem_base = (struct sem *) &sma[1];
-	/* sma->sem_pending = NULL; */
-	sma->sem_pending_last = &sma->sem_pending;
-	/* sma->undo = NULL; */
-	sma->sem_nsems = nsems;
 	sma->sem_ctime = get_seconds();
 	sem_unlock(sma);
 
@@ -243,36 +374,35 @@ asmlinkage long sys_semget (key_t key, int nsems, int semflg)
 	return err;
 }
 
-/* Manage the doubly linked list sma->sem_pending as a FIFO:
- * insert new queue elements at the tail sma->sem_pending_last.
+/* The pending queues are FIFOs of the operations that alter the
+ * array, with those that only wait for zero ahead of them.  Single
+ * operations queue on their semaphore, the others on the array.
  */
 static inline void append_to_queue (struct sem_array * sma,
 				    struct sem_queue * q)
 {
-	*(q->prev = sma->sem_pending_last) = q;
-	*(sma->sem_pending_last = &q->next) = NULL;
-}
+	if (q->nsops == 1) {
+		struct sem *curr = sma->sem_base + q->sops->sem_num;
 
-static inline void prepend_to_queue (struct sem_array * sma,
-				     struct sem_queue * q)
-{
-	q->next = sma->sem_pending;
-	*(q->prev = &sma->sem_pending) = q;
-	if (q->next)
-		q->next->prev = &q->next;
-	else /* sma->sem_pending_last == &sma->sem_pending */
-		sma->sem_pending_last = &q->next;
+		if (q->alter)
+			list_add_tail(&q->list, &curr->sem_pending);
+		else
+			list_add(&q->list, &curr->sem_pending);
+	} else {
+		if (q->alter)
+			list_add_tail(&q->list, &sma->sem_pending);
+		else
+			list_add(&q->list, &sma->sem_pending);
+		sma->complex_count++;
+	}
 }
 
 static inline void remove_from_queue (struct sem_array * sma,
 				      struct sem_queue * q)
 {
-	*(q->prev) = q->next;
-	if (q->next)
-		q->next->prev = q->prev;
-	else /* sma->sem_pending_last == &q->next */
-		sma->sem_pending_last = q->prev;
-	q->prev = NULL; /* mark as removed */
+	list_del(&q->list);
+	if (q->nsops > 1)
+		sma->complex_count--;
 }
 
 /*
@@ -342,49 +472,87 @@ undo:
 	return result;
 }
 
-/* Go through the pending queue for the indicated semaphore
- * looking for tasks that can be completed.
+/* Go through the pending queue of semaphore semnum, or of the array
+ * for -1, looking for tasks that can be completed.  They are put on pt
+ * to be woken.  Returns whether any of them changed the array.
  */
-static void update_queue (struct sem_array * sma)
+static int update_queue (struct sem_array * sma, int semnum,
+			 struct list_head *pt)
 {
-	int error;
-	struct sem_queue * q;
+	int error, semop_completed = 0;
+	struct sem_queue *q, *t;
+	struct list_head *pending;
+
+	if (semnum == -1)
+		pending = &sma->sem_pending;
+	else
+		pending = &sma->sem_base[semnum].sem_pending;
 
-	q = sma->sem_pending;
-	while(q) {
+again:
+	list_for_each_entry_safe(q, t, pending, list) {
 		error = try_atomic_semop(sma, q->sops, q->nsops,
 					 q->undo, q->pid);
 
 		/* Does q->sleeper still need to sleep? */
-		if (error <= 0) {
-			struct sem_queue *n;
-			remove_from_queue(sma,q);
-			q->status = IN_WAKEUP;
-			/*
-			 * Continue scanning. The next operation
-			 * that must be checked depends on the type of the
-			 * completed operation:
-			 * - if the operation modified the array, then
-			 *   restart from the head of the queue and
-			 *   check for threads that might be waiting
-			 *   for semaphore values to become 0.
-			 * - if the operation didn't modify the array,
-			 *   then just continue.
-			 */
-			if (q->alter)
-				n = sma->sem_pending;
-			else
-				n = q->next;
-			wake_up_process(q->sleeper);
-			/* hands-off: q will disappear immediately after
-			 * writing q->status.
-			 */
-			q->status = error;
-			q = n;
-		} else {
-			q = q->next;
+		if (error > 0)
+			continue;
+
+		remove_from_queue(sma, q);
+		wake_up_sem_queue_prepare(pt, q, error);
+		/*
+		 * Continue scanning. The next operation
+		 * that must be checked depends on the type of the
+		 * completed operation:
+		 * - if the operation modified the array, then
+		 *   restart from the head of the queue and
+		 *   check for threads that might be waiting
+		 *   for semaphore values to become 0.
+		 * - if the operation didn't modify the array,
+		 *   then just continue.
+		 */
+		if (q->alter && !error) {
+			semop_completed = 1;
+			goto again;
 		}
 	}
+	return semop_completed;
+}
+
+/* Wake whoever can now complete after the array was changed by sops,
+ * or in any way when sops is NULL.  While there are multi-sop
+ * operations pending, completing one can let others go on any
+ * semaphore, and completing a single one can let a multi-sop one go,
+ * so this goes round until nothing more completes.
+ */
+static void do_smart_update(struct sem_array *sma, struct sembuf *sops,
+			    int nsops, struct list_head *pt)
+{
+	int i, progress;
+
+	if (!sma->complex_count && sops) {
+		for (i = 0; i < nsops; i++)
+			if (sops[i].sem_op)
+				update_queue(sma, sops[i].sem_num, pt);
+		return;
+	}
+
+	do {
+		progress = 0;
+		if (sma->complex_count && update_queue(sma, -1, pt)) {
+			progress = 1;
+			sops = NULL;
+		}
+		if (sops) {
+			for (i = 0; i < nsops; i++)
+				if (sops[i].sem_op &&
+				    update_queue(sma, sops[i].sem_num, pt))
+					progress = 1;
+		} else {
+			for (i = 0; i < sma->sem_nsems; i++)
+				if (update_queue(sma, i, pt))
+					progress = 1;
+		}
+	} while (progress && sma->complex_count);
 }
 
 /* The following counts are associated to each semaphore:
@@ -396,41 +564,33 @@ static void update_queue (struct sem_array * sma)
  * The counts we return here are a rough approximation, but still
  * warrant that semncnt+semzcnt>0 if the task is on the pending queue.
  */
-static int count_semncnt (struct sem_array * sma, ushort semnum)
+static int count_semcnt (struct list_head *pending, ushort semnum, int zero)
 {
-	int semncnt;
+	int semcnt = 0;
 	struct sem_queue * q;
 
-	semncnt = 0;
-	for (q = sma->sem_pending; q; q = q->next) {
+	list_for_each_entry(q, pending, list) {
 		struct sembuf * sops = q->sops;
 		int nsops = q->nsops;
 		int i;
 		for (i = 0; i < nsops; i++)
 			if (sops[i].sem_num == semnum
-			    && (sops[i].sem_op < 0)
+			    && (zero ? sops[i].sem_op == 0 : sops[i].sem_op < 0)
 			    && !(sops[i].sem_flg & IPC_NOWAIT))
-				semncnt++;
+				semcnt++;
 	}
-	return semncnt;
+	return semcnt;
+}
+
+static int count_semncnt (struct sem_array * sma, ushort semnum)
+{
+	return count_semcnt(&sma->sem_pending, semnum, 0) +
+	       count_semcnt(&sma->sem_base[semnum].sem_pending, semnum, 0);
 }
 static int count_semzcnt (struct sem_array * sma, ushort semnum)
 {
-	int semzcnt;
-	struct sem_queue * q;
-
-	semzcnt = 0;
-	for (q = sma->sem_pending; q; q = q->next) {
-		struct sembuf * sops = q->sops;
-		int nsops = q->nsops;
-		int i;
-		for (i = 0; i < nsops; i++)
-			if (sops[i].sem_num == semnum
-			    && (sops[i].sem_op == 0)
-			    && !(sops[i].sem_flg & IPC_NOWAIT))
-				semzcnt++;
-	}
-	return semzcnt;
+	return count_semcnt(&sma->sem_pending, semnum, 1) +
+	       count_semcnt(&sma->sem_base[semnum].sem_pending, semnum, 1);
 }
 
 /* Free a semaphore set. freeary() is called with sem_ids.sem down and
@@ -440,8 +600,9 @@ static int count_semzcnt (struct sem_array * sma, ushort semnum)
 static void freeary (struct sem_array *sma, int id)
 {
 	struct sem_undo *un;
-	struct sem_queue *q;
-	int size;
+	struct sem_queue *q, *t;
+	LIST_HEAD(tasks);
+	int i, size;
 
 	/* Invalidate the existing undo structures for this semaphore set.
 	 * (They will be freed without any further action in exit_sem()
@@ -451,21 +612,23 @@ static void freeary (struct sem_array *sma, int id)
 		un->semid = -1;
 
 	/* Wake up all pending processes and let them fail with EIDRM. */
-	q = sma->sem_pending;
-	while(q) {
-		struct sem_queue *n;
-		/* lazy remove_from_queue: we are killing the whole queue */
-		q->prev = NULL;
-		n = q->next;
-		q->status = IN_WAKEUP;
-		wake_up_process(q->sleeper); /* doesn't sleep */
-		q->status = -EIDRM;	/* hands-off q */
-		q = n;
+	list_for_each_entry_safe(q, t, &sma->sem_pending, list) {
+		list_del(&q->list);
+		wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
+	}
+	for (i = 0; i < sma->sem_nsems; i++) {
+		struct sem *sem = sma->sem_base + i;
+
+		list_for_each_entry_safe(q, t, &sem->sem_pending, list) {
+			list_del(&q->list);
+			wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
+		}
 	}
 
 	/* Remove the semaphore set from the ID array*/
 	sma = sem_rmid(id);
 	sem_unlock(sma);
+	wake_up_sem_queue_do(&tasks);
 
 	used_sems -= sma->sem_nsems;
 	size = sizeof (*sma) + sma->sem_nsems * sizeof (struct sem);
@@ -584,6 +747,7 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 	ushort fast_sem_io[SEMMSL_FAST];
 	ushort* sem_io = fast_sem_io;
 	int nsems;
+	LIST_HEAD(tasks);
 
 	sma = sem_lock(semid);
 	if(sma==NULL)
@@ -616,13 +780,13 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 
 			sem_io = ipc_alloc(sizeof(ushort)*nsems);
 			if(sem_io == NULL) {
-				ipc_lock_by_ptr(&sma->sem_perm);
+				sem_lock_by_ptr(sma);
 				ipc_rcu_putref(sma);
 				sem_unlock(sma);
 				return -ENOMEM;
 			}
 
-			ipc_lock_by_ptr(&sma->sem_perm);
+			sem_lock_by_ptr(sma);
 			ipc_rcu_putref(sma);
 			if (sma->sem_perm.deleted) {
 				sem_unlock(sma);
@@ -650,7 +814,7 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 		if(nsems > SEMMSL_FAST) {
 			sem_io = ipc_alloc(sizeof(ushort)*nsems);
 			if(sem_io == NULL) {
-				ipc_lock_by_ptr(&sma->sem_perm);
+				sem_lock_by_ptr(sma);
 				ipc_rcu_putref(sma);
 				sem_unlock(sma);
 				return -ENOMEM;
@@ -658,7 +822,7 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 		}
 
 		if (copy_from_user (sem_io, arg.array, nsems*sizeof(ushort))) {
-			ipc_lock_by_ptr(&sma->sem_perm);
+			sem_lock_by_ptr(sma);
 			ipc_rcu_putref(sma);
 			sem_unlock(sma);
 			err = -EFAULT;
@@ -667,14 +831,14 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 
 		for (i = 0; i < nsems; i++) {
 			if (sem_io[i] > SEMVMX) {
-				ipc_lock_by_ptr(&sma->sem_perm);
+				sem_lock_by_ptr(sma);
 				ipc_rcu_putref(sma);
 				sem_unlock(sma);
 				err = -ERANGE;
 				goto out_free;
 			}
 		}
-		ipc_lock_by_ptr(&sma->sem_perm);
+		sem_lock_by_ptr(sma);
 		ipc_rcu_putref(sma);
 		if (sma->sem_perm.deleted) {
 			sem_unlock(sma);
@@ -689,7 +853,7 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 				un->semadj[i] = 0;
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0, &tasks);
 		err = 0;
 		goto out_unlock;
 	}
@@ -741,13 +905,14 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 		curr->sempid = current->tgid;
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0, &tasks);
 		err = 0;
 		goto out_unlock;
 	}
 	}
 out_unlock:
 	sem_unlock(sma);
+	wake_up_sem_queue_do(&tasks);
 out_free:
 	if(sem_io != fast_sem_io)
 		ipc_free(sem_io, sizeof(ushort)*nsems);
@@ -1007,7 +1172,7 @@ static struct sem_undo *find_undo(int semid)
 
 	new = (struct sem_undo *) kmalloc(sizeof(struct sem_undo) + sizeof(short)*nsems, GFP_KERNEL);
 	if (!new) {
-		ipc_lock_by_ptr(&sma->sem_perm);
+		sem_lock_by_ptr(sma);
 		ipc_rcu_putref(sma);
 		sem_unlock(sma);
 		return ERR_PTR(-ENOMEM);
@@ -1021,12 +1186,12 @@ static struct sem_undo *find_undo(int semid)
 	if (un) {
 		unlock_semundo();
 		kfree(new);
-		ipc_lock_by_ptr(&sma->sem_perm);
+		sem_lock_by_ptr(sma);
 		ipc_rcu_putref(sma);
 		sem_unlock(sma);
 		goto out;
 	}
-	ipc_lock_by_ptr(&sma->sem_perm);
+	sem_lock_by_ptr(sma);
 	ipc_rcu_putref(sma);
 	if (sma->sem_perm.deleted) {
 		sem_unlock(sma);
@@ -1054,9 +1219,10 @@ asmlinkage long sys_semtimedop(int semid, struct sembuf __user *tsops,
 	struct sembuf fast_sops[SEMOPM_FAST];
 	struct sembuf* sops = fast_sops, *sop;
 	struct sem_undo *un;
-	int undos = 0, decrease = 0, alter = 0, max;
+	int undos = 0, decrease = 0, alter = 0, max, locknum;
 	struct sem_queue queue;
 	unsigned long jiffies_left = 0;
+	LIST_HEAD(tasks);
 
 	if (nsops < 1 || semid < 0)
 		return -EINVAL;
@@ -1107,10 +1273,16 @@ retry_undos:
 	} else
 		un = NULL;
 
-	sma = sem_lock(semid);
+	rcu_read_lock();
+	sma = (struct sem_array *)ipc_lookup_rcu(&sem_ids, semid);
 	error=-EINVAL;
-	if(sma==NULL)
+	if(sma==NULL) {
+		rcu_read_unlock();
 		goto out_free;
+	}
+	locknum = sem_lock_sops(sma, sops, nsops);
+	if (sma->sem_perm.deleted)
+		goto out_unlock_free;
 	error = -EIDRM;
 	if (sem_checkid(sma,semid))
 		goto out_unlock_free;
@@ -1120,7 +1292,7 @@ retry_undos:
 	 * and now a new array with received the same id. Check and retry.
 	 */
 	if (un && un->semid == -1) {
-		sem_unlock(sma);
+		sem_unlock_sops(sma, locknum);
 		goto retry_undos;
 	}
 	error = -EFBIG;
@@ -1138,7 +1310,7 @@ retry_undos:
 	error = try_atomic_semop (sma, sops, nsops, un, current->tgid);
 	if (error <= 0) {
 		if (alter && error == 0)
-			update_queue (sma);
+			do_smart_update(sma, sops, nsops, &tasks);
 		goto out_unlock_free;
 	}
 
@@ -1153,26 +1325,19 @@ retry_undos:
 	queue.pid = current->tgid;
 	queue.id = semid;
 	queue.alter = alter;
-	if (alter)
-		append_to_queue(sma ,&queue);
-	else
-		prepend_to_queue(sma ,&queue);
+	append_to_queue(sma ,&queue);
 
 	queue.status = -EINTR;
 	queue.sleeper = current;
 	current->state = TASK_INTERRUPTIBLE;
-	sem_unlock(sma);
+	sem_unlock_sops(sma, locknum);
 
 	if (timeout)
 		jiffies_left = schedule_timeout(jiffies_left);
 	else
 		schedule();
 
-	error = queue.status;
-	while(unlikely(error == IN_WAKEUP)) {
-		cpu_relax();
-		error = queue.status;
-	}
+	error = get_queue_result(&queue);
 
 	if (error != -EINTR) {
 		/* fast path: update_queue already obtained all requested
@@ -1180,21 +1345,29 @@ retry_undos:
 		goto out_free;
 	}
 
-	sma = sem_lock(semid);
+	rcu_read_lock();
+	sma = (struct sem_array *)ipc_lookup_rcu(&sem_ids, semid);
 	if(sma==NULL) {
-		if(queue.prev != NULL)
-			BUG();
+		rcu_read_unlock();
+		/* freeary() may not be done writing queue.status yet */
+		get_queue_result(&queue);
 		error = -EIDRM;
 		goto out_free;
 	}
+	locknum = sem_lock_sops(sma, sops, nsops);
 
 	/*
-	 * If queue.status != -EINTR we are woken up by another process
+	 * If queue.status != -EINTR we are woken up by another process,
+	 * possibly by freeary() before the array went away.
 	 */
-	error = queue.status;
+	error = get_queue_result(&queue);
 	if (error != -EINTR) {
 		goto out_unlock_free;
 	}
+	if (sma->sem_perm.deleted) {
+		error = -EIDRM;
+		goto out_unlock_free;
+	}
 
 	/*
 	 * If an interrupt occurred we have to clean up the queue
@@ -1205,7 +1378,8 @@ retry_undos:
 	goto out_unlock_free;
 
 out_unlock_free:
-	sem_unlock(sma);
+	sem_unlock_sops(sma, locknum);
+	wake_up_sem_queue_do(&tasks);
 out_free:
 	if(sops != fast_sops)
 		kfree(sops);
@@ -1276,6 +1450,7 @@ void exit_sem(struct task_struct *tsk)
 		int nsems, i;
 		struct sem_undo *un, **unp;
 		int semid;
+		LIST_HEAD(tasks);
 	       
 		semid = u->semid;
 
@@ -1327,9 +1502,10 @@ found:
 		}
 		sma->sem_otime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0, &tasks);
 next_entry:
 		sem_unlock(sma);
+		wake_up_sem_queue_do(&tasks);
 	}
 	kfree(undo_list);
 }
@@ -156,12 +156,14 @@ static int shm_mmap(struct file * file, struct vm_area_struct * vma)
 {
 	file_accessed(file);
 	vma->vm_ops = &shm_vm_ops;
+	shmem_huge_vma(vma);
 	shm_inc(file->f_dentry->d_inode->i_ino);
 	return 0;
 }
 
 static struct file_operations shm_file_operations = {
-	.mmap	= shm_mmap
+	.mmap	= shm_mmap,
+	.get_unmapped_area = shmem_get_unmapped_area,
 };
 
 static struct vm_operations_struct shm_vm_ops = {
@@ -501,19 +501,28 @@ struct kern_ipc_perm* ipc_get(struct ipc_ids* ids, int id)
 	return out;
 }
 
-struct kern_ipc_perm* ipc_lock(struct ipc_ids* ids, int id)
+/*
+ * The entry for id, without taking its lock.  Must be called under
+ * rcu_read_lock(), which keeps the structure from being freed; whether
+ * it has been removed is only known once it is locked.
+ */
+struct kern_ipc_perm* ipc_lookup_rcu(struct ipc_ids* ids, int id)
 {
-	struct kern_ipc_perm* out;
 	int lid = id % SEQ_MULTIPLIER;
 	struct ipc_id_ary* entries;
 
-	rcu_read_lock();
 	entries = rcu_dereference(ids->entries);
-	if(lid >= entries->size) {
-		rcu_read_unlock();
+	if(lid >= entries->size)
 		return NULL;
-	}
-	out = entries->p[lid];
+	return entries->p[lid];
+}
+
+struct kern_ipc_perm* ipc_lock(struct ipc_ids* ids, int id)
+{
+	struct kern_ipc_perm* out;
+
+	rcu_read_lock();
+	out = ipc_lookup_rcu(ids, id);
 	if(out == NULL) {
 		rcu_read_unlock();
 		return NULL;
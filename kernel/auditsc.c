@@ -36,6 +36,7 @@
 #include <linux/module.h>
 
 #include <linux/audit.h>
+#include <linux/rcupdate.h>
 #include <linux/personality.h>
 #include <linux/time.h>
 #include <asm/unistd.h>
@@ -60,7 +61,9 @@ extern int audit_enabled;
 
 /* At task start time, the audit_state is set in the audit_context using
    a per-task filter.  At syscall entry, the audit_state is augmented by
-   the syscall filter. */
+   the syscall filter.  A task no per-task rule matched is left at
+   AUDIT_SETUP_CONTEXT, so that the context is only filled in for the
+   syscalls some entry or exit rule selects. */
 enum audit_state {
 	AUDIT_DISABLED,		/* Do not create per-task audit_context.
 				 * No syscall-specific audit records can
@@ -156,6 +159,70 @@ struct audit_entry {
 	struct audit_rule rule;
 };
 
+#define AUDIT_NR_SYSCALLS	(AUDIT_BITMASK_SIZE * 32)
+
+/* The syscall filters go by an index of the entry and exit lists,
+ * rebuilt whenever a rule is added or deleted: the syscalls selected
+ * by any rule of the list, so that the others take one bit test, and
+ * for each of them the first rule selecting it, to start the walk of
+ * the list from.  Like the rules, the index is freed by RCU. */
+struct audit_index {
+	struct rcu_head	   rcu;
+	__u32		   mask[AUDIT_BITMASK_SIZE];
+	struct audit_entry *first[AUDIT_NR_SYSCALLS];
+};
+
+static struct audit_index *audit_entindex;
+static struct audit_index *audit_extindex;
+
+static inline int audit_index_selects(struct audit_index *index, int major)
+{
+	return index && (unsigned int)major < AUDIT_NR_SYSCALLS
+		&& (index->mask[AUDIT_WORD(major)] & AUDIT_BIT(major));
+}
+
+/* Index the rules of list, leaving out skip. */
+static struct audit_index *audit_build_index(struct list_head *list,
+					     struct audit_entry *skip)
+{
+	struct audit_index *index;
+	struct audit_entry *e;
+	int i;
+
+	if (!(index = kmalloc(sizeof(*index), GFP_KERNEL)))
+		return NULL;
+	memset(index, 0, sizeof(*index));
+
+	list_for_each_entry(e, list, list) {
+		if (e == skip)
+			continue;
+		for (i = 0; i < AUDIT_NR_SYSCALLS; i++) {
+			if ((e->rule.mask[AUDIT_WORD(i)] & AUDIT_BIT(i))
+			    && !index->first[i])
+				index->first[i] = e;
+		}
+		for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+			index->mask[i] |= e->rule.mask[i];
+	}
+	return index;
+}
+
+static void audit_free_index(struct rcu_head *head)
+{
+	struct audit_index *index = container_of(head, struct audit_index, rcu);
+	kfree(index);
+}
+
+static void audit_set_index(struct audit_index **indexp,
+			    struct audit_index *index)
+{
+	struct audit_index *old = *indexp;
+
+	rcu_assign_pointer(*indexp, index);
+	if (old)
+		call_rcu(&old->rcu, audit_free_index);
+}
+
 /* Check to see if two rules are identical.  It is called from
  * audit_del_rule during AUDIT_DEL. */
 static int audit_compare_rule(struct audit_rule *a, struct audit_rule *b)
@@ -188,14 +255,25 @@ static int audit_compare_rule(struct audit_rule *a, struct audit_rule *b)
  * audit_receive() in audit.c, and are protected by
  * audit_netlink_sem. */
 static inline int audit_add_rule(struct audit_entry *entry,
-				 struct list_head *list)
+				 struct list_head *list,
+				 struct audit_index **indexp)
 {
+	struct audit_index *index;
+
 	if (entry->rule.flags & AUDIT_PREPEND) {
 		entry->rule.flags &= ~AUDIT_PREPEND;
 		list_add_rcu(&entry->list, list);
 	} else {
 		list_add_tail_rcu(&entry->list, list);
 	}
+	if (!indexp)
+		return 0;
+
+	if (!(index = audit_build_index(list, NULL))) {
+		list_del_rcu(&entry->list);
+		return -ENOMEM;
+	}
+	audit_set_index(indexp, index);
 	return 0;
 }
 
@@ -209,15 +287,22 @@ static void audit_free_rule(struct rcu_head *head)
  * audit_receive() in audit.c, and are protected by
  * audit_netlink_sem. */
 static inline int audit_del_rule(struct audit_rule *rule,
-				 struct list_head *list)
+				 struct list_head *list,
+				 struct audit_index **indexp)
 {
 	struct audit_entry  *e;
+	struct audit_index  *index = NULL;
 
 	/* Do not use the _rcu iterator here, since this is the only
 	 * deletion routine. */
 	list_for_each_entry(e, list, list) {
 		if (!audit_compare_rule(rule, &e->rule)) {
+			/* The new index must not lead to the rule */
+			if (indexp && !(index = audit_build_index(list, e)))
+				return -ENOMEM;
 			list_del_rcu(&e->list);
+			if (indexp)
+				audit_set_index(indexp, index);
 			call_rcu(&e->rcu, audit_free_rule);
 			return 0;
 		}
@@ -280,20 +365,24 @@ int audit_receive_filter(int type, int pid, int uid, int seq, void *data)
 		}
 		flags = entry->rule.flags;
 		if (!err && (flags & AUDIT_PER_TASK))
-			err = audit_add_rule(entry, &audit_tsklist);
+			err = audit_add_rule(entry, &audit_tsklist, NULL);
 		if (!err && (flags & AUDIT_AT_ENTRY))
-			err = audit_add_rule(entry, &audit_entlist);
+			err = audit_add_rule(entry, &audit_entlist,
+					     &audit_entindex);
 		if (!err && (flags & AUDIT_AT_EXIT))
-			err = audit_add_rule(entry, &audit_extlist);
+			err = audit_add_rule(entry, &audit_extlist,
+					     &audit_extindex);
 		break;
 	case AUDIT_DEL:
 		flags =((struct audit_rule *)data)->flags;
 		if (!err && (flags & AUDIT_PER_TASK))
-			err = audit_del_rule(data, &audit_tsklist);
+			err = audit_del_rule(data, &audit_tsklist, NULL);
 		if (!err && (flags & AUDIT_AT_ENTRY))
-			err = audit_del_rule(data, &audit_entlist);
+			err = audit_del_rule(data, &audit_entlist,
+					     &audit_entindex);
 		if (!err && (flags & AUDIT_AT_EXIT))
-			err = audit_del_rule(data, &audit_extlist);
+			err = audit_del_rule(data, &audit_extlist,
+					     &audit_extindex);
 		break;
 	default:
 		return -EINVAL;
@@ -431,33 +520,57 @@ static enum audit_state audit_filter_task(struct task_struct *tsk)
 		}
 	}
 	rcu_read_unlock();
-	return AUDIT_BUILD_CONTEXT;
+	return AUDIT_SETUP_CONTEXT;
 }
 
 /* At syscall entry and exit time, this filter is called if the
  * audit_state is not low enough that auditing cannot take place, but is
  * also not high enough that we already know we have to write and audit
  * record (i.e., the state is AUDIT_SETUP_CONTEXT or  AUDIT_BUILD_CONTEXT).
+ * Returns 1 and sets *state if a rule matched.
  */
-static enum audit_state audit_filter_syscall(struct task_struct *tsk,
-					     struct audit_context *ctx,
-					     struct list_head *list)
+static int audit_filter_syscall(struct task_struct *tsk,
+				struct audit_context *ctx,
+				struct list_head *list,
+				struct audit_index **indexp,
+				enum audit_state *state)
 {
+	struct audit_index *index;
 	struct audit_entry *e;
-	enum audit_state   state;
+	struct list_head   *pos;
 	int		   word = AUDIT_WORD(ctx->major);
 	int		   bit  = AUDIT_BIT(ctx->major);
+	int		   ret = 0;
 
 	rcu_read_lock();
-	list_for_each_entry_rcu(e, list, list) {
+	index = rcu_dereference(*indexp);
+	if (likely(!audit_index_selects(index, ctx->major)))
+		goto out;
+
+	pos = &index->first[ctx->major]->list;
+	do {
+		e = list_entry(pos, struct audit_entry, list);
 		if ((e->rule.mask[word] & bit) == bit
- 		    && audit_filter_rules(tsk, &e->rule, ctx, &state)) {
-			rcu_read_unlock();
-			return state;
+		    && audit_filter_rules(tsk, &e->rule, ctx, state)) {
+			ret = 1;
+			break;
 		}
-	}
+		pos = rcu_dereference(pos->next);
+	} while (pos != list);
+out:
 	rcu_read_unlock();
-	return AUDIT_BUILD_CONTEXT;
+	return ret;
+}
+
+/* Could an exit rule select this syscall? */
+static inline int audit_exit_selects(int major)
+{
+	int ret;
+
+	rcu_read_lock();
+	ret = audit_index_selects(rcu_dereference(audit_extindex), major);
+	rcu_read_unlock();
+	return ret;
 }
 
 /* This should be called with task_lock() held. */
@@ -474,8 +587,9 @@ static inline struct audit_context *audit_get_context(struct task_struct *tsk,
 
 	if (context->in_syscall && !context->auditable) {
 		enum audit_state state;
-		state = audit_filter_syscall(tsk, context, &audit_extlist);
-		if (state == AUDIT_RECORD_CONTEXT)
+		if (audit_filter_syscall(tsk, context, &audit_extlist,
+					 &audit_extindex, &state)
+		    && state == AUDIT_RECORD_CONTEXT)
 			context->auditable = 1;
 	}
 
@@ -806,10 +920,16 @@ void audit_syscall_entry(struct task_struct *tsk, int major,
 
 	state = context->state;
 	if (state == AUDIT_SETUP_CONTEXT || state == AUDIT_BUILD_CONTEXT)
-		state = audit_filter_syscall(tsk, context, &audit_entlist);
+		audit_filter_syscall(tsk, context, &audit_entlist,
+				     &audit_entindex, &state);
 	if (likely(state == AUDIT_DISABLED))
 		return;
 
+	/* Nothing is collected for a syscall no rule has selected, nor
+	 * can select at exit: it is not in_syscall, and exit is cheap. */
+	if (likely(state == AUDIT_SETUP_CONTEXT) && !audit_exit_selects(major))
+		return;
+
 	context->serial     = audit_serial();
 	context->ctime      = CURRENT_TIME;
 	context->in_syscall = 1;
@@ -823,7 +943,11 @@ void audit_syscall_entry(struct task_struct *tsk, int major,
  * free the names stored from getname(). */
 void audit_syscall_exit(struct task_struct *tsk, int return_code)
 {
-	struct audit_context *context;
+	struct audit_context *context = tsk->audit_context;
+
+	/* Nothing was collected at entry, so there is nothing to free */
+	if (likely(context && !context->in_syscall && !context->previous))
+		return;
 
 	get_task_struct(tsk);
 	task_lock(tsk);
@@ -955,7 +1079,7 @@ void audit_inode(const char *name, const struct inode *inode)
 void audit_get_stamp(struct audit_context *ctx,
 		     struct timespec *t, int *serial)
 {
-	if (ctx) {
+	if (ctx && ctx->in_syscall) {
 		t->tv_sec  = ctx->ctime.tv_sec;
 		t->tv_nsec = ctx->ctime.tv_nsec;
 		*serial    = ctx->serial;
@@ -996,7 +1120,7 @@ int audit_ipc_perms(unsigned long qbytes, uid_t uid, gid_t gid, mode_t mode)
 	struct audit_aux_data_ipcctl *ax;
 	struct audit_context *context = current->audit_context;
 
-	if (likely(!context))
+	if (likely(!context || !context->in_syscall))
 		return 0;
 
 	ax = kmalloc(sizeof(*ax), GFP_KERNEL);
@@ -32,6 +32,7 @@
 #include <linux/kernel.h>
 #include <linux/kmod.h>
 #include <linux/list.h>
+#include <linux/memcontrol.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mount.h>
@@ -77,6 +78,13 @@ struct cpuset {
 	 * recent time this cpuset changed its mems_allowed.
 	 */
 	 int mems_generation;
+
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	struct sched_share share;	/* for sched_share=cpuset */
+#endif
+#ifdef CONFIG_MEM_CONTROLLER
+	struct mem_container *mem;	/* memory charged, NULL in top_cpuset */
+#endif
 };
 
 /* bits in struct cpuset flags field */
@@ -136,6 +144,9 @@ static struct cpuset top_cpuset = {
 	.parent = NULL,
 	.dentry = NULL,
 	.mems_generation = 0,
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	.share = INIT_SCHED_SHARE,
+#endif
 };
 
 static struct vfsmount *cpuset_mount;
@@ -218,6 +229,9 @@ static void cpuset_diput(struct dentry *dentry, struct inode *inode)
 	if (S_ISDIR(inode->i_mode)) {
 		struct cpuset *cs = dentry->d_fsdata;
 		BUG_ON(!(is_removed(cs)));
+#ifdef CONFIG_MEM_CONTROLLER
+		mem_container_put(cs->mem);
+#endif
 		kfree(cs);
 	}
 	iput(inode);
@@ -644,6 +658,78 @@ static int update_flag(cpuset_flagbits_t bit, struct cpuset *cs, char *buf)
 	return err;
 }
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+/*
+ * Set the CPU time weight of the tasks in a cpuset when the
+ * scheduler is sharing CPU time by cpuset (sched_share=cpuset).
+ */
+static int update_cpu_share(struct cpuset *cs, char *buf)
+{
+	unsigned int weight;
+
+	if (sscanf(buf, "%u", &weight) != 1)
+		return -EIO;
+	if (weight < 1 || weight > SCHED_SHARE_MAX)
+		return -EINVAL;
+	cs->share.weight = weight;
+	return 0;
+}
+
+/*
+ * Return the sched_share a task is accounted to with sched_share=cpuset.
+ * Called by the scheduler with the task's runqueue locked.
+ */
+struct sched_share *cpuset_sched_share(struct task_struct *p)
+{
+	return p->cpuset ? &p->cpuset->share : NULL;
+}
+#endif
+
+#ifdef CONFIG_MEM_CONTROLLER
+/*
+ * Set the memory limit of a cpuset, in bytes with an optional K, M or G
+ * suffix, or "unlimited".
+ */
+static int update_memory_limit(struct cpuset *cs, char *buf)
+{
+	unsigned long limit = ULONG_MAX;
+	char *end;
+
+	if (strncmp(buf, "unlimited", 9)) {
+		limit = memparse(buf, &end) >> PAGE_SHIFT;
+		if (end == buf)
+			return -EIO;
+	}
+	return mem_container_set_limit(cs->mem, limit);
+}
+
+static int cpuset_sprintf_memory_limit(char *page, struct cpuset *cs)
+{
+	unsigned long limit = mem_container_limit(cs->mem);
+
+	if (limit == ULONG_MAX)
+		return sprintf(page, "unlimited");
+	return sprintf(page, "%llu", (unsigned long long)limit << PAGE_SHIFT);
+}
+
+/*
+ * Return the mem_container a task charges its memory to, with a reference
+ * held, or NULL if it is not to be charged.
+ */
+struct mem_container *cpuset_mem_container(struct task_struct *p)
+{
+	struct mem_container *mem = NULL;
+
+	task_lock(p);
+	if (p->cpuset && p->cpuset->mem) {
+		mem = p->cpuset->mem;
+		mem_container_get(mem);
+	}
+	task_unlock(p);
+	return mem;
+}
+#endif
+
 static int attach_task(struct cpuset *cs, char *buf)
 {
 	pid_t pid;
@@ -688,6 +774,7 @@ static int attach_task(struct cpuset *cs, char *buf)
 	atomic_inc(&cs->count);
 	tsk->cpuset = cs;
 	task_unlock(tsk);
+	sched_move_share(tsk);
 
 	guarantee_online_cpus(cs, &cpus);
 	set_cpus_allowed(tsk, cpus);
@@ -708,6 +795,10 @@ typedef enum {
 	FILE_CPU_EXCLUSIVE,
 	FILE_MEM_EXCLUSIVE,
 	FILE_NOTIFY_ON_RELEASE,
+	FILE_CPU_SHARE,
+	FILE_MEMORY_LIMIT,
+	FILE_MEMORY_USAGE,
+	FILE_MEMORY_FAILCNT,
 	FILE_TASKLIST,
 } cpuset_filetype_t;
 
@@ -757,6 +848,16 @@ static ssize_t cpuset_common_file_write(struct file *file, const char *userbuf,
 	case FILE_NOTIFY_ON_RELEASE:
 		retval = update_flag(CS_NOTIFY_ON_RELEASE, cs, buffer);
 		break;
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	case FILE_CPU_SHARE:
+		retval = update_cpu_share(cs, buffer);
+		break;
+#endif
+#ifdef CONFIG_MEM_CONTROLLER
+	case FILE_MEMORY_LIMIT:
+		retval = update_memory_limit(cs, buffer);
+		break;
+#endif
 	case FILE_TASKLIST:
 		retval = attach_task(cs, buffer);
 		break;
@@ -858,6 +959,23 @@ static ssize_t cpuset_common_file_read(struct file *file, char __user *buf,
 	case FILE_NOTIFY_ON_RELEASE:
 		*s++ = notify_on_release(cs) ? '1' : '0';
 		break;
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	case FILE_CPU_SHARE:
+		s += sprintf(s, "%u", cs->share.weight);
+		break;
+#endif
+#ifdef CONFIG_MEM_CONTROLLER
+	case FILE_MEMORY_LIMIT:
+		s += cpuset_sprintf_memory_limit(s, cs);
+		break;
+	case FILE_MEMORY_USAGE:
+		s += sprintf(s, "%llu", (unsigned long long)
+				mem_container_usage(cs->mem) << PAGE_SHIFT);
+		break;
+	case FILE_MEMORY_FAILCNT:
+		s += sprintf(s, "%lu", mem_container_failcnt(cs->mem));
+		break;
+#endif
 	default:
 		retval = -EINVAL;
 		goto out;
@@ -1181,6 +1299,30 @@ static struct cftype cft_mem_exclusive = {
 	.private = FILE_MEM_EXCLUSIVE,
 };
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+static struct cftype cft_cpu_share = {
+	.name = "cpu_share",
+	.private = FILE_CPU_SHARE,
+};
+#endif
+
+#ifdef CONFIG_MEM_CONTROLLER
+static struct cftype cft_memory_limit = {
+	.name = "memory_limit",
+	.private = FILE_MEMORY_LIMIT,
+};
+
+static struct cftype cft_memory_usage = {
+	.name = "memory_usage",
+	.private = FILE_MEMORY_USAGE,
+};
+
+static struct cftype cft_memory_failcnt = {
+	.name = "memory_failcnt",
+	.private = FILE_MEMORY_FAILCNT,
+};
+#endif
+
 static struct cftype cft_notify_on_release = {
 	.name = "notify_on_release",
 	.private = FILE_NOTIFY_ON_RELEASE,
@@ -1200,6 +1342,22 @@ static int cpuset_populate_dir(struct dentry *cs_dentry)
 		return err;
 	if ((err = cpuset_add_file(cs_dentry, &cft_notify_on_release)) < 0)
 		return err;
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	if ((err = cpuset_add_file(cs_dentry, &cft_cpu_share)) < 0)
+		return err;
+#endif
+#ifdef CONFIG_MEM_CONTROLLER
+	/* The top cpuset is not accounted */
+	if (__d_cs(cs_dentry)->mem) {
+		if ((err = cpuset_add_file(cs_dentry, &cft_memory_limit)) < 0)
+			return err;
+		if ((err = cpuset_add_file(cs_dentry, &cft_memory_usage)) < 0)
+			return err;
+		if ((err = cpuset_add_file(cs_dentry,
+					   &cft_memory_failcnt)) < 0)
+			return err;
+	}
+#endif
 	if ((err = cpuset_add_file(cs_dentry, &cft_tasks)) < 0)
 		return err;
 	return 0;
@@ -1222,6 +1380,13 @@ static long cpuset_create(struct cpuset *parent, const char *name, int mode)
 	cs = kmalloc(sizeof(*cs), GFP_KERNEL);
 	if (!cs)
 		return -ENOMEM;
+#ifdef CONFIG_MEM_CONTROLLER
+	cs->mem = mem_container_alloc();
+	if (!cs->mem) {
+		kfree(cs);
+		return -ENOMEM;
+	}
+#endif
 
 	down(&cpuset_sem);
 	cs->flags = 0;
@@ -1232,6 +1397,9 @@ static long cpuset_create(struct cpuset *parent, const char *name, int mode)
 	atomic_set(&cs->count, 0);
 	INIT_LIST_HEAD(&cs->sibling);
 	INIT_LIST_HEAD(&cs->children);
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	sched_share_init(&cs->share);
+#endif
 	atomic_inc(&cpuset_mems_generation);
 	cs->mems_generation = atomic_read(&cpuset_mems_generation);
 
@@ -1256,6 +1424,9 @@ static long cpuset_create(struct cpuset *parent, const char *name, int mode)
 err:
 	list_del(&cs->sibling);
 	up(&cpuset_sem);
+#ifdef CONFIG_MEM_CONTROLLER
+	mem_container_put(cs->mem);
+#endif
 	kfree(cs);
 	return err;
 }
@@ -1383,6 +1554,7 @@ void cpuset_exit(struct task_struct *tsk)
 	cs = tsk->cpuset;
 	tsk->cpuset = NULL;
 	task_unlock(tsk);
+	sched_move_share(tsk);
 
 	if (atomic_dec_and_test(&cs->count)) {
 		down(&cpuset_sem);
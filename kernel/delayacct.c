@@ -0,0 +1,99 @@
+/*
+ * kernel/delayacct.c
+ *
+ * Per-task delay accounting, see include/linux/delayacct.h.
+ *
+ * Each delay is timed with sched_clock() on the way in and out.  A
+ * task can wake on another cpu whose clock is behind, so a negative
+ * interval counts as zero.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/time.h>
+#include <linux/delayacct.h>
+
+int delayacct_on = 1;
+
+static int __init delayacct_setup_disable(char *str)
+{
+	delayacct_on = 0;
+	return 1;
+}
+__setup("nodelayacct", delayacct_setup_disable);
+
+void delayacct_init_task(struct task_struct *tsk)
+{
+	memset(&tsk->delays, 0, sizeof(tsk->delays));
+	spin_lock_init(&tsk->delays.lock);
+}
+
+/* Add the time since start to *total, and count it */
+static void delayacct_end(u64 start, u64 *total, u32 *count)
+{
+	struct task_delay_info *delays = &current->delays;
+	s64 ns = sched_clock() - start;
+	unsigned long flags;
+
+	if (ns < 0)
+		ns = 0;
+	spin_lock_irqsave(&delays->lock, flags);
+	*total += ns;
+	(*count)++;
+	spin_unlock_irqrestore(&delays->lock, flags);
+}
+
+void __delayacct_blkio_end(void)
+{
+	struct task_delay_info *delays = &current->delays;
+
+	if (delays->flags & DELAYACCT_PF_SWAPIN)
+		delayacct_end(delays->blkio_start, &delays->swapin_delay,
+			      &delays->swapin_count);
+	else
+		delayacct_end(delays->blkio_start, &delays->blkio_delay,
+			      &delays->blkio_count);
+}
+
+void __delayacct_freepages_end(void)
+{
+	struct task_delay_info *delays = &current->delays;
+
+	delayacct_end(delays->freepages_start, &delays->freepages_delay,
+		      &delays->freepages_count);
+}
+
+/* The sched_info times are in jiffies */
+static inline u64 delayacct_jiffies_to_ns(unsigned long j)
+{
+	return (u64)j * (NSEC_PER_SEC / HZ);
+}
+
+/*
+ * Add the delays of tsk to stats.  This is called with the tasklist_lock
+ * held, which interrupts take too, so the lock is taken irqsave.
+ */
+void delayacct_add_tsk(struct taskstats *stats, struct task_struct *tsk)
+{
+	struct task_delay_info *delays = &tsk->delays;
+	unsigned long flags;
+
+	stats->cpu_count += tsk->sched_info.pcnt;
+	stats->cpu_delay_total +=
+		delayacct_jiffies_to_ns(tsk->sched_info.run_delay);
+	stats->cpu_run_real_total +=
+		delayacct_jiffies_to_ns(tsk->sched_info.cpu_time);
+
+	spin_lock_irqsave(&delays->lock, flags);
+	stats->blkio_count += delays->blkio_count;
+	stats->blkio_delay_total += delays->blkio_delay;
+	stats->swapin_count += delays->swapin_count;
+	stats->swapin_delay_total += delays->swapin_delay;
+	stats->freepages_count += delays->freepages_count;
+	stats->freepages_delay_total += delays->freepages_delay;
+	spin_unlock_irqrestore(&delays->lock, flags);
+}
@@ -40,7 +40,11 @@
 #include <linux/audit.h>
 #include <linux/profile.h>
 #include <linux/rmap.h>
+#include <linux/huge_mm.h>
+#include <linux/ksm.h>
 #include <linux/acct.h>
+#include <linux/delayacct.h>
+#include <linux/posix-timers.h>
 
 #include <asm/pgtable.h>
 #include <asm/pgalloc.h>
@@ -202,6 +206,8 @@ static inline int dup_mmap(struct mm_struct * mm, struct mm_struct * oldmm)
 	rb_link = &mm->mm_rb.rb_node;
 	rb_parent = NULL;
 	pprev = &mm->mmap;
+	khugepaged_fork(mm, oldmm);
+	ksm_fork(mm, oldmm);
 
 	for (mpnt = current->mm->mmap ; mpnt ; mpnt = mpnt->vm_next) {
 		struct file *file;
@@ -230,7 +236,8 @@ static inline int dup_mmap(struct mm_struct * mm, struct mm_struct * oldmm)
 		tmp->vm_flags &= ~VM_LOCKED;
 		tmp->vm_mm = mm;
 		tmp->vm_next = NULL;
-		anon_vma_link(tmp);
+		if (anon_vma_fork(tmp, mpnt))
+			goto fail_nomem_anon_vma_fork;
 		file = tmp->vm_file;
 		if (file) {
 			struct inode *inode = file->f_dentry->d_inode;
@@ -276,6 +283,8 @@ out:
 	flush_tlb_mm(current->mm);
 	up_write(&oldmm->mmap_sem);
 	return retval;
+fail_nomem_anon_vma_fork:
+	mpol_free(pol);
 fail_nomem_policy:
 	kmem_cache_free(vm_area_cachep, tmp);
 fail_nomem:
@@ -315,6 +324,15 @@ static struct mm_struct * mm_init(struct mm_struct * mm)
 	atomic_set(&mm->mm_count, 1);
 	init_rwsem(&mm->mmap_sem);
 	INIT_LIST_HEAD(&mm->mmlist);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	INIT_LIST_HEAD(&mm->khugepaged_list);
+	mm->khugepaged_scan = 0;
+	INIT_LIST_HEAD(&mm->huge_pgtables);
+#endif
+#ifdef CONFIG_KSM
+	INIT_LIST_HEAD(&mm->ksm_list);
+	INIT_LIST_HEAD(&mm->ksm_rmap_list);
+#endif
 	mm->core_waiters = 0;
 	mm->nr_ptes = 0;
 	spin_lock_init(&mm->page_table_lock);
@@ -364,7 +382,14 @@ void fastcall __mmdrop(struct mm_struct *mm)
  */
 void mmput(struct mm_struct *mm)
 {
-	if (atomic_dec_and_test(&mm->mm_users)) {
+	/*
+	 * Taking mmlist_lock as mm_users drops to zero lets khugepaged
+	 * and ksmd pin the mms on their lists with a plain atomic_inc.
+	 */
+	if (atomic_dec_and_lock(&mm->mm_users, &mmlist_lock)) {
+		khugepaged_exit(mm);
+		ksm_exit(mm);
+		spin_unlock(&mmlist_lock);
 		exit_aio(mm);
 		exit_mmap(mm);
 		if (!list_empty(&mm->mmlist)) {
@@ -421,6 +446,12 @@ void mm_release(struct task_struct *tsk, struct mm_struct *mm)
 {
 	struct completion *vfork_done = tsk->vfork_done;
 
+	/* Release the robust futexes while their memory is still mapped */
+	if (unlikely(tsk->robust_list)) {
+		exit_robust_list(tsk);
+		tsk->robust_list = NULL;
+	}
+
 	/* Get rid of any cached register state */
 	deactivate_mm(tsk, mm);
 
@@ -743,6 +774,9 @@ static inline int copy_signal(unsigned long clone_flags, struct task_struct * ts
 	int ret;
 
 	if (clone_flags & CLONE_THREAD) {
+		ret = thread_group_cputime_alloc(current);
+		if (ret < 0)
+			return ret;
 		atomic_inc(&current->signal->count);
 		atomic_inc(&current->signal->live);
 		return 0;
@@ -769,10 +803,10 @@ static inline int copy_signal(unsigned long clone_flags, struct task_struct * ts
 	init_sigpending(&sig->shared_pending);
 	INIT_LIST_HEAD(&sig->posix_timers);
 
-	sig->it_real_value = sig->it_real_incr = 0;
+	hrtimer_init(&sig->real_timer, CLOCK_MONOTONIC, HRTIMER_REL);
+	sig->it_real_incr.tv64 = 0;
 	sig->real_timer.function = it_real_fn;
-	sig->real_timer.data = (unsigned long) tsk;
-	init_timer(&sig->real_timer);
+	sig->tsk = tsk;
 
 	sig->it_virt_expires = cputime_zero;
 	sig->it_virt_incr = cputime_zero;
@@ -789,9 +823,14 @@ static inline int copy_signal(unsigned long clone_flags, struct task_struct * ts
 	sig->nvcsw = sig->nivcsw = sig->cnvcsw = sig->cnivcsw = 0;
 	sig->min_flt = sig->maj_flt = sig->cmin_flt = sig->cmaj_flt = 0;
 	sig->sched_time = 0;
+	taskstats_tgid_init(sig);
 	INIT_LIST_HEAD(&sig->cpu_timers[0]);
 	INIT_LIST_HEAD(&sig->cpu_timers[1]);
 	INIT_LIST_HEAD(&sig->cpu_timers[2]);
+	sig->cputime_totals = NULL;
+	sig->cputime_prof_expires = cputime_zero;
+	sig->cputime_virt_expires = cputime_zero;
+	sig->cputime_sched_expires = 0;
 
 	task_lock(current->group_leader);
 	memcpy(sig->rlim, current->signal->rlim, sizeof sig->rlim);
@@ -799,10 +838,10 @@ static inline int copy_signal(unsigned long clone_flags, struct task_struct * ts
 
 	if (sig->rlim[RLIMIT_CPU].rlim_cur != RLIM_INFINITY) {
 		/*
-		 * New sole thread in the process gets an expiry time
-		 * of the whole CPU time limit.
+		 * The new process starts from zero CPU time, so it
+		 * expires after the whole CPU time limit.
 		 */
-		tsk->it_prof_expires =
+		sig->cputime_prof_expires =
 			secs_to_cputime(sig->rlim[RLIMIT_CPU].rlim_cur);
 	}
 
@@ -813,7 +852,7 @@ static inline void copy_flags(unsigned long clone_flags, struct task_struct *p)
 {
 	unsigned long new_flags = p->flags;
 
-	new_flags &= ~PF_SUPERPRIV;
+	new_flags &= ~(PF_SUPERPRIV | PF_WQ_WORKER);
 	new_flags |= PF_FORKNOEXEC;
 	if (!(clone_flags & CLONE_PTRACE))
 		p->ptrace = 0;
@@ -914,6 +953,13 @@ static task_t *copy_process(unsigned long clone_flags,
 	p->vfork_done = NULL;
 	spin_lock_init(&p->alloc_lock);
 	spin_lock_init(&p->proc_lock);
+	INIT_LIST_HEAD(&p->pi_waiters);
+	p->pi_blocked_on = NULL;
+	INIT_LIST_HEAD(&p->pi_state_list);
+	p->robust_list = NULL;
+	p->wq_worker = NULL;
+	perf_counter_init_task(p);
+	delayacct_init_task(p);
 
 	clear_tsk_thread_flag(p, TIF_SIGPENDING);
 	init_sigpending(&p->pending);
@@ -938,6 +984,7 @@ static task_t *copy_process(unsigned long clone_flags,
 	do_posix_clock_monotonic_gettime(&p->start_time);
 	p->security = NULL;
 	p->io_context = NULL;
+	p->plug = NULL;
 	p->io_wait = NULL;
 	p->audit_context = NULL;
 #ifdef CONFIG_NUMA
@@ -1066,21 +1113,6 @@ static task_t *copy_process(unsigned long clone_flags,
 			set_tsk_thread_flag(p, TIF_SIGPENDING);
 		}
 
-		if (!cputime_eq(current->signal->it_virt_expires,
-				cputime_zero) ||
-		    !cputime_eq(current->signal->it_prof_expires,
-				cputime_zero) ||
-		    current->signal->rlim[RLIMIT_CPU].rlim_cur != RLIM_INFINITY ||
-		    !list_empty(&current->signal->cpu_timers[0]) ||
-		    !list_empty(&current->signal->cpu_timers[1]) ||
-		    !list_empty(&current->signal->cpu_timers[2])) {
-			/*
-			 * Have child wake up on its first tick to check
-			 * for process CPU timers.
-			 */
-			p->it_prof_expires = jiffies_to_cputime(1);
-		}
-
 		spin_unlock(&current->sighand->siglock);
 	}
 
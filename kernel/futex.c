@@ -39,8 +39,13 @@
 #include <linux/mount.h>
 #include <linux/pagemap.h>
 #include <linux/syscalls.h>
+#include <linux/cpumask.h>
+#include <linux/rtmutex.h>
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
+#include <asm/futex.h>
+
+/* Hash buckets per possible CPU */
+#define FUTEX_HASH_PER_CPU (CONFIG_BASE_SMALL ? 16 : 256)
 
 /*
  * Futexes are matched on equal values of this key.
@@ -48,8 +53,14 @@
  * Don't rearrange members without looking at hash_futex().
  *
  * offset is aligned to a multiple of sizeof(u32) (== 4) by definition.
- * We set bit 0 to indicate if it's an inode-based key.
+ * We set bit 0 to indicate if it's an inode-based key, and bit 1 for a
+ * private key found through the vma, which holds a reference to the
+ * mm.  Keys of FUTEX_PRIVATE_FLAG operations have neither: the mm
+ * cannot go away while one of its threads uses the futex.
  */
+#define FUT_OFF_INODE		1
+#define FUT_OFF_MMSHARED	2
+
 union futex_key {
 	struct {
 		unsigned long pgoff;
@@ -68,6 +79,22 @@ union futex_key {
 	} both;
 };
 
+/*
+ * The kernel side of a PI futex that has waiters.  pi_mutex is owned
+ * by the task named in the futex word, and the waiters block on it,
+ * so the owner inherits their priority.  It is found through the
+ * futex_q of any of its waiters, each of which holds a reference.
+ *
+ * The owner and list, on the owner's pi_state_list, are under
+ * rt_mutex_chain_lock; a pi_state without an owner is on no list.
+ */
+struct futex_pi_state {
+	struct list_head list;
+	struct rt_mutex pi_mutex;
+	atomic_t refcount;
+	int owner_died;		/* Passed on by exit_pi_state_list() */
+};
+
 /*
  * We use this hashed waitqueue instead of a normal wait_queue_t, so
  * we can wake only the relevant ones (hashed queues may be shared).
@@ -90,6 +117,9 @@ struct futex_q {
 	/* For fd, sigio sent using these. */
 	int fd;
 	struct file *filp;
+
+	/* Set for FUTEX_LOCK_PI waiters, which futex_wake() leaves alone */
+	struct futex_pi_state *pi_state;
 };
 
 /*
@@ -101,7 +131,8 @@ struct futex_hash_bucket {
        struct list_head       chain;
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+static struct futex_hash_bucket *futex_queues;
+static unsigned long futex_hashsize;
 
 /* Futex-fs vfsmount entry: */
 static struct vfsmount *futex_mnt;
@@ -114,7 +145,7 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
 /*
@@ -133,13 +164,17 @@ static inline int match_futex(union futex_key *key1, union futex_key *key2)
  * For shared mappings, it's (page->index, vma->vm_file->f_dentry->d_inode,
  * offset_within_page).  For private mappings, it's (uaddr, current->mm).
  * We can usually work out the index without swapping in the page.
+ * With !fshared the caller promises the futex is private, and the vma
+ * is not looked at.
  *
  * Returns: 0, or negative error code.
  * The key words are stored in *key on success.
  *
- * Should be called with &current->mm->mmap_sem but NOT any spinlocks.
+ * Should be called with &current->mm->mmap_sem if fshared, but NOT any
+ * spinlocks.
  */
-static int get_futex_key(unsigned long uaddr, union futex_key *key)
+static int get_futex_key(unsigned long uaddr, int fshared,
+			 union futex_key *key)
 {
 	struct mm_struct *mm = current->mm;
 	struct vm_area_struct *vma;
@@ -154,6 +189,14 @@ static int get_futex_key(unsigned long uaddr, union futex_key *key)
 		return -EINVAL;
 	uaddr -= key->both.offset;
 
+	if (!fshared) {
+		if (unlikely(!access_ok(VERIFY_WRITE, uaddr, sizeof(u32))))
+			return -EFAULT;
+		key->private.mm = mm;
+		key->private.uaddr = uaddr;
+		return 0;
+	}
+
 	/*
 	 * The futex is hashed differently depending on whether
 	 * it's in a shared or private mapping.  So check vma first.
@@ -180,6 +223,7 @@ static int get_futex_key(unsigned long uaddr, union futex_key *key)
 	if (likely(!(vma->vm_flags & VM_MAYSHARE))) {
 		key->private.mm = mm;
 		key->private.uaddr = uaddr;
+		key->both.offset |= FUT_OFF_MMSHARED;
 		return 0;
 	}
 
@@ -187,7 +231,7 @@ static int get_futex_key(unsigned long uaddr, union futex_key *key)
 	 * Linear file mappings are also simple.
 	 */
 	key->shared.inode = vma->vm_file->f_dentry->d_inode;
-	key->both.offset++; /* Bit 0 of offset indicates inode-based key. */
+	key->both.offset |= FUT_OFF_INODE;
 	if (likely(!(vma->vm_flags & VM_NONLINEAR))) {
 		key->shared.pgoff = (((uaddr - vma->vm_start) >> PAGE_SHIFT)
 				     + vma->vm_pgoff);
@@ -237,9 +281,9 @@ static int get_futex_key(unsigned long uaddr, union futex_key *key)
 static inline void get_key_refs(union futex_key *key)
 {
 	if (key->both.ptr != 0) {
-		if (key->both.offset & 1)
+		if (key->both.offset & FUT_OFF_INODE)
 			atomic_inc(&key->shared.inode->i_count);
-		else
+		else if (key->both.offset & FUT_OFF_MMSHARED)
 			atomic_inc(&key->private.mm->mm_count);
 	}
 }
@@ -251,13 +295,26 @@ static inline void get_key_refs(union futex_key *key)
 static void drop_key_refs(union futex_key *key)
 {
 	if (key->both.ptr != 0) {
-		if (key->both.offset & 1)
+		if (key->both.offset & FUT_OFF_INODE)
 			iput(key->shared.inode);
-		else
+		else if (key->both.offset & FUT_OFF_MMSHARED)
 			mmdrop(key->private.mm);
 	}
 }
 
+/* mmap_sem is only needed to look at the vma of shared futexes */
+static inline void futex_lock_mm(int fshared)
+{
+	if (fshared)
+		down_read(&current->mm->mmap_sem);
+}
+
+static inline void futex_unlock_mm(int fshared)
+{
+	if (fshared)
+		up_read(&current->mm->mmap_sem);
+}
+
 static inline int get_futex_value_locked(int *dest, int __user *from)
 {
 	int ret;
@@ -270,6 +327,34 @@ static inline int get_futex_value_locked(int *dest, int __user *from)
 	return ret ? -EFAULT : 0;
 }
 
+/* Returns the value found at uaddr, or -EFAULT. */
+static inline int cmpxchg_futex_value_locked(int __user *uaddr, int uval,
+					     int newval)
+{
+	int curval;
+
+	inc_preempt_count();
+	curval = futex_atomic_cmpxchg_inatomic(uaddr, uval, newval);
+	dec_preempt_count();
+	preempt_check_resched();
+
+	return curval;
+}
+
+/*
+ * Fault the futex word in for writing, as a failed
+ * cmpxchg_futex_value_locked() needs.  The cmpxchg writes whatever it
+ * finds, unlike get_user(), and outside atomic context it may fault.
+ */
+static int futex_fault_in(int __user *uaddr)
+{
+	return futex_atomic_cmpxchg_inatomic(uaddr, 0, 0) == -EFAULT ?
+		-EFAULT : 0;
+}
+
+/* The architecture can do PI futexes */
+static int futex_cmpxchg_enabled;
+
 /*
  * The hash bucket lock must be held when this is called.
  * Afterwards, the futex_q must not be accessed.
@@ -295,7 +380,7 @@ static void wake_futex(struct futex_q *q)
  * Wake up all waiters hashed on the physical page that is mapped
  * to this virtual address:
  */
-static int futex_wake(unsigned long uaddr, int nr_wake)
+static int futex_wake(unsigned long uaddr, int fshared, int nr_wake)
 {
 	union futex_key key;
 	struct futex_hash_bucket *bh;
@@ -303,9 +388,9 @@ static int futex_wake(unsigned long uaddr, int nr_wake)
 	struct futex_q *this, *next;
 	int ret;
 
-	down_read(&current->mm->mmap_sem);
+	futex_lock_mm(fshared);
 
-	ret = get_futex_key(uaddr, &key);
+	ret = get_futex_key(uaddr, fshared, &key);
 	if (unlikely(ret != 0))
 		goto out;
 
@@ -315,6 +400,10 @@ static int futex_wake(unsigned long uaddr, int nr_wake)
 
 	list_for_each_entry_safe(this, next, head, list) {
 		if (match_futex (&this->key, &key)) {
+			if (this->pi_state) {
+				ret = -EINVAL;
+				break;
+			}
 			wake_futex(this);
 			if (++ret >= nr_wake)
 				break;
@@ -323,7 +412,7 @@ static int futex_wake(unsigned long uaddr, int nr_wake)
 
 	spin_unlock(&bh->lock);
 out:
-	up_read(&current->mm->mmap_sem);
+	futex_unlock_mm(fshared);
 	return ret;
 }
 
@@ -332,7 +421,7 @@ out:
  * physical page.
  */
 static int futex_requeue(unsigned long uaddr1, unsigned long uaddr2,
-			 int nr_wake, int nr_requeue, int *valp)
+			 int fshared, int nr_wake, int nr_requeue, int *valp)
 {
 	union futex_key key1, key2;
 	struct futex_hash_bucket *bh1, *bh2;
@@ -342,12 +431,12 @@ static int futex_requeue(unsigned long uaddr1, unsigned long uaddr2,
 	unsigned int nqueued;
 
  retry:
-	down_read(&current->mm->mmap_sem);
+	futex_lock_mm(fshared);
 
-	ret = get_futex_key(uaddr1, &key1);
+	ret = get_futex_key(uaddr1, fshared, &key1);
 	if (unlikely(ret != 0))
 		goto out;
-	ret = get_futex_key(uaddr2, &key2);
+	ret = get_futex_key(uaddr2, fshared, &key2);
 	if (unlikely(ret != 0))
 		goto out;
 
@@ -374,7 +463,7 @@ static int futex_requeue(unsigned long uaddr1, unsigned long uaddr2,
 			/* If we would have faulted, release mmap_sem, fault
 			 * it in and start all over again.
 			 */
-			up_read(&current->mm->mmap_sem);
+			futex_unlock_mm(fshared);
 
 			ret = get_user(curval, (int __user *)uaddr1);
 
@@ -404,6 +493,10 @@ static int futex_requeue(unsigned long uaddr1, unsigned long uaddr2,
 	list_for_each_entry_safe(this, next, head1, list) {
 		if (!match_futex (&this->key, &key1))
 			continue;
+		if (this->pi_state) {
+			ret = -EINVAL;
+			break;
+		}
 		if (++ret <= nr_wake) {
 			wake_futex(this);
 		} else {
@@ -431,7 +524,7 @@ out_unlock:
 		drop_key_refs(&key1);
 
 out:
-	up_read(&current->mm->mmap_sem);
+	futex_unlock_mm(fshared);
 	return ret;
 }
 
@@ -447,6 +540,7 @@ static void queue_me(struct futex_q *q, int fd, struct file *filp)
 
 	q->fd = fd;
 	q->filp = filp;
+	q->pi_state = NULL;
 
 	init_waitqueue_head(&q->waiters);
 
@@ -498,16 +592,17 @@ static int unqueue_me(struct futex_q *q)
 	return ret;
 }
 
-static int futex_wait(unsigned long uaddr, int val, unsigned long time)
+static int futex_wait(unsigned long uaddr, int fshared, int val,
+		      unsigned long time)
 {
 	DECLARE_WAITQUEUE(wait, current);
 	int ret, curval;
 	struct futex_q q;
 
  retry:
-	down_read(&current->mm->mmap_sem);
+	futex_lock_mm(fshared);
 
-	ret = get_futex_key(uaddr, &q.key);
+	ret = get_futex_key(uaddr, fshared, &q.key);
 	if (unlikely(ret != 0))
 		goto out_release_sem;
 
@@ -540,7 +635,7 @@ static int futex_wait(unsigned long uaddr, int val, unsigned long time)
 		/* If we would have faulted, release mmap_sem, fault it in and
 		 * start all over again.
 		 */
-		up_read(&current->mm->mmap_sem);
+		futex_unlock_mm(fshared);
 
 		if (!unqueue_me(&q)) /* There's a chance we got woken already */
 			return 0;
@@ -560,7 +655,7 @@ static int futex_wait(unsigned long uaddr, int val, unsigned long time)
 	 * Now the futex is queued and we have checked the data, we
 	 * don't want to hold mmap_sem while we sleep.
 	 */	
-	up_read(&current->mm->mmap_sem);
+	futex_unlock_mm(fshared);
 
 	/*
 	 * There might have been scheduling since the queue_me(), as we
@@ -601,10 +696,453 @@ static int futex_wait(unsigned long uaddr, int val, unsigned long time)
 	if (!unqueue_me(&q))
 		ret = 0;
  out_release_sem:
-	up_read(&current->mm->mmap_sem);
+	futex_unlock_mm(fshared);
+	return ret;
+}
+
+/*
+ * Priority inheritance futexes.  The futex word holds the TID of the
+ * owner, see linux/futex.h; userspace only comes here once that has
+ * failed to change 0 into its TID, or its TID back into 0.
+ */
+
+/* The pi_state of a waiter on the futex at key, with bh->lock held */
+static struct futex_pi_state *
+lookup_pi_state(struct futex_hash_bucket *bh, union futex_key *key)
+{
+	struct futex_q *this;
+
+	list_for_each_entry(this, &bh->chain, list)
+		if (this->pi_state && match_futex(&this->key, key))
+			return this->pi_state;
+	return NULL;
+}
+
+/* Has the owner of a futex word gone, not to unlock it any more? */
+static int futex_owner_dead(pid_t pid)
+{
+	struct task_struct *p;
+	int dead;
+
+	read_lock(&tasklist_lock);
+	p = find_task_by_pid(pid);
+	dead = !p || (p->flags & PF_EXITING);
+	read_unlock(&tasklist_lock);
+
+	return dead;
+}
+
+/* Make the task with TID pid the owner of pi_state, unless it exits. */
+static int attach_pi_state(pid_t pid, struct futex_pi_state *pi_state)
+{
+	struct task_struct *p;
+	int ret = -ESRCH;
+
+	read_lock(&tasklist_lock);
+	p = find_task_by_pid(pid);
+	if (p) {
+		spin_lock_irq(&rt_mutex_chain_lock);
+		/* exit_pi_state_list() comes after PF_EXITING is set */
+		if (!(p->flags & PF_EXITING)) {
+			rt_mutex_init_proxy_locked(&pi_state->pi_mutex, p);
+			list_add(&pi_state->list, &p->pi_state_list);
+			pi_state->owner_died = 0;
+			ret = 0;
+		}
+		spin_unlock_irq(&rt_mutex_chain_lock);
+	}
+	read_unlock(&tasklist_lock);
+
+	return ret;
+}
+
+/* Drop the reference of a waiter that was unqueued, with bh->lock held */
+static int put_pi_state(struct futex_pi_state *pi_state)
+{
+	if (!atomic_dec_and_test(&pi_state->refcount))
+		return 0;
+
+	spin_lock_irq(&rt_mutex_chain_lock);
+	list_del(&pi_state->list);
+	spin_unlock_irq(&rt_mutex_chain_lock);
+	return 1;
+}
+
+/*
+ * pi_state came to us from an owner that exited holding it: put our
+ * TID in the futex word, which still has the old one.
+ */
+static int fixup_owner_died(int __user *uaddr)
+{
+	int uval, curval, newval;
+
+	if (get_futex_value_locked(&uval, uaddr))
+		return -EFAULT;
+	for (;;) {
+		newval = current->pid | FUTEX_OWNER_DIED | FUTEX_WAITERS;
+		curval = cmpxchg_futex_value_locked(uaddr, uval, newval);
+		if (curval == -EFAULT)
+			return -EFAULT;
+		if (curval == uval)
+			return 0;
+		uval = curval;
+	}
+}
+
+static int futex_lock_pi(unsigned long uaddr, int fshared,
+			 unsigned long time, int trylock)
+{
+	struct futex_pi_state *pi_state, *new_state = NULL;
+	struct rt_mutex_waiter waiter;
+	struct futex_hash_bucket *bh;
+	int __user *uptr = (int __user *)uaddr;
+	int ret, curval, owner_died;
+	struct futex_q q;
+
+ retry:
+	if (!new_state && !trylock) {
+		new_state = kmalloc(sizeof(*new_state), GFP_KERNEL);
+		if (!new_state)
+			return -ENOMEM;
+	}
+
+	futex_lock_mm(fshared);
+
+	ret = get_futex_key(uaddr, fshared, &q.key);
+	if (unlikely(ret != 0))
+		goto out_release_sem;
+
+	bh = hash_futex(&q.key);
+	spin_lock(&bh->lock);
+
+ retry_locked:
+	/* It may have been unlocked since userspace looked */
+	curval = cmpxchg_futex_value_locked(uptr, 0, current->pid);
+	if (unlikely(curval == -EFAULT))
+		goto uaddr_faulted;
+	ret = 0;
+	if (curval == 0)
+		goto out_unlock;
+
+	ret = -EDEADLK;
+	if ((curval & FUTEX_TID_MASK) == current->pid)
+		goto out_unlock;
+
+	/*
+	 * With no waiter in the kernel, the owner could have exited, and
+	 * nobody is going to unlock.  Take it over.
+	 */
+	pi_state = lookup_pi_state(bh, &q.key);
+	if ((!pi_state || !pi_state->pi_mutex.owner) &&
+	    futex_owner_dead(curval & FUTEX_TID_MASK)) {
+		ret = cmpxchg_futex_value_locked(uptr, curval,
+					current->pid | FUTEX_OWNER_DIED);
+		if (unlikely(ret == -EFAULT))
+			goto uaddr_faulted;
+		if (ret != curval)
+			goto retry_locked;
+		ret = 0;
+		goto out_unlock;
+	}
+
+	ret = -EWOULDBLOCK;
+	if (trylock)
+		goto out_unlock;
+
+	/* From now on the owner has to unlock through the kernel */
+	if (!(curval & FUTEX_WAITERS)) {
+		ret = cmpxchg_futex_value_locked(uptr, curval,
+						 curval | FUTEX_WAITERS);
+		if (unlikely(ret == -EFAULT))
+			goto uaddr_faulted;
+		if (ret != curval)
+			goto retry_locked;
+	}
+
+	if (!pi_state) {
+		pi_state = new_state;
+		rt_mutex_init(&pi_state->pi_mutex);
+		atomic_set(&pi_state->refcount, 0);
+	}
+	if (!pi_state->pi_mutex.owner &&
+	    attach_pi_state(curval & FUTEX_TID_MASK, pi_state) != 0)
+		/* The owner started to exit: take it over after all */
+		goto retry_locked;
+	if (pi_state == new_state)
+		new_state = NULL;
+	atomic_inc(&pi_state->refcount);
+
+	q.fd = -1;
+	q.filp = NULL;
+	q.pi_state = pi_state;
+	get_key_refs(&q.key);
+	q.lock_ptr = &bh->lock;
+	bh->nqueued++;
+	list_add_tail(&q.list, &bh->chain);
+
+	/* Still under bh->lock, so the owner cannot unlock past us */
+	ret = rt_mutex_start_wait(&pi_state->pi_mutex, &waiter);
+	spin_unlock(&bh->lock);
+	futex_unlock_mm(fshared);
+
+	if (ret == 0)
+		ret = rt_mutex_finish_wait(&pi_state->pi_mutex, &waiter, time);
+	else if (ret > 0)
+		ret = 0;
+
+	/* PI waiters are never requeued, so q.lock_ptr is still bh's */
+	spin_lock(&bh->lock);
+	if (ret == 0) {
+		spin_lock_irq(&rt_mutex_chain_lock);
+		if (list_empty(&pi_state->list))
+			list_add(&pi_state->list, &current->pi_state_list);
+		owner_died = pi_state->owner_died;
+		pi_state->owner_died = 0;
+		spin_unlock_irq(&rt_mutex_chain_lock);
+
+		/* Stay queued, so that the pi_state shows who owns it */
+		while (owner_died && fixup_owner_died(uptr) != 0) {
+			spin_unlock(&bh->lock);
+			ret = futex_fault_in(uptr);
+			spin_lock(&bh->lock);
+			if (ret)
+				break;
+		}
+	}
+	list_del(&q.list);
+	if (put_pi_state(pi_state))
+		kfree(pi_state);
+	spin_unlock(&bh->lock);
+	drop_key_refs(&q.key);
+
+	kfree(new_state);
+	/* Locking without a timeout is restarted after a signal */
+	if (ret == -EINTR && time == MAX_SCHEDULE_TIMEOUT)
+		ret = -ERESTARTNOINTR;
+	return ret;
+
+ out_unlock:
+	spin_unlock(&bh->lock);
+ out_release_sem:
+	futex_unlock_mm(fshared);
+	kfree(new_state);
+	return ret;
+
+ uaddr_faulted:
+	spin_unlock(&bh->lock);
+	futex_unlock_mm(fshared);
+
+	ret = futex_fault_in(uptr);
+	if (!ret)
+		goto retry;
+	kfree(new_state);
+	return ret;
+}
+
+/*
+ * Give the futex to the top waiter, writing its TID into the word
+ * before it wakes up, or free it if nobody waits in the kernel.
+ */
+static int futex_unlock_pi(unsigned long uaddr, int fshared)
+{
+	struct futex_pi_state *pi_state;
+	struct task_struct *new_owner = NULL;
+	struct futex_hash_bucket *bh;
+	int __user *uptr = (int __user *)uaddr;
+	int ret, uval, curval, newval = 0;
+	union futex_key key;
+
+ retry:
+	if (get_user(uval, uptr))
+		return -EFAULT;
+	if ((uval & FUTEX_TID_MASK) != current->pid)
+		return -EPERM;
+
+	futex_lock_mm(fshared);
+
+	ret = get_futex_key(uaddr, fshared, &key);
+	if (unlikely(ret != 0))
+		goto out;
+
+	bh = hash_futex(&key);
+	spin_lock(&bh->lock);
+
+	pi_state = lookup_pi_state(bh, &key);
+	spin_lock_irq(&rt_mutex_chain_lock);
+	/* Without an owner, it is left over from waiters on their way out */
+	if (pi_state && !pi_state->pi_mutex.owner)
+		pi_state = NULL;
+	ret = -EPERM;
+	if (pi_state && pi_state->pi_mutex.owner != current)
+		goto out_unlock;
+
+	if (pi_state)
+		new_owner = rt_mutex_next_owner(&pi_state->pi_mutex);
+	if (new_owner)
+		newval = new_owner->pid | FUTEX_WAITERS;
+
+	curval = cmpxchg_futex_value_locked(uptr, uval, newval);
+	if (unlikely(curval != uval)) {
+		spin_unlock_irq(&rt_mutex_chain_lock);
+		spin_unlock(&bh->lock);
+		futex_unlock_mm(fshared);
+		if (curval == -EFAULT && futex_fault_in(uptr))
+			return -EFAULT;
+		goto retry;
+	}
+
+	ret = 0;
+	if (pi_state) {
+		__rt_mutex_unlock(&pi_state->pi_mutex);
+		if (new_owner)
+			list_move(&pi_state->list, &new_owner->pi_state_list);
+		else
+			list_del_init(&pi_state->list);
+	}
+
+ out_unlock:
+	spin_unlock_irq(&rt_mutex_chain_lock);
+	spin_unlock(&bh->lock);
+ out:
+	futex_unlock_mm(fshared);
 	return ret;
 }
 
+/*
+ * Called by do_exit(): hand the PI futexes curr still owns to their
+ * top waiters, which find FUTEX_OWNER_DIED set in the futex word.
+ */
+void exit_pi_state_list(struct task_struct *curr)
+{
+	struct futex_pi_state *pi_state;
+	struct task_struct *next;
+
+	spin_lock_irq(&rt_mutex_chain_lock);
+	while (!list_empty(&curr->pi_state_list)) {
+		pi_state = list_entry(curr->pi_state_list.next,
+				      struct futex_pi_state, list);
+		pi_state->owner_died = 1;
+		next = rt_mutex_next_owner(&pi_state->pi_mutex);
+		__rt_mutex_unlock(&pi_state->pi_mutex);
+		if (next)
+			list_move(&pi_state->list, &next->pi_state_list);
+		else
+			list_del_init(&pi_state->list);
+	}
+	spin_unlock_irq(&rt_mutex_chain_lock);
+}
+
+/*
+ * A thread died holding the futex at uaddr: mark it FUTEX_OWNER_DIED,
+ * keeping FUTEX_WAITERS, and wake a waiter to take over.  PI waiters
+ * were given the lock by exit_pi_state_list() already.
+ */
+static int handle_futex_death(int __user *uaddr, struct task_struct *curr)
+{
+	int uval, nval, mval;
+
+ retry:
+	if (get_user(uval, uaddr))
+		return -EFAULT;
+	if ((uval & FUTEX_TID_MASK) != curr->pid)
+		return 0;
+
+	mval = (uval & FUTEX_WAITERS) | FUTEX_OWNER_DIED;
+	/* Not in atomic context: this one may fault */
+	nval = futex_atomic_cmpxchg_inatomic(uaddr, uval, mval);
+	if (nval == -EFAULT)
+		return -EFAULT;
+	if (nval != uval)
+		goto retry;
+
+	if (uval & FUTEX_WAITERS)
+		futex_wake((unsigned long)uaddr, 1, 1);
+	return 0;
+}
+
+/*
+ * Walk the robust list of curr, which is exiting or exec'ing, while its
+ * memory is still there.  A list userspace broke ends the walk.
+ */
+void exit_robust_list(struct task_struct *curr)
+{
+	struct robust_list_head __user *head = curr->robust_list;
+	struct robust_list __user *entry, *pending;
+	unsigned int limit = ROBUST_LIST_LIMIT;
+	long futex_offset;
+
+	if (!futex_cmpxchg_enabled)
+		return;
+
+	if (get_user(entry, &head->list.next))
+		return;
+	if (get_user(futex_offset, &head->futex_offset))
+		return;
+	if (get_user(pending, &head->list_op_pending))
+		return;
+
+	while (entry != &head->list) {
+		/* The pending one is done below, whether listed yet or not */
+		if (entry != pending)
+			handle_futex_death((void __user *)entry + futex_offset,
+					   curr);
+		if (get_user(entry, &entry->next))
+			return;
+		if (!--limit)
+			break;
+		cond_resched();
+	}
+
+	if (pending)
+		handle_futex_death((void __user *)pending + futex_offset, curr);
+}
+
+asmlinkage long
+sys_set_robust_list(struct robust_list_head __user *head, size_t len)
+{
+	if (!futex_cmpxchg_enabled)
+		return -ENOSYS;
+	/* The size is there for the head to grow one day */
+	if (unlikely(len != sizeof(*head)))
+		return -EINVAL;
+
+	current->robust_list = head;
+	return 0;
+}
+
+asmlinkage long
+sys_get_robust_list(int pid, struct robust_list_head __user **head_ptr,
+		    size_t __user *len_ptr)
+{
+	struct robust_list_head __user *head;
+	struct task_struct *p;
+
+	if (!futex_cmpxchg_enabled)
+		return -ENOSYS;
+
+	if (!pid)
+		head = current->robust_list;
+	else {
+		read_lock(&tasklist_lock);
+		p = find_task_by_pid(pid);
+		if (!p) {
+			read_unlock(&tasklist_lock);
+			return -ESRCH;
+		}
+		if ((current->euid != p->euid) && (current->euid != p->uid) &&
+		    !capable(CAP_SYS_PTRACE)) {
+			read_unlock(&tasklist_lock);
+			return -EPERM;
+		}
+		head = p->robust_list;
+		read_unlock(&tasklist_lock);
+	}
+
+	if (put_user(sizeof(*head), len_ptr))
+		return -EFAULT;
+	return put_user(head, head_ptr);
+}
+
 static int futex_close(struct inode *inode, struct file *filp)
 {
 	struct futex_q *q = filp->private_data;
@@ -687,7 +1225,7 @@ static int futex_fd(unsigned long uaddr, int signal)
 	}
 
 	down_read(&current->mm->mmap_sem);
-	err = get_futex_key(uaddr, &q->key);
+	err = get_futex_key(uaddr, 1, &q->key);
 
 	if (unlikely(err != 0)) {
 		up_read(&current->mm->mmap_sem);
@@ -715,24 +1253,43 @@ out:
 long do_futex(unsigned long uaddr, int op, int val, unsigned long timeout,
 		unsigned long uaddr2, int val2, int val3)
 {
+	int cmd = op & FUTEX_CMD_MASK;
+	int fshared = !(op & FUTEX_PRIVATE_FLAG);
 	int ret;
 
-	switch (op) {
+	switch (cmd) {
 	case FUTEX_WAIT:
-		ret = futex_wait(uaddr, val, timeout);
+		ret = futex_wait(uaddr, fshared, val, timeout);
 		break;
 	case FUTEX_WAKE:
-		ret = futex_wake(uaddr, val);
+		ret = futex_wake(uaddr, fshared, val);
 		break;
 	case FUTEX_FD:
+		/* The fd may outlive the mm a private key points at */
+		if (!fshared) {
+			ret = -EINVAL;
+			break;
+		}
 		/* non-zero val means F_SETOWN(getpid()) & F_SETSIG(val) */
 		ret = futex_fd(uaddr, val);
 		break;
 	case FUTEX_REQUEUE:
-		ret = futex_requeue(uaddr, uaddr2, val, val2, NULL);
+		ret = futex_requeue(uaddr, uaddr2, fshared, val, val2, NULL);
 		break;
 	case FUTEX_CMP_REQUEUE:
-		ret = futex_requeue(uaddr, uaddr2, val, val2, &val3);
+		ret = futex_requeue(uaddr, uaddr2, fshared, val, val2, &val3);
+		break;
+	case FUTEX_LOCK_PI:
+	case FUTEX_TRYLOCK_PI:
+		if (!futex_cmpxchg_enabled)
+			return -ENOSYS;
+		ret = futex_lock_pi(uaddr, fshared, timeout,
+				    cmd == FUTEX_TRYLOCK_PI);
+		break;
+	case FUTEX_UNLOCK_PI:
+		if (!futex_cmpxchg_enabled)
+			return -ENOSYS;
+		ret = futex_unlock_pi(uaddr, fshared);
 		break;
 	default:
 		ret = -ENOSYS;
@@ -748,8 +1305,9 @@ asmlinkage long sys_futex(u32 __user *uaddr, int op, int val,
 	struct timespec t;
 	unsigned long timeout = MAX_SCHEDULE_TIMEOUT;
 	int val2 = 0;
+	int cmd = op & FUTEX_CMD_MASK;
 
-	if ((op == FUTEX_WAIT) && utime) {
+	if ((cmd == FUTEX_WAIT || cmd == FUTEX_LOCK_PI) && utime) {
 		if (copy_from_user(&t, utime, sizeof(t)) != 0)
 			return -EFAULT;
 		timeout = timespec_to_jiffies(&t) + 1;
@@ -757,7 +1315,7 @@ asmlinkage long sys_futex(u32 __user *uaddr, int op, int val,
 	/*
 	 * requeue parameter in 'utime' if op == FUTEX_REQUEUE.
 	 */
-	if (op >= FUTEX_REQUEUE)
+	if (cmd == FUTEX_REQUEUE || cmd == FUTEX_CMP_REQUEUE)
 		val2 = (int) (unsigned long) utime;
 
 	return do_futex((unsigned long)uaddr, op, val, timeout,
@@ -779,15 +1337,34 @@ static struct file_system_type futex_fs_type = {
 
 static int __init init(void)
 {
-	unsigned int i;
+	unsigned long i;
+	int order;
 
 	register_filesystem(&futex_fs_type);
 	futex_mnt = kern_mount(&futex_fs_type);
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
+	/* Size the hash to the CPUs, settling for less if need be */
+	futex_hashsize = roundup_pow_of_two(FUTEX_HASH_PER_CPU *
+					    num_possible_cpus());
+	for (;;) {
+		order = get_order(futex_hashsize * sizeof(*futex_queues));
+		futex_queues = (struct futex_hash_bucket *)
+			__get_free_pages(GFP_KERNEL, order);
+		if (futex_queues || futex_hashsize <= FUTEX_HASH_PER_CPU)
+			break;
+		futex_hashsize >>= 1;
+	}
+	if (!futex_queues)
+		panic("futex: failed to allocate the hash table\n");
+
+	for (i = 0; i < futex_hashsize; i++) {
 		INIT_LIST_HEAD(&futex_queues[i].chain);
 		spin_lock_init(&futex_queues[i].lock);
 	}
+
+	/* Only a working cmpxchg faults on a NULL pointer */
+	futex_cmpxchg_enabled =
+		cmpxchg_futex_value_locked(NULL, 0, 0) == -EFAULT;
 	return 0;
 }
 __initcall(init);
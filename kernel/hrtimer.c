@@ -0,0 +1,1030 @@
+/*
+ *  linux/kernel/hrtimer.c
+ *
+ *  High-resolution kernel timers
+ *
+ *  In contrast to the low-resolution timeout API implemented in
+ *  kernel/timer.c, hrtimers provide finer resolution and accuracy
+ *  depending on system configuration and capabilities.
+ *
+ *  These timers are currently used for:
+ *   - itimers
+ *   - POSIX timers
+ *   - nanosleep
+ *   - precise in-kernel timing
+ *
+ *  Each CPU has one timer base per clock (CLOCK_REALTIME and
+ *  CLOCK_MONOTONIC), holding the pending timers in an rbtree sorted
+ *  by expiry time. The first (earliest) timer is cached, so finding
+ *  the next event is O(1) and queueing a timer is O(log n).
+ *
+ *  Until the architecture has switched a CPU's event device to
+ *  one-shot mode, the bases are run from the timer softirq, with tick
+ *  resolution. After the switch (CONFIG_HIGH_RES_TIMERS) they are run
+ *  from hrtimer_interrupt(), which the architecture calls when the
+ *  programmed event fires.
+ */
+
+#include <linux/cpu.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/hrtimer.h>
+#include <linux/notifier.h>
+#include <linux/syscalls.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
+
+#include <asm/uaccess.h>
+#include <asm/div64.h>
+
+/**
+ * ktime_get - get the monotonic time in ktime_t format
+ *
+ * returns the time in ktime_t format
+ */
+ktime_t ktime_get(void)
+{
+	struct timespec now;
+
+	do_posix_clock_monotonic_gettime(&now);
+
+	return timespec_to_ktime(now);
+}
+
+EXPORT_SYMBOL_GPL(ktime_get);
+
+/**
+ * ktime_get_real - get the real (wall-) time in ktime_t format
+ *
+ * returns the time in ktime_t format
+ */
+ktime_t ktime_get_real(void)
+{
+	struct timespec now;
+
+	getnstimeofday(&now);
+
+	return timespec_to_ktime(now);
+}
+
+EXPORT_SYMBOL_GPL(ktime_get_real);
+
+/*
+ * The timer bases, indexed by clock id (CLOCK_REALTIME, CLOCK_MONOTONIC):
+ */
+static DEFINE_PER_CPU(struct hrtimer_base, hrtimer_bases[MAX_HRTIMER_BASES]);
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+
+/* Boot option "highres=off" keeps the timers on the softirq */
+static int hrtimer_hres_enabled = 1;
+
+static int __init setup_hrtimer_hres(char *str)
+{
+	if (!strcmp(str, "off"))
+		hrtimer_hres_enabled = 0;
+	else if (!strcmp(str, "on"))
+		hrtimer_hres_enabled = 1;
+	else
+		return 0;
+	return 1;
+}
+
+__setup("highres=", setup_hrtimer_hres);
+
+/*
+ * hres_active: this CPU's bases are run from hrtimer_interrupt()
+ * expires_next: the event currently programmed on this CPU's
+ * device, as CLOCK_MONOTONIC time
+ */
+static DEFINE_PER_CPU(int, hres_active);
+static DEFINE_PER_CPU(ktime_t, expires_next);
+
+static inline int hrtimer_hres_active(void)
+{
+	return __get_cpu_var(hres_active);
+}
+
+/*
+ * The offset of CLOCK_MONOTONIC against CLOCK_REALTIME; the one-shot
+ * event is programmed in CLOCK_MONOTONIC time.
+ */
+static ktime_t hrtimer_wall_to_mono(void)
+{
+	struct timespec wtm;
+	unsigned long seq;
+
+	do {
+		seq = read_seqbegin(&xtime_lock);
+		wtm = wall_to_monotonic;
+	} while (read_seqretry(&xtime_lock, seq));
+
+	return timespec_to_ktime(wtm);
+}
+
+static inline ktime_t hrtimer_mono_expires(struct hrtimer *timer,
+					   struct hrtimer_base *base)
+{
+	if (base->index == CLOCK_REALTIME)
+		return ktime_add(timer->expires, hrtimer_wall_to_mono());
+	return timer->expires;
+}
+
+/*
+ * A timer became the first one of its base. Reprogram the event
+ * device if the timer is on this CPU and expires before the event
+ * which is currently programmed. Called with the base lock held
+ * and interrupts disabled.
+ */
+static void hrtimer_reprogram(struct hrtimer *timer, struct hrtimer_base *base)
+{
+	ktime_t *next = &__get_cpu_var(expires_next);
+	ktime_t expires;
+
+	if (!hrtimer_hres_active() ||
+	    base != &__get_cpu_var(hrtimer_bases)[base->index])
+		return;
+
+	expires = hrtimer_mono_expires(timer, base);
+	if (expires.tv64 >= next->tv64)
+		return;
+
+	*next = expires;
+	hrtimer_arch_program_event(expires);
+}
+
+/*
+ * Find the first expiry over all bases of this CPU and program the
+ * event device for it. Called with interrupts disabled.
+ */
+static void hrtimer_force_reprogram(void)
+{
+	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+	ktime_t next = { .tv64 = KTIME_MAX };
+	int i;
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++, base++) {
+		ktime_t expires;
+
+		spin_lock(&base->lock);
+		if (base->first) {
+			expires = hrtimer_mono_expires(rb_entry(base->first,
+						struct hrtimer, node), base);
+			if (expires.tv64 < next.tv64)
+				next = expires;
+		}
+		spin_unlock(&base->lock);
+	}
+
+	__get_cpu_var(expires_next) = next;
+	hrtimer_arch_program_event(next);
+}
+
+/*
+ * Switch this CPU's bases over to the one-shot event device, if the
+ * architecture can provide one. Returns 1 when high resolution mode
+ * is active afterwards.
+ */
+static int hrtimer_switch_to_hres(void)
+{
+	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+	unsigned long flags;
+	int i;
+
+	if (!hrtimer_hres_enabled)
+		return 0;
+
+	local_irq_save(flags);
+	if (hrtimer_arch_switch_to_oneshot()) {
+		/* No one-shot device (yet), try again on the next tick */
+		local_irq_restore(flags);
+		return 0;
+	}
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++)
+		base[i].resolution = KTIME_HIGH_RES;
+
+	__get_cpu_var(hres_active) = 1;
+	hrtimer_force_reprogram();
+	local_irq_restore(flags);
+
+	printk(KERN_INFO "hrtimers: switched to high resolution mode on CPU %d\n",
+	       smp_processor_id());
+	return 1;
+}
+
+static void retrigger_next_event(void *arg)
+{
+	unsigned long flags;
+
+	if (!hrtimer_hres_active())
+		return;
+
+	local_irq_save(flags);
+	hrtimer_force_reprogram();
+	local_irq_restore(flags);
+}
+
+#else
+
+static inline int hrtimer_hres_active(void) { return 0; }
+static inline void
+hrtimer_reprogram(struct hrtimer *timer, struct hrtimer_base *base) { }
+static inline int hrtimer_switch_to_hres(void) { return 0; }
+static inline void retrigger_next_event(void *arg) { }
+
+#endif /* CONFIG_HIGH_RES_TIMERS */
+
+/*
+ * Functions and macros which are different for UP/SMP systems are kept in a
+ * single place
+ */
+#ifdef CONFIG_SMP
+
+/*
+ * We are using hashed locking: holding per_cpu(hrtimer_bases)[n].lock
+ * means that all timers which are tied to this base via timer->base are
+ * locked, and the base itself is locked too.
+ *
+ * So run_hrtimer_queue/migrate_hrtimers can safely modify all timers
+ * which could be found in the rbtrees.
+ *
+ * When the timer's base is locked, and the timer removed from list, it is
+ * possible to set timer->base = NULL and drop the lock: the timer remains
+ * locked.
+ */
+static struct hrtimer_base *lock_hrtimer_base(const struct hrtimer *timer,
+					      unsigned long *flags)
+{
+	struct hrtimer_base *base;
+
+	for (;;) {
+		base = timer->base;
+		if (likely(base != NULL)) {
+			spin_lock_irqsave(&base->lock, *flags);
+			if (likely(base == timer->base))
+				return base;
+			/* The timer has migrated to another CPU: */
+			spin_unlock_irqrestore(&base->lock, *flags);
+		}
+		cpu_relax();
+	}
+}
+
+/*
+ * Switch the timer base to the current CPU when possible.
+ */
+static inline struct hrtimer_base *
+switch_hrtimer_base(struct hrtimer *timer, struct hrtimer_base *base)
+{
+	struct hrtimer_base *new_base;
+
+	new_base = &__get_cpu_var(hrtimer_bases)[base->index];
+
+	if (base != new_base) {
+		/*
+		 * We are trying to schedule the timer on the local CPU.
+		 * However we can't change timer's base while it is running,
+		 * so we keep it on the same CPU. No hassle vs. reprogramming
+		 * the event source in the high resolution case. The softirq
+		 * code will take care of this when the timer function has
+		 * completed. There is no conflict as we hold the lock until
+		 * the timer is enqueued.
+		 */
+		if (unlikely(base->curr_timer == timer))
+			return base;
+
+		/* See the comment in lock_hrtimer_base() */
+		timer->base = NULL;
+		spin_unlock(&base->lock);
+		spin_lock(&new_base->lock);
+		timer->base = new_base;
+	}
+	return new_base;
+}
+
+#else /* CONFIG_SMP */
+
+static inline struct hrtimer_base *
+lock_hrtimer_base(const struct hrtimer *timer, unsigned long *flags)
+{
+	struct hrtimer_base *base = timer->base;
+
+	spin_lock_irqsave(&base->lock, *flags);
+
+	return base;
+}
+
+#define switch_hrtimer_base(t, b)	(b)
+
+#endif	/* !CONFIG_SMP */
+
+static inline void unlock_hrtimer_base(const struct hrtimer *timer,
+				       unsigned long *flags)
+{
+	spin_unlock_irqrestore(&timer->base->lock, *flags);
+}
+
+/*
+ * Divide a ktime value by a nanosecond value
+ */
+static unsigned long ktime_divns(const ktime_t kt, s64 div)
+{
+#if BITS_PER_LONG >= 64
+	return kt.tv64 / div;
+#else
+	u64 dclc = kt.tv64;
+	int sft = 0;
+
+	/* Make sure the divisor is less than 2^32: */
+	while (div >> 32) {
+		sft++;
+		div >>= 1;
+	}
+	dclc >>= sft;
+	do_div(dclc, (unsigned long) div);
+
+	return (unsigned long) dclc;
+#endif
+}
+
+/**
+ * hrtimer_forward - forward the timer expiry
+ *
+ * @timer:	hrtimer to forward
+ * @now:	forward past this time
+ * @interval:	the interval to forward
+ *
+ * Forward the timer expiry so it will expire in the future.
+ * Returns the number of overruns.
+ */
+unsigned long
+hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval)
+{
+	unsigned long orun = 1;
+	ktime_t delta;
+
+	delta = ktime_sub(now, timer->expires);
+
+	if (delta.tv64 < 0)
+		return 0;
+
+	if (interval.tv64 < timer->base->resolution.tv64)
+		interval.tv64 = timer->base->resolution.tv64;
+
+	if (unlikely(delta.tv64 >= interval.tv64)) {
+		s64 incr = ktime_to_ns(interval);
+
+		orun = ktime_divns(delta, incr);
+		timer->expires = ktime_add_ns(timer->expires, incr * orun);
+		if (timer->expires.tv64 > now.tv64)
+			return orun;
+		/*
+		 * This (and the ktime_add() below) is the
+		 * correction for exact:
+		 */
+		orun++;
+	}
+	timer->expires = ktime_add(timer->expires, interval);
+
+	return orun;
+}
+
+EXPORT_SYMBOL_GPL(hrtimer_forward);
+
+/*
+ * enqueue_hrtimer - internal function to (re)start a timer
+ *
+ * The timer is inserted in expiry order. Insertion into the
+ * red black tree is O(log(n)). Must hold the base lock.
+ */
+static void enqueue_hrtimer(struct hrtimer *timer, struct hrtimer_base *base)
+{
+	struct rb_node **link = &base->active.rb_node;
+	struct rb_node *parent = NULL;
+	struct hrtimer *entry;
+
+	/*
+	 * Find the right place in the rbtree:
+	 */
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct hrtimer, node);
+		/*
+		 * We dont care about collisions. Nodes with
+		 * the same expiry time stay together.
+		 */
+		if (timer->expires.tv64 < entry->expires.tv64)
+			link = &(*link)->rb_left;
+		else
+			link = &(*link)->rb_right;
+	}
+
+	/*
+	 * Insert the timer to the rbtree and check whether it
+	 * replaces the first pending timer
+	 */
+	rb_link_node(&timer->node, parent, link);
+	rb_insert_color(&timer->node, &base->active);
+
+	if (!base->first || timer->expires.tv64 <
+	    rb_entry(base->first, struct hrtimer, node)->expires.tv64) {
+		base->first = &timer->node;
+		hrtimer_reprogram(timer, base);
+	}
+}
+
+/*
+ * __remove_hrtimer - internal function to remove a timer
+ *
+ * Caller must hold the base lock.
+ *
+ * The event device is not reprogrammed when the first timer goes
+ * away; the next event simply finds nothing to do.
+ */
+static void __remove_hrtimer(struct hrtimer *timer, struct hrtimer_base *base)
+{
+	/*
+	 * Remove the timer from the rbtree and replace the
+	 * first entry pointer if necessary.
+	 */
+	if (base->first == &timer->node)
+		base->first = rb_next(&timer->node);
+	rb_erase(&timer->node, &base->active);
+	timer->node.rb_parent = HRTIMER_INACTIVE;
+}
+
+/*
+ * remove hrtimer, called with base lock held
+ */
+static inline int
+remove_hrtimer(struct hrtimer *timer, struct hrtimer_base *base)
+{
+	if (hrtimer_active(timer)) {
+		__remove_hrtimer(timer, base);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * hrtimer_start - (re)start an relative timer on the current CPU
+ *
+ * @timer:	the timer to be added
+ * @tim:	expiry time
+ * @mode:	expiry mode: absolute (HRTIMER_ABS) or relative (HRTIMER_REL)
+ *
+ * Returns:
+ *  0 on success
+ *  1 when the timer was active
+ */
+int
+hrtimer_start(struct hrtimer *timer, ktime_t tim, const enum hrtimer_mode mode)
+{
+	struct hrtimer_base *base, *new_base;
+	unsigned long flags;
+	int ret;
+
+	base = lock_hrtimer_base(timer, &flags);
+
+	/* Remove an active timer from the queue: */
+	ret = remove_hrtimer(timer, base);
+
+	/* Switch the timer base, if necessary: */
+	new_base = switch_hrtimer_base(timer, base);
+
+	if (mode == HRTIMER_REL) {
+		tim = ktime_add(tim, new_base->get_time());
+		/* Relative times past the end of time stay there: */
+		if (tim.tv64 < 0)
+			tim.tv64 = KTIME_MAX;
+	}
+	timer->expires = tim;
+
+	enqueue_hrtimer(timer, new_base);
+
+	unlock_hrtimer_base(timer, &flags);
+
+	return ret;
+}
+
+EXPORT_SYMBOL_GPL(hrtimer_start);
+
+/**
+ * hrtimer_try_to_cancel - try to deactivate a timer
+ *
+ * @timer:	hrtimer to stop
+ *
+ * Returns:
+ *  0 when the timer was not active
+ *  1 when the timer was active
+ * -1 when the timer is currently excuting the callback function and
+ *    can not be stopped
+ */
+int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+	struct hrtimer_base *base;
+	unsigned long flags;
+	int ret = -1;
+
+	base = lock_hrtimer_base(timer, &flags);
+
+	if (base->curr_timer != timer)
+		ret = remove_hrtimer(timer, base);
+
+	unlock_hrtimer_base(timer, &flags);
+
+	return ret;
+
+}
+
+EXPORT_SYMBOL_GPL(hrtimer_try_to_cancel);
+
+/**
+ * hrtimer_cancel - cancel a timer and wait for the handler to finish.
+ *
+ * @timer:	the timer to be cancelled
+ *
+ * Returns:
+ *  0 when the timer was not active
+ *  1 when the timer was active
+ */
+int hrtimer_cancel(struct hrtimer *timer)
+{
+	for (;;) {
+		int ret = hrtimer_try_to_cancel(timer);
+
+		if (ret >= 0)
+			return ret;
+		cpu_relax();
+	}
+}
+
+EXPORT_SYMBOL_GPL(hrtimer_cancel);
+
+/**
+ * hrtimer_get_remaining - get remaining time for the timer
+ *
+ * @timer:	the timer to read
+ */
+ktime_t hrtimer_get_remaining(const struct hrtimer *timer)
+{
+	struct hrtimer_base *base;
+	unsigned long flags;
+	ktime_t rem;
+
+	base = lock_hrtimer_base(timer, &flags);
+	rem = ktime_sub(timer->expires, base->get_time());
+	unlock_hrtimer_base(timer, &flags);
+
+	return rem;
+}
+
+EXPORT_SYMBOL_GPL(hrtimer_get_remaining);
+
+/**
+ * hrtimer_init - initialize a timer to the given clock
+ *
+ * @timer:	the timer to be initialized
+ * @clock_id:	the clock to be used
+ * @mode:	timer mode abs/rel
+ *
+ * Relative CLOCK_REALTIME timers are queued on CLOCK_MONOTONIC, so
+ * that setting the clock does not move them.
+ */
+void hrtimer_init(struct hrtimer *timer, clockid_t clock_id,
+		  enum hrtimer_mode mode)
+{
+	struct hrtimer_base *bases;
+
+	memset(timer, 0, sizeof(struct hrtimer));
+
+	bases = get_cpu_var(hrtimer_bases);
+
+	if (clock_id == CLOCK_REALTIME && mode != HRTIMER_ABS)
+		clock_id = CLOCK_MONOTONIC;
+
+	timer->base = &bases[clock_id];
+	timer->node.rb_parent = HRTIMER_INACTIVE;
+
+	put_cpu_var(hrtimer_bases);
+}
+
+EXPORT_SYMBOL_GPL(hrtimer_init);
+
+/**
+ * hrtimer_get_res - get the timer resolution for a clock
+ *
+ * @which_clock: which clock to query
+ * @tp:		 pointer to timespec variable to store the resolution
+ *
+ * Store the resolution of the clock selected by which_clock in the
+ * variable pointed to by tp.
+ */
+int hrtimer_get_res(const clockid_t which_clock, struct timespec *tp)
+{
+	struct hrtimer_base *bases;
+
+	bases = get_cpu_var(hrtimer_bases);
+	*tp = ktime_to_timespec(bases[which_clock].resolution);
+	put_cpu_var(hrtimer_bases);
+
+	return 0;
+}
+
+EXPORT_SYMBOL_GPL(hrtimer_get_res);
+
+/*
+ * Expire the timers of a base which are due at 'now'. The callbacks
+ * run without the base lock held; a callback returning HRTIMER_RESTART
+ * has moved its expiry and is queued again.
+ */
+static void run_hrtimer_queue(struct hrtimer_base *base, ktime_t now)
+{
+	struct rb_node *node;
+	unsigned long flags;
+
+	spin_lock_irqsave(&base->lock, flags);
+
+	while ((node = base->first)) {
+		struct hrtimer *timer;
+		int restart;
+
+		timer = rb_entry(node, struct hrtimer, node);
+		if (now.tv64 < timer->expires.tv64)
+			break;
+
+		__remove_hrtimer(timer, base);
+		base->curr_timer = timer;
+		spin_unlock_irqrestore(&base->lock, flags);
+
+		restart = timer->function(timer);
+
+		spin_lock_irqsave(&base->lock, flags);
+		base->curr_timer = NULL;
+
+		if (restart != HRTIMER_NORESTART) {
+			BUG_ON(hrtimer_active(timer));
+			enqueue_hrtimer(timer, base);
+		}
+	}
+	spin_unlock_irqrestore(&base->lock, flags);
+}
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+/*
+ * High resolution timer interrupt
+ * Called with interrupts disabled
+ */
+void hrtimer_interrupt(void)
+{
+	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+	int i;
+
+	if (!hrtimer_hres_active())
+		return;
+
+	/*
+	 * Callbacks which requeue their timer must not reprogram the
+	 * device one by one; we do that once when all bases are done.
+	 */
+	__get_cpu_var(expires_next).tv64 = 0;
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++, base++)
+		run_hrtimer_queue(base, base->get_time());
+
+	hrtimer_force_reprogram();
+}
+#endif
+
+#ifdef CONFIG_NO_IDLE_HZ
+/**
+ * hrtimer_get_next_event - get the time until the next hrtimer expiry
+ *
+ * Returns the delta to the first expiry over this CPU's bases, or
+ * KTIME_MAX if there is none, or if the bases are run from the
+ * one-shot event device anyway. Called with interrupts disabled.
+ */
+ktime_t hrtimer_get_next_event(void)
+{
+	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+	ktime_t delta, mindelta = { .tv64 = KTIME_MAX };
+	int i;
+
+	if (hrtimer_hres_active())
+		return mindelta;
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++, base++) {
+		struct hrtimer *timer;
+
+		spin_lock(&base->lock);
+		if (base->first) {
+			timer = rb_entry(base->first, struct hrtimer, node);
+			delta = ktime_sub(timer->expires, base->get_time());
+			if (delta.tv64 < mindelta.tv64)
+				mindelta = delta;
+		}
+		spin_unlock(&base->lock);
+	}
+
+	if (mindelta.tv64 < 0)
+		mindelta.tv64 = 0;
+	return mindelta;
+}
+#endif
+
+/*
+ * Called from the timer softirq every jiffy. Runs the timer queues
+ * with tick resolution, until the CPU can be switched to high
+ * resolution mode.
+ */
+void hrtimer_run_queues(void)
+{
+	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+	int i;
+
+	if (hrtimer_hres_active())
+		return;
+
+	if (hrtimer_switch_to_hres())
+		return;
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++)
+		run_hrtimer_queue(&base[i], base[i].get_time());
+}
+
+/*
+ * Sleep related functions:
+ */
+static int hrtimer_wakeup(struct hrtimer *timer)
+{
+	struct hrtimer_sleeper *t =
+		container_of(timer, struct hrtimer_sleeper, timer);
+	struct task_struct *task = t->task;
+
+	t->task = NULL;
+	if (task)
+		wake_up_process(task);
+
+	return HRTIMER_NORESTART;
+}
+
+void hrtimer_init_sleeper(struct hrtimer_sleeper *sl, struct task_struct *task)
+{
+	sl->timer.function = hrtimer_wakeup;
+	sl->task = task;
+}
+
+static int __sched do_nanosleep(struct hrtimer_sleeper *t, enum hrtimer_mode mode)
+{
+	hrtimer_init_sleeper(t, current);
+
+	do {
+		set_current_state(TASK_INTERRUPTIBLE);
+		hrtimer_start(&t->timer, t->timer.expires, mode);
+
+		schedule();
+
+		hrtimer_cancel(&t->timer);
+		mode = HRTIMER_ABS;
+
+	} while (t->task && !signal_pending(current));
+
+	return t->task == NULL;
+}
+
+/*
+ * Restart a nanosleep which was interrupted by a signal that did not
+ * interrupt the syscall. The absolute expiry is kept in arg2/arg3, the
+ * clock in arg0 and the user's remaining time pointer in arg1 (set by
+ * the syscall, which knows the user address).
+ */
+static long __sched nanosleep_restart(struct restart_block *restart)
+{
+	struct hrtimer_sleeper t;
+	struct timespec __user *rmtp;
+	struct timespec tu;
+	ktime_t time;
+
+	restart->fn = do_no_restart_syscall;
+
+	hrtimer_init(&t.timer, restart->arg0, HRTIMER_ABS);
+	t.timer.expires.tv64 = ((u64)restart->arg3 << 32) | (u64) restart->arg2;
+
+	if (do_nanosleep(&t, HRTIMER_ABS))
+		return 0;
+
+	rmtp = (struct timespec __user *) restart->arg1;
+	if (rmtp) {
+		time = ktime_sub(t.timer.expires, t.timer.base->get_time());
+		if (time.tv64 <= 0)
+			return 0;
+		tu = ktime_to_timespec(time);
+		if (copy_to_user(rmtp, &tu, sizeof(tu)))
+			return -EFAULT;
+	}
+
+	restart->fn = nanosleep_restart;
+
+	/* The other values in restart are already filled in */
+	return -ERESTART_RESTARTBLOCK;
+}
+
+/**
+ * hrtimer_nanosleep - sleep on a clock
+ *
+ * @rqtp:	the requested sleep time
+ * @rmtp:	kernel copy of the remaining time, or NULL
+ * @mode:	HRTIMER_ABS or HRTIMER_REL
+ * @clockid:	the clock to sleep on
+ *
+ * Returns 0 when the time has elapsed, -ERESTART_RESTARTBLOCK with the
+ * remaining time in *rmtp when a relative sleep was interrupted, and
+ * -ERESTARTNOHAND when an absolute one was. The caller stores the user
+ * address of the remaining time in restart_block.arg1.
+ */
+long hrtimer_nanosleep(struct timespec *rqtp, struct timespec *rmtp,
+		       const enum hrtimer_mode mode, const clockid_t clockid)
+{
+	struct restart_block *restart;
+	struct hrtimer_sleeper t;
+	ktime_t rem;
+
+	hrtimer_init(&t.timer, clockid, mode);
+	t.timer.expires = timespec_to_ktime(*rqtp);
+	if (do_nanosleep(&t, mode))
+		return 0;
+
+	/* Absolute timers do not update the rmtp value and restart: */
+	if (mode == HRTIMER_ABS)
+		return -ERESTARTNOHAND;
+
+	if (rmtp) {
+		rem = ktime_sub(t.timer.expires, t.timer.base->get_time());
+		if (rem.tv64 <= 0)
+			return 0;
+		*rmtp = ktime_to_timespec(rem);
+	}
+
+	restart = &current_thread_info()->restart_block;
+	restart->fn = nanosleep_restart;
+	restart->arg0 = (unsigned long) t.timer.base->index;
+	restart->arg2 = t.timer.expires.tv64 & 0xFFFFFFFF;
+	restart->arg3 = t.timer.expires.tv64 >> 32;
+
+	return -ERESTART_RESTARTBLOCK;
+}
+
+asmlinkage long
+sys_nanosleep(struct timespec __user *rqtp, struct timespec __user *rmtp)
+{
+	struct timespec tu, rmt;
+	int ret;
+
+	if (copy_from_user(&tu, rqtp, sizeof(tu)))
+		return -EFAULT;
+
+	if ((tu.tv_nsec >= NSEC_PER_SEC) || (tu.tv_nsec < 0) || (tu.tv_sec < 0))
+		return -EINVAL;
+
+	current_thread_info()->restart_block.arg1 = (unsigned long) rmtp;
+
+	ret = hrtimer_nanosleep(&tu, rmtp ? &rmt : NULL, HRTIMER_REL,
+				CLOCK_MONOTONIC);
+
+	if ((ret == -ERESTART_RESTARTBLOCK) && rmtp &&
+	    copy_to_user(rmtp, &rmt, sizeof(rmt)))
+		return -EFAULT;
+
+	return ret;
+}
+
+/*
+ * The clock was set. Relative timers are queued on CLOCK_MONOTONIC
+ * and do not care; absolute CLOCK_REALTIME timers keep their wall
+ * time expiry and are checked against the new time on the next run.
+ * In high resolution mode the programmed events are in monotonic
+ * time, so every CPU has to recompute its next event.
+ *
+ * clock_was_set() may be called from interrupt context, in which
+ * case the IPIs are deferred to keventd.
+ */
+static DECLARE_WORK(clock_was_set_work, (void(*)(void*))clock_was_set, NULL);
+
+void clock_was_set(void)
+{
+	if (unlikely(in_interrupt())) {
+		schedule_work(&clock_was_set_work);
+		return;
+	}
+	/* Retrigger the CPU local events everywhere */
+	on_each_cpu(retrigger_next_event, NULL, 0, 1);
+}
+
+/*
+ * Functions related to boot-time initialization:
+ */
+static void __devinit init_hrtimers_cpu(int cpu)
+{
+	struct hrtimer_base *base = per_cpu(hrtimer_bases, cpu);
+	int i;
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++, base++) {
+		spin_lock_init(&base->lock);
+		base->index = i;
+		base->active = RB_ROOT;
+		base->first = NULL;
+		base->resolution = KTIME_LOW_RES;
+		base->curr_timer = NULL;
+	}
+	base = per_cpu(hrtimer_bases, cpu);
+	base[CLOCK_REALTIME].get_time = ktime_get_real;
+	base[CLOCK_MONOTONIC].get_time = ktime_get;
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+	per_cpu(hres_active, cpu) = 0;
+	per_cpu(expires_next, cpu).tv64 = KTIME_MAX;
+#endif
+}
+
+#ifdef CONFIG_HOTPLUG_CPU
+
+static void migrate_hrtimer_list(struct hrtimer_base *old_base,
+				struct hrtimer_base *new_base)
+{
+	struct hrtimer *timer;
+	struct rb_node *node;
+
+	while ((node = rb_first(&old_base->active))) {
+		timer = rb_entry(node, struct hrtimer, node);
+		__remove_hrtimer(timer, old_base);
+		timer->base = new_base;
+		enqueue_hrtimer(timer, new_base);
+	}
+}
+
+static void migrate_hrtimers(int cpu)
+{
+	struct hrtimer_base *old_base, *new_base;
+	int i;
+
+	BUG_ON(cpu_online(cpu));
+	old_base = per_cpu(hrtimer_bases, cpu);
+	new_base = get_cpu_var(hrtimer_bases);
+
+	local_irq_disable();
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++) {
+
+		spin_lock(&new_base->lock);
+		spin_lock(&old_base->lock);
+
+		BUG_ON(old_base->curr_timer);
+
+		migrate_hrtimer_list(old_base, new_base);
+
+		spin_unlock(&old_base->lock);
+		spin_unlock(&new_base->lock);
+		old_base++;
+		new_base++;
+	}
+
+	local_irq_enable();
+	put_cpu_var(hrtimer_bases);
+}
+#endif /* CONFIG_HOTPLUG_CPU */
+
+static int __devinit hrtimer_cpu_notify(struct notifier_block *self,
+					unsigned long action, void *hcpu)
+{
+	long cpu = (long)hcpu;
+
+	switch (action) {
+
+	case CPU_UP_PREPARE:
+		init_hrtimers_cpu(cpu);
+		break;
+
+#ifdef CONFIG_HOTPLUG_CPU
+	case CPU_DEAD:
+		migrate_hrtimers(cpu);
+		break;
+#endif
+
+	default:
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __devinitdata hrtimers_nb = {
+	.notifier_call = hrtimer_cpu_notify,
+};
+
+void __init hrtimers_init(void)
+{
+	hrtimer_cpu_notify(&hrtimers_nb, (unsigned long)CPU_UP_PREPARE,
+			  (void *)(long)smp_processor_id());
+	register_cpu_notifier(&hrtimers_nb);
+}
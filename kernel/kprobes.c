@@ -34,6 +34,7 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <asm/cacheflush.h>
+#include <asm/semaphore.h>
 #include <asm/errno.h>
 #include <asm/kdebug.h>
 
@@ -44,6 +45,8 @@ static struct hlist_head kprobe_table[KPROBE_TABLE_SIZE];
 
 unsigned int kprobe_cpu = NR_CPUS;
 static DEFINE_SPINLOCK(kprobe_lock);
+/* Serialises registration, which may sleep to optimize a probe */
+static DECLARE_MUTEX(kprobe_mutex);
 
 /* Locks kprobe: irqs must be disabled */
 void lock_kprobes(void)
@@ -73,13 +76,50 @@ struct kprobe *get_kprobe(void *addr)
 	return NULL;
 }
 
+#ifdef CONFIG_OPTPROBES
+/*
+ * The optimized probe whose jump covers addr, if any.  Holding
+ * kprobe_mutex keeps the table from changing under us.
+ */
+static struct kprobe *get_optimized_kprobe(kprobe_opcode_t *addr)
+{
+	struct kprobe *p;
+	int i;
+
+	for (i = 1; i < MAX_OPTIMIZED_LENGTH; i++) {
+		p = get_kprobe(addr - i);
+		if (p && kprobe_optimized(p) && addr < p->addr + p->ainsn.opt_len)
+			return p;
+	}
+	return NULL;
+}
+
+/* Probes with post or break handlers need the single-step */
+static void try_to_optimize_kprobe(struct kprobe *p)
+{
+	if (!p->post_handler && !p->break_handler)
+		arch_optimize_kprobe(p);
+}
+#endif
+
 int register_kprobe(struct kprobe *p)
 {
 	int ret = 0;
 	unsigned long flags = 0;
 
+	down(&kprobe_mutex);
+#ifdef CONFIG_OPTPROBES
+	{
+		/* Its jump is in the way of the new breakpoint */
+		struct kprobe *op = get_optimized_kprobe(p->addr);
+
+		if (op)
+			arch_unoptimize_kprobe(op);
+	}
+#endif
 	if ((ret = arch_prepare_kprobe(p)) != 0) {
-		goto out;
+		up(&kprobe_mutex);
+		return ret;
 	}
 	spin_lock_irqsave(&kprobe_lock, flags);
 	INIT_HLIST_NODE(&p->hlist);
@@ -100,12 +140,23 @@ int register_kprobe(struct kprobe *p)
 	spin_unlock_irqrestore(&kprobe_lock, flags);
 	if (ret == -EEXIST)
 		arch_remove_kprobe(p);
+#ifdef CONFIG_OPTPROBES
+	else if (!ret)
+		try_to_optimize_kprobe(p);
+#endif
+	up(&kprobe_mutex);
 	return ret;
 }
 
 void unregister_kprobe(struct kprobe *p)
 {
 	unsigned long flags;
+
+	down(&kprobe_mutex);
+#ifdef CONFIG_OPTPROBES
+	if (kprobe_optimized(p))
+		arch_unoptimize_kprobe(p);
+#endif
 	arch_remove_kprobe(p);
 	spin_lock_irqsave(&kprobe_lock, flags);
 	*p->addr = p->opcode;
@@ -113,6 +164,7 @@ void unregister_kprobe(struct kprobe *p)
 	flush_icache_range((unsigned long) p->addr,
 			   (unsigned long) p->addr + sizeof(kprobe_opcode_t));
 	spin_unlock_irqrestore(&kprobe_lock, flags);
+	up(&kprobe_mutex);
 }
 
 static struct notifier_block kprobe_exceptions_nb = {
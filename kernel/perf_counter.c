@@ -0,0 +1,780 @@
+/*
+ * kernel/perf_counter.c
+ *
+ * Performance counters, per task or per cpu, read through a file
+ * descriptor.  See include/linux/perf_counter.h.
+ *
+ * The counters of a task are put on the cpu by context_switch() and
+ * taken off again when it switches out, so they count only while it
+ * runs.  Per cpu counters stay on their cpu for as long as they are
+ * enabled, and get the hardware first: a task counter that finds no
+ * hardware counter free at switch in does not count for that period.
+ *
+ * A counter is only ever active on one cpu at a time, and only that
+ * cpu touches its hardware, so operations on an active counter are done
+ * there, by IPI when need be.  Samples are written from counter overflow
+ * interrupts, NMI on some machines, so the wakeups of readers are left
+ * to perf_counter_do_pending() from the timer tick, and to the switch
+ * out of the task.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/smp.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/mount.h>
+#include <linux/poll.h>
+#include <linux/percpu.h>
+#include <linux/syscalls.h>
+#include <linux/perf_counter.h>
+#include <asm/uaccess.h>
+#include <asm/ptrace.h>
+
+struct perf_cpu_context {
+	struct perf_counter_context	ctx;
+	struct perf_counter_context	*task_ctx;	/* Of current, if any */
+};
+
+static DEFINE_PER_CPU(struct perf_cpu_context, perf_cpu_context);
+
+static struct vfsmount *perf_counter_mnt;
+
+/* Architectures with hardware counters override this. */
+const struct hw_perf_counter_ops * __attribute__((weak))
+hw_perf_counter_init(struct perf_counter *counter)
+{
+	return NULL;
+}
+
+static void init_perf_counter_context(struct perf_counter_context *ctx,
+				      struct task_struct *task)
+{
+	spin_lock_init(&ctx->lock);
+	INIT_LIST_HEAD(&ctx->counter_list);
+	ctx->nr_counters = 0;
+	ctx->nr_active = 0;
+	ctx->last_cpu = -1;
+	ctx->exited = 0;
+	ctx->task = task;
+}
+
+/*
+ * Run func on cpu, with interrupts off.  It may find the counter it was
+ * sent for gone from there by the time it runs, and must check.
+ */
+static void perf_cpu_call(int cpu, void (*func)(void *), void *info)
+{
+	preempt_disable();
+	if (cpu == smp_processor_id()) {
+		local_irq_disable();
+		func(info);
+		local_irq_enable();
+	} else
+		smp_call_function(func, info, 0, 1);
+	preempt_enable();
+}
+
+/* Is ctx on this cpu at the moment?  Interrupts off. */
+static inline int perf_ctx_is_current(struct perf_counter_context *ctx)
+{
+	return ctx->task ? ctx->task == current
+			 : ctx == &__get_cpu_var(perf_cpu_context).ctx;
+}
+
+/* ctx->lock held, interrupts off */
+static void counter_sched_in(struct perf_counter *counter,
+			     struct perf_counter_context *ctx, int cpu)
+{
+	if (counter->state != PERF_COUNTER_STATE_INACTIVE)
+		return;
+	if (counter->cpu != -1 && counter->cpu != cpu)
+		return;
+	if (counter->ops->enable(counter))
+		return;
+	counter->state = PERF_COUNTER_STATE_ACTIVE;
+	counter->oncpu = cpu;
+	ctx->nr_active++;
+}
+
+static void counter_sched_out(struct perf_counter *counter,
+			      struct perf_counter_context *ctx)
+{
+	counter->ops->disable(counter);
+	counter->state = PERF_COUNTER_STATE_INACTIVE;
+	counter->oncpu = -1;
+	ctx->nr_active--;
+}
+
+/*
+ * Called from context_switch(), with the runqueue lock held and
+ * interrupts off, to take the counters of task off the cpu.
+ */
+void perf_counter_task_sched_out(struct task_struct *task, int cpu)
+{
+	struct perf_cpu_context *cpuctx = &per_cpu(perf_cpu_context, cpu);
+	struct perf_counter_context *ctx = &task->perf_counter_ctx;
+	struct perf_counter *counter;
+
+	if (cpuctx->ctx.nr_active || cpuctx->task_ctx)
+		perf_swcounter_event(PERF_COUNT_CONTEXT_SWITCHES, 1, NULL);
+	if (!cpuctx->task_ctx)
+		return;
+
+	spin_lock(&ctx->lock);
+	list_for_each_entry(counter, &ctx->counter_list, list_entry)
+		if (counter->state == PERF_COUNTER_STATE_ACTIVE)
+			counter_sched_out(counter, ctx);
+	cpuctx->task_ctx = NULL;
+	spin_unlock(&ctx->lock);
+}
+
+/* ... and to put those of the next task on. */
+void perf_counter_task_sched_in(struct task_struct *task, int cpu)
+{
+	struct perf_cpu_context *cpuctx = &per_cpu(perf_cpu_context, cpu);
+	struct perf_counter_context *ctx = &task->perf_counter_ctx;
+	struct perf_counter *counter;
+	int migrated;
+
+	if (!ctx->nr_counters)
+		return;
+
+	spin_lock(&ctx->lock);
+	migrated = ctx->last_cpu != -1 && ctx->last_cpu != cpu;
+	ctx->last_cpu = cpu;
+	list_for_each_entry(counter, &ctx->counter_list, list_entry)
+		counter_sched_in(counter, ctx, cpu);
+	cpuctx->task_ctx = ctx;
+	spin_unlock(&ctx->lock);
+
+	if (migrated)
+		perf_swcounter_event(PERF_COUNT_CPU_MIGRATIONS, 1, NULL);
+}
+
+/* Wake up those waiting for samples of counters in ctx.  Under RCU. */
+static void perf_ctx_wakeup(struct perf_counter_context *ctx)
+{
+	struct perf_counter *counter;
+
+	list_for_each_entry_rcu(counter, &ctx->counter_list, list_entry)
+		if (counter->wakeup_pending && xchg(&counter->wakeup_pending, 0))
+			wake_up_all(&counter->waitq);
+}
+
+/* After task switched out, with the runqueue unlocked. */
+void perf_counter_task_wakeup(struct task_struct *task)
+{
+	struct perf_counter_context *ctx = &task->perf_counter_ctx;
+
+	if (!ctx->nr_counters)
+		return;
+	rcu_read_lock();
+	perf_ctx_wakeup(ctx);
+	rcu_read_unlock();
+}
+
+/* From the timer tick. */
+void perf_counter_do_pending(void)
+{
+	struct perf_cpu_context *cpuctx;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	cpuctx = &__get_cpu_var(perf_cpu_context);
+	if (cpuctx->ctx.nr_counters)
+		perf_ctx_wakeup(&cpuctx->ctx);
+	if (cpuctx->task_ctx)
+		perf_ctx_wakeup(cpuctx->task_ctx);
+	local_irq_restore(flags);
+}
+
+/*
+ * Write a sample of counter to its ring, if it is mapped.  Only ever
+ * called on the cpu the counter is active on, from one context.
+ */
+void perf_counter_output(struct perf_counter *counter, u64 ip)
+{
+	struct perf_mmap_data *data;
+	struct perf_counter_sample *sample;
+	unsigned long offset;
+
+	rcu_read_lock();
+	data = rcu_dereference(counter->data);
+	if (!data)
+		goto out;
+
+	offset = data->head & ((data->nr_pages << PAGE_SHIFT) - 1);
+	sample = data->data_pages[offset >> PAGE_SHIFT] +
+		 (offset & ~PAGE_MASK);
+	sample->ip = ip;
+	sample->pid = current->tgid;
+	sample->tid = current->pid;
+
+	data->head += sizeof(*sample);
+	smp_wmb();
+	data->user_page->data_head = data->head;
+	counter->wakeup_pending = 1;
+out:
+	rcu_read_unlock();
+}
+
+/*
+ * Software counters count in perf_swcounter_event() while active, and
+ * need nothing from the methods.
+ */
+static int perf_swcounter_enable(struct perf_counter *counter)
+{
+	return 0;
+}
+
+static void perf_swcounter_disable(struct perf_counter *counter)
+{
+}
+
+static void perf_swcounter_read(struct perf_counter *counter)
+{
+}
+
+static const struct hw_perf_counter_ops perf_ops_software = {
+	.enable		= perf_swcounter_enable,
+	.disable	= perf_swcounter_disable,
+	.read		= perf_swcounter_read,
+};
+
+static void perf_swcounter_ctx_event(struct perf_counter_context *ctx,
+				     u32 event, u64 nr, struct pt_regs *regs)
+{
+	struct perf_counter *counter;
+
+	spin_lock(&ctx->lock);
+	list_for_each_entry(counter, &ctx->counter_list, list_entry) {
+		if (counter->state != PERF_COUNTER_STATE_ACTIVE ||
+		    counter->hw_event.type != PERF_TYPE_SOFTWARE ||
+		    counter->hw_event.config != event)
+			continue;
+		counter->count += nr;
+		if (!counter->hw_event.irq_period)
+			continue;
+		counter->hw.period_left -= nr;
+		if (counter->hw.period_left > 0)
+			continue;
+		counter->hw.period_left += counter->hw_event.irq_period;
+		perf_counter_output(counter, regs ? instruction_pointer(regs)
+						  : 0);
+	}
+	spin_unlock(&ctx->lock);
+}
+
+/* nr events of type event happened on this cpu. */
+void perf_swcounter_event(u32 event, u64 nr, struct pt_regs *regs)
+{
+	struct perf_cpu_context *cpuctx;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	cpuctx = &__get_cpu_var(perf_cpu_context);
+	if (cpuctx->ctx.nr_active)
+		perf_swcounter_ctx_event(&cpuctx->ctx, event, nr, regs);
+	if (cpuctx->task_ctx)
+		perf_swcounter_ctx_event(cpuctx->task_ctx, event, nr, regs);
+	local_irq_restore(flags);
+}
+
+/* Bring the count of an active counter up to date, on its cpu */
+static void __perf_counter_read(void *info)
+{
+	struct perf_counter *counter = info;
+
+	if (counter->state == PERF_COUNTER_STATE_ACTIVE &&
+	    counter->oncpu == smp_processor_id())
+		counter->ops->read(counter);
+}
+
+static u64 perf_counter_read(struct perf_counter *counter)
+{
+	int cpu = counter->oncpu;
+
+	if (counter->state == PERF_COUNTER_STATE_ACTIVE && cpu >= 0)
+		perf_cpu_call(cpu, __perf_counter_read, counter);
+	return counter->count;
+}
+
+static void __perf_counter_enable(void *info)
+{
+	struct perf_counter *counter = info;
+	struct perf_counter_context *ctx = counter->ctx;
+	int cpu = smp_processor_id();
+
+	if (!ctx->task && counter->cpu != cpu)
+		return;
+
+	spin_lock(&ctx->lock);
+	if (counter->state == PERF_COUNTER_STATE_OFF && !ctx->exited)
+		counter->state = PERF_COUNTER_STATE_INACTIVE;
+	if (perf_ctx_is_current(ctx)) {
+		counter_sched_in(counter, ctx, cpu);
+		if (ctx->task)
+			__get_cpu_var(perf_cpu_context).task_ctx = ctx;
+	}
+	spin_unlock(&ctx->lock);
+}
+
+/*
+ * A task counter enabled while the task runs elsewhere starts counting
+ * at its next switch in.
+ */
+static void perf_counter_enable(struct perf_counter *counter)
+{
+	perf_cpu_call(counter->task ? _smp_processor_id() : counter->cpu,
+		      __perf_counter_enable, counter);
+}
+
+static void __perf_counter_disable(void *info)
+{
+	struct perf_counter *counter = info;
+	struct perf_counter_context *ctx = counter->ctx;
+
+	spin_lock(&ctx->lock);
+	if (counter->state == PERF_COUNTER_STATE_ACTIVE &&
+	    counter->oncpu == smp_processor_id())
+		counter_sched_out(counter, ctx);
+	if (counter->state == PERF_COUNTER_STATE_INACTIVE)
+		counter->state = PERF_COUNTER_STATE_OFF;
+	spin_unlock(&ctx->lock);
+}
+
+/* Chase counter down to the cpu it is running on, if any. */
+static void perf_counter_disable(struct perf_counter *counter)
+{
+	while (counter->state != PERF_COUNTER_STATE_OFF) {
+		int cpu = counter->oncpu;
+
+		if (counter->state != PERF_COUNTER_STATE_ACTIVE || cpu < 0)
+			cpu = _smp_processor_id();
+		perf_cpu_call(cpu, __perf_counter_disable, counter);
+	}
+}
+
+static void perf_counter_install(struct perf_counter *counter)
+{
+	struct perf_counter_context *ctx = counter->ctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	list_add_tail_rcu(&counter->list_entry, &ctx->counter_list);
+	ctx->nr_counters++;
+	spin_unlock_irqrestore(&ctx->lock, flags);
+
+	if (counter->state == PERF_COUNTER_STATE_INACTIVE)
+		perf_counter_enable(counter);
+}
+
+static void free_counter_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct perf_counter, rcu_head));
+}
+
+static void perf_counter_remove(struct perf_counter *counter)
+{
+	struct perf_counter_context *ctx = counter->ctx;
+	unsigned long flags;
+
+	perf_counter_disable(counter);
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	list_del_rcu(&counter->list_entry);
+	ctx->nr_counters--;
+	spin_unlock_irqrestore(&ctx->lock, flags);
+
+	if (counter->task)
+		put_task_struct(counter->task);
+	call_rcu(&counter->rcu_head, free_counter_rcu);
+}
+
+void perf_counter_init_task(struct task_struct *task)
+{
+	init_perf_counter_context(&task->perf_counter_ctx, task);
+}
+
+/*
+ * task is exiting: stop its counters for good.  They stay on the
+ * context, which the counters pin with the task, until closed.
+ */
+void perf_counter_exit_task(struct task_struct *task)
+{
+	struct perf_counter_context *ctx = &task->perf_counter_ctx;
+	struct perf_counter *counter;
+
+	if (!ctx->nr_counters)
+		return;
+
+	local_irq_disable();
+	spin_lock(&ctx->lock);
+	ctx->exited = 1;
+	list_for_each_entry(counter, &ctx->counter_list, list_entry) {
+		if (counter->state == PERF_COUNTER_STATE_ACTIVE)
+			counter_sched_out(counter, ctx);
+		counter->state = PERF_COUNTER_STATE_OFF;
+	}
+	__get_cpu_var(perf_cpu_context).task_ctx = NULL;
+	spin_unlock(&ctx->lock);
+	local_irq_enable();
+}
+
+static ssize_t
+perf_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct perf_counter *counter = file->private_data;
+	u64 val;
+
+	if (count < sizeof(val))
+		return -EINVAL;
+	val = perf_counter_read(counter);
+	if (copy_to_user(buf, &val, sizeof(val)))
+		return -EFAULT;
+	return sizeof(val);
+}
+
+static unsigned int perf_poll(struct file *file, poll_table *wait)
+{
+	struct perf_counter *counter = file->private_data;
+	struct perf_mmap_data *data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &counter->waitq, wait);
+
+	rcu_read_lock();
+	data = rcu_dereference(counter->data);
+	if (data && data->user_page->data_head != data->user_page->data_tail)
+		mask = POLLIN | POLLRDNORM;
+	rcu_read_unlock();
+
+	return mask;
+}
+
+static int perf_ioctl(struct inode *inode, struct file *file,
+		      unsigned int cmd, unsigned long arg)
+{
+	struct perf_counter *counter = file->private_data;
+
+	switch (cmd) {
+	case PERF_COUNTER_IOC_ENABLE:
+		perf_counter_enable(counter);
+		return 0;
+	case PERF_COUNTER_IOC_DISABLE:
+		perf_counter_disable(counter);
+		return 0;
+	}
+	return -ENOTTY;
+}
+
+static void free_mmap_data_rcu(struct rcu_head *head)
+{
+	struct perf_mmap_data *data;
+	int i;
+
+	data = container_of(head, struct perf_mmap_data, rcu_head);
+	free_page((unsigned long)data->user_page);
+	for (i = 0; i < data->nr_pages; i++)
+		free_page((unsigned long)data->data_pages[i]);
+	kfree(data);
+}
+
+static struct perf_mmap_data *perf_mmap_data_alloc(int nr_pages)
+{
+	struct perf_mmap_data *data;
+	int i;
+
+	data = kmalloc(sizeof(*data) + nr_pages * sizeof(void *), GFP_KERNEL);
+	if (!data)
+		return NULL;
+	memset(data, 0, sizeof(*data) + nr_pages * sizeof(void *));
+	data->nr_pages = nr_pages;
+
+	data->user_page = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!data->user_page)
+		goto fail;
+	for (i = 0; i < nr_pages; i++) {
+		data->data_pages[i] = (void *)get_zeroed_page(GFP_KERNEL);
+		if (!data->data_pages[i])
+			goto fail;
+	}
+	return data;
+
+fail:
+	free_mmap_data_rcu(&data->rcu_head);
+	return NULL;
+}
+
+static struct page *perf_mmap_nopage(struct vm_area_struct *vma,
+				     unsigned long address, int *type)
+{
+	struct perf_counter *counter = vma->vm_file->private_data;
+	struct perf_mmap_data *data = counter->data;
+	unsigned long pgoff;
+	struct page *page;
+
+	pgoff = (address - vma->vm_start) >> PAGE_SHIFT;
+	if (!data || pgoff > data->nr_pages)
+		return NOPAGE_SIGBUS;
+
+	page = virt_to_page(pgoff ? data->data_pages[pgoff - 1]
+				  : (void *)data->user_page);
+	get_page(page);
+	if (type)
+		*type = VM_FAULT_MINOR;
+	return page;
+}
+
+static void perf_mmap_open(struct vm_area_struct *vma)
+{
+	struct perf_counter *counter = vma->vm_file->private_data;
+
+	down(&counter->mmap_sem);
+	counter->mmap_count++;
+	up(&counter->mmap_sem);
+}
+
+static void perf_mmap_close(struct vm_area_struct *vma)
+{
+	struct perf_counter *counter = vma->vm_file->private_data;
+	struct perf_mmap_data *data;
+
+	down(&counter->mmap_sem);
+	if (!--counter->mmap_count) {
+		data = counter->data;
+		rcu_assign_pointer(counter->data, NULL);
+		call_rcu(&data->rcu_head, free_mmap_data_rcu);
+	}
+	up(&counter->mmap_sem);
+}
+
+static struct vm_operations_struct perf_mmap_vmops = {
+	.open		= perf_mmap_open,
+	.close		= perf_mmap_close,
+	.nopage		= perf_mmap_nopage,
+};
+
+static int perf_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct perf_counter *counter = file->private_data;
+	unsigned long nr_pages;
+	struct perf_mmap_data *data;
+	int ret = 0;
+
+	if (!(vma->vm_flags & VM_SHARED) || vma->vm_pgoff)
+		return -EINVAL;
+	nr_pages = ((vma->vm_end - vma->vm_start) >> PAGE_SHIFT) - 1;
+	if (!nr_pages || (nr_pages & (nr_pages - 1)))
+		return -EINVAL;
+
+	down(&counter->mmap_sem);
+	if (counter->data) {
+		if (counter->data->nr_pages != nr_pages)
+			ret = -EINVAL;
+		goto out;
+	}
+	data = perf_mmap_data_alloc(nr_pages);
+	if (!data) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	rcu_assign_pointer(counter->data, data);
+out:
+	if (!ret) {
+		counter->mmap_count++;
+		vma->vm_flags |= VM_RESERVED;
+		vma->vm_ops = &perf_mmap_vmops;
+	}
+	up(&counter->mmap_sem);
+	return ret;
+}
+
+static int perf_release(struct inode *inode, struct file *file)
+{
+	perf_counter_remove(file->private_data);
+	return 0;
+}
+
+static struct file_operations perf_fops = {
+	.read		= perf_read,
+	.poll		= perf_poll,
+	.ioctl		= perf_ioctl,
+	.mmap		= perf_mmap,
+	.release	= perf_release,
+};
+
+/* The task to count, with a reference, if we may look at it. */
+static struct task_struct *perf_find_task(pid_t pid)
+{
+	struct task_struct *task;
+
+	if (!pid) {
+		get_task_struct(current);
+		return current;
+	}
+
+	read_lock(&tasklist_lock);
+	task = find_task_by_pid(pid);
+	if (task)
+		get_task_struct(task);
+	read_unlock(&tasklist_lock);
+	if (!task)
+		return ERR_PTR(-ESRCH);
+
+	/* As for ptrace */
+	if (((current->uid != task->euid) ||
+	     (current->uid != task->suid) ||
+	     (current->uid != task->uid) ||
+	     (current->gid != task->egid) ||
+	     (current->gid != task->sgid) ||
+	     (current->gid != task->gid)) && !capable(CAP_SYS_PTRACE)) {
+		put_task_struct(task);
+		return ERR_PTR(-EACCES);
+	}
+	return task;
+}
+
+/**
+ * sys_perf_counter_open - open a performance counter
+ * @hw_event_uptr: what to count, and how
+ * @pid: the task to count, 0 for current, or -1 for all on @cpu
+ * @cpu: the only cpu to count on, or -1 for any
+ * @group_fd: must be -1, groups are not supported
+ * @flags: must be 0
+ *
+ * Returns a file descriptor for the counter.
+ */
+asmlinkage long
+sys_perf_counter_open(struct perf_counter_hw_event __user *hw_event_uptr,
+		      pid_t pid, int cpu, int group_fd, unsigned long flags)
+{
+	struct perf_counter_hw_event hw_event;
+	struct perf_counter *counter;
+	struct task_struct *task = NULL;
+	struct file *filp;
+	int ret;
+
+	if (copy_from_user(&hw_event, hw_event_uptr, sizeof(hw_event)))
+		return -EFAULT;
+	if (group_fd != -1 || flags || hw_event.__reserved ||
+	    (hw_event.flags & ~(PERF_FLAG_DISABLED | PERF_FLAG_EXCLUDE_USER |
+				PERF_FLAG_EXCLUDE_KERNEL)))
+		return -EINVAL;
+	if (cpu != -1 && (cpu < 0 || cpu >= NR_CPUS || !cpu_online(cpu)))
+		return -EINVAL;
+
+	if (pid == -1) {
+		if (cpu == -1)
+			return -EINVAL;
+		if (!capable(CAP_SYS_ADMIN))
+			return -EACCES;
+	} else {
+		task = perf_find_task(pid);
+		if (IS_ERR(task))
+			return PTR_ERR(task);
+	}
+
+	ret = -ENOMEM;
+	counter = kmalloc(sizeof(*counter), GFP_KERNEL);
+	if (!counter)
+		goto err_task;
+	memset(counter, 0, sizeof(*counter));
+	INIT_LIST_HEAD(&counter->list_entry);
+	counter->hw_event = hw_event;
+	counter->hw.period_left = hw_event.irq_period;
+	counter->task = task;
+	counter->ctx = task ? &task->perf_counter_ctx
+			    : &per_cpu(perf_cpu_context, cpu).ctx;
+	counter->cpu = cpu;
+	counter->oncpu = -1;
+	counter->state = hw_event.flags & PERF_FLAG_DISABLED ?
+		PERF_COUNTER_STATE_OFF : PERF_COUNTER_STATE_INACTIVE;
+	init_MUTEX(&counter->mmap_sem);
+	init_waitqueue_head(&counter->waitq);
+
+	ret = -EINVAL;
+	switch (hw_event.type) {
+	case PERF_TYPE_HARDWARE:
+		if (hw_event.config >= PERF_HW_EVENTS_MAX)
+			goto err_counter;
+		counter->ops = hw_perf_counter_init(counter);
+		if (!counter->ops) {
+			ret = -EOPNOTSUPP;
+			goto err_counter;
+		}
+		break;
+	case PERF_TYPE_SOFTWARE:
+		if (hw_event.config >= PERF_SW_EVENTS_MAX)
+			goto err_counter;
+		counter->ops = &perf_ops_software;
+		break;
+	default:
+		goto err_counter;
+	}
+
+	ret = get_unused_fd();
+	if (ret < 0)
+		goto err_counter;
+	filp = get_empty_filp();
+	if (!filp) {
+		put_unused_fd(ret);
+		ret = -ENFILE;
+		goto err_counter;
+	}
+	filp->f_op = &perf_fops;
+	filp->f_vfsmnt = mntget(perf_counter_mnt);
+	filp->f_dentry = dget(perf_counter_mnt->mnt_root);
+	filp->f_mapping = filp->f_dentry->d_inode->i_mapping;
+	filp->f_mode = FMODE_READ | FMODE_WRITE;
+	filp->private_data = counter;
+
+	perf_counter_install(counter);
+	fd_install(ret, filp);
+	return ret;
+
+err_counter:
+	kfree(counter);
+err_task:
+	if (task)
+		put_task_struct(task);
+	return ret;
+}
+
+static struct super_block *
+perf_counter_get_sb(struct file_system_type *fs_type,
+		    int flags, const char *dev_name, void *data)
+{
+	return get_sb_pseudo(fs_type, "perf_counter:", NULL, 0x50455246);
+}
+
+static struct file_system_type perf_counter_fs_type = {
+	.name		= "perf_counterfs",
+	.get_sb		= perf_counter_get_sb,
+	.kill_sb	= kill_anon_super,
+};
+
+static int __init perf_counter_init(void)
+{
+	int cpu;
+
+	for_each_cpu(cpu)
+		init_perf_counter_context(&per_cpu(perf_cpu_context, cpu).ctx,
+					  NULL);
+
+	register_filesystem(&perf_counter_fs_type);
+	perf_counter_mnt = kern_mount(&perf_counter_fs_type);
+	if (IS_ERR(perf_counter_mnt))
+		panic("perf_counter: kern_mount ret %ld!\n",
+		      PTR_ERR(perf_counter_mnt));
+	return 0;
+}
+__initcall(perf_counter_init);
@@ -133,6 +133,66 @@ static inline unsigned long long sched_ns(struct task_struct *p)
 	return (p == current) ? current_sched_time(p) : p->sched_time;
 }
 
+/*
+ * Set up the CPU time totals of tsk's thread group, as it gets a second
+ * thread.  Until then tsk's own counters are the totals: start them off
+ * with those, on this CPU.
+ */
+int thread_group_cputime_alloc(struct task_struct *tsk)
+{
+	struct signal_struct *sig = tsk->signal;
+	struct task_cputime *totals, *mine;
+
+	if (sig->cputime_totals)
+		return 0;
+	totals = alloc_percpu(struct task_cputime);
+	if (!totals)
+		return -ENOMEM;
+
+	spin_lock_irq(&tsk->sighand->siglock);
+	if (sig->cputime_totals) {
+		spin_unlock_irq(&tsk->sighand->siglock);
+		free_percpu(totals);
+		return 0;
+	}
+	mine = per_cpu_ptr(totals, smp_processor_id());
+	mine->utime = cputime_add(sig->utime, tsk->utime);
+	mine->stime = cputime_add(sig->stime, tsk->stime);
+	mine->sched_time = sig->sched_time + tsk->sched_time;
+	sig->cputime_totals = totals;
+	spin_unlock_irq(&tsk->sighand->siglock);
+	return 0;
+}
+
+/*
+ * Sum the CPU time of tsk's thread group: a walk over the CPUs, however
+ * many threads there are.  Time banked on other CPUs since their last
+ * tick or context switch is not counted yet.
+ */
+void thread_group_cputime(struct task_struct *tsk, struct task_cputime *times)
+{
+	struct signal_struct *sig = tsk->signal;
+	struct task_cputime *totals = sig->cputime_totals;
+	int i;
+
+	if (!totals) {
+		times->utime = cputime_add(sig->utime, tsk->utime);
+		times->stime = cputime_add(sig->stime, tsk->stime);
+		times->sched_time = sig->sched_time + tsk->sched_time;
+		return;
+	}
+
+	times->utime = times->stime = cputime_zero;
+	times->sched_time = 0;
+	for_each_cpu(i) {
+		struct task_cputime *t = per_cpu_ptr(totals, i);
+
+		times->utime = cputime_add(times->utime, t->utime);
+		times->stime = cputime_add(times->stime, t->stime);
+		times->sched_time += t->sched_time;
+	}
+}
+
 int posix_cpu_clock_getres(clockid_t which_clock, struct timespec *tp)
 {
 	int error = check_clock(which_clock);
@@ -196,41 +256,30 @@ static int cpu_clock_sample_group_locked(unsigned int clock_idx,
 					 struct task_struct *p,
 					 union cpu_time_count *cpu)
 {
-	struct task_struct *t = p;
+	struct task_cputime times;
+
+	thread_group_cputime(p, &times);
  	switch (clock_idx) {
 	default:
 		return -EINVAL;
 	case CPUCLOCK_PROF:
-		cpu->cpu = cputime_add(p->signal->utime, p->signal->stime);
-		do {
-			cpu->cpu = cputime_add(cpu->cpu, prof_ticks(t));
-			t = next_thread(t);
-		} while (t != p);
+		cpu->cpu = cputime_add(times.utime, times.stime);
 		break;
 	case CPUCLOCK_VIRT:
-		cpu->cpu = p->signal->utime;
-		do {
-			cpu->cpu = cputime_add(cpu->cpu, virt_ticks(t));
-			t = next_thread(t);
-		} while (t != p);
+		cpu->cpu = times.utime;
 		break;
 	case CPUCLOCK_SCHED:
-		cpu->sched = p->signal->sched_time;
-		/* Add in each other live thread.  */
-		while ((t = next_thread(t)) != p) {
-			cpu->sched += t->sched_time;
-		}
+		cpu->sched = times.sched_time;
 		if (p->tgid == current->tgid) {
 			/*
 			 * We're sampling ourselves, so include the
 			 * cycles not yet banked.  We still omit
 			 * other threads running on other CPUs,
 			 * so the total can always be behind as
-			 * much as max(nthreads-1,ncpus) * (NSEC_PER_SEC/HZ).
+			 * much as (ncpus-1) * (NSEC_PER_SEC/HZ).
 			 */
-			cpu->sched += current_sched_time(current);
-		} else {
-			cpu->sched += p->sched_time;
+			cpu->sched += current_sched_time(current) -
+				current->sched_time;
 		}
 		break;
 	}
@@ -460,71 +509,6 @@ void posix_cpu_timers_exit_group(struct task_struct *tsk)
 }
 
 
-/*
- * Set the expiry times of all the threads in the process so one of them
- * will go off before the process cumulative expiry total is reached.
- */
-static void process_timer_rebalance(struct task_struct *p,
-				    unsigned int clock_idx,
-				    union cpu_time_count expires,
-				    union cpu_time_count val)
-{
-	cputime_t ticks, left;
-	unsigned long long ns, nsleft;
- 	struct task_struct *t = p;
-	unsigned int nthreads = atomic_read(&p->signal->live);
-
-	switch (clock_idx) {
-	default:
-		BUG();
-		break;
-	case CPUCLOCK_PROF:
-		left = cputime_sub(expires.cpu, val.cpu)
-			/ nthreads;
-		do {
-			if (!unlikely(t->exit_state)) {
-				ticks = cputime_add(prof_ticks(t), left);
-				if (cputime_eq(t->it_prof_expires,
-					       cputime_zero) ||
-				    cputime_gt(t->it_prof_expires, ticks)) {
-					t->it_prof_expires = ticks;
-				}
-			}
-			t = next_thread(t);
-		} while (t != p);
-		break;
-	case CPUCLOCK_VIRT:
-		left = cputime_sub(expires.cpu, val.cpu)
-			/ nthreads;
-		do {
-			if (!unlikely(t->exit_state)) {
-				ticks = cputime_add(virt_ticks(t), left);
-				if (cputime_eq(t->it_virt_expires,
-					       cputime_zero) ||
-				    cputime_gt(t->it_virt_expires, ticks)) {
-					t->it_virt_expires = ticks;
-				}
-			}
-			t = next_thread(t);
-		} while (t != p);
-		break;
-	case CPUCLOCK_SCHED:
-		nsleft = expires.sched - val.sched;
-		do_div(nsleft, nthreads);
-		do {
-			if (!unlikely(t->exit_state)) {
-				ns = t->sched_time + nsleft;
-				if (t->it_sched_expires == 0 ||
-				    t->it_sched_expires > ns) {
-					t->it_sched_expires = ns;
-				}
-			}
-			t = next_thread(t);
-		} while (t != p);
-		break;
-	}
-}
-
 static void clear_dead_task(struct k_itimer *timer, union cpu_time_count now)
 {
 	/*
@@ -549,7 +533,6 @@ static void arm_timer(struct k_itimer *timer, union cpu_time_count now)
 	struct list_head *head, *listpos;
 	struct cpu_timer_list *const nt = &timer->it.cpu;
 	struct cpu_timer_list *next;
-	unsigned long i;
 
 	head = (CPUCLOCK_PERTHREAD(timer->it_clock) ?
 		p->cpu_timers : p->signal->cpu_timers);
@@ -583,57 +566,35 @@ static void arm_timer(struct k_itimer *timer, union cpu_time_count now)
 		 * be a process timer telling us to stop earlier.
 		 */
 
+#define UPDATE_CLOCK(WHICH, exp, n)		      		      \
+			case CPUCLOCK_##WHICH: 				      \
+				if (exp == 0 || exp > nt->expires.n)	      \
+					exp = nt->expires.n;		      \
+				break
 		if (CPUCLOCK_PERTHREAD(timer->it_clock)) {
 			switch (CPUCLOCK_WHICH(timer->it_clock)) {
 			default:
 				BUG();
-#define UPDATE_CLOCK(WHICH, c, n)			      		      \
-			case CPUCLOCK_##WHICH: 				      \
-				if (p->it_##c##_expires == 0 ||		      \
-				    p->it_##c##_expires > nt->expires.n) {    \
-					p->it_##c##_expires = nt->expires.n;  \
-				}					      \
-				break
-			UPDATE_CLOCK(PROF, prof, cpu);
-			UPDATE_CLOCK(VIRT, virt, cpu);
-			UPDATE_CLOCK(SCHED, sched, sched);
-#undef UPDATE_CLOCK
+			UPDATE_CLOCK(PROF, p->it_prof_expires, cpu);
+			UPDATE_CLOCK(VIRT, p->it_virt_expires, cpu);
+			UPDATE_CLOCK(SCHED, p->it_sched_expires, sched);
 			}
 		} else {
 			/*
-			 * For a process timer, we must balance
-			 * all the live threads' expirations.
+			 * For a process timer, the tick checks the
+			 * process expiry against the group totals.
 			 */
+			struct signal_struct *const sig = p->signal;
+
 			switch (CPUCLOCK_WHICH(timer->it_clock)) {
 			default:
 				BUG();
-			case CPUCLOCK_VIRT:
-				if (!cputime_eq(p->signal->it_virt_expires,
-						cputime_zero) &&
-				    cputime_lt(p->signal->it_virt_expires,
-					       timer->it.cpu.expires.cpu))
-					break;
-				goto rebalance;
-			case CPUCLOCK_PROF:
-				if (!cputime_eq(p->signal->it_prof_expires,
-						cputime_zero) &&
-				    cputime_lt(p->signal->it_prof_expires,
-					       timer->it.cpu.expires.cpu))
-					break;
-				i = p->signal->rlim[RLIMIT_CPU].rlim_cur;
-				if (i != RLIM_INFINITY &&
-				    i <= cputime_to_secs(timer->it.cpu.expires.cpu))
-					break;
-				goto rebalance;
-			case CPUCLOCK_SCHED:
-			rebalance:
-				process_timer_rebalance(
-					timer->it.cpu.task,
-					CPUCLOCK_WHICH(timer->it_clock),
-					timer->it.cpu.expires, now);
-				break;
+			UPDATE_CLOCK(PROF, sig->cputime_prof_expires, cpu);
+			UPDATE_CLOCK(VIRT, sig->cputime_virt_expires, cpu);
+			UPDATE_CLOCK(SCHED, sig->cputime_sched_expires, sched);
 			}
 		}
+#undef UPDATE_CLOCK
 	}
 
 	spin_unlock(&p->sighand->siglock);
@@ -985,9 +946,9 @@ static void check_process_timers(struct task_struct *tsk,
 				 struct list_head *firing)
 {
 	struct signal_struct *const sig = tsk->signal;
-	cputime_t utime, stime, ptime, virt_expires, prof_expires;
+	cputime_t utime, ptime, virt_expires, prof_expires;
 	unsigned long long sched_time, sched_expires;
-	struct task_struct *t;
+	struct task_cputime times;
 	struct list_head *timers = sig->cpu_timers;
 
 	/*
@@ -998,23 +959,20 @@ static void check_process_timers(struct task_struct *tsk,
 	    sig->rlim[RLIMIT_CPU].rlim_cur == RLIM_INFINITY &&
 	    list_empty(&timers[CPUCLOCK_VIRT]) &&
 	    cputime_eq(sig->it_virt_expires, cputime_zero) &&
-	    list_empty(&timers[CPUCLOCK_SCHED]))
+	    list_empty(&timers[CPUCLOCK_SCHED])) {
+		sig->cputime_prof_expires = cputime_zero;
+		sig->cputime_virt_expires = cputime_zero;
+		sig->cputime_sched_expires = 0;
 		return;
+	}
 
 	/*
 	 * Collect the current process totals.
 	 */
-	utime = sig->utime;
-	stime = sig->stime;
-	sched_time = sig->sched_time;
-	t = tsk;
-	do {
-		utime = cputime_add(utime, t->utime);
-		stime = cputime_add(stime, t->stime);
-		sched_time += t->sched_time;
-		t = next_thread(t);
-	} while (t != tsk);
-	ptime = cputime_add(utime, stime);
+	thread_group_cputime(tsk, &times);
+	utime = times.utime;
+	ptime = cputime_add(times.utime, times.stime);
+	sched_time = times.sched_time;
 
 	prof_expires = cputime_zero;
 	while (!list_empty(timers)) {
@@ -1120,55 +1078,9 @@ static void check_process_timers(struct task_struct *tsk,
 		}
 	}
 
-	if (!cputime_eq(prof_expires, cputime_zero) ||
-	    !cputime_eq(virt_expires, cputime_zero) ||
-	    sched_expires != 0) {
-		/*
-		 * Rebalance the threads' expiry times for the remaining
-		 * process CPU timers.
-		 */
-
-		cputime_t prof_left, virt_left, ticks;
-		unsigned long long sched_left, sched;
-		const unsigned int nthreads = atomic_read(&sig->live);
-
-		prof_left = cputime_sub(prof_expires,
-					cputime_add(utime, stime)) / nthreads;
-		virt_left = cputime_sub(virt_expires, utime) / nthreads;
-		if (sched_expires) {
-			sched_left = sched_expires - sched_time;
-			do_div(sched_left, nthreads);
-		} else {
-			sched_left = 0;
-		}
-		t = tsk;
-		do {
-			ticks = cputime_add(cputime_add(t->utime, t->stime),
-					    prof_left);
-			if (!cputime_eq(prof_expires, cputime_zero) &&
-			    (cputime_eq(t->it_prof_expires, cputime_zero) ||
-			     cputime_gt(t->it_prof_expires, ticks))) {
-				t->it_prof_expires = ticks;
-			}
-
-			ticks = cputime_add(t->utime, virt_left);
-			if (!cputime_eq(virt_expires, cputime_zero) &&
-			    (cputime_eq(t->it_virt_expires, cputime_zero) ||
-			     cputime_gt(t->it_virt_expires, ticks))) {
-				t->it_virt_expires = ticks;
-			}
-
-			sched = t->sched_time + sched_left;
-			if (sched_expires && (t->it_sched_expires == 0 ||
-					      t->it_sched_expires > sched)) {
-				t->it_sched_expires = sched;
-			}
-
-			do {
-				t = next_thread(t);
-			} while (unlikely(t->exit_state));
-		} while (t != tsk);
-	}
+	sig->cputime_prof_expires = prof_expires;
+	sig->cputime_virt_expires = virt_expires;
+	sig->cputime_sched_expires = sched_expires;
 }
 
 /*
@@ -1232,6 +1144,50 @@ void posix_cpu_timer_schedule(struct k_itimer *timer)
 	read_unlock(&tasklist_lock);
 }
 
+/*
+ * Whether any thread or process CPU timer of tsk may have expired.  The
+ * process timers cost a sum over the CPUs, and then only when set.
+ */
+static inline int fastpath_timer_check(struct task_struct *tsk)
+{
+	struct signal_struct *sig = tsk->signal;
+	struct task_cputime times;
+
+#define UNEXPIRED(clock) \
+		(tsk->it_##clock##_expires == 0 || \
+		 cputime_lt(clock##_ticks(tsk), tsk->it_##clock##_expires))
+
+	if (!UNEXPIRED(prof) || !UNEXPIRED(virt) ||
+	    (tsk->it_sched_expires != 0 &&
+	     tsk->sched_time >= tsk->it_sched_expires))
+		return 1;
+
+#undef	UNEXPIRED
+
+	/*
+	 * An exiting thread, ticking on its way out, leaves the process
+	 * timers to the others; its signal_struct may even be gone.
+	 */
+	if (unlikely(tsk->exit_state) ||
+	    (cputime_eq(sig->cputime_prof_expires, cputime_zero) &&
+	     cputime_eq(sig->cputime_virt_expires, cputime_zero) &&
+	     sig->cputime_sched_expires == 0))
+		return 0;
+
+	thread_group_cputime(tsk, &times);
+	if (!cputime_eq(sig->cputime_prof_expires, cputime_zero) &&
+	    cputime_ge(cputime_add(times.utime, times.stime),
+		       sig->cputime_prof_expires))
+		return 1;
+	if (!cputime_eq(sig->cputime_virt_expires, cputime_zero) &&
+	    cputime_ge(times.utime, sig->cputime_virt_expires))
+		return 1;
+	if (sig->cputime_sched_expires != 0 &&
+	    times.sched_time >= sig->cputime_sched_expires)
+		return 1;
+	return 0;
+}
+
 /*
  * This is called from the timer interrupt handler.  The irq handler has
  * already updated our counts.  We need to check if any timers fire now.
@@ -1244,17 +1200,9 @@ void run_posix_cpu_timers(struct task_struct *tsk)
 
 	BUG_ON(!irqs_disabled());
 
-#define UNEXPIRED(clock) \
-		(tsk->it_##clock##_expires == 0 || \
-		 cputime_lt(clock##_ticks(tsk), tsk->it_##clock##_expires))
-
-	if (UNEXPIRED(prof) && UNEXPIRED(virt) &&
-	    (tsk->it_sched_expires == 0 ||
-	     tsk->sched_time < tsk->it_sched_expires))
+	if (!fastpath_timer_check(tsk))
 		return;
 
-#undef	UNEXPIRED
-
 	BUG_ON(tsk->exit_state);
 
 	/*
@@ -1316,7 +1264,7 @@ void set_process_cpu_timer(struct task_struct *tsk, unsigned int clock_idx,
 			   cputime_t *newval, cputime_t *oldval)
 {
 	union cpu_time_count now;
-	struct list_head *head;
+	cputime_t *expires;
 
 	BUG_ON(clock_idx == CPUCLOCK_SCHED);
 	cpu_clock_sample_group_locked(clock_idx, tsk, &now);
@@ -1345,22 +1293,15 @@ void set_process_cpu_timer(struct task_struct *tsk, unsigned int clock_idx,
 	}
 
 	/*
-	 * Check whether there are any process timers already set to fire
-	 * before this one.  If so, we don't have anything more to do.
+	 * Have the tick notice, unless some process timer is already
+	 * set to fire before this one.
 	 */
-	head = &tsk->signal->cpu_timers[clock_idx];
-	if (list_empty(head) ||
-	    cputime_ge(list_entry(head->next,
-				  struct cpu_timer_list, entry)->expires.cpu,
-		       *newval)) {
-		/*
-		 * Rejigger each thread's expiry time so that one will
-		 * notice before we hit the process-cumulative expiry time.
-		 */
-		union cpu_time_count expires = { .sched = 0 };
-		expires.cpu = *newval;
-		process_timer_rebalance(tsk, clock_idx, expires, now);
-	}
+	expires = (clock_idx == CPUCLOCK_PROF ?
+		   &tsk->signal->cputime_prof_expires :
+		   &tsk->signal->cputime_virt_expires);
+	if (cputime_eq(*expires, cputime_zero) ||
+	    cputime_gt(*expires, *newval))
+		*expires = *newval;
 }
 
 static long posix_cpu_clock_nanosleep_restart(struct restart_block *);
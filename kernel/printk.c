@@ -31,6 +31,8 @@
 #include <linux/security.h>
 #include <linux/bootmem.h>
 #include <linux/syscalls.h>
+#include <linux/percpu.h>
+#include <linux/kthread.h>
 
 #include <asm/uaccess.h>
 
@@ -87,6 +89,46 @@ static int log_buf_len = __LOG_BUF_LEN;
 #define LOG_BUF_MASK	(log_buf_len-1)
 #define LOG_BUF(idx) (log_buf[(idx) & LOG_BUF_MASK])
 
+/*
+ * printk() does not write log_buf itself: each cpu stores its messages,
+ * with interrupts off and no lock, as records in a ring of its own, from
+ * which they are merged into log_buf in the order of their sequence
+ * numbers, under logbuf_lock, by release_console_sem() and syslog.  A
+ * message that does not fit in its cpu's ring is dropped, and the drop
+ * is reported in log_buf at the next merge.  Once kprintd is running,
+ * it is kprintd that merges and calls the console drivers, woken from
+ * the timer tick; until then, and while oopsing, printk() does it
+ * itself, as it always did.
+ */
+#define CPU_LOG_BUF_LEN	(1 << 13)
+#define CPU_LOG_BUF_MASK (CPU_LOG_BUF_LEN - 1)
+#define PRINTK_BUF_LEN	1024
+#define PRINTK_LINE_LEN	(2 * PRINTK_BUF_LEN)	/* Room for the time stamps */
+
+struct cpu_log_record {
+	unsigned int	seq;
+	unsigned int	len;		/* Of the text that follows */
+};
+
+struct cpu_log {
+	char		buf[CPU_LOG_BUF_LEN];
+	unsigned long	head;		/* Written by the cpu */
+	unsigned long	tail;		/* Written by the merge */
+	unsigned long	dropped;	/* Records, written by the cpu */
+	unsigned long	dropped_seen;	/* Written by the merge */
+	int		busy;		/* In vprintk(), for printk from NMI */
+	int		log_level_unknown;
+	int		wake;		/* kprintd to be woken at the tick */
+	char		text[PRINTK_BUF_LEN];
+	char		line[PRINTK_LINE_LEN];
+};
+
+static DEFINE_PER_CPU(struct cpu_log, cpu_logs) = { .log_level_unknown = 1 };
+static atomic_t log_seq = ATOMIC_INIT(0);
+static struct task_struct *printk_task;
+
+static void merge_cpu_logs(void);
+
 /*
  * The indices into log_buf are not constrained to log_buf_len - they
  * must be masked before subscripting
@@ -278,6 +320,7 @@ int do_syslog(int type, char __user * buf, int len)
 			goto out;
 		i = 0;
 		spin_lock_irq(&logbuf_lock);
+		merge_cpu_logs();
 		while (!error && (log_start != log_end) && i < len) {
 			c = LOG_BUF(log_start);
 			log_start++;
@@ -310,6 +353,7 @@ int do_syslog(int type, char __user * buf, int len)
 		if (count > log_buf_len)
 			count = log_buf_len;
 		spin_lock_irq(&logbuf_lock);
+		merge_cpu_logs();
 		if (count > logged_chars)
 			count = logged_chars;
 		if (do_clear)
@@ -367,7 +411,10 @@ int do_syslog(int type, char __user * buf, int len)
 		error = 0;
 		break;
 	case 9:		/* Number of chars in the log buffer */
+		spin_lock_irq(&logbuf_lock);
+		merge_cpu_logs();
 		error = log_end - log_start;
+		spin_unlock_irq(&logbuf_lock);
 		break;
 	case 10:	/* Size of the log buffer */
 		error = log_buf_len;
@@ -480,6 +527,110 @@ static void emit_log_char(char c)
 		logged_chars++;
 }
 
+static void cpu_log_copy_out(struct cpu_log *cl, unsigned long from,
+			     void *to, unsigned int len)
+{
+	char *p = to;
+
+	while (len--)
+		*p++ = cl->buf[from++ & CPU_LOG_BUF_MASK];
+}
+
+/*
+ * Store a record in this cpu's ring, with interrupts off.  Only this
+ * cpu writes head and only the merge writes tail.
+ */
+static void cpu_log_store(struct cpu_log *cl, const char *text,
+			  unsigned int len)
+{
+	struct cpu_log_record rec;
+	unsigned long head = cl->head;
+	char *p;
+	int i;
+
+	if (!len)
+		return;
+	if (head - cl->tail + sizeof(rec) + len > CPU_LOG_BUF_LEN) {
+		cl->dropped++;
+		return;
+	}
+	rec.seq = atomic_inc_return(&log_seq);
+	rec.len = len;
+	for (p = (char *)&rec, i = 0; i < sizeof(rec); i++)
+		cl->buf[head++ & CPU_LOG_BUF_MASK] = *p++;
+	while (len--)
+		cl->buf[head++ & CPU_LOG_BUF_MASK] = *text++;
+
+	/* The record must be there before the merge can see it */
+	smp_wmb();
+	cl->head = head;
+}
+
+static void emit_dropped(int cpu, unsigned long nr)
+{
+	char tbuf[64], *tp;
+
+	sprintf(tbuf, "<%d>printk: %lu messages dropped on cpu %d\n",
+		default_message_loglevel, nr, cpu);
+	for (tp = tbuf; *tp; tp++)
+		emit_log_char(*tp);
+}
+
+/*
+ * Move the records of all the cpus into log_buf, oldest first.  A record
+ * whose cpu took its sequence number but was slower to store it may come
+ * after one with a later number, which no merge can help.
+ * Called with logbuf_lock held and interrupts off.
+ */
+static void merge_cpu_logs(void)
+{
+	struct cpu_log_record rec, best_rec;
+	struct cpu_log *cl, *best;
+	unsigned long head, nr;
+	int cpu;
+
+	for (;;) {
+		best = NULL;
+		for_each_cpu(cpu) {
+			cl = &per_cpu(cpu_logs, cpu);
+			nr = cl->dropped - cl->dropped_seen;
+			if (nr) {
+				cl->dropped_seen += nr;
+				emit_dropped(cpu, nr);
+			}
+			head = cl->head;
+			if (head == cl->tail)
+				continue;
+			smp_rmb();
+			cpu_log_copy_out(cl, cl->tail, &rec, sizeof(rec));
+			if (!best || (int)(rec.seq - best_rec.seq) < 0) {
+				best = cl;
+				best_rec = rec;
+			}
+		}
+		if (!best)
+			break;
+
+		head = best->tail + sizeof(best_rec);
+		while (best_rec.len--)
+			emit_log_char(best->buf[head++ & CPU_LOG_BUF_MASK]);
+		/* Done reading before the cpu can reuse the space */
+		smp_mb();
+		best->tail = head;
+	}
+}
+
+static int cpu_logs_pending(void)
+{
+	int cpu;
+
+	for_each_cpu(cpu) {
+		if (per_cpu(cpu_logs, cpu).head != per_cpu(cpu_logs, cpu).tail)
+			return 1;
+	}
+	return 0;
+}
+
 /*
  * Zap console related locks when oopsing. Only zap at most once
  * every 10 seconds, to leave time for slow consoles to print a
@@ -497,6 +648,7 @@ static void zap_locks(void)
 
 	/* If a crash is occurring, make sure we can't deadlock */
 	spin_lock_init(&logbuf_lock);
+	__get_cpu_var(cpu_logs).busy = 0;
 	/* And make sure that we print immediately */
 	init_MUTEX(&console_sem);
 }
@@ -546,29 +698,35 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 {
 	unsigned long flags;
 	int printed_len;
-	char *p;
-	static char printk_buf[1024];
-	static int log_level_unknown = 1;
+	char *p, *line, *lp;
+	struct cpu_log *cl;
 
 	if (unlikely(oops_in_progress))
 		zap_locks();
 
-	/* This stops the holder of console_sem just where we want him */
-	spin_lock_irqsave(&logbuf_lock, flags);
+	local_irq_save(flags);
+	cl = &__get_cpu_var(cpu_logs);
+	if (unlikely(cl->busy)) {
+		/* An NMI came in the middle of a printk on this cpu */
+		cl->dropped++;
+		local_irq_restore(flags);
+		return 0;
+	}
+	cl->busy = 1;
 
 	/* Emit the output into the temporary buffer */
-	printed_len = vscnprintf(printk_buf, sizeof(printk_buf), fmt, args);
+	printed_len = vscnprintf(cl->text, sizeof(cl->text), fmt, args);
 
 	/*
-	 * Copy the output into log_buf.  If the caller didn't provide
+	 * Copy the output into the record.  If the caller didn't provide
 	 * appropriate log level tags, we insert them here
 	 */
-	for (p = printk_buf; *p; p++) {
-		if (log_level_unknown) {
+	line = lp = cl->line;
+	for (p = cl->text; *p; p++) {
+		if (cl->log_level_unknown) {
                         /* log_level_unknown signals the start of a new line */
 			if (printk_time) {
 				int loglev_char;
-				char tbuf[50], *tp;
 				unsigned tlen;
 				unsigned long long t;
 				unsigned long nanosec_rem;
@@ -588,32 +746,44 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 				}
 				t = sched_clock();
 				nanosec_rem = do_div(t, 1000000000);
-				tlen = sprintf(tbuf,
+				if (lp + 50 > line + PRINTK_LINE_LEN)
+					break;
+				tlen = sprintf(lp,
 						"<%c>[%5lu.%06lu] ",
 						loglev_char,
 						(unsigned long)t,
 						nanosec_rem/1000);
-
-				for (tp = tbuf; tp < tbuf + tlen; tp++)
-					emit_log_char(*tp);
+				lp += tlen;
 				printed_len += tlen - 3;
 			} else {
+				if (lp + 3 > line + PRINTK_LINE_LEN)
+					break;
 				if (p[0] != '<' || p[1] < '0' ||
 				   p[1] > '7' || p[2] != '>') {
-					emit_log_char('<');
-					emit_log_char(default_message_loglevel
-						+ '0');
-					emit_log_char('>');
+					*lp++ = '<';
+					*lp++ = default_message_loglevel + '0';
+					*lp++ = '>';
 				}
 				printed_len += 3;
 			}
-			log_level_unknown = 0;
+			cl->log_level_unknown = 0;
 			if (!*p)
 				break;
 		}
-		emit_log_char(*p);
+		if (lp == line + PRINTK_LINE_LEN)
+			break;
+		*lp++ = *p;
 		if (*p == '\n')
-			log_level_unknown = 1;
+			cl->log_level_unknown = 1;
+	}
+	cpu_log_store(cl, line, lp - line);
+	cl->busy = 0;
+
+	if (likely(printk_task && !oops_in_progress)) {
+		/* kprintd will see to it, see printk_tick() */
+		cl->wake = 1;
+		local_irq_restore(flags);
+		goto out;
 	}
 
 	if (!cpu_online(smp_processor_id()) &&
@@ -624,9 +794,12 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 		 * CPU until it is officially up.  We shouldn't be calling into
 		 * random console drivers on a CPU which doesn't exist yet..
 		 */
-		spin_unlock_irqrestore(&logbuf_lock, flags);
+		local_irq_restore(flags);
 		goto out;
 	}
+
+	/* This stops the holder of console_sem just where we want him */
+	spin_lock(&logbuf_lock);
 	if (!down_trylock(&console_sem)) {
 		console_locked = 1;
 		/*
@@ -639,8 +812,8 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 	} else {
 		/*
 		 * Someone else owns the drivers.  We drop the spinlock, which
-		 * allows the semaphore holder to proceed and to call the
-		 * console drivers with the output which we just produced.
+		 * allows the semaphore holder to proceed and to merge and
+		 * print the record which we just stored.
 		 */
 		spin_unlock_irqrestore(&logbuf_lock, flags);
 	}
@@ -706,6 +879,7 @@ void release_console_sem(void)
 
 	for ( ; ; ) {
 		spin_lock_irqsave(&logbuf_lock, flags);
+		merge_cpu_logs();
 		wake_klogd |= log_start - log_end;
 		if (con_start == log_end)
 			break;			/* Nothing to print */
@@ -725,6 +899,62 @@ void release_console_sem(void)
 }
 EXPORT_SYMBOL(release_console_sem);
 
+/*
+ * Called from the timer tick: wake kprintd for the messages that this
+ * cpu stored since the last tick.  printk() cannot wake it itself, as
+ * it may be called with the runqueue locks held.
+ */
+void printk_tick(void)
+{
+	struct cpu_log *cl = &__get_cpu_var(cpu_logs);
+
+	if (cl->wake) {
+		cl->wake = 0;
+		wake_up_process(printk_task);
+	}
+}
+
+/*
+ * Whether @cpu has messages for kprintd that its next tick would wake
+ * it for: the tick must not be stopped until it has.
+ */
+int printk_needs_cpu(int cpu)
+{
+	return per_cpu(cpu_logs, cpu).wake;
+}
+
+static int kprintd(void *unused)
+{
+	/* Keep printing across suspend */
+	current->flags |= PF_NOFREEZE;
+	set_user_nice(current, -5);
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!cpu_logs_pending())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		/* release_console_sem() merges, prints, and wakes klogd */
+		acquire_console_sem();
+		release_console_sem();
+	}
+	return 0;
+}
+
+static int __init kprintd_init(void)
+{
+	struct task_struct *p;
+
+	p = kthread_run(kprintd, NULL, "kprintd");
+	if (IS_ERR(p))
+		printk(KERN_ERR "printk: could not start kprintd, "
+		       "printing synchronously\n");
+	else
+		printk_task = p;
+	return 0;
+}
+core_initcall(kprintd_init);
+
 /** console_conditional_schedule - yield the CPU if required
  *
  * If the console code is currently allowed to sleep, and
@@ -53,17 +53,50 @@ struct rcu_ctrlblk rcu_ctrlblk =
 struct rcu_ctrlblk rcu_bh_ctrlblk =
 	{ .cur = -300, .completed = -300 };
 
+/*
+ * The CPUs still to pass through a quiescent state are kept in a tree
+ * of masks, RCU_FANOUT bits to a node, so that a CPU reporting one
+ * only takes the lock of its leaf, and that of a node further up only
+ * when it was the last of its group.  32 bits fit a long everywhere.
+ */
+#define RCU_FANOUT	32
+
+#if NR_CPUS <= RCU_FANOUT
+# define RCU_NUM_LVLS	1
+#elif NR_CPUS <= RCU_FANOUT * RCU_FANOUT
+# define RCU_NUM_LVLS	2
+#elif NR_CPUS <= RCU_FANOUT * RCU_FANOUT * RCU_FANOUT
+# define RCU_NUM_LVLS	3
+#else
+# error "NR_CPUS too large for the RCU tree"
+#endif
+
+#define RCU_DIV_UP(n, d)	(((n) + (d) - 1) / (d))
+/* Leaves, the level above, and the root: enough for any of the above */
+#define NUM_RCU_NODES	(RCU_DIV_UP(NR_CPUS, RCU_FANOUT) + \
+			 RCU_DIV_UP(NR_CPUS, RCU_FANOUT * RCU_FANOUT) + 1)
+
+struct rcu_node {
+	spinlock_t	lock;
+	long		batch;		/* Grace period qsmask is for */
+	unsigned long	qsmask;		/* CPUs or groups still to report */
+	unsigned long	grpmask;	/* Our bit in parent->qsmask */
+	int		grplo, grphi;	/* CPUs below us */
+	struct rcu_node	*parent;
+} ____cacheline_maxaligned_in_smp;
+
 /* Bookkeeping of the progress of the grace period */
 struct rcu_state {
-	spinlock_t	lock; /* Guard this struct and writes to rcu_ctrlblk */
-	cpumask_t	cpumask; /* CPUs that need to switch in order    */
-	                              /* for current batch to proceed.        */
+	spinlock_t	lock; /* Starts and ends batches, guards writes to rcu_ctrlblk */
+	struct rcu_node	node[NUM_RCU_NODES];
+	struct rcu_node	*level[RCU_NUM_LVLS];	/* root first */
+	int		levelcnt[RCU_NUM_LVLS];
 };
 
 static struct rcu_state rcu_state ____cacheline_maxaligned_in_smp =
-	  {.lock = SPIN_LOCK_UNLOCKED, .cpumask = CPU_MASK_NONE };
+	  {.lock = SPIN_LOCK_UNLOCKED };
 static struct rcu_state rcu_bh_state ____cacheline_maxaligned_in_smp =
-	  {.lock = SPIN_LOCK_UNLOCKED, .cpumask = CPU_MASK_NONE };
+	  {.lock = SPIN_LOCK_UNLOCKED };
 
 DEFINE_PER_CPU(struct rcu_data, rcu_data) = { 0L };
 DEFINE_PER_CPU(struct rcu_data, rcu_bh_data) = { 0L };
@@ -158,18 +191,31 @@ static void rcu_do_batch(struct rcu_data *rdp)
  * - A new grace period is started.
  *   This is done by rcu_start_batch. The start is not broadcasted to
  *   all cpus, they must pick this up by comparing rcp->cur with
- *   rdp->quiescbatch. All cpus are recorded  in the
- *   rcu_state.cpumask bitmap.
+ *   rdp->quiescbatch. All cpus are recorded in the leaves of the
+ *   rcu_state node tree.
  * - All cpus must go through a quiescent state.
  *   Since the start of the grace period is not broadcasted, at least two
  *   calls to rcu_check_quiescent_state are required:
  *   The first call just notices that a new grace period is running. The
  *   following calls check if there was a quiescent state since the beginning
- *   of the grace period. If so, it updates rcu_state.cpumask. If
- *   the bitmap is empty, then the grace period is completed.
+ *   of the grace period. If so, it clears its bit in its leaf, and
+ *   the last cpu of a node clears the node's bit in its parent.  When
+ *   the root is empty, then the grace period is completed.
  *   rcu_check_quiescent_state calls rcu_start_batch(0) to start the next grace
  *   period (if necessary).
  */
+/* The CPUs of a leaf to wait for: online ones that still take the tick */
+static unsigned long rcu_leaf_mask(struct rcu_node *rnp)
+{
+	unsigned long mask = 0;
+	int cpu;
+
+	for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++)
+		if (cpu_online(cpu) && !cpu_isset(cpu, nohz_cpu_mask))
+			mask |= 1UL << (cpu - rnp->grplo);
+	return mask;
+}
+
 /*
  * Register a new batch of callbacks, and start it up if there is currently no
  * active batch and the batch to be registered has not already occurred.
@@ -178,13 +224,41 @@ static void rcu_do_batch(struct rcu_data *rdp)
 static void rcu_start_batch(struct rcu_ctrlblk *rcp, struct rcu_state *rsp,
 				int next_pending)
 {
+	struct rcu_node *rnp, *child, *end;
+	long batch;
+	int l, i;
+
 	if (next_pending)
 		rcp->next_pending = 1;
 
 	if (rcp->next_pending &&
 			rcp->completed == rcp->cur) {
-		/* Can't change, since spin lock held. */
-		cpus_andnot(rsp->cpumask, cpu_online_map, nohz_cpu_mask);
+		/*
+		 * Fill in the tree from the leaves up.  Nobody reports
+		 * for the new batch before it is in rcp->cur, so the masks
+		 * of the children can be read without their locks.
+		 */
+		batch = rcp->cur + 1;
+		for (l = RCU_NUM_LVLS - 1; l >= 0; l--) {
+			rnp = rsp->level[l];
+			end = rnp + rsp->levelcnt[l];
+			for (i = 0; rnp < end; rnp++, i++) {
+				spin_lock(&rnp->lock);
+				if (l == RCU_NUM_LVLS - 1)
+					rnp->qsmask = rcu_leaf_mask(rnp);
+				else {
+					rnp->qsmask = 0;
+					child = rsp->level[l + 1] + i * RCU_FANOUT;
+					for (; child < rsp->level[l + 1] +
+						       rsp->levelcnt[l + 1] &&
+					       child->parent == rnp; child++)
+						if (child->qsmask)
+							rnp->qsmask |= child->grpmask;
+				}
+				rnp->batch = batch;
+				spin_unlock(&rnp->lock);
+			}
+		}
 
 		rcp->next_pending = 0;
 		/* next_pending == 0 must be visible in __rcu_process_callbacks()
@@ -192,22 +266,55 @@ static void rcu_start_batch(struct rcu_ctrlblk *rcp, struct rcu_state *rsp,
 		 */
 		smp_wmb();
 		rcp->cur++;
+
+		/* Every cpu was idle without a tick: nothing to wait for */
+		if (!rsp->level[0]->qsmask)
+			rcp->completed = rcp->cur;
 	}
 }
 
 /*
- * cpu went through a quiescent state since the beginning of the grace period.
- * Clear it from the cpu mask and complete the grace period if it was the last
- * cpu. Start another grace period if someone has further entries pending
+ * cpu went through a quiescent state since the beginning of grace period
+ * batch.  Clear it from its leaf, and the leaf from its parent if it was
+ * the last cpu there, and so on up.  Complete the grace period if the root
+ * is empty, and start another one if someone has further entries pending.
+ * Reports for an older batch, or from a cpu that was not waited for,
+ * are ignored.
  */
-static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp, struct rcu_state *rsp)
+static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp, struct rcu_state *rsp,
+		      long batch)
 {
-	cpu_clear(cpu, rsp->cpumask);
-	if (cpus_empty(rsp->cpumask)) {
-		/* batch completed ! */
+	struct rcu_node *rnp, *parent;
+	unsigned long mask;
+
+	rnp = rsp->level[RCU_NUM_LVLS - 1] + cpu / RCU_FANOUT;
+	mask = 1UL << (cpu - rnp->grplo);
+	for (;;) {
+		spin_lock(&rnp->lock);
+		if (rnp->batch != batch || !(rnp->qsmask & mask)) {
+			spin_unlock(&rnp->lock);
+			return;
+		}
+		rnp->qsmask &= ~mask;
+		if (rnp->qsmask) {
+			spin_unlock(&rnp->lock);
+			return;
+		}
+		mask = rnp->grpmask;
+		parent = rnp->parent;
+		spin_unlock(&rnp->lock);
+		if (!parent)
+			break;
+		rnp = parent;
+	}
+
+	/* batch completed ! */
+	spin_lock(&rsp->lock);
+	if (rcp->cur == batch) {
 		rcp->completed = rcp->cur;
 		rcu_start_batch(rcp, rsp, 0);
 	}
+	spin_unlock(&rsp->lock);
 }
 
 /*
@@ -241,15 +348,40 @@ static void rcu_check_quiescent_state(struct rcu_ctrlblk *rcp,
 		return;
 	rdp->qs_pending = 0;
 
-	spin_lock(&rsp->lock);
 	/*
-	 * rdp->quiescbatch/rcp->cur and the cpu bitmap can come out of sync
-	 * during cpu startup. Ignore the quiescent state.
+	 * rdp->quiescbatch/rcp->cur and the tree can come out of sync
+	 * during cpu startup: cpu_quiet() then ignores the quiescent state.
 	 */
-	if (likely(rdp->quiescbatch == rcp->cur))
-		cpu_quiet(rdp->cpu, rcp, rsp);
+	cpu_quiet(rdp->cpu, rcp, rsp, rdp->quiescbatch);
+}
 
-	spin_unlock(&rsp->lock);
+static void __rcu_enter_nohz(struct rcu_ctrlblk *rcp, struct rcu_state *rsp,
+			     struct rcu_data *rdp)
+{
+	long cur = rcp->cur;
+
+	if (cur == rcp->completed)
+		return;
+	if (rdp->quiescbatch == cur && !rdp->qs_pending)
+		return;
+	rdp->quiescbatch = cur;
+	rdp->qs_pending = 0;
+	cpu_quiet(rdp->cpu, rcp, rsp, cur);
+}
+
+/*
+ * cpu is about to stop its tick in the idle loop, a quiescent state for
+ * both flavours.  Report it now, rather than keep the tick going for the
+ * tasklet to notice the grace period and report it later; a grace period
+ * started while the tick is off does not wait for this cpu at all.
+ * Called from the idle loop with interrupts disabled, after the cpu
+ * was set in nohz_cpu_mask.
+ */
+void rcu_enter_nohz(int cpu)
+{
+	__rcu_enter_nohz(&rcu_ctrlblk, &rcu_state, &per_cpu(rcu_data, cpu));
+	__rcu_enter_nohz(&rcu_bh_ctrlblk, &rcu_bh_state,
+			 &per_cpu(rcu_bh_data, cpu));
 }
 
 
@@ -276,10 +408,10 @@ static void __rcu_offline_cpu(struct rcu_data *this_rdp,
 	 * we can block indefinitely waiting for it, so flush
 	 * it here
 	 */
-	spin_lock_bh(&rsp->lock);
+	local_bh_disable();
 	if (rcp->cur != rcp->completed)
-		cpu_quiet(rdp->cpu, rcp, rsp);
-	spin_unlock_bh(&rsp->lock);
+		cpu_quiet(rdp->cpu, rcp, rsp, rcp->cur);
+	local_bh_enable();
 	rcu_move_batch(this_rdp, rdp->curlist, rdp->curtail);
 	rcu_move_batch(this_rdp, rdp->nxtlist, rdp->nxttail);
 
@@ -415,6 +547,33 @@ static struct notifier_block __devinitdata rcu_nb = {
 	.notifier_call	= rcu_cpu_notify,
 };
 
+/* Lay out the tree, root first, each level's nodes covering consecutive cpus */
+static void __init rcu_init_state(struct rcu_state *rsp)
+{
+	struct rcu_node *rnp = rsp->node;
+	int span[RCU_NUM_LVLS];
+	int l, i;
+
+	span[RCU_NUM_LVLS - 1] = RCU_FANOUT;
+	for (l = RCU_NUM_LVLS - 2; l >= 0; l--)
+		span[l] = span[l + 1] * RCU_FANOUT;
+
+	for (l = 0; l < RCU_NUM_LVLS; l++) {
+		rsp->level[l] = rnp;
+		rsp->levelcnt[l] = RCU_DIV_UP(NR_CPUS, span[l]);
+		for (i = 0; i < rsp->levelcnt[l]; i++, rnp++) {
+			spin_lock_init(&rnp->lock);
+			rnp->batch = rcu_ctrlblk.completed;
+			rnp->qsmask = 0;
+			rnp->grplo = i * span[l];
+			rnp->grphi = min(rnp->grplo + span[l], NR_CPUS) - 1;
+			rnp->grpmask = 1UL << (i % RCU_FANOUT);
+			rnp->parent = l ? rsp->level[l - 1] + i / RCU_FANOUT
+					: NULL;
+		}
+	}
+}
+
 /*
  * Initializes rcu mechanism.  Assumed to be called early.
  * That is before local timer(SMP) or jiffie timer (uniproc) is setup.
@@ -423,6 +582,8 @@ static struct notifier_block __devinitdata rcu_nb = {
  */
 void __init rcu_init(void)
 {
+	rcu_init_state(&rcu_state);
+	rcu_init_state(&rcu_bh_state);
 	rcu_cpu_notify(&rcu_nb, CPU_UP_PREPARE,
 			(void *)(long)smp_processor_id());
 	/* Register notifier for non-boot CPUs */
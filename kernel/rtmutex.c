@@ -0,0 +1,295 @@
+/*
+ * kernel/rtmutex.c
+ *
+ * Sleeping locks with priority inheritance, see include/linux/rtmutex.h.
+ *
+ * Every owner runs at the priority of the top waiter of the locks it
+ * owns, if that is higher than its own.  Only the top waiter of each
+ * lock is queued on its owner's pi_waiters.  When a priority changes,
+ * the change is passed down the chain: the waiter is requeued on the
+ * lock it waits for, and if that changed the top waiter, the owner
+ * of the lock is adjusted in turn.
+ *
+ * Waiters are of one rank with the lock: they are woken owning it,
+ * in priority order, and nobody can take it in between.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/rtmutex.h>
+
+/* Longest chain of owners followed, should it loop through a deadlock */
+#define RT_MUTEX_MAX_CHAIN	1024
+
+spinlock_t rt_mutex_chain_lock = SPIN_LOCK_UNLOCKED;
+
+static inline struct rt_mutex_waiter *
+rt_mutex_top_waiter(struct rt_mutex *lock)
+{
+	return list_entry(lock->wait_list.next, struct rt_mutex_waiter, list);
+}
+
+/* Queue behind the waiters of the same or higher priority. */
+static void rt_mutex_enqueue(struct rt_mutex *lock,
+			     struct rt_mutex_waiter *waiter)
+{
+	struct list_head *pos;
+
+	list_for_each(pos, &lock->wait_list)
+		if (list_entry(pos, struct rt_mutex_waiter, list)->prio >
+		    waiter->prio)
+			break;
+	list_add_tail(&waiter->list, pos);
+}
+
+static void rt_mutex_enqueue_pi(struct task_struct *task,
+				struct rt_mutex_waiter *waiter)
+{
+	struct list_head *pos;
+
+	list_for_each(pos, &task->pi_waiters)
+		if (list_entry(pos, struct rt_mutex_waiter, pi_list)->prio >
+		    waiter->prio)
+			break;
+	list_add_tail(&waiter->pi_list, pos);
+}
+
+static inline void __rt_mutex_adjust_prio(struct task_struct *task)
+{
+	int prio = rt_mutex_getprio(task);
+
+	if (task->prio != prio)
+		rt_mutex_setprio(task, prio);
+}
+
+/*
+ * The top PI waiter of task, or its own priority, may have changed:
+ * set its priority, and carry on down the chain of locks it waits for.
+ */
+static void rt_mutex_adjust_chain(struct task_struct *task)
+{
+	struct rt_mutex_waiter *waiter, *top;
+	struct rt_mutex *lock;
+	int depth;
+
+	for (depth = 0; depth < RT_MUTEX_MAX_CHAIN; depth++) {
+		__rt_mutex_adjust_prio(task);
+
+		waiter = task->pi_blocked_on;
+		if (!waiter || waiter->prio == task->prio)
+			return;
+
+		lock = waiter->lock;
+		top = rt_mutex_top_waiter(lock);
+		list_del(&waiter->list);
+		waiter->prio = task->prio;
+		rt_mutex_enqueue(lock, waiter);
+
+		/* Only the top waiter of a lock matters to its owner */
+		task = lock->owner;
+		if (top == rt_mutex_top_waiter(lock) && top != waiter)
+			return;
+		list_del(&top->pi_list);
+		rt_mutex_enqueue_pi(task, rt_mutex_top_waiter(lock));
+	}
+}
+
+/* Would task waiting for lock close a loop of owners? */
+static int rt_mutex_chain_deadlocks(struct rt_mutex *lock,
+				    struct task_struct *task)
+{
+	struct task_struct *owner = lock->owner;
+	int depth;
+
+	for (depth = 0; depth < RT_MUTEX_MAX_CHAIN; depth++) {
+		if (owner == task)
+			return 1;
+		if (!owner->pi_blocked_on)
+			return 0;
+		owner = owner->pi_blocked_on->lock->owner;
+	}
+	return 1;
+}
+
+static void rt_mutex_remove_waiter(struct rt_mutex *lock,
+				   struct rt_mutex_waiter *waiter)
+{
+	struct task_struct *owner = lock->owner;
+	int was_top = rt_mutex_top_waiter(lock) == waiter;
+
+	list_del(&waiter->list);
+	waiter->task->pi_blocked_on = NULL;
+	if (!was_top)
+		return;
+
+	list_del(&waiter->pi_list);
+	if (rt_mutex_has_waiters(lock))
+		rt_mutex_enqueue_pi(owner, rt_mutex_top_waiter(lock));
+	rt_mutex_adjust_chain(owner);
+}
+
+/*
+ * Take lock if it is free, and return 1.  Otherwise queue current
+ * as a waiter, boosting the owner, and return 0, or -EDEADLK if the
+ * owner waits, maybe through others, for a lock we own.  Splitting
+ * this from rt_mutex_finish_wait() lets the caller queue up under its
+ * own spinlock.
+ */
+int rt_mutex_start_wait(struct rt_mutex *lock, struct rt_mutex_waiter *waiter)
+{
+	struct rt_mutex_waiter *top = NULL;
+	struct task_struct *owner;
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&rt_mutex_chain_lock, flags);
+	owner = lock->owner;
+	if (!owner) {
+		lock->owner = current;
+		ret = 1;
+		goto out;
+	}
+	if (rt_mutex_chain_deadlocks(lock, current)) {
+		ret = -EDEADLK;
+		goto out;
+	}
+
+	waiter->task = current;
+	waiter->lock = lock;
+	waiter->prio = current->prio;
+	if (rt_mutex_has_waiters(lock))
+		top = rt_mutex_top_waiter(lock);
+	rt_mutex_enqueue(lock, waiter);
+	current->pi_blocked_on = waiter;
+	if (rt_mutex_top_waiter(lock) == waiter) {
+		if (top)
+			list_del(&top->pi_list);
+		rt_mutex_enqueue_pi(owner, waiter);
+		rt_mutex_adjust_chain(owner);
+	}
+out:
+	spin_unlock_irqrestore(&rt_mutex_chain_lock, flags);
+	return ret;
+}
+
+/*
+ * Sleep until a waiter queued by rt_mutex_start_wait() is given the
+ * lock.  The wait is interruptible: returns 0 with the lock held,
+ * -EINTR or -ETIMEDOUT.
+ */
+int rt_mutex_finish_wait(struct rt_mutex *lock, struct rt_mutex_waiter *waiter,
+			 unsigned long timeout)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&rt_mutex_chain_lock, flags);
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		/* The unlocker gives the lock to us, see __rt_mutex_unlock */
+		if (lock->owner == current)
+			break;
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		if (!timeout) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+		spin_unlock_irqrestore(&rt_mutex_chain_lock, flags);
+		timeout = schedule_timeout(timeout);
+		spin_lock_irqsave(&rt_mutex_chain_lock, flags);
+	}
+	__set_current_state(TASK_RUNNING);
+	if (ret)
+		rt_mutex_remove_waiter(lock, waiter);
+	spin_unlock_irqrestore(&rt_mutex_chain_lock, flags);
+	return ret;
+}
+
+/**
+ * rt_mutex_timed_lock - take a lock, boosting its owner while we wait
+ * @lock: the rt_mutex
+ * @timeout: in jiffies, or MAX_SCHEDULE_TIMEOUT
+ *
+ * The wait is interruptible.  Returns 0 with the lock held, -EINTR,
+ * -ETIMEDOUT, or -EDEADLK if the lock's owner waits, maybe through
+ * others, for a lock we own.
+ */
+int rt_mutex_timed_lock(struct rt_mutex *lock, unsigned long timeout)
+{
+	struct rt_mutex_waiter waiter;
+	int ret;
+
+	ret = rt_mutex_start_wait(lock, &waiter);
+	if (ret)
+		return ret > 0 ? 0 : ret;
+	return rt_mutex_finish_wait(lock, &waiter, timeout);
+}
+
+/* Initialise lock as held by owner, on behalf of a waiter about to block. */
+void rt_mutex_init_proxy_locked(struct rt_mutex *lock,
+				struct task_struct *owner)
+{
+	rt_mutex_init(lock);
+	lock->owner = owner;
+}
+
+/* The task that would get lock if it were unlocked now, or NULL. */
+struct task_struct *rt_mutex_next_owner(struct rt_mutex *lock)
+{
+	if (!rt_mutex_has_waiters(lock))
+		return NULL;
+	return rt_mutex_top_waiter(lock)->task;
+}
+
+/*
+ * Hand lock to its top waiter, and drop the boost it gave the owner,
+ * which need not be current.
+ */
+void __rt_mutex_unlock(struct rt_mutex *lock)
+{
+	struct task_struct *owner = lock->owner, *next;
+	struct rt_mutex_waiter *waiter;
+
+	if (!rt_mutex_has_waiters(lock)) {
+		lock->owner = NULL;
+		return;
+	}
+
+	waiter = rt_mutex_top_waiter(lock);
+	list_del(&waiter->list);
+	list_del(&waiter->pi_list);
+	next = waiter->task;
+	next->pi_blocked_on = NULL;
+	lock->owner = next;
+	if (rt_mutex_has_waiters(lock))
+		rt_mutex_enqueue_pi(next, rt_mutex_top_waiter(lock));
+
+	rt_mutex_adjust_chain(owner);
+	__rt_mutex_adjust_prio(next);
+	wake_up_process(next);
+}
+
+void rt_mutex_unlock(struct rt_mutex *lock)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&rt_mutex_chain_lock, flags);
+	__rt_mutex_unlock(lock);
+	spin_unlock_irqrestore(&rt_mutex_chain_lock, flags);
+}
+
+/* The priority of task was changed by sched_setscheduler(). */
+void rt_mutex_adjust_pi(struct task_struct *task)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&rt_mutex_chain_lock, flags);
+	rt_mutex_adjust_chain(task);
+	spin_unlock_irqrestore(&rt_mutex_chain_lock, flags);
+}
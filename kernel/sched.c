@@ -47,7 +47,13 @@
 #include <linux/syscalls.h>
 #include <linux/times.h>
 #include <linux/acct.h>
+#include <linux/vmalloc.h>
+#include <linux/blkdev.h>
+#include <linux/rtmutex.h>
+#include <linux/workqueue.h>
+#include <linux/delayacct.h>
 #include <asm/tlb.h>
+#include <asm/div64.h>
 
 #include <asm/unistd.h>
 
@@ -84,6 +90,7 @@
  */
 #define MIN_TIMESLICE		max(5 * HZ / 1000, 1)
 #define DEF_TIMESLICE		(100 * HZ / 1000)
+#define BATCH_TIMESLICE_FACTOR	  4
 #define ON_RUNQUEUE_WEIGHT	 30
 #define CHILD_PENALTY		 95
 #define PARENT_PENALTY		100
@@ -121,6 +128,8 @@
  * tasks will be expired. Default nice 0 tasks are somewhere between,
  * it takes some effort for them to get interactive, but it's not
  * too hard.
+ *
+ * SCHED_BATCH tasks are never rated interactive.
  */
 
 #define CURRENT_BONUS(p) \
@@ -145,14 +154,19 @@
 	(SCALE(TASK_NICE(p), 40, MAX_BONUS) + INTERACTIVE_DELTA)
 
 #define TASK_INTERACTIVE(p) \
-	((p)->prio <= (p)->static_prio - DELTA(p))
+	(!batch_task(p) && (p)->prio <= (p)->static_prio - DELTA(p))
 
 #define INTERACTIVE_SLEEP(p) \
 	(JIFFIES_TO_NS(MAX_SLEEP_AVG * \
 		(MAX_BONUS / 2 + DELTA((p)) + 1) / MAX_BONUS - 1))
 
+/*
+ * SCHED_BATCH tasks only preempt the idle task, they wait for the
+ * current task to finish its slice otherwise:
+ */
 #define TASK_PREEMPTS_CURR(p, rq) \
-	((p)->prio < (rq)->curr->prio)
+	((p)->prio < (rq)->curr->prio && \
+		(!batch_task(p) || (rq)->curr == (rq)->idle))
 
 /*
  * task_timeslice() scales user-nice values [ -20 ... 0 ... 19 ]
@@ -161,17 +175,106 @@
  * The higher a thread's priority, the bigger timeslices
  * it gets during one round of execution. But even the lowest
  * priority thread gets MIN_TIMESLICE worth of execution time.
+ *
+ * SCHED_BATCH tasks get BATCH_TIMESLICE_FACTOR times longer timeslices,
+ * they do not care about latency and switch less often this way.
  */
 
 #define SCALE_PRIO(x, prio) \
 	max(x * (MAX_PRIO - prio) / (MAX_USER_PRIO/2), MIN_TIMESLICE)
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+/*
+ * Group fair sharing: with sched_share=uid or sched_share=cpuset every
+ * queued task is accounted to the sched_share of its user or cpuset.
+ * The group's weight is split between its runnable tasks by shrinking
+ * their timeslices, so in each round of the runqueue arrays a group
+ * gets CPU time in proportion to its weight rather than to how many
+ * threads it has.
+ *
+ * The runnable count is system-wide, so it does not change when
+ * load_balance() moves tasks between CPUs and the shares hold across
+ * the whole machine. A group with no more runnable tasks than there
+ * are CPUs can keep every task on a CPU and gets unscaled slices.
+ */
+enum {
+	SHARE_NONE,
+	SHARE_BY_UID,
+	SHARE_BY_CPUSET,
+};
+
+static int sched_share_key = SHARE_NONE;
+
+static int __init sched_share_setup(char *str)
+{
+	if (!strcmp(str, "uid"))
+		sched_share_key = SHARE_BY_UID;
+	else if (!strcmp(str, "cpuset"))
+		sched_share_key = SHARE_BY_CPUSET;
+	return 1;
+}
+
+__setup("sched_share=", sched_share_setup);
+
+static inline struct sched_share *task_share(task_t *p)
+{
+	switch (sched_share_key) {
+	case SHARE_BY_UID:
+		return &p->user->share;
+	case SHARE_BY_CPUSET:
+		return cpuset_sched_share(p);
+	}
+	return NULL;
+}
+
+static inline void share_enqueue(task_t *p)
+{
+	p->share = task_share(p);
+	if (p->share)
+		atomic_inc(&p->share->nr_running);
+}
+
+static inline void share_dequeue(task_t *p)
+{
+	if (p->share)
+		atomic_dec(&p->share->nr_running);
+	p->share = NULL;
+}
+
+static inline unsigned int share_timeslice(task_t *p, unsigned int slice)
+{
+	struct sched_share *share = p->share;
+	unsigned int nr, cpus;
+
+	if (!share || rt_task(p))
+		return slice;
+
+	slice = slice * share->weight / SCHED_SHARE_DEFAULT;
+	nr = atomic_read(&share->nr_running);
+	cpus = num_online_cpus();
+	if (nr > cpus)
+		slice = slice * cpus / nr;
+
+	return slice ? slice : 1;
+}
+#else
+# define share_enqueue(p)		do { } while (0)
+# define share_dequeue(p)		do { } while (0)
+# define share_timeslice(p, slice)	(slice)
+#endif
+
 static inline unsigned int task_timeslice(task_t *p)
 {
+	unsigned int slice;
+
 	if (p->static_prio < NICE_TO_PRIO(0))
-		return SCALE_PRIO(DEF_TIMESLICE*4, p->static_prio);
+		slice = SCALE_PRIO(DEF_TIMESLICE*4, p->static_prio);
 	else
-		return SCALE_PRIO(DEF_TIMESLICE, p->static_prio);
+		slice = SCALE_PRIO(DEF_TIMESLICE, p->static_prio);
+
+	if (batch_task(p))
+		slice *= BATCH_TIMESLICE_FACTOR;
+	return share_timeslice(p, slice);
 }
 #define task_hot(p, now, sd) ((long long) ((now) - (p)->last_ran)	\
 				< (long long) (sd)->cache_hot_time)
@@ -186,6 +289,7 @@ typedef struct runqueue runqueue_t;
 
 struct prio_array {
 	unsigned int nr_active;
+	unsigned int rt_nr_active;
 	unsigned long bitmap[BITMAP_SIZE];
 	struct list_head queue[MAX_PRIO];
 };
@@ -229,10 +333,18 @@ struct runqueue {
 #ifdef CONFIG_SMP
 	struct sched_domain *sd;
 
+#ifdef ARCH_HAS_SCHED_WAKE_QUEUE
+	/* Remote wakeups waiting for scheduler_ipi(), see ttwu_queue() */
+	task_t *wake_list;
+#endif
+
 	/* For active balancing */
 	int active_balance;
 	int push_cpu;
 
+	/* Priority of rq->curr, for real-time balancing */
+	int curr_prio;
+
 	task_t *migration_thread;
 	struct list_head migration_queue;
 #endif
@@ -277,6 +389,15 @@ static DEFINE_PER_CPU(struct runqueue, runqueues);
 # define task_running(rq, p)		((rq)->curr == (p))
 #endif
 
+/*
+ * Flush and invalidate the local CPU caches, used by the migration
+ * cost calibration code. Architectures that can do this cheaply
+ * should override it:
+ */
+#ifndef sched_cacheflush
+# define sched_cacheflush()		do { } while (0)
+#endif
+
 /*
  * task_rq_lock - lock the runqueue a given task resides on and disable
  * interrupts.  Note the ordering: we can safely lookup the task_rq without
@@ -309,11 +430,11 @@ static inline void task_rq_unlock(runqueue_t *rq, unsigned long *flags)
  * bump this up when changing the output format or the meaning of an existing
  * format, so that tools can adapt (or abort)
  */
-#define SCHEDSTAT_VERSION 11
+#define SCHEDSTAT_VERSION 14
 
 static int show_schedstat(struct seq_file *seq, void *v)
 {
-	int cpu;
+	int cpu, i;
 	enum idle_type itype;
 
 	seq_printf(seq, "version %d\n", SCHEDSTAT_VERSION);
@@ -335,6 +456,14 @@ static int show_schedstat(struct seq_file *seq, void *v)
 		    rq->rq_sched_info.cpu_time,
 		    rq->rq_sched_info.run_delay, rq->rq_sched_info.pcnt);
 
+		/* wakeup-to-run delay and timeslice length histograms */
+		for (i = 0; i < SCHED_INFO_HIST_BUCKETS; i++)
+			seq_printf(seq, " %lu",
+				rq->rq_sched_info.run_delay_hist[i]);
+		for (i = 0; i < SCHED_INFO_HIST_BUCKETS; i++)
+			seq_printf(seq, " %lu",
+				rq->rq_sched_info.cpu_time_hist[i]);
+
 		seq_printf(seq, "\n");
 
 #ifdef CONFIG_SMP
@@ -356,10 +485,12 @@ static int show_schedstat(struct seq_file *seq, void *v)
 				    sd->lb_nobusyq[itype],
 				    sd->lb_nobusyg[itype]);
 			}
-			seq_printf(seq, " %lu %lu %lu %lu %lu %lu %lu %lu\n",
+			seq_printf(seq, " %lu %lu %lu %lu %lu %lu %lu %lu %llu %lu %lu\n",
 			    sd->alb_cnt, sd->alb_failed, sd->alb_pushed,
 			    sd->sbe_pushed, sd->sbe_attempts,
-			    sd->ttwu_wake_remote, sd->ttwu_move_affine, sd->ttwu_move_balance);
+			    sd->ttwu_wake_remote, sd->ttwu_move_affine, sd->ttwu_move_balance,
+			    sd->cache_hot_time,
+			    sd->lb_numa_toward, sd->lb_numa_kept);
 		}
 #endif
 	}
@@ -430,7 +561,7 @@ static int cpu_and_siblings_are_idle(int cpu)
 #define cpu_and_siblings_are_idle(A) idle_cpu(A)
 #endif
 
-#ifdef CONFIG_SCHEDSTATS
+#if defined(CONFIG_SCHEDSTATS) || defined(CONFIG_TASK_DELAY_ACCT)
 /*
  * Called when a process is dequeued from the active array and given
  * the cpu.  We should note that with the exception of interactive
@@ -451,28 +582,50 @@ static inline void sched_info_dequeued(task_t *t)
 	t->sched_info.last_queued = 0;
 }
 
+/*
+ * Map an interval in jiffies to its log2 histogram bucket.
+ */
+static inline int sched_info_bucket(unsigned long delta)
+{
+	if (delta >= 1UL << (SCHED_INFO_HIST_BUCKETS - 2))
+		return SCHED_INFO_HIST_BUCKETS - 1;
+	return fls(delta);
+}
+
 /*
  * Called when a task finally hits the cpu.  We can now calculate how
  * long it was waiting to run.  We also note when it began so that we
  * can keep stats on how long its timeslice is.
+ *
+ * Like the other sched_info counters the histograms are only ever
+ * updated from schedule() with the runqueue locked, so they need no
+ * locking of their own.
  */
 static inline void sched_info_arrive(task_t *t)
 {
 	unsigned long now = jiffies, diff = 0;
 	struct runqueue *rq = task_rq(t);
+	int bucket = -1;
 
-	if (t->sched_info.last_queued)
+	if (t->sched_info.last_queued) {
 		diff = now - t->sched_info.last_queued;
+		bucket = sched_info_bucket(diff);
+		t->sched_info.run_delay_hist[bucket]++;
+	}
 	sched_info_dequeued(t);
 	t->sched_info.run_delay += diff;
 	t->sched_info.last_arrival = now;
 	t->sched_info.pcnt++;
 
+#ifdef CONFIG_SCHEDSTATS
 	if (!rq)
 		return;
 
 	rq->rq_sched_info.run_delay += diff;
 	rq->rq_sched_info.pcnt++;
+	if (bucket >= 0)
+		rq->rq_sched_info.run_delay_hist[bucket]++;
+#endif
 }
 
 /*
@@ -504,11 +657,17 @@ static inline void sched_info_depart(task_t *t)
 {
 	struct runqueue *rq = task_rq(t);
 	unsigned long diff = jiffies - t->sched_info.last_arrival;
+	int bucket = sched_info_bucket(diff);
 
 	t->sched_info.cpu_time += diff;
+	t->sched_info.cpu_time_hist[bucket]++;
 
-	if (rq)
+#ifdef CONFIG_SCHEDSTATS
+	if (rq) {
 		rq->rq_sched_info.cpu_time += diff;
+		rq->rq_sched_info.cpu_time_hist[bucket]++;
+	}
+#endif
 }
 
 /*
@@ -534,13 +693,26 @@ static inline void sched_info_switch(task_t *prev, task_t *next)
 #else
 #define sched_info_queued(t)		do { } while (0)
 #define sched_info_switch(t, next)	do { } while (0)
-#endif /* CONFIG_SCHEDSTATS */
+#endif /* CONFIG_SCHEDSTATS || CONFIG_TASK_DELAY_ACCT */
 
 /*
  * Adding/removing a task to/from a priority array:
  */
+static inline void inc_rt_tasks(struct task_struct *p, prio_array_t *array)
+{
+	if (rt_task(p))
+		array->rt_nr_active++;
+}
+
+static inline void dec_rt_tasks(struct task_struct *p, prio_array_t *array)
+{
+	if (rt_task(p))
+		array->rt_nr_active--;
+}
+
 static void dequeue_task(struct task_struct *p, prio_array_t *array)
 {
+	dec_rt_tasks(p, array);
 	array->nr_active--;
 	list_del(&p->run_list);
 	if (list_empty(array->queue + p->prio))
@@ -553,6 +725,7 @@ static void enqueue_task(struct task_struct *p, prio_array_t *array)
 	list_add_tail(&p->run_list, array->queue + p->prio);
 	__set_bit(p->prio, array->bitmap);
 	array->nr_active++;
+	inc_rt_tasks(p, array);
 	p->array = array;
 }
 
@@ -570,6 +743,7 @@ static inline void enqueue_task_head(struct task_struct *p, prio_array_t *array)
 	list_add(&p->run_list, array->queue + p->prio);
 	__set_bit(p->prio, array->bitmap);
 	array->nr_active++;
+	inc_rt_tasks(p, array);
 	p->array = array;
 }
 
@@ -587,12 +761,16 @@ static inline void enqueue_task_head(struct task_struct *p, prio_array_t *array)
  *
  * Both properties are important to certain workloads.
  */
-static int effective_prio(task_t *p)
+static int __normal_prio(task_t *p)
 {
 	int bonus, prio;
 
-	if (rt_task(p))
-		return p->prio;
+	/*
+	 * SCHED_BATCH tasks get neither an interactivity bonus nor a
+	 * CPU hog penalty:
+	 */
+	if (batch_task(p))
+		return p->static_prio;
 
 	bonus = CURRENT_BONUS(p) - MAX_BONUS / 2;
 
@@ -604,6 +782,24 @@ static int effective_prio(task_t *p)
 	return prio;
 }
 
+static int effective_prio(task_t *p)
+{
+	if (rt_task(p))
+		return p->prio;
+	return __normal_prio(p);
+}
+
+/*
+ * normal_prio - the priority of p as its policy has it, without any
+ * boost from priority inheritance.
+ */
+static inline int normal_prio(task_t *p)
+{
+	if (p->policy == SCHED_FIFO || p->policy == SCHED_RR)
+		return MAX_USER_RT_PRIO-1 - p->rt_priority;
+	return __normal_prio(p);
+}
+
 /*
  * __activate_task - move a task to the runqueue.
  */
@@ -611,6 +807,7 @@ static inline void __activate_task(task_t *p, runqueue_t *rq)
 {
 	enqueue_task(p, rq->active);
 	rq->nr_running++;
+	share_enqueue(p);
 }
 
 /*
@@ -633,6 +830,13 @@ static void recalc_task_prio(task_t *p, unsigned long long now)
 	else
 		sleep_time = (unsigned long)__sleep_time;
 
+	/*
+	 * SCHED_BATCH tasks do not collect sleep_avg, so they can
+	 * never earn interactive status:
+	 */
+	if (batch_task(p))
+		sleep_time = 0;
+
 	if (likely(sleep_time > 0)) {
 		/*
 		 * User tasks that sleep a long time are categorised as
@@ -741,7 +945,29 @@ static void deactivate_task(struct task_struct *p, runqueue_t *rq)
 	rq->nr_running--;
 	dequeue_task(p, p->array);
 	p->array = NULL;
+	share_dequeue(p);
+}
+
+#ifdef CONFIG_FAIR_GROUP_SCHED
+/*
+ * sched_move_share - re-account a task after its user or cpuset changed.
+ *
+ * Must be called after the task's user or cpuset pointer has been
+ * updated, and before the reference on the old one is dropped.
+ */
+void sched_move_share(task_t *p)
+{
+	unsigned long flags;
+	runqueue_t *rq;
+
+	rq = task_rq_lock(p, &flags);
+	if (p->array) {
+		share_dequeue(p);
+		share_enqueue(p);
+	}
+	task_rq_unlock(rq, &flags);
 }
+#endif
 
 /*
  * resched_task - mark a task 'to be rescheduled now'.
@@ -915,6 +1141,46 @@ static inline unsigned long target_load(int cpu)
  *
  * Returns the CPU we should wake onto.
  */
+#ifdef CONFIG_SMP
+/*
+ * Real-time balancing.
+ *
+ * load_balance() goes by runqueue length only, so an RT task can sit
+ * queued behind a higher priority one while another cpu runs lower
+ * priority work. Each runqueue publishes the priority it runs at in
+ * rq->curr_prio. RT tasks that cannot run where they are woken, or
+ * that get preempted by a higher priority RT task, are pushed to the
+ * cpu running at the lowest priority, and a cpu whose priority drops
+ * pulls queued RT tasks from the others.
+ */
+static inline unsigned int rq_rt_nr_running(runqueue_t *rq)
+{
+	return rq->active->rt_nr_active + rq->expired->rt_nr_active;
+}
+
+/*
+ * Find the allowed cpu running at the lowest priority below p's, ties
+ * going to @cpu. Returns -1 if p would not preempt anything.
+ */
+static int find_lowest_cpu(task_t *p, int cpu)
+{
+	int i, best = -1, best_prio = p->prio;
+	cpumask_t mask;
+
+	cpus_and(mask, p->cpus_allowed, cpu_online_map);
+	for_each_cpu_mask(i, mask) {
+		int prio = cpu_rq(i)->curr_prio;
+
+		if (prio > best_prio || (prio == best_prio && i == cpu &&
+							best >= 0)) {
+			best = i;
+			best_prio = prio;
+		}
+	}
+	return best;
+}
+#endif
+
 #if defined(ARCH_HAS_SCHED_WAKE_IDLE)
 static int wake_idle(int cpu, task_t *p)
 {
@@ -959,6 +1225,193 @@ static inline int wake_idle(int cpu, task_t *p)
  *
  * returns failure only if the task is already active.
  */
+static int try_to_wake_up(task_t * p, unsigned int state, int sync);
+
+#ifdef ARCH_HAS_SCHED_WAKE_QUEUE
+/*
+ * Queued remote wakeups.
+ *
+ * Taking a remote runqueue lock for every wakeup makes rq->lock bounce
+ * between the caches of the waker and the wakee. When the lowest
+ * domain spanning both cpus has SD_WAKE_QUEUE set, the waker instead
+ * pushes the sleeping task onto the target runqueue's wake_list,
+ * without any locks, and sends the target a reschedule IPI if the list
+ * was empty. scheduler_ipi() then does the wakeups for the whole batch
+ * under the target's own rq->lock.
+ *
+ * Only plain (non-sync, TASK_INTERRUPTIBLE|TASK_UNINTERRUPTIBLE)
+ * wakeups of tasks that are off their runqueue are queued. The task is
+ * woken on the cpu it slept on, so affine wakeups and wake balancing
+ * are skipped for these domains.
+ */
+static void ttwu_queue_push(task_t *p, int cpu)
+{
+	runqueue_t *rq = cpu_rq(cpu);
+	task_t *head;
+
+	do {
+		head = rq->wake_list;
+		p->wake_entry = head;
+	} while (cmpxchg(&rq->wake_list, head, p) != head);
+
+	if (!head)
+		smp_send_reschedule(cpu);
+}
+
+static int ttwu_queue(task_t *p, unsigned int state, int sync)
+{
+	struct sched_domain *sd;
+	unsigned long flags;
+	int cpu, this_cpu, queued = 0;
+
+	if (sync || state != (TASK_INTERRUPTIBLE | TASK_UNINTERRUPTIBLE))
+		return 0;
+	/* RT tasks need the placement in try_to_wake_up() */
+	if (rt_task(p))
+		return 0;
+	/*
+	 * Unlocked, so only a hint: scheduler_ipi() checks the state
+	 * and p->array again under rq->lock before it activates p.
+	 */
+	if (!(p->state & state) || p->array)
+		return 0;
+
+	local_irq_save(flags);
+	cpu = task_cpu(p);
+	this_cpu = smp_processor_id();
+	if (cpu == this_cpu || !cpu_online(cpu))
+		goto out;
+
+	for_each_domain(this_cpu, sd) {
+		if (cpu_isset(cpu, sd->span)) {
+			if (sd->flags & SD_WAKE_QUEUE) {
+				/*
+				 * A wakeup that is already queued will
+				 * do for us, too:
+				 */
+				if (!test_and_set_bit(0, &p->wake_queued)) {
+					get_task_struct(p);
+					ttwu_queue_push(p, cpu);
+				}
+				queued = 1;
+			}
+			break;
+		}
+	}
+out:
+	local_irq_restore(flags);
+	return queued;
+}
+
+/* Queued wakeups done per rq->lock hold in scheduler_ipi() */
+#define WAKE_LIST_BATCH		16
+
+/*
+ * Wake up the tasks queued on this_rq()->wake_list by ttwu_queue().
+ * Called from the reschedule IPI.
+ *
+ * p->wake_entry belongs to the wake_list until p->wake_queued is
+ * cleared: a new ttwu_queue() may push p again, onto any cpu's list,
+ * as soon as it is. So the next entry is read before the bit is
+ * cleared, and the tasks are remembered in done[] rather than through
+ * wake_entry.
+ */
+void scheduler_ipi(void)
+{
+	runqueue_t *rq = this_rq();
+	task_t *done[WAKE_LIST_BATCH];
+	task_t *list, *p;
+	unsigned long flags;
+	int i, n;
+
+	if (!rq->wake_list)
+		return;
+
+	list = xchg(&rq->wake_list, NULL);
+
+	while (list) {
+		n = 0;
+		spin_lock_irqsave(&rq->lock, flags);
+		while (list && n < WAKE_LIST_BATCH) {
+			p = list;
+			list = p->wake_entry;
+			done[n++] = p;
+			/*
+			 * Clear the queued bit before looking at the task
+			 * state, so that a wakeup racing with us either sees
+			 * the bit clear and queues again, or had its
+			 * condition set before the task runs:
+			 */
+			smp_mb__before_clear_bit();
+			clear_bit(0, &p->wake_queued);
+			smp_mb__after_clear_bit();
+
+			/*
+			 * ttwu_queue() looked at the task without any lock:
+			 * only wake it if it is still asleep, now that we
+			 * hold its runqueue lock.
+			 */
+			if (task_rq(p) != rq) {
+				/* Migrated while queued: wake it the slow way */
+				continue;
+			}
+			if (!(p->state & (TASK_INTERRUPTIBLE |
+						TASK_UNINTERRUPTIBLE)))
+				continue;
+			if (!p->array) {
+				if (p->state == TASK_UNINTERRUPTIBLE) {
+					rq->nr_uninterruptible--;
+					p->activated = -1;
+				}
+				schedstat_inc(rq, ttwu_cnt);
+				activate_task(p, rq, 1);
+				if (TASK_PREEMPTS_CURR(p, rq))
+					resched_task(rq->curr);
+			}
+			p->state = TASK_RUNNING;
+		}
+		spin_unlock_irqrestore(&rq->lock, flags);
+
+		for (i = 0; i < n; i++) {
+			p = done[i];
+			/* try_to_wake_up() rechecks under the task's rq->lock */
+			if (p->state & (TASK_INTERRUPTIBLE |
+					TASK_UNINTERRUPTIBLE) &&
+					task_rq(p) != rq)
+				try_to_wake_up(p, TASK_INTERRUPTIBLE |
+						TASK_UNINTERRUPTIBLE, 0);
+			put_task_struct(p);
+		}
+	}
+}
+
+#ifdef CONFIG_HOTPLUG_CPU
+/* Wakeups queued on a cpu that went away before it took the IPI */
+static void drain_wake_list(int dead_cpu)
+{
+	task_t *p, *next;
+
+	p = xchg(&cpu_rq(dead_cpu)->wake_list, NULL);
+	for (; p; p = next) {
+		next = p->wake_entry;
+		clear_bit(0, &p->wake_queued);
+		smp_mb__after_clear_bit();
+		try_to_wake_up(p, TASK_INTERRUPTIBLE | TASK_UNINTERRUPTIBLE, 0);
+		put_task_struct(p);
+	}
+}
+#endif
+#else
+static inline int ttwu_queue(task_t *p, unsigned int state, int sync)
+{
+	return 0;
+}
+
+static inline void drain_wake_list(int dead_cpu)
+{
+}
+#endif
+
 static int try_to_wake_up(task_t * p, unsigned int state, int sync)
 {
 	int cpu, this_cpu, success = 0;
@@ -971,6 +1424,9 @@ static int try_to_wake_up(task_t * p, unsigned int state, int sync)
 	int new_cpu;
 #endif
 
+	if (ttwu_queue(p, state, sync))
+		return 1;
+
 	rq = task_rq_lock(p, &flags);
 	old_state = p->state;
 	if (!(old_state & state))
@@ -1001,6 +1457,21 @@ static int try_to_wake_up(task_t * p, unsigned int state, int sync)
 #endif
 
 	new_cpu = cpu;
+
+	/*
+	 * An RT task goes where it can run right away, rather than
+	 * wherever the load balancing heuristics below would put it:
+	 */
+	if (unlikely(rt_task(p))) {
+		if (cpu_rq(cpu)->curr_prio <= p->prio) {
+			int lowest = find_lowest_cpu(p, this_cpu);
+
+			if (lowest >= 0)
+				new_cpu = lowest;
+		}
+		goto out_set_cpu;
+	}
+
 	if (cpu == this_cpu || unlikely(!cpu_isset(this_cpu, p->cpus_allowed)))
 		goto out_set_cpu;
 
@@ -1140,8 +1611,17 @@ void fastcall sched_fork(task_t *p)
 	p->state = TASK_RUNNING;
 	INIT_LIST_HEAD(&p->run_list);
 	p->array = NULL;
+	/* A boost from the locks the parent holds is not inherited */
+	p->prio = normal_prio(current);
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	p->share = NULL;
+#endif
+#ifdef ARCH_HAS_SCHED_WAKE_QUEUE
+	p->wake_entry = NULL;
+	p->wake_queued = 0;
+#endif
 	spin_lock_init(&p->switch_lock);
-#ifdef CONFIG_SCHEDSTATS
+#if defined(CONFIG_SCHEDSTATS) || defined(CONFIG_TASK_DELAY_ACCT)
 	memset(&p->sched_info, 0, sizeof(p->sched_info));
 #endif
 #ifdef CONFIG_PREEMPT
@@ -1227,6 +1707,7 @@ void fastcall wake_up_new_task(task_t * p, unsigned long clone_flags)
 				p->array = current->array;
 				p->array->nr_active++;
 				rq->nr_running++;
+				share_enqueue(p);
 			}
 			set_need_resched();
 		} else
@@ -1330,6 +1811,7 @@ static inline void finish_task_switch(task_t *prev)
 	 */
 	prev_task_flags = prev->flags;
 	finish_arch_switch(rq, prev);
+	perf_counter_task_wakeup(prev);
 	if (mm)
 		mmdrop(mm);
 	if (unlikely(prev_task_flags & PF_DEAD))
@@ -1372,6 +1854,9 @@ task_t * context_switch(runqueue_t *rq, task_t *prev, task_t *next)
 		rq->prev_mm = oldmm;
 	}
 
+	perf_counter_task_sched_out(prev, smp_processor_id());
+	perf_counter_task_sched_in(next, smp_processor_id());
+
 	/* Here we just switch the register state and the stack. */
 	switch_to(prev, next, prev);
 
@@ -1628,36 +2113,169 @@ void pull_task(runqueue_t *src_rq, prio_array_t *src_array, task_t *p,
 }
 
 /*
- * can_migrate_task - may task p from runqueue rq be migrated to this_cpu?
+ * The highest priority RT task queued on rq that is not running there,
+ * or NULL.
  */
-static inline
-int can_migrate_task(task_t *p, runqueue_t *rq, int this_cpu,
-		     struct sched_domain *sd, enum idle_type idle)
+static task_t *pick_queued_rt_task(runqueue_t *rq)
 {
-	/*
-	 * We do not migrate tasks that are:
-	 * 1) running (obviously), or
-	 * 2) cannot be migrated to this CPU due to cpus_allowed, or
-	 * 3) are cache-hot on their current CPU.
-	 */
-	if (task_running(rq, p))
+	prio_array_t *array = rq->active;
+	struct list_head *head, *curr;
+	task_t *p;
+	int idx;
+
+	idx = sched_find_first_bit(array->bitmap);
+	while (idx < MAX_RT_PRIO) {
+		head = array->queue + idx;
+		list_for_each(curr, head) {
+			p = list_entry(curr, task_t, run_list);
+			if (!task_running(rq, p))
+				return p;
+		}
+		idx = find_next_bit(array->bitmap, MAX_RT_PRIO, idx + 1);
+	}
+	return NULL;
+}
+
+/*
+ * Push one queued RT task of this_rq to a cpu running at lower
+ * priority. this_rq must be locked. Returns 1 if a task was moved.
+ */
+static int push_rt_task(runqueue_t *this_rq, int this_cpu)
+{
+	runqueue_t *lowest_rq;
+	task_t *p;
+	int cpu, ret = 0;
+
+	p = pick_queued_rt_task(this_rq);
+	if (!p)
 		return 0;
-	if (!cpu_isset(this_cpu, p->cpus_allowed))
+	cpu = find_lowest_cpu(p, -1);
+	if (cpu < 0 || cpu == this_cpu)
 		return 0;
 
+	lowest_rq = cpu_rq(cpu);
+	double_lock_balance(this_rq, lowest_rq);
 	/*
-	 * Aggressive migration if:
-	 * 1) the [whole] cpu is idle, or
-	 * 2) too many balance attempts have failed.
+	 * this_rq->lock might have been dropped: only go ahead if p is
+	 * still the task to push, and still preempts the target.
 	 */
+	if (pick_queued_rt_task(this_rq) == p &&
+			cpu_isset(cpu, p->cpus_allowed) &&
+			lowest_rq->curr_prio > p->prio) {
+		pull_task(this_rq, p->array, p, lowest_rq, lowest_rq->active,
+				cpu);
+		ret = 1;
+	}
+	spin_unlock(&lowest_rq->lock);
 
-	if (cpu_and_siblings_are_idle(this_cpu) || \
-			sd->nr_balance_failed > sd->cache_nice_tries)
-		return 1;
+	return ret;
+}
 
-	if (task_hot(p, rq->timestamp_last_tick, sd))
-			return 0;
-	return 1;
+static void push_rt_tasks(runqueue_t *rq)
+{
+	int this_cpu = smp_processor_id();
+
+	spin_lock_irq(&rq->lock);
+	while (rq_rt_nr_running(rq) > 1 && push_rt_task(rq, this_cpu))
+		;
+	spin_unlock_irq(&rq->lock);
+}
+
+/*
+ * this_rq is about to run at a lower priority: pull over the RT tasks
+ * that are waiting on other runqueues and now have the highest priority
+ * here. this_rq must be locked.
+ */
+static void pull_rt_tasks(int this_cpu, runqueue_t *this_rq)
+{
+	runqueue_t *src_rq;
+	task_t *p;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		if (cpu == this_cpu)
+			continue;
+		src_rq = cpu_rq(cpu);
+		if (rq_rt_nr_running(src_rq) <= 1)
+			continue;
+
+		double_lock_balance(this_rq, src_rq);
+		p = pick_queued_rt_task(src_rq);
+		if (p && p->prio < sched_find_first_bit(this_rq->active->bitmap)
+				&& cpu_isset(this_cpu, p->cpus_allowed))
+			pull_task(src_rq, p->array, p, this_rq,
+					this_rq->active, this_cpu);
+		spin_unlock(&src_rq->lock);
+	}
+}
+
+#ifdef CONFIG_NUMA
+/*
+ * The node p's memory has been coming from, or -1 if its recent faults
+ * show no clear winner (see task_numa_fault()).
+ */
+static inline int task_numa_node(task_t *p)
+{
+	if (p->mm && p->numa_faults >= NUMA_FAULTS_MAX / 2)
+		return p->numa_node;
+	return -1;
+}
+#else
+static inline int task_numa_node(task_t *p)
+{
+	return -1;
+}
+#endif
+
+/*
+ * can_migrate_task - may task p from runqueue rq be migrated to this_cpu?
+ */
+static inline
+int can_migrate_task(task_t *p, runqueue_t *rq, int this_cpu,
+		     struct sched_domain *sd, enum idle_type idle)
+{
+	int nid;
+
+	/*
+	 * We do not migrate tasks that are:
+	 * 1) running (obviously), or
+	 * 2) cannot be migrated to this CPU due to cpus_allowed, or
+	 * 3) are cache-hot on their current CPU, or
+	 * 4) would be taken off the node their memory lives on.
+	 */
+	if (task_running(rq, p))
+		return 0;
+	if (!cpu_isset(this_cpu, p->cpus_allowed))
+		return 0;
+
+	/*
+	 * Aggressive migration if:
+	 * 1) the [whole] cpu is idle, or
+	 * 2) too many balance attempts have failed.
+	 */
+
+	if (cpu_and_siblings_are_idle(this_cpu) || \
+			sd->nr_balance_failed > sd->cache_nice_tries)
+		return 1;
+
+	/*
+	 * Across nodes, a task whose pages come mostly from one node
+	 * stays there, and one that would move onto it goes even if
+	 * cache hot:
+	 */
+	nid = task_numa_node(p);
+	if (nid >= 0 && cpu_to_node(task_cpu(p)) != cpu_to_node(this_cpu)) {
+		if (nid == cpu_to_node(this_cpu))
+			return 1;
+		if (nid == cpu_to_node(task_cpu(p))) {
+			schedstat_inc(sd, lb_numa_kept);
+			return 0;
+		}
+	}
+
+	if (task_hot(p, rq->timestamp_last_tick, sd))
+			return 0;
+	return 1;
 }
 
 /*
@@ -1727,6 +2345,10 @@ skip_queue:
 #ifdef CONFIG_SCHEDSTATS
 	if (task_hot(tmp, busiest->timestamp_last_tick, sd))
 		schedstat_inc(sd, lb_hot_gained[idle]);
+	if (task_numa_node(tmp) >= 0 && task_numa_node(tmp) ==
+			cpu_to_node(this_cpu) &&
+			cpu_to_node(task_cpu(tmp)) != cpu_to_node(this_cpu))
+		schedstat_inc(sd, lb_numa_toward);
 #endif
 
 	pull_task(busiest, array, tmp, this_rq, dst_array, this_cpu);
@@ -1760,11 +2382,14 @@ find_busiest_group(struct sched_domain *sd, int this_cpu,
 {
 	struct sched_group *busiest = NULL, *this = NULL, *group = sd->groups;
 	unsigned long max_load, avg_load, total_load, this_load, total_pwr;
+	int power_savings = (sd->flags & SD_POWERSAVINGS_BALANCE) != 0;
+	struct sched_group *group_min = NULL, *group_leader = NULL;
+	unsigned long min_nr_running = ULONG_MAX, leader_nr_running = 0;
 
 	max_load = this_load = total_load = total_pwr = 0;
 
 	do {
-		unsigned long load;
+		unsigned long load, sum_nr_running, group_capacity;
 		int local_group;
 		int i;
 
@@ -1772,6 +2397,7 @@ find_busiest_group(struct sched_domain *sd, int this_cpu,
 
 		/* Tally up the load of all CPUs in the group */
 		avg_load = 0;
+		sum_nr_running = 0;
 
 		for_each_cpu_mask(i, group->cpumask) {
 			/* Bias balancing toward cpus of our domain */
@@ -1781,10 +2407,12 @@ find_busiest_group(struct sched_domain *sd, int this_cpu,
 				load = source_load(i);
 
 			avg_load += load;
+			sum_nr_running += cpu_rq(i)->nr_running;
 		}
 
 		total_load += avg_load;
 		total_pwr += group->cpu_power;
+		group_capacity = group->cpu_power / SCHED_LOAD_SCALE;
 
 		/* Adjust by relative CPU power of the group */
 		avg_load = (avg_load * SCHED_LOAD_SCALE) / group->cpu_power;
@@ -1792,11 +2420,50 @@ find_busiest_group(struct sched_domain *sd, int this_cpu,
 		if (local_group) {
 			this_load = avg_load;
 			this = group;
-			goto nextgroup;
-		} else if (avg_load > max_load) {
+		} else if (avg_load > max_load && (!power_savings ||
+				sum_nr_running > group_capacity)) {
+			/*
+			 * When packing for power savings, a group running
+			 * no more tasks than it has cpus is not overloaded.
+			 */
 			max_load = avg_load;
 			busiest = group;
 		}
+
+		/*
+		 * Power savings: busy cpus don't pack, and there's nothing
+		 * to do if our group is idle or already full.
+		 */
+		if (!power_savings || idle == NOT_IDLE)
+			goto nextgroup;
+		if (local_group && (!sum_nr_running ||
+				sum_nr_running >= group_capacity)) {
+			power_savings = 0;
+			goto nextgroup;
+		}
+		if (!sum_nr_running || sum_nr_running >= group_capacity)
+			goto nextgroup;
+
+		/*
+		 * Of the groups with spare capacity, the least loaded one
+		 * is emptied into the most loaded one, the "leader". Ties
+		 * go to the lower numbered group, to keep the choice stable
+		 * across cpus.
+		 */
+		if (sum_nr_running < min_nr_running ||
+				(sum_nr_running == min_nr_running &&
+				 first_cpu(group->cpumask) >
+				 first_cpu(group_min->cpumask))) {
+			group_min = group;
+			min_nr_running = sum_nr_running;
+		}
+		if (sum_nr_running > leader_nr_running ||
+				(sum_nr_running == leader_nr_running &&
+				 first_cpu(group->cpumask) <
+				 first_cpu(group_leader->cpumask))) {
+			group_leader = group;
+			leader_nr_running = sum_nr_running;
+		}
 nextgroup:
 		group = group->next;
 	} while (group != sd->groups);
@@ -1874,6 +2541,12 @@ nextgroup:
 	return busiest;
 
 out_balanced:
+	if (power_savings && idle != NOT_IDLE && this == group_leader &&
+			group_min && group_min != group_leader) {
+		*imbalance = min_nr_running;
+		return group_min;
+	}
+
 	if (busiest && (idle == NEWLY_IDLE ||
 			(idle == SCHED_IDLE && max_load > SCHED_LOAD_SCALE)) ) {
 		*imbalance = 1;
@@ -2091,6 +2764,28 @@ static void active_load_balance(runqueue_t *busiest_rq, int busiest_cpu)
 	cpumask_t visited_cpus;
 	int cpu;
 
+	/*
+	 * Power savings balancing wants this package emptied into the
+	 * push_cpu's one: don't spread the task onto our own idle cores.
+	 */
+	cpu = busiest_rq->push_cpu;
+	for_each_domain(busiest_cpu, sd) {
+		if (cpu_isset(cpu, sd->span))
+			break;
+	}
+	if (sd && (sd->flags & SD_POWERSAVINGS_BALANCE) &&
+			cpu != busiest_cpu && cpu_online(cpu)) {
+		target_rq = cpu_rq(cpu);
+		schedstat_inc(sd, alb_cnt);
+		double_lock_balance(busiest_rq, target_rq);
+		if (move_tasks(target_rq, cpu, busiest_rq, 1, sd, SCHED_IDLE))
+			schedstat_inc(sd, alb_pushed);
+		else
+			schedstat_inc(sd, alb_failed);
+		spin_unlock(&target_rq->lock);
+		return;
+	}
+
 	/*
 	 * Search for suitable CPUs to push tasks to in successively higher
 	 * domains with SD_LOAD_BALANCE set.
@@ -2150,6 +2845,63 @@ static void active_load_balance(runqueue_t *busiest_rq, int busiest_cpu)
 /* Don't have all balancing operations going off at once */
 #define CPU_OFFSET(cpu) (HZ * cpu / NR_CPUS)
 
+#ifdef CONFIG_NO_IDLE_HZ
+/*
+ * Idle cpus that stopped their tick do not run rebalance_tick(), so
+ * they would never pull work over. The lowest numbered cpu that is
+ * still ticking balances on their behalf: when it finds a runqueue
+ * with more than one task, it wakes up a tickless idle cpu from that
+ * runqueue's widest domain, which then pulls the work over through
+ * idle_balance() in schedule().
+ */
+#define NOHZ_KICK_INTERVAL	(HZ / 50 ? : 1)
+
+static void nohz_balance_kick(int this_cpu)
+{
+	static unsigned long next_kick;
+	struct sched_domain *sd, *top;
+	cpumask_t ticking, targets;
+	runqueue_t *rq;
+	int cpu;
+
+	if (likely(cpus_empty(nohz_cpu_mask)))
+		return;
+	cpus_andnot(ticking, cpu_online_map, nohz_cpu_mask);
+	if (first_cpu(ticking) != this_cpu)
+		return;
+	if (time_before(jiffies, next_kick))
+		return;
+	next_kick = jiffies + NOHZ_KICK_INTERVAL;
+
+	for_each_cpu_mask(cpu, ticking) {
+		if (cpu_rq(cpu)->nr_running <= 1)
+			continue;
+
+		top = NULL;
+		for_each_domain(cpu, sd)
+			if (sd->flags & SD_LOAD_BALANCE)
+				top = sd;
+		if (!top)
+			continue;
+
+		cpus_and(targets, top->span, nohz_cpu_mask);
+		if (cpus_empty(targets))
+			continue;
+
+		rq = cpu_rq(first_cpu(targets));
+		spin_lock(&rq->lock);
+		if (rq->curr == rq->idle)
+			resched_task(rq->idle);
+		spin_unlock(&rq->lock);
+		break;
+	}
+}
+#else
+static inline void nohz_balance_kick(int this_cpu)
+{
+}
+#endif
+
 static void rebalance_tick(int this_cpu, runqueue_t *this_rq,
 			   enum idle_type idle)
 {
@@ -2169,6 +2921,8 @@ static void rebalance_tick(int this_cpu, runqueue_t *this_rq,
 		old_load++;
 	this_rq->cpu_load = (old_load + this_load) / 2;
 
+	nohz_balance_kick(this_cpu);
+
 	for_each_domain(this_cpu, sd) {
 		unsigned long interval;
 
@@ -2227,6 +2981,20 @@ DEFINE_PER_CPU(struct kernel_stat, kstat);
 
 EXPORT_PER_CPU_SYMBOL(kstat);
 
+/*
+ * This CPU's copy of the CPU time totals of p's thread group, or NULL
+ * while it has a single thread, or once p has been released.  Called
+ * with interrupts disabled.
+ */
+static inline struct task_cputime *group_cputime(task_t *p)
+{
+	struct signal_struct *sig = p->signal;
+
+	if (unlikely(!sig) || !sig->cputime_totals)
+		return NULL;
+	return per_cpu_ptr(sig->cputime_totals, smp_processor_id());
+}
+
 /*
  * This is called on clock ticks and on context switches.
  * Bank in p->sched_time the ns elapsed since the last tick or switch.
@@ -2235,7 +3003,11 @@ static inline void update_cpu_clock(task_t *p, runqueue_t *rq,
 				    unsigned long long now)
 {
 	unsigned long long last = max(p->timestamp, rq->timestamp_last_tick);
+	struct task_cputime *totals = group_cputime(p);
+
 	p->sched_time += now - last;
+	if (totals)
+		totals->sched_time += now - last;
 }
 
 /*
@@ -2278,9 +3050,12 @@ unsigned long long current_sched_time(const task_t *tsk)
 void account_user_time(struct task_struct *p, cputime_t cputime)
 {
 	struct cpu_usage_stat *cpustat = &kstat_this_cpu.cpustat;
+	struct task_cputime *totals = group_cputime(p);
 	cputime64_t tmp;
 
 	p->utime = cputime_add(p->utime, cputime);
+	if (totals)
+		totals->utime = cputime_add(totals->utime, cputime);
 
 	/* Add user time to cpustat. */
 	tmp = cputime_to_cputime64(cputime);
@@ -2301,9 +3076,12 @@ void account_system_time(struct task_struct *p, int hardirq_offset,
 {
 	struct cpu_usage_stat *cpustat = &kstat_this_cpu.cpustat;
 	runqueue_t *rq = this_rq();
+	struct task_cputime *totals = group_cputime(p);
 	cputime64_t tmp;
 
 	p->stime = cputime_add(p->stime, cputime);
+	if (totals)
+		totals->stime = cputime_add(totals->stime, cputime);
 
 	/* Add system time to cpustat. */
 	tmp = cputime_to_cputime64(cputime);
@@ -2630,6 +3408,23 @@ asmlinkage void __sched schedule(void)
 	}
 	profile_hit(SCHED_PROFILING, __builtin_return_address(0));
 
+	/*
+	 * If we are going to sleep with io held back on our plug, we may
+	 * well be waiting for that very io: submit it first.
+	 */
+	if (unlikely(current->plug) && current->state != TASK_RUNNING &&
+	    !(preempt_count() & PREEMPT_ACTIVE))
+		blk_flush_plug(current);
+
+	/*
+	 * A workqueue worker blocking in a work may have to hand the
+	 * rest of the queue to another.
+	 */
+	if (unlikely(current->flags & PF_WQ_WORKER) &&
+	    current->state != TASK_RUNNING &&
+	    !(preempt_count() & PREEMPT_ACTIVE))
+		wq_worker_sleeping(current);
+
 need_resched:
 	preempt_disable();
 	prev = current;
@@ -2680,6 +3475,12 @@ need_resched_nonpreemptible:
 	}
 
 	cpu = smp_processor_id();
+#ifdef CONFIG_SMP
+	/* An RT task is leaving the cpu to lower priority work: */
+	if (unlikely(rt_task(prev)) &&
+			sched_find_first_bit(rq->active->bitmap) > prev->prio)
+		pull_rt_tasks(cpu, rq);
+#endif
 	if (unlikely(!rq->nr_running)) {
 go_idle:
 		idle_balance(cpu, rq);
@@ -2755,6 +3556,9 @@ switch_tasks:
 	prev->timestamp = prev->last_ran = now;
 
 	sched_info_switch(prev, next);
+#ifdef CONFIG_SMP
+	rq->curr_prio = next->prio;
+#endif
 	if (likely(prev != next)) {
 		next->timestamp = now;
 		rq->nr_switches++;
@@ -2769,9 +3573,17 @@ switch_tasks:
 	} else
 		spin_unlock_irq(&rq->lock);
 
+#ifdef CONFIG_SMP
+	/* Push RT tasks queued behind the one we run, if any */
+	if (unlikely(rq_rt_nr_running(this_rq()) > 1))
+		push_rt_tasks(this_rq());
+#endif
+
 	prev = current;
 	if (unlikely(reacquire_kernel_lock(prev) < 0))
 		goto need_resched_nonpreemptible;
+	if (unlikely(prev->flags & PF_WQ_WORKER))
+		wq_worker_running(prev);
 	preempt_enable_no_resched();
 	if (unlikely(test_thread_flag(TIF_NEED_RESCHED)))
 		goto need_resched;
@@ -3192,7 +4004,7 @@ void set_user_nice(task_t *p, long nice)
 	 * The RT priorities are set via sched_setscheduler(), but we still
 	 * allow the 'normal' nice value to be set - but as expected
 	 * it wont have any effect on scheduling until the task is
-	 * not SCHED_NORMAL:
+	 * SCHED_NORMAL or SCHED_BATCH:
 	 */
 	if (rt_task(p)) {
 		p->static_prio = NICE_TO_PRIO(nice);
@@ -3327,16 +4139,64 @@ static inline task_t *find_process_by_pid(pid_t pid)
 	return pid ? find_task_by_pid(pid) : current;
 }
 
-/* Actually do priority change: must hold rq lock. */
+/*
+ * Actually do priority change: must hold rq lock.  The boost from
+ * priority inheritance is kept, so rt_mutex_chain_lock is held too,
+ * except while the machine is still single threaded.
+ */
 static void __setscheduler(struct task_struct *p, int policy, int prio)
 {
 	BUG_ON(p->array);
 	p->policy = policy;
 	p->rt_priority = prio;
-	if (policy != SCHED_NORMAL)
-		p->prio = MAX_USER_RT_PRIO-1 - p->rt_priority;
-	else
-		p->prio = p->static_prio;
+	p->prio = rt_mutex_getprio(p);
+}
+
+/*
+ * rt_mutex_getprio - the priority p is to run at: its own, or that of
+ * the top waiter of the rt_mutexes it owns if higher.  Called with
+ * rt_mutex_chain_lock held.
+ */
+int rt_mutex_getprio(task_t *p)
+{
+	struct rt_mutex_waiter *top;
+	int prio = normal_prio(p);
+
+	if (list_empty(&p->pi_waiters))
+		return prio;
+	top = list_entry(p->pi_waiters.next, struct rt_mutex_waiter, pi_list);
+	return min(prio, top->prio);
+}
+
+/*
+ * rt_mutex_setprio - boost p to prio, or lower it back.  Called with
+ * rt_mutex_chain_lock held, see kernel/rtmutex.c.
+ */
+void rt_mutex_setprio(task_t *p, int prio)
+{
+	unsigned long flags;
+	prio_array_t *array;
+	runqueue_t *rq;
+	int oldprio;
+
+	rq = task_rq_lock(p, &flags);
+	oldprio = p->prio;
+	array = p->array;
+	if (array)
+		dequeue_task(p, array);
+	p->prio = prio;
+	if (array) {
+		/* A task boosted into the RT range must not sit expired */
+		if (rt_task(p))
+			array = rq->active;
+		enqueue_task(p, array);
+		if (task_running(rq, p)) {
+			if (p->prio > oldprio)
+				resched_task(rq->curr);
+		} else if (TASK_PREEMPTS_CURR(p, rq))
+			resched_task(rq->curr);
+	}
+	task_rq_unlock(rq, &flags);
 }
 
 /**
@@ -3351,7 +4211,7 @@ int sched_setscheduler(struct task_struct *p, int policy, struct sched_param *pa
 	int retval;
 	int oldprio, oldpolicy = -1;
 	prio_array_t *array;
-	unsigned long flags;
+	unsigned long flags, pi_flags;
 	runqueue_t *rq;
 
 recheck:
@@ -3359,16 +4219,18 @@ recheck:
 	if (policy < 0)
 		policy = oldpolicy = p->policy;
 	else if (policy != SCHED_FIFO && policy != SCHED_RR &&
-				policy != SCHED_NORMAL)
+			policy != SCHED_NORMAL && policy != SCHED_BATCH)
 			return -EINVAL;
 	/*
 	 * Valid priorities for SCHED_FIFO and SCHED_RR are
-	 * 1..MAX_USER_RT_PRIO-1, valid priority for SCHED_NORMAL is 0.
+	 * 1..MAX_USER_RT_PRIO-1, valid priority for SCHED_NORMAL and
+	 * SCHED_BATCH is 0.
 	 */
 	if (param->sched_priority < 0 ||
 	    param->sched_priority > MAX_USER_RT_PRIO-1)
 		return -EINVAL;
-	if ((policy == SCHED_NORMAL) != (param->sched_priority == 0))
+	if ((policy == SCHED_NORMAL || policy == SCHED_BATCH) !=
+					(param->sched_priority == 0))
 		return -EINVAL;
 
 	if ((policy == SCHED_FIFO || policy == SCHED_RR) &&
@@ -3383,13 +4245,16 @@ recheck:
 		return retval;
 	/*
 	 * To be able to change p->policy safely, the apropriate
-	 * runqueue lock must be held.
+	 * runqueue lock must be held, and rt_mutex_chain_lock to keep
+	 * the priority p inherits.
 	 */
+	spin_lock_irqsave(&rt_mutex_chain_lock, pi_flags);
 	rq = task_rq_lock(p, &flags);
 	/* recheck policy now with rq lock held */
 	if (unlikely(oldpolicy != -1 && oldpolicy != p->policy)) {
 		policy = oldpolicy = -1;
 		task_rq_unlock(rq, &flags);
+		spin_unlock_irqrestore(&rt_mutex_chain_lock, pi_flags);
 		goto recheck;
 	}
 	array = p->array;
@@ -3411,6 +4276,10 @@ recheck:
 			resched_task(rq->curr);
 	}
 	task_rq_unlock(rq, &flags);
+	spin_unlock_irqrestore(&rt_mutex_chain_lock, pi_flags);
+
+	/* Where p waits, its new priority may change the boost it passes on */
+	rt_mutex_adjust_pi(p);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(sched_setscheduler);
@@ -3711,6 +4580,78 @@ asmlinkage long sys_sched_yield(void)
 	return 0;
 }
 
+/**
+ * yield_to - yield the current processor to a given task
+ * @p: the task current is waiting on, e.g. a lock holder
+ *
+ * sched_yield() only requeues current, which does nothing for the task
+ * it waits on if that one is queued behind others. yield_to() hands
+ * the rest of current's timeslice to @p, queues @p first among its
+ * runqueue's tasks of its priority (and at current's priority, if
+ * that is higher), preempts the task running there if it can, and
+ * reschedules. RT tasks are only requeued, their priorities and slices
+ * left alone.
+ *
+ * Returns 1 if it yielded, 0 if @p is current, is not runnable or is
+ * already running.
+ */
+int __sched yield_to(task_t *p)
+{
+	runqueue_t *rq, *p_rq;
+	prio_array_t *array;
+	unsigned long flags;
+	unsigned int slice;
+	int yielded = 0;
+
+	local_irq_save(flags);
+	rq = this_rq();
+again:
+	p_rq = task_rq(p);
+#ifdef CONFIG_SMP
+	double_rq_lock(rq, p_rq);
+	if (unlikely(task_rq(p) != p_rq)) {
+		double_rq_unlock(rq, p_rq);
+		goto again;
+	}
+#else
+	spin_lock(&rq->lock);
+#endif
+
+	array = p->array;
+	if (p == current || !array || task_running(p_rq, p))
+		goto out;
+
+	dequeue_task(p, array);
+	if (!rt_task(p) && !rt_task(current)) {
+		slice = max(task_timeslice(p), task_timeslice(current));
+		p->time_slice = min(p->time_slice + current->time_slice - 1,
+					slice);
+		current->time_slice = 1;
+		if (current->prio < p->prio)
+			p->prio = current->prio;
+		array = p_rq->active;
+	}
+	enqueue_task_head(p, array);
+	if (TASK_PREEMPTS_CURR(p, p_rq))
+		resched_task(p_rq->curr);
+	set_tsk_need_resched(current);
+	yielded = 1;
+out:
+#ifdef CONFIG_SMP
+	double_rq_unlock(rq, p_rq);
+#else
+	spin_unlock(&rq->lock);
+#endif
+	local_irq_restore(flags);
+
+	if (yielded)
+		schedule();
+
+	return yielded;
+}
+
+EXPORT_SYMBOL(yield_to);
+
 static inline void __cond_resched(void)
 {
 	do {
@@ -3802,9 +4743,11 @@ void __sched io_schedule(void)
 {
 	struct runqueue *rq = &per_cpu(runqueues, _smp_processor_id());
 
+	delayacct_blkio_start();
 	atomic_inc(&rq->nr_iowait);
 	schedule();
 	atomic_dec(&rq->nr_iowait);
+	delayacct_blkio_end();
 }
 
 EXPORT_SYMBOL(io_schedule);
@@ -3814,9 +4757,11 @@ long __sched io_schedule_timeout(long timeout)
 	struct runqueue *rq = &per_cpu(runqueues, _smp_processor_id());
 	long ret;
 
+	delayacct_blkio_start();
 	atomic_inc(&rq->nr_iowait);
 	ret = schedule_timeout(timeout);
 	atomic_dec(&rq->nr_iowait);
+	delayacct_blkio_end();
 	return ret;
 }
 
@@ -3837,6 +4782,7 @@ asmlinkage long sys_sched_get_priority_max(int policy)
 		ret = MAX_USER_RT_PRIO-1;
 		break;
 	case SCHED_NORMAL:
+	case SCHED_BATCH:
 		ret = 0;
 		break;
 	}
@@ -3860,6 +4806,7 @@ asmlinkage long sys_sched_get_priority_min(int policy)
 		ret = 1;
 		break;
 	case SCHED_NORMAL:
+	case SCHED_BATCH:
 		ret = 0;
 	}
 	return ret;
@@ -3893,7 +4840,7 @@ long sys_sched_rr_get_interval(pid_t pid, struct timespec __user *interval)
 	if (retval)
 		goto out_unlock;
 
-	jiffies_to_timespec(p->policy & SCHED_FIFO ?
+	jiffies_to_timespec(p->policy == SCHED_FIFO ?
 				0 : task_timeslice(p), &t);
 	read_unlock(&tasklist_lock);
 	retval = copy_to_user(interval, &t, sizeof(t)) ? -EFAULT : 0;
@@ -4016,6 +4963,9 @@ void __devinit init_idle(task_t *idle, int cpu)
 
 	spin_lock_irqsave(&rq->lock, flags);
 	rq->curr = rq->idle = idle;
+#ifdef CONFIG_SMP
+	rq->curr_prio = idle->prio;
+#endif
 	set_tsk_need_resched(idle);
 	spin_unlock_irqrestore(&rq->lock, flags);
 
@@ -4406,6 +5356,7 @@ static int migration_call(struct notifier_block *nfb, unsigned long action,
 		break;
 	case CPU_DEAD:
 		migrate_live_tasks(cpu);
+		drain_wake_list(cpu);
 		rq = cpu_rq(cpu);
 		kthread_stop(rq->migration_thread);
 		rq->migration_thread = NULL;
@@ -4643,6 +5594,465 @@ void __devinit init_sched_build_groups(struct sched_group groups[],
 }
 
 
+
+/*
+ * Self-tuning task migration cost measurement between source and target CPUs.
+ *
+ * This is done by measuring the cost of manipulating buffers of varying
+ * sizes. For a given buffer-size here are the steps that are taken:
+ *
+ * 1) the source CPU reads+dirties a shared buffer
+ * 2) the target CPU reads+dirties the same shared buffer
+ *
+ * We measure how long they take, in the following 4 scenarios:
+ *
+ *  - source: CPU1, target: CPU2 | cost1
+ *  - source: CPU2, target: CPU1 | cost2
+ *  - source: CPU1, target: CPU1 | cost3
+ *  - source: CPU2, target: CPU2 | cost4
+ *
+ * We then calculate the cost3+cost4-cost1-cost2 difference - this is
+ * the cost of migration.
+ *
+ * We then start off from a small buffer-size and iterate up to larger
+ * buffer sizes, in ~10% steps - measuring each buffer-size separately, and
+ * doing a maximum search for the cost. (The maximum cost for a migration
+ * normally occurs when the working set size is around the effective cache
+ * size.)
+ */
+#define SEARCH_SCOPE		2
+#define MIN_CACHE_SIZE		(64*1024U)
+#define DEFAULT_CACHE_SIZE	(5*1024*1024U)
+#define ITERATIONS		2
+#define SIZE_THRESH		130
+#define COST_THRESH		130
+
+/*
+ * The migration cost is a function of 'domain distance'. Domain
+ * distance is the number of steps a CPU has to iterate down its
+ * domain tree to share a domain with the other CPU. The farther
+ * two CPUs are from each other, the larger the distance gets.
+ *
+ * Note that we use the distance only to cache measurement results,
+ * the distance value is not used numerically otherwise. When two
+ * CPUs have the same distance it is assumed that the migration
+ * cost is the same. (this is a simplification but quite practical)
+ */
+#define MAX_DOMAIN_DISTANCE 32
+
+static unsigned long long migration_cost[MAX_DOMAIN_DISTANCE] =
+		{ [ 0 ... MAX_DOMAIN_DISTANCE-1 ] = -1LL };
+
+/*
+ * Allow override of migration cost - in units of microseconds.
+ * E.g. migration_cost=1000,2000,3000 will set up a level-1 cost
+ * of 1 msec, level-2 cost of 2 msecs and level3 cost of 3 msecs:
+ */
+static int __init migration_cost_setup(char *str)
+{
+	int ints[MAX_DOMAIN_DISTANCE+1], i;
+
+	str = get_options(str, ARRAY_SIZE(ints), ints);
+
+	for (i = 1; i <= ints[0]; i++)
+		migration_cost[i-1] = (unsigned long long)ints[i]*1000;
+	return 1;
+}
+
+__setup ("migration_cost=", migration_cost_setup);
+
+/*
+ * Global multiplier (divisor) for migration-cutoff values,
+ * in percentiles. E.g. use a value of 150 to get 1.5 times
+ * longer cache-hot cutoff times.
+ *
+ * (We scale it from 100 to 128 to long long handling easier.)
+ */
+
+#define MIGRATION_FACTOR_SCALE 128
+
+static unsigned int migration_factor = MIGRATION_FACTOR_SCALE;
+
+static int __init setup_migration_factor(char *str)
+{
+	get_option(&str, &migration_factor);
+	migration_factor = migration_factor * MIGRATION_FACTOR_SCALE / 100;
+	return 1;
+}
+
+__setup("migration_factor=", setup_migration_factor);
+
+/*
+ * Estimated distance of two CPUs, measured via the number of domains
+ * we have to pass for the two CPUs to be in the same span:
+ */
+static unsigned long domain_distance(int cpu1, int cpu2)
+{
+	unsigned long distance = 0;
+	struct sched_domain *sd;
+
+	for_each_domain(cpu1, sd) {
+		WARN_ON(!cpu_isset(cpu1, sd->span));
+		if (cpu_isset(cpu2, sd->span))
+			return distance;
+		distance++;
+	}
+	if (distance >= MAX_DOMAIN_DISTANCE) {
+		WARN_ON(1);
+		distance = MAX_DOMAIN_DISTANCE-1;
+	}
+
+	return distance;
+}
+
+static unsigned int migration_debug;
+
+static int __init setup_migration_debug(char *str)
+{
+	get_option(&str, &migration_debug);
+	return 1;
+}
+
+__setup("migration_debug=", setup_migration_debug);
+
+/*
+ * Maximum cache-size that the scheduler should try to measure.
+ * Architectures with larger caches should tune this up during
+ * bootup. Gets used in the domain-setup code (i.e. during SMP
+ * bootup).
+ */
+unsigned int max_cache_size;
+
+static int __init setup_max_cache_size(char *str)
+{
+	get_option(&str, &max_cache_size);
+	return 1;
+}
+
+__setup("max_cache_size=", setup_max_cache_size);
+
+/*
+ * Dirty a big buffer in a hard-to-predict (for the L2 cache) way. This
+ * is the operation that is timed, so we try to generate unpredictable
+ * cachemisses that still end up filling the L2 cache:
+ */
+static void touch_cache(void *__cache, unsigned long __size)
+{
+	unsigned long size = __size/sizeof(long), chunk1 = size/3,
+			chunk2 = 2*size/3;
+	unsigned long *cache = __cache;
+	int i;
+
+	for (i = 0; i < size/6; i += 8) {
+		switch (i % 6) {
+			case 0: cache[i]++;
+			case 1: cache[size-1-i]++;
+			case 2: cache[chunk1-i]++;
+			case 3: cache[chunk1+i]++;
+			case 4: cache[chunk2-i]++;
+			case 5: cache[chunk2+i]++;
+		}
+	}
+}
+
+/*
+ * Measure the cache-cost of one task migration. Returns in units of nsec.
+ */
+static unsigned long long measure_one(void *cache, unsigned long size,
+				      int source, int target)
+{
+	cpumask_t mask, saved_mask;
+	unsigned long long t0, t1, t2, t3, cost;
+
+	saved_mask = current->cpus_allowed;
+
+	/*
+	 * Flush source caches to RAM and invalidate them:
+	 */
+	sched_cacheflush();
+
+	/*
+	 * Migrate to the source CPU:
+	 */
+	mask = cpumask_of_cpu(source);
+	set_cpus_allowed(current, mask);
+	WARN_ON(_smp_processor_id() != source);
+
+	/*
+	 * Dirty the working set:
+	 */
+	t0 = sched_clock();
+	touch_cache(cache, size);
+	t1 = sched_clock();
+
+	/*
+	 * Migrate to the target CPU, dirty the L2 cache and access
+	 * the shared buffer. (which represents the working set
+	 * of a migrated task.)
+	 */
+	mask = cpumask_of_cpu(target);
+	set_cpus_allowed(current, mask);
+	WARN_ON(_smp_processor_id() != target);
+
+	t2 = sched_clock();
+	touch_cache(cache, size);
+	t3 = sched_clock();
+
+	cost = t1-t0 + t3-t2;
+
+	if (migration_debug >= 2)
+		printk(KERN_DEBUG "[%d->%d]: %8Ld %8Ld %8Ld => %10Ld.\n",
+			source, target, t1-t0, t1-t0, t3-t2, cost);
+	/*
+	 * Flush target caches to RAM and invalidate them:
+	 */
+	sched_cacheflush();
+
+	set_cpus_allowed(current, saved_mask);
+
+	return cost;
+}
+
+/*
+ * Measure a series of task migrations and return the average
+ * result. Since this code runs early during bootup the system
+ * is 'undisturbed' and the average latency makes sense.
+ *
+ * The algorithm in essence auto-detects the relevant cache-size,
+ * so it will properly detect different cachesizes for different
+ * cache-hierarchies, depending on how the CPUs are connected.
+ *
+ * Architectures can prime the upper limit of the search range via
+ * max_cache_size, (in bytes), if the cache-size is known at init time.
+ */
+static unsigned long long measure_cost(int cpu1, int cpu2, void *cache,
+				       unsigned int size)
+{
+	unsigned long long cost1, cost2;
+	int i;
+
+	/*
+	 * Measure the migration cost of 'size' bytes, over an
+	 * average of 10 runs:
+	 *
+	 * (We perturb the cache size by a small (0..4k)
+	 *  value to compensate size/alignment related artifacts.
+	 *  We also subtract the cost of the operation done on
+	 *  the same CPU.)
+	 */
+	cost1 = 0;
+
+	/*
+	 * dry run, to make sure we start off cache-cold on cpu1,
+	 * and to get any vmalloc pagefaults in advance:
+	 */
+	measure_one(cache, size, cpu1, cpu2);
+	for (i = 0; i < ITERATIONS; i++)
+		cost1 += measure_one(cache, size - i*1024, cpu1, cpu2);
+
+	measure_one(cache, size, cpu2, cpu1);
+	for (i = 0; i < ITERATIONS; i++)
+		cost1 += measure_one(cache, size - i*1024, cpu2, cpu1);
+
+	/*
+	 * (We measure the non-migrating [cached] cost on both
+	 *  cpu1 and cpu2, to handle CPUs with different speeds)
+	 */
+	cost2 = 0;
+
+	measure_one(cache, size, cpu1, cpu1);
+	for (i = 0; i < ITERATIONS; i++)
+		cost2 += measure_one(cache, size - i*1024, cpu1, cpu1);
+
+	measure_one(cache, size, cpu2, cpu2);
+	for (i = 0; i < ITERATIONS; i++)
+		cost2 += measure_one(cache, size - i*1024, cpu2, cpu2);
+
+	/*
+	 * Get the per-iteration migration cost:
+	 */
+	do_div(cost1, 2*ITERATIONS);
+	do_div(cost2, 2*ITERATIONS);
+
+	return cost1 - cost2;
+}
+
+static unsigned long long measure_migration_cost(int cpu1, int cpu2)
+{
+	unsigned long long max_cost = 0, fluct = 0, avg_fluct = 0;
+	unsigned int max_size, size, size_found = 0;
+	long long cost = 0, prev_cost;
+	void *cache;
+
+	/*
+	 * Search from max_cache_size*5 down to 64K - the real relevant
+	 * cachesize has to lie somewhere inbetween.
+	 */
+	if (max_cache_size) {
+		max_size = max(max_cache_size * SEARCH_SCOPE, MIN_CACHE_SIZE);
+		size = max(max_cache_size / SEARCH_SCOPE, MIN_CACHE_SIZE);
+	} else {
+		/*
+		 * Since we have no estimation about the relevant
+		 * search range
+		 */
+		max_size = DEFAULT_CACHE_SIZE * SEARCH_SCOPE;
+		size = MIN_CACHE_SIZE;
+	}
+
+	if (!cpu_online(cpu1) || !cpu_online(cpu2)) {
+		printk(KERN_ERR "migration: cpu %d and %d not both online!\n",
+		       cpu1, cpu2);
+		return 0;
+	}
+
+	/*
+	 * Allocate the working set:
+	 */
+	cache = vmalloc(max_size);
+	if (!cache) {
+		printk(KERN_WARNING "migration: could not vmalloc %d bytes "
+		       "for cache!\n", max_size);
+		return 1000000; /* return 1 msec on very small boxen */
+	}
+
+	while (size <= max_size) {
+		prev_cost = cost;
+		cost = measure_cost(cpu1, cpu2, cache, size);
+
+		/*
+		 * Update the max:
+		 */
+		if (cost > 0) {
+			if (max_cost < cost) {
+				max_cost = cost;
+				size_found = size;
+			}
+		}
+		/*
+		 * Calculate average fluctuation, we use this to prevent
+		 * noise from triggering an early break out of the loop:
+		 */
+		fluct = cost > prev_cost ? cost - prev_cost : prev_cost - cost;
+		avg_fluct = (avg_fluct + fluct)/2;
+
+		if (migration_debug)
+			printk(KERN_DEBUG "-> [%d][%d][%7d] %3ld.%ld [%3ld.%ld] (%ld): "
+				"(%8Ld %8Ld)\n",
+				cpu1, cpu2, size,
+				(long)cost / 1000000,
+				((long)cost / 100000) % 10,
+				(long)max_cost / 1000000,
+				((long)max_cost / 100000) % 10,
+				domain_distance(cpu1, cpu2),
+				cost, avg_fluct);
+
+		/*
+		 * If we iterated at least 20% past the previous maximum,
+		 * and the cost has dropped by more than 20% already,
+		 * (taking fluctuations into account) then we assume to
+		 * have found the maximum and break out of the loop early:
+		 */
+		if (size_found && (size*100 > size_found*SIZE_THRESH))
+			if (cost+avg_fluct <= 0 ||
+				max_cost*100 > (cost+avg_fluct)*COST_THRESH) {
+
+				if (migration_debug)
+					printk(KERN_DEBUG "-> found max.\n");
+				break;
+			}
+		/*
+		 * Increase the cache size in ~10% steps (by 10/9):
+		 */
+		size = size * 10 / 9;
+	}
+
+	if (migration_debug)
+		printk(KERN_DEBUG "[%d][%d] working set size found: %d, cost: %Ld\n",
+			cpu1, cpu2, size_found, max_cost);
+
+	vfree(cache);
+
+	/*
+	 * A task is considered 'cache cold' if at least 2 times
+	 * the worst-case cost of migration has passed.
+	 *
+	 * (this limit is only listened to if the load-balancing
+	 * situation is 'nice' - if there is a large imbalance we
+	 * ignore it for the sake of CPU utilization and
+	 * processing fairness.)
+	 */
+	return 2 * max_cost * migration_factor / MIGRATION_FACTOR_SCALE;
+}
+
+/*
+ * Measure the migration cost between every pair of CPUs in cpu_map
+ * that are a new domain distance apart, and update the cache_hot_time
+ * of each domain level with the result. Measurements are cached per
+ * distance, so rebuilding the domains (e.g. on CPU hotplug) does not
+ * redo the calibration.
+ */
+void __devinit calibrate_migration_costs(const cpumask_t *cpu_map)
+{
+	cpumask_t saved_mask = current->cpus_allowed;
+	int cpu1 = -1, cpu2 = -1, cpu;
+	unsigned long j0, j1, distance, max_distance = 0;
+	struct sched_domain *sd;
+
+	j0 = jiffies;
+
+	/*
+	 * First pass - calculate the cacheflush times:
+	 */
+	for_each_cpu_mask(cpu1, *cpu_map) {
+		for_each_cpu_mask(cpu2, *cpu_map) {
+			if (cpu1 == cpu2)
+				continue;
+			distance = domain_distance(cpu1, cpu2);
+			max_distance = max(max_distance, distance);
+			/*
+			 * No result cached yet?
+			 */
+			if (migration_cost[distance] == -1LL)
+				migration_cost[distance] =
+					measure_migration_cost(cpu1, cpu2);
+		}
+	}
+	/*
+	 * Second pass - update the sched domain hierarchy with
+	 * the new cache-hot-time estimations:
+	 */
+	for_each_cpu_mask(cpu, *cpu_map) {
+		distance = 0;
+		for_each_domain(cpu, sd) {
+			if (migration_cost[distance] != -1LL)
+				sd->cache_hot_time = migration_cost[distance];
+			distance++;
+		}
+	}
+	/*
+	 * Print the matrix, in the format migration_cost= takes:
+	 */
+	if (migration_debug) {
+		printk(KERN_DEBUG "migration: max_cache_size: %d\n",
+		       max_cache_size);
+		printk(KERN_INFO "migration_cost=");
+		for (distance = 0; distance <= max_distance; distance++) {
+			if (distance)
+				printk(",");
+			printk("%ld", (long)migration_cost[distance] / 1000);
+		}
+		printk("\n");
+		j1 = jiffies;
+		printk(KERN_DEBUG "migration: %ld seconds\n", (j1-j0)/HZ);
+	}
+
+	/*
+	 * Move back to the affinity we were called with:
+	 */
+	set_cpus_allowed(current, saved_mask);
+}
+
 #ifdef ARCH_HAS_SCHED_DOMAIN
 extern void __devinit arch_init_sched_domains(void);
 extern void __devinit arch_destroy_sched_domains(void);
@@ -4656,11 +6066,41 @@ static int __devinit cpu_to_cpu_group(int cpu)
 }
 #endif
 
+#ifdef CONFIG_SCHED_MC
+static DEFINE_PER_CPU(struct sched_domain, core_domains);
+static struct sched_group sched_group_core[NR_CPUS];
+static int __devinit cpu_to_core_group(int cpu)
+{
+#ifdef CONFIG_SCHED_SMT
+	return first_cpu(cpu_sibling_map[cpu]);
+#else
+	return cpu;
+#endif
+}
+
+/*
+ * With sched_mc_power_savings, balancing between packages packs light
+ * load onto as few packages as possible instead of spreading it, so
+ * the other packages can stay in deep idle states.
+ */
+static int sched_mc_power_savings;
+
+static int __init sched_mc_power_savings_setup(char *str)
+{
+	sched_mc_power_savings = simple_strtoul(str, NULL, 0) != 0;
+	return 1;
+}
+
+__setup("sched_mc_power_savings=", sched_mc_power_savings_setup);
+#endif
+
 static DEFINE_PER_CPU(struct sched_domain, phys_domains);
 static struct sched_group sched_group_phys[NR_CPUS];
 static int __devinit cpu_to_phys_group(int cpu)
 {
-#ifdef CONFIG_SCHED_SMT
+#if defined(CONFIG_SCHED_MC)
+	return first_cpu(cpu_coregroup_map(cpu));
+#elif defined(CONFIG_SCHED_SMT)
 	return first_cpu(cpu_sibling_map[cpu]);
 #else
 	return cpu;
@@ -4701,6 +6141,23 @@ static void check_sibling_maps(void)
 }
 #endif
 
+/*
+ * Returns the span of the core (multi-core) domain of cpu; it must
+ * contain the cpu's siblings and stay within its node.
+ */
+#ifdef CONFIG_SCHED_MC
+static cpumask_t __devinit core_domain_span(int cpu, cpumask_t nodemask)
+{
+	cpumask_t span = cpu_coregroup_map(cpu);
+
+#ifdef CONFIG_SCHED_SMT
+	cpus_or(span, span, cpu_sibling_map[cpu]);
+#endif
+	cpus_and(span, span, nodemask);
+	return span;
+}
+#endif
+
 /*
  * Set up scheduler domains and groups.  Callers must hold the hotplug lock.
  */
@@ -4746,6 +6203,22 @@ static void __devinit arch_init_sched_domains(void)
 		sd->parent = p;
 		sd->groups = &sched_group_phys[group];
 
+#ifdef CONFIG_SCHED_MC
+		if (sched_mc_power_savings) {
+			/* Don't spread wakeups over idle packages */
+			sd->flags &= ~SD_WAKE_IDLE;
+			sd->flags |= SD_POWERSAVINGS_BALANCE;
+		}
+
+		p = sd;
+		sd = &per_cpu(core_domains, i);
+		group = cpu_to_core_group(i);
+		*sd = SD_MC_INIT;
+		sd->span = core_domain_span(i, nodemask);
+		sd->parent = p;
+		sd->groups = &sched_group_core[group];
+#endif
+
 #ifdef CONFIG_SCHED_SMT
 		p = sd;
 		sd = &per_cpu(cpu_domains, i);
@@ -4771,6 +6244,22 @@ static void __devinit arch_init_sched_domains(void)
 	}
 #endif
 
+#ifdef CONFIG_SCHED_MC
+	/* Set up multi-core groups */
+	for_each_cpu_mask(i, cpu_default_map) {
+		cpumask_t nodemask = node_to_cpumask(cpu_to_node(i));
+		cpumask_t this_core_map;
+
+		cpus_and(nodemask, nodemask, cpu_default_map);
+		this_core_map = core_domain_span(i, nodemask);
+		if (i != first_cpu(this_core_map))
+			continue;
+
+		init_sched_build_groups(sched_group_core, this_core_map,
+						&cpu_to_core_group);
+	}
+#endif
+
 	/* Set up physical groups */
 	for (i = 0; i < MAX_NUMNODES; i++) {
 		cpumask_t nodemask = node_to_cpumask(i);
@@ -4799,10 +6288,38 @@ static void __devinit arch_init_sched_domains(void)
 		sd->groups->cpu_power = power;
 #endif
 
+#ifdef CONFIG_SCHED_MC
+		sd = &per_cpu(core_domains, i);
+		power = SCHED_LOAD_SCALE + SCHED_LOAD_SCALE *
+				(cpus_weight(sd->groups->cpumask)-1) / 10;
+		sd->groups->cpu_power = power;
+
+		/*
+		 * A package counts as one cpu, so that load is spread over
+		 * packages before a second core is used, unless we pack
+		 * for power savings: then it counts as one cpu per core, and
+		 * a package is only considered overloaded with more tasks
+		 * than cores.
+		 */
+		sd = &per_cpu(phys_domains, i);
+		power = SCHED_LOAD_SCALE;
+		if (sched_mc_power_savings) {
+			int j;
+
+			power = 0;
+			for_each_cpu_mask(j, sd->groups->cpumask) {
+				/* Count each core once */
+				if (j == cpu_to_core_group(j))
+					power += SCHED_LOAD_SCALE;
+			}
+		}
+		sd->groups->cpu_power = power;
+#else
 		sd = &per_cpu(phys_domains, i);
 		power = SCHED_LOAD_SCALE + SCHED_LOAD_SCALE *
 				(cpus_weight(sd->groups->cpumask)-1) / 10;
 		sd->groups->cpu_power = power;
+#endif
 
 #ifdef CONFIG_NUMA
 		if (i == first_cpu(sd->groups->cpumask)) {
@@ -4816,13 +6333,20 @@ static void __devinit arch_init_sched_domains(void)
 	/* Attach the domains */
 	for_each_online_cpu(i) {
 		struct sched_domain *sd;
-#ifdef CONFIG_SCHED_SMT
+#if defined(CONFIG_SCHED_SMT)
 		sd = &per_cpu(cpu_domains, i);
+#elif defined(CONFIG_SCHED_MC)
+		sd = &per_cpu(core_domains, i);
 #else
 		sd = &per_cpu(phys_domains, i);
 #endif
 		cpu_attach_domain(sd, i);
 	}
+
+	/*
+	 * Tune cache-hot values:
+	 */
+	calibrate_migration_costs(&cpu_default_map);
 }
 
 #ifdef CONFIG_HOTPLUG_CPU
@@ -4922,6 +6446,7 @@ void __init sched_init(void)
 		rq->cpu_load = 0;
 		rq->active_balance = 0;
 		rq->push_cpu = 0;
+		rq->curr_prio = MAX_PRIO;
 		rq->migration_thread = NULL;
 		INIT_LIST_HEAD(&rq->migration_queue);
 #endif
@@ -4988,6 +6513,7 @@ void normalize_rt_tasks(void)
 		if (!rt_task(p))
 			continue;
 
+		spin_lock(&rt_mutex_chain_lock);
 		rq = task_rq_lock(p, &flags);
 
 		array = p->array;
@@ -5000,6 +6526,7 @@ void normalize_rt_tasks(void)
 		}
 
 		task_rq_unlock(rq, &flags);
+		spin_unlock(&rt_mutex_chain_lock);
 	}
 	read_unlock_irq(&tasklist_lock);
 }
@@ -387,6 +387,7 @@ void __exit_signal(struct task_struct *tsk)
 		sig->nvcsw += tsk->nvcsw;
 		sig->nivcsw += tsk->nivcsw;
 		sig->sched_time += tsk->sched_time;
+		taskstats_tgid_add(sig, tsk);
 		spin_unlock(&sighand->siglock);
 		sig = NULL;	/* Marker for below.  */
 	}
@@ -409,6 +410,8 @@ void __exit_signal(struct task_struct *tsk)
 		 */
 		exit_itimers(sig);
 		exit_thread_group_keys(sig);
+		if (sig->cputime_totals)
+			free_percpu(sig->cputime_totals);
 		kmem_cache_free(signal_cachep, sig);
 	}
 }
@@ -60,6 +60,51 @@ static inline void wakeup_softirqd(void)
 		wake_up_process(tsk);
 }
 
+#ifdef CONFIG_SMP
+/* Softirqs raised for this cpu by other cpus, see raise_softirq_on_cpu() */
+static DEFINE_PER_CPU(unsigned long, remote_softirq_pending);
+
+/* This function must run with irqs disabled */
+static inline void fold_remote_softirqs(void)
+{
+	unsigned long *remote = &__get_cpu_var(remote_softirq_pending);
+
+	if (unlikely(*remote))
+		local_softirq_pending() |= xchg(remote, 0);
+}
+
+static inline int remote_softirqs_pending(void)
+{
+	return __get_cpu_var(remote_softirq_pending) != 0;
+}
+
+/**
+ * raise_softirq_on_cpu - raise a softirq on another cpu
+ * @cpu: the cpu that should run the softirq
+ * @nr: the softirq
+ *
+ * The softirq runs on @cpu the next time it leaves an interrupt, or
+ * as soon as its ksoftirqd gets the cpu, which is right away if it was
+ * idle.  Usable from any context.
+ */
+void raise_softirq_on_cpu(int cpu, unsigned int nr)
+{
+	struct task_struct *tsk;
+
+	set_bit(nr, &per_cpu(remote_softirq_pending, cpu));
+	smp_mb__after_clear_bit();
+
+	tsk = per_cpu(ksoftirqd, cpu);
+	if (tsk && tsk->state != TASK_RUNNING)
+		wake_up_process(tsk);
+}
+
+EXPORT_SYMBOL(raise_softirq_on_cpu);
+#else
+static inline void fold_remote_softirqs(void) { }
+static inline int remote_softirqs_pending(void) { return 0; }
+#endif
+
 /*
  * We restart softirq processing MAX_SOFTIRQ_RESTART times,
  * and we fall back to softirqd after that.
@@ -101,6 +146,7 @@ restart:
 
 	local_irq_disable();
 
+	fold_remote_softirqs();
 	pending = local_softirq_pending();
 	if (pending && --max_restart)
 		goto restart;
@@ -165,8 +211,17 @@ void irq_exit(void)
 {
 	account_system_vtime(current);
 	sub_preempt_count(IRQ_EXIT_OFFSET);
-	if (!in_interrupt() && local_softirq_pending())
-		invoke_softirq();
+	if (!in_interrupt()) {
+		if (unlikely(remote_softirqs_pending())) {
+			unsigned long flags;
+
+			local_irq_save(flags);
+			fold_remote_softirqs();
+			local_irq_restore(flags);
+		}
+		if (local_softirq_pending())
+			invoke_softirq();
+	}
 	preempt_enable_no_resched();
 }
 
@@ -356,6 +411,11 @@ static int ksoftirqd(void * __bind_cpu)
 
 	while (!kthread_should_stop()) {
 		preempt_disable();
+		if (remote_softirqs_pending()) {
+			local_irq_disable();
+			fold_remote_softirqs();
+			local_irq_enable();
+		}
 		if (!local_softirq_pending()) {
 			preempt_enable_no_resched();
 			schedule();
@@ -165,6 +165,24 @@ EXPORT_SYMBOL(_write_lock);
 
 #else /* CONFIG_PREEMPT: */
 
+/*
+ * After SPIN_RELAX_LOOPS spins on a contended lock the slow paths below
+ * call _raw_[spin|read|write]_relax(). An architecture running under a
+ * hypervisor can override these to yield its virtual cpu to the lock
+ * holder's, which might not be running at all.
+ */
+#define SPIN_RELAX_LOOPS	1024
+
+#ifndef _raw_spin_relax
+# define _raw_spin_relax(lock)	cpu_relax()
+#endif
+#ifndef _raw_read_relax
+# define _raw_read_relax(lock)	cpu_relax()
+#endif
+#ifndef _raw_write_relax
+# define _raw_write_relax(lock)	cpu_relax()
+#endif
+
 /*
  * This could be a long-held lock. We both prepare to spin for a long
  * time (making _this_ CPU preemptable if possible), and we also signal
@@ -174,6 +192,21 @@ EXPORT_SYMBOL(_write_lock);
  */
 
 #define BUILD_LOCK_OPS(op, locktype)					\
+static inline void op##_lock_spin(locktype##_t *lock)			\
+{									\
+	unsigned int loops = 0;						\
+									\
+	if (!(lock)->break_lock)					\
+		(lock)->break_lock = 1;					\
+	while (!op##_can_lock(lock) && (lock)->break_lock) {		\
+		if (++loops == SPIN_RELAX_LOOPS) {			\
+			_raw_##op##_relax(lock);			\
+			loops = 0;					\
+		} else							\
+			cpu_relax();					\
+	}								\
+}									\
+									\
 void __lockfunc _##op##_lock(locktype##_t *lock)			\
 {									\
 	preempt_disable();						\
@@ -181,10 +214,7 @@ void __lockfunc _##op##_lock(locktype##_t *lock)			\
 		if (likely(_raw_##op##_trylock(lock)))			\
 			break;						\
 		preempt_enable();					\
-		if (!(lock)->break_lock)				\
-			(lock)->break_lock = 1;				\
-		while (!op##_can_lock(lock) && (lock)->break_lock)	\
-			cpu_relax();					\
+		op##_lock_spin(lock);					\
 		preempt_disable();					\
 	}								\
 }									\
@@ -203,10 +233,7 @@ unsigned long __lockfunc _##op##_lock_irqsave(locktype##_t *lock)	\
 		local_irq_restore(flags);				\
 									\
 		preempt_enable();					\
-		if (!(lock)->break_lock)				\
-			(lock)->break_lock = 1;				\
-		while (!op##_can_lock(lock) && (lock)->break_lock)	\
-			cpu_relax();					\
+		op##_lock_spin(lock);					\
 		preempt_disable();					\
 	}								\
 	return flags;							\
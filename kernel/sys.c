@@ -1717,6 +1717,13 @@ asmlinkage long sys_prctl(int option, unsigned long arg2, unsigned long arg3,
 				return -EFAULT;
 			return 0;
 		}
+		case PR_GET_TIMERSLACK:
+			error = put_user(current->timer_slack_ns,
+					 (unsigned long __user *)arg2);
+			break;
+		case PR_SET_TIMERSLACK:
+			current->timer_slack_ns = arg2;
+			break;
 		default:
 			error = -EINVAL;
 			break;
@@ -35,11 +35,15 @@
 #include <linux/highuid.h>
 #include <linux/writeback.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
+#include <linux/compaction.h>
+#include <linux/ksm.h>
 #include <linux/security.h>
 #include <linux/initrd.h>
 #include <linux/times.h>
 #include <linux/limits.h>
 #include <linux/dcache.h>
+#include <linux/pipe_fs_i.h>
 #include <linux/syscalls.h>
 
 #include <asm/uaccess.h>
@@ -62,6 +66,7 @@ extern char core_pattern[];
 extern int cad_pid;
 extern int pid_max;
 extern int min_free_kbytes;
+extern int percpu_pagelist_fraction;
 extern int printk_ratelimit_jiffies;
 extern int printk_ratelimit_burst;
 extern int pid_max_min, pid_max_max;
@@ -78,6 +83,11 @@ static int minolduid;
 
 static int ngroups_max = NGROUPS_MAX;
 
+extern int proc_nr_dentry(ctl_table *, int, struct file *,
+			  void __user *, size_t *, loff_t *);
+extern int proc_nr_inodes(ctl_table *, int, struct file *,
+			  void __user *, size_t *, loff_t *);
+
 #ifdef CONFIG_KMOD
 extern char modprobe_path[];
 #endif
@@ -121,6 +131,12 @@ extern int sysctl_hz_timer;
 extern int acct_parm[];
 #endif
 
+#ifdef CONFIG_INOTIFY
+extern int inotify_max_user_instances;
+extern int inotify_max_user_watches;
+extern int inotify_max_queued_events;
+#endif
+
 int randomize_va_space = 1;
 
 static int parse_table(int __user *, int, void __user *, size_t __user *, void __user *, size_t,
@@ -140,6 +156,9 @@ extern ctl_table net_table[];
 static ctl_table proc_table[];
 static ctl_table fs_table[];
 static ctl_table debug_table[];
+#ifdef CONFIG_INOTIFY
+static ctl_table inotify_table[];
+#endif
 static ctl_table dev_table[];
 extern ctl_table random_table[];
 #ifdef CONFIG_UNIX98_PTYS
@@ -650,6 +669,13 @@ static ctl_table kern_table[] = {
    We use these as one-element integer vectors. */
 static int zero;
 static int one_hundred = 100;
+static int fault_around_max = FAULT_AROUND_MAX;
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) || defined(CONFIG_KSM)
+static int one = 1;
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static int khugepaged_max_ptes_none_max = HPAGE_PMD_NR - 1;
+#endif
 
 
 static ctl_table vm_table[] = {
@@ -677,6 +703,25 @@ static ctl_table vm_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec,
 	},
+	{
+		.ctl_name	= VM_SWAP_VMA_READAHEAD,
+		.procname	= "swap_vma_readahead",
+		.data		= &swap_vma_readahead,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec,
+	},
+	{
+		.ctl_name	= VM_FAULT_AROUND_PAGES,
+		.procname	= "fault_around_pages",
+		.data		= &fault_around_pages,
+		.maxlen		= sizeof(fault_around_pages),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+		.extra2		= &fault_around_max,
+	},
 	{
 		.ctl_name	= VM_DIRTY_BACKGROUND,
 		.procname	= "dirty_background_ratio",
@@ -745,6 +790,16 @@ static ctl_table vm_table[] = {
 		.extra1		= (void *)&hugetlb_zero,
 		.extra2		= (void *)&hugetlb_infinity,
 	 },
+	 {
+		.ctl_name	= VM_NR_OVERCOMMIT_HUGEPAGES,
+		.procname	= "nr_overcommit_hugepages",
+		.data		= &nr_overcommit_huge_pages,
+		.maxlen		= sizeof(unsigned long),
+		.mode		= 0644,
+		.proc_handler	= &proc_doulongvec_minmax,
+		.extra1		= (void *)&hugetlb_zero,
+		.extra2		= (void *)&hugetlb_infinity,
+	 },
 	 {
 		.ctl_name	= VM_HUGETLB_GROUP,
 		.procname	= "hugetlb_shm_group",
@@ -773,6 +828,73 @@ static ctl_table vm_table[] = {
 		.strategy	= &sysctl_intvec,
 		.extra1		= &zero,
 	},
+	{
+		.ctl_name	= VM_PERCPU_PAGELIST_FRACTION,
+		.procname	= "percpu_pagelist_fraction",
+		.data		= &percpu_pagelist_fraction,
+		.maxlen		= sizeof(percpu_pagelist_fraction),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+	{
+		.ctl_name	= VM_PREZERO_RATIO,
+		.procname	= "prezero_ratio",
+		.data		= &sysctl_prezero_ratio,
+		.maxlen		= sizeof(sysctl_prezero_ratio),
+		.mode		= 0644,
+		.proc_handler	= &prezero_ratio_sysctl_handler,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	{
+		.ctl_name	= VM_KHUGEPAGED_PAGES_TO_SCAN,
+		.procname	= "khugepaged_pages_to_scan",
+		.data		= &khugepaged_pages_to_scan,
+		.maxlen		= sizeof(khugepaged_pages_to_scan),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &one,
+	},
+	{
+		.ctl_name	= VM_KHUGEPAGED_SCAN_SLEEP,
+		.procname	= "khugepaged_scan_sleep_millisecs",
+		.data		= &khugepaged_scan_sleep_millisecs,
+		.maxlen		= sizeof(khugepaged_scan_sleep_millisecs),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+	{
+		.ctl_name	= VM_KHUGEPAGED_MAX_PTES_NONE,
+		.procname	= "khugepaged_max_ptes_none",
+		.data		= &khugepaged_max_ptes_none,
+		.maxlen		= sizeof(khugepaged_max_ptes_none),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+		.extra2		= &khugepaged_max_ptes_none_max,
+	},
+#ifdef CONFIG_SHMEM
+	{
+		.ctl_name	= VM_SHMEM_HUGE,
+		.procname	= "shmem_huge",
+		.data		= &shmem_huge,
+		.maxlen		= sizeof(shmem_huge),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
+#endif
 #ifdef CONFIG_MMU
 	{
 		.ctl_name	= VM_MAX_MAP_COUNT,
@@ -782,6 +904,38 @@ static ctl_table vm_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec
 	},
+#endif
+#ifdef CONFIG_COMPACTION
+	{
+		.ctl_name	= VM_COMPACT_MEMORY,
+		.procname	= "compact_memory",
+		.data		= &sysctl_compact_memory,
+		.maxlen		= sizeof(sysctl_compact_memory),
+		.mode		= 0200,
+		.proc_handler	= &sysctl_compaction_handler,
+	},
+#endif
+#ifdef CONFIG_KSM
+	{
+		.ctl_name	= VM_KSM_PAGES_TO_SCAN,
+		.procname	= "ksm_pages_to_scan",
+		.data		= &ksm_pages_to_scan,
+		.maxlen		= sizeof(ksm_pages_to_scan),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &one,
+	},
+	{
+		.ctl_name	= VM_KSM_SLEEP_MILLISECS,
+		.procname	= "ksm_sleep_millisecs",
+		.data		= &ksm_sleep_millisecs,
+		.maxlen		= sizeof(ksm_sleep_millisecs),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
 #endif
 	{
 		.ctl_name	= VM_LAPTOP_MODE,
@@ -850,7 +1004,7 @@ static ctl_table fs_table[] = {
 		.data		= &inodes_stat,
 		.maxlen		= 2*sizeof(int),
 		.mode		= 0444,
-		.proc_handler	= &proc_dointvec,
+		.proc_handler	= &proc_nr_inodes,
 	},
 	{
 		.ctl_name	= FS_STATINODE,
@@ -858,7 +1012,7 @@ static ctl_table fs_table[] = {
 		.data		= &inodes_stat,
 		.maxlen		= 7*sizeof(int),
 		.mode		= 0444,
-		.proc_handler	= &proc_dointvec,
+		.proc_handler	= &proc_nr_inodes,
 	},
 	{
 		.ctl_name	= FS_NRFILE,
@@ -882,7 +1036,7 @@ static ctl_table fs_table[] = {
 		.data		= &dentry_stat,
 		.maxlen		= 6*sizeof(int),
 		.mode		= 0444,
-		.proc_handler	= &proc_dointvec,
+		.proc_handler	= &proc_nr_dentry,
 	},
 	{
 		.ctl_name	= FS_OVERFLOWUID,
@@ -949,10 +1103,71 @@ static ctl_table fs_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec,
 	},
+#endif
+	{
+		.ctl_name	= FS_PIPE_MAX_SIZE,
+		.procname	= "pipe-max-size",
+		.data		= &pipe_max_size,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec,
+	},
+	{
+		.ctl_name	= FS_PIPE_USER_PAGES,
+		.procname	= "pipe-user-pages-max",
+		.data		= &pipe_user_pages_max,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec,
+	},
+#ifdef CONFIG_INOTIFY
+	{
+		.ctl_name	= FS_INOTIFY,
+		.procname	= "inotify",
+		.mode		= 0555,
+		.child		= inotify_table,
+	},
 #endif
 	{ .ctl_name = 0 }
 };
 
+#ifdef CONFIG_INOTIFY
+/* /proc/sys/fs/inotify/ */
+static ctl_table inotify_table[] = {
+	{
+		.ctl_name	= INOTIFY_MAX_USER_INSTANCES,
+		.procname	= "max_user_instances",
+		.data		= &inotify_max_user_instances,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+	{
+		.ctl_name	= INOTIFY_MAX_USER_WATCHES,
+		.procname	= "max_user_watches",
+		.data		= &inotify_max_user_watches,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+	{
+		.ctl_name	= INOTIFY_MAX_QUEUED_EVENTS,
+		.procname	= "max_queued_events",
+		.data		= &inotify_max_queued_events,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
+	{ .ctl_name = 0 }
+};
+#endif
+
 static ctl_table debug_table[] = {
 	{ .ctl_name = 0 }
 };
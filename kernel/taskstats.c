@@ -0,0 +1,204 @@
+/*
+ * kernel/taskstats.c
+ *
+ * Task and thread group statistics over netlink, see
+ * include/linux/taskstats.h.
+ *
+ * The record of a thread group adds up its threads, those still on
+ * its thread list and, from signal->stats, those already released.
+ * A thread is moved from one to the other in __exit_signal(), under
+ * the tasklist_lock we read both under.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/skbuff.h>
+#include <linux/netlink.h>
+#include <linux/taskstats.h>
+#include <linux/delayacct.h>
+#include <net/sock.h>
+
+static struct sock *taskstats_sock;
+
+/* Requests are handled one at a time, like audit's */
+static DECLARE_MUTEX(taskstats_sem);
+
+void taskstats_tgid_init(struct signal_struct *sig)
+{
+	memset(&sig->stats, 0, sizeof(sig->stats));
+}
+
+/* tsk is being released: called with the tasklist_lock write-locked */
+void taskstats_tgid_add(struct signal_struct *sig, struct task_struct *tsk)
+{
+	delayacct_add_tsk(&sig->stats, tsk);
+}
+
+static void taskstats_add(struct taskstats *stats, struct taskstats *dead)
+{
+	stats->cpu_count += dead->cpu_count;
+	stats->cpu_delay_total += dead->cpu_delay_total;
+	stats->cpu_run_real_total += dead->cpu_run_real_total;
+	stats->blkio_count += dead->blkio_count;
+	stats->blkio_delay_total += dead->blkio_delay_total;
+	stats->swapin_count += dead->swapin_count;
+	stats->swapin_delay_total += dead->swapin_delay_total;
+	stats->freepages_count += dead->freepages_count;
+	stats->freepages_delay_total += dead->freepages_delay_total;
+}
+
+static int taskstats_fill(u32 type, u32 id, struct taskstats *stats)
+{
+	struct task_struct *tsk, *t;
+	int ret = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->version = TASKSTATS_VERSION;
+
+	read_lock(&tasklist_lock);
+	tsk = find_task_by_pid(id);
+	if (!tsk) {
+		ret = -ESRCH;
+		goto out;
+	}
+	if (type == TASKSTATS_TYPE_PID) {
+		stats->pid = tsk->pid;
+		stats->tgid = tsk->tgid;
+		delayacct_add_tsk(stats, tsk);
+		goto out;
+	}
+
+	if (tsk->tgid != id) {
+		ret = -ESRCH;
+		goto out;
+	}
+	stats->tgid = id;
+	t = tsk;
+	do {
+		delayacct_add_tsk(stats, t);
+	} while_each_thread(tsk, t);
+	taskstats_add(stats, &tsk->signal->stats);
+out:
+	read_unlock(&tasklist_lock);
+	return ret;
+}
+
+/* Send stats to pid, or to group if it is not zero */
+static int taskstats_send(u32 pid, u32 seq, u32 group,
+			  struct taskstats *stats)
+{
+	struct sk_buff *skb;
+	struct nlmsghdr *nlh;
+
+	skb = alloc_skb(NLMSG_SPACE(sizeof(*stats)), GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+	nlh = NLMSG_PUT(skb, pid, seq, TASKSTATS_MSG_NEW, sizeof(*stats));
+	memcpy(NLMSG_DATA(nlh), stats, sizeof(*stats));
+
+	if (group)
+		return netlink_broadcast(taskstats_sock, skb, 0, group,
+					 GFP_KERNEL);
+	return netlink_unicast(taskstats_sock, skb, pid, MSG_DONTWAIT);
+
+nlmsg_failure:			/* Used by NLMSG_PUT */
+	kfree_skb(skb);
+	return -ENOBUFS;
+}
+
+/*
+ * Called from do_exit() once the task has stopped waiting: send its
+ * record, and that of its thread group if it was the last thread.
+ */
+void taskstats_exit(struct task_struct *tsk, int group_dead)
+{
+	struct taskstats stats;
+
+	if (!taskstats_sock)
+		return;
+
+	memset(&stats, 0, sizeof(stats));
+	stats.version = TASKSTATS_VERSION;
+	stats.pid = tsk->pid;
+	stats.tgid = tsk->tgid;
+	delayacct_add_tsk(&stats, tsk);
+	taskstats_send(0, 0, TASKSTATS_GRP_EXIT, &stats);
+
+	if (!group_dead || thread_group_empty(tsk))
+		return;
+	if (!taskstats_fill(TASKSTATS_TYPE_TGID, tsk->tgid, &stats))
+		taskstats_send(0, 0, TASKSTATS_GRP_EXIT, &stats);
+}
+
+static int taskstats_receive_msg(struct sk_buff *skb, struct nlmsghdr *nlh)
+{
+	struct taskstats_req *req = NLMSG_DATA(nlh);
+	struct taskstats stats;
+	int err;
+
+	if (nlh->nlmsg_type != TASKSTATS_MSG_GET)
+		return -EINVAL;
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*req)))
+		return -EINVAL;
+	if (req->type != TASKSTATS_TYPE_PID && req->type != TASKSTATS_TYPE_TGID)
+		return -EINVAL;
+
+	err = taskstats_fill(req->type, req->id, &stats);
+	if (err)
+		return err;
+	err = taskstats_send(NETLINK_CB(skb).pid, nlh->nlmsg_seq, 0, &stats);
+	return err < 0 ? err : 0;
+}
+
+/* Process the messages of skb, as audit_receive_skb() does. */
+static int taskstats_receive_skb(struct sk_buff *skb)
+{
+	struct nlmsghdr *nlh;
+	u32 rlen;
+	int err;
+
+	while (skb->len >= NLMSG_SPACE(0)) {
+		nlh = (struct nlmsghdr *)skb->data;
+		if (nlh->nlmsg_len < sizeof(*nlh) || skb->len < nlh->nlmsg_len)
+			return 0;
+		rlen = NLMSG_ALIGN(nlh->nlmsg_len);
+		if (rlen > skb->len)
+			rlen = skb->len;
+		if ((err = taskstats_receive_msg(skb, nlh)))
+			netlink_ack(skb, nlh, err);
+		else if (nlh->nlmsg_flags & NLM_F_ACK)
+			netlink_ack(skb, nlh, 0);
+		skb_pull(skb, rlen);
+	}
+	return 0;
+}
+
+static void taskstats_receive(struct sock *sk, int length)
+{
+	struct sk_buff *skb;
+
+	if (down_trylock(&taskstats_sem))
+		return;
+
+	while ((skb = skb_dequeue(&sk->sk_receive_queue))) {
+		if (taskstats_receive_skb(skb) && skb->len)
+			skb_queue_head(&sk->sk_receive_queue, skb);
+		else
+			kfree_skb(skb);
+	}
+	up(&taskstats_sem);
+}
+
+static int __init taskstats_init(void)
+{
+	taskstats_sock = netlink_kernel_create(NETLINK_TASKSTATS,
+					       taskstats_receive);
+	if (!taskstats_sock)
+		printk(KERN_ERR "taskstats: cannot create netlink socket\n");
+	return 0;
+}
+__initcall(taskstats_init);
@@ -37,6 +37,7 @@
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
+#include <asm/div64.h>
 
 /* 
  * The timezone where the local system is located.  Used as a default by some
@@ -569,6 +570,45 @@ void getnstimeofday(struct timespec *tv)
 }
 #endif
 
+/**
+ * ns_to_timespec - Convert nanoseconds to timespec
+ * @nsec:	the nanoseconds value to be converted
+ *
+ * Returns the timespec representation of the nsec parameter.
+ */
+struct timespec ns_to_timespec(const s64 nsec)
+{
+	struct timespec ts;
+	u64 n = nsec < 0 ? -nsec : nsec;
+	long rem;
+
+	rem = do_div(n, NSEC_PER_SEC);
+	if (nsec < 0)
+		set_normalized_timespec(&ts, -(time_t)n, -rem);
+	else {
+		ts.tv_sec = n;
+		ts.tv_nsec = rem;
+	}
+	return ts;
+}
+
+/**
+ * ns_to_timeval - Convert nanoseconds to timeval
+ * @nsec:	the nanoseconds value to be converted
+ *
+ * Returns the timeval representation of the nsec parameter.
+ */
+struct timeval ns_to_timeval(const s64 nsec)
+{
+	struct timespec ts = ns_to_timespec(nsec);
+	struct timeval tv;
+
+	tv.tv_sec = ts.tv_sec;
+	tv.tv_usec = (suseconds_t) ts.tv_nsec / 1000;
+
+	return tv;
+}
+
 #if (BITS_PER_LONG < 64)
 u64 get_jiffies_64(void)
 {
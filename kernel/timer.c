@@ -31,6 +31,7 @@
 #include <linux/time.h>
 #include <linux/jiffies.h>
 #include <linux/posix-timers.h>
+#include <linux/hrtimer.h>
 #include <linux/cpu.h>
 #include <linux/syscalls.h>
 
@@ -156,6 +157,36 @@ static void internal_add_timer(tvec_base_t *base, struct timer_list *timer)
 	list_add_tail(&timer->entry, vec);
 }
 
+/*
+ * Pick the expiry for a timer that may run up to 'slack' jiffies
+ * late: the first tv1 slot in [expires, expires + slack] which already
+ * has timers queued, or else the jiffy in that range with the most
+ * trailing zero bits, so that unrelated timers with slack still tend
+ * to meet in the same slot.
+ */
+static unsigned long apply_slack(tvec_base_t *base, unsigned long expires,
+				 unsigned long slack)
+{
+	unsigned long limit = expires + slack;
+	unsigned long mask, j;
+
+	if (time_before_eq(expires, base->timer_jiffies))
+		return expires;
+
+	if (limit - base->timer_jiffies < TVR_SIZE) {
+		for (j = expires; time_before_eq(j, limit); j++)
+			if (!list_empty(base->tv1.vec + (j & TVR_MASK)))
+				return j;
+	}
+
+	/* the highest bit in which expires and limit differ */
+	mask = expires ^ limit;
+	while (mask & (mask - 1))
+		mask &= mask - 1;
+
+	return limit & ~(mask - 1);
+}
+
 int __mod_timer(struct timer_list *timer, unsigned long expires)
 {
 	tvec_base_t *old_base, *new_base;
@@ -207,6 +238,8 @@ repeat:
 		list_del(&timer->entry);
 		ret = 1;
 	}
+	if (timer->slack)
+		expires = apply_slack(new_base, expires, timer->slack);
 	timer->expires = expires;
 	internal_add_timer(new_base, timer);
 	timer->base = new_base;
@@ -272,9 +305,13 @@ int mod_timer(struct timer_list *timer, unsigned long expires)
 	/*
 	 * This is a common optimization triggered by the
 	 * networking code - if the timer is re-modified
-	 * to be the same thing then just return:
+	 * to be the same thing then just return.  A timer with
+	 * slack was queued at its rounded expiry, which apply_slack()
+	 * keeps within [expires, expires + slack]:
 	 */
-	if (timer->expires == expires && timer_pending(timer))
+	if (timer_pending(timer) &&
+	    time_after_eq(timer->expires, expires) &&
+	    time_before_eq(timer->expires, expires + timer->slack))
 		return 1;
 
 	return __mod_timer(timer, expires);
@@ -484,9 +521,38 @@ repeat:
 }
 
 #ifdef CONFIG_NO_IDLE_HZ
+/*
+ * Until the CPU is in high resolution mode, hrtimers are run from the
+ * timer softirq: their first expiry is a timer event, too. Returns the
+ * earlier of it and @expires.
+ */
+static unsigned long cmp_next_hrtimer_event(unsigned long now,
+					    unsigned long expires)
+{
+	ktime_t hr_delta = hrtimer_get_next_event();
+	struct timespec tsdelta;
+	unsigned long delta;
+
+	if (hr_delta.tv64 == KTIME_MAX)
+		return expires;
+
+	/* Due within the next tick: don't stop it */
+	if (hr_delta.tv64 <= TICK_NSEC)
+		return now;
+
+	tsdelta = ktime_to_timespec(hr_delta);
+	delta = timespec_to_jiffies(&tsdelta);
+	if (time_before(now + delta, expires))
+		return now + delta;
+	return expires;
+}
+
 /*
  * Find out when the next timer event is due to happen. This
- * is used on S/390 to stop all activity when a cpus is idle.
+ * is used on S/390 and x86_64 to stop the HZ tick while a cpu
+ * is idle. Deferrable timers are not taken into account: they
+ * run when the cpu wakes up for something else. Pending hrtimers
+ * are, while they are run from the timer softirq.
  * This functions needs to be called disabled.
  */
 unsigned long next_timer_interrupt(void)
@@ -507,6 +573,8 @@ unsigned long next_timer_interrupt(void)
 	j = base->timer_jiffies & TVR_MASK;
 	do {
 		list_for_each_entry(nte, base->tv1.vec + j, entry) {
+			if (nte->flags & TIMER_DEFERRABLE)
+				continue;
 			expires = nte->expires;
 			if (j < (base->timer_jiffies & TVR_MASK))
 				list = base->tv2.vec + (INDEX(0));
@@ -523,13 +591,19 @@ unsigned long next_timer_interrupt(void)
 	for (i = 0; i < 4; i++) {
 		j = INDEX(i);
 		do {
-			if (list_empty(varray[i]->vec + j)) {
+			int found = 0;
+
+			list_for_each_entry(nte, varray[i]->vec + j, entry) {
+				if (nte->flags & TIMER_DEFERRABLE)
+					continue;
+				found = 1;
+				if (time_before(nte->expires, expires))
+					expires = nte->expires;
+			}
+			if (!found) {
 				j = (j + 1) & TVN_MASK;
 				continue;
 			}
-			list_for_each_entry(nte, varray[i]->vec + j, entry)
-				if (time_before(nte->expires, expires))
-					expires = nte->expires;
 			if (j < (INDEX(i)) && i < 3)
 				list = varray[i + 1]->vec + (INDEX(i + 1));
 			goto found;
@@ -543,12 +617,14 @@ found:
 		 * where we found the timer element.
 		 */
 		list_for_each_entry(nte, list, entry) {
+			if (nte->flags & TIMER_DEFERRABLE)
+				continue;
 			if (time_before(nte->expires, expires))
 				expires = nte->expires;
 		}
 	}
 	spin_unlock(&base->lock);
-	return expires;
+	return cmp_next_hrtimer_event(jiffies, expires);
 }
 #endif
 
@@ -827,6 +903,8 @@ void update_process_times(int user_tick)
 		rcu_check_callbacks(cpu, user_tick);
 	scheduler_tick();
  	run_posix_cpu_timers(p);
+	perf_counter_do_pending();
+	printk_tick();
 }
 
 /*
@@ -888,6 +966,7 @@ static void run_timer_softirq(struct softirq_action *h)
 {
 	tvec_base_t *base = &__get_cpu_var(tvec_bases);
 
+	hrtimer_run_queues();
 	if (time_after_eq(jiffies, base->timer_jiffies))
 		__run_timers(base);
 }
@@ -1116,6 +1195,8 @@ fastcall signed long __sched schedule_timeout(signed long timeout)
 	timer.expires = expire;
 	timer.data = (unsigned long) current;
 	timer.function = process_timeout;
+	if (current->timer_slack_ns && !rt_task(current))
+		set_timer_slack(&timer, current->timer_slack_ns / TICK_NSEC);
 
 	add_timer(&timer);
 	schedule();
@@ -1135,64 +1216,6 @@ asmlinkage long sys_gettid(void)
 	return current->pid;
 }
 
-static long __sched nanosleep_restart(struct restart_block *restart)
-{
-	unsigned long expire = restart->arg0, now = jiffies;
-	struct timespec __user *rmtp = (struct timespec __user *) restart->arg1;
-	long ret;
-
-	/* Did it expire while we handled signals? */
-	if (!time_after(expire, now))
-		return 0;
-
-	current->state = TASK_INTERRUPTIBLE;
-	expire = schedule_timeout(expire - now);
-
-	ret = 0;
-	if (expire) {
-		struct timespec t;
-		jiffies_to_timespec(expire, &t);
-
-		ret = -ERESTART_RESTARTBLOCK;
-		if (rmtp && copy_to_user(rmtp, &t, sizeof(t)))
-			ret = -EFAULT;
-		/* The 'restart' block is already filled in */
-	}
-	return ret;
-}
-
-asmlinkage long sys_nanosleep(struct timespec __user *rqtp, struct timespec __user *rmtp)
-{
-	struct timespec t;
-	unsigned long expire;
-	long ret;
-
-	if (copy_from_user(&t, rqtp, sizeof(t)))
-		return -EFAULT;
-
-	if ((t.tv_nsec >= 1000000000L) || (t.tv_nsec < 0) || (t.tv_sec < 0))
-		return -EINVAL;
-
-	expire = timespec_to_jiffies(&t) + (t.tv_sec || t.tv_nsec);
-	current->state = TASK_INTERRUPTIBLE;
-	expire = schedule_timeout(expire);
-
-	ret = 0;
-	if (expire) {
-		struct restart_block *restart;
-		jiffies_to_timespec(expire, &t);
-		if (rmtp && copy_to_user(rmtp, &t, sizeof(t)))
-			return -EFAULT;
-
-		restart = &current_thread_info()->restart_block;
-		restart->fn = nanosleep_restart;
-		restart->arg0 = jiffies + expire;
-		restart->arg1 = (unsigned long) rmtp;
-		ret = -ERESTART_RESTARTBLOCK;
-	}
-	return ret;
-}
-
 /*
  * sys_sysinfo - fill in sysinfo struct
  */ 
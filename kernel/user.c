@@ -34,8 +34,16 @@ struct user_struct root_user = {
 	.processes	= ATOMIC_INIT(1),
 	.files		= ATOMIC_INIT(0),
 	.sigpending	= ATOMIC_INIT(0),
+	.pipe_bufs	= ATOMIC_INIT(0),
+#ifdef CONFIG_INOTIFY
+	.inotify_watches = ATOMIC_INIT(0),
+	.inotify_devs	= ATOMIC_INIT(0),
+#endif
 	.mq_bytes	= 0,
 	.locked_shm     = 0,
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	.share		= INIT_SCHED_SHARE,
+#endif
 #ifdef CONFIG_KEYS
 	.uid_keyring	= &root_user_keyring,
 	.session_keyring = &root_session_keyring,
@@ -120,9 +128,17 @@ struct user_struct * alloc_uid(uid_t uid)
 		atomic_set(&new->processes, 0);
 		atomic_set(&new->files, 0);
 		atomic_set(&new->sigpending, 0);
+		atomic_set(&new->pipe_bufs, 0);
+#ifdef CONFIG_INOTIFY
+		atomic_set(&new->inotify_watches, 0);
+		atomic_set(&new->inotify_devs, 0);
+#endif
 
 		new->mq_bytes = 0;
 		new->locked_shm = 0;
+#ifdef CONFIG_FAIR_GROUP_SCHED
+		sched_share_init(&new->share);
+#endif
 
 		if (alloc_uid_keyring(new) < 0) {
 			kmem_cache_free(uid_cachep, new);
@@ -163,6 +179,7 @@ void switch_uid(struct user_struct *new_user)
 	atomic_dec(&old_user->processes);
 	switch_uid_keyring(new_user);
 	current->user = new_user;
+	sched_move_share(current);
 	free_uid(old_user);
 	suid_keys(current);
 }
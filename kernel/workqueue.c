@@ -26,6 +26,48 @@
 #include <linux/notifier.h>
 #include <linux/kthread.h>
 
+/*
+ * The works of all multithreaded workqueues are run by one pool of
+ * worker threads per cpu.  The pool keeps about one worker running:
+ * when that one blocks, schedule() calls wq_worker_sleeping(), which
+ * wakes an idle worker to carry on with the queue, and a worker leaving
+ * the idle list makes sure there is another one to wake, creating it if
+ * need be.  Workers idle for long are let go, down to one per pool.
+ *
+ * A single threaded workqueue has a pool of its own, with just the one
+ * worker, so that its works are run one at a time, in order.
+ */
+#define WORKER_IDLE_TIMEOUT	(300 * HZ)
+
+/* worker->flags */
+#define WORKER_IDLE		0x1	/* On pool->idle_list */
+#define WORKER_SLEEPING		0x2	/* Blocked in a work, not counted */
+
+struct worker_pool {
+	spinlock_t lock;
+	struct list_head worklist;
+	struct list_head idle_list;	/* Most recently idle first */
+	struct list_head busy_list;
+	int nr_idle;
+	int nr_running;			/* Busy workers not blocked */
+	int cpu;			/* -1 for a single threaded workqueue's */
+	int managing;			/* A worker is creating another */
+	int dead;			/* Its cpu went away */
+	int next_id;
+} ____cacheline_aligned;
+
+struct worker {
+	struct list_head list;		/* On idle_list or busy_list */
+	struct task_struct *task;
+	struct worker_pool *pool;
+	unsigned int flags;
+	int die;			/* Unlinked, kthread_stop() is coming */
+
+	/* What we are running, for flush_workqueue() */
+	struct cpu_workqueue_struct *current_cwq;
+	long current_seq;
+};
+
 /*
  * The per-CPU workqueue (if single thread, we always use cpu 0's).
  *
@@ -33,23 +75,19 @@
  * until until all currently-scheduled works are completed, but it doesn't
  * want to be livelocked by new, incoming ones.  So it waits until
  * remove_sequence is >= the insert_sequence which pertained when
- * flush_scheduled_work() was called.
+ * flush_scheduled_work() was called, and no worker still runs a work
+ * taken off before that.  Both are guarded by the pool's lock.
  */
 struct cpu_workqueue_struct {
 
-	spinlock_t lock;
+	struct worker_pool *pool;
 
 	long remove_sequence;	/* Least-recently added (next to run) */
 	long insert_sequence;	/* Next to add */
 
-	struct list_head worklist;
-	wait_queue_head_t more_work;
 	wait_queue_head_t work_done;
 
 	struct workqueue_struct *wq;
-	task_t *thread;
-
-	int run_depth;		/* Detect run_workqueue() recursion depth */
 } ____cacheline_aligned;
 
 /*
@@ -59,32 +97,135 @@ struct cpu_workqueue_struct {
 struct workqueue_struct {
 	struct cpu_workqueue_struct cpu_wq[NR_CPUS];
 	const char *name;
-	struct list_head list; 	/* Empty if single thread */
+	int singlethread;
+	struct worker_pool single_pool;	/* If singlethread */
 };
 
-/* All the per-cpu workqueues on the system, for hotplug cpu to add/remove
-   threads to each one as cpus come/go. */
-static DEFINE_SPINLOCK(workqueue_lock);
-static LIST_HEAD(workqueues);
+static struct worker_pool cpu_pools[NR_CPUS];
 
-/* If it's single threaded, it isn't in the list of workqueues. */
 static inline int is_single_threaded(struct workqueue_struct *wq)
 {
-	return list_empty(&wq->list);
+	return wq->singlethread;
+}
+
+static void init_worker_pool(struct worker_pool *pool, int cpu)
+{
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->worklist);
+	INIT_LIST_HEAD(&pool->idle_list);
+	INIT_LIST_HEAD(&pool->busy_list);
+	pool->nr_idle = 0;
+	pool->nr_running = 0;
+	pool->cpu = cpu;
+	pool->managing = 0;
+	pool->dead = 0;
+	pool->next_id = 0;
+}
+
+/* Pool lock held */
+static inline void wake_up_worker(struct worker_pool *pool)
+{
+	if (!list_empty(&pool->idle_list))
+		wake_up_process(list_entry(pool->idle_list.next,
+					   struct worker, list)->task);
+}
+
+/*
+ * Should worker take the next work?  Only if there is one, and nobody
+ * else is running: an idle worker is only wanted when none is.
+ */
+static inline int worker_should_run(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	if (list_empty(&pool->worklist))
+		return 0;
+	return pool->nr_running == (worker->flags & WORKER_IDLE ? 0 : 1);
+}
+
+static void worker_enter_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	worker->flags |= WORKER_IDLE;
+	pool->nr_running--;
+	pool->nr_idle++;
+	list_move(&worker->list, &pool->idle_list);
+}
+
+static void worker_leave_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	worker->flags &= ~WORKER_IDLE;
+	pool->nr_idle--;
+	pool->nr_running++;
+	list_move(&worker->list, &pool->busy_list);
+}
+
+/* Take worker off its pool, pool lock held */
+static void worker_unlink(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	list_del_init(&worker->list);
+	if (worker->flags & WORKER_IDLE)
+		pool->nr_idle--;
+	else if (!(worker->flags & WORKER_SLEEPING))
+		pool->nr_running--;
+}
+
+/*
+ * Called from schedule() when a worker of a cpu pool goes to sleep:
+ * if it was the one running, wake another to keep the queue going.
+ */
+void wq_worker_sleeping(struct task_struct *task)
+{
+	struct worker *worker = task->wq_worker;
+	struct worker_pool *pool = worker->pool;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if (!worker->die && !(worker->flags & (WORKER_IDLE | WORKER_SLEEPING))) {
+		worker->flags |= WORKER_SLEEPING;
+		if (--pool->nr_running == 0 && !list_empty(&pool->worklist))
+			wake_up_worker(pool);
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+/* ... and when it runs again. */
+void wq_worker_running(struct task_struct *task)
+{
+	struct worker *worker = task->wq_worker;
+	struct worker_pool *pool = worker->pool;
+	unsigned long flags;
+
+	if (!(worker->flags & WORKER_SLEEPING))
+		return;
+	spin_lock_irqsave(&pool->lock, flags);
+	if (worker->flags & WORKER_SLEEPING) {
+		worker->flags &= ~WORKER_SLEEPING;
+		if (!worker->die)
+			pool->nr_running++;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
 }
 
 /* Preempt must be disabled. */
 static void __queue_work(struct cpu_workqueue_struct *cwq,
 			 struct work_struct *work)
 {
+	struct worker_pool *pool = cwq->pool;
 	unsigned long flags;
 
-	spin_lock_irqsave(&cwq->lock, flags);
+	spin_lock_irqsave(&pool->lock, flags);
 	work->wq_data = cwq;
-	list_add_tail(&work->entry, &cwq->worklist);
+	list_add_tail(&work->entry, &pool->worklist);
 	cwq->insert_sequence++;
-	wake_up(&cwq->more_work);
-	spin_unlock_irqrestore(&cwq->lock, flags);
+	if (!pool->nr_running)
+		wake_up_worker(pool);
+	spin_unlock_irqrestore(&pool->lock, flags);
 }
 
 /*
@@ -109,6 +250,30 @@ int fastcall queue_work(struct workqueue_struct *wq, struct work_struct *work)
 	return ret;
 }
 
+/*
+ * Like queue_work(), but queue the work to the thread of the given cpu,
+ * so that callers can spread work over the cpus themselves.  Falls back
+ * to the current cpu if the given one is offline.
+ */
+int fastcall queue_work_on(int cpu, struct workqueue_struct *wq,
+			   struct work_struct *work)
+{
+	int ret = 0;
+
+	preempt_disable();
+	if (!test_and_set_bit(0, &work->pending)) {
+		if (unlikely(is_single_threaded(wq)))
+			cpu = 0;
+		else if (unlikely(!cpu_online(cpu)))
+			cpu = smp_processor_id();
+		BUG_ON(!list_empty(&work->entry));
+		__queue_work(wq->cpu_wq + cpu, work);
+		ret = 1;
+	}
+	preempt_enable();
+	return ret;
+}
+
 static void delayed_work_timer_fn(unsigned long __data)
 {
 	struct work_struct *work = (struct work_struct *)__data;
@@ -142,49 +307,40 @@ int fastcall queue_delayed_work(struct workqueue_struct *wq,
 	return ret;
 }
 
-static inline void run_workqueue(struct cpu_workqueue_struct *cwq)
+/*
+ * Run one work off pool->worklist.  Called and returns with the pool
+ * lock held, which is dropped around the work itself.
+ */
+static void process_one_work(struct worker *worker, struct work_struct *work)
 {
-	unsigned long flags;
-
-	/*
-	 * Keep taking off work from the queue until
-	 * done.
-	 */
-	spin_lock_irqsave(&cwq->lock, flags);
-	cwq->run_depth++;
-	if (cwq->run_depth > 3) {
-		/* morton gets to eat his hat */
-		printk("%s: recursion depth exceeded: %d\n",
-			__FUNCTION__, cwq->run_depth);
-		dump_stack();
-	}
-	while (!list_empty(&cwq->worklist)) {
-		struct work_struct *work = list_entry(cwq->worklist.next,
-						struct work_struct, entry);
-		void (*f) (void *) = work->func;
-		void *data = work->data;
-
-		list_del_init(cwq->worklist.next);
-		spin_unlock_irqrestore(&cwq->lock, flags);
-
-		BUG_ON(work->wq_data != cwq);
-		clear_bit(0, &work->pending);
-		f(data);
-
-		spin_lock_irqsave(&cwq->lock, flags);
-		cwq->remove_sequence++;
+	struct worker_pool *pool = worker->pool;
+	struct cpu_workqueue_struct *cwq = work->wq_data;
+	void (*f) (void *) = work->func;
+	void *data = work->data;
+
+	list_del_init(&work->entry);
+	worker->current_cwq = cwq;
+	worker->current_seq = cwq->remove_sequence++;
+	spin_unlock_irq(&pool->lock);
+
+	clear_bit(0, &work->pending);
+	f(data);
+
+	spin_lock_irq(&pool->lock);
+	worker->current_cwq = NULL;
+	if (waitqueue_active(&cwq->work_done))
 		wake_up(&cwq->work_done);
-	}
-	cwq->run_depth--;
-	spin_unlock_irqrestore(&cwq->lock, flags);
 }
 
-static int worker_thread(void *__cwq)
+static int create_worker(struct worker_pool *pool, const char *name);
+
+static int worker_thread(void *__worker)
 {
-	struct cpu_workqueue_struct *cwq = __cwq;
-	DECLARE_WAITQUEUE(wait, current);
+	struct worker *worker = __worker;
+	struct worker_pool *pool = worker->pool;
 	struct k_sigaction sa;
 	sigset_t blocked;
+	long timeout;
 
 	current->flags |= PF_NOFREEZE;
 
@@ -201,47 +357,195 @@ static int worker_thread(void *__cwq)
 	siginitset(&sa.sa.sa_mask, sigmask(SIGCHLD));
 	do_sigaction(SIGCHLD, &sa, (struct k_sigaction *)0);
 
+	current->wq_worker = worker;
+	if (pool->cpu >= 0)
+		current->flags |= PF_WQ_WORKER;
+
+	spin_lock_irq(&pool->lock);
+	while (!worker->die) {
+		if (!worker_should_run(worker)) {
+			if (!(worker->flags & WORKER_IDLE))
+				worker_enter_idle(worker);
+			__set_current_state(TASK_INTERRUPTIBLE);
+			spin_unlock_irq(&pool->lock);
+			timeout = schedule_timeout(WORKER_IDLE_TIMEOUT);
+			spin_lock_irq(&pool->lock);
+
+			/* Let go of workers idle for long, keeping one */
+			if (!timeout && !worker->die && pool->cpu >= 0 &&
+			    pool->nr_idle > 1 && (worker->flags & WORKER_IDLE) &&
+			    !worker_should_run(worker)) {
+				worker_unlink(worker);
+				spin_unlock_irq(&pool->lock);
+				current->flags &= ~PF_WQ_WORKER;
+				current->wq_worker = NULL;
+				kfree(worker);
+				return 0;
+			}
+			continue;
+		}
+
+		if (worker->flags & WORKER_IDLE)
+			worker_leave_idle(worker);
+
+		/* Leave someone to take over, should we block */
+		if (!pool->nr_idle && pool->cpu >= 0 && !pool->managing) {
+			pool->managing = 1;
+			spin_unlock_irq(&pool->lock);
+			create_worker(pool, NULL);
+			spin_lock_irq(&pool->lock);
+			pool->managing = 0;
+			continue;
+		}
+
+		process_one_work(worker, list_entry(pool->worklist.next,
+						    struct work_struct, entry));
+	}
+	spin_unlock_irq(&pool->lock);
+
+	current->flags &= ~PF_WQ_WORKER;
+	current->wq_worker = NULL;
+
+	/* Unlinked by stop_pool_workers(), which frees us */
 	set_current_state(TASK_INTERRUPTIBLE);
 	while (!kthread_should_stop()) {
-		add_wait_queue(&cwq->more_work, &wait);
-		if (list_empty(&cwq->worklist))
-			schedule();
-		else
-			__set_current_state(TASK_RUNNING);
-		remove_wait_queue(&cwq->more_work, &wait);
-
-		if (!list_empty(&cwq->worklist))
-			run_workqueue(cwq);
+		schedule();
 		set_current_state(TASK_INTERRUPTIBLE);
 	}
 	__set_current_state(TASK_RUNNING);
 	return 0;
 }
 
+/* Start another worker in pool, idle.  name is for single threaded pools. */
+static int create_worker(struct worker_pool *pool, const char *name)
+{
+	struct worker *worker;
+	struct task_struct *p;
+	int id;
+
+	worker = kmalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return -ENOMEM;
+	memset(worker, 0, sizeof(*worker));
+	INIT_LIST_HEAD(&worker->list);
+	worker->pool = pool;
+	worker->flags = WORKER_IDLE;
+
+	spin_lock_irq(&pool->lock);
+	id = pool->next_id++;
+	spin_unlock_irq(&pool->lock);
+
+	if (pool->cpu < 0)
+		p = kthread_create(worker_thread, worker, "%s", name);
+	else
+		p = kthread_create(worker_thread, worker, "kworker/%d:%d",
+				   pool->cpu, id);
+	if (IS_ERR(p)) {
+		kfree(worker);
+		return PTR_ERR(p);
+	}
+	worker->task = p;
+	if (pool->cpu >= 0)
+		kthread_bind(p, pool->cpu);
+
+	spin_lock_irq(&pool->lock);
+	if (pool->dead) {
+		spin_unlock_irq(&pool->lock);
+		kthread_stop(p);
+		kfree(worker);
+		return -ENODEV;
+	}
+	list_add(&worker->list, &pool->idle_list);
+	pool->nr_idle++;
+	spin_unlock_irq(&pool->lock);
+
+	wake_up_process(p);
+	return 0;
+}
+
+/*
+ * Stop all the workers of pool, waiting for each to finish the work
+ * it is running.  They are unlinked here, so that they need not touch
+ * the pool on their way out.
+ */
+static void stop_pool_workers(struct worker_pool *pool)
+{
+	struct worker *worker;
+
+	spin_lock_irq(&pool->lock);
+	for (;;) {
+		if (!list_empty(&pool->idle_list))
+			worker = list_entry(pool->idle_list.next,
+					    struct worker, list);
+		else if (!list_empty(&pool->busy_list))
+			worker = list_entry(pool->busy_list.next,
+					    struct worker, list);
+		else
+			break;
+		worker_unlink(worker);
+		worker->die = 1;
+		spin_unlock_irq(&pool->lock);
+
+		kthread_stop(worker->task);
+		kfree(worker);
+
+		spin_lock_irq(&pool->lock);
+	}
+	spin_unlock_irq(&pool->lock);
+}
+
+/* Pool lock held */
+static int cwq_flush_pending(struct cpu_workqueue_struct *cwq, long sequence)
+{
+	struct worker *worker;
+
+	if (sequence - cwq->remove_sequence > 0)
+		return 1;
+	/* Taken off, but maybe still running; not counting ourselves */
+	list_for_each_entry(worker, &cwq->pool->busy_list, list)
+		if (worker->current_cwq == cwq && worker->task != current &&
+		    sequence - worker->current_seq > 0)
+			return 1;
+	return 0;
+}
+
 static void flush_cpu_workqueue(struct cpu_workqueue_struct *cwq)
 {
-	if (cwq->thread == current) {
+	struct worker_pool *pool = cwq->pool;
+	struct worker *worker = current->wq_worker;
+
+	if (worker && worker->pool == pool && pool->cpu < 0) {
 		/*
-		 * Probably keventd trying to flush its own queue. So simply run
-		 * it by hand rather than deadlocking.
+		 * A single threaded workqueue trying to flush itself: nobody
+		 * else runs its works, so simply run them by hand rather
+		 * than deadlocking.
 		 */
-		run_workqueue(cwq);
+		struct cpu_workqueue_struct *saved_cwq = worker->current_cwq;
+		long saved_seq = worker->current_seq;
+
+		spin_lock_irq(&pool->lock);
+		while (!list_empty(&pool->worklist))
+			process_one_work(worker, list_entry(pool->worklist.next,
+						struct work_struct, entry));
+		worker->current_cwq = saved_cwq;
+		worker->current_seq = saved_seq;
+		spin_unlock_irq(&pool->lock);
 	} else {
 		DEFINE_WAIT(wait);
 		long sequence_needed;
 
-		spin_lock_irq(&cwq->lock);
+		spin_lock_irq(&pool->lock);
 		sequence_needed = cwq->insert_sequence;
 
-		while (sequence_needed - cwq->remove_sequence > 0) {
+		while (cwq_flush_pending(cwq, sequence_needed)) {
 			prepare_to_wait(&cwq->work_done, &wait,
 					TASK_UNINTERRUPTIBLE);
-			spin_unlock_irq(&cwq->lock);
+			spin_unlock_irq(&pool->lock);
 			schedule();
-			spin_lock_irq(&cwq->lock);
+			spin_lock_irq(&pool->lock);
 		}
 		finish_wait(&cwq->work_done, &wait);
-		spin_unlock_irq(&cwq->lock);
+		spin_unlock_irq(&pool->lock);
 	}
 }
 
@@ -276,37 +580,22 @@ void fastcall flush_workqueue(struct workqueue_struct *wq)
 	}
 }
 
-static struct task_struct *create_workqueue_thread(struct workqueue_struct *wq,
-						   int cpu)
+static void init_cpu_workqueue(struct workqueue_struct *wq,
+			       struct cpu_workqueue_struct *cwq,
+			       struct worker_pool *pool)
 {
-	struct cpu_workqueue_struct *cwq = wq->cpu_wq + cpu;
-	struct task_struct *p;
-
-	spin_lock_init(&cwq->lock);
+	cwq->pool = pool;
 	cwq->wq = wq;
-	cwq->thread = NULL;
 	cwq->insert_sequence = 0;
 	cwq->remove_sequence = 0;
-	INIT_LIST_HEAD(&cwq->worklist);
-	init_waitqueue_head(&cwq->more_work);
 	init_waitqueue_head(&cwq->work_done);
-
-	if (is_single_threaded(wq))
-		p = kthread_create(worker_thread, cwq, "%s", wq->name);
-	else
-		p = kthread_create(worker_thread, cwq, "%s/%d", wq->name, cpu);
-	if (IS_ERR(p))
-		return NULL;
-	cwq->thread = p;
-	return p;
 }
 
 struct workqueue_struct *__create_workqueue(const char *name,
 					    int singlethread)
 {
-	int cpu, destroy = 0;
+	int cpu;
 	struct workqueue_struct *wq;
-	struct task_struct *p;
 
 	BUG_ON(strlen(name) > 10);
 
@@ -316,73 +605,28 @@ struct workqueue_struct *__create_workqueue(const char *name,
 	memset(wq, 0, sizeof(*wq));
 
 	wq->name = name;
-	/* We don't need the distraction of CPUs appearing and vanishing. */
-	lock_cpu_hotplug();
+	wq->singlethread = singlethread;
 	if (singlethread) {
-		INIT_LIST_HEAD(&wq->list);
-		p = create_workqueue_thread(wq, 0);
-		if (!p)
-			destroy = 1;
-		else
-			wake_up_process(p);
-	} else {
-		spin_lock(&workqueue_lock);
-		list_add(&wq->list, &workqueues);
-		spin_unlock(&workqueue_lock);
-		for_each_online_cpu(cpu) {
-			p = create_workqueue_thread(wq, cpu);
-			if (p) {
-				kthread_bind(p, cpu);
-				wake_up_process(p);
-			} else
-				destroy = 1;
+		init_worker_pool(&wq->single_pool, -1);
+		init_cpu_workqueue(wq, wq->cpu_wq + 0, &wq->single_pool);
+		if (create_worker(&wq->single_pool, name) < 0) {
+			kfree(wq);
+			return NULL;
 		}
-	}
-	unlock_cpu_hotplug();
-
-	/*
-	 * Was there any error during startup? If yes then clean up:
-	 */
-	if (destroy) {
-		destroy_workqueue(wq);
-		wq = NULL;
+	} else {
+		/* The cpu pools are always there, even for offline cpus */
+		for (cpu = 0; cpu < NR_CPUS; cpu++)
+			init_cpu_workqueue(wq, wq->cpu_wq + cpu, cpu_pools + cpu);
 	}
 	return wq;
 }
 
-static void cleanup_workqueue_thread(struct workqueue_struct *wq, int cpu)
-{
-	struct cpu_workqueue_struct *cwq;
-	unsigned long flags;
-	struct task_struct *p;
-
-	cwq = wq->cpu_wq + cpu;
-	spin_lock_irqsave(&cwq->lock, flags);
-	p = cwq->thread;
-	cwq->thread = NULL;
-	spin_unlock_irqrestore(&cwq->lock, flags);
-	if (p)
-		kthread_stop(p);
-}
-
 void destroy_workqueue(struct workqueue_struct *wq)
 {
-	int cpu;
-
 	flush_workqueue(wq);
 
-	/* We don't need the distraction of CPUs appearing and vanishing. */
-	lock_cpu_hotplug();
 	if (is_single_threaded(wq))
-		cleanup_workqueue_thread(wq, 0);
-	else {
-		for_each_online_cpu(cpu)
-			cleanup_workqueue_thread(wq, cpu);
-		spin_lock(&workqueue_lock);
-		list_del(&wq->list);
-		spin_unlock(&workqueue_lock);
-	}
-	unlock_cpu_hotplug();
+		stop_pool_workers(&wq->single_pool);
 	kfree(wq);
 }
 
@@ -454,38 +698,40 @@ int keventd_up(void)
 
 int current_is_keventd(void)
 {
-	struct cpu_workqueue_struct *cwq;
-	int cpu = smp_processor_id();	/* preempt-safe: keventd is per-cpu */
-	int ret = 0;
+	struct worker *worker = current->wq_worker;
 
 	BUG_ON(!keventd_wq);
 
-	cwq = keventd_wq->cpu_wq + cpu;
-	if (current == cwq->thread)
-		ret = 1;
-
-	return ret;
-
+	return worker && worker->current_cwq &&
+		worker->current_cwq->wq == keventd_wq;
 }
 
 #ifdef CONFIG_HOTPLUG_CPU
 /* Take the work from this (downed) CPU. */
-static void take_over_work(struct workqueue_struct *wq, unsigned int cpu)
+static void take_over_work(struct worker_pool *pool)
 {
-	struct cpu_workqueue_struct *cwq = wq->cpu_wq + cpu;
-	LIST_HEAD(list);
+	struct cpu_workqueue_struct *cwq;
 	struct work_struct *work;
+	LIST_HEAD(list);
 
-	spin_lock_irq(&cwq->lock);
-	list_splice_init(&cwq->worklist, &list);
+	spin_lock_irq(&pool->lock);
+	list_splice_init(&pool->worklist, &list);
+	/* Nobody flushes the works of an offline cpu: simply let them go */
+	list_for_each_entry(work, &list, entry) {
+		cwq = work->wq_data;
+		cwq->remove_sequence++;
+	}
+	spin_unlock_irq(&pool->lock);
 
 	while (!list_empty(&list)) {
-		printk("Taking work for %s\n", wq->name);
-		work = list_entry(list.next,struct work_struct,entry);
-		list_del(&work->entry);
-		__queue_work(wq->cpu_wq + smp_processor_id(), work);
+		work = list_entry(list.next, struct work_struct, entry);
+		cwq = work->wq_data;
+		printk("Taking work for %s\n", cwq->wq->name);
+		list_del_init(&work->entry);
+		local_irq_disable();
+		__queue_work(cwq->wq->cpu_wq + smp_processor_id(), work);
+		local_irq_enable();
 	}
-	spin_unlock_irq(&cwq->lock);
 }
 
 /* We're holding the cpucontrol mutex here */
@@ -494,41 +740,24 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 				  void *hcpu)
 {
 	unsigned int hotcpu = (unsigned long)hcpu;
-	struct workqueue_struct *wq;
+	struct worker_pool *pool = cpu_pools + hotcpu;
 
 	switch (action) {
-	case CPU_UP_PREPARE:
-		/* Create a new workqueue thread for it. */
-		list_for_each_entry(wq, &workqueues, list) {
-			if (create_workqueue_thread(wq, hotcpu) < 0) {
-				printk("workqueue for %i failed\n", hotcpu);
-				return NOTIFY_BAD;
-			}
-		}
-		break;
-
 	case CPU_ONLINE:
-		/* Kick off worker threads. */
-		list_for_each_entry(wq, &workqueues, list) {
-			kthread_bind(wq->cpu_wq[hotcpu].thread, hotcpu);
-			wake_up_process(wq->cpu_wq[hotcpu].thread);
-		}
-		break;
-
-	case CPU_UP_CANCELED:
-		list_for_each_entry(wq, &workqueues, list) {
-			/* Unbind so it can run. */
-			kthread_bind(wq->cpu_wq[hotcpu].thread,
-				     smp_processor_id());
-			cleanup_workqueue_thread(wq, hotcpu);
-		}
+		/* Start the pool off with a worker. */
+		spin_lock_irq(&pool->lock);
+		pool->dead = 0;
+		spin_unlock_irq(&pool->lock);
+		if (create_worker(pool, NULL) < 0)
+			printk("workqueue for %i failed\n", hotcpu);
 		break;
 
 	case CPU_DEAD:
-		list_for_each_entry(wq, &workqueues, list)
-			cleanup_workqueue_thread(wq, hotcpu);
-		list_for_each_entry(wq, &workqueues, list)
-			take_over_work(wq, hotcpu);
+		spin_lock_irq(&pool->lock);
+		pool->dead = 1;
+		spin_unlock_irq(&pool->lock);
+		take_over_work(pool);
+		stop_pool_workers(pool);
 		break;
 	}
 
@@ -538,6 +767,12 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 
 void init_workqueues(void)
 {
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		init_worker_pool(cpu_pools + cpu, cpu);
+	for_each_online_cpu(cpu)
+		BUG_ON(create_worker(cpu_pools + cpu, NULL) < 0);
 	hotcpu_notifier(workqueue_cpu_callback, 0);
 	keventd_wq = create_workqueue("events");
 	BUG_ON(!keventd_wq);
@@ -545,6 +780,7 @@ void init_workqueues(void)
 
 EXPORT_SYMBOL_GPL(__create_workqueue);
 EXPORT_SYMBOL_GPL(queue_work);
+EXPORT_SYMBOL_GPL(queue_work_on);
 EXPORT_SYMBOL_GPL(queue_delayed_work);
 EXPORT_SYMBOL_GPL(flush_workqueue);
 EXPORT_SYMBOL_GPL(destroy_workqueue);
@@ -0,0 +1,283 @@
+/*
+ * lib/bench.c
+ *
+ * Microbenchmarks of kernel primitives, see include/linux/bench.h.
+ * crypto/tcrypt.c does the same for the ciphers.
+ *
+ * Each thread of a run is bound to its own cpu, waits for the others
+ * on a completion so that they all start together, and times its ops
+ * with get_cycles().  For each number of threads the result gives the
+ * mean cycles per operation, and the total rate as a percentage of
+ * that of one thread:
+ *
+ *	# spinlock, 1000000 ops per thread
+ *	threads 1: 38 cycles/op, speedup 100%
+ *	threads 2: 190 cycles/op, speedup 40%
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/err.h>
+#include <linux/debugfs.h>
+#include <linux/bench.h>
+#include <asm/timex.h>
+#include <asm/uaccess.h>
+#include <asm/div64.h>
+
+#define BENCH_RESULT_SIZE	PAGE_SIZE
+
+static struct dentry *bench_dir;
+
+/* Serialises the runs, and the registration of benchmarks */
+static DECLARE_MUTEX(bench_sem);
+static LIST_HEAD(bench_list);
+
+struct bench_run {
+	struct bench		*bench;
+	int			nr_threads;
+	unsigned long		ops;
+	struct completion	start, done;
+	atomic_t		running;
+};
+
+struct bench_thread {
+	struct bench_run	*run;
+	int			nr;
+	u64			cycles;
+};
+
+static int bench_thread(void *data)
+{
+	struct bench_thread *t = data;
+	struct bench_run *run = t->run;
+	cycles_t start;
+
+	wait_for_completion(&run->start);
+	start = get_cycles();
+	run->bench->run(run->bench, t->nr, run->nr_threads, run->ops);
+	t->cycles = (u64)(get_cycles() - start);
+
+	if (atomic_dec_and_test(&run->running))
+		complete(&run->done);
+	return 0;
+}
+
+/* Do ops in each of nr_threads threads, giving the mean cycles per op */
+static int bench_run_threads(struct bench *b, int nr_threads,
+			     unsigned long ops, u64 *cycles)
+{
+	struct bench_thread *threads;
+	struct task_struct *k;
+	struct bench_run run;
+	int cpu, i = 0, ret;
+	u64 total = 0;
+
+	threads = kmalloc(nr_threads * sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+	if (b->setup) {
+		ret = b->setup(b, nr_threads);
+		if (ret)
+			goto out;
+	}
+
+	run.bench = b;
+	run.nr_threads = nr_threads;
+	run.ops = ops;
+	init_completion(&run.start);
+	init_completion(&run.done);
+	atomic_set(&run.running, nr_threads);
+
+	ret = 0;
+	for_each_online_cpu(cpu) {
+		if (i == nr_threads)
+			break;
+		threads[i].run = &run;
+		threads[i].nr = i;
+		k = kthread_create(bench_thread, &threads[i], "bench/%d", cpu);
+		if (IS_ERR(k)) {
+			ret = PTR_ERR(k);
+			break;
+		}
+		kthread_bind(k, cpu);
+		wake_up_process(k);
+		i++;
+	}
+	if (ret) {
+		/* Let those already started through doing nothing */
+		run.ops = 0;
+		if (atomic_sub_and_test(nr_threads - i, &run.running))
+			complete(&run.done);
+	}
+
+	complete_all(&run.start);
+	wait_for_completion(&run.done);
+
+	if (b->teardown)
+		b->teardown(b, nr_threads);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < nr_threads; i++)
+		total += threads[i].cycles;
+	do_div(total, nr_threads);
+	do_div(total, ops);
+	*cycles = total;
+out:
+	kfree(threads);
+	return ret;
+}
+
+/* Run b with 1, 2, 4 ... threads, up to one per online cpu */
+static int bench_run(struct bench *b, unsigned long ops)
+{
+	char *buf = b->result;
+	int nr_threads, nr_cpus, len, ret = 0;
+	u64 cycles, base = 0, speedup;
+
+	lock_cpu_hotplug();
+	nr_cpus = num_online_cpus();
+	len = scnprintf(buf, BENCH_RESULT_SIZE, "# %s, %lu ops per thread\n",
+			b->name, ops);
+	for (nr_threads = 1; ; nr_threads = min(2 * nr_threads, nr_cpus)) {
+		ret = bench_run_threads(b, nr_threads, ops, &cycles);
+		if (ret)
+			break;
+		if (nr_threads == 1)
+			base = cycles;
+		speedup = 0;
+		if (cycles) {
+			speedup = base * nr_threads * 100;
+			do_div(speedup, cycles);
+		}
+		len += scnprintf(buf + len, BENCH_RESULT_SIZE - len,
+				 "threads %d: %llu cycles/op, speedup %llu%%\n",
+				 nr_threads, (unsigned long long)cycles,
+				 (unsigned long long)speedup);
+		if (nr_threads == nr_cpus)
+			break;
+	}
+	unlock_cpu_hotplug();
+
+	b->result_len = len;
+	return ret;
+}
+
+/* Is b still registered?  With bench_sem held. */
+static int bench_registered(struct bench *b)
+{
+	struct bench *p;
+
+	list_for_each_entry(p, &bench_list, list)
+		if (p == b)
+			return 1;
+	return 0;
+}
+
+static int bench_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->u.generic_ip;
+	return 0;
+}
+
+static ssize_t bench_read(struct file *file, char __user *ubuf,
+			  size_t count, loff_t *ppos)
+{
+	struct bench *b = file->private_data;
+	ssize_t ret = -ENODEV;
+
+	down(&bench_sem);
+	if (bench_registered(b))
+		ret = simple_read_from_buffer(ubuf, count, ppos, b->result,
+					      b->result_len);
+	up(&bench_sem);
+	return ret;
+}
+
+static ssize_t bench_write(struct file *file, const char __user *ubuf,
+			   size_t count, loff_t *ppos)
+{
+	struct bench *b = file->private_data;
+	unsigned long ops;
+	char buf[32];
+	int ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	ops = simple_strtoul(buf, NULL, 0);
+	if (!ops)
+		return -EINVAL;
+
+	down(&bench_sem);
+	ret = -ENODEV;
+	if (bench_registered(b))
+		ret = bench_run(b, ops);
+	up(&bench_sem);
+	return ret ? ret : count;
+}
+
+static struct file_operations bench_fops = {
+	.open		= bench_open,
+	.read		= bench_read,
+	.write		= bench_write,
+};
+
+/**
+ * bench_register - make a benchmark available in /debug/bench
+ * @b: the benchmark, with name and run set
+ */
+int bench_register(struct bench *b)
+{
+	b->result = kmalloc(BENCH_RESULT_SIZE, GFP_KERNEL);
+	if (!b->result)
+		return -ENOMEM;
+	b->result_len = 0;
+
+	down(&bench_sem);
+	b->dentry = debugfs_create_file(b->name, 0600, bench_dir, b,
+					&bench_fops);
+	if (!b->dentry) {
+		up(&bench_sem);
+		kfree(b->result);
+		return -ENOMEM;
+	}
+	list_add_tail(&b->list, &bench_list);
+	up(&bench_sem);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(bench_register);
+
+/**
+ * bench_unregister - remove a benchmark, waiting for a run of it to end
+ * @b: the benchmark
+ */
+void bench_unregister(struct bench *b)
+{
+	down(&bench_sem);
+	list_del(&b->list);
+	debugfs_remove(b->dentry);
+	up(&bench_sem);
+	kfree(b->result);
+}
+EXPORT_SYMBOL_GPL(bench_unregister);
+
+static int __init bench_init(void)
+{
+	bench_dir = debugfs_create_dir("bench", NULL);
+	return 0;
+}
+__initcall(bench_init);
@@ -0,0 +1,310 @@
+/*
+ * lib/bench_core.c
+ *
+ * Benchmarks of the allocators, locks and data structures that most of
+ * the kernel depends on, see lib/bench.c.  The lock benchmarks share
+ * one lock between all the threads, to show how it holds up under
+ * contention; the others work on data of their own, to show what the
+ * primitive itself costs and how it scales.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <linux/rcupdate.h>
+#include <linux/radix-tree.h>
+#include <linux/crc32.h>
+#include <linux/bench.h>
+
+/* Allocations made before they are all freed again */
+#define BENCH_BATCH		16
+
+#define BENCH_OBJ_SIZE		128
+#define BENCH_RADIX_STRIDE	4099	/* Spreads a batch over the tree */
+#define BENCH_CRC_LEN		1024
+
+static kmem_cache_t *bench_cachep;
+
+/* One op: a kmem_cache_alloc() and a kmem_cache_free() */
+static void bench_kmem_cache_run(struct bench *b, int nr, int nr_threads,
+				 unsigned long ops)
+{
+	void *objs[BENCH_BATCH];
+	unsigned long i;
+	int j, n;
+
+	for (i = 0; i < ops; i += n) {
+		n = min_t(unsigned long, ops - i, BENCH_BATCH);
+		for (j = 0; j < n; j++)
+			objs[j] = kmem_cache_alloc(bench_cachep, GFP_KERNEL);
+		for (j = 0; j < n; j++)
+			if (objs[j])
+				kmem_cache_free(bench_cachep, objs[j]);
+		bench_cond_resched(i);
+	}
+}
+
+/* One op: a kmalloc() and a kfree() */
+static void bench_kmalloc_run(struct bench *b, int nr, int nr_threads,
+			      unsigned long ops)
+{
+	void *objs[BENCH_BATCH];
+	unsigned long i;
+	int j, n;
+
+	for (i = 0; i < ops; i += n) {
+		n = min_t(unsigned long, ops - i, BENCH_BATCH);
+		for (j = 0; j < n; j++)
+			objs[j] = kmalloc(BENCH_OBJ_SIZE, GFP_KERNEL);
+		for (j = 0; j < n; j++)
+			kfree(objs[j]);
+		bench_cond_resched(i);
+	}
+}
+
+/* One op: the allocation and freeing of a page */
+static void bench_pages_run(struct bench *b, int nr, int nr_threads,
+			    unsigned long ops)
+{
+	struct page *pages[BENCH_BATCH];
+	unsigned long i;
+	int j, n;
+
+	for (i = 0; i < ops; i += n) {
+		n = min_t(unsigned long, ops - i, BENCH_BATCH);
+		for (j = 0; j < n; j++)
+			pages[j] = alloc_page(GFP_KERNEL);
+		for (j = 0; j < n; j++)
+			if (pages[j])
+				__free_page(pages[j]);
+		bench_cond_resched(i);
+	}
+}
+
+static spinlock_t bench_lock = SPIN_LOCK_UNLOCKED;
+static DECLARE_RWSEM(bench_rwsem);
+static unsigned long bench_counter;
+
+static void bench_spinlock_run(struct bench *b, int nr, int nr_threads,
+			       unsigned long ops)
+{
+	unsigned long i;
+
+	for (i = 0; i < ops; i++) {
+		spin_lock(&bench_lock);
+		bench_counter++;
+		spin_unlock(&bench_lock);
+		bench_cond_resched(i);
+	}
+}
+
+static void bench_rwsem_read_run(struct bench *b, int nr, int nr_threads,
+				 unsigned long ops)
+{
+	unsigned long i;
+
+	for (i = 0; i < ops; i++) {
+		down_read(&bench_rwsem);
+		up_read(&bench_rwsem);
+		bench_cond_resched(i);
+	}
+}
+
+static void bench_rwsem_write_run(struct bench *b, int nr, int nr_threads,
+				  unsigned long ops)
+{
+	unsigned long i;
+
+	for (i = 0; i < ops; i++) {
+		down_write(&bench_rwsem);
+		bench_counter++;
+		up_write(&bench_rwsem);
+		bench_cond_resched(i);
+	}
+}
+
+struct bench_rcu {
+	struct rcu_head	rcu;
+	atomic_t	*pending;
+};
+
+static void bench_rcu_free(struct rcu_head *head)
+{
+	struct bench_rcu *p = container_of(head, struct bench_rcu, rcu);
+
+	atomic_dec(p->pending);
+	kfree(p);
+}
+
+/*
+ * One op: an object freed through call_rcu().  The run lasts until the
+ * callbacks have all been called, so this is the rate RCU keeps up with.
+ */
+static void bench_call_rcu_run(struct bench *b, int nr, int nr_threads,
+			       unsigned long ops)
+{
+	atomic_t pending = ATOMIC_INIT(0);
+	struct bench_rcu *p;
+	unsigned long i;
+
+	for (i = 0; i < ops; i++) {
+		p = kmalloc(sizeof(*p), GFP_KERNEL);
+		if (!p)
+			break;
+		p->pending = &pending;
+		atomic_inc(&pending);
+		call_rcu(&p->rcu, bench_rcu_free);
+		bench_cond_resched(i);
+	}
+	while (atomic_read(&pending))
+		synchronize_kernel();
+}
+
+/* A radix tree for each thread */
+static int bench_radix_tree_setup(struct bench *b, int nr_threads)
+{
+	struct radix_tree_root *roots;
+	int i;
+
+	roots = kmalloc(nr_threads * sizeof(*roots), GFP_KERNEL);
+	if (!roots)
+		return -ENOMEM;
+	for (i = 0; i < nr_threads; i++)
+		INIT_RADIX_TREE(&roots[i], GFP_KERNEL);
+	b->private = roots;
+	return 0;
+}
+
+static void bench_free_private(struct bench *b, int nr_threads)
+{
+	kfree(b->private);
+	b->private = NULL;
+}
+
+/* One op: an item inserted, looked up and deleted */
+static void bench_radix_tree_run(struct bench *b, int nr, int nr_threads,
+				 unsigned long ops)
+{
+	struct radix_tree_root *root = (struct radix_tree_root *)b->private + nr;
+	unsigned long i;
+	int j, n;
+
+	for (i = 0; i < ops; i += n) {
+		n = min_t(unsigned long, ops - i, BENCH_BATCH);
+		for (j = 0; j < n; j++)
+			if (radix_tree_insert(root, j * BENCH_RADIX_STRIDE,
+					      root))
+				break;
+		n = j;
+		for (j = 0; j < n; j++)
+			radix_tree_lookup(root, j * BENCH_RADIX_STRIDE);
+		for (j = 0; j < n; j++)
+			radix_tree_delete(root, j * BENCH_RADIX_STRIDE);
+		if (!n)
+			break;
+		bench_cond_resched(i);
+	}
+}
+
+/* A buffer for each thread */
+static int bench_crc32_setup(struct bench *b, int nr_threads)
+{
+	b->private = kmalloc(nr_threads * BENCH_CRC_LEN, GFP_KERNEL);
+	if (!b->private)
+		return -ENOMEM;
+	memset(b->private, 0x5a, nr_threads * BENCH_CRC_LEN);
+	return 0;
+}
+
+/* One op: the crc32_le() of BENCH_CRC_LEN bytes */
+static void bench_crc32_run(struct bench *b, int nr, int nr_threads,
+			    unsigned long ops)
+{
+	unsigned char *buf = (unsigned char *)b->private + nr * BENCH_CRC_LEN;
+	unsigned long i;
+	u32 crc = ~0;
+
+	for (i = 0; i < ops; i++) {
+		crc = crc32_le(crc, buf, BENCH_CRC_LEN);
+		bench_cond_resched(i);
+	}
+	buf[0] = crc;
+}
+
+static struct bench bench_core[] = {
+	{
+		.name		= "kmem_cache",
+		.run		= bench_kmem_cache_run,
+	}, {
+		.name		= "kmalloc",
+		.run		= bench_kmalloc_run,
+	}, {
+		.name		= "alloc_pages",
+		.run		= bench_pages_run,
+	}, {
+		.name		= "spinlock",
+		.run		= bench_spinlock_run,
+	}, {
+		.name		= "rwsem_read",
+		.run		= bench_rwsem_read_run,
+	}, {
+		.name		= "rwsem_write",
+		.run		= bench_rwsem_write_run,
+	}, {
+		.name		= "call_rcu",
+		.run		= bench_call_rcu_run,
+	}, {
+		.name		= "radix_tree",
+		.setup		= bench_radix_tree_setup,
+		.teardown	= bench_free_private,
+		.run		= bench_radix_tree_run,
+	}, {
+		.name		= "crc32_le",
+		.setup		= bench_crc32_setup,
+		.teardown	= bench_free_private,
+		.run		= bench_crc32_run,
+	},
+};
+
+static int __init bench_core_init(void)
+{
+	int i, ret;
+
+	bench_cachep = kmem_cache_create("bench_cache", BENCH_OBJ_SIZE, 0, 0,
+					 NULL, NULL);
+	if (!bench_cachep)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(bench_core); i++) {
+		ret = bench_register(&bench_core[i]);
+		if (ret)
+			goto out;
+	}
+	return 0;
+out:
+	while (--i >= 0)
+		bench_unregister(&bench_core[i]);
+	kmem_cache_destroy(bench_cachep);
+	return ret;
+}
+
+static void __exit bench_core_exit(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(bench_core); i++)
+		bench_unregister(&bench_core[i]);
+	kmem_cache_destroy(bench_cachep);
+}
+
+module_init(bench_core_init);
+module_exit(bench_core_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Benchmarks of allocators, locks and data structures");
@@ -6,27 +6,120 @@
 #define CRCPOLY_LE 0xedb88320
 #define CRCPOLY_BE 0x04c11db7
 
-/* How many bits at a time to use.  Requires a table of 4<<CRC_xx_BITS bytes. */
-/* For less performance-sensitive, use 4 */
+/*
+ * How many bits at a time to use.  Up to 8 this needs a table of
+ * 4<<CRC_xx_BITS bytes.  32 and 64 take a word or two of the buffer at a
+ * time through 4 or 8 tables of 256 entries ("slice-by-4" and
+ * "slice-by-8", 4 and 8KB of tables).
+ * For less performance-sensitive, use 4
+ */
 #ifndef CRC_LE_BITS 
-# define CRC_LE_BITS 8
+# define CRC_LE_BITS 64
 #endif
 #ifndef CRC_BE_BITS
-# define CRC_BE_BITS 8
+# define CRC_BE_BITS 64
 #endif
 
 /*
  * Little-endian CRC computation.  Used with serial bit streams sent
  * lsbit-first.  Be sure to use cpu_to_le32() to append the computed CRC.
  */
-#if CRC_LE_BITS > 8 || CRC_LE_BITS < 1 || CRC_LE_BITS & CRC_LE_BITS-1
-# error CRC_LE_BITS must be a power of 2 between 1 and 8
+#if CRC_LE_BITS > 64 || CRC_LE_BITS < 1 || CRC_LE_BITS == 16 || \
+    CRC_LE_BITS & CRC_LE_BITS-1
+# error CRC_LE_BITS must be one of {1, 2, 4, 8, 32, 64}
 #endif
 
 /*
  * Big-endian CRC computation.  Used with serial bit streams sent
  * msbit-first.  Be sure to use cpu_to_be32() to append the computed CRC.
  */
-#if CRC_BE_BITS > 8 || CRC_BE_BITS < 1 || CRC_BE_BITS & CRC_BE_BITS-1
-# error CRC_BE_BITS must be a power of 2 between 1 and 8
+#if CRC_BE_BITS > 64 || CRC_BE_BITS < 1 || CRC_BE_BITS == 16 || \
+    CRC_BE_BITS & CRC_BE_BITS-1
+# error CRC_BE_BITS must be one of {1, 2, 4, 8, 32, 64}
+#endif
+
+#if CRC_LE_BITS > 8
+# define LE_TABLE_ROWS (CRC_LE_BITS / 8)
+# define LE_TABLE_SIZE 256
+#else
+# define LE_TABLE_ROWS 1
+# define LE_TABLE_SIZE (1 << CRC_LE_BITS)
 #endif
+
+#if CRC_BE_BITS > 8
+# define BE_TABLE_ROWS (CRC_BE_BITS / 8)
+# define BE_TABLE_SIZE 256
+#else
+# define BE_TABLE_ROWS 1
+# define BE_TABLE_SIZE (1 << CRC_BE_BITS)
+#endif
+
+#ifdef __KERNEL__
+/*
+ * The CRC of len bytes at buf, with tables of 256 entries: tab[0] is
+ * that of a byte, tab[k] that of a byte followed by k zero bytes.  With
+ * 4 or 8 slices a word or two of the buffer is folded into crc at a
+ * time, one lookup per byte of it in a table of its own, so the lookups
+ * do not wait on each other.  The tables and crc are kept in the byte
+ * order of the CRC (tole() or tobe()), which makes the shifts the same
+ * for crc32_le() and crc32_be().
+ */
+#ifdef __LITTLE_ENDIAN
+# define DO_CRC(x)	crc = tab[0][(crc ^ (x)) & 255] ^ (crc >> 8)
+# define DO_CRC4(q, t)	(tab[(t) + 3][(q) & 255] ^		\
+			 tab[(t) + 2][((q) >> 8) & 255] ^	\
+			 tab[(t) + 1][((q) >> 16) & 255] ^	\
+			 tab[(t)][(q) >> 24])
+#else
+# define DO_CRC(x)	crc = tab[0][((crc >> 24) ^ (x)) & 255] ^ (crc << 8)
+# define DO_CRC4(q, t)	(tab[(t)][(q) & 255] ^			\
+			 tab[(t) + 1][((q) >> 8) & 255] ^	\
+			 tab[(t) + 2][((q) >> 16) & 255] ^	\
+			 tab[(t) + 3][(q) >> 24])
+#endif
+
+static inline u32 crc32_body(u32 crc, unsigned char const *buf, size_t len,
+			     const u32 (*tab)[256], const int slices)
+{
+	const u32 *b;
+	size_t rem_len;
+	u32 q;
+
+	/* Align it */
+	if (unlikely((long)buf & 3 && len)) {
+		do {
+			DO_CRC(*buf++);
+		} while (--len && (long)buf & 3);
+	}
+
+	if (slices == 8) {
+		rem_len = len & 7;
+		len >>= 3;
+	} else if (slices == 4) {
+		rem_len = len & 3;
+		len >>= 2;
+	} else {
+		rem_len = len;
+		len = 0;
+	}
+
+	b = (const u32 *)buf;
+	for (; len; len--) {
+		q = crc ^ *b++;
+		if (slices == 8) {
+			crc = DO_CRC4(q, 4);
+			q = *b++;
+			crc ^= DO_CRC4(q, 0);
+		} else
+			crc = DO_CRC4(q, 0);
+	}
+
+	/* And the last few bytes */
+	buf = (unsigned char const *)b;
+	for (len = rem_len; len; len--)
+		DO_CRC(*buf++);
+	return crc;
+}
+#undef DO_CRC
+#undef DO_CRC4
+#endif /* __KERNEL__ */
@@ -1,14 +1,15 @@
 #include <stdio.h>
+#include <string.h>
 #include "crc32defs.h"
 #include <inttypes.h>
 
 #define ENTRIES_PER_LINE 4
 
-#define LE_TABLE_SIZE (1 << CRC_LE_BITS)
-#define BE_TABLE_SIZE (1 << CRC_BE_BITS)
+/* The Castagnoli polynomial of crc32c, reversed for little-endian */
+#define CRC32C_POLY_LE 0x82F63B78
 
-static uint32_t crc32table_le[LE_TABLE_SIZE];
-static uint32_t crc32table_be[BE_TABLE_SIZE];
+static uint32_t crc32table_le[LE_TABLE_ROWS][256];
+static uint32_t crc32table_be[BE_TABLE_ROWS][256];
 
 /**
  * crc32init_le() - allocate and initialize LE table data
@@ -16,18 +17,27 @@ static uint32_t crc32table_be[BE_TABLE_SIZE];
  * crc is the crc of the byte i; other entries are filled in based on the
  * fact that crctable[i^j] = crctable[i] ^ crctable[j].
  *
+ * Row j of a sliced table is the crc of the byte i followed by j zero
+ * bytes, that of row j - 1 run through one more byte of zeroes.
  */
-static void crc32init_le(void)
+static void crc32init_le(uint32_t polynomial)
 {
 	unsigned i, j;
 	uint32_t crc = 1;
 
-	crc32table_le[0] = 0;
+	crc32table_le[0][0] = 0;
 
-	for (i = 1 << (CRC_LE_BITS - 1); i; i >>= 1) {
-		crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
+	for (i = LE_TABLE_SIZE >> 1; i; i >>= 1) {
+		crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
 		for (j = 0; j < LE_TABLE_SIZE; j += 2 * i)
-			crc32table_le[i + j] = crc ^ crc32table_le[j];
+			crc32table_le[0][i + j] = crc ^ crc32table_le[0][j];
+	}
+	for (i = 0; i < LE_TABLE_SIZE; i++) {
+		crc = crc32table_le[0][i];
+		for (j = 1; j < LE_TABLE_ROWS; j++) {
+			crc = crc32table_le[0][crc & 0xff] ^ (crc >> 8);
+			crc32table_le[j][i] = crc;
+		}
 	}
 }
 
@@ -39,12 +49,19 @@ static void crc32init_be(void)
 	unsigned i, j;
 	uint32_t crc = 0x80000000;
 
-	crc32table_be[0] = 0;
+	crc32table_be[0][0] = 0;
 
 	for (i = 1; i < BE_TABLE_SIZE; i <<= 1) {
 		crc = (crc << 1) ^ ((crc & 0x80000000) ? CRCPOLY_BE : 0);
 		for (j = 0; j < i; j++)
-			crc32table_be[i + j] = crc ^ crc32table_be[j];
+			crc32table_be[0][i + j] = crc ^ crc32table_be[0][j];
+	}
+	for (i = 0; i < BE_TABLE_SIZE; i++) {
+		crc = crc32table_be[0][i];
+		for (j = 1; j < BE_TABLE_ROWS; j++) {
+			crc = crc32table_be[0][(crc >> 24) & 0xff] ^ (crc << 8);
+			crc32table_be[j][i] = crc;
+		}
 	}
 }
 
@@ -60,22 +77,47 @@ static void output_table(uint32_t table[], int len, char *trans)
 	printf("%s(0x%8.8xL)\n", trans, table[len - 1]);
 }
 
+static void output_rows(char *name, uint32_t (*table)[256], int rows,
+			int len, char *trans)
+{
+	int i;
+
+	printf("static const u32 %s[%d][%d] = {", name, rows, len);
+	for (i = 0; i < rows; i++) {
+		printf("{");
+		output_table(table[i], len, trans);
+		printf("}%s", i < rows - 1 ? "," : "");
+	}
+	printf("};\n");
+}
+
+/*
+ * With no argument, the tables of lib/crc32.c; with "crc32c", those of
+ * lib/libcrc32c.c.
+ */
 int main(int argc, char** argv)
 {
 	printf("/* this file is generated - do not edit */\n\n");
 
+	if (argc > 1 && !strcmp(argv[1], "crc32c")) {
+		if (CRC_LE_BITS >= 8) {
+			crc32init_le(CRC32C_POLY_LE);
+			output_rows("crc32ctable_le", crc32table_le,
+				    LE_TABLE_ROWS, LE_TABLE_SIZE, "tole");
+		}
+		return 0;
+	}
+
 	if (CRC_LE_BITS > 1) {
-		crc32init_le();
-		printf("static const u32 crc32table_le[] = {");
-		output_table(crc32table_le, LE_TABLE_SIZE, "tole");
-		printf("};\n");
+		crc32init_le(CRCPOLY_LE);
+		output_rows("crc32table_le", crc32table_le, LE_TABLE_ROWS,
+			    LE_TABLE_SIZE, "tole");
 	}
 
 	if (CRC_BE_BITS > 1) {
 		crc32init_be();
-		printf("static const u32 crc32table_be[] = {");
-		output_table(crc32table_be, BE_TABLE_SIZE, "tobe");
-		printf("};\n");
+		output_rows("crc32table_be", crc32table_be, BE_TABLE_ROWS,
+			    BE_TABLE_SIZE, "tobe");
 	}
 
 	return 0;
@@ -0,0 +1,206 @@
+/*
+ *  LZO1X Decompressor from MiniLZO
+ *
+ *  Copyright (C) 1996-2005 Markus F.X.J. Oberhumer <markus@oberhumer.com>
+ *
+ *  The full LZO package can be found at:
+ *  http://www.oberhumer.com/opensource/lzo/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/lzo.h>
+#include "lzodefs.h"
+
+/*
+ * Every read of the input, write of the output and look back into it is
+ * checked first, so that a corrupt stream gives an error and never
+ * touches memory outside the two buffers.
+ */
+#define HAVE_IP(x)	((size_t)(ip_end - ip) >= (size_t)(x))
+#define HAVE_OP(x)	((size_t)(op_end - op) >= (size_t)(x))
+#define HAVE_LB(m_pos)	((m_pos) >= out && (m_pos) < op)
+
+/* Add the zero bytes and final byte of an extended length to t */
+#define GET_LENGTH(t, base)						\
+	do {								\
+		if (!HAVE_IP(1))					\
+			goto input_overrun;				\
+		while (*ip == 0) {					\
+			t += 255;					\
+			ip++;						\
+			if (!HAVE_IP(1))				\
+				goto input_overrun;			\
+		}							\
+		t += (base) + *ip++;					\
+	} while (0)
+
+int lzo1x_decompress_safe(const unsigned char *in, size_t in_len,
+			unsigned char *out, size_t *out_len)
+{
+	const unsigned char * const ip_end = in + in_len;
+	unsigned char * const op_end = out + *out_len;
+	const unsigned char *ip = in, *m_pos;
+	unsigned char *op = out;
+	size_t t;
+
+	*out_len = 0;
+
+	/* the shortest stream is the end marker */
+	if (unlikely(in_len < 3))
+		goto input_overrun;
+
+	if (*ip > 17) {
+		t = *ip++ - 17;
+		if (t < 4)
+			goto match_next;
+		if (!HAVE_OP(t))
+			goto output_overrun;
+		if (!HAVE_IP(t + 1))
+			goto input_overrun;
+		do {
+			*op++ = *ip++;
+		} while (--t > 0);
+		goto first_literal_run;
+	}
+
+	while (HAVE_IP(1)) {
+		t = *ip++;
+		if (t >= 16)
+			goto match;
+		if (t == 0)
+			GET_LENGTH(t, 15);
+		if (!HAVE_OP(t + 3))
+			goto output_overrun;
+		if (!HAVE_IP(t + 4))
+			goto input_overrun;
+
+		t += 3;
+		do {
+			*op++ = *ip++;
+		} while (--t > 0);
+
+first_literal_run:
+		t = *ip++;
+		if (t >= 16)
+			goto match;
+
+		/* M1 straight after a literal run: 3 bytes, from further back */
+		m_pos = op - (1 + M2_MAX_OFFSET);
+		m_pos -= t >> 2;
+		if (!HAVE_IP(1))
+			goto input_overrun;
+		m_pos -= *ip++ << 2;
+		if (!HAVE_LB(m_pos))
+			goto lookbehind_overrun;
+		if (!HAVE_OP(3))
+			goto output_overrun;
+		*op++ = *m_pos++;
+		*op++ = *m_pos++;
+		*op++ = *m_pos;
+		goto match_done;
+
+		for (;;) {
+match:
+			if (t >= 64) {
+				m_pos = op - 1;
+				m_pos -= (t >> 2) & 7;
+				if (!HAVE_IP(1))
+					goto input_overrun;
+				m_pos -= *ip++ << 3;
+				t = (t >> 5) - 1;
+			} else if (t >= 32) {
+				t &= 31;
+				if (t == 0)
+					GET_LENGTH(t, 31);
+				if (!HAVE_IP(2))
+					goto input_overrun;
+				m_pos = op - 1;
+				m_pos -= (ip[0] >> 2) + (ip[1] << 6);
+				ip += 2;
+			} else if (t >= 16) {
+				m_pos = op;
+				m_pos -= (t & 8) << 11;
+				t &= 7;
+				if (t == 0)
+					GET_LENGTH(t, 7);
+				if (!HAVE_IP(2))
+					goto input_overrun;
+				m_pos -= (ip[0] >> 2) + (ip[1] << 6);
+				ip += 2;
+				if (m_pos == op)
+					goto eof_found;
+				m_pos -= 0x4000;
+			} else {
+				/* M1 after a match: 2 bytes */
+				m_pos = op - 1;
+				m_pos -= t >> 2;
+				if (!HAVE_IP(1))
+					goto input_overrun;
+				m_pos -= *ip++ << 2;
+				if (!HAVE_LB(m_pos))
+					goto lookbehind_overrun;
+				if (!HAVE_OP(2))
+					goto output_overrun;
+				*op++ = *m_pos++;
+				*op++ = *m_pos;
+				goto match_done;
+			}
+
+			/* t + 2 bytes; the copy may overlap what it writes */
+			if (!HAVE_LB(m_pos))
+				goto lookbehind_overrun;
+			if (!HAVE_OP(t + 2))
+				goto output_overrun;
+			t += 2;
+			do {
+				*op++ = *m_pos++;
+			} while (--t > 0);
+
+match_done:
+			t = ip[-2] & 3;
+			if (t == 0)
+				break;
+
+match_next:
+			if (!HAVE_OP(t))
+				goto output_overrun;
+			if (!HAVE_IP(t + 1))
+				goto input_overrun;
+			do {
+				*op++ = *ip++;
+			} while (--t > 0);
+			t = *ip++;
+		}
+	}
+
+	/* ran off the end without the end marker */
+	*out_len = op - out;
+	return LZO_E_EOF_NOT_FOUND;
+
+eof_found:
+	*out_len = op - out;
+	return (t != 1 ? LZO_E_ERROR :
+		ip == ip_end ? LZO_E_OK :
+		ip < ip_end ? LZO_E_INPUT_NOT_CONSUMED : LZO_E_INPUT_OVERRUN);
+
+input_overrun:
+	*out_len = op - out;
+	return LZO_E_INPUT_OVERRUN;
+
+output_overrun:
+	*out_len = op - out;
+	return LZO_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*out_len = op - out;
+	return LZO_E_LOOKBEHIND_OVERRUN;
+}
+EXPORT_SYMBOL_GPL(lzo1x_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZO1X Decompressor");
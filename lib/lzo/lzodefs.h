@@ -0,0 +1,58 @@
+/*
+ *  lzodefs.h -- architecture, OS and compiler specific defines
+ *
+ *  Copyright (C) 1996-2005 Markus F.X.J. Oberhumer <markus@oberhumer.com>
+ *
+ *  The full LZO package can be found at:
+ *  http://www.oberhumer.com/opensource/lzo/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+/*
+ * An LZO1X stream is a sequence of literal runs and matches, ending in
+ * an M4 match of distance 0 (bytes 0x11 0x00 0x00).  SS, the low two
+ * bits of the next to last byte of a match, is the number of literals,
+ * up to 3, that follow it without an instruction of their own.
+ *
+ *	M1	0000DDSS DDDDDDDD		2 bytes, 1-1024 back
+ *						(3, 2049-3072, after a run)
+ *	M2	LLLDDDSS DDDDDDDD		3-8 bytes, 1-2048 back
+ *	M3	001LLLLL [len] DDDDDDSS DDDDDDDD
+ *						1-16384 back
+ *	M4	0001HLLL [len] DDDDDDSS DDDDDDDD
+ *						16385-49151 back
+ *
+ * A length field of 0 is followed by zero bytes adding 255 each and a
+ * final non-zero byte adding its value.
+ */
+
+#define M1_MAX_OFFSET	0x0400
+#define M2_MAX_OFFSET	0x0800
+#define M3_MAX_OFFSET	0x4000
+#define M4_MAX_OFFSET	0xbfff
+
+#define M1_MIN_LEN	2
+#define M1_MAX_LEN	2
+#define M2_MIN_LEN	3
+#define M2_MAX_LEN	8
+#define M3_MIN_LEN	3
+#define M3_MAX_LEN	33
+#define M4_MIN_LEN	3
+#define M4_MAX_LEN	9
+
+#define M1_MARKER	0
+#define M2_MARKER	64
+#define M3_MARKER	32
+#define M4_MARKER	16
+
+/* The compressor's dictionary: a hash of the next four bytes */
+#define D_BITS		14
+#define D_MASK		((1u << D_BITS) - 1)
+#define D_HIGH		((D_MASK >> 1) + 1)
+
+#define DX2(p, s1, s2)	(((((size_t)((p)[2]) << (s2)) ^ (p)[1]) \
+							<< (s1)) ^ (p)[0])
+#define DX3(p, s1, s2, s3)	((DX2((p)+1, s2, s3) << (s1)) ^ (p)[0])
@@ -29,6 +29,7 @@
 #include <linux/gfp.h>
 #include <linux/string.h>
 #include <linux/bitops.h>
+#include <linux/rcupdate.h>
 
 
 #ifdef __KERNEL__
@@ -44,10 +45,18 @@
 #define RADIX_TREE_TAG_LONGS	\
 	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
 
+/*
+ * Lookups may walk the tree under rcu_read_lock() alone, so nodes are
+ * freed after a grace period, and each node knows its own height: such a
+ * reader never looks at root->height, which can be stale against
+ * root->rnode.  A non-empty tree always has a node at root->rnode.
+ */
 struct radix_tree_node {
 	unsigned int	count;
+	unsigned int	height;		/* Of the subtree below, leaves are 1 */
 	void		*slots[RADIX_TREE_MAP_SIZE];
 	unsigned long	tags[RADIX_TREE_TAGS][RADIX_TREE_TAG_LONGS];
+	struct rcu_head	rcu_head;
 };
 
 struct radix_tree_path {
@@ -97,10 +106,18 @@ radix_tree_node_alloc(struct radix_tree_root *root)
 	return ret;
 }
 
+static void radix_tree_node_rcu_free(struct rcu_head *head)
+{
+	struct radix_tree_node *node =
+			container_of(head, struct radix_tree_node, rcu_head);
+
+	kmem_cache_free(radix_tree_node_cachep, node);
+}
+
 static inline void
 radix_tree_node_free(struct radix_tree_node *node)
 {
-	kmem_cache_free(radix_tree_node_cachep, node);
+	call_rcu(&node->rcu_head, radix_tree_node_rcu_free);
 }
 
 /*
@@ -150,6 +167,18 @@ static inline int tag_get(struct radix_tree_node *node, int tag, int offset)
 	return test_bit(offset, &node->tags[tag][0]);
 }
 
+/* Is any slot of @node tagged with @tag? */
+static inline int any_tag_set(struct radix_tree_node *node, int tag)
+{
+	int idx;
+
+	for (idx = 0; idx < RADIX_TREE_TAG_LONGS; idx++) {
+		if (node->tags[tag][idx])
+			return 1;
+	}
+	return 0;
+}
+
 /*
  *	Return the maximum key which can be store into a
  *	radix tree with height HEIGHT.
@@ -209,7 +238,8 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 		}
 
 		node->count = 1;
-		root->rnode = node;
+		node->height = root->height + 1;
+		rcu_assign_pointer(root->rnode, node);
 		root->height++;
 	} while (height > root->height);
 out:
@@ -250,7 +280,8 @@ int radix_tree_insert(struct radix_tree_root *root,
 			/* Have to add a child node.  */
 			if (!(tmp = radix_tree_node_alloc(root)))
 				return -ENOMEM;
-			*slot = tmp;
+			tmp->height = height;
+			rcu_assign_pointer(*slot, tmp);
 			if (node)
 				node->count++;
 		}
@@ -271,45 +302,146 @@ int radix_tree_insert(struct radix_tree_root *root,
 		BUG_ON(tag_get(node, 1, offset));
 	}
 
-	*slot = item;
+	rcu_assign_pointer(*slot, item);
 	return 0;
 }
 EXPORT_SYMBOL(radix_tree_insert);
 
-/**
- *	radix_tree_lookup    -    perform lookup operation on a radix tree
- *	@root:		radix tree root
- *	@index:		index key
- *
- *	Lookup the item at the position @index in the radix tree @root.
+/*
+ * The leaf node which holds, or would hold, the item at @index, or NULL.
+ * Safe under rcu_read_lock().
  */
-void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+static struct radix_tree_node *
+radix_tree_lookup_leaf(struct radix_tree_root *root, unsigned long index)
 {
 	unsigned int height, shift;
-	struct radix_tree_node **slot;
+	struct radix_tree_node *node;
 
-	height = root->height;
+	node = rcu_dereference(root->rnode);
+	if (node == NULL)
+		return NULL;
+
+	height = node->height;
 	if (index > radix_tree_maxindex(height))
 		return NULL;
 
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
-	slot = &root->rnode;
 
-	while (height > 0) {
-		if (*slot == NULL)
+	while (--height > 0) {
+		node = rcu_dereference(node->slots[(index >> shift) &
+							RADIX_TREE_MAP_MASK]);
+		if (node == NULL)
 			return NULL;
-
-		slot = (struct radix_tree_node **)
-			((*slot)->slots +
-				((index >> shift) & RADIX_TREE_MAP_MASK));
 		shift -= RADIX_TREE_MAP_SHIFT;
-		height--;
 	}
+	return node;
+}
 
-	return *slot;
+/**
+ *	radix_tree_lookup_slot    -    lookup a slot in a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *
+ *	Returns the slot which holds, or would hold, the item at position
+ *	@index, or NULL if there is no leaf node for it.  Under
+ *	rcu_read_lock() alone, the slot stays valid until rcu_read_unlock(),
+ *	but what it holds can change under the caller at any time.
+ */
+void **radix_tree_lookup_slot(struct radix_tree_root *root, unsigned long index)
+{
+	struct radix_tree_node *node = radix_tree_lookup_leaf(root, index);
+
+	if (node == NULL)
+		return NULL;
+	return node->slots + (index & RADIX_TREE_MAP_MASK);
+}
+EXPORT_SYMBOL(radix_tree_lookup_slot);
+
+/**
+ *	radix_tree_lookup    -    perform lookup operation on a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *
+ *	Lookup the item at the position @index in the radix tree @root.
+ *	This may be called under rcu_read_lock() instead of the lock that
+ *	serialises the changes to the tree, and the item returned may then
+ *	have been deleted already.
+ */
+void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+{
+	void **slot = radix_tree_lookup_slot(root, index);
+
+	return slot ? rcu_dereference(*slot) : NULL;
 }
 EXPORT_SYMBOL(radix_tree_lookup);
 
+/**
+ *	radix_tree_next_hole    -    find the next absent index
+ *	@root:		radix tree root
+ *	@index:		index key to start from
+ *	@max_scan:	look at no more than this many indices
+ *
+ *	Returns the first index at or after @index that holds no item, or
+ *	@index + @max_scan if there is none that close, going a leaf node at
+ *	a time rather than an index at a time.  May be called under
+ *	rcu_read_lock(), like radix_tree_lookup().
+ */
+unsigned long radix_tree_next_hole(struct radix_tree_root *root,
+				unsigned long index, unsigned long max_scan)
+{
+	struct radix_tree_node *node;
+	unsigned long i = 0;
+
+	while (i < max_scan) {
+		node = radix_tree_lookup_leaf(root, index);
+		if (node == NULL)
+			break;
+		do {
+			if (node->slots[index & RADIX_TREE_MAP_MASK] == NULL)
+				return index;
+			index++;
+			i++;
+		} while ((index & RADIX_TREE_MAP_MASK) && i < max_scan);
+		if (index == 0)
+			break;		/* wraparound */
+	}
+	return index;
+}
+EXPORT_SYMBOL(radix_tree_next_hole);
+
+/**
+ *	radix_tree_prev_hole    -    find the previous absent index
+ *	@root:		radix tree root
+ *	@index:		index key to start from
+ *	@max_scan:	look at no more than this many indices
+ *
+ *	Like radix_tree_next_hole(), but looks at @index and down: returns
+ *	the first index that holds no item, or @index - @max_scan.
+ */
+unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
+				unsigned long index, unsigned long max_scan)
+{
+	struct radix_tree_node *node;
+	unsigned long i = 0;
+
+	while (i < max_scan) {
+		node = radix_tree_lookup_leaf(root, index);
+		if (node == NULL)
+			break;
+		do {
+			if (node->slots[index & RADIX_TREE_MAP_MASK] == NULL)
+				return index;
+			index--;
+			i++;
+		} while ((index & RADIX_TREE_MAP_MASK) != RADIX_TREE_MAP_MASK &&
+			 i < max_scan);
+		if (index == ~0UL)
+			break;		/* wraparound */
+	}
+	return index;
+}
+EXPORT_SYMBOL(radix_tree_prev_hole);
+
 /**
  *	radix_tree_tag_set - set a tag on a radix tree node
  *	@root:		radix tree root
@@ -413,6 +545,83 @@ out:
 }
 EXPORT_SYMBOL(radix_tree_tag_clear);
 
+/**
+ *	radix_tree_range_tag_clear - clear a tag on a range of items
+ *	@root:		radix tree root
+ *	@first:		first index key of the range
+ *	@last:		last index key of the range, inclusive
+ *	@tag: 		tag index
+ *
+ *	Clear the search tag of every item from @first to @last, and in the
+ *	nodes above that are left with no tags set, as radix_tree_tag_clear()
+ *	does for one.  A subtree whose tag is clear is stepped over whole,
+ *	and a leaf node is cleared in one go.
+ *
+ *	Returns the number of items whose tag was cleared.
+ */
+unsigned long radix_tree_range_tag_clear(struct radix_tree_root *root,
+		unsigned long first, unsigned long last, int tag)
+{
+	struct radix_tree_path path[RADIX_TREE_MAX_PATH], *pathp;
+	struct radix_tree_node *node;
+	unsigned long index = first;
+	unsigned long nr_cleared = 0;
+	unsigned int shift;
+	int offset;
+
+	if (root->rnode == NULL || first > last)
+		return 0;
+	if (last > radix_tree_maxindex(root->height))
+		last = radix_tree_maxindex(root->height);
+
+	while (index <= last) {
+		node = root->rnode;
+		pathp = path;
+		shift = (root->height - 1) * RADIX_TREE_MAP_SHIFT;
+
+		/* Go down to the leaf for index while there are tags below */
+		for ( ; shift; shift -= RADIX_TREE_MAP_SHIFT) {
+			offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+			if (!tag_get(node, tag, offset))
+				break;
+			pathp->node = node;
+			pathp->offset = offset;
+			pathp++;
+			node = node->slots[offset];
+		}
+		if (shift) {
+			index &= ~((1UL << shift) - 1);
+			index += 1UL << shift;
+			if (index == 0)
+				break;		/* 32-bit wraparound */
+			continue;
+		}
+
+		offset = index & RADIX_TREE_MAP_MASK;
+		do {
+			if (tag_get(node, tag, offset)) {
+				tag_clear(node, tag, offset);
+				nr_cleared++;
+			}
+			offset++;
+		} while (offset < RADIX_TREE_MAP_SIZE && index++ < last);
+
+		while (pathp > path && !any_tag_set(node, tag)) {
+			pathp--;
+			tag_clear(pathp->node, tag, pathp->offset);
+			node = pathp->node;
+		}
+
+		if (offset < RADIX_TREE_MAP_SIZE)
+			break;			/* Got to last */
+		index = (index | RADIX_TREE_MAP_MASK) + 1;
+		if (index == 0)
+			break;
+	}
+	return nr_cleared;
+}
+EXPORT_SYMBOL(radix_tree_range_tag_clear);
+
 #ifndef __KERNEL__	/* Only the test harness uses this at present */
 /**
  *	radix_tree_tag_get - get a tag on a radix tree node
@@ -467,17 +676,20 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 EXPORT_SYMBOL(radix_tree_tag_get);
 #endif
 
+/*
+ * Place up to max_items slots, of the present items from index up, at
+ * *results.  Safe under rcu_read_lock(): a node that has gone from under
+ * us ends the scan early, which the caller sees as *next_index.
+ */
 static unsigned int
-__lookup(struct radix_tree_root *root, void **results, unsigned long index,
+__lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
 	unsigned int max_items, unsigned long *next_index)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift;
-	unsigned int height = root->height;
-	struct radix_tree_node *slot;
+	unsigned int height = slot->height;
 
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
-	slot = root->rnode;
 
 	while (height > 0) {
 		unsigned long i = (index >> shift) & RADIX_TREE_MAP_MASK;
@@ -499,14 +711,16 @@ __lookup(struct radix_tree_root *root, void **results, unsigned long index,
 			for ( ; j < RADIX_TREE_MAP_SIZE; j++) {
 				index++;
 				if (slot->slots[j]) {
-					results[nr_found++] = slot->slots[j];
+					results[nr_found++] = slot->slots + j;
 					if (nr_found == max_items)
 						goto out;
 				}
 			}
 		}
 		shift -= RADIX_TREE_MAP_SHIFT;
-		slot = slot->slots[i];
+		slot = rcu_dereference(slot->slots[i]);
+		if (slot == NULL)
+			break;
 	}
 out:
 	*next_index = index;
@@ -514,33 +728,37 @@ out:
 }
 
 /**
- *	radix_tree_gang_lookup - perform multiple lookup on a radix tree
+ *	radix_tree_gang_lookup_slot - perform multiple slot lookup on a radix tree
  *	@root:		radix tree root
  *	@results:	where the results of the lookup are placed
  *	@first_index:	start the lookup from this key
- *	@max_items:	place up to this many items at *results
+ *	@max_items:	place up to this many slots at *results
  *
- *	Performs an index-ascending scan of the tree for present items.  Places
- *	them at *@results and returns the number of items which were placed at
- *	*@results.
- *
- *	The implementation is naive.
+ *	Like radix_tree_gang_lookup(), but places the slots of the items at
+ *	*@results, so that under rcu_read_lock() the caller can check that
+ *	an item is still there once it has got hold of it.
  */
 unsigned int
-radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
+radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 			unsigned long first_index, unsigned int max_items)
 {
-	const unsigned long max_index = radix_tree_maxindex(root->height);
+	struct radix_tree_node *node;
+	unsigned long max_index;
 	unsigned long cur_index = first_index;
 	unsigned int ret = 0;
 
+	node = rcu_dereference(root->rnode);
+	if (node == NULL)
+		return 0;
+	max_index = radix_tree_maxindex(node->height);
+
 	while (ret < max_items) {
 		unsigned int nr_found;
 		unsigned long next_index;	/* Index of next search */
 
 		if (cur_index > max_index)
 			break;
-		nr_found = __lookup(root, results + ret, cur_index,
+		nr_found = __lookup(node, results + ret, cur_index,
 					max_items - ret, &next_index);
 		ret += nr_found;
 		if (next_index == 0)
@@ -549,6 +767,39 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 	}
 	return ret;
 }
+EXPORT_SYMBOL(radix_tree_gang_lookup_slot);
+
+/**
+ *	radix_tree_gang_lookup - perform multiple lookup on a radix tree
+ *	@root:		radix tree root
+ *	@results:	where the results of the lookup are placed
+ *	@first_index:	start the lookup from this key
+ *	@max_items:	place up to this many items at *results
+ *
+ *	Performs an index-ascending scan of the tree for present items.  Places
+ *	them at *@results and returns the number of items which were placed at
+ *	*@results.  Like radix_tree_lookup(), this may be called under
+ *	rcu_read_lock().
+ *
+ *	The implementation is naive.
+ */
+unsigned int
+radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
+			unsigned long first_index, unsigned int max_items)
+{
+	unsigned int i, j, ret;
+
+	ret = radix_tree_gang_lookup_slot(root, (void ***)results,
+					first_index, max_items);
+
+	/* Drop the items deleted since */
+	for (i = j = 0; i < ret; i++) {
+		results[j] = rcu_dereference(*(void **)results[i]);
+		if (results[j])
+			j++;
+	}
+	return j;
+}
 EXPORT_SYMBOL(radix_tree_gang_lookup);
 
 /*
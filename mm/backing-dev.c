@@ -0,0 +1,162 @@
+/*
+ * mm/backing-dev.c - per-device flusher threads
+ *
+ * Every registered backing device gets a thread of its own which does its
+ * background and kupdate-style writeback, so that writeback proceeds in
+ * parallel on as many devices as there are, instead of being taken in turns
+ * by the few pdflush threads.  Writeback against unregistered devices is
+ * still done by pdflush.
+ */
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/err.h>
+#include <linux/backing-dev.h>
+#include <linux/writeback.h>
+
+/*
+ * bdi_lock protects bdi_list and ->flusher.  bdi_sem serialises thread
+ * startup and shutdown, which sleep.
+ */
+static DEFINE_SPINLOCK(bdi_lock);
+static LIST_HEAD(bdi_list);
+static DECLARE_MUTEX(bdi_sem);
+
+static int bdi_flusher(void *data)
+{
+	struct backing_dev_info *bdi = data;
+
+	current->flags |= PF_FLUSHER;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!test_bit(BDI_flush_background, &bdi->state) &&
+		    !test_bit(BDI_flush_kupdate, &bdi->state) &&
+		    !kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		if (try_to_freeze(PF_FREEZE))
+			continue;
+
+		if (test_and_clear_bit(BDI_flush_background, &bdi->state))
+			bdi_background_writeout(bdi,
+					xchg(&bdi->flush_pages, 0));
+		if (test_and_clear_bit(BDI_flush_kupdate, &bdi->state))
+			bdi_kupdate_writeout(bdi);
+	}
+	return 0;
+}
+
+/*
+ * Ask @bdi's flusher for some work.  Called under bdi_lock.
+ */
+static void __bdi_kick(struct backing_dev_info *bdi, int work, long nr_pages)
+{
+	if (work == BDI_flush_background && nr_pages > bdi->flush_pages)
+		bdi->flush_pages = nr_pages;
+	set_bit(work, &bdi->state);
+	wake_up_process(bdi->flusher);
+}
+
+/**
+ * bdi_start_writeback - start background writeback against a device
+ * @bdi: the device
+ * @nr_pages: write back at least this many pages
+ *
+ * Returns -1 if @bdi has no flusher thread, and writeback against it is
+ * up to pdflush.
+ */
+int bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages)
+{
+	int ret = -1;
+
+	spin_lock(&bdi_lock);
+	if (bdi->flusher) {
+		__bdi_kick(bdi, BDI_flush_background, nr_pages);
+		ret = 0;
+	}
+	spin_unlock(&bdi_lock);
+	return ret;
+}
+
+/*
+ * Hand @work, BDI_flush_background or BDI_flush_kupdate, to all flushers.
+ */
+void bdi_kick_flushers(int work, long nr_pages)
+{
+	struct backing_dev_info *bdi;
+
+	spin_lock(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list)
+		__bdi_kick(bdi, work, nr_pages);
+	spin_unlock(&bdi_lock);
+}
+
+/**
+ * bdi_register - start a flusher thread for a backing device
+ * @bdi: the device
+ * @name: names the thread, "flush-<name>"
+ *
+ * Registrations nest, for queues shared by several disks.  If the thread
+ * cannot be started, pdflush keeps doing the device's writeback.
+ */
+void bdi_register(struct backing_dev_info *bdi, const char *name)
+{
+	struct task_struct *tsk;
+
+	if (bdi->memory_backed)
+		return;
+
+	down(&bdi_sem);
+	if (bdi->flusher_users++)
+		goto out;
+
+	tsk = kthread_run(bdi_flusher, bdi, "flush-%s", name);
+	if (IS_ERR(tsk)) {
+		printk(KERN_WARNING "%s: cannot start flusher thread: %ld\n",
+			name, PTR_ERR(tsk));
+		bdi->flusher_users--;
+		goto out;
+	}
+
+	spin_lock(&bdi_lock);
+	bdi->flusher = tsk;
+	list_add_tail(&bdi->bdi_list, &bdi_list);
+	spin_unlock(&bdi_lock);
+out:
+	up(&bdi_sem);
+}
+EXPORT_SYMBOL(bdi_register);
+
+/**
+ * bdi_unregister - stop the flusher thread of a backing device
+ * @bdi: the device
+ */
+void bdi_unregister(struct backing_dev_info *bdi)
+{
+	struct task_struct *tsk;
+
+	down(&bdi_sem);
+	if (!bdi->flusher_users || --bdi->flusher_users)
+		goto out;
+
+	spin_lock(&bdi_lock);
+	tsk = bdi->flusher;
+	bdi->flusher = NULL;
+	list_del(&bdi->bdi_list);
+	spin_unlock(&bdi_lock);
+
+	kthread_stop(tsk);
+	clear_bit(BDI_flush_background, &bdi->state);
+	clear_bit(BDI_flush_kupdate, &bdi->state);
+out:
+	up(&bdi_sem);
+}
+EXPORT_SYMBOL(bdi_unregister);
@@ -0,0 +1,274 @@
+/*
+ * mm/compaction.c
+ *
+ * Memory compaction.  Two scanners walk a zone towards each other: the
+ * migrate scanner from the bottom takes pages in use off the LRU, the
+ * free scanner from the top takes the free pages out of movable blocks,
+ * and migrate_pages() moves the former into the latter.  What is freed
+ * at the bottom merges in the buddy allocator into high-order blocks.
+ *
+ * Compaction for an allocation stops as soon as a free page of the
+ * order wanted turns up; compaction of all zones through
+ * /proc/sys/vm/compact_memory goes on until the scanners meet.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/migrate.h>
+#include <linux/compaction.h>
+#include <linux/mm_inline.h>
+#include <linux/cpuset.h>
+#include <linux/sysctl.h>
+#include "internal.h"
+
+/* Pages taken off the LRU for each migrate_pages() */
+#define COMPACT_CLUSTER_MAX	32
+
+struct compact_control {
+	struct list_head freepages;	/* Free pages to migrate to */
+	struct list_head migratepages;	/* Pages to migrate */
+	unsigned long nr_freepages;
+	unsigned long nr_migratepages;
+	unsigned long free_pfn;		/* Lowest block taken by the free scanner */
+	unsigned long migrate_pfn;	/* Next pfn for the migrate scanner */
+	struct zone *zone;
+	int order;			/* Order wanted, or -1 for all of it */
+};
+
+static unsigned long release_freepages(struct list_head *freelist)
+{
+	struct page *page, *next;
+	unsigned long count = 0;
+
+	list_for_each_entry_safe(page, next, freelist, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Move the free scanner down a block at a time, until there are as
+ * many free pages as pages to migrate or it reaches the migrate scanner.
+ */
+static void isolate_freepages(struct compact_control *cc)
+{
+	unsigned long pfn;
+
+	while (cc->nr_freepages < cc->nr_migratepages &&
+	       cc->free_pfn > cc->migrate_pfn) {
+		pfn = (cc->free_pfn - 1) & ~(PAGEBLOCK_NR_PAGES - 1);
+		if (pfn <= cc->migrate_pfn)
+			break;
+
+		cc->nr_freepages += isolate_free_pageblock(cc->zone, pfn,
+							   &cc->freepages);
+		cc->free_pfn = pfn;
+	}
+}
+
+/* The new_page_t for migrate_pages() */
+static struct page *compaction_alloc(struct page *page, unsigned long data)
+{
+	struct compact_control *cc = (struct compact_control *)data;
+	struct page *freepage;
+
+	if (list_empty(&cc->freepages)) {
+		isolate_freepages(cc);
+		if (list_empty(&cc->freepages))
+			return NULL;
+	}
+
+	freepage = list_entry(cc->freepages.next, struct page, lru);
+	list_del(&freepage->lru);
+	cc->nr_freepages--;
+	return freepage;
+}
+
+/*
+ * Take up to COMPACT_CLUSTER_MAX pages off the LRU from the migrate
+ * scanner on, without passing the end of its block or the free scanner.
+ */
+static void isolate_migratepages(struct compact_control *cc)
+{
+	struct zone *zone = cc->zone;
+	unsigned long pfn = cc->migrate_pfn;
+	unsigned long end_pfn;
+
+	end_pfn = (pfn & ~(PAGEBLOCK_NR_PAGES - 1)) + PAGEBLOCK_NR_PAGES;
+	if (end_pfn > cc->free_pfn)
+		end_pfn = cc->free_pfn;
+
+	spin_lock_irq(&zone->lru_lock);
+	for (; pfn < end_pfn && cc->nr_migratepages < COMPACT_CLUSTER_MAX;
+	     pfn++) {
+		struct page *page;
+
+		if (!pfn_valid(pfn))
+			continue;
+		page = pfn_to_page(pfn);
+		if (!PageLRU(page) || PageCompound(page))
+			continue;
+
+		if (!TestClearPageLRU(page))
+			continue;
+		if (get_page_testone(page)) {
+			/* It is being freed elsewhere */
+			__put_page(page);
+			SetPageLRU(page);
+			continue;
+		}
+		if (PageActive(page))
+			del_page_from_active_list(zone, page);
+		else
+			del_page_from_inactive_list(zone, page);
+		list_add(&page->lru, &cc->migratepages);
+		cc->nr_migratepages++;
+	}
+	spin_unlock_irq(&zone->lru_lock);
+
+	if (!(pfn & (PAGEBLOCK_NR_PAGES - 1)))
+		inc_page_state(compact_blocks_moved);
+	cc->migrate_pfn = pfn;
+}
+
+static int compact_finished(struct compact_control *cc)
+{
+	struct zone *zone = cc->zone;
+	int order;
+
+	if (cc->free_pfn <= cc->migrate_pfn)
+		return COMPACT_COMPLETE;
+
+	if (cc->order < 0)
+		return COMPACT_CONTINUE;
+
+	for (order = cc->order; order < MAX_ORDER; order++)
+		if (zone->free_area[order].nr_free)
+			return COMPACT_PARTIAL;
+
+	return COMPACT_CONTINUE;
+}
+
+static int compact_zone(struct zone *zone, struct compact_control *cc)
+{
+	int ret;
+
+	cc->zone = zone;
+	cc->migrate_pfn = zone->zone_start_pfn;
+	cc->free_pfn = zone->zone_start_pfn + zone->spanned_pages;
+	cc->nr_freepages = 0;
+	cc->nr_migratepages = 0;
+	INIT_LIST_HEAD(&cc->freepages);
+	INIT_LIST_HEAD(&cc->migratepages);
+
+	/* Pages still in the pagevecs are not on the LRU yet */
+	lru_add_drain();
+
+	while ((ret = compact_finished(cc)) == COMPACT_CONTINUE) {
+		unsigned long nr_migrate, nr_remaining;
+
+		isolate_migratepages(cc);
+		if (!cc->nr_migratepages)
+			continue;
+
+		nr_migrate = cc->nr_migratepages;
+		nr_remaining = migrate_pages(&cc->migratepages,
+					     compaction_alloc,
+					     (unsigned long)cc);
+		putback_lru_pages(&cc->migratepages);
+		cc->nr_migratepages = 0;
+
+		add_page_state(compact_pages_moved, nr_migrate - nr_remaining);
+		if (nr_remaining)
+			add_page_state(compact_pagemigrate_failed,
+				       nr_remaining);
+
+		/* Let what was freed merge in the buddy lists */
+		drain_local_pages();
+		cond_resched();
+	}
+
+	cc->nr_freepages -= release_freepages(&cc->freepages);
+	BUG_ON(cc->nr_freepages);
+	return ret;
+}
+
+/*
+ * Whether compacting @zone can give a page of @order: there has to be
+ * room above the low watermark for the free pages to migrate into.
+ */
+static int compaction_suitable(struct zone *zone, int order)
+{
+	if (zone->free_pages < zone->pages_low + (2UL << order))
+		return COMPACT_SKIPPED;
+
+	if (zone_watermark_ok(zone, order, zone->pages_low, 0, 0, 0))
+		return COMPACT_PARTIAL;
+
+	return COMPACT_CONTINUE;
+}
+
+/**
+ * try_to_compact_pages - compact zones for a high-order allocation
+ * @zones: the zonelist of the allocation
+ * @order: the order of the allocation
+ * @gfp_mask: its gfp flags
+ *
+ * Compacts the zones in turn until one has a free page of @order.
+ * Returns COMPACT_PARTIAL if that happened, COMPACT_SKIPPED if no zone
+ * was worth compacting or the allocation cannot wait for the I/O that
+ * migration may have to do.
+ */
+int try_to_compact_pages(struct zone **zones, int order, unsigned int gfp_mask)
+{
+	struct compact_control cc;
+	struct zone *zone;
+	int rc = COMPACT_SKIPPED;
+	int status, i;
+
+	if (!order || !(gfp_mask & __GFP_FS) || !(gfp_mask & __GFP_IO))
+		return rc;
+
+	for (i = 0; (zone = zones[i]) != NULL; i++) {
+		if (!cpuset_zone_allowed(zone))
+			continue;
+
+		status = compaction_suitable(zone, order);
+		if (status == COMPACT_CONTINUE) {
+			cc.order = order;
+			status = compact_zone(zone, &cc);
+		}
+		if (status > rc)
+			rc = status;
+		if (status == COMPACT_PARTIAL)
+			break;
+	}
+
+	return rc;
+}
+
+int sysctl_compact_memory;
+
+/*
+ * sysctl_compaction_handler - compact every zone when anything is
+ *	written to /proc/sys/vm/compact_memory.
+ */
+int sysctl_compaction_handler(ctl_table *table, int write,
+	struct file *file, void __user *buffer, size_t *length, loff_t *ppos)
+{
+	struct compact_control cc;
+	struct zone *zone;
+	int ret;
+
+	ret = proc_dointvec(table, write, file, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	for_each_zone(zone) {
+		cc.order = -1;
+		compact_zone(zone, &cc);
+	}
+	return 0;
+}
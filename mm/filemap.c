@@ -28,6 +28,8 @@
 #include <linux/blkdev.h>
 #include <linux/security.h>
 #include <linux/syscalls.h>
+#include <linux/rmap.h>
+#include <linux/memcontrol.h>
 /*
  * This is needed for the following functions:
  *  - try_to_release_page
@@ -79,14 +81,14 @@
  *  ->i_sem
  *    ->i_alloc_sem             (various)
  *
- *  ->inode_lock
- *    ->sb_lock			(fs/fs-writeback.c)
- *    ->mapping->tree_lock	(__sync_single_inode)
+ *  ->sb->s_inode_wb_lock
+ *    ->inode->i_lock
+ *      ->mapping->tree_lock	(__sync_single_inode)
  *
  *  ->i_mmap_lock
- *    ->anon_vma.lock		(vma_adjust)
+ *    ->anon_vma.root->lock	(vma_adjust)
  *
- *  ->anon_vma.lock
+ *  ->anon_vma.root->lock
  *    ->page_table_lock		(anon_vma_prepare and various)
  *
  *  ->page_table_lock
@@ -96,8 +98,8 @@
  *    ->zone.lru_lock		(follow_page->mark_page_accessed)
  *    ->private_lock		(page_remove_rmap->set_page_dirty)
  *    ->tree_lock		(page_remove_rmap->set_page_dirty)
- *    ->inode_lock		(page_remove_rmap->set_page_dirty)
- *    ->inode_lock		(zap_pte_range->set_page_dirty)
+ *    ->s_inode_wb_lock		(page_remove_rmap->set_page_dirty)
+ *    ->s_inode_wb_lock		(zap_pte_range->set_page_dirty)
  *    ->private_lock		(zap_pte_range->__set_page_dirty_buffers)
  *
  *  ->task->proc_lock
@@ -131,12 +133,12 @@ void remove_from_page_cache(struct page *page)
 	write_unlock_irq(&mapping->tree_lock);
 }
 
-static int sync_page(void *word)
+/*
+ * Get the I/O the page is waiting for going.
+ */
+static void __sync_page(struct page *page)
 {
 	struct address_space *mapping;
-	struct page *page;
-
-	page = container_of((page_flags_t *)word, struct page, flags);
 
 	/*
 	 * FIXME, fercrissake.  What is this barrier here for?
@@ -145,6 +147,11 @@ static int sync_page(void *word)
 	mapping = page_mapping(page);
 	if (mapping && mapping->a_ops && mapping->a_ops->sync_page)
 		mapping->a_ops->sync_page(page);
+}
+
+static int sync_page(void *word)
+{
+	__sync_page(container_of((page_flags_t *)word, struct page, flags));
 	io_schedule();
 	return 0;
 }
@@ -362,21 +369,38 @@ int filemap_write_and_wait_range(struct address_space *mapping,
 int add_to_page_cache(struct page *page, struct address_space *mapping,
 		pgoff_t offset, int gfp_mask)
 {
-	int error = radix_tree_preload(gfp_mask & ~__GFP_HIGHMEM);
+	int error = mem_container_charge(page, gfp_mask);
 
+	if (error)
+		return error;
+	error = radix_tree_preload(gfp_mask & ~__GFP_HIGHMEM);
 	if (error == 0) {
+		/*
+		 * A lockless lookup can find the page as soon as it is in the
+		 * tree, so it has to be ready before.  The caller may hold
+		 * the page lock already, see move_from_swap_cache().
+		 */
+		int was_locked = PageLocked(page);
+
+		page_cache_get(page);
+		SetPageLocked(page);
+		page->mapping = mapping;
+		page->index = offset;
+
 		write_lock_irq(&mapping->tree_lock);
 		error = radix_tree_insert(&mapping->page_tree, offset, page);
 		if (!error) {
-			page_cache_get(page);
-			SetPageLocked(page);
-			page->mapping = mapping;
-			page->index = offset;
 			mapping->nrpages++;
 			pagecache_acct(1);
 		}
 		write_unlock_irq(&mapping->tree_lock);
 		radix_tree_preload_end();
+		if (unlikely(error)) {
+			page->mapping = NULL;
+			if (!was_locked)
+				ClearPageLocked(page);
+			page_cache_release(page);
+		}
 	}
 	return error;
 }
@@ -424,6 +448,54 @@ void fastcall wait_on_page_bit(struct page *page, int bit_nr)
 }
 EXPORT_SYMBOL(wait_on_page_bit);
 
+/*
+ * Queue an asynchronous wait: @wait is a kiocb's current->io_wait, which
+ * gets keyed to the page bit and added to the page's wait queue.  The
+ * caller backs out with -EIOCBRETRY, and the wakeup kicks the kiocb so
+ * that the operation is retried.  Returns 0 (and dequeues) if the bit
+ * has cleared meanwhile.
+ */
+static int __wait_on_page_bit_async(struct page *page, int bit_nr,
+				    wait_queue_t *wait, int lock)
+{
+	wait_queue_head_t *wqh = page_waitqueue(page);
+	struct wait_bit_queue *q = container_of(wait, struct wait_bit_queue, wait);
+
+	q->key.flags = &page->flags;
+	q->key.bit_nr = bit_nr;
+
+	/*
+	 * Not an exclusive wait even when we want the lock: the kiocb may
+	 * never come back for it (it can be cancelled), and it must not eat
+	 * the wakeup unlock_page() hands to the sleepers in __lock_page().
+	 */
+	prepare_to_wait(wqh, wait, TASK_UNINTERRUPTIBLE);
+	if (lock ? !TestSetPageLocked(page) : !test_bit(bit_nr, &page->flags)) {
+		finish_wait(wqh, wait);
+		return 0;
+	}
+	__sync_page(page);
+	return -EIOCBRETRY;
+}
+
+/*
+ * wait_on_page_bit() for the aio retry path: instead of sleeping, a kiocb
+ * is queued to be retried when the bit clears, and -EIOCBRETRY returned.
+ * A synchronous @wait (no kiocb) just sleeps.
+ */
+int fastcall wait_on_page_bit_async(struct page *page, int bit_nr,
+				    wait_queue_t *wait)
+{
+	if (is_sync_wait(wait)) {
+		wait_on_page_bit(page, bit_nr);
+		return 0;
+	}
+	if (!test_bit(bit_nr, &page->flags))
+		return 0;
+	return __wait_on_page_bit_async(page, bit_nr, wait, 0);
+}
+EXPORT_SYMBOL(wait_on_page_bit_async);
+
 /**
  * unlock_page() - unlock a locked page
  *
@@ -480,19 +552,52 @@ void fastcall __lock_page(struct page *page)
 }
 EXPORT_SYMBOL(__lock_page);
 
+/*
+ * Same as __lock_page(), but for a kiocb's @wait returns -EIOCBRETRY,
+ * with the kiocb queued to be retried, instead of sleeping.
+ */
+int fastcall __lock_page_async(struct page *page, wait_queue_t *wait)
+{
+	if (is_sync_wait(wait)) {
+		__lock_page(page);
+		return 0;
+	}
+	return __wait_on_page_bit_async(page, PG_locked, wait, 1);
+}
+EXPORT_SYMBOL(__lock_page_async);
+
+/*
+ * The page is locked, most likely for I/O.  It is no use holding on to
+ * mmap_sem while waiting for that, and so holding up whoever wants it
+ * for writing, and every other fault queued up behind them: if the
+ * fault may be retried, wait without it and let the fault start over.
+ */
+int fastcall __lock_page_or_retry(struct page *page, struct mm_struct *mm,
+				  int may_retry)
+{
+	if (!may_retry) {
+		__lock_page(page);
+		return 1;
+	}
+	up_read(&mm->mmap_sem);
+	wait_on_page_locked(page);
+	return 0;
+}
+
 /*
  * a rather lightweight function, finding and getting a reference to a
- * hashed page atomically.
+ * hashed page atomically.  It takes no lock: see page_cache_get_speculative().
  */
 struct page * find_get_page(struct address_space *mapping, unsigned long offset)
 {
-	struct page *page;
+	struct page *page = NULL;
+	void **pagep;
 
-	read_lock_irq(&mapping->tree_lock);
-	page = radix_tree_lookup(&mapping->page_tree, offset);
-	if (page)
-		page_cache_get(page);
-	read_unlock_irq(&mapping->tree_lock);
+	page_cache_read_lock(mapping);
+	pagep = radix_tree_lookup_slot(&mapping->page_tree, offset);
+	if (pagep)
+		page = page_cache_get_speculative((struct page **)pagep);
+	page_cache_read_unlock(mapping);
 	return page;
 }
 
@@ -528,32 +633,48 @@ EXPORT_SYMBOL(find_trylock_page);
  */
 struct page *find_lock_page(struct address_space *mapping,
 				unsigned long offset)
+{
+	return find_lock_page_async(mapping, offset, NULL);
+}
+
+EXPORT_SYMBOL(find_lock_page);
+
+/*
+ * find_lock_page() that returns ERR_PTR(-EIOCBRETRY) rather than sleep on
+ * the page lock when @wait is a kiocb's.
+ */
+struct page *find_lock_page_async(struct address_space *mapping,
+				unsigned long offset, wait_queue_t *wait)
 {
 	struct page *page;
+	int err;
 
-	read_lock_irq(&mapping->tree_lock);
 repeat:
-	page = radix_tree_lookup(&mapping->page_tree, offset);
+	page = find_get_page(mapping, offset);
 	if (page) {
-		page_cache_get(page);
 		if (TestSetPageLocked(page)) {
-			read_unlock_irq(&mapping->tree_lock);
-			lock_page(page);
-			read_lock_irq(&mapping->tree_lock);
-
-			/* Has the page been truncated while we slept? */
-			if (page->mapping != mapping || page->index != offset) {
-				unlock_page(page);
+			err = lock_page_async(page, wait);
+			if (err) {
 				page_cache_release(page);
-				goto repeat;
+				return ERR_PTR(err);
 			}
 		}
+
+		/*
+		 * Has the page been truncated since?  Without tree_lock,
+		 * that can happen before we get the lock as well as while
+		 * we sleep for it.
+		 */
+		if (page->mapping != mapping || page->index != offset) {
+			unlock_page(page);
+			page_cache_release(page);
+			goto repeat;
+		}
 	}
-	read_unlock_irq(&mapping->tree_lock);
 	return page;
 }
 
-EXPORT_SYMBOL(find_lock_page);
+EXPORT_SYMBOL(find_lock_page_async);
 
 /**
  * find_or_create_page - locate or add a pagecache page
@@ -615,20 +736,27 @@ EXPORT_SYMBOL(find_or_create_page);
  * The search returns a group of mapping-contiguous pages with ascending
  * indexes.  There may be holes in the indices due to not-present pages.
  *
- * find_get_pages() returns the number of pages which were found.
+ * find_get_pages() returns the number of pages which were found.  Like
+ * find_get_page(), it takes no lock.
  */
 unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 			    unsigned int nr_pages, struct page **pages)
 {
 	unsigned int i;
-	unsigned int ret;
+	unsigned int nr_found;
+	unsigned int ret = 0;
 
-	read_lock_irq(&mapping->tree_lock);
-	ret = radix_tree_gang_lookup(&mapping->page_tree,
-				(void **)pages, start, nr_pages);
-	for (i = 0; i < ret; i++)
-		page_cache_get(pages[i]);
-	read_unlock_irq(&mapping->tree_lock);
+	page_cache_read_lock(mapping);
+	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				(void ***)pages, start, nr_pages);
+	for (i = 0; i < nr_found; i++) {
+		struct page *page;
+
+		page = page_cache_get_speculative((struct page **)pages[i]);
+		if (page)	/* Else removed since */
+			pages[ret++] = page;
+	}
+	page_cache_read_unlock(mapping);
 	return ret;
 }
 
@@ -708,7 +836,6 @@ void do_generic_mapping_read(struct address_space *mapping,
 	unsigned long end_index;
 	unsigned long offset;
 	unsigned long last_index;
-	unsigned long next_index;
 	unsigned long prev_index;
 	loff_t isize;
 	struct page *cached_page;
@@ -717,7 +844,6 @@ void do_generic_mapping_read(struct address_space *mapping,
 
 	cached_page = NULL;
 	index = *ppos >> PAGE_CACHE_SHIFT;
-	next_index = index;
 	prev_index = ra.prev_page;
 	last_index = (*ppos + desc->count + PAGE_CACHE_SIZE-1) >> PAGE_CACHE_SHIFT;
 	offset = *ppos & ~PAGE_CACHE_MASK;
@@ -744,16 +870,18 @@ void do_generic_mapping_read(struct address_space *mapping,
 		nr = nr - offset;
 
 		cond_resched();
-		if (index == next_index)
-			next_index = page_cache_readahead(mapping, &ra, filp,
-					index, last_index - index);
-
 find_page:
 		page = find_get_page(mapping, index);
-		if (unlikely(page == NULL)) {
-			handle_ra_miss(mapping, &ra, index);
-			goto no_cached_page;
+		if (!page) {
+			page_cache_sync_readahead(mapping, &ra, filp,
+					index, last_index - index);
+			page = find_get_page(mapping, index);
+			if (unlikely(page == NULL))
+				goto no_cached_page;
 		}
+		if (PageReadahead(page))
+			page_cache_async_readahead(mapping, &ra, filp, page,
+					index, last_index - index);
 		if (!PageUptodate(page))
 			goto page_not_up_to_date;
 page_ok:
@@ -794,8 +922,14 @@ page_ok:
 		goto out;
 
 page_not_up_to_date:
-		/* Get exclusive access to the page ... */
-		lock_page(page);
+		/*
+		 * Get exclusive access to the page ... For aio this queues
+		 * the iocb to be retried once the page is unlocked, instead
+		 * of sleeping.
+		 */
+		error = lock_page_async(page, current->io_wait);
+		if (unlikely(error))
+			goto readpage_error;
 
 		/* Did it get unhashed before we got the lock? */
 		if (!page->mapping) {
@@ -818,7 +952,9 @@ readpage:
 			goto readpage_error;
 
 		if (!PageUptodate(page)) {
-			lock_page(page);
+			error = lock_page_async(page, current->io_wait);
+			if (unlikely(error))
+				goto readpage_error;
 			if (!PageUptodate(page)) {
 				if (page->mapping == NULL) {
 					/*
@@ -863,7 +999,10 @@ readpage:
 		goto page_ok;
 
 readpage_error:
-		/* UHHUH! A synchronous read error occurred. Report it */
+		/*
+		 * UHHUH! A synchronous read error occurred, or the iocb has
+		 * to wait for the read to complete. Report it
+		 */
 		desc->error = error;
 		page_cache_release(page);
 		goto out;
@@ -894,6 +1033,7 @@ no_cached_page:
 	}
 
 out:
+	ra.prev_page = prev_index;
 	*_ra = ra;
 
 	*ppos = ((loff_t) index << PAGE_CACHE_SHIFT) + offset;
@@ -1017,6 +1157,9 @@ __generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 				retval = desc.error;
 				break;
 			}
+			/* A short segment must not be followed by the next one */
+			if (desc.error)
+				break;
 		}
 	}
 out:
@@ -1177,6 +1320,7 @@ struct page * filemap_nopage(struct vm_area_struct * area, unsigned long address
 	struct page *page;
 	unsigned long size, pgoff, endoff;
 	int did_readaround = 0, majmin = VM_FAULT_MINOR;
+	int may_retry = type && *type == VM_FAULT_RETRY;
 
 	pgoff = ((address - area->vm_start) >> PAGE_CACHE_SHIFT) + area->vm_pgoff;
 	endoff = ((area->vm_end - area->vm_start) >> PAGE_CACHE_SHIFT) + area->vm_pgoff;
@@ -1197,15 +1341,6 @@ retry_all:
 	if (size > endoff)
 		size = endoff;
 
-	/*
-	 * The readahead code wants to be told about each and every page
-	 * so it can build and shrink its windows appropriately
-	 *
-	 * For sequential accesses, we use the generic readahead logic.
-	 */
-	if (VM_SequentialReadHint(area))
-		page_cache_readahead(mapping, ra, file, pgoff, 1);
-
 	/*
 	 * Do we have something in the page cache already?
 	 */
@@ -1214,9 +1349,17 @@ retry_find:
 	if (!page) {
 		unsigned long ra_pages;
 
+		/*
+		 * For sequential accesses, we use the generic readahead
+		 * logic: it is told about misses and about hitting marked
+		 * pages below.
+		 */
 		if (VM_SequentialReadHint(area)) {
-			handle_ra_miss(mapping, ra, pgoff);
-			goto no_cached_page;
+			page_cache_sync_readahead(mapping, ra, file, pgoff, 1);
+			page = find_get_page(mapping, pgoff);
+			if (!page)
+				goto no_cached_page;
+			goto found_page;
 		}
 		ra->mmap_miss++;
 
@@ -1252,6 +1395,14 @@ retry_find:
 	if (!did_readaround)
 		ra->mmap_hit++;
 
+found_page:
+	if (VM_SequentialReadHint(area)) {
+		if (PageReadahead(page))
+			page_cache_async_readahead(mapping, ra, file, page,
+					pgoff, 1);
+		ra->prev_page = pgoff;
+	}
+
 	/*
 	 * Ok, found a page in the page cache, now we need to check
 	 * that it's up-to-date.
@@ -1306,7 +1457,10 @@ page_not_uptodate:
 		majmin = VM_FAULT_MAJOR;
 		inc_page_state(pgmajfault);
 	}
-	lock_page(page);
+	if (!lock_page_or_retry(page, area->vm_mm, may_retry)) {
+		page_cache_release(page);
+		return NOPAGE_RETRY;
+	}
 
 	/* Did it get unhashed while we waited for it? */
 	if (!page->mapping) {
@@ -1516,9 +1670,100 @@ repeat:
 	return 0;
 }
 
+/*
+ * Pages around a read fault on a file mapping which filemap_map_pages()
+ * maps at the same time, if they are ready in the page cache.
+ */
+int fault_around_pages = 16;
+
+/*
+ * Fault-around: after do_no_page() has mapped the page faulted on, map those
+ * pages of the surrounding window which are uptodate in the page cache and
+ * not busy, saving the minor faults on them.  Nothing is read or waited for.
+ *
+ * Called with page_table_lock held, and with truncate_count confirmed
+ * under it: a truncation from now on zaps these ptes after we are done.
+ * The ptes are made old, so that the speculatively mapped pages do not
+ * look referenced to reclaim until they are, and readahead-marked pages
+ * are left to fault, so that they still trigger mmap readahead.
+ */
+void filemap_map_pages(struct vm_area_struct *vma, unsigned long address,
+		       pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	struct page *pages[FAULT_AROUND_MAX];
+	unsigned long nr = fault_around_pages;
+	unsigned long start, end, pgoff, size;
+	unsigned int i, found;
+	int mapped = 0;
+
+	if (nr > FAULT_AROUND_MAX)
+		nr = FAULT_AROUND_MAX;
+	if (nr <= 1 || (vma->vm_flags & VM_NONLINEAR))
+		return;
+
+	start = address - (((address >> PAGE_SHIFT) % nr) << PAGE_SHIFT);
+	end = start + (nr << PAGE_SHIFT);
+	if (start < (address & PMD_MASK))
+		start = address & PMD_MASK;
+	if (end > (address & PMD_MASK) + PMD_SIZE)
+		end = (address & PMD_MASK) + PMD_SIZE;
+	if (start < vma->vm_start)
+		start = vma->vm_start;
+	if (end > vma->vm_end)
+		end = vma->vm_end;
+
+	pgoff = vma->vm_pgoff + ((start - vma->vm_start) >> PAGE_SHIFT);
+	size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1) >>
+							PAGE_CACHE_SHIFT;
+	found = find_get_pages(mapping, pgoff, (end - start) >> PAGE_SHIFT,
+			       pages);
+
+	for (i = 0; i < found; i++) {
+		struct page *page = pages[i];
+		unsigned long addr;
+		pte_t *pte, entry;
+
+		addr = start + ((page->index - pgoff) << PAGE_SHIFT);
+		if (addr >= end || page->index >= size ||
+		    !PageUptodate(page) || PageReadahead(page) ||
+		    PageReserved(page) || TestSetPageLocked(page))
+			goto skip;
+		if (page->mapping != mapping || !PageUptodate(page)) {
+			unlock_page(page);
+			goto skip;
+		}
+
+		pte = pte_offset_map(pmd, addr);
+		if (!pte_none(*pte)) {
+			pte_unmap(pte);
+			unlock_page(page);
+			goto skip;
+		}
+		++mm->rss;
+		flush_icache_page(vma, page);
+		entry = pte_mkold(mk_pte(page, vma->vm_page_prot));
+		set_pte_at(mm, addr, pte, entry);
+		page_add_file_rmap(page);
+		pte_unmap(pte);
+		update_mmu_cache(vma, addr, entry);
+		unlock_page(page);
+		mapped++;
+		/* The pte keeps the reference find_get_pages() took */
+		continue;
+skip:
+		page_cache_release(page);
+	}
+	if (mapped)
+		mod_page_state(pgfaultaround, mapped);
+}
+EXPORT_SYMBOL(filemap_map_pages);
+
 struct vm_operations_struct generic_file_vm_ops = {
 	.nopage		= filemap_nopage,
 	.populate	= filemap_populate,
+	.map_pages	= filemap_map_pages,
 };
 
 /* This is used for a general mmap of a disk file */
@@ -1639,7 +1884,8 @@ EXPORT_SYMBOL(read_cache_page);
 /*
  * If the page was newly created, increment its refcount and add it to the
  * caller's lru-buffering pagevec.  This function is specifically for
- * generic_file_write().
+ * generic_file_write().  An aio write gets ERR_PTR(-EIOCBRETRY) rather than
+ * wait for a locked page.
  */
 static inline struct page *
 __grab_cache_page(struct address_space *mapping, unsigned long index,
@@ -1648,24 +1894,24 @@ __grab_cache_page(struct address_space *mapping, unsigned long index,
 	int err;
 	struct page *page;
 repeat:
-	page = find_lock_page(mapping, index);
+	page = find_lock_page_async(mapping, index, current->io_wait);
 	if (!page) {
 		if (!*cached_page) {
 			*cached_page = page_cache_alloc(mapping);
 			if (!*cached_page)
-				return NULL;
+				return ERR_PTR(-ENOMEM);
 		}
 		err = add_to_page_cache(*cached_page, mapping,
 					index, GFP_KERNEL);
 		if (err == -EEXIST)
 			goto repeat;
-		if (err == 0) {
-			page = *cached_page;
-			page_cache_get(page);
-			if (!pagevec_add(lru_pvec, page))
-				__pagevec_lru_add(lru_pvec);
-			*cached_page = NULL;
-		}
+		if (err)
+			return ERR_PTR(err);
+		page = *cached_page;
+		page_cache_get(page);
+		if (!pagevec_add(lru_pvec, page))
+			__pagevec_lru_add(lru_pvec);
+		*cached_page = NULL;
 	}
 	return page;
 }
@@ -1974,8 +2220,8 @@ generic_file_buffered_write(struct kiocb *iocb, const struct iovec *iov,
 		fault_in_pages_readable(buf, bytes);
 
 		page = __grab_cache_page(mapping,index,&cached_page,&lru_pvec);
-		if (!page) {
-			status = -ENOMEM;
+		if (IS_ERR(page)) {
+			status = PTR_ERR(page);
 			break;
 		}
 
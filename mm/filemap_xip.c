@@ -0,0 +1,248 @@
+/*
+ *	linux/mm/filemap_xip.c
+ *
+ * Execute in place: read, write and mmap of a file straight from the
+ * memory of the block device under it, with no page cache in between.
+ * A page of such a file is the page of device memory that holds its
+ * block, as found by the get_xip_page() method of its address_space:
+ *
+ *	get_xip_page(mapping, sector, create)
+ *
+ * returns the page holding the given 512-byte sector of the file,
+ * allocating a block for it if create is set, or ERR_PTR(-ENODATA) for
+ * a hole.  The filesystem block has to be a page.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/module.h>
+#include <linux/uio.h>
+#include <linux/mman.h>
+#include <linux/sched.h>
+#include <linux/err.h>
+#include <asm/uaccess.h>
+#include <asm/tlbflush.h>
+
+#define xip_sector(index)	((sector_t)(index) << (PAGE_CACHE_SHIFT - 9))
+
+ssize_t xip_file_read(struct file *filp, char __user *buf, size_t len,
+		      loff_t *ppos)
+{
+	struct address_space *mapping = filp->f_mapping;
+	struct inode *inode = mapping->host;
+	loff_t pos = *ppos, isize;
+	ssize_t copied = 0;
+	int error = 0;
+
+	BUG_ON(!mapping->a_ops->get_xip_page);
+
+	isize = i_size_read(inode);
+	if (pos >= isize)
+		goto out;
+	if (len > isize - pos)
+		len = isize - pos;
+
+	while (len) {
+		unsigned long index = pos >> PAGE_CACHE_SHIFT;
+		unsigned long offset = pos & ~PAGE_CACHE_MASK;
+		unsigned long nr, left;
+		struct page *page;
+
+		nr = PAGE_CACHE_SIZE - offset;
+		if (nr > len)
+			nr = len;
+
+		page = mapping->a_ops->get_xip_page(mapping, xip_sector(index),
+						    0);
+		if (!IS_ERR(page))
+			left = copy_to_user(buf, page_address(page) + offset,
+					    nr);
+		else if (PTR_ERR(page) == -ENODATA)
+			/* A hole reads as zeroes */
+			left = clear_user(buf, nr);
+		else {
+			error = PTR_ERR(page);
+			break;
+		}
+
+		nr -= left;
+		copied += nr;
+		pos += nr;
+		buf += nr;
+		len -= nr;
+		if (left) {
+			error = -EFAULT;
+			break;
+		}
+		cond_resched();
+	}
+	*ppos = pos;
+out:
+	file_accessed(filp);
+	return copied ? copied : error;
+}
+EXPORT_SYMBOL_GPL(xip_file_read);
+
+static ssize_t __xip_file_write(struct file *filp, const char __user *buf,
+				size_t count, loff_t pos, loff_t *ppos)
+{
+	struct address_space *mapping = filp->f_mapping;
+	struct inode *inode = mapping->host;
+	ssize_t written = 0;
+	long status = 0;
+
+	while (count) {
+		unsigned long index = pos >> PAGE_CACHE_SHIFT;
+		unsigned long offset = pos & ~PAGE_CACHE_MASK;
+		unsigned long bytes, left;
+		struct page *page;
+
+		bytes = PAGE_CACHE_SIZE - offset;
+		if (bytes > count)
+			bytes = count;
+
+		page = mapping->a_ops->get_xip_page(mapping, xip_sector(index),
+						    1);
+		if (IS_ERR(page)) {
+			status = PTR_ERR(page);
+			break;
+		}
+
+		left = copy_from_user(page_address(page) + offset, buf, bytes);
+		flush_dcache_page(page);
+
+		bytes -= left;
+		written += bytes;
+		count -= bytes;
+		pos += bytes;
+		buf += bytes;
+		if (left) {
+			status = -EFAULT;
+			break;
+		}
+		cond_resched();
+	}
+
+	*ppos = pos;
+	if (pos > inode->i_size) {
+		i_size_write(inode, pos);
+		mark_inode_dirty(inode);
+	}
+	return written ? written : status;
+}
+
+ssize_t xip_file_write(struct file *filp, const char __user *buf, size_t len,
+		       loff_t *ppos)
+{
+	struct address_space *mapping = filp->f_mapping;
+	struct inode *inode = mapping->host;
+	size_t count = len;
+	loff_t pos = *ppos;
+	ssize_t ret;
+
+	BUG_ON(!mapping->a_ops->get_xip_page);
+
+	if (!access_ok(VERIFY_READ, buf, len))
+		return -EFAULT;
+
+	down(&inode->i_sem);
+	ret = generic_write_checks(filp, &pos, &count, S_ISBLK(inode->i_mode));
+	if (ret || !count)
+		goto out;
+	ret = remove_suid(filp->f_dentry);
+	if (ret)
+		goto out;
+	inode_update_time(inode, 1);
+
+	ret = __xip_file_write(filp, buf, count, pos, ppos);
+out:
+	up(&inode->i_sem);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(xip_file_write);
+
+/*
+ * The device page itself is mapped, and a write lands on the device.
+ * A hole is given a block when it is faulted in a mapping that can
+ * write the file back; elsewhere it is mapped as the zero page, which a
+ * later write() to the file does not replace in mappings that already
+ * have it.
+ */
+static struct page *xip_file_nopage(struct vm_area_struct *area,
+				    unsigned long address, int *type)
+{
+	struct file *file = area->vm_file;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	unsigned long pgoff, size;
+	struct page *page;
+	int create;
+
+	pgoff = ((address - area->vm_start) >> PAGE_CACHE_SHIFT) +
+		area->vm_pgoff;
+	size = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	if (pgoff >= size)
+		return NOPAGE_SIGBUS;
+
+	create = (area->vm_flags & (VM_SHARED | VM_MAYWRITE)) ==
+		 (VM_SHARED | VM_MAYWRITE);
+	page = mapping->a_ops->get_xip_page(mapping, xip_sector(pgoff), create);
+	if (IS_ERR(page)) {
+		if (PTR_ERR(page) == -ENOMEM)
+			return NOPAGE_OOM;
+		if (PTR_ERR(page) != -ENODATA)
+			return NOPAGE_SIGBUS;
+		page = ZERO_PAGE(address);
+	}
+
+	page_cache_get(page);
+	if (type)
+		*type = VM_FAULT_MINOR;
+	return page;
+}
+
+static struct vm_operations_struct xip_file_vm_ops = {
+	.nopage		= xip_file_nopage,
+};
+
+int xip_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	BUG_ON(!file->f_mapping->a_ops->get_xip_page);
+
+	file_accessed(file);
+	vma->vm_ops = &xip_file_vm_ops;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(xip_file_mmap);
+
+/*
+ * Zero the rest of the block at from, truncate_page() without the page
+ * cache.  Nothing to do in a hole.
+ */
+int xip_truncate_page(struct address_space *mapping, loff_t from)
+{
+	unsigned long index = from >> PAGE_CACHE_SHIFT;
+	unsigned offset = from & (PAGE_CACHE_SIZE - 1);
+	unsigned blocksize, length;
+	struct page *page;
+
+	BUG_ON(!mapping->a_ops->get_xip_page);
+
+	blocksize = 1 << mapping->host->i_blkbits;
+	length = offset & (blocksize - 1);
+	if (!length)
+		return 0;
+	length = blocksize - length;
+
+	page = mapping->a_ops->get_xip_page(mapping, xip_sector(index), 0);
+	if (IS_ERR(page))
+		return PTR_ERR(page) == -ENODATA ? 0 : PTR_ERR(page);
+
+	memset(page_address(page) + offset, 0, length);
+	flush_dcache_page(page);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(xip_truncate_page);
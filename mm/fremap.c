@@ -43,8 +43,12 @@ static inline void zap_pte(struct mm_struct *mm, struct vm_area_struct *vma,
 			}
 		}
 	} else {
-		if (!pte_file(pte))
-			free_swap_and_cache(pte_to_swp_entry(pte));
+		if (!pte_file(pte)) {
+			swp_entry_t entry = pte_to_swp_entry(pte);
+
+			if (!is_migration_entry(entry))
+				free_swap_and_cache(entry);
+		}
 		pte_clear(mm, addr, ptep);
 	}
 }
@@ -0,0 +1,679 @@
+/*
+ *  mm/huge_memory.c
+ *
+ *  Transparent huge pages for anonymous memory.
+ *
+ *  An aligned HPAGE_PMD_SIZE extent of a VM_HUGEPAGE vma is mapped by a
+ *  single pmd, either at fault time or later by khugepaged, which
+ *  collapses extents that were faulted in with small pages.  Anything
+ *  that needs to work on individual ptes (COW, mprotect, mremap, reclaim)
+ *  splits the pmd back into an ordinary page table first.
+ *
+ *  Shared file mappings marked VM_HUGEPAGE (tmpfs mounted with huge=1,
+ *  SysV shm with vm.shmem_huge) get a huge pmd when the extent is found
+ *  backed by the subpages of one huge page in the page cache.
+ */
+
+#include <linux/mm.h>
+#include <linux/huge_mm.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/memcontrol.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/init.h>
+
+#include <asm/pgalloc.h>
+#include <asm/tlb.h>
+#include <asm/tlbflush.h>
+
+#define GFP_TRANSHUGE	(GFP_HIGHUSER | __GFP_NOWARN | __GFP_NORETRY)
+
+/* Tunables, see Documentation/sysctl/vm.txt */
+int khugepaged_pages_to_scan = HPAGE_PMD_NR * 8;
+int khugepaged_scan_sleep_millisecs = 10000;
+int khugepaged_max_ptes_none = HPAGE_PMD_NR - 1;
+
+/* mms with VM_HUGEPAGE vmas, protected by mmlist_lock */
+static LIST_HEAD(khugepaged_mm_list);
+static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
+
+/*
+ * The huge page is a plain high-order allocation: give every subpage its
+ * own reference so that it can be unmapped, reclaimed and freed alone.
+ */
+static struct page *alloc_hugepage(void)
+{
+	struct page *page;
+	int i;
+
+	page = alloc_pages(GFP_TRANSHUGE, HPAGE_PMD_ORDER);
+	if (!page)
+		return NULL;
+	for (i = 1; i < HPAGE_PMD_NR; i++)
+		set_page_count(page + i, 1);
+	return page;
+}
+
+static void free_hugepage(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		__free_page(page + i);
+}
+
+/*
+ * Every huge pmd has an empty page table set aside on mm->huge_pgtables,
+ * accounted in nr_ptes as if it were in use, so that splitting the pmd
+ * never has to allocate.  Called with page_table_lock held.
+ */
+static void deposit_pgtable(struct mm_struct *mm, struct page *pgtable)
+{
+	list_add(&pgtable->lru, &mm->huge_pgtables);
+}
+
+static struct page *withdraw_pgtable(struct mm_struct *mm)
+{
+	struct page *pgtable;
+
+	BUG_ON(list_empty(&mm->huge_pgtables));
+	pgtable = list_entry(mm->huge_pgtables.next, struct page, lru);
+	list_del(&pgtable->lru);
+	return pgtable;
+}
+
+static pmd_t mk_huge_pmd(struct page *page, struct vm_area_struct *vma)
+{
+	pmd_t entry;
+
+	entry = pmd_mkhuge(pfn_pmd(page_to_pfn(page), vma->vm_page_prot));
+	entry = __pmd(pmd_val(entry) & __supported_pte_mask);
+	entry = pmd_mkyoung(entry);
+	if (vma->vm_flags & VM_WRITE)
+		entry = pmd_mkdirty(pmd_mkwrite(entry));
+	return entry;
+}
+
+/*
+ * Map the extent around @address with a freshly zeroed huge page.
+ * Called and returns with page_table_lock held, but drops it to
+ * allocate.  Returns 0 if the caller should fall back to small pages.
+ */
+int do_huge_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pmd_t *pmd, int write_access)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page, *pgtable;
+	int i;
+
+	spin_unlock(&mm->page_table_lock);
+	if (unlikely(anon_vma_prepare(vma)))
+		goto oom;
+	page = alloc_hugepage();
+	if (!page)
+		goto fallback;
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		/* Subpages already charged are uncharged as they are freed */
+		if (mem_container_charge(page + i, GFP_KERNEL)) {
+			free_hugepage(page);
+			goto fallback;
+		}
+	}
+	pgtable = pte_alloc_one(mm, haddr);
+	if (!pgtable) {
+		free_hugepage(page);
+		goto oom;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		/* Somebody else faulted the extent in: retry the access */
+		pte_free(pgtable);
+		free_hugepage(page);
+		return VM_FAULT_MINOR;
+	}
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		lru_cache_add_active(page + i);
+		page_add_anon_rmap(page + i, vma, haddr + i * PAGE_SIZE);
+	}
+	mm->rss += HPAGE_PMD_NR;
+	mm->nr_ptes++;
+	inc_page_state(nr_page_table_pages);
+	deposit_pgtable(mm, pgtable);
+	set_pmd(pmd, mk_huge_pmd(page, vma));
+	if (mm == current->mm)
+		task_numa_fault(current, page_to_nid(page));
+	inc_page_state(thp_fault_alloc);
+	return VM_FAULT_MINOR;
+
+fallback:
+	inc_page_state(thp_fault_fallback);
+	spin_lock(&mm->page_table_lock);
+	return 0;
+oom:
+	spin_lock(&mm->page_table_lock);
+	return VM_FAULT_OOM;
+}
+
+/*
+ * Map the extent around @address of a shared file mapping with one pmd,
+ * if ->nopage() finds it backed by all the subpages of one huge page.
+ * Called and returns with page_table_lock held, but drops it meanwhile.
+ * Returns 0 if the caller should fall back to ptes.
+ */
+int do_huge_file_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pmd_t *pmd, int write_access)
+{
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	unsigned long offset = (address - haddr) >> PAGE_SHIFT;
+	unsigned long pgoff;
+	struct page *page, *head, *pgtable;
+	unsigned int sequence;
+	int ret = VM_FAULT_MINOR;
+	int i, nr = 0;
+
+	pgoff = vma->vm_pgoff + ((haddr - vma->vm_start) >> PAGE_SHIFT);
+
+	spin_unlock(&mm->page_table_lock);
+	sequence = mapping->truncate_count;
+	smp_rmb(); /* serializes i_size against truncate_count */
+
+	page = vma->vm_ops->nopage(vma, address & PAGE_MASK, &ret);
+	if (page == NOPAGE_SIGBUS || page == NOPAGE_OOM)
+		goto fallback;	/* let do_no_page() report it */
+	if ((page_to_pfn(page) & (HPAGE_PMD_NR - 1)) != offset) {
+		page_cache_release(page);
+		goto fallback;
+	}
+
+	/* Take a reference to each subpage, as the ptes would */
+	head = page - offset;
+	for (i = 0; i < HPAGE_PMD_NR; i++, nr++) {
+		struct page *p;
+
+		if (i == offset)
+			continue;
+		p = find_get_page(mapping, pgoff + i);
+		if (p != head + i || !PageUptodate(p)) {
+			if (p)
+				page_cache_release(p);
+			goto release;
+		}
+	}
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (!pgtable)
+		goto release;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd) ||
+		     sequence != mapping->truncate_count)) {
+		/* Raced with another fault or with truncation: retry */
+		pte_free(pgtable);
+		ret = VM_FAULT_MINOR;
+		goto release_locked;
+	}
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_file_rmap(head + i);
+	mm->rss += HPAGE_PMD_NR;
+	mm->nr_ptes++;
+	inc_page_state(nr_page_table_pages);
+	deposit_pgtable(mm, pgtable);
+	set_pmd(pmd, mk_huge_pmd(head, vma));
+	inc_page_state(thp_file_mapped);
+	return ret;
+
+release:
+	spin_lock(&mm->page_table_lock);
+	ret = 0;
+release_locked:
+	for (i = 0; i < nr; i++)
+		if (i != offset)
+			page_cache_release(head + i);
+	page_cache_release(page);
+	return ret;
+
+fallback:
+	spin_lock(&mm->page_table_lock);
+	return 0;
+}
+
+/*
+ * fork: share the huge page with the child, write protected in both if
+ * it is COW.  A write fault then splits the pmd and copies one page.
+ *
+ * dst->page_table_lock is held on entry and exit, but dropped to
+ * allocate the child's spare page table.  Returns 1 if the src pmd was
+ * split meanwhile, or the range does not cover all of it, and the caller
+ * has to copy ptes instead.
+ */
+int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long vm_flags = vma->vm_flags;
+	struct page *page, *pgtable;
+	pmd_t pmd;
+	int i;
+
+	if ((addr & ~HPAGE_PMD_MASK) || end - addr != HPAGE_PMD_SIZE) {
+		spin_lock(&src_mm->page_table_lock);
+		split_huge_pmd(src_mm, src_pmd, addr);
+		spin_unlock(&src_mm->page_table_lock);
+		return 1;
+	}
+
+	spin_unlock(&dst_mm->page_table_lock);
+	pgtable = pte_alloc_one(dst_mm, addr);
+	spin_lock(&dst_mm->page_table_lock);
+	if (!pgtable)
+		return -ENOMEM;
+
+	spin_lock(&src_mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*src_pmd))) {
+		spin_unlock(&src_mm->page_table_lock);
+		pte_free(pgtable);
+		return 1;
+	}
+	if ((vm_flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE)
+		pmdp_set_wrprotect(src_pmd);
+	pmd = pmd_mkold(*src_pmd);
+
+	page = pmd_page(pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		get_page(page + i);
+		page_dup_rmap(page + i);
+	}
+	dst_mm->rss += HPAGE_PMD_NR;
+	if (PageAnon(page))
+		dst_mm->anon_rss += HPAGE_PMD_NR;
+	dst_mm->nr_ptes++;
+	inc_page_state(nr_page_table_pages);
+	deposit_pgtable(dst_mm, pgtable);
+	set_pmd(dst_pmd, pmd);
+	spin_unlock(&src_mm->page_table_lock);
+	return 0;
+}
+
+/*
+ * Unmap a whole huge pmd, called from zap_pmd_range() with
+ * page_table_lock held.
+ */
+void zap_huge_pmd(struct mmu_gather *tlb, pmd_t *pmd)
+{
+	struct mm_struct *mm = tlb->mm;
+	pmd_t orig = *pmd;
+	struct page *page = pmd_page(orig);
+	int i;
+
+	pmd_clear(pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++, page++) {
+		if (pmd_dirty(orig))
+			set_page_dirty(page);
+		if (PageAnon(page))
+			mm->anon_rss--;
+		else if (pmd_young(orig))
+			mark_page_accessed(page);
+		tlb->freed++;
+		page_remove_rmap(page);
+		tlb_remove_page(tlb, page);
+	}
+	dec_page_state(nr_page_table_pages);
+	mm->nr_ptes--;
+	pte_free_tlb(tlb, withdraw_pgtable(mm));
+}
+
+struct page *follow_trans_huge_pmd(pmd_t *pmd, unsigned long address,
+		int write)
+{
+	struct page *page;
+
+	if (write && !pmd_write(*pmd))
+		return NULL;
+	page = huge_pmd_page(*pmd, address);
+	mark_page_accessed(page);
+	return page;
+}
+
+/*
+ * The young bit of a huge pmd stands for all of its subpages: the first
+ * one reclaim looks at takes it.  Called with page_table_lock held.
+ */
+int page_referenced_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long address)
+{
+	if (!pmdp_test_and_clear_young(pmd))
+		return 0;
+	flush_tlb_page(vma, address);
+	return 1;
+}
+
+/*
+ * Replace the huge pmd by the spare page table, filled in to map the
+ * same pages with the same protection.  Called with page_table_lock
+ * held; it cannot fail.
+ */
+void __split_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	unsigned long pfn = pmd_pfn(*pmd);
+	struct page *pgtable;
+	pgprot_t prot;
+	pte_t *pte;
+	int i;
+
+	prot = __pgprot(pmd_val(*pmd) & ~(PTE_MASK | _PAGE_PSE));
+	pgtable = withdraw_pgtable(mm);
+	/* page tables are never in highmem where huge pmds are supported */
+	pte = (pte_t *)page_address(pgtable);
+	address &= HPAGE_PMD_MASK;
+	for (i = 0; i < HPAGE_PMD_NR; i++, pte++, address += PAGE_SIZE)
+		set_pte_at(mm, address, pte, pfn_pte(pfn + i, prot));
+	smp_wmb();
+
+	/*
+	 * Don't let the large and the small translations coexist in the
+	 * TLB: clear and flush the pmd before installing the page table.
+	 */
+	pmd_clear(pmd);
+	flush_tlb_mm(mm);
+	pmd_populate(mm, pmd, pgtable);
+	inc_page_state(thp_split);
+}
+
+/*
+ * khugepaged
+ */
+
+void __khugepaged_enter(struct mm_struct *mm)
+{
+	int wakeup = 0;
+
+	spin_lock(&mmlist_lock);
+	if (list_empty(&mm->khugepaged_list)) {
+		wakeup = list_empty(&khugepaged_mm_list);
+		list_add_tail(&mm->khugepaged_list, &khugepaged_mm_list);
+	}
+	spin_unlock(&mmlist_lock);
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+}
+
+static int khugepaged_vma_check(struct vm_area_struct *vma)
+{
+	if (!(vma->vm_flags & VM_HUGEPAGE) || vma->vm_ops)
+		return 0;
+	return vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC);
+}
+
+/* Find the page table mapping @address, if there is one */
+static pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return NULL;
+	return pmd;
+}
+
+/*
+ * Can the extent mapped by @pte be collapsed?  Every present pte must map
+ * an anonymous page nobody else holds a reference to, and at most
+ * khugepaged_max_ptes_none may be empty.  Called with page_table_lock
+ * held.
+ */
+static int khugepaged_check_ptes(pte_t *pte, int *referenced)
+{
+	int i, none = 0;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, pte++) {
+		pte_t pteval = *pte;
+		unsigned long pfn;
+		struct page *page;
+
+		if (pte_none(pteval)) {
+			if (++none > khugepaged_max_ptes_none)
+				return 0;
+			continue;
+		}
+		if (!pte_present(pteval))
+			return 0;
+		pfn = pte_pfn(pteval);
+		if (!pfn_valid(pfn))
+			return 0;
+		page = pfn_to_page(pfn);
+		if (PageReserved(page) || !PageAnon(page) ||
+		    PageSwapCache(page) || PageLocked(page))
+			return 0;
+		if (page_mapcount(page) != 1 || page_count(page) != 1)
+			return 0;
+		if (pte_young(pteval))
+			(*referenced)++;
+	}
+	return 1;
+}
+
+/*
+ * Copy the extent at @address into a huge page and map it with a huge
+ * pmd.  Called with mmap_sem held for reading, which is dropped while
+ * allocating and retaken for writing to keep faults out.
+ */
+static void collapse_huge_page(struct mm_struct *mm, unsigned long address)
+{
+	struct vm_area_struct *vma;
+	struct page *new, *pgtable;
+	pmd_t *pmd;
+	pte_t *pte, *ptep;
+	int i, none = 0, referenced = 0;
+
+	up_read(&mm->mmap_sem);
+	new = alloc_hugepage();
+	if (!new)
+		goto out;
+
+	down_write(&mm->mmap_sem);
+	vma = find_vma(mm, address);
+	if (!vma || !khugepaged_vma_check(vma) ||
+	    !transparent_hugepage_vma(vma, address))
+		goto out_free;
+	if (unlikely(anon_vma_prepare(vma)))
+		goto out_free;
+
+	spin_lock(&mm->page_table_lock);
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd)
+		goto out_unlock;
+	pte = pte_offset_map(pmd, address);
+	if (!khugepaged_check_ptes(pte, &referenced)) {
+		pte_unmap(pte);
+		goto out_unlock;
+	}
+
+	/*
+	 * mmap_sem keeps faults out, but other threads may still access
+	 * the old pages through their TLBs: take the page table away
+	 * before copying.
+	 */
+	pgtable = pmd_page(*pmd);
+	pmd_clear(pmd);
+	flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+
+	for (i = 0, ptep = pte; i < HPAGE_PMD_NR; i++, ptep++) {
+		unsigned long addr = address + i * PAGE_SIZE;
+		pte_t pteval = *ptep;
+		struct page *page;
+
+		if (pte_none(pteval)) {
+			clear_user_highpage(new + i, addr);
+			none++;
+			continue;
+		}
+		page = pte_page(pteval);
+		copy_user_highpage(new + i, page, addr);
+		pte_clear(mm, addr, ptep);
+		mm->anon_rss--;
+		page_remove_rmap(page);
+		page_cache_release(page);
+	}
+	pte_unmap(pte);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		lru_cache_add_active(new + i);
+		page_add_anon_rmap(new + i, vma, address + i * PAGE_SIZE);
+	}
+	mm->rss += none;
+	deposit_pgtable(mm, pgtable);
+	set_pmd(pmd, mk_huge_pmd(new, vma));
+	spin_unlock(&mm->page_table_lock);
+	inc_page_state(thp_collapse_alloc);
+	up_write(&mm->mmap_sem);
+	goto out;
+
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+out_free:
+	up_write(&mm->mmap_sem);
+	free_hugepage(new);
+out:
+	down_read(&mm->mmap_sem);
+}
+
+/*
+ * Look at the extent at @address and collapse it if that is worth it.
+ * Returns 1 if mmap_sem was dropped.
+ */
+static int khugepaged_scan_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pmd_t *pmd;
+	pte_t *pte;
+	int ok, referenced = 0;
+
+	spin_lock(&mm->page_table_lock);
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	pte = pte_offset_map(pmd, address);
+	ok = khugepaged_check_ptes(pte, &referenced);
+	pte_unmap(pte);
+	spin_unlock(&mm->page_table_lock);
+
+	/* Don't bother with extents nobody is using */
+	if (!ok || !referenced)
+		return 0;
+	collapse_huge_page(mm, address);
+	return 1;
+}
+
+/*
+ * Scan up to @pages ptes of @mm, resuming where the last pass stopped.
+ * Returns the number of ptes (or vmas) looked at.
+ */
+static int khugepaged_scan_mm(struct mm_struct *mm, int pages)
+{
+	struct vm_area_struct *vma;
+	unsigned long address, hend;
+	int progress = 0, dropped;
+
+	down_read(&mm->mmap_sem);
+	address = mm->khugepaged_scan;
+	while (progress < pages) {
+		vma = find_vma(mm, address);
+		progress++;
+		if (!vma) {
+			/* Start over on the next pass */
+			address = 0;
+			break;
+		}
+		if (address < vma->vm_start)
+			address = vma->vm_start;
+		hend = vma->vm_end & HPAGE_PMD_MASK;
+		dropped = 0;
+		if (!khugepaged_vma_check(vma)) {
+			address = vma->vm_end;
+			continue;
+		}
+		address = (address + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+		while (address < hend && progress < pages) {
+			dropped = khugepaged_scan_pmd(mm, address);
+			progress += HPAGE_PMD_NR;
+			address += HPAGE_PMD_SIZE;
+			if (dropped)
+				break;
+		}
+		/* If mmap_sem was dropped, vma may be gone: look it up again */
+		if (!dropped && address >= hend)
+			address = vma->vm_end;
+	}
+	mm->khugepaged_scan = address;
+	up_read(&mm->mmap_sem);
+	return progress;
+}
+
+static void khugepaged_do_scan(void)
+{
+	int progress = 0;
+
+	while (progress < khugepaged_pages_to_scan) {
+		struct mm_struct *mm = NULL;
+
+		spin_lock(&mmlist_lock);
+		if (!list_empty(&khugepaged_mm_list)) {
+			mm = list_entry(khugepaged_mm_list.next,
+					struct mm_struct, khugepaged_list);
+			list_move_tail(&mm->khugepaged_list,
+					&khugepaged_mm_list);
+			/* mmput() takes mmlist_lock to take it off the list */
+			atomic_inc(&mm->mm_users);
+		}
+		spin_unlock(&mmlist_lock);
+		if (!mm)
+			break;
+
+		progress += khugepaged_scan_mm(mm,
+				khugepaged_pages_to_scan - progress);
+		mmput(mm);
+		cond_resched();
+	}
+}
+
+static int khugepaged(void *unused)
+{
+	set_user_nice(current, 19);
+	for ( ; ; ) {
+		try_to_freeze(PF_FREEZE);
+		khugepaged_do_scan();
+		if (list_empty(&khugepaged_mm_list))
+			wait_event_interruptible(khugepaged_wait,
+					!list_empty(&khugepaged_mm_list));
+		else
+			msleep_interruptible(khugepaged_scan_sleep_millisecs);
+	}
+	return 0;
+}
+
+static int __init khugepaged_init(void)
+{
+	kthread_run(khugepaged, NULL, "khugepaged");
+	return 0;
+}
+
+module_init(khugepaged_init);
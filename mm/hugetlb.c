@@ -20,6 +20,19 @@ static unsigned int nr_huge_pages_node[MAX_NUMNODES];
 static unsigned int free_huge_pages_node[MAX_NUMNODES];
 static DEFINE_SPINLOCK(hugetlb_lock);
 
+/*
+ * Surplus pages are huge pages beyond the persistent pool of
+ * nr_hugepages, allocated from the buddy allocator when the pool runs
+ * out, up to nr_overcommit_hugepages of them.  They go back to the
+ * buddy allocator when they are freed: any page freed on a node with
+ * surplus pages does, they are all alike.
+ */
+unsigned long nr_overcommit_huge_pages;
+static unsigned long surplus_huge_pages;
+static unsigned int surplus_huge_pages_node[MAX_NUMNODES];
+
+#define persistent_huge_pages()	(nr_huge_pages - surplus_huge_pages)
+
 static void enqueue_huge_page(struct page *page)
 {
 	int nid = page_to_nid(page);
@@ -49,29 +62,82 @@ static struct page *dequeue_huge_page(void)
 	return page;
 }
 
-static struct page *alloc_fresh_huge_page(void)
+static struct page *alloc_fresh_huge_page(unsigned int gfp_mask, int surplus)
 {
 	static int nid = 0;
 	struct page *page;
-	page = alloc_pages_node(nid, GFP_HIGHUSER|__GFP_COMP|__GFP_NOWARN,
+	page = alloc_pages_node(nid, gfp_mask|__GFP_COMP|__GFP_NOWARN,
 					HUGETLB_PAGE_ORDER);
 	nid = (nid + 1) % num_online_nodes();
 	if (page) {
+		spin_lock(&hugetlb_lock);
 		nr_huge_pages++;
 		nr_huge_pages_node[page_to_nid(page)]++;
+		if (surplus)
+			surplus_huge_pages_node[page_to_nid(page)]++;
+		spin_unlock(&hugetlb_lock);
+	}
+	return page;
+}
+
+/* With hugetlb_lock held: give page, free or on no list, to the buddy allocator */
+static void update_and_free_page(struct page *page)
+{
+	int i;
+	nr_huge_pages--;
+	nr_huge_pages_node[page_zone(page)->zone_pgdat->node_id]--;
+	for (i = 0; i < (HPAGE_SIZE / PAGE_SIZE); i++) {
+		page[i].flags &= ~(1 << PG_locked | 1 << PG_error | 1 << PG_referenced |
+				1 << PG_dirty | 1 << PG_active | 1 << PG_reserved |
+				1 << PG_private | 1<< PG_writeback);
+		set_page_count(&page[i], 0);
+	}
+	set_page_count(page, 1);
+	__free_pages(page, HUGETLB_PAGE_ORDER);
+}
+
+/*
+ * Allocate a surplus page, if nr_overcommit_hugepages allows.  It is
+ * counted before it is allocated, so that racing callers cannot go
+ * over the limit between them.
+ */
+static struct page *alloc_surplus_huge_page(unsigned int gfp_mask)
+{
+	struct page *page;
+
+	spin_lock(&hugetlb_lock);
+	if (surplus_huge_pages >= nr_overcommit_huge_pages) {
+		spin_unlock(&hugetlb_lock);
+		return NULL;
+	}
+	surplus_huge_pages++;
+	spin_unlock(&hugetlb_lock);
+
+	page = alloc_fresh_huge_page(gfp_mask, 1);
+	if (!page) {
+		spin_lock(&hugetlb_lock);
+		surplus_huge_pages--;
+		spin_unlock(&hugetlb_lock);
 	}
 	return page;
 }
 
 void free_huge_page(struct page *page)
 {
+	int nid = page_to_nid(page);
+
 	BUG_ON(page_count(page));
 
 	INIT_LIST_HEAD(&page->lru);
 	page[1].mapping = NULL;
 
 	spin_lock(&hugetlb_lock);
-	enqueue_huge_page(page);
+	if (surplus_huge_pages_node[nid]) {
+		update_and_free_page(page);
+		surplus_huge_pages--;
+		surplus_huge_pages_node[nid]--;
+	} else
+		enqueue_huge_page(page);
 	spin_unlock(&hugetlb_lock);
 }
 
@@ -82,11 +148,13 @@ struct page *alloc_huge_page(void)
 
 	spin_lock(&hugetlb_lock);
 	page = dequeue_huge_page();
+	spin_unlock(&hugetlb_lock);
 	if (!page) {
-		spin_unlock(&hugetlb_lock);
-		return NULL;
+		/* hugetlb_prefault() holds the page_table_lock: no waiting */
+		page = alloc_surplus_huge_page(GFP_HIGHUSER & ~__GFP_WAIT);
+		if (!page)
+			return NULL;
 	}
-	spin_unlock(&hugetlb_lock);
 	set_page_count(page, 1);
 	page[1].mapping = (void *)free_huge_page;
 	for (i = 0; i < (HPAGE_SIZE/PAGE_SIZE); ++i)
@@ -94,6 +162,54 @@ struct page *alloc_huge_page(void)
 	return page;
 }
 
+/**
+ * hugetlb_grow_pool - have count free huge pages ready for a mapping
+ * @count: the number of huge pages
+ *
+ * Adds surplus pages to the free lists, allocated with waiting, for
+ * alloc_huge_page() to find.  The caller gives any left over back with
+ * hugetlb_trim_pool().  Returns 0 or -ENOMEM.
+ */
+int hugetlb_grow_pool(unsigned long count)
+{
+	struct page *page;
+
+	spin_lock(&hugetlb_lock);
+	while (free_huge_pages < count) {
+		spin_unlock(&hugetlb_lock);
+		page = alloc_surplus_huge_page(GFP_HIGHUSER);
+		if (!page)
+			return -ENOMEM;
+		spin_lock(&hugetlb_lock);
+		enqueue_huge_page(page);
+	}
+	spin_unlock(&hugetlb_lock);
+	return 0;
+}
+
+/* Give free pages beyond the persistent pool back to the buddy allocator. */
+void hugetlb_trim_pool(void)
+{
+	struct page *page;
+	int nid;
+
+	spin_lock(&hugetlb_lock);
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		while (surplus_huge_pages_node[nid] &&
+		       !list_empty(&hugepage_freelists[nid])) {
+			page = list_entry(hugepage_freelists[nid].next,
+					  struct page, lru);
+			list_del(&page->lru);
+			free_huge_pages--;
+			free_huge_pages_node[nid]--;
+			update_and_free_page(page);
+			surplus_huge_pages--;
+			surplus_huge_pages_node[nid]--;
+		}
+	}
+	spin_unlock(&hugetlb_lock);
+}
+
 static int __init hugetlb_init(void)
 {
 	unsigned long i;
@@ -103,7 +219,7 @@ static int __init hugetlb_init(void)
 		INIT_LIST_HEAD(&hugepage_freelists[i]);
 
 	for (i = 0; i < max_huge_pages; ++i) {
-		page = alloc_fresh_huge_page();
+		page = alloc_fresh_huge_page(GFP_HIGHUSER, 0);
 		if (!page)
 			break;
 		spin_lock(&hugetlb_lock);
@@ -125,21 +241,6 @@ static int __init hugetlb_setup(char *s)
 __setup("hugepages=", hugetlb_setup);
 
 #ifdef CONFIG_SYSCTL
-static void update_and_free_page(struct page *page)
-{
-	int i;
-	nr_huge_pages--;
-	nr_huge_pages_node[page_zone(page)->zone_pgdat->node_id]--;
-	for (i = 0; i < (HPAGE_SIZE / PAGE_SIZE); i++) {
-		page[i].flags &= ~(1 << PG_locked | 1 << PG_error | 1 << PG_referenced |
-				1 << PG_dirty | 1 << PG_active | 1 << PG_reserved |
-				1 << PG_private | 1<< PG_writeback);
-		set_page_count(&page[i], 0);
-	}
-	set_page_count(page, 1);
-	__free_pages(page, HUGETLB_PAGE_ORDER);
-}
-
 #ifdef CONFIG_HIGHMEM
 static void try_to_free_low(unsigned long count)
 {
@@ -154,7 +255,7 @@ static void try_to_free_low(unsigned long count)
 			nid = page_zone(page)->zone_pgdat->node_id;
 			free_huge_pages--;
 			free_huge_pages_node[nid]--;
-			if (count >= nr_huge_pages)
+			if (count >= persistent_huge_pages())
 				return;
 		}
 	}
@@ -165,29 +266,64 @@ static inline void try_to_free_low(unsigned long count)
 }
 #endif
 
+/*
+ * With hugetlb_lock held: move a page between the persistent pool and
+ * the surplus, delta being -1 or 1.  A page only becomes surplus on a
+ * node with pages in use that are not, so that it is freed when they are.
+ */
+static int adjust_pool_surplus(int delta)
+{
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		if (delta < 0 && !surplus_huge_pages_node[nid])
+			continue;
+		if (delta > 0 && surplus_huge_pages_node[nid] >=
+		    nr_huge_pages_node[nid] - free_huge_pages_node[nid])
+			continue;
+		surplus_huge_pages += delta;
+		surplus_huge_pages_node[nid] += delta;
+		return 1;
+	}
+	return 0;
+}
+
 static unsigned long set_max_huge_pages(unsigned long count)
 {
-	while (count > nr_huge_pages) {
-		struct page *page = alloc_fresh_huge_page();
-		if (!page)
-			return nr_huge_pages;
+	unsigned long ret;
+
+	spin_lock(&hugetlb_lock);
+	/* Surplus pages in use become persistent first */
+	while (count > persistent_huge_pages())
+		if (!adjust_pool_surplus(-1))
+			break;
+
+	while (count > persistent_huge_pages()) {
+		struct page *page;
+
+		spin_unlock(&hugetlb_lock);
+		page = alloc_fresh_huge_page(GFP_HIGHUSER, 0);
 		spin_lock(&hugetlb_lock);
+		if (!page)
+			goto out;
 		enqueue_huge_page(page);
-		spin_unlock(&hugetlb_lock);
 	}
-	if (count >= nr_huge_pages)
-		return nr_huge_pages;
 
-	spin_lock(&hugetlb_lock);
 	try_to_free_low(count);
-	while (count < nr_huge_pages) {
+	while (count < persistent_huge_pages()) {
 		struct page *page = dequeue_huge_page();
 		if (!page)
 			break;
 		update_and_free_page(page);
 	}
+	/* The rest are in use: they go back to the buddy allocator when freed */
+	while (count < persistent_huge_pages())
+		if (!adjust_pool_surplus(1))
+			break;
+out:
+	ret = persistent_huge_pages();
 	spin_unlock(&hugetlb_lock);
-	return nr_huge_pages;
+	return ret;
 }
 
 int hugetlb_sysctl_handler(struct ctl_table *table, int write,
@@ -205,9 +341,11 @@ int hugetlb_report_meminfo(char *buf)
 	return sprintf(buf,
 			"HugePages_Total: %5lu\n"
 			"HugePages_Free:  %5lu\n"
+			"HugePages_Surp:  %5lu\n"
 			"Hugepagesize:    %5lu kB\n",
 			nr_huge_pages,
 			free_huge_pages,
+			surplus_huge_pages,
 			HPAGE_SIZE/1024);
 }
 
@@ -215,14 +353,21 @@ int hugetlb_report_node_meminfo(int nid, char *buf)
 {
 	return sprintf(buf,
 		"Node %d HugePages_Total: %5u\n"
-		"Node %d HugePages_Free:  %5u\n",
+		"Node %d HugePages_Free:  %5u\n"
+		"Node %d HugePages_Surp:  %5u\n",
 		nid, nr_huge_pages_node[nid],
-		nid, free_huge_pages_node[nid]);
+		nid, free_huge_pages_node[nid],
+		nid, surplus_huge_pages_node[nid]);
 }
 
+/* Could size bytes of huge pages be had, from the pool or as surplus? */
 int is_hugepage_mem_enough(size_t size)
 {
-	return (size + ~HPAGE_MASK)/HPAGE_SIZE <= free_huge_pages;
+	unsigned long overcommit = 0;
+
+	if (nr_overcommit_huge_pages > surplus_huge_pages)
+		overcommit = nr_overcommit_huge_pages - surplus_huge_pages;
+	return (size + ~HPAGE_MASK)/HPAGE_SIZE <= free_huge_pages + overcommit;
 }
 
 /* Return the number pages of memory we physically have, in PAGE_SIZE units. */
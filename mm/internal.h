@@ -11,3 +11,6 @@
 
 /* page_alloc.c */
 extern void set_page_refs(struct page *page, int order);
+extern void drain_local_pages(void);
+extern unsigned long isolate_free_pageblock(struct zone *zone,
+			unsigned long pfn, struct list_head *freelist);
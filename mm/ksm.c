@@ -0,0 +1,785 @@
+/*
+ *  mm/ksm.c
+ *
+ *  Kernel samepage merging.
+ *
+ *  ksmd walks the anonymous pages of VM_MERGEABLE vmas, a few at a time,
+ *  and keeps two trees of pages sorted by their contents.  The stable
+ *  tree holds the shared pages it has made: they are write-protected
+ *  wherever they are mapped, so their contents never change.  The
+ *  unstable tree holds the pages seen in this pass over the mms which
+ *  have not been merged yet; as their contents may change under it, it
+ *  is only a hint, and is thrown away at the start of every pass.
+ *
+ *  A page is looked up in the stable tree first.  Failing that, and if
+ *  its checksum has not changed since the last pass, it is looked up in
+ *  the unstable tree, and inserted there if nothing matches.  When two
+ *  pages match, a copy of them goes into the stable tree, and both
+ *  ptes are pointed at it.
+ *
+ *  The shared pages have PAGE_MAPPING_ANON but no anon_vma, and are not
+ *  put on the LRU: nothing but ksmd and a write fault ever looks for
+ *  their ptes.
+ */
+
+#include <linux/mm.h>
+#include <linux/ksm.h>
+#include <linux/huge_mm.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/rbtree.h>
+#include <linux/jhash.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/init.h>
+
+#include <asm/tlbflush.h>
+
+/* Tunables, see Documentation/sysctl/vm.txt */
+int ksm_pages_to_scan = 100;
+int ksm_sleep_millisecs = 20;
+
+/*
+ * mms with VM_MERGEABLE vmas, and those which have exited and still have
+ * rmap_items for ksmd to free: both protected by mmlist_lock.
+ */
+static LIST_HEAD(ksm_mm_list);
+static LIST_HEAD(ksm_exit_list);
+static DECLARE_WAIT_QUEUE_HEAD(ksm_wait);
+
+/*
+ * One for every page ksmd has found in a VM_MERGEABLE vma: it remembers
+ * the checksum of the page, and puts the page in the unstable tree.
+ */
+struct rmap_item {
+	struct list_head link;		/* On mm->ksm_rmap_list, by address */
+	struct rb_node node;		/* In the unstable tree ... */
+	unsigned int seqnr;		/* ... if this is ksm_seqnr */
+	unsigned int oldchecksum;	/* Of the page on the last pass */
+	struct mm_struct *mm;
+	unsigned long address;
+};
+
+/* A shared page, holding the reference which keeps it when unmapped */
+struct stable_node {
+	struct rb_node node;
+	struct page *kpage;
+};
+
+static kmem_cache_t *rmap_item_cache;
+static kmem_cache_t *stable_node_cache;
+
+static struct rb_root root_stable_tree = RB_ROOT;
+static struct rb_root root_unstable_tree = RB_ROOT;
+
+/* Number of the current pass, never zero */
+static unsigned int ksm_seqnr = 1;
+
+/*
+ * Where ksmd has got to: ksm_scan_pos is the ksm_list of the mm it is
+ * scanning, or ksm_mm_list itself if a new pass is to start; and in that
+ * mm, ksm_scan_address and the first rmap_item at or after it, or NULL
+ * for the start of its list.  Changed by __ksm_exit() under mmlist_lock.
+ */
+static struct list_head *ksm_scan_pos = &ksm_mm_list;
+static unsigned long ksm_scan_address;
+static struct list_head *ksm_scan_item;
+
+/* The mm whose mmap_sem ksmd holds while it scans */
+static struct mm_struct *ksm_locked_mm;
+
+static void ksm_scan_next(struct list_head *pos)
+{
+	ksm_scan_pos = pos;
+	ksm_scan_address = 0;
+	ksm_scan_item = NULL;
+}
+
+void __ksm_enter(struct mm_struct *mm)
+{
+	int wakeup = 0;
+
+	spin_lock(&mmlist_lock);
+	if (list_empty(&mm->ksm_list)) {
+		wakeup = list_empty(&ksm_mm_list);
+		list_add_tail(&mm->ksm_list, &ksm_mm_list);
+	}
+	spin_unlock(&mmlist_lock);
+	if (wakeup)
+		wake_up_interruptible(&ksm_wait);
+}
+
+/*
+ * The mm is going away: take it off ksmd's list, and leave its
+ * rmap_items, if any, for ksmd to free.  Called with mmlist_lock held.
+ */
+void __ksm_exit(struct mm_struct *mm)
+{
+	if (ksm_scan_pos == &mm->ksm_list)
+		ksm_scan_next(mm->ksm_list.next);
+
+	if (list_empty(&mm->ksm_rmap_list)) {
+		list_del_init(&mm->ksm_list);
+		return;
+	}
+	atomic_inc(&mm->mm_count);
+	list_move_tail(&mm->ksm_list, &ksm_exit_list);
+	wake_up_interruptible(&ksm_wait);
+}
+
+/*
+ * Pin and lock the mm of an rmap_item, which need not be the mm being
+ * scanned.  Fails if that mm is exiting, or busy.
+ */
+static int lock_item_mm(struct rmap_item *item)
+{
+	struct mm_struct *mm = item->mm;
+	int alive;
+
+	if (mm == ksm_locked_mm)
+		return 1;
+
+	/* mmput() takes mmlist_lock as mm_users drops to zero */
+	spin_lock(&mmlist_lock);
+	alive = atomic_read(&mm->mm_users) != 0;
+	if (alive)
+		atomic_inc(&mm->mm_users);
+	spin_unlock(&mmlist_lock);
+	if (!alive)
+		return 0;
+
+	if (!down_read_trylock(&mm->mmap_sem)) {
+		mmput(mm);
+		return 0;
+	}
+	return 1;
+}
+
+static void unlock_item_mm(struct rmap_item *item)
+{
+	struct mm_struct *mm = item->mm;
+
+	if (mm == ksm_locked_mm)
+		return;
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+}
+
+static void remove_from_unstable_tree(struct rmap_item *item)
+{
+	if (item->seqnr == ksm_seqnr)
+		rb_erase(&item->node, &root_unstable_tree);
+	item->seqnr = 0;
+}
+
+static void free_rmap_item(struct rmap_item *item)
+{
+	remove_from_unstable_tree(item);
+	list_del(&item->link);
+	kmem_cache_free(rmap_item_cache, item);
+}
+
+/* Free the rmap_items of the mms which have exited */
+static void ksm_reap_exited(void)
+{
+	struct rmap_item *item, *next;
+	struct mm_struct *mm;
+
+	spin_lock(&mmlist_lock);
+	while (!list_empty(&ksm_exit_list)) {
+		mm = list_entry(ksm_exit_list.next, struct mm_struct, ksm_list);
+		list_del_init(&mm->ksm_list);
+		spin_unlock(&mmlist_lock);
+
+		list_for_each_entry_safe(item, next, &mm->ksm_rmap_list, link)
+			free_rmap_item(item);
+		mmdrop(mm);
+
+		spin_lock(&mmlist_lock);
+	}
+	spin_unlock(&mmlist_lock);
+}
+
+/* The vma at @address, if ksmd may merge its pages */
+static struct vm_area_struct *find_mergeable_vma(struct mm_struct *mm,
+						 unsigned long address)
+{
+	struct vm_area_struct *vma;
+
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start)
+		return NULL;
+	if (!(vma->vm_flags & VM_MERGEABLE) || !vma->anon_vma)
+		return NULL;
+	return vma;
+}
+
+/* Map the pte for @address, if there is a page table for it */
+static pte_t *ksm_find_pte(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return NULL;
+	return pte_offset_map(pmd, address);
+}
+
+/*
+ * Get a reference to the page mapped at @address, if it is one ksmd
+ * could merge: anonymous, and not shared by ksmd already.
+ */
+static struct page *get_mergeable_page(struct mm_struct *mm,
+				       unsigned long address)
+{
+	struct page *page = NULL;
+	pte_t *ptep;
+
+	if (!find_mergeable_vma(mm, address))
+		return NULL;
+
+	spin_lock(&mm->page_table_lock);
+	ptep = ksm_find_pte(mm, address);
+	if (!ptep)
+		goto out;
+	if (pte_present(*ptep) && pfn_valid(pte_pfn(*ptep))) {
+		page = pte_page(*ptep);
+		if (PageAnon(page) && !PageKsm(page) && !PageReserved(page))
+			get_page(page);
+		else
+			page = NULL;
+	}
+	pte_unmap(ptep);
+out:
+	spin_unlock(&mm->page_table_lock);
+	return page;
+}
+
+static int memcmp_pages(struct page *page1, struct page *page2)
+{
+	char *addr1, *addr2;
+	int ret;
+
+	addr1 = kmap_atomic(page1, KM_USER0);
+	addr2 = kmap_atomic(page2, KM_USER1);
+	ret = memcmp(addr1, addr2, PAGE_SIZE);
+	kunmap_atomic(addr2, KM_USER1);
+	kunmap_atomic(addr1, KM_USER0);
+	return ret;
+}
+
+static unsigned int calc_checksum(struct page *page)
+{
+	void *addr;
+	unsigned int checksum;
+
+	addr = kmap_atomic(page, KM_USER0);
+	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	kunmap_atomic(addr, KM_USER0);
+	return checksum;
+}
+
+/*
+ * Make the pte mapping @page at @address read-only and clean, so that
+ * its contents cannot change until a write fault copies it.  Fails if
+ * anything besides the ptes, the swap cache and our caller holds the
+ * page: that may be get_user_pages() for a write through the kernel.
+ */
+static int write_protect_page(struct vm_area_struct *vma, struct page *page,
+			      unsigned long address, pte_t *orig_pte)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pte_t *ptep, entry;
+	int err = -EFAULT;
+
+	spin_lock(&mm->page_table_lock);
+	ptep = ksm_find_pte(mm, address);
+	if (!ptep)
+		goto out_unlock;
+	if (!pte_present(*ptep) || pte_page(*ptep) != page)
+		goto out_unmap;
+
+	if (pte_write(*ptep) || pte_dirty(*ptep)) {
+		flush_cache_page(vma, address, page_to_pfn(page));
+		/* No other cpu may write it through a stale TLB entry */
+		entry = ptep_clear_flush(vma, address, ptep);
+		if (page_mapcount(page) + 1 + !!PageSwapCache(page) !=
+							page_count(page)) {
+			set_pte_at(mm, address, ptep, entry);
+			goto out_unmap;
+		}
+		if (pte_dirty(entry))
+			set_page_dirty(page);
+		entry = pte_mkclean(pte_wrprotect(entry));
+		set_pte_at(mm, address, ptep, entry);
+		update_mmu_cache(vma, address, entry);
+	}
+	*orig_pte = *ptep;
+	err = 0;
+
+out_unmap:
+	pte_unmap(ptep);
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+	return err;
+}
+
+/* Point the write-protected pte mapping @page at @kpage instead */
+static int replace_page(struct vm_area_struct *vma, struct page *page,
+			struct page *kpage, unsigned long address,
+			pte_t orig_pte)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pte_t *ptep, entry;
+	int err = -EFAULT;
+
+	spin_lock(&mm->page_table_lock);
+	ptep = ksm_find_pte(mm, address);
+	if (!ptep)
+		goto out_unlock;
+	if (!pte_same(*ptep, orig_pte))
+		goto out_unmap;
+
+	get_page(kpage);
+	page_add_ksm_rmap(kpage);
+
+	flush_cache_page(vma, address, pte_pfn(*ptep));
+	ptep_clear_flush(vma, address, ptep);
+	entry = pte_wrprotect(mk_pte(kpage, vma->vm_page_prot));
+	set_pte_at(mm, address, ptep, entry);
+	update_mmu_cache(vma, address, entry);
+
+	page_remove_rmap(page);
+	put_page(page);
+	inc_page_state(ksm_pages_merged);
+	err = 0;
+
+out_unmap:
+	pte_unmap(ptep);
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+	return err;
+}
+
+/*
+ * Replace @page, mapped by @item, by @kpage if they are still the same
+ * once @page is write-protected.  Called with @item's mm locked.
+ */
+static int try_to_merge_one_page(struct rmap_item *item, struct page *page,
+				 struct page *kpage)
+{
+	struct vm_area_struct *vma;
+	pte_t orig_pte;
+	int err = -EFAULT;
+
+	vma = find_mergeable_vma(item->mm, item->address);
+	if (!vma)
+		return err;
+
+	/* Swap cache is added and removed with the page locked */
+	if (TestSetPageLocked(page))
+		return err;
+	if (write_protect_page(vma, page, item->address, &orig_pte) == 0 &&
+	    !memcmp_pages(page, kpage))
+		err = replace_page(vma, page, kpage, item->address, orig_pte);
+	unlock_page(page);
+	return err;
+}
+
+static struct page *stable_tree_search(struct page *page)
+{
+	struct rb_node *node = root_stable_tree.rb_node;
+
+	while (node) {
+		struct stable_node *stable;
+		int ret;
+
+		stable = rb_entry(node, struct stable_node, node);
+		ret = memcmp_pages(page, stable->kpage);
+		if (ret < 0)
+			node = node->rb_left;
+		else if (ret > 0)
+			node = node->rb_right;
+		else
+			return stable->kpage;
+	}
+	return NULL;
+}
+
+static void stable_tree_insert(struct stable_node *stable)
+{
+	struct rb_node **new = &root_stable_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*new) {
+		struct stable_node *s;
+
+		parent = *new;
+		s = rb_entry(parent, struct stable_node, node);
+		if (memcmp_pages(stable->kpage, s->kpage) < 0)
+			new = &parent->rb_left;
+		else
+			new = &parent->rb_right;
+	}
+	rb_link_node(&stable->node, parent, new);
+	rb_insert_color(&stable->node, &root_stable_tree);
+}
+
+/* Free the shared pages which are mapped nowhere any more */
+static void prune_stable_tree(void)
+{
+	struct rb_node *node = rb_first(&root_stable_tree);
+
+	while (node) {
+		struct stable_node *stable;
+
+		stable = rb_entry(node, struct stable_node, node);
+		node = rb_next(node);
+		if (page_mapped(stable->kpage))
+			continue;
+		rb_erase(&stable->node, &root_stable_tree);
+		put_page(stable->kpage);
+		kmem_cache_free(stable_node_cache, stable);
+	}
+}
+
+/* Get the page of an rmap_item in the unstable tree */
+static struct page *get_tree_page(struct rmap_item *item)
+{
+	struct page *page;
+
+	if (!lock_item_mm(item))
+		return NULL;
+	page = get_mergeable_page(item->mm, item->address);
+	unlock_item_mm(item);
+	return page;
+}
+
+/*
+ * Look for a page the same as @page in the unstable tree, and return
+ * its rmap_item, with a reference to it in *@tree_pagep.  If there is
+ * none, put @item in the tree.  A page which can't be read any more
+ * ends the search: it will be gone from the tree on the next pass.
+ */
+static struct rmap_item *unstable_tree_search_insert(struct rmap_item *item,
+		struct page *page, struct page **tree_pagep)
+{
+	struct rb_node **new = &root_unstable_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*new) {
+		struct rmap_item *tree_item;
+		struct page *tree_page;
+		int ret;
+
+		tree_item = rb_entry(*new, struct rmap_item, node);
+		tree_page = get_tree_page(tree_item);
+		if (!tree_page)
+			return NULL;
+		if (tree_page == page) {
+			put_page(tree_page);
+			return NULL;
+		}
+
+		ret = memcmp_pages(page, tree_page);
+		parent = *new;
+		if (ret < 0) {
+			put_page(tree_page);
+			new = &parent->rb_left;
+		} else if (ret > 0) {
+			put_page(tree_page);
+			new = &parent->rb_right;
+		} else {
+			*tree_pagep = tree_page;
+			return tree_item;
+		}
+	}
+
+	item->seqnr = ksm_seqnr;
+	rb_link_node(&item->node, parent, new);
+	rb_insert_color(&item->node, &root_unstable_tree);
+	return NULL;
+}
+
+/*
+ * Merge @page, mapped by @item, with a shared page if there is one the
+ * same, or else with a page the same in the unstable tree.
+ */
+static void cmp_and_merge_page(struct rmap_item *item, struct page *page)
+{
+	struct rmap_item *tree_item;
+	struct page *tree_page, *kpage;
+	struct stable_node *stable;
+	unsigned int checksum;
+
+	remove_from_unstable_tree(item);
+
+	kpage = stable_tree_search(page);
+	if (kpage) {
+		try_to_merge_one_page(item, page, kpage);
+		return;
+	}
+
+	/* Only a page which stayed the same for a pass is worth the tree */
+	checksum = calc_checksum(page);
+	if (item->oldchecksum != checksum) {
+		item->oldchecksum = checksum;
+		return;
+	}
+
+	tree_item = unstable_tree_search_insert(item, page, &tree_page);
+	if (!tree_item)
+		return;
+
+	stable = kmem_cache_alloc(stable_node_cache, SLAB_KERNEL);
+	if (!stable)
+		goto out;
+	kpage = alloc_page(GFP_HIGHUSER);
+	if (!kpage) {
+		kmem_cache_free(stable_node_cache, stable);
+		goto out;
+	}
+	copy_highpage(kpage, page);
+	kpage->mapping = (struct address_space *) PAGE_MAPPING_ANON;
+
+	if (try_to_merge_one_page(item, page, kpage)) {
+		put_page(kpage);
+		kmem_cache_free(stable_node_cache, stable);
+		goto out;
+	}
+	stable->kpage = kpage;
+	stable_tree_insert(stable);
+
+	remove_from_unstable_tree(tree_item);
+	if (lock_item_mm(tree_item)) {
+		try_to_merge_one_page(tree_item, tree_page, kpage);
+		unlock_item_mm(tree_item);
+	}
+out:
+	put_page(tree_page);
+}
+
+/*
+ * The rmap_item for @address in the mm being scanned: rmap_items for
+ * addresses ksmd has passed without finding a page there are freed.
+ */
+static struct rmap_item *get_rmap_item(struct mm_struct *mm,
+				       unsigned long address)
+{
+	struct rmap_item *item;
+
+	while (ksm_scan_item != &mm->ksm_rmap_list) {
+		item = list_entry(ksm_scan_item, struct rmap_item, link);
+		if (item->address > address)
+			break;
+		ksm_scan_item = item->link.next;
+		if (item->address == address)
+			return item;
+		free_rmap_item(item);
+	}
+
+	item = kmem_cache_alloc(rmap_item_cache, SLAB_KERNEL);
+	if (!item)
+		return NULL;
+	item->mm = mm;
+	item->address = address;
+	item->oldchecksum = 0;
+	item->seqnr = 0;
+	list_add_tail(&item->link, ksm_scan_item);
+	return item;
+}
+
+/*
+ * Scan up to @pages ptes of @mm, resuming where the last batch stopped.
+ * Returns the number of ptes (or vmas) looked at, and sets *@done once
+ * the whole mm has been scanned.
+ */
+static int ksm_scan_mm(struct mm_struct *mm, int pages, int *done)
+{
+	struct vm_area_struct *vma;
+	unsigned long address;
+	int progress = 0;
+
+	down_read(&mm->mmap_sem);
+	ksm_locked_mm = mm;
+	if (!ksm_scan_item)
+		ksm_scan_item = mm->ksm_rmap_list.next;
+
+	address = ksm_scan_address;
+	*done = 0;
+	while (progress < pages) {
+		vma = find_vma(mm, address);
+		progress++;
+		if (!vma) {
+			*done = 1;
+			break;
+		}
+		if (address < vma->vm_start)
+			address = vma->vm_start;
+		if (!(vma->vm_flags & VM_MERGEABLE) || !vma->anon_vma) {
+			address = vma->vm_end;
+			continue;
+		}
+		while (address < vma->vm_end && progress < pages) {
+			struct rmap_item *item;
+			struct page *page;
+
+			page = get_mergeable_page(mm, address);
+			if (page) {
+				item = get_rmap_item(mm, address);
+				if (item)
+					cmp_and_merge_page(item, page);
+				put_page(page);
+			}
+			progress++;
+			address += PAGE_SIZE;
+		}
+	}
+
+	/* Nothing more is mapped: free what is left */
+	if (*done)
+		while (ksm_scan_item != &mm->ksm_rmap_list) {
+			struct rmap_item *item;
+
+			item = list_entry(ksm_scan_item, struct rmap_item, link);
+			ksm_scan_item = item->link.next;
+			free_rmap_item(item);
+		}
+
+	ksm_scan_address = address;
+	ksm_locked_mm = NULL;
+	up_read(&mm->mmap_sem);
+	add_page_state(ksm_pages_scanned, progress);
+	return progress;
+}
+
+static void ksm_start_pass(void)
+{
+	if (!++ksm_seqnr)
+		ksm_seqnr = 1;
+	root_unstable_tree = RB_ROOT;
+	prune_stable_tree();
+}
+
+static void ksm_do_scan(void)
+{
+	int progress = 0;
+
+	ksm_reap_exited();
+
+	while (progress < ksm_pages_to_scan) {
+		struct mm_struct *mm;
+		int new_pass = 0, done;
+
+		spin_lock(&mmlist_lock);
+		if (ksm_scan_pos == &ksm_mm_list) {
+			if (list_empty(&ksm_mm_list)) {
+				spin_unlock(&mmlist_lock);
+				break;
+			}
+			ksm_scan_next(ksm_mm_list.next);
+			new_pass = 1;
+		}
+		mm = list_entry(ksm_scan_pos, struct mm_struct, ksm_list);
+		/* mmput() takes mmlist_lock to take it off the list */
+		atomic_inc(&mm->mm_users);
+		spin_unlock(&mmlist_lock);
+
+		if (new_pass)
+			ksm_start_pass();
+
+		progress += ksm_scan_mm(mm, ksm_pages_to_scan - progress,
+					&done);
+		if (done) {
+			spin_lock(&mmlist_lock);
+			if (ksm_scan_pos == &mm->ksm_list)
+				ksm_scan_next(mm->ksm_list.next);
+			spin_unlock(&mmlist_lock);
+		}
+		mmput(mm);
+		cond_resched();
+	}
+}
+
+static int ksm_has_work(void)
+{
+	return !list_empty(&ksm_mm_list) || !list_empty(&ksm_exit_list);
+}
+
+static int ksmd(void *unused)
+{
+	set_user_nice(current, 19);
+	for ( ; ; ) {
+		try_to_freeze(PF_FREEZE);
+		ksm_do_scan();
+		if (!ksm_has_work())
+			wait_event_interruptible(ksm_wait, ksm_has_work());
+		else
+			msleep_interruptible(ksm_sleep_millisecs);
+	}
+	return 0;
+}
+
+/**
+ * ksm_unmerge_range - give the merged pages in a range their own copies
+ * @vma: the vma, no longer VM_MERGEABLE
+ * @start: start of the range
+ * @end: end of the range
+ *
+ * Called with mmap_sem held for writing, which keeps ksmd out.
+ */
+int ksm_unmerge_range(struct vm_area_struct *vma,
+		      unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long address;
+
+	for (address = start; address < end; address += PAGE_SIZE) {
+		int ksm = 0;
+		pte_t *ptep;
+
+		spin_lock(&mm->page_table_lock);
+		ptep = ksm_find_pte(mm, address);
+		if (ptep) {
+			if (pte_present(*ptep) && pfn_valid(pte_pfn(*ptep)))
+				ksm = PageKsm(pte_page(*ptep));
+			pte_unmap(ptep);
+		}
+		spin_unlock(&mm->page_table_lock);
+
+		if (ksm) {
+			switch (handle_mm_fault(mm, vma, address, 1)) {
+			case VM_FAULT_OOM:
+				return -ENOMEM;
+			case VM_FAULT_SIGBUS:
+				return -EFAULT;
+			}
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+static int __init ksm_init(void)
+{
+	rmap_item_cache = kmem_cache_create("ksm_rmap_item",
+			sizeof(struct rmap_item), 0, SLAB_PANIC, NULL, NULL);
+	stable_node_cache = kmem_cache_create("ksm_stable_node",
+			sizeof(struct stable_node), 0, SLAB_PANIC, NULL, NULL);
+	kthread_run(ksmd, NULL, "ksmd");
+	return 0;
+}
+
+module_init(ksm_init);
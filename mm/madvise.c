@@ -9,6 +9,8 @@
 #include <linux/pagemap.h>
 #include <linux/syscalls.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
+#include <linux/ksm.h>
 
 /*
  * We can potentially split a vm area into separate
@@ -111,6 +113,86 @@ static long madvise_dontneed(struct vm_area_struct * vma,
 	return 0;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Only private anonymous memory can be mapped with transparent huge
+ * pages.  Clearing VM_HUGEPAGE leaves existing huge pmds alone.
+ */
+static long madvise_hugepage(struct vm_area_struct * vma, unsigned long start,
+			     unsigned long end, int behavior)
+{
+	struct mm_struct * mm = vma->vm_mm;
+	int error = 0;
+
+	if (vma->vm_ops || (vma->vm_flags & (VM_SHARED|VM_IO|VM_HUGETLB)))
+		return -EINVAL;
+
+	if (start != vma->vm_start) {
+		error = split_vma(mm, vma, start, 1);
+		if (error)
+			goto out;
+	}
+
+	if (end != vma->vm_end) {
+		error = split_vma(mm, vma, end, 0);
+		if (error)
+			goto out;
+	}
+
+	if (behavior == MADV_HUGEPAGE) {
+		vma->vm_flags |= VM_HUGEPAGE;
+		khugepaged_enter(mm);
+	} else
+		vma->vm_flags &= ~VM_HUGEPAGE;
+
+out:
+	if (error == -ENOMEM)
+		error = -EAGAIN;
+	return error;
+}
+#endif
+
+#ifdef CONFIG_KSM
+/*
+ * ksmd only merges the anonymous pages of private mappings.  Clearing
+ * VM_MERGEABLE gives every merged page in the range its own copy again.
+ */
+static long madvise_ksm(struct vm_area_struct * vma, unsigned long start,
+			unsigned long end, int behavior)
+{
+	struct mm_struct * mm = vma->vm_mm;
+	int error = 0;
+
+	if (vma->vm_flags & (VM_SHARED|VM_IO|VM_HUGETLB|VM_RESERVED|VM_NONLINEAR))
+		return -EINVAL;
+
+	if (start != vma->vm_start) {
+		error = split_vma(mm, vma, start, 1);
+		if (error)
+			goto out;
+	}
+
+	if (end != vma->vm_end) {
+		error = split_vma(mm, vma, end, 0);
+		if (error)
+			goto out;
+	}
+
+	if (behavior == MADV_MERGEABLE) {
+		vma->vm_flags |= VM_MERGEABLE;
+		ksm_enter(mm);
+	} else {
+		vma->vm_flags &= ~VM_MERGEABLE;
+		error = ksm_unmerge_range(vma, start, end);
+	}
+
+out:
+	if (error == -ENOMEM)
+		error = -EAGAIN;
+	return error;
+}
+#endif
+
 static long madvise_vma(struct vm_area_struct * vma, unsigned long start,
 			unsigned long end, int behavior)
 {
@@ -131,6 +213,20 @@ static long madvise_vma(struct vm_area_struct * vma, unsigned long start,
 		error = madvise_dontneed(vma, start, end);
 		break;
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	case MADV_HUGEPAGE:
+	case MADV_NOHUGEPAGE:
+		error = madvise_hugepage(vma, start, end, behavior);
+		break;
+#endif
+
+#ifdef CONFIG_KSM
+	case MADV_MERGEABLE:
+	case MADV_UNMERGEABLE:
+		error = madvise_ksm(vma, start, end, behavior);
+		break;
+#endif
+
 	default:
 		error = -EINVAL;
 		break;
@@ -161,6 +257,13 @@ static long madvise_vma(struct vm_area_struct * vma, unsigned long start,
  *		some pages ahead.
  *  MADV_DONTNEED - the application is finished with the given range,
  *		so the kernel can free resources associated with it.
+ *  MADV_HUGEPAGE - map private anonymous memory in the range with
+ *		transparent huge pages where possible.
+ *  MADV_NOHUGEPAGE - undo MADV_HUGEPAGE for the range.
+ *  MADV_MERGEABLE - let ksmd merge the private anonymous pages in the
+ *		range with identical pages anywhere else.
+ *  MADV_UNMERGEABLE - undo MADV_MERGEABLE for the range, unsharing
+ *		whatever has been merged in it.
  *
  * return values:
  *  zero    - success
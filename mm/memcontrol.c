@@ -0,0 +1,282 @@
+/*
+ *  linux/mm/memcontrol.c
+ *
+ *  Memory controller: accounting and limiting the user memory of the
+ *  tasks in a cpuset.
+ *
+ *  Every charged page has a page_container, which links it into the LRU
+ *  of the mem_container it is charged to.  Pages are added at the head as
+ *  they are charged; reclaim for the container takes them from the tail,
+ *  off the zone LRUs, and moves everything it looked at back to the head.
+ *  That is a clock over the container's own pages, whatever zones they are
+ *  in, which leaves the pages of other containers alone.  shrink_list()
+ *  still decides what is freed, so referenced pages get activated and
+ *  survive as they would in zone reclaim.
+ *
+ *  mem->lru_lock nests outside zone->lru_lock.  Pages are uncharged as
+ *  they are freed, which can happen in interrupt context, so it is taken
+ *  with interrupts disabled.
+ */
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+#include <linux/init.h>
+#include <linux/spinlock.h>
+#include <linux/cpuset.h>
+#include <linux/memcontrol.h>
+#include <linux/mm_inline.h>
+
+struct mem_container {
+	atomic_t refcnt;		/* the cpuset's, and one per page */
+	spinlock_t lru_lock;		/* protects lru and the counters */
+	struct list_head lru;		/* page_containers, oldest at the tail */
+	unsigned long usage;		/* pages charged */
+	unsigned long limit;		/* in pages, ULONG_MAX if unlimited */
+	unsigned long failcnt;		/* charges failed at the limit */
+};
+
+struct page_container {
+	struct list_head lru;
+	struct page *page;
+	struct mem_container *mem;
+};
+
+/* Rounds of container reclaim before a charge fails */
+#define MEM_CONTAINER_RECLAIM_RETRIES	5
+
+static kmem_cache_t *page_container_cachep;
+
+struct mem_container *mem_container_alloc(void)
+{
+	struct mem_container *mem;
+
+	mem = kmalloc(sizeof(*mem), GFP_KERNEL);
+	if (mem) {
+		atomic_set(&mem->refcnt, 1);
+		spin_lock_init(&mem->lru_lock);
+		INIT_LIST_HEAD(&mem->lru);
+		mem->usage = 0;
+		mem->limit = ULONG_MAX;
+		mem->failcnt = 0;
+	}
+	return mem;
+}
+
+void mem_container_get(struct mem_container *mem)
+{
+	atomic_inc(&mem->refcnt);
+}
+
+void mem_container_put(struct mem_container *mem)
+{
+	if (atomic_dec_and_test(&mem->refcnt))
+		kfree(mem);
+}
+
+unsigned long mem_container_usage(struct mem_container *mem)
+{
+	return mem->usage;
+}
+
+unsigned long mem_container_limit(struct mem_container *mem)
+{
+	return mem->limit;
+}
+
+unsigned long mem_container_failcnt(struct mem_container *mem)
+{
+	return mem->failcnt;
+}
+
+/*
+ * Reclaim while the container uses more than @mem->limit pages.
+ */
+static int mem_container_shrink(struct mem_container *mem,
+				unsigned int gfp_mask)
+{
+	int retries = MEM_CONTAINER_RECLAIM_RETRIES;
+	int ret = 0;
+
+	current->flags |= PF_MEMALLOC;
+	while (mem->usage > mem->limit) {
+		if (!retries--) {
+			ret = -ENOMEM;
+			break;
+		}
+		try_to_free_mem_container_pages(mem, gfp_mask);
+	}
+	current->flags &= ~PF_MEMALLOC;
+	return ret;
+}
+
+/*
+ * Set the limit to @limit pages, reclaiming down to it.  If that fails,
+ * the old limit is left in place.
+ */
+int mem_container_set_limit(struct mem_container *mem, unsigned long limit)
+{
+	unsigned long old = mem->limit;
+
+	mem->limit = limit;
+	if (mem_container_shrink(mem, GFP_KERNEL)) {
+		mem->limit = old;
+		return -EBUSY;
+	}
+	return 0;
+}
+
+/**
+ * mem_container_charge - charge a new page to the current task's cpuset
+ * @page: the page, not yet visible to anybody else, or locked
+ * @gfp_mask: how the charge may allocate and reclaim
+ *
+ * Returns -ENOMEM if the charge would take the cpuset over its limit and
+ * reclaiming from it did not help.  Pages which are already charged are
+ * left alone.  Tasks in memory reclaim may go over the limit, rather than
+ * recursing into it.
+ */
+int mem_container_charge(struct page *page, unsigned int gfp_mask)
+{
+	struct mem_container *mem;
+	struct page_container *pc;
+	unsigned long flags;
+	int retries = MEM_CONTAINER_RECLAIM_RETRIES;
+
+	if (page->page_container)
+		return 0;
+	mem = cpuset_mem_container(current);
+	if (!mem)
+		return 0;
+
+	pc = kmem_cache_alloc(page_container_cachep, gfp_mask & GFP_LEVEL_MASK);
+	if (!pc)
+		goto nomem;
+
+	spin_lock_irqsave(&mem->lru_lock, flags);
+	while (mem->usage >= mem->limit &&
+			!(current->flags & PF_MEMALLOC)) {
+		if (!(gfp_mask & __GFP_WAIT) || !retries--) {
+			mem->failcnt++;
+			spin_unlock_irqrestore(&mem->lru_lock, flags);
+			kmem_cache_free(page_container_cachep, pc);
+			goto nomem;
+		}
+		spin_unlock_irqrestore(&mem->lru_lock, flags);
+
+		current->flags |= PF_MEMALLOC;
+		try_to_free_mem_container_pages(mem, gfp_mask);
+		current->flags &= ~PF_MEMALLOC;
+
+		spin_lock_irqsave(&mem->lru_lock, flags);
+	}
+	mem->usage++;
+	pc->page = page;
+	pc->mem = mem;			/* takes over our reference */
+	list_add(&pc->lru, &mem->lru);
+	page->page_container = pc;
+	spin_unlock_irqrestore(&mem->lru_lock, flags);
+	return 0;
+
+nomem:
+	mem_container_put(mem);
+	return -ENOMEM;
+}
+
+void __mem_container_uncharge_page(struct page *page)
+{
+	struct page_container *pc = page->page_container;
+	struct mem_container *mem = pc->mem;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mem->lru_lock, flags);
+	list_del(&pc->lru);
+	mem->usage--;
+	page->page_container = NULL;
+	spin_unlock_irqrestore(&mem->lru_lock, flags);
+
+	kmem_cache_free(page_container_cachep, pc);
+	mem_container_put(mem);
+}
+
+/*
+ * Page migration: @new takes over the charge of @page.  Both are locked.
+ */
+void mem_container_migrate(struct page *page, struct page *new)
+{
+	struct page_container *pc = page->page_container;
+	unsigned long flags;
+
+	if (!pc)
+		return;
+	spin_lock_irqsave(&pc->mem->lru_lock, flags);
+	pc->page = new;
+	new->page_container = pc;
+	page->page_container = NULL;
+	spin_unlock_irqrestore(&pc->mem->lru_lock, flags);
+}
+
+/**
+ * mem_container_isolate_pages - take the oldest pages of a container
+ * @mem: the container
+ * @nr_to_scan: how many of its pages to look at
+ * @page_list: where to put the pages taken off the zone LRUs
+ * @nr_scanned: returns how many pages were looked at
+ *
+ * Pages come off the active lists deactivated, for shrink_list().  Each
+ * page taken has a reference held, as in shrink_cache().  Returns the
+ * number of pages taken.
+ */
+int mem_container_isolate_pages(struct mem_container *mem, int nr_to_scan,
+		struct list_head *page_list, int *nr_scanned)
+{
+	LIST_HEAD(scanned);
+	unsigned long flags;
+	int nr_taken = 0;
+	int nr_scan = 0;
+
+	spin_lock_irqsave(&mem->lru_lock, flags);
+	while (nr_scan < nr_to_scan && !list_empty(&mem->lru)) {
+		struct page_container *pc;
+		struct page *page;
+		struct zone *zone;
+
+		pc = list_entry(mem->lru.prev, struct page_container, lru);
+		list_move(&pc->lru, &scanned);
+		nr_scan++;
+
+		page = pc->page;
+		zone = page_zone(page);
+		spin_lock(&zone->lru_lock);
+		if (TestClearPageLRU(page)) {
+			if (get_page_testone(page)) {
+				/* It is being freed elsewhere */
+				__put_page(page);
+				SetPageLRU(page);
+			} else {
+				if (PageActive(page)) {
+					del_page_from_active_list(zone, page);
+					ClearPageActive(page);
+				} else
+					del_page_from_inactive_list(zone, page);
+				list_add(&page->lru, page_list);
+				nr_taken++;
+			}
+		}
+		spin_unlock(&zone->lru_lock);
+	}
+	list_splice(&scanned, &mem->lru);
+	spin_unlock_irqrestore(&mem->lru_lock, flags);
+
+	*nr_scanned = nr_scan;
+	return nr_taken;
+}
+
+static int __init mem_container_init(void)
+{
+	page_container_cachep = kmem_cache_create("page_container",
+			sizeof(struct page_container), 0, SLAB_PANIC,
+			NULL, NULL);
+	return 0;
+}
+__initcall(mem_container_init);
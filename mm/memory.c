@@ -41,11 +41,14 @@
 #include <linux/kernel_stat.h>
 #include <linux/mm.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/mman.h>
 #include <linux/swap.h>
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
+#include <linux/memcontrol.h>
+#include <linux/delayacct.h>
 #include <linux/module.h>
 #include <linux/init.h>
 
@@ -195,6 +198,7 @@ void clear_page_range(struct mmu_gather *tlb,
 
 pte_t fastcall * pte_alloc_map(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
 {
+	split_huge_pmd(mm, pmd, address);
 	if (!pmd_present(*pmd)) {
 		struct page *new;
 
@@ -264,7 +268,8 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 
 	/* pte contains position in swap or file, so copy. */
 	if (unlikely(!pte_present(pte))) {
-		if (!pte_file(pte)) {
+		if (!pte_file(pte) &&
+		    !is_migration_entry(pte_to_swp_entry(pte))) {
 			swap_duplicate(pte_to_swp_entry(pte));
 			/* make sure dst_mm is on swapoff's mmlist. */
 			if (unlikely(list_empty(&dst_mm->mmlist))) {
@@ -371,6 +376,14 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*src_pmd)) {
+			int err = copy_huge_pmd(dst_mm, src_mm, dst_pmd,
+						src_pmd, vma, addr, next);
+			if (err < 0)
+				return -ENOMEM;
+			if (!err)
+				continue;
+		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
@@ -410,6 +423,16 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	unsigned long addr = vma->vm_start;
 	unsigned long end = vma->vm_end;
 
+	/*
+	 * Don't copy ptes where a page fault can refill them: a vma with
+	 * no anon_vma holds only pagecache pages, mapped at their linear
+	 * offset.  Nonlinear, hugetlb, remapped pfn and vm_insert_page()
+	 * ptes cannot be refaulted, so those are copied.
+	 */
+	if (!(vma->vm_flags & (VM_HUGETLB|VM_NONLINEAR|VM_IO|VM_RESERVED)) &&
+	    !vma->anon_vma)
+		return 0;
+
 	if (is_vm_hugetlb_page(vma))
 		return copy_hugetlb_page_range(dst_mm, src_mm, vma);
 
@@ -478,6 +501,8 @@ static void zap_pte_range(struct mmu_gather *tlb, pmd_t *pmd,
 				tlb->mm->anon_rss--;
 			else if (pte_young(ptent))
 				mark_page_accessed(page);
+			else
+				inc_page_state(pgfaultaround_unused);
 			tlb->freed++;
 			page_remove_rmap(page);
 			tlb_remove_page(tlb, page);
@@ -489,8 +514,12 @@ static void zap_pte_range(struct mmu_gather *tlb, pmd_t *pmd,
 		 */
 		if (unlikely(details))
 			continue;
-		if (!pte_file(ptent))
-			free_swap_and_cache(pte_to_swp_entry(ptent));
+		if (!pte_file(ptent)) {
+			swp_entry_t entry = pte_to_swp_entry(ptent);
+
+			if (!is_migration_entry(entry))
+				free_swap_and_cache(entry);
+		}
 		pte_clear(tlb->mm, addr, pte);
 	} while (pte++, addr += PAGE_SIZE, addr != end);
 	pte_unmap(pte - 1);
@@ -506,6 +535,13 @@ static inline void zap_pmd_range(struct mmu_gather *tlb, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*pmd)) {
+			if (next - addr == PMD_SIZE) {
+				zap_huge_pmd(tlb, pmd);
+				continue;
+			}
+			split_huge_pmd(tlb->mm, pmd, addr);
+		}
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		zap_pte_range(tlb, pmd, addr, next, details);
@@ -713,6 +749,8 @@ __follow_page(struct mm_struct *mm, unsigned long address, int read, int write)
 		goto out;
 	
 	pmd = pmd_offset(pud, address);
+	if (pmd_trans_huge(*pmd))
+		return follow_trans_huge_pmd(pmd, address, write);
 	if (pmd_none(*pmd) || unlikely(pmd_bad(*pmd)))
 		goto out;
 	if (pmd_huge(*pmd))
@@ -1109,6 +1147,65 @@ int remap_pfn_range(struct vm_area_struct *vma, unsigned long addr,
 }
 EXPORT_SYMBOL(remap_pfn_range);
 
+/**
+ * vm_insert_page - map a single kernel page into a user vma
+ * @vma: the vma to map it into
+ * @addr: the user address, within @vma, which must have no page there
+ * @page: the page, which the mapping takes a reference to
+ *
+ * For drivers and protocols handing out pages of their own, not page
+ * cache: the page is mapped like a file page, and zapping the pte drops
+ * the reference as usual.  Such a pte cannot be refaulted, so the vma
+ * is marked VM_RESERVED: fork copies it and swapout leaves it alone.
+ *
+ * Note: this is only safe if the mm semaphore is held when called.
+ */
+int vm_insert_page(struct vm_area_struct *vma, unsigned long addr,
+		   struct page *page)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+	int err = -ENOMEM;
+
+	if (addr < vma->vm_start || addr >= vma->vm_end)
+		return -EFAULT;
+	if (PageAnon(page) || !page_count(page))
+		return -EINVAL;
+	vma->vm_flags |= VM_RESERVED;
+
+	flush_dcache_page(page);
+	pgd = pgd_offset(mm, addr);
+	spin_lock(&mm->page_table_lock);
+
+	pud = pud_alloc(mm, pgd, addr);
+	if (!pud)
+		goto out;
+	pmd = pmd_alloc(mm, pud, addr);
+	if (!pmd)
+		goto out;
+	pte = pte_alloc_map(mm, pmd, addr);
+	if (!pte)
+		goto out;
+
+	err = -EBUSY;
+	if (pte_none(*pte)) {
+		get_page(page);
+		mm->rss++;
+		page_add_file_rmap(page);
+		set_pte_at(mm, addr, pte, mk_pte(page, vma->vm_page_prot));
+		update_mmu_cache(vma, addr, *pte);
+		err = 0;
+	}
+	pte_unmap(pte);
+out:
+	spin_unlock(&mm->page_table_lock);
+	return err;
+}
+EXPORT_SYMBOL(vm_insert_page);
+
 /*
  * Do pte_mkwrite, but only if the vma says VM_WRITE.  We do this when
  * servicing faults for write access.  In the normal case, do always want
@@ -1136,6 +1233,16 @@ static inline void break_cow(struct vm_area_struct * vma, struct page * new_page
 	update_mmu_cache(vma, address, entry);
 }
 
+/*
+ * Tell the scheduler which node the page just mapped for current lives
+ * on. Faults on behalf of another mm (access_process_vm) don't count.
+ */
+static inline void numa_fault_account(struct mm_struct *mm, struct page *page)
+{
+	if (mm == current->mm && !PageReserved(page))
+		task_numa_fault(current, page_to_nid(page));
+}
+
 /*
  * This routine handles present pages, when users try to write
  * to a shared page. It is done by copying the page to a new address
@@ -1177,7 +1284,8 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 	}
 	old_page = pfn_to_page(pfn);
 
-	if (!TestSetPageLocked(old_page)) {
+	/* A page merged by ksmd is always copied, however few map it */
+	if (!PageKsm(old_page) && !TestSetPageLocked(old_page)) {
 		int reuse = can_share_swap_page(old_page);
 		unlock_page(old_page);
 		if (reuse) {
@@ -1212,6 +1320,10 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 			goto no_new_page;
 		copy_user_highpage(new_page, old_page, address);
 	}
+	if (mem_container_charge(new_page, GFP_KERNEL)) {
+		page_cache_release(new_page);
+		goto no_new_page;
+	}
 	/*
 	 * Re-check the pte - we dropped the lock
 	 */
@@ -1220,6 +1332,8 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 	if (likely(pte_same(*page_table, pte))) {
 		if (PageAnon(old_page))
 			mm->anon_rss--;
+		if (PageKsm(old_page))
+			inc_page_state(ksm_cow_break);
 		if (PageReserved(old_page))
 			++mm->rss;
 		else
@@ -1228,6 +1342,7 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 		break_cow(vma, new_page, address, page_table);
 		lru_cache_add_active(new_page);
 		page_add_anon_rmap(new_page, vma, address);
+		numa_fault_account(mm, new_page);
 
 		/* Free the old page.. */
 		new_page = old_page;
@@ -1562,24 +1677,142 @@ void swapin_readahead(swp_entry_t entry, unsigned long addr,struct vm_area_struc
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 }
 
+/*
+ * How many pages to read for a swapin fault at page @pfn of @vma.  The
+ * window grows with the readahead pages used since the last fault, and
+ * shrinks at most by half per fault when they were not: much as the
+ * file readahead window follows its cache hits.
+ */
+static unsigned int swap_ra_window(struct vm_area_struct *vma,
+				   unsigned long pfn)
+{
+	unsigned int max = 1 << page_cluster;
+	unsigned int hits = vma->vm_swap_ra_hits;
+	unsigned long prev = vma->vm_swap_ra_prev;
+	unsigned int win;
+
+	if (!hits) {
+		/* Nothing to judge by: read ahead only on sequential faults */
+		win = (pfn == prev + 1 || pfn == prev - 1) ? 2 : 1;
+	} else {
+		win = 4;
+		while (win < hits + 2)
+			win <<= 1;
+	}
+	if (win < vma->vm_swap_ra_win / 2)
+		win = vma->vm_swap_ra_win / 2;
+	if (win > max)
+		win = max;
+	return win;
+}
+
+/*
+ * Virtual address based swap readahead.  When the swap area has
+ * fragmented, the slots around the faulting one hold pages of unrelated
+ * processes, so read the swap entries of the neighbouring virtual pages
+ * instead, from wherever they are in swap.  The window extends in the
+ * direction the faults are moving, within the vma and the page table of
+ * the fault.  Pages read are marked PG_readahead, and the fault which
+ * finds one counts a hit for the next window.
+ *
+ * The vma's readahead state is updated under mmap_sem held for read
+ * only, so concurrent faults can lose an update: it is just a hint.
+ */
+static void swapin_vma_readahead(struct vm_area_struct *vma,
+				 unsigned long address, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long fpfn = address >> PAGE_SHIFT;
+	unsigned long prev = vma->vm_swap_ra_prev;
+	unsigned long lo, hi, start, end, pfn;
+	unsigned int win;
+
+	win = swap_ra_window(vma, fpfn);
+	vma->vm_swap_ra_prev = fpfn;
+	vma->vm_swap_ra_win = win;
+	vma->vm_swap_ra_hits = 0;
+	if (win <= 1)
+		return;
+
+	lo = max(vma->vm_start, address & PMD_MASK) >> PAGE_SHIFT;
+	hi = (min(vma->vm_end - 1, (address & PMD_MASK) + PMD_SIZE - 1)
+			>> PAGE_SHIFT) + 1;
+	if (fpfn == prev + 1) {
+		start = fpfn;
+		end = fpfn + win;
+	} else if (fpfn == prev - 1) {
+		start = fpfn + 1 - min_t(unsigned long, win, fpfn + 1 - lo);
+		end = fpfn + 1;
+	} else {
+		start = fpfn - min_t(unsigned long, win / 2, fpfn - lo);
+		end = start + win;
+	}
+	if (end > hi)
+		end = hi;
+
+	for (pfn = start; pfn < end; pfn++) {
+		unsigned long addr = pfn << PAGE_SHIFT;
+		struct page *page;
+		swp_entry_t entry;
+		pte_t *pte;
+		pte_t pteval;
+
+		if (pfn == fpfn)
+			continue;
+		spin_lock(&mm->page_table_lock);
+		pte = pte_offset_map(pmd, addr);
+		pteval = *pte;
+		pte_unmap(pte);
+		spin_unlock(&mm->page_table_lock);
+		if (pte_none(pteval) || pte_present(pteval) || pte_file(pteval))
+			continue;
+		entry = pte_to_swp_entry(pteval);
+		if (is_migration_entry(entry))
+			continue;
+
+		page = read_swap_cache_async(entry, vma, addr);
+		if (!page)
+			break;
+		if (!PageUptodate(page))
+			SetPageReadahead(page);
+		page_cache_release(page);
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+}
+
 /*
  * We hold the mm semaphore and the page_table_lock on entry and
  * should release the pagetable lock on exit..
  */
 static int do_swap_page(struct mm_struct * mm,
 	struct vm_area_struct * vma, unsigned long address,
-	pte_t *page_table, pmd_t *pmd, pte_t orig_pte, int write_access)
+	pte_t *page_table, pmd_t *pmd, pte_t orig_pte, int write_access,
+	unsigned int flags)
 {
 	struct page *page;
 	swp_entry_t entry = pte_to_swp_entry(orig_pte);
 	pte_t pte;
 	int ret = VM_FAULT_MINOR;
 
+	if (is_migration_entry(entry)) {
+		/* The page is locked until it has been migrated */
+		page = migration_entry_to_page(entry);
+		get_page(page);
+		pte_unmap(page_table);
+		spin_unlock(&mm->page_table_lock);
+		wait_on_page_locked(page);
+		put_page(page);
+		return ret;
+	}
+
 	pte_unmap(page_table);
 	spin_unlock(&mm->page_table_lock);
 	page = lookup_swap_cache(entry);
 	if (!page) {
- 		swapin_readahead(entry, address, vma);
+		if (swap_vma_readahead)
+			swapin_vma_readahead(vma, address, pmd);
+		else
+			swapin_readahead(entry, address, vma);
  		page = read_swap_cache_async(entry, vma, address);
 		if (!page) {
 			/*
@@ -1601,10 +1834,23 @@ static int do_swap_page(struct mm_struct * mm,
 		ret = VM_FAULT_MAJOR;
 		inc_page_state(pgmajfault);
 		grab_swap_token();
-	}
+	} else if (TestClearPageReadahead(page))
+		vma->vm_swap_ra_hits++;
 
 	mark_page_accessed(page);
-	lock_page(page);
+	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
+	if (!lock_page_or_retry(page, mm, flags & FAULT_FLAG_ALLOW_RETRY)) {
+		delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
+		page_cache_release(page);
+		return VM_FAULT_RETRY;
+	}
+	delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
+	if (mem_container_charge(page, GFP_KERNEL)) {
+		unlock_page(page);
+		page_cache_release(page);
+		ret = VM_FAULT_OOM;
+		goto out;
+	}
 
 	/*
 	 * Back out if somebody else faulted in this pte while we
@@ -1638,6 +1884,7 @@ static int do_swap_page(struct mm_struct * mm,
 	flush_icache_page(vma, page);
 	set_pte_at(mm, address, page_table, pte);
 	page_add_anon_rmap(page, vma, address);
+	numa_fault_account(mm, page);
 
 	if (write_access) {
 		if (do_wp_page(mm, vma, address,
@@ -1681,6 +1928,10 @@ do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		page = alloc_zeroed_user_highpage(vma, addr);
 		if (!page)
 			goto no_mem;
+		if (mem_container_charge(page, GFP_KERNEL)) {
+			page_cache_release(page);
+			goto no_mem;
+		}
 
 		spin_lock(&mm->page_table_lock);
 		page_table = pte_offset_map(pmd, addr);
@@ -1698,6 +1949,7 @@ do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		lru_cache_add_active(page);
 		SetPageReferenced(page);
 		page_add_anon_rmap(page, vma, addr);
+		numa_fault_account(mm, page);
 	}
 
 	set_pte_at(mm, addr, page_table, entry);
@@ -1726,7 +1978,8 @@ no_mem:
  */
 static int
 do_no_page(struct mm_struct *mm, struct vm_area_struct *vma,
-	unsigned long address, int write_access, pte_t *page_table, pmd_t *pmd)
+	unsigned long address, int write_access, pte_t *page_table, pmd_t *pmd,
+	unsigned int flags)
 {
 	struct page * new_page;
 	struct address_space *mapping = NULL;
@@ -1735,6 +1988,10 @@ do_no_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	int ret = VM_FAULT_MINOR;
 	int anon = 0;
 
+	/* Tell ->nopage it may drop mmap_sem to wait, see FAULT_FLAG_* */
+	if (flags & FAULT_FLAG_ALLOW_RETRY)
+		ret = VM_FAULT_RETRY;
+
 	if (!vma->vm_ops || !vma->vm_ops->nopage)
 		return do_anonymous_page(mm, vma, page_table,
 					pmd, write_access, address);
@@ -1762,6 +2019,12 @@ retry:
 		return VM_FAULT_SIGBUS;
 	if (new_page == NOPAGE_OOM)
 		return VM_FAULT_OOM;
+	/* mmap_sem was dropped, the vma may be gone */
+	if (new_page == NOPAGE_RETRY)
+		return VM_FAULT_RETRY;
+	/* Not every ->nopage sets *type */
+	if (ret == VM_FAULT_RETRY)
+		ret = VM_FAULT_MINOR;
 
 	/*
 	 * Should we do an early C-O-W break?
@@ -1774,6 +2037,10 @@ retry:
 		page = alloc_page_vma(GFP_HIGHUSER, vma, address);
 		if (!page)
 			goto oom;
+		if (mem_container_charge(page, GFP_KERNEL)) {
+			page_cache_release(page);
+			goto oom;
+		}
 		copy_user_highpage(page, new_page, address);
 		page_cache_release(new_page);
 		new_page = page;
@@ -1819,6 +2086,7 @@ retry:
 			page_add_anon_rmap(new_page, vma, address);
 		} else
 			page_add_file_rmap(new_page);
+		numa_fault_account(mm, new_page);
 		pte_unmap(page_table);
 	} else {
 		/* One of our sibling threads was faster, back out. */
@@ -1830,6 +2098,13 @@ retry:
 
 	/* no need to invalidate: a not-present page shouldn't be cached */
 	update_mmu_cache(vma, address, entry);
+	/*
+	 * A read fault on a file is likely to be followed by others nearby:
+	 * still under the page_table_lock we checked truncate_count with,
+	 * map whatever the file has ready around it.
+	 */
+	if (!write_access && vma->vm_ops->map_pages)
+		vma->vm_ops->map_pages(vma, address, pmd);
 	spin_unlock(&mm->page_table_lock);
 out:
 	return ret;
@@ -1858,7 +2133,7 @@ static int do_file_page(struct mm_struct * mm, struct vm_area_struct * vma,
 	if (!vma->vm_ops || !vma->vm_ops->populate || 
 			(write_access && !(vma->vm_flags & VM_SHARED))) {
 		pte_clear(mm, address, pte);
-		return do_no_page(mm, vma, address, write_access, pte, pmd);
+		return do_no_page(mm, vma, address, write_access, pte, pmd, 0);
 	}
 
 	pgoff = pte_to_pgoff(*pte);
@@ -1897,7 +2172,7 @@ static int do_file_page(struct mm_struct * mm, struct vm_area_struct * vma,
  */
 static inline int handle_pte_fault(struct mm_struct *mm,
 	struct vm_area_struct * vma, unsigned long address,
-	int write_access, pte_t *pte, pmd_t *pmd)
+	int write_access, pte_t *pte, pmd_t *pmd, unsigned int flags)
 {
 	pte_t entry;
 
@@ -1909,10 +2184,12 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 		 * drop the lock.
 		 */
 		if (pte_none(entry))
-			return do_no_page(mm, vma, address, write_access, pte, pmd);
+			return do_no_page(mm, vma, address, write_access,
+					  pte, pmd, flags);
 		if (pte_file(entry))
 			return do_file_page(mm, vma, address, write_access, pte, pmd);
-		return do_swap_page(mm, vma, address, pte, pmd, entry, write_access);
+		return do_swap_page(mm, vma, address, pte, pmd, entry,
+				    write_access, flags);
 	}
 
 	if (write_access) {
@@ -1930,10 +2207,12 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 }
 
 /*
- * By the time we get here, we already hold the mm semaphore
+ * By the time we get here, we already hold the mm semaphore.  With
+ * FAULT_FLAG_ALLOW_RETRY in @flags it may have been released again
+ * by the time VM_FAULT_RETRY is returned.
  */
-int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct * vma,
-		unsigned long address, int write_access)
+int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct * vma,
+		unsigned long address, int write_access, unsigned int flags)
 {
 	pgd_t *pgd;
 	pud_t *pud;
@@ -1962,11 +2241,34 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct * vma,
 	if (!pmd)
 		goto oom;
 
+	if (pmd_none(*pmd) && transparent_hugepage_vma(vma, address)) {
+		int ret = do_huge_anonymous_page(mm, vma, address, pmd,
+						 write_access);
+		if (ret) {
+			spin_unlock(&mm->page_table_lock);
+			return ret;
+		}
+	}
+	if (pmd_none(*pmd) && transparent_hugepage_file_vma(vma, address)) {
+		int ret = do_huge_file_page(mm, vma, address, pmd,
+					    write_access);
+		if (ret) {
+			spin_unlock(&mm->page_table_lock);
+			return ret;
+		}
+	}
+	if (pmd_trans_huge(*pmd) && (!write_access || pmd_write(*pmd))) {
+		/* Raced with another fault on the same extent */
+		spin_unlock(&mm->page_table_lock);
+		return VM_FAULT_MINOR;
+	}
+
+	/* COW of a huge pmd: pte_alloc_map() splits it first */
 	pte = pte_alloc_map(mm, pmd, address);
 	if (!pte)
 		goto oom;
 	
-	return handle_pte_fault(mm, vma, address, write_access, pte, pmd);
+	return handle_pte_fault(mm, vma, address, write_access, pte, pmd, flags);
 
  oom:
 	spin_unlock(&mm->page_table_lock);
@@ -63,6 +63,7 @@
 #include <linux/mm.h>
 #include <linux/highmem.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/kernel.h>
 #include <linux/sched.h>
 #include <linux/mm.h>
@@ -70,6 +71,8 @@
 #include <linux/cpuset.h>
 #include <linux/gfp.h>
 #include <linux/slab.h>
+#include <linux/swap.h>
+#include <linux/migrate.h>
 #include <linux/string.h>
 #include <linux/module.h>
 #include <linux/interrupt.h>
@@ -266,6 +269,13 @@ verify_pages(struct mm_struct *mm,
 			addr = (addr + PMD_SIZE) & PMD_MASK;
 			continue;
 		}
+		if (pmd_trans_huge(*pmd)) {
+			p = huge_pmd_page(*pmd, addr);
+			if (!test_bit(page_to_nid(p), nodes))
+				return -EIO;
+			addr = (addr + PMD_SIZE) & PMD_MASK;
+			continue;
+		}
 		p = NULL;
 		pte = pte_offset_map(pmd, addr);
 		if (pte_present(*pte))
@@ -298,7 +308,8 @@ check_range(struct mm_struct *mm, unsigned long start, unsigned long end,
 			return ERR_PTR(-EFAULT);
 		if (prev && prev->vm_end < vma->vm_start)
 			return ERR_PTR(-EFAULT);
-		if ((flags & MPOL_MF_STRICT) && !is_vm_hugetlb_page(vma)) {
+		if ((flags & MPOL_MF_STRICT) && !(flags & MPOL_MF_MOVE) &&
+		    !is_vm_hugetlb_page(vma)) {
 			err = verify_pages(vma->vm_mm,
 					   vma->vm_start, vma->vm_end, nodes);
 			if (err) {
@@ -354,6 +365,89 @@ static int mbind_range(struct vm_area_struct *vma, unsigned long start,
 	return err;
 }
 
+/*
+ * Isolate the pages of @vma between @start and @end which are on one
+ * of @nodes, ready for migrate_pages().  Pages mapped by other mms too
+ * are left alone: migration relies on the caller's mmap_sem to keep the
+ * page's vmas, and with them its anon_vma, in place.
+ */
+static void gather_pages(struct vm_area_struct *vma, unsigned long start,
+			 unsigned long end, unsigned long *nodes,
+			 struct list_head *pagelist)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr;
+
+	if ((vma->vm_flags & (VM_IO|VM_RESERVED)) || is_vm_hugetlb_page(vma))
+		return;
+
+	addr = max(start, vma->vm_start);
+	end = min(end, vma->vm_end);
+	while (addr < end) {
+		struct page *page;
+		pmd_t *pmd;
+		pud_t *pud;
+		pgd_t *pgd;
+
+		pgd = pgd_offset(mm, addr);
+		if (pgd_none(*pgd)) {
+			addr = (addr + PGDIR_SIZE) & PGDIR_MASK;
+			if (!addr)
+				break;
+			continue;
+		}
+		pud = pud_offset(pgd, addr);
+		if (pud_none(*pud)) {
+			addr = (addr + PUD_SIZE) & PUD_MASK;
+			continue;
+		}
+		pmd = pmd_offset(pud, addr);
+		if (pmd_none(*pmd)) {
+			addr = (addr + PMD_SIZE) & PMD_MASK;
+			continue;
+		}
+
+		spin_lock(&mm->page_table_lock);
+		page = follow_page(mm, addr, 0);
+		if (page && !PageReserved(page) && page_mapcount(page) == 1 &&
+		    test_bit(page_to_nid(page), nodes))
+			isolate_lru_page(page, pagelist);
+		spin_unlock(&mm->page_table_lock);
+		cond_resched();
+		addr += PAGE_SIZE;
+	}
+}
+
+/* Allocate a page to migrate to according to the vma policy */
+static struct page *new_vma_page(struct page *page, unsigned long private)
+{
+	struct vm_area_struct *vma = (struct vm_area_struct *)private;
+	unsigned long addr;
+
+	addr = vma->vm_start + ((page->index - vma->vm_pgoff) << PAGE_SHIFT);
+	return alloc_page_vma(GFP_HIGHUSER, vma, addr);
+}
+
+/* Step 3: move the pages not on @nodes to where the new policy puts them */
+static void migrate_range(struct mm_struct *mm, unsigned long start,
+			  unsigned long end, unsigned long *nodes)
+{
+	DECLARE_BITMAP(misplaced, MAX_NUMNODES);
+	struct vm_area_struct *vma;
+	LIST_HEAD(pagelist);
+
+	bitmap_complement(misplaced, nodes, MAX_NUMNODES);
+	lru_add_drain();
+	for (vma = find_vma(mm, start); vma && vma->vm_start < end;
+			vma = vma->vm_next) {
+		gather_pages(vma, start, end, misplaced, &pagelist);
+		if (list_empty(&pagelist))
+			continue;
+		migrate_pages(&pagelist, new_vma_page, (unsigned long)vma);
+		putback_lru_pages(&pagelist);
+	}
+}
+
 /* Change policy for a memory range */
 asmlinkage long sys_mbind(unsigned long start, unsigned long len,
 			  unsigned long mode,
@@ -367,12 +461,13 @@ asmlinkage long sys_mbind(unsigned long start, unsigned long len,
 	DECLARE_BITMAP(nodes, MAX_NUMNODES);
 	int err;
 
-	if ((flags & ~(unsigned long)(MPOL_MF_STRICT)) || mode > MPOL_MAX)
+	if ((flags & ~(unsigned long)(MPOL_MF_STRICT|MPOL_MF_MOVE)) ||
+	    mode > MPOL_MAX)
 		return -EINVAL;
 	if (start & ~PAGE_MASK)
 		return -EINVAL;
 	if (mode == MPOL_DEFAULT)
-		flags &= ~MPOL_MF_STRICT;
+		flags &= ~(MPOL_MF_STRICT|MPOL_MF_MOVE);
 	len = (len + PAGE_SIZE - 1) & PAGE_MASK;
 	end = start + len;
 	if (end < start)
@@ -396,6 +491,16 @@ asmlinkage long sys_mbind(unsigned long start, unsigned long len,
 	err = PTR_ERR(vma);
 	if (!IS_ERR(vma))
 		err = mbind_range(vma, start, end, new);
+	if (!err && (flags & MPOL_MF_MOVE)) {
+		migrate_range(mm, start, end, nodes);
+		/* With MPOL_MF_MOVE, strict means all pages were moved */
+		if (flags & MPOL_MF_STRICT) {
+			vma = check_range(mm, start, end, nodes,
+					  MPOL_MF_STRICT);
+			if (IS_ERR(vma))
+				err = PTR_ERR(vma);
+		}
+	}
 	up_write(&mm->mmap_sem);
 	mpol_free(new);
 	return err;
@@ -424,6 +529,96 @@ asmlinkage long sys_set_mempolicy(int mode, unsigned long __user *nmask,
 	return 0;
 }
 
+/* Allocate a page to migrate to on the node node_map[] gives for its node */
+static struct page *new_node_page(struct page *page, unsigned long private)
+{
+	int *node_map = (int *)private;
+
+	return alloc_pages_node(node_map[page_to_nid(page)], GFP_HIGHUSER, 0);
+}
+
+/*
+ * Move the pages of a process from one set of nodes to another.  Pages
+ * on the n-th node of old_nodes go to the n-th node of new_nodes, which
+ * wraps around when it has fewer nodes.  Only pages not mapped by other
+ * processes are moved.  Returns the number of pages that could not be.
+ */
+asmlinkage long sys_migrate_pages(pid_t pid, unsigned long maxnode,
+				  unsigned long __user *old_nodes,
+				  unsigned long __user *new_nodes)
+{
+	struct task_struct *task;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	DECLARE_BITMAP(old, MAX_NUMNODES);
+	DECLARE_BITMAP(new, MAX_NUMNODES);
+	LIST_HEAD(pagelist);
+	int *node_map;
+	int nd, to, err;
+
+	err = get_nodes(old, old_nodes, maxnode, MPOL_BIND);
+	if (err)
+		return err;
+	err = get_nodes(new, new_nodes, maxnode, MPOL_BIND);
+	if (err)
+		return err;
+
+	read_lock(&tasklist_lock);
+	task = pid ? find_task_by_pid(pid) : current;
+	if (!task) {
+		read_unlock(&tasklist_lock);
+		return -ESRCH;
+	}
+	if (current->euid != task->suid && current->euid != task->uid &&
+	    current->uid != task->suid && current->uid != task->uid &&
+	    !capable(CAP_SYS_NICE)) {
+		read_unlock(&tasklist_lock);
+		return -EPERM;
+	}
+	mm = get_task_mm(task);
+	read_unlock(&tasklist_lock);
+	if (!mm)
+		return -EINVAL;
+
+	err = -ENOMEM;
+	node_map = kmalloc(MAX_NUMNODES * sizeof(int), GFP_KERNEL);
+	if (!node_map)
+		goto out;
+	for (nd = 0; nd < MAX_NUMNODES; nd++)
+		node_map[nd] = -1;
+	to = find_first_bit(new, MAX_NUMNODES);
+	for (nd = find_first_bit(old, MAX_NUMNODES); nd < MAX_NUMNODES;
+	     nd = find_next_bit(old, MAX_NUMNODES, nd + 1)) {
+		if (to == nd)
+			clear_bit(nd, old);
+		else
+			node_map[nd] = to;
+		to = find_next_bit(new, MAX_NUMNODES, to + 1);
+		if (to >= MAX_NUMNODES)
+			to = find_first_bit(new, MAX_NUMNODES);
+	}
+
+	/*
+	 * Gather everything before moving anything, so that pages moved
+	 * onto a node which is itself being emptied stay there.
+	 */
+	lru_add_drain();
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next)
+		gather_pages(vma, vma->vm_start, vma->vm_end, old, &pagelist);
+	err = 0;
+	if (!list_empty(&pagelist)) {
+		err = migrate_pages(&pagelist, new_node_page,
+				    (unsigned long)node_map);
+		putback_lru_pages(&pagelist);
+	}
+	up_read(&mm->mmap_sem);
+	kfree(node_map);
+out:
+	mmput(mm);
+	return err;
+}
+
 /* Fill a zone bitmap for a policy */
 static void get_zonemask(struct mempolicy *p, unsigned long *nodes)
 {
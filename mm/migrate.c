@@ -0,0 +1,261 @@
+/*
+ * mm/migrate.c
+ *
+ * Moving pages which are in use to other pages: to another node, or
+ * to the other end of a zone for compaction.
+ *
+ * A page is taken off the LRU, unmapped with try_to_unmap(page, 1),
+ * which leaves migration entries in its ptes, and then the new page
+ * takes over its place in the page cache or swap cache.  The contents
+ * and page flags are copied across and the migration entries are
+ * replaced by ptes for the new page.  Both pages stay locked throughout,
+ * so faults on the migration entries and page cache lookups wait until
+ * the new page is ready.
+ *
+ * Once an anonymous page is unmapped nothing pins its anon_vma, which
+ * may be freed if the last mm mapping the page exits meanwhile.  Its
+ * slab is SLAB_DESTROY_BY_RCU, so holding rcu_read_lock() from before
+ * try_to_unmap() until remove_migration_ptes() keeps the memory an
+ * anon_vma; if it has been freed there are no ptes left to restore.
+ */
+
+#include <linux/mm.h>
+#include <linux/migrate.h>
+#include <linux/pagemap.h>
+#include <linux/buffer_head.h>
+#include <linux/highmem.h>
+#include <linux/swap.h>
+#include <linux/rmap.h>
+#include <linux/mm_inline.h>
+#include <linux/memcontrol.h>
+#include <linux/rcupdate.h>
+
+/*
+ * Take @page off the LRU and add it to @pagelist, with a reference held.
+ * The caller must hold a reference to the page, or the page_table_lock
+ * of a pte mapping it.  Returns -EBUSY if the page was not on the LRU.
+ */
+int isolate_lru_page(struct page *page, struct list_head *pagelist)
+{
+	struct zone *zone = page_zone(page);
+	int ret = -EBUSY;
+
+	spin_lock_irq(&zone->lru_lock);
+	if (TestClearPageLRU(page)) {
+		if (PageActive(page))
+			del_page_from_active_list(zone, page);
+		else
+			del_page_from_inactive_list(zone, page);
+		get_page(page);
+		list_add_tail(&page->lru, pagelist);
+		ret = 0;
+	}
+	spin_unlock_irq(&zone->lru_lock);
+	return ret;
+}
+
+static void move_to_lru(struct page *page)
+{
+	if (TestClearPageActive(page))
+		lru_cache_add_active(page);
+	else
+		lru_cache_add(page);
+	page_cache_release(page);
+}
+
+/*
+ * Return the pages left on @pagelist by migrate_pages() to the LRU.
+ */
+void putback_lru_pages(struct list_head *pagelist)
+{
+	struct page *page, *page2;
+
+	list_for_each_entry_safe(page, page2, pagelist, lru) {
+		list_del(&page->lru);
+		move_to_lru(page);
+	}
+}
+
+/*
+ * Let @new take the place of the unmapped @page in its page cache or
+ * swap cache radix tree.  The references held are ours from isolation
+ * plus the radix tree's one: anything more means somebody is still
+ * using the page, and we have to try again later.
+ */
+static int move_mapping(struct page *new, struct page *page)
+{
+	struct address_space *mapping = page_mapping(page);
+	unsigned long index;
+	void **pslot;
+
+	if (!mapping) {
+		/* Anonymous page without swap cache */
+		if (page_count(page) != 1)
+			return -EAGAIN;
+		new->index = page->index;
+		new->mapping = page->mapping;
+		return 0;
+	}
+
+	index = PageSwapCache(page) ? page->private : page->index;
+
+	write_lock_irq(&mapping->tree_lock);
+	pslot = radix_tree_lookup_slot(&mapping->page_tree, index);
+	if (!pslot || *pslot != page || !page_freeze_refs(page, 2)) {
+		write_unlock_irq(&mapping->tree_lock);
+		return -EAGAIN;
+	}
+
+	/* A lockless lookup can find new as soon as it is in the slot */
+	get_page(new);
+	new->index = page->index;
+	if (PageSwapCache(page)) {
+		SetPageSwapCache(new);
+		new->private = page->private;
+		new->mapping = page->mapping;
+	} else
+		new->mapping = mapping;
+
+	radix_tree_replace_slot(pslot, new);
+	if (PageSwapCache(page)) {
+		ClearPageSwapCache(page);
+		page->private = 0;
+	} else
+		page->mapping = NULL;
+
+	/* Less the radix tree's reference */
+	page_unfreeze_refs(page, 1);
+	write_unlock_irq(&mapping->tree_lock);
+	return 0;
+}
+
+static void copy_page_flags(struct page *new, struct page *page)
+{
+	if (PageUptodate(page))
+		SetPageUptodate(new);
+	if (PageError(page))
+		SetPageError(new);
+	if (PageReferenced(page))
+		SetPageReferenced(new);
+	if (TestClearPageActive(page))
+		SetPageActive(new);
+	if (PageChecked(page))
+		SetPageChecked(new);
+	if (PageMappedToDisk(page))
+		SetPageMappedToDisk(new);
+	if (PageDirty(page)) {
+		ClearPageDirty(page);
+		SetPageDirty(new);
+	}
+}
+
+/*
+ * Migrate one isolated page.  Returns 0 when the page is done with and
+ * has been released, -EAGAIN if it should be retried later.
+ */
+static int unmap_and_move(new_page_t get_new_page, unsigned long private,
+			  struct page *page, int force)
+{
+	struct page *new;
+	int rc = -EAGAIN;
+	int anon;
+
+	/* Freed from under us: nothing left to move */
+	if (page_count(page) == 1)
+		goto release;
+
+	new = get_new_page(page, private);
+	if (!new)
+		return -ENOMEM;
+
+	lock_page(page);
+
+	/* Truncated since it was isolated */
+	if (!PageAnon(page) && !page->mapping) {
+		rc = 0;
+		goto unlock;
+	}
+
+	if (PageWriteback(page)) {
+		if (!force)
+			goto unlock;
+		wait_on_page_writeback(page);
+	}
+
+	/* Buffers cannot follow the page, so they have to go */
+	if (PagePrivate(page) && !try_to_release_page(page, GFP_KERNEL))
+		goto unlock;
+
+	SetPageLocked(new);
+	anon = PageAnon(page);
+	if (anon)
+		rcu_read_lock();
+	if (try_to_unmap(page, 1) == SWAP_SUCCESS)
+		rc = move_mapping(new, page);
+
+	if (!rc) {
+		copy_highpage(new, page);
+		copy_page_flags(new, page);
+		mem_container_migrate(page, new);
+		remove_migration_ptes(page, new);
+	} else
+		remove_migration_ptes(page, page);
+	if (anon)
+		rcu_read_unlock();
+	unlock_page(new);
+	unlock_page(page);
+
+	if (!rc) {
+		move_to_lru(new);
+		goto release;
+	}
+	put_page(new);
+	return rc;
+
+unlock:
+	unlock_page(page);
+	put_page(new);
+	if (rc)
+		return rc;
+release:
+	list_del(&page->lru);
+	page_cache_release(page);
+	return 0;
+}
+
+/**
+ * migrate_pages - move a list of pages to newly allocated pages
+ * @from: pages isolated with isolate_lru_page()
+ * @get_new_page: allocates the page to move each page to
+ * @private: passed on to @get_new_page
+ *
+ * Pages which could not be moved are left on @from, for the caller to
+ * putback_lru_pages().  Returns the number of them.
+ */
+int migrate_pages(struct list_head *from, new_page_t get_new_page,
+		  unsigned long private)
+{
+	struct page *page, *page2;
+	int retry = 1;
+	int pass;
+	int nr = 0;
+
+	for (pass = 0; pass < 10 && retry; pass++) {
+		retry = 0;
+		list_for_each_entry_safe(page, page2, from, lru) {
+			int rc;
+
+			cond_resched();
+			rc = unmap_and_move(get_new_page, private,
+					    page, pass > 2);
+			if (rc == -ENOMEM)
+				goto out;
+			if (rc)
+				retry++;
+		}
+	}
+out:
+	list_for_each_entry(page, from, lru)
+		nr++;
+	return nr;
+}
@@ -12,6 +12,7 @@
 #include <linux/mm.h>
 #include <linux/mman.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/syscalls.h>
 
 #include <asm/pgtable.h>
@@ -57,6 +58,7 @@ static inline void sync_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		split_huge_pmd(vma->vm_mm, pmd, addr);
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		sync_pte_range(vma, pmd, addr, next);
@@ -585,7 +585,7 @@ unsigned long do_mmap_pgoff(struct file *file,
 		goto error_getting_vma;
 
 	memset(vma, 0, sizeof(*vma));
-	INIT_LIST_HEAD(&vma->anon_vma_node);
+	INIT_LIST_HEAD(&vma->anon_vma_chain);
 	atomic_set(&vma->vm_usage, 1);
 	if (file)
 		get_file(file);
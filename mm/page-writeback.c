@@ -29,6 +29,7 @@
 #include <linux/sysctl.h>
 #include <linux/cpu.h>
 #include <linux/syscalls.h>
+#include <asm/div64.h>
 
 /*
  * The maximum number of pages to writeout in a single bdflush/kupdate
@@ -46,7 +47,6 @@
 static long ratelimit_pages = 32;
 
 static long total_pages;	/* The total number of pages in the machine. */
-static int dirty_exceeded;	/* Dirty mem may be over limit */
 
 /*
  * When balance_dirty_pages decides that the caller needs to perform some
@@ -115,6 +115,103 @@ static void get_writeback_state(struct writeback_state *wbs)
 	wbs->nr_writeback = read_page_state(nr_writeback);
 }
 
+/*
+ * Each backing device gets a share of the dirty limit in proportion to the
+ * rate at which it has been completing writeout, so that a slow device
+ * cannot fill the whole dirty pool and stall writers to the fast ones.
+ *
+ * Completions are counted per device and globally.  Every time a period's
+ * worth of completions, as many as the dirty limit, has gone by, the global
+ * count is halved and the period number advanced.  The devices catch up on
+ * the halvings they missed when they are next looked at.  The share of a
+ * device is then its count over the global count: a floating average of
+ * its part of the recent writeout, which adapts in about a period.
+ */
+static DEFINE_SPINLOCK(writeout_lock);
+static atomic_t writeout_events = ATOMIC_INIT(0);
+static unsigned long writeout_period;
+
+static inline int writeout_period_events(void)
+{
+	long events = (vm_dirty_ratio * total_pages) / 100;
+
+	return events > 16 ? events : 16;
+}
+
+/*
+ * Apply the halvings of the periods @bdi missed.  Called under writeout_lock.
+ */
+static void bdi_writeout_decay(struct backing_dev_info *bdi)
+{
+	unsigned long missed = writeout_period - bdi->writeout_period;
+
+	if (missed) {
+		int events = atomic_read(&bdi->writeout_events);
+
+		if (missed >= 8 * sizeof(int))
+			events = 0;
+		else
+			events >>= missed;
+		atomic_set(&bdi->writeout_events, events);
+		bdi->writeout_period = writeout_period;
+	}
+}
+
+/*
+ * Called as writeback of a page against @bdi completes, maybe in interrupt
+ * context.
+ */
+void bdi_writeout_inc(struct backing_dev_info *bdi)
+{
+	unsigned long flags;
+
+	if (unlikely(bdi->writeout_period != writeout_period)) {
+		spin_lock_irqsave(&writeout_lock, flags);
+		bdi_writeout_decay(bdi);
+		spin_unlock_irqrestore(&writeout_lock, flags);
+	}
+	atomic_inc(&bdi->writeout_events);
+
+	atomic_inc(&writeout_events);
+	if (unlikely(atomic_read(&writeout_events) >=
+				writeout_period_events())) {
+		spin_lock_irqsave(&writeout_lock, flags);
+		if (atomic_read(&writeout_events) >= writeout_period_events()) {
+			atomic_set(&writeout_events,
+					atomic_read(&writeout_events) / 2);
+			writeout_period++;
+		}
+		spin_unlock_irqrestore(&writeout_lock, flags);
+	}
+}
+
+/*
+ * Scale the dirty limit down to @bdi's share of it.  Until there has been
+ * any writeout at all, every device may use the lot.
+ */
+static long bdi_dirty_limit(struct backing_dev_info *bdi, long dirty)
+{
+	unsigned long flags;
+	long events;
+	long total;
+	u64 limit;
+
+	spin_lock_irqsave(&writeout_lock, flags);
+	bdi_writeout_decay(bdi);
+	events = atomic_read(&bdi->writeout_events);
+	total = atomic_read(&writeout_events);
+	spin_unlock_irqrestore(&writeout_lock, flags);
+
+	if (total <= 0)
+		return dirty;
+	if (events > total)
+		events = total;
+
+	limit = (u64)dirty * events;
+	do_div(limit, total);
+	return limit;
+}
+
 /*
  * Work out the current dirty-memory clamping and background writeout
  * thresholds.
@@ -131,10 +228,13 @@ static void get_writeback_state(struct writeback_state *wbs)
  *
  * We make sure that the background writeout level is below the adjusted
  * clamping level.
+ *
+ * If @pbdi_dirty is passed, it gets the share of the clamping level which
+ * the backing device of @mapping is allowed.
  */
 static void
 get_dirty_limits(struct writeback_state *wbs, long *pbackground, long *pdirty,
-		struct address_space *mapping)
+		long *pbdi_dirty, struct address_space *mapping)
 {
 	int background_ratio;		/* Percentages */
 	int dirty_ratio;
@@ -178,21 +278,25 @@ get_dirty_limits(struct writeback_state *wbs, long *pbackground, long *pdirty,
 	}
 	*pbackground = background;
 	*pdirty = dirty;
+	if (pbdi_dirty)
+		*pbdi_dirty = bdi_dirty_limit(mapping->backing_dev_info, dirty);
 }
 
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
- * data.  It looks at the number of dirty pages in the machine and will force
- * the caller to perform writeback if the system is over `vm_dirty_ratio'.
- * If we're over `background_thresh' then pdflush is woken to perform some
- * writeout.
+ * data.  It looks at the number of dirty pages against the backing device and
+ * will force the caller to perform writeback if the device is over its share
+ * of `vm_dirty_ratio'.  If the machine is over `background_thresh' then
+ * pdflush is woken to perform some writeout.
  */
 static void balance_dirty_pages(struct address_space *mapping)
 {
 	struct writeback_state wbs;
 	long nr_reclaimable;
+	long bdi_nr_dirty;
 	long background_thresh;
 	long dirty_thresh;
+	long bdi_thresh;
 	unsigned long pages_written = 0;
 	unsigned long write_chunk = sync_writeback_pages();
 
@@ -207,12 +311,14 @@ static void balance_dirty_pages(struct address_space *mapping)
 		};
 
 		get_dirty_limits(&wbs, &background_thresh,
-					&dirty_thresh, mapping);
+					&dirty_thresh, &bdi_thresh, mapping);
 		nr_reclaimable = wbs.nr_dirty + wbs.nr_unstable;
-		if (nr_reclaimable + wbs.nr_writeback <= dirty_thresh)
+		bdi_nr_dirty = bdi_nr_reclaimable(bdi);
+		if (bdi_nr_dirty + bdi_nr_writeback(bdi) <= bdi_thresh)
 			break;
 
-		dirty_exceeded = 1;
+		if (!bdi->dirty_exceeded)
+			bdi->dirty_exceeded = 1;
 
 		/* Note: nr_reclaimable denotes nr_dirty + nr_unstable.
 		 * Unstable writes are a feature of certain networked
@@ -220,12 +326,13 @@ static void balance_dirty_pages(struct address_space *mapping)
 		 * written to the server's write cache, but has not yet
 		 * been flushed to permanent storage.
 		 */
-		if (nr_reclaimable) {
+		if (bdi_nr_dirty) {
 			writeback_inodes(&wbc);
 			get_dirty_limits(&wbs, &background_thresh,
-					&dirty_thresh, mapping);
+					&dirty_thresh, &bdi_thresh, mapping);
 			nr_reclaimable = wbs.nr_dirty + wbs.nr_unstable;
-			if (nr_reclaimable + wbs.nr_writeback <= dirty_thresh)
+			bdi_nr_dirty = bdi_nr_reclaimable(bdi);
+			if (bdi_nr_dirty + bdi_nr_writeback(bdi) <= bdi_thresh)
 				break;
 			pages_written += write_chunk - wbc.nr_to_write;
 			if (pages_written >= write_chunk)
@@ -234,11 +341,12 @@ static void balance_dirty_pages(struct address_space *mapping)
 		blk_congestion_wait(WRITE, HZ/10);
 	}
 
-	if (nr_reclaimable + wbs.nr_writeback <= dirty_thresh)
-		dirty_exceeded = 0;
+	if (bdi_nr_dirty + bdi_nr_writeback(bdi) <= bdi_thresh &&
+			bdi->dirty_exceeded)
+		bdi->dirty_exceeded = 0;
 
 	if (writeback_in_progress(bdi))
-		return;		/* pdflush is already working this queue */
+		return;		/* a flusher is already working this queue */
 
 	/*
 	 * In laptop mode, we wait until hitting the higher threshold before
@@ -249,8 +357,10 @@ static void balance_dirty_pages(struct address_space *mapping)
 	 * background_thresh, to keep the amount of dirty memory low.
 	 */
 	if ((laptop_mode && pages_written) ||
-	     (!laptop_mode && (nr_reclaimable > background_thresh)))
-		pdflush_operation(background_writeout, 0);
+	     (!laptop_mode && (nr_reclaimable > background_thresh))) {
+		if (bdi_start_writeback(bdi, 0))
+			pdflush_operation(background_writeout, 0);
+	}
 }
 
 /**
@@ -272,7 +382,7 @@ void balance_dirty_pages_ratelimited(struct address_space *mapping)
 	long ratelimit;
 
 	ratelimit = ratelimit_pages;
-	if (dirty_exceeded)
+	if (mapping->backing_dev_info->dirty_exceeded)
 		ratelimit = 8;
 
 	/*
@@ -296,7 +406,8 @@ void throttle_vm_writeout(void)
 	long dirty_thresh;
 
         for ( ; ; ) {
-		get_dirty_limits(&wbs, &background_thresh, &dirty_thresh, NULL);
+		get_dirty_limits(&wbs, &background_thresh, &dirty_thresh,
+				NULL, NULL);
 
                 /*
                  * Boost the allowable dirty threshold a bit for page
@@ -312,18 +423,21 @@ void throttle_vm_writeout(void)
 
 
 /*
- * writeback at least _min_pages, and keep writing until the amount of dirty
+ * writeback at least min_pages, and keep writing until the amount of dirty
  * memory is less than the background threshold, or until we're all clean.
+ *
+ * This is done by the flusher of @bdi, or for a NULL @bdi by pdflush against
+ * all the queues which have no flusher.
  */
-static void background_writeout(unsigned long _min_pages)
+void bdi_background_writeout(struct backing_dev_info *bdi, long min_pages)
 {
-	long min_pages = _min_pages;
 	struct writeback_control wbc = {
-		.bdi		= NULL,
+		.bdi		= bdi,
 		.sync_mode	= WB_SYNC_NONE,
 		.older_than_this = NULL,
 		.nr_to_write	= 0,
 		.nonblocking	= 1,
+		.pdflush_only	= !bdi,
 	};
 
 	for ( ; ; ) {
@@ -331,7 +445,8 @@ static void background_writeout(unsigned long _min_pages)
 		long background_thresh;
 		long dirty_thresh;
 
-		get_dirty_limits(&wbs, &background_thresh, &dirty_thresh, NULL);
+		get_dirty_limits(&wbs, &background_thresh, &dirty_thresh,
+				NULL, NULL);
 		if (wbs.nr_dirty + wbs.nr_unstable < background_thresh
 				&& min_pages <= 0)
 			break;
@@ -349,10 +464,16 @@ static void background_writeout(unsigned long _min_pages)
 	}
 }
 
+static void background_writeout(unsigned long _min_pages)
+{
+	bdi_background_writeout(NULL, _min_pages);
+}
+
 /*
  * Start writeback of `nr_pages' pages.  If `nr_pages' is zero, write back
- * the whole world.  Returns 0 if a pdflush thread was dispatched.  Returns
- * -1 if all pdflush threads were busy.
+ * the whole world.  All the flusher threads are woken, and the queues without
+ * one are handed to pdflush.  Returns 0 if a pdflush thread was dispatched.
+ * Returns -1 if all pdflush threads were busy.
  */
 int wakeup_bdflush(long nr_pages)
 {
@@ -362,6 +483,7 @@ int wakeup_bdflush(long nr_pages)
 		get_writeback_state(&wbs);
 		nr_pages = wbs.nr_dirty + wbs.nr_unstable;
 	}
+	bdi_kick_flushers(BDI_flush_background, nr_pages);
 	return pdflush_operation(background_writeout, nr_pages);
 }
 
@@ -387,31 +509,50 @@ static struct timer_list laptop_mode_wb_timer =
  *
  * older_than_this takes precedence over nr_to_write.  So we'll only write back
  * all dirty pages if they are all attached to "old" mappings.
+ *
+ * pdflush runs this against the superblocks and the queues which have no
+ * flusher thread, and hands the other queues to their flushers.
  */
 static void wb_kupdate(unsigned long arg)
 {
-	unsigned long oldest_jif;
 	unsigned long start_jif;
 	unsigned long next_jif;
+
+	sync_supers();
+
+	start_jif = jiffies;
+	next_jif = start_jif + (dirty_writeback_centisecs * HZ) / 100;
+	bdi_kick_flushers(BDI_flush_kupdate, 0);
+	bdi_kupdate_writeout(NULL);
+	if (time_before(next_jif, jiffies + HZ))
+		next_jif = jiffies + HZ;
+	if (dirty_writeback_centisecs)
+		mod_timer(&wb_timer, next_jif);
+}
+
+/*
+ * Write back the "old" data against @bdi, or for a NULL @bdi against all the
+ * queues without a flusher thread.
+ */
+void bdi_kupdate_writeout(struct backing_dev_info *bdi)
+{
+	unsigned long oldest_jif;
 	long nr_to_write;
 	struct writeback_state wbs;
 	struct writeback_control wbc = {
-		.bdi		= NULL,
+		.bdi		= bdi,
 		.sync_mode	= WB_SYNC_NONE,
 		.older_than_this = &oldest_jif,
 		.nr_to_write	= 0,
 		.nonblocking	= 1,
 		.for_kupdate	= 1,
+		.pdflush_only	= !bdi,
 	};
 
-	sync_supers();
-
 	get_writeback_state(&wbs);
 	oldest_jif = jiffies - (dirty_expire_centisecs * HZ) / 100;
-	start_jif = jiffies;
-	next_jif = start_jif + (dirty_writeback_centisecs * HZ) / 100;
 	nr_to_write = wbs.nr_dirty + wbs.nr_unstable +
-			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+			(get_nr_inodes() - get_nr_inodes_unused());
 	while (nr_to_write > 0) {
 		wbc.encountered_congestion = 0;
 		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
@@ -424,10 +565,6 @@ static void wb_kupdate(unsigned long arg)
 		}
 		nr_to_write -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 	}
-	if (time_before(next_jif, jiffies + HZ))
-		next_jif = jiffies + HZ;
-	if (dirty_writeback_centisecs)
-		mod_timer(&wb_timer, next_jif);
 }
 
 /*
@@ -627,8 +764,11 @@ int __set_page_dirty_nobuffers(struct page *page)
 			mapping2 = page_mapping(page);
 			if (mapping2) { /* Race with truncate? */
 				BUG_ON(mapping2 != mapping);
-				if (!mapping->backing_dev_info->memory_backed)
+				if (!mapping->backing_dev_info->memory_backed) {
 					inc_page_state(nr_dirty);
+					bdi_mod_reclaimable(
+						mapping->backing_dev_info, 1);
+				}
 				radix_tree_tag_set(&mapping->page_tree,
 					page_index(page), PAGECACHE_TAG_DIRTY);
 			}
@@ -713,8 +853,11 @@ int test_clear_page_dirty(struct page *page)
 						page_index(page),
 						PAGECACHE_TAG_DIRTY);
 			write_unlock_irqrestore(&mapping->tree_lock, flags);
-			if (!mapping->backing_dev_info->memory_backed)
+			if (!mapping->backing_dev_info->memory_backed) {
 				dec_page_state(nr_dirty);
+				bdi_mod_reclaimable(mapping->backing_dev_info,
+							-1);
+			}
 			return 1;
 		}
 		write_unlock_irqrestore(&mapping->tree_lock, flags);
@@ -744,8 +887,11 @@ int clear_page_dirty_for_io(struct page *page)
 
 	if (mapping) {
 		if (TestClearPageDirty(page)) {
-			if (!mapping->backing_dev_info->memory_backed)
+			if (!mapping->backing_dev_info->memory_backed) {
 				dec_page_state(nr_dirty);
+				bdi_mod_reclaimable(mapping->backing_dev_info,
+							-1);
+			}
 			return 1;
 		}
 		return 0;
@@ -769,6 +915,10 @@ int test_clear_page_writeback(struct page *page)
 						page_index(page),
 						PAGECACHE_TAG_WRITEBACK);
 		write_unlock_irqrestore(&mapping->tree_lock, flags);
+		if (ret) {
+			bdi_mod_writeback(mapping->backing_dev_info, -1);
+			bdi_writeout_inc(mapping->backing_dev_info);
+		}
 	} else {
 		ret = TestClearPageWriteback(page);
 	}
@@ -794,6 +944,8 @@ int test_set_page_writeback(struct page *page)
 						page_index(page),
 						PAGECACHE_TAG_DIRTY);
 		write_unlock_irqrestore(&mapping->tree_lock, flags);
+		if (!ret)
+			bdi_mod_writeback(mapping->backing_dev_info, 1);
 	} else {
 		ret = TestSetPageWriteback(page);
 	}
@@ -34,6 +34,11 @@
 #include <linux/cpuset.h>
 #include <linux/nodemask.h>
 #include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/memcontrol.h>
+#include <linux/delayacct.h>
+#include <linux/compaction.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -72,12 +77,39 @@ EXPORT_SYMBOL(zone_table);
 static char *zone_names[MAX_NR_ZONES] = { "DMA", "Normal", "HighMem" };
 int min_free_kbytes = 1024;
 
+/*
+ * The per-cpu page lists of a zone may grow up to 1/fraction of the
+ * zone under a high allocation rate. 0 keeps them at their boot size.
+ */
+int percpu_pagelist_fraction = 1024;
+
+/*
+ * Percentage of each zone which kzerod may keep cleared in advance for
+ * __GFP_ZERO allocations. 0 turns it off.
+ */
+int sysctl_prezero_ratio;
+
 unsigned long __initdata nr_kernel_pages;
 unsigned long __initdata nr_all_pages;
 
 /*
  * Temporary debugging check for pages not lying within a given zone.
  */
+/*
+ * Take zone->lock with interrupts disabled, counting how often it was
+ * contended. The counters live next to the lock and are only touched
+ * with it held.
+ */
+#define lock_zone(zone, flags)					\
+	do {							\
+		local_irq_save(flags);				\
+		if (unlikely(!spin_trylock(&(zone)->lock))) {	\
+			spin_lock(&(zone)->lock);		\
+			(zone)->lock_contended++;		\
+		}						\
+		(zone)->lock_acquired++;			\
+	} while (0)
+
 static int bad_range(struct zone *zone, struct page *page)
 {
 	if (page_to_pfn(page) >= zone->zone_start_pfn + zone->spanned_pages)
@@ -195,6 +227,35 @@ static inline void rmv_page_order(struct page *page)
 	page->private = 0;
 }
 
+/*
+ * The migrate type of the MAX_ORDER block a page belongs to.
+ */
+static inline unsigned long pageblock_index(struct zone *zone,
+					struct page *page)
+{
+	return (page_to_pfn(page) - zone->zone_start_pfn) >> PAGEBLOCK_ORDER;
+}
+
+static inline int get_pageblock_type(struct zone *zone, struct page *page)
+{
+	return zone->pageblock_type[pageblock_index(zone, page)];
+}
+
+static inline void set_pageblock_type(struct zone *zone, struct page *page,
+					int type)
+{
+	zone->pageblock_type[pageblock_index(zone, page)] = type;
+}
+
+static inline int gfp_to_migratetype(unsigned int gfp_flags)
+{
+	if (gfp_flags & __GFP_MOVABLE)
+		return MIGRATE_MOVABLE;
+	if (gfp_flags & __GFP_RECLAIMABLE)
+		return MIGRATE_RECLAIMABLE;
+	return MIGRATE_UNMOVABLE;
+}
+
 /*
  * Locate the struct page for both the matching buddy in our
  * pair (buddy1) and the combined O(n+1) page they form (page).
@@ -305,7 +366,8 @@ static inline void __free_pages_bulk (struct page *page,
 		order++;
 	}
 	set_page_order(page, order);
-	list_add(&page->lru, &zone->free_area[order].free_list);
+	list_add(&page->lru,
+		&zone->free_area[order].free_list[get_pageblock_type(zone, page)]);
 	zone->free_area[order].nr_free++;
 }
 
@@ -347,7 +409,7 @@ free_pages_bulk(struct zone *zone, int count,
 	struct page *page = NULL;
 	int ret = 0;
 
-	spin_lock_irqsave(&zone->lock, flags);
+	lock_zone(zone, flags);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 	while (!list_empty(list) && count--) {
@@ -376,8 +438,10 @@ void __free_pages_ok(struct page *page, unsigned int order)
 			__put_page(page + i);
 #endif
 
-	for (i = 0 ; i < (1 << order) ; ++i)
+	for (i = 0 ; i < (1 << order) ; ++i) {
+		mem_container_uncharge_page(page + i);
 		free_pages_check(__FUNCTION__, page + i);
+	}
 	list_add(&page->lru, &list);
 	kernel_map_pages(page, 1<<order, 0);
 	free_pages_bulk(page_zone(page), 1, &list, order);
@@ -400,7 +464,7 @@ void __free_pages_ok(struct page *page, unsigned int order)
  */
 static inline struct page *
 expand(struct zone *zone, struct page *page,
- 	int low, int high, struct free_area *area)
+ 	int low, int high, struct free_area *area, int migratetype)
 {
 	unsigned long size = 1 << high;
 
@@ -409,7 +473,7 @@ expand(struct zone *zone, struct page *page,
 		high--;
 		size >>= 1;
 		BUG_ON(bad_range(zone, &page[size]));
-		list_add(&page[size].lru, &area->free_list);
+		list_add(&page[size].lru, &area->free_list[migratetype]);
 		area->nr_free++;
 		set_page_order(&page[size], high);
 	}
@@ -452,17 +516,18 @@ static void prep_new_page(struct page *page, int order)
 
 	page->flags &= ~(1 << PG_uptodate | 1 << PG_error |
 			1 << PG_referenced | 1 << PG_arch_1 |
-			1 << PG_checked | 1 << PG_mappedtodisk);
+			1 << PG_checked | 1 << PG_mappedtodisk |
+			1 << PG_anon_lru | 1 << PG_readahead);
 	page->private = 0;
 	set_page_refs(page, order);
 	kernel_map_pages(page, 1 << order, 1);
 }
 
-/* 
- * Do the hard work of removing an element from the buddy allocator.
- * Call me with the zone->lock already held.
+/*
+ * Take the smallest free block of the given type which is large enough.
  */
-static struct page *__rmqueue(struct zone *zone, unsigned int order)
+static struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
+					int migratetype)
 {
 	struct free_area * area;
 	unsigned int current_order;
@@ -470,46 +535,221 @@ static struct page *__rmqueue(struct zone *zone, unsigned int order)
 
 	for (current_order = order; current_order < MAX_ORDER; ++current_order) {
 		area = zone->free_area + current_order;
-		if (list_empty(&area->free_list))
+		if (list_empty(&area->free_list[migratetype]))
 			continue;
 
-		page = list_entry(area->free_list.next, struct page, lru);
+		page = list_entry(area->free_list[migratetype].next,
+				struct page, lru);
 		list_del(&page->lru);
 		rmv_page_order(page);
 		area->nr_free--;
 		zone->free_pages -= 1UL << order;
-		return expand(zone, page, order, current_order, area);
+		return expand(zone, page, order, current_order, area,
+				migratetype);
 	}
 
 	return NULL;
 }
 
+/* The types to fall back to when a type has no free pages left */
+static const int fallbacks[MIGRATE_TYPES][MIGRATE_TYPES - 1] = {
+	[MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE },
+	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE },
+	[MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE },
+};
+
+/*
+ * Move the free pages of the MAX_ORDER block @page is in to the lists
+ * of @migratetype. Returns the number of pages moved.
+ */
+static unsigned long move_freepages_block(struct zone *zone,
+					struct page *page, int migratetype)
+{
+	unsigned long pfn, end_pfn;
+	unsigned long moved = 0;
+
+	pfn = page_to_pfn(page) & ~(PAGEBLOCK_NR_PAGES - 1);
+	end_pfn = pfn + PAGEBLOCK_NR_PAGES;
+	if (pfn < zone->zone_start_pfn)
+		pfn = zone->zone_start_pfn;
+	if (end_pfn > zone->zone_start_pfn + zone->spanned_pages)
+		end_pfn = zone->zone_start_pfn + zone->spanned_pages;
+
+	while (pfn < end_pfn) {
+		unsigned long order;
+
+		if (!pfn_valid(pfn)) {
+			pfn++;
+			continue;
+		}
+		page = pfn_to_page(pfn);
+		if (!PagePrivate(page) || PageReserved(page) ||
+		    page_count(page) != 0) {
+			pfn++;
+			continue;
+		}
+		order = page_order(page);
+		list_del(&page->lru);
+		list_add(&page->lru,
+			&zone->free_area[order].free_list[migratetype]);
+		pfn += 1UL << order;
+		moved += 1UL << order;
+	}
+	return moved;
+}
+
+/*
+ * No free block of the wanted type: take the largest free block of
+ * another type, so that the remaining fragmentation is concentrated
+ * there. If the block taken is a large part of its MAX_ORDER block,
+ * move the rest of that block over too, so that later allocations of
+ * this type do not have to steal again.
+ */
+static struct page *__rmqueue_fallback(struct zone *zone, unsigned int order,
+					int start_migratetype)
+{
+	struct free_area * area;
+	int current_order;
+	struct page *page;
+	int migratetype, i;
+
+	for (current_order = MAX_ORDER - 1; current_order >= (int)order;
+							--current_order) {
+		for (i = 0; i < MIGRATE_TYPES - 1; i++) {
+			migratetype = fallbacks[start_migratetype][i];
+
+			area = zone->free_area + current_order;
+			if (list_empty(&area->free_list[migratetype]))
+				continue;
+
+			page = list_entry(area->free_list[migratetype].next,
+					struct page, lru);
+			area->nr_free--;
+
+			if (current_order >= PAGEBLOCK_ORDER / 2 ||
+			    start_migratetype == MIGRATE_RECLAIMABLE) {
+				unsigned long moved;
+
+				moved = move_freepages_block(zone, page,
+							start_migratetype);
+				/* Claim the block if we own most of it */
+				if (moved >= PAGEBLOCK_NR_PAGES / 2)
+					set_pageblock_type(zone, page,
+							start_migratetype);
+				migratetype = start_migratetype;
+			}
+
+			list_del(&page->lru);
+			rmv_page_order(page);
+			zone->free_pages -= 1UL << order;
+
+			if (current_order == PAGEBLOCK_ORDER)
+				set_pageblock_type(zone, page,
+							start_migratetype);
+
+			return expand(zone, page, order, current_order, area,
+					migratetype);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Pre-zeroed pages.
+ *
+ * While there are idle cpus, kzerod takes order-0 pages off the movable
+ * free lists, clears them with non-temporal stores and parks them on
+ * zone->zero_list, marked PG_zeroed.  __GFP_ZERO allocations take those
+ * first and skip the clearing.  The parked pages still count as free:
+ * order-0 allocations fall back to them when the free lists run dry, and
+ * higher order ones give them back to the buddy lists first.
+ */
+#define KZEROD_BATCH	32
+
+static DECLARE_WAIT_QUEUE_HEAD(kzerod_wait);
+
+static inline unsigned long zero_pool_target(struct zone *zone)
+{
+	return zone->present_pages * sysctl_prezero_ratio / 100;
+}
+
+/* Called with zone->lock held */
+static struct page *__rmqueue_zeroed(struct zone *zone)
+{
+	struct page *page;
+
+	if (list_empty(&zone->zero_list))
+		return NULL;
+	page = list_entry(zone->zero_list.next, struct page, lru);
+	list_del(&page->lru);
+	__ClearPageZeroed(page);
+	zone->nr_zero--;
+	zone->free_pages--;
+	return page;
+}
+
+/* Give up to @nr pre-zeroed pages back to the buddy lists */
+static void __drain_zero_pool(struct zone *zone, unsigned long nr)
+{
+	struct page *page;
+
+	while (nr-- && (page = __rmqueue_zeroed(zone)) != NULL)
+		__free_pages_bulk(page, zone, 0);
+}
+
+/* 
+ * Do the hard work of removing an element from the buddy allocator.
+ * Call me with the zone->lock already held.
+ */
+static struct page *__rmqueue(struct zone *zone, unsigned int order,
+				int migratetype)
+{
+	struct page *page;
+	int drained = 0;
+
+retry:
+	page = __rmqueue_smallest(zone, order, migratetype);
+	if (unlikely(!page))
+		page = __rmqueue_fallback(zone, order, migratetype);
+	if (unlikely(!page) && zone->nr_zero && !drained) {
+		if (!order)
+			return __rmqueue_zeroed(zone);
+		__drain_zero_pool(zone, zone->nr_zero);
+		drained = 1;
+		goto retry;
+	}
+	return page;
+}
+
 /* 
  * Obtain a specified number of elements from the buddy allocator, all under
  * a single hold of the lock, for efficiency.  Add them to the supplied list.
  * Returns the number of new pages which were placed at *list.
  */
 static int rmqueue_bulk(struct zone *zone, unsigned int order, 
-			unsigned long count, struct list_head *list)
+			unsigned long count, struct list_head *list,
+			int migratetype)
 {
 	unsigned long flags;
 	int i;
 	int allocated = 0;
 	struct page *page;
 	
-	spin_lock_irqsave(&zone->lock, flags);
+	lock_zone(zone, flags);
 	for (i = 0; i < count; ++i) {
-		page = __rmqueue(zone, order);
+		page = __rmqueue(zone, order, migratetype);
 		if (page == NULL)
 			break;
 		allocated++;
+		/* the per-cpu lists remember what the page was wanted as */
+		page->private = migratetype;
 		list_add_tail(&page->lru, list);
 	}
 	spin_unlock_irqrestore(&zone->lock, flags);
 	return allocated;
 }
 
-#if defined(CONFIG_PM) || defined(CONFIG_HOTPLUG_CPU)
+#if defined(CONFIG_PM) || defined(CONFIG_HOTPLUG_CPU) || defined(CONFIG_COMPACTION)
 static void __drain_pages(unsigned int cpu)
 {
 	struct zone *zone;
@@ -528,14 +768,14 @@ static void __drain_pages(unsigned int cpu)
 		}
 	}
 }
-#endif /* CONFIG_PM || CONFIG_HOTPLUG_CPU */
+#endif /* CONFIG_PM || CONFIG_HOTPLUG_CPU || CONFIG_COMPACTION */
 
 #ifdef CONFIG_PM
 
 void mark_free_pages(struct zone *zone)
 {
 	unsigned long zone_pfn, flags;
-	int order;
+	int order, t;
 	struct list_head *curr;
 
 	if (!zone->spanned_pages)
@@ -545,8 +785,12 @@ void mark_free_pages(struct zone *zone)
 	for (zone_pfn = 0; zone_pfn < zone->spanned_pages; ++zone_pfn)
 		ClearPageNosaveFree(pfn_to_page(zone_pfn + zone->zone_start_pfn));
 
+	list_for_each(curr, &zone->zero_list)
+		SetPageNosaveFree(list_entry(curr, struct page, lru));
+
 	for (order = MAX_ORDER - 1; order >= 0; --order)
-		list_for_each(curr, &zone->free_area[order].free_list) {
+		for (t = 0; t < MIGRATE_TYPES; t++)
+		list_for_each(curr, &zone->free_area[order].free_list[t]) {
 			unsigned long start_pfn, i;
 
 			start_pfn = page_to_pfn(list_entry(curr, struct page, lru));
@@ -556,7 +800,9 @@ void mark_free_pages(struct zone *zone)
 	}
 	spin_unlock_irqrestore(&zone->lock, flags);
 }
+#endif /* CONFIG_PM */
 
+#if defined(CONFIG_PM) || defined(CONFIG_COMPACTION)
 /*
  * Spill all of this CPU's per-cpu pages back into the buddy allocator.
  */
@@ -568,7 +814,70 @@ void drain_local_pages(void)
 	__drain_pages(smp_processor_id());
 	local_irq_restore(flags);	
 }
-#endif /* CONFIG_PM */
+#endif /* CONFIG_PM || CONFIG_COMPACTION */
+
+#ifdef CONFIG_COMPACTION
+/*
+ * Take the free pages of the MAX_ORDER block at @pfn off the free lists
+ * and add them to @freelist as order-0 pages ready for use, for
+ * compaction to migrate pages into.  Only movable blocks are taken
+ * from, and only while the zone stays above its low watermark.
+ * Returns the number of pages taken.
+ */
+unsigned long isolate_free_pageblock(struct zone *zone, unsigned long pfn,
+				     struct list_head *freelist)
+{
+	unsigned long end_pfn = (pfn & ~(PAGEBLOCK_NR_PAGES - 1)) +
+				PAGEBLOCK_NR_PAGES;
+	unsigned long zone_end = zone->zone_start_pfn + zone->spanned_pages;
+	unsigned long flags, nr = 0;
+	struct page *page;
+	int order, i;
+
+	if (pfn < zone->zone_start_pfn)
+		pfn = zone->zone_start_pfn;
+	if (end_pfn > zone_end)
+		end_pfn = zone_end;
+	if (pfn >= end_pfn)
+		return 0;
+
+	lock_zone(zone, flags);
+	if (get_pageblock_type(zone, pfn_to_page(pfn)) != MIGRATE_MOVABLE)
+		goto out;
+
+	while (pfn < end_pfn) {
+		if (!pfn_valid(pfn)) {
+			pfn++;
+			continue;
+		}
+		page = pfn_to_page(pfn);
+		if (!PagePrivate(page) || PageReserved(page) ||
+		    page_count(page)) {
+			pfn++;
+			continue;
+		}
+
+		/* The head of a free block */
+		order = page_order(page);
+		if (zone->free_pages < zone->pages_low + (1UL << order))
+			break;
+		list_del(&page->lru);
+		rmv_page_order(page);
+		zone->free_area[order].nr_free--;
+		zone->free_pages -= 1UL << order;
+
+		for (i = 0; i < (1 << order); i++) {
+			prep_new_page(page + i, 0);
+			list_add_tail(&page[i].lru, freelist);
+		}
+		nr += 1UL << order;
+		pfn += 1UL << order;
+	}
+out:
+	spin_unlock_irqrestore(&zone->lock, flags);
+	return nr;
+}
+#endif /* CONFIG_COMPACTION */
 
 static void zone_statistics(struct zonelist *zonelist, struct zone *z)
 {
@@ -596,6 +905,67 @@ static void zone_statistics(struct zonelist *zonelist, struct zone *z)
 #endif
 }
 
+/*
+ * Per-cpu page lists are sized from batch: the hot list is refilled
+ * below 2 * batch and drained above 6 * batch, the cold list is only
+ * refilled when empty and drained above 2 * batch.
+ */
+static void setup_pcp(struct per_cpu_pages *pcp, int batch, int cold)
+{
+	pcp->low = cold ? 0 : 2 * batch;
+	pcp->high = (cold ? 2 : 6) * batch;
+	pcp->batch = batch;
+}
+
+/*
+ * Auto-scaling of the per-cpu lists. Every refill from and drain to the
+ * buddy lists takes zone->lock; when a cpu does more than
+ * PCP_GROW_EVENTS of them in PCP_INTERVAL its batch doubles, when it
+ * does fewer than PCP_SHRINK_EVENTS the batch halves again, down to the
+ * boot time value. high is capped at 1/percpu_pagelist_fraction of the
+ * zone, and batch at PCP_MAX_BATCH to bound the zone->lock hold time.
+ */
+#define PCP_INTERVAL		(HZ / 10)
+#define PCP_GROW_EVENTS		16
+#define PCP_SHRINK_EVENTS	2
+#define PCP_MAX_BATCH		512
+
+/* Called with interrupts disabled, after a refill or a drain */
+static void pcp_autoscale(struct zone *zone, struct per_cpu_pages *pcp,
+			int cold)
+{
+	int batch = pcp->batch;
+	int fraction = percpu_pagelist_fraction;
+
+	pcp->events++;
+	if (time_before(jiffies, pcp->stamp + PCP_INTERVAL))
+		return;
+
+	if (!fraction) {
+		batch = pcp->base_batch;
+	} else {
+		unsigned long max_high = zone->present_pages / fraction;
+		int factor = cold ? 2 : 6;
+
+		if (pcp->events >= PCP_GROW_EVENTS &&
+		    batch * 2 <= PCP_MAX_BATCH &&
+		    batch * 2 * factor <= max_high)
+			batch *= 2;
+		else if (pcp->events < PCP_SHRINK_EVENTS)
+			batch /= 2;
+		/* the fraction may have been lowered */
+		while (batch > pcp->base_batch && batch * factor > max_high)
+			batch /= 2;
+		if (batch < pcp->base_batch)
+			batch = pcp->base_batch;
+	}
+
+	if (batch != pcp->batch)
+		setup_pcp(pcp, batch, cold);
+	pcp->events = 0;
+	pcp->stamp = jiffies;
+}
+
 /*
  * Free a 0-order page
  */
@@ -612,11 +982,15 @@ static void fastcall free_hot_cold_page(struct page *page, int cold)
 	inc_page_state(pgfree);
 	if (PageAnon(page))
 		page->mapping = NULL;
+	mem_container_uncharge_page(page);
 	free_pages_check(__FUNCTION__, page);
+	page->private = get_pageblock_type(zone, page);
 	pcp = &zone->pageset[get_cpu()].pcp[cold];
 	local_irq_save(flags);
-	if (pcp->count >= pcp->high)
+	if (pcp->count >= pcp->high) {
 		pcp->count -= free_pages_bulk(zone, pcp->batch, &pcp->list, 0);
+		pcp_autoscale(zone, pcp, cold);
+	}
 	list_add(&page->lru, &pcp->list);
 	pcp->count++;
 	local_irq_restore(flags);
@@ -642,28 +1016,169 @@ static inline void prep_zero_page(struct page *page, int order, int gfp_flags)
 		clear_highpage(page + i);
 }
 
+/*
+ * Take a page from @zone's pre-zeroed pool, and have kzerod top the pool
+ * up once it is half used.
+ */
+static struct page *rmqueue_zeroed(struct zone *zone)
+{
+	struct page *page = NULL;
+	unsigned long flags;
+
+	if (zone->nr_zero) {
+		lock_zone(zone, flags);
+		page = __rmqueue_zeroed(zone);
+		spin_unlock_irqrestore(&zone->lock, flags);
+	}
+	if (zone->nr_zero < zero_pool_target(zone) / 2 &&
+	    waitqueue_active(&kzerod_wait))
+		wake_up_interruptible(&kzerod_wait);
+	return page;
+}
+
+/*
+ * Top @zone's pre-zeroed pool up by a batch, or trim it down to the
+ * target.  Returns the number of pages cleared.  Pages are only taken
+ * while the zone is above its high watermark.
+ */
+static int refill_zero_pool(struct zone *zone)
+{
+	unsigned long target = zero_pool_target(zone);
+	unsigned long flags;
+	struct page *page;
+	LIST_HEAD(list);
+	int nr = 0;
+
+	lock_zone(zone, flags);
+	if (zone->nr_zero > target)
+		__drain_zero_pool(zone, zone->nr_zero - target);
+	while (nr < KZEROD_BATCH && zone->nr_zero + nr < target &&
+	       zone->free_pages > zone->pages_high) {
+		page = __rmqueue_smallest(zone, 0, MIGRATE_MOVABLE);
+		if (!page)
+			break;
+		list_add(&page->lru, &list);
+		nr++;
+	}
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	if (!nr)
+		return 0;
+
+	list_for_each_entry(page, &list, lru) {
+		kernel_map_pages(page, 1, 1);
+		clear_highpage_nocache(page);
+		kernel_map_pages(page, 1, 0);
+		__SetPageZeroed(page);
+	}
+
+	lock_zone(zone, flags);
+	list_splice(&list, &zone->zero_list);
+	zone->nr_zero += nr;
+	zone->free_pages += nr;
+	spin_unlock_irqrestore(&zone->lock, flags);
+	return nr;
+}
+
+/* Is there a cpu with nothing better to do than kzerod? */
+static inline int kzerod_may_run(void)
+{
+	return nr_running() <= num_online_cpus();
+}
+
+static int kzerod(void *unused)
+{
+	set_user_nice(current, 19);
+
+	for ( ; ; ) {
+		DEFINE_WAIT(wait);
+		struct zone *zone;
+		int busy = 0;
+
+		try_to_freeze(PF_FREEZE);
+
+		for_each_zone(zone) {
+			if (!zone->present_pages)
+				continue;
+			do {
+				cond_resched();
+				if (!kzerod_may_run()) {
+					busy = 1;
+					break;
+				}
+			} while (refill_zero_pool(zone));
+		}
+
+		prepare_to_wait(&kzerod_wait, &wait, TASK_INTERRUPTIBLE);
+		if (busy)
+			schedule_timeout(HZ);
+		else
+			schedule();
+		finish_wait(&kzerod_wait, &wait);
+	}
+	return 0;
+}
+
+static int __init kzerod_init(void)
+{
+	kthread_run(kzerod, NULL, "kzerod");
+	return 0;
+}
+module_init(kzerod_init)
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
  * or two.
  */
+/* Find a page of the given type on a per-cpu list */
+static inline struct page *pcp_find(struct per_cpu_pages *pcp,
+					int migratetype)
+{
+	struct page *page;
+
+	list_for_each_entry(page, &pcp->list, lru)
+		if (page->private == migratetype)
+			return page;
+	return NULL;
+}
+
 static struct page *
 buffered_rmqueue(struct zone *zone, int order, int gfp_flags)
 {
 	unsigned long flags;
 	struct page *page = NULL;
 	int cold = !!(gfp_flags & __GFP_COLD);
+	int migratetype = gfp_to_migratetype(gfp_flags);
+	int zeroed = 0;
+
+	if (order == 0 && (gfp_flags & __GFP_ZERO) && sysctl_prezero_ratio) {
+		page = rmqueue_zeroed(zone);
+		zeroed = (page != NULL);
+	}
 
-	if (order == 0) {
+	if (order == 0 && page == NULL) {
 		struct per_cpu_pages *pcp;
 
 		pcp = &zone->pageset[get_cpu()].pcp[cold];
 		local_irq_save(flags);
-		if (pcp->count <= pcp->low)
+		if (pcp->count <= pcp->low) {
+			pcp->count += rmqueue_bulk(zone, 0,
+					pcp->batch, &pcp->list, migratetype);
+			pcp_autoscale(zone, pcp, cold);
+		}
+		page = pcp_find(pcp, migratetype);
+		if (!page) {
+			/* only pages of other types left on the list */
 			pcp->count += rmqueue_bulk(zone, 0,
-						pcp->batch, &pcp->list);
-		if (pcp->count) {
+					pcp->batch, &pcp->list, migratetype);
+			pcp_autoscale(zone, pcp, cold);
+			page = pcp_find(pcp, migratetype);
+		}
+		if (!page && pcp->count)
+			/* zone exhausted: better a page of the wrong type */
 			page = list_entry(pcp->list.next, struct page, lru);
+		if (page) {
 			list_del(&page->lru);
 			pcp->count--;
 		}
@@ -672,8 +1187,8 @@ buffered_rmqueue(struct zone *zone, int order, int gfp_flags)
 	}
 
 	if (page == NULL) {
-		spin_lock_irqsave(&zone->lock, flags);
-		page = __rmqueue(zone, order);
+		lock_zone(zone, flags);
+		page = __rmqueue(zone, order, migratetype);
 		spin_unlock_irqrestore(&zone->lock, flags);
 	}
 
@@ -682,7 +1197,7 @@ buffered_rmqueue(struct zone *zone, int order, int gfp_flags)
 		mod_page_state_zone(zone, pgalloc, 1 << order);
 		prep_new_page(page, order);
 
-		if (gfp_flags & __GFP_ZERO)
+		if ((gfp_flags & __GFP_ZERO) && !zeroed)
 			prep_zero_page(page, order, gfp_flags);
 
 		if (order && (gfp_flags & __GFP_COMP))
@@ -812,6 +1327,38 @@ __alloc_pages(unsigned int gfp_mask, unsigned int order,
 	if (!wait)
 		goto nopage;
 
+	/*
+	 * A high-order allocation may fail only because the free memory is
+	 * scattered: try moving pages together before reclaiming any.
+	 */
+	if (order) {
+		int compact;
+
+		p->flags |= PF_MEMALLOC;
+		compact = try_to_compact_pages(zones, order, gfp_mask);
+		p->flags &= ~PF_MEMALLOC;
+
+		if (compact != COMPACT_SKIPPED) {
+			inc_page_state(compact_stall);
+			for (i = 0; (z = zones[i]) != NULL; i++) {
+				if (!zone_watermark_ok(z, order, z->pages_min,
+						       classzone_idx, can_try_harder,
+						       gfp_mask & __GFP_HIGH))
+					continue;
+
+				if (!cpuset_zone_allowed(z))
+					continue;
+
+				page = buffered_rmqueue(z, order, gfp_mask);
+				if (page) {
+					inc_page_state(compact_success);
+					goto got_pg;
+				}
+			}
+			inc_page_state(compact_fail);
+		}
+	}
+
 rebalance:
 	cond_resched();
 
@@ -820,7 +1367,9 @@ rebalance:
 	reclaim_state.reclaimed_slab = 0;
 	p->reclaim_state = &reclaim_state;
 
+	delayacct_freepages_start();
 	did_some_progress = try_to_free_pages(zones, gfp_mask, order);
+	delayacct_freepages_end();
 
 	p->reclaim_state = NULL;
 	p->flags &= ~PF_MEMALLOC;
@@ -1142,8 +1691,8 @@ void __get_zone_counts(unsigned long *active, unsigned long *inactive,
 	*inactive = 0;
 	*free = 0;
 	for (i = 0; i < MAX_NR_ZONES; i++) {
-		*active += zones[i].nr_active;
-		*inactive += zones[i].nr_inactive;
+		*active += zone_nr_active(&zones[i]);
+		*inactive += zone_nr_inactive(&zones[i]);
 		*free += zones[i].free_pages;
 	}
 }
@@ -1279,8 +1828,8 @@ void show_free_areas(void)
 			K(zone->pages_min),
 			K(zone->pages_low),
 			K(zone->pages_high),
-			K(zone->nr_active),
-			K(zone->nr_inactive),
+			K(zone_nr_active(zone)),
+			K(zone_nr_inactive(zone)),
 			K(zone->present_pages),
 			zone->pages_scanned,
 			(zone->all_unreclaimable ? "yes" : "no")
@@ -1588,6 +2137,7 @@ void __init memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 		reset_page_mapcount(page);
 		SetPageReserved(page);
 		INIT_LIST_HEAD(&page->lru);
+		page_container_reset(page);
 #ifdef WANT_PAGE_VIRTUAL
 		/* The shift won't overflow because ZONE_NORMAL is below 4G. */
 		if (!is_highmem_idx(zone))
@@ -1600,13 +2150,29 @@ void __init memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 void zone_init_free_lists(struct pglist_data *pgdat, struct zone *zone,
 				unsigned long size)
 {
-	int order;
+	int order, t;
 	for (order = 0; order < MAX_ORDER ; order++) {
-		INIT_LIST_HEAD(&zone->free_area[order].free_list);
+		for (t = 0; t < MIGRATE_TYPES; t++)
+			INIT_LIST_HEAD(&zone->free_area[order].free_list[t]);
 		zone->free_area[order].nr_free = 0;
 	}
 }
 
+/*
+ * All blocks start out movable: the pages are freed into them by
+ * free_all_bootmem(), and the kernel allocations that follow take
+ * over whole blocks as they need them.
+ */
+static void __init zone_init_pageblock_types(struct pglist_data *pgdat,
+				struct zone *zone, unsigned long size)
+{
+	unsigned long nr_blocks = (size + PAGEBLOCK_NR_PAGES - 1)
+						>> PAGEBLOCK_ORDER;
+
+	zone->pageblock_type = alloc_bootmem_node(pgdat, nr_blocks ? : 1);
+	memset(zone->pageblock_type, MIGRATE_MOVABLE, nr_blocks);
+}
+
 #ifndef __HAVE_ARCH_MEMMAP_INIT
 #define memmap_init(size, nid, zone, start_pfn) \
 	memmap_init_zone((size), (nid), (zone), (start_pfn))
@@ -1648,6 +2214,10 @@ static void __init free_area_init_core(struct pglist_data *pgdat,
 		zone->present_pages = realsize;
 		zone->name = zone_names[j];
 		spin_lock_init(&zone->lock);
+		zone->lock_acquired = 0;
+		zone->lock_contended = 0;
+		INIT_LIST_HEAD(&zone->zero_list);
+		zone->nr_zero = 0;
 		spin_lock_init(&zone->lru_lock);
 		zone->zone_pgdat = pgdat;
 		zone->free_pages = 0;
@@ -1669,30 +2239,32 @@ static void __init free_area_init_core(struct pglist_data *pgdat,
 			batch = 1;
 
 		for (cpu = 0; cpu < NR_CPUS; cpu++) {
-			struct per_cpu_pages *pcp;
-
-			pcp = &zone->pageset[cpu].pcp[0];	/* hot */
-			pcp->count = 0;
-			pcp->low = 2 * batch;
-			pcp->high = 6 * batch;
-			pcp->batch = 1 * batch;
-			INIT_LIST_HEAD(&pcp->list);
-
-			pcp = &zone->pageset[cpu].pcp[1];	/* cold */
-			pcp->count = 0;
-			pcp->low = 0;
-			pcp->high = 2 * batch;
-			pcp->batch = 1 * batch;
-			INIT_LIST_HEAD(&pcp->list);
+			int cold;
+
+			for (cold = 0; cold < 2; cold++) {
+				struct per_cpu_pages *pcp;
+
+				pcp = &zone->pageset[cpu].pcp[cold];
+				pcp->count = 0;
+				setup_pcp(pcp, batch, cold);
+				pcp->base_batch = batch;
+				pcp->events = 0;
+				pcp->stamp = INITIAL_JIFFIES;
+				INIT_LIST_HEAD(&pcp->list);
+			}
 		}
 		printk(KERN_DEBUG "  %s zone: %lu pages, LIFO batch:%lu\n",
 				zone_names[j], realsize, batch);
-		INIT_LIST_HEAD(&zone->active_list);
-		INIT_LIST_HEAD(&zone->inactive_list);
-		zone->nr_scan_active = 0;
-		zone->nr_scan_inactive = 0;
-		zone->nr_active = 0;
-		zone->nr_inactive = 0;
+		for (i = 0; i < NR_LRU_TYPES; i++) {
+			INIT_LIST_HEAD(&zone->active_list[i]);
+			INIT_LIST_HEAD(&zone->inactive_list[i]);
+			zone->nr_scan_active[i] = 0;
+			zone->nr_scan_inactive[i] = 0;
+			zone->nr_active[i] = 0;
+			zone->nr_inactive[i] = 0;
+			zone->recent_scanned[i] = 0;
+			zone->recent_rotated[i] = 0;
+		}
 		if (!size)
 			continue;
 
@@ -1723,6 +2295,7 @@ static void __init free_area_init_core(struct pglist_data *pgdat,
 		zone_start_pfn += size;
 
 		zone_init_free_lists(pgdat, zone, zone->spanned_pages);
+		zone_init_pageblock_types(pgdat, zone, zone->spanned_pages);
 	}
 }
 
@@ -1833,6 +2406,102 @@ struct seq_operations fragmentation_op = {
 	.show	= frag_show,
 };
 
+/*
+ * Per-zone watermarks, zone->lock contention and the current sizes of
+ * the (auto-scaled) per-cpu lists.
+ */
+static int zoneinfo_show(struct seq_file *m, void *arg)
+{
+	pg_data_t *pgdat = (pg_data_t *)arg;
+	struct zone *zone;
+	struct zone *node_zones = pgdat->node_zones;
+	int cpu, cold;
+
+	for (zone = node_zones; zone - node_zones < MAX_NR_ZONES; ++zone) {
+		unsigned long blocks[MIGRATE_TYPES] = { 0, };
+		unsigned long i, nr_blocks;
+
+		if (!zone->present_pages)
+			continue;
+
+		nr_blocks = (zone->spanned_pages + PAGEBLOCK_NR_PAGES - 1)
+						>> PAGEBLOCK_ORDER;
+		for (i = 0; i < nr_blocks; i++)
+			blocks[zone->pageblock_type[i]]++;
+
+		seq_printf(m, "Node %d, zone %8s", pgdat->node_id, zone->name);
+		seq_printf(m,
+			   "\n  pages free     %lu"
+			   "\n        min      %lu"
+			   "\n        low      %lu"
+			   "\n        high     %lu"
+			   "\n        present  %lu"
+			   "\n        zeroed   %lu"
+			   "\n  lock  acquired %lu"
+			   "\n        contended %lu"
+			   "\n  blocks unmovable %lu"
+			   "\n        reclaimable %lu"
+			   "\n        movable  %lu"
+			   "\n  anon  active   %lu"
+			   "\n        inactive %lu"
+			   "\n        scanned  %lu"
+			   "\n        rotated  %lu"
+			   "\n  file  active   %lu"
+			   "\n        inactive %lu"
+			   "\n        scanned  %lu"
+			   "\n        rotated  %lu"
+			   "\n  pagesets",
+			   zone->free_pages,
+			   zone->pages_min,
+			   zone->pages_low,
+			   zone->pages_high,
+			   zone->present_pages,
+			   zone->nr_zero,
+			   zone->lock_acquired,
+			   zone->lock_contended,
+			   blocks[MIGRATE_UNMOVABLE],
+			   blocks[MIGRATE_RECLAIMABLE],
+			   blocks[MIGRATE_MOVABLE],
+			   zone->nr_active[LRU_ANON],
+			   zone->nr_inactive[LRU_ANON],
+			   zone->recent_scanned[LRU_ANON],
+			   zone->recent_rotated[LRU_ANON],
+			   zone->nr_active[LRU_FILE],
+			   zone->nr_inactive[LRU_FILE],
+			   zone->recent_scanned[LRU_FILE],
+			   zone->recent_rotated[LRU_FILE]);
+		for (cpu = 0; cpu < NR_CPUS; cpu++) {
+			if (!cpu_possible(cpu))
+				continue;
+			for (cold = 0; cold < 2; cold++) {
+				struct per_cpu_pages *pcp;
+
+				pcp = &zone->pageset[cpu].pcp[cold];
+				seq_printf(m,
+					   "\n    cpu: %i %s"
+					   "\n              count: %i"
+					   "\n              low:   %i"
+					   "\n              high:  %i"
+					   "\n              batch: %i",
+					   cpu, cold ? "cold" : "hot",
+					   pcp->count,
+					   pcp->low,
+					   pcp->high,
+					   pcp->batch);
+			}
+		}
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+
+struct seq_operations zoneinfo_op = {
+	.start	= frag_start,	/* iterate over all zones, same as buddyinfo */
+	.next	= frag_next,
+	.stop	= frag_stop,
+	.show	= zoneinfo_show,
+};
+
 static char *vmstat_text[] = {
 	"nr_dirty",
 	"nr_writeback",
@@ -1855,6 +2524,8 @@ static char *vmstat_text[] = {
 
 	"pgfault",
 	"pgmajfault",
+	"pgfaultaround",
+	"pgfaultaround_unused",
 	"pgrefill_high",
 	"pgrefill_normal",
 	"pgrefill_dma",
@@ -1876,8 +2547,27 @@ static char *vmstat_text[] = {
 	"kswapd_inodesteal",
 	"pageoutrun",
 	"allocstall",
+	"pgscan_container",
+	"pgsteal_container",
 
 	"pgrotated",
+
+	"thp_fault_alloc",
+	"thp_fault_fallback",
+	"thp_collapse_alloc",
+	"thp_split",
+	"thp_file_mapped",
+
+	"compact_blocks_moved",
+	"compact_pages_moved",
+	"compact_pagemigrate_failed",
+	"compact_stall",
+	"compact_fail",
+	"compact_success",
+
+	"ksm_pages_scanned",
+	"ksm_pages_merged",
+	"ksm_cow_break",
 };
 
 static void *vmstat_start(struct seq_file *m, loff_t *pos)
@@ -2125,6 +2815,19 @@ int lowmem_reserve_ratio_sysctl_handler(ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * prezero_ratio_sysctl_handler - wake kzerod up to fill or trim the
+ *	pre-zeroed pools to the new size.
+ */
+int prezero_ratio_sysctl_handler(ctl_table *table, int write,
+	struct file *file, void __user *buffer, size_t *length, loff_t *ppos)
+{
+	proc_dointvec_minmax(table, write, file, buffer, length, ppos);
+	if (write)
+		wake_up_interruptible(&kzerod_wait);
+	return 0;
+}
+
 __initdata int hashdist = HASHDIST_DEFAULT;
 
 #ifdef CONFIG_NUMA
@@ -38,28 +38,16 @@ file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping)
 	ra->prev_page = -1;
 }
 
-/*
- * Return max readahead size for this inode in number-of-pages.
- */
-static inline unsigned long get_max_readahead(struct file_ra_state *ra)
-{
-	return ra->ra_pages;
-}
-
-static inline unsigned long get_min_readahead(struct file_ra_state *ra)
-{
-	return (VM_MIN_READAHEAD * 1024) / PAGE_CACHE_SIZE;
-}
-
-static inline void ra_off(struct file_ra_state *ra)
-{
-	ra->start = 0;
-	ra->flags = 0;
-	ra->size = 0;
-	ra->ahead_start = 0;
-	ra->ahead_size = 0;
-	return;
-}
+#ifdef CONFIG_DEBUG_READAHEAD
+#define ra_trace(pattern, mapping, offset, req_size, ra, actual)	\
+	printk(KERN_DEBUG "readahead-%s(ino=%lu, req=%lu+%lu, "		\
+		"ra=%lu+%lu-%lu) = %d\n", pattern,			\
+		(mapping)->host->i_ino, offset, req_size,		\
+		(ra)->start, (ra)->size, (ra)->async_size, actual)
+#else
+#define ra_trace(pattern, mapping, offset, req_size, ra, actual)	\
+	do { } while (0)
+#endif
 
 /*
  * Set the initial window size, round to next power of 2 and square
@@ -81,25 +69,19 @@ static unsigned long get_init_ra_size(unsigned long size, unsigned long max)
 }
 
 /*
- * Set the new window size, this is called only when I/O is to be submitted,
- * not for each call to readahead.  If a cache miss occured, reduce next I/O
- * size, else increase depending on how close to max we are.
+ * Get the size of the next window: ramp up fast while it is small,
+ * then slow down as it approaches max_readahead.
  */
-static inline unsigned long get_next_ra_size(struct file_ra_state *ra)
+static inline unsigned long get_next_ra_size(struct file_ra_state *ra,
+					     unsigned long max)
 {
-	unsigned long max = get_max_readahead(ra);
-	unsigned long min = get_min_readahead(ra);
 	unsigned long cur = ra->size;
 	unsigned long newsize;
 
-	if (ra->flags & RA_FLAG_MISS) {
-		ra->flags &= ~RA_FLAG_MISS;
-		newsize = max((cur - 2), min);
-	} else if (cur < max / 16) {
+	if (cur < max / 16)
 		newsize = 4 * cur;
-	} else {
+	else
 		newsize = 2 * cur;
-	}
 	return min(newsize, max);
 }
 
@@ -157,8 +139,11 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 {
 	unsigned page_idx;
 	struct pagevec lru_pvec;
+	struct blk_plug plug;
 	int ret = 0;
 
+	blk_start_plug(&plug);
+
 	if (mapping->a_ops->readpages) {
 		ret = mapping->a_ops->readpages(filp, mapping, pages, nr_pages);
 		goto out;
@@ -179,81 +164,72 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 	}
 	pagevec_lru_add(&lru_pvec);
 out:
+	blk_finish_plug(&plug);
 	return ret;
 }
 
 /*
  * Readahead design.
  *
- * The fields in struct file_ra_state represent the most-recently-executed
- * readahead attempt:
+ * Readahead is done on demand: it is triggered by what the reader finds,
+ * or does not find, in the page cache rather than by bookkeeping done on
+ * every read.  There are two triggers:
  *
- * start:	Page index at which we started the readahead
- * size:	Number of pages in that read
- *              Together, these form the "current window".
- *              Together, start and size represent the `readahead window'.
- * prev_page:   The page which the readahead algorithm most-recently inspected.
- *              It is mainly used to detect sequential file reading.
- *              If page_cache_readahead sees that it is again being called for
- *              a page which it just looked at, it can return immediately without
- *              making any state changes.
- * ahead_start,
- * ahead_size:  Together, these form the "ahead window".
- * ra_pages:	The externally controlled max readahead for this fd.
- *
- * When readahead is in the off state (size == 0), readahead is disabled.
- * In this state, prev_page is used to detect the resumption of sequential I/O.
- *
- * The readahead code manages two windows - the "current" and the "ahead"
- * windows.  The intent is that while the application is walking the pages
- * in the current window, I/O is underway on the ahead window.  When the
- * current window is fully traversed, it is replaced by the ahead window
- * and the ahead window is invalidated.  When this copying happens, the
- * new current window's pages are probably still locked.  So
- * we submit a new batch of I/O immediately, creating a new ahead window.
- *
- * So:
+ * - a synchronous readahead when the page being read is not cached, and
+ * - an asynchronous readahead when the page being read has PG_readahead
+ *   set.  That page is marked when a window is submitted, async_size
+ *   pages before the window ends, so that the next window is in flight
+ *   by the time the reader gets to it.
  *
- *   ----|----------------|----------------|-----
- *       ^start           ^start+size
- *                        ^ahead_start     ^ahead_start+ahead_size
+ * The fields in struct file_ra_state describe the most recently submitted
+ * window:
  *
- *         ^ When this page is read, we submit I/O for the
- *           ahead window.
+ * start:	Page index at which the window starts
+ * size:	Number of pages in the window
+ * async_size:	Number of pages at the end of the window which are read
+ *		ahead asynchronously, ie. the distance of the PG_readahead
+ *		page from the end of the window
+ * prev_page:	The page which was last read.  It is used to detect
+ *		sequential reads which miss the page cache.
+ * ra_pages:	The externally controlled max readahead for this fd.
  *
- * A `readahead hit' occurs when a read request is made against a page which is
- * the next sequential page. Ahead window calculations are done only when it
- * is time to submit a new IO.  The code ramps up the size agressively at first,
- * but slow down as it approaches max_readhead.
+ *   ----|-------------------------|--------------|-----
+ *       ^start                    ^               ^start+size
+ *                                 ^start+size-async_size: PG_readahead
  *
- * Any seek/ramdom IO will result in readahead being turned off.  It will resume
- * at the first sequential access.
+ * When the marked page is read in the expected place, the window is simply
+ * pushed forward and ramped up.  When a marked page is hit but the state
+ * says otherwise, the file is being read by more than one stream (several
+ * threads, or reads interleaved by one process, or nfsd reopening the file
+ * for each request), and the window is rebuilt from the page cache: the
+ * run of cached pages following the page is the previous window.
  *
- * There is a special-case: if the first page which the application tries to
- * read happens to be the first page of the file, it is assumed that a linear
- * read is about to happen and the window is immediately set to the initial size
- * based on I/O request size and the max_readahead.
+ * A cache miss is treated as the start of a sequential stream when it is at
+ * the start of the file, right after the previous read, or big; otherwise
+ * the pages cached right before the miss are counted, as those are what a
+ * sequential reader leaves behind.  Failing that, cached pages right after
+ * the read indicate a backward reader, which is given a window ending
+ * where the read ends.  A read showing none of these is random, and only
+ * the requested pages are read, leaving the readahead state alone.
  *
- * This function is to be called for every read request, rather than when
- * it is time to perform readahead.  It is called only once for the entire I/O
- * regardless of size unless readahead is unable to start enough I/O to satisfy
- * the request (I/O request > max_readahead).
+ * If readahead pages are reclaimed before they are read, the reader simply
+ * misses again and the window is rebuilt at the miss.
  */
 
 /*
- * do_page_cache_readahead actually reads a chunk of disk.  It allocates all
- * the pages first, then submits them all for I/O. This avoids the very bad
- * behaviour which would occur if page allocations are causing VM writeback.
- * We really don't want to intermingle reads and writes like that.
+ * __do_page_cache_readahead actually reads a chunk of disk.  It allocates
+ * all the pages first, then submits them all for I/O. This avoids the very
+ * bad behaviour which would occur if page allocations are causing VM
+ * writeback.  We really don't want to intermingle reads and writes like
+ * that.  The page @lookahead_size pages before the end of the chunk gets
+ * PG_readahead set, if it had to be allocated.
  *
  * Returns the number of pages requested, or the maximum amount of I/O allowed.
- *
- * do_page_cache_readahead() returns -1 if it encountered request queue
- * congestion.
  */
 static int
 __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
-			unsigned long offset, unsigned long nr_to_read)
+			unsigned long offset, unsigned long nr_to_read,
+			unsigned long lookahead_size)
 {
 	struct inode *inode = mapping->host;
 	struct page *page;
@@ -271,27 +247,29 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	/*
 	 * Preallocate as many pages as we will need.
 	 */
-	read_lock_irq(&mapping->tree_lock);
+	page_cache_read_lock(mapping);
 	for (page_idx = 0; page_idx < nr_to_read; page_idx++) {
-		unsigned long page_offset = offset + page_idx;
-		
-		if (page_offset > end_index)
-			break;
+		unsigned long page_offset;
 
-		page = radix_tree_lookup(&mapping->page_tree, page_offset);
-		if (page)
-			continue;
+		/* Step over the pages cached already */
+		page_offset = radix_tree_next_hole(&mapping->page_tree,
+					offset + page_idx, nr_to_read - page_idx);
+		page_idx = page_offset - offset;
+		if (page_idx >= nr_to_read || page_offset > end_index)
+			break;
 
-		read_unlock_irq(&mapping->tree_lock);
+		page_cache_read_unlock(mapping);
 		page = page_cache_alloc_cold(mapping);
-		read_lock_irq(&mapping->tree_lock);
+		page_cache_read_lock(mapping);
 		if (!page)
 			break;
 		page->index = page_offset;
 		list_add(&page->lru, &page_pool);
+		if (lookahead_size && page_idx == nr_to_read - lookahead_size)
+			SetPageReadahead(page);
 		ret++;
 	}
-	read_unlock_irq(&mapping->tree_lock);
+	page_cache_read_unlock(mapping);
 
 	/*
 	 * Now start the IO.  We ignore I/O errors - if the page is not
@@ -325,7 +303,7 @@ int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		if (this_chunk > nr_to_read)
 			this_chunk = nr_to_read;
 		err = __do_page_cache_readahead(mapping, filp,
-						offset, this_chunk);
+						offset, this_chunk, 0);
 		if (err < 0) {
 			ret = err;
 			break;
@@ -338,33 +316,13 @@ int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 }
 
 /*
- * Check how effective readahead is being.  If the amount of started IO is
- * less than expected then the file is partly or fully in pagecache and
- * readahead isn't helping.
- *
- */
-static inline int check_ra_success(struct file_ra_state *ra,
-			unsigned long nr_to_read, unsigned long actual)
-{
-	if (actual == 0) {
-		ra->cache_hit += nr_to_read;
-		if (ra->cache_hit >= VM_MAX_CACHE_HIT) {
-			ra_off(ra);
-			ra->flags |= RA_FLAG_INCACHE;
-			return 0;
-		}
-	} else {
-		ra->cache_hit=0;
-	}
-	return 1;
-}
-
-/*
- * This version skips the IO if the queue is read-congested, and will tell the
- * block layer to abandon the readahead if request allocation would block.
+ * This version skips the IO if the queue is read-congested.
  *
  * force_page_cache_readahead() will ignore queue congestion and will block on
  * request queues.
+ *
+ * do_page_cache_readahead() returns -1 if it encountered request queue
+ * congestion.
  */
 int do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			unsigned long offset, unsigned long nr_to_read)
@@ -372,174 +330,273 @@ int do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	if (bdi_read_congested(mapping->backing_dev_info))
 		return -1;
 
-	return __do_page_cache_readahead(mapping, filp, offset, nr_to_read);
+	return __do_page_cache_readahead(mapping, filp, offset, nr_to_read, 0);
 }
 
 /*
- * Read 'nr_to_read' pages starting at page 'offset'. If the flag 'block'
- * is set wait till the read completes.  Otherwise attempt to read without
- * blocking.
- * Returns 1 meaning 'success' if read is succesfull without switching off
- * readhaead mode. Otherwise return failure.
+ * Submit the window described by @ra.
  */
-static int
-blockable_page_cache_readahead(struct address_space *mapping, struct file *filp,
-			unsigned long offset, unsigned long nr_to_read,
-			struct file_ra_state *ra, int block)
+static inline int ra_submit(struct file_ra_state *ra,
+			    struct address_space *mapping, struct file *filp)
 {
-	int actual;
+	return __do_page_cache_readahead(mapping, filp,
+				ra->start, ra->size, ra->async_size);
+}
+
+/*
+ * Find the first hole (uncached page) at or after @index, looking at no
+ * more than @max pages.  Returns @index + @max if there is none.
+ */
+static unsigned long next_cache_hole(struct address_space *mapping,
+				     unsigned long index, unsigned long max)
+{
+	unsigned long hole;
+
+	page_cache_read_lock(mapping);
+	hole = radix_tree_next_hole(&mapping->page_tree, index, max);
+	page_cache_read_unlock(mapping);
+	return hole;
+}
 
-	if (!block && bdi_read_congested(mapping->backing_dev_info))
-		return 0;
+/*
+ * Count the cached pages right before @index, looking at no more than
+ * @max pages.
+ */
+static unsigned long count_history_pages(struct address_space *mapping,
+					 unsigned long index, unsigned long max)
+{
+	unsigned long hole;
 
-	actual = __do_page_cache_readahead(mapping, filp, offset, nr_to_read);
+	if (max > index)
+		max = index;
 
-	return check_ra_success(ra, nr_to_read, actual);
+	page_cache_read_lock(mapping);
+	hole = radix_tree_prev_hole(&mapping->page_tree, index - 1, max);
+	page_cache_read_unlock(mapping);
+	return index - 1 - hole;
 }
 
-static int make_ahead_window(struct address_space *mapping, struct file *filp,
-				struct file_ra_state *ra, int force)
+/*
+ * Look for the cached pages that a forward or backward sequential reader
+ * would have left around the missed read at @offset, and set up a window
+ * for it.  Returns the name of the pattern found, or NULL for a random read.
+ */
+static const char *try_context_readahead(struct address_space *mapping,
+				struct file_ra_state *ra, unsigned long offset,
+				unsigned long req_size, unsigned long max)
 {
-	int block, ret;
-
-	ra->ahead_size = get_next_ra_size(ra);
-	ra->ahead_start = ra->start + ra->size;
-
-	block = force || (ra->prev_page >= ra->ahead_start);
-	ret = blockable_page_cache_readahead(mapping, filp,
-			ra->ahead_start, ra->ahead_size, ra, block);
-
-	if (!ret && !force) {
-		/* A read failure in blocking mode, implies pages are
-		 * all cached. So we can safely assume we have taken
-		 * care of all the pages requested in this call.
-		 * A read failure in non-blocking mode, implies we are
-		 * reading more pages than requested in this call.  So
-		 * we safely assume we have taken care of all the pages
-		 * requested in this call.
-		 *
-		 * Just reset the ahead window in case we failed due to
-		 * congestion.  The ahead window will any way be closed
-		 * in case we failed due to excessive page cache hits.
+	unsigned long size;
+
+	size = count_history_pages(mapping, offset, max);
+	if (size) {
+		/*
+		 * History all the way back to the start of the file is a
+		 * strong indication of a long stream (or whole-file read).
 		 */
-		ra->ahead_start = 0;
-		ra->ahead_size = 0;
+		if (size >= offset)
+			size *= 2;
+
+		ra->start = offset;
+		ra->size = get_init_ra_size(size + req_size, max);
+		ra->async_size = ra->size;
+		return "context";
 	}
 
-	return ret;
+	size = next_cache_hole(mapping, offset + req_size, max) -
+			(offset + req_size);
+	if (size) {
+		/*
+		 * Reading backwards: read the window ending where this read
+		 * ends.  There is nothing to mark, the next read misses the
+		 * cache right below this window and finds it as history.
+		 */
+		size = get_init_ra_size(size + req_size, max);
+		if (size > offset + req_size)
+			size = offset + req_size;
+		ra->start = offset + req_size - size;
+		ra->size = size;
+		ra->async_size = 0;
+		return "backward";
+	}
+
+	return NULL;
 }
 
 /*
- * page_cache_readahead is the main function.  If performs the adaptive
- * readahead window size management and submits the readahead I/O.
+ * A minimal readahead algorithm for trivial sequential/random reads.
  */
-unsigned long
-page_cache_readahead(struct address_space *mapping, struct file_ra_state *ra,
-		     struct file *filp, unsigned long offset,
-		     unsigned long req_size)
+static unsigned long
+ondemand_readahead(struct address_space *mapping, struct file_ra_state *ra,
+		   struct file *filp, int hit_readahead_marker,
+		   unsigned long offset, unsigned long req_size)
 {
-	unsigned long max, newsize;
-	int sequential;
+	unsigned long max = max_sane_readahead(ra->ra_pages);
+	const char *pattern;
+	int actual;
 
 	/*
-	 * We avoid doing extra work and bogusly perturbing the readahead
-	 * window expansion logic.
+	 * Start of file.
 	 */
-	if (offset == ra->prev_page && --req_size)
-		++offset;
+	if (!offset) {
+		pattern = "initial";
+		goto initial_readahead;
+	}
 
-	/* Note that prev_page == -1 if it is a first read */
-	sequential = (offset == ra->prev_page + 1);
-	ra->prev_page = offset;
+	/*
+	 * It's the expected callback offset, assume sequential access.
+	 * Ramp up sizes, and push forward the readahead window.
+	 */
+	if (offset == ra->start + ra->size - ra->async_size ||
+	    offset == ra->start + ra->size) {
+		ra->start += ra->size;
+		ra->size = get_next_ra_size(ra, max);
+		ra->async_size = ra->size;
+		pattern = "sequential";
+		goto readit;
+	}
 
-	max = get_max_readahead(ra);
-	newsize = min(req_size, max);
+	/*
+	 * Hit a marked page without valid readahead state: interleaved
+	 * streams.  The cached pages from here on are the previous window
+	 * of this stream, so ramp that up and read it ahead.
+	 */
+	if (hit_readahead_marker) {
+		unsigned long start;
 
-	/* No readahead or sub-page sized read or file already in cache */
-	if (newsize == 0 || (ra->flags & RA_FLAG_INCACHE))
-		goto out;
+		start = next_cache_hole(mapping, offset + 1, max);
+		if (start - offset > max)
+			return 0;
 
-	ra->prev_page += newsize - 1;
+		ra->start = start;
+		ra->size = start - offset;	/* old async_size */
+		ra->size += req_size;
+		ra->size = get_next_ra_size(ra, max);
+		ra->async_size = ra->size;
+		pattern = "interleaved";
+		goto readit;
+	}
 
 	/*
-	 * Special case - first read at start of file. We'll assume it's
-	 * a whole-file read and grow the window fast.  Or detect first
-	 * sequential access
+	 * Oversize read: assume a stream, it has to be read anyway.
 	 */
-	if (sequential && ra->size == 0) {
-		ra->size = get_init_ra_size(newsize, max);
-		ra->start = offset;
-		if (!blockable_page_cache_readahead(mapping, filp, offset,
-							 ra->size, ra, 1))
-			goto out;
-
-		/*
-		 * If the request size is larger than our max readahead, we
-		 * at least want to be sure that we get 2 IOs in flight and
-		 * we know that we will definitly need the new I/O.
-		 * once we do this, subsequent calls should be able to overlap
-		 * IOs,* thus preventing stalls. so issue the ahead window
-		 * immediately.
-		 */
-		if (req_size >= max)
-			make_ahead_window(mapping, filp, ra, 1);
-
-		goto out;
+	if (req_size > max) {
+		pattern = "oversize";
+		goto initial_readahead;
 	}
 
 	/*
-	 * Now handle the random case:
-	 * partial page reads and first access were handled above,
-	 * so this must be the next page otherwise it is random
+	 * Sequential cache miss: the readahead pages were reclaimed, or
+	 * the stream stopped triggering them.
 	 */
-	if (!sequential) {
-		ra_off(ra);
-		blockable_page_cache_readahead(mapping, filp, offset,
-				 newsize, ra, 1);
-		goto out;
+	if (offset - ra->prev_page <= 1UL) {
+		pattern = "miss";
+		goto initial_readahead;
 	}
 
+	pattern = try_context_readahead(mapping, ra, offset, req_size, max);
+	if (pattern)
+		goto readit;
+
 	/*
-	 * If we get here we are doing sequential IO and this was not the first
-	 * occurence (ie we have an existing window)
+	 * Standalone, small random read.  Read as is, and do not pollute
+	 * the readahead state.
 	 */
+	actual = __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	ra_trace("random", mapping, offset, req_size, ra, actual);
+	return actual;
 
-	if (ra->ahead_start == 0) {	 /* no ahead window yet */
-		if (!make_ahead_window(mapping, filp, ra, 0))
-			goto out;
-	}
+initial_readahead:
+	ra->start = offset;
+	ra->size = get_init_ra_size(req_size, max);
+	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
+
+readit:
 	/*
-	 * Already have an ahead window, check if we crossed into it.
-	 * If so, shift windows and issue a new ahead window.
-	 * Only return the #pages that are in the current window, so that
-	 * we get called back on the first page of the ahead window which
-	 * will allow us to submit more IO.
+	 * Will this read hit the readahead marker made by itself?  If so,
+	 * trigger the readahead marker hit now, and merge the resulting
+	 * next window into the current one.
 	 */
-	if (ra->prev_page >= ra->ahead_start) {
-		ra->start = ra->ahead_start;
-		ra->size = ra->ahead_size;
-		make_ahead_window(mapping, filp, ra, 0);
+	if (offset == ra->start && ra->async_size && ra->size == ra->async_size) {
+		ra->async_size = get_next_ra_size(ra, max);
+		ra->size += ra->async_size;
 	}
 
-out:
-	return ra->prev_page + 1;
+	actual = ra_submit(ra, mapping, filp);
+	ra_trace(pattern, mapping, offset, req_size, ra, actual);
+	return actual;
 }
 
-/*
- * handle_ra_miss() is called when it is known that a page which should have
- * been present in the pagecache (we just did some readahead there) was in fact
- * not found.  This will happen if it was evicted by the VM (readahead
- * thrashing)
+/**
+ * page_cache_sync_readahead - generic file readahead
+ * @mapping: address_space which holds the pagecache and I/O vectors
+ * @ra: file_ra_state which holds the readahead state
+ * @filp: passed on to ->readpage() and ->readpages()
+ * @offset: start offset into @mapping, in pagecache page-sized units
+ * @req_size: hint: total size of the read which the caller is performing in
+ *            pagecache pages
  *
- * Turn on the cache miss flag in the RA struct, this will cause the RA code
- * to reduce the RA size on the next read.
+ * page_cache_sync_readahead() should be called when a cache miss happened:
+ * it will submit the read.  The readahead logic may decide to piggyback more
+ * pages onto the read request if access patterns suggest it will improve
+ * performance.
  */
-void handle_ra_miss(struct address_space *mapping,
-		struct file_ra_state *ra, pgoff_t offset)
+void page_cache_sync_readahead(struct address_space *mapping,
+			       struct file_ra_state *ra, struct file *filp,
+			       unsigned long offset, unsigned long req_size)
 {
-	ra->flags |= RA_FLAG_MISS;
-	ra->flags &= ~RA_FLAG_INCACHE;
+	/* no read-ahead */
+	if (!ra->ra_pages)
+		return;
+
+	if (!req_size)
+		req_size = 1;
+
+	ondemand_readahead(mapping, ra, filp, 0, offset, req_size);
+}
+EXPORT_SYMBOL_GPL(page_cache_sync_readahead);
+
+/**
+ * page_cache_async_readahead - file readahead for marked pages
+ * @mapping: address_space which holds the pagecache and I/O vectors
+ * @ra: file_ra_state which holds the readahead state
+ * @filp: passed on to ->readpage() and ->readpages()
+ * @page: the page at @offset which has the PG_readahead flag set
+ * @offset: start offset into @mapping, in pagecache page-sized units
+ * @req_size: hint: total size of the read which the caller is performing in
+ *            pagecache pages
+ *
+ * page_cache_async_readahead() should be called when a page is used which
+ * has the PG_readahead flag: this is a marker to suggest that the
+ * application has used up enough of the readahead window that we should
+ * start pulling in more pages.
+ */
+void page_cache_async_readahead(struct address_space *mapping,
+				struct file_ra_state *ra, struct file *filp,
+				struct page *page, unsigned long offset,
+				unsigned long req_size)
+{
+	/* no read-ahead */
+	if (!ra->ra_pages)
+		return;
+
+	/*
+	 * Same bit is used for PG_readahead and swap readahead hits.
+	 */
+	if (!TestClearPageReadahead(page))
+		return;
+
+	/*
+	 * Defer asynchronous readahead on IO congestion.
+	 */
+	if (bdi_read_congested(mapping->backing_dev_info))
+		return;
+
+	if (!req_size)
+		req_size = 1;
+
+	ondemand_readahead(mapping, ra, filp, 1, offset, req_size);
 }
+EXPORT_SYMBOL_GPL(page_cache_async_readahead);
 
 /*
  * Given a desired number of PAGE_CACHE_SIZE readahead pages, return a
@@ -31,18 +31,18 @@
  * mm->mmap_sem
  *   page->flags PG_locked (lock_page)
  *     mapping->i_mmap_lock
- *       anon_vma->lock
+ *       anon_vma->root->lock
  *         mm->page_table_lock
  *           zone->lru_lock (in mark_page_accessed)
  *           swap_list_lock (in swap_free etc's swap_info_get)
  *             mmlist_lock (in mmput, drain_mmlist and others)
  *             swap_device_lock (in swap_duplicate, swap_info_get)
  *             mapping->private_lock (in __set_page_dirty_buffers)
- *             inode_lock (in set_page_dirty's __mark_inode_dirty)
- *               sb_lock (within inode_lock in fs/fs-writeback.c)
- *               mapping->tree_lock (widely used, in set_page_dirty,
- *                         in arch-dependent flush_dcache_mmap_lock,
- *                         within inode_lock in __sync_single_inode)
+ *             sb->s_inode_wb_lock (in set_page_dirty's __mark_inode_dirty)
+ *               inode->i_lock (in set_page_dirty's __mark_inode_dirty)
+ *                 mapping->tree_lock (widely used, in set_page_dirty,
+ *                           in arch-dependent flush_dcache_mmap_lock,
+ *                           within inode->i_lock in __sync_single_inode)
  */
 
 #include <linux/mm.h>
@@ -52,6 +52,7 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/rmap.h>
+#include <linux/huge_mm.h>
 #include <linux/rcupdate.h>
 
 #include <asm/tlbflush.h>
@@ -59,111 +60,199 @@
 //#define RMAP_DEBUG /* can be enabled only for debugging */
 
 kmem_cache_t *anon_vma_cachep;
+kmem_cache_t *anon_vma_chain_cachep;
 
-static inline void validate_anon_vma(struct vm_area_struct *find_vma)
+static inline void validate_anon_vma(struct anon_vma_chain *find_avc)
 {
 #ifdef RMAP_DEBUG
-	struct anon_vma *anon_vma = find_vma->anon_vma;
-	struct vm_area_struct *vma;
+	struct anon_vma *anon_vma = find_avc->anon_vma;
+	struct anon_vma_chain *avc;
 	unsigned int mapcount = 0;
 	int found = 0;
 
-	list_for_each_entry(vma, &anon_vma->head, anon_vma_node) {
+	list_for_each_entry(avc, &anon_vma->head, same_anon_vma) {
 		mapcount++;
 		BUG_ON(mapcount > 100000);
-		if (vma == find_vma)
+		if (avc == find_avc)
 			found = 1;
 	}
 	BUG_ON(!found);
 #endif
 }
 
+/* Called with the root anon_vma's lock held for writing */
+static void anon_vma_chain_link(struct vm_area_struct *vma,
+		struct anon_vma_chain *avc, struct anon_vma *anon_vma)
+{
+	avc->vma = vma;
+	avc->anon_vma = anon_vma;
+	list_add(&avc->same_vma, &vma->anon_vma_chain);
+	list_add_tail(&avc->same_anon_vma, &anon_vma->head);
+	validate_anon_vma(avc);
+}
+
 /* This must be called under the mmap_sem. */
 int anon_vma_prepare(struct vm_area_struct *vma)
 {
 	struct anon_vma *anon_vma = vma->anon_vma;
+	struct anon_vma_chain *avc;
 
 	might_sleep();
 	if (unlikely(!anon_vma)) {
 		struct mm_struct *mm = vma->vm_mm;
-		struct anon_vma *allocated, *locked;
+		struct anon_vma *allocated;
+
+		avc = anon_vma_chain_alloc();
+		if (unlikely(!avc))
+			return -ENOMEM;
 
 		anon_vma = find_mergeable_anon_vma(vma);
-		if (anon_vma) {
-			allocated = NULL;
-			locked = anon_vma;
-			spin_lock(&locked->lock);
-		} else {
+		allocated = NULL;
+		if (!anon_vma) {
 			anon_vma = anon_vma_alloc();
-			if (unlikely(!anon_vma))
+			if (unlikely(!anon_vma)) {
+				anon_vma_chain_free(avc);
 				return -ENOMEM;
+			}
 			allocated = anon_vma;
-			locked = NULL;
 		}
 
+		write_lock(&anon_vma->root->lock);
 		/* page_table_lock to protect against threads */
 		spin_lock(&mm->page_table_lock);
 		if (likely(!vma->anon_vma)) {
 			vma->anon_vma = anon_vma;
-			list_add(&vma->anon_vma_node, &anon_vma->head);
+			INIT_LIST_HEAD(&vma->anon_vma_chain);
+			anon_vma_chain_link(vma, avc, anon_vma);
 			allocated = NULL;
+			avc = NULL;
 		}
 		spin_unlock(&mm->page_table_lock);
+		write_unlock(&anon_vma->root->lock);
 
-		if (locked)
-			spin_unlock(&locked->lock);
 		if (unlikely(allocated))
 			anon_vma_free(allocated);
+		if (unlikely(avc))
+			anon_vma_chain_free(avc);
 	}
 	return 0;
 }
 
-void __anon_vma_merge(struct vm_area_struct *vma, struct vm_area_struct *next)
+static void unlink_anon_vma_chain(struct anon_vma_chain *avc)
 {
-	BUG_ON(vma->anon_vma != next->anon_vma);
-	list_del(&next->anon_vma_node);
+	struct anon_vma *anon_vma = avc->anon_vma;
+	struct anon_vma *root = anon_vma->root;
+	int empty;
+
+	write_lock(&root->lock);
+	validate_anon_vma(avc);
+	list_del(&avc->same_anon_vma);
+
+	/* We must garbage collect the anon_vma if it's empty */
+	empty = list_empty(&anon_vma->head) && !atomic_read(&anon_vma->refcount);
+	write_unlock(&root->lock);
+
+	if (!empty)
+		return;
+	anon_vma_free(anon_vma);
+	if (root == anon_vma)
+		return;
+
+	write_lock(&root->lock);
+	empty = atomic_dec_and_test(&root->refcount) && list_empty(&root->head);
+	write_unlock(&root->lock);
+	if (empty)
+		anon_vma_free(root);
 }
 
-void __anon_vma_link(struct vm_area_struct *vma)
+static void __unlink_anon_vmas(struct vm_area_struct *vma)
 {
-	struct anon_vma *anon_vma = vma->anon_vma;
+	struct anon_vma_chain *avc, *next;
 
-	if (anon_vma) {
-		list_add(&vma->anon_vma_node, &anon_vma->head);
-		validate_anon_vma(vma);
+	list_for_each_entry_safe(avc, next, &vma->anon_vma_chain, same_vma) {
+		unlink_anon_vma_chain(avc);
+		list_del(&avc->same_vma);
+		anon_vma_chain_free(avc);
 	}
+	vma->anon_vma = NULL;
 }
 
-void anon_vma_link(struct vm_area_struct *vma)
+/*
+ * Unlink @vma from all its anon_vmas, freeing those it was the last
+ * vma of.  Called when the vma goes away, with its pages unmapped.
+ */
+void unlink_anon_vmas(struct vm_area_struct *vma)
 {
-	struct anon_vma *anon_vma = vma->anon_vma;
+	if (vma->anon_vma)
+		__unlink_anon_vmas(vma);
+}
+
+/*
+ * Link @dst, a copy of @src, to all the anon_vmas @src is linked to,
+ * oldest first, so that @dst->anon_vma_chain comes out in the same order.
+ * Called under the mmap_sem.
+ */
+int anon_vma_clone(struct vm_area_struct *dst, struct vm_area_struct *src)
+{
+	struct anon_vma_chain *avc, *pavc;
+
+	INIT_LIST_HEAD(&dst->anon_vma_chain);
+	if (!src->anon_vma)
+		return 0;
 
-	if (anon_vma) {
-		spin_lock(&anon_vma->lock);
-		list_add(&vma->anon_vma_node, &anon_vma->head);
-		validate_anon_vma(vma);
-		spin_unlock(&anon_vma->lock);
+	list_for_each_entry_reverse(pavc, &src->anon_vma_chain, same_vma) {
+		struct anon_vma *root = pavc->anon_vma->root;
+
+		avc = anon_vma_chain_alloc();
+		if (!avc)
+			goto enomem;
+		write_lock(&root->lock);
+		anon_vma_chain_link(dst, avc, pavc->anon_vma);
+		write_unlock(&root->lock);
 	}
+	return 0;
+
+enomem:
+	__unlink_anon_vmas(dst);
+	return -ENOMEM;
 }
 
-void anon_vma_unlink(struct vm_area_struct *vma)
+/*
+ * Link @vma, the child's copy of @pvma in fork, to the anon_vmas of
+ * @pvma, and give it an anon_vma of its own for the pages it COWs.
+ * The new anon_vma keeps the root of the tree alive.
+ */
+int anon_vma_fork(struct vm_area_struct *vma, struct vm_area_struct *pvma)
 {
-	struct anon_vma *anon_vma = vma->anon_vma;
-	int empty;
-
-	if (!anon_vma)
-		return;
+	struct anon_vma_chain *avc;
+	struct anon_vma *anon_vma, *root;
 
-	spin_lock(&anon_vma->lock);
-	validate_anon_vma(vma);
-	list_del(&vma->anon_vma_node);
+	if (!pvma->anon_vma)
+		return 0;
+	if (anon_vma_clone(vma, pvma))
+		return -ENOMEM;
 
-	/* We must garbage collect the anon_vma if it's empty */
-	empty = list_empty(&anon_vma->head);
-	spin_unlock(&anon_vma->lock);
+	anon_vma = anon_vma_alloc();
+	if (!anon_vma)
+		goto out_unlink;
+	avc = anon_vma_chain_alloc();
+	if (!avc)
+		goto out_free;
+
+	root = pvma->anon_vma->root;
+	anon_vma->root = root;
+	vma->anon_vma = anon_vma;
+	write_lock(&root->lock);
+	atomic_inc(&root->refcount);
+	anon_vma_chain_link(vma, avc, anon_vma);
+	write_unlock(&root->lock);
+	return 0;
 
-	if (empty)
-		anon_vma_free(anon_vma);
+out_free:
+	anon_vma_free(anon_vma);
+out_unlink:
+	__unlink_anon_vmas(vma);
+	return -ENOMEM;
 }
 
 static void anon_vma_ctor(void *data, kmem_cache_t *cachep, unsigned long flags)
@@ -172,7 +261,9 @@ static void anon_vma_ctor(void *data, kmem_cache_t *cachep, unsigned long flags)
 						SLAB_CTOR_CONSTRUCTOR) {
 		struct anon_vma *anon_vma = data;
 
-		spin_lock_init(&anon_vma->lock);
+		anon_vma->root = anon_vma;
+		rwlock_init(&anon_vma->lock);
+		atomic_set(&anon_vma->refcount, 0);
 		INIT_LIST_HEAD(&anon_vma->head);
 	}
 }
@@ -181,31 +272,47 @@ void __init anon_vma_init(void)
 {
 	anon_vma_cachep = kmem_cache_create("anon_vma", sizeof(struct anon_vma),
 			0, SLAB_DESTROY_BY_RCU|SLAB_PANIC, anon_vma_ctor, NULL);
+	anon_vma_chain_cachep = kmem_cache_create("anon_vma_chain",
+			sizeof(struct anon_vma_chain), 0, SLAB_PANIC, NULL, NULL);
 }
 
 /*
  * Getting a lock on a stable anon_vma from a page off the LRU is
  * tricky: page_lock_anon_vma rely on RCU to guard against the races.
+ * The anon_vma may be freed and reused as we look at it, but its memory
+ * stays an anon_vma with a valid root: once we hold the root's lock,
+ * the page still being mapped tells that it is still the page's.
  */
 static struct anon_vma *page_lock_anon_vma(struct page *page)
 {
 	struct anon_vma *anon_vma = NULL;
+	struct anon_vma *root;
 	unsigned long anon_mapping;
 
 	rcu_read_lock();
 	anon_mapping = (unsigned long) page->mapping;
 	if (!(anon_mapping & PAGE_MAPPING_ANON))
 		goto out;
-	if (!page_mapped(page))
+	if (!page_mapped(page) || PageKsm(page))
 		goto out;
 
 	anon_vma = (struct anon_vma *) (anon_mapping - PAGE_MAPPING_ANON);
-	spin_lock(&anon_vma->lock);
+	root = anon_vma->root;
+	read_lock(&root->lock);
+	if (!page_mapped(page)) {
+		read_unlock(&root->lock);
+		anon_vma = NULL;
+	}
 out:
 	rcu_read_unlock();
 	return anon_vma;
 }
 
+static inline void page_unlock_anon_vma(struct anon_vma *anon_vma)
+{
+	read_unlock(&anon_vma->root->lock);
+}
+
 /*
  * At what user virtual address is page expected in vma?
  */
@@ -231,8 +338,12 @@ vma_address(struct page *page, struct vm_area_struct *vma)
 unsigned long page_address_in_vma(struct page *page, struct vm_area_struct *vma)
 {
 	if (PageAnon(page)) {
-		if ((void *)vma->anon_vma !=
-		    (void *)page->mapping - PAGE_MAPPING_ANON)
+		struct anon_vma *page_anon_vma = (struct anon_vma *)
+			((unsigned long)page->mapping - PAGE_MAPPING_ANON);
+
+		/* The page may be of any generation of the vma's fork tree */
+		if (!vma->anon_vma ||
+		    vma->anon_vma->root != page_anon_vma->root)
 			return -EFAULT;
 	} else if (page->mapping && !(vma->vm_flags & VM_NONLINEAR)) {
 		if (vma->vm_file->f_mapping != page->mapping)
@@ -277,6 +388,17 @@ static int page_referenced_one(struct page *page,
 	if (!pmd_present(*pmd))
 		goto out_unlock;
 
+	if (pmd_trans_huge(*pmd)) {
+		if (huge_pmd_page(*pmd, address) != page)
+			goto out_unlock;
+		if (page_referenced_huge_pmd(vma, pmd, address))
+			referenced++;
+		if (mm != current->mm && !ignore_token && has_swap_token(mm))
+			referenced++;
+		(*mapcount)--;
+		goto out_unlock;
+	}
+
 	pte = pte_offset_map(pmd, address);
 	if (!pte_present(*pte))
 		goto out_unmap;
@@ -304,7 +426,7 @@ static int page_referenced_anon(struct page *page, int ignore_token)
 {
 	unsigned int mapcount;
 	struct anon_vma *anon_vma;
-	struct vm_area_struct *vma;
+	struct anon_vma_chain *avc;
 	int referenced = 0;
 
 	anon_vma = page_lock_anon_vma(page);
@@ -312,13 +434,13 @@ static int page_referenced_anon(struct page *page, int ignore_token)
 		return referenced;
 
 	mapcount = page_mapcount(page);
-	list_for_each_entry(vma, &anon_vma->head, anon_vma_node) {
-		referenced += page_referenced_one(page, vma, &mapcount,
+	list_for_each_entry(avc, &anon_vma->head, same_anon_vma) {
+		referenced += page_referenced_one(page, avc->vma, &mapcount,
 							ignore_token);
 		if (!mapcount)
 			break;
 	}
-	spin_unlock(&anon_vma->lock);
+	page_unlock_anon_vma(anon_vma);
 	return referenced;
 }
 
@@ -467,6 +589,21 @@ void page_add_file_rmap(struct page *page)
 		inc_page_state(nr_mapped);
 }
 
+#ifdef CONFIG_KSM
+/**
+ * page_add_ksm_rmap - add pte mapping to a page merged by ksmd
+ * @page:	the page to add the mapping to
+ *
+ * The page replaces an anonymous page already counted in anon_rss.
+ * Caller needs to hold the mm->page_table_lock.
+ */
+void page_add_ksm_rmap(struct page *page)
+{
+	if (atomic_inc_and_test(&page->_mapcount))
+		inc_page_state(nr_mapped);
+}
+#endif
+
 /**
  * page_remove_rmap - take down pte mapping from a page
  * @page: page to remove mapping from
@@ -498,7 +635,8 @@ void page_remove_rmap(struct page *page)
  * Subfunctions of try_to_unmap: try_to_unmap_one called
  * repeatedly from either try_to_unmap_anon or try_to_unmap_file.
  */
-static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
+static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
+	int migration)
 {
 	struct mm_struct *mm = vma->vm_mm;
 	unsigned long address;
@@ -533,6 +671,16 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
 	if (!pmd_present(*pmd))
 		goto out_unlock;
 
+	/* A huge pmd has to be broken up before one of its pages can go */
+	if (pmd_trans_huge(*pmd)) {
+		if ((vma->vm_flags & VM_RESERVED) ||
+		    (!migration && (vma->vm_flags & VM_LOCKED))) {
+			ret = SWAP_FAIL;
+			goto out_unlock;
+		}
+		split_huge_pmd(mm, pmd, address);
+	}
+
 	pte = pte_offset_map(pmd, address);
 	if (!pte_present(*pte))
 		goto out_unmap;
@@ -544,9 +692,11 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
 	 * If the page is mlock()d, we cannot swap it out.
 	 * If it's recently referenced (perhaps page_referenced
 	 * skipped over this mm) then we should reactivate it.
+	 * Neither matters to migration, which puts the page back.
 	 */
-	if ((vma->vm_flags & (VM_LOCKED|VM_RESERVED)) ||
-			ptep_clear_flush_young(vma, address, pte)) {
+	if ((vma->vm_flags & VM_RESERVED) ||
+	    (!migration && ((vma->vm_flags & VM_LOCKED) ||
+			ptep_clear_flush_young(vma, address, pte)))) {
 		ret = SWAP_FAIL;
 		goto out_unmap;
 	}
@@ -580,7 +730,16 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma)
 	if (pte_dirty(pteval))
 		set_page_dirty(page);
 
-	if (PageAnon(page)) {
+	if (migration) {
+		/*
+		 * Leave a migration entry for faults to wait on, until
+		 * remove_migration_ptes() installs the new page here.
+		 */
+		set_pte_at(mm, address, pte,
+			   swp_entry_to_pte(make_migration_entry(page)));
+		if (PageAnon(page))
+			mm->anon_rss--;
+	} else if (PageAnon(page)) {
 		swp_entry_t entry = { .val = page->private };
 		/*
 		 * Store the swap location in the pte.
@@ -713,22 +872,22 @@ out_unlock:
 	spin_unlock(&mm->page_table_lock);
 }
 
-static int try_to_unmap_anon(struct page *page)
+static int try_to_unmap_anon(struct page *page, int migration)
 {
 	struct anon_vma *anon_vma;
-	struct vm_area_struct *vma;
+	struct anon_vma_chain *avc;
 	int ret = SWAP_AGAIN;
 
 	anon_vma = page_lock_anon_vma(page);
 	if (!anon_vma)
 		return ret;
 
-	list_for_each_entry(vma, &anon_vma->head, anon_vma_node) {
-		ret = try_to_unmap_one(page, vma);
+	list_for_each_entry(avc, &anon_vma->head, same_anon_vma) {
+		ret = try_to_unmap_one(page, avc->vma, migration);
 		if (ret == SWAP_FAIL || !page_mapped(page))
 			break;
 	}
-	spin_unlock(&anon_vma->lock);
+	page_unlock_anon_vma(anon_vma);
 	return ret;
 }
 
@@ -741,7 +900,7 @@ static int try_to_unmap_anon(struct page *page)
  *
  * This function is only called from try_to_unmap for object-based pages.
  */
-static int try_to_unmap_file(struct page *page)
+static int try_to_unmap_file(struct page *page, int migration)
 {
 	struct address_space *mapping = page->mapping;
 	pgoff_t pgoff = page->index << (PAGE_CACHE_SHIFT - PAGE_SHIFT);
@@ -755,7 +914,7 @@ static int try_to_unmap_file(struct page *page)
 
 	spin_lock(&mapping->i_mmap_lock);
 	vma_prio_tree_foreach(vma, &iter, &mapping->i_mmap, pgoff, pgoff) {
-		ret = try_to_unmap_one(page, vma);
+		ret = try_to_unmap_one(page, vma, migration);
 		if (ret == SWAP_FAIL || !page_mapped(page))
 			goto out;
 	}
@@ -763,6 +922,15 @@ static int try_to_unmap_file(struct page *page)
 	if (list_empty(&mapping->i_mmap_nonlinear))
 		goto out;
 
+	/*
+	 * Nonlinear ptes cannot be found from the page, so there is
+	 * no way to put migration entries in them.
+	 */
+	if (migration) {
+		ret = SWAP_FAIL;
+		goto out;
+	}
+
 	list_for_each_entry(vma, &mapping->i_mmap_nonlinear,
 						shared.vm_set.list) {
 		if (vma->vm_flags & (VM_LOCKED|VM_RESERVED))
@@ -835,16 +1003,17 @@ out:
 /**
  * try_to_unmap - try to remove all page table mappings to a page
  * @page: the page to get unmapped
+ * @migration: replace the mappings by migration entries
  *
  * Tries to remove all the page table entries which are mapping this
- * page, used in the pageout path.  Caller must hold the page lock.
- * Return values are:
+ * page, used in the pageout path and by page migration.  Caller must
+ * hold the page lock.  Return values are:
  *
  * SWAP_SUCCESS	- we succeeded in removing all mappings
  * SWAP_AGAIN	- we missed a mapping, try again later
  * SWAP_FAIL	- the page is unswappable
  */
-int try_to_unmap(struct page *page)
+int try_to_unmap(struct page *page, int migration)
 {
 	int ret;
 
@@ -852,11 +1021,109 @@ int try_to_unmap(struct page *page)
 	BUG_ON(!PageLocked(page));
 
 	if (PageAnon(page))
-		ret = try_to_unmap_anon(page);
+		ret = try_to_unmap_anon(page, migration);
 	else
-		ret = try_to_unmap_file(page);
+		ret = try_to_unmap_file(page, migration);
 
 	if (!page_mapped(page))
 		ret = SWAP_SUCCESS;
 	return ret;
 }
+
+#ifdef CONFIG_MIGRATION
+/*
+ * Replace a migration entry for @old at @address in @vma by a pte
+ * mapping @new.
+ */
+static void remove_migration_pte(struct vm_area_struct *vma,
+	struct page *old, struct page *new)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long address;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+	pte_t pteval;
+	swp_entry_t entry;
+
+	address = vma_address(new, vma);
+	if (address == -EFAULT)
+		return;
+
+	spin_lock(&mm->page_table_lock);
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		goto out_unlock;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		goto out_unlock;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		goto out_unlock;
+
+	pte = pte_offset_map(pmd, address);
+	pteval = *pte;
+	if (pte_none(pteval) || pte_present(pteval) || pte_file(pteval))
+		goto out_unmap;
+
+	entry = pte_to_swp_entry(pteval);
+	if (!is_migration_entry(entry) || migration_entry_to_page(entry) != old)
+		goto out_unmap;
+
+	get_page(new);
+	pteval = mk_pte(new, vma->vm_page_prot);
+	set_pte_at(mm, address, pte, pteval);
+	mm->rss++;
+	if (PageAnon(new))
+		page_add_anon_rmap(new, vma, address);
+	else
+		page_add_file_rmap(new);
+	update_mmu_cache(vma, address, pteval);
+
+out_unmap:
+	pte_unmap(pte);
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+}
+
+/**
+ * remove_migration_ptes - map a migrated page where its old copy was
+ * @old: the page which was unmapped by try_to_unmap(old, 1)
+ * @new: the page to map instead, or @old itself if migration failed
+ *
+ * @new must already have taken over the mapping and index of @old.
+ * Both pages are locked by the caller, which also holds rcu_read_lock()
+ * from before try_to_unmap() for an anonymous page: the anon_vma cache
+ * is SLAB_DESTROY_BY_RCU, so the anon_vma stays usable even though the
+ * page no longer maps it.
+ */
+void remove_migration_ptes(struct page *old, struct page *new)
+{
+	struct vm_area_struct *vma;
+
+	if (PageAnon(new)) {
+		struct anon_vma *anon_vma;
+		struct anon_vma_chain *avc;
+
+		anon_vma = (struct anon_vma *)
+			((unsigned long)new->mapping - PAGE_MAPPING_ANON);
+		read_lock(&anon_vma->root->lock);
+		list_for_each_entry(avc, &anon_vma->head, same_anon_vma)
+			remove_migration_pte(avc->vma, old, new);
+		read_unlock(&anon_vma->root->lock);
+	} else {
+		struct address_space *mapping = new->mapping;
+		pgoff_t pgoff = new->index << (PAGE_CACHE_SHIFT - PAGE_SHIFT);
+		struct prio_tree_iter iter;
+
+		spin_lock(&mapping->i_mmap_lock);
+		vma_prio_tree_foreach(vma, &iter, &mapping->i_mmap, pgoff, pgoff)
+			remove_migration_pte(vma, old, new);
+		spin_unlock(&mapping->i_mmap_lock);
+	}
+}
+#endif /* CONFIG_MIGRATION */
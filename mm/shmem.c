@@ -40,12 +40,14 @@
 #include <linux/mount.h>
 #include <linux/writeback.h>
 #include <linux/vfs.h>
+#include <linux/memcontrol.h>
 #include <linux/blkdev.h>
 #include <linux/security.h>
 #include <linux/swapops.h>
 #include <linux/mempolicy.h>
 #include <linux/namei.h>
 #include <linux/xattr.h>
+#include <linux/huge_mm.h>
 #include <asm/uaccess.h>
 #include <asm/div64.h>
 #include <asm/pgtable.h>
@@ -65,6 +67,8 @@
 /* info->flags needs VM_flags to handle pagein/truncate races efficiently */
 #define SHMEM_PAGEIN	 VM_READ
 #define SHMEM_TRUNCATE	 VM_WRITE
+/* Flag in shmem_inode_info.flags: back aligned extents with huge pages */
+#define SHMEM_HUGE	 VM_HUGEPAGE
 
 /* Definition to limit shmem_truncate's steps between cond_rescheds */
 #define LATENCY_LIMIT	 64
@@ -168,6 +172,12 @@ static inline int shmem_acct_block(unsigned long flags)
 		0: security_vm_enough_memory(VM_ACCT(PAGE_CACHE_SIZE));
 }
 
+static inline int shmem_acct_blocks(unsigned long flags, long pages)
+{
+	return (flags & VM_ACCOUNT)?
+		0: security_vm_enough_memory(pages * VM_ACCT(PAGE_CACHE_SIZE));
+}
+
 static inline void shmem_unacct_blocks(unsigned long flags, long pages)
 {
 	if (!(flags & VM_ACCOUNT))
@@ -929,6 +939,160 @@ shmem_alloc_page(unsigned long gfp,struct shmem_inode_info *info,
 }
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Sysctl vm.shmem_huge: give SysV shared memory segments and shared
+ * anonymous mappings, which live on the internal mount, huge pages too.
+ */
+int shmem_huge;
+
+/* Do new regular files on @sb get SHMEM_HUGE?  Not for the internal mount */
+static inline int shmem_sb_huge(struct super_block *sb)
+{
+	return sb->s_root &&
+		(SHMEM_I(sb->s_root->d_inode)->flags & SHMEM_HUGE);
+}
+
+/*
+ * shmem_getpage_huge - fill a huge page sized extent at once
+ *
+ * Put the subpages of one huge page into the page cache for the whole
+ * aligned extent around @idx, if it lies within i_size and none of it
+ * is cached or swapped yet.  From then on they are ordinary pages which
+ * are swapped out, truncated and freed one by one; shmem_nopage() users
+ * map the extent with a huge pmd while it stays intact.  Returns 0 if
+ * the page at @idx was added, or an error to fall back to a small page.
+ */
+static int shmem_getpage_huge(struct inode *inode, unsigned long idx)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	unsigned long hidx = idx & ~((unsigned long)HPAGE_PMD_NR - 1);
+	struct page *page;
+	swp_entry_t *entry;
+	int i, nr = 0;
+
+	if (hidx + HPAGE_PMD_NR > SHMEM_MAX_INDEX ||
+	    ((loff_t)(hidx + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT) >
+						i_size_read(inode))
+		return -EINVAL;
+	if (find_get_pages(mapping, hidx, 1, &page)) {
+		unsigned long index = page->index;
+
+		page_cache_release(page);
+		if (index < hidx + HPAGE_PMD_NR)
+			return -EEXIST;
+	}
+
+	if (shmem_acct_blocks(info->flags, HPAGE_PMD_NR))
+		return -ENOSPC;
+	if (sbinfo) {
+		spin_lock(&sbinfo->stat_lock);
+		if (sbinfo->free_blocks < HPAGE_PMD_NR) {
+			spin_unlock(&sbinfo->stat_lock);
+			shmem_unacct_blocks(info->flags, HPAGE_PMD_NR);
+			return -ENOSPC;
+		}
+		sbinfo->free_blocks -= HPAGE_PMD_NR;
+		inode->i_blocks += HPAGE_PMD_NR * BLOCKS_PER_PAGE;
+		spin_unlock(&sbinfo->stat_lock);
+	}
+
+	/* Don't force it: small pages will do when memory is fragmented */
+	page = alloc_pages(mapping_gfp_mask(mapping) | __GFP_ZERO |
+			   __GFP_NOWARN | __GFP_NORETRY, HPAGE_PMD_ORDER);
+	if (!page) {
+		inc_page_state(thp_fault_fallback);
+		goto unacct;
+	}
+	for (i = 1; i < HPAGE_PMD_NR; i++)
+		set_page_count(page + i, 1);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (mem_container_charge(page + i, mapping_gfp_mask(mapping))) {
+			for (i = 0; i < HPAGE_PMD_NR; i++)
+				__free_page(page + i);
+			inc_page_state(thp_fault_fallback);
+			goto unacct;
+		}
+	}
+
+	spin_lock(&info->lock);
+	for (; nr < HPAGE_PMD_NR; nr++) {
+		swp_entry_t swap;
+
+		entry = shmem_swp_alloc(info, hidx + nr, SGP_CACHE);
+		if (IS_ERR(entry))
+			break;
+		swap = *entry;
+		shmem_swp_unmap(entry);
+		if (swap.val || add_to_page_cache_lru(page + nr, mapping,
+						hidx + nr, GFP_ATOMIC))
+			break;
+		info->alloced++;
+	}
+	if (nr)
+		info->flags |= SHMEM_PAGEIN;
+	spin_unlock(&info->lock);
+
+	/* What did get in is fine as it is; free the rest */
+	for (i = 0; i < nr; i++) {
+		flush_dcache_page(page + i);
+		SetPageUptodate(page + i);
+		unlock_page(page + i);
+		page_cache_release(page + i);
+	}
+	for (i = nr; i < HPAGE_PMD_NR; i++)
+		__free_page(page + i);
+	if (nr == HPAGE_PMD_NR)
+		inc_page_state(thp_fault_alloc);
+
+unacct:
+	shmem_unacct_blocks(info->flags, HPAGE_PMD_NR - nr);
+	shmem_free_blocks(inode, HPAGE_PMD_NR - nr);
+	return idx - hidx < nr ? 0 : -EAGAIN;
+}
+
+/*
+ * Mappings of SHMEM_HUGE files can only get huge pmds where the virtual
+ * address is aligned like the file offset: pick such an address.
+ */
+unsigned long shmem_get_unmapped_area(struct file *file, unsigned long addr,
+		unsigned long len, unsigned long pgoff, unsigned long flags)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+	unsigned long offset, base;
+
+	if (!(SHMEM_I(inode)->flags & SHMEM_HUGE) || (flags & MAP_FIXED) ||
+	    len < HPAGE_PMD_SIZE || len + HPAGE_PMD_SIZE < len)
+		goto plain;
+
+	/* Find room for an extra huge page, and align within it */
+	base = current->mm->get_unmapped_area(file, addr,
+			len + HPAGE_PMD_SIZE, pgoff, flags);
+	if (base & ~PAGE_MASK)
+		goto plain;
+	offset = (pgoff << PAGE_SHIFT) & ~HPAGE_PMD_MASK;
+	return ((base - offset + HPAGE_PMD_SIZE - 1) & HPAGE_PMD_MASK) + offset;
+
+plain:
+	return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+}
+
+/* Let shared mappings of a SHMEM_HUGE file get huge pmds */
+void shmem_huge_vma(struct vm_area_struct *vma)
+{
+	struct inode *inode = vma->vm_file->f_dentry->d_inode;
+
+	if ((SHMEM_I(inode)->flags & SHMEM_HUGE) &&
+	    (vma->vm_flags & VM_SHARED))
+		vma->vm_flags |= VM_HUGEPAGE;
+}
+#else
+#define shmem_sb_huge(sb)		0
+#define shmem_getpage_huge(inode, idx)	(-EINVAL)
+#endif
+
 /*
  * shmem_getpage - either get the page from swap or allocate a new one
  *
@@ -967,6 +1131,10 @@ repeat:
 	if (sgp == SGP_QUICK)
 		goto failed;
 
+	if (!filepage && (info->flags & SHMEM_HUGE) && sgp != SGP_READ &&
+	    !shmem_getpage_huge(inode, idx))
+		goto repeat;
+
 	spin_lock(&info->lock);
 	shmem_recalc_inode(inode);
 	entry = shmem_swp_alloc(info, idx, sgp);
@@ -1057,6 +1225,16 @@ repeat:
 		} else {
 			shmem_swp_unmap(entry);
 			spin_unlock(&info->lock);
+			/*
+			 * The charge in add_to_page_cache() could not reclaim
+			 * under info->lock: try again where it can.
+			 */
+			if (error == -ENOMEM && mem_container_charge(swappage,
+						mapping_gfp_mask(mapping))) {
+				unlock_page(swappage);
+				page_cache_release(swappage);
+				goto failed;
+			}
 			unlock_page(swappage);
 			page_cache_release(swappage);
 			if (error == -ENOMEM) {
@@ -1109,6 +1287,16 @@ repeat:
 				error = -ENOMEM;
 				goto failed;
 			}
+			/* Charge it here: it is added to the cache atomically */
+			if (mem_container_charge(filepage,
+					mapping_gfp_mask(mapping))) {
+				page_cache_release(filepage);
+				shmem_unacct_blocks(info->flags, 1);
+				shmem_free_blocks(inode, 1);
+				filepage = NULL;
+				error = -ENOMEM;
+				goto failed;
+			}
 
 			spin_lock(&info->lock);
 			entry = shmem_swp_alloc(info, idx, sgp);
@@ -1259,6 +1447,7 @@ static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	file_accessed(file);
 	vma->vm_ops = &shmem_vm_ops;
+	shmem_huge_vma(vma);
 	return 0;
 }
 
@@ -1303,6 +1492,8 @@ shmem_get_inode(struct super_block *sb, int mode, dev_t dev)
 			inode->i_op = &shmem_inode_operations;
 			inode->i_fop = &shmem_file_operations;
 			mpol_shared_policy_init(&info->policy);
+			if (shmem_sb_huge(sb))
+				info->flags |= SHMEM_HUGE;
 			break;
 		case S_IFDIR:
 			inode->i_nlink++;
@@ -1849,7 +2040,7 @@ static struct inode_operations shmem_symlink_inode_operations = {
 #endif
 };
 
-static int shmem_parse_options(char *options, int *mode, uid_t *uid, gid_t *gid, unsigned long *blocks, unsigned long *inodes)
+static int shmem_parse_options(char *options, int *mode, uid_t *uid, gid_t *gid, unsigned long *blocks, unsigned long *inodes, int *huge)
 {
 	char *this_char, *value, *rest;
 
@@ -1903,6 +2094,12 @@ static int shmem_parse_options(char *options, int *mode, uid_t *uid, gid_t *gid,
 			*gid = simple_strtoul(value,&rest,0);
 			if (*rest)
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		} else if (!strcmp(this_char,"huge")) {
+			*huge = simple_strtoul(value,&rest,0);
+			if (*rest)
+				goto bad_val;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -1923,16 +2120,22 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	struct shmem_sb_info *sbinfo = SHMEM_SB(sb);
 	unsigned long max_blocks = 0;
 	unsigned long max_inodes = 0;
+	int huge = shmem_sb_huge(sb);
 
 	if (sbinfo) {
 		max_blocks = sbinfo->max_blocks;
 		max_inodes = sbinfo->max_inodes;
 	}
-	if (shmem_parse_options(data, NULL, NULL, NULL, &max_blocks, &max_inodes))
+	if (shmem_parse_options(data, NULL, NULL, NULL, &max_blocks, &max_inodes, &huge))
 		return -EINVAL;
 	/* Keep it simple: disallow limited <-> unlimited remount */
 	if ((max_blocks || max_inodes) == !sbinfo)
 		return -EINVAL;
+	/* Only files created from now on are affected */
+	if (huge)
+		SHMEM_I(sb->s_root->d_inode)->flags |= SHMEM_HUGE;
+	else
+		SHMEM_I(sb->s_root->d_inode)->flags &= ~SHMEM_HUGE;
 	/* But allow the pointless unlimited -> unlimited remount */
 	if (!sbinfo)
 		return 0;
@@ -1965,6 +2168,7 @@ static int shmem_fill_super(struct super_block *sb,
 #ifdef CONFIG_TMPFS
 	unsigned long blocks = 0;
 	unsigned long inodes = 0;
+	int huge = 0;
 
 	/*
 	 * Per default we only allow half of the physical ram per
@@ -1978,7 +2182,7 @@ static int shmem_fill_super(struct super_block *sb,
 			inodes = blocks;
 
 		if (shmem_parse_options(data, &mode,
-					&uid, &gid, &blocks, &inodes))
+				&uid, &gid, &blocks, &inodes, &huge))
 			return -EINVAL;
 	}
 
@@ -2009,6 +2213,11 @@ static int shmem_fill_super(struct super_block *sb,
 		goto failed;
 	inode->i_uid = uid;
 	inode->i_gid = gid;
+#ifdef CONFIG_TMPFS
+	/* The root directory carries the huge= option, see shmem_sb_huge() */
+	if (huge)
+		SHMEM_I(inode)->flags |= SHMEM_HUGE;
+#endif
 	root = d_alloc_root(inode);
 	if (!root)
 		goto failed_iput;
@@ -2079,6 +2288,9 @@ static struct address_space_operations shmem_aops = {
 
 static struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.get_unmapped_area = shmem_get_unmapped_area,
+#endif
 #ifdef CONFIG_TMPFS
 	.llseek		= generic_file_llseek,
 	.read		= shmem_file_read,
@@ -2285,6 +2497,10 @@ struct file *shmem_file_setup(char *name, loff_t size, unsigned long flags)
 		goto close_file;
 
 	SHMEM_I(inode)->flags = flags & VM_ACCOUNT;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (shmem_huge)
+		SHMEM_I(inode)->flags |= SHMEM_HUGE;
+#endif
 	d_instantiate(dentry, inode);
 	inode->i_size = size;
 	inode->i_nlink = 0;	/* It is unlinked */
@@ -2322,5 +2538,6 @@ int shmem_zero_setup(struct vm_area_struct *vma)
 		fput(vma->vm_file);
 	vma->vm_file = file;
 	vma->vm_ops = &shmem_vm_ops;
+	shmem_huge_vma(vma);
 	return 0;
 }
@@ -0,0 +1,1410 @@
+/*
+ * linux/mm/slub.c
+ *
+ * A slab allocator without object queues, an alternative to mm/slab.c
+ * with the same kmem_cache_* interface.
+ *
+ * mm/slab.c keeps cache-warm objects in per-cpu, per-node shared and
+ * alien arrays, describes every slab with a struct slab and a bufctl
+ * array, and trims all those queues from cache_reap() on every cpu
+ * every few seconds. On machines with many cpus the queues alone pin
+ * a lot of memory, and the reaping shows up as latency.
+ *
+ * This allocator does without all of that:
+ *
+ * - The free objects of a slab are chained through a free pointer
+ *   stored in the objects themselves (at offset 0, or behind the
+ *   object if a constructor, destructor or SLAB_DESTROY_BY_RCU needs
+ *   the contents preserved).
+ *
+ * - The metadata of a slab lives in the struct page of its first page:
+ *   page->slab is the cache, page->freelist the first free object and
+ *   page->inuse the number of allocated objects. Every page of a slab
+ *   points back to the first one with page->first_page.
+ *
+ * - Each cpu allocates from its own active slab, the "cpu slab", until
+ *   it runs out of objects. Frees go straight back to the slab the
+ *   object belongs to. Caching is thus done with slabs rather than
+ *   with queues of objects.
+ *
+ * - Partially used slabs are kept on per-node partial lists; full
+ *   slabs are not tracked at all. A slab which becomes empty is
+ *   returned to the page allocator at once, so there is nothing to
+ *   reap periodically.
+ *
+ * Locking:
+ *   1. slab_lock(page), a bit spinlock in page->flags, protects the
+ *	freelist and inuse of a slab.
+ *   2. kmem_cache_node->list_lock protects the partial list of a node.
+ *	It nests inside the slab lock; the partial list is scanned with
+ *	slab_trylock() to keep the order.
+ *   Whether a slab is a cpu slab is tracked with PG_active, which is
+ *   only changed under the slab lock.
+ *
+ *   slub_lock protects the list of caches.
+ */
+
+#include	<linux/config.h>
+#include	<linux/slab.h>
+#include	<linux/mm.h>
+#include	<linux/swap.h>
+#include	<linux/cache.h>
+#include	<linux/interrupt.h>
+#include	<linux/init.h>
+#include	<linux/seq_file.h>
+#include	<linux/notifier.h>
+#include	<linux/cpu.h>
+#include	<linux/module.h>
+#include	<linux/rcupdate.h>
+#include	<linux/spinlock.h>
+#include	<linux/string.h>
+
+#include	<asm/uaccess.h>
+#include	<asm/semaphore.h>
+#include	<asm/page.h>
+
+#ifndef cache_line_size
+#define cache_line_size()	L1_CACHE_BYTES
+#endif
+
+#ifndef ARCH_KMALLOC_MINALIGN
+#define ARCH_KMALLOC_MINALIGN 0
+#endif
+
+#ifndef ARCH_SLAB_MINALIGN
+#define ARCH_SLAB_MINALIGN 0
+#endif
+
+#ifndef ARCH_KMALLOC_FLAGS
+#define ARCH_KMALLOC_FLAGS SLAB_HWCACHE_ALIGN
+#endif
+
+/*
+ * Slabs are allocated with the smallest order that holds at least
+ * SLUB_MIN_OBJECTS objects and wastes no more than 1/8 of the slab,
+ * but not above SLUB_MAX_ORDER unless the object does not fit.
+ */
+#define SLUB_MIN_OBJECTS	4
+#define SLUB_MAX_ORDER		1
+
+/*
+ * Empty slabs are kept on the partial list of a node, instead of being
+ * freed, while the list is shorter than this.
+ */
+#define MIN_PARTIAL		2
+
+/* Largest object size, same limit as mm/slab.c */
+#define MAX_OBJ_SIZE		((1 << 13) * PAGE_SIZE)
+
+/*
+ * The slab lists of a node.
+ */
+struct kmem_cache_node {
+	spinlock_t		list_lock;	/* Protects the partial list */
+	unsigned long		nr_partial;
+	atomic_t		nr_slabs;
+	struct list_head	partial;
+};
+
+/*
+ * kmem_cache_t
+ *
+ * manages a cache.
+ */
+struct kmem_cache_s {
+/* 1) touched by every alloc & free */
+	struct page		*cpu_slab[NR_CPUS];
+	int			offset;		/* Free pointer offset */
+	int			size;		/* Object size including metadata */
+	unsigned long		flags;
+/* 2) slab allocation */
+	int			objects;	/* Number of objects per slab */
+	unsigned int		order;
+	unsigned int		gfpflags;	/* force GFP flags, e.g. GFP_DMA */
+	int			objsize;	/* Object size as requested */
+	int			align;
+	void (*ctor)(void *, kmem_cache_t *, unsigned long);
+	void (*dtor)(void *, kmem_cache_t *, unsigned long);
+	struct kmem_cache_node	*node[MAX_NUMNODES];
+/* 3) cache creation/removal */
+	const char		*name;
+	struct list_head	list;
+};
+
+/* The caches for the kmem_cache_node and kmem_cache_t structures */
+static kmem_cache_t node_cache;
+static kmem_cache_t cache_cache;
+
+/* Guard access to the cache list */
+static DECLARE_MUTEX(slub_lock);
+static LIST_HEAD(slab_caches);
+
+/*
+ * vm_enough_memory() looks at this to determine how many
+ * slab-allocated pages are possibly freeable under pressure
+ *
+ * SLAB_RECLAIM_ACCOUNT turns this on per-slab
+ */
+atomic_t slab_reclaim_pages;
+EXPORT_SYMBOL(slab_reclaim_pages);
+
+/* These are the default caches for kmalloc. Custom caches can have other sizes. */
+struct cache_sizes malloc_sizes[] = {
+#define CACHE(x) { .cs_size = (x) },
+#include <linux/kmalloc_sizes.h>
+	{ 0, }
+#undef CACHE
+};
+
+EXPORT_SYMBOL(malloc_sizes);
+
+/* Must match cache_sizes above. Out of line to keep cache footprint low. */
+struct cache_names {
+	char *name;
+	char *name_dma;
+};
+
+static struct cache_names __initdata cache_names[] = {
+#define CACHE(x) { .name = "size-" #x, .name_dma = "size-" #x "(DMA)" },
+#include <linux/kmalloc_sizes.h>
+	{ NULL, }
+#undef CACHE
+};
+
+#define slab_error(s, msg) __slab_error(__FUNCTION__, s, msg)
+
+static void __slab_error(const char *function, kmem_cache_t *s, char *msg)
+{
+	printk(KERN_ERR "slab error in %s(): cache `%s': %s\n",
+		function, s->name, msg);
+	dump_stack();
+}
+
+/********************************************************************
+ * 			Core slab cache functions
+ *******************************************************************/
+
+static inline struct kmem_cache_node *get_node(kmem_cache_t *s, int node)
+{
+	return s->node[node];
+}
+
+static inline void *get_freepointer(kmem_cache_t *s, void *object)
+{
+	return *(void **)(object + s->offset);
+}
+
+static inline void set_freepointer(kmem_cache_t *s, void *object, void *fp)
+{
+	*(void **)(object + s->offset) = fp;
+}
+
+/* The page struct holding the metadata of the slab @x belongs to */
+static inline struct page *virt_to_head_page(const void *x)
+{
+	struct page *page = virt_to_page(x);
+
+	BUG_ON(!PageSlab(page));
+	return page->first_page;
+}
+
+/*
+ * page->flags is only 32 bits with ARCH_HAS_ATOMIC_UNSIGNED, but that
+ * is little-endian x86_64 where the bitops work on 32 bit words anyway.
+ */
+#define slab_flags(page)	((unsigned long *)&(page)->flags)
+
+static inline void slab_lock(struct page *page)
+{
+	bit_spin_lock(PG_locked, slab_flags(page));
+}
+
+static inline void slab_unlock(struct page *page)
+{
+	bit_spin_unlock(PG_locked, slab_flags(page));
+}
+
+static inline int slab_trylock(struct page *page)
+{
+	return bit_spin_trylock(PG_locked, slab_flags(page));
+}
+
+/* A cpu slab is "frozen": frees never move it to or from a list. */
+#define SlabFrozen(page)	PageActive(page)
+#define SetSlabFrozen(page)	SetPageActive(page)
+#define ClearSlabFrozen(page)	ClearPageActive(page)
+
+/********************************************************************
+ * 			Slab allocation and freeing
+ *******************************************************************/
+
+static struct page *allocate_slab(kmem_cache_t *s, int flags, int node)
+{
+	struct page *page;
+	int pages = 1 << s->order;
+	int i;
+
+	/* slab pages can be reclaimed at best, never moved */
+	flags &= ~__GFP_MOVABLE;
+	flags |= s->gfpflags;
+	if (node == -1)
+		page = alloc_pages(flags, s->order);
+	else
+		page = alloc_pages_node(node, flags, s->order);
+	if (!page)
+		return NULL;
+
+	if (s->flags & SLAB_RECLAIM_ACCOUNT)
+		atomic_add(pages, &slab_reclaim_pages);
+	add_page_state(nr_slab, pages);
+	for (i = 0; i < pages; i++) {
+		SetPageSlab(page + i);
+		page[i].first_page = page;
+	}
+	return page;
+}
+
+static void setup_object(kmem_cache_t *s, void *object, int flags)
+{
+	unsigned long ctor_flags = SLAB_CTOR_CONSTRUCTOR;
+
+	if (!(flags & __GFP_WAIT))
+		/*
+		 * Not allowed to sleep.  Need to tell a constructor about
+		 * this - it might need to know...
+		 */
+		ctor_flags |= SLAB_CTOR_ATOMIC;
+	if (s->ctor)
+		s->ctor(object, s, ctor_flags);
+}
+
+/*
+ * Allocate a new slab and chain all its objects on the freelist.
+ * Called with interrupts enabled if the allocation may sleep.
+ */
+static struct page *new_slab(kmem_cache_t *s, int flags, int node)
+{
+	struct page *page;
+	struct kmem_cache_node *n;
+	void *start, *last, *p;
+
+	page = allocate_slab(s, flags & SLAB_LEVEL_MASK, node);
+	if (!page)
+		return NULL;
+
+	n = get_node(s, page_to_nid(page));
+	if (n)
+		atomic_inc(&n->nr_slabs);
+	page->slab = s;
+
+	start = page_address(page);
+	last = start;
+	for (p = start + s->size; p < start + s->objects * s->size;
+							p += s->size) {
+		setup_object(s, last, flags);
+		set_freepointer(s, last, p);
+		last = p;
+	}
+	setup_object(s, last, flags);
+	set_freepointer(s, last, NULL);
+
+	page->freelist = start;
+	page->inuse = 0;
+	return page;
+}
+
+static void __free_slab(kmem_cache_t *s, struct page *page)
+{
+	int pages = 1 << s->order;
+	int i;
+
+	if (s->dtor) {
+		void *start = page_address(page);
+		void *p;
+
+		for (p = start; p < start + s->objects * s->size; p += s->size)
+			s->dtor(p, s, 0);
+	}
+
+	for (i = 0; i < pages; i++) {
+		if (!TestClearPageSlab(page + i))
+			BUG();
+		page[i].first_page = NULL;
+	}
+	page->slab = NULL;
+	page->freelist = NULL;
+	reset_page_mapcount(page);
+
+	sub_page_state(nr_slab, pages);
+	if (current->reclaim_state)
+		current->reclaim_state->reclaimed_slab += pages;
+	if (s->flags & SLAB_RECLAIM_ACCOUNT)
+		atomic_sub(pages, &slab_reclaim_pages);
+	__free_pages(page, s->order);
+}
+
+static void rcu_free_slab(struct rcu_head *h)
+{
+	struct page *page;
+
+	page = container_of((struct list_head *)h, struct page, lru);
+	__free_slab(page->slab, page);
+}
+
+static void free_slab(kmem_cache_t *s, struct page *page)
+{
+	if (unlikely(s->flags & SLAB_DESTROY_BY_RCU)) {
+		/*
+		 * RCU free overloads the RCU head over the LRU
+		 */
+		struct rcu_head *head = (void *)&page->lru;
+
+		call_rcu(head, rcu_free_slab);
+	} else
+		__free_slab(s, page);
+}
+
+static void discard_slab(kmem_cache_t *s, struct page *page)
+{
+	struct kmem_cache_node *n = get_node(s, page_to_nid(page));
+
+	atomic_dec(&n->nr_slabs);
+	free_slab(s, page);
+}
+
+/********************************************************************
+ * 			Partial list management
+ *******************************************************************/
+
+static void add_partial(struct kmem_cache_node *n, struct page *page)
+{
+	spin_lock(&n->list_lock);
+	n->nr_partial++;
+	list_add(&page->lru, &n->partial);
+	spin_unlock(&n->list_lock);
+}
+
+/* Empty slabs go to the end, so that the partial slabs are used first */
+static void add_partial_tail(struct kmem_cache_node *n, struct page *page)
+{
+	spin_lock(&n->list_lock);
+	n->nr_partial++;
+	list_add_tail(&page->lru, &n->partial);
+	spin_unlock(&n->list_lock);
+}
+
+static void remove_partial(kmem_cache_t *s, struct page *page)
+{
+	struct kmem_cache_node *n = get_node(s, page_to_nid(page));
+
+	spin_lock(&n->list_lock);
+	list_del(&page->lru);
+	n->nr_partial--;
+	spin_unlock(&n->list_lock);
+}
+
+/*
+ * Lock a slab and take it off the partial list. The list_lock must be
+ * held; it nests inside the slab lock, so only a trylock is possible.
+ */
+static inline int lock_and_del_slab(struct kmem_cache_node *n,
+							struct page *page)
+{
+	if (slab_trylock(page)) {
+		list_del(&page->lru);
+		n->nr_partial--;
+		return 1;
+	}
+	return 0;
+}
+
+/* Try to get a locked partial slab from a specific node */
+static struct page *get_partial_node(struct kmem_cache_node *n)
+{
+	struct page *page;
+
+	/*
+	 * Racy check. If we mistakenly see no partial slabs then we
+	 * just allocate an empty slab.
+	 */
+	if (!n || !n->nr_partial)
+		return NULL;
+
+	spin_lock(&n->list_lock);
+	list_for_each_entry(page, &n->partial, lru)
+		if (lock_and_del_slab(n, page))
+			goto out;
+	page = NULL;
+out:
+	spin_unlock(&n->list_lock);
+	return page;
+}
+
+/*
+ * Get a partial slab from another node. Only nodes with more than
+ * MIN_PARTIAL partial slabs are raided, a few are left for local use.
+ */
+static struct page *get_any_partial(kmem_cache_t *s)
+{
+#ifdef CONFIG_NUMA
+	struct kmem_cache_node *n;
+	struct page *page;
+	int node;
+
+	for_each_online_node(node) {
+		n = get_node(s, node);
+		if (n && n->nr_partial > MIN_PARTIAL) {
+			page = get_partial_node(n);
+			if (page)
+				return page;
+		}
+	}
+#endif
+	return NULL;
+}
+
+/*
+ * Get a locked partial slab, from @node if it is not -1, else
+ * preferably from the local node.
+ */
+static struct page *get_partial(kmem_cache_t *s, int node)
+{
+	struct page *page;
+	int searchnode = (node == -1) ? numa_node_id() : node;
+
+	page = get_partial_node(get_node(s, searchnode));
+	if (page || node != -1)
+		return page;
+
+	return get_any_partial(s);
+}
+
+/*
+ * Move a slab back to the lists after it stopped being a cpu slab.
+ * Full slabs are not tracked. Called with the slab locked, unlocks it.
+ */
+static void putback_slab(kmem_cache_t *s, struct page *page)
+{
+	struct kmem_cache_node *n = get_node(s, page_to_nid(page));
+
+	ClearSlabFrozen(page);
+	if (page->inuse) {
+		if (page->freelist)
+			add_partial(n, page);
+		slab_unlock(page);
+	} else {
+		if (n->nr_partial < MIN_PARTIAL) {
+			/*
+			 * Keep a few empty slabs around to avoid going to
+			 * the page allocator for every new slab.
+			 */
+			add_partial_tail(n, page);
+			slab_unlock(page);
+		} else {
+			slab_unlock(page);
+			discard_slab(s, page);
+		}
+	}
+}
+
+/* Remove the cpu slab. Called with the slab locked, unlocks it. */
+static void deactivate_slab(kmem_cache_t *s, struct page *page, int cpu)
+{
+	s->cpu_slab[cpu] = NULL;
+	putback_slab(s, page);
+}
+
+static inline void flush_slab(kmem_cache_t *s, struct page *page, int cpu)
+{
+	slab_lock(page);
+	deactivate_slab(s, page, cpu);
+}
+
+/*
+ * Flush the cpu slab of @cpu. Called with interrupts disabled, from
+ * the cpu itself or for a cpu that is gone.
+ */
+static inline void __flush_cpu_slab(kmem_cache_t *s, int cpu)
+{
+	struct page *page = s->cpu_slab[cpu];
+
+	if (likely(page))
+		flush_slab(s, page, cpu);
+}
+
+static void flush_cpu_slab(void *d)
+{
+	kmem_cache_t *s = d;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	__flush_cpu_slab(s, smp_processor_id());
+	local_irq_restore(flags);
+}
+
+static void flush_all(kmem_cache_t *s)
+{
+	on_each_cpu(flush_cpu_slab, s, 1, 1);
+}
+
+/********************************************************************
+ * 			Allocation and freeing of objects
+ *******************************************************************/
+
+/*
+ * Slow path: the cpu slab is missing, full, or on the wrong node. Get a
+ * new one, first from the partial lists and then from the page
+ * allocator. Called with interrupts disabled.
+ */
+static void *__slab_alloc(kmem_cache_t *s, int flags, int node)
+{
+	void *object;
+	struct page *page;
+	int cpu = smp_processor_id();
+
+	page = s->cpu_slab[cpu];
+	if (!page)
+		goto new_slab;
+
+	slab_lock(page);
+	if (unlikely(node != -1 && page_to_nid(page) != node))
+		goto another_slab;
+load_freelist:
+	object = page->freelist;
+	if (unlikely(!object))
+		goto another_slab;
+
+	page->inuse++;
+	page->freelist = get_freepointer(s, object);
+	slab_unlock(page);
+	return object;
+
+another_slab:
+	deactivate_slab(s, page, cpu);
+
+new_slab:
+	page = get_partial(s, node);
+	if (page) {
+		SetSlabFrozen(page);
+		s->cpu_slab[cpu] = page;
+		goto load_freelist;
+	}
+
+	/* Be lazy and only check for valid flags here,
+	 * keeping it out of the fast path.
+	 */
+	if (flags & ~(SLAB_DMA|SLAB_LEVEL_MASK|SLAB_NO_GROW))
+		BUG();
+	if (flags & SLAB_NO_GROW)
+		return NULL;
+
+	if (flags & __GFP_WAIT)
+		local_irq_enable();
+	page = new_slab(s, flags, node);
+	if (flags & __GFP_WAIT)
+		local_irq_disable();
+	if (!page)
+		return NULL;
+
+	/* We may have slept and come back on another cpu */
+	cpu = smp_processor_id();
+	if (s->cpu_slab[cpu])
+		__flush_cpu_slab(s, cpu);
+	slab_lock(page);
+	SetSlabFrozen(page);
+	s->cpu_slab[cpu] = page;
+	goto load_freelist;
+}
+
+static inline void *slab_alloc(kmem_cache_t *s, int flags, int node)
+{
+	unsigned long save_flags;
+	void *object;
+
+	local_irq_save(save_flags);
+	object = __slab_alloc(s, flags, node);
+	local_irq_restore(save_flags);
+	return object;
+}
+
+/*
+ * Return an object to its slab. A slab that was full goes onto the
+ * partial list, a slab that becomes empty is freed. The cpu slabs stay
+ * where they are.
+ */
+static void slab_free(kmem_cache_t *s, struct page *page, void *object)
+{
+	void *prior;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	slab_lock(page);
+
+	prior = page->freelist;
+	set_freepointer(s, object, prior);
+	page->freelist = object;
+	page->inuse--;
+
+	if (unlikely(SlabFrozen(page)))
+		goto out_unlock;
+
+	if (unlikely(!page->inuse))
+		goto slab_empty;
+
+	/*
+	 * Objects left in the slab. If it was not on the partial list
+	 * before then add it.
+	 */
+	if (unlikely(!prior))
+		add_partial(get_node(s, page_to_nid(page)), page);
+
+out_unlock:
+	slab_unlock(page);
+	local_irq_restore(flags);
+	return;
+
+slab_empty:
+	if (prior)
+		/* Slab was on the partial list */
+		remove_partial(s, page);
+
+	slab_unlock(page);
+	discard_slab(s, page);
+	local_irq_restore(flags);
+}
+
+/**
+ * kmem_cache_alloc - Allocate an object
+ * @cachep: The cache to allocate from.
+ * @flags: See kmalloc().
+ *
+ * Allocate an object from this cache.  The flags are only relevant
+ * if the cache has no available objects.
+ */
+void *kmem_cache_alloc(kmem_cache_t *cachep, int flags)
+{
+	return slab_alloc(cachep, flags, -1);
+}
+
+EXPORT_SYMBOL(kmem_cache_alloc);
+
+#ifdef CONFIG_NUMA
+/**
+ * kmem_cache_alloc_node - Allocate an object on the specified node
+ * @cachep: The cache to allocate from.
+ * @flags: See kmalloc().
+ * @nodeid: node number of the target node.
+ *
+ * Identical to kmem_cache_alloc, except that the object comes from a
+ * slab on the given node.
+ */
+void *kmem_cache_alloc_node(kmem_cache_t *cachep, int flags, int nodeid)
+{
+	if (nodeid != -1 && unlikely(!get_node(cachep, nodeid)))
+		nodeid = -1;
+	return slab_alloc(cachep, flags, nodeid);
+}
+EXPORT_SYMBOL(kmem_cache_alloc_node);
+#endif
+
+/**
+ * kmem_cache_free - Deallocate an object
+ * @cachep: The cache the allocation was from.
+ * @objp: The previously allocated object.
+ *
+ * Free an object which was previously allocated from this
+ * cache.
+ */
+void kmem_cache_free(kmem_cache_t *cachep, void *objp)
+{
+	struct page *page = virt_to_head_page(objp);
+
+	BUG_ON(page->slab != cachep);
+	slab_free(cachep, page, objp);
+}
+
+EXPORT_SYMBOL(kmem_cache_free);
+
+/**
+ * kmem_ptr_validate - check if an untrusted pointer might
+ *	be a slab entry.
+ * @cachep: the cache we're checking against
+ * @ptr: pointer to validate
+ *
+ * This verifies that the untrusted pointer looks sane:
+ * it is _not_ a guarantee that the pointer is actually
+ * part of the slab cache in question, but it at least
+ * validates that the pointer can be dereferenced and
+ * looks half-way sane.
+ *
+ * Currently only used for dentry validation.
+ */
+int fastcall kmem_ptr_validate(kmem_cache_t *cachep, void *ptr)
+{
+	unsigned long addr = (unsigned long) ptr;
+	unsigned long min_addr = PAGE_OFFSET;
+	unsigned long align_mask = sizeof(void *) - 1;
+	unsigned long size = cachep->objsize;
+	struct page *page;
+
+	if (unlikely(addr < min_addr))
+		goto out;
+	if (unlikely(addr > (unsigned long)high_memory - size))
+		goto out;
+	if (unlikely(addr & align_mask))
+		goto out;
+	if (unlikely(!kern_addr_valid(addr)))
+		goto out;
+	if (unlikely(!kern_addr_valid(addr + size - 1)))
+		goto out;
+	page = virt_to_page(ptr);
+	if (unlikely(!PageSlab(page)))
+		goto out;
+	if (unlikely(page->first_page->slab != cachep))
+		goto out;
+	return 1;
+out:
+	return 0;
+}
+
+unsigned int kmem_cache_size(kmem_cache_t *cachep)
+{
+	return cachep->objsize;
+}
+
+EXPORT_SYMBOL(kmem_cache_size);
+
+/********************************************************************
+ * 			Cache setup and removal
+ *******************************************************************/
+
+static void init_kmem_cache_node(struct kmem_cache_node *n)
+{
+	spin_lock_init(&n->list_lock);
+	n->nr_partial = 0;
+	atomic_set(&n->nr_slabs, 0);
+	INIT_LIST_HEAD(&n->partial);
+}
+
+/*
+ * The kmem_cache_node structures of node_cache itself cannot be
+ * allocated with kmem_cache_alloc_node(): carve the first object of a
+ * new slab by hand.
+ */
+static void __init early_kmem_cache_node_alloc(int node)
+{
+	struct page *page;
+	struct kmem_cache_node *n;
+
+	page = new_slab(&node_cache, GFP_KERNEL, node);
+	BUG_ON(!page);
+
+	n = page->freelist;
+	page->freelist = get_freepointer(&node_cache, n);
+	page->inuse++;
+	node_cache.node[node] = n;
+	init_kmem_cache_node(n);
+	atomic_inc(&n->nr_slabs);
+	add_partial(n, page);
+}
+
+static void free_kmem_cache_nodes(kmem_cache_t *s)
+{
+	int node;
+
+	for_each_online_node(node) {
+		struct kmem_cache_node *n = s->node[node];
+
+		if (n)
+			kmem_cache_free(&node_cache, n);
+		s->node[node] = NULL;
+	}
+}
+
+static int init_kmem_cache_nodes(kmem_cache_t *s)
+{
+	int node;
+
+	for_each_online_node(node) {
+		struct kmem_cache_node *n;
+
+		if (s == &node_cache) {
+			early_kmem_cache_node_alloc(node);
+			continue;
+		}
+		n = kmem_cache_alloc_node(&node_cache, GFP_KERNEL, node);
+		if (!n) {
+			free_kmem_cache_nodes(s);
+			return 0;
+		}
+		s->node[node] = n;
+		init_kmem_cache_node(n);
+	}
+	return 1;
+}
+
+/*
+ * Figure out what the alignment of the objects will be.
+ */
+static unsigned long calculate_alignment(unsigned long flags,
+		unsigned long align, unsigned long size)
+{
+	/*
+	 * If the user wants hardware cache aligned objects then
+	 * follow that suggestion if the object is sufficiently
+	 * large. The hardware cache alignment cannot override the
+	 * specified alignment though. If that is greater then use it.
+	 */
+	if (flags & (SLAB_HWCACHE_ALIGN|SLAB_MUST_HWCACHE_ALIGN)) {
+		unsigned long ralign = cache_line_size();
+
+		while (size <= ralign / 2)
+			ralign /= 2;
+		if (ralign > align)
+			align = ralign;
+	}
+
+	if (align < ARCH_SLAB_MINALIGN)
+		align = ARCH_SLAB_MINALIGN;
+
+	return ALIGN(align, sizeof(void *));
+}
+
+static int calculate_order(int size)
+{
+	int order;
+
+	order = fls(size - 1) - PAGE_SHIFT;
+	if (order < 0)
+		order = 0;
+	for (; order < MAX_ORDER; order++) {
+		unsigned long slab_size = PAGE_SIZE << order;
+
+		if (slab_size < size)
+			continue;
+		if (order >= SLUB_MAX_ORDER)
+			break;
+		if (slab_size < SLUB_MIN_OBJECTS * size)
+			continue;
+		if (slab_size % size <= slab_size / 8)
+			break;
+	}
+	if (order >= MAX_ORDER)
+		return -1;
+	return order;
+}
+
+/*
+ * calculate_sizes() determines the layout of the objects and the order
+ * of the slabs.
+ */
+static int calculate_sizes(kmem_cache_t *s)
+{
+	unsigned long size = ALIGN(s->objsize, sizeof(void *));
+	int order;
+
+	if ((s->flags & SLAB_DESTROY_BY_RCU) || s->ctor || s->dtor) {
+		/*
+		 * The object contents must survive the free: put the free
+		 * pointer behind the object.
+		 */
+		s->offset = size;
+		size += sizeof(void *);
+	} else
+		s->offset = 0;
+
+	s->align = calculate_alignment(s->flags, s->align, s->objsize);
+	size = ALIGN(size, s->align);
+	s->size = size;
+
+	order = calculate_order(size);
+	if (order < 0)
+		return 0;
+	s->order = order;
+	s->objects = (PAGE_SIZE << order) / size;
+	return s->objects != 0;
+}
+
+static int kmem_cache_open(kmem_cache_t *s, const char *name, size_t size,
+		size_t align, unsigned long flags,
+		void (*ctor)(void *, kmem_cache_t *, unsigned long),
+		void (*dtor)(void *, kmem_cache_t *, unsigned long))
+{
+	memset(s, 0, sizeof(kmem_cache_t));
+	s->name = name;
+	s->ctor = ctor;
+	s->dtor = dtor;
+	s->objsize = size;
+	s->align = align;
+	s->flags = flags;
+	if (flags & SLAB_CACHE_DMA)
+		s->gfpflags |= GFP_DMA;
+	if (flags & SLAB_RECLAIM_ACCOUNT)
+		s->gfpflags |= __GFP_RECLAIMABLE;
+
+	if (!calculate_sizes(s))
+		return 0;
+	return init_kmem_cache_nodes(s);
+}
+
+/**
+ * kmem_cache_create - Create a cache.
+ * @name: A string which is used in /proc/slabinfo to identify this cache.
+ * @size: The size of objects to be created in this cache.
+ * @align: The required alignment for the objects.
+ * @flags: SLAB flags
+ * @ctor: A constructor for the objects.
+ * @dtor: A destructor for the objects.
+ *
+ * Returns a ptr to the cache on success, NULL on failure.
+ * Cannot be called within a int, but can be interrupted.
+ * The @ctor is run when new pages are allocated by the cache
+ * and the @dtor is run before the pages are handed back.
+ *
+ * @name must be valid until the cache is destroyed. This implies that
+ * the module calling this has to destroy the cache before getting
+ * unloaded.
+ *
+ * The debugging flags (%SLAB_POISON, %SLAB_RED_ZONE, ...) are accepted
+ * and ignored, and so is %SLAB_NO_REAP: nothing is ever reaped.
+ */
+kmem_cache_t *
+kmem_cache_create(const char *name, size_t size, size_t align,
+	unsigned long flags, void (*ctor)(void*, kmem_cache_t *, unsigned long),
+	void (*dtor)(void*, kmem_cache_t *, unsigned long))
+{
+	kmem_cache_t *s;
+
+	/*
+	 * Sanity checks... these are all serious usage bugs.
+	 */
+	if ((!name) ||
+		in_interrupt() ||
+		(size < sizeof(void *)) ||
+		(size > MAX_OBJ_SIZE) ||
+		(dtor && !ctor)) {
+			printk(KERN_ERR "%s: Early error in slab %s\n",
+					__FUNCTION__, name);
+			BUG();
+		}
+
+	s = kmem_cache_alloc(&cache_cache, SLAB_KERNEL);
+	if (s && !kmem_cache_open(s, name, size, align, flags, ctor, dtor)) {
+		kmem_cache_free(&cache_cache, s);
+		s = NULL;
+	}
+
+	if (s) {
+		down(&slub_lock);
+		list_add(&s->list, &slab_caches);
+		up(&slub_lock);
+	} else if (flags & SLAB_PANIC)
+		panic("kmem_cache_create(): failed to create slab `%s'\n",
+			name);
+	return s;
+}
+EXPORT_SYMBOL(kmem_cache_create);
+
+/*
+ * Free the empty slabs on the partial lists of the cache. Returns
+ * non-zero if objects are still allocated.
+ */
+static int __cache_shrink(kmem_cache_t *s)
+{
+	struct kmem_cache_node *n;
+	struct page *page, *t;
+	unsigned long flags;
+	int node;
+	int ret = 0;
+
+	flush_all(s);
+	for_each_online_node(node) {
+		n = get_node(s, node);
+		if (!n)
+			continue;
+
+		spin_lock_irqsave(&n->list_lock, flags);
+		list_for_each_entry_safe(page, t, &n->partial, lru) {
+			if (page->inuse || !slab_trylock(page))
+				continue;
+			list_del(&page->lru);
+			n->nr_partial--;
+			slab_unlock(page);
+			discard_slab(s, page);
+		}
+		spin_unlock_irqrestore(&n->list_lock, flags);
+
+		if (atomic_read(&n->nr_slabs))
+			ret = 1;
+	}
+	return ret;
+}
+
+/**
+ * kmem_cache_shrink - Shrink a cache.
+ * @cachep: The cache to shrink.
+ *
+ * Releases as many slabs as possible for a cache.
+ * To help debugging, a zero exit status indicates all slabs were released.
+ */
+int kmem_cache_shrink(kmem_cache_t *cachep)
+{
+	if (!cachep || in_interrupt())
+		BUG();
+
+	return __cache_shrink(cachep);
+}
+
+EXPORT_SYMBOL(kmem_cache_shrink);
+
+/**
+ * kmem_cache_destroy - delete a cache
+ * @cachep: the cache to destroy
+ *
+ * Remove a kmem_cache_t object from the slab cache.
+ * Returns 0 on success.
+ *
+ * The cache must be empty before calling this function.
+ *
+ * The caller must guarantee that noone will allocate memory from the cache
+ * during the kmem_cache_destroy().
+ */
+int kmem_cache_destroy(kmem_cache_t *cachep)
+{
+	if (!cachep || in_interrupt())
+		BUG();
+
+	down(&slub_lock);
+	list_del(&cachep->list);
+	up(&slub_lock);
+
+	if (__cache_shrink(cachep)) {
+		slab_error(cachep, "Can't free all objects");
+		down(&slub_lock);
+		list_add(&cachep->list, &slab_caches);
+		up(&slub_lock);
+		return 1;
+	}
+
+	if (unlikely(cachep->flags & SLAB_DESTROY_BY_RCU))
+		synchronize_kernel();
+
+	free_kmem_cache_nodes(cachep);
+	kmem_cache_free(&cache_cache, cachep);
+	return 0;
+}
+
+EXPORT_SYMBOL(kmem_cache_destroy);
+
+/********************************************************************
+ *			kmalloc and friends
+ *******************************************************************/
+
+static kmem_cache_t *kmem_find_general_cachep(size_t size, int gfpflags)
+{
+	struct cache_sizes *csizep = malloc_sizes;
+
+	for ( ; csizep->cs_size; csizep++) {
+		if (size > csizep->cs_size)
+			continue;
+		break;
+	}
+	return (gfpflags & GFP_DMA) ? csizep->cs_dmacachep : csizep->cs_cachep;
+}
+
+void *__kmalloc(size_t size, int flags)
+{
+	kmem_cache_t *s = kmem_find_general_cachep(size, flags);
+
+	if (unlikely(!s))
+		return NULL;
+	return slab_alloc(s, flags, -1);
+}
+
+EXPORT_SYMBOL(__kmalloc);
+
+#ifdef CONFIG_NUMA
+void *kmalloc_node(size_t size, int flags, int node)
+{
+	kmem_cache_t *s = kmem_find_general_cachep(size, flags);
+
+	if (unlikely(!s))
+		return NULL;
+	return kmem_cache_alloc_node(s, flags, node);
+}
+EXPORT_SYMBOL(kmalloc_node);
+#endif
+
+/**
+ * kcalloc - allocate memory for an array. The memory is set to zero.
+ * @n: number of elements.
+ * @size: element size.
+ * @flags: the type of memory to allocate.
+ */
+void *kcalloc(size_t n, size_t size, int flags)
+{
+	void *ret = NULL;
+
+	if (n != 0 && size > INT_MAX / n)
+		return ret;
+
+	ret = kmalloc(n * size, flags);
+	if (ret)
+		memset(ret, 0, n * size);
+	return ret;
+}
+
+EXPORT_SYMBOL(kcalloc);
+
+/**
+ * kfree - free previously allocated memory
+ * @objp: pointer returned by kmalloc.
+ *
+ * Don't free memory not originally allocated by kmalloc()
+ * or you will run into trouble.
+ */
+void kfree(const void *objp)
+{
+	struct page *page;
+
+	if (!objp)
+		return;
+	page = virt_to_head_page(objp);
+	slab_free(page->slab, page, (void *)objp);
+}
+
+EXPORT_SYMBOL(kfree);
+
+unsigned int ksize(const void *objp)
+{
+	if (unlikely(objp == NULL))
+		return 0;
+	return kmem_cache_size(virt_to_head_page(objp)->slab);
+}
+
+#ifdef CONFIG_SMP
+/**
+ * __alloc_percpu - allocate one copy of the object for every present
+ * cpu in the system, zeroing them.
+ * Objects should be dereferenced using the per_cpu_ptr macro only.
+ *
+ * @size: how many bytes of memory are required.
+ * @align: the alignment, which can't be greater than SMP_CACHE_BYTES.
+ */
+void *__alloc_percpu(size_t size, size_t align)
+{
+	int i;
+	struct percpu_data *pdata = kmalloc(sizeof (*pdata), GFP_KERNEL);
+
+	if (!pdata)
+		return NULL;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		if (!cpu_possible(i))
+			continue;
+		pdata->ptrs[i] = kmalloc_node(size, GFP_KERNEL,
+				cpu_to_node(i));
+
+		if (!pdata->ptrs[i])
+			goto unwind_oom;
+		memset(pdata->ptrs[i], 0, size);
+	}
+
+	/* Catch derefs w/o wrappers */
+	return (void *) (~(unsigned long) pdata);
+
+unwind_oom:
+	while (--i >= 0) {
+		if (!cpu_possible(i))
+			continue;
+		kfree(pdata->ptrs[i]);
+	}
+	kfree(pdata);
+	return NULL;
+}
+
+EXPORT_SYMBOL(__alloc_percpu);
+
+/**
+ * free_percpu - free previously allocated percpu memory
+ * @objp: pointer returned by alloc_percpu.
+ *
+ * Don't free memory not originally allocated by alloc_percpu()
+ * The complemented objp is to check for that.
+ */
+void
+free_percpu(const void *objp)
+{
+	int i;
+	struct percpu_data *p = (struct percpu_data *) (~(unsigned long) objp);
+
+	for (i = 0; i < NR_CPUS; i++) {
+		if (!cpu_possible(i))
+			continue;
+		kfree(p->ptrs[i]);
+	}
+	kfree(p);
+}
+
+EXPORT_SYMBOL(free_percpu);
+#endif
+
+/********************************************************************
+ *			Basic setup of slabs
+ *******************************************************************/
+
+/*
+ * The cpu slab of a dead cpu would otherwise never be put back.
+ */
+static int __devinit slab_cpuup_callback(struct notifier_block *nfb,
+		unsigned long action, void *hcpu)
+{
+	long cpu = (long)hcpu;
+	kmem_cache_t *s;
+	unsigned long flags;
+
+	switch (action) {
+	case CPU_UP_CANCELED:
+	case CPU_DEAD:
+		down(&slub_lock);
+		list_for_each_entry(s, &slab_caches, list) {
+			local_irq_save(flags);
+			__flush_cpu_slab(s, cpu);
+			local_irq_restore(flags);
+		}
+		up(&slub_lock);
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block slab_notifier =
+	{ &slab_cpuup_callback, NULL, 0 };
+
+/* Initialisation.
+ * Called after the gfp() functions have been enabled, and before smp_init().
+ */
+void __init kmem_cache_init(void)
+{
+	struct cache_sizes *sizes = malloc_sizes;
+	struct cache_names *names = cache_names;
+
+	/*
+	 * The kmem_cache_node structures come from node_cache, which
+	 * allocates its own by hand. The kmem_cache_t structures come
+	 * from cache_cache. Everything else is created normally.
+	 */
+	if (!kmem_cache_open(&node_cache, "kmem_cache_node",
+			sizeof(struct kmem_cache_node), 0, 0, NULL, NULL))
+		BUG();
+	list_add(&node_cache.list, &slab_caches);
+
+	if (!kmem_cache_open(&cache_cache, "kmem_cache",
+			sizeof(kmem_cache_t), 0, SLAB_HWCACHE_ALIGN, NULL, NULL))
+		BUG();
+	list_add(&cache_cache.list, &slab_caches);
+
+	for ( ; sizes->cs_size; sizes++, names++) {
+		sizes->cs_cachep = kmem_cache_create(names->name,
+			sizes->cs_size, ARCH_KMALLOC_MINALIGN,
+			(ARCH_KMALLOC_FLAGS | SLAB_PANIC), NULL, NULL);
+		sizes->cs_dmacachep = kmem_cache_create(names->name_dma,
+			sizes->cs_size, ARCH_KMALLOC_MINALIGN,
+			(ARCH_KMALLOC_FLAGS | SLAB_CACHE_DMA | SLAB_PANIC),
+			NULL, NULL);
+	}
+
+	register_cpu_notifier(&slab_notifier);
+}
+
+#ifdef CONFIG_PROC_FS
+
+static void *s_start(struct seq_file *m, loff_t *pos)
+{
+	loff_t n = *pos;
+	struct list_head *p;
+
+	down(&slub_lock);
+	if (!n) {
+		/*
+		 * Same format as mm/slab.c, so that tools keep working.
+		 * There are no tunables and no shared arrays.
+		 */
+		seq_puts(m, "slabinfo - version: 2.1\n");
+		seq_puts(m, "# name            <active_objs> <num_objs> <objsize> <objperslab> <pagesperslab>");
+		seq_puts(m, " : tunables <limit> <batchcount> <sharedfactor>");
+		seq_puts(m, " : slabdata <active_slabs> <num_slabs> <sharedavail>");
+		seq_putc(m, '\n');
+	}
+	p = slab_caches.next;
+	while (n--) {
+		p = p->next;
+		if (p == &slab_caches)
+			return NULL;
+	}
+	return list_entry(p, kmem_cache_t, list);
+}
+
+static void *s_next(struct seq_file *m, void *p, loff_t *pos)
+{
+	kmem_cache_t *s = p;
+
+	++*pos;
+	return s->list.next == &slab_caches ? NULL
+		: list_entry(s->list.next, kmem_cache_t, list);
+}
+
+static void s_stop(struct seq_file *m, void *p)
+{
+	up(&slub_lock);
+}
+
+static int s_show(struct seq_file *m, void *p)
+{
+	kmem_cache_t *s = p;
+	unsigned long nr_slabs = 0;
+	unsigned long nr_partial = 0;
+	unsigned long nr_free = 0;
+	unsigned long nr_objs;
+	struct page *page;
+	int node;
+
+	for_each_online_node(node) {
+		struct kmem_cache_node *n = get_node(s, node);
+
+		if (!n)
+			continue;
+		spin_lock_irq(&n->list_lock);
+		nr_slabs += atomic_read(&n->nr_slabs);
+		nr_partial += n->nr_partial;
+		list_for_each_entry(page, &n->partial, lru)
+			nr_free += s->objects - page->inuse;
+		spin_unlock_irq(&n->list_lock);
+	}
+	nr_objs = nr_slabs * s->objects;
+
+	seq_printf(m, "%-17s %6lu %6lu %6u %4u %4d",
+		s->name, nr_objs - nr_free, nr_objs, s->size,
+		s->objects, (1 << s->order));
+	seq_printf(m, " : tunables %4u %4u %4u", 0, 0, 0);
+	seq_printf(m, " : slabdata %6lu %6lu %6u",
+		nr_slabs - nr_partial, nr_slabs, 0);
+	seq_putc(m, '\n');
+	return 0;
+}
+
+/*
+ * slabinfo_op - iterator that generates /proc/slabinfo
+ *
+ * Objects on the cpu slabs count as active.
+ */
+struct seq_operations slabinfo_op = {
+	.start	= s_start,
+	.next	= s_next,
+	.stop	= s_stop,
+	.show	= s_show,
+};
+
+#endif
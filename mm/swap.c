@@ -34,6 +34,9 @@
 /* How many pages do we try to swap or page in/out together? */
 int page_cluster;
 
+/* Read ahead around the faulting virtual address rather than swap offset */
+int swap_vma_readahead;
+
 #ifdef CONFIG_HUGETLB_PAGE
 
 void put_page(struct page *page)
@@ -87,7 +90,8 @@ int rotate_reclaimable_page(struct page *page)
 	spin_lock_irqsave(&zone->lru_lock, flags);
 	if (PageLRU(page) && !PageActive(page)) {
 		list_del(&page->lru);
-		list_add_tail(&page->lru, &zone->inactive_list);
+		list_add_tail(&page->lru,
+			&zone->inactive_list[page_lru_type(page)]);
 		inc_page_state(pgrotated);
 	}
 	if (!test_clear_page_writeback(page))
@@ -108,6 +112,7 @@ void fastcall activate_page(struct page *page)
 		del_page_from_inactive_list(zone, page);
 		SetPageActive(page);
 		add_page_to_active_list(zone, page);
+		zone->recent_rotated[page_lru_type(page)]++;
 		inc_page_state(pgactivate);
 	}
 	spin_unlock_irq(&zone->lru_lock);
@@ -23,6 +23,7 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/rmap.h>
+#include <linux/huge_mm.h>
 #include <linux/security.h>
 #include <linux/backing-dev.h>
 #include <linux/syscalls.h>
@@ -84,9 +85,69 @@ void swap_unplug_io_fn(struct backing_dev_info *unused_bdi, struct page *page)
 	up_read(&swap_unplug_sem);
 }
 
+static inline void inc_cluster_info(struct swap_info_struct *si,
+				    unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	ci = &si->cluster_info[offset / SWAPFILE_CLUSTER];
+	if (!ci->count++)
+		list_del_init(&ci->list);
+}
+
+static inline void dec_cluster_info(struct swap_info_struct *si,
+				    unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	ci = &si->cluster_info[offset / SWAPFILE_CLUSTER];
+	if (!--ci->count)
+		list_add_tail(&ci->list, &si->free_clusters);
+}
+
+/*
+ * Find a free slot in this CPU's cluster, starting a new cluster from
+ * the free list when that one is used up.  Each CPU thus writes out
+ * long sequential runs of slots, instead of the CPUs interleaving their
+ * swap-outs over one another's, and needs no scanning of swap_map.
+ *
+ * Two CPUs may end up filling the same cluster, if it was freed while
+ * one of them still had it: swap_map decides in the end.
+ */
+static inline unsigned long scan_percpu_cluster(struct swap_info_struct *si)
+{
+	struct percpu_cluster *pc;
+	unsigned long offset, end;
+
+	pc = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+	for (;;) {
+		if (!pc->next) {
+			struct swap_cluster_info *ci;
+
+			if (list_empty(&si->free_clusters))
+				return 0;
+			ci = list_entry(si->free_clusters.next,
+					struct swap_cluster_info, list);
+			pc->next = (ci - si->cluster_info) * SWAPFILE_CLUSTER;
+		}
+		offset = pc->next;
+		end = (offset / SWAPFILE_CLUSTER + 1) * SWAPFILE_CLUSTER;
+		while (offset < end && si->swap_map[offset])
+			offset++;
+		pc->next = offset + 1 < end ? offset + 1 : 0;
+		if (offset < end)
+			return offset;
+	}
+}
+
 static inline int scan_swap_map(struct swap_info_struct *si)
 {
 	unsigned long offset;
+
+	offset = scan_percpu_cluster(si);
+	if (offset)
+		goto got_page;
+
 	/* 
 	 * We try to cluster swap pages by allocating them
 	 * sequentially in swap.  Once we've allocated
@@ -94,7 +155,9 @@ static inline int scan_swap_map(struct swap_info_struct *si)
 	 * first-free allocation, starting a new cluster.  This
 	 * prevents us from scattering swap pages all over the entire
 	 * swap partition, so that we reduce overall disk seek times
-	 * between swap pages.  -- sct */
+	 * between swap pages.  -- sct
+	 *
+	 * Only once there are no free clusters left do we get here. */
 	if (si->cluster_nr) {
 		while (si->cluster_next <= si->highest_bit) {
 			offset = si->cluster_next++;
@@ -106,24 +169,7 @@ static inline int scan_swap_map(struct swap_info_struct *si)
 	}
 	si->cluster_nr = SWAPFILE_CLUSTER;
 
-	/* try to find an empty (even not aligned) cluster. */
-	offset = si->lowest_bit;
- check_next_cluster:
-	if (offset+SWAPFILE_CLUSTER-1 <= si->highest_bit)
-	{
-		unsigned long nr;
-		for (nr = offset; nr < offset+SWAPFILE_CLUSTER; nr++)
-			if (si->swap_map[nr])
-			{
-				offset = nr+1;
-				goto check_next_cluster;
-			}
-		/* We found a completly empty cluster, so start
-		 * using it.
-		 */
-		goto got_page;
-	}
-	/* No luck, so now go finegrined as usual. -Andrea */
+	/* No empty cluster, so go finegrined as usual. -Andrea */
 	for (offset = si->lowest_bit; offset <= si->highest_bit ; offset++) {
 		if (si->swap_map[offset])
 			continue;
@@ -137,6 +183,7 @@ static inline int scan_swap_map(struct swap_info_struct *si)
 			si->lowest_bit = si->max;
 			si->highest_bit = 0;
 		}
+		inc_cluster_info(si, offset);
 		si->swap_map[offset] = 1;
 		si->inuse_pages++;
 		nr_swap_pages--;
@@ -255,6 +302,13 @@ static int swap_entry_free(struct swap_info_struct *p, unsigned long offset)
 				p->highest_bit = offset;
 			nr_swap_pages++;
 			p->inuse_pages--;
+			dec_cluster_info(p, offset);
+			if (p->flags & SWP_BLKDEV) {
+				struct gendisk *disk = p->bdev->bd_disk;
+				if (disk->fops->swap_slot_free_notify)
+					disk->fops->swap_slot_free_notify(p->bdev,
+									  offset);
+			}
 		}
 	}
 	return count;
@@ -363,10 +417,13 @@ int remove_exclusive_swap_page(struct page *page)
 	if (p->swap_map[swp_offset(entry)] == 1) {
 		/* Recheck the page count with the swapcache lock held.. */
 		write_lock_irq(&swapper_space.tree_lock);
-		if ((page_count(page) == 2) && !PageWriteback(page)) {
-			__delete_from_swap_cache(page);
-			SetPageDirty(page);
-			retval = 1;
+		if (page_freeze_refs(page, 2)) {
+			if (!PageWriteback(page)) {
+				__delete_from_swap_cache(page);
+				SetPageDirty(page);
+				retval = 1;
+			}
+			page_unfreeze_refs(page, 2);
 		}
 		write_unlock_irq(&swapper_space.tree_lock);
 	}
@@ -468,6 +525,9 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* huge pmds never map swap entries */
+		if (pmd_trans_huge(*pmd))
+			continue;
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		if (unuse_pte_range(vma, pmd, addr, next, entry, page))
@@ -1065,10 +1125,52 @@ int page_queue_congested(struct page *page)
 }
 #endif
 
+/*
+ * Count the slots in use (or bad, or beyond the end) of each cluster,
+ * and put the empty clusters on the free list.
+ */
+static int setup_swap_clusters(struct swap_info_struct *p)
+{
+	unsigned long nr_clusters;
+	unsigned long i;
+
+	nr_clusters = (p->max + SWAPFILE_CLUSTER - 1) / SWAPFILE_CLUSTER;
+	p->cluster_info = vmalloc(nr_clusters * sizeof(struct swap_cluster_info));
+	if (!p->cluster_info)
+		return -ENOMEM;
+	p->percpu_cluster = alloc_percpu(struct percpu_cluster);
+	if (!p->percpu_cluster)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&p->free_clusters);
+	for (i = 0; i < nr_clusters; i++) {
+		INIT_LIST_HEAD(&p->cluster_info[i].list);
+		p->cluster_info[i].count = 0;
+	}
+	for (i = 0; i < nr_clusters * SWAPFILE_CLUSTER; i++)
+		if (i >= p->max || p->swap_map[i])
+			p->cluster_info[i / SWAPFILE_CLUSTER].count++;
+	for (i = 0; i < nr_clusters; i++)
+		if (!p->cluster_info[i].count)
+			list_add_tail(&p->cluster_info[i].list,
+					&p->free_clusters);
+	return 0;
+}
+
+static void free_swap_clusters(struct swap_cluster_info *cluster_info,
+			       struct percpu_cluster *percpu_cluster)
+{
+	vfree(cluster_info);
+	if (percpu_cluster)
+		free_percpu(percpu_cluster);
+}
+
 asmlinkage long sys_swapoff(const char __user * specialfile)
 {
 	struct swap_info_struct * p = NULL;
 	unsigned short *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster *percpu_cluster;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1160,12 +1262,17 @@ asmlinkage long sys_swapoff(const char __user * specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
 	destroy_swap_extents(p);
 	swap_device_unlock(p);
 	swap_list_unlock();
 	up(&swapon_sem);
 	vfree(swap_map);
+	free_swap_clusters(cluster_info, percpu_cluster);
 	inode = mapping->host;
 	if (S_ISBLK(inode->i_mode)) {
 		struct block_device *bdev = I_BDEV(inode);
@@ -1299,6 +1406,8 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 	unsigned long maxpages = 1;
 	int swapfilesize;
 	unsigned short *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster *percpu_cluster;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 	int did_down = 0;
@@ -1335,6 +1444,8 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 	p->swap_file = NULL;
 	p->old_block_size = 0;
 	p->swap_map = NULL;
+	p->cluster_info = NULL;
+	p->percpu_cluster = NULL;
 	p->lowest_bit = 0;
 	p->highest_bit = 0;
 	p->cluster_nr = 0;
@@ -1388,6 +1499,7 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 		if (error < 0)
 			goto bad_swap;
 		p->bdev = bdev;
+		p->flags |= SWP_BLKDEV;
 	} else if (S_ISREG(inode->i_mode)) {
 		p->bdev = inode->i_sb->s_bdev;
 		down(&inode->i_sem);
@@ -1509,6 +1621,10 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 	p->max = maxpages;
 	p->pages = nr_good_pages;
 
+	error = setup_swap_clusters(p);
+	if (error)
+		goto bad_swap;
+
 	error = setup_swap_extents(p);
 	if (error)
 		goto bad_swap;
@@ -1516,7 +1632,7 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 	down(&swapon_sem);
 	swap_list_lock();
 	swap_device_lock(p);
-	p->flags = SWP_ACTIVE;
+	p->flags |= SWP_ACTIVE;
 	nr_swap_pages += nr_good_pages;
 	total_swap_pages += nr_good_pages;
 	printk(KERN_INFO "Adding %dk swap on %s.  Priority:%d extents:%d\n",
@@ -1550,14 +1666,19 @@ bad_swap:
 bad_swap_2:
 	swap_list_lock();
 	swap_map = p->swap_map;
+	cluster_info = p->cluster_info;
+	percpu_cluster = p->percpu_cluster;
 	p->swap_file = NULL;
 	p->swap_map = NULL;
+	p->cluster_info = NULL;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
 	if (!(swap_flags & SWAP_FLAG_PREFER))
 		++least_priority;
 	swap_list_unlock();
 	destroy_swap_extents(p);
 	vfree(swap_map);
+	free_swap_clusters(cluster_info, percpu_cluster);
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
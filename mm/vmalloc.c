@@ -13,6 +13,9 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
+#include <linux/rbtree.h>
+#include <linux/radix-tree.h>
+#include <linux/percpu.h>
 
 #include <linux/vmalloc.h>
 
@@ -23,6 +26,12 @@
 DEFINE_RWLOCK(vmlist_lock);
 struct vm_struct *vmlist;
 
+/*
+ * The areas on vmlist are also kept in an rbtree by address, so that they
+ * can be found without walking the list.  Both are protected by vmlist_lock.
+ */
+static struct rb_root vm_area_root = RB_ROOT;
+
 static void vunmap_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end)
 {
 	pte_t *pte;
@@ -64,12 +73,13 @@ static inline void vunmap_pud_range(pgd_t *pgd, unsigned long addr,
 	} while (pud++, addr = next, addr != end);
 }
 
-void unmap_vm_area(struct vm_struct *area)
+/*
+ * Clear the page tables for a range, leaving the TLB flush to the caller.
+ */
+static void vunmap_page_range(unsigned long addr, unsigned long end)
 {
 	pgd_t *pgd;
 	unsigned long next;
-	unsigned long addr = (unsigned long) area->addr;
-	unsigned long end = addr + area->size;
 
 	BUG_ON(addr >= end);
 	pgd = pgd_offset_k(addr);
@@ -80,7 +90,15 @@ void unmap_vm_area(struct vm_struct *area)
 			continue;
 		vunmap_pud_range(pgd, addr, next);
 	} while (pgd++, addr = next, addr != end);
-	flush_tlb_kernel_range((unsigned long) area->addr, end);
+}
+
+void unmap_vm_area(struct vm_struct *area)
+{
+	unsigned long addr = (unsigned long) area->addr;
+	unsigned long end = addr + area->size;
+
+	vunmap_page_range(addr, end);
+	flush_tlb_kernel_range(addr, end);
 }
 
 static int vmap_pte_range(pmd_t *pmd, unsigned long addr,
@@ -136,12 +154,11 @@ static inline int vmap_pud_range(pgd_t *pgd, unsigned long addr,
 	return 0;
 }
 
-int map_vm_area(struct vm_struct *area, pgprot_t prot, struct page ***pages)
+static int vmap_page_range(unsigned long addr, unsigned long end,
+			   pgprot_t prot, struct page ***pages)
 {
 	pgd_t *pgd;
 	unsigned long next;
-	unsigned long addr = (unsigned long) area->addr;
-	unsigned long end = addr + area->size - PAGE_SIZE;
 	int err;
 
 	BUG_ON(addr >= end);
@@ -154,30 +171,203 @@ int map_vm_area(struct vm_struct *area, pgprot_t prot, struct page ***pages)
 			break;
 	} while (pgd++, addr = next, addr != end);
 	spin_unlock(&init_mm.page_table_lock);
-	flush_cache_vmap((unsigned long) area->addr, end);
 	return err;
 }
 
-#define IOREMAP_MAX_ORDER	(7 + PAGE_SHIFT)	/* 128 pages */
+int map_vm_area(struct vm_struct *area, pgprot_t prot, struct page ***pages)
+{
+	unsigned long addr = (unsigned long) area->addr;
+	unsigned long end = addr + area->size - PAGE_SIZE;
+	int err;
 
-struct vm_struct *__get_vm_area(unsigned long size, unsigned long flags,
-				unsigned long start, unsigned long end)
+	err = vmap_page_range(addr, end, prot, pages);
+	flush_cache_vmap(addr, end);
+	return err;
+}
+
+/*
+ * Insert @area into the rbtree, and into vmlist at @p.  Called under
+ * vmlist_lock.
+ */
+static void vm_area_link(struct vm_struct **p, struct vm_struct *area)
 {
-	struct vm_struct **p, *tmp, *area;
-	unsigned long align = 1;
-	unsigned long addr;
+	struct rb_node **link = &vm_area_root.rb_node;
+	struct rb_node *parent = NULL;
 
-	if (flags & VM_IOREMAP) {
-		int bit = fls(size);
+	area->next = *p;
+	*p = area;
 
-		if (bit > IOREMAP_MAX_ORDER)
-			bit = IOREMAP_MAX_ORDER;
-		else if (bit < PAGE_SHIFT)
-			bit = PAGE_SHIFT;
+	while (*link) {
+		struct vm_struct *tmp;
 
-		align = 1ul << bit;
+		parent = *link;
+		tmp = rb_entry(parent, struct vm_struct, rb_node);
+		if (area->addr < tmp->addr)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
 	}
-	addr = ALIGN(start, align);
+	rb_link_node(&area->rb_node, parent, link);
+	rb_insert_color(&area->rb_node, &vm_area_root);
+}
+
+static void vm_area_unlink(struct vm_struct *area)
+{
+	struct rb_node *prev = rb_prev(&area->rb_node);
+
+	if (prev)
+		rb_entry(prev, struct vm_struct, rb_node)->next = area->next;
+	else
+		vmlist = area->next;
+	rb_erase(&area->rb_node, &vm_area_root);
+}
+
+/*
+ * Find the area starting at @addr.  Called under vmlist_lock.
+ */
+static struct vm_struct *__find_vm_area(void *addr)
+{
+	struct rb_node *n = vm_area_root.rb_node;
+
+	while (n) {
+		struct vm_struct *tmp = rb_entry(n, struct vm_struct, rb_node);
+
+		if (addr < tmp->addr)
+			n = n->rb_left;
+		else if (addr > tmp->addr)
+			n = n->rb_right;
+		else
+			return tmp;
+	}
+	return NULL;
+}
+
+/*
+ * Return the vmlist link at which to look for room at @addr: the one leading
+ * to the first area which ends beyond @addr.  Called under vmlist_lock.
+ */
+static struct vm_struct **vm_area_search_start(unsigned long addr)
+{
+	struct rb_node *n = vm_area_root.rb_node;
+	struct rb_node *prev;
+	struct vm_struct *first = NULL;
+
+	while (n) {
+		struct vm_struct *tmp = rb_entry(n, struct vm_struct, rb_node);
+
+		if ((unsigned long)tmp->addr + tmp->size > addr) {
+			first = tmp;
+			n = n->rb_left;
+		} else
+			n = n->rb_right;
+	}
+
+	if (first)
+		prev = rb_prev(&first->rb_node);
+	else
+		prev = rb_last(&vm_area_root);
+	if (!prev)
+		return &vmlist;
+	return &rb_entry(prev, struct vm_struct, rb_node)->next;
+}
+
+/*
+ * Lazy unmapping.
+ *
+ * vunmap() and vfree() clear the page tables at once, but only mark the area
+ * VM_LAZY_FREE and leave it in place.  The TLB is then flushed for a whole
+ * batch of such areas at a time, instead of sending an IPI to every CPU for
+ * each one.  Until the flush the address range is not reused, so the stale
+ * TLB entries can only be hit by code which uses memory it has freed.
+ *
+ * vm_map_ram() blocks, below, are released the same way.
+ */
+static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);	/* Pages in lazy areas */
+static DEFINE_SPINLOCK(vmap_purge_lock);
+
+/*
+ * The TLB flush gets more expensive with the number of CPUs, so batch
+ * more with more of them; but do not tie up too much of the address space.
+ */
+static unsigned long lazy_max_pages(void)
+{
+	unsigned long nr = fls(num_online_cpus()) * (16UL << (20 - PAGE_SHIFT));
+	unsigned long space = (VMALLOC_END - VMALLOC_START) >> (PAGE_SHIFT + 2);
+
+	return min(nr, space);
+}
+
+/*
+ * Flush the TLB for the lazily freed areas and free them.  Unless @sync is
+ * set, don't bother if somebody else is purging already.
+ */
+static void purge_lazy_areas(int sync)
+{
+	struct vm_struct **p, *tmp, *purge = NULL;
+	unsigned long start = ULONG_MAX, end = 0;
+	int nr = 0;
+
+	if (!sync) {
+		if (!spin_trylock(&vmap_purge_lock))
+			return;
+	} else
+		spin_lock(&vmap_purge_lock);
+
+	write_lock(&vmlist_lock);
+	for (tmp = vmlist; tmp; tmp = tmp->next) {
+		if (!(tmp->flags & VM_LAZY_FREE))
+			continue;
+		tmp->flags |= VM_LAZY_PURGE;
+		start = min(start, (unsigned long)tmp->addr);
+		end = max(end, (unsigned long)tmp->addr + tmp->size);
+		nr += tmp->size >> PAGE_SHIFT;
+	}
+	write_unlock(&vmlist_lock);
+
+	if (nr) {
+		flush_tlb_kernel_range(start, end);
+
+		write_lock(&vmlist_lock);
+		for (p = &vmlist; (tmp = *p) != NULL; ) {
+			if (!(tmp->flags & VM_LAZY_PURGE)) {
+				p = &tmp->next;
+				continue;
+			}
+			vm_area_unlink(tmp);
+			tmp->next = purge;
+			purge = tmp;
+		}
+		write_unlock(&vmlist_lock);
+		atomic_sub(nr, &vmap_lazy_nr);
+	}
+	spin_unlock(&vmap_purge_lock);
+
+	while ((tmp = purge) != NULL) {
+		purge = tmp->next;
+		kfree(tmp);
+	}
+}
+
+/*
+ * Account for an area which has just been marked VM_LAZY_FREE.
+ */
+static void lazy_area_added(struct vm_struct *area)
+{
+	atomic_add(area->size >> PAGE_SHIFT, &vmap_lazy_nr);
+	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
+		purge_lazy_areas(0);
+}
+
+#define IOREMAP_MAX_ORDER	(7 + PAGE_SHIFT)	/* 128 pages */
+
+static struct vm_struct *__get_vm_area_align(unsigned long size,
+		unsigned long align, unsigned long flags,
+		unsigned long start, unsigned long end)
+{
+	struct vm_struct **p, *tmp, *area;
+	unsigned long addr;
+	int purged = 0;
+
 	size = PAGE_ALIGN(size);
 
 	area = kmalloc(sizeof(*area), GFP_KERNEL);
@@ -194,8 +384,10 @@ struct vm_struct *__get_vm_area(unsigned long size, unsigned long flags,
 	 */
 	size += PAGE_SIZE;
 
+retry:
+	addr = ALIGN(start, align);
 	write_lock(&vmlist_lock);
-	for (p = &vmlist; (tmp = *p) != NULL ;p = &tmp->next) {
+	for (p = vm_area_search_start(addr); (tmp = *p) != NULL ;p = &tmp->next) {
 		if ((unsigned long)tmp->addr < addr) {
 			if((unsigned long)tmp->addr + tmp->size >= addr)
 				addr = ALIGN(tmp->size + 
@@ -212,8 +404,7 @@ struct vm_struct *__get_vm_area(unsigned long size, unsigned long flags,
 	}
 
 found:
-	area->next = *p;
-	*p = area;
+	vm_area_link(p, area);
 
 	area->flags = flags;
 	area->addr = (void *)addr;
@@ -227,12 +418,35 @@ found:
 
 out:
 	write_unlock(&vmlist_lock);
+	if (!purged && atomic_read(&vmap_lazy_nr)) {
+		purge_lazy_areas(1);
+		purged = 1;
+		goto retry;
+	}
 	kfree(area);
 	if (printk_ratelimit())
 		printk(KERN_WARNING "allocation failed: out of vmalloc space - use vmalloc=<size> to increase size.\n");
 	return NULL;
 }
 
+struct vm_struct *__get_vm_area(unsigned long size, unsigned long flags,
+				unsigned long start, unsigned long end)
+{
+	unsigned long align = 1;
+
+	if (flags & VM_IOREMAP) {
+		int bit = fls(size);
+
+		if (bit > IOREMAP_MAX_ORDER)
+			bit = IOREMAP_MAX_ORDER;
+		else if (bit < PAGE_SHIFT)
+			bit = PAGE_SHIFT;
+
+		align = 1ul << bit;
+	}
+	return __get_vm_area_align(size, align, flags, start, end);
+}
+
 /**
  *	get_vm_area  -  reserve a contingous kernel virtual area
  *
@@ -249,30 +463,35 @@ struct vm_struct *get_vm_area(unsigned long size, unsigned long flags)
 }
 
 /**
- *	remove_vm_area  -  find and remove a contingous kernel virtual area
- *
- *	@addr:		base address
+ *	vm_area_add_early  -  add an area set up by early boot code
  *
- *	Search for the kernel VM area starting at @addr, and remove it.
- *	This function returns the found VM area, but using it is NOT safe
- *	on SMP machines.
+ *	@vm:		the area, its size including any guard page
  */
-struct vm_struct *remove_vm_area(void *addr)
+void __init vm_area_add_early(struct vm_struct *vm)
 {
 	struct vm_struct **p, *tmp;
 
 	write_lock(&vmlist_lock);
-	for (p = &vmlist ; (tmp = *p) != NULL ;p = &tmp->next) {
-		 if (tmp->addr == addr)
-			 goto found;
-	}
+	for (p = &vmlist; (tmp = *p) != NULL; p = &tmp->next)
+		if (tmp->addr > vm->addr)
+			break;
+	vm_area_link(p, vm);
 	write_unlock(&vmlist_lock);
-	return NULL;
+}
+
+/*
+ * Like remove_vm_area(), for callers holding vmlist_lock for writing.
+ */
+struct vm_struct *__remove_vm_area(void *addr)
+{
+	struct vm_struct *tmp;
+
+	tmp = __find_vm_area(addr);
+	if (!tmp || (tmp->flags & (VM_LAZY_FREE | VM_RAM)))
+		return NULL;
 
-found:
 	unmap_vm_area(tmp);
-	*p = tmp->next;
-	write_unlock(&vmlist_lock);
+	vm_area_unlink(tmp);
 
 	/*
 	 * Remove the guard page.
@@ -281,6 +500,25 @@ found:
 	return tmp;
 }
 
+/**
+ *	remove_vm_area  -  find and remove a contingous kernel virtual area
+ *
+ *	@addr:		base address
+ *
+ *	Search for the kernel VM area starting at @addr, and remove it.
+ *	This function returns the found VM area, but using it is NOT safe
+ *	on SMP machines.
+ */
+struct vm_struct *remove_vm_area(void *addr)
+{
+	struct vm_struct *tmp;
+
+	write_lock(&vmlist_lock);
+	tmp = __remove_vm_area(addr);
+	write_unlock(&vmlist_lock);
+	return tmp;
+}
+
 void __vunmap(void *addr, int deallocate_pages)
 {
 	struct vm_struct *area;
@@ -294,7 +532,16 @@ void __vunmap(void *addr, int deallocate_pages)
 		return;
 	}
 
-	area = remove_vm_area(addr);
+	write_lock(&vmlist_lock);
+	area = __find_vm_area(addr);
+	if (area && !(area->flags & (VM_LAZY_FREE | VM_RAM))) {
+		vunmap_page_range((unsigned long)addr,
+				(unsigned long)addr + area->size);
+		area->flags |= VM_LAZY_FREE;
+	} else
+		area = NULL;
+	write_unlock(&vmlist_lock);
+
 	if (unlikely(!area)) {
 		printk(KERN_ERR "Trying to vfree() nonexistent vm area (%p)\n",
 				addr);
@@ -315,9 +562,11 @@ void __vunmap(void *addr, int deallocate_pages)
 			vfree(area->pages);
 		else
 			kfree(area->pages);
+		area->pages = NULL;
+		area->nr_pages = 0;
 	}
 
-	kfree(area);
+	lazy_area_added(area);
 	return;
 }
 
@@ -389,6 +638,249 @@ void *vmap(struct page **pages, unsigned int count,
 
 EXPORT_SYMBOL(vmap);
 
+/*
+ * vm_map_ram() serves small mappings out of per-cpu blocks of address space,
+ * so that mapping and unmapping them takes neither vmlist_lock nor a TLB
+ * flush of its own.  A block hands out its pages in order, and is released
+ * through the lazy purge like any other area once all of them have been
+ * unmapped again.  The last page of a block is its guard page.
+ */
+#define VMAP_BLOCK_PAGES	128
+#define VMAP_BLOCK_SIZE		(VMAP_BLOCK_PAGES * PAGE_SIZE)
+#define VMAP_BLOCK_AVAIL	(VMAP_BLOCK_PAGES - 1)
+#define VMAP_MAX_ALLOC		32	/* Bigger ones go to vmap() */
+
+struct vmap_block {
+	spinlock_t lock;
+	struct vm_struct *area;
+	unsigned int used;		/* Pages handed out */
+	unsigned int dirty;		/* Pages unmapped again */
+};
+
+/* The block each CPU is allocating from */
+static DEFINE_PER_CPU(struct vmap_block *, vmap_block);
+
+/* All blocks by address, for vm_unmap_ram() */
+static DEFINE_SPINLOCK(vmap_block_tree_lock);
+static RADIX_TREE(vmap_block_tree, GFP_ATOMIC);
+
+static inline unsigned long vb_index(unsigned long addr)
+{
+	return addr / VMAP_BLOCK_SIZE;
+}
+
+static struct vmap_block *new_vmap_block(void)
+{
+	struct vmap_block *vb;
+	struct vm_struct *area;
+	int err;
+
+	vb = kmalloc(sizeof(*vb), GFP_KERNEL);
+	if (!vb)
+		return NULL;
+
+	area = __get_vm_area_align(VMAP_BLOCK_SIZE - PAGE_SIZE,
+			VMAP_BLOCK_SIZE, VM_RAM, VMALLOC_START, VMALLOC_END);
+	if (!area)
+		goto out_free;
+
+	spin_lock_init(&vb->lock);
+	vb->area = area;
+	vb->used = 0;
+	vb->dirty = 0;
+
+	if (radix_tree_preload(GFP_KERNEL))
+		goto out_area;
+	spin_lock(&vmap_block_tree_lock);
+	err = radix_tree_insert(&vmap_block_tree,
+				vb_index((unsigned long)area->addr), vb);
+	spin_unlock(&vmap_block_tree_lock);
+	radix_tree_preload_end();
+	if (err)
+		goto out_area;
+	return vb;
+
+out_area:
+	kfree(remove_vm_area(area->addr));
+out_free:
+	kfree(vb);
+	return NULL;
+}
+
+static void free_vmap_block(struct vmap_block *vb)
+{
+	struct vm_struct *area = vb->area;
+
+	spin_lock(&vmap_block_tree_lock);
+	radix_tree_delete(&vmap_block_tree, vb_index((unsigned long)area->addr));
+	spin_unlock(&vmap_block_tree_lock);
+	kfree(vb);
+
+	/* The page tables have all been cleared by vm_unmap_ram() */
+	write_lock(&vmlist_lock);
+	area->flags |= VM_LAZY_FREE;
+	write_unlock(&vmlist_lock);
+	lazy_area_added(area);
+}
+
+/*
+ * Retire @nr pages of @vb, handed out or not; the block goes once all of
+ * them are.
+ */
+static void vb_put_pages(struct vmap_block *vb, unsigned int nr)
+{
+	int done;
+
+	spin_lock(&vb->lock);
+	vb->dirty += nr;
+	BUG_ON(vb->dirty > VMAP_BLOCK_AVAIL);
+	done = (vb->dirty == VMAP_BLOCK_AVAIL);
+	spin_unlock(&vb->lock);
+
+	if (done)
+		free_vmap_block(vb);
+}
+
+/*
+ * A CPU has moved on to a new block: give up the rest of @vb.
+ */
+static void vb_retire(struct vmap_block *vb)
+{
+	unsigned int nr;
+
+	spin_lock(&vb->lock);
+	nr = VMAP_BLOCK_AVAIL - vb->used;
+	vb->used = VMAP_BLOCK_AVAIL;
+	spin_unlock(&vb->lock);
+
+	if (nr)
+		vb_put_pages(vb, nr);
+}
+
+static void *vb_alloc(unsigned int nr)
+{
+	struct vmap_block *vb, *new = NULL;
+	unsigned long addr;
+
+	for (;;) {
+		struct vmap_block **vbp = &get_cpu_var(vmap_block);
+
+		vb = *vbp;
+		if (vb) {
+			spin_lock(&vb->lock);
+			if (vb->used + nr <= VMAP_BLOCK_AVAIL) {
+				addr = (unsigned long)vb->area->addr +
+						(vb->used << PAGE_SHIFT);
+				vb->used += nr;
+				spin_unlock(&vb->lock);
+				put_cpu_var(vmap_block);
+				if (new)	/* Raced with another task */
+					vb_put_pages(new, VMAP_BLOCK_AVAIL);
+				return (void *)addr;
+			}
+			spin_unlock(&vb->lock);
+		}
+
+		if (new) {
+			*vbp = new;
+			put_cpu_var(vmap_block);
+			new = NULL;
+			if (vb)
+				vb_retire(vb);
+			continue;
+		}
+		put_cpu_var(vmap_block);
+
+		new = new_vmap_block();
+		if (!new)
+			return NULL;
+	}
+}
+
+static void vb_free(unsigned long addr, unsigned int nr)
+{
+	struct vmap_block *vb;
+
+	spin_lock(&vmap_block_tree_lock);
+	vb = radix_tree_lookup(&vmap_block_tree, vb_index(addr));
+	spin_unlock(&vmap_block_tree_lock);
+	BUG_ON(!vb);
+
+	vunmap_page_range(addr, addr + (nr << PAGE_SHIFT));
+	vb_put_pages(vb, nr);
+}
+
+/**
+ *	vm_map_ram  -  map pages for a short while
+ *
+ *	@pages:		array of page pointers
+ *	@count:		number of pages to map
+ *	@prot:		page protection for the mapping
+ *
+ *	Like vmap(), but much cheaper for the small mappings which are made
+ *	and torn down all the time, such as filesystem buffers spanning
+ *	several pages.  Unmap with vm_unmap_ram(), passing the same @count.
+ */
+void *vm_map_ram(struct page **pages, unsigned int count, pgprot_t prot)
+{
+	unsigned long addr;
+	void *mem;
+
+	if (count > VMAP_MAX_ALLOC)
+		return vmap(pages, count, VM_MAP, prot);
+
+	mem = vb_alloc(count);
+	if (!mem)
+		return NULL;
+	addr = (unsigned long)mem;
+	if (vmap_page_range(addr, addr + (count << PAGE_SHIFT), prot, &pages)) {
+		vm_unmap_ram(mem, count);
+		return NULL;
+	}
+	flush_cache_vmap(addr, addr + (count << PAGE_SHIFT));
+	return mem;
+}
+
+EXPORT_SYMBOL(vm_map_ram);
+
+/**
+ *	vm_unmap_ram  -  unmap pages mapped by vm_map_ram()
+ *
+ *	@mem:		address returned by vm_map_ram()
+ *	@count:		the count passed to vm_map_ram()
+ *
+ *	May not be called in interrupt context.
+ */
+void vm_unmap_ram(void *mem, unsigned int count)
+{
+	BUG_ON(in_interrupt());
+	BUG_ON(!mem);
+
+	if (count > VMAP_MAX_ALLOC)
+		vunmap(mem);
+	else
+		vb_free((unsigned long)mem, count);
+}
+
+EXPORT_SYMBOL(vm_unmap_ram);
+
+/**
+ *	vm_unmap_aliases  -  get rid of stale vmalloc TLB entries
+ *
+ *	The TLB may still hold translations for vmalloc addresses which were
+ *	unmapped lazily, pointing to pages that have been freed since.  Code
+ *	about to change the caching attributes of pages calls this, so that
+ *	no such aliases remain.
+ */
+void vm_unmap_aliases(void)
+{
+	purge_lazy_areas(1);
+	/* And for what vm_unmap_ram() cleared in blocks still in use */
+	flush_tlb_kernel_range(VMALLOC_START, VMALLOC_END);
+}
+
+EXPORT_SYMBOL_GPL(vm_unmap_aliases);
+
 void *__vmalloc_area(struct vm_struct *area, int gfp_mask, pgprot_t prot)
 {
 	struct page **pages;
@@ -527,6 +1019,9 @@ long vread(char *buf, char *addr, unsigned long count)
 		vaddr = (char *) tmp->addr;
 		if (addr >= vaddr + tmp->size - PAGE_SIZE)
 			continue;
+		/* Not all mapped, read as holes */
+		if (tmp->flags & (VM_LAZY_FREE | VM_RAM))
+			continue;
 		while (addr < vaddr) {
 			if (count == 0)
 				goto finished;
@@ -565,6 +1060,8 @@ long vwrite(char *buf, char *addr, unsigned long count)
 		vaddr = (char *) tmp->addr;
 		if (addr >= vaddr + tmp->size - PAGE_SIZE)
 			continue;
+		if (tmp->flags & (VM_LAZY_FREE | VM_RAM))
+			continue;
 		while (addr < vaddr) {
 			if (count == 0)
 				goto finished;
@@ -33,6 +33,7 @@
 #include <linux/cpuset.h>
 #include <linux/notifier.h>
 #include <linux/rwsem.h>
+#include <linux/memcontrol.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -79,6 +80,13 @@ struct scan_control {
 	 * In this context, it doesn't matter that we scan the
 	 * whole list at once. */
 	int swap_cluster_max;
+
+	/*
+	 * The order of the allocation this reclaim is for. Above 0,
+	 * shrink_cache() also takes the neighbours of each page it
+	 * isolates, see isolate_lumpy_neighbours().
+	 */
+	int order;
 };
 
 /*
@@ -422,7 +430,7 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 		 * processes. Try to unmap it here.
 		 */
 		if (page_mapped(page) && mapping) {
-			switch (try_to_unmap(page)) {
+			switch (try_to_unmap(page, 0)) {
 			case SWAP_FAIL:
 				goto activate_locked;
 			case SWAP_AGAIN:
@@ -500,8 +508,15 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 		 * The non-racy check for busy page.  It is critical to check
 		 * PageDirty _after_ making sure that the page is freeable and
 		 * not in use by anybody. 	(pagecache + us == 2)
+		 * Freezing the count keeps lockless page cache lookups from
+		 * taking a new reference meanwhile.
 		 */
-		if (page_count(page) != 2 || PageDirty(page)) {
+		if (!page_freeze_refs(page, 2)) {
+			write_unlock_irq(&mapping->tree_lock);
+			goto keep_locked;
+		}
+		if (PageDirty(page)) {
+			page_unfreeze_refs(page, 2);
 			write_unlock_irq(&mapping->tree_lock);
 			goto keep_locked;
 		}
@@ -510,16 +525,16 @@ static int shrink_list(struct list_head *page_list, struct scan_control *sc)
 		if (PageSwapCache(page)) {
 			swp_entry_t swap = { .val = page->private };
 			__delete_from_swap_cache(page);
+			page_unfreeze_refs(page, 1);	/* Less the pagecache ref */
 			write_unlock_irq(&mapping->tree_lock);
 			swap_free(swap);
-			__put_page(page);	/* The pagecache ref */
 			goto free_it;
 		}
 #endif /* CONFIG_SWAP */
 
 		__remove_from_page_cache(page);
+		page_unfreeze_refs(page, 1);	/* Less the pagecache ref */
 		write_unlock_irq(&mapping->tree_lock);
-		__put_page(page);
 
 free_it:
 		unlock_page(page);
@@ -545,6 +560,54 @@ keep:
 	return reclaimed;
 }
 
+/*
+ * Lumpy reclaim: freeing pages in LRU order alone rarely frees all the
+ * pages of any one aligned block, so a high-order allocation can push
+ * out a lot of memory before it succeeds. When reclaiming for such an
+ * allocation, also take the inactive pages of the (1 << order) sized
+ * block around each page picked from the LRU. Neighbours in another
+ * zone, on the active list or being freed are left alone.
+ *
+ * Called with zone->lru_lock held. Returns the number of pages taken.
+ */
+static int isolate_lumpy_neighbours(struct zone *zone, struct page *page,
+				struct list_head *page_list, int order)
+{
+	unsigned long pfn = page_to_pfn(page);
+	unsigned long start_pfn = pfn & ~((1UL << order) - 1);
+	unsigned long end_pfn = start_pfn + (1UL << order);
+	int nr_taken = 0;
+
+	for (; start_pfn < end_pfn; start_pfn++) {
+		struct page *cursor;
+
+		if (start_pfn == pfn || !pfn_valid(start_pfn))
+			continue;
+		cursor = pfn_to_page(start_pfn);
+		if (page_zone(cursor) != zone)
+			continue;
+		if (!PageLRU(cursor) || PageActive(cursor))
+			continue;
+		if (page_lru_type(cursor) != page_lru_type(page))
+			continue;
+
+		if (!TestClearPageLRU(cursor))
+			BUG();
+		list_del(&cursor->lru);
+		if (get_page_testone(cursor)) {
+			/* It is being freed elsewhere */
+			__put_page(cursor);
+			SetPageLRU(cursor);
+			list_add(&cursor->lru,
+				&zone->inactive_list[page_lru_type(cursor)]);
+			continue;
+		}
+		list_add(&cursor->lru, page_list);
+		nr_taken++;
+	}
+	return nr_taken;
+}
+
 /*
  * zone->lru_lock is heavily contented.  We relieve it by quickly privatising
  * a batch of pages and working on them outside the lock.  Any pages which were
@@ -555,11 +618,12 @@ keep:
  * For pagecache intensive workloads, the first loop here is the hottest spot
  * in the kernel (apart from the copy_*_user functions).
  */
-static void shrink_cache(struct zone *zone, struct scan_control *sc)
+static void shrink_cache(struct zone *zone, struct scan_control *sc, int file)
 {
 	LIST_HEAD(page_list);
 	struct pagevec pvec;
 	int max_scan = sc->nr_to_scan;
+	struct list_head *inactive_list = &zone->inactive_list[file];
 
 	pagevec_init(&pvec, 1);
 
@@ -572,11 +636,10 @@ static void shrink_cache(struct zone *zone, struct scan_control *sc)
 		int nr_freed;
 
 		while (nr_scan++ < sc->swap_cluster_max &&
-				!list_empty(&zone->inactive_list)) {
-			page = lru_to_page(&zone->inactive_list);
+				!list_empty(inactive_list)) {
+			page = lru_to_page(inactive_list);
 
-			prefetchw_prev_lru_page(page,
-						&zone->inactive_list, flags);
+			prefetchw_prev_lru_page(page, inactive_list, flags);
 
 			if (!TestClearPageLRU(page))
 				BUG();
@@ -587,14 +650,18 @@ static void shrink_cache(struct zone *zone, struct scan_control *sc)
 				 */
 				__put_page(page);
 				SetPageLRU(page);
-				list_add(&page->lru, &zone->inactive_list);
+				list_add(&page->lru, inactive_list);
 				continue;
 			}
 			list_add(&page->lru, &page_list);
 			nr_taken++;
+			if (sc->order)
+				nr_taken += isolate_lumpy_neighbours(zone,
+						page, &page_list, sc->order);
 		}
-		zone->nr_inactive -= nr_taken;
+		zone->nr_inactive[file] -= nr_taken;
 		zone->pages_scanned += nr_scan;
+		zone->recent_scanned[file] += nr_taken;
 		spin_unlock_irq(&zone->lru_lock);
 
 		if (nr_taken == 0)
@@ -620,9 +687,10 @@ static void shrink_cache(struct zone *zone, struct scan_control *sc)
 			if (TestSetPageLRU(page))
 				BUG();
 			list_del(&page->lru);
-			if (PageActive(page))
+			if (PageActive(page)) {
 				add_page_to_active_list(zone, page);
-			else
+				zone->recent_rotated[page_lru_type(page)]++;
+			} else
 				add_page_to_inactive_list(zone, page);
 			if (!pagevec_add(&pvec, page)) {
 				spin_unlock_irq(&zone->lru_lock);
@@ -654,7 +722,7 @@ done:
  * But we had to alter page->flags anyway.
  */
 static void
-refill_inactive_zone(struct zone *zone, struct scan_control *sc)
+refill_inactive_zone(struct zone *zone, struct scan_control *sc, int file)
 {
 	int pgmoved;
 	int pgdeactivate = 0;
@@ -669,13 +737,14 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 	long mapped_ratio;
 	long distress;
 	long swap_tendency;
+	struct list_head *active_list = &zone->active_list[file];
 
 	lru_add_drain();
 	pgmoved = 0;
 	spin_lock_irq(&zone->lru_lock);
-	while (pgscanned < nr_pages && !list_empty(&zone->active_list)) {
-		page = lru_to_page(&zone->active_list);
-		prefetchw_prev_lru_page(page, &zone->active_list, flags);
+	while (pgscanned < nr_pages && !list_empty(active_list)) {
+		page = lru_to_page(active_list);
+		prefetchw_prev_lru_page(page, active_list, flags);
 		if (!TestClearPageLRU(page))
 			BUG();
 		list_del(&page->lru);
@@ -688,7 +757,7 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 			 */
 			__put_page(page);
 			SetPageLRU(page);
-			list_add(&page->lru, &zone->active_list);
+			list_add(&page->lru, active_list);
 		} else {
 			list_add(&page->lru, &l_hold);
 			pgmoved++;
@@ -696,7 +765,8 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 		pgscanned++;
 	}
 	zone->pages_scanned += pgscanned;
-	zone->nr_active -= pgmoved;
+	zone->nr_active[file] -= pgmoved;
+	zone->recent_scanned[file] += pgmoved;
 	spin_unlock_irq(&zone->lru_lock);
 
 	/*
@@ -755,10 +825,10 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 			BUG();
 		if (!TestClearPageActive(page))
 			BUG();
-		list_move(&page->lru, &zone->inactive_list);
+		list_move(&page->lru, &zone->inactive_list[file]);
 		pgmoved++;
 		if (!pagevec_add(&pvec, page)) {
-			zone->nr_inactive += pgmoved;
+			zone->nr_inactive[file] += pgmoved;
 			spin_unlock_irq(&zone->lru_lock);
 			pgdeactivate += pgmoved;
 			pgmoved = 0;
@@ -768,7 +838,7 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 			spin_lock_irq(&zone->lru_lock);
 		}
 	}
-	zone->nr_inactive += pgmoved;
+	zone->nr_inactive[file] += pgmoved;
 	pgdeactivate += pgmoved;
 	if (buffer_heads_over_limit) {
 		spin_unlock_irq(&zone->lru_lock);
@@ -783,17 +853,18 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 		if (TestSetPageLRU(page))
 			BUG();
 		BUG_ON(!PageActive(page));
-		list_move(&page->lru, &zone->active_list);
+		list_move(&page->lru, active_list);
 		pgmoved++;
+		zone->recent_rotated[file]++;
 		if (!pagevec_add(&pvec, page)) {
-			zone->nr_active += pgmoved;
+			zone->nr_active[file] += pgmoved;
 			pgmoved = 0;
 			spin_unlock_irq(&zone->lru_lock);
 			__pagevec_release(&pvec);
 			spin_lock_irq(&zone->lru_lock);
 		}
 	}
-	zone->nr_active += pgmoved;
+	zone->nr_active[file] += pgmoved;
 	spin_unlock_irq(&zone->lru_lock);
 	pagevec_release(&pvec);
 
@@ -801,53 +872,109 @@ refill_inactive_zone(struct zone *zone, struct scan_control *sc)
 	mod_page_state(pgdeactivate, pgdeactivate);
 }
 
+/*
+ * Decide how much of the scanning goes to the anon and to the file
+ * LRU lists, in percent. A type whose pages mostly come back to the
+ * active list after being scanned is expensive to reclaim from, so it
+ * gets scanned less; vm_swappiness biases the result towards anon
+ * (100) or file (0) pages. Without swap, anon pages are not scanned.
+ */
+static void get_scan_ratio(struct zone *zone, int percent[NR_LRU_TYPES])
+{
+	unsigned long anon, file;
+	unsigned long ap, fp;
+	int i;
+
+	if (!total_swap_pages) {
+		percent[LRU_ANON] = 0;
+		percent[LRU_FILE] = 100;
+		return;
+	}
+
+	spin_lock_irq(&zone->lru_lock);
+	for (i = 0; i < NR_LRU_TYPES; i++) {
+		unsigned long size = zone->nr_active[i] + zone->nr_inactive[i];
+
+		/* Forget old history, so that the ratio follows the load */
+		if (zone->recent_scanned[i] > size / 4) {
+			zone->recent_scanned[i] /= 2;
+			zone->recent_rotated[i] /= 2;
+		}
+	}
+
+	anon = (vm_swappiness + 1) * (zone->recent_scanned[LRU_ANON] + 1);
+	anon /= zone->recent_rotated[LRU_ANON] + 1;
+	file = (200 - vm_swappiness + 1) * (zone->recent_scanned[LRU_FILE] + 1);
+	file /= zone->recent_rotated[LRU_FILE] + 1;
+	spin_unlock_irq(&zone->lru_lock);
+
+	ap = (anon * 100) / (anon + file + 1);
+	fp = 100 - ap;
+	percent[LRU_ANON] = ap;
+	percent[LRU_FILE] = fp;
+}
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
 static void
 shrink_zone(struct zone *zone, struct scan_control *sc)
 {
-	unsigned long nr_active;
-	unsigned long nr_inactive;
+	unsigned long nr_active[NR_LRU_TYPES];
+	unsigned long nr_inactive[NR_LRU_TYPES];
+	int percent[NR_LRU_TYPES];
+	int type, todo;
 
-	/*
-	 * Add one to `nr_to_scan' just to make sure that the kernel will
-	 * slowly sift through the active list.
-	 */
-	zone->nr_scan_active += (zone->nr_active >> sc->priority) + 1;
-	nr_active = zone->nr_scan_active;
-	if (nr_active >= sc->swap_cluster_max)
-		zone->nr_scan_active = 0;
-	else
-		nr_active = 0;
-
-	zone->nr_scan_inactive += (zone->nr_inactive >> sc->priority) + 1;
-	nr_inactive = zone->nr_scan_inactive;
-	if (nr_inactive >= sc->swap_cluster_max)
-		zone->nr_scan_inactive = 0;
-	else
-		nr_inactive = 0;
+	get_scan_ratio(zone, percent);
+
+	for (type = 0; type < NR_LRU_TYPES; type++) {
+		unsigned long scan;
+
+		/*
+		 * Add one to `nr_to_scan' just to make sure that the kernel
+		 * will slowly sift through the active list.
+		 */
+		scan = zone->nr_active[type] >> sc->priority;
+		zone->nr_scan_active[type] += scan * percent[type] / 100 + 1;
+		nr_active[type] = zone->nr_scan_active[type];
+		if (nr_active[type] >= sc->swap_cluster_max)
+			zone->nr_scan_active[type] = 0;
+		else
+			nr_active[type] = 0;
+
+		scan = zone->nr_inactive[type] >> sc->priority;
+		zone->nr_scan_inactive[type] += scan * percent[type] / 100 + 1;
+		nr_inactive[type] = zone->nr_scan_inactive[type];
+		if (nr_inactive[type] >= sc->swap_cluster_max)
+			zone->nr_scan_inactive[type] = 0;
+		else
+			nr_inactive[type] = 0;
+	}
 
 	sc->nr_to_reclaim = sc->swap_cluster_max;
 
-	while (nr_active || nr_inactive) {
-		if (nr_active) {
-			sc->nr_to_scan = min(nr_active,
+	do {
+		todo = 0;
+		for (type = 0; type < NR_LRU_TYPES; type++) {
+			if (nr_active[type]) {
+				sc->nr_to_scan = min(nr_active[type],
 					(unsigned long)sc->swap_cluster_max);
-			nr_active -= sc->nr_to_scan;
-			refill_inactive_zone(zone, sc);
-		}
+				nr_active[type] -= sc->nr_to_scan;
+				refill_inactive_zone(zone, sc, type);
+			}
 
-		if (nr_inactive) {
-			sc->nr_to_scan = min(nr_inactive,
+			if (nr_inactive[type]) {
+				sc->nr_to_scan = min(nr_inactive[type],
 					(unsigned long)sc->swap_cluster_max);
-			nr_inactive -= sc->nr_to_scan;
-			shrink_cache(zone, sc);
-			if (sc->nr_to_reclaim <= 0)
-				break;
+				nr_inactive[type] -= sc->nr_to_scan;
+				shrink_cache(zone, sc, type);
+				if (sc->nr_to_reclaim <= 0)
+					goto out;
+			}
+			todo |= nr_active[type] || nr_inactive[type];
 		}
-	}
-
+	} while (todo);
+out:
 	throttle_vm_writeout();
 }
 
@@ -918,6 +1045,7 @@ int try_to_free_pages(struct zone **zones,
 
 	sc.gfp_mask = gfp_mask;
 	sc.may_writepage = 0;
+	sc.order = order;
 
 	inc_page_state(allocstall);
 
@@ -928,7 +1056,7 @@ int try_to_free_pages(struct zone **zones,
 			continue;
 
 		zone->temp_priority = DEF_PRIORITY;
-		lru_pages += zone->nr_active + zone->nr_inactive;
+		lru_pages += zone_nr_active(zone) + zone_nr_inactive(zone);
 	}
 
 	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
@@ -978,6 +1106,115 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_MEM_CONTROLLER
+/*
+ * Return pages left over by shrink_list() to the LRUs of their zones.
+ */
+static void putback_mem_container_pages(struct list_head *page_list)
+{
+	struct pagevec pvec;
+	struct zone *zone = NULL;
+
+	pagevec_init(&pvec, 1);
+	while (!list_empty(page_list)) {
+		struct page *page = lru_to_page(page_list);
+		struct zone *pagezone = page_zone(page);
+
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock_irq(&zone->lru_lock);
+			zone = pagezone;
+			spin_lock_irq(&zone->lru_lock);
+		}
+		if (TestSetPageLRU(page))
+			BUG();
+		list_del(&page->lru);
+		if (PageActive(page)) {
+			add_page_to_active_list(zone, page);
+			zone->recent_rotated[page_lru_type(page)]++;
+		} else
+			add_page_to_inactive_list(zone, page);
+		if (!pagevec_add(&pvec, page)) {
+			spin_unlock_irq(&zone->lru_lock);
+			__pagevec_release(&pvec);
+			zone = NULL;
+		}
+	}
+	if (zone)
+		spin_unlock_irq(&zone->lru_lock);
+	pagevec_release(&pvec);
+}
+
+/*
+ * shrink_cache() for the pages charged to a container, in the order of the
+ * container's own LRU.
+ */
+static void shrink_mem_container(struct mem_container *mem,
+				 struct scan_control *sc)
+{
+	LIST_HEAD(page_list);
+	int max_scan = sc->nr_to_scan;
+
+	lru_add_drain();
+	while (max_scan > 0) {
+		int nr_scan;
+		int nr_taken;
+
+		nr_taken = mem_container_isolate_pages(mem,
+				sc->swap_cluster_max, &page_list, &nr_scan);
+		if (nr_taken == 0)
+			break;
+		max_scan -= nr_scan;
+		mod_page_state(pgscan_container, nr_scan);
+		mod_page_state(pgsteal_container, shrink_list(&page_list, sc));
+		putback_mem_container_pages(&page_list);
+	}
+}
+
+/*
+ * Reclaim from the pages charged to @mem, which has reached its limit.
+ * Unlike try_to_free_pages(), this does not care which zones the pages are
+ * in, and leaves the slab caches alone: those are not charged.
+ *
+ * Returns 1 if some pages were freed.
+ */
+int try_to_free_mem_container_pages(struct mem_container *mem,
+				    unsigned int gfp_mask)
+{
+	struct scan_control sc;
+	int total_scanned = 0;
+	int priority;
+
+	sc.gfp_mask = gfp_mask;
+	sc.may_writepage = 0;
+	sc.order = 0;
+	sc.nr_reclaimed = 0;
+	sc.swap_cluster_max = SWAP_CLUSTER_MAX;
+
+	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
+		sc.nr_mapped = read_page_state(nr_mapped);
+		sc.nr_scanned = 0;
+		sc.priority = priority;
+		sc.nr_to_scan = max(mem_container_usage(mem) >> priority,
+				    (unsigned long)SWAP_CLUSTER_MAX);
+		shrink_mem_container(mem, &sc);
+		total_scanned += sc.nr_scanned;
+		if (sc.nr_reclaimed >= sc.swap_cluster_max)
+			return 1;
+
+		if (total_scanned > sc.swap_cluster_max + sc.swap_cluster_max/2) {
+			wakeup_bdflush(laptop_mode ? 0 : total_scanned);
+			sc.may_writepage = 1;
+		}
+
+		/* Take a nap, wait for some writeback to complete */
+		if (sc.nr_scanned && priority < DEF_PRIORITY - 2)
+			blk_congestion_wait(WRITE, HZ/10);
+	}
+	return sc.nr_reclaimed != 0;
+}
+#endif /* CONFIG_MEM_CONTROLLER */
+
 /*
  * For kswapd, balance_pgdat() will work across all this node's zones until
  * they are all at pages_high.
@@ -1018,6 +1255,7 @@ loop_again:
 	total_reclaimed = 0;
 	sc.gfp_mask = GFP_KERNEL;
 	sc.may_writepage = 0;
+	sc.order = order;
 	sc.nr_mapped = read_page_state(nr_mapped);
 
 	inc_page_state(pageoutrun);
@@ -1063,7 +1301,8 @@ scan:
 		for (i = 0; i <= end_zone; i++) {
 			struct zone *zone = pgdat->node_zones + i;
 
-			lru_pages += zone->nr_active + zone->nr_inactive;
+			lru_pages += zone_nr_active(zone) +
+					zone_nr_inactive(zone);
 		}
 
 		/*
@@ -1104,8 +1343,8 @@ scan:
 			total_scanned += sc.nr_scanned;
 			if (zone->all_unreclaimable)
 				continue;
-			if (zone->pages_scanned >= (zone->nr_active +
-							zone->nr_inactive) * 4)
+			if (zone->pages_scanned >= (zone_nr_active(zone) +
+						zone_nr_inactive(zone)) * 4)
 				zone->all_unreclaimable = 1;
 			/*
 			 * If we've done a decent amount of scanning and
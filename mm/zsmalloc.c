@@ -0,0 +1,285 @@
+/*
+ *  mm/zsmalloc.c
+ *
+ *  An allocator for compressed pages and other small objects.
+ *
+ *  Sizes are rounded up to a multiple of ZS_SIZE_CLASS_DELTA, and each
+ *  size class packs its objects back to back in zspages: groups of one
+ *  to ZS_MAX_PAGES_PER_ZSPAGE order-0 pages, as many as waste the least
+ *  at the end.  Compared with kmalloc(), that keeps the rounding up and
+ *  the slack at the end of a slab small, and only ever asks for single
+ *  pages, which are there to be had even when memory is fragmented.
+ *
+ *  The free objects of a zspage are linked through their first word.
+ *  A zspage is on its class's list while it has free objects, and is
+ *  freed as soon as it has none in use.
+ */
+
+#include <linux/mm.h>
+#include <linux/zsmalloc.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/module.h>
+
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_NR_CLASSES		\
+	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / ZS_SIZE_CLASS_DELTA + 1)
+
+/* End of a free list */
+#define ZS_NO_FREE		(~0U)
+
+struct size_class {
+	unsigned int size;		/* Of every object in the class */
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	struct list_head partial;	/* zspages with free objects */
+};
+
+struct zspage {
+	struct list_head list;		/* On its class's partial list */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned int class;
+	unsigned int inuse;		/* Objects allocated */
+	unsigned int freeobj;		/* First free object, or ZS_NO_FREE */
+};
+
+struct zs_pool {
+	spinlock_t lock;		/* Protects all the zspages */
+	unsigned int gfp_mask;		/* For the pages of the zspages */
+	unsigned long pages;		/* Pages in all of them */
+	struct size_class classes[ZS_NR_CLASSES];
+};
+
+static inline unsigned int size_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+	return (size - ZS_MIN_ALLOC_SIZE + ZS_SIZE_CLASS_DELTA - 1) /
+							ZS_SIZE_CLASS_DELTA;
+}
+
+/* The zspage size, in pages, which wastes the least for objects of @size */
+static unsigned int pages_per_zspage(unsigned int size)
+{
+	unsigned int i, best = 1, best_waste = PAGE_SIZE;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned int waste = (i * PAGE_SIZE) % size;
+
+		/* As a share of the zspage: compare waste/i */
+		if (waste * best < best_waste * i) {
+			best = i;
+			best_waste = waste;
+		}
+	}
+	return best;
+}
+
+/*
+ * Copy between @buf and an object, which may straddle two pages.  Called
+ * with the pool locked, or for an object the caller owns.
+ */
+static void zs_copy_object(struct zs_pool *pool, struct zspage *zspage,
+			   unsigned int index, void *buf, size_t len, int write)
+{
+	unsigned long pos;
+
+	pos = (unsigned long)index * pool->classes[zspage->class].size;
+	while (len) {
+		struct page *page = zspage->pages[pos >> PAGE_SHIFT];
+		unsigned int off = pos & ~PAGE_MASK;
+		size_t n = min_t(size_t, len, PAGE_SIZE - off);
+		char *addr;
+
+		addr = kmap_atomic(page, KM_USER0);
+		if (write)
+			memcpy(addr + off, buf, n);
+		else
+			memcpy(buf, addr + off, n);
+		kunmap_atomic(addr, KM_USER0);
+
+		buf = (char *)buf + n;
+		pos += n;
+		len -= n;
+	}
+}
+
+/*
+ * The link of a free object is in its first word: objects start at a
+ * multiple of ZS_SIZE_CLASS_DELTA, so it never straddles two pages.
+ */
+static unsigned int get_free_link(struct zs_pool *pool, struct zspage *zspage,
+				  unsigned int index)
+{
+	unsigned int next;
+
+	zs_copy_object(pool, zspage, index, &next, sizeof(next), 0);
+	return next;
+}
+
+static void set_free_link(struct zs_pool *pool, struct zspage *zspage,
+			  unsigned int index, unsigned int next)
+{
+	zs_copy_object(pool, zspage, index, &next, sizeof(next), 1);
+}
+
+static void free_zspage(struct zspage *zspage, unsigned int nr_pages)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_pages; i++)
+		if (zspage->pages[i])
+			__free_page(zspage->pages[i]);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool, unsigned int class)
+{
+	struct size_class *c = &pool->classes[class];
+	struct zspage *zspage;
+	unsigned int i;
+
+	zspage = kmalloc(sizeof(*zspage), pool->gfp_mask & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+	memset(zspage, 0, sizeof(*zspage));
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+
+	for (i = 0; i < c->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->gfp_mask);
+		if (!zspage->pages[i]) {
+			free_zspage(zspage, c->pages_per_zspage);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < c->objs_per_zspage; i++)
+		set_free_link(pool, zspage, i,
+			      i + 1 < c->objs_per_zspage ? i + 1 : ZS_NO_FREE);
+	zspage->freeobj = 0;
+	return zspage;
+}
+
+/**
+ * zs_create_pool - create an empty pool
+ * @gfp_mask: allocation flags for its pages, which may include __GFP_HIGHMEM
+ */
+struct zs_pool *zs_create_pool(unsigned int gfp_mask)
+{
+	struct zs_pool *pool;
+	unsigned int i;
+
+	pool = kmalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	spin_lock_init(&pool->lock);
+	pool->gfp_mask = gfp_mask;
+	pool->pages = 0;
+	for (i = 0; i < ZS_NR_CLASSES; i++) {
+		struct size_class *c = &pool->classes[i];
+
+		c->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		c->pages_per_zspage = pages_per_zspage(c->size);
+		c->objs_per_zspage = c->pages_per_zspage * PAGE_SIZE / c->size;
+		INIT_LIST_HEAD(&c->partial);
+	}
+	return pool;
+}
+EXPORT_SYMBOL(zs_create_pool);
+
+/* Every object must have been freed */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	BUG_ON(pool->pages);
+	kfree(pool);
+}
+EXPORT_SYMBOL(zs_destroy_pool);
+
+/**
+ * zs_malloc - allocate an object
+ * @pool: the pool to allocate from
+ * @size: its size, at most ZS_MAX_ALLOC_SIZE
+ * @index: where to return its index in the zspage
+ *
+ * Returns the zspage of the object, or NULL.  May sleep if the gfp_mask
+ * of the pool allows it.
+ */
+struct zspage *zs_malloc(struct zs_pool *pool, size_t size,
+			 unsigned int *index)
+{
+	struct size_class *c;
+	struct zspage *zspage;
+	unsigned int class;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return NULL;
+	class = size_class_index(size);
+	c = &pool->classes[class];
+
+	spin_lock(&pool->lock);
+	if (list_empty(&c->partial)) {
+		spin_unlock(&pool->lock);
+		zspage = alloc_zspage(pool, class);
+		if (!zspage)
+			return NULL;
+		spin_lock(&pool->lock);
+		list_add(&zspage->list, &c->partial);
+		pool->pages += c->pages_per_zspage;
+	}
+
+	zspage = list_entry(c->partial.next, struct zspage, list);
+	*index = zspage->freeobj;
+	zspage->freeobj = get_free_link(pool, zspage, *index);
+	if (++zspage->inuse == c->objs_per_zspage)
+		list_del_init(&zspage->list);
+	spin_unlock(&pool->lock);
+	return zspage;
+}
+EXPORT_SYMBOL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, struct zspage *zspage, unsigned int index)
+{
+	struct size_class *c = &pool->classes[zspage->class];
+	int empty = 0;
+
+	spin_lock(&pool->lock);
+	set_free_link(pool, zspage, index, zspage->freeobj);
+	zspage->freeobj = index;
+	/* Refill the nearly full zspages first, so the others drain */
+	if (zspage->inuse-- == c->objs_per_zspage)
+		list_add(&zspage->list, &c->partial);
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		pool->pages -= c->pages_per_zspage;
+		empty = 1;
+	}
+	spin_unlock(&pool->lock);
+
+	if (empty)
+		free_zspage(zspage, c->pages_per_zspage);
+}
+EXPORT_SYMBOL(zs_free);
+
+void zs_read_object(struct zs_pool *pool, struct zspage *zspage,
+		    unsigned int index, void *dst, size_t len)
+{
+	zs_copy_object(pool, zspage, index, dst, len, 0);
+}
+EXPORT_SYMBOL(zs_read_object);
+
+void zs_write_object(struct zs_pool *pool, struct zspage *zspage,
+		     unsigned int index, const void *src, size_t len)
+{
+	zs_copy_object(pool, zspage, index, (void *)src, len, 1);
+}
+EXPORT_SYMBOL(zs_write_object);
+
+/* Pages the pool holds, for the caller's statistics */
+unsigned long zs_get_total_pages(struct zs_pool *pool)
+{
+	return pool->pages;
+}
+EXPORT_SYMBOL(zs_get_total_pages);
@@ -99,6 +99,7 @@
 #include <linux/if_bridge.h>
 #include <linux/divert.h>
 #include <net/dst.h>
+#include <net/ip.h>
 #include <net/pkt_sched.h>
 #include <net/checksum.h>
 #include <linux/highmem.h>
@@ -109,6 +110,11 @@
 #include <linux/netpoll.h>
 #include <linux/rcupdate.h>
 #include <linux/delay.h>
+#include <linux/jhash.h>
+#include <linux/err.h>
+#include <linux/random.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
 #ifdef CONFIG_NET_RADIO
 #include <linux/wireless.h>		/* Note : will define WIRELESS_EXT */
 #include <net/iw_handler.h>
@@ -1216,12 +1222,118 @@ int __skb_linearize(struct sk_buff *skb, int gfp_mask)
  *	to congestion or traffic shaping.
  */
 
+/*
+ * Pick the transmit queue of a packet for a multiqueue device.  The
+ * packets of a socket all go to one queue, so they stay in order
+ * whichever cpu sends them; the rest use a queue per cpu.
+ */
+static u16 dev_pick_tx(struct net_device *dev, struct sk_buff *skb)
+{
+	if (dev->select_queue)
+		return dev->select_queue(dev, skb) % dev->num_tx_queues;
+
+	if (skb->sk)
+		return ((u64) jhash_1word((u32) (unsigned long) skb->sk, 0) *
+			dev->num_tx_queues) >> 32;
+
+	return smp_processor_id() % dev->num_tx_queues;
+}
+
+/**
+ *	skb_gso_segment - segment a large send
+ *	@skb: buffer to segment
+ *	@sg: build the segments out of page fragments
+ *
+ *	Split a large send, an skb with tso_size set, into a list of
+ *	packets of at most tso_size bytes of payload each, using the
+ *	gso_segment handler of its protocol.  @skb is left unchanged;
+ *	returns the list of segments or an ERR_PTR() value.
+ */
+struct sk_buff *skb_gso_segment(struct sk_buff *skb, int sg)
+{
+	struct sk_buff *segs = ERR_PTR(-EPROTONOSUPPORT);
+	struct packet_type *ptype;
+	int type = skb->protocol;
+
+	/*
+	 * Pages can only be shared with segments whose checksum the card
+	 * fills in; merged received segments (frag_list, checksum already
+	 * verified) get copied and checksummed here.
+	 */
+	if (skb_shinfo(skb)->frag_list || skb->ip_summed != CHECKSUM_HW)
+		sg = 0;
+
+	skb->mac.raw = skb->data;
+	__skb_pull(skb, skb->nh.raw - skb->data);
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype, &ptype_base[ntohs(type) & 15], list) {
+		if (ptype->type == type && !ptype->dev && ptype->gso_segment) {
+			segs = ptype->gso_segment(skb, sg);
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	__skb_push(skb, skb->data - skb->mac.raw);
+
+	return segs;
+}
+
+/*
+ * Segment a large send that the device can't do itself and queue the
+ * pieces one by one, so that everything above here saw a single skb.
+ */
+static int dev_gso_xmit(struct sk_buff *skb)
+{
+	struct net_device *dev = skb->dev;
+	struct sk_buff *segs, *next;
+	int sg = (dev->features & NETIF_F_SG) && !illegal_highdma(dev, skb);
+	int rc = NET_XMIT_SUCCESS;
+
+	segs = skb_gso_segment(skb, sg);
+	kfree_skb(skb);
+	if (unlikely(IS_ERR(segs)))
+		return PTR_ERR(segs);
+
+	for (; segs; segs = next) {
+		int err;
+
+		next = segs->next;
+		segs->next = NULL;
+		err = dev_queue_xmit(segs);
+		if (err && !rc)
+			rc = err;
+	}
+
+	return rc;
+}
+
+/* dev_queue_xmit() for transmit queue @txq of a multiqueue device */
+static int dev_subqueue_xmit(struct netdev_queue *txq, struct sk_buff *skb)
+{
+	struct Qdisc *q;
+	int rc;
+
+	q = rcu_dereference(txq->qdisc);
+
+	spin_lock(&txq->lock);
+	rc = q->enqueue(skb, q);
+	subqueue_run(txq);
+	spin_unlock(&txq->lock);
+
+	return rc == NET_XMIT_BYPASS ? NET_XMIT_SUCCESS : rc;
+}
+
 int dev_queue_xmit(struct sk_buff *skb)
 {
 	struct net_device *dev = skb->dev;
 	struct Qdisc *q;
 	int rc = -ENOMEM;
 
+	if (netif_needs_gso(dev, skb))
+		return dev_gso_xmit(skb);
+
 	if (skb_shinfo(skb)->frag_list &&
 	    !(dev->features & NETIF_F_FRAGLIST) &&
 	    __skb_linearize(skb, GFP_ATOMIC))
@@ -1267,7 +1379,22 @@ int dev_queue_xmit(struct sk_buff *skb)
 #ifdef CONFIG_NET_CLS_ACT
 	skb->tc_verd = SET_TC_AT(skb->tc_verd,AT_EGRESS);
 #endif
+	skb->queue_mapping = 0;
 	if (q->enqueue) {
+		/* The queues of a multiqueue device are only used with the
+		 * default qdisc; anything configured is on queue 0 and
+		 * must see all the traffic.
+		 */
+		if (dev->num_tx_queues > 1 && (q->flags & TCQ_F_DEFAULT)) {
+			skb->queue_mapping = dev_pick_tx(dev, skb);
+			if (skb->queue_mapping) {
+				rc = dev_subqueue_xmit(netdev_get_tx_queue(dev,
+							skb->queue_mapping),
+						       skb);
+				goto out;
+			}
+		}
+
 		/* Grab device queue */
 		spin_lock(&dev->queue_lock);
 
@@ -1402,50 +1529,160 @@ static void sample_queue(unsigned long dummy)
 }
 #endif
 
+/*
+ * Other cpus only touch a cpu's input_pkt_queue with receive packet
+ * steering; without it irqs off is all the locking the queue needs.
+ */
+static inline void rps_lock(struct softnet_data *queue)
+{
+#ifdef CONFIG_RPS
+	spin_lock(&queue->input_pkt_queue.lock);
+#endif
+}
 
-/**
- *	netif_rx	-	post buffer to the network code
- *	@skb: buffer to post
- *
- *	This function receives a packet from a device driver and queues it for
- *	the upper (protocol) levels to process.  It always succeeds. The buffer
- *	may be dropped during processing for congestion control or by the
- *	protocol layers.
- *
- *	return values:
- *	NET_RX_SUCCESS	(no congestion)
- *	NET_RX_CN_LOW   (low congestion)
- *	NET_RX_CN_MOD   (moderate congestion)
- *	NET_RX_CN_HIGH  (high congestion)
- *	NET_RX_DROP     (packet was dropped)
- *
+static inline void rps_unlock(struct softnet_data *queue)
+{
+#ifdef CONFIG_RPS
+	spin_unlock(&queue->input_pkt_queue.lock);
+#endif
+}
+
+#ifdef CONFIG_RPS
+static u32 rps_hashrnd;
+
+/*
+ * Hash the flow of a received packet, whose network header is at
+ * skb->data: the addresses and, for the transports that have them,
+ * the ports.  All packets of a flow hash alike, so they are handled
+ * by the same cpu and stay in order.  Fragments are hashed without
+ * ports, only the first one has them.
  */
+static u32 rps_flow_hash(struct sk_buff *skb)
+{
+	u32 addr1, addr2, ports = 0;
+	int ihl;
+	u8 ip_proto;
 
-int netif_rx(struct sk_buff *skb)
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP): {
+		struct iphdr *iph = (struct iphdr *) skb->data;
+
+		if (skb_headlen(skb) < sizeof(*iph))
+			return 0;
+
+		ihl = iph->ihl * 4;
+		addr1 = iph->saddr;
+		addr2 = iph->daddr;
+		ip_proto = iph->protocol;
+		if (iph->frag_off & htons(IP_MF | IP_OFFSET))
+			ip_proto = 0;
+		break;
+	}
+	case __constant_htons(ETH_P_IPV6): {
+		struct ipv6hdr *ip6h = (struct ipv6hdr *) skb->data;
+		u32 *s, *d;
+
+		if (skb_headlen(skb) < sizeof(*ip6h))
+			return 0;
+
+		ihl = sizeof(*ip6h);
+		s = ip6h->saddr.s6_addr32;
+		d = ip6h->daddr.s6_addr32;
+		addr1 = s[0] ^ s[1] ^ s[2] ^ s[3];
+		addr2 = d[0] ^ d[1] ^ d[2] ^ d[3];
+		ip_proto = ip6h->nexthdr;
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	switch (ip_proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_SCTP:
+		if (skb_headlen(skb) >= ihl + 4)
+			ports = *(u32 *) (skb->data + ihl);
+		break;
+	}
+
+	return jhash_3words(addr1, addr2, ports, rps_hashrnd);
+}
+
+/*
+ * The cpu whose backlog a packet received on @dev should go to, or -1
+ * to handle it right here.
+ */
+static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb)
 {
-	int this_cpu;
-	struct softnet_data *queue;
-	unsigned long flags;
+	struct rps_map *map;
+	int cpu = -1;
 
-#ifdef CONFIG_NETPOLL
-	if (skb->dev->netpoll_rx && netpoll_rx(skb)) {
-		kfree_skb(skb);
-		return NET_RX_DROP;
+	rcu_read_lock();
+	map = rcu_dereference(dev->rps_map);
+	if (map) {
+		cpu = map->cpus[((u64) rps_flow_hash(skb) * map->len) >> 32];
+		if (!cpu_online(cpu))
+			cpu = -1;
+	}
+	rcu_read_unlock();
+
+	return cpu;
+}
+
+/*
+ * Kick the cpus we queued packets to while their backlog was idle.
+ * Done once per net_rx_action, so a burst of packets costs each of
+ * them at most one wakeup.  Must run with irqs disabled.
+ */
+static void net_rps_send_kicks(struct softnet_data *queue)
+{
+	int cpu;
+
+	if (cpus_empty(queue->rps_kick))
+		return;
+
+	for_each_cpu_mask(cpu, queue->rps_kick)
+		raise_softirq_on_cpu(cpu, NET_RX_SOFTIRQ);
+	cpus_clear(queue->rps_kick);
+}
+#endif
+
+/* Schedule the idle backlog of @cpu, whose queue lock we hold */
+static inline void backlog_schedule(struct softnet_data *queue, int cpu)
+{
+#ifdef CONFIG_RPS
+	if (cpu != smp_processor_id()) {
+		/* only the cpu itself can put its backlog on its poll list */
+		queue->rps_sched = 1;
+		cpu_set(cpu, __get_cpu_var(softnet_data).rps_kick);
+		__raise_softirq_irqoff(NET_RX_SOFTIRQ);
+		return;
 	}
 #endif
-	
-	if (!skb->stamp.tv_sec)
-		net_timestamp(&skb->stamp);
+	netif_rx_schedule(&queue->backlog_dev);
+}
+
+/*
+ * Queue a received packet to the backlog of @cpu, or of this cpu
+ * if @cpu is -1.
+ */
+static int enqueue_to_backlog(struct sk_buff *skb, int cpu)
+{
+	struct softnet_data *queue;
+	unsigned long flags;
 
 	/*
 	 * The code is rearranged so that the path is the most
 	 * short when CPU is congested, but is still operating.
 	 */
 	local_irq_save(flags);
-	this_cpu = smp_processor_id();
-	queue = &__get_cpu_var(softnet_data);
+	if (cpu < 0)
+		cpu = smp_processor_id();
+	queue = &per_cpu(softnet_data, cpu);
 
 	__get_cpu_var(netdev_rx_stat).total++;
+	rps_lock(queue);
 	if (queue->input_pkt_queue.qlen <= netdev_max_backlog) {
 		if (queue->input_pkt_queue.qlen) {
 			if (queue->throttle)
@@ -1455,8 +1692,9 @@ enqueue:
 			dev_hold(skb->dev);
 			__skb_queue_tail(&queue->input_pkt_queue, skb);
 #ifndef OFFLINE_SAMPLE
-			get_sample_stats(this_cpu);
+			get_sample_stats(cpu);
 #endif
+			rps_unlock(queue);
 			local_irq_restore(flags);
 			return queue->cng_level;
 		}
@@ -1464,7 +1702,7 @@ enqueue:
 		if (queue->throttle)
 			queue->throttle = 0;
 
-		netif_rx_schedule(&queue->backlog_dev);
+		backlog_schedule(queue, cpu);
 		goto enqueue;
 	}
 
@@ -1474,6 +1712,7 @@ enqueue:
 	}
 
 drop:
+	rps_unlock(queue);
 	__get_cpu_var(netdev_rx_stat).dropped++;
 	local_irq_restore(flags);
 
@@ -1481,6 +1720,117 @@ drop:
 	return NET_RX_DROP;
 }
 
+/*
+ * Each cpu keeps a small pool of transmitted skbs for drivers to reuse
+ * as receive buffers, sparing a forwarding box the slab round trip of
+ * both the sk_buff and its data on every packet.
+ */
+#define SKB_RECYCLE_MAX		64
+
+/**
+ *	dev_kfree_skb_recycle	-	free a transmitted skb for reuse
+ *	@skb: buffer to free
+ *
+ *	Like dev_kfree_skb_any(), but if @skb holds the only reference
+ *	to its data and its data is linear, it is reset and kept in this
+ *	cpu's pool for dev_alloc_skb_recycle() instead of being freed.
+ */
+void dev_kfree_skb_recycle(struct sk_buff *skb)
+{
+	int full;
+
+	if (in_irq() || irqs_disabled()) {
+		dev_kfree_skb_irq(skb);
+		return;
+	}
+
+	local_irq_disable();
+	full = skb_queue_len(&__get_cpu_var(softnet_data).recycle_pool) >=
+	       SKB_RECYCLE_MAX;
+	local_irq_enable();
+
+	/* releasing the socket, dst and conntrack needs irqs enabled */
+	if (full || !skb_recycle_check(skb)) {
+		dev_kfree_skb(skb);
+		return;
+	}
+
+	local_irq_disable();
+	__skb_queue_head(&__get_cpu_var(softnet_data).recycle_pool, skb);
+	local_irq_enable();
+}
+
+/**
+ *	dev_alloc_skb_recycle	-	allocate a receive skb
+ *	@length: length to allocate
+ *
+ *	Like dev_alloc_skb(), but takes the skb from this cpu's recycle
+ *	pool if its buffer is big enough.  Hits and misses are counted
+ *	in /proc/net/softnet_stat.
+ */
+struct sk_buff *dev_alloc_skb_recycle(unsigned int length)
+{
+	struct netif_rx_stats *stat;
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	stat = &__get_cpu_var(netdev_rx_stat);
+	skb = __skb_dequeue(&__get_cpu_var(softnet_data).recycle_pool);
+	if (skb && skb->end - skb->head >= length + 16) {
+		stat->recycle_hit++;
+		local_irq_restore(flags);
+		skb_reserve(skb, 16);
+		return skb;
+	}
+	stat->recycle_miss++;
+	local_irq_restore(flags);
+
+	/* too small for this device, let the slab have it back */
+	if (skb)
+		kfree_skb(skb);
+
+	return dev_alloc_skb(length);
+}
+
+/**
+ *	netif_rx	-	post buffer to the network code
+ *	@skb: buffer to post
+ *
+ *	This function receives a packet from a device driver and queues it for
+ *	the upper (protocol) levels to process.  It always succeeds. The buffer
+ *	may be dropped during processing for congestion control or by the
+ *	protocol layers.
+ *
+ *	return values:
+ *	NET_RX_SUCCESS	(no congestion)
+ *	NET_RX_CN_LOW   (low congestion)
+ *	NET_RX_CN_MOD   (moderate congestion)
+ *	NET_RX_CN_HIGH  (high congestion)
+ *	NET_RX_DROP     (packet was dropped)
+ *
+ */
+
+int netif_rx(struct sk_buff *skb)
+{
+	int cpu = -1;
+
+#ifdef CONFIG_NETPOLL
+	if (skb->dev->netpoll_rx && netpoll_rx(skb)) {
+		kfree_skb(skb);
+		return NET_RX_DROP;
+	}
+#endif
+	
+	if (!skb->stamp.tv_sec)
+		net_timestamp(&skb->stamp);
+
+#ifdef CONFIG_RPS
+	cpu = get_rps_cpu(skb->dev, skb);
+#endif
+	return enqueue_to_backlog(skb, cpu);
+}
+
 int netif_rx_ni(struct sk_buff *skb)
 {
 	int err;
@@ -1550,6 +1900,30 @@ static void net_tx_action(struct softirq_action *h)
 			}
 		}
 	}
+
+	if (sd->output_subqueue) {
+		struct netdev_queue *head;
+
+		local_irq_disable();
+		head = sd->output_subqueue;
+		sd->output_subqueue = NULL;
+		local_irq_enable();
+
+		while (head) {
+			struct netdev_queue *txq = head;
+			head = head->next_sched;
+
+			smp_mb__before_clear_bit();
+			clear_bit(__QUEUE_STATE_SCHED, &txq->state);
+
+			if (spin_trylock(&txq->lock)) {
+				subqueue_run(txq);
+				spin_unlock(&txq->lock);
+			} else {
+				netif_schedule_subqueue(txq);
+			}
+		}
+	}
 }
 
 static __inline__ int deliver_skb(struct sk_buff *skb,
@@ -1623,7 +1997,7 @@ static int ing_filter(struct sk_buff *skb)
 }
 #endif
 
-int netif_receive_skb(struct sk_buff *skb)
+static int __netif_receive_skb(struct sk_buff *skb)
 {
 	struct packet_type *ptype, *pt_prev;
 	int ret = NET_RX_DROP;
@@ -1714,6 +2088,164 @@ out:
 	return ret;
 }
 
+int netif_receive_skb(struct sk_buff *skb)
+{
+#ifdef CONFIG_RPS
+	int cpu = get_rps_cpu(skb->dev, skb);
+
+	if (cpu >= 0 && cpu != smp_processor_id()) {
+		if (!skb->stamp.tv_sec)
+			net_timestamp(&skb->stamp);
+		return enqueue_to_backlog(skb, cpu);
+	}
+#endif
+	return __netif_receive_skb(skb);
+}
+
+/*
+ * Receive aggregation: consecutive segments of a flow handed in by a
+ * driver's ->poll() are merged into one skb, which goes up the stack
+ * when the flow can't be extended any further or at the end of the
+ * poll, whichever comes first.
+ */
+#define MAX_GRO_SKBS	8
+
+static int netif_gro_complete(struct sk_buff *skb)
+{
+	struct packet_type *ptype;
+	int type = skb->protocol;
+
+	if (NAPI_GRO_CB(skb)->count > 1) {
+		rcu_read_lock();
+		list_for_each_entry_rcu(ptype, &ptype_base[ntohs(type) & 15],
+					list) {
+			if (ptype->type == type && !ptype->dev &&
+			    ptype->gro_complete) {
+				ptype->gro_complete(skb);
+				break;
+			}
+		}
+		rcu_read_unlock();
+	}
+
+	memset(NAPI_GRO_CB(skb), 0, sizeof(struct napi_gro_cb));
+	return netif_receive_skb(skb);
+}
+
+void __netif_gro_flush(struct net_device *dev)
+{
+	struct sk_buff *skb, *next;
+
+	for (skb = dev->gro_list; skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		netif_gro_complete(skb);
+	}
+
+	dev->gro_list = NULL;
+	dev->gro_count = 0;
+}
+
+/**
+ *	netif_gro_receive - receive a segment that may be merged
+ *	@dev: device the segment came in on
+ *	@skb: buffer to process
+ *
+ *	Like netif_receive_skb(), for use from dev->poll() only: @skb
+ *	may be held back and merged with the segments that follow it.
+ *	Held segments are passed up the stack by netif_rx_complete(), or
+ *	netif_gro_flush() for drivers that don't use it, and at the end
+ *	of every poll that doesn't complete.
+ */
+int netif_gro_receive(struct net_device *dev, struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct packet_type *ptype;
+	struct sk_buff *p;
+	int type = skb->protocol;
+	int same_flow = 0;
+	int found = 0;
+
+	if (!(dev->features & NETIF_F_GRO) || skb_shinfo(skb)->frag_list)
+		goto normal;
+
+	for (p = dev->gro_list; p; p = p->next) {
+		NAPI_GRO_CB(p)->same_flow = 1;
+		NAPI_GRO_CB(p)->flush = 0;
+	}
+
+	NAPI_GRO_CB(skb)->same_flow = 0;
+	NAPI_GRO_CB(skb)->flush = 0;
+	NAPI_GRO_CB(skb)->count = 1;
+	NAPI_GRO_CB(skb)->last = skb;
+
+	skb->nh.raw = skb->data;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype, &ptype_base[ntohs(type) & 15], list) {
+		if (ptype->type == type && !ptype->dev && ptype->gro_receive) {
+			pp = ptype->gro_receive(&dev->gro_list, skb);
+			found = 1;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	if (!found)
+		goto normal;
+
+	/* a held flow that can't take this segment goes up first */
+	if (pp) {
+		p = *pp;
+		*pp = p->next;
+		p->next = NULL;
+		dev->gro_count--;
+		netif_gro_complete(p);
+	}
+
+	same_flow = NAPI_GRO_CB(skb)->same_flow;
+	if (same_flow)
+		return NET_RX_SUCCESS;
+
+	__skb_push(skb, skb->data - skb->nh.raw);
+
+	if (NAPI_GRO_CB(skb)->flush || dev->gro_count >= MAX_GRO_SKBS)
+		goto normal;
+
+	skb->next = dev->gro_list;
+	dev->gro_list = skb;
+	dev->gro_count++;
+	return NET_RX_SUCCESS;
+
+normal:
+	memset(NAPI_GRO_CB(skb), 0, sizeof(struct napi_gro_cb));
+	return netif_receive_skb(skb);
+}
+
+/**
+ *	skb_gro_receive - merge a segment into a held one
+ *	@p: buffer held on the gro list
+ *	@skb: segment to append, pulled to its payload
+ *
+ *	Chains @skb onto the frag_list of @p.  The protocols have
+ *	checked that @skb carries the data that follows @p's.
+ */
+void skb_gro_receive(struct sk_buff *p, struct sk_buff *skb)
+{
+	if (NAPI_GRO_CB(p)->last == p)
+		skb_shinfo(p)->frag_list = skb;
+	else
+		NAPI_GRO_CB(p)->last->next = skb;
+	NAPI_GRO_CB(p)->last = skb;
+	NAPI_GRO_CB(p)->count++;
+
+	p->len += skb->len;
+	p->data_len += skb->len;
+	p->truesize += skb->truesize;
+
+	NAPI_GRO_CB(skb)->same_flow = 1;
+}
+
 static int process_backlog(struct net_device *backlog_dev, int *budget)
 {
 	int work = 0;
@@ -1726,14 +2258,16 @@ static int process_backlog(struct net_device *backlog_dev, int *budget)
 		struct net_device *dev;
 
 		local_irq_disable();
+		rps_lock(queue);
 		skb = __skb_dequeue(&queue->input_pkt_queue);
 		if (!skb)
 			goto job_done;
+		rps_unlock(queue);
 		local_irq_enable();
 
 		dev = skb->dev;
 
-		netif_receive_skb(skb);
+		__netif_receive_skb(skb);
 
 		dev_put(dev);
 
@@ -1758,6 +2292,7 @@ job_done:
 
 	if (queue->throttle)
 		queue->throttle = 0;
+	rps_unlock(queue);
 	local_irq_enable();
 	return 0;
 }
@@ -1771,6 +2306,17 @@ static void net_rx_action(struct softirq_action *h)
 	
 	local_irq_disable();
 
+#ifdef CONFIG_RPS
+	/*
+	 * Another cpu queued packets to our idle backlog.  A kick racing
+	 * with this just schedules the backlog once more.
+	 */
+	if (queue->rps_sched) {
+		queue->rps_sched = 0;
+		netif_rx_schedule(&queue->backlog_dev);
+	}
+#endif
+
 	while (!list_empty(&queue->poll_list)) {
 		struct net_device *dev;
 
@@ -1783,6 +2329,7 @@ static void net_rx_action(struct softirq_action *h)
 				 struct net_device, poll_list);
 
 		if (dev->quota <= 0 || dev->poll(dev, &budget)) {
+			netif_gro_flush(dev);
 			local_irq_disable();
 			list_del(&dev->poll_list);
 			list_add_tail(&dev->poll_list, &queue->poll_list);
@@ -1796,6 +2343,9 @@ static void net_rx_action(struct softirq_action *h)
 		}
 	}
 out:
+#ifdef CONFIG_RPS
+	net_rps_send_kicks(queue);
+#endif
 	local_irq_enable();
 	return;
 
@@ -1805,6 +2355,59 @@ softnet_break:
 	goto out;
 }
 
+#ifdef CONFIG_NET_BUSY_POLL
+int sysctl_net_busy_read;
+int sysctl_net_busy_poll_budget = 8;
+
+/**
+ *	sk_busy_loop	-	poll the device of a socket for its data
+ *	@sk: socket about to sleep waiting for data
+ *	@nonblock: poll only once
+ *
+ *	Instead of waiting for the interrupt and the softirq, spin on the
+ *	->busy_poll hook of the device the last packet for @sk came in on,
+ *	for at most sk->sk_busy_poll microseconds or until something is
+ *	queued on @sk.  Returns non zero if the receive queue of @sk is no
+ *	longer empty.  Must be called from process context, without the
+ *	socket lock held, since the packets are delivered through it.
+ */
+int sk_busy_loop(struct sock *sk, int nonblock)
+{
+	unsigned long long end_time;
+	struct net_device *dev;
+	struct netif_rx_stats *stat;
+	int rc = 0;
+
+	dev = dev_get_by_index(sk->sk_busy_ifindex);
+	if (!dev)
+		return 0;
+	if (!dev->busy_poll || !netif_running(dev))
+		goto out;
+
+	end_time = sched_clock() + sk->sk_busy_poll * 1000ULL;
+	do {
+		int work;
+
+		local_bh_disable();
+		work = dev->busy_poll(dev, sysctl_net_busy_poll_budget);
+		stat = &__get_cpu_var(netdev_rx_stat);
+		stat->busy_poll_loops++;
+		stat->busy_poll_packets += work;
+		local_bh_enable();
+
+		rc = !skb_queue_empty(&sk->sk_receive_queue);
+		if (rc || nonblock)
+			break;
+		cpu_relax();
+	} while (!need_resched() && !signal_pending(current) &&
+		 sched_clock() < end_time);
+out:
+	dev_put(dev);
+	return rc;
+}
+EXPORT_SYMBOL(sk_busy_loop);
+#endif /* CONFIG_NET_BUSY_POLL */
+
 static gifconf_func_t * gifconf_list [NPROTO];
 
 /**
@@ -2027,16 +2630,18 @@ static int softnet_seq_show(struct seq_file *seq, void *v)
 {
 	struct netif_rx_stats *s = v;
 
-	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x "
+		   "%08x %08x %08x %08x\n",
 		   s->total, s->dropped, s->time_squeeze, s->throttled,
 		   s->fastroute_hit, s->fastroute_success, s->fastroute_defer,
 		   s->fastroute_deferred_out,
 #if 0
-		   s->fastroute_latency_reduction
+		   s->fastroute_latency_reduction,
 #else
-		   s->cpu_collision
+		   s->cpu_collision,
 #endif
-		  );
+		   s->recycle_hit, s->recycle_miss,
+		   s->busy_poll_loops, s->busy_poll_packets);
 	return 0;
 }
 
@@ -2780,6 +3385,10 @@ int register_netdevice(struct net_device *dev)
 		dev->features &= ~NETIF_F_TSO;
 	}
 
+	/* Large sends can be segmented in software for any SG device. */
+	if (dev->features & NETIF_F_SG)
+		dev->features |= NETIF_F_GSO;
+
 	/*
 	 *	nil rebuild_header routine,
 	 *	that should be never called and used as just bug trap.
@@ -3007,20 +3616,35 @@ out:
 }
 
 /**
- *	alloc_netdev - allocate network device
+ *	alloc_netdev_mq - allocate network device with several tx queues
  *	@sizeof_priv:	size of private data to allocate space for
  *	@name:		device name format string
  *	@setup:		callback to initialize device
+ *	@queue_count:	the number of transmit queues
  *
  *	Allocates a struct net_device with private data area for driver use
- *	and performs basic initialization.
+ *	and @queue_count transmit queues, and performs basic initialization.
+ *	The driver's hard_start_xmit() must be able to run for different
+ *	queues at the same time.
  */
-struct net_device *alloc_netdev(int sizeof_priv, const char *name,
-		void (*setup)(struct net_device *))
+struct net_device *alloc_netdev_mq(int sizeof_priv, const char *name,
+		void (*setup)(struct net_device *), unsigned int queue_count)
 {
 	void *p;
 	struct net_device *dev;
-	int alloc_size;
+	struct netdev_queue *txqs = NULL;
+	int alloc_size, i;
+
+	BUG_ON(!queue_count);
+
+	if (queue_count > 1) {
+		txqs = kmalloc((queue_count - 1) * sizeof(*txqs), GFP_KERNEL);
+		if (!txqs) {
+			printk(KERN_ERR "alloc_dev: Unable to allocate tx queues.\n");
+			return NULL;
+		}
+		memset(txqs, 0, (queue_count - 1) * sizeof(*txqs));
+	}
 
 	/* ensure 32-byte alignment of both the device and private area */
 	alloc_size = (sizeof(*dev) + NETDEV_ALIGN_CONST) & ~NETDEV_ALIGN_CONST;
@@ -3029,6 +3653,7 @@ struct net_device *alloc_netdev(int sizeof_priv, const char *name,
 	p = kmalloc(alloc_size, GFP_KERNEL);
 	if (!p) {
 		printk(KERN_ERR "alloc_dev: Unable to allocate device.\n");
+		kfree(txqs);
 		return NULL;
 	}
 	memset(p, 0, alloc_size);
@@ -3040,10 +3665,38 @@ struct net_device *alloc_netdev(int sizeof_priv, const char *name,
 	if (sizeof_priv)
 		dev->priv = netdev_priv(dev);
 
+	dev->tx_subqueues = txqs;
+	dev->num_tx_queues = queue_count;
+	for (i = 1; i < queue_count; i++) {
+		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
+
+		spin_lock_init(&txq->lock);
+		spin_lock_init(&txq->xmit_lock);
+		txq->xmit_lock_owner = -1;
+		txq->dev = dev;
+		txq->index = i;
+	}
+
 	setup(dev);
 	strcpy(dev->name, name);
 	return dev;
 }
+EXPORT_SYMBOL(alloc_netdev_mq);
+
+/**
+ *	alloc_netdev - allocate network device
+ *	@sizeof_priv:	size of private data to allocate space for
+ *	@name:		device name format string
+ *	@setup:		callback to initialize device
+ *
+ *	Allocates a struct net_device with private data area for driver use
+ *	and performs basic initialization.
+ */
+struct net_device *alloc_netdev(int sizeof_priv, const char *name,
+		void (*setup)(struct net_device *))
+{
+	return alloc_netdev_mq(sizeof_priv, name, setup, 1);
+}
 EXPORT_SYMBOL(alloc_netdev);
 
 /**
@@ -3056,6 +3709,15 @@ EXPORT_SYMBOL(alloc_netdev);
  */
 void free_netdev(struct net_device *dev)
 {
+	kfree(dev->tx_subqueues);
+	dev->tx_subqueues = NULL;
+
+#ifdef CONFIG_RPS
+	/* unregistered, so nobody is looking at it any more */
+	kfree(dev->rps_map);
+	dev->rps_map = NULL;
+#endif
+
 #ifdef CONFIG_SYSFS
 	/*  Compatiablity with error handling in drivers */
 	if (dev->reg_state == NETREG_UNINITIALIZED) {
@@ -3194,6 +3856,7 @@ static int dev_cpu_callback(struct notifier_block *nfb,
 {
 	struct sk_buff **list_skb;
 	struct net_device **list_net;
+	struct netdev_queue **list_txq;
 	struct sk_buff *skb;
 	unsigned int cpu, oldcpu = (unsigned long)ocpu;
 	struct softnet_data *sd, *oldsd;
@@ -3222,13 +3885,25 @@ static int dev_cpu_callback(struct notifier_block *nfb,
 	*list_net = oldsd->output_queue;
 	oldsd->output_queue = NULL;
 
+	/* Same for the transmit queues of multiqueue devices. */
+	list_txq = &sd->output_subqueue;
+	while (*list_txq)
+		list_txq = &(*list_txq)->next_sched;
+	*list_txq = oldsd->output_subqueue;
+	oldsd->output_subqueue = NULL;
+
 	raise_softirq_irqoff(NET_TX_SOFTIRQ);
+#ifdef CONFIG_RPS
+	net_rps_send_kicks(oldsd);
+#endif
 	local_irq_enable();
 
 	/* Process offline CPU's input_pkt_queue */
 	while ((skb = __skb_dequeue(&oldsd->input_pkt_queue)))
 		netif_rx(skb);
 
+	__skb_queue_purge(&oldsd->recycle_pool);
+
 	return NOTIFY_OK;
 }
 #endif /* CONFIG_HOTPLUG_CPU */
@@ -3252,6 +3927,9 @@ static int __init net_dev_init(void)
 	BUG_ON(!dev_boot_phase);
 
 	net_random_init();
+#ifdef CONFIG_RPS
+	get_random_bytes(&rps_hashrnd, sizeof(rps_hashrnd));
+#endif
 
 	if (dev_proc_init())
 		goto out;
@@ -3282,7 +3960,13 @@ static int __init net_dev_init(void)
 		queue->cng_level = 0;
 		queue->avg_blog = 10; /* arbitrary non-zero */
 		queue->completion_queue = NULL;
+		skb_queue_head_init(&queue->recycle_pool);
+		queue->output_subqueue = NULL;
 		INIT_LIST_HEAD(&queue->poll_list);
+#ifdef CONFIG_RPS
+		queue->rps_sched = 0;
+		cpus_clear(queue->rps_kick);
+#endif
 		set_bit(__LINK_STATE_START, &queue->backlog_dev.state);
 		queue->backlog_dev.weight = weight_p;
 		queue->backlog_dev.poll = process_backlog;
@@ -3322,6 +4006,7 @@ EXPORT_SYMBOL(dev_get_by_name);
 EXPORT_SYMBOL(dev_ioctl);
 EXPORT_SYMBOL(dev_open);
 EXPORT_SYMBOL(dev_queue_xmit);
+EXPORT_SYMBOL(skb_gso_segment);
 EXPORT_SYMBOL(dev_remove_pack);
 EXPORT_SYMBOL(dev_set_allmulti);
 EXPORT_SYMBOL(dev_set_promiscuity);
@@ -3333,6 +4018,11 @@ EXPORT_SYMBOL(netdev_boot_setup_check);
 EXPORT_SYMBOL(netdev_set_master);
 EXPORT_SYMBOL(netdev_state_change);
 EXPORT_SYMBOL(netif_receive_skb);
+EXPORT_SYMBOL(netif_gro_receive);
+EXPORT_SYMBOL(dev_kfree_skb_recycle);
+EXPORT_SYMBOL(dev_alloc_skb_recycle);
+EXPORT_SYMBOL(__netif_gro_flush);
+EXPORT_SYMBOL(skb_gro_receive);
 EXPORT_SYMBOL(netif_rx);
 EXPORT_SYMBOL(register_gifconf);
 EXPORT_SYMBOL(register_netdevice);
@@ -411,11 +411,16 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+#ifdef CONFIG_BPF_JIT
+	fp->bpf_func = NULL;
+#endif
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (!err) {
 		struct sk_filter *old_fp;
 
+		bpf_jit_compile(fp);
+
 		spin_lock_bh(&sk->sk_lock.slock);
 		old_fp = sk->sk_filter;
 		sk->sk_filter = fp;
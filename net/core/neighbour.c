@@ -65,7 +65,14 @@ static struct file_operations neigh_stat_seq_fops;
 /*
    Neighbour hash table buckets are protected with rwlock tbl->lock.
 
-   - All the scans/updates to hash buckets MUST be made under this lock.
+   - All the updates to hash buckets and all the scans that are not
+     plain lookups MUST be made under this lock.
+   - neigh_lookup() and neigh_lookup_nodev() walk the chains locklessly
+     under rcu_read_lock_bh().  For that reason an entry taken off a
+     chain gives up the reference held by the table only after a grace
+     period (neigh_unhash_release()), and a grown table (tbl->nht) is
+     freed the same way.  A lockless miss racing with a resize is
+     harmless: neigh_create() repeats the search under the lock.
    - NOTHING clever should be made under this lock: no callbacks
      to protocol backends, no attempts to send something to network.
      It will result in deadlocks, if backend/driver wants to use neighbour
@@ -112,7 +119,24 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 	return (base ? (net_random() % base) + (base >> 1) : 0);
 }
 
+static void neigh_hash_release_rcu(struct rcu_head *head)
+{
+	neigh_release(container_of(head, struct neighbour, rcu));
+}
+
+/* Drop the reference the hash table holds on an entry that has just
+ * been unlinked.  Lockless lookups may still be looking at it, so the
+ * reference is only released once they are all done.
+ */
+static inline void neigh_unhash_release(struct neighbour *n)
+{
+	call_rcu(&n->rcu, neigh_hash_release_rcu);
+}
 
+/* Walk the table one chain at a time, so that a big cache does not
+ * keep writers (and neigh_create() in particular) off the lock for
+ * the whole scan.
+ */
 static int neigh_forced_gc(struct neigh_table *tbl)
 {
 	int shrunk = 0;
@@ -120,11 +144,18 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 
 	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
 
-	write_lock_bh(&tbl->lock);
-	for (i = 0; i <= tbl->hash_mask; i++) {
+	for (i = 0; ; i++) {
+		struct neigh_hash_table *nht;
 		struct neighbour *n, **np;
 
-		np = &tbl->hash_buckets[i];
+		write_lock_bh(&tbl->lock);
+		nht = tbl->nht;
+		if (i > nht->hash_mask) {
+			write_unlock_bh(&tbl->lock);
+			break;
+		}
+
+		np = &nht->hash_buckets[i];
 		while ((n = *np) != NULL) {
 			/* Neighbour record may be discarded if:
 			 * - nobody refers to it.
@@ -137,18 +168,17 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 				n->dead = 1;
 				shrunk	= 1;
 				write_unlock(&n->lock);
-				neigh_release(n);
+				neigh_unhash_release(n);
 				continue;
 			}
 			write_unlock(&n->lock);
 			np = &n->next;
 		}
+		write_unlock_bh(&tbl->lock);
 	}
 
 	tbl->last_flush = jiffies;
 
-	write_unlock_bh(&tbl->lock);
-
 	return shrunk;
 }
 
@@ -178,10 +208,10 @@ void neigh_changeaddr(struct neigh_table *tbl, struct net_device *dev)
 
 	write_lock_bh(&tbl->lock);
 
-	for (i=0; i <= tbl->hash_mask; i++) {
+	for (i=0; i <= tbl->nht->hash_mask; i++) {
 		struct neighbour *n, **np;
 
-		np = &tbl->hash_buckets[i];
+		np = &tbl->nht->hash_buckets[i];
 		while ((n = *np) != NULL) {
 			if (dev && n->dev != dev) {
 				np = &n->next;
@@ -192,7 +222,7 @@ void neigh_changeaddr(struct neigh_table *tbl, struct net_device *dev)
 			n->dead = 1;
 			neigh_del_timer(n);
 			write_unlock_bh(&n->lock);
-			neigh_release(n);
+			neigh_unhash_release(n);
 		}
 	}
 
@@ -205,8 +235,8 @@ int neigh_ifdown(struct neigh_table *tbl, struct net_device *dev)
 
 	write_lock_bh(&tbl->lock);
 
-	for (i = 0; i <= tbl->hash_mask; i++) {
-		struct neighbour *n, **np = &tbl->hash_buckets[i];
+	for (i = 0; i <= tbl->nht->hash_mask; i++) {
+		struct neighbour *n, **np = &tbl->nht->hash_buckets[i];
 
 		while ((n = *np) != NULL) {
 			if (dev && n->dev != dev) {
@@ -237,7 +267,7 @@ int neigh_ifdown(struct neigh_table *tbl, struct net_device *dev)
 				NEIGH_PRINTK2("neigh %p is stray.\n", n);
 			}
 			write_unlock(&n->lock);
-			neigh_release(n);
+			neigh_unhash_release(n);
 		}
 	}
 
@@ -319,80 +349,121 @@ static void neigh_hash_free(struct neighbour **hash, unsigned int entries)
 		free_pages((unsigned long)hash, get_order(size));
 }
 
-static void neigh_hash_grow(struct neigh_table *tbl, unsigned long new_entries)
+static struct neigh_hash_table *neigh_hash_table_alloc(unsigned int entries)
 {
-	struct neighbour **new_hash, **old_hash;
-	unsigned int i, new_hash_mask, old_entries;
+	struct neigh_hash_table *nht;
+
+	nht = kmalloc(sizeof(*nht), GFP_ATOMIC);
+	if (!nht)
+		return NULL;
+	nht->hash_buckets = neigh_hash_alloc(entries);
+	if (!nht->hash_buckets) {
+		kfree(nht);
+		return NULL;
+	}
+	nht->hash_mask = entries - 1;
+	return nht;
+}
+
+static void neigh_hash_table_free(struct neigh_hash_table *nht)
+{
+	neigh_hash_free(nht->hash_buckets, nht->hash_mask + 1);
+	kfree(nht);
+}
+
+static void neigh_hash_table_free_rcu(struct rcu_head *head)
+{
+	neigh_hash_table_free(container_of(head, struct neigh_hash_table, rcu));
+}
+
+/* Called with tbl->lock held for writing.  The entries are relinked
+ * into a new table which is then published; lockless readers still
+ * walking the old one may follow a chain into the new table and miss,
+ * but never loop, and the old buckets stay around until they are gone.
+ */
+static struct neigh_hash_table *neigh_hash_grow(struct neigh_table *tbl,
+						unsigned long new_entries)
+{
+	struct neigh_hash_table *old_nht = tbl->nht, *new_nht;
+	unsigned int i;
 
 	NEIGH_CACHE_STAT_INC(tbl, hash_grows);
 
 	BUG_ON(new_entries & (new_entries - 1));
-	new_hash = neigh_hash_alloc(new_entries);
-	if (!new_hash)
-		return;
-
-	old_entries = tbl->hash_mask + 1;
-	new_hash_mask = new_entries - 1;
-	old_hash = tbl->hash_buckets;
+	new_nht = neigh_hash_table_alloc(new_entries);
+	if (!new_nht)
+		return old_nht;
 
 	get_random_bytes(&tbl->hash_rnd, sizeof(tbl->hash_rnd));
-	for (i = 0; i < old_entries; i++) {
+	for (i = 0; i <= old_nht->hash_mask; i++) {
 		struct neighbour *n, *next;
 
-		for (n = old_hash[i]; n; n = next) {
+		for (n = old_nht->hash_buckets[i]; n; n = next) {
 			unsigned int hash_val = tbl->hash(n->primary_key, n->dev);
 
-			hash_val &= new_hash_mask;
+			hash_val &= new_nht->hash_mask;
 			next = n->next;
 
-			n->next = new_hash[hash_val];
-			new_hash[hash_val] = n;
+			n->next = new_nht->hash_buckets[hash_val];
+			new_nht->hash_buckets[hash_val] = n;
 		}
 	}
-	tbl->hash_buckets = new_hash;
-	tbl->hash_mask = new_hash_mask;
+	rcu_assign_pointer(tbl->nht, new_nht);
 
-	neigh_hash_free(old_hash, old_entries);
+	call_rcu(&old_nht->rcu, neigh_hash_table_free_rcu);
+	return new_nht;
 }
 
 struct neighbour *neigh_lookup(struct neigh_table *tbl, const void *pkey,
 			       struct net_device *dev)
 {
+	struct neigh_hash_table *nht;
 	struct neighbour *n;
 	int key_len = tbl->key_len;
-	u32 hash_val = tbl->hash(pkey, dev) & tbl->hash_mask;
+	u32 hash_val;
 	
 	NEIGH_CACHE_STAT_INC(tbl, lookups);
 
-	read_lock_bh(&tbl->lock);
-	for (n = tbl->hash_buckets[hash_val]; n; n = n->next) {
+	rcu_read_lock_bh();
+	nht = rcu_dereference(tbl->nht);
+	hash_val = tbl->hash(pkey, dev) & nht->hash_mask;
+	for (n = rcu_dereference(nht->hash_buckets[hash_val]); n;
+	     n = rcu_dereference(n->next)) {
 		if (dev == n->dev && !memcmp(n->primary_key, pkey, key_len)) {
+			if (n->dead)
+				continue;
 			neigh_hold(n);
 			NEIGH_CACHE_STAT_INC(tbl, hits);
 			break;
 		}
 	}
-	read_unlock_bh(&tbl->lock);
+	rcu_read_unlock_bh();
 	return n;
 }
 
 struct neighbour *neigh_lookup_nodev(struct neigh_table *tbl, const void *pkey)
 {
+	struct neigh_hash_table *nht;
 	struct neighbour *n;
 	int key_len = tbl->key_len;
-	u32 hash_val = tbl->hash(pkey, NULL) & tbl->hash_mask;
+	u32 hash_val;
 
 	NEIGH_CACHE_STAT_INC(tbl, lookups);
 
-	read_lock_bh(&tbl->lock);
-	for (n = tbl->hash_buckets[hash_val]; n; n = n->next) {
+	rcu_read_lock_bh();
+	nht = rcu_dereference(tbl->nht);
+	hash_val = tbl->hash(pkey, NULL) & nht->hash_mask;
+	for (n = rcu_dereference(nht->hash_buckets[hash_val]); n;
+	     n = rcu_dereference(n->next)) {
 		if (!memcmp(n->primary_key, pkey, key_len)) {
+			if (n->dead)
+				continue;
 			neigh_hold(n);
 			NEIGH_CACHE_STAT_INC(tbl, hits);
 			break;
 		}
 	}
-	read_unlock_bh(&tbl->lock);
+	rcu_read_unlock_bh();
 	return n;
 }
 
@@ -402,6 +473,7 @@ struct neighbour *neigh_create(struct neigh_table *tbl, const void *pkey,
 	u32 hash_val;
 	int key_len = tbl->key_len;
 	int error;
+	struct neigh_hash_table *nht;
 	struct neighbour *n1, *rc, *n = neigh_alloc(tbl);
 
 	if (!n) {
@@ -430,17 +502,18 @@ struct neighbour *neigh_create(struct neigh_table *tbl, const void *pkey,
 
 	write_lock_bh(&tbl->lock);
 
-	if (atomic_read(&tbl->entries) > (tbl->hash_mask + 1))
-		neigh_hash_grow(tbl, (tbl->hash_mask + 1) << 1);
+	nht = tbl->nht;
+	if (atomic_read(&tbl->entries) > (nht->hash_mask + 1))
+		nht = neigh_hash_grow(tbl, (nht->hash_mask + 1) << 1);
 
-	hash_val = tbl->hash(pkey, dev) & tbl->hash_mask;
+	hash_val = tbl->hash(pkey, dev) & nht->hash_mask;
 
 	if (n->parms->dead) {
 		rc = ERR_PTR(-EINVAL);
 		goto out_tbl_unlock;
 	}
 
-	for (n1 = tbl->hash_buckets[hash_val]; n1; n1 = n1->next) {
+	for (n1 = nht->hash_buckets[hash_val]; n1; n1 = n1->next) {
 		if (dev == n1->dev && !memcmp(n1->primary_key, pkey, key_len)) {
 			neigh_hold(n1);
 			rc = n1;
@@ -448,10 +521,11 @@ struct neighbour *neigh_create(struct neigh_table *tbl, const void *pkey,
 		}
 	}
 
-	n->next = tbl->hash_buckets[hash_val];
-	tbl->hash_buckets[hash_val] = n;
+	/* Fully set up before lockless lookups can find it. */
 	n->dead = 0;
 	neigh_hold(n);
+	n->next = nht->hash_buckets[hash_val];
+	rcu_assign_pointer(nht->hash_buckets[hash_val], n);
 	write_unlock_bh(&tbl->lock);
 	NEIGH_PRINTK2("neigh %p is created.\n", n);
 	rc = n;
@@ -651,6 +725,7 @@ static void neigh_connect(struct neighbour *neigh)
 static void neigh_periodic_timer(unsigned long arg)
 {
 	struct neigh_table *tbl = (struct neigh_table *)arg;
+	struct neigh_hash_table *nht;
 	struct neighbour *n, **np;
 	unsigned long expire, now = jiffies;
 
@@ -670,8 +745,9 @@ static void neigh_periodic_timer(unsigned long arg)
 				neigh_rand_reach_time(p->base_reachable_time);
 	}
 
-	np = &tbl->hash_buckets[tbl->hash_chain_gc];
-	tbl->hash_chain_gc = ((tbl->hash_chain_gc + 1) & tbl->hash_mask);
+	nht = tbl->nht;
+	np = &nht->hash_buckets[tbl->hash_chain_gc & nht->hash_mask];
+	tbl->hash_chain_gc = ((tbl->hash_chain_gc + 1) & nht->hash_mask);
 
 	while ((n = *np) != NULL) {
 		unsigned int state;
@@ -693,7 +769,7 @@ static void neigh_periodic_timer(unsigned long arg)
 			*np = n->next;
 			n->dead = 1;
 			write_unlock(&n->lock);
-			neigh_release(n);
+			neigh_unhash_release(n);
 			continue;
 		}
 		write_unlock(&n->lock);
@@ -707,7 +783,7 @@ next_elt:
  	 * base_reachable_time.
 	 */
 	expire = tbl->parms.base_reachable_time >> 1;
-	expire /= (tbl->hash_mask + 1);
+	expire /= (nht->hash_mask + 1);
 	if (!expire)
 		expire = 1;
 
@@ -1354,13 +1430,12 @@ void neigh_table_init(struct neigh_table *tbl)
 	tbl->pde->data = tbl;
 #endif
 
-	tbl->hash_mask = 1;
-	tbl->hash_buckets = neigh_hash_alloc(tbl->hash_mask + 1);
+	tbl->nht = neigh_hash_table_alloc(2);
 
 	phsize = (PNEIGH_HASHMASK + 1) * sizeof(struct pneigh_entry *);
 	tbl->phash_buckets = kmalloc(phsize, GFP_KERNEL);
 
-	if (!tbl->hash_buckets || !tbl->phash_buckets)
+	if (!tbl->nht || !tbl->phash_buckets)
 		panic("cannot allocate neighbour cache hashes");
 
 	memset(tbl->phash_buckets, 0, phsize);
@@ -1396,6 +1471,8 @@ int neigh_table_clear(struct neigh_table *tbl)
 	del_timer_sync(&tbl->proxy_timer);
 	pneigh_queue_purge(&tbl->proxy_queue);
 	neigh_ifdown(tbl, NULL);
+	/* Let the deferred hash references go. */
+	synchronize_kernel();
 	if (atomic_read(&tbl->entries))
 		printk(KERN_CRIT "neighbour leakage\n");
 	write_lock(&neigh_tbl_lock);
@@ -1407,8 +1484,8 @@ int neigh_table_clear(struct neigh_table *tbl)
 	}
 	write_unlock(&neigh_tbl_lock);
 
-	neigh_hash_free(tbl->hash_buckets, tbl->hash_mask + 1);
-	tbl->hash_buckets = NULL;
+	neigh_hash_table_free(tbl->nht);
+	tbl->nht = NULL;
 
 	kfree(tbl->phash_buckets);
 	tbl->phash_buckets = NULL;
@@ -1594,17 +1671,21 @@ rtattr_failure:
 static int neigh_dump_table(struct neigh_table *tbl, struct sk_buff *skb,
 			    struct netlink_callback *cb)
 {
+	struct neigh_hash_table *nht;
 	struct neighbour *n;
 	int rc, h, s_h = cb->args[1];
 	int idx, s_idx = idx = cb->args[2];
 
-	for (h = 0; h <= tbl->hash_mask; h++) {
-		if (h < s_h)
-			continue;
+	for (h = s_h; ; h++) {
 		if (h > s_h)
 			s_idx = 0;
 		read_lock_bh(&tbl->lock);
-		for (n = tbl->hash_buckets[h], idx = 0; n; n = n->next, idx++) {
+		nht = tbl->nht;
+		if (h > nht->hash_mask) {
+			read_unlock_bh(&tbl->lock);
+			break;
+		}
+		for (n = nht->hash_buckets[h], idx = 0; n; n = n->next, idx++) {
 			if (idx < s_idx)
 				continue;
 			if (neigh_fill_info(skb, n, NETLINK_CB(cb->skb).pid,
@@ -1653,10 +1734,10 @@ void neigh_for_each(struct neigh_table *tbl, void (*cb)(struct neighbour *, void
 	int chain;
 
 	read_lock_bh(&tbl->lock);
-	for (chain = 0; chain <= tbl->hash_mask; chain++) {
+	for (chain = 0; chain <= tbl->nht->hash_mask; chain++) {
 		struct neighbour *n;
 
-		for (n = tbl->hash_buckets[chain]; n; n = n->next)
+		for (n = tbl->nht->hash_buckets[chain]; n; n = n->next)
 			cb(n, cookie);
 	}
 	read_unlock_bh(&tbl->lock);
@@ -1669,10 +1750,10 @@ void __neigh_for_each_release(struct neigh_table *tbl,
 {
 	int chain;
 
-	for (chain = 0; chain <= tbl->hash_mask; chain++) {
+	for (chain = 0; chain <= tbl->nht->hash_mask; chain++) {
 		struct neighbour *n, **np;
 
-		np = &tbl->hash_buckets[chain];
+		np = &tbl->nht->hash_buckets[chain];
 		while ((n = *np) != NULL) {
 			int release;
 
@@ -1685,7 +1766,7 @@ void __neigh_for_each_release(struct neigh_table *tbl,
 				np = &n->next;
 			write_unlock(&n->lock);
 			if (release)
-				neigh_release(n);
+				neigh_unhash_release(n);
 		}
 	}
 }
@@ -1701,8 +1782,8 @@ static struct neighbour *neigh_get_first(struct seq_file *seq)
 	int bucket = state->bucket;
 
 	state->flags &= ~NEIGH_SEQ_IS_PNEIGH;
-	for (bucket = 0; bucket <= tbl->hash_mask; bucket++) {
-		n = tbl->hash_buckets[bucket];
+	for (bucket = 0; bucket <= tbl->nht->hash_mask; bucket++) {
+		n = tbl->nht->hash_buckets[bucket];
 
 		while (n) {
 			if (state->neigh_sub_iter) {
@@ -1763,10 +1844,10 @@ static struct neighbour *neigh_get_next(struct seq_file *seq,
 		if (n)
 			break;
 
-		if (++state->bucket > tbl->hash_mask)
+		if (++state->bucket > tbl->nht->hash_mask)
 			break;
 
-		n = tbl->hash_buckets[state->bucket];
+		n = tbl->nht->hash_buckets[state->bucket];
 	}
 
 	if (n && pos)
@@ -184,6 +184,84 @@ static ssize_t store_tx_queue_len(struct class_device *dev, const char *buf, siz
 static CLASS_DEVICE_ATTR(tx_queue_len, S_IRUGO | S_IWUSR, show_tx_queue_len, 
 			 store_tx_queue_len);
 
+#ifdef CONFIG_RPS
+/* the cpus received packets are steered to, as a cpu list like "0-3,8" */
+static ssize_t show_rps_cpus(struct class_device *cd, char *buf)
+{
+	struct net_device *net = to_net_dev(cd);
+	struct rps_map *map;
+	cpumask_t mask;
+	int i, len;
+
+	cpus_clear(mask);
+	rcu_read_lock();
+	map = rcu_dereference(net->rps_map);
+	if (map)
+		for (i = 0; i < map->len; i++)
+			cpu_set(map->cpus[i], mask);
+	rcu_read_unlock();
+
+	len = cpulist_scnprintf(buf, PAGE_SIZE - 1, mask);
+	buf[len++] = '\n';
+	return len;
+}
+
+static void rps_map_release(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct rps_map, rcu));
+}
+
+/* an empty list turns steering off */
+static ssize_t store_rps_cpus(struct class_device *cd, const char *buf,
+			      size_t len)
+{
+	struct net_device *net = to_net_dev(cd);
+	struct rps_map *map = NULL, *old;
+	cpumask_t mask;
+	int cpu, i = 0, err;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	cpus_clear(mask);
+	if (*buf != '\n' && *buf != '\0') {
+		err = cpulist_parse(buf, mask);
+		if (err)
+			return err;
+		cpus_and(mask, mask, cpu_possible_map);
+	}
+
+	if (!cpus_empty(mask)) {
+		map = kmalloc(sizeof(*map) + cpus_weight(mask) * sizeof(u16),
+			      GFP_KERNEL);
+		if (!map)
+			return -ENOMEM;
+
+		for_each_cpu_mask(cpu, mask)
+			map->cpus[i++] = cpu;
+		map->len = i;
+	}
+
+	rtnl_lock();
+	if (!dev_isalive(net)) {
+		rtnl_unlock();
+		kfree(map);
+		return -EINVAL;
+	}
+	old = net->rps_map;
+	rcu_assign_pointer(net->rps_map, map);
+	rtnl_unlock();
+
+	if (old)
+		call_rcu(&old->rcu, rps_map_release);
+
+	return len;
+}
+
+static CLASS_DEVICE_ATTR(rps_cpus, S_IRUGO | S_IWUSR, show_rps_cpus,
+			 store_rps_cpus);
+#endif
+
 
 static struct class_device_attribute *net_class_attributes[] = {
 	&class_device_attr_ifindex,
@@ -197,6 +275,9 @@ static struct class_device_attribute *net_class_attributes[] = {
 	&class_device_attr_address,
 	&class_device_attr_broadcast,
 	&class_device_attr_carrier,
+#ifdef CONFIG_RPS
+	&class_device_attr_rps_cpus,
+#endif
 	NULL
 };
 
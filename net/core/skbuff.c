@@ -58,6 +58,7 @@
 #include <linux/rtnetlink.h>
 #include <linux/init.h>
 #include <linux/highmem.h>
+#include <linux/err.h>
 
 #include <net/protocol.h>
 #include <net/dst.h>
@@ -274,14 +275,8 @@ void kfree_skbmem(struct sk_buff *skb)
  *	always call kfree_skb
  */
 
-void __kfree_skb(struct sk_buff *skb)
+static void skb_release_head_state(struct sk_buff *skb)
 {
-	if (skb->list) {
-	 	printk(KERN_WARNING "Warning: kfree_skb passed an skb still "
-		       "on a list (from %p).\n", NET_CALLER(skb));
-		BUG();
-	}
-
 	dst_release(skb->dst);
 #ifdef CONFIG_XFRM
 	secpath_put(skb->sp);
@@ -306,10 +301,53 @@ void __kfree_skb(struct sk_buff *skb)
 	skb->tc_classid = 0;
 #endif
 #endif
+}
+
+void __kfree_skb(struct sk_buff *skb)
+{
+	if (skb->list) {
+	 	printk(KERN_WARNING "Warning: kfree_skb passed an skb still "
+		       "on a list (from %p).\n", NET_CALLER(skb));
+		BUG();
+	}
 
+	skb_release_head_state(skb);
 	kfree_skbmem(skb);
 }
 
+/**
+ *	skb_recycle_check - reset an skb for reuse
+ *	@skb: buffer to check
+ *
+ *	If @skb is the only reference to its data and that data is all
+ *	linear, drop everything else it holds (dst, socket, conntrack...)
+ *	and reset it to the state alloc_skb() returns it in, keeping the
+ *	data buffer.  Returns 1 if so, 0 if @skb can't be reused.  Must
+ *	not be called from hard irq context.
+ */
+int skb_recycle_check(struct sk_buff *skb)
+{
+	u8 *head = skb->head;
+	u8 *end = skb->end;
+
+	if (skb->list || skb_shared(skb) || skb_cloned(skb) ||
+	    skb_is_nonlinear(skb) || skb_shinfo(skb)->frag_list)
+		return 0;
+
+	skb_release_head_state(skb);
+
+	memset(skb, 0, offsetof(struct sk_buff, truesize));
+	skb->truesize = (end - head) + sizeof(struct sk_buff);
+	skb->data = head;
+	skb->tail = head;
+
+	atomic_set(&(skb_shinfo(skb)->dataref), 1);
+	skb_shinfo(skb)->tso_size = 0;
+	skb_shinfo(skb)->tso_segs = 0;
+
+	return 1;
+}
+
 /**
  *	skb_clone	-	duplicate an sk_buff
  *	@skb: buffer to clone
@@ -360,6 +398,7 @@ struct sk_buff *skb_clone(struct sk_buff *skb, int gfp_mask)
 	C(priority);
 	C(protocol);
 	C(security);
+	C(queue_mapping);
 	n->destructor = NULL;
 #ifdef CONFIG_NETFILTER
 	C(nfmark);
@@ -415,6 +454,7 @@ static void copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->real_dev	= old->real_dev;
 	new->priority	= old->priority;
 	new->protocol	= old->protocol;
+	new->queue_mapping = old->queue_mapping;
 	new->dst	= dst_clone(old->dst);
 #ifdef CONFIG_INET
 	new->sp		= secpath_get(old->sp);
@@ -1420,6 +1460,126 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 		skb_split_no_header(skb, skb1, len, pos);
 }
 
+/**
+ * skb_segment - Perform protocol segmentation on skb.
+ * @skb: buffer to segment
+ * @sg: build the segments out of page fragments
+ *
+ * This function performs segmentation on the given skb.  skb->data
+ * must point just past the protocol headers, skb->mac.raw at the
+ * start of them: each segment gets a copy of the headers followed by
+ * up to tso_size bytes of the payload.  With @sg the payload pages
+ * are shared with @skb, otherwise the payload is copied and its
+ * checksum left in the segment's csum.  The protocol handlers fix up
+ * the headers of the segments.  It returns the list of segments or an
+ * ERR_PTR() value.
+ */
+struct sk_buff *skb_segment(struct sk_buff *skb, int sg)
+{
+	struct sk_buff *segs = NULL;
+	struct sk_buff *tail = NULL;
+	unsigned int mss = skb_shinfo(skb)->tso_size;
+	unsigned int doffset = skb->data - skb->mac.raw;
+	unsigned int offset = doffset;
+	unsigned int headroom;
+	unsigned int len;
+	int nfrags = skb_shinfo(skb)->nr_frags;
+	int i = 0;
+	int pos;
+
+	__skb_push(skb, doffset);
+	headroom = skb_headroom(skb);
+	pos = skb_headlen(skb);
+
+	do {
+		struct sk_buff *nskb;
+		skb_frag_t *frag;
+		int hsize, nsize;
+		int k, size;
+
+		len = skb->len - offset;
+		if (len > mss)
+			len = mss;
+
+		hsize = skb_headlen(skb) - offset;
+		if (hsize < 0)
+			hsize = 0;
+		nsize = hsize + doffset;
+		if (nsize > len + doffset || !sg)
+			nsize = len + doffset;
+
+		nskb = alloc_skb(nsize + headroom, GFP_ATOMIC);
+		if (unlikely(!nskb))
+			goto err;
+
+		if (segs)
+			tail->next = nskb;
+		else
+			segs = nskb;
+		tail = nskb;
+
+		skb_reserve(nskb, headroom);
+		memcpy(skb_put(nskb, doffset), skb->data, doffset);
+		copy_skb_header(nskb, skb);
+		skb_shinfo(nskb)->tso_size = 0;
+		skb_shinfo(nskb)->tso_segs = 1;
+
+		if (!sg) {
+			nskb->csum = skb_copy_and_csum_bits(skb, offset,
+							    skb_put(nskb, len),
+							    len, 0);
+			continue;
+		}
+
+		frag = skb_shinfo(nskb)->frags;
+		k = 0;
+
+		nskb->ip_summed = CHECKSUM_HW;
+		nskb->csum = skb->csum;
+		memcpy(skb_put(nskb, hsize), skb->data + offset, hsize);
+
+		while (pos < offset + len) {
+			BUG_ON(i >= nfrags);
+
+			*frag = skb_shinfo(skb)->frags[i];
+			get_page(frag->page);
+			size = frag->size;
+
+			if (pos < offset) {
+				frag->page_offset += offset - pos;
+				frag->size -= offset - pos;
+			}
+
+			k++;
+
+			if (pos + size <= offset + len) {
+				i++;
+				pos += size;
+			} else {
+				/* the rest of this page goes in the next one */
+				frag->size -= pos + size - (offset + len);
+				break;
+			}
+
+			frag++;
+		}
+
+		skb_shinfo(nskb)->nr_frags = k;
+		nskb->data_len = len - hsize;
+		nskb->len += nskb->data_len;
+		nskb->truesize += nskb->data_len;
+	} while ((offset += len) < skb->len);
+
+	return segs;
+
+err:
+	while ((skb = segs)) {
+		segs = skb->next;
+		kfree_skb(skb);
+	}
+	return ERR_PTR(-ENOMEM);
+}
+
 void __init skb_init(void)
 {
 	skbuff_head_cache = kmem_cache_create("skbuff_head_cache",
@@ -1458,3 +1618,5 @@ EXPORT_SYMBOL(skb_queue_tail);
 EXPORT_SYMBOL(skb_unlink);
 EXPORT_SYMBOL(skb_append);
 EXPORT_SYMBOL(skb_split);
+EXPORT_SYMBOL(skb_segment);
+EXPORT_SYMBOL(skb_recycle_check);
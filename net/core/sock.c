@@ -236,6 +236,9 @@ int sock_setsockopt(struct socket *sock, int level, int optname,
 		case SO_REUSEADDR:
 			sk->sk_reuse = valbool;
 			break;
+		case SO_REUSEPORT:
+			sk->sk_reuseport = valbool;
+			break;
 		case SO_TYPE:
 		case SO_ERROR:
 			ret = -ENOPROTOOPT;
@@ -366,6 +369,19 @@ int sock_setsockopt(struct socket *sock, int level, int optname,
 			ret = sock_set_timeout(&sk->sk_sndtimeo, optval, optlen);
 			break;
 
+#ifdef CONFIG_NET_BUSY_POLL
+		case SO_BUSY_POLL:
+			/* spinning burns cpu, only the admin may spin longer */
+			if (val < 0)
+				ret = -EINVAL;
+			else if (val > sk->sk_busy_poll &&
+				 !capable(CAP_NET_ADMIN))
+				ret = -EPERM;
+			else
+				sk->sk_busy_poll = val;
+			break;
+#endif
+
 #ifdef CONFIG_NETDEVICES
 		case SO_BINDTODEVICE:
 		{
@@ -496,6 +512,10 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 			v.val = sk->sk_reuse;
 			break;
 
+		case SO_REUSEPORT:
+			v.val = sk->sk_reuseport;
+			break;
+
 		case SO_KEEPALIVE:
 			v.val = !!sock_flag(sk, SOCK_KEEPOPEN);
 			break;
@@ -562,6 +582,12 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 			v.val = sk->sk_rcvlowat;
 			break;
 
+#ifdef CONFIG_NET_BUSY_POLL
+		case SO_BUSY_POLL:
+			v.val = sk->sk_busy_poll;
+			break;
+#endif
+
 		case SO_SNDLOWAT:
 			v.val=1;
 			break; 
@@ -1228,6 +1254,10 @@ void sock_init_data(struct socket *sock, struct sock *sk)
 	sk->sk_rcvtimeo		=	MAX_SCHEDULE_TIMEOUT;
 	sk->sk_sndtimeo		=	MAX_SCHEDULE_TIMEOUT;
 	sk->sk_owner		=	NULL;
+#ifdef CONFIG_NET_BUSY_POLL
+	sk->sk_busy_poll	=	sysctl_net_busy_read;
+	sk->sk_busy_ifindex	=	0;
+#endif
 
 	sk->sk_stamp.tv_sec     = -1L;
 	sk->sk_stamp.tv_usec    = -1L;
@@ -1252,6 +1282,8 @@ void fastcall release_sock(struct sock *sk)
 	spin_lock_bh(&(sk->sk_lock.slock));
 	if (sk->sk_backlog.tail)
 		__release_sock(sk);
+	if (sk->sk_prot->release_cb)
+		sk->sk_prot->release_cb(sk);
 	sk->sk_lock.owner = NULL;
         if (waitqueue_active(&(sk->sk_lock.wq)))
 		wake_up(&(sk->sk_lock.wq));
@@ -0,0 +1,172 @@
+/*
+ * sock_diag.c	Socket monitoring over netlink.
+ *
+ *		The NETLINK_TCPDIAG socket, shared by the per-protocol
+ *		handlers: the nlmsg_type of a request picks the handler,
+ *		which fills the replies in its own binary format.  A dump
+ *		calls the handler under sock_diag_sem each time the reader
+ *		wants more, so the handler can be unloaded in the middle of
+ *		one, which then just ends.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/init.h>
+#include <linux/kmod.h>
+#include <linux/skbuff.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <net/sock.h>
+#include <asm/semaphore.h>
+
+struct sock *sock_diag_nl;
+EXPORT_SYMBOL_GPL(sock_diag_nl);
+
+static struct sock_diag_handler *
+sock_diag_handlers[SOCK_DIAG_LAST - SOCK_DIAG_FIRST + 1];
+static DECLARE_MUTEX(sock_diag_sem);
+
+int sock_diag_register(struct sock_diag_handler *h)
+{
+	int err = -EEXIST;
+
+	if (h->type < SOCK_DIAG_FIRST || h->type > SOCK_DIAG_LAST)
+		return -EINVAL;
+
+	down(&sock_diag_sem);
+	if (!sock_diag_handlers[h->type - SOCK_DIAG_FIRST]) {
+		sock_diag_handlers[h->type - SOCK_DIAG_FIRST] = h;
+		err = 0;
+	}
+	up(&sock_diag_sem);
+	return err;
+}
+EXPORT_SYMBOL_GPL(sock_diag_register);
+
+void sock_diag_unregister(struct sock_diag_handler *h)
+{
+	down(&sock_diag_sem);
+	sock_diag_handlers[h->type - SOCK_DIAG_FIRST] = NULL;
+	up(&sock_diag_sem);
+}
+EXPORT_SYMBOL_GPL(sock_diag_unregister);
+
+/* Returns with sock_diag_sem held, even if there is no handler */
+static struct sock_diag_handler *sock_diag_lock_handler(int type)
+{
+	down(&sock_diag_sem);
+	return sock_diag_handlers[type - SOCK_DIAG_FIRST];
+}
+
+static int sock_diag_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct sock_diag_handler *h;
+	int err = 0;
+
+	h = sock_diag_lock_handler(cb->nlh->nlmsg_type);
+	if (h)
+		err = h->dump(skb, cb);
+	up(&sock_diag_sem);
+	return err;
+}
+
+static int sock_diag_dump_done(struct netlink_callback *cb)
+{
+	return 0;
+}
+
+static __inline__ int
+sock_diag_rcv_msg(struct sk_buff *skb, struct nlmsghdr *nlh)
+{
+	struct sock_diag_handler *h;
+	int type = nlh->nlmsg_type;
+	int err;
+
+	if (!(nlh->nlmsg_flags&NLM_F_REQUEST))
+		return 0;
+
+	if (type < SOCK_DIAG_FIRST || type > SOCK_DIAG_LAST)
+		return -EINVAL;
+
+#ifdef CONFIG_KMOD
+	if (!sock_diag_handlers[type - SOCK_DIAG_FIRST])
+		request_module("net-pf-%d-proto-%d-type-%d",
+			       PF_NETLINK, NETLINK_TCPDIAG, type);
+#endif
+
+	h = sock_diag_lock_handler(type);
+	err = -ENOENT;
+	if (!h)
+		goto out;
+
+	err = -EINVAL;
+	if (NLMSG_LENGTH(h->req_size) > skb->len)
+		goto out;
+
+	if (nlh->nlmsg_flags&NLM_F_DUMP) {
+		if (h->audit) {
+			err = h->audit(nlh);
+			if (err)
+				goto out;
+		}
+		up(&sock_diag_sem);
+		return netlink_dump_start(sock_diag_nl, skb, nlh,
+					  sock_diag_dump,
+					  sock_diag_dump_done);
+	}
+
+	err = -EOPNOTSUPP;
+	if (h->get_exact)
+		err = h->get_exact(skb, nlh);
+out:
+	up(&sock_diag_sem);
+	return err;
+}
+
+static inline void sock_diag_rcv_skb(struct sk_buff *skb)
+{
+	int err;
+	struct nlmsghdr * nlh;
+
+	if (skb->len >= NLMSG_SPACE(0)) {
+		nlh = (struct nlmsghdr *)skb->data;
+		if (nlh->nlmsg_len < sizeof(*nlh) || skb->len < nlh->nlmsg_len)
+			return;
+		err = sock_diag_rcv_msg(skb, nlh);
+		if (err || nlh->nlmsg_flags & NLM_F_ACK)
+			netlink_ack(skb, nlh, err);
+	}
+}
+
+static void sock_diag_rcv(struct sock *sk, int len)
+{
+	struct sk_buff *skb;
+
+	while ((skb = skb_dequeue(&sk->sk_receive_queue)) != NULL) {
+		sock_diag_rcv_skb(skb);
+		kfree_skb(skb);
+	}
+}
+
+static int __init sock_diag_init(void)
+{
+	sock_diag_nl = netlink_kernel_create(NETLINK_TCPDIAG, sock_diag_rcv);
+	if (sock_diag_nl == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+static void __exit sock_diag_exit(void)
+{
+	sock_release(sock_diag_nl->sk_socket);
+}
+
+module_init(sock_diag_init);
+module_exit(sock_diag_exit);
+MODULE_LICENSE("GPL");
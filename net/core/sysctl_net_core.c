@@ -35,6 +35,15 @@ extern int sysctl_somaxconn;
 extern char sysctl_divert_version[];
 #endif /* CONFIG_NET_DIVERT */
 
+#ifdef CONFIG_BPF_JIT
+extern int bpf_jit_enable;
+#endif
+
+#ifdef CONFIG_NET_BUSY_POLL
+extern int sysctl_net_busy_read;
+extern int sysctl_net_busy_poll_budget;
+#endif
+
 /*
  * This strdup() is used for creating copies of network 
  * device names to be handed over to sysctl.
@@ -165,7 +174,35 @@ ctl_table core_table[] = {
 		.proc_handler	= &proc_dostring
 	},
 #endif /* CONFIG_NET_DIVERT */
+#ifdef CONFIG_BPF_JIT
+	{
+		.ctl_name	= NET_CORE_BPF_JIT_ENABLE,
+		.procname	= "bpf_jit_enable",
+		.data		= &bpf_jit_enable,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec
+	},
+#endif
 #endif /* CONFIG_NET */
+#ifdef CONFIG_NET_BUSY_POLL
+	{
+		.ctl_name	= NET_CORE_BUSY_READ,
+		.procname	= "busy_read",
+		.data		= &sysctl_net_busy_read,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec
+	},
+	{
+		.ctl_name	= NET_CORE_BUSY_POLL_BUDGET,
+		.procname	= "busy_poll_budget",
+		.data		= &sysctl_net_busy_poll_budget,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec
+	},
+#endif
 	{
 		.ctl_name	= NET_CORE_SOMAXCONN,
 		.procname	= "somaxconn",
@@ -796,7 +796,7 @@ struct proto_ops inet_stream_ops = {
 	.getsockopt =	sock_common_getsockopt,
 	.sendmsg =	inet_sendmsg,
 	.recvmsg =	sock_common_recvmsg,
-	.mmap =		sock_no_mmap,
+	.mmap =		tcp_mmap,
 	.sendpage =	tcp_sendpage
 };
 
@@ -975,6 +975,8 @@ static struct net_protocol igmp_protocol = {
 static struct net_protocol tcp_protocol = {
 	.handler =	tcp_v4_rcv,
 	.err_handler =	tcp_v4_err,
+	.gso_segment =	tcp_tso_segment,
+	.gro_receive =	tcp_gro_receive,
 	.no_policy =	1,
 };
 
@@ -1087,6 +1089,9 @@ static int __init inet_init(void)
 	/* Setup TCP slab cache for open requests. */
 	tcp_init();
 
+	/* Setup UDP hash tables */
+	udp_table_init();
+
 
 	/*
 	 *	Set the ICMP layer up
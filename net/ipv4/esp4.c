@@ -17,6 +17,52 @@ struct esp_decap_data {
 	__u8		proto;
 };
 
+/* Encrypt and sign a packet esp_output() has laid out */
+static int esp_output_crypt(struct esp_data *esp, struct sk_buff *skb,
+			    struct sk_buff *trailer, struct ip_esp_hdr *esph,
+			    int clen, int nfrags)
+{
+	struct crypto_tfm *tfm = esp->conf.tfm;
+
+	if (esp->conf.ivlen)
+		crypto_cipher_set_iv(tfm, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
+
+	do {
+		struct scatterlist *sg = &esp->sgbuf[0];
+
+		if (unlikely(nfrags > ESP_NUM_FAST_SG)) {
+			sg = kmalloc(sizeof(struct scatterlist)*nfrags, GFP_ATOMIC);
+			if (!sg)
+				return -ENOMEM;
+		}
+		skb_to_sgvec(skb, sg, esph->enc_data+esp->conf.ivlen-skb->data, clen);
+		crypto_cipher_encrypt(tfm, sg, sg, clen);
+		if (unlikely(sg != &esp->sgbuf[0]))
+			kfree(sg);
+	} while (0);
+
+	if (esp->conf.ivlen) {
+		memcpy(esph->enc_data, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
+		crypto_cipher_get_iv(tfm, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
+	}
+
+	if (esp->auth.icv_full_len) {
+		esp->auth.icv(esp, skb, (u8*)esph-skb->data,
+		              sizeof(struct ip_esp_hdr) + esp->conf.ivlen+clen, trailer->tail);
+		pskb_put(skb, trailer, esp->auth.icv_trunc_len);
+	}
+
+	ip_send_check(skb->nh.iph);
+
+	return 0;
+}
+
+#ifdef CONFIG_XFRM_PARALLEL
+static int esp_output_parallel(struct xfrm_state *x, struct sk_buff *skb,
+			       struct sk_buff *trailer,
+			       struct ip_esp_hdr *esph, int clen, int nfrags);
+#endif
+
 static int esp_output(struct xfrm_state *x, struct sk_buff *skb)
 {
 	int err;
@@ -96,37 +142,11 @@ static int esp_output(struct xfrm_state *x, struct sk_buff *skb)
 	esph->spi = x->id.spi;
 	esph->seq_no = htonl(++x->replay.oseq);
 
-	if (esp->conf.ivlen)
-		crypto_cipher_set_iv(tfm, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
-
-	do {
-		struct scatterlist *sg = &esp->sgbuf[0];
-
-		if (unlikely(nfrags > ESP_NUM_FAST_SG)) {
-			sg = kmalloc(sizeof(struct scatterlist)*nfrags, GFP_ATOMIC);
-			if (!sg)
-				goto error;
-		}
-		skb_to_sgvec(skb, sg, esph->enc_data+esp->conf.ivlen-skb->data, clen);
-		crypto_cipher_encrypt(tfm, sg, sg, clen);
-		if (unlikely(sg != &esp->sgbuf[0]))
-			kfree(sg);
-	} while (0);
-
-	if (esp->conf.ivlen) {
-		memcpy(esph->enc_data, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
-		crypto_cipher_get_iv(tfm, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
-	}
-
-	if (esp->auth.icv_full_len) {
-		esp->auth.icv(esp, skb, (u8*)esph-skb->data,
-		              sizeof(struct ip_esp_hdr) + esp->conf.ivlen+clen, trailer->tail);
-		pskb_put(skb, trailer, alen);
-	}
-
-	ip_send_check(top_iph);
-
-	err = 0;
+#ifdef CONFIG_XFRM_PARALLEL
+	if (esp->par)
+		return esp_output_parallel(x, skb, trailer, esph, clen, nfrags);
+#endif
+	err = esp_output_crypt(esp, skb, trailer, esph, clen, nfrags);
 
 error:
 	return err;
@@ -137,23 +157,34 @@ error:
  * expensive, so we only support truncated data, which is the recommended
  * and common case.
  */
-static int esp_input(struct xfrm_state *x, struct xfrm_decap_state *decap, struct sk_buff *skb)
+static int esp_input_check(struct xfrm_state *x, struct sk_buff *skb)
 {
-	struct iphdr *iph;
-	struct ip_esp_hdr *esph;
 	struct esp_data *esp = x->data;
-	struct sk_buff *trailer;
 	int blksize = crypto_tfm_alg_blocksize(esp->conf.tfm);
 	int alen = esp->auth.icv_trunc_len;
 	int elen = skb->len - sizeof(struct ip_esp_hdr) - esp->conf.ivlen - alen;
-	int nfrags;
-	int encap_len = 0;
 
 	if (!pskb_may_pull(skb, sizeof(struct ip_esp_hdr)))
-		goto out;
+		return -EINVAL;
 
 	if (elen <= 0 || (elen & (blksize-1)))
-		goto out;
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Check and decrypt a packet that has passed esp_input_check().
+ * Returns -EBADMSG if the ICV is wrong. */
+static int esp_input_crypt(struct xfrm_state *x, struct esp_data *esp,
+			   struct xfrm_decap_state *decap, struct sk_buff *skb)
+{
+	struct iphdr *iph;
+	struct ip_esp_hdr *esph;
+	struct sk_buff *trailer;
+	int alen = esp->auth.icv_trunc_len;
+	int elen = skb->len - sizeof(struct ip_esp_hdr) - esp->conf.ivlen - alen;
+	int nfrags;
+	int encap_len = 0;
 
 	/* If integrity check is required, do this. */
 	if (esp->auth.icv_full_len) {
@@ -165,10 +196,8 @@ static int esp_input(struct xfrm_state *x, struct xfrm_decap_state *decap, struc
 		if (skb_copy_bits(skb, skb->len-alen, sum1, alen))
 			BUG();
 
-		if (unlikely(memcmp(sum, sum1, alen))) {
-			x->stats.integrity_failed++;
-			goto out;
-		}
+		if (unlikely(memcmp(sum, sum1, alen)))
+			return -EBADMSG;
 	}
 
 	if ((nfrags = skb_cow_data(skb, 0, &trailer)) < 0)
@@ -244,6 +273,155 @@ out:
 	return -EINVAL;
 }
 
+static int esp_input(struct xfrm_state *x, struct xfrm_decap_state *decap, struct sk_buff *skb)
+{
+	int err;
+
+	err = esp_input_check(x, skb);
+	if (err)
+		return err;
+
+	err = esp_input_crypt(x, x->data, decap, skb);
+	if (err == -EBADMSG)
+		x->stats.integrity_failed++;
+	return err;
+}
+
+#ifdef CONFIG_XFRM_PARALLEL
+struct esp_parallel {
+	struct xfrm_parallel	par;
+	struct esp_data		*cpu[NR_CPUS];
+};
+
+struct esp_pjob {
+	struct xfrm_pjob	job;
+	struct xfrm_state	*x;
+	struct sk_buff		*skb;
+	union {
+		struct {
+			struct sk_buff		*trailer;
+			struct ip_esp_hdr	*esph;
+			int			clen;
+			int			nfrags;
+		} out;
+		struct {
+			u32			seq;
+			struct xfrm_decap_state	decap;
+		} in;
+	} u;
+};
+
+static inline struct esp_data *esp_pjob_data(struct esp_pjob *pj)
+{
+	struct esp_data *esp = pj->x->data;
+
+	return esp->par->cpu[pj->job.cpu];
+}
+
+static void esp_output_work(struct xfrm_pjob *job)
+{
+	struct esp_pjob *pj = container_of(job, struct esp_pjob, job);
+
+	job->err = esp_output_crypt(esp_pjob_data(pj), pj->skb, pj->u.out.trailer,
+				    pj->u.out.esph, pj->u.out.clen,
+				    pj->u.out.nfrags);
+}
+
+static void esp_output_done(struct xfrm_pjob *job)
+{
+	struct esp_pjob *pj = container_of(job, struct esp_pjob, job);
+
+	xfrm4_output_resume(pj->skb, job->err);
+	xfrm_state_put(pj->x);
+	kfree(pj);
+}
+
+/* Called with x->lock held: the sequence number is taken, the rest of
+   the work goes to another CPU */
+static int esp_output_parallel(struct xfrm_state *x, struct sk_buff *skb,
+			       struct sk_buff *trailer,
+			       struct ip_esp_hdr *esph, int clen, int nfrags)
+{
+	struct esp_data *esp = x->data;
+	struct esp_pjob *pj;
+
+	pj = kmalloc(sizeof(*pj), GFP_ATOMIC);
+	if (!pj)
+		return -ENOMEM;
+
+	pj->job.work = esp_output_work;
+	pj->job.done = esp_output_done;
+	pj->x = x;
+	pj->skb = skb;
+	pj->u.out.trailer = trailer;
+	pj->u.out.esph = esph;
+	pj->u.out.clen = clen;
+	pj->u.out.nfrags = nfrags;
+
+	xfrm_state_hold(x);
+	if (xfrm_parallel_submit(&esp->par->par, &pj->job)) {
+		xfrm_state_put(x);
+		kfree(pj);
+		return -ENOBUFS;
+	}
+	return -EINPROGRESS;
+}
+
+static void esp_input_work(struct xfrm_pjob *job)
+{
+	struct esp_pjob *pj = container_of(job, struct esp_pjob, job);
+
+	job->err = esp_input_crypt(pj->x, esp_pjob_data(pj), &pj->u.in.decap,
+				   pj->skb);
+}
+
+static void esp_input_done(struct xfrm_pjob *job)
+{
+	struct esp_pjob *pj = container_of(job, struct esp_pjob, job);
+	struct net_device *dev = pj->skb->dev;
+
+	/* this passes on our reference to the state */
+	xfrm4_rcv_resume(pj->x, &pj->u.in.decap, pj->skb, pj->u.in.seq,
+			 job->err);
+	dev_put(dev);
+	kfree(pj);
+}
+
+static int esp_input_parallel(struct xfrm_state *x, struct xfrm_decap_state *decap, struct sk_buff *skb)
+{
+	struct esp_data *esp = x->data;
+	struct esp_pjob *pj;
+	int err;
+
+	if (!esp->par)
+		return esp_input(x, decap, skb);
+
+	err = esp_input_check(x, skb);
+	if (err)
+		return err;
+
+	pj = kmalloc(sizeof(*pj), GFP_ATOMIC);
+	if (!pj)
+		return -ENOMEM;
+
+	pj->job.work = esp_input_work;
+	pj->job.done = esp_input_done;
+	pj->x = x;
+	pj->skb = skb;
+	pj->u.in.seq = ((struct ip_esp_hdr *)skb->data)->seq_no;
+	pj->u.in.decap = *decap;
+
+	/* held for netif_rx() at the end */
+	dev_hold(skb->dev);
+	if (xfrm_parallel_submit(&esp->par->par, &pj->job)) {
+		dev_put(skb->dev);
+		kfree(pj);
+		return -ENOBUFS;
+	}
+	return -EINPROGRESS;
+}
+#endif
+
 static int esp_post_input(struct xfrm_state *x, struct xfrm_decap_state *decap, struct sk_buff *skb)
 {
   
@@ -336,13 +514,8 @@ static void esp4_err(struct sk_buff *skb, u32 info)
 	xfrm_state_put(x);
 }
 
-static void esp_destroy(struct xfrm_state *x)
+static void esp_free_data(struct esp_data *esp)
 {
-	struct esp_data *esp = x->data;
-
-	if (!esp)
-		return;
-
 	if (esp->conf.tfm) {
 		crypto_free_tfm(esp->conf.tfm);
 		esp->conf.tfm = NULL;
@@ -362,6 +535,90 @@ static void esp_destroy(struct xfrm_state *x)
 	kfree(esp);
 }
 
+#ifdef CONFIG_XFRM_PARALLEL
+/* Give every CPU transforms of its own */
+static int esp_init_parallel(struct xfrm_state *x, struct esp_data *esp)
+{
+	struct esp_parallel *par;
+	int cpu, err;
+
+	par = kmalloc(sizeof(*par), GFP_KERNEL);
+	if (!par)
+		return -ENOMEM;
+	memset(par, 0, sizeof(*par));
+	esp->par = par;
+
+	err = xfrm_parallel_init(&par->par);
+	if (err)
+		return err;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct esp_data *e;
+
+		if (!cpu_possible(cpu))
+			continue;
+
+		e = kmalloc(sizeof(*e), GFP_KERNEL);
+		if (!e)
+			return -ENOMEM;
+		*e = *esp;
+		e->conf.tfm = e->auth.tfm = NULL;
+		e->conf.ivec = e->auth.work_icv = NULL;
+		e->par = NULL;
+		par->cpu[cpu] = e;
+
+		if (esp->auth.tfm) {
+			e->auth.tfm = crypto_alloc_tfm(x->aalg->alg_name, 0);
+			e->auth.work_icv = kmalloc(e->auth.icv_full_len, GFP_KERNEL);
+			if (!e->auth.tfm || !e->auth.work_icv)
+				return -ENOMEM;
+		}
+		if (x->props.ealgo == SADB_EALG_NULL)
+			e->conf.tfm = crypto_alloc_tfm(x->ealg->alg_name, CRYPTO_TFM_MODE_ECB);
+		else
+			e->conf.tfm = crypto_alloc_tfm(x->ealg->alg_name, CRYPTO_TFM_MODE_CBC);
+		if (!e->conf.tfm)
+			return -ENOMEM;
+		if (e->conf.ivlen) {
+			e->conf.ivec = kmalloc(e->conf.ivlen, GFP_KERNEL);
+			if (!e->conf.ivec)
+				return -ENOMEM;
+			get_random_bytes(e->conf.ivec, e->conf.ivlen);
+		}
+		if (crypto_cipher_setkey(e->conf.tfm, e->conf.key, e->conf.key_len))
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static void esp_destroy_parallel(struct esp_data *esp)
+{
+	int cpu;
+
+	if (!esp->par)
+		return;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		if (esp->par->cpu[cpu])
+			esp_free_data(esp->par->cpu[cpu]);
+	kfree(esp->par);
+	esp->par = NULL;
+}
+#endif
+
+static void esp_destroy(struct xfrm_state *x)
+{
+	struct esp_data *esp = x->data;
+
+	if (!esp)
+		return;
+
+#ifdef CONFIG_XFRM_PARALLEL
+	esp_destroy_parallel(esp);
+#endif
+	esp_free_data(esp);
+}
+
 static int esp_init_state(struct xfrm_state *x, void *args)
 {
 	struct esp_data *esp = NULL;
@@ -444,6 +701,10 @@ static int esp_init_state(struct xfrm_state *x, void *args)
 			break;
 		}
 	}
+#ifdef CONFIG_XFRM_PARALLEL
+	if ((x->props.flags & XFRM_STATE_PARALLEL) && esp_init_parallel(x, esp))
+		goto error;
+#endif
 	x->data = esp;
 	x->props.trailer_len = esp4_get_max_size(x, 0) - x->props.header_len;
 	return 0;
@@ -464,6 +725,9 @@ static struct xfrm_type esp_type =
 	.destructor	= esp_destroy,
 	.get_max_size	= esp4_get_max_size,
 	.input		= esp_input,
+#ifdef CONFIG_XFRM_PARALLEL
+	.input_parallel	= esp_input_parallel,
+#endif
 	.post_input	= esp_post_input,
 	.output		= esp_output
 };
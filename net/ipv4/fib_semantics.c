@@ -155,9 +155,12 @@ void free_fib_info(struct fib_info *fi)
 	kfree(fi);
 }
 
+/* May be called from softirq context, fib_trie releases its aliases
+ * from RCU callbacks, hence the _bh locking of fib_info_lock writers.
+ */
 void fib_release_info(struct fib_info *fi)
 {
-	write_lock(&fib_info_lock);
+	write_lock_bh(&fib_info_lock);
 	if (fi && --fi->fib_treeref == 0) {
 		hlist_del(&fi->fib_hash);
 		if (fi->fib_prefsrc)
@@ -170,7 +173,7 @@ void fib_release_info(struct fib_info *fi)
 		fi->fib_dead = 1;
 		fib_info_put(fi);
 	}
-	write_unlock(&fib_info_lock);
+	write_unlock_bh(&fib_info_lock);
 }
 
 static __inline__ int nh_comp(const struct fib_info *fi, const struct fib_info *ofi)
@@ -595,7 +598,7 @@ static void fib_hash_move(struct hlist_head *new_info_hash,
 	unsigned int old_size = fib_hash_size;
 	unsigned int i;
 
-	write_lock(&fib_info_lock);
+	write_lock_bh(&fib_info_lock);
 	fib_hash_size = new_size;
 
 	for (i = 0; i < old_size; i++) {
@@ -634,7 +637,7 @@ static void fib_hash_move(struct hlist_head *new_info_hash,
 	}
 	fib_info_laddrhash = new_laddrhash;
 
-	write_unlock(&fib_info_lock);
+	write_unlock_bh(&fib_info_lock);
 }
 
 struct fib_info *
@@ -787,16 +790,20 @@ fib_create_info(const struct rtmsg *r, struct kern_rta *rta,
 	}
 
 link_it:
+	/* Look up and take the reference under the lock, a concurrent
+	 * fib_release_info() may be dropping the last one.
+	 */
+	write_lock_bh(&fib_info_lock);
 	if ((ofi = fib_find_info(fi)) != NULL) {
+		ofi->fib_treeref++;
+		write_unlock_bh(&fib_info_lock);
 		fi->fib_dead = 1;
 		free_fib_info(fi);
-		ofi->fib_treeref++;
 		return ofi;
 	}
 
 	fi->fib_treeref++;
 	atomic_inc(&fi->fib_clntref);
-	write_lock(&fib_info_lock);
 	hlist_add_head(&fi->fib_hash,
 		       &fib_info_hash[fib_info_hashfn(fi)]);
 	if (fi->fib_prefsrc) {
@@ -815,7 +822,7 @@ link_it:
 		head = &fib_info_devhash[hash];
 		hlist_add_head(&nh->nh_hash, head);
 	} endfor_nexthops(fi)
-	write_unlock(&fib_info_lock);
+	write_unlock_bh(&fib_info_lock);
 	return fi;
 
 err_inval:
@@ -836,7 +843,7 @@ int fib_semantic_match(struct list_head *head, const struct flowi *flp,
 	struct fib_alias *fa;
 	int nh_sel = 0;
 
-	list_for_each_entry(fa, head, fa_list) {
+	list_for_each_entry_rcu(fa, head, fa_list) {
 		int err;
 
 		if (fa->fa_tos &&
@@ -1141,12 +1148,14 @@ int fib_sync_down(u32 local, struct net_device *dev, int force)
 		struct hlist_node *node;
 		struct fib_info *fi;
 
+		read_lock_bh(&fib_info_lock);
 		hlist_for_each_entry(fi, node, head, fib_lhash) {
 			if (fi->fib_prefsrc == local) {
 				fi->fib_flags |= RTNH_F_DEAD;
 				ret++;
 			}
 		}
+		read_unlock_bh(&fib_info_lock);
 	}
 
 	if (dev) {
@@ -1156,6 +1165,7 @@ int fib_sync_down(u32 local, struct net_device *dev, int force)
 		struct hlist_node *node;
 		struct fib_nh *nh;
 
+		read_lock_bh(&fib_info_lock);
 		hlist_for_each_entry(nh, node, head, nh_hash) {
 			struct fib_info *fi = nh->nh_parent;
 			int dead;
@@ -1191,6 +1201,7 @@ int fib_sync_down(u32 local, struct net_device *dev, int force)
 				ret++;
 			}
 		}
+		read_unlock_bh(&fib_info_lock);
 	}
 
 	return ret;
@@ -1220,6 +1231,7 @@ int fib_sync_up(struct net_device *dev)
 	head = &fib_info_devhash[hash];
 	ret = 0;
 
+	read_lock_bh(&fib_info_lock);
 	hlist_for_each_entry(nh, node, head, nh_hash) {
 		struct fib_info *fi = nh->nh_parent;
 		int alive;
@@ -1251,6 +1263,7 @@ int fib_sync_up(struct net_device *dev)
 			ret++;
 		}
 	}
+	read_unlock_bh(&fib_info_lock);
 
 	return ret;
 }
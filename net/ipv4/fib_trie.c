@@ -0,0 +1,1623 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		IPv4 FIB: level compressed trie lookup engine.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The prefixes of a table are kept in a path and level compressed binary
+ * trie, as described in S. Nilsson, G. Karlsson, "IP-address lookup using
+ * LC-tries", IEEE Journal on Selected Areas in Communications, 17(6), 1999,
+ * made dynamic: internal nodes are doubled or halved as prefixes come and
+ * go, instead of building the trie once from a sorted list.
+ *
+ * An internal node (tnode) at bit position pos with 2^bits children
+ * indexes them by bits [pos, pos + bits) of the key, counting from the
+ * most significant bit.  All keys below it share the bits above pos with
+ * tn->key; bits skipped between a node and its parent are verified on the
+ * way.  A leaf holds one key, the masked prefix, and one leaf_info per
+ * prefix length for which it is a prefix, longest first; these in turn
+ * hold the fib_alias list fib_hash keeps per fib_node.
+ *
+ * Lookups run under rcu_read_lock() only.  Writers are serialised by the
+ * RTNL semaphore; nodes are replaced, never changed in place, except for
+ * the parent pointers, which only the backtracking of a lookup uses and
+ * at worst lead it to a less specific route while a resize is going on.
+ */
+
+#include <linux/config.h>
+#include <asm/uaccess.h>
+#include <asm/system.h>
+#include <linux/bitops.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/socket.h>
+#include <linux/sockios.h>
+#include <linux/errno.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/netdevice.h>
+#include <linux/if_arp.h>
+#include <linux/proc_fs.h>
+#include <linux/rcupdate.h>
+#include <linux/skbuff.h>
+#include <linux/netlink.h>
+#include <linux/init.h>
+
+#include <net/ip.h>
+#include <net/protocol.h>
+#include <net/route.h>
+#include <net/tcp.h>
+#include <net/sock.h>
+#include <net/ip_fib.h>
+
+#include "fib_lookup.h"
+
+#define KEYLENGTH	32
+
+/* Node sizes are bounded by what __get_free_pages() can give us */
+#define TNODE_MAX_BITS	16
+
+typedef u32 t_key;
+
+#define T_TNODE		0
+#define T_LEAF		1
+#define NODE_TYPE_MASK	0x1UL
+#define NODE_TYPE(n)	((n)->parent & NODE_TYPE_MASK)
+#define NODE_PARENT(n)	((struct tnode *)((n)->parent & ~NODE_TYPE_MASK))
+#define IS_TNODE(n)	(!((n)->parent & T_LEAF))
+#define IS_LEAF(n)	((n)->parent & T_LEAF)
+
+/* Common head of struct leaf and struct tnode */
+struct node {
+	t_key			key;
+	unsigned long		parent;		/* tnode pointer | T_* */
+};
+
+struct leaf {
+	t_key			key;
+	unsigned long		parent;
+	struct list_head	list;		/* leaf_infos, longest first */
+	struct rcu_head		rcu;
+};
+
+struct leaf_info {
+	struct list_head	list;
+	int			plen;
+	t_key			mask;
+	struct list_head	falh;		/* fib_aliases */
+	struct rcu_head		rcu;
+};
+
+struct tnode {
+	t_key			key;
+	unsigned long		parent;
+	unsigned char		pos;		/* first bit of the index */
+	unsigned char		bits;		/* log2 of the number of children */
+	unsigned int		full_children;	/* tnodes that skip no bits */
+	unsigned int		empty_children;
+	struct rcu_head		rcu;
+	struct node		*child[0];
+};
+
+struct trie {
+	struct node		*trie;
+	unsigned int		size;		/* number of leaves */
+	unsigned int		revision;	/* bumped on every change */
+};
+
+/*
+ * Fill factors (in percent) above which a node is doubled and below which
+ * it is halved.  Every lookup goes through the root, so it is kept wider.
+ */
+static int halve_threshold = 25;
+static int inflate_threshold = 50;
+static int halve_threshold_root = 15;
+static int inflate_threshold_root = 30;
+
+static kmem_cache_t *fn_alias_kmem;
+
+static struct node *resize(struct trie *t, struct tnode *tn);
+
+static inline t_key mask_pfx(t_key k, int l)
+{
+	return l ? k & (~0U << (KEYLENGTH - l)) : 0;
+}
+
+static inline t_key tkey_extract_bits(t_key a, int offset, int bits)
+{
+	if (offset < KEYLENGTH && bits)
+		return (a << offset) >> (KEYLENGTH - bits);
+	return 0;
+}
+
+/* Do A and B agree in bits [offset, offset + bits)? */
+static inline int tkey_sub_equals(t_key a, int offset, int bits, t_key b)
+{
+	if (bits == 0 || offset >= KEYLENGTH)
+		return 1;
+	return ((a ^ b) << offset) >> (KEYLENGTH - bits) == 0;
+}
+
+/* The first bit from OFFSET on in which A and B differ, they must differ */
+static inline int tkey_mismatch(t_key a, int offset, t_key b)
+{
+	t_key diff = a ^ b;
+
+	if (offset)
+		diff &= ~0U >> offset;
+	return KEYLENGTH - fls(diff);
+}
+
+static inline unsigned int tnode_child_length(const struct tnode *tn)
+{
+	return 1U << tn->bits;
+}
+
+static inline struct node *tnode_get_child(struct tnode *tn, unsigned int i)
+{
+	return rcu_dereference(tn->child[i]);
+}
+
+static inline void node_set_parent(struct node *n, struct tnode *tp)
+{
+	smp_wmb();
+	n->parent = (unsigned long) tp | NODE_TYPE(n);
+}
+
+/* A child that skips no bits and so gets split up when TN is doubled */
+static inline int tnode_full(const struct tnode *tn, const struct node *n)
+{
+	return n && IS_TNODE(n) &&
+		((struct tnode *) n)->pos == tn->pos + tn->bits;
+}
+
+static inline unsigned int tnode_size(int bits)
+{
+	return sizeof(struct tnode) + (sizeof(struct node *) << bits);
+}
+
+static struct tnode *tnode_new(t_key key, int pos, int bits)
+{
+	unsigned int size = tnode_size(bits);
+	struct tnode *tn;
+
+	if (size <= PAGE_SIZE)
+		tn = kmalloc(size, GFP_KERNEL);
+	else
+		tn = (struct tnode *)
+			__get_free_pages(GFP_KERNEL, get_order(size));
+	if (tn) {
+		memset(tn, 0, size);
+		tn->key = mask_pfx(key, pos);
+		tn->parent = T_TNODE;
+		tn->pos = pos;
+		tn->bits = bits;
+		tn->empty_children = 1U << bits;
+	}
+	return tn;
+}
+
+static void __tnode_free(struct tnode *tn)
+{
+	unsigned int size = tnode_size(tn->bits);
+
+	if (size <= PAGE_SIZE)
+		kfree(tn);
+	else
+		free_pages((unsigned long) tn, get_order(size));
+}
+
+static void tnode_free_rcu(struct rcu_head *head)
+{
+	__tnode_free(container_of(head, struct tnode, rcu));
+}
+
+static inline void tnode_free(struct tnode *tn)
+{
+	call_rcu(&tn->rcu, tnode_free_rcu);
+}
+
+static struct leaf *leaf_new(t_key key)
+{
+	struct leaf *l = kmalloc(sizeof(struct leaf), GFP_KERNEL);
+
+	if (l) {
+		l->key = key;
+		l->parent = T_LEAF;
+		INIT_LIST_HEAD(&l->list);
+	}
+	return l;
+}
+
+static void leaf_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct leaf, rcu));
+}
+
+static struct leaf_info *leaf_info_new(int plen)
+{
+	struct leaf_info *li = kmalloc(sizeof(struct leaf_info), GFP_KERNEL);
+
+	if (li) {
+		li->plen = plen;
+		li->mask = mask_pfx(~0U, plen);
+		INIT_LIST_HEAD(&li->falh);
+	}
+	return li;
+}
+
+static void leaf_info_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct leaf_info, rcu));
+}
+
+static void fn_free_alias_rcu(struct rcu_head *head)
+{
+	struct fib_alias *fa = container_of(head, struct fib_alias, fa_rcu);
+
+	fib_release_info(fa->fa_info);
+	kmem_cache_free(fn_alias_kmem, fa);
+}
+
+/* Lookups may still be using FA, so it goes after a grace period. */
+static inline void fn_free_alias(struct fib_alias *fa)
+{
+	call_rcu(&fa->fa_rcu, fn_free_alias_rcu);
+}
+
+/* Set child I of TN to N, keeping the child counters of TN. */
+static void put_child(struct tnode *tn, unsigned int i, struct node *n)
+{
+	struct node *chi = tn->child[i];
+
+	if (!chi)
+		tn->empty_children--;
+	else if (tnode_full(tn, chi))
+		tn->full_children--;
+
+	if (!n)
+		tn->empty_children++;
+	else {
+		if (tnode_full(tn, n))
+			tn->full_children++;
+		node_set_parent(n, tn);
+	}
+
+	rcu_assign_pointer(tn->child[i], n);
+}
+
+/* Make N, a child that would be alone in its new node, stand on its own. */
+static struct node *collapse(struct tnode *tn)
+{
+	struct node *n = NULL;
+	unsigned int i;
+
+	for (i = 0; i < tnode_child_length(tn); i++) {
+		n = tn->child[i];
+		if (n)
+			break;
+	}
+	tnode_free(tn);
+	return n;
+}
+
+/*
+ * Double TN.  Children skipping a bit move into the half their next bit
+ * selects; full children are split in two, or dissolved when binary.
+ * Returns NULL, leaving TN alone, when out of memory.
+ */
+static struct tnode *inflate(struct trie *t, struct tnode *oldtn)
+{
+	unsigned int olen = tnode_child_length(oldtn);
+	struct tnode *tn;
+	unsigned int i;
+
+	tn = tnode_new(oldtn->key, oldtn->pos, oldtn->bits + 1);
+	if (!tn)
+		return NULL;
+	tn->parent = oldtn->parent;
+
+	/* Allocate all the halves first, so failing leaves nothing changed */
+	for (i = 0; i < olen; i++) {
+		struct tnode *inode = (struct tnode *) oldtn->child[i];
+
+		if (!tnode_full(oldtn, (struct node *) inode) || inode->bits == 1)
+			continue;
+
+		tn->child[2*i] = (struct node *)
+			tnode_new(inode->key, inode->pos + 1, inode->bits - 1);
+		tn->child[2*i + 1] = (struct node *)
+			tnode_new(inode->key | (1U << (KEYLENGTH - 1 - inode->pos)),
+				  inode->pos + 1, inode->bits - 1);
+		if (!tn->child[2*i] || !tn->child[2*i + 1])
+			goto nomem;
+	}
+
+	for (i = 0; i < olen; i++) {
+		struct node *node = oldtn->child[i];
+		struct tnode *inode, *left, *right;
+		unsigned int j, half;
+
+		if (!node)
+			continue;
+
+		if (!tnode_full(oldtn, node)) {
+			put_child(tn, tkey_extract_bits(node->key, tn->pos,
+							tn->bits), node);
+			continue;
+		}
+
+		inode = (struct tnode *) node;
+		if (inode->bits == 1) {
+			put_child(tn, 2*i, inode->child[0]);
+			put_child(tn, 2*i + 1, inode->child[1]);
+			tnode_free(inode);
+			continue;
+		}
+
+		left = (struct tnode *) tn->child[2*i];
+		right = (struct tnode *) tn->child[2*i + 1];
+		tn->child[2*i] = tn->child[2*i + 1] = NULL;
+		left->parent = right->parent = (unsigned long) tn;
+
+		half = tnode_child_length(left);
+		for (j = 0; j < half; j++) {
+			if (inode->child[j])
+				put_child(left, j, inode->child[j]);
+			if (inode->child[j + half])
+				put_child(right, j, inode->child[j + half]);
+		}
+
+		put_child(tn, 2*i, resize(t, left));
+		put_child(tn, 2*i + 1, resize(t, right));
+		tnode_free(inode);
+	}
+
+	tnode_free(oldtn);
+	return tn;
+
+nomem:
+	for (i = 0; i < tnode_child_length(tn); i++)
+		if (tn->child[i])
+			__tnode_free((struct tnode *) tn->child[i]);
+	__tnode_free(tn);
+	return NULL;
+}
+
+/*
+ * Halve TN.  Pairs of children that are both in use get a new binary
+ * node of their own.  Returns NULL, leaving TN alone, when out of memory.
+ */
+static struct tnode *halve(struct trie *t, struct tnode *oldtn)
+{
+	unsigned int olen = tnode_child_length(oldtn);
+	struct tnode *tn;
+	unsigned int i;
+
+	tn = tnode_new(oldtn->key, oldtn->pos, oldtn->bits - 1);
+	if (!tn)
+		return NULL;
+	tn->parent = oldtn->parent;
+
+	for (i = 0; i < olen; i += 2) {
+		struct node *left = oldtn->child[i];
+
+		if (!left || !oldtn->child[i + 1])
+			continue;
+		tn->child[i/2] = (struct node *)
+			tnode_new(left->key, tn->pos + tn->bits, 1);
+		if (!tn->child[i/2])
+			goto nomem;
+	}
+
+	for (i = 0; i < olen; i += 2) {
+		struct node *left = oldtn->child[i];
+		struct node *right = oldtn->child[i + 1];
+		struct tnode *binary;
+
+		if (!left || !right) {
+			if (left || right)
+				put_child(tn, i/2, left ? left : right);
+			continue;
+		}
+
+		binary = (struct tnode *) tn->child[i/2];
+		tn->child[i/2] = NULL;
+		binary->parent = (unsigned long) tn;
+		put_child(binary, 0, left);
+		put_child(binary, 1, right);
+		put_child(tn, i/2, (struct node *) binary);
+	}
+
+	tnode_free(oldtn);
+	return tn;
+
+nomem:
+	for (i = 0; i < tnode_child_length(tn); i++)
+		if (tn->child[i])
+			__tnode_free((struct tnode *) tn->child[i]);
+	__tnode_free(tn);
+	return NULL;
+}
+
+/*
+ * Bring TN back into shape after one of its children changed: drop it
+ * when empty, replace it by its child when it has only one, and double
+ * or halve it as the fill factor asks for.  Returns what should take the
+ * place of TN in its parent.
+ */
+static struct node *resize(struct trie *t, struct tnode *tn)
+{
+	int inflate_th = inflate_threshold, halve_th = halve_threshold;
+	int max_resize = 10;
+	struct tnode *new;
+
+	if (!tn)
+		return NULL;
+
+	if (tn->empty_children == tnode_child_length(tn)) {
+		tnode_free(tn);
+		return NULL;
+	}
+	if (tn->empty_children == tnode_child_length(tn) - 1)
+		return collapse(tn);
+
+	if (!NODE_PARENT(tn)) {
+		inflate_th = inflate_threshold_root;
+		halve_th = halve_threshold_root;
+	}
+
+	/*
+	 * Doubling turns every full child into two, so the new node would
+	 * have (len - empty + full) of its 2 * len slots in use.
+	 */
+	while (tn->full_children > 0 && max_resize-- > 0 &&
+	       tn->bits < TNODE_MAX_BITS && tn->pos + tn->bits < KEYLENGTH &&
+	       50 * (tn->full_children + tnode_child_length(tn) -
+		     tn->empty_children) >=
+	       inflate_th * tnode_child_length(tn)) {
+		new = inflate(t, tn);
+		if (!new)
+			break;
+		tn = new;
+	}
+
+	while (tn->bits > 1 && max_resize-- > 0 &&
+	       100 * (tnode_child_length(tn) - tn->empty_children) <
+	       halve_th * tnode_child_length(tn)) {
+		new = halve(t, tn);
+		if (!new)
+			break;
+		tn = new;
+	}
+
+	if (tn->empty_children == tnode_child_length(tn) - 1)
+		return collapse(tn);
+
+	return (struct node *) tn;
+}
+
+/* Resize TN and all the nodes above it, up to the root. */
+static void trie_rebalance(struct trie *t, struct tnode *tn)
+{
+	struct tnode *tp;
+	struct node *n;
+
+	if (!tn)
+		return;
+
+	while ((tp = NODE_PARENT(tn)) != NULL) {
+		unsigned int cindex = tkey_extract_bits(tn->key, tp->pos,
+							tp->bits);
+
+		put_child(tp, cindex, resize(t, tn));
+		tn = tp;
+	}
+
+	n = resize(t, tn);
+	if (n)
+		node_set_parent(n, NULL);
+	rcu_assign_pointer(t->trie, n);
+}
+
+static struct leaf *fib_find_node(struct trie *t, t_key key)
+{
+	struct node *n = rcu_dereference(t->trie);
+
+	while (n && IS_TNODE(n)) {
+		struct tnode *tn = (struct tnode *) n;
+
+		n = tnode_get_child(tn, tkey_extract_bits(key, tn->pos,
+							  tn->bits));
+	}
+
+	if (n && n->key == key)
+		return (struct leaf *) n;
+	return NULL;
+}
+
+static struct leaf_info *find_leaf_info(struct leaf *l, int plen)
+{
+	struct leaf_info *li;
+
+	list_for_each_entry_rcu(li, &l->list, list)
+		if (li->plen == plen)
+			return li;
+	return NULL;
+}
+
+static struct list_head *get_fa_head(struct leaf *l, int plen)
+{
+	struct leaf_info *li = find_leaf_info(l, plen);
+
+	return li ? &li->falh : NULL;
+}
+
+static void insert_leaf_info(struct leaf *l, struct leaf_info *new)
+{
+	struct leaf_info *li;
+
+	list_for_each_entry(li, &l->list, list)
+		if (new->plen > li->plen)
+			break;
+	list_add_tail_rcu(&new->list, &li->list);
+}
+
+/*
+ * Add a leaf_info for KEY/PLEN, and the leaf itself if KEY is new.
+ * Returns its alias list, or NULL when out of memory.
+ */
+static struct list_head *fib_insert_node(struct trie *t, t_key key, int plen)
+{
+	struct node *n;
+	struct tnode *tp, *tn;
+	struct leaf_info *li;
+	struct leaf *l;
+	int pos, newpos;
+
+	li = leaf_info_new(plen);
+	if (!li)
+		return NULL;
+
+	l = fib_find_node(t, key);
+	if (l) {
+		insert_leaf_info(l, li);
+		return &li->falh;
+	}
+
+	l = leaf_new(key);
+	if (!l) {
+		kfree(li);
+		return NULL;
+	}
+	list_add(&li->list, &l->list);
+
+	pos = 0;
+	tp = NULL;
+	n = t->trie;
+	while (n && IS_TNODE(n)) {
+		tn = (struct tnode *) n;
+		if (!tkey_sub_equals(tn->key, pos, tn->pos - pos, key))
+			break;
+		tp = tn;
+		pos = tn->pos + tn->bits;
+		n = tn->child[tkey_extract_bits(key, tn->pos, tn->bits)];
+	}
+
+	/*
+	 * N is now an empty slot of TP, a leaf with another key or a tnode
+	 * whose skipped bits don't match.  In the latter cases a binary node
+	 * at the first differing bit takes its place, holding both.
+	 */
+	if (!n) {
+		if (tp)
+			put_child(tp, tkey_extract_bits(key, tp->pos, tp->bits),
+				  (struct node *) l);
+		else
+			rcu_assign_pointer(t->trie, (struct node *) l);
+		trie_rebalance(t, tp);
+	} else {
+		int missbit;
+
+		newpos = tkey_mismatch(key, pos, n->key);
+		tn = tnode_new(key, newpos, 1);
+		if (!tn) {
+			kfree(li);
+			kfree(l);
+			return NULL;
+		}
+		tn->parent = (unsigned long) tp;
+
+		missbit = tkey_extract_bits(key, newpos, 1);
+		put_child(tn, missbit, (struct node *) l);
+		put_child(tn, 1 - missbit, n);
+
+		if (tp)
+			put_child(tp, tkey_extract_bits(key, tp->pos, tp->bits),
+				  (struct node *) tn);
+		else
+			rcu_assign_pointer(t->trie, (struct node *) tn);
+		trie_rebalance(t, tn);
+	}
+
+	t->size++;
+	return &li->falh;
+}
+
+static void trie_leaf_remove(struct trie *t, struct leaf *l)
+{
+	struct tnode *tp = NODE_PARENT(l);
+
+	if (tp) {
+		put_child(tp, tkey_extract_bits(l->key, tp->pos, tp->bits),
+			  NULL);
+		trie_rebalance(t, tp);
+	} else
+		rcu_assign_pointer(t->trie, NULL);
+
+	t->size--;
+	call_rcu(&l->rcu, leaf_free_rcu);
+}
+
+/* Drop the leaf_info LI of L when its last alias went, and L with it. */
+static void trie_leaf_info_check(struct trie *t, struct leaf *l,
+				 struct leaf_info *li)
+{
+	if (!list_empty(&li->falh))
+		return;
+
+	list_del_rcu(&li->list);
+	call_rcu(&li->rcu, leaf_info_free_rcu);
+
+	if (list_empty(&l->list))
+		trie_leaf_remove(t, l);
+}
+
+/* The node after N in preorder, NULL at the end. */
+static struct node *trie_nextnode(struct node *n)
+{
+	struct tnode *p;
+	unsigned int i;
+
+	if (IS_TNODE(n)) {
+		struct tnode *tn = (struct tnode *) n;
+
+		for (i = 0; i < tnode_child_length(tn); i++) {
+			struct node *c = tnode_get_child(tn, i);
+			if (c)
+				return c;
+		}
+	}
+
+	while ((p = NODE_PARENT(n)) != NULL) {
+		i = tkey_extract_bits(n->key, p->pos, p->bits) + 1;
+		for (; i < tnode_child_length(p); i++) {
+			struct node *c = tnode_get_child(p, i);
+			if (c)
+				return c;
+		}
+		n = (struct node *) p;
+	}
+	return NULL;
+}
+
+/* The leaf after L in key order, the first one when L is NULL. */
+static struct leaf *trie_nextleaf(struct trie *t, struct leaf *l)
+{
+	struct node *n;
+
+	if (l)
+		n = trie_nextnode((struct node *) l);
+	else
+		n = rcu_dereference(t->trie);
+
+	while (n && IS_TNODE(n))
+		n = trie_nextnode(n);
+	return (struct leaf *) n;
+}
+
+static int check_leaf(struct leaf *l, t_key key, const struct flowi *flp,
+		      struct fib_result *res)
+{
+	struct leaf_info *li;
+	int err;
+
+	list_for_each_entry_rcu(li, &l->list, list) {
+		if ((key ^ l->key) & li->mask)
+			continue;
+		err = fib_semantic_match(&li->falh, flp, res, li->plen);
+		if (err <= 0)
+			return err;
+	}
+	return 1;
+}
+
+/*
+ * The first child of TN that may hold a prefix of KEY, -1 if none can.
+ * When KEY leaves the bits TN skips at bit d, only prefixes of at most
+ * d bits can match, which are zero from there on.
+ */
+static inline int tnode_lookup_index(struct tnode *tn, t_key key)
+{
+	t_key diff = mask_pfx(key ^ tn->key, tn->pos);
+	int d;
+
+	if (!diff)
+		return tkey_extract_bits(key, tn->pos, tn->bits);
+
+	d = KEYLENGTH - fls(diff);
+	if (tn->key << d)
+		return -1;
+	return 0;
+}
+
+/*
+ * Longest prefix match.  The prefixes of KEY in the child at index i of a
+ * node are all longer than those in the child at i with its lowest set
+ * bit cleared, so trying the children in that order, and backtracking to
+ * the parent after child 0, finds the longest matching prefix first.
+ */
+static int
+fn_trie_lookup(struct fib_table *tb, const struct flowi *flp, struct fib_result *res)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+	t_key key = ntohl(flp->fl4_dst);
+	struct tnode *tn;
+	struct node *n;
+	int cindex;
+	int ret = 1;
+
+	rcu_read_lock();
+
+	n = rcu_dereference(t->trie);
+	if (!n)
+		goto out;
+	if (IS_LEAF(n)) {
+		ret = check_leaf((struct leaf *) n, key, flp, res);
+		goto out;
+	}
+
+	tn = (struct tnode *) n;
+	cindex = tnode_lookup_index(tn, key);
+	if (cindex < 0)
+		goto out;
+
+	for (;;) {
+		n = tnode_get_child(tn, cindex);
+		if (n) {
+			if (IS_LEAF(n)) {
+				ret = check_leaf((struct leaf *) n, key,
+						 flp, res);
+				if (ret <= 0)
+					goto out;
+			} else {
+				int i = tnode_lookup_index((struct tnode *) n,
+							   key);
+				if (i >= 0) {
+					tn = (struct tnode *) n;
+					cindex = i;
+					continue;
+				}
+			}
+		}
+
+		while (!cindex) {
+			struct tnode *p = NODE_PARENT(tn);
+
+			if (!p) {
+				ret = 1;
+				goto out;
+			}
+			cindex = tkey_extract_bits(tn->key, p->pos, p->bits);
+			tn = p;
+		}
+		cindex &= cindex - 1;
+	}
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+static int trie_last_dflt = -1;
+
+static void
+fn_trie_select_default(struct fib_table *tb, const struct flowi *flp, struct fib_result *res)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+	int order, last_idx;
+	struct fib_info *fi = NULL;
+	struct fib_info *last_resort;
+	struct fib_alias *fa;
+	struct list_head *fa_head;
+	struct leaf *l;
+
+	last_idx = -1;
+	last_resort = NULL;
+	order = -1;
+
+	rcu_read_lock();
+
+	l = fib_find_node(t, 0);
+	if (!l)
+		goto out;
+	fa_head = get_fa_head(l, 0);
+	if (!fa_head)
+		goto out;
+
+	list_for_each_entry_rcu(fa, fa_head, fa_list) {
+		struct fib_info *next_fi = fa->fa_info;
+
+		if (fa->fa_scope != res->scope ||
+		    fa->fa_type != RTN_UNICAST)
+			continue;
+
+		if (next_fi->fib_priority > res->fi->fib_priority)
+			break;
+		if (!next_fi->fib_nh[0].nh_gw ||
+		    next_fi->fib_nh[0].nh_scope != RT_SCOPE_LINK)
+			continue;
+		fa->fa_state |= FA_S_ACCESSED;
+
+		if (fi == NULL) {
+			if (next_fi != res->fi)
+				break;
+		} else if (!fib_detect_death(fi, order, &last_resort,
+					     &last_idx, &trie_last_dflt)) {
+			if (res->fi)
+				fib_info_put(res->fi);
+			res->fi = fi;
+			atomic_inc(&fi->fib_clntref);
+			trie_last_dflt = order;
+			goto out;
+		}
+		fi = next_fi;
+		order++;
+	}
+
+	if (order <= 0 || fi == NULL) {
+		trie_last_dflt = -1;
+		goto out;
+	}
+
+	if (!fib_detect_death(fi, order, &last_resort, &last_idx, &trie_last_dflt)) {
+		if (res->fi)
+			fib_info_put(res->fi);
+		res->fi = fi;
+		atomic_inc(&fi->fib_clntref);
+		trie_last_dflt = order;
+		goto out;
+	}
+
+	if (last_idx >= 0) {
+		if (res->fi)
+			fib_info_put(res->fi);
+		res->fi = last_resort;
+		if (last_resort)
+			atomic_inc(&last_resort->fib_clntref);
+	}
+	trie_last_dflt = last_idx;
+out:
+	rcu_read_unlock();
+}
+
+static int
+fn_trie_insert(struct fib_table *tb, struct rtmsg *r, struct kern_rta *rta,
+	       struct nlmsghdr *n, struct netlink_skb_parms *req)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+	struct fib_alias *fa, *new_fa;
+	struct list_head *fa_head = NULL;
+	struct fib_info *fi;
+	struct leaf *l;
+	int plen = r->rtm_dst_len;
+	int type = r->rtm_type;
+	u8 tos = r->rtm_tos;
+	u32 key;
+	int err;
+
+	if (plen > 32)
+		return -EINVAL;
+
+	key = 0;
+	if (rta->rta_dst) {
+		u32 dst;
+		memcpy(&dst, rta->rta_dst, 4);
+		key = ntohl(dst);
+	}
+	if (key != mask_pfx(key, plen))
+		return -EINVAL;
+
+	if  ((fi = fib_create_info(r, rta, n, &err)) == NULL)
+		return err;
+
+	l = fib_find_node(t, key);
+	fa = NULL;
+	if (l) {
+		fa_head = get_fa_head(l, plen);
+		fa = fib_find_alias(fa_head, tos, fi->fib_priority);
+	}
+
+	/* Now fa, if non-NULL, points to the first fib alias
+	 * with the same keys [prefix,tos,priority], if such key already
+	 * exists or to the node before which we will insert new one.
+	 *
+	 * If fa is NULL, we will need to allocate a new one and
+	 * insert to the head of fa_head.
+	 *
+	 * If fa_head is NULL, no leaf_info matched the destination key
+	 * and we need to allocate a new one of those as well.
+	 */
+
+	if (fa && fa->fa_tos == tos &&
+	    fa->fa_info->fib_priority == fi->fib_priority) {
+		struct fib_alias *fa_orig;
+
+		err = -EEXIST;
+		if (n->nlmsg_flags & NLM_F_EXCL)
+			goto out;
+
+		if (n->nlmsg_flags & NLM_F_REPLACE) {
+			/* Lookups may be looking at fa, so replace it */
+			err = -ENOBUFS;
+			new_fa = kmem_cache_alloc(fn_alias_kmem, SLAB_KERNEL);
+			if (new_fa == NULL)
+				goto out;
+
+			new_fa->fa_info = fi;
+			new_fa->fa_tos = fa->fa_tos;
+			new_fa->fa_type = type;
+			new_fa->fa_scope = r->rtm_scope;
+			new_fa->fa_state = fa->fa_state & ~FA_S_ACCESSED;
+
+			list_replace_rcu(&fa->fa_list, &new_fa->fa_list);
+			t->revision++;
+
+			if (fa->fa_state & FA_S_ACCESSED)
+				rt_cache_flush(-1);
+			fn_free_alias(fa);
+			return 0;
+		}
+
+		/* Error if we find a perfect match which
+		 * uses the same scope, type, and nexthop
+		 * information.
+		 */
+		fa_orig = fa;
+		fa = list_entry(fa->fa_list.prev, struct fib_alias, fa_list);
+		list_for_each_entry_continue(fa, fa_head, fa_list) {
+			if (fa->fa_tos != tos)
+				break;
+			if (fa->fa_info->fib_priority != fi->fib_priority)
+				break;
+			if (fa->fa_type == type &&
+			    fa->fa_scope == r->rtm_scope &&
+			    fa->fa_info == fi)
+				goto out;
+		}
+		if (!(n->nlmsg_flags & NLM_F_APPEND))
+			fa = fa_orig;
+	}
+
+	err = -ENOENT;
+	if (!(n->nlmsg_flags&NLM_F_CREATE))
+		goto out;
+
+	err = -ENOBUFS;
+	new_fa = kmem_cache_alloc(fn_alias_kmem, SLAB_KERNEL);
+	if (new_fa == NULL)
+		goto out;
+
+	new_fa->fa_info = fi;
+	new_fa->fa_tos = tos;
+	new_fa->fa_type = type;
+	new_fa->fa_scope = r->rtm_scope;
+	new_fa->fa_state = 0;
+
+	if (!fa_head) {
+		fa_head = fib_insert_node(t, key, plen);
+		if (fa_head == NULL)
+			goto out_free_new_fa;
+	}
+
+	list_add_tail_rcu(&new_fa->fa_list,
+			  (fa ? &fa->fa_list : fa_head));
+	t->revision++;
+
+	rt_cache_flush(-1);
+	rtmsg_fib(RTM_NEWROUTE, htonl(key), new_fa, plen, tb->tb_id, n, req);
+	return 0;
+
+out_free_new_fa:
+	kmem_cache_free(fn_alias_kmem, new_fa);
+out:
+	fib_release_info(fi);
+	return err;
+}
+
+static int
+fn_trie_delete(struct fib_table *tb, struct rtmsg *r, struct kern_rta *rta,
+	       struct nlmsghdr *n, struct netlink_skb_parms *req)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+	struct fib_alias *fa, *fa_to_delete;
+	struct leaf_info *li;
+	struct leaf *l;
+	int plen = r->rtm_dst_len;
+	u8 tos = r->rtm_tos;
+	u32 key;
+
+	if (plen > 32)
+		return -EINVAL;
+
+	key = 0;
+	if (rta->rta_dst) {
+		u32 dst;
+		memcpy(&dst, rta->rta_dst, 4);
+		key = ntohl(dst);
+	}
+	if (key != mask_pfx(key, plen))
+		return -EINVAL;
+
+	l = fib_find_node(t, key);
+	if (!l)
+		return -ESRCH;
+	li = find_leaf_info(l, plen);
+	if (!li)
+		return -ESRCH;
+
+	fa = fib_find_alias(&li->falh, tos, 0);
+	if (!fa)
+		return -ESRCH;
+
+	fa_to_delete = NULL;
+	fa = list_entry(fa->fa_list.prev, struct fib_alias, fa_list);
+	list_for_each_entry_continue(fa, &li->falh, fa_list) {
+		struct fib_info *fi = fa->fa_info;
+
+		if (fa->fa_tos != tos)
+			break;
+
+		if ((!r->rtm_type ||
+		     fa->fa_type == r->rtm_type) &&
+		    (r->rtm_scope == RT_SCOPE_NOWHERE ||
+		     fa->fa_scope == r->rtm_scope) &&
+		    (!r->rtm_protocol ||
+		     fi->fib_protocol == r->rtm_protocol) &&
+		    fib_nh_match(r, n, rta, fi) == 0) {
+			fa_to_delete = fa;
+			break;
+		}
+	}
+
+	if (!fa_to_delete)
+		return -ESRCH;
+
+	fa = fa_to_delete;
+	rtmsg_fib(RTM_DELROUTE, htonl(key), fa, plen, tb->tb_id, n, req);
+
+	list_del_rcu(&fa->fa_list);
+	trie_leaf_info_check(t, l, li);
+	t->revision++;
+
+	if (fa->fa_state & FA_S_ACCESSED)
+		rt_cache_flush(-1);
+	fn_free_alias(fa);
+	return 0;
+}
+
+static int trie_flush_leaf(struct trie *t, struct leaf *l)
+{
+	struct leaf_info *li, *li_next;
+	int found = 0;
+
+	list_for_each_entry_safe(li, li_next, &l->list, list) {
+		struct fib_alias *fa, *fa_node;
+
+		list_for_each_entry_safe(fa, fa_node, &li->falh, fa_list) {
+			struct fib_info *fi = fa->fa_info;
+
+			if (fi && (fi->fib_flags&RTNH_F_DEAD)) {
+				list_del_rcu(&fa->fa_list);
+				fn_free_alias(fa);
+				found++;
+			}
+		}
+		if (list_empty(&li->falh)) {
+			list_del_rcu(&li->list);
+			call_rcu(&li->rcu, leaf_info_free_rcu);
+		}
+	}
+	return found;
+}
+
+static int fn_trie_flush(struct fib_table *tb)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+	struct leaf *l, *next;
+	int found = 0;
+
+	for (l = trie_nextleaf(t, NULL); l; l = next) {
+		/* Removing l reshapes the trie, but leaves stay where they are */
+		next = trie_nextleaf(t, l);
+		found += trie_flush_leaf(t, l);
+		if (list_empty(&l->list))
+			trie_leaf_remove(t, l);
+	}
+	if (found)
+		t->revision++;
+	return found;
+}
+
+/*
+ * Dump the aliases of L from the cb->args[3]th on.  A dump interrupted
+ * here resumes at the key of L (cb->args[2]) with cb->args[1] set.
+ */
+static int fn_trie_dump_leaf(struct leaf *l, struct fib_table *tb,
+			     struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct leaf_info *li;
+	u32 xkey = htonl(l->key);
+	int i, s_i;
+
+	s_i = cb->args[3];
+	i = 0;
+	list_for_each_entry_rcu(li, &l->list, list) {
+		struct fib_alias *fa;
+
+		list_for_each_entry_rcu(fa, &li->falh, fa_list) {
+			if (i < s_i)
+				goto next;
+
+			if (fib_dump_info(skb, NETLINK_CB(cb->skb).pid,
+					  cb->nlh->nlmsg_seq,
+					  RTM_NEWROUTE,
+					  tb->tb_id,
+					  fa->fa_type,
+					  fa->fa_scope,
+					  &xkey,
+					  li->plen,
+					  fa->fa_tos,
+					  fa->fa_info) < 0) {
+				cb->args[1] = 1;
+				cb->args[2] = l->key;
+				cb->args[3] = i;
+				return -1;
+			}
+		next:
+			i++;
+		}
+	}
+	cb->args[3] = 0;
+	return skb->len;
+}
+
+static int fn_trie_dump(struct fib_table *tb, struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+	struct leaf *l = NULL;
+
+	rcu_read_lock();
+	if (cb->args[1]) {
+		t_key key = cb->args[2];
+
+		/* The leaf we stopped at may be gone, go on with the next */
+		l = fib_find_node(t, key);
+		if (!l) {
+			cb->args[3] = 0;
+			for (l = trie_nextleaf(t, NULL); l && l->key < key;
+			     l = trie_nextleaf(t, l))
+				;
+		}
+	} else
+		l = trie_nextleaf(t, NULL);
+
+	for (; l; l = trie_nextleaf(t, l)) {
+		if (fn_trie_dump_leaf(l, tb, skb, cb) < 0) {
+			rcu_read_unlock();
+			return -1;
+		}
+	}
+	rcu_read_unlock();
+
+	cb->args[1] = 0;
+	return skb->len;
+}
+
+/* fib_frontend.c knows a single FIB engine under this name */
+#ifdef CONFIG_IP_MULTIPLE_TABLES
+struct fib_table * fib_hash_init(int id)
+#else
+struct fib_table * __init fib_hash_init(int id)
+#endif
+{
+	struct fib_table *tb;
+
+	if (fn_alias_kmem == NULL)
+		fn_alias_kmem = kmem_cache_create("ip_fib_alias",
+						  sizeof(struct fib_alias),
+						  0, SLAB_HWCACHE_ALIGN,
+						  NULL, NULL);
+
+	tb = kmalloc(sizeof(struct fib_table) + sizeof(struct trie),
+		     GFP_KERNEL);
+	if (tb == NULL)
+		return NULL;
+
+	tb->tb_id = id;
+	tb->tb_lookup = fn_trie_lookup;
+	tb->tb_insert = fn_trie_insert;
+	tb->tb_delete = fn_trie_delete;
+	tb->tb_flush = fn_trie_flush;
+	tb->tb_select_default = fn_trie_select_default;
+	tb->tb_dump = fn_trie_dump;
+	memset(tb->tb_data, 0, sizeof(struct trie));
+	return tb;
+}
+
+/* ------------------------------------------------------------------------ */
+#ifdef CONFIG_PROC_FS
+
+struct fib_iter_state {
+	struct trie	*trie;
+	struct leaf	*l;
+	struct leaf_info *li;
+	struct fib_alias *fa;
+	loff_t		pos;
+	unsigned int	revision;
+	int		valid;
+};
+
+/* The first alias after leaf_info LI of L, or of L if LI is NULL. */
+static struct fib_alias *fib_get_from(struct fib_iter_state *iter,
+				      struct leaf *l, struct leaf_info *li)
+{
+	for (; l; l = trie_nextleaf(iter->trie, l), li = NULL) {
+		struct list_head *p;
+
+		p = rcu_dereference(li ? li->list.next : l->list.next);
+		for (; p != &l->list; p = rcu_dereference(p->next)) {
+			struct list_head *q;
+
+			li = list_entry(p, struct leaf_info, list);
+			q = rcu_dereference(li->falh.next);
+			if (q != &li->falh) {
+				iter->l = l;
+				iter->li = li;
+				iter->fa = list_entry(q, struct fib_alias,
+						      fa_list);
+				return iter->fa;
+			}
+		}
+	}
+
+	iter->l = NULL;
+	iter->li = NULL;
+	iter->fa = NULL;
+	return NULL;
+}
+
+static struct fib_alias *fib_get_first(struct seq_file *seq)
+{
+	struct fib_iter_state *iter = seq->private;
+
+	iter->trie	= (struct trie *) ip_fib_main_table->tb_data;
+	iter->pos	= 0;
+	iter->revision	= iter->trie->revision;
+	iter->valid	= 1;
+
+	return fib_get_from(iter, trie_nextleaf(iter->trie, NULL), NULL);
+}
+
+static struct fib_alias *fib_get_next(struct seq_file *seq)
+{
+	struct fib_iter_state *iter = seq->private;
+	struct fib_alias *fa = iter->fa;
+	struct list_head *q;
+
+	iter->pos++;
+	if (!fa)
+		return NULL;
+
+	q = rcu_dereference(fa->fa_list.next);
+	if (q != &iter->li->falh) {
+		iter->fa = list_entry(q, struct fib_alias, fa_list);
+		return iter->fa;
+	}
+	return fib_get_from(iter, iter->l, iter->li);
+}
+
+static struct fib_alias *fib_get_idx(struct seq_file *seq, loff_t pos)
+{
+	struct fib_iter_state *iter = seq->private;
+	struct fib_alias *fa;
+
+	if (iter->valid && pos >= iter->pos &&
+	    iter->revision == iter->trie->revision) {
+		fa   = iter->fa;
+		pos -= iter->pos;
+	} else
+		fa = fib_get_first(seq);
+
+	if (fa)
+		while (pos && (fa = fib_get_next(seq)))
+			--pos;
+	return pos ? NULL : fa;
+}
+
+static void *fib_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	void *v = NULL;
+
+	rcu_read_lock();
+	if (ip_fib_main_table)
+		v = *pos ? fib_get_idx(seq, *pos - 1) : SEQ_START_TOKEN;
+	return v;
+}
+
+static void *fib_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	++*pos;
+	return v == SEQ_START_TOKEN ? fib_get_first(seq) : fib_get_next(seq);
+}
+
+static void fib_seq_stop(struct seq_file *seq, void *v)
+{
+	rcu_read_unlock();
+}
+
+static unsigned fib_flag_trans(int type, u32 mask, struct fib_info *fi)
+{
+	static unsigned type2flags[RTN_MAX + 1] = {
+		[7] = RTF_REJECT, [8] = RTF_REJECT,
+	};
+	unsigned flags = type2flags[type];
+
+	if (fi && fi->fib_nh->nh_gw)
+		flags |= RTF_GATEWAY;
+	if (mask == 0xFFFFFFFF)
+		flags |= RTF_HOST;
+	flags |= RTF_UP;
+	return flags;
+}
+
+/*
+ *	This outputs /proc/net/route.
+ *
+ *	It always works in backward compatibility mode.
+ *	The format of the file is not supposed to be changed.
+ */
+static int fib_seq_show(struct seq_file *seq, void *v)
+{
+	struct fib_iter_state *iter;
+	char bf[128];
+	u32 prefix, mask;
+	unsigned flags;
+	struct fib_alias *fa;
+	struct fib_info *fi;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(seq, "%-127s\n", "Iface\tDestination\tGateway "
+			   "\tFlags\tRefCnt\tUse\tMetric\tMask\t\tMTU"
+			   "\tWindow\tIRTT");
+		goto out;
+	}
+
+	iter	= seq->private;
+	fa	= iter->fa;
+	fi	= fa->fa_info;
+	prefix	= htonl(iter->l->key);
+	mask	= inet_make_mask(iter->li->plen);
+	flags	= fib_flag_trans(fa->fa_type, mask, fi);
+	if (fi)
+		snprintf(bf, sizeof(bf),
+			 "%s\t%08X\t%08X\t%04X\t%d\t%u\t%d\t%08X\t%d\t%u\t%u",
+			 fi->fib_dev ? fi->fib_dev->name : "*", prefix,
+			 fi->fib_nh->nh_gw, flags, 0, 0, fi->fib_priority,
+			 mask, (fi->fib_advmss ? fi->fib_advmss + 40 : 0),
+			 fi->fib_window,
+			 fi->fib_rtt >> 3);
+	else
+		snprintf(bf, sizeof(bf),
+			 "*\t%08X\t%08X\t%04X\t%d\t%u\t%d\t%08X\t%d\t%u\t%u",
+			 prefix, 0, flags, 0, 0, 0, mask, 0, 0, 0);
+	seq_printf(seq, "%-127s\n", bf);
+out:
+	return 0;
+}
+
+static struct seq_operations fib_seq_ops = {
+	.start  = fib_seq_start,
+	.next   = fib_seq_next,
+	.stop   = fib_seq_stop,
+	.show   = fib_seq_show,
+};
+
+static int fib_seq_open(struct inode *inode, struct file *file)
+{
+	struct seq_file *seq;
+	int rc = -ENOMEM;
+	struct fib_iter_state *s = kmalloc(sizeof(*s), GFP_KERNEL);
+
+	if (!s)
+		goto out;
+
+	rc = seq_open(file, &fib_seq_ops);
+	if (rc)
+		goto out_kfree;
+
+	seq	     = file->private_data;
+	seq->private = s;
+	memset(s, 0, sizeof(*s));
+out:
+	return rc;
+out_kfree:
+	kfree(s);
+	goto out;
+}
+
+static struct file_operations fib_seq_fops = {
+	.owner		= THIS_MODULE,
+	.open           = fib_seq_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release	= seq_release_private,
+};
+
+struct trie_stat {
+	unsigned int	totdepth;
+	unsigned int	maxdepth;
+	unsigned int	tnodes;
+	unsigned int	leaves;
+	unsigned int	prefixes;
+	unsigned int	nullpointers;
+	unsigned int	memory;
+	unsigned int	nodesizes[TNODE_MAX_BITS + 1];
+};
+
+static void trie_collect_stats(struct trie *t, struct trie_stat *s)
+{
+	struct node *n;
+
+	memset(s, 0, sizeof(*s));
+
+	rcu_read_lock();
+	for (n = rcu_dereference(t->trie); n; n = trie_nextnode(n)) {
+		if (IS_LEAF(n)) {
+			struct leaf *l = (struct leaf *) n;
+			struct leaf_info *li;
+			struct tnode *p;
+			unsigned int depth = 0;
+
+			for (p = NODE_PARENT(n); p; p = NODE_PARENT(p))
+				depth++;
+			s->leaves++;
+			s->totdepth += depth;
+			if (depth > s->maxdepth)
+				s->maxdepth = depth;
+			s->memory += sizeof(struct leaf);
+			list_for_each_entry_rcu(li, &l->list, list) {
+				s->prefixes++;
+				s->memory += sizeof(struct leaf_info);
+			}
+		} else {
+			struct tnode *tn = (struct tnode *) n;
+
+			s->tnodes++;
+			if (tn->bits <= TNODE_MAX_BITS)
+				s->nodesizes[tn->bits]++;
+			s->nullpointers += tn->empty_children;
+			s->memory += tnode_size(tn->bits);
+		}
+	}
+	rcu_read_unlock();
+}
+
+static void trie_show_stats(struct seq_file *seq, const char *name,
+			    struct fib_table *tb)
+{
+	struct trie_stat s;
+	unsigned int i, avdepth, pointers = 0;
+
+	trie_collect_stats((struct trie *) tb->tb_data, &s);
+
+	avdepth = s.leaves ? s.totdepth * 100 / s.leaves : 0;
+	for (i = 1; i <= TNODE_MAX_BITS; i++)
+		pointers += s.nodesizes[i] << i;
+
+	seq_printf(seq, "%s:\n", name);
+	seq_printf(seq, "\tAver depth:     %u.%02u\n",
+		   avdepth / 100, avdepth % 100);
+	seq_printf(seq, "\tMax depth:      %u\n", s.maxdepth);
+	seq_printf(seq, "\tLeaves:         %u\n", s.leaves);
+	seq_printf(seq, "\tPrefixes:       %u\n", s.prefixes);
+	seq_printf(seq, "\tInternal nodes: %u\n\t ", s.tnodes);
+	for (i = 1; i <= TNODE_MAX_BITS; i++)
+		if (s.nodesizes[i])
+			seq_printf(seq, " %u: %u", i, s.nodesizes[i]);
+	seq_printf(seq, "\n");
+	seq_printf(seq, "\tPointers:       %u\n", pointers);
+	seq_printf(seq, "\tNull ptrs:      %u\n", s.nullpointers);
+	seq_printf(seq, "\tTotal size:     %u kB\n", (s.memory + 1023) / 1024);
+}
+
+/*
+ *	This outputs /proc/net/fib_triestat, the shape of the tries:
+ *	depth of the leaves, node counts and sizes (by log2 of the
+ *	number of children) and the memory they take.
+ */
+static int fib_triestat_seq_show(struct seq_file *seq, void *v)
+{
+#ifdef CONFIG_IP_MULTIPLE_TABLES
+	int id;
+#endif
+
+	seq_printf(seq, "Basic info: size of leaf: %u bytes, "
+		   "size of tnode: %u bytes.\n",
+		   (unsigned int) sizeof(struct leaf),
+		   (unsigned int) sizeof(struct tnode));
+
+#ifdef CONFIG_IP_MULTIPLE_TABLES
+	for (id = RT_TABLE_MAX; id > 0; id--) {
+		char name[16];
+
+		if (!fib_tables[id])
+			continue;
+		if (id == RT_TABLE_LOCAL)
+			strcpy(name, "Local");
+		else if (id == RT_TABLE_MAIN)
+			strcpy(name, "Main");
+		else
+			sprintf(name, "Table %d", id);
+		trie_show_stats(seq, name, fib_tables[id]);
+	}
+#else
+	if (ip_fib_local_table)
+		trie_show_stats(seq, "Local", ip_fib_local_table);
+	if (ip_fib_main_table)
+		trie_show_stats(seq, "Main", ip_fib_main_table);
+#endif
+	return 0;
+}
+
+static int fib_triestat_seq_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, fib_triestat_seq_show, NULL);
+}
+
+static struct file_operations fib_triestat_fops = {
+	.owner		= THIS_MODULE,
+	.open		= fib_triestat_seq_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int __init fib_proc_init(void)
+{
+	if (!proc_net_fops_create("route", S_IRUGO, &fib_seq_fops))
+		goto out1;
+	if (!proc_net_fops_create("fib_triestat", S_IRUGO, &fib_triestat_fops))
+		goto out2;
+	return 0;
+
+out2:
+	proc_net_remove("route");
+out1:
+	return -ENOMEM;
+}
+
+void __init fib_proc_exit(void)
+{
+	proc_net_remove("fib_triestat");
+	proc_net_remove("route");
+}
+#endif /* CONFIG_PROC_FS */
@@ -20,6 +20,8 @@
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/net.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 #include <net/inetpeer.h>
 
 /*
@@ -53,9 +55,10 @@
  *  lookups performed with disabled BHs.
  *
  *  Serialisation issues.
- *  1.  Nodes may appear in the tree only with the pool write lock held.
- *  2.  Nodes may disappear from the tree only with the pool write lock held
- *      AND reference count being 0.
+ *  1.  Nodes may appear in the tree only with the pool seqlock held.
+ *  2.  Nodes may disappear from the tree only with the pool seqlock held
+ *      AND reference count being 0, and are freed an RCU grace period
+ *      later.
  *  3.  Nodes appears and disappears from unused node list only under
  *      "inet_peer_unused_lock".
  *  4.  Global variable peer_total is modified under the pool lock.
@@ -64,9 +67,19 @@
  *		unused_next, unused_prevp: unused node list lock
  *		refcnt: atomically against modifications on other CPU;
  *		   usually under some other lock to prevent node disappearing
+ *		dead: pool lock
  *		dtime: unused node list lock
  *		v4daddr: unchangeable
  *		ip_id_count: idlock
+ *
+ *  Lookups walk the tree under rcu_read_lock_bh() only.  A rebalance
+ *  under way can make such a walk miss a node that is there, so a miss
+ *  is trusted only if the seqlock did not move meanwhile, and is
+ *  otherwise done again under the lock.  A node found without the lock
+ *  can be in the middle of being unlinked: the unlinker sets "dead"
+ *  before looking at the reference count, and the lookup takes its
+ *  reference before looking at "dead", so at least one of the two sees
+ *  the other and backs off.
  */
 
 /* Exported for inet_getid inline function.  */
@@ -82,7 +95,7 @@ static struct inet_peer peer_fake_node = {
 };
 #define peer_avl_empty (&peer_fake_node)
 static struct inet_peer *peer_root = peer_avl_empty;
-static DEFINE_RWLOCK(peer_pool_lock);
+static seqlock_t peer_pool_lock = SEQLOCK_UNLOCKED;
 #define PEER_MAXDEPTH 40 /* sufficient for about 2^27 nodes */
 
 static volatile int peer_total;
@@ -176,6 +189,36 @@ static void unlink_from_unused(struct inet_peer *p)
 	u;							\
 })
 
+/*
+ * Called under rcu_read_lock_bh().  Returns the node for daddr with a
+ * reference held, or NULL; a concurrent rebalance can make it miss.
+ * The walk is bounded, as a rotation could take it round in a circle.
+ */
+static struct inet_peer *lookup_rcu_bh(__u32 daddr)
+{
+	struct inet_peer *u = rcu_dereference(peer_root);
+	int count = 0;
+
+	while (u != peer_avl_empty) {
+		if (daddr == u->v4daddr) {
+			atomic_inc(&u->refcnt);
+			smp_mb__after_atomic_inc();
+			if (unlikely(u->dead)) {
+				atomic_dec(&u->refcnt);
+				return NULL;
+			}
+			return u;
+		}
+		if (daddr < u->v4daddr)
+			u = rcu_dereference(u->avl_left);
+		else
+			u = rcu_dereference(u->avl_right);
+		if (unlikely(++count == PEER_MAXDEPTH))
+			break;
+	}
+	return NULL;
+}
+
 /* Called with local BH disabled and the pool write lock held. */
 #define lookup_rightempty(start)				\
 ({								\
@@ -274,10 +317,16 @@ do {								\
 	n->avl_height = 1;					\
 	n->avl_left = peer_avl_empty;				\
 	n->avl_right = peer_avl_empty;				\
-	**--stackptr = n;					\
+	n->dead = 0;						\
+	rcu_assign_pointer(**--stackptr, n);			\
 	peer_avl_rebalance(stack, stackptr);			\
 } while(0)
 
+static void peer_free_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(peer_cachep, container_of(head, struct inet_peer, rcu));
+}
+
 /* May be called with local BH enabled. */
 static void unlink_from_pool(struct inet_peer *p)
 {
@@ -285,12 +334,15 @@ static void unlink_from_pool(struct inet_peer *p)
 
 	do_free = 0;
 
-	write_lock_bh(&peer_pool_lock);
+	write_seqlock_bh(&peer_pool_lock);
 	/* Check the reference counter.  It was artificially incremented by 1
 	 * in cleanup() function to prevent sudden disappearing.  If the
 	 * reference count is still 1 then the node is referenced only as `p'
 	 * here and from the pool.  So under the exclusive pool lock it's safe
-	 * to remove the node and free it later. */
+	 * to remove the node and free it later.  A lockless lookup may be
+	 * taking a reference right now: see "dead" above. */
+	p->dead = 1;
+	smp_mb();
 	if (atomic_read(&p->refcnt) == 1) {
 		struct inet_peer **stack[PEER_MAXDEPTH];
 		struct inet_peer ***stackptr, ***delp;
@@ -321,11 +373,12 @@ static void unlink_from_pool(struct inet_peer *p)
 		peer_avl_rebalance(stack, stackptr);
 		peer_total--;
 		do_free = 1;
-	}
-	write_unlock_bh(&peer_pool_lock);
+	} else
+		p->dead = 0;
+	write_sequnlock_bh(&peer_pool_lock);
 
 	if (do_free)
-		kmem_cache_free(peer_cachep, p);
+		call_rcu_bh(&p->rcu, peer_free_rcu);
 	else
 		/* The node is used again.  Decrease the reference counter
 		 * back.  The loop "cleanup -> unlink_from_unused
@@ -377,21 +430,32 @@ struct inet_peer *inet_getpeer(__u32 daddr, int create)
 {
 	struct inet_peer *p, *n;
 	struct inet_peer **stack[PEER_MAXDEPTH], ***stackptr;
+	unsigned int seq;
+	int invalidated;
 
-	/* Look up for the address quickly. */
-	read_lock_bh(&peer_pool_lock);
-	p = lookup(daddr);
-	if (p != peer_avl_empty)
-		atomic_inc(&p->refcnt);
-	read_unlock_bh(&peer_pool_lock);
+	/* Look up for the address quickly, without the pool lock. */
+	rcu_read_lock_bh();
+	seq = read_seqbegin(&peer_pool_lock);
+	p = lookup_rcu_bh(daddr);
+	invalidated = read_seqretry(&peer_pool_lock, seq);
+	rcu_read_unlock_bh();
 
-	if (p != peer_avl_empty) {
+	if (p != NULL) {
 		/* The existing node has been found. */
 		/* Remove the entry from unused list if it was there. */
 		unlink_from_unused(p);
 		return p;
 	}
 
+	/* A miss is only certain if the tree did not change under us. */
+	if (invalidated) {
+		write_seqlock_bh(&peer_pool_lock);
+		p = lookup(daddr);
+		if (p != peer_avl_empty)
+			goto out_found;
+		write_sequnlock_bh(&peer_pool_lock);
+	}
+
 	if (!create)
 		return NULL;
 
@@ -404,17 +468,17 @@ struct inet_peer *inet_getpeer(__u32 daddr, int create)
 	n->ip_id_count = secure_ip_id(daddr);
 	n->tcp_ts_stamp = 0;
 
-	write_lock_bh(&peer_pool_lock);
+	write_seqlock_bh(&peer_pool_lock);
 	/* Check if an entry has suddenly appeared. */
 	p = lookup(daddr);
 	if (p != peer_avl_empty)
 		goto out_free;
 
 	/* Link the node. */
-	link_to_pool(n);
 	n->unused_prevp = NULL; /* not on the list */
+	link_to_pool(n);
 	peer_total++;
-	write_unlock_bh(&peer_pool_lock);
+	write_sequnlock_bh(&peer_pool_lock);
 
 	if (peer_total >= inet_peer_threshold)
 		/* Remove one less-recently-used entry. */
@@ -423,13 +487,14 @@ struct inet_peer *inet_getpeer(__u32 daddr, int create)
 	return n;
 
 out_free:
+	/* Free preallocated the preallocated node. */
+	kmem_cache_free(peer_cachep, n);
+out_found:
 	/* The appropriate node is already in the pool. */
 	atomic_inc(&p->refcnt);
-	write_unlock_bh(&peer_pool_lock);
+	write_sequnlock_bh(&peer_pool_lock);
 	/* Remove the entry from unused list if it was there. */
 	unlink_from_unused(p);
-	/* Free preallocated the preallocated node. */
-	kmem_cache_free(peer_cachep, n);
 	return p;
 }
 
@@ -20,6 +20,8 @@
  *		John McDonald	:	0 length frag bug.
  *		Alexey Kuznetsov:	SMP races, threading, cleanup.
  *		Patrick McHardy :	LRU queue of frag heads for evictor.
+ *		xxxx		:	Per-bucket locks, growing hash,
+ *					evictor by age.
  */
 
 #include <linux/config.h>
@@ -34,6 +36,8 @@
 #include <linux/netdevice.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
 #include <net/sock.h>
 #include <net/ip.h>
 #include <net/icmp.h>
@@ -72,7 +76,6 @@ struct ipfrag_skb_cb
 /* Describe an entry in the "incomplete datagrams" queue. */
 struct ipq {
 	struct ipq	*next;		/* linked list pointers			*/
-	struct list_head lru_list;	/* lru list member 			*/
 	u32		user;
 	u32		saddr;
 	u32		daddr;
@@ -96,73 +99,197 @@ struct ipq {
 
 /* Hash table. */
 
-#define IPQ_HASHSZ	64
+/*
+ * Each bucket has its own lock.  The table is replaced as a whole when
+ * it has to grow and when the secret is rebuilt, see ipq_rehash(): the
+ * queues are moved over one old bucket at a time, and a lookup which
+ * finds its old bucket moved goes on to the new table.  Lookups pick
+ * the table up with rcu_dereference(), and an old table is freed once
+ * they are done with it.
+ */
+#define IPQ_HASH_LOG_MIN	6	/* 64 buckets */
+#define IPQ_HASH_LOG_MAX	12
+
+struct ipq_bucket {
+	struct ipq	*chain;
+	spinlock_t	lock;
+};
 
-/* Per-bucket lock is easy to add now. */
-static struct ipq *ipq_hash[IPQ_HASHSZ];
-static DEFINE_RWLOCK(ipfrag_lock);
-static u32 ipfrag_hash_rnd;
-static LIST_HEAD(ipq_lru_list);
-int ip_frag_nqueues = 0;
+struct ipq_table {
+	struct ipq_bucket	*buckets;
+	unsigned int		mask;
+	int			log;
+	u32			rnd;
+	unsigned int		moved;	/* buckets below went to next	*/
+	struct ipq_table	*next;
+};
+
+static struct ipq_table *ipq_table;
+atomic_t ip_frag_nqueues = ATOMIC_INIT(0);
+
+static unsigned int ipqhashfn(struct ipq_table *tbl,
+			      u16 id, u32 saddr, u32 daddr, u8 prot)
+{
+	return jhash_3words((u32)id << 16 | prot, saddr, daddr,
+			    tbl->rnd) & tbl->mask;
+}
+
+/*
+ * Lock the bucket the queue for this key is or goes in.  Called in BH
+ * context under rcu_read_lock(), release with spin_unlock().
+ */
+static struct ipq_bucket *ipq_lock_bucket(u16 id, u32 saddr, u32 daddr,
+					  u8 prot)
+{
+	struct ipq_table *tbl = rcu_dereference(ipq_table);
+	struct ipq_bucket *b;
+	unsigned int hash;
+
+	for (;;) {
+		hash = ipqhashfn(tbl, id, saddr, daddr, prot);
+		b = &tbl->buckets[hash];
+		spin_lock(&b->lock);
+		if (likely(hash >= tbl->moved))
+			return b;
+		spin_unlock(&b->lock);
+		tbl = tbl->next;
+	}
+}
+
+static __inline__ void ipq_link(struct ipq_bucket *b, struct ipq *qp)
+{
+	if ((qp->next = b->chain) != NULL)
+		qp->next->pprev = &qp->next;
+	b->chain = qp;
+	qp->pprev = &b->chain;
+}
 
 static __inline__ void __ipq_unlink(struct ipq *qp)
 {
 	if(qp->next)
 		qp->next->pprev = qp->pprev;
 	*qp->pprev = qp->next;
-	list_del(&qp->lru_list);
-	ip_frag_nqueues--;
 }
 
 static __inline__ void ipq_unlink(struct ipq *ipq)
 {
-	write_lock(&ipfrag_lock);
+	struct ipq_bucket *b;
+
+	rcu_read_lock();
+	b = ipq_lock_bucket(ipq->id, ipq->saddr, ipq->daddr, ipq->protocol);
 	__ipq_unlink(ipq);
-	write_unlock(&ipfrag_lock);
+	spin_unlock(&b->lock);
+	rcu_read_unlock();
+	atomic_dec(&ip_frag_nqueues);
 }
 
-static unsigned int ipqhashfn(u16 id, u32 saddr, u32 daddr, u8 prot)
+/* Two queues a bucket at most, within the limits of the table. */
+static int ipq_hash_log(void)
 {
-	return jhash_3words((u32)id << 16 | prot, saddr, daddr,
-			    ipfrag_hash_rnd) & (IPQ_HASHSZ - 1);
+	int log = IPQ_HASH_LOG_MIN;
+
+	while (log < IPQ_HASH_LOG_MAX &&
+	       (2 << log) < atomic_read(&ip_frag_nqueues))
+		log++;
+	return log;
+}
+
+static struct ipq_table *ipq_table_alloc(int log, int gfp_mask)
+{
+	struct ipq_table *tbl;
+	unsigned int i;
+
+	tbl = kmalloc(sizeof(*tbl), gfp_mask);
+	if (!tbl)
+		return NULL;
+	tbl->buckets = kmalloc(sizeof(struct ipq_bucket) << log, gfp_mask);
+	if (!tbl->buckets) {
+		kfree(tbl);
+		return NULL;
+	}
+
+	tbl->log = log;
+	tbl->mask = (1 << log) - 1;
+	tbl->moved = 0;
+	tbl->next = NULL;
+	for (i = 0; i <= tbl->mask; i++) {
+		tbl->buckets[i].chain = NULL;
+		spin_lock_init(&tbl->buckets[i].lock);
+	}
+	return tbl;
+}
+
+static void ipq_table_free(struct ipq_table *tbl)
+{
+	kfree(tbl->buckets);
+	kfree(tbl);
+}
+
+static DECLARE_MUTEX(ipq_rehash_sem);
+static unsigned long ipq_rehash_secret;
+
+/*
+ * Move all the queues to a new table sized for their number, with a new
+ * secret.  Done when the queues outgrow the table, and every
+ * sysctl_ipfrag_secret_interval, when the table can shrink back.
+ */
+static void ipq_rehash(void *dummy)
+{
+	struct ipq_table *old, *new;
+	unsigned int i;
+	int log;
+
+	down(&ipq_rehash_sem);
+
+	old = ipq_table;
+	log = ipq_hash_log();
+	if (!test_and_clear_bit(0, &ipq_rehash_secret) && log == old->log)
+		goto out;
+
+	new = ipq_table_alloc(log, GFP_KERNEL);
+	if (!new)
+		goto out;
+	get_random_bytes(&new->rnd, sizeof(u32));
+
+	/* Lookups see next, under the lock of a bucket, once it moved. */
+	old->next = new;
+	for (i = 0; i <= old->mask; i++) {
+		struct ipq_bucket *b = &old->buckets[i];
+		struct ipq *qp;
+
+		spin_lock_bh(&b->lock);
+		while ((qp = b->chain) != NULL) {
+			struct ipq_bucket *nb;
+
+			__ipq_unlink(qp);
+			nb = &new->buckets[ipqhashfn(new, qp->id, qp->saddr,
+						     qp->daddr, qp->protocol)];
+			spin_lock(&nb->lock);
+			ipq_link(nb, qp);
+			spin_unlock(&nb->lock);
+		}
+		old->moved = i + 1;
+		spin_unlock_bh(&b->lock);
+	}
+
+	rcu_assign_pointer(ipq_table, new);
+	synchronize_kernel();
+	ipq_table_free(old);
+out:
+	up(&ipq_rehash_sem);
 }
 
+static DECLARE_WORK(ipq_rehash_work, ipq_rehash, NULL);
+
 static struct timer_list ipfrag_secret_timer;
 int sysctl_ipfrag_secret_interval = 10 * 60 * HZ;
 
 static void ipfrag_secret_rebuild(unsigned long dummy)
 {
 	unsigned long now = jiffies;
-	int i;
-
-	write_lock(&ipfrag_lock);
-	get_random_bytes(&ipfrag_hash_rnd, sizeof(u32));
-	for (i = 0; i < IPQ_HASHSZ; i++) {
-		struct ipq *q;
-
-		q = ipq_hash[i];
-		while (q) {
-			struct ipq *next = q->next;
-			unsigned int hval = ipqhashfn(q->id, q->saddr,
-						      q->daddr, q->protocol);
-
-			if (hval != i) {
-				/* Unlink. */
-				if (q->next)
-					q->next->pprev = q->pprev;
-				*q->pprev = q->next;
-
-				/* Relink to new hash chain. */
-				if ((q->next = ipq_hash[hval]) != NULL)
-					q->next->pprev = &q->next;
-				ipq_hash[hval] = q;
-				q->pprev = &ipq_hash[hval];
-			}
 
-			q = next;
-		}
-	}
-	write_unlock(&ipfrag_lock);
+	set_bit(0, &ipq_rehash_secret);
+	schedule_work(&ipq_rehash_work);
 
 	mod_timer(&ipfrag_secret_timer, now + sysctl_ipfrag_secret_interval);
 }
@@ -241,38 +368,55 @@ static void ipq_kill(struct ipq *ipq)
 	}
 }
 
-/* Memory limiting on fragments.  Evictor trashes the oldest 
- * fragment queue until we are back under the threshold.
+/* Memory limiting on fragments.  Evictor goes round the table from
+ * where it stopped last time, and trashes the fragment queues which
+ * have used up half their time, then any, until we are back under the
+ * threshold.  It goes round at most once for each, so that the work
+ * done for a fragment is bounded.
  */
 static void ip_evictor(void)
 {
-	struct ipq *qp;
-	struct list_head *tmp;
-	int work;
+	static unsigned int rover;
+	struct ipq_table *tbl;
+	unsigned int n;
+	int work, pass;
 
 	work = atomic_read(&ip_frag_mem) - sysctl_ipfrag_low_thresh;
 	if (work <= 0)
 		return;
 
-	while (work > 0) {
-		read_lock(&ipfrag_lock);
-		if (list_empty(&ipq_lru_list)) {
-			read_unlock(&ipfrag_lock);
-			return;
+	rcu_read_lock();
+	tbl = rcu_dereference(ipq_table);
+	for (pass = 0; pass < 2 && work > 0; pass++) {
+		unsigned long old = jiffies + sysctl_ipfrag_time / 2;
+
+		for (n = 0; n <= tbl->mask && work > 0; n++) {
+			struct ipq_bucket *b = &tbl->buckets[rover++ & tbl->mask];
+			struct ipq *qp;
+
+			while (work > 0) {
+				spin_lock(&b->lock);
+				for (qp = b->chain; qp; qp = qp->next)
+					if (pass || time_before(qp->timer.expires,
+								old))
+						break;
+				if (qp)
+					atomic_inc(&qp->refcnt);
+				spin_unlock(&b->lock);
+				if (!qp)
+					break;
+
+				spin_lock(&qp->lock);
+				if (!(qp->last_in&COMPLETE))
+					ipq_kill(qp);
+				spin_unlock(&qp->lock);
+
+				ipq_put(qp, &work);
+				IP_INC_STATS_BH(IPSTATS_MIB_REASMFAILS);
+			}
 		}
-		tmp = ipq_lru_list.next;
-		qp = list_entry(tmp, struct ipq, lru_list);
-		atomic_inc(&qp->refcnt);
-		read_unlock(&ipfrag_lock);
-
-		spin_lock(&qp->lock);
-		if (!(qp->last_in&COMPLETE))
-			ipq_kill(qp);
-		spin_unlock(&qp->lock);
-
-		ipq_put(qp, &work);
-		IP_INC_STATS_BH(IPSTATS_MIB_REASMFAILS);
 	}
+	rcu_read_unlock();
 }
 
 /*
@@ -307,49 +451,24 @@ out:
 
 /* Creation primitives. */
 
-static struct ipq *ip_frag_intern(unsigned int hash, struct ipq *qp_in)
+/* Called with the lock of bucket b held, which the lookup missed in. */
+static struct ipq *ip_frag_intern(struct ipq_bucket *b, struct ipq *qp)
 {
-	struct ipq *qp;
-
-	write_lock(&ipfrag_lock);
-#ifdef CONFIG_SMP
-	/* With SMP race we have to recheck hash table, because
-	 * such entry could be created on other cpu, while we
-	 * promoted read lock to write lock.
-	 */
-	for(qp = ipq_hash[hash]; qp; qp = qp->next) {
-		if(qp->id == qp_in->id		&&
-		   qp->saddr == qp_in->saddr	&&
-		   qp->daddr == qp_in->daddr	&&
-		   qp->protocol == qp_in->protocol &&
-		   qp->user == qp_in->user) {
-			atomic_inc(&qp->refcnt);
-			write_unlock(&ipfrag_lock);
-			qp_in->last_in |= COMPLETE;
-			ipq_put(qp_in, NULL);
-			return qp;
-		}
-	}
-#endif
-	qp = qp_in;
-
 	if (!mod_timer(&qp->timer, jiffies + sysctl_ipfrag_time))
 		atomic_inc(&qp->refcnt);
 
 	atomic_inc(&qp->refcnt);
-	if((qp->next = ipq_hash[hash]) != NULL)
-		qp->next->pprev = &qp->next;
-	ipq_hash[hash] = qp;
-	qp->pprev = &ipq_hash[hash];
-	INIT_LIST_HEAD(&qp->lru_list);
-	list_add_tail(&qp->lru_list, &ipq_lru_list);
-	ip_frag_nqueues++;
-	write_unlock(&ipfrag_lock);
+	ipq_link(b, qp);
+	atomic_inc(&ip_frag_nqueues);
+
+	if (unlikely(ipq_hash_log() > rcu_dereference(ipq_table)->log))
+		schedule_work(&ipq_rehash_work);
 	return qp;
 }
 
 /* Add an entry to the 'ipq' queue for a newly received IP datagram. */
-static struct ipq *ip_frag_create(unsigned hash, struct iphdr *iph, u32 user)
+static struct ipq *ip_frag_create(struct ipq_bucket *b, struct iphdr *iph,
+				  u32 user)
 {
 	struct ipq *qp;
 
@@ -374,7 +493,7 @@ static struct ipq *ip_frag_create(unsigned hash, struct iphdr *iph, u32 user)
 	spin_lock_init(&qp->lock);
 	atomic_set(&qp->refcnt, 1);
 
-	return ip_frag_intern(hash, qp);
+	return ip_frag_intern(b, qp);
 
 out_nomem:
 	NETDEBUG(if (net_ratelimit()) printk(KERN_ERR "ip_frag_create: no memory left !\n"));
@@ -390,24 +509,28 @@ static inline struct ipq *ip_find(struct iphdr *iph, u32 user)
 	__u32 saddr = iph->saddr;
 	__u32 daddr = iph->daddr;
 	__u8 protocol = iph->protocol;
-	unsigned int hash = ipqhashfn(id, saddr, daddr, protocol);
+	struct ipq_bucket *b;
 	struct ipq *qp;
 
-	read_lock(&ipfrag_lock);
-	for(qp = ipq_hash[hash]; qp; qp = qp->next) {
+	rcu_read_lock();
+	b = ipq_lock_bucket(id, saddr, daddr, protocol);
+	for(qp = b->chain; qp; qp = qp->next) {
 		if(qp->id == id		&&
 		   qp->saddr == saddr	&&
 		   qp->daddr == daddr	&&
 		   qp->protocol == protocol &&
 		   qp->user == user) {
 			atomic_inc(&qp->refcnt);
-			read_unlock(&ipfrag_lock);
-			return qp;
+			goto out;
 		}
 	}
-	read_unlock(&ipfrag_lock);
 
-	return ip_frag_create(hash, iph, user);
+	/* Created under the bucket lock, so it cannot appear twice. */
+	qp = ip_frag_create(b, iph, user);
+out:
+	spin_unlock(&b->lock);
+	rcu_read_unlock();
+	return qp;
 }
 
 /* Add new segment to existing queue. */
@@ -539,10 +662,6 @@ static void ip_frag_queue(struct ipq *qp, struct sk_buff *skb)
 	if (offset == 0)
 		qp->last_in |= FIRST_IN;
 
-	write_lock(&ipfrag_lock);
-	list_move_tail(&qp->lru_list, &ipq_lru_list);
-	write_unlock(&ipfrag_lock);
-
 	return;
 
 err:
@@ -679,8 +798,11 @@ struct sk_buff *ip_defrag(struct sk_buff *skb, u32 user)
 
 void ipfrag_init(void)
 {
-	ipfrag_hash_rnd = (u32) ((num_physpages ^ (num_physpages>>7)) ^
-				 (jiffies ^ (jiffies >> 6)));
+	ipq_table = ipq_table_alloc(IPQ_HASH_LOG_MIN, GFP_KERNEL);
+	if (!ipq_table)
+		panic("IP: failed to allocate the fragment queue hash\n");
+	ipq_table->rnd = (u32) ((num_physpages ^ (num_physpages>>7)) ^
+				(jiffies ^ (jiffies >> 6)));
 
 	init_timer(&ipfrag_secret_timer);
 	ipfrag_secret_timer.function = ipfrag_secret_rebuild;
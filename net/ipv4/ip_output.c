@@ -84,6 +84,7 @@
 #include <linux/netfilter_bridge.h>
 #include <linux/mroute.h>
 #include <linux/netlink.h>
+#include <linux/err.h>
 
 /*
  *      Shall we try to damage output packets if routing dev changes?
@@ -1326,9 +1327,135 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, struct ip_reply_arg *ar
  *	IP protocol layer initialiser
  */
 
+/*
+ *	Segment a large send: the transport protocol splits the payload,
+ *	each segment then gets its own IP id, length and checksum.
+ */
+static struct sk_buff *inet_gso_segment(struct sk_buff *skb, int sg)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct net_protocol *ipprot;
+	struct iphdr *iph;
+	int ihl, hash;
+	u16 id;
+
+	if (!pskb_may_pull(skb, sizeof(*iph)))
+		goto out;
+
+	iph = skb->nh.iph;
+	ihl = iph->ihl * 4;
+	if (ihl < sizeof(*iph) || !pskb_may_pull(skb, ihl))
+		goto out;
+
+	iph = skb->nh.iph;
+	skb->h.raw = __skb_pull(skb, ihl);
+	id = ntohs(iph->id);
+	hash = iph->protocol & (MAX_INET_PROTOS - 1);
+	segs = ERR_PTR(-EPROTONOSUPPORT);
+
+	rcu_read_lock();
+	ipprot = rcu_dereference(inet_protos[hash]);
+	if (ipprot && ipprot->gso_segment)
+		segs = ipprot->gso_segment(skb, sg);
+	rcu_read_unlock();
+
+	if (IS_ERR(segs))
+		goto out;
+
+	for (skb = segs; skb; skb = skb->next) {
+		iph = skb->nh.iph;
+		iph->id = htons(id++);
+		iph->tot_len = htons(skb->len - (skb->nh.raw - skb->data));
+		iph->check = 0;
+		iph->check = ip_fast_csum((unsigned char *) iph, iph->ihl);
+	}
+
+out:
+	return segs;
+}
+
+/*
+ *	Receive aggregation: only plain, unfragmented packets with no
+ *	options are merged, and only with a held packet of the same
+ *	flow whose IP id precedes theirs.
+ */
+static struct sk_buff **inet_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct net_protocol *ipprot;
+	struct sk_buff *p;
+	struct iphdr *iph;
+	int flush = 1;
+	int hash;
+
+	if (!pskb_may_pull(skb, sizeof(*iph)))
+		goto out;
+
+	iph = skb->nh.iph;
+	if (iph->version != 4 || iph->ihl != 5 ||
+	    (iph->frag_off & htons(IP_MF | IP_OFFSET)) ||
+	    ntohs(iph->tot_len) != skb->len ||
+	    unlikely(ip_fast_csum((u8 *) iph, iph->ihl)))
+		goto out;
+
+	hash = iph->protocol & (MAX_INET_PROTOS - 1);
+
+	rcu_read_lock();
+	ipprot = rcu_dereference(inet_protos[hash]);
+	if (!ipprot || !ipprot->gro_receive)
+		goto out_unlock;
+
+	flush = 0;
+	for (p = *head; p; p = p->next) {
+		struct iphdr *iph2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		iph2 = p->nh.iph;
+		if (iph->protocol != iph2->protocol ||
+		    iph->saddr != iph2->saddr ||
+		    iph->daddr != iph2->daddr) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		/* same flow, but the headers don't allow merging */
+		if (iph->tos != iph2->tos || iph->ttl != iph2->ttl ||
+		    ntohs(iph->id) != (u16) (ntohs(iph2->id) +
+					     NAPI_GRO_CB(p)->count))
+			NAPI_GRO_CB(p)->flush = 1;
+	}
+
+	skb->h.raw = __skb_pull(skb, sizeof(*iph));
+	pp = ipprot->gro_receive(head, skb);
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+	return pp;
+}
+
+static int inet_gro_complete(struct sk_buff *skb)
+{
+	struct iphdr *iph = skb->nh.iph;
+
+	iph->tot_len = htons(skb->len);
+	iph->check = 0;
+	iph->check = ip_fast_csum((unsigned char *) iph, iph->ihl);
+	skb_shinfo(skb)->tso_segs = NAPI_GRO_CB(skb)->count;
+
+	return 0;
+}
+
 static struct packet_type ip_packet_type = {
 	.type = __constant_htons(ETH_P_IP),
 	.func = ip_rcv,
+	.gso_segment = inet_gso_segment,
+	.gro_receive = inet_gro_receive,
+	.gro_complete = inet_gro_complete,
 };
 
 /*
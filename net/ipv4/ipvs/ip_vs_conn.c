@@ -30,14 +30,34 @@
 #include <linux/seq_file.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/seqlock.h>
 
 #include <net/ip_vs.h>
 
 
 /*
- *  Connection hash table: for input and output packets lookups of IPVS
+ *  Connection hash table: for input and output packets lookups of IPVS.
+ *
+ *  Lookups walk the chains under RCU alone.  A conn which is rehashed
+ *  (given a client port, or an invalidated template) may carry a lookup
+ *  onto another chain, so a lookup reaching a chain head other than its
+ *  own starts over.  Resizing moves every conn into a new table, and
+ *  lookups start over when ip_vs_conn_generation changes under them.
  */
-static struct list_head *ip_vs_conn_tab;
+struct ip_vs_conn_tab {
+	unsigned int		size;
+	unsigned int		mask;
+	struct list_head	buckets[0];
+};
+
+static struct ip_vs_conn_tab *ip_vs_conn_tab;
+
+static seqcount_t ip_vs_conn_generation = SEQCNT_ZERO;
+
+/* serialises resizing */
+static DECLARE_MUTEX(ip_vs_conn_resize_sem);
+
+int ip_vs_conn_tab_bits = IP_VS_CONN_TAB_BITS;
 
 /*  SLAB cache for IPVS connections */
 static kmem_cache_t *ip_vs_conn_cachep;
@@ -52,7 +72,10 @@ static atomic_t ip_vs_conn_no_cport_cnt = ATOMIC_INIT(0);
 static unsigned int ip_vs_conn_rnd;
 
 /*
- *  Fine locking granularity for big connection hash table
+ *  Fine locking granularity for big connection hash table.  The locks
+ *  are only taken to change the chains; resizing takes them all.  A
+ *  lock is picked by the low bits of the hash, which are kept by any
+ *  table size, so a writer holding it may read ip_vs_conn_tab.
  */
 #define CT_LOCKARRAY_BITS  4
 #define CT_LOCKARRAY_SIZE  (1<<CT_LOCKARRAY_BITS)
@@ -60,61 +83,86 @@ static unsigned int ip_vs_conn_rnd;
 
 struct ip_vs_aligned_lock
 {
-	rwlock_t	l;
+	spinlock_t	l;
 } __attribute__((__aligned__(SMP_CACHE_BYTES)));
 
 /* lock array for conn table */
 static struct ip_vs_aligned_lock
 __ip_vs_conntbl_lock_array[CT_LOCKARRAY_SIZE] __cacheline_aligned;
 
-static inline void ct_read_lock(unsigned key)
+static inline void ct_lock(unsigned key)
 {
-	read_lock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spin_lock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
-static inline void ct_read_unlock(unsigned key)
+static inline void ct_unlock(unsigned key)
 {
-	read_unlock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spin_unlock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
-static inline void ct_write_lock(unsigned key)
+static inline void ct_lock_bh(unsigned key)
 {
-	write_lock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spin_lock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
-static inline void ct_write_unlock(unsigned key)
+static inline void ct_unlock_bh(unsigned key)
 {
-	write_unlock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spin_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
-static inline void ct_read_lock_bh(unsigned key)
+
+/*
+ *	Returns hash value for IPVS connection entry; its chain is
+ *	picked by the bits of the table's mask.
+ */
+static unsigned int ip_vs_conn_hashkey(unsigned proto, __u32 addr, __u16 port)
 {
-	read_lock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	return jhash_3words(addr, port, proto, ip_vs_conn_rnd);
 }
 
-static inline void ct_read_unlock_bh(unsigned key)
+static inline struct list_head *
+ip_vs_conn_chain(struct ip_vs_conn_tab *tab, unsigned hash)
 {
-	read_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	return &tab->buckets[hash & tab->mask];
 }
 
-static inline void ct_write_lock_bh(unsigned key)
+/*
+ *	Is e the head of one of the chains of tab?
+ */
+static inline int
+ip_vs_conn_tab_head(const struct ip_vs_conn_tab *tab, const struct list_head *e)
 {
-	write_lock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	return (unsigned long)e - (unsigned long)tab->buckets
+		< tab->size * sizeof(struct list_head);
 }
 
-static inline void ct_write_unlock_bh(unsigned key)
+/*
+ *	Must a lockless lookup, which found e while looking for another
+ *	chain head of tab, start over?
+ */
+static inline int
+ip_vs_conn_lost(const struct ip_vs_conn_tab *tab, const struct list_head *e,
+		unsigned seq)
 {
-	write_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	return read_seqcount_retry(&ip_vs_conn_generation, seq)
+		|| ip_vs_conn_tab_head(tab, e);
 }
 
-
 /*
- *	Returns hash value for IPVS connection entry
+ *	Take a reference to a conn found by a lockless lookup.  That fails
+ *	if the conn has been unhashed meanwhile: ip_vs_conn_expire() checks
+ *	the reference count after clearing IP_VS_CONN_F_HASHED, and we
+ *	check the flag after taking our reference, so either it sees our
+ *	reference or we see the flag clear and drop it again.
  */
-static unsigned int ip_vs_conn_hashkey(unsigned proto, __u32 addr, __u16 port)
+static inline int ip_vs_conn_hold(struct ip_vs_conn *cp)
 {
-	return jhash_3words(addr, port, proto, ip_vs_conn_rnd)
-		& IP_VS_CONN_TAB_MASK;
+	atomic_inc(&cp->refcnt);
+	smp_mb__after_atomic_inc();
+	if (likely(cp->flags & IP_VS_CONN_F_HASHED))
+		return 1;
+	atomic_dec(&cp->refcnt);
+	return 0;
 }
 
 
@@ -130,12 +178,12 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 	/* Hash by protocol, client address and port */
 	hash = ip_vs_conn_hashkey(cp->protocol, cp->caddr, cp->cport);
 
-	ct_write_lock(hash);
+	ct_lock(hash);
 
 	if (!(cp->flags & IP_VS_CONN_F_HASHED)) {
-		list_add(&cp->c_list, &ip_vs_conn_tab[hash]);
 		cp->flags |= IP_VS_CONN_F_HASHED;
 		atomic_inc(&cp->refcnt);
+		list_add_rcu(&cp->c_list, ip_vs_conn_chain(ip_vs_conn_tab, hash));
 		ret = 1;
 	} else {
 		IP_VS_ERR("ip_vs_conn_hash(): request for already hashed, "
@@ -143,7 +191,7 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 		ret = 0;
 	}
 
-	ct_write_unlock(hash);
+	ct_unlock(hash);
 
 	return ret;
 }
@@ -161,17 +209,17 @@ static inline int ip_vs_conn_unhash(struct ip_vs_conn *cp)
 	/* unhash it and decrease its reference counter */
 	hash = ip_vs_conn_hashkey(cp->protocol, cp->caddr, cp->cport);
 
-	ct_write_lock(hash);
+	ct_lock(hash);
 
 	if (cp->flags & IP_VS_CONN_F_HASHED) {
-		list_del(&cp->c_list);
+		list_del_rcu(&cp->c_list);
 		cp->flags &= ~IP_VS_CONN_F_HASHED;
 		atomic_dec(&cp->refcnt);
 		ret = 1;
 	} else
 		ret = 0;
 
-	ct_write_unlock(hash);
+	ct_unlock(hash);
 
 	return ret;
 }
@@ -186,25 +234,38 @@ static inline int ip_vs_conn_unhash(struct ip_vs_conn *cp)
 static inline struct ip_vs_conn *__ip_vs_conn_in_get
 (int protocol, __u32 s_addr, __u16 s_port, __u32 d_addr, __u16 d_port)
 {
-	unsigned hash;
+	unsigned hash, seq;
+	struct ip_vs_conn_tab *tab;
+	struct list_head *head, *e;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey(protocol, s_addr, s_port);
 
-	ct_read_lock(hash);
-
-	list_for_each_entry(cp, &ip_vs_conn_tab[hash], c_list) {
+	rcu_read_lock();
+  restart:
+	seq = read_seqcount_begin(&ip_vs_conn_generation);
+	tab = rcu_dereference(ip_vs_conn_tab);
+	head = ip_vs_conn_chain(tab, hash);
+
+	for (e = rcu_dereference(head->next); e != head;
+	     e = rcu_dereference(e->next)) {
+		if (ip_vs_conn_lost(tab, e, seq))
+			goto restart;
+		cp = list_entry(e, struct ip_vs_conn, c_list);
 		if (s_addr==cp->caddr && s_port==cp->cport &&
 		    d_port==cp->vport && d_addr==cp->vaddr &&
 		    protocol==cp->protocol) {
 			/* HIT */
-			atomic_inc(&cp->refcnt);
-			ct_read_unlock(hash);
+			if (!ip_vs_conn_hold(cp))
+				goto restart;
+			rcu_read_unlock();
 			return cp;
 		}
 	}
+	if (read_seqcount_retry(&ip_vs_conn_generation, seq))
+		goto restart;
 
-	ct_read_unlock(hash);
+	rcu_read_unlock();
 
 	return NULL;
 }
@@ -237,7 +298,9 @@ struct ip_vs_conn *ip_vs_conn_in_get
 struct ip_vs_conn *ip_vs_conn_out_get
 (int protocol, __u32 s_addr, __u16 s_port, __u32 d_addr, __u16 d_port)
 {
-	unsigned hash;
+	unsigned hash, seq;
+	struct ip_vs_conn_tab *tab;
+	struct list_head *head, *e;
 	struct ip_vs_conn *cp, *ret=NULL;
 
 	/*
@@ -245,20 +308,31 @@ struct ip_vs_conn *ip_vs_conn_out_get
 	 */
 	hash = ip_vs_conn_hashkey(protocol, d_addr, d_port);
 
-	ct_read_lock(hash);
-
-	list_for_each_entry(cp, &ip_vs_conn_tab[hash], c_list) {
+	rcu_read_lock();
+  restart:
+	seq = read_seqcount_begin(&ip_vs_conn_generation);
+	tab = rcu_dereference(ip_vs_conn_tab);
+	head = ip_vs_conn_chain(tab, hash);
+
+	for (e = rcu_dereference(head->next); e != head;
+	     e = rcu_dereference(e->next)) {
+		if (ip_vs_conn_lost(tab, e, seq))
+			goto restart;
+		cp = list_entry(e, struct ip_vs_conn, c_list);
 		if (d_addr == cp->caddr && d_port == cp->cport &&
 		    s_port == cp->dport && s_addr == cp->daddr &&
 		    protocol == cp->protocol) {
 			/* HIT */
-			atomic_inc(&cp->refcnt);
+			if (!ip_vs_conn_hold(cp))
+				goto restart;
 			ret = cp;
 			break;
 		}
 	}
+	if (!ret && read_seqcount_retry(&ip_vs_conn_generation, seq))
+		goto restart;
 
-	ct_read_unlock(hash);
+	rcu_read_unlock();
 
 	IP_VS_DBG(7, "lookup/out %s %u.%u.%u.%u:%d->%u.%u.%u.%u:%d %s\n",
 		  ip_vs_proto_name(protocol),
@@ -486,6 +560,18 @@ int ip_vs_check_template(struct ip_vs_conn *ct)
 	return 1;
 }
 
+/*
+ *	Free a conn once no lockless lookup can see it any more.
+ */
+static void ip_vs_conn_rcu_free(struct rcu_head *head)
+{
+	struct ip_vs_conn *cp = container_of(head, struct ip_vs_conn,
+					     rcu_head);
+
+	kmem_cache_free(ip_vs_conn_cachep, cp);
+	atomic_dec(&ip_vs_conn_count);
+}
+
 static void ip_vs_conn_expire(unsigned long data)
 {
 	struct ip_vs_conn *cp = (struct ip_vs_conn *)data;
@@ -510,8 +596,10 @@ static void ip_vs_conn_expire(unsigned long data)
 		goto expire_later;
 
 	/*
-	 *	refcnt==1 implies I'm the only one referrer
+	 *	refcnt==1 implies I'm the only one referrer; see
+	 *	ip_vs_conn_hold() for the lookups racing with us
 	 */
+	smp_mb();
 	if (likely(atomic_read(&cp->refcnt) == 1)) {
 		/* delete the timer if it is activated by other users */
 		if (timer_pending(&cp->timer))
@@ -526,9 +614,8 @@ static void ip_vs_conn_expire(unsigned long data)
 		ip_vs_unbind_dest(cp);
 		if (cp->flags & IP_VS_CONN_F_NO_CPORT)
 			atomic_dec(&ip_vs_conn_no_cport_cnt);
-		atomic_dec(&ip_vs_conn_count);
 
-		kmem_cache_free(ip_vs_conn_cachep, cp);
+		call_rcu(&cp->rcu_head, ip_vs_conn_rcu_free);
 		return;
 	}
 
@@ -623,66 +710,69 @@ ip_vs_conn_new(int proto, __u32 caddr, __u16 cport, __u32 vaddr, __u16 vport,
  */
 #ifdef CONFIG_PROC_FS
 
+/*
+ *	The dump runs under RCU.  A conn which is rehashed may lead it to
+ *	another chain, which it takes for the end of its own; a dump which
+ *	races with a resize ends early.
+ */
+struct ip_vs_conn_iter {
+	struct ip_vs_conn_tab	*tab;
+	unsigned int		bucket;
+	unsigned int		seq;
+};
+
+static struct ip_vs_conn *
+ip_vs_conn_iter_next(struct ip_vs_conn_iter *iter, struct list_head *e)
+{
+	struct ip_vs_conn_tab *tab = iter->tab;
+
+	e = rcu_dereference(e->next);
+	while (ip_vs_conn_tab_head(tab, e)) {
+		if (++iter->bucket >= tab->size)
+			return NULL;
+		e = rcu_dereference(tab->buckets[iter->bucket].next);
+	}
+	if (read_seqcount_retry(&ip_vs_conn_generation, iter->seq))
+		return NULL;
+	return list_entry(e, struct ip_vs_conn, c_list);
+}
+
 static void *ip_vs_conn_array(struct seq_file *seq, loff_t pos)
 {
-	int idx;
+	struct ip_vs_conn_iter *iter = seq->private;
 	struct ip_vs_conn *cp;
-	
-	for(idx = 0; idx < IP_VS_CONN_TAB_SIZE; idx++) {
-		ct_read_lock_bh(idx);
-		list_for_each_entry(cp, &ip_vs_conn_tab[idx], c_list) {
-			if (pos-- == 0) {
-				seq->private = &ip_vs_conn_tab[idx];
-				return cp;
-			}
-		}
-		ct_read_unlock_bh(idx);
-	}
 
-	return NULL;
+	iter->bucket = 0;
+	cp = ip_vs_conn_iter_next(iter, &iter->tab->buckets[0]);
+	while (cp && pos-- > 0)
+		cp = ip_vs_conn_iter_next(iter, &cp->c_list);
+	return cp;
 }
 
 static void *ip_vs_conn_seq_start(struct seq_file *seq, loff_t *pos)
 {
-	seq->private = NULL;
+	struct ip_vs_conn_iter *iter = seq->private;
+
+	rcu_read_lock_bh();
+	iter->seq = read_seqcount_begin(&ip_vs_conn_generation);
+	iter->tab = rcu_dereference(ip_vs_conn_tab);
 	return *pos ? ip_vs_conn_array(seq, *pos - 1) :SEQ_START_TOKEN;
 }
 
 static void *ip_vs_conn_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 {
 	struct ip_vs_conn *cp = v;
-	struct list_head *e, *l = seq->private;
-	int idx;
 
 	++*pos;
 	if (v == SEQ_START_TOKEN) 
 		return ip_vs_conn_array(seq, 0);
 
-	/* more on same hash chain? */
-	if ((e = cp->c_list.next) != l)
-		return list_entry(e, struct ip_vs_conn, c_list);
-
-	idx = l - ip_vs_conn_tab;
-	ct_read_unlock_bh(idx);
-
-	while (++idx < IP_VS_CONN_TAB_SIZE) {
-		ct_read_lock_bh(idx);
-		list_for_each_entry(cp, &ip_vs_conn_tab[idx], c_list) {
-			seq->private = &ip_vs_conn_tab[idx];
-			return cp;
-		}	
-		ct_read_unlock_bh(idx);
-	}
-	seq->private = NULL;
-	return NULL;
+	return ip_vs_conn_iter_next(seq->private, &cp->c_list);
 }
 
 static void ip_vs_conn_seq_stop(struct seq_file *seq, void *v)
 {
-	struct list_head *l = seq->private;
-
-	if (l)
-		ct_read_unlock_bh(l - ip_vs_conn_tab);
+	rcu_read_unlock_bh();
 }
 
 static int ip_vs_conn_seq_show(struct seq_file *seq, void *v)
@@ -715,7 +805,20 @@ static struct seq_operations ip_vs_conn_seq_ops = {
 
 static int ip_vs_conn_open(struct inode *inode, struct file *file)
 {
-	return seq_open(file, &ip_vs_conn_seq_ops);
+	struct ip_vs_conn_iter *iter;
+	int rc;
+
+	iter = kmalloc(sizeof(*iter), GFP_KERNEL);
+	if (!iter)
+		return -ENOMEM;
+
+	rc = seq_open(file, &ip_vs_conn_seq_ops);
+	if (rc) {
+		kfree(iter);
+		return rc;
+	}
+	((struct seq_file *)file->private_data)->private = iter;
+	return 0;
 }
 
 static struct file_operations ip_vs_conn_fops = {
@@ -723,7 +826,7 @@ static struct file_operations ip_vs_conn_fops = {
 	.open    = ip_vs_conn_open,
 	.read    = seq_read,
 	.llseek  = seq_lseek,
-	.release = seq_release,
+	.release = seq_release_private,
 };
 #endif
 
@@ -760,24 +863,40 @@ static inline int todrop_entry(struct ip_vs_conn *cp)
 }
 
 
+/*
+ *	Can a walk of chain, which let go of the locks to expire cp, go on
+ *	from cp?  Not if cp has been unhashed or moved meanwhile.
+ */
+static inline int
+ip_vs_conn_on_chain(struct ip_vs_conn *cp, struct list_head *chain)
+{
+	return (cp->flags & IP_VS_CONN_F_HASHED) &&
+		ip_vs_conn_chain(ip_vs_conn_tab,
+				 ip_vs_conn_hashkey(cp->protocol, cp->caddr,
+						    cp->cport)) == chain;
+}
+
+
 void ip_vs_random_dropentry(void)
 {
 	int idx;
+	struct list_head *chain;
 	struct ip_vs_conn *cp;
 	struct ip_vs_conn *ct;
 
 	/*
 	 * Randomly scan 1/32 of the whole table every second
 	 */
-	for (idx = 0; idx < (IP_VS_CONN_TAB_SIZE>>5); idx++) {
-		unsigned hash = net_random() & IP_VS_CONN_TAB_MASK;
+	for (idx = 0; idx < (ip_vs_conn_tab->size>>5); idx++) {
+		unsigned hash = net_random();
 
 		/*
 		 *  Lock is actually needed in this loop.
 		 */
-		ct_write_lock(hash);
+		ct_lock(hash);
+		chain = ip_vs_conn_chain(ip_vs_conn_tab, hash);
 
-		list_for_each_entry(cp, &ip_vs_conn_tab[hash], c_list) {
+		list_for_each_entry(cp, chain, c_list) {
 			if (!cp->cport && !(cp->flags & IP_VS_CONN_F_NO_CPORT))
 				/* connection template */
 				continue;
@@ -805,7 +924,7 @@ void ip_vs_random_dropentry(void)
 			 * Drop the entry, and drop its ct if not referenced
 			 */
 			atomic_inc(&cp->refcnt);
-			ct_write_unlock(hash);
+			ct_unlock(hash);
 
 			if ((ct = cp->control))
 				atomic_inc(&ct->refcnt);
@@ -815,9 +934,11 @@ void ip_vs_random_dropentry(void)
 				IP_VS_DBG(4, "del conn template\n");
 				ip_vs_conn_expire_now(ct);
 			}
-			ct_write_lock(hash);
+			ct_lock(hash);
+			if (!ip_vs_conn_on_chain(cp, chain))
+				break;
 		}
-		ct_write_unlock(hash);
+		ct_unlock(hash);
 	}
 }
 
@@ -828,19 +949,23 @@ void ip_vs_random_dropentry(void)
 static void ip_vs_conn_flush(void)
 {
 	int idx;
+	struct list_head *chain;
 	struct ip_vs_conn *cp;
 	struct ip_vs_conn *ct;
 
   flush_again:
-	for (idx=0; idx<IP_VS_CONN_TAB_SIZE; idx++) {
+	for (idx=0; idx<ip_vs_conn_tab->size; idx++) {
 		/*
-		 *  Lock is actually needed in this loop.
+		 *  Lock is actually needed in this loop.  RCU keeps the
+		 *  entries around while we let go of it.
 		 */
-		ct_write_lock_bh(idx);
+		ct_lock_bh(idx);
+		rcu_read_lock();
+		chain = &ip_vs_conn_tab->buckets[idx];
 
-		list_for_each_entry(cp, &ip_vs_conn_tab[idx], c_list) {
+		list_for_each_entry(cp, chain, c_list) {
 			atomic_inc(&cp->refcnt);
-			ct_write_unlock(idx);
+			ct_unlock(idx);
 
 			if ((ct = cp->control))
 				atomic_inc(&ct->refcnt);
@@ -850,13 +975,17 @@ static void ip_vs_conn_flush(void)
 				IP_VS_DBG(4, "del conn template\n");
 				ip_vs_conn_expire_now(ct);
 			}
-			ct_write_lock(idx);
+			ct_lock(idx);
+			if (!ip_vs_conn_on_chain(cp, chain))
+				break;
 		}
-		ct_write_unlock_bh(idx);
+		rcu_read_unlock();
+		ct_unlock_bh(idx);
 	}
 
 	/* the counter may be not NULL, because maybe some conn entries
-	   are run by slow timer handler or unhashed but still referred */
+	   are run by slow timer handler or unhashed but still referred,
+	   or not yet freed after a grace period */
 	if (atomic_read(&ip_vs_conn_count) != 0) {
 		schedule();
 		goto flush_again;
@@ -864,6 +993,79 @@ static void ip_vs_conn_flush(void)
 }
 
 
+static struct ip_vs_conn_tab *ip_vs_conn_tab_alloc(int bits)
+{
+	struct ip_vs_conn_tab *tab;
+	unsigned int idx, size = 1 << bits;
+
+	tab = vmalloc(sizeof(*tab) + size*sizeof(struct list_head));
+	if (!tab)
+		return NULL;
+
+	tab->size = size;
+	tab->mask = size - 1;
+	for (idx = 0; idx < size; idx++) {
+		INIT_LIST_HEAD(&tab->buckets[idx]);
+	}
+	return tab;
+}
+
+
+/*
+ *	Move every connection into a table of 2^bits entries.  Process
+ *	context only.
+ */
+int ip_vs_conn_resize(int bits)
+{
+	struct ip_vs_conn_tab *tab, *old;
+	struct ip_vs_conn *cp, *next;
+	unsigned idx, hash;
+
+	if (bits < IP_VS_CONN_TAB_BITS_MIN || bits > IP_VS_CONN_TAB_BITS_MAX)
+		return -EINVAL;
+
+	tab = ip_vs_conn_tab_alloc(bits);
+	if (!tab)
+		return -ENOMEM;
+
+	down(&ip_vs_conn_resize_sem);
+
+	/* hold off everybody changing the chains */
+	local_bh_disable();
+	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)
+		ct_lock(idx);
+	write_seqcount_begin(&ip_vs_conn_generation);
+
+	old = ip_vs_conn_tab;
+	for (idx = 0; idx < old->size; idx++) {
+		list_for_each_entry_safe(cp, next, &old->buckets[idx], c_list) {
+			hash = ip_vs_conn_hashkey(cp->protocol,
+						  cp->caddr, cp->cport);
+			list_del_rcu(&cp->c_list);
+			list_add_rcu(&cp->c_list, ip_vs_conn_chain(tab, hash));
+		}
+	}
+	rcu_assign_pointer(ip_vs_conn_tab, tab);
+	ip_vs_conn_tab_bits = bits;
+
+	write_seqcount_end(&ip_vs_conn_generation);
+	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)
+		ct_unlock(idx);
+	local_bh_enable();
+
+	up(&ip_vs_conn_resize_sem);
+
+	IP_VS_INFO("Connection hash table resized "
+		   "(size=%d, memory=%ldKbytes)\n", tab->size,
+		   (long)(tab->size*sizeof(struct list_head))/1024);
+
+	/* wait for the lookups still walking the old table */
+	synchronize_kernel();
+	vfree(old);
+	return 0;
+}
+
+
 int ip_vs_conn_init(void)
 {
 	int idx;
@@ -871,7 +1073,7 @@ int ip_vs_conn_init(void)
 	/*
 	 * Allocate the connection hash table and initialize its list heads
 	 */
-	ip_vs_conn_tab = vmalloc(IP_VS_CONN_TAB_SIZE*sizeof(struct list_head));
+	ip_vs_conn_tab = ip_vs_conn_tab_alloc(ip_vs_conn_tab_bits);
 	if (!ip_vs_conn_tab)
 		return -ENOMEM;
 
@@ -886,17 +1088,13 @@ int ip_vs_conn_init(void)
 
 	IP_VS_INFO("Connection hash table configured "
 		   "(size=%d, memory=%ldKbytes)\n",
-		   IP_VS_CONN_TAB_SIZE,
-		   (long)(IP_VS_CONN_TAB_SIZE*sizeof(struct list_head))/1024);
+		   ip_vs_conn_tab->size,
+		   (long)(ip_vs_conn_tab->size*sizeof(struct list_head))/1024);
 	IP_VS_DBG(0, "Each connection entry needs %Zd bytes at least\n",
 		  sizeof(struct ip_vs_conn));
 
-	for (idx = 0; idx < IP_VS_CONN_TAB_SIZE; idx++) {
-		INIT_LIST_HEAD(&ip_vs_conn_tab[idx]);
-	}
-
 	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)  {
-		rwlock_init(&__ip_vs_conntbl_lock_array[idx].l);
+		spin_lock_init(&__ip_vs_conntbl_lock_array[idx].l);
 	}
 
 	proc_net_fops_create("ip_vs_conn", 0, &ip_vs_conn_fops);
@@ -1389,6 +1389,29 @@ proc_do_sync_threshold(ctl_table *table, int write, struct file *filp,
 }
 
 
+static int
+proc_do_conn_tab_bits(ctl_table *table, int write, struct file *filp,
+		      void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int *valp = table->data;
+	int val = *valp;
+	int rc;
+
+	rc = proc_dointvec(table, write, filp, buffer, lenp, ppos);
+	if (write && (*valp != val)) {
+		int bits = *valp;
+
+		/* ip_vs_conn_resize() sets it once the table is in place */
+		*valp = val;
+		rc = ip_vs_conn_resize(bits);
+	}
+	return rc;
+}
+
+static int ip_vs_sync_threads_min = 1;
+static int ip_vs_sync_threads_max = IP_VS_SYNC_THREADS_MAX;
+
+
 /*
  *	IPVS sysctl table (under the /proc/sys/net/ipv4/vs/)
  */
@@ -1574,6 +1597,25 @@ static struct ctl_table vs_vars[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_do_sync_threshold,
 	},
+	{
+		.ctl_name	= NET_IPV4_VS_SYNC_THREADS,
+		.procname	= "sync_threads",
+		.data		= &sysctl_ip_vs_sync_threads,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &ip_vs_sync_threads_min,
+		.extra2		= &ip_vs_sync_threads_max,
+	},
+	{
+		.ctl_name	= NET_IPV4_VS_CONN_TAB_BITS,
+		.procname	= "conn_tab_bits",
+		.data		= &ip_vs_conn_tab_bits,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_do_conn_tab_bits,
+	},
 	{
 		.ctl_name	= NET_IPV4_VS_NAT_ICMP_SEND,
 		.procname	= "nat_icmp_send",
@@ -117,13 +117,36 @@ struct ip_vs_sync_buff {
 };
 
 
-/* the sync_buff list head and the lock */
-static LIST_HEAD(ip_vs_sync_queue);
-static DEFINE_SPINLOCK(ip_vs_sync_lock);
+/*
+ *	Each CPU fills a sync_buff of its own.  A full one goes on the
+ *	queue of one of the master threads, picked by the CPU, which sends
+ *	it at once; each thread also sends the partly filled buffers of
+ *	its CPUs every so often.  The per-CPU lock is only contended by
+ *	that thread.
+ */
+struct ip_vs_sync_cpu {
+	spinlock_t		lock;
+	struct ip_vs_sync_buff	*sb;
+};
+
+static DEFINE_PER_CPU(struct ip_vs_sync_cpu, ip_vs_sync_cpu) = {
+	.lock	= SPIN_LOCK_UNLOCKED,
+};
+
+struct ip_vs_sync_master {
+	spinlock_t		lock;
+	struct list_head	queue;
+	wait_queue_head_t	wait;
+};
+
+static struct ip_vs_sync_master sync_masters[IP_VS_SYNC_THREADS_MAX];
 
-/* current sync_buff for accepting new conn entries */
-static struct ip_vs_sync_buff   *curr_sb = NULL;
-static DEFINE_SPINLOCK(curr_sb_lock);
+/* master threads started, and still running */
+static int sync_master_threads;
+static atomic_t sync_master_running = ATOMIC_INIT(0);
+
+/* master threads to start, under /proc/sys/net/ipv4/vs/sync_threads */
+int sysctl_ip_vs_sync_threads = 1;
 
 /* ipvs sync daemon state */
 volatile int ip_vs_sync_state = IP_VS_STATE_NONE;
@@ -140,25 +163,29 @@ static struct sockaddr_in mcast_addr;
 
 static inline void sb_queue_tail(struct ip_vs_sync_buff *sb)
 {
-	spin_lock(&ip_vs_sync_lock);
-	list_add_tail(&sb->list, &ip_vs_sync_queue);
-	spin_unlock(&ip_vs_sync_lock);
+	struct ip_vs_sync_master *m;
+
+	m = &sync_masters[smp_processor_id() % sync_master_threads];
+	spin_lock(&m->lock);
+	list_add_tail(&sb->list, &m->queue);
+	spin_unlock(&m->lock);
+	wake_up(&m->wait);
 }
 
-static inline struct ip_vs_sync_buff * sb_dequeue(void)
+static inline struct ip_vs_sync_buff * sb_dequeue(struct ip_vs_sync_master *m)
 {
 	struct ip_vs_sync_buff *sb;
 
-	spin_lock_bh(&ip_vs_sync_lock);
-	if (list_empty(&ip_vs_sync_queue)) {
+	spin_lock_bh(&m->lock);
+	if (list_empty(&m->queue)) {
 		sb = NULL;
 	} else {
-		sb = list_entry(ip_vs_sync_queue.next,
+		sb = list_entry(m->queue.next,
 				struct ip_vs_sync_buff,
 				list);
 		list_del(&sb->list);
 	}
-	spin_unlock_bh(&ip_vs_sync_lock);
+	spin_unlock_bh(&m->lock);
 
 	return sb;
 }
@@ -190,22 +217,23 @@ static inline void ip_vs_sync_buff_release(struct ip_vs_sync_buff *sb)
 }
 
 /*
- *	Get the current sync buffer if it has been created for more
- *	than the specified time or the specified time is zero.
+ *	Get the current sync buffer of a CPU if it has been created for
+ *	more than the specified time or the specified time is zero.
  */
 static inline struct ip_vs_sync_buff *
-get_curr_sync_buff(unsigned long time)
+get_curr_sync_buff(int cpu, unsigned long time)
 {
+	struct ip_vs_sync_cpu *sc = &per_cpu(ip_vs_sync_cpu, cpu);
 	struct ip_vs_sync_buff *sb;
 
-	spin_lock_bh(&curr_sb_lock);
-	if (curr_sb && (time == 0 ||
-			time_before(jiffies - curr_sb->firstuse, time))) {
-		sb = curr_sb;
-		curr_sb = NULL;
+	spin_lock_bh(&sc->lock);
+	if (sc->sb && (time == 0 ||
+		       time_before(jiffies - sc->sb->firstuse, time))) {
+		sb = sc->sb;
+		sc->sb = NULL;
 	} else
 		sb = NULL;
-	spin_unlock_bh(&curr_sb_lock);
+	spin_unlock_bh(&sc->lock);
 	return sb;
 }
 
@@ -216,14 +244,17 @@ get_curr_sync_buff(unsigned long time)
  */
 void ip_vs_sync_conn(struct ip_vs_conn *cp)
 {
+	struct ip_vs_sync_cpu *sc;
+	struct ip_vs_sync_buff *sb, *full = NULL;
 	struct ip_vs_sync_mesg *m;
 	struct ip_vs_sync_conn *s;
 	int len;
 
-	spin_lock(&curr_sb_lock);
-	if (!curr_sb) {
-		if (!(curr_sb=ip_vs_sync_buff_create())) {
-			spin_unlock(&curr_sb_lock);
+	sc = &__get_cpu_var(ip_vs_sync_cpu);
+	spin_lock(&sc->lock);
+	if (!(sb = sc->sb)) {
+		if (!(sb = sc->sb = ip_vs_sync_buff_create())) {
+			spin_unlock(&sc->lock);
 			IP_VS_ERR("ip_vs_sync_buff_create failed.\n");
 			return;
 		}
@@ -231,8 +262,8 @@ void ip_vs_sync_conn(struct ip_vs_conn *cp)
 
 	len = (cp->flags & IP_VS_CONN_F_SEQ_MASK) ? FULL_CONN_SIZE :
 		SIMPLE_CONN_SIZE;
-	m = curr_sb->mesg;
-	s = (struct ip_vs_sync_conn *)curr_sb->head;
+	m = sb->mesg;
+	s = (struct ip_vs_sync_conn *)sb->head;
 
 	/* copy members */
 	s->protocol = cp->protocol;
@@ -252,14 +283,17 @@ void ip_vs_sync_conn(struct ip_vs_conn *cp)
 
 	m->nr_conns++;
 	m->size += len;
-	curr_sb->head += len;
+	sb->head += len;
 
 	/* check if there is a space for next one */
-	if (curr_sb->head+FULL_CONN_SIZE > curr_sb->end) {
-		sb_queue_tail(curr_sb);
-		curr_sb = NULL;
+	if (sb->head+FULL_CONN_SIZE > sb->end) {
+		full = sb;
+		sc->sb = NULL;
 	}
-	spin_unlock(&curr_sb_lock);
+	spin_unlock(&sc->lock);
+
+	if (full)
+		sb_queue_tail(full);
 
 	/* synchronize its controller if it has */
 	if (cp->control)
@@ -573,17 +607,28 @@ ip_vs_send_async(struct socket *sock, const char *buffer, const size_t length)
 	return len;
 }
 
+/* times a master thread waits for room in its socket for a message */
+#define IP_VS_SYNC_SEND_TRIES	10
+
+static int stop_master_sync = 0;
+
 static void
 ip_vs_send_sync_msg(struct socket *sock, struct ip_vs_sync_mesg *msg)
 {
-	int msize;
+	int msize, len, tries = 0;
 
 	msize = msg->size;
 
 	/* Put size in network byte order */
 	msg->size = htons(msg->size);
 
-	if (ip_vs_send_async(sock, (char *)msg, msize) != msize)
+	/* rather than lose the message to a burst, let the device drain
+	   the socket for a while */
+	while ((len = ip_vs_send_async(sock, (char *)msg, msize)) == -EAGAIN
+	       && ++tries < IP_VS_SYNC_SEND_TRIES && !stop_master_sync)
+		msleep(1);
+
+	if (len != msize)
 		IP_VS_ERR("ip_vs_send_async error\n");
 }
 
@@ -611,53 +656,61 @@ ip_vs_receive(struct socket *sock, char *buffer, const size_t buflen)
 
 
 static DECLARE_WAIT_QUEUE_HEAD(sync_wait);
-static pid_t sync_master_pid = 0;
 static pid_t sync_backup_pid = 0;
 
 static DECLARE_WAIT_QUEUE_HEAD(stop_sync_wait);
-static int stop_master_sync = 0;
 static int stop_backup_sync = 0;
 
-static void sync_master_loop(void)
+static void sync_master_loop(int id)
 {
+	struct ip_vs_sync_master *m = &sync_masters[id];
 	struct socket *sock;
 	struct ip_vs_sync_buff *sb;
+	int cpu;
 
 	/* create the sending multicast socket */
 	sock = make_send_sock();
 	if (!sock)
 		return;
 
-	IP_VS_INFO("sync thread started: state = MASTER, mcast_ifn = %s, "
+	IP_VS_INFO("sync thread %d started: state = MASTER, mcast_ifn = %s, "
 		   "syncid = %d\n",
-		   ip_vs_master_mcast_ifn, ip_vs_master_syncid);
+		   id, ip_vs_master_mcast_ifn, ip_vs_master_syncid);
 
 	for (;;) {
-		while ((sb=sb_dequeue())) {
+		while ((sb=sb_dequeue(m))) {
 			ip_vs_send_sync_msg(sock, sb->mesg);
 			ip_vs_sync_buff_release(sb);
 		}
 
-		/* check if entries stay in curr_sb for 2 seconds */
-		if ((sb = get_curr_sync_buff(2*HZ))) {
-			ip_vs_send_sync_msg(sock, sb->mesg);
-			ip_vs_sync_buff_release(sb);
+		/* check if entries stay in the buffers of our CPUs
+		   for 2 seconds */
+		for (cpu = id; cpu < NR_CPUS; cpu += sync_master_threads) {
+			if (!cpu_possible(cpu))
+				continue;
+			if ((sb = get_curr_sync_buff(cpu, 2*HZ))) {
+				ip_vs_send_sync_msg(sock, sb->mesg);
+				ip_vs_sync_buff_release(sb);
+			}
 		}
 
 		if (stop_master_sync)
 			break;
 
-		ssleep(1);
+		wait_event_interruptible_timeout(m->wait,
+						 !list_empty(&m->queue) ||
+						 stop_master_sync, HZ);
 	}
 
 	/* clean up the sync_buff queue */
-	while ((sb=sb_dequeue())) {
+	while ((sb=sb_dequeue(m))) {
 		ip_vs_sync_buff_release(sb);
 	}
 
-	/* clean up the current sync_buff */
-	if ((sb = get_curr_sync_buff(0))) {
-		ip_vs_sync_buff_release(sb);
+	/* clean up the current sync_buffs */
+	for (cpu = id; cpu < NR_CPUS; cpu += sync_master_threads) {
+		if (cpu_possible(cpu) && (sb = get_curr_sync_buff(cpu, 0)))
+			ip_vs_sync_buff_release(sb);
 	}
 
 	/* release the sending multicast socket */
@@ -715,14 +768,6 @@ static void sync_backup_loop(void)
 }
 
 
-static void set_sync_pid(int sync_state, pid_t sync_pid)
-{
-	if (sync_state == IP_VS_STATE_MASTER)
-		sync_master_pid = sync_pid;
-	else if (sync_state == IP_VS_STATE_BACKUP)
-		sync_backup_pid = sync_pid;
-}
-
 static void set_stop_sync(int sync_state, int set)
 {
 	if (sync_state == IP_VS_STATE_MASTER)
@@ -735,29 +780,37 @@ static void set_stop_sync(int sync_state, int set)
 	}
 }
 
-static int sync_thread(void *startup)
+static int sync_running(int sync_state)
+{
+	if (sync_state == IP_VS_STATE_MASTER)
+		return atomic_read(&sync_master_running);
+	else
+		return sync_backup_pid != 0;
+}
+
+struct ip_vs_sync_thread_arg {
+	struct completion	startup;
+	int			state;
+	int			id;		/* of a master thread */
+};
+
+static int sync_thread(void *data)
 {
+	struct ip_vs_sync_thread_arg *arg = data;
 	DECLARE_WAITQUEUE(wait, current);
 	mm_segment_t oldmm;
-	int state;
-	const char *name;
+	int state = arg->state;
+	int id = arg->id;
 
 	/* increase the module use count */
 	ip_vs_use_count_inc();
 
-	if (ip_vs_sync_state & IP_VS_STATE_MASTER && !sync_master_pid) {
-		state = IP_VS_STATE_MASTER;
-		name = "ipvs_syncmaster";
-	} else if (ip_vs_sync_state & IP_VS_STATE_BACKUP && !sync_backup_pid) {
-		state = IP_VS_STATE_BACKUP;
-		name = "ipvs_syncbackup";
-	} else {
-		IP_VS_BUG();
-		ip_vs_use_count_dec();
-		return -EINVAL;
-	}
-
-	daemonize(name);
+	if (state == IP_VS_STATE_BACKUP)
+		daemonize("ipvs_syncbackup");
+	else if (id)
+		daemonize("ipvs_syncmaster/%d", id);
+	else
+		daemonize("ipvs_syncmaster");
 
 	oldmm = get_fs();
 	set_fs(KERNEL_DS);
@@ -778,12 +831,13 @@ static int sync_thread(void *startup)
 
 	add_wait_queue(&sync_wait, &wait);
 
-	set_sync_pid(state, current->pid);
-	complete((struct completion *)startup);
+	if (state == IP_VS_STATE_BACKUP)
+		sync_backup_pid = current->pid;
+	complete(&arg->startup);
 
 	/* processing master/backup loop here */
 	if (state == IP_VS_STATE_MASTER)
-		sync_master_loop();
+		sync_master_loop(id);
 	else if (state == IP_VS_STATE_BACKUP)
 		sync_backup_loop();
 	else IP_VS_BUG();
@@ -791,7 +845,6 @@ static int sync_thread(void *startup)
 	remove_wait_queue(&sync_wait, &wait);
 
 	/* thread exits */
-	set_sync_pid(state, 0);
 	IP_VS_INFO("sync thread stopped!\n");
 
 	set_fs(oldmm);
@@ -799,21 +852,24 @@ static int sync_thread(void *startup)
 	/* decrease the module use count */
 	ip_vs_use_count_dec();
 
-	set_stop_sync(state, 0);
+	if (state == IP_VS_STATE_MASTER)
+		atomic_dec(&sync_master_running);
+	else
+		sync_backup_pid = 0;
 	wake_up(&stop_sync_wait);
 
 	return 0;
 }
 
 
-static int fork_sync_thread(void *startup)
+static int fork_sync_thread(void *arg)
 {
 	pid_t pid;
 
 	/* fork the sync thread here, then the parent process of the
 	   sync thread is the init process after this thread exits. */
   repeat:
-	if ((pid = kernel_thread(sync_thread, startup, 0)) < 0) {
+	if ((pid = kernel_thread(sync_thread, arg, 0)) < 0) {
 		IP_VS_ERR("could not create sync_thread due to %d... "
 			  "retrying.\n", pid);
 		ssleep(1);
@@ -826,35 +882,51 @@ static int fork_sync_thread(void *startup)
 
 int start_sync_thread(int state, char *mcast_ifn, __u8 syncid)
 {
-	DECLARE_COMPLETION(startup);
+	struct ip_vs_sync_thread_arg arg;
 	pid_t pid;
+	int id, threads = 1;
 
-	if ((state == IP_VS_STATE_MASTER && sync_master_pid) ||
-	    (state == IP_VS_STATE_BACKUP && sync_backup_pid))
+	if (state != IP_VS_STATE_MASTER && state != IP_VS_STATE_BACKUP)
+		return -EINVAL;
+	if (sync_running(state))
 		return -EEXIST;
 
 	IP_VS_DBG(7, "%s: pid %d\n", __FUNCTION__, current->pid);
 	IP_VS_DBG(7, "Each ip_vs_sync_conn entry need %Zd bytes\n",
 		  sizeof(struct ip_vs_sync_conn));
 
-	ip_vs_sync_state |= state;
 	if (state == IP_VS_STATE_MASTER) {
 		strcpy(ip_vs_master_mcast_ifn, mcast_ifn);
 		ip_vs_master_syncid = syncid;
+
+		threads = sysctl_ip_vs_sync_threads;
+		for (id = 0; id < threads; id++) {
+			spin_lock_init(&sync_masters[id].lock);
+			INIT_LIST_HEAD(&sync_masters[id].queue);
+			init_waitqueue_head(&sync_masters[id].wait);
+		}
+		sync_master_threads = threads;
+		atomic_set(&sync_master_running, threads);
 	} else {
 		strcpy(ip_vs_backup_mcast_ifn, mcast_ifn);
 		ip_vs_backup_syncid = syncid;
 	}
+	ip_vs_sync_state |= state;
 
-  repeat:
-	if ((pid = kernel_thread(fork_sync_thread, &startup, 0)) < 0) {
-		IP_VS_ERR("could not create fork_sync_thread due to %d... "
-			  "retrying.\n", pid);
-		ssleep(1);
-		goto repeat;
-	}
+	arg.state = state;
+	for (id = 0; id < threads; id++) {
+		init_completion(&arg.startup);
+		arg.id = id;
+	  repeat:
+		if ((pid = kernel_thread(fork_sync_thread, &arg, 0)) < 0) {
+			IP_VS_ERR("could not create fork_sync_thread due to %d... "
+				  "retrying.\n", pid);
+			ssleep(1);
+			goto repeat;
+		}
 
-	wait_for_completion(&startup);
+		wait_for_completion(&arg.startup);
+	}
 
 	return 0;
 }
@@ -862,31 +934,32 @@ int start_sync_thread(int state, char *mcast_ifn, __u8 syncid)
 
 int stop_sync_thread(int state)
 {
-	DECLARE_WAITQUEUE(wait, current);
+	int id;
 
-	if ((state == IP_VS_STATE_MASTER && !sync_master_pid) ||
-	    (state == IP_VS_STATE_BACKUP && !sync_backup_pid))
+	if (state != IP_VS_STATE_MASTER && state != IP_VS_STATE_BACKUP)
+		return -EINVAL;
+	if (!sync_running(state))
 		return -ESRCH;
 
 	IP_VS_DBG(7, "%s: pid %d\n", __FUNCTION__, current->pid);
-	IP_VS_INFO("stopping sync thread %d ...\n",
-		   (state == IP_VS_STATE_MASTER) ? sync_master_pid : sync_backup_pid);
+	if (state == IP_VS_STATE_MASTER)
+		IP_VS_INFO("stopping %d master sync threads ...\n",
+			   sync_master_threads);
+	else
+		IP_VS_INFO("stopping sync thread %d ...\n", sync_backup_pid);
 
-	__set_current_state(TASK_UNINTERRUPTIBLE);
-	add_wait_queue(&stop_sync_wait, &wait);
 	set_stop_sync(state, 1);
 	ip_vs_sync_state -= state;
 	wake_up(&sync_wait);
-	schedule();
-	__set_current_state(TASK_RUNNING);
-	remove_wait_queue(&stop_sync_wait, &wait);
+	if (state == IP_VS_STATE_MASTER)
+		for (id = 0; id < sync_master_threads; id++)
+			wake_up(&sync_masters[id].wait);
+
+	wait_event(stop_sync_wait, !sync_running(state));
+	set_stop_sync(state, 0);
 
 	/* Note: no need to reap the sync thread, because its parent
 	   process is the init process */
 
-	if ((state == IP_VS_STATE_MASTER && stop_master_sync) ||
-	    (state == IP_VS_STATE_BACKUP && stop_backup_sync))
-		IP_VS_BUG();
-
 	return 0;
 }
@@ -37,9 +37,12 @@
 #include <linux/err.h>
 #include <linux/percpu.h>
 #include <linux/moduleparam.h>
+#include <linux/hash.h>
+#include <linux/rcupdate.h>
 
-/* This rwlock protects the main hash table, protocol/helper/expected
-   registrations, conntrack timers*/
+/* This rwlock protects protocol/helper/expected registrations and the
+   expectation list.  The main hash table is read under RCU and updated
+   under the hashed ip_conntrack_locks; see below. */
 #define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(&ip_conntrack_lock)
 #define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(&ip_conntrack_lock)
 
@@ -63,6 +66,10 @@ DECLARE_RWLOCK(ip_conntrack_lock);
 atomic_t ip_conntrack_count = ATOMIC_INIT(0);
 
 void (*ip_conntrack_destroyed)(struct ip_conntrack *conntrack) = NULL;
+void (*ip_conntrack_resized)(unsigned int hashsize) = NULL;
+#ifdef CONFIG_IP_NF_CONNTRACK_EVENTS
+struct notifier_block *ip_conntrack_chain;
+#endif
 LIST_HEAD(ip_conntrack_expect_list);
 struct ip_conntrack_protocol *ip_ct_protos[MAX_IP_CT_PROTO];
 static LIST_HEAD(helpers);
@@ -73,11 +80,128 @@ static kmem_cache_t *ip_conntrack_cachep;
 static kmem_cache_t *ip_conntrack_expect_cachep;
 struct ip_conntrack ip_conntrack_untracked;
 unsigned int ip_ct_log_invalid;
-static LIST_HEAD(unconfirmed);
 static int ip_conntrack_vmalloc;
 
 DEFINE_PER_CPU(struct ip_conntrack_stat, ip_conntrack_stat);
 
+/* Hash chains are walked under rcu_read_lock_bh() and modified under
+   the spinlock covering their bucket.  The same locks, picked by
+   conntrack address, serialise timer refreshes and accounting.  A
+   conntrack keeps the hash table's reference for a grace period after
+   it is unlinked, so a lockless reader may always take one of its own.
+
+   Resizing moves every entry to a new table with a new seed.  It holds
+   off the writers through ip_ct_all_lock and bumps
+   ip_conntrack_generation around the move; lockless readers retry when
+   the generation changes under them, since they may have been carried
+   onto a chain of the new table. */
+#define IP_CT_LOCKS_SHIFT	8
+#define IP_CT_LOCKS		(1 << IP_CT_LOCKS_SHIFT)
+static spinlock_t ip_conntrack_locks[IP_CT_LOCKS];
+static DEFINE_SPINLOCK(ip_ct_all_lock);
+static int ip_ct_locks_all;
+seqcount_t ip_conntrack_generation = SEQCNT_ZERO;
+
+static inline spinlock_t *ip_ct_bucket_lock(unsigned int hash)
+{
+	return &ip_conntrack_locks[hash & (IP_CT_LOCKS - 1)];
+}
+
+static inline spinlock_t *ip_ct_lock(const struct ip_conntrack *ct)
+{
+	return &ip_conntrack_locks[hash_ptr((void *)ct, IP_CT_LOCKS_SHIFT)];
+}
+
+/* Take a bucket lock, waiting for a resize to finish if one holds
+   them all.  BHs must be disabled. */
+static void ip_ct_spin_lock(spinlock_t *lock)
+{
+	spin_lock(lock);
+	if (likely(!ip_ct_locks_all))
+		return;
+
+	spin_unlock(lock);
+	spin_lock(&ip_ct_all_lock);
+	spin_lock(lock);
+	spin_unlock(&ip_ct_all_lock);
+}
+
+/* Keep every bucket writer out.  Anyone already holding a bucket lock
+   is waited for; anyone coming later blocks on ip_ct_all_lock. */
+static void ip_ct_all_lock_bh(void)
+{
+	int i;
+
+	spin_lock_bh(&ip_ct_all_lock);
+	ip_ct_locks_all = 1;
+	for (i = 0; i < IP_CT_LOCKS; i++) {
+		spin_lock(&ip_conntrack_locks[i]);
+		spin_unlock(&ip_conntrack_locks[i]);
+	}
+}
+
+static void ip_ct_all_unlock_bh(void)
+{
+	ip_ct_locks_all = 0;
+	spin_unlock_bh(&ip_ct_all_lock);
+}
+
+/* Lock the bucket a hash computed in generation seq falls in.  Fails
+   if the table was resized since, and the hash must be redone. */
+static int ip_ct_lock_bucket(unsigned int hash, unsigned int seq)
+{
+	spinlock_t *l = ip_ct_bucket_lock(hash);
+
+	local_bh_disable();
+	ip_ct_spin_lock(l);
+	if (read_seqcount_retry(&ip_conntrack_generation, seq)) {
+		spin_unlock_bh(l);
+		return 0;
+	}
+	return 1;
+}
+
+static void ip_ct_unlock_buckets(unsigned int h1, unsigned int h2)
+{
+	spinlock_t *l1 = ip_ct_bucket_lock(h1), *l2 = ip_ct_bucket_lock(h2);
+
+	if (l1 != l2)
+		spin_unlock(l2);
+	spin_unlock(l1);
+	local_bh_enable();
+}
+
+/* Lock the buckets of both directions, in a fixed order. */
+static int ip_ct_lock_buckets(unsigned int h1, unsigned int h2,
+			      unsigned int seq)
+{
+	spinlock_t *l1 = ip_ct_bucket_lock(h1), *l2 = ip_ct_bucket_lock(h2);
+
+	if (l1 > l2) {
+		spinlock_t *tmp = l1;
+		l1 = l2;
+		l2 = tmp;
+	}
+	local_bh_disable();
+	ip_ct_spin_lock(l1);
+	if (l1 != l2)
+		spin_lock(l2);
+	if (read_seqcount_retry(&ip_conntrack_generation, seq)) {
+		ip_ct_unlock_buckets(h1, h2);
+		return 0;
+	}
+	return 1;
+}
+
+/* Unconfirmed conntracks are linked (through their original tuple) on a
+   list of the CPU which created them. */
+struct ip_ct_unconfirmed
+{
+	spinlock_t lock;
+	struct list_head list;
+};
+static DEFINE_PER_CPU(struct ip_ct_unconfirmed, ip_ct_unconfirmed);
+
 void 
 ip_conntrack_put(struct ip_conntrack *ct)
 {
@@ -85,11 +209,17 @@ ip_conntrack_put(struct ip_conntrack *ct)
 	nf_conntrack_put(&ct->ct_general);
 }
 
+static void ip_conntrack_put_rcu(struct rcu_head *head)
+{
+	ip_conntrack_put(container_of(head, struct ip_conntrack, rcu));
+}
+
 static int ip_conntrack_hash_rnd_initted;
 static unsigned int ip_conntrack_hash_rnd;
 
 static u_int32_t
-hash_conntrack(const struct ip_conntrack_tuple *tuple)
+__hash_conntrack(const struct ip_conntrack_tuple *tuple,
+		 unsigned int size, unsigned int rnd)
 {
 #if 0
 	dump_tuple(tuple);
@@ -97,7 +227,14 @@ hash_conntrack(const struct ip_conntrack_tuple *tuple)
 	return (jhash_3words(tuple->src.ip,
 	                     (tuple->dst.ip ^ tuple->dst.protonum),
 	                     (tuple->src.u.all | (tuple->dst.u.all << 16)),
-	                     ip_conntrack_hash_rnd) % ip_conntrack_htable_size);
+	                     rnd) % size);
+}
+
+static inline u_int32_t
+hash_conntrack(const struct ip_conntrack_tuple *tuple)
+{
+	return __hash_conntrack(tuple, ip_conntrack_htable_size,
+				ip_conntrack_hash_rnd);
 }
 
 int
@@ -206,18 +343,27 @@ static void remove_expectations(struct ip_conntrack *ct)
 static void
 clean_from_lists(struct ip_conntrack *ct)
 {
-	unsigned int ho, hr;
+	unsigned int ho, hr, seq;
 	
 	DEBUGP("clean_from_lists(%p)\n", ct);
-	MUST_BE_WRITE_LOCKED(&ip_conntrack_lock);
 
-	ho = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	hr = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
-	LIST_DELETE(&ip_conntrack_hash[ho], &ct->tuplehash[IP_CT_DIR_ORIGINAL]);
-	LIST_DELETE(&ip_conntrack_hash[hr], &ct->tuplehash[IP_CT_DIR_REPLY]);
+	do {
+		seq = read_seqcount_begin(&ip_conntrack_generation);
+		ho = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+		hr = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	} while (!ip_ct_lock_buckets(ho, hr, seq));
+	CONNTRACK_STAT_INC(delete_list);
+	list_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list);
+	list_del_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].list);
+	ip_ct_unlock_buckets(ho, hr);
 
-	/* Destroy all pending expectations */
-	remove_expectations(ct);
+	/* Destroy all pending expectations.  Only conntracks with a
+	   helper get any, so most never touch the global lock. */
+	if (ct->helper || ct->expecting) {
+		WRITE_LOCK(&ip_conntrack_lock);
+		remove_expectations(ct);
+		WRITE_UNLOCK(&ip_conntrack_lock);
+	}
 }
 
 static void
@@ -230,6 +376,9 @@ destroy_conntrack(struct nf_conntrack *nfct)
 	IP_NF_ASSERT(atomic_read(&nfct->use) == 0);
 	IP_NF_ASSERT(!timer_pending(&ct->timeout));
 
+	if (is_confirmed(ct))
+		ip_conntrack_event(IPCT_DESTROY, ct);
+
 	/* To make sure we don't get any weird locking issues here:
 	 * destroy_conntrack() MUST NOT be called with a write lock
 	 * to ip_conntrack_lock!!! -HW */
@@ -240,21 +389,30 @@ destroy_conntrack(struct nf_conntrack *nfct)
 	if (ip_conntrack_destroyed)
 		ip_conntrack_destroyed(ct);
 
-	WRITE_LOCK(&ip_conntrack_lock);
 	/* Expectations will have been removed in clean_from_lists,
 	 * except TFTP can create an expectation on the first packet,
 	 * before connection is in the list, so we need to clean here,
 	 * too. */
-	remove_expectations(ct);
+	if (ct->expecting) {
+		WRITE_LOCK(&ip_conntrack_lock);
+		remove_expectations(ct);
+		WRITE_UNLOCK(&ip_conntrack_lock);
+	}
 
 	/* We overload first tuple to link into unconfirmed list. */
 	if (!is_confirmed(ct)) {
+		struct ip_ct_unconfirmed *uc = &per_cpu(ip_ct_unconfirmed,
+							ct->cpu);
+
+		spin_lock_bh(&uc->lock);
 		BUG_ON(list_empty(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list));
 		list_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list);
+		spin_unlock_bh(&uc->lock);
 	}
 
+	local_bh_disable();
 	CONNTRACK_STAT_INC(delete);
-	WRITE_UNLOCK(&ip_conntrack_lock);
+	local_bh_enable();
 
 	if (ct->master)
 		ip_conntrack_put(ct->master);
@@ -268,13 +426,10 @@ static void death_by_timeout(unsigned long ul_conntrack)
 {
 	struct ip_conntrack *ct = (void *)ul_conntrack;
 
-	WRITE_LOCK(&ip_conntrack_lock);
-	/* Inside lock so preempt is disabled on module removal path.
-	 * Otherwise we can get spurious warnings. */
-	CONNTRACK_STAT_INC(delete_list);
 	clean_from_lists(ct);
-	WRITE_UNLOCK(&ip_conntrack_lock);
-	ip_conntrack_put(ct);
+	/* Lockless lookups may still find us: the hash table's reference
+	 * goes only once they are done. */
+	call_rcu(&ct->rcu, ip_conntrack_put_rcu);
 }
 
 static inline int
@@ -282,26 +437,37 @@ conntrack_tuple_cmp(const struct ip_conntrack_tuple_hash *i,
 		    const struct ip_conntrack_tuple *tuple,
 		    const struct ip_conntrack *ignored_conntrack)
 {
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
 	return tuplehash_to_ctrack(i) != ignored_conntrack
 		&& ip_ct_tuple_equal(tuple, &i->tuple);
 }
 
+/* Called under rcu_read_lock_bh() or with the bucket lock held. */
 static struct ip_conntrack_tuple_hash *
 __ip_conntrack_find(const struct ip_conntrack_tuple *tuple,
 		    const struct ip_conntrack *ignored_conntrack)
 {
 	struct ip_conntrack_tuple_hash *h;
-	unsigned int hash = hash_conntrack(tuple);
+	struct list_head *chain;
+	unsigned int seq;
 
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
-	list_for_each_entry(h, &ip_conntrack_hash[hash], list) {
+restart:
+	seq = read_seqcount_begin(&ip_conntrack_generation);
+	chain = &ip_conntrack_hash[hash_conntrack(tuple)];
+	if (read_seqcount_retry(&ip_conntrack_generation, seq))
+		goto restart;
+
+	list_for_each_entry_rcu(h, chain, list) {
 		if (conntrack_tuple_cmp(h, tuple, ignored_conntrack)) {
 			CONNTRACK_STAT_INC(found);
 			return h;
 		}
 		CONNTRACK_STAT_INC(searched);
+		/* We may have been moved onto a chain of a new table. */
+		if (read_seqcount_retry(&ip_conntrack_generation, seq))
+			goto restart;
 	}
+	if (read_seqcount_retry(&ip_conntrack_generation, seq))
+		goto restart;
 
 	return NULL;
 }
@@ -313,11 +479,11 @@ ip_conntrack_find_get(const struct ip_conntrack_tuple *tuple,
 {
 	struct ip_conntrack_tuple_hash *h;
 
-	READ_LOCK(&ip_conntrack_lock);
+	rcu_read_lock_bh();
 	h = __ip_conntrack_find(tuple, ignored_conntrack);
 	if (h)
 		atomic_inc(&tuplehash_to_ctrack(h)->ct_general.use);
-	READ_UNLOCK(&ip_conntrack_lock);
+	rcu_read_unlock_bh();
 
 	return h;
 }
@@ -326,7 +492,7 @@ ip_conntrack_find_get(const struct ip_conntrack_tuple *tuple,
 int
 __ip_conntrack_confirm(struct sk_buff **pskb)
 {
-	unsigned int hash, repl_hash;
+	unsigned int hash, repl_hash, seq;
 	struct ip_conntrack *ct;
 	enum ip_conntrack_info ctinfo;
 
@@ -339,9 +505,6 @@ __ip_conntrack_confirm(struct sk_buff **pskb)
 	if (CTINFO2DIR(ctinfo) != IP_CT_DIR_ORIGINAL)
 		return NF_ACCEPT;
 
-	hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
-
 	/* We're not in hash table, and we refuse to set up related
 	   connections for unconfirmed conns.  But packet copies and
 	   REJECT will give spurious warnings here. */
@@ -352,26 +515,27 @@ __ip_conntrack_confirm(struct sk_buff **pskb)
 	IP_NF_ASSERT(!is_confirmed(ct));
 	DEBUGP("Confirming conntrack %p\n", ct);
 
-	WRITE_LOCK(&ip_conntrack_lock);
+	do {
+		seq = read_seqcount_begin(&ip_conntrack_generation);
+		hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+		repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	} while (!ip_ct_lock_buckets(hash, repl_hash, seq));
 
 	/* See if there's one in the list already, including reverse:
            NAT could have grabbed it without realizing, since we're
            not in the hash.  If there is, we lost race. */
-	if (!LIST_FIND(&ip_conntrack_hash[hash],
-		       conntrack_tuple_cmp,
-		       struct ip_conntrack_tuple_hash *,
-		       &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, NULL)
-	    && !LIST_FIND(&ip_conntrack_hash[repl_hash],
-			  conntrack_tuple_cmp,
-			  struct ip_conntrack_tuple_hash *,
-			  &ct->tuplehash[IP_CT_DIR_REPLY].tuple, NULL)) {
+	if (!__ip_conntrack_find(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple,
+				 NULL)
+	    && !__ip_conntrack_find(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
+				    NULL)) {
+		struct ip_ct_unconfirmed *uc = &per_cpu(ip_ct_unconfirmed,
+							ct->cpu);
+
 		/* Remove from unconfirmed list */
+		spin_lock(&uc->lock);
 		list_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list);
+		spin_unlock(&uc->lock);
 
-		list_prepend(&ip_conntrack_hash[hash],
-			     &ct->tuplehash[IP_CT_DIR_ORIGINAL]);
-		list_prepend(&ip_conntrack_hash[repl_hash],
-			     &ct->tuplehash[IP_CT_DIR_REPLY]);
 		/* Timer relative to confirmation time, not original
 		   setting time, otherwise we'd get timer wrap in
 		   weird delay cases. */
@@ -379,13 +543,19 @@ __ip_conntrack_confirm(struct sk_buff **pskb)
 		add_timer(&ct->timeout);
 		atomic_inc(&ct->ct_general.use);
 		set_bit(IPS_CONFIRMED_BIT, &ct->status);
+
+		list_add_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list,
+			     &ip_conntrack_hash[hash]);
+		list_add_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].list,
+			     &ip_conntrack_hash[repl_hash]);
 		CONNTRACK_STAT_INC(insert);
-		WRITE_UNLOCK(&ip_conntrack_lock);
+		ip_ct_unlock_buckets(hash, repl_hash);
+		ip_conntrack_event(IPCT_NEW, ct);
 		return NF_ACCEPT;
 	}
 
 	CONNTRACK_STAT_INC(insert_failed);
-	WRITE_UNLOCK(&ip_conntrack_lock);
+	ip_ct_unlock_buckets(hash, repl_hash);
 
 	return NF_DROP;
 }
@@ -398,9 +568,9 @@ ip_conntrack_tuple_taken(const struct ip_conntrack_tuple *tuple,
 {
 	struct ip_conntrack_tuple_hash *h;
 
-	READ_LOCK(&ip_conntrack_lock);
+	rcu_read_lock_bh();
 	h = __ip_conntrack_find(tuple, ignored_conntrack);
-	READ_UNLOCK(&ip_conntrack_lock);
+	rcu_read_unlock_bh();
 
 	return h != NULL;
 }
@@ -412,20 +582,28 @@ static inline int unreplied(const struct ip_conntrack_tuple_hash *i)
 	return !(test_bit(IPS_ASSURED_BIT, &tuplehash_to_ctrack(i)->status));
 }
 
-static int early_drop(struct list_head *chain)
+static int early_drop(const struct ip_conntrack_tuple *tuple)
 {
-	/* Traverse backwards: gives us oldest, which is roughly LRU */
+	/* Traverse backwards: gives us oldest, which is roughly LRU.
+	   The prev pointers are not RCU safe, so take the bucket. */
 	struct ip_conntrack_tuple_hash *h;
 	struct ip_conntrack *ct = NULL;
+	unsigned int hash, seq;
 	int dropped = 0;
 
-	READ_LOCK(&ip_conntrack_lock);
-	h = LIST_FIND_B(chain, unreplied, struct ip_conntrack_tuple_hash *);
-	if (h) {
-		ct = tuplehash_to_ctrack(h);
-		atomic_inc(&ct->ct_general.use);
+	do {
+		seq = read_seqcount_begin(&ip_conntrack_generation);
+		hash = hash_conntrack(tuple);
+	} while (!ip_ct_lock_bucket(hash, seq));
+
+	list_for_each_entry_reverse(h, &ip_conntrack_hash[hash], list) {
+		if (unreplied(h)) {
+			ct = tuplehash_to_ctrack(h);
+			atomic_inc(&ct->ct_general.use);
+			break;
+		}
 	}
-	READ_UNLOCK(&ip_conntrack_lock);
+	spin_unlock_bh(ip_ct_bucket_lock(hash));
 
 	if (!ct)
 		return dropped;
@@ -445,11 +623,16 @@ static inline int helper_cmp(const struct ip_conntrack_helper *i,
 	return ip_ct_tuple_mask_cmp(rtuple, &i->tuple, &i->mask);
 }
 
+/* The helper list is walked under RCU; ip_conntrack_helper_unregister
+   waits for the walkers with synchronize_net(). */
 static struct ip_conntrack_helper *ip_ct_find_helper(const struct ip_conntrack_tuple *tuple)
 {
-	return LIST_FIND(&helpers, helper_cmp,
-			 struct ip_conntrack_helper *,
-			 tuple);
+	struct ip_conntrack_helper *h;
+
+	list_for_each_entry_rcu(h, &helpers, list)
+		if (helper_cmp(h, tuple))
+			return h;
+	return NULL;
 }
 
 /* Allocate a new conntrack: we return -ENOMEM if classification
@@ -461,20 +644,18 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 {
 	struct ip_conntrack *conntrack;
 	struct ip_conntrack_tuple repl_tuple;
-	size_t hash;
-	struct ip_conntrack_expect *exp;
+	struct ip_conntrack_expect *exp = NULL;
+	struct ip_ct_unconfirmed *uc;
 
 	if (!ip_conntrack_hash_rnd_initted) {
 		get_random_bytes(&ip_conntrack_hash_rnd, 4);
 		ip_conntrack_hash_rnd_initted = 1;
 	}
 
-	hash = hash_conntrack(tuple);
-
 	if (ip_conntrack_max
 	    && atomic_read(&ip_conntrack_count) >= ip_conntrack_max) {
 		/* Try dropping from this hash chain. */
-		if (!early_drop(&ip_conntrack_hash[hash])) {
+		if (!early_drop(tuple)) {
 			if (net_ratelimit())
 				printk(KERN_WARNING
 				       "ip_conntrack: table full, dropping"
@@ -508,8 +689,13 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 	conntrack->timeout.data = (unsigned long)conntrack;
 	conntrack->timeout.function = death_by_timeout;
 
-	WRITE_LOCK(&ip_conntrack_lock);
-	exp = find_expectation(tuple);
+	/* An expectation created while we look is one we would have
+	   raced with anyway, so don't take the lock for an empty list. */
+	if (!list_empty(&ip_conntrack_expect_list)) {
+		WRITE_LOCK(&ip_conntrack_lock);
+		exp = find_expectation(tuple);
+		WRITE_UNLOCK(&ip_conntrack_lock);
+	}
 
 	if (exp) {
 		DEBUGP("conntrack: expectation arrives ct=%p exp=%p\n",
@@ -523,16 +709,21 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 		nf_conntrack_get(&conntrack->master->ct_general);
 		CONNTRACK_STAT_INC(expect_new);
 	} else {
+		rcu_read_lock_bh();
 		conntrack->helper = ip_ct_find_helper(&repl_tuple);
+		rcu_read_unlock_bh();
 
 		CONNTRACK_STAT_INC(new);
 	}
 
 	/* Overload tuple linked list to put us in unconfirmed list. */
-	list_add(&conntrack->tuplehash[IP_CT_DIR_ORIGINAL].list, &unconfirmed);
+	conntrack->cpu = smp_processor_id();
+	uc = &per_cpu(ip_ct_unconfirmed, conntrack->cpu);
+	spin_lock_bh(&uc->lock);
+	list_add(&conntrack->tuplehash[IP_CT_DIR_ORIGINAL].list, &uc->list);
+	spin_unlock_bh(&uc->lock);
 
 	atomic_inc(&ip_conntrack_count);
-	WRITE_UNLOCK(&ip_conntrack_lock);
 
 	if (exp) {
 		if (exp->expectfn)
@@ -849,37 +1040,59 @@ void ip_conntrack_alter_reply(struct ip_conntrack *conntrack,
 	DUMP_TUPLE(newreply);
 
 	conntrack->tuplehash[IP_CT_DIR_REPLY].tuple = *newreply;
-	if (!conntrack->master && conntrack->expecting == 0)
+	if (!conntrack->master && conntrack->expecting == 0) {
+		rcu_read_lock_bh();
 		conntrack->helper = ip_ct_find_helper(newreply);
+		rcu_read_unlock_bh();
+	}
 	WRITE_UNLOCK(&ip_conntrack_lock);
 }
 
+#ifdef CONFIG_IP_NF_CONNTRACK_EVENTS
+int ip_conntrack_register_notifier(struct notifier_block *nb)
+{
+	return notifier_chain_register(&ip_conntrack_chain, nb);
+}
+
+int ip_conntrack_unregister_notifier(struct notifier_block *nb)
+{
+	int ret = notifier_chain_unregister(&ip_conntrack_chain, nb);
+
+	/* Events are sent under rcu_read_lock() */
+	synchronize_kernel();
+	return ret;
+}
+#endif
+
 int ip_conntrack_helper_register(struct ip_conntrack_helper *me)
 {
 	BUG_ON(me->timeout == 0);
 	WRITE_LOCK(&ip_conntrack_lock);
-	list_prepend(&helpers, me);
+	list_add_rcu(&me->list, &helpers);
 	WRITE_UNLOCK(&ip_conntrack_lock);
 
 	return 0;
 }
 
-static inline int unhelp(struct ip_conntrack_tuple_hash *i,
-			 const struct ip_conntrack_helper *me)
+static void unhelp_list(struct list_head *list,
+			const struct ip_conntrack_helper *me)
 {
-	if (tuplehash_to_ctrack(i)->helper == me)
-		tuplehash_to_ctrack(i)->helper = NULL;
-	return 0;
+	struct ip_conntrack_tuple_hash *i;
+
+	list_for_each_entry(i, list, list) {
+		if (tuplehash_to_ctrack(i)->helper == me)
+			tuplehash_to_ctrack(i)->helper = NULL;
+	}
 }
 
 void ip_conntrack_helper_unregister(struct ip_conntrack_helper *me)
 {
-	unsigned int i;
+	unsigned int i, seq;
 	struct ip_conntrack_expect *exp, *tmp;
 
 	/* Need write lock here, to delete helper. */
 	WRITE_LOCK(&ip_conntrack_lock);
-	LIST_DELETE(&helpers, me);
+	list_del_rcu(&me->list);
 
 	/* Get rid of expectations */
 	list_for_each_entry_safe(exp, tmp, &ip_conntrack_expect_list, list) {
@@ -889,10 +1102,25 @@ void ip_conntrack_helper_unregister(struct ip_conntrack_helper *me)
 		}
 	}
 	/* Get rid of expecteds, set helpers to NULL. */
-	LIST_FIND_W(&unconfirmed, unhelp, struct ip_conntrack_tuple_hash*, me);
-	for (i = 0; i < ip_conntrack_htable_size; i++)
-		LIST_FIND_W(&ip_conntrack_hash[i], unhelp,
-			    struct ip_conntrack_tuple_hash *, me);
+	for (i = 0; i < NR_CPUS; i++) {
+		struct ip_ct_unconfirmed *uc;
+
+		if (!cpu_possible(i))
+			continue;
+		uc = &per_cpu(ip_ct_unconfirmed, i);
+		spin_lock(&uc->lock);
+		unhelp_list(&uc->list, me);
+		spin_unlock(&uc->lock);
+	}
+	do {
+		seq = read_seqcount_begin(&ip_conntrack_generation);
+		for (i = 0; i < ip_conntrack_htable_size; i++) {
+			ip_ct_spin_lock(ip_ct_bucket_lock(i));
+			if (i < ip_conntrack_htable_size)
+				unhelp_list(&ip_conntrack_hash[i], me);
+			spin_unlock(ip_ct_bucket_lock(i));
+		}
+	} while (read_seqcount_retry(&ip_conntrack_generation, seq));
 	WRITE_UNLOCK(&ip_conntrack_lock);
 
 	/* Someone could be still looking at the helper in a bh. */
@@ -925,14 +1153,14 @@ void ip_ct_refresh_acct(struct ip_conntrack *ct,
 		ct->timeout.expires = extra_jiffies;
 		ct_add_counters(ct, ctinfo, skb);
 	} else {
-		WRITE_LOCK(&ip_conntrack_lock);
+		spin_lock_bh(ip_ct_lock(ct));
 		/* Need del_timer for race avoidance (may already be dying). */
 		if (del_timer(&ct->timeout)) {
 			ct->timeout.expires = jiffies + extra_jiffies;
 			add_timer(&ct->timeout);
 		}
 		ct_add_counters(ct, ctinfo, skb);
-		WRITE_UNLOCK(&ip_conntrack_lock);
+		spin_unlock_bh(ip_ct_lock(ct));
 	}
 }
 
@@ -994,12 +1222,20 @@ static void ip_conntrack_attach(struct sk_buff *nskb, struct sk_buff *skb)
 	nf_conntrack_get(nskb->nfct);
 }
 
-static inline int
-do_iter(const struct ip_conntrack_tuple_hash *i,
-	int (*iter)(struct ip_conntrack *i, void *data),
-	void *data)
+static struct ip_conntrack_tuple_hash *
+find_corpse(struct list_head *list,
+	    int (*iter)(struct ip_conntrack *i, void *data),
+	    void *data)
 {
-	return iter(tuplehash_to_ctrack(i), data);
+	struct ip_conntrack_tuple_hash *h;
+
+	list_for_each_entry(h, list, list) {
+		if (iter(tuplehash_to_ctrack(h), data)) {
+			atomic_inc(&tuplehash_to_ctrack(h)->ct_general.use);
+			return h;
+		}
+	}
+	return NULL;
 }
 
 /* Bring out ya dead! */
@@ -1008,20 +1244,30 @@ get_next_corpse(int (*iter)(struct ip_conntrack *i, void *data),
 		void *data, unsigned int *bucket)
 {
 	struct ip_conntrack_tuple_hash *h = NULL;
+	int cpu;
 
-	WRITE_LOCK(&ip_conntrack_lock);
 	for (; *bucket < ip_conntrack_htable_size; (*bucket)++) {
-		h = LIST_FIND_W(&ip_conntrack_hash[*bucket], do_iter,
-				struct ip_conntrack_tuple_hash *, iter, data);
+		local_bh_disable();
+		ip_ct_spin_lock(ip_ct_bucket_lock(*bucket));
+		if (*bucket < ip_conntrack_htable_size)
+			h = find_corpse(&ip_conntrack_hash[*bucket],
+					iter, data);
+		spin_unlock_bh(ip_ct_bucket_lock(*bucket));
+		if (h)
+			return h;
+	}
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct ip_ct_unconfirmed *uc;
+
+		if (!cpu_possible(cpu))
+			continue;
+		uc = &per_cpu(ip_ct_unconfirmed, cpu);
+		spin_lock_bh(&uc->lock);
+		h = find_corpse(&uc->list, iter, data);
+		spin_unlock_bh(&uc->lock);
 		if (h)
 			break;
 	}
-	if (!h)
-		h = LIST_FIND_W(&unconfirmed, do_iter,
-				struct ip_conntrack_tuple_hash *, iter, data);
-	if (h)
-		atomic_inc(&tuplehash_to_ctrack(h)->ct_general.use);
-	WRITE_UNLOCK(&ip_conntrack_lock);
 
 	return h;
 }
@@ -1030,17 +1276,22 @@ void
 ip_ct_iterate_cleanup(int (*iter)(struct ip_conntrack *i, void *), void *data)
 {
 	struct ip_conntrack_tuple_hash *h;
-	unsigned int bucket = 0;
-
-	while ((h = get_next_corpse(iter, data, &bucket)) != NULL) {
-		struct ip_conntrack *ct = tuplehash_to_ctrack(h);
-		/* Time to push up daises... */
-		if (del_timer(&ct->timeout))
-			death_by_timeout((unsigned long)ct);
-		/* ... else the timer will get him soon. */
-
-		ip_conntrack_put(ct);
-	}
+	unsigned int bucket, seq;
+
+	do {
+		seq = read_seqcount_begin(&ip_conntrack_generation);
+		bucket = 0;
+		while ((h = get_next_corpse(iter, data, &bucket)) != NULL) {
+			struct ip_conntrack *ct = tuplehash_to_ctrack(h);
+			/* Time to push up daises... */
+			if (del_timer(&ct->timeout))
+				death_by_timeout((unsigned long)ct);
+			/* ... else the timer will get him soon. */
+
+			ip_conntrack_put(ct);
+		}
+		/* A resize shuffles the buckets under us: go again. */
+	} while (read_seqcount_retry(&ip_conntrack_generation, seq));
 }
 
 /* Fast function for those who don't want to parse /proc (and I don't
@@ -1110,14 +1361,97 @@ static int kill_all(struct ip_conntrack *i, void *data)
 	return 1;
 }
 
-static void free_conntrack_hash(void)
+/* AK: the hash table is twice as big than needed because it
+   uses list_head.  it would be much nicer to caches to use a
+   single pointer list head here. */
+static struct list_head *alloc_conntrack_hash(unsigned int size,
+					      int *vmalloced)
+{
+	struct list_head *hash;
+	unsigned int i;
+
+	*vmalloced = 0; 
+	hash = (void*)__get_free_pages(GFP_KERNEL, 
+				       get_order(sizeof(struct list_head)
+						 * size));
+	if (!hash) { 
+		*vmalloced = 1;
+		printk(KERN_WARNING "ip_conntrack: falling back to vmalloc.\n");
+		hash = vmalloc(sizeof(struct list_head) * size);
+	}
+	if (hash)
+		for (i = 0; i < size; i++)
+			INIT_LIST_HEAD(&hash[i]);
+	return hash;
+}
+
+static void free_conntrack_hash(struct list_head *hash, int vmalloced,
+				unsigned int size)
 {
-	if (ip_conntrack_vmalloc)
-		vfree(ip_conntrack_hash);
+	if (vmalloced)
+		vfree(hash);
 	else
-		free_pages((unsigned long)ip_conntrack_hash, 
-			   get_order(sizeof(struct list_head)
-				     * ip_conntrack_htable_size));
+		free_pages((unsigned long)hash, 
+			   get_order(sizeof(struct list_head) * size));
+}
+
+static DECLARE_MUTEX(ip_conntrack_resize_sem);
+
+/* Rehash all conntracks into a table of the given size, with a fresh
+   seed, without dropping any of them.  Process context only. */
+int ip_conntrack_set_hashsize(unsigned int hashsize)
+{
+	struct list_head *hash, *old_hash;
+	unsigned int i, rnd, old_size;
+	int vmalloced, old_vmalloced;
+
+	if (!hashsize)
+		return -EINVAL;
+
+	hash = alloc_conntrack_hash(hashsize, &vmalloced);
+	if (!hash)
+		return -ENOMEM;
+	get_random_bytes(&rnd, sizeof(rnd));
+
+	down(&ip_conntrack_resize_sem);
+	ip_ct_all_lock_bh();
+	write_seqcount_begin(&ip_conntrack_generation);
+
+	for (i = 0; i < ip_conntrack_htable_size; i++) {
+		while (!list_empty(&ip_conntrack_hash[i])) {
+			struct ip_conntrack_tuple_hash *h;
+			unsigned int bucket;
+
+			h = list_entry(ip_conntrack_hash[i].next,
+				       struct ip_conntrack_tuple_hash, list);
+			bucket = __hash_conntrack(&h->tuple, hashsize, rnd);
+			list_del_rcu(&h->list);
+			list_add_rcu(&h->list, &hash[bucket]);
+		}
+	}
+
+	old_hash = ip_conntrack_hash;
+	old_size = ip_conntrack_htable_size;
+	old_vmalloced = ip_conntrack_vmalloc;
+
+	ip_conntrack_hash = hash;
+	ip_conntrack_htable_size = hashsize;
+	ip_conntrack_vmalloc = vmalloced;
+	ip_conntrack_hash_rnd = rnd;
+	ip_conntrack_hash_rnd_initted = 1;
+
+	write_seqcount_end(&ip_conntrack_generation);
+	ip_ct_all_unlock_bh();
+
+	/* Lockless readers may still be on the old buckets. */
+	synchronize_kernel();
+	free_conntrack_hash(old_hash, old_vmalloced, old_size);
+
+	if (ip_conntrack_resized)
+		ip_conntrack_resized(hashsize);
+	up(&ip_conntrack_resize_sem);
+
+	return 0;
 }
 
 /* Mishearing the voices in his head, our hero wonders how he's
@@ -1139,7 +1473,8 @@ void ip_conntrack_cleanup(void)
 
 	kmem_cache_destroy(ip_conntrack_cachep);
 	kmem_cache_destroy(ip_conntrack_expect_cachep);
-	free_conntrack_hash();
+	free_conntrack_hash(ip_conntrack_hash, ip_conntrack_vmalloc,
+			    ip_conntrack_htable_size);
 	nf_unregister_sockopt(&so_getorigdst);
 }
 
@@ -1177,20 +1512,8 @@ int __init ip_conntrack_init(void)
 		return ret;
 	}
 
-	/* AK: the hash table is twice as big than needed because it
-	   uses list_head.  it would be much nicer to caches to use a
-	   single pointer list head here. */
-	ip_conntrack_vmalloc = 0; 
-	ip_conntrack_hash 
-		=(void*)__get_free_pages(GFP_KERNEL, 
-					 get_order(sizeof(struct list_head)
-						   *ip_conntrack_htable_size));
-	if (!ip_conntrack_hash) { 
-		ip_conntrack_vmalloc = 1;
-		printk(KERN_WARNING "ip_conntrack: falling back to vmalloc.\n");
-		ip_conntrack_hash = vmalloc(sizeof(struct list_head)
-					    * ip_conntrack_htable_size);
-	}
+	ip_conntrack_hash = alloc_conntrack_hash(ip_conntrack_htable_size,
+						 &ip_conntrack_vmalloc);
 	if (!ip_conntrack_hash) {
 		printk(KERN_ERR "Unable to create ip_conntrack_hash\n");
 		goto err_unreg_sockopt;
@@ -1222,8 +1545,12 @@ int __init ip_conntrack_init(void)
 	ip_ct_protos[IPPROTO_ICMP] = &ip_conntrack_protocol_icmp;
 	WRITE_UNLOCK(&ip_conntrack_lock);
 
-	for (i = 0; i < ip_conntrack_htable_size; i++)
-		INIT_LIST_HEAD(&ip_conntrack_hash[i]);
+	for (i = 0; i < IP_CT_LOCKS; i++)
+		spin_lock_init(&ip_conntrack_locks[i]);
+	for (i = 0; i < NR_CPUS; i++) {
+		spin_lock_init(&per_cpu(ip_ct_unconfirmed, i).lock);
+		INIT_LIST_HEAD(&per_cpu(ip_ct_unconfirmed, i).list);
+	}
 
 	/* For use by ipt_REJECT */
 	ip_ct_attach = ip_conntrack_attach;
@@ -1239,7 +1566,8 @@ int __init ip_conntrack_init(void)
 err_free_conntrack_slab:
 	kmem_cache_destroy(ip_conntrack_cachep);
 err_free_hash:
-	free_conntrack_hash();
+	free_conntrack_hash(ip_conntrack_hash, ip_conntrack_vmalloc,
+			    ip_conntrack_htable_size);
 err_unreg_sockopt:
 	nf_unregister_sockopt(&so_getorigdst);
 
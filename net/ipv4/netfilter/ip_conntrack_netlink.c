@@ -0,0 +1,320 @@
+/*
+ * Connection tracking events and table dumps over netlink.  See
+ * linux/netfilter_ipv4/ip_conntrack_netlink.h.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/init.h>
+#include <linux/netlink.h>
+#include <linux/notifier.h>
+#include <linux/percpu.h>
+#include <linux/timer.h>
+#include <linux/security.h>
+#include <linux/in.h>
+#include <net/sock.h>
+
+#include <linux/netfilter_ipv4/ip_conntrack.h>
+#include <linux/netfilter_ipv4/ip_conntrack_core.h>
+#include <linux/netfilter_ipv4/ip_conntrack_netlink.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("IPv4 connection tracking netlink interface");
+
+static unsigned int flush_interval = 50;
+module_param(flush_interval, uint, 0600);
+MODULE_PARM_DESC(flush_interval, "longest wait for a batch of events, in ms; 0 sends every event at once");
+
+static struct sock *ctnl;
+
+#define CTNL_MSG_SPACE	NLMSG_SPACE(sizeof(struct ip_ctnl_msg))
+
+/* Events waiting to go out, per CPU and group.  The lock is only
+   contended by the flush timer. */
+struct ctnl_batch {
+	spinlock_t lock;
+	struct sk_buff *skb[2];		/* IPCTNL_GRP_NEW, _DESTROY */
+};
+static DEFINE_PER_CPU(struct ctnl_batch, ctnl_batch);
+static struct timer_list ctnl_flush_timer;
+
+static int
+ctnl_fill(struct sk_buff *skb, u32 pid, u32 seq, int type, int flags,
+	  const struct ip_conntrack *ct)
+{
+	unsigned char *b = skb->tail;
+	struct nlmsghdr *nlh;
+	struct ip_ctnl_msg *m;
+	int dir;
+
+	nlh = NLMSG_PUT(skb, pid, seq, type, sizeof(*m));
+	nlh->nlmsg_flags = flags;
+	m = NLMSG_DATA(nlh);
+	memset(m, 0, sizeof(*m));
+
+	for (dir = 0; dir < IP_CT_DIR_MAX; dir++) {
+		const struct ip_conntrack_tuple *t = &ct->tuplehash[dir].tuple;
+
+		m->tuple[dir].src = t->src.ip;
+		m->tuple[dir].dst = t->dst.ip;
+		m->tuple[dir].src_u = t->src.u.all;
+		m->tuple[dir].dst_u = t->dst.u.all;
+#ifdef CONFIG_IP_NF_CT_ACCT
+		m->packets[dir] = ct->counters[dir].packets;
+		m->bytes[dir] = ct->counters[dir].bytes;
+#endif
+	}
+
+	m->status = ct->status;
+	if (type == IPCTNL_MSG_NEW && timer_pending(&ct->timeout)) {
+		long timeout = (long)(ct->timeout.expires - jiffies) / HZ;
+
+		m->timeout = timeout > 0 ? timeout : 0;
+	}
+#if defined(CONFIG_IP_NF_CONNTRACK_MARK)
+	m->mark = ct->mark;
+#endif
+	m->protonum = ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple.dst.protonum;
+	if (m->protonum == IPPROTO_TCP)
+		m->tcp_state = ct->proto.tcp.state;
+
+	nlh->nlmsg_len = skb->tail - b;
+	return skb->len;
+
+nlmsg_failure:
+	skb_trim(skb, b - skb->data);
+	return -1;
+}
+
+static inline void
+ctnl_send(struct sk_buff *skb, int grp)
+{
+	netlink_broadcast(ctnl, skb, 0, 1 << grp, GFP_ATOMIC);
+}
+
+static int
+ctnl_conntrack_event(struct notifier_block *this, unsigned long event,
+		     void *ptr)
+{
+	struct ip_conntrack *ct = ptr;
+	struct ctnl_batch *batch;
+	struct sk_buff *full = NULL;
+	int grp, type;
+
+	switch (event) {
+	case IPCT_NEW:
+		grp = 0;
+		type = IPCTNL_MSG_NEW;
+		break;
+	case IPCT_DESTROY:
+		grp = 1;
+		type = IPCTNL_MSG_DESTROY;
+		break;
+	default:
+		return NOTIFY_DONE;
+	}
+
+	local_bh_disable();
+	batch = &__get_cpu_var(ctnl_batch);
+	spin_lock(&batch->lock);
+
+	if (batch->skb[grp] && skb_tailroom(batch->skb[grp]) < CTNL_MSG_SPACE) {
+		full = batch->skb[grp];
+		batch->skb[grp] = NULL;
+	}
+	if (!batch->skb[grp]) {
+		batch->skb[grp] = alloc_skb(flush_interval ? NLMSG_GOODSIZE
+					    : CTNL_MSG_SPACE, GFP_ATOMIC);
+		if (!batch->skb[grp])
+			goto unlock;
+	}
+	ctnl_fill(batch->skb[grp], 0, 0, type, 0, ct);
+
+	if (!flush_interval) {
+		ctnl_send(batch->skb[grp], grp);
+		batch->skb[grp] = NULL;
+	} else if (!timer_pending(&ctnl_flush_timer))
+		mod_timer(&ctnl_flush_timer,
+			  jiffies + msecs_to_jiffies(flush_interval));
+unlock:
+	spin_unlock(&batch->lock);
+
+	if (full)
+		ctnl_send(full, grp);
+	local_bh_enable();
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ctnl_notifier = {
+	.notifier_call	= ctnl_conntrack_event,
+};
+
+static void ctnl_flush(unsigned long send)
+{
+	int cpu, grp;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct ctnl_batch *batch;
+		struct sk_buff *skb[2];
+
+		if (!cpu_possible(cpu))
+			continue;
+		batch = &per_cpu(ctnl_batch, cpu);
+		spin_lock_bh(&batch->lock);
+		skb[0] = batch->skb[0];
+		skb[1] = batch->skb[1];
+		batch->skb[0] = batch->skb[1] = NULL;
+		spin_unlock_bh(&batch->lock);
+
+		for (grp = 0; grp < 2; grp++) {
+			if (!skb[grp])
+				continue;
+			if (send)
+				ctnl_send(skb[grp], grp);
+			else
+				kfree_skb(skb[grp]);
+		}
+	}
+}
+
+/* State of a dump: the bucket, the conntracks of it already sent, and
+   the generation of the table. */
+static int
+ctnl_dump_table(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct ip_conntrack_tuple_hash *h;
+	unsigned int bucket = cb->args[0], skip = cb->args[1], n = 0;
+	int err = 0;
+
+	rcu_read_lock_bh();
+	if (!cb->args[3]) {
+		cb->args[2] = read_seqcount_begin(&ip_conntrack_generation);
+		cb->args[3] = 1;
+	}
+	if (read_seqcount_retry(&ip_conntrack_generation, cb->args[2])) {
+		rcu_read_unlock_bh();
+		return -EAGAIN;
+	}
+
+	for (; bucket < ip_conntrack_htable_size; bucket++, skip = 0) {
+		n = 0;
+		list_for_each_entry_rcu(h, &ip_conntrack_hash[bucket], list) {
+			if (DIRECTION(h))
+				continue;
+			if (n++ < skip)
+				continue;
+			if (ctnl_fill(skb, NETLINK_CB(cb->skb).pid,
+				      cb->nlh->nlmsg_seq, IPCTNL_MSG_NEW,
+				      NLM_F_MULTI,
+				      tuplehash_to_ctrack(h)) < 0) {
+				n--;
+				goto out;
+			}
+		}
+		if (read_seqcount_retry(&ip_conntrack_generation,
+					cb->args[2])) {
+			err = -EAGAIN;
+			n = 0;
+			break;
+		}
+	}
+out:
+	rcu_read_unlock_bh();
+
+	cb->args[0] = bucket;
+	cb->args[1] = n;
+	if (err && !skb->len)
+		return err;
+	return skb->len;
+}
+
+static int
+ctnl_dump_done(struct netlink_callback *cb)
+{
+	return 0;
+}
+
+static int
+ctnl_rcv_msg(struct sk_buff *skb, struct nlmsghdr *nlh)
+{
+	if (!(nlh->nlmsg_flags & NLM_F_REQUEST))
+		return 0;
+
+	if (nlh->nlmsg_type != IPCTNL_MSG_GET
+	    || !(nlh->nlmsg_flags & NLM_F_DUMP))
+		return -EINVAL;
+
+	if (security_netlink_recv(skb))
+		return -EPERM;
+
+	return netlink_dump_start(ctnl, skb, nlh,
+				  ctnl_dump_table, ctnl_dump_done);
+}
+
+static inline void
+ctnl_rcv_skb(struct sk_buff *skb)
+{
+	struct nlmsghdr *nlh;
+	int err;
+
+	if (skb->len >= NLMSG_SPACE(0)) {
+		nlh = (struct nlmsghdr *)skb->data;
+		if (nlh->nlmsg_len < sizeof(*nlh) || skb->len < nlh->nlmsg_len)
+			return;
+		err = ctnl_rcv_msg(skb, nlh);
+		if (err || nlh->nlmsg_flags & NLM_F_ACK)
+			netlink_ack(skb, nlh, err);
+	}
+}
+
+static void
+ctnl_rcv(struct sock *sk, int len)
+{
+	struct sk_buff *skb;
+
+	while ((skb = skb_dequeue(&sk->sk_receive_queue)) != NULL) {
+		ctnl_rcv_skb(skb);
+		kfree_skb(skb);
+	}
+}
+
+static int __init init(void)
+{
+	int cpu, ret;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		if (cpu_possible(cpu))
+			spin_lock_init(&per_cpu(ctnl_batch, cpu).lock);
+	init_timer(&ctnl_flush_timer);
+	ctnl_flush_timer.function = ctnl_flush;
+	ctnl_flush_timer.data = 1;
+
+	ctnl = netlink_kernel_create(NETLINK_CONNTRACK, ctnl_rcv);
+	if (ctnl == NULL) {
+		printk(KERN_ERR "ip_conntrack_netlink: failed to create "
+		       "netlink socket\n");
+		return -ENOMEM;
+	}
+
+	ret = ip_conntrack_register_notifier(&ctnl_notifier);
+	if (ret < 0) {
+		sock_release(ctnl->sk_socket);
+		return ret;
+	}
+	return 0;
+}
+
+static void __exit fini(void)
+{
+	ip_conntrack_unregister_notifier(&ctnl_notifier);
+	del_timer_sync(&ctnl_flush_timer);
+	ctnl_flush(0);
+	sock_release(ctnl->sk_socket);
+}
+
+module_init(init);
+module_exit(fini);
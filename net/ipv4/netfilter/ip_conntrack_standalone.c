@@ -77,19 +77,31 @@ seq_print_counters(struct seq_file *s,
 #define seq_print_counters(x, y)	0
 #endif
 
+/* The table walked is the one current at ct_seq_start().  If it is
+   resized under us the dump simply ends early. */
 struct ct_iter_state {
 	unsigned int bucket;
+	unsigned int seq;
+	struct list_head *hash;
+	unsigned int htable_size;
 };
 
 static struct list_head *ct_get_first(struct seq_file *seq)
 {
 	struct ct_iter_state *st = seq->private;
 
-	for (st->bucket = 0;
-	     st->bucket < ip_conntrack_htable_size;
-	     st->bucket++) {
-		if (!list_empty(&ip_conntrack_hash[st->bucket]))
-			return ip_conntrack_hash[st->bucket].next;
+	st->seq = read_seqcount_begin(&ip_conntrack_generation);
+	st->hash = ip_conntrack_hash;
+	st->htable_size = ip_conntrack_htable_size;
+
+	for (st->bucket = 0; st->bucket < st->htable_size; st->bucket++) {
+		struct list_head *head;
+
+		head = rcu_dereference(st->hash[st->bucket].next);
+		if (read_seqcount_retry(&ip_conntrack_generation, st->seq))
+			return NULL;
+		if (head != &st->hash[st->bucket])
+			return head;
 	}
 	return NULL;
 }
@@ -98,13 +110,16 @@ static struct list_head *ct_get_next(struct seq_file *seq, struct list_head *hea
 {
 	struct ct_iter_state *st = seq->private;
 
-	head = head->next;
-	while (head == &ip_conntrack_hash[st->bucket]) {
-		if (++st->bucket >= ip_conntrack_htable_size)
+	head = rcu_dereference(head->next);
+	for (;;) {
+		if (read_seqcount_retry(&ip_conntrack_generation, st->seq))
 			return NULL;
-		head = ip_conntrack_hash[st->bucket].next;
+		if (head != &st->hash[st->bucket])
+			return head;
+		if (++st->bucket >= st->htable_size)
+			return NULL;
+		head = rcu_dereference(st->hash[st->bucket].next);
 	}
-	return head;
 }
 
 static struct list_head *ct_get_idx(struct seq_file *seq, loff_t pos)
@@ -119,7 +134,7 @@ static struct list_head *ct_get_idx(struct seq_file *seq, loff_t pos)
 
 static void *ct_seq_start(struct seq_file *seq, loff_t *pos)
 {
-	READ_LOCK(&ip_conntrack_lock);
+	rcu_read_lock_bh();
 	return ct_get_idx(seq, *pos);
 }
 
@@ -131,7 +146,7 @@ static void *ct_seq_next(struct seq_file *s, void *v, loff_t *pos)
   
 static void ct_seq_stop(struct seq_file *s, void *v)
 {
-	READ_UNLOCK(&ip_conntrack_lock);
+	rcu_read_unlock_bh();
 }
  
 static int ct_seq_show(struct seq_file *s, void *v)
@@ -140,7 +155,6 @@ static int ct_seq_show(struct seq_file *s, void *v)
 	const struct ip_conntrack *conntrack = tuplehash_to_ctrack(hash);
 	struct ip_conntrack_protocol *proto;
 
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
 	IP_NF_ASSERT(conntrack);
 
 	/* we only want to print DIR_ORIGINAL */
@@ -571,6 +585,54 @@ static int log_invalid_proto_max = 255;
 
 static struct ctl_table_header *ip_ct_sysctl_header;
 
+static int ip_ct_sysctl_buckets(ctl_table *ctl, int write, struct file *filp,
+				void __user *buffer, size_t *lenp,
+				loff_t *ppos)
+{
+	unsigned int size = ip_conntrack_htable_size;
+	ctl_table tmp = *ctl;
+	int ret;
+
+	tmp.data = &size;
+	ret = proc_dointvec(&tmp, write, filp, buffer, lenp, ppos);
+	if (ret || !write || size == ip_conntrack_htable_size)
+		return ret;
+	return ip_conntrack_set_hashsize(size);
+}
+
+static int ip_ct_sysctl_buckets_strategy(ctl_table *table, int __user *name,
+					 int nlen, void __user *oldval,
+					 size_t __user *oldlenp,
+					 void __user *newval, size_t newlen,
+					 void **context)
+{
+	unsigned int size;
+	int ret;
+
+	if (!newval || !newlen)
+		return 0;
+	if (newlen != sizeof(size))
+		return -EINVAL;
+	if (oldval && oldlenp) {
+		size_t len;
+
+		if (get_user(len, oldlenp))
+			return -EFAULT;
+		if (len) {
+			if (len > sizeof(size))
+				len = sizeof(size);
+			if (copy_to_user(oldval, &ip_conntrack_htable_size,
+					 len) ||
+			    put_user(len, oldlenp))
+				return -EFAULT;
+		}
+	}
+	if (copy_from_user(&size, newval, sizeof(size)))
+		return -EFAULT;
+	ret = ip_conntrack_set_hashsize(size);
+	return ret ? ret : 1;
+}
+
 static ctl_table ip_ct_sysctl_table[] = {
 	{
 		.ctl_name	= NET_IPV4_NF_CONNTRACK_MAX,
@@ -593,8 +655,9 @@ static ctl_table ip_ct_sysctl_table[] = {
 		.procname	= "ip_conntrack_buckets",
 		.data		= &ip_conntrack_htable_size,
 		.maxlen		= sizeof(unsigned int),
-		.mode		= 0444,
-		.proc_handler	= &proc_dointvec,
+		.mode		= 0644,
+		.proc_handler	= &ip_ct_sysctl_buckets,
+		.strategy	= &ip_ct_sysctl_buckets_strategy,
 	},
 	{
 		.ctl_name	= NET_IPV4_NF_CONNTRACK_TCP_TIMEOUT_SYN_SENT,
@@ -937,6 +1000,12 @@ EXPORT_SYMBOL(ip_ct_get_tuple);
 EXPORT_SYMBOL(invert_tuplepr);
 EXPORT_SYMBOL(ip_conntrack_alter_reply);
 EXPORT_SYMBOL(ip_conntrack_destroyed);
+EXPORT_SYMBOL(ip_conntrack_resized);
+#ifdef CONFIG_IP_NF_CONNTRACK_EVENTS
+EXPORT_SYMBOL_GPL(ip_conntrack_chain);
+EXPORT_SYMBOL_GPL(ip_conntrack_register_notifier);
+EXPORT_SYMBOL_GPL(ip_conntrack_unregister_notifier);
+#endif
 EXPORT_SYMBOL(need_ip_conntrack);
 EXPORT_SYMBOL(ip_conntrack_helper_register);
 EXPORT_SYMBOL(ip_conntrack_helper_unregister);
@@ -953,6 +1022,7 @@ EXPORT_SYMBOL(ip_ct_gather_frags);
 EXPORT_SYMBOL(ip_conntrack_htable_size);
 EXPORT_SYMBOL(ip_conntrack_lock);
 EXPORT_SYMBOL(ip_conntrack_hash);
+EXPORT_SYMBOL_GPL(ip_conntrack_generation);
 EXPORT_SYMBOL(ip_conntrack_untracked);
 EXPORT_SYMBOL_GPL(ip_conntrack_find_get);
 EXPORT_SYMBOL_GPL(ip_conntrack_put);
@@ -21,6 +21,7 @@
 #include <linux/icmp.h>
 #include <linux/udp.h>
 #include <linux/jhash.h>
+#include <linux/random.h>
 
 #define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(&ip_nat_lock)
 #define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(&ip_nat_lock)
@@ -43,20 +44,23 @@
 
 DECLARE_RWLOCK(ip_nat_lock);
 
-/* Calculated at init based on memory size */
+/* Calculated at init based on memory size, follows conntrack resizes */
 static unsigned int ip_nat_htable_size;
+static unsigned int ip_nat_hash_rnd;
 
 static struct list_head *bysource;
 struct ip_nat_protocol *ip_nat_protos[MAX_IP_NAT_PROTO];
 
 
-/* We keep an extra hash for each conntrack, for fast searching. */
+/* We keep an extra hash for each conntrack, for fast searching.
+   Called with ip_nat_lock held, since a resize changes the seed. */
 static inline unsigned int
 hash_by_src(const struct ip_conntrack_tuple *tuple)
 {
 	/* Original src, to ensure we map it consistently if poss. */
 	return jhash_3words(tuple->src.ip, tuple->src.u.all,
-			    tuple->dst.protonum, 0) % ip_nat_htable_size;
+			    tuple->dst.protonum, ip_nat_hash_rnd)
+		% ip_nat_htable_size;
 }
 
 /* Noone using conntrack by the time this called. */
@@ -139,10 +143,11 @@ find_appropriate_src(const struct ip_conntrack_tuple *tuple,
 		     struct ip_conntrack_tuple *result,
 		     const struct ip_nat_range *range)
 {
-	unsigned int h = hash_by_src(tuple);
+	unsigned int h;
 	struct ip_conntrack *ct;
 
 	READ_LOCK(&ip_nat_lock);
+	h = hash_by_src(tuple);
 	list_for_each_entry(ct, &bysource[h], nat.info.bysource) {
 		if (same_src(ct, tuple)) {
 			/* Copy source part from reply tuple. */
@@ -294,10 +299,11 @@ ip_nat_setup_info(struct ip_conntrack *conntrack,
 
 	/* Place in source hash if this is the first time. */
 	if (have_to_hash) {
-		unsigned int srchash
-			= hash_by_src(&conntrack->tuplehash[IP_CT_DIR_ORIGINAL]
-				      .tuple);
+		unsigned int srchash;
+
 		WRITE_LOCK(&ip_nat_lock);
+		srchash = hash_by_src(&conntrack->tuplehash[IP_CT_DIR_ORIGINAL]
+				      .tuple);
 		list_add(&info->bysource, &bysource[srchash]);
 		WRITE_UNLOCK(&ip_nat_lock);
 	}
@@ -505,12 +511,55 @@ void ip_nat_protocol_unregister(struct ip_nat_protocol *proto)
 	synchronize_net();
 }
 
+/* Follow the conntrack table: rehash bysource with a fresh seed. */
+static void ip_nat_resize(unsigned int hashsize)
+{
+	struct list_head *hash, *old_hash;
+	unsigned int i, rnd;
+
+	hash = vmalloc(sizeof(struct list_head) * hashsize);
+	if (!hash) {
+		printk(KERN_WARNING "ip_nat: can't resize hash to %u\n",
+		       hashsize);
+		return;
+	}
+	for (i = 0; i < hashsize; i++)
+		INIT_LIST_HEAD(&hash[i]);
+	get_random_bytes(&rnd, sizeof(rnd));
+
+	WRITE_LOCK(&ip_nat_lock);
+	old_hash = bysource;
+	for (i = 0; i < ip_nat_htable_size; i++) {
+		while (!list_empty(&old_hash[i])) {
+			struct ip_conntrack *ct;
+			unsigned int h;
+
+			ct = list_entry(old_hash[i].next, struct ip_conntrack,
+					nat.info.bysource);
+			h = jhash_3words(ct->tuplehash[IP_CT_DIR_ORIGINAL]
+					 .tuple.src.ip,
+					 ct->tuplehash[IP_CT_DIR_ORIGINAL]
+					 .tuple.src.u.all,
+					 ct->tuplehash[IP_CT_DIR_ORIGINAL]
+					 .tuple.dst.protonum, rnd) % hashsize;
+			list_move(&ct->nat.info.bysource, &hash[h]);
+		}
+	}
+	bysource = hash;
+	ip_nat_htable_size = hashsize;
+	ip_nat_hash_rnd = rnd;
+	WRITE_UNLOCK(&ip_nat_lock);
+
+	vfree(old_hash);
+}
+
 int __init ip_nat_init(void)
 {
 	size_t i;
 
 	/* Leave them the same for the moment. */
 	ip_nat_htable_size = ip_conntrack_htable_size;
+	get_random_bytes(&ip_nat_hash_rnd, sizeof(ip_nat_hash_rnd));
 
 	/* One vmalloc for both hash tables */
 	bysource = vmalloc(sizeof(struct list_head) * ip_nat_htable_size);
@@ -533,6 +582,7 @@ int __init ip_nat_init(void)
 	/* FIXME: Man, this is a hack.  <SIGH> */
 	IP_NF_ASSERT(ip_conntrack_destroyed == NULL);
 	ip_conntrack_destroyed = &ip_nat_cleanup_conntrack;
+	ip_conntrack_resized = &ip_nat_resize;
 
 	/* Initialize fake conntrack so that NAT will skip it */
 	ip_conntrack_untracked.status |= IPS_NAT_DONE_MASK;
@@ -552,5 +602,6 @@ void ip_nat_cleanup(void)
 {
 	ip_ct_iterate_cleanup(&clean_nat, NULL);
 	ip_conntrack_destroyed = NULL;
+	ip_conntrack_resized = NULL;
 	vfree(bysource);
 }
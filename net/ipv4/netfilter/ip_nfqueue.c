@@ -0,0 +1,899 @@
+/*
+ * Numbered queues of IPv4 packets for userspace.  Where ip_queue has a
+ * single queue and sends a netlink message per packet, this keeps one
+ * queue per bound file of /dev/ip_nfqueue, passes packets through a
+ * ring the reader has mapped, and takes verdicts for a batch of
+ * packets at a time.  See linux/netfilter_ipv4/ip_nfqueue.h.
+ *
+ * Based on ip_queue, (C) 2000-2002 James Morris, and on the packet
+ * socket ring.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/init.h>
+#include <linux/ip.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/miscdevice.h>
+#include <linux/notifier.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4/ip_nfqueue.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/spinlock.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <asm/uaccess.h>
+#include <asm/cacheflush.h>
+#include <asm/semaphore.h>
+#include <net/route.h>
+
+#define NFQ_QMAX_DEFAULT	1024
+#define NFQ_HTABLE_SIZE		16
+#define NFQ_PROC_FS_NAME	"ip_nfqueue"
+
+struct nfq_rt_info {
+	__u8 tos;
+	__u32 daddr;
+	__u32 saddr;
+};
+
+struct nfq_entry {
+	struct list_head list;
+	u_int32_t id;
+	struct nf_info *info;
+	struct sk_buff *skb;
+	struct nfq_rt_info rt_info;
+};
+
+struct nfq_ring {
+	char **pg_vec;
+	unsigned int pg_vec_order;
+	unsigned int pg_vec_pages;
+	unsigned int pg_vec_len;
+	unsigned int frames_per_block;
+	unsigned int frame_size;
+	unsigned int frame_max;
+	unsigned int head;
+};
+
+struct nfq_instance {
+	struct hlist_node hnode;	/* in instance_table, once bound */
+	int bound;
+	u_int16_t queue;
+
+	/* lock protects everything below but the ring's pages */
+	spinlock_t lock;
+	unsigned int copy_range;
+	unsigned int maxlen;
+	struct list_head entries;	/* in order of id */
+	unsigned int total;
+	u_int32_t next_id;
+	unsigned int queue_dropped;
+	unsigned int ring_dropped;
+	struct nfq_ring ring;
+
+	wait_queue_head_t wait;
+	struct semaphore ring_sem;	/* serializes ring changes, mmap */
+	atomic_t mapped;
+};
+
+typedef int (*nfq_cmpfn)(struct nfq_entry *, unsigned long);
+
+static struct hlist_head instance_table[NFQ_HTABLE_SIZE];
+static DEFINE_RWLOCK(instances_lock);
+
+static inline struct nfq_instance *
+__instance_lookup(u_int16_t queue)
+{
+	struct nfq_instance *inst;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(inst, n,
+			     &instance_table[queue % NFQ_HTABLE_SIZE], hnode)
+		if (inst->queue == queue)
+			return inst;
+	return NULL;
+}
+
+static inline char *
+nfq_lookup_frame(const struct nfq_ring *rb, unsigned int position)
+{
+	return rb->pg_vec[position / rb->frames_per_block]
+		+ (position % rb->frames_per_block) * rb->frame_size;
+}
+
+/* Make the [start, start + len) part of a frame coherent with userspace */
+static void nfq_flush_frame(void *start, unsigned int len)
+{
+	struct page *p_start, *p_end;
+
+	p_start = virt_to_page(start);
+	p_end = virt_to_page((u8 *)start + len - 1);
+	while (p_start <= p_end) {
+		flush_dcache_page(p_start);
+		p_start++;
+	}
+}
+
+static void
+nfq_issue_verdict(struct nfq_entry *entry, int verdict)
+{
+	nf_reinject(entry->skb, entry->info, verdict);
+	kfree(entry);
+}
+
+/* Move the entries matched by cmpfn, and all of them if cmpfn is NULL,
+   to list.  Called with inst->lock held. */
+static void
+__nfq_dequeue_entries(struct nfq_instance *inst, struct list_head *list,
+		      nfq_cmpfn cmpfn, unsigned long data)
+{
+	struct nfq_entry *entry, *next;
+
+	list_for_each_entry_safe(entry, next, &inst->entries, list) {
+		if (cmpfn && !cmpfn(entry, data))
+			continue;
+		list_move_tail(&entry->list, list);
+		inst->total--;
+	}
+}
+
+static void
+nfq_issue_verdicts(struct list_head *list, int verdict)
+{
+	struct nfq_entry *entry, *next;
+
+	list_for_each_entry_safe(entry, next, list, list) {
+		list_del(&entry->list);
+		nfq_issue_verdict(entry, verdict);
+	}
+}
+
+static void
+nfq_flush(struct nfq_instance *inst, int verdict)
+{
+	LIST_HEAD(list);
+
+	spin_lock_bh(&inst->lock);
+	__nfq_dequeue_entries(inst, &list, NULL, 0);
+	spin_unlock_bh(&inst->lock);
+	nfq_issue_verdicts(&list, verdict);
+}
+
+static void
+nfq_fill_frame(struct nfq_instance *inst, struct ip_nfq_frame *frame,
+	       struct nfq_entry *entry)
+{
+	struct sk_buff *skb = entry->skb;
+	struct nf_info *info = entry->info;
+	unsigned int caplen;
+
+	caplen = inst->ring.frame_size - IP_NFQ_FRAME_HDRLEN;
+	if (caplen > inst->copy_range)
+		caplen = inst->copy_range;
+	if (caplen > skb->len)
+		caplen = skb->len;
+
+	memset((char *)frame + sizeof(frame->status), 0,
+	       sizeof(*frame) - sizeof(frame->status));
+	frame->packet_id = entry->id;
+	frame->len = skb->len;
+	frame->caplen = caplen;
+	frame->mark = skb->nfmark;
+	frame->tstamp_sec = skb->stamp.tv_sec;
+	frame->tstamp_usec = skb->stamp.tv_usec;
+	frame->hook = info->hook;
+	frame->indev = info->indev ? info->indev->ifindex : 0;
+	frame->outdev = info->outdev ? info->outdev->ifindex : 0;
+	frame->hw_protocol = skb->protocol;
+
+	if (info->indev && skb->dev) {
+		frame->hw_type = skb->dev->type;
+		if (skb->dev->hard_header_parse)
+			frame->hw_addrlen =
+				skb->dev->hard_header_parse(skb,
+							    frame->hw_addr);
+	}
+
+	if (caplen && skb_copy_bits(skb, 0,
+				    (char *)frame + IP_NFQ_FRAME_HDRLEN,
+				    caplen))
+		BUG();
+
+	/* The contents must be visible before the status flips */
+	smp_wmb();
+	frame->status = IP_NFQ_STATUS_USER;
+	nfq_flush_frame(frame, IP_NFQ_FRAME_HDRLEN + caplen);
+}
+
+static int
+nfq_enqueue_packet(struct sk_buff *skb, struct nf_info *info, void *data)
+{
+	struct nfq_instance *inst;
+	struct nfq_entry *entry;
+	struct ip_nfq_frame *frame;
+	int status;
+
+	entry = kmalloc(sizeof(*entry), GFP_ATOMIC);
+	if (entry == NULL) {
+		printk(KERN_ERR "ip_nfqueue: OOM in nfq_enqueue_packet()\n");
+		return -ENOMEM;
+	}
+
+	entry->info = info;
+	entry->skb = skb;
+
+	if (info->hook == NF_IP_LOCAL_OUT) {
+		struct iphdr *iph = skb->nh.iph;
+
+		entry->rt_info.tos = iph->tos;
+		entry->rt_info.daddr = iph->daddr;
+		entry->rt_info.saddr = iph->saddr;
+	}
+
+	read_lock_bh(&instances_lock);
+	inst = __instance_lookup(info->queuenum);
+	if (inst == NULL) {
+		status = -ESRCH;
+		goto err_out_unlock;
+	}
+
+	spin_lock(&inst->lock);
+
+	if (inst->ring.pg_vec == NULL) {
+		status = -EAGAIN;
+		goto err_out_unlock_inst;
+	}
+
+	if (inst->total >= inst->maxlen) {
+		inst->queue_dropped++;
+		status = -ENOSPC;
+		if (net_ratelimit())
+			printk(KERN_WARNING "ip_nfqueue: queue %u full at %u "
+			       "entries, dropping packet(s). Dropped: %u\n",
+			       inst->queue, inst->total, inst->queue_dropped);
+		goto err_out_unlock_inst;
+	}
+
+	frame = (struct ip_nfq_frame *)nfq_lookup_frame(&inst->ring,
+							inst->ring.head);
+	if (frame->status != IP_NFQ_STATUS_KERNEL) {
+		inst->ring_dropped++;
+		status = -ENOBUFS;
+		goto err_out_unlock_inst;
+	}
+
+	entry->id = inst->next_id++;
+	nfq_fill_frame(inst, frame, entry);
+	inst->ring.head = inst->ring.head != inst->ring.frame_max
+		? inst->ring.head + 1 : 0;
+
+	list_add_tail(&entry->list, &inst->entries);
+	inst->total++;
+
+	spin_unlock(&inst->lock);
+	wake_up_interruptible(&inst->wait);
+	read_unlock_bh(&instances_lock);
+	return 0;
+
+err_out_unlock_inst:
+	spin_unlock(&inst->lock);
+err_out_unlock:
+	read_unlock_bh(&instances_lock);
+	kfree(entry);
+	return status;
+}
+
+static int
+nfq_mangle_ipv4(struct nfq_entry *e, const unsigned char *payload,
+		unsigned int data_len)
+{
+	int diff;
+
+	if (data_len < sizeof(struct iphdr))
+		return 0;
+	diff = data_len - e->skb->len;
+	if (diff < 0)
+		skb_trim(e->skb, data_len);
+	else if (diff > 0) {
+		if (diff > skb_tailroom(e->skb)) {
+			struct sk_buff *newskb;
+
+			newskb = skb_copy_expand(e->skb,
+						 skb_headroom(e->skb),
+						 diff,
+						 GFP_ATOMIC);
+			if (newskb == NULL) {
+				printk(KERN_WARNING "ip_nfqueue: OOM "
+				       "in mangle, dropping packet\n");
+				return -ENOMEM;
+			}
+			if (e->skb->sk)
+				skb_set_owner_w(newskb, e->skb->sk);
+			kfree_skb(e->skb);
+			e->skb = newskb;
+		}
+		skb_put(e->skb, diff);
+	}
+	if (!skb_ip_make_writable(&e->skb, data_len))
+		return -ENOMEM;
+	memcpy(e->skb->data, payload, data_len);
+	e->skb->nfcache |= NFC_ALTERED;
+
+	/*
+	 * Extra routing may needed on local out, as the QUEUE target never
+	 * returns control to the table.
+	 */
+	if (e->info->hook == NF_IP_LOCAL_OUT) {
+		struct iphdr *iph = e->skb->nh.iph;
+
+		if (!(iph->tos == e->rt_info.tos
+		      && iph->daddr == e->rt_info.daddr
+		      && iph->saddr == e->rt_info.saddr))
+			return ip_route_me_harder(&e->skb);
+	}
+	return 0;
+}
+
+static inline int
+id_cmp(struct nfq_entry *e, unsigned long id)
+{
+	return e->id == id;
+}
+
+/* IDs wrap, but never by more than the queue length. */
+static inline int
+id_upto_cmp(struct nfq_entry *e, unsigned long id)
+{
+	return (int32_t)(e->id - (u_int32_t)id) <= 0;
+}
+
+static int
+nfq_set_verdict(struct nfq_instance *inst, const struct ip_nfq_verdict *v,
+		const unsigned char __user *payload)
+{
+	struct nfq_entry *entry;
+	unsigned char *data = NULL;
+	int verdict = v->verdict;
+	LIST_HEAD(list);
+
+	if ((verdict & NF_VERDICT_MASK) > NF_MAX_VERDICT
+	    || (verdict & NF_VERDICT_MASK) == NF_STOLEN)
+		return -EINVAL;
+
+	if (v->flags & IP_NFQ_VERDICT_BATCH) {
+		if (v->data_len)
+			return -EINVAL;
+
+		spin_lock_bh(&inst->lock);
+		__nfq_dequeue_entries(inst, &list, id_upto_cmp, v->id);
+		spin_unlock_bh(&inst->lock);
+		if (list_empty(&list))
+			return -ENOENT;
+		nfq_issue_verdicts(&list, verdict);
+		return 0;
+	}
+
+	if (v->data_len) {
+		data = kmalloc(v->data_len, GFP_KERNEL);
+		if (data == NULL)
+			return -ENOMEM;
+		if (copy_from_user(data, payload, v->data_len)) {
+			kfree(data);
+			return -EFAULT;
+		}
+	}
+
+	spin_lock_bh(&inst->lock);
+	__nfq_dequeue_entries(inst, &list, id_cmp, v->id);
+	spin_unlock_bh(&inst->lock);
+	if (list_empty(&list)) {
+		kfree(data);
+		return -ENOENT;
+	}
+
+	entry = list_entry(list.next, struct nfq_entry, list);
+	list_del(&entry->list);
+	if (data && nfq_mangle_ipv4(entry, data, v->data_len) < 0)
+		verdict = NF_DROP;
+	nfq_issue_verdict(entry, verdict);
+	kfree(data);
+	return 0;
+}
+
+static ssize_t
+nfq_write(struct file *file, const char __user *buf, size_t count,
+	  loff_t *ppos)
+{
+	struct nfq_instance *inst = file->private_data;
+	struct ip_nfq_verdict v;
+	size_t done = 0, len;
+	int ret = -EINVAL;
+
+	while (count - done >= sizeof(v)) {
+		if (copy_from_user(&v, buf + done, sizeof(v))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (v.data_len > 0xFFFF) {
+			ret = -EINVAL;
+			break;
+		}
+		len = sizeof(v) + v.data_len;
+		if (len > count - done) {
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = nfq_set_verdict(inst, &v, buf + done + sizeof(v));
+		if (ret < 0)
+			break;
+
+		len = IP_NFQ_ALIGN(len);
+		done += min(len, count - done);
+	}
+	return done ? done : ret;
+}
+
+static unsigned int
+nfq_poll(struct file *file, poll_table *wait)
+{
+	struct nfq_instance *inst = file->private_data;
+	unsigned int mask = POLLOUT | POLLWRNORM;
+
+	poll_wait(file, &inst->wait, wait);
+
+	spin_lock_bh(&inst->lock);
+	if (inst->ring.pg_vec) {
+		struct nfq_ring *rb = &inst->ring;
+		unsigned int last = rb->head ? rb->head - 1 : rb->frame_max;
+		struct ip_nfq_frame *frame;
+
+		frame = (struct ip_nfq_frame *)nfq_lookup_frame(rb, last);
+		if (frame->status != IP_NFQ_STATUS_KERNEL)
+			mask |= POLLIN | POLLRDNORM;
+	}
+	spin_unlock_bh(&inst->lock);
+	return mask;
+}
+
+static int
+nfq_bind(struct nfq_instance *inst, const struct ip_nfq_config *cfg)
+{
+	struct nfq_instance *other;
+	int ret = 0;
+
+	write_lock_bh(&instances_lock);
+	if (inst->bound && inst->queue != cfg->queue) {
+		ret = -EBUSY;
+		goto out;
+	}
+	other = __instance_lookup(cfg->queue);
+	if (other && other != inst) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	spin_lock(&inst->lock);
+	inst->copy_range = cfg->copy_range;
+	inst->maxlen = cfg->maxlen ? cfg->maxlen : NFQ_QMAX_DEFAULT;
+	spin_unlock(&inst->lock);
+
+	if (!inst->bound) {
+		inst->queue = cfg->queue;
+		inst->bound = 1;
+		hlist_add_head(&inst->hnode,
+			       &instance_table[cfg->queue % NFQ_HTABLE_SIZE]);
+		net_enable_timestamp();
+	}
+out:
+	write_unlock_bh(&instances_lock);
+	return ret;
+}
+
+static inline struct page *pg_vec_endpage(char *one_pg_vec, unsigned int order)
+{
+	return virt_to_page(one_pg_vec + (PAGE_SIZE << order) - 1);
+}
+
+static void free_pg_vec(char **pg_vec, unsigned order, unsigned len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (pg_vec[i]) {
+			struct page *page, *pend;
+
+			pend = pg_vec_endpage(pg_vec[i], order);
+			for (page = virt_to_page(pg_vec[i]); page <= pend; page++)
+				ClearPageReserved(page);
+			free_pages((unsigned long)pg_vec[i], order);
+		}
+	}
+	kfree(pg_vec);
+}
+
+#define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
+
+static int
+nfq_set_ring(struct nfq_instance *inst, struct ip_nfq_ring_req *req)
+{
+	char **pg_vec = NULL;
+	unsigned int frames_per_block = 0;
+	int i, order = 0;
+	int err;
+
+	if (req->block_nr) {
+		if ((int)req->block_size <= 0
+		    || req->block_size & (PAGE_SIZE-1))
+			return -EINVAL;
+		if (req->frame_size < IP_NFQ_FRAME_HDRLEN
+		    || req->frame_size & (IP_NFQ_ALIGNMENT-1))
+			return -EINVAL;
+
+		frames_per_block = req->block_size / req->frame_size;
+		if (frames_per_block == 0
+		    || frames_per_block * req->block_nr != req->frame_nr)
+			return -EINVAL;
+
+		while ((PAGE_SIZE << order) < req->block_size)
+			order++;
+
+		pg_vec = kmalloc(req->block_nr * sizeof(char *), GFP_KERNEL);
+		if (pg_vec == NULL)
+			return -ENOMEM;
+		memset(pg_vec, 0, req->block_nr * sizeof(char *));
+
+		for (i = 0; i < req->block_nr; i++) {
+			struct page *page, *pend;
+
+			pg_vec[i] = (char *)__get_free_pages(GFP_KERNEL, order);
+			if (!pg_vec[i]) {
+				free_pg_vec(pg_vec, order, req->block_nr);
+				return -ENOMEM;
+			}
+			/* Every frame starts out IP_NFQ_STATUS_KERNEL */
+			memset(pg_vec[i], 0, PAGE_SIZE << order);
+
+			pend = pg_vec_endpage(pg_vec[i], order);
+			for (page = virt_to_page(pg_vec[i]); page <= pend; page++)
+				SetPageReserved(page);
+		}
+	} else if (req->frame_nr)
+		return -EINVAL;
+
+	down(&inst->ring_sem);
+	err = -EBUSY;
+	if (atomic_read(&inst->mapped) == 0) {
+		err = 0;
+		spin_lock_bh(&inst->lock);
+		pg_vec = XC(inst->ring.pg_vec, pg_vec);
+		inst->ring.frames_per_block = frames_per_block;
+		inst->ring.frame_size = req->frame_size;
+		inst->ring.frame_max = req->frame_nr - 1;
+		inst->ring.head = 0;
+		spin_unlock_bh(&inst->lock);
+
+		order = XC(inst->ring.pg_vec_order, order);
+		req->block_nr = XC(inst->ring.pg_vec_len, req->block_nr);
+		inst->ring.pg_vec_pages = req->block_size / PAGE_SIZE;
+	}
+	up(&inst->ring_sem);
+
+	/* The old ring, or the new one if it's not in use */
+	if (pg_vec)
+		free_pg_vec(pg_vec, order, req->block_nr);
+	return err;
+}
+
+#undef XC
+
+static int
+nfq_ioctl(struct inode *inode, struct file *file, unsigned int cmd,
+	  unsigned long arg)
+{
+	struct nfq_instance *inst = file->private_data;
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case IP_NFQ_BIND: {
+		struct ip_nfq_config cfg;
+
+		if (copy_from_user(&cfg, argp, sizeof(cfg)))
+			return -EFAULT;
+		return nfq_bind(inst, &cfg);
+	}
+
+	case IP_NFQ_SET_RING: {
+		struct ip_nfq_ring_req req;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		return nfq_set_ring(inst, &req);
+	}
+
+	case IP_NFQ_GET_STATS: {
+		struct ip_nfq_stats st;
+
+		spin_lock_bh(&inst->lock);
+		st.queued = inst->total;
+		st.maxlen = inst->maxlen;
+		st.queue_dropped = inst->queue_dropped;
+		st.ring_dropped = inst->ring_dropped;
+		spin_unlock_bh(&inst->lock);
+		return copy_to_user(argp, &st, sizeof(st)) ? -EFAULT : 0;
+	}
+	}
+	return -ENOTTY;
+}
+
+static void nfq_mm_open(struct vm_area_struct *vma)
+{
+	struct nfq_instance *inst = vma->vm_file->private_data;
+
+	atomic_inc(&inst->mapped);
+}
+
+static void nfq_mm_close(struct vm_area_struct *vma)
+{
+	struct nfq_instance *inst = vma->vm_file->private_data;
+
+	atomic_dec(&inst->mapped);
+}
+
+static struct vm_operations_struct nfq_mmap_ops = {
+	.open	= nfq_mm_open,
+	.close	= nfq_mm_close,
+};
+
+static int
+nfq_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct nfq_instance *inst = file->private_data;
+	struct nfq_ring *rb = &inst->ring;
+	unsigned long start;
+	int err = -EINVAL;
+	int i;
+
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	down(&inst->ring_sem);
+	if (rb->pg_vec == NULL
+	    || vma->vm_end - vma->vm_start
+	       != rb->pg_vec_len * rb->pg_vec_pages * PAGE_SIZE)
+		goto out;
+
+	start = vma->vm_start;
+	err = -EAGAIN;
+	for (i = 0; i < rb->pg_vec_len; i++) {
+		if (remap_pfn_range(vma, start,
+				    __pa(rb->pg_vec[i]) >> PAGE_SHIFT,
+				    rb->pg_vec_pages * PAGE_SIZE,
+				    vma->vm_page_prot))
+			goto out;
+		start += rb->pg_vec_pages * PAGE_SIZE;
+	}
+	atomic_inc(&inst->mapped);
+	vma->vm_ops = &nfq_mmap_ops;
+	err = 0;
+out:
+	up(&inst->ring_sem);
+	return err;
+}
+
+static int
+nfq_open(struct inode *inode, struct file *file)
+{
+	struct nfq_instance *inst;
+
+	inst = kmalloc(sizeof(*inst), GFP_KERNEL);
+	if (inst == NULL)
+		return -ENOMEM;
+	memset(inst, 0, sizeof(*inst));
+
+	INIT_HLIST_NODE(&inst->hnode);
+	spin_lock_init(&inst->lock);
+	INIT_LIST_HEAD(&inst->entries);
+	inst->maxlen = NFQ_QMAX_DEFAULT;
+	init_waitqueue_head(&inst->wait);
+	init_MUTEX(&inst->ring_sem);
+	atomic_set(&inst->mapped, 0);
+
+	file->private_data = inst;
+	return 0;
+}
+
+static int
+nfq_release(struct inode *inode, struct file *file)
+{
+	struct nfq_instance *inst = file->private_data;
+
+	write_lock_bh(&instances_lock);
+	if (inst->bound) {
+		hlist_del(&inst->hnode);
+		net_disable_timestamp();
+	}
+	write_unlock_bh(&instances_lock);
+
+	nfq_flush(inst, NF_DROP);
+	if (inst->ring.pg_vec)
+		free_pg_vec(inst->ring.pg_vec, inst->ring.pg_vec_order,
+			    inst->ring.pg_vec_len);
+	kfree(inst);
+	return 0;
+}
+
+static struct file_operations nfq_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nfq_open,
+	.release	= nfq_release,
+	.write		= nfq_write,
+	.poll		= nfq_poll,
+	.ioctl		= nfq_ioctl,
+	.mmap		= nfq_mmap,
+};
+
+static struct miscdevice nfq_miscdev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= IP_NFQ_DEVICE_NAME,
+	.fops	= &nfq_fops,
+};
+
+static int
+dev_cmp(struct nfq_entry *entry, unsigned long ifindex)
+{
+	if (entry->info->indev)
+		if (entry->info->indev->ifindex == ifindex)
+			return 1;
+
+	if (entry->info->outdev)
+		if (entry->info->outdev->ifindex == ifindex)
+			return 1;
+
+	return 0;
+}
+
+static void
+nfq_dev_drop(int ifindex)
+{
+	struct nfq_instance *inst;
+	struct hlist_node *n;
+	LIST_HEAD(list);
+	int i;
+
+	read_lock_bh(&instances_lock);
+	for (i = 0; i < NFQ_HTABLE_SIZE; i++)
+		hlist_for_each_entry(inst, n, &instance_table[i], hnode) {
+			spin_lock(&inst->lock);
+			__nfq_dequeue_entries(inst, &list, dev_cmp, ifindex);
+			spin_unlock(&inst->lock);
+		}
+	read_unlock_bh(&instances_lock);
+
+	nfq_issue_verdicts(&list, NF_DROP);
+}
+
+static int
+nfq_rcv_dev_event(struct notifier_block *this,
+		  unsigned long event, void *ptr)
+{
+	struct net_device *dev = ptr;
+
+	/* Drop any packets associated with the downed device */
+	if (event == NETDEV_DOWN)
+		nfq_dev_drop(dev->ifindex);
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block nfq_dev_notifier = {
+	.notifier_call	= nfq_rcv_dev_event,
+};
+
+#ifdef CONFIG_PROC_FS
+static int nfq_seq_show(struct seq_file *s, void *v)
+{
+	struct nfq_instance *inst;
+	struct hlist_node *n;
+	int i;
+
+	seq_printf(s, "queue  copy_range   queued   maxlen  "
+		   "queue_dropped ring_dropped\n");
+
+	read_lock_bh(&instances_lock);
+	for (i = 0; i < NFQ_HTABLE_SIZE; i++)
+		hlist_for_each_entry(inst, n, &instance_table[i], hnode) {
+			spin_lock(&inst->lock);
+			seq_printf(s, "%5u %11u %8u %8u %14u %12u\n",
+				   inst->queue, inst->copy_range, inst->total,
+				   inst->maxlen, inst->queue_dropped,
+				   inst->ring_dropped);
+			spin_unlock(&inst->lock);
+		}
+	read_unlock_bh(&instances_lock);
+	return 0;
+}
+
+static int nfq_seq_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfq_seq_show, NULL);
+}
+
+static struct file_operations nfq_seq_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nfq_seq_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif /* CONFIG_PROC_FS */
+
+static int
+init_or_cleanup(int init)
+{
+	int status;
+
+	if (!init)
+		goto cleanup;
+
+	status = misc_register(&nfq_miscdev);
+	if (status < 0) {
+		printk(KERN_ERR "ip_nfqueue: failed to register device\n");
+		return status;
+	}
+
+#ifdef CONFIG_PROC_FS
+	if (!proc_net_fops_create(NFQ_PROC_FS_NAME, 0444, &nfq_seq_fops)) {
+		printk(KERN_ERR "ip_nfqueue: failed to create proc entry\n");
+		status = -ENOMEM;
+		goto cleanup_misc;
+	}
+#endif
+
+	register_netdevice_notifier(&nfq_dev_notifier);
+
+	status = nf_register_queue_handler(PF_INET, nfq_enqueue_packet, NULL);
+	if (status < 0) {
+		printk(KERN_ERR "ip_nfqueue: failed to register queue "
+		       "handler\n");
+		goto cleanup_notifier;
+	}
+	return status;
+
+cleanup:
+	/* Open files hold the module, so all instances are gone */
+	nf_unregister_queue_handler(PF_INET);
+	synchronize_net();
+	status = 0;
+
+cleanup_notifier:
+	unregister_netdevice_notifier(&nfq_dev_notifier);
+#ifdef CONFIG_PROC_FS
+	proc_net_remove(NFQ_PROC_FS_NAME);
+cleanup_misc:
+#endif
+	misc_deregister(&nfq_miscdev);
+	return status;
+}
+
+static int __init init(void)
+{
+	return init_or_cleanup(1);
+}
+
+static void __exit fini(void)
+{
+	init_or_cleanup(0);
+}
+
+MODULE_DESCRIPTION("IPv4 numbered packet queues with a mapped ring");
+MODULE_LICENSE("GPL");
+
+module_init(init);
+module_exit(fini);
@@ -0,0 +1,633 @@
+/* IP sets: the set array, set types, the SO_IP_SET socket option and
+ * the packet path used by the `set' match and the `SET' target.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/kmod.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <linux/netfilter.h>
+#include <net/ip.h>
+#include <linux/netfilter_ipv4/ip_set.h>
+#include <asm/semaphore.h>
+#include <asm/uaccess.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("IP set support");
+
+#if 0
+#define DEBUGP printk
+#else
+#define DEBUGP(format, args...)
+#endif
+
+static int max_sets = 256;
+module_param(max_sets, int, 0400);
+MODULE_PARM_DESC(max_sets, "maximal number of sets");
+
+/* Rules refer to sets by their index in ip_set_list.  The packet path
+ * looks sets up under ip_set_lock read; the array only changes under
+ * ip_set_lock write, with ip_set_app_sem held.  The semaphore also
+ * covers the type list, set names and reference counts.  Elements are
+ * protected by each set's own lock. */
+static struct ip_set **ip_set_list;
+static DEFINE_RWLOCK(ip_set_lock);
+static DECLARE_MUTEX(ip_set_app_sem);
+static LIST_HEAD(ip_set_type_list);
+
+static struct ip_set_type *find_set_type(const char *typename)
+{
+	struct ip_set_type *type;
+
+	list_for_each_entry(type, &ip_set_type_list, list)
+		if (strncmp(type->typename, typename, IP_SET_MAXNAMELEN) == 0)
+			return type;
+	return NULL;
+}
+
+static struct ip_set *find_set_byname(const char *name)
+{
+	ip_set_id_t i;
+
+	for (i = 0; i < max_sets; i++)
+		if (ip_set_list[i]
+		    && strncmp(ip_set_list[i]->name, name,
+			       IP_SET_MAXNAMELEN) == 0)
+			return ip_set_list[i];
+	return NULL;
+}
+
+int ip_set_register_type(struct ip_set_type *type)
+{
+	int ret = 0;
+
+	if (!type->create || !type->destroy || !type->flush || !type->test
+	    || !type->add || !type->del || !type->members
+	    || !type->list_members) {
+		printk(KERN_ERR "ip_set: type %s does not implement "
+		       "required ops\n", type->typename);
+		return -EINVAL;
+	}
+
+	down(&ip_set_app_sem);
+	if (find_set_type(type->typename))
+		ret = -EEXIST;
+	else
+		list_add(&type->list, &ip_set_type_list);
+	up(&ip_set_app_sem);
+
+	return ret;
+}
+
+/* Sets of this type hold a reference on its module, so there are
+   none left by now. */
+void ip_set_unregister_type(struct ip_set_type *type)
+{
+	down(&ip_set_app_sem);
+	list_del(&type->list);
+	up(&ip_set_app_sem);
+}
+
+ip_set_id_t ip_set_get_byname(const char *name)
+{
+	struct ip_set *set;
+	ip_set_id_t id = IP_SET_INVALID_ID;
+
+	down(&ip_set_app_sem);
+	set = find_set_byname(name);
+	if (set) {
+		set->ref++;
+		id = set->id;
+	}
+	up(&ip_set_app_sem);
+
+	return id;
+}
+
+void ip_set_put(ip_set_id_t id)
+{
+	down(&ip_set_app_sem);
+	BUG_ON(!ip_set_list[id] || !ip_set_list[id]->ref);
+	ip_set_list[id]->ref--;
+	up(&ip_set_app_sem);
+}
+
+/* Packet path */
+
+static int build_elem(const struct ip_set *set, const struct sk_buff *skb,
+		      int src_ip, int src_port, struct ip_set_elem *elem)
+{
+	const struct iphdr *iph = skb->nh.iph;
+	u_int16_t ports[2];
+
+	memset(elem, 0, sizeof(*elem));
+	elem->ip = ntohl(src_ip ? iph->saddr : iph->daddr);
+	elem->cidr = 32;
+
+	if (!(set->type->features & IPSET_TYPE_PORT))
+		return 1;
+
+	/* TCP and UDP both start with the source and destination port. */
+	if (iph->frag_off & htons(IP_OFFSET))
+		return 0;
+	if (iph->protocol != IPPROTO_TCP && iph->protocol != IPPROTO_UDP)
+		return 0;
+	if (skb_copy_bits(skb, iph->ihl * 4, ports, sizeof(ports)) < 0)
+		return 0;
+	elem->port = ntohs(src_port ? ports[0] : ports[1]);
+
+	return 1;
+}
+
+int ip_set_testip_kernel(ip_set_id_t id, const struct sk_buff *skb,
+			 int src_ip, int src_port)
+{
+	struct ip_set *set;
+	struct ip_set_elem elem;
+	int ret = 0;
+
+	read_lock_bh(&ip_set_lock);
+	set = ip_set_list[id];
+	if (build_elem(set, skb, src_ip, src_port, &elem)) {
+		read_lock(&set->lock);
+		ret = set->type->test(set, &elem);
+		read_unlock(&set->lock);
+	}
+	read_unlock_bh(&ip_set_lock);
+
+	return ret;
+}
+
+void ip_set_addip_kernel(ip_set_id_t id, const struct sk_buff *skb,
+			 int src_ip, int src_port)
+{
+	struct ip_set *set;
+	struct ip_set_elem elem;
+
+	read_lock_bh(&ip_set_lock);
+	set = ip_set_list[id];
+	if (build_elem(set, skb, src_ip, src_port, &elem)) {
+		write_lock(&set->lock);
+		set->type->add(set, &elem);
+		write_unlock(&set->lock);
+	}
+	read_unlock_bh(&ip_set_lock);
+}
+
+void ip_set_delip_kernel(ip_set_id_t id, const struct sk_buff *skb,
+			 int src_ip, int src_port)
+{
+	struct ip_set *set;
+	struct ip_set_elem elem;
+
+	read_lock_bh(&ip_set_lock);
+	set = ip_set_list[id];
+	if (build_elem(set, skb, src_ip, src_port, &elem)) {
+		write_lock(&set->lock);
+		set->type->del(set, &elem);
+		write_unlock(&set->lock);
+	}
+	read_unlock_bh(&ip_set_lock);
+}
+
+/* Userspace requests, all under ip_set_app_sem */
+
+static int ip_set_create(const char *name, const char *typename,
+			 const void *data, size_t size)
+{
+	struct ip_set_type *type;
+	struct ip_set *set;
+	ip_set_id_t id;
+	int ret;
+
+	if (!*name)
+		return -EINVAL;
+	if (find_set_byname(name))
+		return -EEXIST;
+
+	for (id = 0; id < max_sets; id++)
+		if (!ip_set_list[id])
+			break;
+	if (id == max_sets)
+		return -ENOSPC;
+
+	type = find_set_type(typename);
+#ifdef CONFIG_KMOD
+	if (!type) {
+		up(&ip_set_app_sem);
+		request_module("ip_set_%s", typename);
+		down(&ip_set_app_sem);
+		type = find_set_type(typename);
+		/* Somebody may have been quicker. */
+		if (find_set_byname(name))
+			return -EEXIST;
+		if (ip_set_list[id])
+			return -EAGAIN;
+	}
+#endif
+	if (!type)
+		return -ENOENT;
+	if (size != type->create_size)
+		return -EINVAL;
+	if (!try_module_get(type->me))
+		return -ENOENT;
+
+	set = kmalloc(sizeof(*set), GFP_KERNEL);
+	if (!set) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+	memset(set, 0, sizeof(*set));
+	strncpy(set->name, name, IP_SET_MAXNAMELEN);
+	set->id = id;
+	rwlock_init(&set->lock);
+	set->type = type;
+
+	ret = type->create(set, data, size);
+	if (ret)
+		goto out_free;
+
+	write_lock_bh(&ip_set_lock);
+	ip_set_list[id] = set;
+	write_unlock_bh(&ip_set_lock);
+
+	DEBUGP("ip_set: created %s of type %s at %u\n", name, typename, id);
+	return 0;
+
+out_free:
+	kfree(set);
+out_put:
+	module_put(type->me);
+	return ret;
+}
+
+static int ip_set_destroy(const char *name)
+{
+	struct ip_set *set = find_set_byname(name);
+
+	if (!set)
+		return -ENOENT;
+	if (set->ref)
+		return -EBUSY;
+
+	write_lock_bh(&ip_set_lock);
+	ip_set_list[set->id] = NULL;
+	write_unlock_bh(&ip_set_lock);
+
+	set->type->destroy(set);
+	module_put(set->type->me);
+	kfree(set);
+
+	return 0;
+}
+
+static int ip_set_flush(const char *name)
+{
+	struct ip_set *set = find_set_byname(name);
+
+	if (!set)
+		return -ENOENT;
+
+	write_lock_bh(&set->lock);
+	set->type->flush(set);
+	write_unlock_bh(&set->lock);
+
+	return 0;
+}
+
+/* Exchange the contents of two sets: rules using either index see the
+   other's elements from the next packet on.  This is how userspace
+   reloads a set without a gap: fill a new one, swap it in, destroy the
+   old contents. */
+static int ip_set_swap(const char *name, const char *name2)
+{
+	struct ip_set *from = find_set_byname(name);
+	struct ip_set *to = find_set_byname(name2);
+	char tmpname[IP_SET_MAXNAMELEN];
+	unsigned int tmpref;
+	ip_set_id_t tmpid;
+
+	if (!from || !to)
+		return -ENOENT;
+	if (from == to)
+		return 0;
+	/* Rules were set up for a particular kind of element. */
+	if (from->type->features != to->type->features)
+		return -EINVAL;
+
+	write_lock_bh(&ip_set_lock);
+	ip_set_list[from->id] = to;
+	ip_set_list[to->id] = from;
+
+	memcpy(tmpname, from->name, IP_SET_MAXNAMELEN);
+	memcpy(from->name, to->name, IP_SET_MAXNAMELEN);
+	memcpy(to->name, tmpname, IP_SET_MAXNAMELEN);
+
+	tmpref = from->ref;
+	from->ref = to->ref;
+	to->ref = tmpref;
+
+	tmpid = from->id;
+	from->id = to->id;
+	to->id = tmpid;
+	write_unlock_bh(&ip_set_lock);
+
+	return 0;
+}
+
+static int ip_set_elem_op(const char *name, unsigned int op,
+			  struct ip_set_elem *elem)
+{
+	struct ip_set *set = find_set_byname(name);
+	int ret;
+
+	if (!set)
+		return -ENOENT;
+	if (!(set->type->features & IPSET_TYPE_PORT))
+		elem->port = 0;
+
+	switch (op) {
+	case IP_SET_OP_ADD:
+		write_lock_bh(&set->lock);
+		ret = set->type->add(set, elem);
+		write_unlock_bh(&set->lock);
+		break;
+	case IP_SET_OP_DEL:
+		write_lock_bh(&set->lock);
+		ret = set->type->del(set, elem);
+		write_unlock_bh(&set->lock);
+		break;
+	default:	/* IP_SET_OP_TEST */
+		read_lock_bh(&set->lock);
+		ret = set->type->test(set, elem);
+		read_unlock_bh(&set->lock);
+		break;
+	}
+
+	return ret;
+}
+
+static int ip_set_list_set(struct ip_set_req_list __user *user, int *len)
+{
+	struct ip_set_req_list req, *buf;
+	struct ip_set *set;
+	unsigned int n;
+	size_t size;
+	int ret = 0;
+
+	if (*len < sizeof(req))
+		return -EINVAL;
+	if (copy_from_user(&req, user, sizeof(req)))
+		return -EFAULT;
+	req.header.name[IP_SET_MAXNAMELEN-1] = '\0';
+
+	set = find_set_byname(req.header.name);
+	if (!set)
+		return -ENOENT;
+
+	if (req.header.op == IP_SET_OP_LIST_SIZE) {
+		strncpy(req.typename, set->type->typename, IP_SET_MAXNAMELEN);
+		req.features = set->type->features;
+		read_lock_bh(&set->lock);
+		req.members = set->type->members(set);
+		read_unlock_bh(&set->lock);
+		*len = sizeof(req);
+		return copy_to_user(user, &req, sizeof(req)) ? -EFAULT : 0;
+	}
+
+	n = req.members;
+	if (n > (INT_MAX - sizeof(req)) / sizeof(struct ip_set_elem))
+		return -EINVAL;
+	size = sizeof(req) + n * sizeof(struct ip_set_elem);
+	if (*len < size)
+		return -EINVAL;
+
+	buf = vmalloc(size);
+	if (!buf)
+		return -ENOMEM;
+	memcpy(buf, &req, sizeof(req));
+	strncpy(buf->typename, set->type->typename, IP_SET_MAXNAMELEN);
+	buf->features = set->type->features;
+
+	read_lock_bh(&set->lock);
+	if (set->type->members(set) != n)
+		ret = -EAGAIN;
+	else
+		set->type->list_members(set, buf->elems, n);
+	read_unlock_bh(&set->lock);
+
+	if (!ret) {
+		*len = size;
+		if (copy_to_user(user, buf, size))
+			ret = -EFAULT;
+	}
+	vfree(buf);
+
+	return ret;
+}
+
+static int
+do_ip_set_set_ctl(struct sock *sk, int cmd, void __user *user,
+		  unsigned int len)
+{
+	struct ip_set_req_header *req;
+	void *data;
+	int ret;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+	if (len < sizeof(*req) || len > PAGE_SIZE)
+		return -EINVAL;
+
+	data = kmalloc(len, GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+	if (copy_from_user(data, user, len)) {
+		ret = -EFAULT;
+		goto out;
+	}
+	req = data;
+	req->name[IP_SET_MAXNAMELEN-1] = '\0';
+	if (req->version != IP_SET_PROTOCOL_VERSION) {
+		ret = -EPROTO;
+		goto out;
+	}
+
+	down(&ip_set_app_sem);
+	switch (req->op) {
+	case IP_SET_OP_CREATE: {
+		struct ip_set_req_create *create = data;
+
+		if (len < sizeof(*create)) {
+			ret = -EINVAL;
+			break;
+		}
+		create->typename[IP_SET_MAXNAMELEN-1] = '\0';
+		ret = ip_set_create(create->header.name, create->typename,
+				    create + 1, len - sizeof(*create));
+		break;
+	}
+	case IP_SET_OP_DESTROY:
+		ret = ip_set_destroy(req->name);
+		break;
+
+	case IP_SET_OP_FLUSH:
+		ret = ip_set_flush(req->name);
+		break;
+
+	case IP_SET_OP_SWAP: {
+		struct ip_set_req_swap *swap = data;
+
+		if (len != sizeof(*swap)) {
+			ret = -EINVAL;
+			break;
+		}
+		swap->name2[IP_SET_MAXNAMELEN-1] = '\0';
+		ret = ip_set_swap(swap->header.name, swap->name2);
+		break;
+	}
+	case IP_SET_OP_ADD:
+	case IP_SET_OP_DEL: {
+		struct ip_set_req_elem *elem = data;
+
+		if (len != sizeof(*elem)) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = ip_set_elem_op(elem->header.name, req->op, &elem->elem);
+		break;
+	}
+	default:
+		DEBUGP("ip_set: unknown set request %u\n", req->op);
+		ret = -EBADMSG;
+	}
+	up(&ip_set_app_sem);
+
+out:
+	kfree(data);
+	return ret;
+}
+
+static int
+do_ip_set_get_ctl(struct sock *sk, int cmd, void __user *user, int *len)
+{
+	struct ip_set_req_header req;
+	int ret;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+	if (*len < sizeof(req))
+		return -EINVAL;
+	if (copy_from_user(&req, user, sizeof(req)))
+		return -EFAULT;
+
+	/* Let userspace find out what we speak before anything else. */
+	if (req.op == IP_SET_OP_VERSION) {
+		req.version = IP_SET_PROTOCOL_VERSION;
+		*len = sizeof(req);
+		return copy_to_user(user, &req, sizeof(req)) ? -EFAULT : 0;
+	}
+	if (req.version != IP_SET_PROTOCOL_VERSION)
+		return -EPROTO;
+
+	down(&ip_set_app_sem);
+	switch (req.op) {
+	case IP_SET_OP_TEST: {
+		struct ip_set_req_elem elem;
+
+		if (*len != sizeof(elem)) {
+			ret = -EINVAL;
+			break;
+		}
+		if (copy_from_user(&elem, user, sizeof(elem))) {
+			ret = -EFAULT;
+			break;
+		}
+		elem.header.name[IP_SET_MAXNAMELEN-1] = '\0';
+		ret = ip_set_elem_op(elem.header.name, IP_SET_OP_TEST,
+				     &elem.elem);
+		if (ret < 0)
+			break;
+		elem.result = ret;
+		ret = copy_to_user(user, &elem, sizeof(elem)) ? -EFAULT : 0;
+		break;
+	}
+	case IP_SET_OP_LIST_SIZE:
+	case IP_SET_OP_LIST:
+		ret = ip_set_list_set(user, len);
+		break;
+
+	default:
+		DEBUGP("ip_set: unknown get request %u\n", req.op);
+		ret = -EBADMSG;
+	}
+	up(&ip_set_app_sem);
+
+	return ret;
+}
+
+static struct nf_sockopt_ops ip_set_sockopts = {
+	.pf		= PF_INET,
+	.set_optmin	= SO_IP_SET,
+	.set_optmax	= SO_IP_SET + 1,
+	.set		= do_ip_set_set_ctl,
+	.get_optmin	= SO_IP_SET,
+	.get_optmax	= SO_IP_SET + 1,
+	.get		= do_ip_set_get_ctl,
+};
+
+static int __init init(void)
+{
+	int ret;
+
+	if (max_sets <= 0 || max_sets >= IP_SET_INVALID_ID) {
+		printk(KERN_ERR "ip_set: max_sets must be 1..%u\n",
+		       IP_SET_INVALID_ID - 1);
+		return -EINVAL;
+	}
+
+	ip_set_list = vmalloc(sizeof(struct ip_set *) * max_sets);
+	if (!ip_set_list)
+		return -ENOMEM;
+	memset(ip_set_list, 0, sizeof(struct ip_set *) * max_sets);
+
+	ret = nf_register_sockopt(&ip_set_sockopts);
+	if (ret) {
+		vfree(ip_set_list);
+		return ret;
+	}
+
+	printk(KERN_INFO "ip_set: protocol version %u, %d sets\n",
+	       IP_SET_PROTOCOL_VERSION, max_sets);
+	return 0;
+}
+
+/* Every set pins its type's module, which in turn depends on us, so
+   no sets are left by the time we go. */
+static void __exit fini(void)
+{
+	nf_unregister_sockopt(&ip_set_sockopts);
+	vfree(ip_set_list);
+}
+
+EXPORT_SYMBOL(ip_set_register_type);
+EXPORT_SYMBOL(ip_set_unregister_type);
+EXPORT_SYMBOL(ip_set_get_byname);
+EXPORT_SYMBOL(ip_set_put);
+EXPORT_SYMBOL(ip_set_testip_kernel);
+EXPORT_SYMBOL(ip_set_addip_kernel);
+EXPORT_SYMBOL(ip_set_delip_kernel);
+
+module_init(init);
+module_exit(fini);
@@ -0,0 +1,238 @@
+/* The "iphash" and "ipporthash" IP set types: chained hashes of
+ * addresses, and of address and port pairs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/list.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/netfilter_ipv4/ip_set.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("iphash and ipporthash types of IP sets");
+MODULE_ALIAS("ip_set_ipporthash");
+
+#define IPHASH_DEFAULT_SIZE	1024
+#define IPHASH_MAX_SIZE		(1 << 20)
+
+struct iphash_elem {
+	struct hlist_node node;
+	u_int32_t ip;
+	u_int16_t port;
+};
+
+struct ip_set_iphash {
+	unsigned int hashsize;
+	unsigned int elements;
+	u_int32_t rnd;
+	struct hlist_head hash[0];
+};
+
+static kmem_cache_t *iphash_cachep;
+
+static inline struct hlist_head *
+iphash_bucket(struct ip_set_iphash *h, const struct ip_set_elem *elem)
+{
+	return &h->hash[jhash_2words(elem->ip, elem->port, h->rnd)
+			% h->hashsize];
+}
+
+static struct iphash_elem *
+iphash_find(struct ip_set_iphash *h, const struct ip_set_elem *elem)
+{
+	struct iphash_elem *e;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(e, n, iphash_bucket(h, elem), node)
+		if (e->ip == elem->ip && e->port == elem->port)
+			return e;
+	return NULL;
+}
+
+static int iphash_create(struct ip_set *set, const void *data, size_t size)
+{
+	const struct ip_set_req_iphash_create *req = data;
+	struct ip_set_iphash *h;
+	unsigned int i, hashsize = req->hashsize;
+
+	if (!hashsize)
+		hashsize = IPHASH_DEFAULT_SIZE;
+	if (hashsize > IPHASH_MAX_SIZE)
+		return -EINVAL;
+
+	h = vmalloc(sizeof(*h) + hashsize * sizeof(struct hlist_head));
+	if (!h)
+		return -ENOMEM;
+	h->hashsize = hashsize;
+	h->elements = 0;
+	get_random_bytes(&h->rnd, sizeof(h->rnd));
+	for (i = 0; i < hashsize; i++)
+		INIT_HLIST_HEAD(&h->hash[i]);
+
+	set->data = h;
+	return 0;
+}
+
+static void iphash_flush(struct ip_set *set)
+{
+	struct ip_set_iphash *h = set->data;
+	struct iphash_elem *e;
+	struct hlist_node *n, *next;
+	unsigned int i;
+
+	for (i = 0; i < h->hashsize; i++) {
+		hlist_for_each_entry_safe(e, n, next, &h->hash[i], node)
+			kmem_cache_free(iphash_cachep, e);
+		INIT_HLIST_HEAD(&h->hash[i]);
+	}
+	h->elements = 0;
+}
+
+static void iphash_destroy(struct ip_set *set)
+{
+	iphash_flush(set);
+	vfree(set->data);
+}
+
+static int iphash_test(struct ip_set *set, const struct ip_set_elem *elem)
+{
+	return iphash_find(set->data, elem) != NULL;
+}
+
+/* May be called from the SET target, in softirq. */
+static int iphash_add(struct ip_set *set, const struct ip_set_elem *elem)
+{
+	struct ip_set_iphash *h = set->data;
+	struct iphash_elem *e;
+
+	if (iphash_find(h, elem))
+		return -EEXIST;
+
+	e = kmem_cache_alloc(iphash_cachep, GFP_ATOMIC);
+	if (!e)
+		return -ENOMEM;
+	e->ip = elem->ip;
+	e->port = elem->port;
+	hlist_add_head(&e->node, iphash_bucket(h, elem));
+	h->elements++;
+
+	return 0;
+}
+
+static int iphash_del(struct ip_set *set, const struct ip_set_elem *elem)
+{
+	struct ip_set_iphash *h = set->data;
+	struct iphash_elem *e = iphash_find(h, elem);
+
+	if (!e)
+		return -ENOENT;
+
+	hlist_del(&e->node);
+	kmem_cache_free(iphash_cachep, e);
+	h->elements--;
+
+	return 0;
+}
+
+static unsigned int iphash_members(const struct ip_set *set)
+{
+	const struct ip_set_iphash *h = set->data;
+
+	return h->elements;
+}
+
+static unsigned int iphash_list(const struct ip_set *set,
+				struct ip_set_elem *elems, unsigned int max)
+{
+	const struct ip_set_iphash *h = set->data;
+	struct iphash_elem *e;
+	struct hlist_node *n;
+	unsigned int i, cnt = 0;
+
+	for (i = 0; i < h->hashsize; i++) {
+		hlist_for_each_entry(e, n, &h->hash[i], node) {
+			if (cnt == max)
+				return cnt;
+			memset(&elems[cnt], 0, sizeof(elems[cnt]));
+			elems[cnt].ip = e->ip;
+			elems[cnt].port = e->port;
+			elems[cnt].cidr = 32;
+			cnt++;
+		}
+	}
+	return cnt;
+}
+
+static struct ip_set_type ip_set_iphash = {
+	.typename	= "iphash",
+	.features	= IPSET_TYPE_IP,
+	.create_size	= sizeof(struct ip_set_req_iphash_create),
+	.create		= iphash_create,
+	.destroy	= iphash_destroy,
+	.flush		= iphash_flush,
+	.test		= iphash_test,
+	.add		= iphash_add,
+	.del		= iphash_del,
+	.members	= iphash_members,
+	.list_members	= iphash_list,
+	.me		= THIS_MODULE,
+};
+
+/* The core zeroes the port of elements for sets without
+   IPSET_TYPE_PORT, so both types can share the code. */
+static struct ip_set_type ip_set_ipporthash = {
+	.typename	= "ipporthash",
+	.features	= IPSET_TYPE_IP | IPSET_TYPE_PORT,
+	.create_size	= sizeof(struct ip_set_req_iphash_create),
+	.create		= iphash_create,
+	.destroy	= iphash_destroy,
+	.flush		= iphash_flush,
+	.test		= iphash_test,
+	.add		= iphash_add,
+	.del		= iphash_del,
+	.members	= iphash_members,
+	.list_members	= iphash_list,
+	.me		= THIS_MODULE,
+};
+
+static int __init init(void)
+{
+	int ret;
+
+	iphash_cachep = kmem_cache_create("ip_set_iphash",
+					  sizeof(struct iphash_elem), 0,
+					  0, NULL, NULL);
+	if (!iphash_cachep)
+		return -ENOMEM;
+
+	ret = ip_set_register_type(&ip_set_iphash);
+	if (ret)
+		goto out_cache;
+	ret = ip_set_register_type(&ip_set_ipporthash);
+	if (ret)
+		goto out_iphash;
+	return 0;
+
+out_iphash:
+	ip_set_unregister_type(&ip_set_iphash);
+out_cache:
+	kmem_cache_destroy(iphash_cachep);
+	return ret;
+}
+
+static void __exit fini(void)
+{
+	ip_set_unregister_type(&ip_set_ipporthash);
+	ip_set_unregister_type(&ip_set_iphash);
+	kmem_cache_destroy(iphash_cachep);
+}
+
+module_init(init);
+module_exit(fini);
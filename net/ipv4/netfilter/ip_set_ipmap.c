@@ -0,0 +1,148 @@
+/* The "ipmap" IP set type: one bit per address of a range.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/netfilter_ipv4/ip_set.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("ipmap type of IP sets");
+
+struct ip_set_ipmap {
+	u_int32_t first_ip;
+	u_int32_t last_ip;
+	unsigned int elements;
+	unsigned long members[0];
+};
+
+static inline size_t ipmap_bytes(u_int32_t first_ip, u_int32_t last_ip)
+{
+	return BITS_TO_LONGS(last_ip - first_ip + 1) * sizeof(unsigned long);
+}
+
+static int ipmap_create(struct ip_set *set, const void *data, size_t size)
+{
+	const struct ip_set_req_ipmap_create *req = data;
+	struct ip_set_ipmap *map;
+	size_t bytes;
+
+	if (req->first_ip > req->last_ip
+	    || req->last_ip - req->first_ip >= IP_SET_IPMAP_MAX)
+		return -ERANGE;
+
+	bytes = ipmap_bytes(req->first_ip, req->last_ip);
+	map = kmalloc(sizeof(*map) + bytes, GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+	map->first_ip = req->first_ip;
+	map->last_ip = req->last_ip;
+	map->elements = 0;
+	memset(map->members, 0, bytes);
+
+	set->data = map;
+	return 0;
+}
+
+static void ipmap_destroy(struct ip_set *set)
+{
+	kfree(set->data);
+}
+
+static void ipmap_flush(struct ip_set *set)
+{
+	struct ip_set_ipmap *map = set->data;
+
+	memset(map->members, 0, ipmap_bytes(map->first_ip, map->last_ip));
+	map->elements = 0;
+}
+
+static int ipmap_test(struct ip_set *set, const struct ip_set_elem *elem)
+{
+	const struct ip_set_ipmap *map = set->data;
+
+	if (elem->ip < map->first_ip || elem->ip > map->last_ip)
+		return 0;
+	return test_bit(elem->ip - map->first_ip, map->members);
+}
+
+static int ipmap_add(struct ip_set *set, const struct ip_set_elem *elem)
+{
+	struct ip_set_ipmap *map = set->data;
+
+	if (elem->ip < map->first_ip || elem->ip > map->last_ip)
+		return -ERANGE;
+	if (__test_and_set_bit(elem->ip - map->first_ip, map->members))
+		return -EEXIST;
+	map->elements++;
+	return 0;
+}
+
+static int ipmap_del(struct ip_set *set, const struct ip_set_elem *elem)
+{
+	struct ip_set_ipmap *map = set->data;
+
+	if (elem->ip < map->first_ip || elem->ip > map->last_ip)
+		return -ERANGE;
+	if (!__test_and_clear_bit(elem->ip - map->first_ip, map->members))
+		return -ENOENT;
+	map->elements--;
+	return 0;
+}
+
+static unsigned int ipmap_members(const struct ip_set *set)
+{
+	const struct ip_set_ipmap *map = set->data;
+
+	return map->elements;
+}
+
+static unsigned int ipmap_list(const struct ip_set *set,
+			       struct ip_set_elem *elems, unsigned int max)
+{
+	const struct ip_set_ipmap *map = set->data;
+	unsigned int i, n = 0;
+
+	for (i = 0; i <= map->last_ip - map->first_ip && n < max; i++) {
+		if (!test_bit(i, map->members))
+			continue;
+		memset(&elems[n], 0, sizeof(elems[n]));
+		elems[n].ip = map->first_ip + i;
+		elems[n].cidr = 32;
+		n++;
+	}
+	return n;
+}
+
+static struct ip_set_type ip_set_ipmap = {
+	.typename	= "ipmap",
+	.features	= IPSET_TYPE_IP,
+	.create_size	= sizeof(struct ip_set_req_ipmap_create),
+	.create		= ipmap_create,
+	.destroy	= ipmap_destroy,
+	.flush		= ipmap_flush,
+	.test		= ipmap_test,
+	.add		= ipmap_add,
+	.del		= ipmap_del,
+	.members	= ipmap_members,
+	.list_members	= ipmap_list,
+	.me		= THIS_MODULE,
+};
+
+static int __init init(void)
+{
+	return ip_set_register_type(&ip_set_ipmap);
+}
+
+static void __exit fini(void)
+{
+	ip_set_unregister_type(&ip_set_ipmap);
+}
+
+module_init(init);
+module_exit(fini);
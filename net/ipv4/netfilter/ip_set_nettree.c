@@ -0,0 +1,231 @@
+/* The "nettree" IP set type: CIDR networks in a binary trie, one level
+ * per prefix bit.  An address is in the set if any network on its path
+ * is, so a test walks at most 32 nodes whatever the number of networks.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/netfilter_ipv4/ip_set.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("nettree type of IP sets");
+
+struct nettree_node {
+	struct nettree_node *child[2];
+	int terminal;			/* this prefix is in the set */
+};
+
+struct ip_set_nettree {
+	struct nettree_node root;	/* the empty prefix, 0/0 */
+	unsigned int elements;
+};
+
+static kmem_cache_t *nettree_cachep;
+
+static inline int prefix_bit(u_int32_t ip, unsigned int depth)
+{
+	return (ip >> (31 - depth)) & 1;
+}
+
+static int nettree_create(struct ip_set *set, const void *data, size_t size)
+{
+	struct ip_set_nettree *tree;
+
+	tree = kmalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree)
+		return -ENOMEM;
+	memset(tree, 0, sizeof(*tree));
+
+	set->data = tree;
+	return 0;
+}
+
+static void nettree_free(struct nettree_node *node)
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+		if (node->child[i]) {
+			nettree_free(node->child[i]);
+			kmem_cache_free(nettree_cachep, node->child[i]);
+		}
+}
+
+static void nettree_flush(struct ip_set *set)
+{
+	struct ip_set_nettree *tree = set->data;
+
+	nettree_free(&tree->root);
+	memset(tree, 0, sizeof(*tree));
+}
+
+static void nettree_destroy(struct ip_set *set)
+{
+	nettree_flush(set);
+	kfree(set->data);
+}
+
+static int nettree_test(struct ip_set *set, const struct ip_set_elem *elem)
+{
+	const struct ip_set_nettree *tree = set->data;
+	const struct nettree_node *node = &tree->root;
+	unsigned int depth = 0;
+
+	while (node) {
+		if (node->terminal)
+			return 1;
+		if (depth == 32)
+			break;
+		node = node->child[prefix_bit(elem->ip, depth++)];
+	}
+	return 0;
+}
+
+/* May be called from the SET target, in softirq. */
+static int nettree_add(struct ip_set *set, const struct ip_set_elem *elem)
+{
+	struct ip_set_nettree *tree = set->data;
+	struct nettree_node *node = &tree->root;
+	unsigned int depth;
+
+	if (elem->cidr > 32)
+		return -EINVAL;
+
+	for (depth = 0; depth < elem->cidr; depth++) {
+		struct nettree_node **next;
+
+		next = &node->child[prefix_bit(elem->ip, depth)];
+		if (!*next) {
+			*next = kmem_cache_alloc(nettree_cachep, GFP_ATOMIC);
+			if (!*next)
+				return -ENOMEM;
+			memset(*next, 0, sizeof(**next));
+		}
+		node = *next;
+	}
+
+	if (node->terminal)
+		return -EEXIST;
+	node->terminal = 1;
+	tree->elements++;
+
+	return 0;
+}
+
+static int nettree_del(struct ip_set *set, const struct ip_set_elem *elem)
+{
+	struct ip_set_nettree *tree = set->data;
+	struct nettree_node *path[33];
+	struct nettree_node *node = &tree->root;
+	unsigned int depth;
+
+	if (elem->cidr > 32)
+		return -EINVAL;
+
+	path[0] = node;
+	for (depth = 0; depth < elem->cidr; depth++) {
+		node = node->child[prefix_bit(elem->ip, depth)];
+		if (!node)
+			return -ENOENT;
+		path[depth + 1] = node;
+	}
+
+	if (!node->terminal)
+		return -ENOENT;
+	node->terminal = 0;
+	tree->elements--;
+
+	/* Prune the branch back up to the last node still in use. */
+	for (depth = elem->cidr; depth > 0; depth--) {
+		node = path[depth];
+		if (node->terminal || node->child[0] || node->child[1])
+			break;
+		path[depth - 1]->child[prefix_bit(elem->ip, depth - 1)] = NULL;
+		kmem_cache_free(nettree_cachep, node);
+	}
+
+	return 0;
+}
+
+static unsigned int nettree_members(const struct ip_set *set)
+{
+	const struct ip_set_nettree *tree = set->data;
+
+	return tree->elements;
+}
+
+static void nettree_walk(const struct nettree_node *node, u_int32_t prefix,
+			 unsigned int depth, struct ip_set_elem *elems,
+			 unsigned int max, unsigned int *cnt)
+{
+	int i;
+
+	if (node->terminal && *cnt < max) {
+		memset(&elems[*cnt], 0, sizeof(elems[*cnt]));
+		elems[*cnt].ip = prefix;
+		elems[*cnt].cidr = depth;
+		(*cnt)++;
+	}
+	if (depth == 32)
+		return;
+	for (i = 0; i < 2; i++)
+		if (node->child[i])
+			nettree_walk(node->child[i],
+				     prefix | ((u_int32_t)i << (31 - depth)),
+				     depth + 1, elems, max, cnt);
+}
+
+static unsigned int nettree_list(const struct ip_set *set,
+				 struct ip_set_elem *elems, unsigned int max)
+{
+	const struct ip_set_nettree *tree = set->data;
+	unsigned int cnt = 0;
+
+	nettree_walk(&tree->root, 0, 0, elems, max, &cnt);
+	return cnt;
+}
+
+static struct ip_set_type ip_set_nettree = {
+	.typename	= "nettree",
+	.features	= IPSET_TYPE_IP,
+	.create_size	= 0,
+	.create		= nettree_create,
+	.destroy	= nettree_destroy,
+	.flush		= nettree_flush,
+	.test		= nettree_test,
+	.add		= nettree_add,
+	.del		= nettree_del,
+	.members	= nettree_members,
+	.list_members	= nettree_list,
+	.me		= THIS_MODULE,
+};
+
+static int __init init(void)
+{
+	int ret;
+
+	nettree_cachep = kmem_cache_create("ip_set_nettree",
+					   sizeof(struct nettree_node), 0,
+					   0, NULL, NULL);
+	if (!nettree_cachep)
+		return -ENOMEM;
+
+	ret = ip_set_register_type(&ip_set_nettree);
+	if (ret)
+		kmem_cache_destroy(nettree_cachep);
+	return ret;
+}
+
+static void __exit fini(void)
+{
+	ip_set_unregister_type(&ip_set_nettree);
+	kmem_cache_destroy(nettree_cachep);
+}
+
+module_init(init);
+module_exit(fini);
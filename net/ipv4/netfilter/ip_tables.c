@@ -1208,6 +1208,454 @@ do_replace(void __user *user, unsigned int len)
 	return ret;
 }
 
+/* Incremental changes.  The table stays one blob per CPU, so a splice
+ * still builds a new copy of it, but only the spliced entries come from
+ * userspace.  check_entry() only runs on them, and on those entries
+ * which the splice makes reachable from a hook they were not checked
+ * for: those get a fresh copy, as they would in a full replace. */
+
+/* Put back the names of matches and target the kernel replaced by
+   pointers, so the entry reads as userspace handed it in. */
+static inline int
+untranslate_match(struct ipt_entry_match *m)
+{
+	struct ipt_match *match = m->u.kernel.match;
+
+	memset(m->u.user.name, 0, sizeof(m->u.user.name));
+	strncpy(m->u.user.name, match->name, sizeof(m->u.user.name));
+	m->u.user.revision = match->revision;
+	return 0;
+}
+
+static void
+untranslate_entry(struct ipt_entry *e)
+{
+	struct ipt_entry_target *t = ipt_get_target(e);
+	struct ipt_target *target = t->u.kernel.target;
+
+	IPT_MATCH_ITERATE(e, untranslate_match);
+	memset(t->u.user.name, 0, sizeof(t->u.user.name));
+	strncpy(t->u.user.name, target->name, sizeof(t->u.user.name));
+	t->u.user.revision = target->revision;
+}
+
+/* Is the entry at pos in the spliced table one of the new ones? */
+static inline int
+splice_is_new(const struct ipt_splice *s, unsigned int pos)
+{
+	return pos >= s->offset && pos < s->offset + s->insert_size;
+}
+
+/* Old position of a kept entry, and back. */
+static inline unsigned int
+splice_old_pos(const struct ipt_splice *s, unsigned int pos)
+{
+	return pos < s->offset ? pos : pos - s->insert_size + s->delete_size;
+}
+
+static inline unsigned int
+splice_new_pos(const struct ipt_splice *s, unsigned int pos)
+{
+	return pos < s->offset ? pos : pos - s->delete_size + s->insert_size;
+}
+
+/* The range must be whole entries, short of the final one, and must not
+   take out a hook entry point or a policy. */
+static int
+splice_check_range(const struct ipt_table_info *info,
+		   unsigned int valid_hooks,
+		   const struct ipt_splice *s)
+{
+	unsigned int pos, last = 0, num = 0, h;
+	int start = 0, end = 0;
+	struct ipt_entry *e;
+
+	for (pos = 0; pos < info->size; pos += e->next_offset) {
+		e = (struct ipt_entry *)(info->entries + pos);
+		if (pos == s->offset)
+			start = 1;
+		if (pos == s->offset + s->delete_size)
+			end = 1;
+		if (pos >= s->offset && pos < s->offset + s->delete_size)
+			num++;
+		last = pos;
+	}
+	if (!start || !end || num != s->num_deleted
+	    || s->offset + s->delete_size > last) {
+		duprintf("splice: bad range %u+%u (%u entries)\n",
+			 s->offset, s->delete_size, s->num_deleted);
+		return -EINVAL;
+	}
+
+	for (h = 0; h < NF_IP_NUMHOOKS; h++) {
+		if (!(valid_hooks & (1 << h)))
+			continue;
+		if ((info->hook_entry[h] > s->offset
+		     && info->hook_entry[h] < s->offset + s->delete_size)
+		    || (info->underflow[h] >= s->offset
+			&& info->underflow[h] < s->offset + s->delete_size)) {
+			duprintf("splice: range covers hook %u\n", h);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/* Move the jumps of kept entries along with their targets. */
+static int
+splice_move_jumps(struct ipt_table_info *newinfo, const struct ipt_splice *s)
+{
+	unsigned int pos;
+	struct ipt_entry *e;
+
+	for (pos = 0; pos < newinfo->size; pos += e->next_offset) {
+		struct ipt_standard_target *t;
+
+		e = (struct ipt_entry *)(newinfo->entries + pos);
+		if (splice_is_new(s, pos))
+			continue;
+
+		t = (void *)ipt_get_target(e);
+		if (t->target.u.kernel.target != &ipt_standard_target
+		    || t->verdict < 0)
+			continue;
+
+		if (t->verdict >= s->offset + s->delete_size)
+			t->verdict = splice_new_pos(s, t->verdict);
+		else if (t->verdict > s->offset) {
+			duprintf("splice: entry %u jumps into range\n", pos);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/* Work out from which hooks each entry of info is reachable.  This is
+   done on a copy in scratch, since mark_source_chains() wants to see
+   user names and scribbles on the entries; the masks end up in the
+   copy's comefrom.  Entries of info are in kernel form, except for the
+   new ones of a splice. */
+static int
+splice_hook_masks(struct ipt_table_info *scratch,
+		  const struct ipt_table_info *info,
+		  unsigned int valid_hooks,
+		  const struct ipt_splice *s)
+{
+	unsigned int pos;
+	struct ipt_entry *e;
+
+	scratch->size = info->size;
+	memcpy(scratch->hook_entry, info->hook_entry,
+	       sizeof(scratch->hook_entry));
+	memcpy(scratch->underflow, info->underflow,
+	       sizeof(scratch->underflow));
+	memcpy(scratch->entries, info->entries, info->size);
+
+	for (pos = 0; pos < scratch->size; pos += e->next_offset) {
+		e = (struct ipt_entry *)(scratch->entries + pos);
+		if (!s || !splice_is_new(s, pos))
+			untranslate_entry(e);
+		e->comefrom = 0;
+		e->counters = ((struct ipt_counters) { 0, 0 });
+	}
+
+	return mark_source_chains(scratch, valid_hooks) ? 0 : -ELOOP;
+}
+
+#define SPLICE_CHECK_NEW	1
+#define SPLICE_CHECK_AGAIN	2
+
+/* Check the new entries, and kept ones reachable from new hooks.
+   Marks them in scratch, which holds the spliced table's hook masks. */
+static int
+splice_check_entries(struct ipt_table_info *newinfo,
+		     struct ipt_table_info *scratch,
+		     const char *name,
+		     const struct ipt_splice *s)
+{
+	unsigned int pos, n = 0;
+	struct ipt_entry *e, *se;
+	int ret = 0;
+
+	for (pos = 0; pos < newinfo->size; pos += e->next_offset) {
+		unsigned int mask;
+
+		e = (struct ipt_entry *)(newinfo->entries + pos);
+		se = (struct ipt_entry *)(scratch->entries + pos);
+		mask = se->comefrom;
+
+		/* Kept entries carry the mask they were checked with. */
+		if (splice_is_new(s, pos))
+			se->counters.bcnt = SPLICE_CHECK_NEW;
+		else if (mask & ~e->comefrom & ((1 << NF_IP_NUMHOOKS) - 1)) {
+			untranslate_entry(e);
+			se->counters.bcnt = SPLICE_CHECK_AGAIN;
+		}
+		e->comefrom = mask;
+
+		if (se->counters.bcnt) {
+			ret = check_entry(e, name, newinfo->size, &n);
+			if (ret != 0) {
+				se->counters.bcnt = 0;
+				break;
+			}
+		}
+	}
+	if (ret == 0)
+		return 0;
+
+	/* Undo the ones which passed. */
+	for (pos = 0; pos < newinfo->size; pos += e->next_offset) {
+		e = (struct ipt_entry *)(newinfo->entries + pos);
+		se = (struct ipt_entry *)(scratch->entries + pos);
+		if (se->counters.bcnt)
+			cleanup_entry(e, NULL);
+	}
+	return ret;
+}
+
+/* Carry the counters of kept entries over, for every CPU.  Called with
+   the table write locked. */
+static void
+splice_move_counters(const struct ipt_table_info *oldinfo,
+		     struct ipt_table_info *newinfo,
+		     const struct ipt_splice *s)
+{
+	unsigned int cpu, pos;
+	struct ipt_entry *e;
+
+	for (cpu = 0; cpu < num_possible_cpus(); cpu++) {
+		void *oldbase = (void *)oldinfo->entries
+			+ TABLE_OFFSET(oldinfo, cpu);
+		void *newbase = (void *)newinfo->entries
+			+ TABLE_OFFSET(newinfo, cpu);
+
+		for (pos = 0; pos < oldinfo->size; pos += e->next_offset) {
+			e = oldbase + pos;
+			if (pos >= s->offset
+			    && pos < s->offset + s->delete_size)
+				continue;
+			((struct ipt_entry *)(newbase
+					      + splice_new_pos(s, pos)))->counters
+				= e->counters;
+		}
+	}
+}
+
+static int
+do_splice(void __user *user, unsigned int len)
+{
+	int ret;
+	struct ipt_splice tmp;
+	struct ipt_table *t;
+	struct ipt_table_info *newinfo, *oldinfo, *scratch;
+	struct ipt_counters *counters = NULL;
+	unsigned int newsize, pos, cpu, i;
+	struct ipt_entry *e;
+	static const unsigned int nohooks[NF_IP_NUMHOOKS] = {
+		[0 ... NF_IP_NUMHOOKS-1] = 0xFFFFFFFF
+	};
+
+	if (copy_from_user(&tmp, user, sizeof(tmp)) != 0)
+		return -EFAULT;
+	tmp.name[IPT_TABLE_MAXNAMELEN-1] = '\0';
+
+	if (len != sizeof(tmp) + tmp.insert_size
+	    || tmp.delete_size > tmp.size
+	    || tmp.offset > tmp.size - tmp.delete_size
+	    || tmp.num_deleted > tmp.num_entries)
+		return -EINVAL;
+	newsize = tmp.size - tmp.delete_size + tmp.insert_size;
+
+	/* Pedantry: prevent them from hitting BUG() in vmalloc.c --RR */
+	if (newsize < tmp.insert_size
+	    || (SMP_ALIGN(newsize) >> PAGE_SHIFT) + 2 > num_physpages)
+		return -ENOMEM;
+
+	newinfo = vmalloc(sizeof(struct ipt_table_info)
+			  + SMP_ALIGN(newsize) * num_possible_cpus());
+	if (!newinfo)
+		return -ENOMEM;
+	scratch = vmalloc(sizeof(struct ipt_table_info)
+			  + max(tmp.size, newsize));
+	if (!scratch) {
+		ret = -ENOMEM;
+		goto free_newinfo;
+	}
+	if (tmp.num_deleted) {
+		counters = vmalloc(tmp.num_deleted
+				   * sizeof(struct ipt_counters));
+		if (!counters) {
+			ret = -ENOMEM;
+			goto free_scratch;
+		}
+		memset(counters, 0,
+		       tmp.num_deleted * sizeof(struct ipt_counters));
+	}
+
+	if (copy_from_user(newinfo->entries + tmp.offset, user + sizeof(tmp),
+			   tmp.insert_size) != 0) {
+		ret = -EFAULT;
+		goto free_counters;
+	}
+
+	t = find_table_lock(tmp.name);
+	if (!t || IS_ERR(t)) {
+		ret = t ? PTR_ERR(t) : -ENOENT;
+		goto free_counters;
+	}
+	oldinfo = t->private;
+
+	/* Someone got in first: userspace has to look again. */
+	if (oldinfo->size != tmp.size || oldinfo->number != tmp.num_entries) {
+		ret = -EAGAIN;
+		goto put_module;
+	}
+	ret = splice_check_range(oldinfo, t->valid_hooks, &tmp);
+	if (ret != 0)
+		goto put_module;
+
+	/* Lay the table out: the new entries are already in place. */
+	newinfo->size = newsize;
+	newinfo->number = tmp.num_entries - tmp.num_deleted
+		+ tmp.num_inserted;
+	memcpy(newinfo->entries, oldinfo->entries, tmp.offset);
+	memcpy(newinfo->entries + tmp.offset + tmp.insert_size,
+	       oldinfo->entries + tmp.offset + tmp.delete_size,
+	       oldinfo->size - tmp.offset - tmp.delete_size);
+	for (i = 0; i < NF_IP_NUMHOOKS; i++) {
+		newinfo->hook_entry[i] = oldinfo->hook_entry[i];
+		newinfo->underflow[i] = oldinfo->underflow[i];
+		if (!(t->valid_hooks & (1 << i)))
+			continue;
+		if (newinfo->hook_entry[i] > tmp.offset)
+			newinfo->hook_entry[i]
+				= splice_new_pos(&tmp, newinfo->hook_entry[i]);
+		newinfo->underflow[i]
+			= splice_new_pos(&tmp, newinfo->underflow[i]);
+	}
+
+	/* Sanity check the new entries' offsets. */
+	i = 0;
+	for (pos = 0; pos < tmp.insert_size; pos += e->next_offset) {
+		e = (struct ipt_entry *)(newinfo->entries + tmp.offset + pos);
+		ret = check_entry_size_and_hooks(e, newinfo, newinfo->entries,
+						 newinfo->entries + tmp.offset
+						 + tmp.insert_size,
+						 nohooks, nohooks, &i);
+		if (ret != 0)
+			goto put_module;
+	}
+	if (pos != tmp.insert_size || i != tmp.num_inserted) {
+		duprintf("splice: %u entries in %u bytes, not %u in %u\n",
+			 i, pos, tmp.num_inserted, tmp.insert_size);
+		ret = -EINVAL;
+		goto put_module;
+	}
+
+	ret = splice_move_jumps(newinfo, &tmp);
+	if (ret != 0)
+		goto put_module;
+
+	/* Note the hooks kept entries were checked for... */
+	ret = splice_hook_masks(scratch, oldinfo, t->valid_hooks, NULL);
+	if (ret != 0)
+		goto put_module;
+	for (pos = 0; pos < newinfo->size; pos += e->next_offset) {
+		e = (struct ipt_entry *)(newinfo->entries + pos);
+		if (!splice_is_new(&tmp, pos))
+			e->comefrom = ((struct ipt_entry *)
+				       (scratch->entries
+					+ splice_old_pos(&tmp, pos)))->comefrom;
+	}
+	/* ... against those they will be reachable from. */
+	ret = splice_hook_masks(scratch, newinfo, t->valid_hooks, &tmp);
+	if (ret != 0)
+		goto put_module;
+
+	ret = splice_check_entries(newinfo, scratch, tmp.name, &tmp);
+	if (ret != 0)
+		goto put_module;
+
+	/* And one copy for every other CPU */
+	for (cpu = 1; cpu < num_possible_cpus(); cpu++)
+		memcpy(newinfo->entries + SMP_ALIGN(newinfo->size) * cpu,
+		       newinfo->entries,
+		       SMP_ALIGN(newinfo->size));
+
+#ifdef CONFIG_NETFILTER_DEBUG
+	for (cpu = 0; cpu < num_possible_cpus(); cpu++)
+		((struct ipt_entry *)(newinfo->entries
+				      + TABLE_OFFSET(newinfo, cpu)))->comefrom
+			= 0xdead57ac;
+#endif
+
+	write_lock_bh(&t->lock);
+	splice_move_counters(oldinfo, newinfo, &tmp);
+	t->private = newinfo;
+	newinfo->initial_entries = oldinfo->initial_entries;
+	write_unlock_bh(&t->lock);
+
+	/* Update module usage count based on number of rules */
+	if ((oldinfo->number > oldinfo->initial_entries) || 
+	    (newinfo->number <= oldinfo->initial_entries)) 
+		module_put(t->me);
+	if ((oldinfo->number > oldinfo->initial_entries) &&
+	    (newinfo->number <= oldinfo->initial_entries))
+		module_put(t->me);
+
+	/* Collect the deleted entries' counters and let them go, along
+	   with the old copies of entries which were checked again. */
+	for (cpu = 0; cpu < num_possible_cpus(); cpu++) {
+		void *base = (void *)oldinfo->entries
+			+ TABLE_OFFSET(oldinfo, cpu);
+
+		i = 0;
+		for (pos = tmp.offset;
+		     pos < tmp.offset + tmp.delete_size;
+		     pos += e->next_offset) {
+			e = base + pos;
+			ADD_COUNTER(counters[i], e->counters.bcnt,
+				    e->counters.pcnt);
+			i++;
+		}
+	}
+	for (pos = tmp.offset;
+	     pos < tmp.offset + tmp.delete_size;
+	     pos += e->next_offset) {
+		e = (struct ipt_entry *)(oldinfo->entries + pos);
+		cleanup_entry(e, NULL);
+	}
+	for (pos = 0; pos < scratch->size; pos += e->next_offset) {
+		e = (struct ipt_entry *)(scratch->entries + pos);
+		if (e->counters.bcnt == SPLICE_CHECK_AGAIN)
+			cleanup_entry((struct ipt_entry *)
+				      (oldinfo->entries
+				       + splice_old_pos(&tmp, pos)), NULL);
+	}
+	vfree(oldinfo);
+	up(&ipt_mutex);
+
+	if (tmp.counters && tmp.num_deleted
+	    && copy_to_user(tmp.counters, counters,
+			    sizeof(struct ipt_counters) * tmp.num_deleted))
+		ret = -EFAULT;
+	vfree(counters);
+	vfree(scratch);
+	return ret;
+
+ put_module:
+	module_put(t->me);
+	up(&ipt_mutex);
+ free_counters:
+	vfree(counters);
+ free_scratch:
+	vfree(scratch);
+ free_newinfo:
+	vfree(newinfo);
+	return ret;
+}
+
 /* We're lazy, and add to the first CPU; overflow works its fey magic
  * and everything is OK. */
 static inline int
@@ -1298,6 +1746,10 @@ do_ipt_set_ctl(struct sock *sk,	int cmd, void __user *user, unsigned int len)
 		ret = do_add_counters(user, len);
 		break;
 
+	case IPT_SO_SET_SPLICE:
+		ret = do_splice(user, len);
+		break;
+
 	default:
 		duprintf("do_ipt_set_ctl:  unknown request %i\n", cmd);
 		ret = -EINVAL;
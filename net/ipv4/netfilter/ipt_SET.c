@@ -0,0 +1,116 @@
+/* Kernel module to add packets to, or remove them from, IP sets.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter_ipv4/ipt_SET.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("iptables IP set target module");
+
+static unsigned int
+target(struct sk_buff **pskb,
+       const struct net_device *in,
+       const struct net_device *out,
+       unsigned int hooknum,
+       const void *targinfo,
+       void *userinfo)
+{
+	const struct ipt_set_info_target *info = targinfo;
+
+	if (info->add_set.index != IP_SET_INVALID_ID)
+		ip_set_addip_kernel(info->add_set.index, *pskb,
+				    info->add_set.flags & IPT_SET_SRC_IP,
+				    info->add_set.flags & IPT_SET_SRC_PORT);
+	if (info->del_set.index != IP_SET_INVALID_ID)
+		ip_set_delip_kernel(info->del_set.index, *pskb,
+				    info->del_set.flags & IPT_SET_SRC_IP,
+				    info->del_set.flags & IPT_SET_SRC_PORT);
+
+	return IPT_CONTINUE;
+}
+
+/* An empty name means no set. */
+static int get_set(struct ipt_set_info *info)
+{
+	info->index = IP_SET_INVALID_ID;
+	info->name[IP_SET_MAXNAMELEN-1] = '\0';
+	if (!info->name[0])
+		return 1;
+
+	info->index = ip_set_get_byname(info->name);
+	if (info->index == IP_SET_INVALID_ID) {
+		printk(KERN_WARNING "ipt_SET: no set named `%s'\n",
+		       info->name);
+		return 0;
+	}
+	return 1;
+}
+
+static void put_set(const struct ipt_set_info *info)
+{
+	if (info->index != IP_SET_INVALID_ID)
+		ip_set_put(info->index);
+}
+
+static int
+checkentry(const char *tablename,
+	   const struct ipt_entry *e,
+	   void *targinfo,
+	   unsigned int targinfosize,
+	   unsigned int hook_mask)
+{
+	struct ipt_set_info_target *info = targinfo;
+
+	if (targinfosize != IPT_ALIGN(sizeof(struct ipt_set_info_target)))
+		return 0;
+
+	if (!get_set(&info->add_set))
+		return 0;
+	if (!get_set(&info->del_set)) {
+		put_set(&info->add_set);
+		return 0;
+	}
+	if (info->add_set.index == IP_SET_INVALID_ID
+	    && info->del_set.index == IP_SET_INVALID_ID) {
+		printk(KERN_WARNING "ipt_SET: no set to add to or "
+		       "delete from\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+static void destroy(void *targinfo, unsigned int targinfosize)
+{
+	struct ipt_set_info_target *info = targinfo;
+
+	put_set(&info->add_set);
+	put_set(&info->del_set);
+}
+
+static struct ipt_target SET_target = {
+	.name		= "SET",
+	.target		= target,
+	.checkentry	= checkentry,
+	.destroy	= destroy,
+	.me		= THIS_MODULE
+};
+
+static int __init init(void)
+{
+	return ipt_register_target(&SET_target);
+}
+
+static void __exit fini(void)
+{
+	ipt_unregister_target(&SET_target);
+}
+
+module_init(init);
+module_exit(fini);
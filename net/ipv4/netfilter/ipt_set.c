@@ -0,0 +1,86 @@
+/* Kernel module to match packets against an IP set.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter_ipv4/ipt_set.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("iptables IP set match module");
+
+static int
+match(const struct sk_buff *skb,
+      const struct net_device *in,
+      const struct net_device *out,
+      const void *matchinfo,
+      int offset,
+      int *hotdrop)
+{
+	const struct ipt_set_info *info
+		= &((const struct ipt_set_info_match *)matchinfo)->match_set;
+	int res;
+
+	res = ip_set_testip_kernel(info->index, skb,
+				   info->flags & IPT_SET_SRC_IP,
+				   info->flags & IPT_SET_SRC_PORT);
+
+	return res ^ !!(info->flags & IPT_SET_INV);
+}
+
+static int
+checkentry(const char *tablename,
+	   const struct ipt_ip *ip,
+	   void *matchinfo,
+	   unsigned int matchsize,
+	   unsigned int hook_mask)
+{
+	struct ipt_set_info *info
+		= &((struct ipt_set_info_match *)matchinfo)->match_set;
+
+	if (matchsize != IPT_ALIGN(sizeof(struct ipt_set_info_match)))
+		return 0;
+
+	info->name[IP_SET_MAXNAMELEN-1] = '\0';
+	info->index = ip_set_get_byname(info->name);
+	if (info->index == IP_SET_INVALID_ID) {
+		printk(KERN_WARNING "ipt_set: no set named `%s'\n",
+		       info->name);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void destroy(void *matchinfo, unsigned int matchsize)
+{
+	struct ipt_set_info *info
+		= &((struct ipt_set_info_match *)matchinfo)->match_set;
+
+	ip_set_put(info->index);
+}
+
+static struct ipt_match set_match = {
+	.name		= "set",
+	.match		= &match,
+	.checkentry	= &checkentry,
+	.destroy	= &destroy,
+	.me		= THIS_MODULE
+};
+
+static int __init init(void)
+{
+	return ipt_register_match(&set_match);
+}
+
+static void __exit fini(void)
+{
+	ipt_unregister_match(&set_match);
+}
+
+module_init(init);
+module_exit(fini);
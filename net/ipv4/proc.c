@@ -63,13 +63,14 @@ static int sockstat_seq_show(struct seq_file *seq, void *v)
 	extern void socket_seq_show(struct seq_file *seq);
 
 	socket_seq_show(seq);
-	seq_printf(seq, "TCP: inuse %d orphan %d tw %d alloc %d mem %d\n",
+	seq_printf(seq, "TCP: inuse %d orphan %d tw %d alloc %d mem %ld\n",
 		   fold_prot_inuse(&tcp_prot), atomic_read(&tcp_orphan_count),
 		   tcp_tw_count, atomic_read(&tcp_sockets_allocated),
-		   atomic_read(&tcp_memory_allocated));
+		   max(percpu_counter_read(&tcp_memory_allocated), 0L));
 	seq_printf(seq, "UDP: inuse %d\n", fold_prot_inuse(&udp_prot));
 	seq_printf(seq, "RAW: inuse %d\n", fold_prot_inuse(&raw_prot));
-	seq_printf(seq,  "FRAG: inuse %d memory %d\n", ip_frag_nqueues,
+	seq_printf(seq,  "FRAG: inuse %d memory %d\n",
+		   atomic_read(&ip_frag_nqueues),
 		   atomic_read(&ip_frag_mem));
 	return 0;
 }
@@ -40,6 +40,7 @@
  */
  
 #include <linux/config.h> 
+#include <linux/module.h>
 #include <asm/atomic.h>
 #include <asm/byteorder.h>
 #include <asm/current.h>
@@ -82,6 +83,8 @@
 
 struct hlist_head raw_v4_htable[RAWV4_HTABLE_SIZE];
 DEFINE_RWLOCK(raw_v4_lock);
+EXPORT_SYMBOL_GPL(raw_v4_htable);
+EXPORT_SYMBOL_GPL(raw_v4_lock);
 
 static void raw_v4_hash(struct sock *sk)
 {
@@ -204,20 +204,70 @@ struct rt_hash_bucket {
 	spinlock_t	lock;
 } __attribute__((__aligned__(8)));
 
-static struct rt_hash_bucket 	*rt_hash_table;
-static unsigned			rt_hash_mask;
-static int			rt_hash_log;
+/*
+ * The bucket array is replaced as a whole when the cache grows or
+ * shrinks, see rt_hash_resize().  Lookups pick up the current table
+ * with rcu_dereference(rt_hash); writers go through rt_hash_lock() so
+ * that nothing is added to a table which is being retired.
+ */
+struct rt_hash_table {
+	struct rt_hash_bucket	*buckets;
+	unsigned		mask;
+	int			log;
+};
+
+static struct rt_hash_table	*rt_hash;
+static int			rt_hash_log_min;
+static int			rt_hash_log_max;
 static unsigned int		rt_hash_rnd;
 
+/* The table may grow up to 1 << RT_HASH_GROW_LOG times its boot size. */
+#define RT_HASH_GROW_LOG	4
+
 struct rt_cache_stat *rt_cache_stat;
 
 static int rt_intern_hash(unsigned hash, struct rtable *rth,
 				struct rtable **res);
 
+/* Hash values are independent of the table size, see rt_hash_bucket(). */
 static unsigned int rt_hash_code(u32 daddr, u32 saddr, u8 tos)
 {
-	return (jhash_3words(daddr, saddr, (u32) tos, rt_hash_rnd)
-		& rt_hash_mask);
+	return jhash_3words(daddr, saddr, (u32) tos, rt_hash_rnd);
+}
+
+static inline struct rt_hash_bucket *rt_hash_bucket(struct rt_hash_table *tbl,
+						    unsigned hash)
+{
+	return &tbl->buckets[hash & tbl->mask];
+}
+
+/* Head of the chain for hash, caller holds rcu_read_lock{,_bh}(). */
+static inline struct rtable *rt_hash_chain(unsigned hash)
+{
+	return rcu_dereference(rt_hash_bucket(rcu_dereference(rt_hash),
+					      hash)->chain);
+}
+
+/*
+ * Lock the bucket for hash in the current table and return it with
+ * BHs disabled; release it with spin_unlock_bh().  Once a table has
+ * been replaced its buckets are only being emptied, so if we raced
+ * with rt_hash_resize() retry on the new one.
+ */
+static struct rt_hash_bucket *rt_hash_lock(unsigned hash)
+{
+	struct rt_hash_table *tbl;
+	struct rt_hash_bucket *b;
+
+	local_bh_disable();
+	for (;;) {
+		tbl = rcu_dereference(rt_hash);
+		b = rt_hash_bucket(tbl, hash);
+		spin_lock(&b->lock);
+		if (likely(tbl == rt_hash))
+			return b;
+		spin_unlock(&b->lock);
+	}
 }
 
 #ifdef CONFIG_PROC_FS
@@ -230,9 +280,13 @@ static struct rtable *rt_cache_get_first(struct seq_file *seq)
 	struct rtable *r = NULL;
 	struct rt_cache_iter_state *st = seq->private;
 
-	for (st->bucket = rt_hash_mask; st->bucket >= 0; --st->bucket) {
+	rcu_read_lock_bh();
+	st->bucket = rcu_dereference(rt_hash)->mask;
+	rcu_read_unlock_bh();
+
+	for (; st->bucket >= 0; --st->bucket) {
 		rcu_read_lock_bh();
-		r = rt_hash_table[st->bucket].chain;
+		r = rt_hash_chain(st->bucket);
 		if (r)
 			break;
 		rcu_read_unlock_bh();
@@ -250,7 +304,7 @@ static struct rtable *rt_cache_get_next(struct seq_file *seq, struct rtable *r)
 		if (--st->bucket < 0)
 			break;
 		rcu_read_lock_bh();
-		r = rt_hash_table[st->bucket].chain;
+		r = rt_hash_chain(st->bucket);
 	}
 	return r;
 }
@@ -397,12 +451,13 @@ static int rt_cpu_seq_show(struct seq_file *seq, void *v)
 	struct rt_cache_stat *st = v;
 
 	if (v == SEQ_START_TOKEN) {
-		seq_printf(seq, "entries  in_hit in_slow_tot in_no_route in_brd in_martian_dst in_martian_src  out_hit out_slow_tot out_slow_mc  gc_total gc_ignored gc_goal_miss gc_dst_overflow in_hlist_search out_hlist_search\n");
+		seq_printf(seq, "entries  in_hit in_slow_tot in_no_route in_brd in_martian_dst in_martian_src  out_hit out_slow_tot out_slow_mc  gc_total gc_ignored gc_goal_miss gc_dst_overflow in_hlist_search out_hlist_search gc_buckets gc_freed gc_expired gc_evicted hash_resize\n");
 		return 0;
 	}
 	
 	seq_printf(seq,"%08x  %08x %08x %08x %08x %08x %08x %08x "
-		   " %08x %08x %08x %08x %08x %08x %08x %08x %08x \n",
+		   " %08x %08x %08x %08x %08x %08x %08x %08x %08x "
+		   " %08x %08x %08x %08x %08x \n",
 		   atomic_read(&ipv4_dst_ops.entries),
 		   st->in_hit,
 		   st->in_slow_tot,
@@ -421,7 +476,13 @@ static int rt_cpu_seq_show(struct seq_file *seq, void *v)
 		   st->gc_goal_miss,
 		   st->gc_dst_overflow,
 		   st->in_hlist_search,
-		   st->out_hlist_search
+		   st->out_hlist_search,
+
+		   st->gc_buckets,
+		   st->gc_freed,
+		   st->gc_expired,
+		   st->gc_evicted,
+		   st->hash_resize
 		);
 	return 0;
 }
@@ -517,22 +578,135 @@ static inline u32 rt_score(struct rtable *rt)
 	return score;
 }
 
+/* Unlink and free every entry of tbl. */
+static void rt_hash_empty(struct rt_hash_table *tbl)
+{
+	int i;
+	struct rtable *rth, *next;
+
+	for (i = tbl->mask; i >= 0; i--) {
+		spin_lock_bh(&tbl->buckets[i].lock);
+		rth = tbl->buckets[i].chain;
+		if (rth)
+			tbl->buckets[i].chain = NULL;
+		spin_unlock_bh(&tbl->buckets[i].lock);
+
+		for (; rth; rth = next) {
+			next = rth->u.rt_next;
+			rt_free(rth);
+		}
+	}
+}
+
+static inline int rt_hash_order(int log)
+{
+	return get_order(sizeof(struct rt_hash_bucket) << log);
+}
+
+static struct rt_hash_table *rt_hash_alloc(int log, int gfp_mask)
+{
+	struct rt_hash_table *tbl;
+	int i;
+
+	tbl = kmalloc(sizeof(*tbl), gfp_mask);
+	if (!tbl)
+		return NULL;
+
+	tbl->buckets = (struct rt_hash_bucket *)
+		__get_free_pages(gfp_mask, rt_hash_order(log));
+	if (!tbl->buckets) {
+		kfree(tbl);
+		return NULL;
+	}
+
+	tbl->log = log;
+	tbl->mask = (1 << log) - 1;
+	for (i = 0; i <= tbl->mask; i++) {
+		spin_lock_init(&tbl->buckets[i].lock);
+		tbl->buckets[i].chain = NULL;
+	}
+	return tbl;
+}
+
+static void rt_hash_free(struct rt_hash_table *tbl)
+{
+	free_pages((unsigned long) tbl->buckets, rt_hash_order(tbl->log));
+	kfree(tbl);
+}
+
+static DECLARE_MUTEX(rt_hash_sem);
+
+/*
+ * Size the table for the current number of entries: it is grown by
+ * the garbage collector once chains get long and shrunk by
+ * rt_check_expire() when it is mostly empty.
+ *
+ * Entries are not rehashed.  The new, empty table is published and
+ * the old one is flushed: lookups which miss fall back to the slow
+ * path and repopulate the new table, and moving entries over could
+ * let them escape a concurrent rt_run_flush().  Readers still walking
+ * the old table are waited for before it is freed.
+ */
+static void rt_hash_resize(void *dummy)
+{
+	struct rt_hash_table *old, *new;
+	int log;
+
+	down(&rt_hash_sem);
+
+	old = rt_hash;
+	log = fls(atomic_read(&ipv4_dst_ops.entries)) - 1;
+	if (log < rt_hash_log_min)
+		log = rt_hash_log_min;
+	if (log > rt_hash_log_max)
+		log = rt_hash_log_max;
+
+	/* Only shrink by a large enough step to be worth a flush. */
+	if (log == old->log || (log < old->log && log > old->log - 3))
+		goto out;
+
+	new = rt_hash_alloc(log, GFP_KERNEL);
+	if (!new)
+		goto out;
+
+	/* Scale the GC limits along, unless they were tuned by hand. */
+	if (ipv4_dst_ops.gc_thresh == old->mask + 1)
+		ipv4_dst_ops.gc_thresh = new->mask + 1;
+	if (ip_rt_max_size == (old->mask + 1) * 16)
+		ip_rt_max_size = (new->mask + 1) * 16;
+
+	rcu_assign_pointer(rt_hash, new);
+	rt_hash_empty(old);
+	RT_CACHE_STAT_INC(hash_resize);
+
+	synchronize_kernel();
+	rt_hash_free(old);
+
+	printk(KERN_INFO "IP: routing cache hash table resized to %u buckets\n",
+	       new->mask + 1);
+out:
+	up(&rt_hash_sem);
+}
+
+static DECLARE_WORK(rt_hash_work, rt_hash_resize, NULL);
+
 /* This runs via a timer and thus is always in BH context. */
 static void rt_check_expire(unsigned long dummy)
 {
 	static int rover;
 	int i = rover, t;
+	struct rt_hash_table *tbl = rcu_dereference(rt_hash);
 	struct rtable *rth, **rthp;
 	unsigned long now = jiffies;
 
-	for (t = ip_rt_gc_interval << rt_hash_log; t >= 0;
+	for (t = ip_rt_gc_interval << tbl->log; t >= 0;
 	     t -= ip_rt_gc_timeout) {
 		unsigned long tmo = ip_rt_gc_timeout;
 
-		i = (i + 1) & rt_hash_mask;
-		rthp = &rt_hash_table[i].chain;
+		i = (i + 1) & tbl->mask;
+		rthp = &tbl->buckets[i].chain;
 
-		spin_lock(&rt_hash_table[i].lock);
+		spin_lock(&tbl->buckets[i].lock);
 		while ((rth = *rthp) != NULL) {
 			if (rth->u.dst.expires) {
 				/* Entry is expired even if it is in use */
@@ -550,14 +724,21 @@ static void rt_check_expire(unsigned long dummy)
 			/* Cleanup aged off entries. */
 			*rthp = rth->u.rt_next;
 			rt_free(rth);
+			RT_CACHE_STAT_INC(gc_expired);
 		}
-		spin_unlock(&rt_hash_table[i].lock);
+		spin_unlock(&tbl->buckets[i].lock);
 
 		/* Fallback loop breaker. */
 		if (time_after(jiffies, now))
 			break;
 	}
 	rover = i;
+
+	/* Give back the memory of a table grown for a burst long gone. */
+	if (tbl->log > rt_hash_log_min &&
+	    atomic_read(&ipv4_dst_ops.entries) < (tbl->mask + 1) >> 3)
+		schedule_work(&rt_hash_work);
+
 	mod_timer(&rt_periodic_timer, now + ip_rt_gc_interval);
 }
 
@@ -566,25 +747,13 @@ static void rt_check_expire(unsigned long dummy)
  */
 static void rt_run_flush(unsigned long dummy)
 {
-	int i;
-	struct rtable *rth, *next;
-
 	rt_deadline = 0;
 
 	get_random_bytes(&rt_hash_rnd, 4);
 
-	for (i = rt_hash_mask; i >= 0; i--) {
-		spin_lock_bh(&rt_hash_table[i].lock);
-		rth = rt_hash_table[i].chain;
-		if (rth)
-			rt_hash_table[i].chain = NULL;
-		spin_unlock_bh(&rt_hash_table[i].lock);
-
-		for (; rth; rth = next) {
-			next = rth->u.rt_next;
-			rt_free(rth);
-		}
-	}
+	rcu_read_lock();
+	rt_hash_empty(rcu_dereference(rt_hash));
+	rcu_read_unlock();
 }
 
 static DEFINE_SPINLOCK(rt_flush_lock);
@@ -656,9 +825,10 @@ static int rt_garbage_collect(void)
 	static unsigned long last_gc;
 	static int rover;
 	static int equilibrium;
+	struct rt_hash_table *tbl;
 	struct rtable *rth, **rthp;
 	unsigned long now = jiffies;
-	int goal;
+	int goal, budget, ret = 0;
 
 	/*
 	 * Garbage collection is pretty expensive,
@@ -673,23 +843,29 @@ static int rt_garbage_collect(void)
 		goto out;
 	}
 
+	rcu_read_lock();
+	tbl = rcu_dereference(rt_hash);
+
 	/* Calculate number of entries, which we want to expire now. */
 	goal = atomic_read(&ipv4_dst_ops.entries) -
-		(ip_rt_gc_elasticity << rt_hash_log);
+		(ip_rt_gc_elasticity << tbl->log);
 	if (goal <= 0) {
 		if (equilibrium < ipv4_dst_ops.gc_thresh)
 			equilibrium = ipv4_dst_ops.gc_thresh;
 		goal = atomic_read(&ipv4_dst_ops.entries) - equilibrium;
 		if (goal > 0) {
-			equilibrium += min_t(unsigned int, goal / 2, rt_hash_mask + 1);
+			equilibrium += min_t(unsigned int, goal / 2, tbl->mask + 1);
 			goal = atomic_read(&ipv4_dst_ops.entries) - equilibrium;
 		}
 	} else {
 		/* We are in dangerous area. Try to reduce cache really
-		 * aggressively.
+		 * aggressively, and have the table grown so that chains
+		 * get back to a sane length.
 		 */
-		goal = max_t(unsigned int, goal / 2, rt_hash_mask + 1);
+		goal = max_t(unsigned int, goal / 2, tbl->mask + 1);
 		equilibrium = atomic_read(&ipv4_dst_ops.entries) - goal;
+		if (tbl->log < rt_hash_log_max)
+			schedule_work(&rt_hash_work);
 	}
 
 	if (now - last_gc >= ip_rt_gc_min_interval)
@@ -700,15 +876,25 @@ static int rt_garbage_collect(void)
 		goto work_done;
 	}
 
+	/*
+	 * From softirq a pass covers at most an eighth of the table and
+	 * the next one resumes where it stopped, so that a flood of new
+	 * flows does not have every dst_alloc() walk the whole cache.
+	 */
+	budget = tbl->mask + 1;
+	if (in_softirq())
+		budget = (budget >> 3) ? : 1;
+
 	do {
-		int i, k;
+		int i, k, scanned = 0, freed = 0;
 
-		for (i = rt_hash_mask, k = rover; i >= 0; i--) {
+		for (i = budget, k = rover; i > 0; i--) {
 			unsigned long tmo = expire;
 
-			k = (k + 1) & rt_hash_mask;
-			rthp = &rt_hash_table[k].chain;
-			spin_lock_bh(&rt_hash_table[k].lock);
+			k = (k + 1) & tbl->mask;
+			rthp = &tbl->buckets[k].chain;
+			scanned++;
+			spin_lock_bh(&tbl->buckets[k].lock);
 			while ((rth = *rthp) != NULL) {
 				if (!rt_may_expire(rth, tmo, expire)) {
 					tmo >>= 1;
@@ -717,13 +903,16 @@ static int rt_garbage_collect(void)
 				}
 				*rthp = rth->u.rt_next;
 				rt_free(rth);
-				goal--;
+				freed++;
 			}
-			spin_unlock_bh(&rt_hash_table[k].lock);
-			if (goal <= 0)
+			spin_unlock_bh(&tbl->buckets[k].lock);
+			if (freed >= goal)
 				break;
 		}
 		rover = k;
+		RT_CACHE_STAT_ADD(gc_buckets, scanned);
+		RT_CACHE_STAT_ADD(gc_freed, freed);
+		goal -= freed;
 
 		if (goal <= 0)
 			goto work_done;
@@ -749,15 +938,18 @@ static int rt_garbage_collect(void)
 #endif
 
 		if (atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
-			goto out;
+			goto unlock;
 	} while (!in_softirq() && time_before_eq(jiffies, now));
 
 	if (atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
-		goto out;
+		goto unlock;
 	if (net_ratelimit())
 		printk(KERN_WARNING "dst cache overflow\n");
 	RT_CACHE_STAT_INC(gc_dst_overflow);
-	return 1;
+	if (tbl->log < rt_hash_log_max)
+		schedule_work(&rt_hash_work);
+	ret = 1;
+	goto unlock;
 
 work_done:
 	expire += ip_rt_gc_min_interval;
@@ -768,7 +960,9 @@ work_done:
 	printk(KERN_DEBUG "expire++ %u %d %d %d\n", expire,
 			atomic_read(&ipv4_dst_ops.entries), goal, rover);
 #endif
-out:	return 0;
+unlock:
+	rcu_read_unlock();
+out:	return ret;
 }
 
 static inline int compare_keys(struct flowi *fl1, struct flowi *fl2)
@@ -780,8 +974,9 @@ static inline int compare_keys(struct flowi *fl1, struct flowi *fl2)
 
 static int rt_intern_hash(unsigned hash, struct rtable *rt, struct rtable **rp)
 {
+	struct rt_hash_bucket *b;
 	struct rtable	*rth, **rthp;
-	unsigned long	now;
+	unsigned long	now, tmo;
 	struct rtable *cand, **candp;
 	u32 		min_score;
 	int		chain_length;
@@ -793,10 +988,11 @@ restart:
 	cand = NULL;
 	candp = NULL;
 	now = jiffies;
+	tmo = ip_rt_gc_timeout;
 
-	rthp = &rt_hash_table[hash].chain;
+	b = rt_hash_lock(hash);
+	rthp = &b->chain;
 
-	spin_lock_bh(&rt_hash_table[hash].lock);
 	while ((rth = *rthp) != NULL) {
 		if (compare_keys(&rth->fl, &rt->fl)) {
 			/* Put it first */
@@ -806,18 +1002,17 @@ restart:
 			 * must be visible to another weakly ordered CPU before
 			 * the insertion at the start of the hash chain.
 			 */
-			rcu_assign_pointer(rth->u.rt_next,
-					   rt_hash_table[hash].chain);
+			rcu_assign_pointer(rth->u.rt_next, b->chain);
 			/*
 			 * Since lookup is lockfree, the update writes
 			 * must be ordered for consistency on SMP.
 			 */
-			rcu_assign_pointer(rt_hash_table[hash].chain, rth);
+			rcu_assign_pointer(b->chain, rth);
 
 			rth->u.dst.__use++;
 			dst_hold(&rth->u.dst);
 			rth->u.dst.lastuse = now;
-			spin_unlock_bh(&rt_hash_table[hash].lock);
+			spin_unlock_bh(&b->lock);
 
 			rt_drop(rt);
 			*rp = rth;
@@ -825,7 +1020,22 @@ restart:
 		}
 
 		if (!atomic_read(&rth->u.dst.__refcnt)) {
-			u32 score = rt_score(rth);
+			u32 score;
+
+			/*
+			 * Age off the chain while we hold its lock anyway,
+			 * with the same rule as rt_check_expire(), so that
+			 * buckets are cleaned where entries are created
+			 * rather than only by the periodic scan.
+			 */
+			if (rt_may_expire(rth, tmo, ip_rt_gc_timeout)) {
+				*rthp = rth->u.rt_next;
+				rt_free(rth);
+				RT_CACHE_STAT_INC(gc_expired);
+				continue;
+			}
+
+			score = rt_score(rth);
 
 			if (score <= min_score) {
 				cand = rth;
@@ -835,6 +1045,7 @@ restart:
 		}
 
 		chain_length++;
+		tmo >>= 1;
 
 		rthp = &rth->u.rt_next;
 	}
@@ -849,6 +1060,7 @@ restart:
 		if (chain_length > ip_rt_gc_elasticity) {
 			*candp = cand->u.rt_next;
 			rt_free(cand);
+			RT_CACHE_STAT_INC(gc_evicted);
 		}
 	}
 
@@ -858,7 +1070,7 @@ restart:
 	if (rt->rt_type == RTN_UNICAST || rt->fl.iif == 0) {
 		int err = arp_bind_neighbour(&rt->u.dst);
 		if (err) {
-			spin_unlock_bh(&rt_hash_table[hash].lock);
+			spin_unlock_bh(&b->lock);
 
 			if (err != -ENOBUFS) {
 				rt_drop(rt);
@@ -887,7 +1099,7 @@ restart:
 		}
 	}
 
-	rt->u.rt_next = rt_hash_table[hash].chain;
+	rt->u.rt_next = b->chain;
 #if RT_CACHE_DEBUG >= 2
 	if (rt->u.rt_next) {
 		struct rtable *trt;
@@ -898,8 +1110,8 @@ restart:
 		printk("\n");
 	}
 #endif
-	rt_hash_table[hash].chain = rt;
-	spin_unlock_bh(&rt_hash_table[hash].lock);
+	b->chain = rt;
+	spin_unlock_bh(&b->lock);
 	*rp = rt;
 	return 0;
 }
@@ -964,18 +1176,18 @@ void __ip_select_ident(struct iphdr *iph, struct dst_entry *dst, int more)
 
 static void rt_del(unsigned hash, struct rtable *rt)
 {
+	struct rt_hash_bucket *b;
 	struct rtable **rthp;
 
-	spin_lock_bh(&rt_hash_table[hash].lock);
+	b = rt_hash_lock(hash);
 	ip_rt_put(rt);
-	for (rthp = &rt_hash_table[hash].chain; *rthp;
-	     rthp = &(*rthp)->u.rt_next)
+	for (rthp = &b->chain; *rthp; rthp = &(*rthp)->u.rt_next)
 		if (*rthp == rt) {
 			*rthp = rt->u.rt_next;
 			rt_free(rt);
 			break;
 		}
-	spin_unlock_bh(&rt_hash_table[hash].lock);
+	spin_unlock_bh(&b->lock);
 }
 
 void ip_rt_redirect(u32 old_gw, u32 daddr, u32 new_gw,
@@ -1012,9 +1224,9 @@ void ip_rt_redirect(u32 old_gw, u32 daddr, u32 new_gw,
 						     skeys[i] ^ (ikeys[k] << 5),
 						     tos);
 
-			rthp=&rt_hash_table[hash].chain;
-
 			rcu_read_lock();
+			rthp = &rt_hash_bucket(rcu_dereference(rt_hash),
+					       hash)->chain;
 			while ((rth = rcu_dereference(*rthp)) != NULL) {
 				struct rtable *rt;
 
@@ -1269,7 +1481,7 @@ unsigned short ip_rt_frag_needed(struct iphdr *iph, unsigned short new_mtu)
 		unsigned hash = rt_hash_code(daddr, skeys[i], tos);
 
 		rcu_read_lock();
-		for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
+		for (rth = rt_hash_chain(hash); rth;
 		     rth = rcu_dereference(rth->u.rt_next)) {
 			if (rth->fl.fl4_dst == daddr &&
 			    rth->fl.fl4_src == skeys[i] &&
@@ -1903,7 +2115,7 @@ int ip_route_input(struct sk_buff *skb, u32 daddr, u32 saddr,
 	hash = rt_hash_code(daddr, saddr ^ (iif << 5), tos);
 
 	rcu_read_lock();
-	for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
+	for (rth = rt_hash_chain(hash); rth;
 	     rth = rcu_dereference(rth->u.rt_next)) {
 		if (rth->fl.fl4_dst == daddr &&
 		    rth->fl.fl4_src == saddr &&
@@ -2311,7 +2523,7 @@ int __ip_route_output_key(struct rtable **rp, const struct flowi *flp)
 	hash = rt_hash_code(flp->fl4_dst, flp->fl4_src ^ (flp->oif << 5), flp->fl4_tos);
 
 	rcu_read_lock_bh();
-	for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
+	for (rth = rt_hash_chain(hash); rth;
 		rth = rcu_dereference(rth->u.rt_next)) {
 		if (rth->fl.fl4_dst == flp->fl4_dst &&
 		    rth->fl.fl4_src == flp->fl4_src &&
@@ -2537,18 +2749,23 @@ out_free:
 
 int ip_rt_dump(struct sk_buff *skb,  struct netlink_callback *cb)
 {
+	struct rt_hash_table *tbl;
 	struct rtable *rt;
 	int h, s_h;
 	int idx, s_idx;
 
 	s_h = cb->args[0];
 	s_idx = idx = cb->args[1];
-	for (h = 0; h <= rt_hash_mask; h++) {
-		if (h < s_h) continue;
+	for (h = s_h; ; h++) {
 		if (h > s_h)
 			s_idx = 0;
 		rcu_read_lock_bh();
-		for (rt = rcu_dereference(rt_hash_table[h].chain), idx = 0; rt;
+		tbl = rcu_dereference(rt_hash);
+		if (h > tbl->mask) {
+			rcu_read_unlock_bh();
+			break;
+		}
+		for (rt = rcu_dereference(tbl->buckets[h].chain), idx = 0; rt;
 		     rt = rcu_dereference(rt->u.rt_next), idx++) {
 			if (idx < s_idx)
 				continue;
@@ -2842,7 +3059,7 @@ __setup("rhash_entries=", set_rhash_entries);
 
 int __init ip_rt_init(void)
 {
-	int i, order, goal, rc = 0;
+	int log, order, goal, rc = 0;
 
 	rt_hash_rnd = (int) ((num_physpages ^ (num_physpages>>8)) ^
 			     (jiffies ^ (jiffies >> 7)));
@@ -2872,32 +3089,27 @@ int __init ip_rt_init(void)
 		/* NOTHING */;
 
 	do {
-		rt_hash_mask = (1UL << order) * PAGE_SIZE /
-			sizeof(struct rt_hash_bucket);
-		while (rt_hash_mask & (rt_hash_mask - 1))
-			rt_hash_mask--;
-		rt_hash_table = (struct rt_hash_bucket *)
-			__get_free_pages(GFP_ATOMIC, order);
-	} while (rt_hash_table == NULL && --order > 0);
-
-	if (!rt_hash_table)
+		for (log = 0; (sizeof(struct rt_hash_bucket) << (log + 1)) <=
+			      (PAGE_SIZE << order); log++)
+			/* NOTHING */;
+		rt_hash = rt_hash_alloc(log, GFP_ATOMIC);
+	} while (rt_hash == NULL && --order > 0);
+
+	if (!rt_hash)
 		panic("Failed to allocate IP route cache hash table\n");
 
 	printk(KERN_INFO "IP: routing cache hash table of %u buckets, %ldKbytes\n",
-	       rt_hash_mask,
-	       (long) (rt_hash_mask * sizeof(struct rt_hash_bucket)) / 1024);
+	       rt_hash->mask + 1,
+	       (long) ((rt_hash->mask + 1) * sizeof(struct rt_hash_bucket)) / 1024);
 
-	for (rt_hash_log = 0; (1 << rt_hash_log) != rt_hash_mask; rt_hash_log++)
-		/* NOTHING */;
-
-	rt_hash_mask--;
-	for (i = 0; i <= rt_hash_mask; i++) {
-		spin_lock_init(&rt_hash_table[i].lock);
-		rt_hash_table[i].chain = NULL;
-	}
+	rt_hash_log_min = rt_hash->log;
+	rt_hash_log_max = rt_hash->log + RT_HASH_GROW_LOG;
+	while (rt_hash_log_max > rt_hash_log_min &&
+	       rt_hash_order(rt_hash_log_max) >= MAX_ORDER)
+		rt_hash_log_max--;
 
-	ipv4_dst_ops.gc_thresh = (rt_hash_mask + 1);
-	ip_rt_max_size = (rt_hash_mask + 1) * 16;
+	ipv4_dst_ops.gc_thresh = (rt_hash->mask + 1);
+	ip_rt_max_size = (rt_hash->mask + 1) * 16;
 
 	rt_cache_stat = alloc_percpu(struct rt_cache_stat);
 	if (!rt_cache_stat)
@@ -2908,7 +3120,7 @@ int __init ip_rt_init(void)
 
 	init_timer(&rt_flush_timer);
 	rt_flush_timer.function = rt_run_flush;
-	init_timer(&rt_periodic_timer);
+	init_timer_deferrable(&rt_periodic_timer);
 	rt_periodic_timer.function = rt_check_expire;
 	init_timer(&rt_secret_timer);
 	rt_secret_timer.function = rt_secret_rebuild;
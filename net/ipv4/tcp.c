@@ -257,6 +257,8 @@
 #include <linux/fs.h>
 #include <linux/random.h>
 #include <linux/bootmem.h>
+#include <linux/err.h>
+#include <linux/mm.h>
 
 #include <net/icmp.h>
 #include <net/tcp.h>
@@ -285,7 +287,7 @@ EXPORT_SYMBOL(sysctl_tcp_mem);
 EXPORT_SYMBOL(sysctl_tcp_rmem);
 EXPORT_SYMBOL(sysctl_tcp_wmem);
 
-atomic_t tcp_memory_allocated;	/* Current allocated memory. */
+struct percpu_counter tcp_memory_allocated;	/* Current allocated memory. */
 atomic_t tcp_sockets_allocated;	/* Current number of TCP sockets. */
 
 EXPORT_SYMBOL(tcp_memory_allocated);
@@ -599,7 +601,7 @@ static inline void skb_entail(struct sock *sk, struct tcp_sock *tp,
 	TCP_SKB_CB(skb)->flags = TCPCB_FLAG_ACK;
 	TCP_SKB_CB(skb)->sacked = 0;
 	skb_header_release(skb);
-	__skb_queue_tail(&sk->sk_write_queue, skb);
+	tcp_add_write_queue_tail(sk, skb);
 	sk_charge_skb(sk, skb);
 	if (!sk->sk_send_head)
 		sk->sk_send_head = skb;
@@ -990,7 +992,7 @@ do_fault:
 	if (!skb->len) {
 		if (sk->sk_send_head == skb)
 			sk->sk_send_head = NULL;
-		__skb_unlink(skb, skb->list);
+		tcp_unlink_write_queue(sk, skb);
 		sk_stream_free_skb(sk, skb);
 	}
 
@@ -1213,6 +1215,176 @@ int tcp_read_sock(struct sock *sk, read_descriptor_t *desc,
 	return copied;
 }
 
+/*
+ * Zero-copy receive.  A TCP socket can be mmap()ed read-only, and
+ * getsockopt(TCP_ZEROCOPY_RECEIVE) then maps received payload into that
+ * mapping instead of copying it: each whole page of payload that sits in
+ * a page-sized frag of its own, as NICs splitting headers from payload
+ * give them, has that very page mapped.  The first data which is not such
+ * a page stops the mapping, and recv_skip_hint says how much of it to
+ * read with recvmsg() before trying again.
+ *
+ * A mapped page stays the application's until the range is zapped by
+ * the next TCP_ZEROCOPY_RECEIVE into it, by setsockopt
+ * (TCP_ZEROCOPY_RELEASE) or by munmap().
+ */
+static struct page *tcp_vm_nopage(struct vm_area_struct *vma,
+				  unsigned long address, int *type)
+{
+	/* nothing there until TCP_ZEROCOPY_RECEIVE puts a page there */
+	return NOPAGE_SIGBUS;
+}
+
+static struct vm_operations_struct tcp_vm_ops = {
+	.nopage	= tcp_vm_nopage,
+};
+
+int tcp_mmap(struct file *file, struct socket *sock,
+	     struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & (VM_WRITE | VM_EXEC))
+		return -EPERM;
+	vma->vm_flags &= ~(VM_MAYWRITE | VM_MAYEXEC);
+	vma->vm_ops = &tcp_vm_ops;
+	return 0;
+}
+
+/* The mapping at address of this socket, or NULL; mmap_sem held */
+static struct vm_area_struct *tcp_zerocopy_vma(struct sock *sk,
+					       unsigned long address)
+{
+	struct vm_area_struct *vma;
+
+	vma = find_vma(current->mm, address);
+	if (!vma || vma->vm_start > address || vma->vm_ops != &tcp_vm_ops ||
+	    vma->vm_file->private_data != sk->sk_socket)
+		return NULL;
+	return vma;
+}
+
+/*
+ * The page holding the payload at offset in skb, if it can be mapped.
+ * Otherwise *skip is how much of the payload must be copied before the
+ * next page which can be.
+ */
+static struct page *tcp_zerocopy_page(struct sk_buff *skb, u32 offset,
+				      u32 *skip)
+{
+	u32 start = skb_headlen(skb);
+	int i;
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+
+		if (start >= offset && !frag->page_offset &&
+		    frag->size == PAGE_SIZE && !PageCompound(frag->page)) {
+			if (start == offset)
+				return frag->page;
+			*skip = start - offset;
+			return NULL;
+		}
+		start += frag->size;
+	}
+	*skip = skb->len - offset;
+	return NULL;
+}
+
+static int tcp_zerocopy_receive(struct sock *sk,
+				struct tcp_zerocopy_receive *zc)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	unsigned long address = (unsigned long)zc->address;
+	struct vm_area_struct *vma;
+	struct sk_buff *skb;
+	u32 seq, offset, avail, length = 0;
+	int err = 0;
+
+	if (address != zc->address || (address & ~PAGE_MASK))
+		return -EINVAL;
+	if (sk->sk_state == TCP_LISTEN)
+		return -ENOTCONN;
+
+	down_read(&current->mm->mmap_sem);
+
+	vma = tcp_zerocopy_vma(sk, address);
+	if (!vma) {
+		up_read(&current->mm->mmap_sem);
+		return -EINVAL;
+	}
+	zc->length = min_t(unsigned long, zc->length, vma->vm_end - address);
+	zc->length &= PAGE_MASK;
+	zc->recv_skip_hint = 0;
+
+	/* hand back whatever was mapped there before */
+	if (zc->length)
+		zap_page_range(vma, address, zc->length, NULL);
+
+	seq = tp->copied_seq;
+	avail = tp->rcv_nxt - seq;
+	if (tp->urg_data) {
+		/* leave urgent data to recvmsg() */
+		u32 urg_offset = tp->urg_seq - seq;
+
+		if (urg_offset < avail)
+			avail = urg_offset;
+	}
+
+	while (length < zc->length) {
+		struct page *page;
+
+		if (avail < PAGE_SIZE) {
+			zc->recv_skip_hint = avail;
+			break;
+		}
+		skb = tcp_recv_skb(sk, seq, &offset);
+		if (!skb || offset >= skb->len)
+			break;
+		page = tcp_zerocopy_page(skb, offset, &zc->recv_skip_hint);
+		if (!page)
+			break;
+		err = vm_insert_page(vma, address + length, page);
+		if (err)
+			break;
+
+		seq += PAGE_SIZE;
+		length += PAGE_SIZE;
+		avail -= PAGE_SIZE;
+		if (offset + PAGE_SIZE == skb->len && !skb->h.th->fin)
+			sk_eat_skb(sk, skb);
+	}
+
+	up_read(&current->mm->mmap_sem);
+
+	zc->length = length;
+	if (length) {
+		tp->copied_seq = seq;
+		tcp_rcv_space_adjust(sk);
+		cleanup_rbuf(sk, length);
+		err = 0;
+	}
+	return err;
+}
+
+static int tcp_zerocopy_release(struct sock *sk,
+				struct tcp_zerocopy_receive *zc)
+{
+	unsigned long address = (unsigned long)zc->address;
+	struct vm_area_struct *vma;
+	int err = -EINVAL;
+
+	if (address != zc->address || (address & ~PAGE_MASK))
+		return -EINVAL;
+
+	down_read(&current->mm->mmap_sem);
+	vma = tcp_zerocopy_vma(sk, address);
+	if (vma && zc->length <= vma->vm_end - address) {
+		zap_page_range(vma, address, PAGE_ALIGN(zc->length), NULL);
+		err = 0;
+	}
+	up_read(&current->mm->mmap_sem);
+	return err;
+}
+
 /*
  *	This routine copies from a sock struct into the user buffer.
  *
@@ -1234,6 +1406,10 @@ int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	long timeo;
 	struct task_struct *user_recv = NULL;
 
+	if (sk_can_busy_loop(sk) && skb_queue_empty(&sk->sk_receive_queue) &&
+	    sk->sk_state == TCP_ESTABLISHED)
+		sk_busy_loop(sk, nonblock);
+
 	lock_sock(sk);
 
 	TCP_CHECK_TIMER(sk);
@@ -1751,7 +1927,8 @@ adjudge_to_death:
 		sk_stream_mem_reclaim(sk);
 		if (atomic_read(&tcp_orphan_count) > sysctl_tcp_max_orphans ||
 		    (sk->sk_wmem_queued > SOCK_MIN_SNDBUF &&
-		     atomic_read(&tcp_memory_allocated) > sysctl_tcp_mem[2])) {
+		     percpu_counter_read(&tcp_memory_allocated) >
+							sysctl_tcp_mem[2])) {
 			if (net_ratelimit())
 				printk(KERN_INFO "TCP: too many of orphaned "
 				       "sockets\n");
@@ -1807,7 +1984,7 @@ int tcp_disconnect(struct sock *sk, int flags)
 
 	tcp_clear_xmit_timers(sk);
 	__skb_queue_purge(&sk->sk_receive_queue);
-	sk_stream_writequeue_purge(sk);
+	tcp_write_queue_purge(sk);
 	__skb_queue_purge(&tp->out_of_order_queue);
 
 	inet->dport = 0;
@@ -1828,6 +2005,7 @@ int tcp_disconnect(struct sock *sk, int flags)
 	tp->snd_cwnd_cnt = 0;
 	tcp_set_ca_state(tp, TCP_CA_Open);
 	tcp_clear_retrans(tp);
+	tcp_clear_sack_cache(tp);
 	tcp_delack_init(tp);
 	sk->sk_send_head = NULL;
 	tp->rx_opt.saw_tstamp = 0;
@@ -1953,6 +2131,35 @@ int tcp_setsockopt(struct sock *sk, int level, int optname, char __user *optval,
 		return tp->af_specific->setsockopt(sk, level, optname,
 						   optval, optlen);
 
+	/* This is a string value all the others are int's */
+	if (optname == TCP_CONGESTION) {
+		char name[TCP_CA_NAME_MAX];
+
+		if (optlen < 1)
+			return -EINVAL;
+
+		val = strncpy_from_user(name, optval,
+					min(TCP_CA_NAME_MAX-1, optlen));
+		if (val < 0)
+			return -EFAULT;
+		name[val] = 0;
+
+		lock_sock(sk);
+		err = tcp_set_congestion_control(tp, name);
+		release_sock(sk);
+		return err;
+	}
+
+	if (optname == TCP_ZEROCOPY_RELEASE) {
+		struct tcp_zerocopy_receive zc;
+
+		if (optlen < sizeof(zc))
+			return -EINVAL;
+		if (copy_from_user(&zc, optval, sizeof(zc)))
+			return -EFAULT;
+		return tcp_zerocopy_release(sk, &zc);
+	}
+
 	if (optlen < sizeof(int))
 		return -EINVAL;
 
@@ -2237,6 +2444,33 @@ int tcp_getsockopt(struct sock *sk, int level, int optname, char __user *optval,
 	case TCP_QUICKACK:
 		val = !tp->ack.pingpong;
 		break;
+
+	case TCP_CONGESTION:
+		if (get_user(len, optlen))
+			return -EFAULT;
+		len = min_t(unsigned int, len, TCP_CA_NAME_MAX);
+		if (put_user(len, optlen))
+			return -EFAULT;
+		if (copy_to_user(optval, tp->ca_ops->name, len))
+			return -EFAULT;
+		return 0;
+	case TCP_ZEROCOPY_RECEIVE: {
+		struct tcp_zerocopy_receive zc;
+		int err;
+
+		if (get_user(len, optlen))
+			return -EFAULT;
+		if (len != sizeof(zc))
+			return -EINVAL;
+		if (copy_from_user(&zc, optval, len))
+			return -EFAULT;
+		lock_sock(sk);
+		err = tcp_zerocopy_receive(sk, &zc);
+		release_sock(sk);
+		if (!err && copy_to_user(optval, &zc, len))
+			err = -EFAULT;
+		return err;
+	}
 	default:
 		return -ENOPROTOOPT;
 	};
@@ -2248,6 +2482,140 @@ int tcp_getsockopt(struct sock *sk, int level, int optname, char __user *optval,
 	return 0;
 }
 
+/*
+ *	Split a large send, for a device that can't do it itself, into
+ *	segments of tso_size bytes.  The TCP header is copied to each and
+ *	fixed up the way a TSO capable card would: sequence number, flags
+ *	that only belong on the first or last segment, and checksum.
+ */
+struct sk_buff *tcp_tso_segment(struct sk_buff *skb, int sg)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct tcphdr *th;
+	unsigned int thlen;
+	u32 seq;
+
+	if (!pskb_may_pull(skb, sizeof(*th)))
+		goto out;
+
+	th = skb->h.th;
+	thlen = th->doff * 4;
+	if (thlen < sizeof(*th) || !pskb_may_pull(skb, thlen))
+		goto out;
+
+	th = skb->h.th;
+	seq = ntohl(th->seq);
+	__skb_pull(skb, thlen);
+
+	segs = skb_segment(skb, sg);
+	if (IS_ERR(segs))
+		goto out;
+
+	for (skb = segs; skb; skb = skb->next) {
+		struct iphdr *iph = skb->nh.iph;
+		unsigned int len = skb->len - (skb->h.raw - skb->data);
+
+		th = skb->h.th;
+		th->seq = htonl(seq);
+		seq += len - thlen;
+		if (skb != segs)
+			th->cwr = 0;
+		if (skb->next)
+			th->fin = th->psh = 0;
+
+		if (skb->ip_summed == CHECKSUM_HW) {
+			th->check = ~tcp_v4_check(th, len, iph->saddr,
+						  iph->daddr, 0);
+		} else {
+			th->check = 0;
+			th->check = tcp_v4_check(th, len, iph->saddr, iph->daddr,
+						 csum_partial((char *) th, thlen,
+							      skb->csum));
+		}
+	}
+
+out:
+	return segs;
+}
+
+/*
+ *	Receive aggregation: append @skb to the held segment of its
+ *	connection if it carries the next bytes of data with the same
+ *	ack, window and options.  A held segment is passed up as soon
+ *	as a segment can't be merged, is short or has PSH set.
+ */
+struct sk_buff **tcp_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct tcphdr *th, *th2;
+	unsigned int thlen, len, plen;
+	unsigned int mss = 1;
+	int flush = 1;
+
+	if (!pskb_may_pull(skb, sizeof(*th)))
+		goto out;
+
+	th = skb->h.th;
+	thlen = th->doff * 4;
+	if (thlen < sizeof(*th) || !pskb_may_pull(skb, thlen))
+		goto out;
+
+	th = skb->h.th;
+	__skb_pull(skb, thlen);
+	len = skb->len;
+
+	for (; (p = *head); head = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		th2 = p->h.th;
+		if (th->source != th2->source || th->dest != th2->dest) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		goto found;
+	}
+	goto out_check_final;
+
+found:
+	plen = p->len - (p->h.raw - p->data) - th2->doff * 4;
+	mss = skb_shinfo(p)->tso_size ? : plen;
+
+	flush = NAPI_GRO_CB(p)->flush;
+	flush |= skb->ip_summed != CHECKSUM_UNNECESSARY;
+	flush |= th->syn || th->rst || th->urg || th->fin || th->cwr ||
+		 th->ece != th2->ece || !th->ack;
+	flush |= th->ack_seq != th2->ack_seq || th->window != th2->window;
+	flush |= ntohl(th->seq) != ntohl(th2->seq) + plen;
+	flush |= thlen != th2->doff * 4 ||
+		 memcmp(th + 1, th2 + 1, thlen - sizeof(*th));
+	flush |= len > mss || p->len + len > 65535;
+
+	if (flush) {
+		mss = 1;
+		goto out_check_final;
+	}
+
+	skb_shinfo(p)->tso_size = mss;
+	skb_gro_receive(p, skb);
+	th2->psh |= th->psh;
+
+out_check_final:
+	flush = len < mss;
+	flush |= skb->ip_summed != CHECKSUM_UNNECESSARY;
+	flush |= th->psh || th->syn || th->rst || th->urg || th->fin ||
+		 th->cwr || !th->ack;
+
+	if (p && (!NAPI_GRO_CB(skb)->same_flow || flush))
+		pp = head;
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+	return pp;
+}
+
 
 extern void __skb_cb_too_small_for_tcp(int, int);
 extern void tcpdiag_init(void);
@@ -2271,6 +2639,8 @@ void __init tcp_init(void)
 		__skb_cb_too_small_for_tcp(sizeof(struct tcp_skb_cb),
 					   sizeof(skb->cb));
 
+	percpu_counter_init(&tcp_memory_allocated);
+
 	tcp_openreq_cachep = kmem_cache_create("tcp_open_request",
 						   sizeof(struct open_request),
 					       0, SLAB_HWCACHE_ALIGN,
@@ -2310,7 +2680,7 @@ void __init tcp_init(void)
 					0);
 	tcp_ehash_size = (1 << tcp_ehash_size) >> 1;
 	for (i = 0; i < (tcp_ehash_size << 1); i++) {
-		rwlock_init(&tcp_ehash[i].lock);
+		spin_lock_init(&tcp_ehash[i].lock);
 		INIT_HLIST_HEAD(&tcp_ehash[i].chain);
 	}
 
@@ -2351,6 +2721,8 @@ void __init tcp_init(void)
 		sysctl_max_syn_backlog = 128;
 	}
 	tcp_port_rover = sysctl_local_port_range[0] - 1;
+	get_random_bytes(&tcp_reuseport_secret, sizeof(tcp_reuseport_secret));
+	tcp_tasklet_init();
 
 	sysctl_tcp_mem[0] =  768 << order;
 	sysctl_tcp_mem[1] = 1024 << order;
@@ -2366,6 +2738,8 @@ void __init tcp_init(void)
 	printk(KERN_INFO "TCP: Hash tables configured "
 	       "(established %d bind %d)\n",
 	       tcp_ehash_size << 1, tcp_bhash_size);
+
+	tcp_register_congestion_control(&tcp_reno);
 }
 
 EXPORT_SYMBOL(tcp_accept);
@@ -2380,6 +2754,7 @@ EXPORT_SYMBOL(tcp_read_sock);
 EXPORT_SYMBOL(tcp_recvmsg);
 EXPORT_SYMBOL(tcp_sendmsg);
 EXPORT_SYMBOL(tcp_sendpage);
+EXPORT_SYMBOL(tcp_mmap);
 EXPORT_SYMBOL(tcp_setsockopt);
 EXPORT_SYMBOL(tcp_shutdown);
 EXPORT_SYMBOL(tcp_statistics);
@@ -104,6 +104,11 @@ struct tcp_hashinfo __cacheline_aligned tcp_hashinfo = {
 int sysctl_local_port_range[2] = { 1024, 4999 };
 int tcp_port_rover = 1024 - 1;
 
+/* Keys the flow hash that spreads connections over SO_REUSEPORT
+ * listeners, so remote ends cannot aim at one of them.
+ */
+u32 tcp_reuseport_secret;
+
 static __inline__ int tcp_hashfn(__u32 laddr, __u16 lport,
 				 __u32 faddr, __u16 fport)
 {
@@ -185,6 +190,8 @@ static inline int tcp_bind_conflict(struct sock *sk, struct tcp_bind_bucket *tb)
 	struct sock *sk2;
 	struct hlist_node *node;
 	int reuse = sk->sk_reuse;
+	int reuseport = sk->sk_reuseport;
+	int uid = sock_i_uid(sk);
 
 	sk_for_each_bound(sk2, node, &tb->owners) {
 		if (sk != sk2 &&
@@ -192,8 +199,9 @@ static inline int tcp_bind_conflict(struct sock *sk, struct tcp_bind_bucket *tb)
 		    (!sk->sk_bound_dev_if ||
 		     !sk2->sk_bound_dev_if ||
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if)) {
-			if (!reuse || !sk2->sk_reuse ||
-			    sk2->sk_state == TCP_LISTEN) {
+			if ((!reuse || !sk2->sk_reuse ||
+			     sk2->sk_state == TCP_LISTEN) &&
+			    !tcp_reuseport_ok(sk2, reuseport, uid)) {
 				const u32 sk2_rcv_saddr = tcp_v4_rcv_saddr(sk2);
 				if (!sk2_rcv_saddr || !sk_rcv_saddr ||
 				    sk2_rcv_saddr == sk_rcv_saddr)
@@ -348,26 +356,69 @@ void tcp_listen_wlock(void)
 	}
 }
 
-static __inline__ void __tcp_v4_hash(struct sock *sk, const int listen_possible)
+/*
+ * The established hash is searched under RCU only.  Members are linked
+ * and unlinked under the bucket lock, and the hash holds a reference on
+ * each of them which is dropped a grace period after the unlink, so a
+ * reader can always take its own reference on what it finds.
+ */
+static void tcp_ehash_put(struct rcu_head *head)
+{
+	struct sock *sk = container_of(head, struct sock, sk_rcu);
+
+	head->func = NULL;
+	sock_put(sk);
+}
+
+/* Called with the bucket lock held. */
+void __tcp_ehash_add(struct sock *sk, struct hlist_head *list)
+{
+	sock_hold(sk);
+	__sk_add_node_rcu(sk, list);
+	sock_prot_inc_use(sk->sk_prot);
+}
+
+/* Called with the bucket lock held. */
+int __tcp_ehash_del(struct sock *sk)
+{
+	if (!__sk_del_node_init(sk))
+		return 0;
+	sock_prot_dec_use(sk->sk_prot);
+	call_rcu(&sk->sk_rcu, tcp_ehash_put);
+	return 1;
+}
+
+static void __tcp_tw_put_rcu(struct rcu_head *head)
+{
+	tcp_tw_put(container_of(head, struct tcp_tw_bucket, tw_rcu));
+}
+
+/* Drop the established hash's reference on an unlinked TIME_WAIT bucket. */
+void tcp_tw_put_rcu(struct tcp_tw_bucket *tw)
 {
-	struct hlist_head *list;
-	rwlock_t *lock;
+	call_rcu(&tw->tw_rcu, __tcp_tw_put_rcu);
+}
 
+static __inline__ void __tcp_v4_hash(struct sock *sk, const int listen_possible)
+{
 	BUG_TRAP(sk_unhashed(sk));
 	if (listen_possible && sk->sk_state == TCP_LISTEN) {
+		struct hlist_head *list;
+
 		list = &tcp_listening_hash[tcp_sk_listen_hashfn(sk)];
-		lock = &tcp_lhash_lock;
 		tcp_listen_wlock();
+		__sk_add_node(sk, list);
+		sock_prot_inc_use(sk->sk_prot);
+		write_unlock(&tcp_lhash_lock);
+		wake_up(&tcp_lhash_wait);
 	} else {
-		list = &tcp_ehash[(sk->sk_hashent = tcp_sk_hashfn(sk))].chain;
-		lock = &tcp_ehash[sk->sk_hashent].lock;
-		write_lock(lock);
+		struct tcp_ehash_bucket *head;
+
+		head = &tcp_ehash[(sk->sk_hashent = tcp_sk_hashfn(sk))];
+		spin_lock(&head->lock);
+		__tcp_ehash_add(sk, &head->chain);
+		spin_unlock(&head->lock);
 	}
-	__sk_add_node(sk, list);
-	sock_prot_inc_use(sk->sk_prot);
-	write_unlock(lock);
-	if (listen_possible && sk->sk_state == TCP_LISTEN)
-		wake_up(&tcp_lhash_wait);
 }
 
 static void tcp_v4_hash(struct sock *sk)
@@ -381,24 +432,22 @@ static void tcp_v4_hash(struct sock *sk)
 
 void tcp_unhash(struct sock *sk)
 {
-	rwlock_t *lock;
-
 	if (sk_unhashed(sk))
 		goto ende;
 
 	if (sk->sk_state == TCP_LISTEN) {
 		local_bh_disable();
 		tcp_listen_wlock();
-		lock = &tcp_lhash_lock;
+		if (__sk_del_node_init(sk))
+			sock_prot_dec_use(sk->sk_prot);
+		write_unlock_bh(&tcp_lhash_lock);
 	} else {
 		struct tcp_ehash_bucket *head = &tcp_ehash[sk->sk_hashent];
-		lock = &head->lock;
-		write_lock_bh(&head->lock);
-	}
 
-	if (__sk_del_node_init(sk))
-		sock_prot_dec_use(sk->sk_prot);
-	write_unlock_bh(lock);
+		spin_lock_bh(&head->lock);
+		__tcp_ehash_del(sk);
+		spin_unlock_bh(&head->lock);
+	}
 
  ende:
 	if (sk->sk_state == TCP_LISTEN)
@@ -411,12 +460,15 @@ void tcp_unhash(struct sock *sk)
  * connection.  So always assume those are both wildcarded
  * during the search since they can never be otherwise.
  */
-static struct sock *__tcp_v4_lookup_listener(struct hlist_head *head, u32 daddr,
+static struct sock *__tcp_v4_lookup_listener(struct hlist_head *head,
+					     u32 saddr, u16 sport, u32 daddr,
 					     unsigned short hnum, int dif)
 {
 	struct sock *result = NULL, *sk;
 	struct hlist_node *node;
 	int score, hiscore;
+	int reuseport = 0, matches = 0;
+	u32 phash = 0;
 
 	hiscore=-1;
 	sk_for_each(sk, node, head) {
@@ -436,20 +488,38 @@ static struct sock *__tcp_v4_lookup_listener(struct hlist_head *head, u32 daddr,
 					continue;
 				score+=2;
 			}
-			if (score == 5)
-				return sk;
 			if (score > hiscore) {
 				hiscore = score;
 				result = sk;
+				reuseport = sk->sk_reuseport;
+				if (reuseport) {
+					phash = jhash_3words(saddr, daddr,
+						TCP_COMBINED_PORTS(sport, hnum),
+						tcp_reuseport_secret);
+					matches = 1;
+				}
+			} else if (score == hiscore && reuseport &&
+				   sk->sk_reuseport) {
+				/* Pick one of the equally good listeners
+				 * by flow hash, so that a connection keeps
+				 * landing on the same one.
+				 */
+				matches++;
+				if (tcp_reuseport_scale(phash, matches) == 0)
+					result = sk;
+				phash = tcp_reuseport_next(phash);
 			}
+			if (score == 5 && !reuseport)
+				break;
 		}
 	}
 	return result;
 }
 
 /* Optimize the common listener case. */
-static inline struct sock *tcp_v4_lookup_listener(u32 daddr,
-		unsigned short hnum, int dif)
+static inline struct sock *tcp_v4_lookup_listener(u32 saddr, u16 sport,
+						  u32 daddr,
+						  unsigned short hnum, int dif)
 {
 	struct sock *sk = NULL;
 	struct hlist_head *head;
@@ -464,7 +534,8 @@ static inline struct sock *tcp_v4_lookup_listener(u32 daddr,
 		    (sk->sk_family == PF_INET || !ipv6_only_sock(sk)) &&
 		    !sk->sk_bound_dev_if)
 			goto sherry_cache;
-		sk = __tcp_v4_lookup_listener(head, daddr, hnum, dif);
+		sk = __tcp_v4_lookup_listener(head, saddr, sport, daddr,
+					      hnum, dif);
 	}
 	if (sk) {
 sherry_cache:
@@ -493,25 +564,49 @@ static inline struct sock *__tcp_v4_lookup_established(u32 saddr, u16 sport,
 	 * have wildcards anyways.
 	 */
 	int hash = tcp_hashfn(daddr, hnum, saddr, sport);
+	int locked = 0;
+
 	head = &tcp_ehash[hash];
-	read_lock(&head->lock);
-	sk_for_each(sk, node, &head->chain) {
-		if (TCP_IPV4_MATCH(sk, acookie, saddr, daddr, ports, dif))
-			goto hit; /* You sunk my battleship! */
+	rcu_read_lock();
+begin:
+	sk_for_each_rcu(sk, node, &head->chain) {
+		if (TCP_IPV4_MATCH(sk, acookie, saddr, daddr, ports, dif)) {
+			/* You sunk my battleship! */
+			sock_hold(sk);
+			/* Recheck now that it cannot go away under us. */
+			if (unlikely(!TCP_IPV4_MATCH(sk, acookie, saddr,
+						     daddr, ports, dif))) {
+				sock_put(sk);
+				goto begin;
+			}
+			goto out;
+		}
 	}
 
 	/* Must check for a TIME_WAIT'er before going to listener hash. */
-	sk_for_each(sk, node, &(head + tcp_ehash_size)->chain) {
-		if (TCP_IPV4_TW_MATCH(sk, acookie, saddr, daddr, ports, dif))
-			goto hit;
+	sk_for_each_rcu(sk, node, &(head + tcp_ehash_size)->chain) {
+		if (TCP_IPV4_TW_MATCH(sk, acookie, saddr, daddr, ports, dif)) {
+			sock_hold(sk);
+			goto out;
+		}
+	}
+
+	/* A socket moved to another chain while we were walking past
+	 * it takes the rest of the walk with it.  Our chains carry no
+	 * end markers to detect that, so confirm a miss with the
+	 * writers held off before sending the segment to a listener.
+	 */
+	if (!locked) {
+		locked = 1;
+		spin_lock(&head->lock);
+		goto begin;
 	}
 	sk = NULL;
 out:
-	read_unlock(&head->lock);
+	if (locked)
+		spin_unlock(&head->lock);
+	rcu_read_unlock();
 	return sk;
-hit:
-	sock_hold(sk);
-	goto out;
 }
 
 static inline struct sock *__tcp_v4_lookup(u32 saddr, u16 sport,
@@ -520,7 +615,7 @@ static inline struct sock *__tcp_v4_lookup(u32 saddr, u16 sport,
 	struct sock *sk = __tcp_v4_lookup_established(saddr, sport,
 						      daddr, hnum, dif);
 
-	return sk ? : tcp_v4_lookup_listener(daddr, hnum, dif);
+	return sk ? : tcp_v4_lookup_listener(saddr, sport, daddr, hnum, dif);
 }
 
 inline struct sock *tcp_v4_lookup(u32 saddr, u16 sport, u32 daddr,
@@ -561,7 +656,7 @@ static int __tcp_v4_check_established(struct sock *sk, __u16 lport,
 	struct hlist_node *node;
 	struct tcp_tw_bucket *tw;
 
-	write_lock(&head->lock);
+	spin_lock(&head->lock);
 
 	/* Check TIME-WAIT sockets first. */
 	sk_for_each(sk2, node, &(head + tcp_ehash_size)->chain) {
@@ -614,9 +709,8 @@ unique:
 	inet->sport = htons(lport);
 	sk->sk_hashent = hash;
 	BUG_TRAP(sk_unhashed(sk));
-	__sk_add_node(sk, &head->chain);
-	sock_prot_inc_use(sk->sk_prot);
-	write_unlock(&head->lock);
+	__tcp_ehash_add(sk, &head->chain);
+	spin_unlock(&head->lock);
 
 	if (twp) {
 		*twp = tw;
@@ -632,7 +726,7 @@ unique:
 	return 0;
 
 not_unique:
-	write_unlock(&head->lock);
+	spin_unlock(&head->lock);
 	return -EADDRNOTAVAIL;
 }
 
@@ -820,6 +914,7 @@ int tcp_v4_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
 	 * complete initialization after this.
 	 */
 	tcp_set_state(sk, TCP_SYN_SENT);
+	tcp_ehash_sync(sk);
 	err = tcp_v4_hash_connect(sk);
 	if (err)
 		goto failure;
@@ -1773,6 +1868,7 @@ process:
 	if (sk_filter(sk, skb, 0))
 		goto discard_and_relse;
 
+	sk_mark_busy_poll(sk, skb);
 	skb->dev = NULL;
 
 	bh_lock_sock(sk);
@@ -1822,7 +1918,9 @@ do_time_wait:
 	switch (tcp_timewait_state_process((struct tcp_tw_bucket *)sk,
 					   skb, th, skb->len)) {
 	case TCP_TW_SYN: {
-		struct sock *sk2 = tcp_v4_lookup_listener(skb->nh.iph->daddr,
+		struct sock *sk2 = tcp_v4_lookup_listener(skb->nh.iph->saddr,
+							  th->source,
+							  skb->nh.iph->daddr,
 							  ntohs(th->dest),
 							  tcp_v4_iif(skb));
 		if (sk2) {
@@ -1848,8 +1946,22 @@ do_time_wait:
  */
 static void __tcp_v4_rehash(struct sock *sk)
 {
-	sk->sk_prot->unhash(sk);
-	sk->sk_prot->hash(sk);
+	struct tcp_ehash_bucket *head = &tcp_ehash[sk->sk_hashent];
+
+	/* Move the socket, and the hash's reference with it: going
+	 * through tcp_unhash() would have to wait for a grace period.
+	 */
+	spin_lock_bh(&head->lock);
+	if (!__sk_del_node_init(sk)) {
+		spin_unlock_bh(&head->lock);
+		return;
+	}
+	spin_unlock_bh(&head->lock);
+
+	head = &tcp_ehash[(sk->sk_hashent = tcp_sk_hashfn(sk))];
+	spin_lock_bh(&head->lock);
+	__sk_add_node_rcu(sk, &head->chain);
+	spin_unlock_bh(&head->lock);
 }
 
 static int tcp_v4_reselect_saddr(struct sock *sk)
@@ -2060,6 +2172,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 	tp->mss_cache_std = tp->mss_cache = 536;
 
 	tp->reordering = sysctl_tcp_reordering;
+	tp->ca_ops = &tcp_init_congestion_ops;
 
 	sk->sk_state = TCP_CLOSE;
 
@@ -2082,8 +2195,10 @@ int tcp_v4_destroy_sock(struct sock *sk)
 
 	tcp_clear_xmit_timers(sk);
 
+	tcp_cleanup_congestion_control(tp);
+
 	/* Cleanup up the write buffer. */
-  	sk_stream_writequeue_purge(sk);
+  	tcp_write_queue_purge(sk);
 
 	/* Cleans up our, hopefully empty, out_of_order_queue. */
   	__skb_queue_purge(&tp->out_of_order_queue);
@@ -2220,7 +2335,7 @@ static void *established_get_first(struct seq_file *seq)
 		/* We can reschedule _before_ having picked the target: */
 		cond_resched_softirq();
 
-		read_lock(&tcp_ehash[st->bucket].lock);
+		spin_lock(&tcp_ehash[st->bucket].lock);
 		sk_for_each(sk, node, &tcp_ehash[st->bucket].chain) {
 			if (sk->sk_family != st->family) {
 				continue;
@@ -2237,7 +2352,7 @@ static void *established_get_first(struct seq_file *seq)
 			rc = tw;
 			goto out;
 		}
-		read_unlock(&tcp_ehash[st->bucket].lock);
+		spin_unlock(&tcp_ehash[st->bucket].lock);
 		st->state = TCP_SEQ_STATE_ESTABLISHED;
 	}
 out:
@@ -2264,14 +2379,14 @@ get_tw:
 			cur = tw;
 			goto out;
 		}
-		read_unlock(&tcp_ehash[st->bucket].lock);
+		spin_unlock(&tcp_ehash[st->bucket].lock);
 		st->state = TCP_SEQ_STATE_ESTABLISHED;
 
 		/* We can reschedule between buckets: */
 		cond_resched_softirq();
 
 		if (++st->bucket < tcp_ehash_size) {
-			read_lock(&tcp_ehash[st->bucket].lock);
+			spin_lock(&tcp_ehash[st->bucket].lock);
 			sk = sk_head(&tcp_ehash[st->bucket].chain);
 		} else {
 			cur = NULL;
@@ -2381,7 +2496,7 @@ static void tcp_seq_stop(struct seq_file *seq, void *v)
 	case TCP_SEQ_STATE_TIME_WAIT:
 	case TCP_SEQ_STATE_ESTABLISHED:
 		if (v)
-			read_unlock(&tcp_ehash[st->bucket].lock);
+			spin_unlock(&tcp_ehash[st->bucket].lock);
 		local_bh_enable();
 		break;
 	}
@@ -2603,6 +2718,7 @@ struct proto tcp_prot = {
 	.sendmsg		= tcp_sendmsg,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= tcp_v4_hash,
 	.unhash			= tcp_unhash,
 	.get_port		= tcp_v4_get_port,
@@ -2634,6 +2750,7 @@ void __init tcp_v4_init(struct net_proto_family *ops)
 	tcp_socket->sk->sk_prot->unhash(tcp_socket->sk);
 }
 
+EXPORT_SYMBOL(__tcp_ehash_add);
 EXPORT_SYMBOL(ipv4_specific);
 EXPORT_SYMBOL(tcp_bind_hash);
 EXPORT_SYMBOL(tcp_bucket_create);
@@ -2641,6 +2758,7 @@ EXPORT_SYMBOL(tcp_hashinfo);
 EXPORT_SYMBOL(tcp_inherit_port);
 EXPORT_SYMBOL(tcp_listen_wlock);
 EXPORT_SYMBOL(tcp_port_rover);
+EXPORT_SYMBOL(tcp_reuseport_secret);
 EXPORT_SYMBOL(tcp_prot);
 EXPORT_SYMBOL(tcp_put_port);
 EXPORT_SYMBOL(tcp_unhash);
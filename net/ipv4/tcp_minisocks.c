@@ -66,14 +66,14 @@ static void tcp_timewait_kill(struct tcp_tw_bucket *tw)
 
 	/* Unlink from established hashes. */
 	ehead = &tcp_ehash[tw->tw_hashent];
-	write_lock(&ehead->lock);
+	spin_lock(&ehead->lock);
 	if (hlist_unhashed(&tw->tw_node)) {
-		write_unlock(&ehead->lock);
+		spin_unlock(&ehead->lock);
 		return;
 	}
 	__hlist_del(&tw->tw_node);
 	sk_node_init(&tw->tw_node);
-	write_unlock(&ehead->lock);
+	spin_unlock(&ehead->lock);
 
 	/* Disassociate with bind bucket. */
 	bhead = &tcp_bhash[tcp_bhashfn(tw->tw_num)];
@@ -90,7 +90,8 @@ static void tcp_timewait_kill(struct tcp_tw_bucket *tw)
 		       atomic_read(&tw->tw_refcnt));
 	}
 #endif
-	tcp_tw_put(tw);
+	/* Lockless lookups may still be looking at it. */
+	tcp_tw_put_rcu(tw);
 }
 
 /* 
@@ -310,17 +311,16 @@ static void __tcp_tw_hashdance(struct sock *sk, struct tcp_tw_bucket *tw)
 	tw_add_bind_node(tw, &tw->tw_tb->owners);
 	spin_unlock(&bhead->lock);
 
-	write_lock(&ehead->lock);
-
-	/* Step 2: Remove SK from established hash. */
-	if (__sk_del_node_init(sk))
-		sock_prot_dec_use(sk->sk_prot);
+	spin_lock(&ehead->lock);
 
-	/* Step 3: Hash TW into TIMEWAIT half of established hash table. */
-	tw_add_node(tw, &(ehead + tcp_ehash_size)->chain);
+	/* Step 2: Hash TW into TIMEWAIT half of established hash table. */
 	atomic_inc(&tw->tw_refcnt);
+	tw_add_node(tw, &(ehead + tcp_ehash_size)->chain);
+
+	/* Step 3: Remove SK from established hash. */
+	__tcp_ehash_del(sk);
 
-	write_unlock(&ehead->lock);
+	spin_unlock(&ehead->lock);
 }
 
 /* 
@@ -353,6 +353,7 @@ void tcp_time_wait(struct sock *sk, int state, int timeo)
 		tw->tw_dport		= inet->dport;
 		tw->tw_family		= sk->sk_family;
 		tw->tw_reuse		= sk->sk_reuse;
+		tw->tw_reuseport	= sk->sk_reuseport;
 		tw->tw_rcv_wscale	= tp->rx_opt.rcv_wscale;
 		atomic_set(&tw->tw_refcnt, 1);
 
@@ -700,6 +701,7 @@ struct sock *tcp_create_openreq_child(struct sock *sk, struct open_request *req,
 
 		/* SANITY */
 		sk_node_init(&newsk->sk_node);
+		newsk->sk_rcu.func = NULL;
 		tcp_sk(newsk)->bind_hash = NULL;
 
 		/* Clone the TCP header template */
@@ -739,6 +741,7 @@ struct sock *tcp_create_openreq_child(struct sock *sk, struct open_request *req,
 		/* Now setup tcp_sock */
 		newtp = tcp_sk(newsk);
 		newtp->pred_flags = 0;
+		newtp->write_queue_rb = RB_ROOT;
 		newtp->rcv_nxt = req->rcv_isn + 1;
 		newtp->snd_nxt = req->snt_isn + 1;
 		newtp->snd_una = req->snt_isn + 1;
@@ -843,7 +846,12 @@ struct sock *tcp_create_openreq_child(struct sock *sk, struct open_request *req,
 		if (newtp->ecn_flags&TCP_ECN_OK)
 			sock_set_flag(newsk, SOCK_NO_LARGESEND);
 
-		tcp_ca_init(newtp);
+		/* The child inherits the listener's congestion control
+		 * choice; it needs its own reference on the module.
+		 */
+		if (!try_module_get(newtp->ca_ops->owner))
+			newtp->ca_ops = &tcp_init_congestion_ops;
+		tcp_init_congestion_control(newtp);
 
 		TCP_INC_STATS_BH(TCP_MIB_PASSIVEOPENS);
 	}
@@ -41,6 +41,9 @@
 #include <linux/compiler.h>
 #include <linux/module.h>
 #include <linux/smp_lock.h>
+#include <linux/interrupt.h>
+#include <linux/percpu.h>
+#include <asm/div64.h>
 
 /* People can turn this off for buggy TCP's found in printers etc. */
 int sysctl_tcp_retrans_collapse = 1;
@@ -51,6 +54,14 @@ int sysctl_tcp_retrans_collapse = 1;
  */
 int sysctl_tcp_tso_win_divisor = 8;
 
+/* Bytes a socket may have sitting in qdisc and device queues before
+ * tcp_write_xmit() waits for some of them to be freed.
+ */
+int sysctl_tcp_limit_output_bytes = 131072;
+
+/* Space segments out at pacing_rate instead of sending cwnd in bursts. */
+int sysctl_tcp_pacing;
+
 static inline void update_send_head(struct sock *sk, struct tcp_sock *tp,
 				    struct sk_buff *skb)
 {
@@ -58,6 +69,7 @@ static inline void update_send_head(struct sock *sk, struct tcp_sock *tp,
 	if (sk->sk_send_head == (struct sk_buff *)&sk->sk_write_queue)
 		sk->sk_send_head = NULL;
 	tp->snd_nxt = TCP_SKB_CB(skb)->end_seq;
+	tcp_skb_set_pkt_idx(sk, skb);
 	tcp_packets_out_inc(sk, tp, skb);
 }
 
@@ -111,8 +123,7 @@ static void tcp_cwnd_restart(struct tcp_sock *tp, struct dst_entry *dst)
 	u32 restart_cwnd = tcp_init_cwnd(tp, dst);
 	u32 cwnd = tp->snd_cwnd;
 
-	if (tcp_is_vegas(tp)) 
-		tcp_vegas_enable(tp);
+	tcp_ca_event(tp, CA_EVENT_CWND_RESTART);
 
 	tp->snd_ssthresh = tcp_current_ssthresh(tp);
 	restart_cwnd = min(restart_cwnd, cwnd);
@@ -304,21 +315,17 @@ static int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb)
 					    (tp->rx_opt.eff_sacks * TCPOLEN_SACK_PERBLOCK));
 		}
 		
-		/*
-		 * If the connection is idle and we are restarting,
-		 * then we don't want to do any Vegas calculations
-		 * until we get fresh RTT samples.  So when we
-		 * restart, we reset our Vegas state to a clean
-		 * slate. After we get acks for this flight of
-		 * packets, _then_ we can make Vegas calculations
-		 * again.
+		/* Tell the congestion control handler when we start
+		 * sending again with nothing in flight, so that delay
+		 * based algorithms can discard their stale samples.
 		 */
-		if (tcp_is_vegas(tp) && tcp_packets_in_flight(tp) == 0)
-			tcp_vegas_enable(tp);
+		if (tcp_packets_in_flight(tp) == 0)
+			tcp_ca_event(tp, CA_EVENT_TX_START);
 
 		th = (struct tcphdr *) skb_push(skb, tcp_header_size);
 		skb->h.th = th;
 		skb_set_owner_w(skb, sk);
+		skb->destructor = tcp_wfree;
 
 		/* Build TCP header and checksum it. */
 		th->source		= inet->sport;
@@ -389,6 +396,44 @@ static int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb)
 }
 
 
+void tcp_write_queue_rb_insert(struct sock *sk, struct sk_buff *skb)
+{
+	struct rb_node **p = &tcp_sk(sk)->write_queue_rb.rb_node;
+	struct rb_node *parent = NULL;
+	u32 seq = TCP_SKB_CB(skb)->seq;
+
+	while (*p) {
+		struct sk_buff *cur;
+
+		parent = *p;
+		cur = rb_entry(parent, struct sk_buff, rbnode);
+		if (before(seq, TCP_SKB_CB(cur)->seq))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&skb->rbnode, parent, p);
+	rb_insert_color(&skb->rbnode, &tcp_sk(sk)->write_queue_rb);
+}
+
+/* The packet count of a sent skb has changed, renumber the skbs after
+ * it.  Stops as soon as the old numbering lines up again.
+ */
+static void tcp_renumber_rtx_queue(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *next;
+
+	while ((next = skb->next) != sk->sk_send_head &&
+	       next != (struct sk_buff *)&sk->sk_write_queue) {
+		u32 idx = TCP_SKB_CB(skb)->pkt_idx + tcp_skb_pcount(skb);
+
+		if (TCP_SKB_CB(next)->pkt_idx == idx)
+			break;
+		TCP_SKB_CB(next)->pkt_idx = idx;
+		skb = next;
+	}
+}
+
 /* This routine just queue's the buffer 
  *
  * NOTE: probe0 timer is not checked, do not forget tcp_push_pending_frames,
@@ -401,7 +446,7 @@ static void tcp_queue_skb(struct sock *sk, struct sk_buff *skb)
 	/* Advance write_seq and place onto the write_queue. */
 	tp->write_seq = TCP_SKB_CB(skb)->end_seq;
 	skb_header_release(skb);
-	__skb_queue_tail(&sk->sk_write_queue, skb);
+	tcp_add_write_queue_tail(sk, skb);
 	sk_charge_skb(sk, skb);
 
 	/* Queue it, remembering where we must start sending. */
@@ -422,19 +467,77 @@ static inline void tcp_tso_set_push(struct sk_buff *skb)
 /* Send _single_ skb sitting at the send head. This function requires
  * true push pending frames to setup probe timer etc.
  */
+/* TCP Small Queues: stop once the socket has enough bytes queued
+ * below it.  tcp_wfree() restarts the transmit when one of them is
+ * freed.  At higher rates about a millisecond worth is allowed, so the
+ * device does not run dry between completions.
+ */
+static inline int tcp_tsq_limited(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	unsigned int limit;
+
+	limit = max_t(unsigned int, 2 * skb->truesize, tp->pacing_rate >> 10);
+	limit = min_t(unsigned int, limit, sysctl_tcp_limit_output_bytes);
+
+	if (atomic_read(&sk->sk_wmem_alloc) <= limit)
+		return 0;
+
+	set_bit(TSQ_THROTTLED, &tp->tsq_flags);
+	/* The last completion may have come in before we set the flag. */
+	smp_mb__after_clear_bit();
+	return atomic_read(&sk->sk_wmem_alloc) > limit;
+}
+
+/* Returns 1 and arms the pacing timer if it is too early to send. */
+static int tcp_pacing_delay(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (!sysctl_tcp_pacing || tp->pacing_rate == ~0U)
+		return 0;
+	if (ktime_get().tv64 >= tp->pacing_next.tv64)
+		return 0;
+
+	hrtimer_start(&tp->pacing_timer, tp->pacing_next, HRTIMER_ABS);
+	return 1;
+}
+
+/* Advance the pacing clock by the transmit time of LEN bytes.  An idle
+ * socket does not bank credit for a later burst.
+ */
+static void tcp_pacing_sent(struct sock *sk, unsigned int len)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	s64 now, next;
+	u64 ns;
+
+	if (!sysctl_tcp_pacing || tp->pacing_rate == ~0U)
+		return;
+
+	now = ktime_get().tv64;
+	next = max(tp->pacing_next.tv64, now);
+	ns = (u64)len * NSEC_PER_SEC;
+	do_div(ns, tp->pacing_rate);
+	tp->pacing_next.tv64 = next + ns;
+}
+
 void tcp_push_one(struct sock *sk, unsigned cur_mss)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct sk_buff *skb = sk->sk_send_head;
 
-	if (tcp_snd_test(tp, skb, cur_mss, TCP_NAGLE_PUSH)) {
+	if (tcp_snd_test(tp, skb, cur_mss, TCP_NAGLE_PUSH) &&
+	    !tcp_tsq_limited(sk, skb) && !tcp_pacing_delay(sk)) {
 		/* Send it out now. */
 		TCP_SKB_CB(skb)->when = tcp_time_stamp;
 		tcp_tso_set_push(skb);
 		if (!tcp_transmit_skb(sk, skb_clone(skb, sk->sk_allocation))) {
 			sk->sk_send_head = NULL;
 			tp->snd_nxt = TCP_SKB_CB(skb)->end_seq;
+			tcp_skb_set_pkt_idx(sk, skb);
 			tcp_packets_out_inc(sk, tp, skb);
+			tcp_pacing_sent(sk, skb->len);
 			return;
 		}
 	}
@@ -540,6 +643,17 @@ static int tcp_fragment(struct sock *sk, struct sk_buff *skb, u32 len)
 
 	/* Link BUFF into the send queue. */
 	__skb_append(skb, buff);
+	tcp_write_queue_rb_insert(sk, buff);
+
+	/* Splitting a sent skb changes the retransmit queue numbering,
+	 * and the new tail part may not be SACK tagged yet.
+	 */
+	if (before(TCP_SKB_CB(skb)->seq, tp->snd_nxt)) {
+		TCP_SKB_CB(buff)->pkt_idx = TCP_SKB_CB(skb)->pkt_idx +
+					    tcp_skb_pcount(skb);
+		tcp_renumber_rtx_queue(sk, buff);
+		tcp_clear_sack_cache(tp);
+	}
 
 	return 0;
 }
@@ -598,10 +712,16 @@ int tcp_trim_head(struct sock *sk, struct sk_buff *skb, u32 len)
 	sock_set_flag(sk, SOCK_QUEUE_SHRUNK);
 
 	/* Any change of skb->len requires recalculation of tso
-	 * factor and mss.
+	 * factor and mss.  This is the head of the retransmit queue,
+	 * keep the packet index of its end where it was.
 	 */
-	if (tcp_skb_pcount(skb) > 1)
+	if (tcp_skb_pcount(skb) > 1) {
+		int old_factor = tcp_skb_pcount(skb);
+
 		tcp_set_skb_tso_segs(skb, tcp_skb_mss(skb));
+		TCP_SKB_CB(skb)->pkt_idx += old_factor - tcp_skb_pcount(skb);
+	}
+	tcp_clear_sack_cache(tcp_sk(sk));
 
 	return 0;
 }
@@ -735,6 +855,7 @@ int tcp_write_xmit(struct sock *sk, int nonagle)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	unsigned int mss_now;
+	int held = 0;
 
 	/* If we are closed, the bytes will have to remain here.
 	 * In time closedown will finish, we empty the write queue and all
@@ -755,6 +876,14 @@ int tcp_write_xmit(struct sock *sk, int nonagle)
 		       tcp_snd_test(tp, skb, mss_now,
 			       	    tcp_skb_is_last(sk, skb) ? nonagle :
 				    			       TCP_NAGLE_PUSH)) {
+			/* Will be restarted by tcp_wfree() or the pacing
+			 * timer, no need for a probe.
+			 */
+			if (tcp_tsq_limited(sk, skb) || tcp_pacing_delay(sk)) {
+				held = 1;
+				break;
+			}
+
 			if (skb->len > mss_now) {
 				if (tcp_fragment(sk, skb, mss_now))
 					break;
@@ -771,6 +900,7 @@ int tcp_write_xmit(struct sock *sk, int nonagle)
 			update_send_head(sk, tp, skb);
 
 			tcp_minshall_update(tp, mss_now, skb);
+			tcp_pacing_sent(sk, skb->len);
 			sent_pkts = 1;
 		}
 
@@ -779,11 +909,121 @@ int tcp_write_xmit(struct sock *sk, int nonagle)
 			return 0;
 		}
 
-		return !tp->packets_out && sk->sk_send_head;
+		return !held && !tp->packets_out && sk->sk_send_head;
 	}
 	return 0;
 }
 
+/* Sockets whose transmit was held back by tcp_tsq_limited() or
+ * tcp_pacing_delay() are queued here, from skb free or hrtimer
+ * context, and pushed again from a tasklet on the same CPU.
+ */
+struct tsq_tasklet {
+	struct tasklet_struct	tasklet;
+	struct list_head	head;
+};
+static DEFINE_PER_CPU(struct tsq_tasklet, tsq_tasklet);
+
+static void tcp_tsq_handler(struct sock *sk)
+{
+	if ((1 << sk->sk_state) &
+	    (TCPF_ESTABLISHED | TCPF_FIN_WAIT1 | TCPF_CLOSING |
+	     TCPF_CLOSE_WAIT | TCPF_LAST_ACK))
+		tcp_push_pending_frames(sk, tcp_sk(sk));
+}
+
+static void tcp_tasklet_func(unsigned long data)
+{
+	struct tsq_tasklet *tsq = (struct tsq_tasklet *)data;
+	LIST_HEAD(list);
+	unsigned long flags;
+	struct list_head *q, *n;
+
+	local_irq_save(flags);
+	list_splice_init(&tsq->head, &list);
+	local_irq_restore(flags);
+
+	list_for_each_safe(q, n, &list) {
+		struct tcp_sock *tp = list_entry(q, struct tcp_sock, tsq_node);
+		struct sock *sk = (struct sock *)tp;
+
+		list_del(&tp->tsq_node);
+		clear_bit(TSQ_QUEUED, &tp->tsq_flags);
+		smp_mb__after_clear_bit();
+
+		bh_lock_sock(sk);
+		if (!sock_owned_by_user(sk))
+			tcp_tsq_handler(sk);
+		else
+			/* Left to tcp_release_cb() */
+			set_bit(TSQ_OWNED, &tp->tsq_flags);
+		bh_unlock_sock(sk);
+
+		sock_put(sk);
+	}
+}
+
+static void tcp_tsq_queue(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct tsq_tasklet *tsq;
+	unsigned long flags;
+
+	if (test_and_set_bit(TSQ_QUEUED, &tp->tsq_flags))
+		return;
+
+	sock_hold(sk);
+	local_irq_save(flags);
+	tsq = &__get_cpu_var(tsq_tasklet);
+	list_add(&tp->tsq_node, &tsq->head);
+	tasklet_schedule(&tsq->tasklet);
+	local_irq_restore(flags);
+}
+
+/* Destructor of the skbs tcp_transmit_skb() hands down. */
+void tcp_wfree(struct sk_buff *skb)
+{
+	struct sock *sk = skb->sk;
+
+	if (test_and_clear_bit(TSQ_THROTTLED, &tcp_sk(sk)->tsq_flags))
+		tcp_tsq_queue(sk);
+	sock_wfree(skb);
+}
+
+/* Pacing timer.  It may run in hard interrupt context, so the push is
+ * left to the tasklet.  The timer is cancelled synchronously in
+ * tcp_clear_xmit_timers(), which is why it needs no socket reference.
+ */
+int tcp_pace_kick(struct hrtimer *timer)
+{
+	struct tcp_sock *tp = container_of(timer, struct tcp_sock, pacing_timer);
+
+	tcp_tsq_queue((struct sock *)tp);
+	return HRTIMER_NORESTART;
+}
+
+/* Called from release_sock() for work deferred by the tasklet. */
+void tcp_release_cb(struct sock *sk)
+{
+	if (test_and_clear_bit(TSQ_OWNED, &tcp_sk(sk)->tsq_flags))
+		tcp_tsq_handler(sk);
+}
+
+EXPORT_SYMBOL(tcp_release_cb);
+
+void __init tcp_tasklet_init(void)
+{
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		struct tsq_tasklet *tsq = &per_cpu(tsq_tasklet, i);
+
+		INIT_LIST_HEAD(&tsq->head);
+		tasklet_init(&tsq->tasklet, tcp_tasklet_func,
+			     (unsigned long)tsq);
+	}
+}
+
 /* This function returns the amount that we can raise the
  * usable window based on the following constraints
  *  
@@ -929,7 +1169,7 @@ static void tcp_retrans_try_collapse(struct sock *sk, struct sk_buff *skb, int m
 		       tcp_skb_pcount(next_skb) != 1);
 
 		/* Ok.  We will be able to collapse the packet. */
-		__skb_unlink(next_skb, next_skb->list);
+		tcp_unlink_write_queue(sk, next_skb);
 
 		memcpy(skb_put(skb, next_skb_size), next_skb->data, next_skb_size);
 
@@ -968,6 +1208,7 @@ static void tcp_retrans_try_collapse(struct sock *sk, struct sk_buff *skb, int m
 		tcp_dec_pcount_approx(&tp->fackets_out, next_skb);
 		tcp_packets_out_dec(tp, next_skb);
 		sk_stream_free_skb(sk, next_skb);
+		tcp_renumber_rtx_queue(sk, skb);
 	}
 }
 
@@ -1096,6 +1337,8 @@ int tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
 			skb_shinfo(skb)->tso_size = 0;
 			skb->ip_summed = CHECKSUM_NONE;
 			skb->csum = 0;
+			tcp_renumber_rtx_queue(sk, skb);
+			tcp_clear_sack_cache(tp);
 		}
 	}
 
@@ -1337,6 +1580,8 @@ int tcp_send_synack(struct sock *sk)
 			__skb_unlink(skb, &sk->sk_write_queue);
 			skb_header_release(nskb);
 			__skb_queue_head(&sk->sk_write_queue, nskb);
+			rb_replace_node(&skb->rbnode, &nskb->rbnode,
+					&tcp_sk(sk)->write_queue_rb);
 			sk_stream_free_skb(sk, skb);
 			sk_charge_skb(sk, nskb);
 			skb = nskb;
@@ -1445,7 +1690,6 @@ static inline void tcp_connect_init(struct sock *sk)
 		tp->window_clamp = dst_metric(dst, RTAX_WINDOW);
 	tp->advmss = dst_metric(dst, RTAX_ADVMSS);
 	tcp_initialize_rcv_mss(sk);
-	tcp_ca_init(tp);
 
 	tcp_select_initial_window(tcp_full_space(sk),
 				  tp->advmss - (tp->rx_opt.ts_recent_stamp ? tp->tcp_header_len - sizeof(struct tcphdr) : 0),
@@ -1499,14 +1743,15 @@ int tcp_connect(struct sock *sk)
 	TCP_SKB_CB(buff)->end_seq = tp->write_seq;
 	tp->snd_nxt = tp->write_seq;
 	tp->pushed_seq = tp->write_seq;
-	tcp_ca_init(tp);
+	tcp_init_congestion_control(tp);
 
 	/* Send it off. */
 	TCP_SKB_CB(buff)->when = tcp_time_stamp;
 	tp->retrans_stamp = TCP_SKB_CB(buff)->when;
 	skb_header_release(buff);
-	__skb_queue_tail(&sk->sk_write_queue, buff);
+	tcp_add_write_queue_tail(sk, buff);
 	sk_charge_skb(sk, buff);
+	TCP_SKB_CB(buff)->pkt_idx = 0;
 	tp->packets_out += tcp_skb_pcount(buff);
 	tcp_transmit_skb(sk, skb_clone(buff, GFP_KERNEL));
 	TCP_INC_STATS(TCP_MIB_ACTIVEOPENS);
@@ -64,6 +64,13 @@ void tcp_init_xmit_timers(struct sock *sk)
 	init_timer(&sk->sk_timer);
 	sk->sk_timer.function	= &tcp_keepalive_timer;
 	sk->sk_timer.data	= (unsigned long)sk;
+
+	tp->tsq_flags = 0;
+	INIT_LIST_HEAD(&tp->tsq_node);
+	tp->pacing_rate = ~0U;
+	tp->pacing_next = ktime_set(0, 0);
+	hrtimer_init(&tp->pacing_timer, CLOCK_MONOTONIC, HRTIMER_ABS);
+	tp->pacing_timer.function = tcp_pace_kick;
 }
 
 void tcp_clear_xmit_timers(struct sock *sk)
@@ -78,6 +85,8 @@ void tcp_clear_xmit_timers(struct sock *sk)
 	sk_stop_timer(sk, &tp->delack_timer);
 
 	sk_stop_timer(sk, &sk->sk_timer);
+
+	hrtimer_cancel(&tp->pacing_timer);
 }
 
 static void tcp_write_err(struct sock *sk)
@@ -116,7 +125,7 @@ static int tcp_out_of_resources(struct sock *sk, int do_reset)
 
 	if (orphans >= sysctl_tcp_max_orphans ||
 	    (sk->sk_wmem_queued > SOCK_MIN_SNDBUF &&
-	     atomic_read(&tcp_memory_allocated) > sysctl_tcp_mem[2])) {
+	     percpu_counter_read(&tcp_memory_allocated) > sysctl_tcp_mem[2])) {
 		if (net_ratelimit())
 			printk(KERN_INFO "Out of socket memory\n");
 
@@ -107,6 +107,8 @@
 #include <net/inet_common.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <linux/bootmem.h>
+#include <linux/init.h>
 
 /*
  *	Snmp MIB for the UDP layer
@@ -114,91 +116,123 @@
 
 DEFINE_SNMP_STAT(struct udp_mib, udp_statistics);
 
-struct hlist_head udp_hash[UDP_HTABLE_SIZE];
-DEFINE_RWLOCK(udp_hash_lock);
+struct udp_table udp_table;
 
 /* Shared by v4/v6 udp. */
 int udp_port_rover;
 
-static int udp_v4_get_port(struct sock *sk, unsigned short snum)
+/*
+ * The tables hold a reference on each socket in them, which is dropped a
+ * grace period after it is unhashed, so that a lookup can always take
+ * its own reference on what it finds.
+ */
+static void udp_hash_put(struct rcu_head *head)
+{
+	struct sock *sk = container_of(head, struct sock, sk_rcu);
+
+	head->func = NULL;
+	sock_put(sk);
+}
+
+/* Called with the slot lock held. */
+static int udp_lib_lport_inuse(struct udp_hslot *hslot, unsigned short num,
+			       struct sock *sk,
+			       int (*saddr_cmp)(const struct sock *sk1,
+						const struct sock *sk2))
 {
-	struct hlist_node *node;
 	struct sock *sk2;
+	struct hlist_node *node;
+
+	sk_for_each(sk2, node, &hslot->head) {
+		if (inet_sk(sk2)->num != num)
+			continue;
+		if (!sk)
+			return 1;
+		if (sk2 != sk &&
+		    (!sk2->sk_bound_dev_if ||
+		     !sk->sk_bound_dev_if ||
+		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
+		    (!sk2->sk_reuse || !sk->sk_reuse) &&
+		    saddr_cmp(sk, sk2))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Bind sk to port snum, or to a free port of the local port range when
+ * snum is 0.  saddr_cmp tells whether two sockets of the port have
+ * conflicting bound addresses.  Returns 0 on success.
+ */
+int udp_lib_get_port(struct sock *sk, unsigned short snum,
+		     int (*saddr_cmp)(const struct sock *sk1,
+				      const struct sock *sk2))
+{
 	struct inet_sock *inet = inet_sk(sk);
+	struct udp_hslot *hslot, *hslot2;
+
+	/* The reference held for a previous stay must be gone first. */
+	while (sk->sk_rcu.func)
+		synchronize_kernel();
 
-	write_lock_bh(&udp_hash_lock);
 	if (snum == 0) {
-		int best_size_so_far, best, result, i;
-
-		if (udp_port_rover > sysctl_local_port_range[1] ||
-		    udp_port_rover < sysctl_local_port_range[0])
-			udp_port_rover = sysctl_local_port_range[0];
-		best_size_so_far = 32767;
-		best = result = udp_port_rover;
-		for (i = 0; i < UDP_HTABLE_SIZE; i++, result++) {
-			struct hlist_head *list;
-			int size;
-
-			list = &udp_hash[result & (UDP_HTABLE_SIZE - 1)];
-			if (hlist_empty(list)) {
-				if (result > sysctl_local_port_range[1])
-					result = sysctl_local_port_range[0] +
-						((result - sysctl_local_port_range[0]) &
-						 (UDP_HTABLE_SIZE - 1));
-				goto gotit;
-			}
-			size = 0;
-			sk_for_each(sk2, node, list)
-				if (++size >= best_size_so_far)
-					goto next;
-			best_size_so_far = size;
-			best = result;
-		next:;
-		}
-		result = best;
-		for(i = 0; i < (1 << 16) / UDP_HTABLE_SIZE; i++, result += UDP_HTABLE_SIZE) {
-			if (result > sysctl_local_port_range[1])
-				result = sysctl_local_port_range[0]
-					+ ((result - sysctl_local_port_range[0]) &
-					   (UDP_HTABLE_SIZE - 1));
-			if (!udp_lport_inuse(result))
+		int low = sysctl_local_port_range[0];
+		int high = sysctl_local_port_range[1];
+		int remaining = high - low + 1;
+		int rover = udp_port_rover;
+
+		for (; remaining > 0; remaining--) {
+			if (++rover < low || rover > high)
+				rover = low;
+			hslot = udp_hashslot(rover);
+			spin_lock_bh(&hslot->lock);
+			if (!udp_lib_lport_inuse(hslot, rover, NULL, NULL))
 				break;
+			spin_unlock_bh(&hslot->lock);
 		}
-		if (i >= (1 << 16) / UDP_HTABLE_SIZE)
-			goto fail;
-gotit:
-		udp_port_rover = snum = result;
+		if (remaining <= 0)
+			return 1;
+		udp_port_rover = snum = rover;
 	} else {
-		sk_for_each(sk2, node,
-			    &udp_hash[snum & (UDP_HTABLE_SIZE - 1)]) {
-			struct inet_sock *inet2 = inet_sk(sk2);
-
-			if (inet2->num == snum &&
-			    sk2 != sk &&
-			    !ipv6_only_sock(sk2) &&
-			    (!sk2->sk_bound_dev_if ||
-			     !sk->sk_bound_dev_if ||
-			     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
-			    (!inet2->rcv_saddr ||
-			     !inet->rcv_saddr ||
-			     inet2->rcv_saddr == inet->rcv_saddr) &&
-			    (!sk2->sk_reuse || !sk->sk_reuse))
-				goto fail;
+		hslot = udp_hashslot(snum);
+		spin_lock_bh(&hslot->lock);
+		if (udp_lib_lport_inuse(hslot, snum, sk, saddr_cmp)) {
+			spin_unlock_bh(&hslot->lock);
+			return 1;
 		}
 	}
+
 	inet->num = snum;
 	if (sk_unhashed(sk)) {
-		struct hlist_head *h = &udp_hash[snum & (UDP_HTABLE_SIZE - 1)];
+		sock_hold(sk);
+		__sk_add_node_rcu(sk, &hslot->head);
+		hslot->count++;
+
+		sk->sk_hashent = udp_hash2fn(inet->rcv_saddr, snum);
+		hslot2 = &udp_table.hash2[sk->sk_hashent];
+		spin_lock(&hslot2->lock);
+		__sk_add_bind_node_rcu(sk, &hslot2->head);
+		hslot2->count++;
+		spin_unlock(&hslot2->lock);
 
-		sk_add_node(sk, h);
 		sock_prot_inc_use(sk->sk_prot);
 	}
-	write_unlock_bh(&udp_hash_lock);
+	spin_unlock_bh(&hslot->lock);
 	return 0;
+}
 
-fail:
-	write_unlock_bh(&udp_hash_lock);
-	return 1;
+static int ipv4_rcv_saddr_equal(const struct sock *sk1, const struct sock *sk2)
+{
+	struct inet_sock *inet1 = inet_sk(sk1), *inet2 = inet_sk(sk2);
+
+	return !ipv6_only_sock(sk2) &&
+	       (!inet1->rcv_saddr || !inet2->rcv_saddr ||
+		inet1->rcv_saddr == inet2->rcv_saddr);
+}
+
+static int udp_v4_get_port(struct sock *sk, unsigned short snum)
+{
+	return udp_lib_get_port(sk, snum, ipv4_rcv_saddr_equal);
 }
 
 static void udp_v4_hash(struct sock *sk)
@@ -206,75 +240,216 @@ static void udp_v4_hash(struct sock *sk)
 	BUG();
 }
 
-static void udp_v4_unhash(struct sock *sk)
+void udp_lib_unhash(struct sock *sk)
 {
-	write_lock_bh(&udp_hash_lock);
-	if (sk_del_node_init(sk)) {
+	struct udp_hslot *hslot, *hslot2;
+
+	if (sk_unhashed(sk))
+		return;
+
+	hslot = udp_hashslot(inet_sk(sk)->num);
+	spin_lock_bh(&hslot->lock);
+	if (!sk_unhashed(sk)) {
+		write_seqcount_begin(&hslot->seq);
+		__sk_del_node_init(sk);
+		write_seqcount_end(&hslot->seq);
+		hslot->count--;
+
+		hslot2 = &udp_table.hash2[sk->sk_hashent];
+		spin_lock(&hslot2->lock);
+		write_seqcount_begin(&hslot2->seq);
+		hlist_del_init(&sk->sk_bind_node);
+		write_seqcount_end(&hslot2->seq);
+		hslot2->count--;
+		spin_unlock(&hslot2->lock);
+
 		inet_sk(sk)->num = 0;
 		sock_prot_dec_use(sk->sk_prot);
+		call_rcu(&sk->sk_rcu, udp_hash_put);
 	}
-	write_unlock_bh(&udp_hash_lock);
+	spin_unlock_bh(&hslot->lock);
 }
 
-/* UDP is nearly always wildcards out the wazoo, it makes no sense to try
- * harder than this. -DaveM
+/*
+ * Move a hashed socket to the hash2 slot of its new bound address.  A
+ * lookup in hash2 does not see it while it moves.
  */
-static struct sock *udp_v4_lookup_longway(u32 saddr, u16 sport,
-					  u32 daddr, u16 dport, int dif)
+void udp_lib_rehash(struct sock *sk)
 {
-	struct sock *sk, *result = NULL;
-	struct hlist_node *node;
-	unsigned short hnum = ntohs(dport);
-	int badness = -1;
+	struct udp_hslot *hslot, *ohslot2, *nhslot2;
+	unsigned int hash2;
 
-	sk_for_each(sk, node, &udp_hash[hnum & (UDP_HTABLE_SIZE - 1)]) {
-		struct inet_sock *inet = inet_sk(sk);
+	if (sk_unhashed(sk))
+		return;
 
-		if (inet->num == hnum && !ipv6_only_sock(sk)) {
-			int score = (sk->sk_family == PF_INET ? 1 : 0);
-			if (inet->rcv_saddr) {
-				if (inet->rcv_saddr != daddr)
-					continue;
-				score+=2;
-			}
-			if (inet->daddr) {
-				if (inet->daddr != saddr)
-					continue;
-				score+=2;
-			}
-			if (inet->dport) {
-				if (inet->dport != sport)
-					continue;
-				score+=2;
-			}
-			if (sk->sk_bound_dev_if) {
-				if (sk->sk_bound_dev_if != dif)
-					continue;
-				score+=2;
-			}
-			if(score == 9) {
-				result = sk;
+	hslot = udp_hashslot(inet_sk(sk)->num);
+	spin_lock_bh(&hslot->lock);
+	hash2 = udp_hash2fn(inet_sk(sk)->rcv_saddr, inet_sk(sk)->num);
+	if (!sk_unhashed(sk) && hash2 != sk->sk_hashent) {
+		ohslot2 = &udp_table.hash2[sk->sk_hashent];
+		nhslot2 = &udp_table.hash2[hash2];
+
+		spin_lock(&ohslot2->lock);
+		write_seqcount_begin(&ohslot2->seq);
+		hlist_del_init(&sk->sk_bind_node);
+		write_seqcount_end(&ohslot2->seq);
+		ohslot2->count--;
+		spin_unlock(&ohslot2->lock);
+
+		spin_lock(&nhslot2->lock);
+		__sk_add_bind_node_rcu(sk, &nhslot2->head);
+		nhslot2->count++;
+		spin_unlock(&nhslot2->lock);
+
+		sk->sk_hashent = hash2;
+	}
+	spin_unlock_bh(&hslot->lock);
+}
+
+/*
+ * How well sk matches a datagram, or -1 if it does not.  UDP is nearly
+ * always wildcards out the wazoo, it makes no sense to try harder than
+ * this. -DaveM
+ */
+static inline int udp_v4_score(struct sock *sk, u32 saddr, u16 sport,
+			       u32 daddr, unsigned short hnum, int dif)
+{
+	struct inet_sock *inet = inet_sk(sk);
+	int score;
+
+	if (inet->num != hnum || ipv6_only_sock(sk))
+		return -1;
+
+	score = (sk->sk_family == PF_INET ? 1 : 0);
+	if (inet->rcv_saddr) {
+		if (inet->rcv_saddr != daddr)
+			return -1;
+		score += 2;
+	}
+	if (inet->daddr) {
+		if (inet->daddr != saddr)
+			return -1;
+		score += 2;
+	}
+	if (inet->dport) {
+		if (inet->dport != sport)
+			return -1;
+		score += 2;
+	}
+	if (sk->sk_bound_dev_if) {
+		if (sk->sk_bound_dev_if != dif)
+			return -1;
+		score += 2;
+	}
+	return score;
+}
+
+#define UDP_V4_BEST_SCORE	9
+
+/* Walk a slot of hash, under rcu_read_lock(). */
+static struct sock *udp_v4_lookup_port(struct udp_hslot *hslot,
+				       u32 saddr, u16 sport, u32 daddr,
+				       unsigned short hnum, int dif,
+				       int *badness)
+{
+	struct sock *sk, *result;
+	struct hlist_node *node;
+	unsigned int seq;
+	int score, best;
+
+begin:
+	seq = read_seqcount_begin(&hslot->seq);
+	result = NULL;
+	best = *badness;
+	sk_for_each_rcu(sk, node, &hslot->head) {
+		score = udp_v4_score(sk, saddr, sport, daddr, hnum, dif);
+		if (score > best) {
+			result = sk;
+			best = score;
+			if (score == UDP_V4_BEST_SCORE)
 				break;
-			} else if(score > badness) {
-				result = sk;
-				badness = score;
-			}
 		}
 	}
+	if (read_seqcount_retry(&hslot->seq, seq))
+		goto begin;
+	*badness = best;
 	return result;
 }
 
-static __inline__ struct sock *udp_v4_lookup(u32 saddr, u16 sport,
-					     u32 daddr, u16 dport, int dif)
+/* Walk a slot of hash2, under rcu_read_lock(). */
+static struct sock *udp_v4_lookup_addr(struct udp_hslot *hslot2,
+				       u32 saddr, u16 sport, u32 daddr,
+				       unsigned short hnum, int dif,
+				       int *badness)
 {
-	struct sock *sk;
+	struct sock *sk, *result;
+	struct hlist_node *node;
+	unsigned int seq;
+	int score, best;
+
+begin:
+	seq = read_seqcount_begin(&hslot2->seq);
+	result = NULL;
+	best = *badness;
+	sk_for_each_bound_rcu(sk, node, &hslot2->head) {
+		score = udp_v4_score(sk, saddr, sport, daddr, hnum, dif);
+		if (score > best) {
+			result = sk;
+			best = score;
+			if (score == UDP_V4_BEST_SCORE)
+				break;
+		}
+	}
+	if (read_seqcount_retry(&hslot2->seq, seq))
+		goto begin;
+	*badness = best;
+	return result;
+}
 
-	read_lock(&udp_hash_lock);
-	sk = udp_v4_lookup_longway(saddr, sport, daddr, dport, dif);
-	if (sk)
-		sock_hold(sk);
-	read_unlock(&udp_hash_lock);
-	return sk;
+/*
+ * A port with few sockets is searched in hash; one with many, as a
+ * server with a socket per local address or per peer has, in the two
+ * hash2 slots for the destination address and for INADDR_ANY.
+ */
+#define UDP_LOOKUP_BY_ADDR	10
+
+static struct sock *udp_v4_lookup(u32 saddr, u16 sport,
+				  u32 daddr, u16 dport, int dif)
+{
+	unsigned short hnum = ntohs(dport);
+	struct udp_hslot *hslot = udp_hashslot(hnum);
+	struct sock *sk, *result;
+	int badness;
+
+	rcu_read_lock();
+begin:
+	badness = -1;
+	if (hslot->count > UDP_LOOKUP_BY_ADDR) {
+		result = udp_v4_lookup_addr(
+				&udp_table.hash2[udp_hash2fn(daddr, hnum)],
+				saddr, sport, daddr, hnum, dif, &badness);
+		if (badness < UDP_V4_BEST_SCORE) {
+			sk = udp_v4_lookup_addr(
+				&udp_table.hash2[udp_hash2fn(INADDR_ANY, hnum)],
+				saddr, sport, daddr, hnum, dif, &badness);
+			if (sk)
+				result = sk;
+		}
+	} else
+		result = udp_v4_lookup_port(hslot, saddr, sport, daddr, hnum,
+					    dif, &badness);
+
+	if (result) {
+		sock_hold(result);
+		/* Recheck now that it cannot go away under us. */
+		if (unlikely(udp_v4_score(result, saddr, sport, daddr, hnum,
+					  dif) < badness)) {
+			sock_put(result);
+			goto begin;
+		}
+	}
+	rcu_read_unlock();
+	return result;
 }
 
 static inline struct sock *udp_v4_mcast_next(struct sock *sk,
@@ -883,7 +1058,8 @@ int udp_disconnect(struct sock *sk, int flags)
 	if (!(sk->sk_userlocks & SOCK_BINDPORT_LOCK)) {
 		sk->sk_prot->unhash(sk);
 		inet->sport = 0;
-	}
+	} else if (sk->sk_prot->rehash)
+		sk->sk_prot->rehash(sk);
 	sk_dst_reset(sk);
 	return 0;
 }
@@ -1047,17 +1223,18 @@ static int udp_queue_rcv_skb(struct sock * sk, struct sk_buff *skb)
 /*
  *	Multicasts and broadcasts go to each listener.
  *
- *	Note: called only from the BH handler context,
- *	so we don't need to lock the hashes.
+ *	Note: called only from the BH handler context, so the slot
+ *	lock is taken without disabling BHs.
  */
 static int udp_v4_mcast_deliver(struct sk_buff *skb, struct udphdr *uh,
 				 u32 saddr, u32 daddr)
 {
+	struct udp_hslot *hslot = udp_hashslot(ntohs(uh->dest));
 	struct sock *sk;
 	int dif;
 
-	read_lock(&udp_hash_lock);
-	sk = sk_head(&udp_hash[ntohs(uh->dest) & (UDP_HTABLE_SIZE - 1)]);
+	spin_lock(&hslot->lock);
+	sk = sk_head(&hslot->head);
 	dif = skb->dev->ifindex;
 	sk = udp_v4_mcast_next(sk, uh->dest, daddr, uh->source, saddr, dif);
 	if (sk) {
@@ -1082,7 +1259,7 @@ static int udp_v4_mcast_deliver(struct sk_buff *skb, struct udphdr *uh,
 		} while(sknext);
 	} else
 		kfree_skb(skb);
-	read_unlock(&udp_hash_lock);
+	spin_unlock(&hslot->lock);
 	return 0;
 }
 
@@ -1369,25 +1546,82 @@ struct proto udp_prot = {
 	.sendpage =	udp_sendpage,
 	.backlog_rcv =	udp_queue_rcv_skb,
 	.hash =		udp_v4_hash,
-	.unhash =	udp_v4_unhash,
+	.unhash =	udp_lib_unhash,
 	.get_port =	udp_v4_get_port,
+	.rehash =	udp_lib_rehash,
 	.slab_obj_size = sizeof(struct udp_sock),
 };
 
+static __initdata unsigned long uhash_entries;
+static int __init set_uhash_entries(char *str)
+{
+	if (!str)
+		return 0;
+	uhash_entries = simple_strtoul(str, &str, 0);
+	return 1;
+}
+__setup("uhash_entries=", set_uhash_entries);
+
+/*
+ * One slot of each table per 2MB of low memory, somewhere between
+ * UDP_HTABLE_SIZE_MIN and one per port.  hash2 follows hash in the same
+ * allocation.
+ */
+void __init udp_table_init(void)
+{
+	unsigned long entries = uhash_entries;
+	unsigned int i;
+
+	if (!entries)
+		entries = nr_kernel_pages >> (21 - PAGE_SHIFT);
+	if (entries < UDP_HTABLE_SIZE_MIN)
+		entries = UDP_HTABLE_SIZE_MIN;
+
+	udp_table.hash = (struct udp_hslot *)
+		alloc_large_system_hash("UDP",
+					2 * sizeof(struct udp_hslot),
+					entries,
+					21,
+					0,
+					&udp_table.log,
+					&udp_table.mask,
+					64 * 1024);
+	udp_table.hash2 = udp_table.hash + udp_table.mask + 1;
+	for (i = 0; i < 2 * (udp_table.mask + 1); i++) {
+		INIT_HLIST_HEAD(&udp_table.hash[i].head);
+		udp_table.hash[i].count = 0;
+		seqcount_init(&udp_table.hash[i].seq);
+		spin_lock_init(&udp_table.hash[i].lock);
+	}
+}
+
 /* ------------------------------------------------------------------------ */
 #ifdef CONFIG_PROC_FS
 
-static struct sock *udp_get_first(struct seq_file *seq)
+/*
+ * The slot of the socket returned is left locked, until the walk moves
+ * on to the next slot or stops: state->bucket is past the table when no
+ * slot is locked.
+ */
+static struct sock *udp_get_first(struct seq_file *seq, int start)
 {
 	struct sock *sk;
 	struct udp_iter_state *state = seq->private;
 
-	for (state->bucket = 0; state->bucket < UDP_HTABLE_SIZE; ++state->bucket) {
+	for (state->bucket = start; state->bucket <= udp_table.mask;
+	     ++state->bucket) {
+		struct udp_hslot *hslot = &udp_table.hash[state->bucket];
 		struct hlist_node *node;
-		sk_for_each(sk, node, &udp_hash[state->bucket]) {
+
+		if (hlist_empty(&hslot->head))
+			continue;
+
+		spin_lock_bh(&hslot->lock);
+		sk_for_each(sk, node, &hslot->head) {
 			if (sk->sk_family == state->family)
 				goto found;
 		}
+		spin_unlock_bh(&hslot->lock);
 	}
 	sk = NULL;
 found:
@@ -1400,20 +1634,18 @@ static struct sock *udp_get_next(struct seq_file *seq, struct sock *sk)
 
 	do {
 		sk = sk_next(sk);
-try_again:
-		;
 	} while (sk && sk->sk_family != state->family);
 
-	if (!sk && ++state->bucket < UDP_HTABLE_SIZE) {
-		sk = sk_head(&udp_hash[state->bucket]);
-		goto try_again;
+	if (!sk) {
+		spin_unlock_bh(&udp_table.hash[state->bucket].lock);
+		return udp_get_first(seq, state->bucket + 1);
 	}
 	return sk;
 }
 
 static struct sock *udp_get_idx(struct seq_file *seq, loff_t pos)
 {
-	struct sock *sk = udp_get_first(seq);
+	struct sock *sk = udp_get_first(seq, 0);
 
 	if (sk)
 		while(pos && (sk = udp_get_next(seq, sk)) != NULL)
@@ -1423,7 +1655,9 @@ static struct sock *udp_get_idx(struct seq_file *seq, loff_t pos)
 
 static void *udp_seq_start(struct seq_file *seq, loff_t *pos)
 {
-	read_lock(&udp_hash_lock);
+	struct udp_iter_state *state = seq->private;
+
+	state->bucket = udp_table.mask + 1;
 	return *pos ? udp_get_idx(seq, *pos-1) : (void *)1;
 }
 
@@ -1442,7 +1676,10 @@ static void *udp_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 
 static void udp_seq_stop(struct seq_file *seq, void *v)
 {
-	read_unlock(&udp_hash_lock);
+	struct udp_iter_state *state = seq->private;
+
+	if (state->bucket <= udp_table.mask)
+		spin_unlock_bh(&udp_table.hash[state->bucket].lock);
 }
 
 static int udp_seq_open(struct inode *inode, struct file *file)
@@ -1561,10 +1798,12 @@ void udp4_proc_exit(void)
 #endif /* CONFIG_PROC_FS */
 
 EXPORT_SYMBOL(udp_disconnect);
-EXPORT_SYMBOL(udp_hash);
-EXPORT_SYMBOL(udp_hash_lock);
 EXPORT_SYMBOL(udp_ioctl);
+EXPORT_SYMBOL(udp_lib_get_port);
+EXPORT_SYMBOL(udp_lib_rehash);
+EXPORT_SYMBOL(udp_lib_unhash);
 EXPORT_SYMBOL(udp_port_rover);
+EXPORT_SYMBOL(udp_table);
 EXPORT_SYMBOL(udp_prot);
 EXPORT_SYMBOL(udp_sendmsg);
 EXPORT_SYMBOL(udp_poll);
@@ -0,0 +1,200 @@
+/*
+ * udp_diag.c	Module for monitoring UDP and raw sockets, the
+ *		UDPDIAG_GETSOCK and RAWDIAG_GETSOCK handlers of sock_diag.
+ *
+ *		The request and reply are those of tcp_diag, with the same
+ *		bytecode filter, so that a dump costs a hash table walk and
+ *		the sockets asked for rather than formatting all of them as
+ *		/proc/net/udp does.  The hash locks are held for one chain
+ *		at a time.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/init.h>
+
+#include <net/sock.h>
+#include <net/udp.h>
+#include <net/protocol.h>
+#include <net/raw.h>
+#include <linux/rtnetlink.h>
+
+#include <linux/tcp_diag.h>
+#include <linux/sock_diag.h>
+
+static int dgramdiag_fill(struct sk_buff *skb, struct sock *sk,
+			  struct netlink_callback *cb)
+{
+	struct tcpdiagreq *req = NLMSG_DATA(cb->nlh);
+	struct tcpdiagmsg *r;
+	struct nlmsghdr  *nlh;
+	struct tcpdiag_meminfo  *minfo = NULL;
+	unsigned char	 *b = skb->tail;
+
+	nlh = NLMSG_PUT(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+			cb->nlh->nlmsg_type, sizeof(*r));
+	nlh->nlmsg_flags = NLM_F_MULTI;
+	r = NLMSG_DATA(nlh);
+	if (req->tcpdiag_ext & (1<<(TCPDIAG_MEMINFO-1)))
+		minfo = TCPDIAG_PUT(skb, TCPDIAG_MEMINFO, sizeof(*minfo));
+
+	inet_diag_fill_id(r, sk);
+	r->tcpdiag_state = sk->sk_state;
+	r->tcpdiag_timer = 0;
+	r->tcpdiag_retrans = 0;
+	r->tcpdiag_expires = 0;
+	r->tcpdiag_rqueue = atomic_read(&sk->sk_rmem_alloc);
+	r->tcpdiag_wqueue = atomic_read(&sk->sk_wmem_alloc);
+	r->tcpdiag_uid = sock_i_uid(sk);
+	r->tcpdiag_inode = sock_i_ino(sk);
+
+	if (minfo) {
+		minfo->tcpdiag_rmem = atomic_read(&sk->sk_rmem_alloc);
+		minfo->tcpdiag_wmem = sk->sk_wmem_queued;
+		minfo->tcpdiag_fmem = sk->sk_forward_alloc;
+		minfo->tcpdiag_tmem = atomic_read(&sk->sk_wmem_alloc);
+	}
+
+	nlh->nlmsg_len = skb->tail - b;
+	return skb->len;
+
+nlmsg_failure:
+	skb_trim(skb, b - skb->data);
+	return -1;
+}
+
+/*
+ * Dump the sockets of a hash chain wanted by the request, from socket
+ * s_num of it on.  Returns the number of sockets gone through, or -1
+ * when the skb is full, with *num where to start again.
+ */
+static int dgramdiag_dump_chain(struct sk_buff *skb,
+				struct netlink_callback *cb,
+				struct hlist_head *head, int s_num, int *num)
+{
+	struct tcpdiagreq *r = NLMSG_DATA(cb->nlh);
+	struct sock *sk;
+	struct hlist_node *node;
+
+	*num = 0;
+	sk_for_each(sk, node, head) {
+		struct inet_sock *inet = inet_sk(sk);
+
+		if (*num < s_num)
+			goto next;
+		if (!(r->tcpdiag_states & (1 << sk->sk_state)))
+			goto next;
+		if (r->id.tcpdiag_sport != inet->sport &&
+		    r->id.tcpdiag_sport)
+			goto next;
+		if (r->id.tcpdiag_dport != inet->dport &&
+		    r->id.tcpdiag_dport)
+			goto next;
+		if (!inet_diag_bc_sk(cb->nlh, sk))
+			goto next;
+		if (dgramdiag_fill(skb, sk, cb) < 0)
+			return -1;
+next:
+		++*num;
+	}
+	return *num;
+}
+
+/* The slot lock is held for one slot at a time. */
+static int udpdiag_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	int i, num, s_i, s_num, err;
+
+	s_i = cb->args[0];
+	s_num = num = cb->args[1];
+
+	for (i = s_i; i <= udp_table.mask; i++) {
+		struct udp_hslot *hslot = &udp_table.hash[i];
+
+		if (i > s_i)
+			s_num = 0;
+		num = 0;
+		if (hlist_empty(&hslot->head))
+			continue;
+
+		spin_lock_bh(&hslot->lock);
+		err = dgramdiag_dump_chain(skb, cb, &hslot->head, s_num, &num);
+		spin_unlock_bh(&hslot->lock);
+		if (err < 0)
+			break;
+	}
+
+	cb->args[0] = i;
+	cb->args[1] = num;
+	return skb->len;
+}
+
+/* IPv4 only: raw IPv6 sockets live in the ipv6 module's own table */
+static int rawdiag_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	int i, num, s_i, s_num, err;
+
+	s_i = cb->args[0];
+	s_num = num = cb->args[1];
+
+	for (i = s_i; i < RAWV4_HTABLE_SIZE; i++) {
+		if (i > s_i)
+			s_num = 0;
+
+		read_lock(&raw_v4_lock);
+		err = dgramdiag_dump_chain(skb, cb, &raw_v4_htable[i], s_num,
+					   &num);
+		read_unlock(&raw_v4_lock);
+		if (err < 0)
+			break;
+	}
+
+	cb->args[0] = i;
+	cb->args[1] = num;
+	return skb->len;
+}
+
+static struct sock_diag_handler udpdiag_handler = {
+	.type		= UDPDIAG_GETSOCK,
+	.req_size	= sizeof(struct tcpdiagreq),
+	.audit		= inet_diag_audit_req,
+	.dump		= udpdiag_dump,
+};
+
+static struct sock_diag_handler rawdiag_handler = {
+	.type		= RAWDIAG_GETSOCK,
+	.req_size	= sizeof(struct tcpdiagreq),
+	.audit		= inet_diag_audit_req,
+	.dump		= rawdiag_dump,
+};
+
+static int __init udpdiag_init(void)
+{
+	int err;
+
+	err = sock_diag_register(&udpdiag_handler);
+	if (err)
+		return err;
+	err = sock_diag_register(&rawdiag_handler);
+	if (err)
+		sock_diag_unregister(&udpdiag_handler);
+	return err;
+}
+
+static void __exit udpdiag_exit(void)
+{
+	sock_diag_unregister(&rawdiag_handler);
+	sock_diag_unregister(&udpdiag_handler);
+}
+
+module_init(udpdiag_init);
+module_exit(udpdiag_exit);
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_SOCK_DIAG(UDPDIAG_GETSOCK);
+MODULE_ALIAS_SOCK_DIAG(RAWDIAG_GETSOCK);
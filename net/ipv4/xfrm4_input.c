@@ -45,6 +45,62 @@ static int xfrm4_parse_spi(struct sk_buff *skb, u8 nexthdr, u32 *spi, u32 *seq)
 	return xfrm_parse_spi(skb, nexthdr, spi, seq);
 }
 
+/* Strip the outer header of a tunnel mode packet */
+static int xfrm4_decap_tunnel(struct sk_buff *skb, struct xfrm_state *x)
+{
+	struct iphdr *iph = skb->nh.iph;
+
+	if (iph->protocol != IPPROTO_IPIP)
+		return -EINVAL;
+	if (!pskb_may_pull(skb, sizeof(struct iphdr)))
+		return -EINVAL;
+	if (skb_cloned(skb) &&
+	    pskb_expand_head(skb, 0, 0, GFP_ATOMIC))
+		return -ENOMEM;
+	if (x->props.flags & XFRM_STATE_DECAP_DSCP)
+		ipv4_copy_dscp(iph, skb->h.ipiph);
+	if (!(x->props.flags & XFRM_STATE_NOECN))
+		ipip_ecn_decapsulate(skb);
+	skb->mac.raw = memmove(skb->data - skb->mac_len,
+			       skb->mac.raw, skb->mac_len);
+	skb->nh.raw = skb->data;
+	memset(&(IPCB(skb)->opt), 0, sizeof(struct ip_options));
+	return 0;
+}
+
+/* Record the states the packet went through in its secpath */
+static int xfrm4_rcv_secpath(struct sk_buff *skb,
+			     struct sec_decap_state *xfrm_vec, int xfrm_nr)
+{
+	/* Allocate new secpath or COW existing one. */
+
+	if (!skb->sp || atomic_read(&skb->sp->refcnt) != 1) {
+		struct sec_path *sp;
+		sp = secpath_dup(skb->sp);
+		if (!sp)
+			return -ENOMEM;
+		if (skb->sp)
+			secpath_put(skb->sp);
+		skb->sp = sp;
+	}
+	if (xfrm_nr + skb->sp->len > XFRM_MAX_DEPTH)
+		return -EINVAL;
+
+	memcpy(skb->sp->x+skb->sp->len, xfrm_vec, xfrm_nr*sizeof(struct sec_decap_state));
+	skb->sp->len += xfrm_nr;
+	return 0;
+}
+
+static inline int xfrm4_parallel(struct xfrm_state *x)
+{
+#ifdef CONFIG_XFRM_PARALLEL
+	return x->props.mode && (x->props.flags & XFRM_STATE_PARALLEL) &&
+	       x->type->input_parallel;
+#else
+	return 0;
+#endif
+}
+
 int xfrm4_rcv_encap(struct sk_buff *skb, __u16 encap_type)
 {
 	int err;
@@ -78,7 +134,17 @@ int xfrm4_rcv_encap(struct sk_buff *skb, __u16 encap_type)
 			goto drop_unlock;
 
 		xfrm_vec[xfrm_nr].decap.decap_type = encap_type;
-		if (x->type->input(x, &(xfrm_vec[xfrm_nr].decap), skb))
+		if (!xfrm_nr && xfrm4_parallel(x)) {
+			err = x->type->input_parallel(x, &xfrm_vec[0].decap, skb);
+			if (err == -EINPROGRESS) {
+				/* The reference on x goes with the packet
+				   to xfrm4_rcv_resume() */
+				spin_unlock(&x->lock);
+				return 0;
+			}
+		} else
+			err = x->type->input(x, &(xfrm_vec[xfrm_nr].decap), skb);
+		if (err)
 			goto drop_unlock;
 
 		/* only the first xfrm gets the encap type */
@@ -94,24 +160,9 @@ int xfrm4_rcv_encap(struct sk_buff *skb, __u16 encap_type)
 
 		xfrm_vec[xfrm_nr++].xvec = x;
 
-		iph = skb->nh.iph;
-
 		if (x->props.mode) {
-			if (iph->protocol != IPPROTO_IPIP)
-				goto drop;
-			if (!pskb_may_pull(skb, sizeof(struct iphdr)))
+			if (xfrm4_decap_tunnel(skb, x))
 				goto drop;
-			if (skb_cloned(skb) &&
-			    pskb_expand_head(skb, 0, 0, GFP_ATOMIC))
-				goto drop;
-			if (x->props.flags & XFRM_STATE_DECAP_DSCP)
-				ipv4_copy_dscp(iph, skb->h.ipiph);
-			if (!(x->props.flags & XFRM_STATE_NOECN))
-				ipip_ecn_decapsulate(skb);
-			skb->mac.raw = memmove(skb->data - skb->mac_len,
-					       skb->mac.raw, skb->mac_len);
-			skb->nh.raw = skb->data;
-			memset(&(IPCB(skb)->opt), 0, sizeof(struct ip_options));
 			decaps = 1;
 			break;
 		}
@@ -120,23 +171,9 @@ int xfrm4_rcv_encap(struct sk_buff *skb, __u16 encap_type)
 			goto drop;
 	} while (!err);
 
-	/* Allocate new secpath or COW existing one. */
-
-	if (!skb->sp || atomic_read(&skb->sp->refcnt) != 1) {
-		struct sec_path *sp;
-		sp = secpath_dup(skb->sp);
-		if (!sp)
-			goto drop;
-		if (skb->sp)
-			secpath_put(skb->sp);
-		skb->sp = sp;
-	}
-	if (xfrm_nr + skb->sp->len > XFRM_MAX_DEPTH)
+	if (xfrm4_rcv_secpath(skb, xfrm_vec, xfrm_nr))
 		goto drop;
 
-	memcpy(skb->sp->x+skb->sp->len, xfrm_vec, xfrm_nr*sizeof(struct sec_decap_state));
-	skb->sp->len += xfrm_nr;
-
 	if (decaps) {
 		if (!(skb->dev->flags&IFF_LOOPBACK)) {
 			dst_release(skb->dst);
@@ -158,3 +195,51 @@ drop:
 	kfree_skb(skb);
 	return 0;
 }
+
+#ifdef CONFIG_XFRM_PARALLEL
+/* The rest of xfrm4_rcv_encap() for a packet that input_parallel has
+ * finished in the background, in order and with BHs disabled.  err is
+ * what input would have returned, -EBADMSG if the ICV was wrong. */
+void xfrm4_rcv_resume(struct xfrm_state *x, struct xfrm_decap_state *decap,
+		      struct sk_buff *skb, u32 seq, int err)
+{
+	struct sec_decap_state xfrm_vec[1];
+
+	spin_lock(&x->lock);
+	if (err == -EBADMSG)
+		x->stats.integrity_failed++;
+	if (err || unlikely(x->km.state != XFRM_STATE_VALID))
+		goto drop_unlock;
+
+	/* Checked before, but the window may have moved since */
+	if (x->props.replay_window) {
+		if (xfrm_replay_check(x, seq))
+			goto drop_unlock;
+		xfrm_replay_advance(x, seq);
+	}
+
+	x->curlft.bytes += skb->len;
+	x->curlft.packets++;
+
+	spin_unlock(&x->lock);
+
+	xfrm_vec[0].xvec = x;
+	xfrm_vec[0].decap = *decap;
+	if (xfrm4_decap_tunnel(skb, x) || xfrm4_rcv_secpath(skb, xfrm_vec, 1))
+		goto drop;
+
+	if (!(skb->dev->flags&IFF_LOOPBACK)) {
+		dst_release(skb->dst);
+		skb->dst = NULL;
+	}
+	netif_rx(skb);
+	return;
+
+drop_unlock:
+	spin_unlock(&x->lock);
+drop:
+	xfrm_state_put(x);
+	kfree_skb(skb);
+}
+EXPORT_SYMBOL(xfrm4_rcv_resume);
+#endif
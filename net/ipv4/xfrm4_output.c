@@ -8,6 +8,7 @@
  * 2 of the License, or (at your option) any later version.
  */
 
+#include <linux/module.h>
 #include <linux/skbuff.h>
 #include <linux/spinlock.h>
 #include <net/inet_ecn.h>
@@ -117,6 +118,11 @@ int xfrm4_output(struct sk_buff *skb)
 	xfrm4_encap(skb);
 
 	err = x->type->output(x, skb);
+	if (err == -EINPROGRESS) {
+		/* xfrm4_output_resume() takes it from here */
+		spin_unlock_bh(&x->lock);
+		return 0;
+	}
 	if (err)
 		goto error;
 
@@ -139,3 +145,33 @@ error_nolock:
 	kfree_skb(skb);
 	goto out_exit;
 }
+
+#ifdef CONFIG_XFRM_PARALLEL
+/* The end of xfrm4_output(), for an x->type->output that has finished
+ * a packet in the background.  Called with BHs disabled; err is what
+ * output would have returned. */
+int xfrm4_output_resume(struct sk_buff *skb, int err)
+{
+	struct dst_entry *dst = skb->dst;
+	struct xfrm_state *x = dst->xfrm;
+
+	if (err)
+		goto error;
+
+	spin_lock(&x->lock);
+	x->curlft.bytes += skb->len;
+	x->curlft.packets++;
+	spin_unlock(&x->lock);
+
+	if (!(skb->dst = dst_pop(dst))) {
+		err = -EHOSTUNREACH;
+		goto error;
+	}
+	return dst_output(skb);
+
+error:
+	kfree_skb(skb);
+	return err;
+}
+EXPORT_SYMBOL(xfrm4_output_resume);
+#endif
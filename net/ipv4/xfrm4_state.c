@@ -45,7 +45,7 @@ __xfrm4_state_lookup(xfrm_address_t *daddr, u32 spi, u8 proto)
 	unsigned h = __xfrm4_spi_hash(daddr, spi, proto);
 	struct xfrm_state *x;
 
-	list_for_each_entry(x, xfrm4_state_afinfo.state_byspi+h, byspi) {
+	list_for_each_entry(x, xfrm_state_byspi+h, byspi) {
 		if (x->props.family == AF_INET &&
 		    spi == x->id.spi &&
 		    daddr->a4 == x->id.daddr.a4 &&
@@ -67,7 +67,7 @@ __xfrm4_find_acq(u8 mode, u32 reqid, u8 proto,
 
 	x0 = NULL;
 
-	list_for_each_entry(x, xfrm4_state_afinfo.state_bydst+h, bydst) {
+	list_for_each_entry(x, xfrm_state_bydst+h, bydst) {
 		if (x->props.family == AF_INET &&
 		    daddr->a4 == x->id.daddr.a4 &&
 		    mode == x->props.mode &&
@@ -98,7 +98,7 @@ __xfrm4_find_acq(u8 mode, u32 reqid, u8 proto,
 		x0->timer.expires = jiffies + XFRM_ACQ_EXPIRES*HZ;
 		add_timer(&x0->timer);
 		xfrm_state_hold(x0);
-		list_add_tail(&x0->bydst, xfrm4_state_afinfo.state_bydst+h);
+		list_add_tail(&x0->bydst, xfrm_state_bydst+h);
 		wake_up(&km_waitq);
 	}
 	if (x0)
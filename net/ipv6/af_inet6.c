@@ -486,7 +486,7 @@ struct proto_ops inet6_stream_ops = {
 	.getsockopt =	sock_common_getsockopt,		/* ok		*/
 	.sendmsg =	inet_sendmsg,			/* ok		*/
 	.recvmsg =	sock_common_recvmsg,		/* ok		*/
-	.mmap =		sock_no_mmap,
+	.mmap =		tcp_mmap,
 	.sendpage =	tcp_sendpage
 };
 
@@ -80,7 +80,6 @@ DEFINE_RWLOCK(fib6_walker_lock);
 #define SUBTREE(fn) NULL
 #endif
 
-static void fib6_prune_clones(struct fib6_node *fn, struct rt6_info *rt);
 static struct fib6_node * fib6_repair_tree(struct fib6_node *fn);
 
 /*
@@ -187,15 +186,36 @@ static __inline__ struct fib6_node * node_alloc(void)
 	return fn;
 }
 
+/*
+ * Lookups walk the tree under rcu_read_lock_bh() without rt6_lock, so
+ * nodes and routes are only freed a grace period after they are
+ * unlinked, and are published fully set up.
+ */
+static void node_free_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(fib6_node_kmem,
+			container_of(head, struct fib6_node, rcu));
+}
+
 static __inline__ void node_free(struct fib6_node * fn)
 {
-	kmem_cache_free(fib6_node_kmem, fn);
+	call_rcu_bh(&fn->rcu, node_free_rcu);
+}
+
+static void rt6_free_rcu(struct rcu_head *head)
+{
+	head->func = NULL;
+	dst_free(container_of(head, struct dst_entry, rcu_head));
 }
 
+/* A route can be put back in the tree, and released again, before the
+ * free of its last release has run: that free is the one which counts,
+ * as dst_free() of a freed route is a no-op.
+ */
 static __inline__ void rt6_release(struct rt6_info *rt)
 {
-	if (atomic_dec_and_test(&rt->rt6i_ref))
-		dst_free(&rt->u.dst);
+	if (atomic_dec_and_test(&rt->rt6i_ref) && !rt->u.dst.rcu_head.func)
+		call_rcu_bh(&rt->u.dst.rcu_head, rt6_free_rcu);
 }
 
 
@@ -276,9 +296,9 @@ static struct fib6_node * fib6_add_1(struct fib6_node *root, void *addr,
 	ln->fn_sernum = sernum;
 
 	if (dir)
-		pn->right = ln;
+		rcu_assign_pointer(pn->right, ln);
 	else
-		pn->left  = ln;
+		rcu_assign_pointer(pn->left, ln);
 
 	return ln;
 
@@ -335,16 +355,9 @@ insert_above:
 
 		in->fn_sernum = sernum;
 
-		/* update parent pointer */
-		if (dir)
-			pn->right = in;
-		else
-			pn->left  = in;
-
 		ln->fn_bit = plen;
 
 		ln->parent = in;
-		fn->parent = in;
 
 		ln->fn_sernum = sernum;
 
@@ -355,6 +368,14 @@ insert_above:
 			in->left  = ln;
 			in->right = fn;
 		}
+
+		/* update parent pointer */
+		if (dir)
+			rcu_assign_pointer(pn->right, in);
+		else
+			rcu_assign_pointer(pn->left, in);
+
+		fn->parent = in;
 	} else { /* plen <= bit */
 
 		/* 
@@ -373,17 +394,17 @@ insert_above:
 		ln->parent = pn;
 
 		ln->fn_sernum = sernum;
-		
-		if (dir)
-			pn->right = ln;
-		else
-			pn->left  = ln;
 
 		if (addr_bit_set(&key->addr, plen))
 			ln->right = fn;
 		else
 			ln->left  = fn;
 
+		if (dir)
+			rcu_assign_pointer(pn->right, ln);
+		else
+			rcu_assign_pointer(pn->left, ln);
+
 		fn->parent = ln;
 	}
 	return ln;
@@ -404,8 +425,8 @@ static int fib6_add_rt2node(struct fib6_node *fn, struct rt6_info *rt,
 	if (fn->fn_flags&RTN_TL_ROOT &&
 	    fn->leaf == &ip6_null_entry &&
 	    !(rt->rt6i_flags & (RTF_DEFAULT | RTF_ADDRCONF)) ){
-		fn->leaf = rt;
 		rt->u.next = NULL;
+		rcu_assign_pointer(fn->leaf, rt);
 		goto out;
 	}
 
@@ -444,9 +465,9 @@ static int fib6_add_rt2node(struct fib6_node *fn, struct rt6_info *rt,
 	 *	insert node
 	 */
 
-out:
 	rt->u.next = iter;
-	*ins = rt;
+	rcu_assign_pointer(*ins, rt);
+out:
 	rt->rt6i_node = fn;
 	atomic_inc(&rt->rt6i_ref);
 	inet6_rt_notify(RTM_NEWROUTE, rt, nlh);
@@ -454,6 +475,8 @@ out:
 
 	if ((fn->fn_flags & RTN_RTINFO) == 0) {
 		rt6_stats.fib_route_nodes++;
+		/* A lookup trusts the leaf of a node with routing info */
+		smp_wmb();
 		fn->fn_flags |= RTN_RTINFO;
 	}
 
@@ -463,7 +486,7 @@ out:
 static __inline__ void fib6_start_gc(struct rt6_info *rt)
 {
 	if (ip6_fib_timer.expires == 0 &&
-	    (rt->rt6i_flags & (RTF_EXPIRES|RTF_CACHE)))
+	    (rt->rt6i_flags & RTF_EXPIRES))
 		mod_timer(&ip6_fib_timer, jiffies + ip6_rt_gc_interval);
 }
 
@@ -534,9 +557,9 @@ int fib6_add(struct fib6_node *root, struct rt6_info *rt, struct nlmsghdr *nlh,
 
 			/* Now link new subtree to main tree */
 			sfn->parent = fn;
-			fn->subtree = sfn;
+			rcu_assign_pointer(fn->subtree, sfn);
 			if (fn->leaf == NULL) {
-				fn->leaf = rt;
+				rcu_assign_pointer(fn->leaf, rt);
 				atomic_inc(&rt->rt6i_ref);
 			}
 		} else {
@@ -556,8 +579,7 @@ int fib6_add(struct fib6_node *root, struct rt6_info *rt, struct nlmsghdr *nlh,
 
 	if (err == 0) {
 		fib6_start_gc(rt);
-		if (!(rt->rt6i_flags&RTF_CACHE))
-			fib6_prune_clones(fn, rt);
+		rt6_cache_flush();
 	}
 
 out:
@@ -604,7 +626,7 @@ static struct fib6_node * fib6_lookup_1(struct fib6_node *root,
 
 		dir = addr_bit_set(args->addr, fn->fn_bit);
 
-		next = dir ? fn->right : fn->left;
+		next = rcu_dereference(dir ? fn->right : fn->left);
 
 		if (next) {
 			fn = next;
@@ -616,14 +638,16 @@ static struct fib6_node * fib6_lookup_1(struct fib6_node *root,
 
 	while ((fn->fn_flags & RTN_ROOT) == 0) {
 #ifdef CONFIG_IPV6_SUBTREES
-		if (fn->subtree) {
+		struct fib6_node *sfn = rcu_dereference(fn->subtree);
+
+		if (sfn) {
 			struct fib6_node *st;
 			struct lookup_args *narg;
 
 			narg = args + 1;
 
 			if (narg->addr) {
-				st = fib6_lookup_1(fn->subtree, narg);
+				st = fib6_lookup_1(sfn, narg);
 
 				if (st && !(st->fn_flags & RTN_ROOT))
 					return st;
@@ -632,13 +656,18 @@ static struct fib6_node * fib6_lookup_1(struct fib6_node *root,
 #endif
 
 		if (fn->fn_flags & RTN_RTINFO) {
+			struct rt6_info *leaf = rcu_dereference(fn->leaf);
 			struct rt6key *key;
 
-			key = (struct rt6key *) ((u8 *) fn->leaf +
-						 args->offset);
+			/* NULL while its last route is being deleted */
+			if (leaf) {
+				key = (struct rt6key *) ((u8 *) leaf +
+							 args->offset);
 
-			if (ipv6_prefix_equal(&key->addr, args->addr, key->plen))
-				return fn;
+				if (ipv6_prefix_equal(&key->addr, args->addr,
+						      key->plen))
+					return fn;
+			}
 		}
 
 		fn = fn->parent;
@@ -884,7 +913,7 @@ static void fib6_del_route(struct fib6_node *fn, struct rt6_info **rtp,
 	}
 	read_unlock(&fib6_walker_lock);
 
-	rt->u.next = NULL;
+	/* rt->u.next is left alone for lookups walking past it */
 
 	if (fn->leaf == NULL && fn->fn_flags&RTN_TL_ROOT)
 		fn->leaf = &ip6_null_entry;
@@ -935,8 +964,7 @@ int fib6_del(struct rt6_info *rt, struct nlmsghdr *nlh, void *_rtattr)
 
 	BUG_TRAP(fn->fn_flags&RTN_RTINFO);
 
-	if (!(rt->rt6i_flags&RTF_CACHE))
-		fib6_prune_clones(fn, rt);
+	rt6_cache_flush();
 
 	/*
 	 *	Walk the leaf entries looking for ourself
@@ -1114,21 +1142,6 @@ void fib6_clean_tree(struct fib6_node *root,
 	fib6_walk(&c.w);
 }
 
-static int fib6_prune_clone(struct rt6_info *rt, void *arg)
-{
-	if (rt->rt6i_flags & RTF_CACHE) {
-		RT6_TRACE("pruning clone %p\n", rt);
-		return -1;
-	}
-
-	return 0;
-}
-
-static void fib6_prune_clones(struct fib6_node *fn, struct rt6_info *rt)
-{
-	fib6_clean_tree(fn, fib6_prune_clone, 1, rt);
-}
-
 /*
  *	Garbage collection
  */
@@ -1147,8 +1160,7 @@ static int fib6_age(struct rt6_info *rt, void *arg)
 	 *	check addrconf expiration here.
 	 *	Routes are expired even if they are in use.
 	 *
-	 *	Also age clones. Note, that clones are aged out
-	 *	only if they are not in use now.
+	 *	Clones are aged in the route cache, see rt6_cache_gc().
 	 */
 
 	if (rt->rt6i_flags&RTF_EXPIRES && rt->rt6i_expires) {
@@ -1158,18 +1170,6 @@ static int fib6_age(struct rt6_info *rt, void *arg)
 			return -1;
 		}
 		gc_args.more++;
-	} else if (rt->rt6i_flags & RTF_CACHE) {
-		if (atomic_read(&rt->u.dst.__refcnt) == 0 &&
-		    time_after_eq(now, rt->u.dst.lastuse + gc_args.timeout)) {
-			RT6_TRACE("aging clone %p\n", rt);
-			return -1;
-		} else if ((rt->rt6i_flags & RTF_GATEWAY) &&
-			   (!(rt->rt6i_nexthop->flags & NTF_ROUTER))) {
-			RT6_TRACE("purging route %p via non-router but gateway\n",
-				  rt);
-			return -1;
-		}
-		gc_args.more++;
 	}
 
 	return 0;
@@ -1199,6 +1199,8 @@ void fib6_run_gc(unsigned long dummy)
 	fib6_clean_tree(&ip6_routing_table, fib6_age, 0, NULL);
 	write_unlock_bh(&rt6_lock);
 
+	gc_args.more += rt6_cache_gc(gc_args.timeout);
+
 	if (gc_args.more)
 		mod_timer(&ip6_fib_timer, jiffies + ip6_rt_gc_interval);
 	else {
@@ -37,6 +37,9 @@
 #include <linux/init.h>
 #include <linux/netlink.h>
 #include <linux/if_arp.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
 
 #ifdef 	CONFIG_PROC_FS
 #include <linux/proc_fs.h>
@@ -136,6 +139,218 @@ struct fib6_node ip6_routing_table = {
 
 DEFINE_RWLOCK(rt6_lock);
 
+/*
+ *	Route cache.
+ *
+ *	The /128 clones made for a destination (COW of connected routes,
+ *	PMTU and redirects) live in a hash by destination rather than in
+ *	the tree, so that a packet to a known destination costs one hash
+ *	chain walk under rcu_read_lock_bh() and no rt6_lock.  Chains are
+ *	changed under the lock of their bucket, and an entry is freed a
+ *	grace period after it is unlinked.
+ *
+ *	A clone is a copy of a tree route and so is stale as soon as the
+ *	tree changes: the cache is then flushed, and rt6_cache_genid
+ *	bumped so that a clone made from the old tree is not cached.
+ */
+
+struct rt6_cache_bucket {
+	struct rt6_info		*chain;
+	spinlock_t		lock;
+} __attribute__((__aligned__(8)));
+
+static struct rt6_cache_bucket	*rt6_cache;
+static unsigned int		rt6_cache_mask;
+static unsigned int		rt6_cache_rnd;
+static atomic_t			rt6_cache_genid = ATOMIC_INIT(0);
+static atomic_t			rt6_cache_entries = ATOMIC_INIT(0);
+
+static __inline__ struct rt6_cache_bucket *
+rt6_cache_bucket(const struct in6_addr *daddr)
+{
+	return &rt6_cache[jhash2((u32 *)daddr->s6_addr32, 4, rt6_cache_rnd) &
+			  rt6_cache_mask];
+}
+
+/* The device choice of rt6_device_match(), among the clones for daddr */
+static struct rt6_info *rt6_cache_lookup(struct in6_addr *daddr,
+					 struct in6_addr *saddr,
+					 int oif, int strict)
+{
+	struct rt6_cache_bucket *b = rt6_cache_bucket(daddr);
+	struct rt6_info *rt, *local = NULL, *first = NULL;
+
+	for (rt = rcu_dereference(b->chain); rt;
+	     rt = rcu_dereference(rt->u.next)) {
+		struct net_device *dev = rt->rt6i_dev;
+
+		if (!ipv6_addr_equal(&rt->rt6i_dst.addr, daddr))
+			continue;
+#ifdef CONFIG_IPV6_SUBTREES
+		if (rt->rt6i_src.plen &&
+		    (!saddr || !ipv6_addr_equal(&rt->rt6i_src.addr, saddr)))
+			continue;
+#endif
+		if (!oif || dev->ifindex == oif)
+			goto found;
+		if (!first)
+			first = rt;
+		if (dev->flags & IFF_LOOPBACK) {
+			if (rt->rt6i_idev &&
+			    rt->rt6i_idev->dev->ifindex == oif)
+				local = rt;
+			else if (!strict && !local)
+				local = rt;
+		}
+	}
+
+	rt = local;
+	if (!rt && !strict)
+		rt = first;
+	if (!rt)
+		return NULL;
+found:
+	dst_hold(&rt->u.dst);
+	return rt;
+}
+
+static void rt6_cache_free(struct rt6_info *rt)
+{
+	atomic_dec(&rt6_cache_entries);
+	call_rcu_bh(&rt->u.dst.rcu_head, dst_rcu_free);
+}
+
+/*
+ * Cache rt, which the cache then owns, in place of a clone for the same
+ * destination, source and device.  A clone made before the last flush
+ * is freed instead.
+ */
+static void rt6_cache_insert(struct rt6_info *rt, int genid)
+{
+	struct rt6_cache_bucket *b = rt6_cache_bucket(&rt->rt6i_dst.addr);
+	struct rt6_info *iter, **rtp;
+
+	spin_lock_bh(&b->lock);
+	if (genid != atomic_read(&rt6_cache_genid)) {
+		spin_unlock_bh(&b->lock);
+		dst_free(&rt->u.dst);
+		return;
+	}
+
+	for (rtp = &b->chain; (iter = *rtp) != NULL; rtp = &iter->u.next) {
+		if (iter->rt6i_dev == rt->rt6i_dev &&
+		    ipv6_addr_equal(&iter->rt6i_dst.addr, &rt->rt6i_dst.addr)
+#ifdef CONFIG_IPV6_SUBTREES
+		    && iter->rt6i_src.plen == rt->rt6i_src.plen &&
+		    ipv6_addr_equal(&iter->rt6i_src.addr, &rt->rt6i_src.addr)
+#endif
+		    )
+			break;
+	}
+
+	if (iter) {
+		rt->u.next = iter->u.next;
+		rcu_assign_pointer(*rtp, rt);
+		call_rcu_bh(&iter->u.dst.rcu_head, dst_rcu_free);
+	} else {
+		rt->u.next = b->chain;
+		rcu_assign_pointer(b->chain, rt);
+		atomic_inc(&rt6_cache_entries);
+	}
+	spin_unlock_bh(&b->lock);
+
+	fib6_force_start_gc();
+}
+
+static int rt6_cache_del(struct rt6_info *rt)
+{
+	struct rt6_cache_bucket *b = rt6_cache_bucket(&rt->rt6i_dst.addr);
+	struct rt6_info **rtp;
+	int err = -ENOENT;
+
+	spin_lock_bh(&b->lock);
+	for (rtp = &b->chain; *rtp; rtp = &(*rtp)->u.next) {
+		if (*rtp == rt) {
+			*rtp = rt->u.next;
+			rt6_cache_free(rt);
+			err = 0;
+			break;
+		}
+	}
+	spin_unlock_bh(&b->lock);
+	return err;
+}
+
+/* Call func for each cached route, and drop those it returns -1 for */
+static void rt6_cache_clean(int (*func)(struct rt6_info *, void *arg),
+			    void *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i <= rt6_cache_mask; i++) {
+		struct rt6_cache_bucket *b = &rt6_cache[i];
+		struct rt6_info *rt, **rtp;
+
+		if (!b->chain)
+			continue;
+
+		spin_lock_bh(&b->lock);
+		rtp = &b->chain;
+		while ((rt = *rtp) != NULL) {
+			if (func(rt, arg) < 0) {
+				*rtp = rt->u.next;
+				rt6_cache_free(rt);
+			} else
+				rtp = &rt->u.next;
+		}
+		spin_unlock_bh(&b->lock);
+	}
+}
+
+static int rt6_cache_all(struct rt6_info *rt, void *arg)
+{
+	return -1;
+}
+
+void rt6_cache_flush(void)
+{
+	atomic_inc(&rt6_cache_genid);
+	rt6_cache_clean(rt6_cache_all, NULL);
+}
+
+static int rt6_cache_age(struct rt6_info *rt, void *arg)
+{
+	unsigned long now = jiffies;
+	int timeout = *(int *)arg;
+
+	/*
+	 *	Expiring clones go even if they are in use, the others
+	 *	only if they are not.
+	 */
+	if (rt->rt6i_flags & RTF_EXPIRES && rt->rt6i_expires) {
+		if (time_after(now, rt->rt6i_expires)) {
+			RT6_TRACE("expiring clone %p\n", rt);
+			return -1;
+		}
+	} else if (atomic_read(&rt->u.dst.__refcnt) == 0 &&
+		   time_after_eq(now, rt->u.dst.lastuse + timeout)) {
+		RT6_TRACE("aging clone %p\n", rt);
+		return -1;
+	} else if ((rt->rt6i_flags & RTF_GATEWAY) &&
+		   !(rt->rt6i_nexthop->flags & NTF_ROUTER)) {
+		RT6_TRACE("purging route %p via non-router but gateway\n", rt);
+		return -1;
+	}
+	return 0;
+}
+
+/* Called from fib6_run_gc(), returns the number of clones left */
+int rt6_cache_gc(int timeout)
+{
+	rt6_cache_clean(rt6_cache_age, &timeout);
+	return atomic_read(&rt6_cache_entries);
+}
+
 
 /* allocate dst with ip6_dst_ops */
 static __inline__ struct rt6_info *ip6_dst_alloc(void)
@@ -176,7 +391,7 @@ static __inline__ int rt6_check_expired(const struct rt6_info *rt)
 }
 
 /*
- *	Route lookup. Any rt6_lock is implied.
+ *	Route lookup. rt6_lock or rcu_read_lock_bh() is implied.
  */
 
 static __inline__ struct rt6_info *rt6_device_match(struct rt6_info *rt,
@@ -358,18 +573,29 @@ static struct rt6_info *rt6_best_dflt(struct rt6_info *rt, int oif)
 	return match;
 }
 
+/* The last route of a node can be going away under a lockless lookup */
+static __inline__ struct rt6_info *fib6_leaf(struct fib6_node *fn)
+{
+	struct rt6_info *rt = rcu_dereference(fn->leaf);
+
+	return rt ? rt : &ip6_null_entry;
+}
+
 struct rt6_info *rt6_lookup(struct in6_addr *daddr, struct in6_addr *saddr,
 			    int oif, int strict)
 {
 	struct fib6_node *fn;
 	struct rt6_info *rt;
 
-	read_lock_bh(&rt6_lock);
-	fn = fib6_lookup(&ip6_routing_table, daddr, saddr);
-	rt = rt6_device_match(fn->leaf, oif, strict);
-	dst_hold(&rt->u.dst);
+	rcu_read_lock_bh();
+	rt = rt6_cache_lookup(daddr, saddr, oif, strict);
+	if (rt == NULL) {
+		fn = fib6_lookup(&ip6_routing_table, daddr, saddr);
+		rt = rt6_device_match(fib6_leaf(fn), oif, strict);
+		dst_hold(&rt->u.dst);
+	}
 	rt->u.dst.__use++;
-	read_unlock_bh(&rt6_lock);
+	rcu_read_unlock_bh();
 
 	rt->u.dst.lastuse = jiffies;
 	if (rt->u.dst.error == 0)
@@ -395,14 +621,13 @@ int ip6_ins_rt(struct rt6_info *rt, struct nlmsghdr *nlh, void *_rtattr)
 	return err;
 }
 
-/* No rt6_lock! If COW failed, the function returns dead route entry
-   with dst->error set to errno value.
+/* No rt6_lock!  Returns the clone held, and cached unless the tree
+   changed since genid was read; or ip6_null_entry if there is no memory.
  */
 
 static struct rt6_info *rt6_cow(struct rt6_info *ort, struct in6_addr *daddr,
-				struct in6_addr *saddr)
+				struct in6_addr *saddr, int genid)
 {
-	int err;
 	struct rt6_info *rt;
 
 	/*
@@ -431,13 +656,7 @@ static struct rt6_info *rt6_cow(struct rt6_info *ort, struct in6_addr *daddr,
 		rt->rt6i_nexthop = ndisc_get_neigh(rt->rt6i_dev, &rt->rt6i_gateway);
 
 		dst_hold(&rt->u.dst);
-
-		err = ip6_ins_rt(rt, NULL, NULL);
-		if (err == 0)
-			return rt;
-
-		rt->u.dst.error = err;
-
+		rt6_cache_insert(rt, genid);
 		return rt;
 	}
 	dst_hold(&ip6_null_entry.u.dst);
@@ -461,55 +680,33 @@ void ip6_route_input(struct sk_buff *skb)
 {
 	struct fib6_node *fn;
 	struct rt6_info *rt;
-	int strict;
-	int attempts = 3;
+	int strict, genid;
 
 	strict = ipv6_addr_type(&skb->nh.ipv6h->daddr) & (IPV6_ADDR_MULTICAST|IPV6_ADDR_LINKLOCAL);
 
-relookup:
-	read_lock_bh(&rt6_lock);
+	genid = atomic_read(&rt6_cache_genid);
+	rcu_read_lock_bh();
+
+	rt = rt6_cache_lookup(&skb->nh.ipv6h->daddr, &skb->nh.ipv6h->saddr,
+			      skb->dev->ifindex, strict);
+	if (rt)
+		goto out;
 
 	fn = fib6_lookup(&ip6_routing_table, &skb->nh.ipv6h->daddr,
 			 &skb->nh.ipv6h->saddr);
 
 restart:
-	rt = fn->leaf;
-
-	if ((rt->rt6i_flags & RTF_CACHE)) {
-		rt = rt6_device_match(rt, skb->dev->ifindex, strict);
-		BACKTRACK();
-		dst_hold(&rt->u.dst);
-		goto out;
-	}
-
-	rt = rt6_device_match(rt, skb->dev->ifindex, 0);
+	rt = rt6_device_match(fib6_leaf(fn), skb->dev->ifindex, 0);
 	BACKTRACK();
 
-	if (!rt->rt6i_nexthop && !(rt->rt6i_flags & RTF_NONEXTHOP)) {
-		struct rt6_info *nrt;
+	if (!rt->rt6i_nexthop && !(rt->rt6i_flags & RTF_NONEXTHOP))
+		rt = rt6_cow(rt, &skb->nh.ipv6h->daddr,
+			     &skb->nh.ipv6h->saddr, genid);
+	else
 		dst_hold(&rt->u.dst);
-		read_unlock_bh(&rt6_lock);
-
-		nrt = rt6_cow(rt, &skb->nh.ipv6h->daddr,
-			      &skb->nh.ipv6h->saddr);
-
-		dst_release(&rt->u.dst);
-		rt = nrt;
-
-		if (rt->u.dst.error != -EEXIST || --attempts <= 0)
-			goto out2;
-
-		/* Race condition! In the gap, when rt6_lock was
-		   released someone could insert this route.  Relookup.
-		*/
-		dst_release(&rt->u.dst);
-		goto relookup;
-	}
-	dst_hold(&rt->u.dst);
 
 out:
-	read_unlock_bh(&rt6_lock);
-out2:
+	rcu_read_unlock_bh();
 	rt->u.dst.lastuse = jiffies;
 	rt->u.dst.__use++;
 	skb->dst = (struct dst_entry *) rt;
@@ -519,25 +716,22 @@ struct dst_entry * ip6_route_output(struct sock *sk, struct flowi *fl)
 {
 	struct fib6_node *fn;
 	struct rt6_info *rt;
-	int strict;
-	int attempts = 3;
+	int strict, genid;
 
 	strict = ipv6_addr_type(&fl->fl6_dst) & (IPV6_ADDR_MULTICAST|IPV6_ADDR_LINKLOCAL);
 
-relookup:
-	read_lock_bh(&rt6_lock);
+	genid = atomic_read(&rt6_cache_genid);
+	rcu_read_lock_bh();
+
+	rt = rt6_cache_lookup(&fl->fl6_dst, &fl->fl6_src, fl->oif, strict);
+	if (rt)
+		goto out;
 
 	fn = fib6_lookup(&ip6_routing_table, &fl->fl6_dst, &fl->fl6_src);
 
 restart:
-	rt = fn->leaf;
+	rt = fib6_leaf(fn);
 
-	if ((rt->rt6i_flags & RTF_CACHE)) {
-		rt = rt6_device_match(rt, fl->oif, strict);
-		BACKTRACK();
-		dst_hold(&rt->u.dst);
-		goto out;
-	}
 	if (rt->rt6i_flags & RTF_DEFAULT) {
 		if (rt->rt6i_metric >= IP6_RT_PRIO_ADDRCONF)
 			rt = rt6_best_dflt(rt, fl->oif);
@@ -546,30 +740,13 @@ restart:
 		BACKTRACK();
 	}
 
-	if (!rt->rt6i_nexthop && !(rt->rt6i_flags & RTF_NONEXTHOP)) {
-		struct rt6_info *nrt;
+	if (!rt->rt6i_nexthop && !(rt->rt6i_flags & RTF_NONEXTHOP))
+		rt = rt6_cow(rt, &fl->fl6_dst, &fl->fl6_src, genid);
+	else
 		dst_hold(&rt->u.dst);
-		read_unlock_bh(&rt6_lock);
-
-		nrt = rt6_cow(rt, &fl->fl6_dst, &fl->fl6_src);
-
-		dst_release(&rt->u.dst);
-		rt = nrt;
-
-		if (rt->u.dst.error != -EEXIST || --attempts <= 0)
-			goto out2;
-
-		/* Race condition! In the gap, when rt6_lock was
-		   released someone could insert this route.  Relookup.
-		*/
-		dst_release(&rt->u.dst);
-		goto relookup;
-	}
-	dst_hold(&rt->u.dst);
 
 out:
-	read_unlock_bh(&rt6_lock);
-out2:
+	rcu_read_unlock_bh();
 	rt->u.dst.lastuse = jiffies;
 	rt->u.dst.__use++;
 	return &rt->u.dst;
@@ -990,6 +1167,12 @@ int ip6_del_rt(struct rt6_info *rt, struct nlmsghdr *nlh, void *_rtattr)
 {
 	int err;
 
+	if (rt->rt6i_flags & RTF_CACHE) {
+		err = rt6_cache_del(rt);
+		dst_release(&rt->u.dst);
+		return err;
+	}
+
 	write_lock_bh(&rt6_lock);
 
 	rt6_reset_dflt_pointer(NULL);
@@ -1044,6 +1227,7 @@ void rt6_redirect(struct in6_addr *dest, struct in6_addr *saddr,
 		  struct neighbour *neigh, u8 *lladdr, int on_link)
 {
 	struct rt6_info *rt, *nrt;
+	int genid = atomic_read(&rt6_cache_genid);
 
 	/* Locate old route to this destination. */
 	rt = rt6_lookup(dest, NULL, neigh->dev->ifindex, 1);
@@ -1136,8 +1320,7 @@ source_ok:
 	nrt->u.dst.metrics[RTAX_MTU-1] = ipv6_get_mtu(neigh->dev);
 	nrt->u.dst.metrics[RTAX_ADVMSS-1] = ipv6_advmss(dst_mtu(&nrt->u.dst));
 
-	if (ip6_ins_rt(nrt, NULL, NULL))
-		goto out;
+	rt6_cache_insert(nrt, genid);
 
 	if (rt->rt6i_flags&RTF_CACHE) {
 		ip6_del_rt(rt, NULL, NULL);
@@ -1159,6 +1342,7 @@ void rt6_pmtu_discovery(struct in6_addr *daddr, struct in6_addr *saddr,
 {
 	struct rt6_info *rt, *nrt;
 	int allfrag = 0;
+	int genid = atomic_read(&rt6_cache_genid);
 
 	rt = rt6_lookup(daddr, saddr, dev->ifindex, 0);
 	if (rt == NULL)
@@ -1204,7 +1388,7 @@ void rt6_pmtu_discovery(struct in6_addr *daddr, struct in6_addr *saddr,
 	   2. It is gatewayed route or NONEXTHOP route. Action: clone it.
 	 */
 	if (!rt->rt6i_nexthop && !(rt->rt6i_flags & RTF_NONEXTHOP)) {
-		nrt = rt6_cow(rt, daddr, saddr);
+		nrt = rt6_cow(rt, daddr, saddr, genid);
 		if (!nrt->u.dst.error) {
 			nrt->u.dst.metrics[RTAX_MTU-1] = pmtu;
 			if (allfrag)
@@ -1232,7 +1416,7 @@ void rt6_pmtu_discovery(struct in6_addr *daddr, struct in6_addr *saddr,
 		nrt->u.dst.metrics[RTAX_MTU-1] = pmtu;
 		if (allfrag)
 			nrt->u.dst.metrics[RTAX_FEATURES-1] |= RTAX_FEATURE_ALLFRAG;
-		ip6_ins_rt(nrt, NULL, NULL);
+		rt6_cache_insert(nrt, genid);
 	}
 
 out:
@@ -1441,6 +1625,7 @@ void rt6_ifdown(struct net_device *dev)
 	write_lock_bh(&rt6_lock);
 	fib6_clean_tree(&ip6_routing_table, fib6_ifdown, 0, dev);
 	write_unlock_bh(&rt6_lock);
+	rt6_cache_clean(fib6_ifdown, dev);
 }
 
 struct rt6_mtu_change_arg
@@ -1497,6 +1682,7 @@ void rt6_mtu_change(struct net_device *dev, unsigned mtu)
 	read_lock_bh(&rt6_lock);
 	fib6_clean_tree(&ip6_routing_table, rt6_mtu_change_route, 0, &arg);
 	read_unlock_bh(&rt6_lock);
+	rt6_cache_clean(rt6_mtu_change_route, &arg);
 }
 
 static int inet6_rtm_to_rtmsg(struct rtmsg *r, struct rtattr **rta,
@@ -1716,6 +1902,37 @@ static int fib6_dump_done(struct netlink_callback *cb)
 	return cb->done(cb);
 }
 
+/*
+ * Dump the route cache after the tree, from bucket cb->args[2] - 1 and
+ * entry cb->args[3] of it on.  Returns 1 when the frame is full.
+ */
+static int rt6_dump_cache(struct rt6_rtnl_dump_arg *arg)
+{
+	struct netlink_callback *cb = arg->cb;
+	unsigned int h;
+	int idx;
+
+	for (h = cb->args[2] - 1; h <= rt6_cache_mask; h++, cb->args[3] = 0) {
+		struct rt6_info *rt;
+
+		rcu_read_lock_bh();
+		for (rt = rcu_dereference(rt6_cache[h].chain), idx = 0; rt;
+		     rt = rcu_dereference(rt->u.next), idx++) {
+			if (idx < cb->args[3])
+				continue;
+			if (rt6_dump_route(rt, arg) < 0) {
+				rcu_read_unlock_bh();
+				cb->args[2] = h + 1;
+				cb->args[3] = idx;
+				return 1;
+			}
+		}
+		rcu_read_unlock_bh();
+	}
+	cb->args[2] = h + 1;
+	return 0;
+}
+
 int inet6_dump_fib(struct sk_buff *skb, struct netlink_callback *cb)
 {
 	struct rt6_rtnl_dump_arg arg;
@@ -1725,6 +1942,9 @@ int inet6_dump_fib(struct sk_buff *skb, struct netlink_callback *cb)
 	arg.skb = skb;
 	arg.cb = cb;
 
+	if (cb->args[2])
+		goto dump_cache;
+
 	w = (void*)cb->args[0];
 	if (w == NULL) {
 		/* New dump:
@@ -1755,19 +1975,30 @@ int inet6_dump_fib(struct sk_buff *skb, struct netlink_callback *cb)
 		res = fib6_walk_continue(w);
 		read_unlock_bh(&rt6_lock);
 	}
-#if RT6_DEBUG >= 3
-	if (res <= 0 && skb->len == 0)
-		RT6_TRACE("%p>dump end\n", w);
-#endif
-	res = res < 0 ? res : skb->len;
 	/* res < 0 is an error. (really, impossible)
-	   res == 0 means that dump is complete, but skb still can contain data.
+	   res == 0 means that the tree is done, but skb still can contain data.
 	   res > 0 dump is not complete, but frame is full.
 	 */
-	/* Destroy walker, if dump of this table is complete. */
-	if (res <= 0)
+	if (res < 0) {
 		fib6_dump_end(cb);
-	return res;
+		return res;
+	}
+	if (res > 0)
+		return skb->len;
+
+	/* Destroy walker, the tree is done: go on with the route cache. */
+	RT6_TRACE("%p>dump cache\n", w);
+	cb->args[0] = 0;
+	fib6_walker_unlink(w);
+	kfree(w);
+	cb->args[2] = 1;
+	cb->args[3] = 0;
+
+dump_cache:
+	res = rt6_dump_cache(&arg);
+	if (res == 0 && skb->len == 0)
+		fib6_dump_end(cb);
+	return skb->len;
 }
 
 int inet6_rtm_getroute(struct sk_buff *in_skb, struct nlmsghdr* nlh, void *arg)
@@ -1940,6 +2171,7 @@ static int rt6_proc_info(char *buffer, char **start, off_t offset, int length)
 	read_lock_bh(&rt6_lock);
 	fib6_clean_tree(&ip6_routing_table, rt6_info_route, 0, &arg);
 	read_unlock_bh(&rt6_lock);
+	rt6_cache_clean(rt6_info_route, &arg);
 
 	*start = buffer;
 	if (offset)
@@ -1962,7 +2194,7 @@ static int rt6_stats_seq_show(struct seq_file *seq, void *v)
 	seq_printf(seq, "%04x %04x %04x %04x %04x %04x %04x\n",
 		      rt6_stats.fib_nodes, rt6_stats.fib_route_nodes,
 		      rt6_stats.fib_rt_alloc, rt6_stats.fib_rt_entries,
-		      rt6_stats.fib_rt_cache,
+		      atomic_read(&rt6_cache_entries),
 		      atomic_read(&ip6_dst_ops.entries),
 		      rt6_stats.fib_discarded_routes);
 
@@ -2095,6 +2327,9 @@ ctl_table ipv6_route_table[] = {
 void __init ip6_route_init(void)
 {
 	struct proc_dir_entry *p;
+	unsigned long goal;
+	unsigned int i;
+	int order;
 
 	ip6_dst_ops.kmem_cachep = kmem_cache_create("ip6_dst_cache",
 						     sizeof(struct rt6_info),
@@ -2103,6 +2338,33 @@ void __init ip6_route_init(void)
 	if (!ip6_dst_ops.kmem_cachep)
 		panic("cannot create ip6_dst_cache");
 
+	/* A bucket for each 64 pages, 256 to 65536 of them */
+	goal = num_physpages >> 6;
+	if (goal < 256)
+		goal = 256;
+	if (goal > 65536)
+		goal = 65536;
+	for (order = 0;
+	     (PAGE_SIZE << order) < goal * sizeof(struct rt6_cache_bucket);
+	     order++)
+		/* NOTHING */;
+	do {
+		rt6_cache = (struct rt6_cache_bucket *)
+			__get_free_pages(GFP_KERNEL, order);
+	} while (rt6_cache == NULL && --order >= 0);
+	if (!rt6_cache)
+		panic("Failed to allocate IPv6 route cache hash table\n");
+
+	rt6_cache_mask = (PAGE_SIZE << order) / sizeof(struct rt6_cache_bucket);
+	while (rt6_cache_mask & (rt6_cache_mask - 1))
+		rt6_cache_mask &= rt6_cache_mask - 1;
+	rt6_cache_mask--;
+	for (i = 0; i <= rt6_cache_mask; i++) {
+		rt6_cache[i].chain = NULL;
+		spin_lock_init(&rt6_cache[i].lock);
+	}
+	get_random_bytes(&rt6_cache_rnd, sizeof(rt6_cache_rnd));
+
 	fib6_init();
 #ifdef 	CONFIG_PROC_FS
 	p = proc_net_create("ipv6_route", 0, rt6_proc_info);
@@ -2127,5 +2389,8 @@ void ip6_route_cleanup(void)
 #endif
 	rt6_ifdown(NULL);
 	fib6_gc_cleanup();
+	free_pages((unsigned long)rt6_cache,
+		   get_order((rt6_cache_mask + 1) *
+			     sizeof(struct rt6_cache_bucket)));
 	kmem_cache_destroy(ip6_dst_ops.kmem_cachep);
 }
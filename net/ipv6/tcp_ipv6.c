@@ -103,6 +103,8 @@ static inline int tcp_v6_bind_conflict(struct sock *sk,
 {
 	struct sock *sk2;
 	struct hlist_node *node;
+	int reuseport = sk->sk_reuseport;
+	int uid = sock_i_uid(sk);
 
 	/* We must walk the whole port owner list in this case. -DaveM */
 	sk_for_each_bound(sk2, node, &tb->owners) {
@@ -112,6 +114,7 @@ static inline int tcp_v6_bind_conflict(struct sock *sk,
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if) &&
 		    (!sk->sk_reuse || !sk2->sk_reuse ||
 		     sk2->sk_state == TCP_LISTEN) &&
+		    !tcp_reuseport_ok(sk2, reuseport, uid) &&
 		     ipv6_rcv_saddr_equal(sk, sk2))
 			break;
 	}
@@ -210,25 +213,25 @@ fail:
 
 static __inline__ void __tcp_v6_hash(struct sock *sk)
 {
-	struct hlist_head *list;
-	rwlock_t *lock;
-
 	BUG_TRAP(sk_unhashed(sk));
 
 	if (sk->sk_state == TCP_LISTEN) {
+		struct hlist_head *list;
+
 		list = &tcp_listening_hash[tcp_sk_listen_hashfn(sk)];
-		lock = &tcp_lhash_lock;
 		tcp_listen_wlock();
+		__sk_add_node(sk, list);
+		sock_prot_inc_use(sk->sk_prot);
+		write_unlock(&tcp_lhash_lock);
 	} else {
+		struct tcp_ehash_bucket *head;
+
 		sk->sk_hashent = tcp_v6_sk_hashfn(sk);
-		list = &tcp_ehash[sk->sk_hashent].chain;
-		lock = &tcp_ehash[sk->sk_hashent].lock;
-		write_lock(lock);
+		head = &tcp_ehash[sk->sk_hashent];
+		spin_lock(&head->lock);
+		__tcp_ehash_add(sk, &head->chain);
+		spin_unlock(&head->lock);
 	}
-
-	__sk_add_node(sk, list);
-	sock_prot_inc_use(sk->sk_prot);
-	write_unlock(lock);
 }
 
 
@@ -247,12 +250,16 @@ static void tcp_v6_hash(struct sock *sk)
 	}
 }
 
-static struct sock *tcp_v6_lookup_listener(struct in6_addr *daddr, unsigned short hnum, int dif)
+static struct sock *tcp_v6_lookup_listener(struct in6_addr *saddr, u16 sport,
+					   struct in6_addr *daddr,
+					   unsigned short hnum, int dif)
 {
 	struct sock *sk;
 	struct hlist_node *node;
 	struct sock *result = NULL;
 	int score, hiscore;
+	int reuseport = 0, matches = 0;
+	u32 phash = 0;
 
 	hiscore=0;
 	read_lock(&tcp_lhash_lock);
@@ -271,14 +278,27 @@ static struct sock *tcp_v6_lookup_listener(struct in6_addr *daddr, unsigned shor
 					continue;
 				score++;
 			}
-			if (score == 3) {
-				result = sk;
-				break;
-			}
 			if (score > hiscore) {
 				hiscore = score;
 				result = sk;
+				reuseport = sk->sk_reuseport;
+				if (reuseport) {
+					phash = jhash_3words(saddr->s6_addr32[3],
+						daddr->s6_addr32[3],
+						TCP_COMBINED_PORTS(sport, hnum),
+						tcp_reuseport_secret);
+					matches = 1;
+				}
+			} else if (score == hiscore && reuseport &&
+				   sk->sk_reuseport) {
+				/* See __tcp_v4_lookup_listener(). */
+				matches++;
+				if (tcp_reuseport_scale(phash, matches) == 0)
+					result = sk;
+				phash = tcp_reuseport_next(phash);
 			}
+			if (score == 3 && !reuseport)
+				break;
 		}
 	}
 	if (result)
@@ -290,7 +310,7 @@ static struct sock *tcp_v6_lookup_listener(struct in6_addr *daddr, unsigned shor
 /* Sockets in TCP_CLOSE state are _always_ taken out of the hash, so
  * we need not check it for TCP lookups anymore, thanks Alexey. -DaveM
  *
- * The sockhash lock must be held as a reader here.
+ * Local BH must be disabled here.
  */
 
 static inline struct sock *__tcp_v6_lookup_established(struct in6_addr *saddr, u16 sport,
@@ -302,20 +322,30 @@ static inline struct sock *__tcp_v6_lookup_established(struct in6_addr *saddr, u
 	struct hlist_node *node;
 	__u32 ports = TCP_COMBINED_PORTS(sport, hnum);
 	int hash;
+	int locked = 0;
 
 	/* Optimize here for direct hit, only listening connections can
 	 * have wildcards anyways.
 	 */
 	hash = tcp_v6_hashfn(daddr, hnum, saddr, sport);
 	head = &tcp_ehash[hash];
-	read_lock(&head->lock);
-	sk_for_each(sk, node, &head->chain) {
+	rcu_read_lock();
+begin:
+	sk_for_each_rcu(sk, node, &head->chain) {
 		/* For IPV6 do the cheaper port and family tests first. */
-		if(TCP_IPV6_MATCH(sk, saddr, daddr, ports, dif))
-			goto hit; /* You sunk my battleship! */
+		if(TCP_IPV6_MATCH(sk, saddr, daddr, ports, dif)) {
+			/* You sunk my battleship! */
+			sock_hold(sk);
+			if (unlikely(!TCP_IPV6_MATCH(sk, saddr, daddr,
+						     ports, dif))) {
+				sock_put(sk);
+				goto begin;
+			}
+			goto out;
+		}
 	}
 	/* Must check for a TIME_WAIT'er before going to listener hash. */
-	sk_for_each(sk, node, &(head + tcp_ehash_size)->chain) {
+	sk_for_each_rcu(sk, node, &(head + tcp_ehash_size)->chain) {
 		/* FIXME: acme: check this... */
 		struct tcp_tw_bucket *tw = (struct tcp_tw_bucket *)sk;
 
@@ -323,16 +353,24 @@ static inline struct sock *__tcp_v6_lookup_established(struct in6_addr *saddr, u
 		   sk->sk_family		== PF_INET6) {
 			if(ipv6_addr_equal(&tw->tw_v6_daddr, saddr)	&&
 			   ipv6_addr_equal(&tw->tw_v6_rcv_saddr, daddr)	&&
-			   (!sk->sk_bound_dev_if || sk->sk_bound_dev_if == dif))
-				goto hit;
+			   (!sk->sk_bound_dev_if || sk->sk_bound_dev_if == dif)) {
+				sock_hold(sk);
+				goto out;
+			}
 		}
 	}
-	read_unlock(&head->lock);
-	return NULL;
 
-hit:
-	sock_hold(sk);
-	read_unlock(&head->lock);
+	/* See __tcp_v4_lookup_established(). */
+	if (!locked) {
+		locked = 1;
+		spin_lock(&head->lock);
+		goto begin;
+	}
+	sk = NULL;
+out:
+	if (locked)
+		spin_unlock(&head->lock);
+	rcu_read_unlock();
 	return sk;
 }
 
@@ -348,7 +386,7 @@ static inline struct sock *__tcp_v6_lookup(struct in6_addr *saddr, u16 sport,
 	if (sk)
 		return sk;
 
-	return tcp_v6_lookup_listener(daddr, hnum, dif);
+	return tcp_v6_lookup_listener(saddr, sport, daddr, hnum, dif);
 }
 
 inline struct sock *tcp_v6_lookup(struct in6_addr *saddr, u16 sport,
@@ -456,7 +494,7 @@ static int __tcp_v6_check_established(struct sock *sk, __u16 lport,
 	struct hlist_node *node;
 	struct tcp_tw_bucket *tw;
 
-	write_lock(&head->lock);
+	spin_lock(&head->lock);
 
 	/* Check TIME-WAIT sockets first. */
 	sk_for_each(sk2, node, &(head + tcp_ehash_size)->chain) {
@@ -495,10 +533,9 @@ static int __tcp_v6_check_established(struct sock *sk, __u16 lport,
 
 unique:
 	BUG_TRAP(sk_unhashed(sk));
-	__sk_add_node(sk, &head->chain);
 	sk->sk_hashent = hash;
-	sock_prot_inc_use(sk->sk_prot);
-	write_unlock(&head->lock);
+	__tcp_ehash_add(sk, &head->chain);
+	spin_unlock(&head->lock);
 
 	if (twp) {
 		*twp = tw;
@@ -513,7 +550,7 @@ unique:
 	return 0;
 
 not_unique:
-	write_unlock(&head->lock);
+	spin_unlock(&head->lock);
 	return -EADDRNOTAVAIL;
 }
 
@@ -788,6 +825,7 @@ static int tcp_v6_connect(struct sock *sk, struct sockaddr *uaddr,
 	inet->dport = usin->sin6_port;
 
 	tcp_set_state(sk, TCP_SYN_SENT);
+	tcp_ehash_sync(sk);
 	err = tcp_v6_hash_connect(sk);
 	if (err)
 		goto late_failure;
@@ -1750,6 +1788,7 @@ process:
 	if (sk_filter(sk, skb, 0))
 		goto discard_and_relse;
 
+	sk_mark_busy_poll(sk, skb);
 	skb->dev = NULL;
 
 	bh_lock_sock(sk);
@@ -1806,7 +1845,9 @@ do_time_wait:
 	{
 		struct sock *sk2;
 
-		sk2 = tcp_v6_lookup_listener(&skb->nh.ipv6h->daddr, ntohs(th->dest), tcp_v6_iif(skb));
+		sk2 = tcp_v6_lookup_listener(&skb->nh.ipv6h->saddr, th->source,
+					     &skb->nh.ipv6h->daddr,
+					     ntohs(th->dest), tcp_v6_iif(skb));
 		if (sk2 != NULL) {
 			tcp_tw_deschedule((struct tcp_tw_bucket *)sk);
 			tcp_tw_put((struct tcp_tw_bucket *)sk);
@@ -2021,6 +2062,7 @@ static int tcp_v6_init_sock(struct sock *sk)
 	tp->mss_cache_std = tp->mss_cache = 536;
 
 	tp->reordering = sysctl_tcp_reordering;
+	tp->ca_ops = &tcp_init_congestion_ops;
 
 	sk->sk_state = TCP_CLOSE;
 
@@ -2224,6 +2266,7 @@ struct proto tcpv6_prot = {
 	.sendmsg		= tcp_sendmsg,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v6_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= tcp_v6_hash,
 	.unhash			= tcp_unhash,
 	.get_port		= tcp_v6_get_port,
@@ -165,7 +165,20 @@ struct packet_mclist
 };
 #endif
 #ifdef CONFIG_PACKET_MMAP
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing);
+static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+			   int closing, int tx_ring);
+
+struct packet_ring_buffer {
+	char *			*pg_vec;
+	unsigned int		head;
+	unsigned int            frames_per_block;
+	unsigned int		frame_size;
+	unsigned int		frame_max;
+
+	unsigned int            pg_vec_order;
+	unsigned int		pg_vec_pages;
+	unsigned int		pg_vec_len;
+};
 #endif
 
 static void packet_flush_mclist(struct sock *sk);
@@ -175,11 +188,8 @@ struct packet_sock {
 	struct sock		sk;
 	struct tpacket_stats	stats;
 #ifdef CONFIG_PACKET_MMAP
-	char *			*pg_vec;
-	unsigned int		head;
-	unsigned int            frames_per_block;
-	unsigned int		frame_size;
-	unsigned int		frame_max;
+	struct packet_ring_buffer	rx_ring;
+	struct packet_ring_buffer	tx_ring;
 	int			copy_thresh;
 #endif
 	struct packet_type	prot_hook;
@@ -192,26 +202,42 @@ struct packet_sock {
 #endif
 #ifdef CONFIG_PACKET_MMAP
 	atomic_t		mapped;
-	unsigned int            pg_vec_order;
-	unsigned int		pg_vec_pages;
-	unsigned int		pg_vec_len;
 #endif
 };
 
 #ifdef CONFIG_PACKET_MMAP
 
-static inline char *packet_lookup_frame(struct packet_sock *po, unsigned int position)
+static inline char *packet_lookup_frame(struct packet_ring_buffer *rb,
+					unsigned int position)
 {
 	unsigned int pg_vec_pos, frame_offset;
 	char *frame;
 
-	pg_vec_pos = position / po->frames_per_block;
-	frame_offset = position % po->frames_per_block;
+	pg_vec_pos = position / rb->frames_per_block;
+	frame_offset = position % rb->frames_per_block;
 
-	frame = po->pg_vec[pg_vec_pos] + (frame_offset * po->frame_size);
+	frame = rb->pg_vec[pg_vec_pos] + (frame_offset * rb->frame_size);
 	
 	return frame;
 }
+
+static inline void packet_increment_head(struct packet_ring_buffer *rb)
+{
+	rb->head = rb->head != rb->frame_max ? rb->head+1 : 0;
+}
+
+/* Make the [start, start + len) part of a frame coherent with userspace */
+static void packet_flush_frame(void *start, unsigned int len)
+{
+	struct page *p_start, *p_end;
+
+	p_start = virt_to_page(start);
+	p_end = virt_to_page((u8 *)start + len - 1);
+	while (p_start <= p_end) {
+		flush_dcache_page(p_start);
+		p_start++;
+	}
+}
 #endif
 
 static inline struct packet_sock *pkt_sk(struct sock *sk)
@@ -420,7 +446,7 @@ static inline unsigned run_filter(struct sk_buff *skb, struct sock *sk, unsigned
 	 * verify that under bh_lock_sock() to be safe
 	 */
 	if (likely(filter != NULL))
-		res = sk_run_filter(skb, filter->insns, filter->len);
+		res = sk_filter_run(skb, filter);
 	bh_unlock_sock(sk);
 
 	return res;
@@ -588,7 +614,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,  struct pack
 		macoff = netoff - maclen;
 	}
 
-	if (macoff + snaplen > po->frame_size) {
+	if (macoff + snaplen > po->rx_ring.frame_size) {
 		if (po->copy_thresh &&
 		    atomic_read(&sk->sk_rmem_alloc) + skb->truesize <
 		    (unsigned)sk->sk_rcvbuf) {
@@ -601,7 +627,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,  struct pack
 			if (copy_skb)
 				skb_set_owner_r(copy_skb, sk);
 		}
-		snaplen = po->frame_size - macoff;
+		snaplen = po->rx_ring.frame_size - macoff;
 		if ((int)snaplen < 0)
 			snaplen = 0;
 	}
@@ -609,11 +635,12 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,  struct pack
 		snaplen = skb->len-skb->data_len;
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h = (struct tpacket_hdr *)packet_lookup_frame(po, po->head);
+	h = (struct tpacket_hdr *)packet_lookup_frame(&po->rx_ring,
+						      po->rx_ring.head);
 	
 	if (h->tp_status)
 		goto ring_is_full;
-	po->head = po->head != po->frame_max ? po->head+1 : 0;
+	packet_increment_head(&po->rx_ring);
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -649,17 +676,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,  struct pack
 	h->tp_status = status;
 	mb();
 
-	{
-		struct page *p_start, *p_end;
-		u8 *h_end = (u8 *)h + macoff + snaplen - 1;
-
-		p_start = virt_to_page(h);
-		p_end = virt_to_page(h_end);
-		while (p_start <= p_end) {
-			flush_dcache_page(p_start);
-			p_start++;
-		}
-	}
+	packet_flush_frame(h, macoff + snaplen);
 
 	sk->sk_data_ready(sk, 0);
 
@@ -682,6 +699,133 @@ ring_is_full:
 	goto drop_n_restore;
 }
 
+static inline void tpacket_set_status(struct tpacket_hdr *h,
+				      unsigned long status)
+{
+	h->tp_status = status;
+	mb();
+	packet_flush_frame(h, sizeof(*h));
+}
+
+/*
+ * Send every frame of the tx ring that userspace marked
+ * TP_STATUS_SEND_REQUEST, starting at the ring head and stopping at the
+ * first frame that isn't.  Each frame gets TP_STATUS_AVAILABLE back once
+ * it has been handed to the device, TP_STATUS_WRONG_FORMAT if it can't
+ * be sent.  Returns the bytes sent, or an error if nothing was.
+ */
+static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
+{
+	struct sock *sk = &po->sk;
+	struct packet_ring_buffer *rb = &po->tx_ring;
+	struct sockaddr_ll *saddr=(struct sockaddr_ll *)msg->msg_name;
+	struct tpacket_hdr *h;
+	struct sk_buff *skb;
+	struct net_device *dev;
+	unsigned short proto;
+	unsigned char *addr;
+	unsigned int size_max, tp_len, frames;
+	int ifindex, err, reserve = 0, len_sum = 0;
+
+	if (saddr == NULL) {
+		ifindex	= po->ifindex;
+		proto	= po->num;
+		addr	= NULL;
+	} else {
+		if (msg->msg_namelen < sizeof(struct sockaddr_ll))
+			return -EINVAL;
+		ifindex	= saddr->sll_ifindex;
+		proto	= saddr->sll_protocol;
+		addr	= saddr->sll_addr;
+	}
+
+	dev = dev_get_by_index(ifindex);
+	if (dev == NULL)
+		return -ENXIO;
+	if (sk->sk_type == SOCK_RAW)
+		reserve = dev->hard_header_len;
+
+	/* keeps packet_set_ring() from swapping the ring under us */
+	lock_sock(sk);
+
+	err = -ENETDOWN;
+	if (!(dev->flags & IFF_UP))
+		goto out;
+	err = -EINVAL;
+	if (!rb->pg_vec)
+		goto out;
+
+	size_max = rb->frame_size - TPACKET_ALIGN(sizeof(struct tpacket_hdr));
+	if (size_max > dev->mtu + reserve)
+		size_max = dev->mtu + reserve;
+
+	err = 0;
+	for (frames = 0; frames <= rb->frame_max; frames++) {
+		h = (struct tpacket_hdr *)packet_lookup_frame(rb, rb->head);
+		packet_flush_frame(h, sizeof(*h));
+		if (h->tp_status != TP_STATUS_SEND_REQUEST)
+			break;
+		/* the frame contents were written before its status */
+		rmb();
+
+		tp_len = h->tp_len;
+		if (tp_len > size_max) {
+			tpacket_set_status(h, TP_STATUS_WRONG_FORMAT);
+			packet_increment_head(rb);
+			continue;
+		}
+
+		skb = sock_alloc_send_skb(sk, tp_len + LL_RESERVED_SPACE(dev),
+					  msg->msg_flags & MSG_DONTWAIT, &err);
+		if (skb == NULL)
+			break;
+
+		skb_reserve(skb, LL_RESERVED_SPACE(dev));
+		skb->nh.raw = skb->data;
+
+		if (dev->hard_header) {
+			int res;
+			res = dev->hard_header(skb, dev, ntohs(proto), addr,
+					       NULL, tp_len);
+			if (sk->sk_type != SOCK_DGRAM) {
+				skb->tail = skb->data;
+				skb->len = 0;
+			} else if (res < 0) {
+				kfree_skb(skb);
+				tpacket_set_status(h, TP_STATUS_WRONG_FORMAT);
+				packet_increment_head(rb);
+				continue;
+			}
+		}
+
+		packet_flush_frame(h, TPACKET_ALIGN(sizeof(*h)) + tp_len);
+		memcpy(skb_put(skb, tp_len),
+		       (u8 *)h + TPACKET_ALIGN(sizeof(*h)), tp_len);
+
+		skb->protocol = proto;
+		skb->dev = dev;
+		skb->priority = sk->sk_priority;
+
+		err = dev_queue_xmit(skb);
+		if (err > 0)
+			err = net_xmit_errno(err);
+		tpacket_set_status(h, TP_STATUS_AVAILABLE);
+		packet_increment_head(rb);
+		if (err)
+			break;
+		len_sum += tp_len;
+
+		cond_resched();
+	}
+
+	if (len_sum)
+		err = len_sum;
+out:
+	release_sock(sk);
+	dev_put(dev);
+	return err;
+}
+
 #endif
 
 
@@ -696,6 +840,11 @@ static int packet_sendmsg(struct kiocb *iocb, struct socket *sock,
 	unsigned char *addr;
 	int ifindex, err, reserve = 0;
 
+#ifdef CONFIG_PACKET_MMAP
+	if (pkt_sk(sk)->tx_ring.pg_vec)
+		return tpacket_snd(pkt_sk(sk), msg);
+#endif
+
 	/*
 	 *	Get and verify the address. 
 	 */
@@ -818,10 +967,14 @@ static int packet_release(struct socket *sock)
 #endif
 
 #ifdef CONFIG_PACKET_MMAP
-	if (po->pg_vec) {
+	{
 		struct tpacket_req req;
 		memset(&req, 0, sizeof(req));
-		packet_set_ring(sk, &req, 1);
+
+		if (po->rx_ring.pg_vec)
+			packet_set_ring(sk, &req, 1, 0);
+		if (po->tx_ring.pg_vec)
+			packet_set_ring(sk, &req, 1, 1);
 	}
 #endif
 
@@ -1320,6 +1473,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 #endif
 #ifdef CONFIG_PACKET_MMAP
 	case PACKET_RX_RING:
+	case PACKET_TX_RING:
 	{
 		struct tpacket_req req;
 
@@ -1327,7 +1481,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 			return -EINVAL;
 		if (copy_from_user(&req,optval,sizeof(req)))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0);
+		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1505,11 +1659,12 @@ static unsigned int packet_poll(struct file * file, struct socket *sock,
 	unsigned int mask = datagram_poll(file, sock, wait);
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
-	if (po->pg_vec) {
-		unsigned last = po->head ? po->head-1 : po->frame_max;
+	if (po->rx_ring.pg_vec) {
+		struct packet_ring_buffer *rb = &po->rx_ring;
+		unsigned last = rb->head ? rb->head-1 : rb->frame_max;
 		struct tpacket_hdr *h;
 
-		h = (struct tpacket_hdr *)packet_lookup_frame(po, last);
+		h = (struct tpacket_hdr *)packet_lookup_frame(rb, last);
 
 		if (h->tp_status)
 			mask |= POLLIN | POLLRDNORM;
@@ -1573,10 +1728,12 @@ static void free_pg_vec(char **pg_vec, unsigned order, unsigned len)
 }
 
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing)
+static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+			   int closing, int tx_ring)
 {
 	char **pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
+	struct packet_ring_buffer *rb = tx_ring ? &po->tx_ring : &po->rx_ring;
 	int was_running, num, order = 0;
 	int err = 0;
 	
@@ -1585,7 +1742,7 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 
 		/* Sanity tests and some calculations */
 
-		if (po->pg_vec)
+		if (rb->pg_vec)
 			return -EBUSY;
 
 		if ((int)req->tp_block_size <= 0)
@@ -1597,10 +1754,10 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 		if (req->tp_frame_size&(TPACKET_ALIGNMENT-1))
 			return -EINVAL;
 
-		po->frames_per_block = req->tp_block_size/req->tp_frame_size;
-		if (po->frames_per_block <= 0)
+		rb->frames_per_block = req->tp_block_size/req->tp_frame_size;
+		if (rb->frames_per_block <= 0)
 			return -EINVAL;
-		if (po->frames_per_block*req->tp_block_nr != req->tp_frame_nr)
+		if (rb->frames_per_block*req->tp_block_nr != req->tp_frame_nr)
 			return -EINVAL;
 		/* OK! */
 
@@ -1633,10 +1790,11 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 			struct tpacket_hdr *header;
 			int k;
 
-			for (k=0; k<po->frames_per_block; k++) {
+			for (k=0; k<rb->frames_per_block; k++) {
 				
 				header = (struct tpacket_hdr*)ptr;
-				header->tp_status = TP_STATUS_KERNEL;
+				header->tp_status = tx_ring ? TP_STATUS_AVAILABLE :
+							      TP_STATUS_KERNEL;
 				ptr += req->tp_frame_size;
 			}
 		}
@@ -1668,18 +1826,20 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 
 		spin_lock_bh(&sk->sk_receive_queue.lock);
-		pg_vec = XC(po->pg_vec, pg_vec);
-		po->frame_max = req->tp_frame_nr-1;
-		po->head = 0;
-		po->frame_size = req->tp_frame_size;
+		pg_vec = XC(rb->pg_vec, pg_vec);
+		rb->frame_max = req->tp_frame_nr-1;
+		rb->head = 0;
+		rb->frame_size = req->tp_frame_size;
 		spin_unlock_bh(&sk->sk_receive_queue.lock);
 
-		order = XC(po->pg_vec_order, order);
-		req->tp_block_nr = XC(po->pg_vec_len, req->tp_block_nr);
+		order = XC(rb->pg_vec_order, order);
+		req->tp_block_nr = XC(rb->pg_vec_len, req->tp_block_nr);
 
-		po->pg_vec_pages = req->tp_block_size/PAGE_SIZE;
-		po->prot_hook.func = po->pg_vec ? tpacket_rcv : packet_rcv;
-		skb_queue_purge(&sk->sk_receive_queue);
+		rb->pg_vec_pages = req->tp_block_size/PAGE_SIZE;
+		if (!tx_ring) {
+			po->prot_hook.func = rb->pg_vec ? tpacket_rcv : packet_rcv;
+			skb_queue_purge(&sk->sk_receive_queue);
+		}
 #undef XC
 		if (atomic_read(&po->mapped))
 			printk(KERN_DEBUG "packet_mmap: vma is busy: %d\n", atomic_read(&po->mapped));
@@ -1707,7 +1867,8 @@ static int packet_mmap(struct file *file, struct socket *sock, struct vm_area_st
 {
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
-	unsigned long size;
+	struct packet_ring_buffer *rb;
+	unsigned long size, expected_size;
 	unsigned long start;
 	int err = -EINVAL;
 	int i;
@@ -1718,21 +1879,31 @@ static int packet_mmap(struct file *file, struct socket *sock, struct vm_area_st
 	size = vma->vm_end - vma->vm_start;
 
 	lock_sock(sk);
-	if (po->pg_vec == NULL)
+
+	/* the rx ring, if any, is mapped first, the tx ring right after it */
+	expected_size = 0;
+	for (rb = &po->rx_ring; rb <= &po->tx_ring; rb++)
+		if (rb->pg_vec)
+			expected_size += rb->pg_vec_len*rb->pg_vec_pages*PAGE_SIZE;
+	if (expected_size == 0)
 		goto out;
-	if (size != po->pg_vec_len*po->pg_vec_pages*PAGE_SIZE)
+	if (size != expected_size)
 		goto out;
 
 	atomic_inc(&po->mapped);
 	start = vma->vm_start;
 	err = -EAGAIN;
-	for (i=0; i<po->pg_vec_len; i++) {
-		if (remap_pfn_range(vma, start,
-				     __pa(po->pg_vec[i]) >> PAGE_SHIFT,
-				     po->pg_vec_pages*PAGE_SIZE,
-				     vma->vm_page_prot))
-			goto out;
-		start += po->pg_vec_pages*PAGE_SIZE;
+	for (rb = &po->rx_ring; rb <= &po->tx_ring; rb++) {
+		if (rb->pg_vec == NULL)
+			continue;
+		for (i=0; i<rb->pg_vec_len; i++) {
+			if (remap_pfn_range(vma, start,
+					     __pa(rb->pg_vec[i]) >> PAGE_SHIFT,
+					     rb->pg_vec_pages*PAGE_SIZE,
+					     vma->vm_page_prot))
+				goto out;
+			start += rb->pg_vec_pages*PAGE_SIZE;
+		}
 	}
 	vma->vm_ops = &packet_mmap_ops;
 	err = 0;
@@ -62,6 +62,7 @@ struct tc_u_knode
 {
 	struct tc_u_knode	*next;
 	u32			handle;
+	struct tc_u_knode	*inext;		/* in the index of ht_up */
 	struct tc_u_hnode	*ht_up;
 	struct tcf_exts		exts;
 #ifdef CONFIG_NET_CLS_IND
@@ -87,9 +88,35 @@ struct tc_u_hnode
 	struct tc_u_common	*tp_c;
 	int			refcnt;
 	unsigned		divisor;
+	int			autoidx;
+	struct tc_u_index	*index;
+#ifdef CONFIG_CLS_U32_PERF
+	u64			lookups;
+	u64			visits;
+#endif
+	struct tc_u_knode	*ht[1];
+};
+
+/* A table without a divisor is one chain of nodes.  With TCA_U32_AUTO
+   it is indexed by the key most of the nodes test: a packet can only
+   match the nodes in the bucket of its value of that key, or those
+   which don't test it, and merging the two lists in handle order tries
+   them in the order the chain would.  The lists are linked by inext,
+   rebuilt under tcf_tree_lock whenever the chain changes. */
+struct tc_u_index
+{
+	int			off;		/* of the key */
+	u32			mask;
+	unsigned		hmask;		/* buckets - 1 */
+	unsigned		indexed;	/* nodes in the buckets */
+	struct tc_u_knode	*wild;		/* nodes without the key */
 	struct tc_u_knode	*ht[1];
 };
 
+#define U32_AUTO_MIN		8	/* nodes with the key worth an index */
+#define U32_AUTO_CANDIDATES	8	/* keys considered */
+#define U32_AUTO_BUCKETS	1024	/* at most */
+
 struct tc_u_common
 {
 	struct tc_u_common	*next;
@@ -113,16 +140,44 @@ static __inline__ unsigned u32_hash_fold(u32 key, struct tc_u32_sel *sel, u8 fsh
 	return h;
 }
 
+static __inline__ unsigned u32_index_hash(struct tc_u_index *ix, u32 v)
+{
+	v ^= v >> 16;
+	v ^= v >> 8;
+	return v & ix->hmask;
+}
+
+/* The node after n: in the chain, or the next of the bucket and wild
+   lists of the index. */
+static __inline__ struct tc_u_knode *
+u32_next(struct tc_u_knode *n, struct tc_u_index *ix,
+	 struct tc_u_knode **cur, struct tc_u_knode **wild)
+{
+	if (ix == NULL)
+		return n->next;
+
+	if (*cur && (*wild == NULL ||
+		     TC_U32_NODE((*cur)->handle) < TC_U32_NODE((*wild)->handle))) {
+		n = *cur;
+		*cur = n->inext;
+	} else if ((n = *wild) != NULL)
+		*wild = n->inext;
+	return n;
+}
+
 static int u32_classify(struct sk_buff *skb, struct tcf_proto *tp, struct tcf_result *res)
 {
 	struct {
 		struct tc_u_knode *knode;
 		u8		  *ptr;
+		struct tc_u_knode *icur, *iwild;
 	} stack[TC_U32_MAXDEPTH];
 
 	struct tc_u_hnode *ht = (struct tc_u_hnode*)tp->root;
 	u8 *ptr = skb->nh.raw;
 	struct tc_u_knode *n;
+	struct tc_u_index *ix;
+	struct tc_u_knode *icur = NULL, *iwild = NULL;
 	int sdepth = 0;
 	int off2 = 0;
 	int sel = 0;
@@ -132,7 +187,15 @@ static int u32_classify(struct sk_buff *skb, struct tcf_proto *tp, struct tcf_re
 	int i, r;
 
 next_ht:
-	n = ht->ht[sel];
+#ifdef CONFIG_CLS_U32_PERF
+	ht->lookups++;
+#endif
+	if ((ix = ht->index) != NULL) {
+		icur = ix->ht[u32_index_hash(ix, *(u32*)(ptr+ix->off) & ix->mask)];
+		iwild = ix->wild;
+		n = u32_next(NULL, ix, &icur, &iwild);
+	} else
+		n = ht->ht[sel];
 
 next_knode:
 	if (n) {
@@ -140,12 +203,13 @@ next_knode:
 
 #ifdef CONFIG_CLS_U32_PERF
 		n->pf->rcnt +=1;
+		ht->visits++;
 		j = 0;
 #endif
 
 #ifdef CONFIG_CLS_U32_MARK
 		if ((skb->nfmark & n->mark.mask) != n->mark.val) {
-			n = n->next;
+			n = u32_next(n, ix, &icur, &iwild);
 			goto next_knode;
 		} else {
 			n->mark.success++;
@@ -155,7 +219,7 @@ next_knode:
 		for (i = n->sel.nkeys; i>0; i--, key++) {
 
 			if ((*(u32*)(ptr+key->off+(off2&key->offmask))^key->val)&key->mask) {
-				n = n->next;
+				n = u32_next(n, ix, &icur, &iwild);
 				goto next_knode;
 			}
 #ifdef CONFIG_CLS_U32_PERF
@@ -170,7 +234,7 @@ check_terminal:
 				*res = n->res;
 #ifdef CONFIG_NET_CLS_IND
 				if (!tcf_match_indev(skb, n->indev)) {
-					n = n->next;
+					n = u32_next(n, ix, &icur, &iwild);
 					goto next_knode;
 				}
 #endif
@@ -179,13 +243,13 @@ check_terminal:
 #endif
 				r = tcf_exts_exec(skb, &n->exts, res);
 				if (r < 0) {
-					n = n->next;
+					n = u32_next(n, ix, &icur, &iwild);
 					goto next_knode;
 				}
 
 				return r;
 			}
-			n = n->next;
+			n = u32_next(n, ix, &icur, &iwild);
 			goto next_knode;
 		}
 
@@ -194,6 +258,8 @@ check_terminal:
 			goto deadloop;
 		stack[sdepth].knode = n;
 		stack[sdepth].ptr = ptr;
+		stack[sdepth].icur = icur;
+		stack[sdepth].iwild = iwild;
 		sdepth++;
 
 		ht = n->ht_down;
@@ -224,6 +290,9 @@ check_terminal:
 		n = stack[sdepth].knode;
 		ht = n->ht_up;
 		ptr = stack[sdepth].ptr;
+		ix = ht->index;
+		icur = stack[sdepth].icur;
+		iwild = stack[sdepth].iwild;
 		goto check_terminal;
 	}
 	return -1;
@@ -354,6 +423,137 @@ static int u32_destroy_key(struct tcf_proto *tp, struct tc_u_knode *n)
 	return 0;
 }
 
+/* The key of n the index would file it under, if it has one. */
+static struct tc_u32_key *
+u32_index_key(struct tc_u_knode *n, int off, u32 mask)
+{
+	struct tc_u32_key *key = n->sel.keys;
+	int i;
+
+	for (i = n->sel.nkeys; i > 0; i--, key++)
+		if (key->off == off && key->mask == mask && !key->offmask)
+			return key;
+	return NULL;
+}
+
+/* Pick the key to index ht by, leaving out the node gone, and allocate
+   an index for it; NULL if no key is common enough to be worth one. */
+static struct tc_u_index *
+u32_index_alloc(struct tc_u_hnode *ht, struct tc_u_knode *gone)
+{
+	struct {
+		int		off;
+		u32		mask;
+		unsigned	count;
+	} cand[U32_AUTO_CANDIDATES];
+	struct tc_u_index *ix;
+	struct tc_u_knode *n;
+	unsigned nodes = 0, size;
+	int i, j, best = 0, ncand = 0;
+
+	for (n = ht->ht[0]; n; n = n->next) {
+		struct tc_u32_key *key = n->sel.keys;
+
+		if (n == gone)
+			continue;
+		nodes++;
+		for (i = n->sel.nkeys; i > 0; i--, key++) {
+			if (key->offmask || !key->mask)
+				continue;
+			for (j = 0; j < ncand; j++)
+				if (cand[j].off == key->off &&
+				    cand[j].mask == key->mask)
+					break;
+			if (j == ncand) {
+				if (ncand == U32_AUTO_CANDIDATES)
+					continue;
+				cand[j].off = key->off;
+				cand[j].mask = key->mask;
+				cand[j].count = 0;
+				ncand++;
+			}
+			cand[j].count++;
+		}
+	}
+
+	for (j = 1; j < ncand; j++)
+		if (cand[j].count > cand[best].count)
+			best = j;
+	if (ncand == 0 || cand[best].count < U32_AUTO_MIN ||
+	    cand[best].count*2 < nodes)
+		return NULL;
+
+	for (size = 1; size < cand[best].count && size < U32_AUTO_BUCKETS; )
+		size <<= 1;
+	ix = kmalloc(sizeof(*ix) + (size-1)*sizeof(void*), GFP_KERNEL);
+	if (ix == NULL)
+		return NULL;
+	memset(ix, 0, sizeof(*ix) + (size-1)*sizeof(void*));
+	ix->off = cand[best].off;
+	ix->mask = cand[best].mask;
+	ix->hmask = size - 1;
+	return ix;
+}
+
+static struct tc_u_knode *u32_index_reverse(struct tc_u_knode *n)
+{
+	struct tc_u_knode *prev = NULL, *next;
+
+	for (; n; n = next) {
+		next = n->inext;
+		n->inext = prev;
+		prev = n;
+	}
+	return prev;
+}
+
+/* File the nodes of ht but gone in ix, keeping every list in handle
+   order.  This relinks inext, so lookups must be locked out. */
+static void u32_index_fill(struct tc_u_index *ix, struct tc_u_hnode *ht,
+			   struct tc_u_knode *gone)
+{
+	struct tc_u_knode *n, **head;
+	struct tc_u32_key *key;
+	unsigned h;
+
+	for (n = ht->ht[0]; n; n = n->next) {
+		if (n == gone)
+			continue;
+		key = u32_index_key(n, ix->off, ix->mask);
+		if (key) {
+			head = &ix->ht[u32_index_hash(ix, key->val & key->mask)];
+			ix->indexed++;
+		} else
+			head = &ix->wild;
+		n->inext = *head;
+		*head = n;
+	}
+
+	for (h = 0; h <= ix->hmask; h++)
+		ix->ht[h] = u32_index_reverse(ix->ht[h]);
+	ix->wild = u32_index_reverse(ix->wild);
+}
+
+/* Rebuild the index of ht after its chain has changed, or is about to
+   lose gone.  Without a key worth indexing, or memory for the index,
+   the table goes back to being walked. */
+static void u32_reindex(struct tcf_proto *tp, struct tc_u_hnode *ht,
+			struct tc_u_knode *gone)
+{
+	struct tc_u_index *ix = NULL;
+
+	if (ht->autoidx && ht->divisor == 0)
+		ix = u32_index_alloc(ht, gone);
+
+	tcf_tree_lock(tp);
+	if (ix)
+		u32_index_fill(ix, ht, gone);
+	ix = xchg(&ht->index, ix);
+	tcf_tree_unlock(tp);
+
+	kfree(ix);
+}
+
 static int u32_delete_key(struct tcf_proto *tp, struct tc_u_knode* key)
 {
 	struct tc_u_knode **kp;
@@ -362,6 +562,8 @@ static int u32_delete_key(struct tcf_proto *tp, struct tc_u_knode* key)
 	if (ht) {
 		for (kp = &ht->ht[TC_U32_HASH(key->handle)]; *kp; kp = &(*kp)->next) {
 			if (*kp == key) {
+				if (ht->index)
+					u32_reindex(tp, ht, key);
 				tcf_tree_lock(tp);
 				*kp = key->next;
 				tcf_tree_unlock(tp);
@@ -380,6 +582,8 @@ static void u32_clear_hnode(struct tcf_proto *tp, struct tc_u_hnode *ht)
 	struct tc_u_knode *n;
 	unsigned h;
 
+	kfree(ht->index);
+	ht->index = NULL;
 	for (h=0; h<=ht->divisor; h++) {
 		while ((n = ht->ht[h]) != NULL) {
 			ht->ht[h] = n->next;
@@ -568,6 +772,8 @@ static int u32_change(struct tcf_proto *tp, unsigned long base, u32 handle,
 			return -EINVAL;
 		if (TC_U32_KEY(handle))
 			return -EINVAL;
+		if (tb[TCA_U32_AUTO-1] && divisor)
+			return -EINVAL;
 		if (handle == 0) {
 			handle = gen_new_htid(tp->data);
 			if (handle == 0)
@@ -580,6 +786,8 @@ static int u32_change(struct tcf_proto *tp, unsigned long base, u32 handle,
 		ht->tp_c = tp_c;
 		ht->refcnt = 0;
 		ht->divisor = divisor;
+		if (tb[TCA_U32_AUTO-1])
+			ht->autoidx = *(u32*)RTA_DATA(tb[TCA_U32_AUTO-1]) != 0;
 		ht->handle = handle;
 		ht->prio = tp->prio;
 		ht->next = tp_c->hlist;
@@ -605,6 +813,8 @@ static int u32_change(struct tcf_proto *tp, unsigned long base, u32 handle,
 
 	if (ht->divisor < TC_U32_HASH(htid))
 		return -EINVAL;
+	if (tb[TCA_U32_AUTO-1] && ht->divisor)
+		return -EINVAL;
 
 	if (handle) {
 		if (TC_U32_HTID(handle) && TC_U32_HTID(handle^htid))
@@ -676,6 +886,11 @@ static int u32_change(struct tcf_proto *tp, unsigned long base, u32 handle,
 		wmb();
 		*ins = n;
 
+		if (tb[TCA_U32_AUTO-1])
+			ht->autoidx = *(u32*)RTA_DATA(tb[TCA_U32_AUTO-1]) != 0;
+		if (ht->autoidx || ht->index)
+			u32_reindex(tp, ht, NULL);
+
 		*arg = (unsigned long)n;
 		return 0;
 	}
@@ -741,7 +956,24 @@ static int u32_dump(struct tcf_proto *tp, unsigned long fh,
 	if (TC_U32_KEY(n->handle) == 0) {
 		struct tc_u_hnode *ht = (struct tc_u_hnode*)fh;
 		u32 divisor = ht->divisor+1;
+		struct tc_u32_hcnt hcnt;
+
 		RTA_PUT(skb, TCA_U32_DIVISOR, 4, &divisor);
+		if (ht->autoidx) {
+			u32 on = 1;
+			RTA_PUT(skb, TCA_U32_AUTO, 4, &on);
+		}
+
+		memset(&hcnt, 0, sizeof(hcnt));
+#ifdef CONFIG_CLS_U32_PERF
+		hcnt.lookups = ht->lookups;
+		hcnt.visits = ht->visits;
+#endif
+		if (ht->index) {
+			hcnt.buckets = ht->index->hmask + 1;
+			hcnt.indexed = ht->index->indexed;
+		}
+		RTA_PUT(skb, TCA_U32_HCNT, sizeof(hcnt), &hcnt);
 	} else {
 		RTA_PUT(skb, TCA_U32_SEL,
 			sizeof(n->sel) + n->sel.nkeys*sizeof(struct tc_u32_key),
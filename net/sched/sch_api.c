@@ -1089,6 +1089,46 @@ static int tc_dump_tclass(struct sk_buff *skb, struct netlink_callback *cb)
 	return skb->len;
 }
 
+/* The watchdog is a CLOCK_MONOTONIC hrtimer, so a throttled qdisc is
+   woken up with the resolution of the hrtimer clock rather than of HZ.
+   Where hrtimers run from the timer softirq that is still a tick, but
+   nothing spins waiting for the qdisc to become due. */
+static int qdisc_watchdog(struct hrtimer *timer)
+{
+	struct qdisc_watchdog *wd = container_of(timer, struct qdisc_watchdog,
+						 timer);
+
+	wd->qdisc->flags &= ~TCQ_F_THROTTLED;
+	netif_schedule(wd->qdisc->dev);
+	return HRTIMER_NORESTART;
+}
+
+void qdisc_watchdog_init(struct qdisc_watchdog *wd, struct Qdisc *qdisc)
+{
+	hrtimer_init(&wd->timer, CLOCK_MONOTONIC, HRTIMER_REL);
+	wd->timer.function = qdisc_watchdog;
+	wd->qdisc = qdisc;
+}
+
+/* delay is in psched clock units, PSCHED_JIFFIE2US(1) of them to a tick */
+void qdisc_watchdog_schedule(struct qdisc_watchdog *wd, psched_tdiff_t delay)
+{
+	u64 ns;
+
+	if (delay <= 0)
+		delay = 1;
+	ns = (u64)delay * TICK_NSEC;
+	do_div(ns, PSCHED_JIFFIE2US(1));
+	hrtimer_start(&wd->timer, ktime_add_ns(ktime_set(0, 0), ns),
+		      HRTIMER_REL);
+}
+
+void qdisc_watchdog_cancel(struct qdisc_watchdog *wd)
+{
+	hrtimer_cancel(&wd->timer);
+	wd->qdisc->flags &= ~TCQ_F_THROTTLED;
+}
+
 /* Main classifier routine: scans classifier chain attached
    to this qdisc, (optionally) tests for protocol and asks
    specific classifiers.
@@ -1267,3 +1307,6 @@ EXPORT_SYMBOL(qdisc_put_rtab);
 EXPORT_SYMBOL(register_qdisc);
 EXPORT_SYMBOL(unregister_qdisc);
 EXPORT_SYMBOL(tc_classify);
+EXPORT_SYMBOL(qdisc_watchdog_init);
+EXPORT_SYMBOL(qdisc_watchdog_schedule);
+EXPORT_SYMBOL(qdisc_watchdog_cancel);
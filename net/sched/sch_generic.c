@@ -182,6 +182,87 @@ requeue:
 	return q->q.qlen;
 }
 
+/* qdisc_restart() for the transmit queue @txq of a multiqueue device.
+   NOTE: Called under txq->lock with locally disabled BH.
+ */
+
+int subqueue_restart(struct netdev_queue *txq)
+{
+	struct net_device *dev = txq->dev;
+	struct Qdisc *q = txq->qdisc;
+	struct sk_buff *skb;
+	unsigned nolock;
+
+	if ((skb = q->dequeue(q)) == NULL)
+		return q->q.qlen;
+
+	nolock = (dev->features & NETIF_F_LLTX);
+	if (!nolock) {
+		if (!spin_trylock(&txq->xmit_lock)) {
+		collision:
+			if (txq->xmit_lock_owner == smp_processor_id()) {
+				kfree_skb(skb);
+				if (net_ratelimit())
+					printk(KERN_DEBUG "Dead loop on netdevice %s, fix it urgently!\n", dev->name);
+				return -1;
+			}
+			__get_cpu_var(netdev_rx_stat).cpu_collision++;
+			goto requeue;
+		}
+		txq->xmit_lock_owner = smp_processor_id();
+	}
+
+	spin_unlock(&txq->lock);
+
+	if (!test_bit(__QUEUE_STATE_XOFF, &txq->state)) {
+		int ret;
+
+		if (netdev_nit)
+			dev_queue_xmit_nit(skb, dev);
+
+		ret = dev->hard_start_xmit(skb, dev);
+		if (ret == NETDEV_TX_OK) {
+			if (!nolock) {
+				txq->xmit_lock_owner = -1;
+				spin_unlock(&txq->xmit_lock);
+			}
+			spin_lock(&txq->lock);
+			return -1;
+		}
+		if (ret == NETDEV_TX_LOCKED && nolock) {
+			spin_lock(&txq->lock);
+			goto collision;
+		}
+	}
+
+	/* NETDEV_TX_BUSY - we need to requeue */
+	if (!nolock) {
+		txq->xmit_lock_owner = -1;
+		spin_unlock(&txq->xmit_lock);
+	}
+	spin_lock(&txq->lock);
+	q = txq->qdisc;
+
+requeue:
+	q->ops->requeue(skb, q);
+	netif_schedule_subqueue(txq);
+	return 1;
+}
+
+/* Is any transmit queue of the device stopped? */
+static int dev_tx_stopped(struct net_device *dev)
+{
+	unsigned int i;
+
+	if (netif_queue_stopped(dev))
+		return 1;
+	for (i = 1; i < dev->num_tx_queues; i++)
+		if (test_bit(__QUEUE_STATE_XOFF,
+			     &netdev_get_tx_queue(dev, i)->state))
+			return 1;
+	return 0;
+}
+
 static void dev_watchdog(unsigned long arg)
 {
 	struct net_device *dev = (struct net_device *)arg;
@@ -191,7 +272,7 @@ static void dev_watchdog(unsigned long arg)
 		if (netif_device_present(dev) &&
 		    netif_running(dev) &&
 		    netif_carrier_ok(dev)) {
-			if (netif_queue_stopped(dev) &&
+			if (dev_tx_stopped(dev) &&
 			    (jiffies - dev->trans_start) > dev->watchdog_timeo) {
 				printk(KERN_INFO "NETDEV WATCHDOG: %s: transmit timed out\n", dev->name);
 				dev->tx_timeout(dev);
@@ -512,6 +593,63 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	call_rcu(&qdisc->q_rcu, __qdisc_destroy);
 }
 
+/* Give every extra transmit queue of a multiqueue device a pfifo_fast */
+static void dev_activate_subqueues(struct net_device *dev)
+{
+	unsigned int i;
+
+	for (i = 1; i < dev->num_tx_queues; i++) {
+		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
+
+		if (txq->qdisc_sleeping == &noop_qdisc) {
+			struct Qdisc *qdisc;
+
+			qdisc = qdisc_create_dflt(dev, &pfifo_fast_ops);
+			if (qdisc == NULL) {
+				printk(KERN_INFO "%s: activation of tx queue %u failed\n",
+				       dev->name, i);
+				continue;
+			}
+			txq->qdisc_sleeping = qdisc;
+		}
+
+		spin_lock_bh(&txq->lock);
+		rcu_assign_pointer(txq->qdisc, txq->qdisc_sleeping);
+		spin_unlock_bh(&txq->lock);
+	}
+}
+
+static void dev_deactivate_subqueues(struct net_device *dev)
+{
+	unsigned int i;
+
+	for (i = 1; i < dev->num_tx_queues; i++) {
+		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
+		struct Qdisc *qdisc;
+
+		spin_lock_bh(&txq->lock);
+		qdisc = txq->qdisc;
+		txq->qdisc = &noop_qdisc;
+		qdisc_reset(qdisc);
+		spin_unlock_bh(&txq->lock);
+	}
+}
+
+/* Wait for whoever is still transmitting on the extra queues */
+static void dev_sync_subqueues(struct net_device *dev)
+{
+	unsigned int i;
+
+	for (i = 1; i < dev->num_tx_queues; i++) {
+		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
+
+		while (test_bit(__QUEUE_STATE_SCHED, &txq->state))
+			yield();
+
+		spin_unlock_wait(&txq->xmit_lock);
+	}
+}
+
 void dev_activate(struct net_device *dev)
 {
 	/* No queueing discipline is attached to device;
@@ -528,6 +666,7 @@ void dev_activate(struct net_device *dev)
 				printk(KERN_INFO "%s: activation failed\n", dev->name);
 				return;
 			}
+			qdisc->flags |= TCQ_F_DEFAULT;
 			write_lock_bh(&qdisc_tree_lock);
 			list_add_tail(&qdisc->list, &dev->qdisc_list);
 			write_unlock_bh(&qdisc_tree_lock);
@@ -539,6 +678,9 @@ void dev_activate(struct net_device *dev)
 		write_unlock_bh(&qdisc_tree_lock);
 	}
 
+	if (dev->tx_queue_len)
+		dev_activate_subqueues(dev);
+
 	spin_lock_bh(&dev->queue_lock);
 	rcu_assign_pointer(dev->qdisc, dev->qdisc_sleeping);
 	if (dev->qdisc != &noqueue_qdisc) {
@@ -560,20 +702,32 @@ void dev_deactivate(struct net_device *dev)
 
 	spin_unlock_bh(&dev->queue_lock);
 
+	dev_deactivate_subqueues(dev);
+
 	dev_watchdog_down(dev);
 
 	while (test_bit(__LINK_STATE_SCHED, &dev->state))
 		yield();
 
 	spin_unlock_wait(&dev->xmit_lock);
+
+	dev_sync_subqueues(dev);
 }
 
 void dev_init_scheduler(struct net_device *dev)
 {
+	unsigned int i;
+
 	qdisc_lock_tree(dev);
 	dev->qdisc = &noop_qdisc;
 	dev->qdisc_sleeping = &noop_qdisc;
 	INIT_LIST_HEAD(&dev->qdisc_list);
+	for (i = 1; i < dev->num_tx_queues; i++) {
+		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
+
+		txq->qdisc = &noop_qdisc;
+		txq->qdisc_sleeping = &noop_qdisc;
+	}
 	qdisc_unlock_tree(dev);
 
 	dev_watchdog_init(dev);
@@ -582,12 +736,21 @@ void dev_init_scheduler(struct net_device *dev)
 void dev_shutdown(struct net_device *dev)
 {
 	struct Qdisc *qdisc;
+	unsigned int i;
 
 	qdisc_lock_tree(dev);
 	qdisc = dev->qdisc_sleeping;
 	dev->qdisc = &noop_qdisc;
 	dev->qdisc_sleeping = &noop_qdisc;
 	qdisc_destroy(qdisc);
+	for (i = 1; i < dev->num_tx_queues; i++) {
+		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
+
+		qdisc = txq->qdisc_sleeping;
+		txq->qdisc = &noop_qdisc;
+		txq->qdisc_sleeping = &noop_qdisc;
+		qdisc_destroy(qdisc);
+	}
 #if defined(CONFIG_NET_SCH_INGRESS) || defined(CONFIG_NET_SCH_INGRESS_MODULE)
         if ((qdisc = dev->qdisc_ingress) != NULL) {
 		dev->qdisc_ingress = NULL;
@@ -605,5 +768,6 @@ EXPORT_SYMBOL(qdisc_create_dflt);
 EXPORT_SYMBOL(qdisc_destroy);
 EXPORT_SYMBOL(qdisc_reset);
 EXPORT_SYMBOL(qdisc_restart);
+EXPORT_SYMBOL(subqueue_restart);
 EXPORT_SYMBOL(qdisc_lock_tree);
 EXPORT_SYMBOL(qdisc_unlock_tree);
@@ -169,6 +169,8 @@ struct htb_class
 		    int quantum;
 		    int deficit[TC_HTB_MAXDEPTH];
 		    struct list_head drop_list;
+		    /* sent on own rate, not yet charged to ancestors */
+		    int charge_bytes, charge_pkts;
 	    } leaf;
 	    struct htb_class_inner {
 		    struct rb_root feed[TC_HTB_NUMPRIO]; /* feed trees */
@@ -214,6 +216,15 @@ static __inline__ long L2T(struct htb_class *cl,struct qdisc_rate_table *rate,
     return rate->data[slot];
 }
 
+/* the same for pkts packets of bytes in all, charged together */
+static __inline__ long L2T_N(struct htb_class *cl,
+	struct qdisc_rate_table *rate, int bytes, int pkts)
+{
+    if (pkts == 1)
+	return L2T(cl, rate, bytes);
+    return pkts * L2T(cl, rate, bytes / pkts);
+}
+
 struct htb_sched
 {
     struct list_head root;			/* root classes list */
@@ -246,6 +257,7 @@ struct htb_sched
     int filter_cnt;
 
     int rate2quantum;		/* quant = rate / rate2quantum */
+    u32 charge_batch;		/* see htb_charge_class, 0 = off */
     psched_time_t now;		/* cached dequeue time */
     struct timer_list timer;	/* send delay timer */
 #ifdef HTB_RATECM
@@ -810,18 +822,19 @@ static void htb_rate_timer(unsigned long arg)
 #endif
 
 /**
- * htb_charge_class - charges amount "bytes" to leaf and ancestors
+ * __htb_charge_class - charges amount "bytes" to class and ancestors
  *
- * Routine assumes that packet "bytes" long was dequeued from leaf cl
- * borrowing from "level". It accounts bytes to ceil leaky bucket for
- * leaf and all ancestors and to rate bucket for ancestors at levels
- * "level" and higher. It also handles possible change of mode resulting
- * from the update. Note that mode can also increase here (MAY_BORROW to
- * CAN_SEND) because we can use more precise clock that event queue here.
- * In such case we remove class from event queue first.
+ * Routine assumes that "pkts" packets "bytes" long in all were dequeued
+ * from leaf below cl borrowing from "level". It accounts bytes to ceil
+ * leaky bucket for cl and all ancestors up to (not including) "stop" and
+ * to rate bucket for ancestors at levels "level" and higher. It also
+ * handles possible change of mode resulting from the update. Note that
+ * mode can also increase here (MAY_BORROW to CAN_SEND) because we can use
+ * more precise clock that event queue here. In such case we remove class
+ * from event queue first.
  */
-static void htb_charge_class(struct htb_sched *q,struct htb_class *cl,
-		int level,int bytes)
+static void __htb_charge_class(struct htb_sched *q,struct htb_class *cl,
+		struct htb_class *stop,int level,int bytes,int pkts)
 {	
 	long toks,diff;
 	enum htb_cmode old_mode;
@@ -829,11 +842,11 @@ static void htb_charge_class(struct htb_sched *q,struct htb_class *cl,
 
 #define HTB_ACCNT(T,B,R) toks = diff + cl->T; \
 	if (toks > cl->B) toks = cl->B; \
-	toks -= L2T(cl, cl->R, bytes); \
+	toks -= L2T_N(cl, cl->R, bytes, pkts); \
 	if (toks <= -cl->mbuffer) toks = 1-cl->mbuffer; \
 	cl->T = toks
 
-	while (cl) {
+	while (cl != stop) {
 		HTB_CHCL(cl);
 		diff = PSCHED_TDIFF_SAFE(q->now, cl->t_c, (u32)cl->mbuffer);
 #ifdef HTB_DEBUG
@@ -874,18 +887,58 @@ static void htb_charge_class(struct htb_sched *q,struct htb_class *cl,
 		
 #ifdef HTB_RATECM
 		/* update rate counters */
-		cl->sum_bytes += bytes; cl->sum_packets++;
+		cl->sum_bytes += bytes; cl->sum_packets += pkts;
 #endif
 
 		/* update byte stats except for leaves which are already updated */
 		if (cl->level) {
 			cl->bstats.bytes += bytes;
-			cl->bstats.packets++;
+			cl->bstats.packets += pkts;
 		}
 		cl = cl->parent;
 	}
 }
 
+/* charge ancestors of leaf cl with what it has sent on its own rate */
+static void htb_flush_charge(struct htb_sched *q,struct htb_class *cl)
+{
+	if (cl->un.leaf.charge_pkts && cl->parent)
+		__htb_charge_class(q,cl->parent,NULL,0,
+				cl->un.leaf.charge_bytes,cl->un.leaf.charge_pkts);
+	cl->un.leaf.charge_bytes = cl->un.leaf.charge_pkts = 0;
+}
+
+/**
+ * htb_charge_class - charges packet "bytes" long dequeued from leaf cl
+ *
+ * With q->charge_batch set, the walk up the tree is not done for every
+ * packet a leaf sends on its own rate (level 0): the leaf pays at once,
+ * but its ancestors are charged when charge_batch bytes have built up,
+ * when it borrows, or when it runs empty.  Ancestors' buckets lag by up
+ * to charge_batch bytes per leaf, so siblings may borrow that much too
+ * much; in exchange a deep tree costs one walk per batch.
+ */
+static void htb_charge_class(struct htb_sched *q,struct htb_class *cl,
+		int level,int bytes)
+{
+	if (!q->charge_batch) {
+		__htb_charge_class(q,cl,NULL,level,bytes,1);
+		return;
+	}
+	__htb_charge_class(q,cl,cl->parent,level,bytes,1);
+	if (!level) {
+		cl->un.leaf.charge_bytes += bytes;
+		cl->un.leaf.charge_pkts++;
+		if (cl->un.leaf.charge_bytes < q->charge_batch &&
+				cl->un.leaf.q->q.qlen)
+			return;
+		bytes = 0;
+	}
+	htb_flush_charge(q,cl);
+	if (bytes && cl->parent)
+		__htb_charge_class(q,cl->parent,NULL,level,bytes,1);
+}
+
 /**
  * htb_do_events - make mode changes to classes at the level
  *
@@ -1207,6 +1260,8 @@ static void htb_reset(struct Qdisc* sch)
 				if (cl->un.leaf.q) 
 					qdisc_reset(cl->un.leaf.q);
 				INIT_LIST_HEAD(&cl->un.leaf.drop_list);
+				cl->un.leaf.charge_bytes = 0;
+				cl->un.leaf.charge_pkts = 0;
 			}
 			cl->prio_activity = 0;
 			cl->cmode = HTB_CAN_SEND;
@@ -1232,14 +1287,14 @@ static void htb_reset(struct Qdisc* sch)
 static int htb_init(struct Qdisc *sch, struct rtattr *opt)
 {
 	struct htb_sched *q = qdisc_priv(sch);
-	struct rtattr *tb[TCA_HTB_INIT];
+	struct rtattr *tb[TCA_HTB_MAX];
 	struct tc_htb_glob *gopt;
 	int i;
 #ifdef HTB_DEBUG
 	printk(KERN_INFO "HTB init, kernel part version %d.%d\n",
 			  HTB_VER >> 16,HTB_VER & 0xffff);
 #endif
-	if (!opt || rtattr_parse_nested(tb, TCA_HTB_INIT, opt) ||
+	if (!opt || rtattr_parse_nested(tb, TCA_HTB_MAX, opt) ||
 			tb[TCA_HTB_INIT-1] == NULL ||
 			RTA_PAYLOAD(tb[TCA_HTB_INIT-1]) < sizeof(*gopt)) {
 		printk(KERN_ERR "HTB: hey probably you have bad tc tool ?\n");
@@ -1279,6 +1334,9 @@ static int htb_init(struct Qdisc *sch, struct rtattr *opt)
 	if ((q->rate2quantum = gopt->rate2quantum) < 1)
 		q->rate2quantum = 1;
 	q->defcls = gopt->defcls;
+	if (tb[TCA_HTB_BATCH-1] &&
+			RTA_PAYLOAD(tb[TCA_HTB_BATCH-1]) >= sizeof(u32))
+		q->charge_batch = *(u32*)RTA_DATA(tb[TCA_HTB_BATCH-1]);
 
 	return 0;
 }
@@ -1304,6 +1362,9 @@ static int htb_dump(struct Qdisc *sch, struct sk_buff *skb)
 	rta = (struct rtattr*)b;
 	RTA_PUT(skb, TCA_OPTIONS, 0, NULL);
 	RTA_PUT(skb, TCA_HTB_INIT, sizeof(gopt), &gopt);
+	if (q->charge_batch)
+		RTA_PUT(skb, TCA_HTB_BATCH, sizeof(q->charge_batch),
+				&q->charge_batch);
 	rta->rta_len = skb->tail - b;
 	HTB_QUNLOCK(sch);
 	return skb->len;
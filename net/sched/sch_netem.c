@@ -22,6 +22,7 @@
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>
 #include <linux/rtnetlink.h>
+#include <linux/rbtree.h>
 
 #include <net/pkt_sched.h>
 
@@ -43,18 +44,24 @@
 	 duplication, and reordering can also be emulated.
 
 	 This qdisc does not do classification that can be handled in
-	 layering other disciplines.  It does not need to do bandwidth
-	 control either since that can be handled by using token
-	 bucket or other rate control.
-
-	 The simulator is limited by the Linux timer resolution
-	 and will create packet bursts on the HZ boundary (1ms).
+	 layering other disciplines.  Bandwidth control can be handled
+	 by token bucket or other rate control, but a link of a given
+	 rate can be emulated here too: packets then leave one after
+	 the other, each taking its length (plus a per packet overhead,
+	 for framing) at that rate, before they are delayed.
+
+	 Delayed packets are kept in a tree sorted by the time they are
+	 due, so jitter reorders them as it would on a real path.  Their
+	 resolution is that of the packet scheduler clock and of the
+	 hrtimer behind the watchdog.  With the jiffies clock, packets
+	 are still sent in bursts on the HZ boundary.
 */
 
 struct netem_sched_data {
 	struct Qdisc	*qdisc;
-	struct sk_buff_head delayed;
-	struct timer_list timer;
+	struct rb_root	delayed;
+	unsigned int	delayed_qlen;
+	struct qdisc_watchdog watchdog;
 
 	u32 latency;
 	u32 loss;
@@ -63,6 +70,9 @@ struct netem_sched_data {
 	u32 gap;
 	u32 jitter;
 	u32 duplicate;
+	u32 rate;
+	s32 packet_overhead;
+	psched_time_t link_free;	/* when the emulated link is idle */
 
 	struct crndstate {
 		unsigned long last;
@@ -75,11 +85,19 @@ struct netem_sched_data {
 	} *delay_dist;
 };
 
-/* Time stamp put into socket buffer control block */
+/* Time stamp put into socket buffer control block, and the node of
+   the packet in the delayed tree */
 struct netem_skb_cb {
 	psched_time_t	time_to_send;
+	struct rb_node	node;
 };
 
+static inline struct sk_buff *netem_node_skb(struct rb_node *p)
+{
+	return (struct sk_buff *)((char *)rb_entry(p, struct netem_skb_cb, node)
+				  - offsetof(struct sk_buff, cb));
+}
+
 /* init_crandom - initialize correlated random number generator
  * Use entropy source for initial seed.
  */
@@ -137,34 +155,64 @@ static long tabledist(unsigned long mu, long sigma,
 	return  x / NETEM_DIST_SCALE + (sigma / NETEM_DIST_SCALE) * t + mu;
 }
 
-/* Put skb in the private delayed queue. */
+/* Time the emulated link takes to send len bytes. */
+static psched_tdiff_t netem_txtime(const struct netem_sched_data *q,
+				   unsigned int len)
+{
+	long bytes = (long)len + q->packet_overhead;
+	u64 t;
+
+	if (bytes <= 0)
+		return 0;
+	t = (u64)bytes * PSCHED_JIFFIE2US(HZ);
+	do_div(t, q->rate);
+	return t;
+}
+
+/* Put skb in the private delayed queue, after the packets due no later
+   than it. */
 static int delay_skb(struct Qdisc *sch, struct sk_buff *skb)
 {
 	struct netem_sched_data *q = qdisc_priv(sch);
 	struct netem_skb_cb *cb = (struct netem_skb_cb *)skb->cb;
+	struct rb_node **p = &q->delayed.rb_node, *parent = NULL;
 	psched_tdiff_t td;
 	psched_time_t now;
-	
+
+	if (unlikely(q->delayed_qlen >= q->limit)) {
+		sch->qstats.drops++;
+		kfree_skb(skb);
+		return NET_XMIT_DROP;
+	}
+
 	PSCHED_GET_TIME(now);
 	td = tabledist(q->latency, q->jitter, &q->delay_cor, q->delay_dist);
-	PSCHED_TADD2(now, td, cb->time_to_send);
-	
-	/* Always queue at tail to keep packets in order */
-	if (likely(q->delayed.qlen < q->limit)) {
-		__skb_queue_tail(&q->delayed, skb);
-		sch->bstats.bytes += skb->len;
-		sch->bstats.packets++;
-
-		if (!timer_pending(&q->timer)) {
-			q->timer.expires = jiffies + PSCHED_US2JIFFIE(td);
-			add_timer(&q->timer);
-		}
-		return NET_XMIT_SUCCESS;
+	if (q->rate) {
+		if (PSCHED_TLESS(q->link_free, now))
+			q->link_free = now;
+		PSCHED_TADD(q->link_free, netem_txtime(q, skb->len));
+		PSCHED_TADD2(q->link_free, td, cb->time_to_send);
+	} else
+		PSCHED_TADD2(now, td, cb->time_to_send);
+
+	while (*p) {
+		const struct netem_skb_cb *c;
+
+		parent = *p;
+		c = rb_entry(parent, struct netem_skb_cb, node);
+		if (PSCHED_TLESS(cb->time_to_send, c->time_to_send))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
 	}
-
-	sch->qstats.drops++;
-	kfree_skb(skb);
-	return NET_XMIT_DROP;
+	rb_link_node(&cb->node, parent, p);
+	rb_insert_color(&cb->node, &q->delayed);
+	q->delayed_qlen++;
+
+	sch->q.qlen++;
+	sch->bstats.bytes += skb->len;
+	sch->bstats.packets++;
+	return NET_XMIT_SUCCESS;
 }
 
 static int netem_enqueue(struct sk_buff *skb, struct Qdisc *sch)
@@ -242,54 +290,59 @@ static unsigned int netem_drop(struct Qdisc* sch)
 
 /* Dequeue packet.
  *  Move all packets that are ready to send from the delay holding
- *  list to the underlying qdisc, then just call dequeue
+ *  tree to the underlying qdisc, then just call dequeue; if that has
+ *  nothing, have the watchdog call again when the next one is due.
  */
 static struct sk_buff *netem_dequeue(struct Qdisc *sch)
 {
 	struct netem_sched_data *q = qdisc_priv(sch);
 	struct sk_buff *skb;
-
-	skb = q->qdisc->dequeue(q->qdisc);
-	if (skb) 
-		sch->q.qlen--;
-	return skb;
-}
-
-static void netem_watchdog(unsigned long arg)
-{
-	struct Qdisc *sch = (struct Qdisc *)arg;
-	struct netem_sched_data *q = qdisc_priv(sch);
-	struct net_device *dev = sch->dev;
-	struct sk_buff *skb;
+	struct rb_node *p;
 	psched_time_t now;
 
-	pr_debug("netem_watchdog: fired @%lu\n", jiffies);
-
-	spin_lock_bh(&dev->queue_lock);
 	PSCHED_GET_TIME(now);
-
-	while ((skb = skb_peek(&q->delayed)) != NULL) {
+	while ((p = rb_first(&q->delayed)) != NULL) {
 		const struct netem_skb_cb *cb
-			= (const struct netem_skb_cb *)skb->cb;
-		long delay 
-			= PSCHED_US2JIFFIE(PSCHED_TDIFF(cb->time_to_send, now));
-		pr_debug("netem_watchdog: skb %p@%lu %ld\n",
-			 skb, jiffies, delay);
-
-		/* if more time remaining? */
-		if (delay > 0) {
-			mod_timer(&q->timer, jiffies + delay);
+			= rb_entry(p, struct netem_skb_cb, node);
+
+		if (PSCHED_TLESS(now, cb->time_to_send))
 			break;
-		}
-		__skb_unlink(skb, &q->delayed);
+		rb_erase(p, &q->delayed);
+		q->delayed_qlen--;
 
-		if (q->qdisc->enqueue(skb, q->qdisc))
+		skb = netem_node_skb(p);
+		if (q->qdisc->enqueue(skb, q->qdisc)) {
+			sch->q.qlen--;
 			sch->qstats.drops++;
-		else
-			sch->q.qlen++;
+		}
+	}
+
+	skb = q->qdisc->dequeue(q->qdisc);
+	if (skb) {
+		sch->q.qlen--;
+		return skb;
+	}
+
+	if (p) {
+		const struct netem_skb_cb *cb
+			= rb_entry(p, struct netem_skb_cb, node);
+
+		qdisc_watchdog_schedule(&q->watchdog,
+					PSCHED_TDIFF_SAFE(cb->time_to_send, now,
+							  PSCHED_JIFFIE2US(HZ)));
+	}
+	return NULL;
+}
+
+static void netem_purge(struct netem_sched_data *q)
+{
+	struct rb_node *p;
+
+	while ((p = rb_first(&q->delayed)) != NULL) {
+		rb_erase(p, &q->delayed);
+		kfree_skb(netem_node_skb(p));
 	}
-	qdisc_run(dev);
-	spin_unlock_bh(&dev->queue_lock);
+	q->delayed_qlen = 0;
 }
 
 static void netem_reset(struct Qdisc *sch)
@@ -297,10 +350,10 @@ static void netem_reset(struct Qdisc *sch)
 	struct netem_sched_data *q = qdisc_priv(sch);
 
 	qdisc_reset(q->qdisc);
-	skb_queue_purge(&q->delayed);
+	netem_purge(q);
 
 	sch->q.qlen = 0;
-	del_timer_sync(&q->timer);
+	qdisc_watchdog_cancel(&q->watchdog);
 }
 
 static int set_fifo_limit(struct Qdisc *q, int limit)
@@ -365,6 +418,19 @@ static int get_correlation(struct Qdisc *sch, const struct rtattr *attr)
 	return 0;
 }
 
+static int get_rate(struct Qdisc *sch, const struct rtattr *attr)
+{
+	struct netem_sched_data *q = qdisc_priv(sch);
+	const struct tc_netem_rate *r = RTA_DATA(attr);
+
+	if (RTA_PAYLOAD(attr) != sizeof(*r))
+		return -EINVAL;
+
+	q->rate = r->rate;
+	q->packet_overhead = r->packet_overhead;
+	return 0;
+}
+
 static int netem_change(struct Qdisc *sch, struct rtattr *opt)
 {
 	struct netem_sched_data *q = qdisc_priv(sch);
@@ -409,6 +475,12 @@ static int netem_change(struct Qdisc *sch, struct rtattr *opt)
 			if (ret)
 				return ret;
 		}
+
+		if (tb[TCA_NETEM_RATE-1]) {
+			ret = get_rate(sch, tb[TCA_NETEM_RATE-1]);
+			if (ret)
+				return ret;
+		}
 	}
 
 
@@ -423,10 +495,8 @@ static int netem_init(struct Qdisc *sch, struct rtattr *opt)
 	if (!opt)
 		return -EINVAL;
 
-	skb_queue_head_init(&q->delayed);
-	init_timer(&q->timer);
-	q->timer.function = netem_watchdog;
-	q->timer.data = (unsigned long) sch;
+	q->delayed = RB_ROOT;
+	qdisc_watchdog_init(&q->watchdog, sch);
 	q->counter = 0;
 
 	q->qdisc = qdisc_create_dflt(sch->dev, &pfifo_qdisc_ops);
@@ -447,7 +517,7 @@ static void netem_destroy(struct Qdisc *sch)
 {
 	struct netem_sched_data *q = qdisc_priv(sch);
 
-	del_timer_sync(&q->timer);
+	qdisc_watchdog_cancel(&q->watchdog);
 	qdisc_destroy(q->qdisc);
 	kfree(q->delay_dist);
 }
@@ -459,6 +529,7 @@ static int netem_dump(struct Qdisc *sch, struct sk_buff *skb)
 	struct rtattr *rta = (struct rtattr *) b;
 	struct tc_netem_qopt qopt;
 	struct tc_netem_corr cor;
+	struct tc_netem_rate rate;
 
 	qopt.latency = q->latency;
 	qopt.jitter = q->jitter;
@@ -472,6 +543,12 @@ static int netem_dump(struct Qdisc *sch, struct sk_buff *skb)
 	cor.loss_corr = q->loss_cor.rho;
 	cor.dup_corr = q->dup_cor.rho;
 	RTA_PUT(skb, TCA_NETEM_CORR, sizeof(cor), &cor);
+
+	if (q->rate) {
+		rate.rate = q->rate;
+		rate.packet_overhead = q->packet_overhead;
+		RTA_PUT(skb, TCA_NETEM_RATE, sizeof(rate), &rate);
+	}
 	rta->rta_len = skb->tail - b;
 
 	return skb->len;
@@ -506,7 +583,7 @@ static int netem_graft(struct Qdisc *sch, unsigned long arg, struct Qdisc *new,
 	sch_tree_lock(sch);
 	*old = xchg(&q->qdisc, new);
 	qdisc_reset(*old);
-	sch->q.qlen = 0;
+	sch->q.qlen = q->delayed_qlen;
 	sch_tree_unlock(sch);
 
 	return 0;
@@ -586,6 +663,8 @@ static struct Qdisc_ops netem_qdisc_ops = {
 
 static int __init netem_module_init(void)
 {
+	BUILD_BUG_ON(sizeof(struct netem_skb_cb) >
+		     sizeof(((struct sk_buff *)0)->cb));
 	return register_qdisc(&netem_qdisc_ops);
 }
 static void __exit netem_module_exit(void)
@@ -133,7 +133,8 @@ static struct file_operations socket_file_ops = {
 	.fasync =	sock_fasync,
 	.readv =	sock_readv,
 	.writev =	sock_writev,
-	.sendpage =	sock_sendpage
+	.sendpage =	sock_sendpage,
+	.splice_write =	generic_splice_sendpage,
 };
 
 /*
@@ -577,10 +578,9 @@ int kernel_sendmsg(struct socket *sock, struct msghdr *msg,
 	return result;
 }
 
-static inline int __sock_recvmsg(struct kiocb *iocb, struct socket *sock, 
-				 struct msghdr *msg, size_t size, int flags)
+static inline int __sock_recvmsg_nosec(struct kiocb *iocb, struct socket *sock,
+				       struct msghdr *msg, size_t size, int flags)
 {
-	int err;
 	struct sock_iocb *si = kiocb_to_siocb(iocb);
 
 	si->sock = sock;
@@ -589,11 +589,19 @@ static inline int __sock_recvmsg(struct kiocb *iocb, struct socket *sock,
 	si->size = size;
 	si->flags = flags;
 
+	return sock->ops->recvmsg(iocb, sock, msg, size, flags);
+}
+
+static inline int __sock_recvmsg(struct kiocb *iocb, struct socket *sock, 
+				 struct msghdr *msg, size_t size, int flags)
+{
+	int err;
+
 	err = security_socket_recvmsg(sock, msg, size, flags);
 	if (err)
 		return err;
 
-	return sock->ops->recvmsg(iocb, sock, msg, size, flags);
+	return __sock_recvmsg_nosec(iocb, sock, msg, size, flags);
 }
 
 int sock_recvmsg(struct socket *sock, struct msghdr *msg, 
@@ -611,6 +619,24 @@ int sock_recvmsg(struct socket *sock, struct msghdr *msg,
 	return ret;
 }
 
+/* For the second and later datagrams of a recvmmsg() batch, which the
+ * security hook has already approved for this socket.
+ */
+static int sock_recvmsg_nosec(struct socket *sock, struct msghdr *msg,
+			      size_t size, int flags)
+{
+	struct kiocb iocb;
+	struct sock_iocb siocb;
+	int ret;
+
+	init_sync_kiocb(&iocb, NULL);
+	iocb.private = &siocb;
+	ret = __sock_recvmsg_nosec(&iocb, sock, msg, size, flags);
+	if (-EIOCBQUEUED == ret)
+		ret = wait_on_sync_kiocb(&iocb);
+	return ret;
+}
+
 int kernel_recvmsg(struct socket *sock, struct msghdr *msg, 
 		   struct kvec *vec, size_t num,
 		   size_t size, int flags)
@@ -635,6 +661,55 @@ static void sock_aio_dtor(struct kiocb *iocb)
 	kfree(iocb->private);
 }
 
+/*
+ * Get the sock_iocb of an aio request, allocated on its first try and
+ * reused on the retries.
+ */
+static struct sock_iocb *sock_aio_siocb(struct kiocb *iocb)
+{
+	struct sock_iocb *x = iocb->private;
+
+	if (!x) {
+		x = kmalloc(sizeof(struct sock_iocb), GFP_KERNEL);
+		if (!x)
+			return NULL;
+		iocb->private = x;
+		iocb->ki_dtor = sock_aio_dtor;
+	}
+	return x;
+}
+
+/*
+ * A retried kiocb (current->io_wait is its wait entry) must not sleep in
+ * the protocol: it is queued on the socket's wait queue before the
+ * operation is tried with MSG_DONTWAIT, and if that would block it stays
+ * there and -EIOCBRETRY is returned.  The wakeup from sk_data_ready,
+ * sk_write_space or the accept queue kicks the kiocb for another try.
+ */
+static inline int sock_aio_retrying(struct kiocb *iocb)
+{
+	return current->io_wait == &iocb->ki_wait.wait;
+}
+
+static inline void sock_aio_prepare_wait(struct kiocb *iocb,
+					 struct socket *sock)
+{
+	if (sock_aio_retrying(iocb))
+		prepare_to_wait(sock->sk->sk_sleep, current->io_wait,
+				TASK_INTERRUPTIBLE);
+}
+
+static inline int sock_aio_finish_wait(struct kiocb *iocb, struct socket *sock,
+				       int ret, int nonblock)
+{
+	if (sock_aio_retrying(iocb)) {
+		if (ret == -EAGAIN && !nonblock)
+			return -EIOCBRETRY;
+		finish_wait(sock->sk->sk_sleep, current->io_wait);
+	}
+	return ret;
+}
+
 /*
  *	Read data from a socket. ubuf is a user mode pointer. We make sure the user
  *	area ubuf...ubuf+size-1 is writable before asking the protocol.
@@ -645,22 +720,18 @@ static ssize_t sock_aio_read(struct kiocb *iocb, char __user *ubuf,
 {
 	struct sock_iocb *x, siocb;
 	struct socket *sock;
-	int flags;
+	int flags, nonblock, ret;
 
 	if (pos != 0)
 		return -ESPIPE;
 	if (size==0)		/* Match SYS5 behaviour */
 		return 0;
 
-	if (is_sync_kiocb(iocb))
+	if (is_sync_kiocb(iocb)) {
 		x = &siocb;
-	else {
-		x = kmalloc(sizeof(struct sock_iocb), GFP_KERNEL);
-		if (!x)
-			return -ENOMEM;
-		iocb->ki_dtor = sock_aio_dtor;
-	}
-	iocb->private = x;
+		iocb->private = x;
+	} else if (!(x = sock_aio_siocb(iocb)))
+		return -ENOMEM;
 	x->kiocb = iocb;
 	sock = SOCKET_I(iocb->ki_filp->f_dentry->d_inode); 
 
@@ -672,9 +743,12 @@ static ssize_t sock_aio_read(struct kiocb *iocb, char __user *ubuf,
 	x->async_msg.msg_controllen = 0;
 	x->async_iov.iov_base = ubuf;
 	x->async_iov.iov_len = size;
-	flags = !(iocb->ki_filp->f_flags & O_NONBLOCK) ? 0 : MSG_DONTWAIT;
+	nonblock = iocb->ki_filp->f_flags & O_NONBLOCK;
+	flags = (nonblock || sock_aio_retrying(iocb)) ? MSG_DONTWAIT : 0;
 
-	return __sock_recvmsg(iocb, sock, &x->async_msg, size, flags);
+	sock_aio_prepare_wait(iocb, sock);
+	ret = __sock_recvmsg(iocb, sock, &x->async_msg, size, flags);
+	return sock_aio_finish_wait(iocb, sock, ret, nonblock);
 }
 
 
@@ -688,21 +762,18 @@ static ssize_t sock_aio_write(struct kiocb *iocb, const char __user *ubuf,
 {
 	struct sock_iocb *x, siocb;
 	struct socket *sock;
+	int nonblock, ret;
 	
 	if (pos != 0)
 		return -ESPIPE;
 	if(size==0)		/* Match SYS5 behaviour */
 		return 0;
 
-	if (is_sync_kiocb(iocb))
+	if (is_sync_kiocb(iocb)) {
 		x = &siocb;
-	else {
-		x = kmalloc(sizeof(struct sock_iocb), GFP_KERNEL);
-		if (!x)
-			return -ENOMEM;
-		iocb->ki_dtor = sock_aio_dtor;
-	}
-	iocb->private = x;
+		iocb->private = x;
+	} else if (!(x = sock_aio_siocb(iocb)))
+		return -ENOMEM;
 	x->kiocb = iocb;
 	sock = SOCKET_I(iocb->ki_filp->f_dentry->d_inode); 
 
@@ -712,13 +783,121 @@ static ssize_t sock_aio_write(struct kiocb *iocb, const char __user *ubuf,
 	x->async_msg.msg_iovlen = 1;
 	x->async_msg.msg_control = NULL;
 	x->async_msg.msg_controllen = 0;
-	x->async_msg.msg_flags = !(iocb->ki_filp->f_flags & O_NONBLOCK) ? 0 : MSG_DONTWAIT;
+	nonblock = iocb->ki_filp->f_flags & O_NONBLOCK;
+	x->async_msg.msg_flags = (nonblock || sock_aio_retrying(iocb)) ? MSG_DONTWAIT : 0;
 	if (sock->type == SOCK_SEQPACKET)
 		x->async_msg.msg_flags |= MSG_EOR;
 	x->async_iov.iov_base = (void __user *)ubuf;
 	x->async_iov.iov_len = size;
 	
-	return __sock_sendmsg(iocb, sock, &x->async_msg, size);
+	sock_aio_prepare_wait(iocb, sock);
+	ret = __sock_sendmsg(iocb, sock, &x->async_msg, size);
+	return sock_aio_finish_wait(iocb, sock, ret, nonblock);
+}
+
+/*
+ * IOCB_CMD_ACCEPT: aio_buf/aio_nbytes give room for the peer address, which
+ * is truncated to fit, and the new descriptor is the result of the iocb.
+ *
+ * Retries run from the aio kernel thread, so what the descriptor and its
+ * inode would take from the caller of accept() is remembered on the first
+ * try, from io_submit().
+ */
+struct sock_aio_accept {
+	struct files_struct	*files;
+	uid_t			uid;
+	gid_t			gid;
+};
+
+static void sock_aio_accept_dtor(struct kiocb *iocb)
+{
+	struct sock_aio_accept *x = iocb->private;
+
+	put_files_struct(x->files);
+	kfree(x);
+}
+
+ssize_t sock_aio_accept(struct kiocb *iocb)
+{
+	struct file *file = iocb->ki_filp;
+	struct sock_aio_accept *x = iocb->private;
+	struct socket *sock, *newsock;
+	struct files_struct *files;
+	char address[MAX_SOCK_ADDR];
+	int err, len;
+
+	if (file->f_op != &socket_file_ops)
+		return -ENOTSOCK;
+	sock = SOCKET_I(file->f_dentry->d_inode);
+
+	if (!x) {
+		x = kmalloc(sizeof(*x), GFP_KERNEL);
+		if (!x)
+			return -ENOMEM;
+		x->files = current->files;
+		atomic_inc(&x->files->count);
+		x->uid = current->fsuid;
+		x->gid = current->fsgid;
+		iocb->private = x;
+		iocb->ki_dtor = sock_aio_accept_dtor;
+	}
+
+	err = -ENFILE;
+	if (!(newsock = sock_alloc()))
+		goto out;
+
+	newsock->type = sock->type;
+	newsock->ops = sock->ops;
+	SOCK_INODE(newsock)->i_uid = x->uid;
+	SOCK_INODE(newsock)->i_gid = x->gid;
+
+	err = security_socket_accept(sock, newsock);
+	if (err)
+		goto out_release;
+
+	/* As in sys_accept(), the listening socket holds the module */
+	__module_get(newsock->ops->owner);
+
+	sock_aio_prepare_wait(iocb, sock);
+	err = sock->ops->accept(sock, newsock, file->f_flags | O_NONBLOCK);
+	err = sock_aio_finish_wait(iocb, sock, err, file->f_flags & O_NONBLOCK);
+	if (err < 0)
+		goto out_release;
+
+	if (iocb->ki_nbytes) {
+		if (newsock->ops->getname(newsock, (struct sockaddr *)address,
+					  &len, 2) < 0) {
+			err = -ECONNABORTED;
+			goto out_release;
+		}
+		if (len > iocb->ki_nbytes)
+			len = iocb->ki_nbytes;
+		err = -EFAULT;
+		if (copy_to_user(iocb->ki_buf, address, len))
+			goto out_release;
+	}
+
+	/* Install the descriptor in the submitter's table */
+	task_lock(current);
+	files = current->files;
+	current->files = x->files;
+	task_unlock(current);
+
+	err = sock_map_fd(newsock);
+
+	task_lock(current);
+	current->files = files;
+	task_unlock(current);
+
+	if (err < 0)
+		goto out_release;
+
+	security_socket_post_accept(sock, newsock);
+out:
+	return err;
+out_release:
+	sock_release(newsock);
+	goto out;
 }
 
 ssize_t sock_sendpage(struct file *file, struct page *page,
@@ -1690,10 +1869,10 @@ asmlinkage long sys_shutdown(int fd, int how)
  *	BSD sendmsg interface
  */
 
-asmlinkage long sys_sendmsg(int fd, struct msghdr __user *msg, unsigned flags)
+static int __sys_sendmsg(struct socket *sock, struct msghdr __user *msg,
+			 unsigned flags)
 {
 	struct compat_msghdr __user *msg_compat = (struct compat_msghdr __user *)msg;
-	struct socket *sock;
 	char address[MAX_SOCK_ADDR];
 	struct iovec iovstack[UIO_FASTIOV], *iov = iovstack;
 	unsigned char ctl[sizeof(struct cmsghdr) + 20];	/* 20 is size of ipv6_pktinfo */
@@ -1701,21 +1880,16 @@ asmlinkage long sys_sendmsg(int fd, struct msghdr __user *msg, unsigned flags)
 	struct msghdr msg_sys;
 	int err, ctl_len, iov_size, total_len;
 	
-	err = -EFAULT;
 	if (MSG_CMSG_COMPAT & flags) {
 		if (get_compat_msghdr(&msg_sys, msg_compat))
 			return -EFAULT;
 	} else if (copy_from_user(&msg_sys, msg, sizeof(struct msghdr)))
 		return -EFAULT;
 
-	sock = sockfd_lookup(fd, &err);
-	if (!sock) 
-		goto out;
-
 	/* do not move before msg_sys is valid */
 	err = -EMSGSIZE;
 	if (msg_sys.msg_iovlen > UIO_MAXIOV)
-		goto out_put;
+		goto out;
 
 	/* Check whether to allocate the iovec area*/
 	err = -ENOMEM;
@@ -1723,7 +1897,7 @@ asmlinkage long sys_sendmsg(int fd, struct msghdr __user *msg, unsigned flags)
 	if (msg_sys.msg_iovlen > UIO_FASTIOV) {
 		iov = sock_kmalloc(sock->sk, iov_size, GFP_KERNEL);
 		if (!iov)
-			goto out_put;
+			goto out;
 	}
 
 	/* This will also move the address data into kernel space */
@@ -1774,20 +1948,87 @@ out_freectl:
 out_freeiov:
 	if (iov != iovstack)
 		sock_kfree_s(sock->sk, iov, iov_size);
-out_put:
-	sockfd_put(sock);
 out:       
 	return err;
 }
 
+asmlinkage long sys_sendmsg(int fd, struct msghdr __user *msg, unsigned flags)
+{
+	struct socket *sock;
+	int err;
+
+	sock = sockfd_lookup(fd, &err);
+	if (!sock)
+		return err;
+	err = __sys_sendmsg(sock, msg, flags);
+	sockfd_put(sock);
+	return err;
+}
+
+/*
+ *	Send several datagrams with one system call.  Each entry's msg_len
+ *	is set to the bytes sent.  Returns the number of entries sent, or
+ *	the error if the first one failed.
+ */
+
+asmlinkage long sys_sendmmsg(int fd, struct mmsghdr __user *mmsg,
+			     unsigned int vlen, unsigned int flags)
+{
+	struct compat_mmsghdr __user *compat_entry;
+	struct mmsghdr __user *entry;
+	struct socket *sock;
+	int datagrams = 0;
+	int err;
+
+	if (vlen > UIO_MAXIOV)
+		vlen = UIO_MAXIOV;
+
+	sock = sockfd_lookup(fd, &err);
+	if (!sock)
+		return err;
+
+	entry = mmsg;
+	compat_entry = (struct compat_mmsghdr __user *)mmsg;
+	err = 0;
+
+	while (datagrams < vlen) {
+		if (MSG_CMSG_COMPAT & flags) {
+			err = __sys_sendmsg(sock,
+				(struct msghdr __user *)&compat_entry->msg_hdr,
+				flags);
+			if (err < 0)
+				break;
+			err = __put_user(err, &compat_entry->msg_len);
+			compat_entry++;
+		} else {
+			err = __sys_sendmsg(sock, &entry->msg_hdr, flags);
+			if (err < 0)
+				break;
+			err = put_user(err, &entry->msg_len);
+			entry++;
+		}
+		if (err)
+			break;
+		datagrams++;
+		cond_resched();
+	}
+
+	sockfd_put(sock);
+
+	/* We only return an error if no datagrams were able to be sent */
+	if (datagrams != 0)
+		return datagrams;
+	return err;
+}
+
 /*
  *	BSD recvmsg interface
  */
 
-asmlinkage long sys_recvmsg(int fd, struct msghdr __user *msg, unsigned int flags)
+static int __sys_recvmsg(struct socket *sock, struct msghdr __user *msg,
+			 unsigned int flags, int nosec)
 {
 	struct compat_msghdr __user *msg_compat = (struct compat_msghdr __user *)msg;
-	struct socket *sock;
 	struct iovec iovstack[UIO_FASTIOV];
 	struct iovec *iov=iovstack;
 	struct msghdr msg_sys;
@@ -1808,13 +2049,9 @@ asmlinkage long sys_recvmsg(int fd, struct msghdr __user *msg, unsigned int flag
 		if (copy_from_user(&msg_sys,msg,sizeof(struct msghdr)))
 			return -EFAULT;
 
-	sock = sockfd_lookup(fd, &err);
-	if (!sock)
-		goto out;
-
 	err = -EMSGSIZE;
 	if (msg_sys.msg_iovlen > UIO_MAXIOV)
-		goto out_put;
+		goto out;
 	
 	/* Check whether to allocate the iovec area*/
 	err = -ENOMEM;
@@ -1822,7 +2059,7 @@ asmlinkage long sys_recvmsg(int fd, struct msghdr __user *msg, unsigned int flag
 	if (msg_sys.msg_iovlen > UIO_FASTIOV) {
 		iov = sock_kmalloc(sock->sk, iov_size, GFP_KERNEL);
 		if (!iov)
-			goto out_put;
+			goto out;
 	}
 
 	/*
@@ -1847,7 +2084,8 @@ asmlinkage long sys_recvmsg(int fd, struct msghdr __user *msg, unsigned int flag
 	
 	if (sock->file->f_flags & O_NONBLOCK)
 		flags |= MSG_DONTWAIT;
-	err = sock_recvmsg(sock, &msg_sys, total_len, flags);
+	err = (nosec ? sock_recvmsg_nosec : sock_recvmsg)(sock, &msg_sys,
+							  total_len, flags);
 	if (err < 0)
 		goto out_freeiov;
 	len = err;
@@ -1873,19 +2111,150 @@ asmlinkage long sys_recvmsg(int fd, struct msghdr __user *msg, unsigned int flag
 out_freeiov:
 	if (iov != iovstack)
 		sock_kfree_s(sock->sk, iov, iov_size);
-out_put:
-	sockfd_put(sock);
 out:
 	return err;
 }
 
+asmlinkage long sys_recvmsg(int fd, struct msghdr __user *msg, unsigned int flags)
+{
+	struct socket *sock;
+	int err;
+
+	sock = sockfd_lookup(fd, &err);
+	if (!sock)
+		return err;
+	err = __sys_recvmsg(sock, msg, flags, 0);
+	sockfd_put(sock);
+	return err;
+}
+
+/*
+ *	Receive several datagrams with one system call.  Each entry's
+ *	msg_len is set to the bytes received.  With MSG_WAITFORONE only
+ *	the first datagram is waited for.  The timeout, if given, is checked
+ *	after each datagram and updated with the time left.
+ */
+
+int __sys_recvmmsg(int fd, struct mmsghdr __user *mmsg, unsigned int vlen,
+		   unsigned int flags, struct timespec *timeout)
+{
+	struct compat_mmsghdr __user *compat_entry;
+	struct mmsghdr __user *entry;
+	struct socket *sock;
+	unsigned long end_time = 0;
+	int datagrams = 0;
+	int err;
+
+	if (vlen > UIO_MAXIOV)
+		vlen = UIO_MAXIOV;
+
+	if (timeout) {
+		if (timeout->tv_sec < 0 ||
+		    (unsigned long)timeout->tv_nsec >= NSEC_PER_SEC)
+			return -EINVAL;
+		end_time = jiffies + timespec_to_jiffies(timeout);
+	}
+
+	sock = sockfd_lookup(fd, &err);
+	if (!sock)
+		return err;
+
+	err = sock_error(sock->sk);
+	if (err)
+		goto out_put;
+
+	entry = mmsg;
+	compat_entry = (struct compat_mmsghdr __user *)mmsg;
+
+	while (datagrams < vlen) {
+		/* No need to ask the security module again for every
+		 * datagram once it has cleared the first one.
+		 */
+		if (MSG_CMSG_COMPAT & flags) {
+			err = __sys_recvmsg(sock,
+				(struct msghdr __user *)&compat_entry->msg_hdr,
+				flags & ~MSG_WAITFORONE, datagrams);
+			if (err < 0)
+				break;
+			err = __put_user(err, &compat_entry->msg_len);
+			compat_entry++;
+		} else {
+			err = __sys_recvmsg(sock, &entry->msg_hdr,
+					    flags & ~MSG_WAITFORONE, datagrams);
+			if (err < 0)
+				break;
+			err = put_user(err, &entry->msg_len);
+			entry++;
+		}
+		if (err)
+			break;
+		datagrams++;
+
+		/* MSG_WAITFORONE turns on MSG_DONTWAIT after one packet */
+		if (flags & MSG_WAITFORONE)
+			flags |= MSG_DONTWAIT;
+
+		if (timeout) {
+			long left = (long)(end_time - jiffies);
+
+			if (left < 0)
+				left = 0;
+			jiffies_to_timespec(left, timeout);
+			if (!left)
+				break;
+		}
+
+		/* Out of band data, return right away */
+		if (flags & MSG_OOB)
+			break;
+		cond_resched();
+	}
+
+out_put:
+	sockfd_put(sock);
+
+	if (datagrams == 0)
+		return err;
+
+	/* We may return less entries than requested (vlen) if the
+	 * sock is non block and there aren't enough datagrams.  Report
+	 * anything else on the next call, as an error on the socket.
+	 */
+	if (err != 0 && err != -EAGAIN)
+		sock->sk->sk_err = -err;
+	return datagrams;
+}
+
+asmlinkage long sys_recvmmsg(int fd, struct mmsghdr __user *mmsg,
+			     unsigned int vlen, unsigned int flags,
+			     struct timespec __user *timeout)
+{
+	struct timespec timeout_sys;
+	int datagrams;
+
+	if (!timeout)
+		return __sys_recvmmsg(fd, mmsg, vlen, flags, NULL);
+
+	if (copy_from_user(&timeout_sys, timeout, sizeof(timeout_sys)))
+		return -EFAULT;
+
+	datagrams = __sys_recvmmsg(fd, mmsg, vlen, flags, &timeout_sys);
+
+	if (datagrams > 0 &&
+	    copy_to_user(timeout, &timeout_sys, sizeof(timeout_sys)))
+		datagrams = -EFAULT;
+
+	return datagrams;
+}
+
 #ifdef __ARCH_WANT_SYS_SOCKETCALL
 
 /* Argument list sizes for sys_socketcall */
 #define AL(x) ((x) * sizeof(unsigned long))
-static unsigned char nargs[18]={AL(0),AL(3),AL(3),AL(3),AL(2),AL(3),
+static unsigned char nargs[20]={AL(0),AL(3),AL(3),AL(3),AL(2),AL(3),
 				AL(3),AL(3),AL(4),AL(4),AL(4),AL(6),
-				AL(6),AL(2),AL(5),AL(5),AL(3),AL(3)};
+				AL(6),AL(2),AL(5),AL(5),AL(3),AL(3),
+				AL(5),AL(4)};
 #undef AL
 
 /*
@@ -1902,7 +2271,7 @@ asmlinkage long sys_socketcall(int call, unsigned long __user *args)
 	unsigned long a0,a1;
 	int err;
 
-	if(call<1||call>SYS_RECVMSG)
+	if(call<1||call>SYS_SENDMMSG)
 		return -EINVAL;
 
 	/* copy_from_user should be SMP safe. */
@@ -1967,6 +2336,14 @@ asmlinkage long sys_socketcall(int call, unsigned long __user *args)
 		case SYS_RECVMSG:
 			err = sys_recvmsg(a0, (struct msghdr __user *) a1, a[2]);
 			break;
+		case SYS_RECVMMSG:
+			err = sys_recvmmsg(a0, (struct mmsghdr __user *) a1, a[2],
+					   a[3], (struct timespec __user *)a[4]);
+			break;
+		case SYS_SENDMMSG:
+			err = sys_sendmmsg(a0, (struct mmsghdr __user *) a1, a[2],
+					   a[3]);
+			break;
 		default:
 			err = -EINVAL;
 			break;
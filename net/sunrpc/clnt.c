@@ -136,6 +136,8 @@ rpc_create_client(struct rpc_xprt *xprt, char *servname,
 	strlcpy(clnt->cl_server, servname, len);
 
 	clnt->cl_xprt     = xprt;
+	clnt->cl_xprts[0] = xprt;
+	clnt->cl_nxprts   = 1;
 	clnt->cl_procinfo = version->procs;
 	clnt->cl_maxproc  = version->nrprocs;
 	clnt->cl_protname = program->name;
@@ -214,6 +216,47 @@ out_no_clnt:
 	return ERR_PTR(-ENOMEM);
 }
 
+/*
+ * Give a client another transport to the same server, to spread its
+ * calls over.  This must be done before the client is used or cloned;
+ * the client destroys the transport when it goes away.
+ */
+int
+rpc_clnt_add_xprt(struct rpc_clnt *clnt, struct rpc_xprt *xprt)
+{
+	if (clnt->cl_nxprts >= RPC_MAX_XPRTS)
+		return -ENOSPC;
+	if (xprt->prot != clnt->cl_xprt->prot)
+		return -EINVAL;
+	clnt->cl_xprts[clnt->cl_nxprts++] = xprt;
+	return 0;
+}
+
+/*
+ * Choose the transport for a new call: the one with the fewest calls
+ * holding a slot.  Each search starts one transport further along, so
+ * that ties are broken round robin; cl_xprt_next is not locked, as a
+ * lost update only makes two calls start at the same place.
+ */
+static struct rpc_xprt *
+rpc_clnt_pick_xprt(struct rpc_clnt *clnt)
+{
+	struct rpc_xprt *best, *xprt;
+	unsigned int i, n = clnt->cl_nxprts, start;
+
+	if (n <= 1)
+		return clnt->cl_xprt;
+
+	start = clnt->cl_xprt_next++ % n;
+	best = clnt->cl_xprts[start];
+	for (i = 1; i < n; i++) {
+		xprt = clnt->cl_xprts[(start + i) % n];
+		if (xprt->outstanding < best->outstanding)
+			best = xprt;
+	}
+	return best;
+}
+
 /*
  * Properly shut down an RPC client, terminating all outstanding
  * requests. Note that we must be certain that cl_oneshot and
@@ -269,6 +312,8 @@ rpc_destroy_client(struct rpc_clnt *clnt)
 	}
 	if (clnt->cl_pathname[0])
 		rpc_rmdir(clnt->cl_pathname);
+	while (clnt->cl_nxprts > 1)
+		xprt_destroy(clnt->cl_xprts[--clnt->cl_nxprts]);
 	if (clnt->cl_xprt) {
 		xprt_destroy(clnt->cl_xprt);
 		clnt->cl_xprt = NULL;
@@ -440,16 +485,20 @@ rpc_call_setup(struct rpc_task *task, struct rpc_message *msg, int flags)
 void
 rpc_setbufsize(struct rpc_clnt *clnt, unsigned int sndsize, unsigned int rcvsize)
 {
-	struct rpc_xprt *xprt = clnt->cl_xprt;
-
-	xprt->sndsize = 0;
-	if (sndsize)
-		xprt->sndsize = sndsize + RPC_SLACK_SPACE;
-	xprt->rcvsize = 0;
-	if (rcvsize)
-		xprt->rcvsize = rcvsize + RPC_SLACK_SPACE;
-	if (xprt_connected(xprt))
-		xprt_sock_setbufsize(xprt);
+	unsigned int i;
+
+	for (i = 0; i < clnt->cl_nxprts; i++) {
+		struct rpc_xprt *xprt = clnt->cl_xprts[i];
+
+		xprt->sndsize = 0;
+		if (sndsize)
+			xprt->sndsize = sndsize + RPC_SLACK_SPACE;
+		xprt->rcvsize = 0;
+		if (rcvsize)
+			xprt->rcvsize = rcvsize + RPC_SLACK_SPACE;
+		if (xprt_connected(xprt))
+			xprt_sock_setbufsize(xprt);
+	}
 }
 
 /*
@@ -515,6 +564,8 @@ call_reserve(struct rpc_task *task)
 
 	task->tk_status  = 0;
 	task->tk_action  = call_reserveresult;
+	if (!task->tk_rqstp)
+		task->tk_xprt = rpc_clnt_pick_xprt(task->tk_client);
 	xprt_reserve(task);
 }
 
@@ -658,7 +709,7 @@ static void
 call_bind(struct rpc_task *task)
 {
 	struct rpc_clnt	*clnt = task->tk_client;
-	struct rpc_xprt *xprt = clnt->cl_xprt;
+	struct rpc_xprt *xprt = task->tk_xprt;
 
 	dprintk("RPC: %4d call_bind xprt %p %s connected\n", task->tk_pid,
 			xprt, (xprt_connected(xprt) ? "is" : "is not"));
@@ -678,12 +729,10 @@ call_bind(struct rpc_task *task)
 static void
 call_connect(struct rpc_task *task)
 {
-	struct rpc_clnt *clnt = task->tk_client;
-
 	dprintk("RPC: %4d call_connect status %d\n",
 				task->tk_pid, task->tk_status);
 
-	if (xprt_connected(clnt->cl_xprt)) {
+	if (xprt_connected(task->tk_xprt)) {
 		task->tk_action = call_transmit;
 		return;
 	}
@@ -944,7 +993,7 @@ static u32 *
 call_header(struct rpc_task *task)
 {
 	struct rpc_clnt *clnt = task->tk_client;
-	struct rpc_xprt *xprt = clnt->cl_xprt;
+	struct rpc_xprt *xprt = task->tk_xprt;
 	struct rpc_rqst	*req = task->tk_rqstp;
 	u32		*p = req->rq_svec[0].iov_base;
 
@@ -141,9 +141,12 @@ pmap_getport_done(struct rpc_task *task)
 		task->tk_status = -EACCES;
 		task->tk_action = NULL;
 	} else {
+		unsigned int i;
+
 		/* byte-swap port number first */
 		clnt->cl_port = htons(clnt->cl_port);
-		clnt->cl_xprt->addr.sin_port = clnt->cl_port;
+		for (i = 0; i < clnt->cl_nxprts; i++)
+			clnt->cl_xprts[i]->addr.sin_port = clnt->cl_port;
 	}
 	spin_lock(&pmap_lock);
 	map->pm_binding = 0;
@@ -747,6 +747,8 @@ void rpc_init_task(struct rpc_task *task, struct rpc_clnt *clnt, rpc_action call
 	task->tk_timer.data     = (unsigned long) task;
 	task->tk_timer.function = (void (*)(unsigned long)) rpc_run_timer;
 	task->tk_client = clnt;
+	if (clnt)
+		task->tk_xprt = clnt->cl_xprt;
 	task->tk_flags  = flags;
 	task->tk_exit   = callback;
 
@@ -859,6 +861,7 @@ void rpc_release_task(struct rpc_task *task)
 	if (task->tk_client) {
 		rpc_release_client(task->tk_client);
 		task->tk_client = NULL;
+		task->tk_xprt = NULL;
 	}
 
 #ifdef RPC_DEBUG
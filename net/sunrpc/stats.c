@@ -106,6 +106,27 @@ void svc_seq_show(struct seq_file *seq, const struct svc_stat *statp) {
 	}
 }
 
+/*
+ * One line per thread pool: id, threads, then the svc_pool_stats.
+ * The caller keeps the service from going away.
+ */
+void svc_seq_show_pools(struct seq_file *seq, struct svc_serv *serv)
+{
+	unsigned int i;
+
+	for (i = 0; i < serv->sv_nrpools; i++) {
+		struct svc_pool *pool = &serv->sv_pools[i];
+
+		seq_printf(seq, "pool %u %u %lu %lu %lu %lu\n",
+			   pool->sp_id,
+			   pool->sp_nrthreads,
+			   pool->sp_stats.packets,
+			   pool->sp_stats.sockets_queued,
+			   pool->sp_stats.threads_woken,
+			   pool->sp_stats.threads_timedout);
+	}
+}
+
 /*
  * Register/unregister RPC proc files
  */
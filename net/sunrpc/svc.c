@@ -12,6 +12,10 @@
 #include <linux/net.h>
 #include <linux/in.h>
 #include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/topology.h>
+#include <asm/semaphore.h>
 
 #include <linux/sunrpc/types.h>
 #include <linux/sunrpc/xdr.h>
@@ -22,15 +26,229 @@
 #define RPCDBG_FACILITY	RPCDBG_SVCDSP
 #define RPC_PARANOIA 1
 
+/*
+ * How the threads of a pooled service are split up.  The map is shared
+ * by all pooled services and is built when the first one is created;
+ * the mode can only change while no pooled service exists.
+ */
+enum {
+	SVC_POOL_AUTO = -1,	/* choose one of the others */
+	SVC_POOL_GLOBAL,	/* no mapping, just a single global pool */
+	SVC_POOL_PERCPU,	/* one pool per cpu */
+	SVC_POOL_PERNODE	/* one pool per NUMA node */
+};
+
+#define SVC_POOL_MAP_SIZE	(NR_CPUS > MAX_NUMNODES ? NR_CPUS : MAX_NUMNODES)
+
+static struct svc_pool_map {
+	int		count;			/* pooled services using the map */
+	int		mode;			/* SVC_POOL_*, as set by the admin */
+	int		active;			/* SVC_POOL_*, as in use */
+	unsigned int	npools;
+	unsigned int	pool_to[SVC_POOL_MAP_SIZE];	/* pool -> cpu or node */
+	unsigned int	to_pool[SVC_POOL_MAP_SIZE];	/* cpu or node -> pool */
+} svc_pool_map = {
+	.mode		= SVC_POOL_AUTO,
+};
+
+static DECLARE_MUTEX(svc_pool_map_sem);
+
+static const char *svc_pool_mode_names[] = {
+	[SVC_POOL_GLOBAL]	= "global",
+	[SVC_POOL_PERCPU]	= "percpu",
+	[SVC_POOL_PERNODE]	= "pernode",
+};
+
+static int
+param_set_pool_mode(const char *val, struct kernel_param *kp)
+{
+	int *ip = (int *)kp->arg;
+	int mode, err = -EINVAL;
+
+	if (!strncmp(val, "auto", 4))
+		mode = SVC_POOL_AUTO;
+	else {
+		for (mode = 0; mode < ARRAY_SIZE(svc_pool_mode_names); mode++)
+			if (!strncmp(val, svc_pool_mode_names[mode],
+				     strlen(svc_pool_mode_names[mode])))
+				break;
+		if (mode == ARRAY_SIZE(svc_pool_mode_names))
+			return -EINVAL;
+	}
+
+	down(&svc_pool_map_sem);
+	if (svc_pool_map.count == 0) {
+		*ip = mode;
+		err = 0;
+	} else
+		err = -EBUSY;
+	up(&svc_pool_map_sem);
+	return err;
+}
+
+static int
+param_get_pool_mode(char *buf, struct kernel_param *kp)
+{
+	int mode = *(int *)kp->arg;
+
+	if (mode == SVC_POOL_AUTO)
+		return sprintf(buf, "auto");
+	return sprintf(buf, "%s", svc_pool_mode_names[mode]);
+}
+
+module_param_call(pool_mode, param_set_pool_mode, param_get_pool_mode,
+		  &svc_pool_map.mode, 0644);
+
+/*
+ * Pools only pay off when there is more than one node, or failing
+ * that, enough cpus for the single queue to be contended.
+ */
+static int
+svc_pool_map_choose_mode(void)
+{
+	if (num_online_nodes() > 1)
+		return SVC_POOL_PERNODE;
+	if (num_online_cpus() > 2)
+		return SVC_POOL_PERCPU;
+	return SVC_POOL_GLOBAL;
+}
+
+static void
+svc_pool_map_init_percpu(struct svc_pool_map *m)
+{
+	unsigned int pidx = 0;
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		m->to_pool[cpu] = 0;
+		if (!cpu_online(cpu))
+			continue;
+		m->pool_to[pidx] = cpu;
+		m->to_pool[cpu] = pidx;
+		pidx++;
+	}
+	m->npools = pidx;
+}
+
+static void
+svc_pool_map_init_pernode(struct svc_pool_map *m)
+{
+	unsigned int pidx = 0;
+	int node;
+
+	for (node = 0; node < MAX_NUMNODES; node++) {
+		m->to_pool[node] = 0;
+		if (!node_online(node))
+			continue;
+		m->pool_to[pidx] = node;
+		m->to_pool[node] = pidx;
+		pidx++;
+	}
+	m->npools = pidx;
+}
+
+/*
+ * Take a reference to the pool map, building it if this is the first
+ * pooled service.  Returns the number of pools to create.
+ */
+static unsigned int
+svc_pool_map_get(void)
+{
+	struct svc_pool_map *m = &svc_pool_map;
+
+	down(&svc_pool_map_sem);
+	if (m->count++ == 0) {
+		m->active = m->mode;
+		if (m->active == SVC_POOL_AUTO)
+			m->active = svc_pool_map_choose_mode();
+
+		m->npools = 1;
+		if (m->active == SVC_POOL_PERCPU)
+			svc_pool_map_init_percpu(m);
+		else if (m->active == SVC_POOL_PERNODE)
+			svc_pool_map_init_pernode(m);
+		if (m->npools <= 1) {
+			m->active = SVC_POOL_GLOBAL;
+			m->npools = 1;
+		}
+	}
+	up(&svc_pool_map_sem);
+	return m->npools;
+}
+
+static void
+svc_pool_map_put(void)
+{
+	down(&svc_pool_map_sem);
+	svc_pool_map.count--;
+	up(&svc_pool_map_sem);
+}
+
+/*
+ * Find the pool that should serve work arriving on @cpu.  A pool with
+ * no threads is never chosen while another pool has some.
+ */
+struct svc_pool *
+svc_pool_for_cpu(struct svc_serv *serv, int cpu)
+{
+	struct svc_pool_map *m = &svc_pool_map;
+	unsigned int pidx = 0;
+
+	if (serv->sv_nrpools <= 1)
+		return serv->sv_pools;
+
+	if (m->active == SVC_POOL_PERCPU)
+		pidx = m->to_pool[cpu];
+	else if (m->active == SVC_POOL_PERNODE)
+		pidx = m->to_pool[cpu_to_node(cpu)];
+	pidx %= serv->sv_nrpools;
+
+	if (!serv->sv_pools[pidx].sp_nrthreads) {
+		unsigned int i;
+
+		for (i = 0; i < serv->sv_nrpools; i++)
+			if (serv->sv_pools[i].sp_nrthreads)
+				return &serv->sv_pools[i];
+	}
+	return &serv->sv_pools[pidx];
+}
+
+/*
+ * Restrict the calling task to the cpus of a pool, so that a thread
+ * forked now inherits them.  Returns 1 if *oldmask must be restored.
+ */
+static int
+svc_pool_map_set_cpumask(struct svc_serv *serv, unsigned int pidx,
+			 cpumask_t *oldmask)
+{
+	struct svc_pool_map *m = &svc_pool_map;
+	unsigned int to;
+
+	if (serv->sv_nrpools <= 1)
+		return 0;
+
+	to = m->pool_to[pidx];
+	*oldmask = current->cpus_allowed;
+	if (m->active == SVC_POOL_PERCPU)
+		set_cpus_allowed(current, cpumask_of_cpu(to));
+	else if (m->active == SVC_POOL_PERNODE)
+		set_cpus_allowed(current, node_to_cpumask(to));
+	else
+		return 0;
+	return 1;
+}
+
 /*
  * Create an RPC service
  */
-struct svc_serv *
-svc_create(struct svc_program *prog, unsigned int bufsize)
+static struct svc_serv *
+__svc_create(struct svc_program *prog, unsigned int bufsize,
+	     unsigned int npools)
 {
 	struct svc_serv	*serv;
 	int vers;
 	unsigned int xdrsize;
+	unsigned int i;
 
 	if (!(serv = (struct svc_serv *) kmalloc(sizeof(*serv), GFP_KERNEL)))
 		return NULL;
@@ -50,20 +268,57 @@ svc_create(struct svc_program *prog, unsigned int bufsize)
 				xdrsize = prog->pg_vers[vers]->vs_xdrsize;
 		}
 	serv->sv_xdrsize   = xdrsize;
-	INIT_LIST_HEAD(&serv->sv_threads);
-	INIT_LIST_HEAD(&serv->sv_sockets);
 	INIT_LIST_HEAD(&serv->sv_tempsocks);
 	INIT_LIST_HEAD(&serv->sv_permsocks);
 	spin_lock_init(&serv->sv_lock);
 
 	serv->sv_name      = prog->pg_name;
 
+	serv->sv_nrpools = npools;
+	serv->sv_pools = kmalloc(npools * sizeof(struct svc_pool), GFP_KERNEL);
+	if (!serv->sv_pools) {
+		kfree(serv);
+		return NULL;
+	}
+	memset(serv->sv_pools, 0, npools * sizeof(struct svc_pool));
+	for (i = 0; i < npools; i++) {
+		struct svc_pool *pool = &serv->sv_pools[i];
+
+		pool->sp_id = i;
+		INIT_LIST_HEAD(&pool->sp_threads);
+		INIT_LIST_HEAD(&pool->sp_sockets);
+		spin_lock_init(&pool->sp_lock);
+	}
+
 	/* Remove any stale portmap registrations */
 	svc_register(serv, 0, 0);
 
 	return serv;
 }
 
+struct svc_serv *
+svc_create(struct svc_program *prog, unsigned int bufsize)
+{
+	return __svc_create(prog, bufsize, 1);
+}
+
+/*
+ * Create an RPC service whose threads are split into pools according
+ * to the pool map.
+ */
+struct svc_serv *
+svc_create_pooled(struct svc_program *prog, unsigned int bufsize)
+{
+	struct svc_serv *serv;
+	unsigned int npools = svc_pool_map_get();
+
+	serv = __svc_create(prog, bufsize, npools);
+	/* a single pool needs no map, so don't pin the mode for it */
+	if (!serv || npools == 1)
+		svc_pool_map_put();
+	return serv;
+}
+
 /*
  * Destroy an RPC service
  */
@@ -101,6 +356,9 @@ svc_destroy(struct svc_serv *serv)
 
 	/* Unregister service with the portmapper */
 	svc_register(serv, 0, 0);
+	if (serv->sv_nrpools > 1)
+		svc_pool_map_put();
+	kfree(serv->sv_pools);
 	kfree(serv);
 }
 
@@ -149,6 +407,26 @@ svc_release_buffer(struct svc_rqst *rqstp)
 	rqstp->rq_argused = 0;
 }
 
+/*
+ * Pick the pool with the fewest threads for a new one, and count it
+ * there.
+ */
+static struct svc_pool *
+svc_pool_add_thread(struct svc_serv *serv)
+{
+	struct svc_pool *pool = serv->sv_pools;
+	unsigned int i;
+
+	for (i = 1; i < serv->sv_nrpools; i++)
+		if (serv->sv_pools[i].sp_nrthreads < pool->sp_nrthreads)
+			pool = &serv->sv_pools[i];
+
+	spin_lock_bh(&pool->sp_lock);
+	pool->sp_nrthreads++;
+	spin_unlock_bh(&pool->sp_lock);
+	return pool;
+}
+
 /*
  * Create a server thread
  */
@@ -157,6 +435,8 @@ svc_create_thread(svc_thread_fn func, struct svc_serv *serv)
 {
 	struct svc_rqst	*rqstp;
 	int		error = -ENOMEM;
+	cpumask_t	oldmask;
+	int		have_oldmask;
 
 	rqstp = kmalloc(sizeof(*rqstp), GFP_KERNEL);
 	if (!rqstp)
@@ -172,7 +452,14 @@ svc_create_thread(svc_thread_fn func, struct svc_serv *serv)
 
 	serv->sv_nrthreads++;
 	rqstp->rq_server = serv;
+	rqstp->rq_pool = svc_pool_add_thread(serv);
+
+	/* the new thread inherits our cpus, so borrow the pool's */
+	have_oldmask = svc_pool_map_set_cpumask(serv, rqstp->rq_pool->sp_id,
+						&oldmask);
 	error = kernel_thread((int (*)(void *)) func, rqstp, 0);
+	if (have_oldmask)
+		set_cpus_allowed(current, oldmask);
 	if (error < 0)
 		goto out_thread;
 	svc_sock_update_bufs(serv);
@@ -200,6 +487,8 @@ svc_exit_thread(struct svc_rqst *rqstp)
 		kfree(rqstp->rq_argp);
 	if (rqstp->rq_auth_data)
 		kfree(rqstp->rq_auth_data);
+	if (rqstp->rq_pool)
+		svc_sock_pool_del_thread(rqstp->rq_pool, serv);
 	kfree(rqstp);
 
 	/* Release the server */
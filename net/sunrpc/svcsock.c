@@ -45,7 +45,10 @@
 
 /* SMP locking strategy:
  *
- * 	svc_serv->sv_lock protects most stuff for that service.
+ *	svc_pool->sp_lock protects most of the fields of that pool.
+ * 	svc_serv->sv_lock protects sv_tempsocks, sv_permsocks, sv_tmpcnt.
+ *	when both need to be taken (rare), svc_serv->sv_lock is first.
+ *	sk_inuse and sk_reserved are atomic and need no lock.
  *
  *	Some flags can be set to certain values at any time
  *	providing that certain rules are followed:
@@ -74,22 +77,22 @@ static int svc_deferred_recv(struct svc_rqst *rqstp);
 static struct cache_deferred_req *svc_defer(struct cache_req *req);
 
 /*
- * Queue up an idle server thread.  Must have serv->sv_lock held.
+ * Queue up an idle server thread.  Must have pool->sp_lock held.
  * Note: this is really a stack rather than a queue, so that we only
  * use as many different threads as we need, and the rest don't polute
  * the cache.
  */
 static inline void
-svc_serv_enqueue(struct svc_serv *serv, struct svc_rqst *rqstp)
+svc_thread_enqueue(struct svc_pool *pool, struct svc_rqst *rqstp)
 {
-	list_add(&rqstp->rq_list, &serv->sv_threads);
+	list_add(&rqstp->rq_list, &pool->sp_threads);
 }
 
 /*
- * Dequeue an nfsd thread.  Must have serv->sv_lock held.
+ * Dequeue an nfsd thread.  Must have pool->sp_lock held.
  */
 static inline void
-svc_serv_dequeue(struct svc_serv *serv, struct svc_rqst *rqstp)
+svc_thread_dequeue(struct svc_pool *pool, struct svc_rqst *rqstp)
 {
 	list_del(&rqstp->rq_list);
 }
@@ -131,6 +134,34 @@ svc_sock_wspace(struct svc_sock *svsk)
 	return wspace;
 }
 
+/*
+ * Lock and return the pool that should take a socket made ready on
+ * this cpu.  A pool whose last thread has gone is skipped, unless
+ * every pool is empty.
+ */
+static struct svc_pool *
+svc_pool_lock_for_enqueue(struct svc_serv *serv)
+{
+	struct svc_pool *pool;
+
+	pool = svc_pool_for_cpu(serv, get_cpu());
+	put_cpu();
+
+	for (;;) {
+		struct svc_pool *other;
+
+		spin_lock_bh(&pool->sp_lock);
+		if (pool->sp_nrthreads || serv->sv_nrpools <= 1)
+			break;
+		other = svc_pool_for_cpu(serv, smp_processor_id());
+		if (other == pool || !other->sp_nrthreads)
+			break;
+		spin_unlock_bh(&pool->sp_lock);
+		pool = other;
+	}
+	return pool;
+}
+
 /*
  * Queue up a socket with data pending. If there are idle nfsd
  * processes, wake 'em up.
@@ -140,6 +171,7 @@ static void
 svc_sock_enqueue(struct svc_sock *svsk)
 {
 	struct svc_serv	*serv = svsk->sk_server;
+	struct svc_pool *pool;
 	struct svc_rqst	*rqstp;
 
 	if (!(svsk->sk_flags &
@@ -148,10 +180,11 @@ svc_sock_enqueue(struct svc_sock *svsk)
 	if (test_bit(SK_DEAD, &svsk->sk_flags))
 		return;
 
-	spin_lock_bh(&serv->sv_lock);
+	pool = svc_pool_lock_for_enqueue(serv);
+	pool->sp_stats.packets++;
 
-	if (!list_empty(&serv->sv_threads) && 
-	    !list_empty(&serv->sv_sockets))
+	if (!list_empty(&pool->sp_threads) &&
+	    !list_empty(&pool->sp_sockets))
 		printk(KERN_ERR
 			"svc_sock_enqueue: threads and sockets both waiting??\n");
 
@@ -168,13 +201,13 @@ svc_sock_enqueue(struct svc_sock *svsk)
 	}
 
 	set_bit(SOCK_NOSPACE, &svsk->sk_sock->flags);
-	if (((svsk->sk_reserved + serv->sv_bufsz)*2
+	if (((atomic_read(&svsk->sk_reserved) + serv->sv_bufsz)*2
 	     > svc_sock_wspace(svsk))
 	    && !test_bit(SK_CLOSE, &svsk->sk_flags)
 	    && !test_bit(SK_CONN, &svsk->sk_flags)) {
 		/* Don't enqueue while not enough space for reply */
 		dprintk("svc: socket %p  no space, %d*2 > %ld, not enqueued\n",
-			svsk->sk_sk, svsk->sk_reserved+serv->sv_bufsz,
+			svsk->sk_sk, atomic_read(&svsk->sk_reserved)+serv->sv_bufsz,
 			svc_sock_wspace(svsk));
 		goto out_unlock;
 	}
@@ -186,48 +219,50 @@ svc_sock_enqueue(struct svc_sock *svsk)
 	 */
 	set_bit(SK_BUSY, &svsk->sk_flags);
 
-	if (!list_empty(&serv->sv_threads)) {
-		rqstp = list_entry(serv->sv_threads.next,
+	if (!list_empty(&pool->sp_threads)) {
+		rqstp = list_entry(pool->sp_threads.next,
 				   struct svc_rqst,
 				   rq_list);
 		dprintk("svc: socket %p served by daemon %p\n",
 			svsk->sk_sk, rqstp);
-		svc_serv_dequeue(serv, rqstp);
+		svc_thread_dequeue(pool, rqstp);
 		if (rqstp->rq_sock)
 			printk(KERN_ERR 
 				"svc_sock_enqueue: server %p, rq_sock=%p!\n",
 				rqstp, rqstp->rq_sock);
 		rqstp->rq_sock = svsk;
-		svsk->sk_inuse++;
+		atomic_inc(&svsk->sk_inuse);
 		rqstp->rq_reserved = serv->sv_bufsz;
-		svsk->sk_reserved += rqstp->rq_reserved;
+		atomic_add(rqstp->rq_reserved, &svsk->sk_reserved);
+		pool->sp_stats.threads_woken++;
 		wake_up(&rqstp->rq_wait);
 	} else {
 		dprintk("svc: socket %p put into queue\n", svsk->sk_sk);
-		list_add_tail(&svsk->sk_ready, &serv->sv_sockets);
+		list_add_tail(&svsk->sk_ready, &pool->sp_sockets);
+		pool->sp_stats.sockets_queued++;
 	}
 
 out_unlock:
-	spin_unlock_bh(&serv->sv_lock);
+	spin_unlock_bh(&pool->sp_lock);
 }
 
 /*
- * Dequeue the first socket.  Must be called with the serv->sv_lock held.
+ * Dequeue the first socket.  Must be called with the pool->sp_lock held.
  */
 static inline struct svc_sock *
-svc_sock_dequeue(struct svc_serv *serv)
+svc_sock_dequeue(struct svc_pool *pool)
 {
 	struct svc_sock	*svsk;
 
-	if (list_empty(&serv->sv_sockets))
+	if (list_empty(&pool->sp_sockets))
 		return NULL;
 
-	svsk = list_entry(serv->sv_sockets.next,
+	svsk = list_entry(pool->sp_sockets.next,
 			  struct svc_sock, sk_ready);
 	list_del_init(&svsk->sk_ready);
 
 	dprintk("svc: socket %p dequeued, inuse=%d\n",
-		svsk->sk_sk, svsk->sk_inuse);
+		svsk->sk_sk, atomic_read(&svsk->sk_inuse));
 
 	return svsk;
 }
@@ -262,32 +297,26 @@ void svc_reserve(struct svc_rqst *rqstp, int space)
 
 	if (space < rqstp->rq_reserved) {
 		struct svc_sock *svsk = rqstp->rq_sock;
-		spin_lock_bh(&svsk->sk_server->sv_lock);
-		svsk->sk_reserved -= (rqstp->rq_reserved - space);
+		atomic_sub((rqstp->rq_reserved - space), &svsk->sk_reserved);
 		rqstp->rq_reserved = space;
-		spin_unlock_bh(&svsk->sk_server->sv_lock);
 
 		svc_sock_enqueue(svsk);
 	}
 }
 
 /*
- * Release a socket after use.
+ * Release a socket after use.  The socket holds a reference to itself
+ * until svc_delete_socket(), so the last put is always on a dead one.
  */
 static inline void
 svc_sock_put(struct svc_sock *svsk)
 {
-	struct svc_serv *serv = svsk->sk_server;
-
-	spin_lock_bh(&serv->sv_lock);
-	if (!--(svsk->sk_inuse) && test_bit(SK_DEAD, &svsk->sk_flags)) {
-		spin_unlock_bh(&serv->sv_lock);
+	if (atomic_dec_and_test(&svsk->sk_inuse)) {
+		BUG_ON(!test_bit(SK_DEAD, &svsk->sk_flags));
 		dprintk("svc: releasing dead socket\n");
 		sock_release(svsk->sk_sock);
 		kfree(svsk);
 	}
-	else
-		spin_unlock_bh(&serv->sv_lock);
 }
 
 static void
@@ -326,20 +355,52 @@ void
 svc_wake_up(struct svc_serv *serv)
 {
 	struct svc_rqst	*rqstp;
+	unsigned int i;
+	struct svc_pool *pool;
+
+	for (i = 0; i < serv->sv_nrpools; i++) {
+		pool = &serv->sv_pools[i];
+
+		spin_lock_bh(&pool->sp_lock);
+		if (!list_empty(&pool->sp_threads)) {
+			rqstp = list_entry(pool->sp_threads.next,
+					   struct svc_rqst,
+					   rq_list);
+			dprintk("svc: daemon %p woken up.\n", rqstp);
+			/*
+			svc_thread_dequeue(pool, rqstp);
+			rqstp->rq_sock = NULL;
+			 */
+			wake_up(&rqstp->rq_wait);
+			spin_unlock_bh(&pool->sp_lock);
+			return;
+		}
+		spin_unlock_bh(&pool->sp_lock);
+	}
+}
 
-	spin_lock_bh(&serv->sv_lock);
-	if (!list_empty(&serv->sv_threads)) {
-		rqstp = list_entry(serv->sv_threads.next,
-				   struct svc_rqst,
-				   rq_list);
-		dprintk("svc: daemon %p woken up.\n", rqstp);
-		/*
-		svc_serv_dequeue(serv, rqstp);
-		rqstp->rq_sock = NULL;
-		 */
-		wake_up(&rqstp->rq_wait);
+/*
+ * A thread of @pool is going away.  If it was the last one, hand the
+ * sockets still waiting there to the other pools.
+ */
+void
+svc_sock_pool_del_thread(struct svc_pool *pool, struct svc_serv *serv)
+{
+	LIST_HEAD(orphans);
+	struct svc_sock *svsk;
+
+	spin_lock_bh(&pool->sp_lock);
+	pool->sp_nrthreads--;
+	if (!pool->sp_nrthreads && serv->sv_nrpools > 1)
+		list_splice_init(&pool->sp_sockets, &orphans);
+	spin_unlock_bh(&pool->sp_lock);
+
+	while (!list_empty(&orphans)) {
+		svsk = list_entry(orphans.next, struct svc_sock, sk_ready);
+		list_del_init(&svsk->sk_ready);
+		clear_bit(SK_BUSY, &svsk->sk_flags);
+		svc_sock_enqueue(svsk);
 	}
-	spin_unlock_bh(&serv->sv_lock);
 }
 
 /*
@@ -862,7 +923,7 @@ svc_tcp_accept(struct svc_sock *svsk)
 					  struct svc_sock,
 					  sk_list);
 			set_bit(SK_CLOSE, &svsk->sk_flags);
-			svsk->sk_inuse ++;
+			atomic_inc(&svsk->sk_inuse);
 		}
 		spin_unlock_bh(&serv->sv_lock);
 
@@ -1141,6 +1202,7 @@ int
 svc_recv(struct svc_serv *serv, struct svc_rqst *rqstp, long timeout)
 {
 	struct svc_sock		*svsk =NULL;
+	struct svc_pool		*pool = rqstp->rq_pool;
 	int			len;
 	int 			pages;
 	struct xdr_buf		*arg;
@@ -1190,6 +1252,7 @@ svc_recv(struct svc_serv *serv, struct svc_rqst *rqstp, long timeout)
 		return -EINTR;
 
 	spin_lock_bh(&serv->sv_lock);
+	svsk = NULL;
 	if (!list_empty(&serv->sv_tempsocks)) {
 		svsk = list_entry(serv->sv_tempsocks.next,
 				  struct svc_sock, sk_list);
@@ -1206,42 +1269,49 @@ svc_recv(struct svc_serv *serv, struct svc_rqst *rqstp, long timeout)
 		set_bit(SK_BUSY, &svsk->sk_flags);
 		set_bit(SK_CLOSE, &svsk->sk_flags);
 		rqstp->rq_sock = svsk;
-		svsk->sk_inuse++;
-	} else if ((svsk = svc_sock_dequeue(serv)) != NULL) {
-		rqstp->rq_sock = svsk;
-		svsk->sk_inuse++;
-		rqstp->rq_reserved = serv->sv_bufsz;	
-		svsk->sk_reserved += rqstp->rq_reserved;
-	} else {
-		/* No data pending. Go to sleep */
-		svc_serv_enqueue(serv, rqstp);
+		atomic_inc(&svsk->sk_inuse);
+	}
+	spin_unlock_bh(&serv->sv_lock);
 
-		/*
-		 * We have to be able to interrupt this wait
-		 * to bring down the daemons ...
-		 */
-		set_current_state(TASK_INTERRUPTIBLE);
-		add_wait_queue(&rqstp->rq_wait, &wait);
-		spin_unlock_bh(&serv->sv_lock);
+	if (!svsk) {
+		spin_lock_bh(&pool->sp_lock);
+		if ((svsk = svc_sock_dequeue(pool)) != NULL) {
+			rqstp->rq_sock = svsk;
+			atomic_inc(&svsk->sk_inuse);
+			rqstp->rq_reserved = serv->sv_bufsz;
+			atomic_add(rqstp->rq_reserved, &svsk->sk_reserved);
+		} else {
+			/* No data pending. Go to sleep */
+			svc_thread_enqueue(pool, rqstp);
 
-		schedule_timeout(timeout);
+			/*
+			 * We have to be able to interrupt this wait
+			 * to bring down the daemons ...
+			 */
+			set_current_state(TASK_INTERRUPTIBLE);
+			add_wait_queue(&rqstp->rq_wait, &wait);
+			spin_unlock_bh(&pool->sp_lock);
 
-		try_to_freeze(PF_FREEZE);
+			schedule_timeout(timeout);
 
-		spin_lock_bh(&serv->sv_lock);
-		remove_wait_queue(&rqstp->rq_wait, &wait);
+			try_to_freeze(PF_FREEZE);
+
+			spin_lock_bh(&pool->sp_lock);
+			remove_wait_queue(&rqstp->rq_wait, &wait);
 
-		if (!(svsk = rqstp->rq_sock)) {
-			svc_serv_dequeue(serv, rqstp);
-			spin_unlock_bh(&serv->sv_lock);
-			dprintk("svc: server %p, no data yet\n", rqstp);
-			return signalled()? -EINTR : -EAGAIN;
+			if (!(svsk = rqstp->rq_sock)) {
+				svc_thread_dequeue(pool, rqstp);
+				pool->sp_stats.threads_timedout++;
+				spin_unlock_bh(&pool->sp_lock);
+				dprintk("svc: server %p, no data yet\n", rqstp);
+				return signalled()? -EINTR : -EAGAIN;
+			}
 		}
+		spin_unlock_bh(&pool->sp_lock);
 	}
-	spin_unlock_bh(&serv->sv_lock);
 
 	dprintk("svc: server %p, socket %p, inuse=%d\n",
-		 rqstp, svsk, svsk->sk_inuse);
+		 rqstp, svsk, atomic_read(&svsk->sk_inuse));
 	len = svsk->sk_recvfrom(rqstp);
 	dprintk("svc: got len=%d\n", len);
 
@@ -1359,6 +1429,8 @@ svc_setup_socket(struct svc_serv *serv, struct socket *sock,
 	INIT_LIST_HEAD(&svsk->sk_deferred);
 	INIT_LIST_HEAD(&svsk->sk_ready);
 	sema_init(&svsk->sk_sem, 1);
+	/* the socket's own reference, dropped by svc_delete_socket() */
+	atomic_set(&svsk->sk_inuse, 1);
 
 	/* Initialize the socket */
 	if (sock->type == SOCK_DGRAM)
@@ -1455,20 +1527,22 @@ svc_delete_socket(struct svc_sock *svsk)
 	spin_lock_bh(&serv->sv_lock);
 
 	list_del_init(&svsk->sk_list);
-	list_del_init(&svsk->sk_ready);
-	if (!test_and_set_bit(SK_DEAD, &svsk->sk_flags))
-		if (test_bit(SK_TEMP, &svsk->sk_flags))
-			serv->sv_tmpcnt--;
-
-	if (!svsk->sk_inuse) {
-		spin_unlock_bh(&serv->sv_lock);
-		sock_release(svsk->sk_sock);
-		kfree(svsk);
-	} else {
+	/*
+	 * The socket is not taken off the sk_ready list of its pool.  It
+	 * can only be on one while it waits for a thread, and then the
+	 * only caller is svc_destroy(), which frees the pools as well.
+	 */
+	if (test_and_set_bit(SK_DEAD, &svsk->sk_flags)) {
 		spin_unlock_bh(&serv->sv_lock);
-		dprintk(KERN_NOTICE "svc: server socket destroy delayed\n");
-		/* svsk->sk_server = NULL; */
+		return;
 	}
+	if (test_bit(SK_TEMP, &svsk->sk_flags))
+		serv->sv_tmpcnt--;
+	spin_unlock_bh(&serv->sv_lock);
+
+	if (atomic_read(&svsk->sk_inuse) > 1)
+		dprintk(KERN_NOTICE "svc: server socket destroy delayed\n");
+	svc_sock_put(svsk);
 }
 
 /*
@@ -1537,10 +1611,8 @@ svc_defer(struct cache_req *req)
 		dr->argslen = rqstp->rq_arg.len >> 2;
 		memcpy(dr->args, rqstp->rq_arg.head[0].iov_base-skip, dr->argslen<<2);
 	}
-	spin_lock_bh(&rqstp->rq_server->sv_lock);
-	rqstp->rq_sock->sk_inuse++;
+	atomic_inc(&rqstp->rq_sock->sk_inuse);
 	dr->svsk = rqstp->rq_sock;
-	spin_unlock_bh(&rqstp->rq_server->sv_lock);
 
 	dr->handle.revisit = svc_revisit;
 	return &dr->handle;
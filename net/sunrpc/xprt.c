@@ -1314,6 +1314,7 @@ do_xprt_reserve(struct rpc_task *task)
 		struct rpc_rqst	*req = list_entry(xprt->free.next, struct rpc_rqst, rq_list);
 		list_del_init(&req->rq_list);
 		task->tk_rqstp = req;
+		xprt->outstanding++;
 		xprt_request_init(task, xprt);
 		return;
 	}
@@ -1394,6 +1395,7 @@ xprt_release(struct rpc_task *task)
 
 	spin_lock(&xprt->xprt_lock);
 	list_add(&req->rq_list, &xprt->free);
+	xprt->outstanding--;
 	xprt_clear_backlog(xprt);
 	spin_unlock(&xprt->xprt_lock);
 }
@@ -0,0 +1,137 @@
+/*
+ * NET4:	Unix domain socket monitoring, the UNIXDIAG_GETSOCK handler
+ *		of sock_diag.
+ *
+ *		A dump walks unix_socket_table one chain at a time, and
+ *		gives the sockets in the states asked for with their inode,
+ *		their peer's and, when bound, their name.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/init.h>
+#include <linux/socket.h>
+#include <linux/un.h>
+#include <linux/skbuff.h>
+#include <linux/rtnetlink.h>
+#include <linux/unix_diag.h>
+#include <linux/sock_diag.h>
+#include <net/sock.h>
+#include <net/af_unix.h>
+
+static int unixdiag_fill(struct sk_buff *skb, struct sock *sk,
+			 struct netlink_callback *cb)
+{
+	struct unix_sock *u = unix_sk(sk);
+	struct unixdiagmsg *r;
+	struct nlmsghdr *nlh;
+	struct sock *peer;
+	unsigned char *b = skb->tail;
+
+	nlh = NLMSG_PUT(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+			UNIXDIAG_GETSOCK, sizeof(*r));
+	nlh->nlmsg_flags = NLM_F_MULTI;
+	r = NLMSG_DATA(nlh);
+
+	r->udiag_family = AF_UNIX;
+	r->udiag_type = sk->sk_type;
+	r->udiag_state = sk->sk_state;
+	r->udiag_pad = 0;
+	r->udiag_ino = sock_i_ino(sk);
+	r->udiag_rqueue = skb_queue_len(&sk->sk_receive_queue);
+	r->udiag_wqueue = atomic_read(&sk->sk_wmem_alloc);
+	r->udiag_uid = sock_i_uid(sk);
+	r->udiag_cookie[0] = (u32)(unsigned long)sk;
+	r->udiag_cookie[1] = (u32)(((unsigned long)sk >> 31) >> 1);
+
+	unix_state_rlock(sk);
+	peer = u->peer;
+	if (peer)
+		sock_hold(peer);
+	if (u->addr)
+		RTA_PUT(skb, UNIXDIAG_NAME, u->addr->len - sizeof(short),
+			u->addr->name->sun_path);
+	unix_state_runlock(sk);
+
+	r->udiag_peer = 0;
+	if (peer) {
+		r->udiag_peer = sock_i_ino(peer);
+		sock_put(peer);
+	}
+
+	nlh->nlmsg_len = skb->tail - b;
+	return skb->len;
+
+rtattr_failure:
+	unix_state_runlock(sk);
+	if (peer)
+		sock_put(peer);
+nlmsg_failure:
+	skb_trim(skb, b - skb->data);
+	return -1;
+}
+
+static int unixdiag_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct unixdiagreq *r = NLMSG_DATA(cb->nlh);
+	int i, num, s_i, s_num;
+
+	s_i = cb->args[0];
+	s_num = num = cb->args[1];
+
+	for (i = s_i; i <= UNIX_HASH_SIZE; i++) {
+		struct sock *sk;
+		struct hlist_node *node;
+
+		if (i > s_i)
+			s_num = 0;
+
+		read_lock(&unix_table_lock);
+		num = 0;
+		sk_for_each(sk, node, &unix_socket_table[i]) {
+			if (num < s_num)
+				goto next;
+			if (!(r->udiag_states & (1 << sk->sk_state)))
+				goto next;
+			if (unixdiag_fill(skb, sk, cb) < 0) {
+				read_unlock(&unix_table_lock);
+				goto done;
+			}
+next:
+			++num;
+		}
+		read_unlock(&unix_table_lock);
+	}
+
+done:
+	cb->args[0] = i;
+	cb->args[1] = num;
+	return skb->len;
+}
+
+static struct sock_diag_handler unixdiag_handler = {
+	.type		= UNIXDIAG_GETSOCK,
+	.req_size	= sizeof(struct unixdiagreq),
+	.dump		= unixdiag_dump,
+};
+
+static int __init unixdiag_init(void)
+{
+	return sock_diag_register(&unixdiag_handler);
+}
+
+static void __exit unixdiag_exit(void)
+{
+	sock_diag_unregister(&unixdiag_handler);
+}
+
+module_init(unixdiag_init);
+module_exit(unixdiag_exit);
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_SOCK_DIAG(UNIXDIAG_GETSOCK);
@@ -0,0 +1,44 @@
+/*
+ * xfrm_hash.c	Bucket arrays for the state and policy hashes.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+
+#include "xfrm_hash.h"
+
+/* A table of hmask + 1 empty buckets.  Small ones come from kmalloc,
+   the rest whole pages. */
+struct list_head *xfrm_hash_alloc(unsigned int hmask)
+{
+	unsigned int i, sz = (hmask + 1) * sizeof(struct list_head);
+	struct list_head *table;
+
+	if (sz <= PAGE_SIZE)
+		table = kmalloc(sz, GFP_KERNEL);
+	else
+		table = (struct list_head *)
+			__get_free_pages(GFP_KERNEL, get_order(sz));
+	if (!table)
+		return NULL;
+
+	for (i = 0; i <= hmask; i++)
+		INIT_LIST_HEAD(&table[i]);
+	return table;
+}
+
+void xfrm_hash_free(struct list_head *table, unsigned int hmask)
+{
+	unsigned int sz = (hmask + 1) * sizeof(struct list_head);
+
+	if (sz <= PAGE_SIZE)
+		kfree(table);
+	else
+		free_pages((unsigned long)table, get_order(sz));
+}
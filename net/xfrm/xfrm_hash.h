@@ -0,0 +1,12 @@
+#ifndef _XFRM_HASH_H
+#define _XFRM_HASH_H
+
+#include <linux/list.h>
+
+/* Largest table, in buckets, the state and policy hashes grow to */
+#define XFRM_HASH_MAX		(1 << 17)
+
+extern struct list_head *xfrm_hash_alloc(unsigned int hmask);
+extern void xfrm_hash_free(struct list_head *table, unsigned int hmask);
+
+#endif /* _XFRM_HASH_H */
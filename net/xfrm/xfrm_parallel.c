@@ -0,0 +1,191 @@
+/*
+ * xfrm_parallel.c	Spreading the packets of one state across CPUs.
+ *
+ * The per-packet work of a transform with XFRM_STATE_PARALLEL set is
+ * handed to a kernel thread per CPU, round robin, and the packets are
+ * given back to the stack in the order they were submitted, so one
+ * busy SA is not limited to the CPU its traffic arrives on.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/spinlock.h>
+#include <net/xfrm.h>
+
+/* Jobs waiting for one worker, more than this and they are refused */
+#define XFRM_PARALLEL_QLEN	1000
+
+struct xfrm_pworker {
+	spinlock_t		lock;
+	struct list_head	jobs;
+	unsigned int		qlen;
+	struct task_struct	*task;
+};
+
+static struct xfrm_pworker xfrm_pworkers[NR_CPUS];
+static DECLARE_MUTEX(xfrm_pworkers_sem);
+static int xfrm_pworkers_started;
+
+/* Hand finished jobs to their done method in submission order.  Whoever
+   finds the next one due takes care of all that follow it. */
+static void xfrm_parallel_complete(struct xfrm_pjob *job)
+{
+	struct xfrm_parallel *par = job->par;
+	struct list_head *pos;
+
+	spin_lock_bh(&par->lock);
+	list_for_each_prev(pos, &par->reorder) {
+		struct xfrm_pjob *prev = list_entry(pos, struct xfrm_pjob, list);
+
+		if ((s32)(prev->seq - job->seq) < 0)
+			break;
+	}
+	list_add(&job->list, pos);
+
+	if (par->draining)
+		goto out;
+	par->draining = 1;
+	while (!list_empty(&par->reorder)) {
+		job = list_entry(par->reorder.next, struct xfrm_pjob, list);
+		if (job->seq != par->done_seq)
+			break;
+		list_del(&job->list);
+		par->done_seq++;
+
+		/* BHs stay disabled, as done expects */
+		spin_unlock(&par->lock);
+		job->done(job);
+		spin_lock(&par->lock);
+	}
+	par->draining = 0;
+out:
+	spin_unlock_bh(&par->lock);
+}
+
+static int xfrm_parallel_worker(void *arg)
+{
+	struct xfrm_pworker *w = arg;
+	LIST_HEAD(jobs);
+
+	set_user_nice(current, -5);
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock_bh(&w->lock);
+		if (list_empty(&w->jobs)) {
+			spin_unlock_bh(&w->lock);
+			if (kthread_should_stop())
+				break;
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		list_splice_init(&w->jobs, &jobs);
+		w->qlen = 0;
+		spin_unlock_bh(&w->lock);
+
+		while (!list_empty(&jobs)) {
+			struct xfrm_pjob *job;
+
+			job = list_entry(jobs.next, struct xfrm_pjob, list);
+			list_del(&job->list);
+			job->work(job);
+			xfrm_parallel_complete(job);
+		}
+		cond_resched();
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int xfrm_parallel_start(void)
+{
+	int cpu, n = 0, err = 0;
+
+	down(&xfrm_pworkers_sem);
+	if (xfrm_pworkers_started)
+		goto out;
+
+	for_each_online_cpu(cpu) {
+		struct xfrm_pworker *w = &xfrm_pworkers[cpu];
+		struct task_struct *p;
+
+		spin_lock_init(&w->lock);
+		INIT_LIST_HEAD(&w->jobs);
+		p = kthread_create(xfrm_parallel_worker, w, "kxfrmd/%d", cpu);
+		if (IS_ERR(p)) {
+			err = PTR_ERR(p);
+			break;
+		}
+		kthread_bind(p, cpu);
+		w->task = p;
+		wake_up_process(p);
+		n++;
+	}
+	/* Whatever did start is used, so not having them all is fine */
+	if (n)
+		xfrm_pworkers_started = 1;
+out:
+	up(&xfrm_pworkers_sem);
+	return xfrm_pworkers_started ? 0 : err;
+}
+
+int xfrm_parallel_init(struct xfrm_parallel *par)
+{
+	spin_lock_init(&par->lock);
+	INIT_LIST_HEAD(&par->reorder);
+	par->next_seq = par->done_seq = 0;
+	par->cpu = first_cpu(cpu_online_map);
+	par->draining = 0;
+
+	return xfrm_parallel_start();
+}
+EXPORT_SYMBOL(xfrm_parallel_init);
+
+/* Queue job to the next CPU along.  Fails with -ENOBUFS when that one
+   is too far behind; the caller then still owns the job. */
+int xfrm_parallel_submit(struct xfrm_parallel *par, struct xfrm_pjob *job)
+{
+	struct xfrm_pworker *w;
+	int cpu, err = 0;
+
+	spin_lock_bh(&par->lock);
+	cpu = par->cpu;
+	do {
+		cpu = next_cpu(cpu, cpu_online_map);
+		if (cpu >= NR_CPUS)
+			cpu = first_cpu(cpu_online_map);
+	} while (!xfrm_pworkers[cpu].task && cpu != par->cpu);
+	w = &xfrm_pworkers[cpu];
+	if (!w->task) {
+		err = -ENODEV;
+		goto out;
+	}
+	par->cpu = cpu;
+
+	spin_lock(&w->lock);
+	if (w->qlen >= XFRM_PARALLEL_QLEN) {
+		spin_unlock(&w->lock);
+		err = -ENOBUFS;
+		goto out;
+	}
+	job->par = par;
+	job->cpu = cpu;
+	job->seq = par->next_seq++;
+	list_add_tail(&job->list, &w->jobs);
+	w->qlen++;
+	spin_unlock(&w->lock);
+	wake_up_process(w->task);
+out:
+	spin_unlock_bh(&par->lock);
+	return err;
+}
+EXPORT_SYMBOL(xfrm_parallel_submit);
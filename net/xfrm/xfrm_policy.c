@@ -22,9 +22,12 @@
 #include <linux/notifier.h>
 #include <linux/netdevice.h>
 #include <linux/module.h>
+#include <linux/jhash.h>
 #include <net/xfrm.h>
 #include <net/ip.h>
 
+#include "xfrm_hash.h"
+
 DECLARE_MUTEX(xfrm_cfg_sem);
 EXPORT_SYMBOL(xfrm_cfg_sem);
 
@@ -33,6 +36,29 @@ static DEFINE_RWLOCK(xfrm_policy_lock);
 struct xfrm_policy *xfrm_policy_list[XFRM_POLICY_MAX*2];
 EXPORT_SYMBOL(xfrm_policy_list);
 
+/* For lookups the policies of each direction are also kept in zones by
+ * the prefix length of their destination, as fib_hash does routes, and
+ * hashed there by the destination prefix.  A flow is looked for in the
+ * one chain of each zone in use.  Chains are kept sorted by priority
+ * and pos, the order of xfrm_policy_list, so the first match in each is
+ * the best of its zone.  Socket policies are not looked up this way.
+ */
+struct xfrm_pol_zone {
+	struct list_head	list;		/* On xfrm_pol_zones[dir] */
+	struct list_head	*table;
+	unsigned int		hmask;
+	unsigned int		count;
+	unsigned int		plen;
+	struct list_head	small;		/* The table until it grows */
+};
+
+static struct xfrm_pol_zone xfrm_pol_zone[XFRM_POLICY_MAX][129];
+static struct list_head xfrm_pol_zones[XFRM_POLICY_MAX];	/* Longest first */
+static u32 xfrm_policy_pos;
+
+static struct work_struct xfrm_policy_hash_work;
+static DECLARE_MUTEX(xfrm_policy_hash_sem);
+
 static DEFINE_RWLOCK(xfrm_policy_afinfo_lock);
 static struct xfrm_policy_afinfo *xfrm_policy_afinfo[NPROTO];
 
@@ -294,6 +320,140 @@ static void xfrm_policy_gc_task(void *data)
 	}
 }
 
+static inline unsigned int xfrm_pol_zone_plen(unsigned int plen,
+					      unsigned short family)
+{
+	switch (family) {
+	case AF_INET:
+		return min(plen, 32U);
+	case AF_INET6:
+		return min(plen, 128U);
+	}
+	return 0;
+}
+
+/* Hash of the first plen bits of the address at a */
+static inline unsigned int xfrm_pol_hash(const u32 *a, unsigned int plen,
+					 unsigned int hmask)
+{
+	u32 h = 0;
+
+	for (; plen >= 32; plen -= 32)
+		h = jhash_1word(*a++, h);
+	if (plen)
+		h = jhash_1word(*a & htonl(~0U << (32 - plen)), h);
+	return h & hmask;
+}
+
+/* Does a come before b in xfrm_policy_list? */
+static inline int xfrm_policy_before(struct xfrm_policy *a,
+				     struct xfrm_policy *b)
+{
+	if (a->priority != b->priority)
+		return a->priority < b->priority;
+	return (s32)(a->pos - b->pos) < 0;
+}
+
+static inline struct xfrm_pol_zone *xfrm_policy_zone(struct xfrm_policy *pol,
+						     int dir)
+{
+	return &xfrm_pol_zone[dir][xfrm_pol_zone_plen(pol->selector.prefixlen_d,
+						       pol->family)];
+}
+
+static void __xfrm_policy_index(struct xfrm_policy *pol, int dir)
+{
+	struct xfrm_pol_zone *z;
+	struct list_head *head, *pos;
+
+	if (dir >= XFRM_POLICY_MAX)
+		return;
+
+	z = xfrm_policy_zone(pol, dir);
+	if (!z->count++) {
+		list_for_each(pos, &xfrm_pol_zones[dir]) {
+			if (list_entry(pos, struct xfrm_pol_zone, list)->plen
+			    < z->plen)
+				break;
+		}
+		list_add_tail(&z->list, pos);
+	}
+
+	head = z->table + xfrm_pol_hash((u32 *)&pol->selector.daddr,
+					z->plen, z->hmask);
+	list_for_each(pos, head) {
+		if (xfrm_policy_before(pol, list_entry(pos, struct xfrm_policy,
+						       bydst)))
+			break;
+	}
+	list_add_tail(&pol->bydst, pos);
+
+	if (z->count > z->hmask + 1 && z->hmask + 1 < XFRM_HASH_MAX)
+		schedule_work(&xfrm_policy_hash_work);
+}
+
+static void __xfrm_policy_unindex(struct xfrm_policy *pol, int dir)
+{
+	struct xfrm_pol_zone *z;
+
+	if (dir >= XFRM_POLICY_MAX)
+		return;
+
+	z = xfrm_policy_zone(pol, dir);
+	list_del(&pol->bydst);
+	if (!--z->count)
+		list_del(&z->list);
+}
+
+/* Grow the tables of the zones with more policies than buckets.  Each
+   new chain is filled from a single old one, so stays in order. */
+static void xfrm_policy_hash_resize(void *data)
+{
+	struct list_head *ntable, *otable;
+	unsigned int nhmask, ohmask, i;
+	int dir, plen;
+
+	down(&xfrm_policy_hash_sem);
+	for (dir = 0; dir < XFRM_POLICY_MAX; dir++) {
+		for (plen = 0; plen <= 128; plen++) {
+			struct xfrm_pol_zone *z = &xfrm_pol_zone[dir][plen];
+
+			nhmask = z->hmask;
+			while (nhmask + 1 < z->count &&
+			       nhmask + 1 < XFRM_HASH_MAX)
+				nhmask = (nhmask << 1) | 1;
+			if (nhmask == z->hmask)
+				continue;
+			ntable = xfrm_hash_alloc(nhmask);
+			if (!ntable)
+				continue;
+
+			write_lock_bh(&xfrm_policy_lock);
+			otable = z->table;
+			ohmask = z->hmask;
+			for (i = 0; i <= ohmask; i++) {
+				while (!list_empty(otable+i)) {
+					struct xfrm_policy *pol;
+
+					pol = list_entry(otable[i].next,
+							 struct xfrm_policy,
+							 bydst);
+					list_move_tail(&pol->bydst, ntable +
+						xfrm_pol_hash((u32 *)&pol->selector.daddr,
+							      plen, nhmask));
+				}
+			}
+			z->table = ntable;
+			z->hmask = nhmask;
+			write_unlock_bh(&xfrm_policy_lock);
+
+			if (otable != &z->small)
+				xfrm_hash_free(otable, ohmask);
+		}
+	}
+	up(&xfrm_policy_hash_sem);
+}
+
 /* Rule must be locked. Release descentant resources, announce
  * entry dead. The rule must be unlinked from lists to the moment.
  */
@@ -351,6 +511,7 @@ int xfrm_policy_insert(int dir, struct xfrm_policy *policy, int excl)
 				return -EEXIST;
 			}
 			*p = pol->next;
+			__xfrm_policy_unindex(pol, dir);
 			delpol = pol;
 			if (policy->priority > pol->priority)
 				continue;
@@ -369,6 +530,11 @@ int xfrm_policy_insert(int dir, struct xfrm_policy *policy, int excl)
 	xfrm_pol_hold(policy);
 	policy->next = *p;
 	*p = policy;
+	if (delpol && delpol->priority == policy->priority)
+		policy->pos = delpol->pos;
+	else
+		policy->pos = xfrm_policy_pos++;
+	__xfrm_policy_index(policy, dir);
 	atomic_inc(&flow_cache_genid);
 	policy->index = delpol ? delpol->index : xfrm_gen_index(dir);
 	policy->curlft.add_time = (unsigned long)xtime.tv_sec;
@@ -393,8 +559,10 @@ struct xfrm_policy *xfrm_policy_bysel(int dir, struct xfrm_selector *sel,
 	for (p = &xfrm_policy_list[dir]; (pol=*p)!=NULL; p = &pol->next) {
 		if (memcmp(sel, &pol->selector, sizeof(*sel)) == 0) {
 			xfrm_pol_hold(pol);
-			if (delete)
+			if (delete) {
 				*p = pol->next;
+				__xfrm_policy_unindex(pol, dir);
+			}
 			break;
 		}
 	}
@@ -416,8 +584,10 @@ struct xfrm_policy *xfrm_policy_byid(int dir, u32 id, int delete)
 	for (p = &xfrm_policy_list[id & 7]; (pol=*p)!=NULL; p = &pol->next) {
 		if (pol->index == id) {
 			xfrm_pol_hold(pol);
-			if (delete)
+			if (delete) {
 				*p = pol->next;
+				__xfrm_policy_unindex(pol, id & 7);
+			}
 			break;
 		}
 	}
@@ -440,6 +610,7 @@ void xfrm_policy_flush(void)
 	for (dir = 0; dir < XFRM_POLICY_MAX; dir++) {
 		while ((xp = xfrm_policy_list[dir]) != NULL) {
 			xfrm_policy_list[dir] = xp->next;
+			__xfrm_policy_unindex(xp, dir);
 			write_unlock_bh(&xfrm_policy_lock);
 
 			xfrm_policy_kill(xp);
@@ -487,25 +658,54 @@ EXPORT_SYMBOL(xfrm_policy_walk);
 
 /* Find policy to apply to this flow. */
 
-static void xfrm_policy_lookup(struct flowi *fl, u16 family, u8 dir,
-			       void **objp, atomic_t **obj_refp)
+static struct xfrm_policy *__xfrm_policy_lookup(struct flowi *fl, u16 family,
+						u8 dir)
 {
-	struct xfrm_policy *pol;
+	struct xfrm_policy *pol, *best = NULL;
+	struct xfrm_pol_zone *z;
+	unsigned int maxlen;
+	u32 *daddr;
+
+	switch (family) {
+	case AF_INET:
+		daddr = &fl->fl4_dst;
+		maxlen = 32;
+		break;
+	case AF_INET6:
+		daddr = (u32 *)&fl->fl6_dst;
+		maxlen = 128;
+		break;
+	default:
+		return NULL;
+	}
 
-	read_lock_bh(&xfrm_policy_lock);
-	for (pol = xfrm_policy_list[dir]; pol; pol = pol->next) {
-		struct xfrm_selector *sel = &pol->selector;
-		int match;
+	list_for_each_entry(z, &xfrm_pol_zones[dir], list) {
+		struct list_head *head;
 
-		if (pol->family != family)
+		if (z->plen > maxlen)
 			continue;
-
-		match = xfrm_selector_match(sel, fl, family);
-		if (match) {
-			xfrm_pol_hold(pol);
-			break;
+		head = z->table + xfrm_pol_hash(daddr, z->plen, z->hmask);
+		list_for_each_entry(pol, head, bydst) {
+			if (best && !xfrm_policy_before(pol, best))
+				break;
+			if (pol->family == family &&
+			    xfrm_selector_match(&pol->selector, fl, family)) {
+				best = pol;
+				break;
+			}
 		}
 	}
+	return best;
+}
+
+static void xfrm_policy_lookup(struct flowi *fl, u16 family, u8 dir,
+			       void **objp, atomic_t **obj_refp)
+{
+	struct xfrm_policy *pol;
+
+	read_lock_bh(&xfrm_policy_lock);
+	pol = __xfrm_policy_lookup(fl, family, dir);
+	xfrm_pol_hold(pol);
 	read_unlock_bh(&xfrm_policy_lock);
 	if ((*objp = (void *) pol) != NULL)
 		*obj_refp = &pol->refcnt;
@@ -532,6 +732,8 @@ static void __xfrm_policy_link(struct xfrm_policy *pol, int dir)
 {
 	pol->next = xfrm_policy_list[dir];
 	xfrm_policy_list[dir] = pol;
+	pol->pos = xfrm_policy_pos++;
+	__xfrm_policy_index(pol, dir);
 	xfrm_pol_hold(pol);
 }
 
@@ -544,6 +746,7 @@ static struct xfrm_policy *__xfrm_policy_unlink(struct xfrm_policy *pol,
 	     *polp != NULL; polp = &(*polp)->next) {
 		if (*polp == pol) {
 			*polp = pol->next;
+			__xfrm_policy_unindex(pol, dir);
 			return pol;
 		}
 	}
@@ -1342,6 +1545,8 @@ static struct notifier_block xfrm_dev_notifier = {
 
 static void __init xfrm_policy_init(void)
 {
+	int dir, plen;
+
 	xfrm_dst_cache = kmem_cache_create("xfrm_dst_cache",
 					   sizeof(struct xfrm_dst),
 					   0, SLAB_HWCACHE_ALIGN,
@@ -1349,6 +1554,18 @@ static void __init xfrm_policy_init(void)
 	if (!xfrm_dst_cache)
 		panic("XFRM: failed to allocate xfrm_dst_cache\n");
 
+	for (dir = 0; dir < XFRM_POLICY_MAX; dir++) {
+		INIT_LIST_HEAD(&xfrm_pol_zones[dir]);
+		for (plen = 0; plen <= 128; plen++) {
+			struct xfrm_pol_zone *z = &xfrm_pol_zone[dir][plen];
+
+			INIT_LIST_HEAD(&z->small);
+			z->table = &z->small;
+			z->plen = plen;
+		}
+	}
+	INIT_WORK(&xfrm_policy_hash_work, xfrm_policy_hash_resize, NULL);
+
 	INIT_WORK(&xfrm_policy_gc_work, xfrm_policy_gc_task, NULL);
 	register_netdevice_notifier(&xfrm_dev_notifier);
 }
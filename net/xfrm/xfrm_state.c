@@ -20,11 +20,16 @@
 #include <linux/module.h>
 #include <asm/uaccess.h>
 
+#include "xfrm_hash.h"
+
 /* Each xfrm_state may be linked to two tables:
 
    1. Hash table by (spi,daddr,ah/esp) to find SA by SPI. (input,ctl)
    2. Hash table by daddr to find what SAs exist for given
       destination/tunnel endpoint. (output)
+
+   Both start small and are doubled, from keventd, as states are
+   allocated, so that their chains stay about one state long.
  */
 
 static DEFINE_SPINLOCK(xfrm_state_lock);
@@ -35,8 +40,16 @@ static DEFINE_SPINLOCK(xfrm_state_lock);
  * Main use is finding SA after policy selected tunnel or transport mode.
  * Also, it can be used by ah/esp icmp error handler to find offending SA.
  */
-static struct list_head xfrm_state_bydst[XFRM_DST_HSIZE];
-static struct list_head xfrm_state_byspi[XFRM_DST_HSIZE];
+struct list_head *xfrm_state_bydst;
+struct list_head *xfrm_state_byspi;
+unsigned int xfrm_state_hmask;
+EXPORT_SYMBOL(xfrm_state_bydst);
+EXPORT_SYMBOL(xfrm_state_byspi);
+EXPORT_SYMBOL(xfrm_state_hmask);
+
+static atomic_t xfrm_state_num = ATOMIC_INIT(0);
+static struct work_struct xfrm_state_hash_work;
+static DECLARE_MUTEX(xfrm_state_hash_sem);
 
 DECLARE_WAIT_QUEUE_HEAD(km_waitq);
 EXPORT_SYMBOL(km_waitq);
@@ -73,6 +86,7 @@ static void xfrm_state_gc_destroy(struct xfrm_state *x)
 		xfrm_put_type(x->type);
 	}
 	kfree(x);
+	atomic_dec(&xfrm_state_num);
 }
 
 static void xfrm_state_gc_task(void *data)
@@ -92,6 +106,62 @@ static void xfrm_state_gc_task(void *data)
 	wake_up(&km_waitq);
 }
 
+/* Grow both tables to at least a bucket a state.  Entries keep their
+   order, as each new chain is filled from a single old one. */
+static void xfrm_state_hash_resize(void *data)
+{
+	struct list_head *ndst, *nspi, *odst, *ospi;
+	struct xfrm_state *x;
+	unsigned int nhmask, ohmask, i;
+
+	down(&xfrm_state_hash_sem);
+	nhmask = xfrm_state_hmask;
+	while (nhmask + 1 < atomic_read(&xfrm_state_num) &&
+	       nhmask + 1 < XFRM_HASH_MAX)
+		nhmask = (nhmask << 1) | 1;
+	if (nhmask == xfrm_state_hmask)
+		goto out;
+
+	ndst = xfrm_hash_alloc(nhmask);
+	nspi = xfrm_hash_alloc(nhmask);
+	if (!ndst || !nspi) {
+		if (ndst)
+			xfrm_hash_free(ndst, nhmask);
+		if (nspi)
+			xfrm_hash_free(nspi, nhmask);
+		goto out;
+	}
+
+	spin_lock_bh(&xfrm_state_lock);
+	odst = xfrm_state_bydst;
+	ospi = xfrm_state_byspi;
+	ohmask = xfrm_state_hmask;
+	xfrm_state_hmask = nhmask;
+	for (i = 0; i <= ohmask; i++) {
+		while (!list_empty(odst+i)) {
+			x = list_entry(odst[i].next, struct xfrm_state, bydst);
+			list_move_tail(&x->bydst, ndst +
+				       xfrm_dst_hash(&x->id.daddr,
+						     x->props.family));
+		}
+		while (!list_empty(ospi+i)) {
+			x = list_entry(ospi[i].next, struct xfrm_state, byspi);
+			list_move_tail(&x->byspi, nspi +
+				       xfrm_spi_hash(&x->id.daddr, x->id.spi,
+						     x->id.proto,
+						     x->props.family));
+		}
+	}
+	xfrm_state_bydst = ndst;
+	xfrm_state_byspi = nspi;
+	spin_unlock_bh(&xfrm_state_lock);
+
+	xfrm_hash_free(odst, ohmask);
+	xfrm_hash_free(ospi, ohmask);
+out:
+	up(&xfrm_state_hash_sem);
+}
+
 static inline unsigned long make_jiffies(long secs)
 {
 	if (secs >= (MAX_SCHEDULE_TIMEOUT-1)/HZ)
@@ -192,6 +262,10 @@ struct xfrm_state *xfrm_state_alloc(void)
 		x->lft.hard_byte_limit = XFRM_INF;
 		x->lft.hard_packet_limit = XFRM_INF;
 		spin_lock_init(&x->lock);
+
+		if (atomic_inc_return(&xfrm_state_num) > xfrm_state_hmask + 1 &&
+		    xfrm_state_hmask + 1 < XFRM_HASH_MAX)
+			schedule_work(&xfrm_state_hash_work);
 	}
 	return x;
 }
@@ -253,7 +327,7 @@ void xfrm_state_flush(u8 proto)
 	struct xfrm_state *x;
 
 	spin_lock_bh(&xfrm_state_lock);
-	for (i = 0; i < XFRM_DST_HSIZE; i++) {
+	for (i = 0; i <= xfrm_state_hmask; i++) {
 restart:
 		list_for_each_entry(x, xfrm_state_bydst+i, bydst) {
 			if (!xfrm_state_kern(x) &&
@@ -607,7 +681,7 @@ static struct xfrm_state *__xfrm_find_acq_byseq(u32 seq)
 	int i;
 	struct xfrm_state *x;
 
-	for (i = 0; i < XFRM_DST_HSIZE; i++) {
+	for (i = 0; i <= xfrm_state_hmask; i++) {
 		list_for_each_entry(x, xfrm_state_bydst+i, bydst) {
 			if (x->km.seq == seq && x->km.state == XFRM_STATE_ACQ) {
 				xfrm_state_hold(x);
@@ -692,7 +766,7 @@ int xfrm_state_walk(u8 proto, int (*func)(struct xfrm_state *, int, void*),
 	int err = 0;
 
 	spin_lock_bh(&xfrm_state_lock);
-	for (i = 0; i < XFRM_DST_HSIZE; i++) {
+	for (i = 0; i <= xfrm_state_hmask; i++) {
 		list_for_each_entry(x, xfrm_state_bydst+i, bydst) {
 			if (proto == IPSEC_PROTO_ANY || x->id.proto == proto)
 				count++;
@@ -703,7 +777,7 @@ int xfrm_state_walk(u8 proto, int (*func)(struct xfrm_state *, int, void*),
 		goto out;
 	}
 
-	for (i = 0; i < XFRM_DST_HSIZE; i++) {
+	for (i = 0; i <= xfrm_state_hmask; i++) {
 		list_for_each_entry(x, xfrm_state_bydst+i, bydst) {
 			if (proto != IPSEC_PROTO_ANY && x->id.proto != proto)
 				continue;
@@ -900,8 +974,6 @@ int xfrm_state_register_afinfo(struct xfrm_state_afinfo *afinfo)
 	if (unlikely(xfrm_state_afinfo[afinfo->family] != NULL))
 		err = -ENOBUFS;
 	else {
-		afinfo->state_bydst = xfrm_state_bydst;
-		afinfo->state_byspi = xfrm_state_byspi;
 		xfrm_state_afinfo[afinfo->family] = afinfo;
 	}
 	write_unlock(&xfrm_state_afinfo_lock);
@@ -922,8 +994,6 @@ int xfrm_state_unregister_afinfo(struct xfrm_state_afinfo *afinfo)
 			err = -EINVAL;
 		else {
 			xfrm_state_afinfo[afinfo->family] = NULL;
-			afinfo->state_byspi = NULL;
-			afinfo->state_bydst = NULL;
 		}
 	}
 	write_unlock(&xfrm_state_afinfo_lock);
@@ -998,12 +1068,13 @@ EXPORT_SYMBOL(xfrm_state_mtu);
  
 void __init xfrm_state_init(void)
 {
-	int i;
+	xfrm_state_hmask = 7;
+	xfrm_state_bydst = xfrm_hash_alloc(xfrm_state_hmask);
+	xfrm_state_byspi = xfrm_hash_alloc(xfrm_state_hmask);
+	if (!xfrm_state_bydst || !xfrm_state_byspi)
+		panic("XFRM: failed to allocate state hashes\n");
 
-	for (i=0; i<XFRM_DST_HSIZE; i++) {
-		INIT_LIST_HEAD(&xfrm_state_bydst[i]);
-		INIT_LIST_HEAD(&xfrm_state_byspi[i]);
-	}
+	INIT_WORK(&xfrm_state_hash_work, xfrm_state_hash_resize, NULL);
 	INIT_WORK(&xfrm_state_gc_work, xfrm_state_gc_task, NULL);
 }
 
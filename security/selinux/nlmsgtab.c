@@ -17,6 +17,7 @@
 #include <linux/if.h>
 #include <linux/netfilter_ipv4/ip_queue.h>
 #include <linux/tcp_diag.h>
+#include <linux/unix_diag.h>
 #include <linux/xfrm.h>
 #include <linux/audit.h>
 
@@ -74,6 +75,9 @@ static struct nlmsg_perm nlmsg_firewall_perms[] =
 static struct nlmsg_perm nlmsg_tcpdiag_perms[] =
 {
 	{ TCPDIAG_GETSOCK,	NETLINK_TCPDIAG_SOCKET__NLMSG_READ },
+	{ UDPDIAG_GETSOCK,	NETLINK_TCPDIAG_SOCKET__NLMSG_READ },
+	{ RAWDIAG_GETSOCK,	NETLINK_TCPDIAG_SOCKET__NLMSG_READ },
+	{ UNIXDIAG_GETSOCK,	NETLINK_TCPDIAG_SOCKET__NLMSG_READ },
 };
 
 static struct nlmsg_perm nlmsg_xfrm_perms[] =
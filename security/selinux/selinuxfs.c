@@ -902,6 +902,7 @@ static void sel_remove_bools(struct dentry *de)
 {
 	struct list_head *p, *node;
 	struct super_block *sb = de->d_sb;
+	int cpu;
 
 	spin_lock(&dcache_lock);
 	node = de->d_subdirs.next;
@@ -922,17 +923,19 @@ static void sel_remove_bools(struct dentry *de)
 
 	spin_unlock(&dcache_lock);
 
-	file_list_lock();
-	list_for_each(p, &sb->s_files) {
-		struct file * filp = list_entry(p, struct file, f_list);
-		struct dentry * dentry = filp->f_dentry;
+	for_each_cpu(cpu) {
+		file_sb_list_lock(cpu);
+		list_for_each(p, sb_files(sb, cpu)) {
+			struct file * filp = list_entry(p, struct file, f_list);
+			struct dentry * dentry = filp->f_dentry;
 
-		if (dentry->d_parent != de) {
-			continue;
+			if (dentry->d_parent != de) {
+				continue;
+			}
+			filp->f_op = NULL;
 		}
-		filp->f_op = NULL;
+		file_sb_list_unlock(cpu);
 	}
-	file_list_unlock();
 }
 
 #define BOOL_DIR_NAME "booleans"